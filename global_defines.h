@@ -10,11 +10,16 @@
 
 // G_ prefixed HTTP parser defaults (from libs/HTTPParser.h)
 #define G_HTTP_VERSION "HTTP/1.1" // From libs/HTTPParser.h
-#define G_CLOSE_CONNECTIONS 1 // From libs/HTTPParser.h
-#define G_MAX_URL_LEN 256 // From libs/HTTPParser.h
+#define G_CLOSE_CONNECTIONS 0 // From libs/HTTPParser.h
+// Room for a /getweatherbatch of Weather_BATCH_MAX_LOCATIONS coordinates, URLs are views into the read buffer
+#define G_MAX_URL_LEN 2048 // From libs/HTTPParser.h
+#define G_MAX_HEADERS 32 // From include/HTTPParser.h
+#define G_MAX_QUERY_PARAMETERS 16 // From include/HTTPParser.h
+#define G_RESPONSE_BLOCK_CACHE 32 // From include/HTTPParser.h
+#define G_RESPONSE_BLOCK_SIZE 384 // From include/HTTPParser.h
 #define G_STRICT_VALIDATION 1 // From libs/HTTPParser.h
 #define G_CORS_ALLOWED_ORIGIN "*" // From libs/HTTPParser.h
-#define G_CORS_ALLOWED_METHODS "GET, OPTIONS" // From libs/HTTPParser.h
+#define G_CORS_ALLOWED_METHODS "GET, HEAD, OPTIONS" // From libs/HTTPParser.h
 #define G_CORS_ALLOWED_HEADERS "" // From libs/HTTPParser.h
 
 #ifndef GLOBAL_DEFINES_H
@@ -22,38 +27,368 @@
 
 // TCPServer limits
 #define TCPServer_MAX_CLIENTS 10 // From libs/TCPServer.h
-#define TCPServer_MAX_CONNECTIONS_PER_WINDOW 10 // From libs/TCPServer.h
-#define TCPServer_MAX_CONNECTIONS_WINDOW_SECONDS 10 // From libs/TCPServer.h
+#define TCPServer_ACCEPT_BUDGET 32 // From src/connection.c
+// Listen socket tuning (conn_listen_options_default), accepted sockets inherit it
+#define TCPServer_LISTEN_BACKLOG 1024 // From src/connection.c
+#define TCPServer_TCP_NODELAY 1 // From src/connection.c
+#define TCPServer_DEFER_ACCEPT_SECONDS 1 // From src/connection.c
+#define TCPServer_FASTOPEN_QUEUE 256 // From src/connection.c
+// Lossy mobile links: BBR does not take every lost packet for congestion, and
+// at most NOTSENT_LOWAT bytes wait unsent in a client's socket (0 = off)
+#define TCPServer_CONGESTION "bbr" // From src/connection.c
+#define TCPServer_NOTSENT_LOWAT 16384 // From src/connection.c
+#define TCPServer_SOCKET_RCVBUF 0 // From src/connection.c
+#define TCPServer_SOCKET_SNDBUF 0 // From src/connection.c
+#define TCPServer_KEEPALIVE 0 // From src/connection.c
+#define TCPServer_KEEPALIVE_IDLE_SECONDS 0 // From src/connection.c
+#define TCPServer_KEEPALIVE_INTERVAL_SECONDS 0 // From src/connection.c
+#define TCPServer_KEEPALIVE_COUNT 0 // From src/connection.c
+// Accept admission: token bucket per client address, plus a global ceiling
+#define TCPServer_CLIENT_RATE_PER_SECOND 10 // From src/connection.c
+#define TCPServer_CLIENT_BURST 20 // From src/connection.c
+#define TCPServer_GLOBAL_RATE_PER_SECOND 1000 // From src/connection.c
+#define TCPServer_GLOBAL_BURST 2000 // From src/connection.c
+// Seconds a client over its accept bucket is dropped by the XDP program (--xdp-ban)
+#define IP_BAN_SECONDS 10 // From include/utilities/ip_ban.h
+// Live connections per listener and worker before new ones get a 503 (TLS: a reset), 0 = no cap
+#define TCPServer_MAX_CONNECTIONS 4096 // From src/connection.c
+// unix:PATH listener (main.c), file mode of PATH and the one peer uid (SO_PEERCRED) besides ours let in, -1 = any
+#define TCPServer_UNIX_SOCKET_MODE 0660 // From src/connection.c
+#define TCPServer_UNIX_PEER_UID -1 // From src/connection.c
+// Listen sockets a prefork worker process takes over from the master, one per port
+#define CONN_LISTEN_MAX_INHERITED 4 // From src/connection.c
+// Responses of a loop per TCP_INFO sample of the socket one went out on, 0 samples none
+#define CONN_TCP_INFO_SAMPLE_EVERY 8 // From src/connection.c
+// Plain TCP bodies held by reference (cached blobs, snapshots) this large go out with MSG_ZEROCOPY,
+// the kernel reads them from our memory; a connection closed before it is done keeps its socket up to
+// LINGER_MS, looked at every REAP_MS, and is reset past that
+#define TCP_ZEROCOPY_ENABLED 1 // From src/connection.c
+#define TCP_ZEROCOPY_MIN_BYTES (16 << 10) // From src/HTTPServer/HTTPServerConnection.c
+#define TCP_ZEROCOPY_LINGER_MS 5000 // From src/connection.c
+#define TCP_ZEROCOPY_REAP_MS 10 // From src/connection.c
+#define RATE_LIMITER_TABLE_SIZE 1024 // From include/utilities/rate_limiter.h
+// Route table lookup, seeds tried per table size before the table grows
+#define PERFECT_HASH_MAX_KEYS 32 // From include/utilities/perfect_hash.h
+#define PERFECT_HASH_MAX_SEEDS 4096 // From include/utilities/perfect_hash.h
+// Concurrent upstream fetches of one URL share a transfer, per worker loop
+#define SINGLE_FLIGHT_BUCKETS 64 // From include/utilities/single_flight.h
 
 // HTTP server connection buffers/timeouts
-#define HTTPServerConnection_READBUFFER_SIZE 4096 // From libs/HTTPServer/HTTPServerConnection.h
+// Request heads are read into a small buffer inside the connection, one that outgrows it
+// moves to a pooled buffer of READBUFFER_SIZE, the largest head accepted (431 beyond)
+#define HTTPServerConnection_READ_INLINE_SIZE 1024 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_READBUFFER_SIZE 16384 // From libs/HTTPServer/HTTPServerConnection.h
 #define HTTPServerConnection_WRITEBUFFER_SIZE 4096 // From libs/HTTPServer/HTTPServerConnection.h
-#define HTTPServerConnection_HTTPSERVER_TIMEOUT_MS 1000 // From libs/HTTPServer/HTTPServerConnection.h
+// Per phase deadlines: a request head has HEADER_TIMEOUT_MS to arrive, the handler
+// HANDLER_TIMEOUT_MS to produce the response (then 504), enough for a curl fetch to finish
+#define HTTPServerConnection_HEADER_TIMEOUT_MS 1000 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_HANDLER_TIMEOUT_MS 12000 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_HANDSHAKE_TIMEOUT_MS 500 // From include/HTTPServer/HTTPServerConnection.h
+// A client's own, shorter handler deadline, ms from when the request came
+#define HTTPServerConnection_DEADLINE_HEADER "X-Request-Deadline-Ms" // From include/HTTPServer/HTTPServerConnection.h
+// Once a response is being sent, how long the socket may take no bytes at all
+#define HTTPServerConnection_WRITE_TIMEOUT_MS 10000 // From include/HTTPServer/HTTPServerConnection.h
+// Persistent connections: idle time between requests, requests served per connection
+// and pipelined requests queued ahead of their responses
+#define HTTPServerConnection_KEEPALIVE_TIMEOUT_MS 5000 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_KEEPALIVE_MAX_REQUESTS 100 // From include/HTTPServer/HTTPServerConnection.h
+// Responses over BULK_BYTES (or streamed) are sent after the small ones, a quantum per turn
+// and about PASS_BYTES of them per loop pass
+#define HTTPServerConnection_BULK_BYTES (64 * 1024) // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_BULK_QUANTUM (64 * 1024) // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_BULK_PASS_BYTES (512 * 1024) // From include/HTTPServer/HTTPServerConnection.h
+// Slow clients: a head arriving or a response leaving below this many bytes/s on
+// average is dropped once past the grace period, 0 = no floor
+#define HTTPServerConnection_MIN_RATE_BYTES_PER_SECOND 256 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_MIN_RATE_GRACE_MS 1000 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_PIPELINE_DEPTH 8 // From include/HTTPServer/HTTPServerConnection.h
+// Response heads and small bodies are built into the request itself, larger bodies go in the
+// connection's arena (one block kept per busy connection, bigger responses get a block of their own)
+#define HTTPServerConnection_RESPONSE_INLINE_SIZE 640 // From include/HTTPServer/HTTPServerConnection.h
+#define HTTPServerConnection_ARENA_BLOCK_SIZE 16384 // From include/HTTPServer/HTTPServerConnection.h
+// Streamed bodies (SendResponse_Stream) are pulled and sent this many bytes at a time
+#define HTTPServerConnection_STREAM_CHUNK_SIZE 8192 // From include/HTTPServer/HTTPServerConnection.h
+// Room per request for headers handlers add (validators, Content-Encoding, Vary, Server-Timing,
+// Cache-Control, Age and Surrogate-Key)
+#define HTTPServerConnection_EXTRA_HEADERS_SIZE 512 // From include/HTTPServer/HTTPServerConnection.h
+// HTTP/2 over TLS: streams a connection may have open at once, and over its life before a
+// GOAWAY (what its arena holds only shrinks once nothing is open), frames buffered to send
+#define HTTP2Connection_MAX_CONCURRENT_STREAMS 100 // From include/HTTPServer/HTTP2Connection.h
+#define HTTP2Connection_MAX_STREAMS 1000 // From include/HTTPServer/HTTP2Connection.h
+#define HTTP2Connection_OUTPUT_SIZE 16384 // From include/HTTPServer/HTTP2Connection.h
+// Longest header name and value together once Huffman decoded
+#define HPACK_STRING_MAX 8192 // From include/utilities/hpack.h
 
-// smw task limits
-#define smw_max_tasks 16 // From libs/smw.h
+// smw task table (grows by one slab at a time, no fixed task limit)
+#define smw_task_slab_size 64 // From include/smw.h
+// Closed connections and instances each loop keeps for reuse, per type
+#define OBJECT_POOL_MAX_FREE 256 // From include/utilities/object_pool.h
 
 // Surprise backend files
 #define Surprise_IMAGE_NAME "surprise.png" // From libs/backends/surprise/surprise.c
 #define Surprise_FOLDER "./resources/surprise/" // From libs/backends/surprise/surprise.c
+// Seconds a surprise file asked for by name may be cached (a literal, it goes into Cache-Control)
+#define Surprise_MAX_AGE 86400 // From include/backends/surprise.h
+#define Surprise_VARIANTS_FOLDER Surprise_FOLDER "variants/" // From include/backends/surprise.h
+#define Surprise_SMALL_SIZE 160 // From include/backends/surprise.h
+// The watcher rebuilds the cities and surprise snapshots once a folder was quiet this long
+#define WATCHER_DEBOUNCE_MS 250 // From include/watcher.h
 
 // Cache directories used by backends
 #define Cities_CACHE_DIR "cache/cities" // From libs/backends/cities/cities.c
+// All cities in one file, rewritten (tmp file and rename) only when one was added
+#define Cities_STORE_PATH Cities_CACHE_DIR "/cities.json" // From include/backends/cities.h
 #define Weather_CACHE_DIR "cache/weather" // From libs/backends/weather/weather.c
+// One log structured file holds every location, mapped up to its capacity
+#define Weather_STORE_PATH Weather_CACHE_DIR "/weather.store" // From include/backends/weather.h
+#define Weather_STORE_CAPACITY (64 << 20) // From include/backends/weather.h
+// Bytes of stored values past which the least asked for locations are removed
+// from the store, 0 leaves only the TTL based compaction
+#define Weather_STORE_BUDGET_BYTES (32 << 20) // From include/backends/weather.h
+// Logs smaller than this are never compacted
+#define RECORD_STORE_MIN_COMPACT_BYTES (1 << 20) // From include/utilities/record_store.h
+// Locations are snapped to the centre of a grid cell of this size (degrees)
+// and share one cache entry, well below the upstream model resolution
+#define Weather_GRID_DEGREES 0.05 // From include/backends/weather.h
+// Initial buffer of the client weather JSON, the series grow it
+#define Weather_JSON_INITIAL_SIZE 2048 // From include/backends/weather.h
+// Longest unit string kept from a response (NUL included), longer ones read as the default
+#define Weather_UNIT_MAX_LENGTH 64 // From include/backends/weather.h
+// A cell without a fresh forecast takes the nearest fresh one within this
+// distance (km), 0 turns the lookup off
+#define Weather_NEAREST_KM 0 // From include/backends/weather.h
+// Forecast API base (ending in /), ./server --upstream= overrides it at runtime
+#define METEO_API_URL "https://api.open-meteo.com/v1/" // From include/backends/weather.h
+// Days of hourly and daily forecast asked for with every location
+#define Weather_FORECAST_DAYS 7 // From include/backends/weather.h
+// Age at which a cached forecast is fetched again, the default of the live knob
+// weather_ttl_seconds (see include/utilities/tuning.h)
+#define Weather_CACHE_TTL_SECONDS 900 // From include/backends/weather.h
+// Past the TTL a forecast is still served this long while it is refreshed in the background
+#define Weather_STALE_WHILE_REVALIDATE_SECONDS 300 // From include/backends/weather.h
+// and this long (from the TTL) in place of an error when the upstream fetch fails
+#define Weather_STALE_IF_ERROR_SECONDS 3600 // From include/backends/weather.h
+// Surrogate key of a location's forecasts, weather/LAT,LON
+#define Weather_SURROGATE_KEY_SIZE 48 // From include/backends/weather.h
+// Background refreshes in flight per loop, further ones wait for the next stale hit
+#define Weather_REFRESH_MAX_INFLIGHT 8 // From include/backends/weather.h
+#define Weather_REFRESH_POLL_MS 1 // From include/backends/weather.h
+// A forecast expires when the model step after the one it was fetched in is
+// published: the step (the interval upstream reports) plus this lag, which
+// grows if upstream turns out slower; never past the TTL plus the lag
+#define Weather_MODEL_INTERVAL_SECONDS 900 // From include/backends/weather.h
+#define Weather_PUBLICATION_LAG_SECONDS 180 // From include/backends/weather.h
+// Hot entries (read this often per sweep, decayed by half each sweep) are
+// fetched again this long plus up to the jitter before they expire
+#define Weather_REFRESH_SWEEP_MS 10000 // From include/backends/weather.h
+#define Weather_REFRESH_HOT_HITS 4 // From include/backends/weather.h
+#define Weather_REFRESH_LEAD_SECONDS 60 // From include/backends/weather.h
+#define Weather_REFRESH_JITTER_SECONDS 60 // From include/backends/weather.h
+// Upstream requests speculative forecast fetches leave to clients
+#define Weather_PREFETCH_BUDGET_RESERVE 30 // From include/backends/weather.h
+// Top search results whose forecasts are fetched ahead of the client (0 turns it off)
+#define Geolocation_PREFETCH_WEATHER 1 // From include/backends/geolocation.h
+// Forecasts each loop keeps in memory in front of the disk cache, ready to send
+#define Weather_HOT_CACHE_ENTRIES 256 // From include/backends/weather.h
+// and the bytes of bodies they may hold together, 0 for no byte bound
+#define Weather_HOT_CACHE_BYTES (4 << 20) // From include/backends/weather.h
+// Locations per loop whose previous version is kept for delta polls (?since=), 0 for none
+#define Weather_DELTA_ENTRIES 128 // From include/backends/weather.h
+// Width of the access frequency sketch both cache tiers evict by, about the
+// number of distinct locations it tells apart
+#define Weather_SKETCH_WIDTH 4096 // From include/backends/weather.h
+#define Weather_HEAVY_HITTERS_WIDTH 4096 // From include/backends/weather.h
+// Bodies projected to a ?fields= set each loop keeps, and the bytes they may hold
+#define Weather_PROJECTION_CACHE_ENTRIES 256 // From include/backends/weather.h
+#define Weather_PROJECTION_CACHE_BYTES (1 << 20) // From include/backends/weather.h
+// A location's hot entry lives on the loop owning its key, the others keep a replica once it is this
+// popular (sketch estimate 0 - 15, 0 never)
+#define Weather_SHARD_REPLICATE_HITS 8 // From include/backends/weather.h
+
+// Geocoding results by normalized query, in memory per loop and in one store file
+// Geocoding API base (ending in /), ./server --upstream= overrides it at runtime
+#define METEO_GEOLOCATION_API_URL "https://geocoding-api.open-meteo.com/v1/" // From include/backends/geolocation.h
+#define Geolocation_CACHE_DIR "cache/geolocation" // From include/backends/geolocation.h
+#define Geolocation_STORE_PATH Geolocation_CACHE_DIR "/geolocation.store" // From include/backends/geolocation.h
+#define Geolocation_STORE_CAPACITY (16 << 20) // From include/backends/geolocation.h
+// Places do not move, searches without results ([]) are asked again sooner
+#define Geolocation_CACHE_TTL_SECONDS (30 * 24 * 3600) // From include/backends/geolocation.h
+#define Geolocation_NEGATIVE_TTL_SECONDS (24 * 3600) // From include/backends/geolocation.h
+#define Geolocation_HOT_CACHE_ENTRIES 256 // From include/backends/geolocation.h
+#define Geolocation_HOT_CACHE_BYTES (2 << 20) // From include/backends/geolocation.h
+// --prefork: buckets of the shared memory table search results go to, and the largest value one holds
+#define Geolocation_SHARED_ENTRIES 4096 // From include/backends/geolocation.h
+#define Geolocation_SHARED_VALUE_SIZE (8 << 10) // From include/backends/geolocation.h
+#define Geolocation_HEAVY_HITTERS_WIDTH 4096 // From include/backends/geolocation.h
+// Type-ahead prefix index over every place seen (and an optional GeoNames dump)
+#define Geolocation_INDEX_MAX_ENTRIES 500000 // From include/backends/geolocation_index.h
+#define Geolocation_INDEX_MAX_RESULTS 100 // From include/backends/geolocation_index.h
+// Misspelled searches answered from the dump's names: edits, share of the letters, names checked
+#define Geolocation_FUZZY_MAX_EDITS 2 // From include/backends/geolocation_index.h
+#define Geolocation_FUZZY_MIN_CONFIDENCE 80 // From include/backends/geolocation_index.h
+#define Geolocation_FUZZY_MAX_CANDIDATES 65536 // From include/backends/geolocation_index.h
+// Trigram posting lists (hashed into) and the letters of a name they look at
+#define TRIGRAM_INDEX_BUCKETS (1 << 18) // From include/utilities/trigram_index.h
+#define TRIGRAM_INDEX_MAX_LENGTH 64 // From include/utilities/trigram_index.h
+// Reverse lookups, places added since the 3-d tree was built before it is rebuilt
+#define Geolocation_NEAREST_PENDING_MAX 256 // From include/backends/geolocation_nearest.h
+// /GetLocationBatch: names per request, searches of one running at once
+#define Geolocation_BATCH_MAX_NAMES 64 // From include/backends/geolocation_batch.h
+#define Geolocation_BATCH_PARALLEL 8 // From include/backends/geolocation_batch.h
+
+// Locations one /getweatherbatch request may ask for
+#define Weather_BATCH_MAX_LOCATIONS 64 // From include/backends/weather_batch.h
+// Cities the /getcitiesweather bundle holds, the first ones of a longer registry
+#define CitiesWeather_MAX_CITIES 64 // From include/backends/cities_weather.h
+// Local observation history behind /GetWeatherHistory: days kept (and the
+// longest range asked), observations a location's day holds
+#define Weather_ARCHIVE_PATH Weather_CACHE_DIR "/archive.store" // From include/backends/weather_archive.h
+#define Weather_ARCHIVE_CAPACITY (64 << 20) // From include/backends/weather_archive.h
+#define Weather_ARCHIVE_RETAIN_DAYS 31 // From include/backends/weather_archive.h
+#define Weather_ARCHIVE_DAY_SAMPLES 288 // From include/backends/weather_archive.h
+// JSON nested deeper than this is not transcoded to CBOR (Accept: application/cbor)
+#define CBOR_MAX_DEPTH 64 // From include/utilities/cbor.h
 
 // Defaults used by WeatherServerInstance for geolocation searches
 #define WeatherServerInstance_DEFAULT_LOCATION_COUNT 5 // From WeatherServerInstance.c
+// Scratch memory of one request, reset once its response is sent
+#define WeatherServerInstance_REQUEST_ARENA_SIZE 4096 // From include/WeatherServerInstance.h
+// A /subscribeweather stream with no forecast to send gets a comment this often, well
+// under HTTPServerConnection_HANDLER_TIMEOUT_MS (a stream quiet that long is closed)
+#define WeatherServerInstance_SSE_HEARTBEAT_MS 5000 // From include/WeatherServerInstance.h
+// Load shedding: past a standing queue delay above the target for the interval, the
+// cache misses that waited longer are answered 503 with this Retry-After
+#define ADMISSION_TARGET_MS 5 // From include/utilities/admission.h
+#define ADMISSION_INTERVAL_MS 100 // From include/utilities/admission.h
+#define WeatherServerInstance_RETRY_AFTER_S 1 // From include/WeatherServerInstance.h
+// Cost quota of a client address on each loop, in tokens of one cheap request (0 a second
+// turns it off): a fetch upstream costs FETCH_COST more, every BYTES_PER_TOKEN sent one
+// more, and a client in debt gets 429 for its cache misses until the refill covers it
+#define WeatherServerInstance_QUOTA_TOKENS_PER_SECOND 100 // From include/WeatherServerInstance.h
+#define WeatherServerInstance_QUOTA_BURST 1000 // From include/WeatherServerInstance.h
+#define WeatherServerInstance_QUOTA_FETCH_COST 20 // From include/WeatherServerInstance.h
+#define WeatherServerInstance_QUOTA_BYTES_PER_TOKEN (64 << 10) // From include/WeatherServerInstance.h
+// Micro-cache of final 200 bodies on each loop, for the routes whose descriptor asks for
+// it (the ones without a cache of their own), keyed on the normalized target
+#define WeatherServerInstance_MICRO_CACHE_ENTRIES 1024 // From include/WeatherServerInstance.h
+#define WeatherServerInstance_MICRO_CACHE_BYTES (8 << 20) // From include/WeatherServerInstance.h
+#define WeatherServerInstance_MICRO_CACHE_TTL_S 30 // From include/WeatherServerInstance.h
+// /GetWeatherBatch requests a loop runs at once, past it they get a 503 (route descriptor)
+#define WeatherServerInstance_BATCH_CONCURRENCY 32 // From include/WeatherServerInstance.h
+#define WeatherServerInstance_LOCATION_BATCH_CONCURRENCY 8 // From include/WeatherServerInstance.h
+// Days /GetWeatherHistory covers when no from is given
+#define WeatherServerInstance_HISTORY_DAYS 7 // From include/WeatherServerInstance.h
+// How soon an instance whose backend has a transfer nothing signals is stepped again
+#define WeatherServer_POLL_INTERVAL_MS 1 // From include/WeatherServer.h
 
 // Server listen configuration
 // Port used by the HTTP server (originally hardcoded in libs/HTTPServer/HTTPServer.c)
 //#define WeatherServer_LISTEN_PORT "10480" // From libs/HTTPServer/HTTPServer.c
 #define LISTEN_PORT_MAX_SIZE 16
+// unix:PATH in place of the port, the path as long as sun_path takes
+#define LISTEN_ADDRESS_MAX_SIZE 113
 #define LISTEN_PORT_RANGE 65535
 #define TLS_PORT "10443"
+// TLS session resumption, shared by every worker's listener
+#define TLS_TICKET_LIFETIME_SECONDS 86400 // From src/connection.c
+#define TLS_SESSION_CACHE_ENABLED 1 // From src/connection.c
+#define TLS_SESSION_CACHE_MAX_ENTRIES 1000 // From src/connection.c
+#define TLS_SESSION_CACHE_TIMEOUT_SECONDS 86400 // From src/connection.c
+// Server signatures of TLS 1.2 handshakes run on the job pool instead of the worker loop
+#define TLS_ASYNC_PRIVATE_KEY 1 // From src/connection.c
+// Largest gather copied into one TLS record by conn_tls_writev
+#define TLS_WRITEV_COALESCE_BYTES 16384 // From src/connection.c
+// Records of one TCP segment for the first bytes after an idle period, so the client decodes early, then full ones
+#define TLS_DYNAMIC_RECORDS 1 // From src/connection.c
+#define TLS_RECORD_SMALL_BYTES 1400 // From src/connection.c
+#define TLS_RECORD_RAMP_BYTES (10 * TLS_RECORD_SMALL_BYTES) // From src/connection.c
+#define TLS_RECORD_IDLE_MS 1000 // From src/connection.c
+// mbedTLS record buffers of an idle keep-alive connection are given back until its next read or write
+#define TLS_IDLE_RELEASE_BUFFERS 1 // From src/connection.c
+// Largest record sent (512, 1024, 2048, 4096 or 16384), smaller saves output buffer memory per connection
+#define TLS_MAX_FRAGMENT_BYTES 16384 // From src/connection.c
+// Hand TLS 1.2 AES-GCM records to the kernel after the handshake (needs the tls module), 0 keeps mbedTLS
+#define TLS_KTLS_ENABLED 0 // From src/connection.c
+// TLS 1.3 0-RTT: requests of returning clients in the first flight, tickets single use for it
+#define TLS_EARLY_DATA_ENABLED 1 // From src/connection.c
+#define TLS_EARLY_DATA_MAX_BYTES 4096 // From src/connection.c
+#define TLS_EARLY_DATA_REPLAY_ENTRIES 16384 // From src/connection.c
+// ALPN offers HTTP/2 ("h2") ahead of http/1.1, 0 keeps every TLS connection on HTTP/1.1
+#define TLS_ALPN_HTTP2 1 // From src/connection.c
+// Worker threads, each runs its own smw loop and SO_REUSEPORT listeners
+#define WORKERS_DEFAULT_COUNT 1 // From include/workers.h
+#define WORKERS_MAX_COUNT 64 // From include/workers.h
+// --prefork=N: a crashed worker process is forked again no sooner than this after its last fork,
+// the master looks for exited ones this often
+#define WORKERS_PREFORK_RESTART_MS 1000 // From include/workers.h
+#define WORKERS_PREFORK_POLL_MS 100 // From include/workers.h
+// --busy-poll without a value, us a socket read or epoll_wait polls the NIC queue for
+#define WORKERS_BUSY_POLL_USECS 50 // From main.c
+// Mailboxes the loops message each other through, one per worker
+#define LOOP_MAILBOX_MAX_LOOPS WORKERS_MAX_COUNT // From include/utilities/loop_mailbox.h
+// Bounded ring per loop (a power of two), a full one defers the post
+#define LOOP_MAILBOX_RING_SIZE 1024 // From include/utilities/loop_mailbox.h
+// Messages a loop runs per pass before its tasks
+#define LOOP_MAILBOX_DRAIN_BATCH 256 // From include/utilities/loop_mailbox.h
+// Loops holding up reclamation of replaced snapshots, one per worker
+#define EPOCH_MAX_THREADS WORKERS_MAX_COUNT // From include/utilities/epoch.h
+// Peer tier (--peers): nodes on the ring at most, and the points each one has on it
+#define PEER_RING_MAX_PEERS 32 // From include/utilities/peer_ring.h
+#define PEER_RING_VNODES 128 // From include/utilities/peer_ring.h
+// Cache stores (--cache-store=URL): memory entries, a file store's bound and retention
+#define CACHE_STORE_MEMORY_ENTRIES 4096 // From include/utilities/cache_store.h
+// shm: buckets of the table in shared memory and the largest value one holds (--prefork opens one)
+#define CACHE_STORE_SHM_ENTRIES 4096 // From include/utilities/cache_store.h
+#define CACHE_STORE_SHM_VALUE_SIZE (32u << 10) // From include/utilities/cache_store.h
+#define CACHE_STORE_FILE_CAPACITY (256u << 20) // From include/utilities/cache_store.h
+#define CACHE_STORE_FILE_RETAIN_S 86400 // From include/utilities/cache_store.h
+// Redis: reply timeout, delay before reconnecting and operations a loop pipelines at most
+#define CACHE_STORE_REDIS_TIMEOUT_MS 250 // From include/utilities/cache_store.h
+#define CACHE_STORE_REDIS_RETRY_MS 1000 // From include/utilities/cache_store.h
+#define CACHE_STORE_REDIS_MAX_PENDING 1024 // From include/utilities/cache_store.h
+// Shared memory tables: tries of a read that keeps meeting writes, tables a crashed writer is looked for in
+#define SHM_TABLE_READ_TRIES 8 // From include/utilities/shm_table.h
+#define SHM_TABLE_MAX_TABLES 8 // From include/utilities/shm_table.h
+// Heavy hitters (/admin/hotkeys): keys each loop keeps in its top-K heap, bytes of a key's label
+#define HEAVY_HITTERS_TOP_K 32 // From include/utilities/heavy_hitters.h
+#define HEAVY_HITTERS_LABEL_SIZE 64 // From include/utilities/heavy_hitters.h
+#define WARMUP_MAX_LOCATIONS 64 // From include/warmup.h
+// Pre-warm (--prewarm): default windows, region size, requests in flight, budget kept for others, retry and pass intervals
+#define PREWARM_WINDOWS "03:00-05:00,06:00-07:00" // From include/prewarm.h
+#define PREWARM_MAX_WINDOWS 8 // From include/prewarm.h
+#define PREWARM_MAX_CELLS (1 << 20) // From include/prewarm.h
+#define PREWARM_MAX_INFLIGHT 4 // From include/prewarm.h
+#define PREWARM_BUDGET_RESERVE 40 // From include/prewarm.h
+#define PREWARM_BUDGET_WAIT_MS 1000 // From include/prewarm.h
+#define PREWARM_CHECK_MS 60000 // From include/prewarm.h
+#define PREWARM_PASS_INTERVAL_MS 900000 // From include/prewarm.h
+// --cdn-purge: keys per purge request (Fastly takes 256), gathered per loop for DELAY_MS first
+#define CDN_PURGE_MAX_KEYS 256 // From include/cdn_purge.h
+#define CDN_PURGE_KEY_SIZE 48 // From include/cdn_purge.h
+#define CDN_PURGE_DELAY_MS 1000 // From include/cdn_purge.h
+#define CDN_PURGE_TIMEOUT_MS 5000 // From include/cdn_purge.h
+#define STARTUP_MAX_PHASES 16 // From include/startup.h
+// Hot restart (--hot-restart=PATH): listen sockets and cache keys handed over at most
+#define HOT_RESTART_MAX_FDS 128 // From include/hot_restart.h
+#define HOT_RESTART_MAX_KEYS 65536 // From include/hot_restart.h
+// How long the old process may take to send, and the new one to serve, before the other gives up
+#define HOT_RESTART_TIMEOUT_MS 5000 // From include/hot_restart.h
+#define HOT_RESTART_READY_TIMEOUT_MS 60000 // From include/hot_restart.h
+// Longest the old process goes on answering what it accepted before the handover
+#define HOT_RESTART_DRAIN_MS 10000 // From include/hot_restart.h
+// Threads running blocking backend work (disk, JSON files), shared by all workers
+#define JOB_POOL_THREADS 2 // From include/utilities/job_pool.h
+// Plain HTTP listener on io_uring (multishot accept/recv, linked send+close), 0 keeps epoll
+#define HTTPServer_USE_IO_URING 0 // From src/HTTPServer/HTTPServer.c
+#define uring_entries 256 // From include/uring.h
+#define uring_buffer_count 256 // From include/uring.h
 // SECURITY
-#define SKIP_TLS_CERT_FOR_DEV 0  // Set to 1 for dev
+#define SKIP_TLS_CERT_FOR_DEV 1  // Set to 1 for dev
 #define CERT_FILE_PATH "/home/drone/Documents/dump/UB-WeatherServer/cert/fullchain.pem"
 #define PRIVKEY_FILE_PATH "/home/drone/Documents/dump/UB-WeatherServer/cert/privkey.pem"
+// ECDSA P-256 certificate served ahead of the one above to clients that support it, "" for none
+#define ECDSA_CERT_FILE_PATH "" // From src/connection.c
+#define ECDSA_PRIVKEY_FILE_PATH "" // From src/connection.c
 
 // External API timeouts (seconds)
 // General curl timeouts used by `libs/utilities/curl_client.c` and backend clients
@@ -67,5 +402,73 @@
 // Curl response buffer cap to avoid unbounded allocations (bytes)
 // Enforced in `libs/utilities/curl_client.c` write callback
 #define CURL_CLIENT_MAX_RESPONSE_SIZE (1024 * 1024 * 5) // 5MB cap, from libs/utilities/curl_client.c
+// First receive buffer when the upstream sends no Content-Length, doubled as needed
+#define CURL_CLIENT_INITIAL_BUFFER_SIZE (16 * 1024) // From include/utilities/curl_client.h
+// Hedged upstream GETs, sent again past the p95 for at most 5% of requests
+#define CURL_CLIENT_HEDGE_PERCENTILE 95 // From include/utilities/curl_client.h
+#define CURL_CLIENT_HEDGE_BUDGET_PERCENT 5 // From include/utilities/curl_client.h
+// Upstream request scheduling, per host per loop and the quota of the process
+#define CURL_CLIENT_HOST_CONCURRENCY 16 // From include/utilities/curl_client.h
+#define CURL_CLIENT_RATE_PER_MINUTE 600 // From include/utilities/curl_client.h
+#define CURL_CLIENT_RATE_BURST 60 // From include/utilities/curl_client.h
+// Least deadline left to start a transfer, or the upstream's median if more
+#define CURL_CLIENT_DEADLINE_MIN_MS 20 // From include/utilities/curl_client.h
+
+// Upstream circuit breaker, trips on failed or slow requests per window
+#define CIRCUIT_BREAKER_WINDOW_MS 10000 // From include/utilities/circuit_breaker.h
+#define CIRCUIT_BREAKER_MIN_REQUESTS 10 // From include/utilities/circuit_breaker.h
+#define CIRCUIT_BREAKER_FAILURE_PERCENT 50 // From include/utilities/circuit_breaker.h
+#define CIRCUIT_BREAKER_SLOW_MS 2000 // From include/utilities/circuit_breaker.h
+#define CIRCUIT_BREAKER_OPEN_MS 5000 // From include/utilities/circuit_breaker.h
+// Adaptive upstream timeout, p99 times the factor, never below the minimum
+#define CIRCUIT_BREAKER_TIMEOUT_FACTOR 3 // From include/utilities/circuit_breaker.h
+#define CIRCUIT_BREAKER_MIN_TIMEOUT_MS 1000 // From include/utilities/circuit_breaker.h
+
+// Per event loop upstream connection cache and pooled easy handles
+#define CURL_CLIENT_MAX_CONNECTS 16 // From include/utilities/curl_client.h
+#define CURL_CLIENT_POOL_SIZE 16 // From include/utilities/curl_client.h
+// HTTP/2 multiplexing to upstreams, streams per connection and connections per host
+#define CURL_CLIENT_MAX_STREAMS 100 // From include/utilities/curl_client.h
+#define CURL_CLIENT_MAX_HOST_CONNECTIONS 4 // From include/utilities/curl_client.h
+
+// Slots of the process wide string intern table (units), three quarters may fill
+#define STRING_INTERN_SLOTS 512 // From include/utilities/string_intern.h
+// Block size of the arenas jansson allocates from while a backend builds JSON
+#define JSON_ARENA_BLOCK_SIZE 16384 // From include/utilities/json_arena.h
+// Arena blocks of this size an idle owner gives up (arena_trim, keep-alive connections) are pooled
+// per loop for the next arena that needs one
+#define ARENA_POOL_BLOCK_SIZE HTTPServerConnection_ARENA_BLOCK_SIZE // From include/utilities/arena.h
+// First size of a thread's json_buffer, later ones start at its last dump's size
+#define JSON_BUFFER_INITIAL_SIZE 1024 // From include/utilities/json_arena.h
+// jansson writes reals with real_format (shortest digits), 0 for its printf
+#define JSON_SHORTEST_REALS 1 // From include/utilities/real_format.h
+
+// Async logger: ring slots (power of two), message size, per call site rate, writer idle sleep
+#define LOG_RING_SLOTS 1024 // From include/utilities/logger.h
+#define LOG_MESSAGE_SIZE 256 // From include/utilities/logger.h
+#define LOG_SITE_PER_SECOND 20 // From include/utilities/logger.h
+#define LOG_FLUSH_INTERVAL_MS 20 // From include/utilities/logger.h
+
+// Request tracing: one in N requests per loop sampled (0 none), export any slower than MS (0 none);
+// --trace-sample and --trace-slow override them
+#define TRACE_SAMPLE_EVERY 0 // From include/utilities/trace.h
+#define TRACE_SLOW_MS 0 // From include/utilities/trace.h
+
+// Memory accounting: samples a subsystem's object count must grow across before --mem-leak-check reports it
+#define MEM_ACCOUNT_LEAK_WINDOW 8 // From include/utilities/mem_account.h
+
+// Entries of headers and query parameters kept inside their vector before it spills to the heap (bytes)
+#define SMALL_VECTOR_INLINE_SIZE 256 // From include/small_vector.h
+
+// Huge pages for the big randomly probed tables: 0 off, 1 transparent (madvise), 2 explicit (MAP_HUGETLB,
+// transparent without reserved pages), --huge-pages overrides it; tables under MIN_BYTES stay on the heap
+#define HUGE_PAGES_MODE 2 // From include/utilities/huge_pages.h
+#define HUGE_PAGES_SIZE (2 << 20) // From include/utilities/huge_pages.h
+#define HUGE_PAGES_MIN_BYTES (2 << 20) // From include/utilities/huge_pages.h
+#define HUGE_PAGES_MAX_MAPPINGS 32 // From include/utilities/huge_pages.h
+
+// /metrics: shards per counter and histogram (threads beyond share), metrics registered at most
+#define METRICS_SHARDS 8 // From include/utilities/metrics.h
+#define METRICS_MAX_ENTRIES 192 // From include/utilities/metrics.h
 
 #endif // GLOBAL_DEFINES_H
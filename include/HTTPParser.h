@@ -37,6 +37,40 @@ For most use cases, the default values should work perfectly fine.
 #  endif
 #endif
 
+// Header limit of HTTPRequestParser, more is an invalid request
+#ifndef MAX_HEADERS
+#  ifdef G_MAX_HEADERS
+#    define MAX_HEADERS G_MAX_HEADERS
+#  else
+#    define MAX_HEADERS 32
+#  endif
+#endif
+
+// Parameters HTTPQueryView keeps, the rest of the query string is ignored
+#ifndef MAX_QUERY_PARAMETERS
+#  ifdef G_MAX_QUERY_PARAMETERS
+#    define MAX_QUERY_PARAMETERS G_MAX_QUERY_PARAMETERS
+#  else
+#    define MAX_QUERY_PARAMETERS 16
+#  endif
+#endif
+
+// Prebuilt response head blocks HTTPResponse_build_head keeps per thread, and their size limit
+#ifndef RESPONSE_BLOCK_CACHE
+#  ifdef G_RESPONSE_BLOCK_CACHE
+#    define RESPONSE_BLOCK_CACHE G_RESPONSE_BLOCK_CACHE
+#  else
+#    define RESPONSE_BLOCK_CACHE 32
+#  endif
+#endif
+#ifndef RESPONSE_BLOCK_SIZE
+#  ifdef G_RESPONSE_BLOCK_SIZE
+#    define RESPONSE_BLOCK_SIZE G_RESPONSE_BLOCK_SIZE
+#  else
+#    define RESPONSE_BLOCK_SIZE 384
+#  endif
+#endif
+
 // Strict validation
 #ifndef STRICT_VALIDATION
 #  ifdef G_STRICT_VALIDATION
@@ -59,7 +93,7 @@ For most use cases, the default values should work perfectly fine.
 #  ifdef G_CORS_ALLOWED_METHODS
 #    define CORS_ALLOWED_METHODS G_CORS_ALLOWED_METHODS
 #  else
-#    define CORS_ALLOWED_METHODS "GET, OPTIONS"
+#    define CORS_ALLOWED_METHODS "GET, HEAD, OPTIONS"
 #  endif
 #endif
 
@@ -76,7 +110,7 @@ For most use cases, the default values should work perfectly fine.
           BEGIN LIBRARY CODE
 */
 
-#include "linked_list.h"
+#include "small_vector.h"
 #include <stdint.h>
 
 // HTTPQuery - Path & query separator for URLs
@@ -87,13 +121,44 @@ typedef struct {
 } HTTPQueryParameter;
 typedef struct {
     const char* Path;
-    LinkedList* Query;
+    SmallVector Query; // of HTTPQueryParameter
 } HTTPQuery;
 
+// Names and values are percent-decoded ('+' is a space), the view below is not
 HTTPQuery* HTTPQuery_fromstring(const char* URL);
 const char* HTTPQuery_getParameter(HTTPQuery* query, const char* name); // Returns GET parameter value if name found, NULL if not found
 void HTTPQuery_Dispose(HTTPQuery** query);
 
+// HTTPStringView - a (pointer, length) slice of a buffer owned by someone else, not terminated
+
+typedef struct {
+    const char* data;
+    size_t length;
+} HTTPStringView;
+
+int HTTPStringView_equals(HTTPStringView view, const char* str);
+int HTTPStringView_equalsIgnoreCase(HTTPStringView view, const char* str);
+// Terminated copy into out, NULL if it does not fit
+const char* HTTPStringView_copy(HTTPStringView view, char* out, size_t size);
+
+// HTTPQueryView - HTTPQuery without allocations, everything is a view into the URL
+
+typedef struct {
+    HTTPStringView Name;
+    HTTPStringView Value;
+    int HasValue; // 0 for a bare "?name"
+} HTTPQueryViewParameter;
+typedef struct {
+    HTTPStringView Path;
+    HTTPQueryViewParameter Query[MAX_QUERY_PARAMETERS];
+    int Count;
+} HTTPQueryView;
+
+void HTTPQueryView_parse(HTTPQueryView* query, HTTPStringView URL);
+const HTTPQueryViewParameter* HTTPQueryView_getParameter(const HTTPQueryView* query, const char* name);
+// Terminated copy of the value into out, NULL if not found, valueless or too long (like HTTPQuery_getParameter)
+const char* HTTPQueryView_copyParameter(const HTTPQueryView* query, const char* name, char* out, size_t size);
+
 // A HTTPRequest struct should only be disposed by HTTPRequest_Dispose
 
 // If a HTTPRequest is not valid, why?
@@ -106,7 +171,10 @@ typedef enum {
     URLTooLong = 4, // Originally existed because the URL was fixed size in the struct, but kept for extra safety
     InvalidMethod = 5, // only for STRICT_VALIDATION
     InvalidProtocol = 6, // only for STRICT_VALIDATION
-    InvalidURL = 7 // URLs must begin with a slash
+    InvalidURL = 7, // URLs must begin with a slash
+    InvalidHeader = 8, // HTTPRequestParser only
+    TooManyHeaders = 9, // HTTPRequestParser only, see MAX_HEADERS
+    HeadTooLarge = 10 // set by HTTPServerConnection, the head outgrew its read buffer
 } InvalidReason;
 
 const char* InvalidReason_tostring(InvalidReason method);
@@ -142,7 +210,10 @@ typedef enum {
     ResponseCode_Unknown = 0,
 
     OK = 200,
+    Accepted = 202,
     No_Content = 204,
+    Partial_Content = 206,
+    IM_Used = 226,
 
     Moved_Permanently = 301,
     Found = 302,
@@ -160,6 +231,8 @@ typedef enum {
     Length_Required = 411,
     Content_Too_Large = 413,
     URI_Too_Long = 414,
+    Range_Not_Satisfiable = 416,
+    Too_Early = 425,
     Too_Many_Requests = 429,
     Request_Header_Fields_Too_Large = 431,
 
@@ -179,7 +252,7 @@ typedef struct {
     ProtocolVersion protocol;
     const char* URL;
 
-    LinkedList* headers;
+    SmallVector headers; // of HTTPHeader
 } HTTPRequest;
 
 typedef struct {
@@ -188,7 +261,7 @@ typedef struct {
 
     ResponseCode responseCode;
     ProtocolVersion protocol;
-    LinkedList* headers;
+    SmallVector headers; // of HTTPHeader
 
     uint8_t* body;
     size_t bodySize;
@@ -200,12 +273,111 @@ HTTPRequest* HTTPRequest_new(RequestMethod method, const char* URL);
 int HTTPRequest_add_header(HTTPRequest* response, const char* name, const char* value);
 const char* HTTPRequest_tostring(HTTPRequest* request);
 HTTPRequest* HTTPRequest_fromstring(const char* request); // DEPRECATED: USE HTTPRequestParser
+const char* HTTPRequest_getHeader(HTTPRequest* request, const char* name); // Case insensitive, NULL if not present
 void HTTPRequest_Dispose(HTTPRequest** request);
 
-HTTPResponse* HTTPResponse_new(ResponseCode code, uint8_t* body, size_t bodyLength);
+// HTTPRequestParser - resumable parser for a request head arriving in pieces.
+// Feed it the same buffer again as it grows, only the new bytes are looked at.
+// Nothing is allocated, the URL and headers are offsets into that buffer.
+
+typedef enum {
+    HTTPRequestParser_Method,
+    HTTPRequestParser_URL,
+    HTTPRequestParser_Protocol,
+    HTTPRequestParser_RequestLineLF,
+    HTTPRequestParser_HeaderStart,
+    HTTPRequestParser_HeaderName,
+    HTTPRequestParser_HeaderValueStart,
+    HTTPRequestParser_HeaderValue,
+    HTTPRequestParser_HeaderLF,
+    HTTPRequestParser_HeadLF,
+    HTTPRequestParser_Done,
+    HTTPRequestParser_Invalid
+} HTTPRequestParser_State;
+
+typedef struct {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t valueOffset;
+    uint32_t valueLength;
+} HTTPRequestParser_Header;
+
+// Headers the server reads on every request. The parser looks each name up
+// once as it ends (a perfect hash, case folded as it hashes) and remembers
+// where the first of every known one is, reading one back is an index.
+typedef enum {
+    HTTPHeader_Connection,
+    HTTPHeader_Host,
+    HTTPHeader_AcceptEncoding,
+    HTTPHeader_IfNoneMatch,
+    HTTPHeader_IfModifiedSince,
+    HTTPHeader_Range,
+    HTTPHeader_IfRange,
+    HTTPHeader_Upgrade,
+    HTTPHeader_Traceparent,
+    HTTPHeader_Accept,
+    HTTPHeader_ContentLength,
+    HTTPHeader_TransferEncoding,
+    HTTPHeader_KnownCount,
+    HTTPHeader_Unknown = HTTPHeader_KnownCount
+} HTTPHeaderId;
+
+// The id of a header name, HTTPHeader_Unknown for the others
+HTTPHeaderId HTTPHeader_id(const char* name, size_t length);
+
+typedef struct {
+    HTTPRequestParser_State state;
+    InvalidReason reason;
+    uint32_t offset; // bytes consumed, the length of the head once done
+    uint32_t token; // start of the token being scanned
+
+    RequestMethod method;
+    ProtocolVersion protocol;
+    uint32_t urlOffset;
+    uint32_t urlLength;
+
+    HTTPRequestParser_Header headers[MAX_HEADERS];
+    int headerCount;
+    // index + 1 in headers of the first of each known header, 0 if it was not sent
+    uint8_t known[HTTPHeader_KnownCount];
+} HTTPRequestParser;
+
+void HTTPRequestParser_init(HTTPRequestParser* parser);
+// 1 once the head is complete, 0 if more bytes are needed, -1 if invalid (see reason)
+int HTTPRequestParser_execute(HTTPRequestParser* parser, const char* buffer, size_t length);
+HTTPStringView HTTPRequestParser_getURL(const HTTPRequestParser* parser, const char* buffer);
+// Case insensitive, the value is not terminated. NULL if not present.
+const char* HTTPRequestParser_getHeader(const HTTPRequestParser* parser, const char* buffer, const char* name,
+                                        size_t* valueLength);
+// The same for a known header, without looking at the others
+const char* HTTPRequestParser_getKnownHeader(const HTTPRequestParser* parser, const char* buffer, HTTPHeaderId id,
+                                             size_t* valueLength);
+// 1 if the head announces a body: Transfer-Encoding, or a Content-Length
+// other than 0 (one that is not a number counts as a body)
+int HTTPRequestParser_hasBody(const HTTPRequestParser* parser, const char* buffer);
+
+// A response with a copy of body, cors 0 leaves out the CORS headers
+HTTPResponse* HTTPResponse_new(ResponseCode code, uint8_t* body, size_t bodyLength, int cors);
+// Headers only, for a body of bodyLength bytes that is sent separately
+HTTPResponse* HTTPResponse_new_head(ResponseCode code, size_t bodyLength, int cors);
 int HTTPResponse_add_header(HTTPResponse* response, const char* name, const char* value);
 const char* HTTPResponse_tostring(HTTPResponse* response, size_t* outSize);
+// Status line and headers up to the blank line, outSize excludes the body
+const char* HTTPResponse_head_tostring(HTTPResponse* response, size_t* outSize);
 HTTPResponse* HTTPResponse_fromstring(const char* response);
 void HTTPResponse_Dispose(HTTPResponse** response);
 
+// Response head without an HTTPResponse: the status line, Content-Type, Connection and CORS
+// headers of every (code, contentType, connection, cors) seen are formatted once per thread, a
+// head then costs a memcpy of that block and the Content-Length digits. contentType and
+// connection may be NULL to leave the header out, cors 0 leaves out the CORS headers (no page of
+// another origin may read the response), extraHeaders (complete "Name: value\r\n" lines, may be
+// NULL) are copied in per response. Returns the length written, -1 if size is too small.
+int HTTPResponse_build_head(char* out, size_t size, ResponseCode code, const char* contentType,
+                            const char* connection, int cors, const char* extraHeaders, size_t bodyLength);
+// The same head for a body of unknown length: Transfer-Encoding: chunked in place of
+// Content-Length, or with chunked 0 neither (HTTP/1.0, the body ends when the connection closes)
+int HTTPResponse_build_head_streamed(char* out, size_t size, ResponseCode code, const char* contentType,
+                                     const char* connection, int cors, const char* extraHeaders, int chunked);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef __HTTP2Connection_h_
+#define __HTTP2Connection_h_
+
+#include "HTTPServerConnection.h"
+#include "global_defines.h"
+
+/*
+ * HTTP/2 (RFC 9113) on a TLS connection whose ALPN settled on "h2". The
+ * HTTPServerConnection stays what the handler sees: every stream becomes an
+ * HTTPServerConnection_Request on its queue, with a head rebuilt from the
+ * HPACK fields so GetHeader and the url work as over HTTP/1.1, and is
+ * answered with the same SendResponse calls. The HTTP/1.1 head those build
+ * is sent as a HEADERS frame (see utilities/hpack.h), the body as DATA
+ * frames as far as the client's flow control windows allow, streams in the
+ * order their responses are ready. There is no server push and no
+ * prioritisation, request bodies are taken in and dropped.
+ */
+
+#ifndef HTTP2Connection_MAX_CONCURRENT_STREAMS
+#define HTTP2Connection_MAX_CONCURRENT_STREAMS 100
+#endif
+#ifndef HTTP2Connection_MAX_STREAMS
+#define HTTP2Connection_MAX_STREAMS 1000
+#endif
+#ifndef HTTP2Connection_OUTPUT_SIZE
+#define HTTP2Connection_OUTPUT_SIZE 16384
+#endif
+
+typedef struct HTTP2Connection HTTP2Connection;
+
+/* 1 if the handshake of _Connection settled on h2 */
+int HTTP2Connection_Negotiated(HTTPServerConnection *_Connection);
+/* once the handshake is done, queues the server's SETTINGS. NULL if out of memory. */
+HTTP2Connection *HTTP2Connection_Create(HTTPServerConnection *_Connection, uint64_t _MonTime);
+/* a run of the connection's task: reads and answers frames, sends what is
+   ready. -1 once the connection is to be disposed. */
+int HTTP2Connection_Work(HTTP2Connection *_HTTP2, uint64_t _MonTime);
+void HTTP2Connection_Dispose(HTTP2Connection *_HTTP2);
+
+/* connections and streams on /metrics, with HTTPServerConnection_RegisterMetrics */
+void HTTP2Connection_RegisterMetrics(void);
+
+#endif //__HTTP2Connection_h_
@@ -5,6 +5,14 @@
 #include "HTTPServerConnection.h"
 #include "../connection.h" // Includes conn_listen_server_t
 
+#ifndef HTTPServer_USE_IO_URING
+#define HTTPServer_USE_IO_URING 0
+#endif
+
+/* a port argument of "unix:PATH" listens on the unix socket PATH instead
+   ("unix:@name" an abstract one), see conn_listen_server_unix_init */
+#define HTTPServer_UNIX_PREFIX "unix:"
+
 typedef int (*HTTPServer_OnConnection)(void* _Context, HTTPServerConnection* _Connection);
 
 typedef struct
@@ -26,6 +34,8 @@ int HTTPServer_Initiate(HTTPServer* _Server, void *_Context, HTTPServer_OnConnec
 int HTTPServer_InitiatePtr(void *_Context, HTTPServer_OnConnection _OnConnection, HTTPServer** _ServerPtr, char *port);
 
 
+/* closes the listeners, the connections accepted so far are left alone */
+void HTTPServer_StopListening(HTTPServer* _Server);
 void HTTPServer_Dispose(HTTPServer* _Server);
 void HTTPServer_DisposePtr(HTTPServer** _ServerPtr);
 
@@ -3,18 +3,39 @@
 
 #include "../../include/connection.h" // Include your new connection interface
 #include "HTTPParser.h"
+#include "utilities/arena.h"
+#include "utilities/http_validators.h"
+#include "utilities/response_blob.h"
+#include "utilities/trace.h"
 #include "smw.h"
 #include "global_defines.h"
 
-typedef int (*HTTPServerConnection_OnRequest)(void *_Context);
+typedef struct HTTPServerConnection HTTPServerConnection;
+typedef struct HTTPServerConnection_Request HTTPServerConnection_Request;
+
+/* a request was parsed, answer it with SendResponse whenever it is ready */
+typedef int (*HTTPServerConnection_OnRequest)(void *_Context, HTTPServerConnection_Request *_Request);
+/* the response left the socket, _Request is released right after */
+typedef void (*HTTPServerConnection_OnResponseSent)(void *_Context, HTTPServerConnection_Request *_Request);
+/* the connection is finished and can be disposed, not from inside this callback */
+typedef void (*HTTPServerConnection_OnClosed)(void *_Context);
+/* next piece of a streamed body into _Buffer: the bytes written, 0 at the end of the body,
+   HTTPServerConnection_STREAM_AGAIN if nothing is available yet (call
+   HTTPServerConnection_ResumeStream once there is) or -1 to abort the connection */
+typedef int (*HTTPServerConnection_StreamRead)(void *_Context, uint8_t *_Buffer, int _Size);
+
+#define HTTPServerConnection_STREAM_AGAIN -2
 
 typedef enum {
   HTTPServerConnection_State_Init,
+  HTTPServerConnection_State_Handshake,
   HTTPServerConnection_State_Reading,
   HTTPServerConnection_State_Parsing,
   HTTPServerConnection_State_Wait,
   HTTPServerConnection_State_Timeout,
   HTTPServerConnection_State_Send,
+  /* ALPN settled on h2, HTTP2Connection_Work runs the connection */
+  HTTPServerConnection_State_HTTP2,
   HTTPServerConnection_State_Done,
   HTTPServerConnection_State_Dispose,
   HTTPServerConnection_State_Failed
@@ -22,26 +43,239 @@ typedef enum {
 
 #define READBUFFER_SIZE HTTPServerConnection_READBUFFER_SIZE 
 #define WRITEBUFFER_SIZE HTTPServerConnection_WRITEBUFFER_SIZE
-#define HTTPSERVER_TIMEOUT_MS HTTPServerConnection_HTTPSERVER_TIMEOUT_MS
+#ifndef HTTPServerConnection_HEADER_TIMEOUT_MS
+#define HTTPServerConnection_HEADER_TIMEOUT_MS 1000
+#endif
+#ifndef HTTPServerConnection_HANDLER_TIMEOUT_MS
+#define HTTPServerConnection_HANDLER_TIMEOUT_MS 12000
+#endif
+/* a client may ask for less with this header, ms from when the request
+   arrived; the handler and its upstream fetches get no more than that */
+#ifndef HTTPServerConnection_DEADLINE_HEADER
+#define HTTPServerConnection_DEADLINE_HEADER "X-Request-Deadline-Ms"
+#endif
+/* a response larger than BULK_BYTES (or streamed) is bulk: it is sent
+   after the small ones of a pass, BULK_QUANTUM bytes per turn, and a pass
+   sends at most about BULK_PASS_BYTES of bulk in all */
+#ifndef HTTPServerConnection_BULK_BYTES
+#define HTTPServerConnection_BULK_BYTES (64 * 1024)
+#endif
+#ifndef HTTPServerConnection_BULK_QUANTUM
+#define HTTPServerConnection_BULK_QUANTUM (64 * 1024)
+#endif
+#ifndef HTTPServerConnection_BULK_PASS_BYTES
+#define HTTPServerConnection_BULK_PASS_BYTES (512 * 1024)
+#endif
+#ifndef HTTPServerConnection_READ_INLINE_SIZE
+#define HTTPServerConnection_READ_INLINE_SIZE 1024
+#endif
+#ifndef HTTPServerConnection_HANDSHAKE_TIMEOUT_MS
+#define HTTPServerConnection_HANDSHAKE_TIMEOUT_MS 500
+#endif
+#ifndef HTTPServerConnection_WRITE_TIMEOUT_MS
+#define HTTPServerConnection_WRITE_TIMEOUT_MS 10000
+#endif
+#ifndef HTTPServerConnection_KEEPALIVE_TIMEOUT_MS
+#define HTTPServerConnection_KEEPALIVE_TIMEOUT_MS 5000
+#endif
+/* a head arriving or a response leaving slower than this on average
+   (bytes/s) is given up on, once past the grace period (tuning knob
+   min_transfer_rate, 0 turns it off) */
+#ifndef HTTPServerConnection_MIN_RATE_BYTES_PER_SECOND
+#define HTTPServerConnection_MIN_RATE_BYTES_PER_SECOND 256
+#endif
+#ifndef HTTPServerConnection_MIN_RATE_GRACE_MS
+#define HTTPServerConnection_MIN_RATE_GRACE_MS 1000
+#endif
+#ifndef HTTPServerConnection_PIPELINE_DEPTH
+#define HTTPServerConnection_PIPELINE_DEPTH 8
+#endif
+#ifndef HTTPServerConnection_RESPONSE_INLINE_SIZE
+#define HTTPServerConnection_RESPONSE_INLINE_SIZE 640
+#endif
+#ifndef HTTPServerConnection_ARENA_BLOCK_SIZE
+#define HTTPServerConnection_ARENA_BLOCK_SIZE 16384
+#endif
+#ifndef HTTPServerConnection_EXTRA_HEADERS_SIZE
+#define HTTPServerConnection_EXTRA_HEADERS_SIZE 512
+#endif
+#ifndef HTTPServerConnection_STREAM_CHUNK_SIZE
+#define HTTPServerConnection_STREAM_CHUNK_SIZE 8192
+#endif
+#ifndef HTTPServerConnection_KEEPALIVE_MAX_REQUESTS
+#define HTTPServerConnection_KEEPALIVE_MAX_REQUESTS 100
+#endif
 
+// Handshakes finished on this thread's loop, durations are wall time from accept
 typedef struct {
-  conn_t *conn;
+  uint64_t completed;
+  uint64_t failed;
+  uint64_t timed_out;
+  uint64_t total_us;
+  uint64_t max_us;
+} HTTPServerConnection_HandshakeStats;
 
-  char readBuffer[READBUFFER_SIZE];
-  int bytesRead;
+/* one parsed request, over HTTP/1.x responses leave in the order the
+   requests came in. What the send path and the handler touch on every
+   request comes first and is all QueueRequest clears; the parsed head and
+   the inline buffers behind it are written before they are read. */
+struct HTTPServerConnection_Request {
+  HTTPServerConnection *connection;
+  HTTPServerConnection_Request *next;
+  RequestMethod method;
+  /* go back to Reading once this response is sent */
+  int keepAlive;
+  /* the handler missed HANDLER_TIMEOUT_MS and the connection answered 504
+     in its place, whatever the handler still has in flight can be dropped */
+  int timedOut;
+  /* the monotonic ms the client's DEADLINE_HEADER ends at, 0 without one */
+  uint64_t deadlineMs;
+  /* the head came, at least in part, in TLS 1.3 0-RTT data: the client's
+     handshake is not finished, answer only what is safe to replay */
+  int earlyData;
+  /* the response leaves out the CORS headers, no page of another origin
+     may read it (operator routes) */
+  int noCors;
+
+  /* the response, held until every request ahead of it is sent. The head,
+     and a body small enough, go in responseInline, larger copies in the
+     connection's arena. */
+  int ready;
+  /* the status line's code, for the metrics */
+  int status;
+  /* bytes the response took on the wire, set before onResponseSent */
+  int sent;
   uint8_t *writeBuffer;
   int writeBufferSize;
+  int ownsWriteBuffer;
+  /* borrowed body sent after writeBuffer, see SendResponse_Binary. A
+     streamed response points it at the chunk being sent. */
+  const uint8_t *body;
+  int bodySize;
+  /* the file body is a part of (from bodyFdOffset), -1 if none. Sent with
+     sendfile where the connection can, body is the fallback. */
+  int bodyFd;
+  off_t bodyFdOffset;
+  /* what the body belongs to when the request holds it, see
+     SendResponse_Take/_Ref/_Blob, released with bodyRelease once sent */
+  const void *bodyOwner;
+  void (*bodyRelease)(const void *_Owner);
+  /* part of the body went out with conn_writev_zerocopy, the kernel may
+     still be reading it: the connection holds it on release */
+  int zerocopy;
+  /* see SendResponse_Stream, streamRemaining is -1 for a body of unknown length */
+  HTTPServerConnection_StreamRead stream;
+  void *streamContext;
+  uint8_t *streamBuffer;
+  int64_t streamRemaining;
+  int streamChunked;
+  int streamDone;
+
+  /* views into the connection's readBuffer, it is not compacted while any
+     request is queued. head's offsets are relative to headBuffer. */
+  HTTPStringView url;
+  const char *headBuffer;
+  /* headBuffer is a head of its own (HTTP/2), released with the request */
+  int ownsHeadBuffer;
+  /* with etag, as given to SetValidators */
+  time_t lastModified;
+
+  /* over HTTP/2 the stream it came on (id 0 over HTTP/1.x), its send
+     window and how far the response got: the length of the head in
+     writeBuffer once its HEADERS are out (-1 before) and the body bytes
+     sent behind it */
+  struct {
+    uint32_t id;
+    int32_t window;
+    uint64_t openedAt;
+    int headLength;
+    int sent;
+    /* the client cancelled it (RST_STREAM), the response is dropped */
+    int reset;
+    /* the client may still send DATA, the stream is reset once answered */
+    int remoteOpen;
+  } http2;
+
+  /* the handler's own state for this request */
+  void *context;
+
+  /* phases of this request when it is traced, see utilities/trace.h; the
+     handler stamps its own and exports it in OnResponseSent */
+  trace_context trace;
+
+  /* not cleared for a new request from here on */
+  HTTPRequestParser head;
+  char responseInline[HTTPServerConnection_RESPONSE_INLINE_SIZE];
+  /* header lines added to the response, see AddHeader */
+  char extraHeaders[HTTPServerConnection_EXTRA_HEADERS_SIZE];
+  /* as given to SetValidators, for If-Range */
+  char etag[HTTP_ETAG_SIZE];
+};
+
+/* the fields every pass of the connection's task reads come first, up to
+   context within two cache lines of the (cache line aligned) start; the
+   handler's callbacks, the parser, timings and the inline read buffer
+   follow */
+struct HTTPServerConnection {
+  conn_t *conn;
+  smw_task *task;
+  HTTPServerConnection_State state;
+  /* requests queued, and how much of the oldest one's response is sent */
+  int pending;
   int bytesSent;
+  /* the last HTTPRequestParser_execute result for the head at readStart */
+  int headResult;
+  /* requests waiting for or sending their response, oldest first */
+  HTTPServerConnection_Request *requests;
+  HTTPServerConnection_Request *requestsTail;
+
+  /* queued requests point into readBuffer, what follows readStart is not
+     parsed yet. It is readInline until a head outgrows that, then a pooled
+     buffer of READBUFFER_SIZE until the connection is idle again. */
+  char *readBuffer;
+  int readCapacity;
+  int bytesRead;
+  int readStart;
+  int requestCount;
+  /* a request without keep-alive was queued, nothing after it is read */
+  int closing;
+  /* the server is going away: no request is kept alive, an idle
+     connection is closed, see Drain */
+  int draining;
+  /* the TLS handshake still runs under 0-RTT data, it is driven from
+     Reading and Send and a response waits for it. readBuffer before
+     earlyEnd came in that data. */
+  int earlyHandshake;
+  int earlyEnd;
   uint64_t startTime;
+  /* the HTTP/2 framing once ALPN settled on h2, NULL over HTTP/1.x */
+  struct HTTP2Connection *http2;
 
   void *context;
   HTTPServerConnection_OnRequest onRequest;
+  HTTPServerConnection_OnResponseSent onResponseSent;
+  HTTPServerConnection_OnClosed onClosed;
 
-  char *method;
-  char *url;
-  smw_task *task;
-  HTTPServerConnection_State state;
-} HTTPServerConnection;
+  /* the head at readStart so far */
+  HTTPRequestParser parser;
+  /* responses of the queued requests, reset whenever the queue runs empty.
+     Set up by InitiatePtr and kept while the connection sits in the pool. */
+  arena arena;
+  uint64_t handshakeStartNs;
+  /* monotonic ms the head at readStart began to arrive and the oldest
+     response began to leave, the rate floor is measured from them; the
+     Send deadline armed is the floor's rather than the write timeout */
+  uint64_t headStartMs;
+  uint64_t sendStartMs;
+  int rateDeadline;
+  /* while tracing is on: monotonic ns the loop took the connection, the
+     handshake finished and the head at readStart began to arrive */
+  uint64_t initNs;
+  uint64_t handshakenNs;
+  uint64_t headStartNs;
+
+  char readInline[HTTPServerConnection_READ_INLINE_SIZE];
+};
 
 // Updated to take conn_t* instead of int FD
 int HTTPServerConnection_Initiate(HTTPServerConnection *_Connection, conn_t *_Conn);
@@ -49,12 +283,90 @@ int HTTPServerConnection_InitiatePtr(conn_t *_Conn, HTTPServerConnection **_Conn
 
 void HTTPServerConnection_SetCallback(
     HTTPServerConnection *_Connection, void *_Context,
-    HTTPServerConnection_OnRequest _OnRequest);
+    HTTPServerConnection_OnRequest _OnRequest,
+    HTTPServerConnection_OnResponseSent _OnResponseSent,
+    HTTPServerConnection_OnClosed _OnClosed);
 
-void HTTPServerConnection_SendResponse(HTTPServerConnection *_Connection,
+void HTTPServerConnection_SendResponse(HTTPServerConnection_Request *_Request,
                                        int _responseCode, char *_responseBody, char *_contentType);
-void HTTPServerConnection_SendResponse_Binary(HTTPServerConnection *_Connection,
+/* the body is sent in place, it has to stay valid until OnResponseSent for
+   this request, or the connection is disposed */
+void HTTPServerConnection_SendResponse_Binary(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, uint8_t *_responseBody, size_t _responseBodySize, char *_contentType);
+
+/* as SendResponse_Binary for a malloc'd body the request takes over, it is
+   freed once sent (or if there already is a response) */
+void HTTPServerConnection_SendResponse_Take(HTTPServerConnection_Request *_Request,
                                        int _responseCode, uint8_t *_responseBody, size_t _responseBodySize, char *_contentType);
+/* as SendResponse_Binary for a shared blob (utilities/shared_blob.h): the
+   request holds a reference until it is sent, the caller keeps its own */
+void HTTPServerConnection_SendResponse_Ref(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, const uint8_t *_responseBody, size_t _responseBodySize, char *_contentType);
+
+/* _Encoding's variant of _Blob with its ETag, Last-Modified and
+   Content-Encoding lines, holding a reference until sent */
+void HTTPServerConnection_SendResponse_Blob(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, const response_blob *_Blob, compress_encoding _Encoding,
+                                       char *_contentType);
+
+/* as SendResponse_Binary for a body that is file _Fd from _FdOffset on,
+   mapped at _responseBody: over connections that can, the file is handed to
+   the kernel and no byte of it is copied in user space. _Fd has the lifetime
+   of the body. A GET's Range (and If-Range, against the validators set before)
+   is honoured with a 206 of that part, or a 416. */
+void HTTPServerConnection_SendResponse_File(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, const uint8_t *_responseBody, size_t _responseBodySize,
+                                       int _Fd, off_t _FdOffset, char *_contentType);
+
+/* the body is pulled from _Read a chunk at a time as the socket drains, so a
+   large body never has to be in memory. _Length -1 if unknown: the body is
+   sent chunked, to an HTTP/1.0 client until the connection closes. _Context
+   has the lifetime of a SendResponse_Binary body. */
+void HTTPServerConnection_SendResponse_Stream(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, char *_contentType, int64_t _Length,
+                                       HTTPServerConnection_StreamRead _Read, void *_Context);
+/* the stream has data again after returning HTTPServerConnection_STREAM_AGAIN */
+void HTTPServerConnection_ResumeStream(HTTPServerConnection_Request *_Request);
+
+/* a request header's value, NULL if it was not sent */
+const char *HTTPServerConnection_GetHeader(HTTPServerConnection_Request *_Request, const char *_Name, size_t *_Length);
+/* the same for one of the headers the parser indexes, see HTTPHeaderId */
+const char *HTTPServerConnection_GetKnownHeader(HTTPServerConnection_Request *_Request, HTTPHeaderId _Id, size_t *_Length);
+/* the request's If-None-Match and If-Modified-Since */
+void HTTPServerConnection_GetConditional(HTTPServerConnection_Request *_Request, http_conditional *_Conditional);
+/* a header line for the response, call before SendResponse. -1 if there
+   is no room left for it. */
+int HTTPServerConnection_AddHeader(HTTPServerConnection_Request *_Request, const char *_Name, const char *_Value);
+/* ETag and Last-Modified through AddHeader, _ETag NULL and _LastModified 0
+   to leave either out */
+void HTTPServerConnection_SetValidators(HTTPServerConnection_Request *_Request, const char *_ETag, time_t _LastModified);
+/* bodyless 304 carrying the validators */
+void HTTPServerConnection_SendNotModified(HTTPServerConnection_Request *_Request);
+
+/* the server hands over to another process: the requests in hand are
+   answered, the last with Connection: close, and an idle keep-alive
+   connection is closed once nothing is waiting in the socket */
+void HTTPServerConnection_Drain(HTTPServerConnection *_Connection);
+
+/* for HTTP2Connection, whose streams go through the same queue: a new
+   request at its tail (NULL if out of memory), handing a parsed one to
+   the handler, the next chunk of a streamed body (1 if there is one in
+   body, 0 to wait, -1 on error), a 504 in place of a late handler,
+   counting bytes written and releasing a request once its response is out */
+HTTPServerConnection_Request *HTTPServerConnection_QueueRequest(HTTPServerConnection *_Connection, uint64_t _MonTime);
+void HTTPServerConnection_DispatchRequest(HTTPServerConnection_Request *_Request);
+int HTTPServerConnection_FillStream(HTTPServerConnection_Request *_Request);
+void HTTPServerConnection_TimeOut(HTTPServerConnection_Request *_Request);
+/* when the handler of a request that got its turn at _From is late: the
+   handler timeout on, sooner if the client's deadline is */
+uint64_t HTTPServerConnection_HandlerDeadline(const HTTPServerConnection_Request *_Request, uint64_t _From);
+void HTTPServerConnection_CountSent(int _Bytes);
+void HTTPServerConnection_CompleteRequest(HTTPServerConnection_Request *_Request, int _Sent);
+
+void HTTPServerConnection_GetHandshakeStats(HTTPServerConnection_HandshakeStats *_Stats);
+/* open connections, responses by status class and bytes sent on /metrics,
+   once before the loops start */
+void HTTPServerConnection_RegisterMetrics(void);
 
 void HTTPServerConnection_Dispose(HTTPServerConnection *_Connection);
 void HTTPServerConnection_DisposePtr(HTTPServerConnection **_ConnectionPtr);
@@ -3,16 +3,27 @@
 #define __WeatherServer_h_
 
 #include "smw.h"
-#include "linked_list.h"
 #include "HTTPServer/HTTPServer.h"
 
 #include "WeatherServerInstance.h"
 
+#ifndef WeatherServer_POLL_INTERVAL_MS
+#define WeatherServer_POLL_INTERVAL_MS 1
+#endif
+
+/* the task is event driven: it only runs for instances that were woken
+   (request parsed, backend progressed, connection closed) and, while a
+   backend transfer has to be polled, every WeatherServer_POLL_INTERVAL_MS */
 typedef struct
 {
 	HTTPServer httpServer;
 
-	LinkedList* instances;
+	/* intrusive through WeatherServerInstance prev/next, newest last */
+	WeatherServerInstance* instances;
+	WeatherServerInstance* instancesTail;
+	/* instances to run on the next pass, through readyNext */
+	WeatherServerInstance* ready;
+	WeatherServerInstance* readyTail;
 
 	smw_task* task;
 
@@ -23,6 +34,10 @@ int WeatherServer_Initiate(WeatherServer* _Server, char *port);
 int WeatherServer_InitiatePtr(WeatherServer** _ServerPtr, char *port);
 
 
+/* stops accepting and lets every connection finish what it has in hand,
+   see HTTPServerConnection_Drain; instances runs empty as they close */
+void WeatherServer_Drain(WeatherServer* _Server);
+
 void WeatherServer_Dispose(WeatherServer* _Server);
 void WeatherServer_DisposePtr(WeatherServer** _ServerPtr);
 
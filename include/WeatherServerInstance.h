@@ -4,6 +4,64 @@
 
 #include "HTTPServer/HTTPServerConnection.h"
 #include "smw.h"
+#include "utilities/access_log.h"
+#include "utilities/arena.h"
+#include "utilities/compress.h"
+#include "utilities/metrics.h"
+#include "utilities/trace.h"
+
+#ifndef WeatherServerInstance_REQUEST_ARENA_SIZE
+#define WeatherServerInstance_REQUEST_ARENA_SIZE 4096
+#endif
+#ifndef WeatherServerInstance_SSE_HEARTBEAT_MS
+#define WeatherServerInstance_SSE_HEARTBEAT_MS 5000
+#endif
+#ifndef WeatherServerInstance_RETRY_AFTER_S
+#define WeatherServerInstance_RETRY_AFTER_S 1
+#endif
+/* per client address and loop, in tokens of one cheap request; 0 tokens a
+   second turns the quota off */
+#ifndef WeatherServerInstance_QUOTA_TOKENS_PER_SECOND
+#define WeatherServerInstance_QUOTA_TOKENS_PER_SECOND 100
+#endif
+#ifndef WeatherServerInstance_QUOTA_BURST
+#define WeatherServerInstance_QUOTA_BURST 1000
+#endif
+/* what a request costs on top of its token when it went upstream, and the
+   response bytes that cost one more */
+#ifndef WeatherServerInstance_QUOTA_FETCH_COST
+#define WeatherServerInstance_QUOTA_FETCH_COST 20
+#endif
+#ifndef WeatherServerInstance_QUOTA_BYTES_PER_TOKEN
+#define WeatherServerInstance_QUOTA_BYTES_PER_TOKEN (64 << 10)
+#endif
+/* the loop's cache of final bodies, for routes with WeatherServerCache_Micro */
+#ifndef WeatherServerInstance_MICRO_CACHE_ENTRIES
+#define WeatherServerInstance_MICRO_CACHE_ENTRIES 1024
+#endif
+#ifndef WeatherServerInstance_MICRO_CACHE_BYTES
+#define WeatherServerInstance_MICRO_CACHE_BYTES (8 << 20)
+#endif
+#ifndef WeatherServerInstance_MICRO_CACHE_TTL_S
+#define WeatherServerInstance_MICRO_CACHE_TTL_S 30
+#endif
+/* /getweatherbatch backends at once on a loop, each fetches up to a batch */
+#ifndef WeatherServerInstance_BATCH_CONCURRENCY
+#define WeatherServerInstance_BATCH_CONCURRENCY 32
+#endif
+/* /getlocationbatch backends at once on a loop, each runs up to
+   Geolocation_BATCH_PARALLEL searches */
+#ifndef WeatherServerInstance_LOCATION_BATCH_CONCURRENCY
+#define WeatherServerInstance_LOCATION_BATCH_CONCURRENCY 8
+#endif
+/* what /getweatherhistory covers without a from */
+#ifndef WeatherServerInstance_HISTORY_DAYS
+#define WeatherServerInstance_HISTORY_DAYS 7
+#endif
+/* longest --admin-token, the value of `Authorization: Bearer TOKEN` */
+#ifndef WeatherServerInstance_ADMIN_TOKEN_MAX
+#define WeatherServerInstance_ADMIN_TOKEN_MAX 256
+#endif
 
 typedef enum {
     WeatherServerInstance_State_Waiting,
@@ -15,29 +73,238 @@ typedef enum {
     WeatherServerInstance_State_This_Is_Actually_The_State_Where_We_Want_This_Struct_To_Be_Disposed
 } WeatherServerInstance_State;
 
+/* what WeatherServerInstance_Work leaves the instance waiting for */
+typedef enum {
+    WeatherServerInstance_Run_Wait,  /* parked until something wakes it */
+    WeatherServerInstance_Run_Again, /* more work right behind, run it on the next pass */
+    WeatherServerInstance_Run_Poll   /* a backend transfer nothing signals, run it again shortly */
+} WeatherServerInstance_Run;
+
+typedef struct WeatherServerRequest WeatherServerRequest;
+typedef struct WeatherServerBodyMemo WeatherServerBodyMemo;
+typedef struct WeatherServerInstance WeatherServerInstance;
+typedef struct WeatherServerSubscription WeatherServerSubscription;
+
+/* the instance has work to do, run it on the owner's next pass */
+typedef void (*WeatherServerInstance_OnWake)(void* _Context, WeatherServerInstance* _Instance);
+
+/* what a route's backend can do, the optional ones are NULL when it can't */
 typedef struct {
-    void* backend_struct;
-    int (*backend_get_buffer)(void** weatherbackend_struct, char** buffer);
-    int (*backend_get_buffer_size)(void** weatherbackend_struct, size_t* size);
-    int (*backend_work)(void** weatherbackend_struct);
-    int (*backend_dispose)(void** weatherbackend_struct);
+    int (*init)(void** ctx, void** backend_struct, void (*ondone)(void* context), void (*onwake)(void* context));
+    // BACKEND_WORK_AGAIN, _WAIT or _POLL, see backends/backend.h
+    int (*work)(void** backend_struct);
+    int (*dispose)(void** backend_struct);
+    int (*get_buffer)(void** backend_struct, char** buffer);
+    int (*get_buffer_size)(void** backend_struct, size_t* size);
+    // Set for backends whose body is streamed instead of handed over in one buffer,
+    // get_buffer_size gives its length (chunked without one). Such a backend
+    // may call on_done before its body is whole: work() keeps being called
+    // while the response is sent and read() says BACKEND_READ_AGAIN meanwhile
+    int (*read)(void** backend_struct, uint8_t* buffer, int size);
+    // ETag/Last-Modified of the body once done (NULL/0 if unknown). Returns 1 if the
+    // backend found the client's copy current and produced no body. Backends without one get
+    // an ETag hashed from their body.
+    int (*get_validators)(void** backend_struct, const char** etag, time_t* last_modified);
+    // Encoded body, when the backend keeps compressed variants of its own
+    compress_encoding (*get_encoded)(void** backend_struct, const uint8_t** data, size_t* length);
+    // A cached response to send as it is (its validator lines included) in
+    // place of the body, NULL when there is none
+    const response_blob* (*get_blob)(void** backend_struct, compress_encoding* encoding);
+    // Content type of the body when it varies per response (NULL for the route's)
+    const char* (*get_content_type)(void** backend_struct);
+    // Cache-Control for the response, NULL to send none
+    const char* (*get_cache_control)(void** backend_struct);
+    // When the body was made and until when it is fresh, and the surrogate
+    // key a CDN in front may purge it by: Cache-Control, Age and
+    // Surrogate-Key in place of get_cache_control. -1 to send none
+    int (*get_freshness)(void** backend_struct, time_t* stamp, time_t* expires, char* key, size_t size);
+    // Descriptor of a file holding body (whatever its encoding) from offset on,
+    // so it can be sent with sendfile, -1 when it isn't in one
+    int (*get_file)(void** backend_struct, const uint8_t* body, off_t* offset);
+    // Where the body came from, for the access log (ACCESS_CACHE_NONE without it)
+    access_cache (*get_cache_outcome)(void** backend_struct);
+    // The request's trace for the backend to stamp its cache and upstream
+    // phases on, only set for traced requests; it outlives the backend
+    void (*set_trace)(void** backend_struct, trace_context* trace);
+} WeatherServerBackendOps;
+
+/* where a route's bodies are cached */
+typedef enum {
+    WeatherServerCache_None,  /* made for every request */
+    WeatherServerCache_Own,   /* the backend keeps caches of its own */
+    WeatherServerCache_Micro  /* the server's micro-cache keeps them for ttl_s */
+} WeatherServerCachePolicy;
+
+/* what answering a request may take, cheapest first */
+typedef enum {
+    WeatherServerCost_Local,    /* memory of this process, never shed */
+    WeatherServerCost_Disk,     /* local files */
+    WeatherServerCost_Upstream, /* may fetch from an upstream */
+    WeatherServerCost_Peer      /* a node of the peer ring asking, its client was charged there */
+} WeatherServerCostClass;
+
+/* what the server may assume about a route, so caching, shedding, quotas
+   and limits treat every route the same way */
+typedef struct {
+    const char* content_type;
+    WeatherServerCachePolicy cache;
+    /* seconds a body stays in the micro-cache, WeatherServerCache_Micro only */
+    int ttl_s;
+    WeatherServerCostClass cost;
+    /* backends of the route running at once on a loop, past it a request
+       gets a 503; 0 for no limit */
+    int max_concurrency;
+    /* the body is produced while it is sent (ops->read, event streams) */
+    int streaming;
+} WeatherServerRouteDescriptor;
+
+/* one entry of the route table, matched on the path ignoring case */
+typedef struct {
+    const char* path;
+    /* sets up _Request's backend (init included) from its params, 0 to run
+       it and 1 if a response is queued already (errors, routes without a
+       backend) */
+    int (*setup)(WeatherServerRequest* _Request);
+    const WeatherServerBackendOps* ops;
+    const WeatherServerRouteDescriptor* descriptor;
+    /* the body is a buffer of get_buffer_size bytes rather than a string */
     int binary_mode;
-} WeatherServerBackend;
+    /* the body is compressed when the client accepts it */
+    int negotiate_encoding;
+    // smw stats class the backend steps are accounted under
+    const char* name;
+    /* what the access log records it as */
+    access_log_route access;
+    /* answered from TLS 1.3 0-RTT data, a replay of it changes nothing;
+       the others get a 425 and the client asks again after its handshake */
+    int early_data;
+    /* a body already in memory, sent from the request callback without
+       waiting for the loop's next pass; 1 if it answered, NULL for routes
+       that always need setup */
+    int (*answer)(WeatherServerRequest* _Request);
+    /* the JSON body goes out as CBOR to clients whose Accept prefers it */
+    int negotiate_format;
+} WeatherServerRoute;
 
+/* the query, parsed once when the request arrives. Strings are copies in
+   the request arena, NULL (and has_location 0) for what was not sent. */
 typedef struct {
-    HTTPServerConnection* connection;
+    HTTPStringView path;
+    double latitude;
+    double longitude;
+    int has_location;
+    const char* name;
+    // A city of the registry, for routes that take a location
+    const char* city;
+    const char* country_code;
+    int count; // -1 if not sent
+    int reset;
+    const char* mode;
+    // A projection of the forecast, set the weather_fields_parse set of it
+    // (0 if the list is not one)
+    const char* fields;
+    uint32_t field_set;
+    // A time range, as sent
+    const char* from;
+    const char* to;
+    // "small" for a thumbnail of a surprise
+    const char* size;
+    // The ETag or Last-Modified of the forecast a polling client has, for a
+    // delta from it
+    const char* since;
+} WeatherServerRequestParams;
+
+typedef struct {
+    void* backend_struct;
+    /* the route's, NULL until it is set up */
+    const WeatherServerRoute* route;
+    // For routes whose body only changes with a restart, see WeatherServerBodyMemo
+    WeatherServerBodyMemo* memo;
+} WeatherServerBackend;
+
+/* the last body a route produced on this thread, with the ETag of every
+   encoding served so far and the compressed variants, so they are made
+   once per thread and revalidations are answered before a backend runs */
+struct WeatherServerBodyMemo {
+    char etag[HTTP_ETAG_SIZE];
+    char etags[COMPRESS_ENCODINGS][HTTP_ETAG_SIZE];
+    uint8_t* variants[COMPRESS_ENCODINGS];
+    size_t lengths[COMPRESS_ENCODINGS];
+};
+
+/* one pipelined request and the backend answering it, lives until its
+   response has been sent */
+struct WeatherServerRequest {
+    WeatherServerInstance* instance;
+    HTTPServerConnection_Request* request;
     WeatherServerInstance_State state;
 
     WeatherServerBackend backend;
+    WeatherServerRequestParams params;
+    /* the client's cached copy, and the ETag hashed from our body */
+    http_conditional conditional;
+    char etag[HTTP_ETAG_SIZE];
+    /* what the client accepts, identity on routes that don't negotiate */
+    compress_encoding encoding;
+    /* the client prefers application/cbor, on routes that negotiate it */
+    int cbor;
+    /* scratch memory until the response is sent, kept across pooled reuses */
+    arena arena;
+    /* when the request came in, for the route's latency */
+    uint64_t started_ns;
+    /* how long it waited to be started, cache misses are shed on it */
+    uint64_t queued_ms;
+    /* how far /metrics got, in the arena */
+    metrics_cursor* metrics;
+    /* a /subscribeweather stream, in the arena */
+    WeatherServerSubscription* subscription;
+    /* where a body answered before any backend came from, else the backend's */
+    access_cache cache;
+    /* the route's answer found nothing in memory, setup need not look again */
+    int hot_missed;
+    /* its micro-cache key, 0 if the route is not micro-cached */
+    uint64_t micro_key;
+    /* holds one of its route's max_concurrency slots */
+    int admitted;
+
+    WeatherServerRequest* next;
+};
+
+struct WeatherServerInstance {
+    HTTPServerConnection* connection;
+    WeatherServerInstance_State state;
+
+    /* requests being answered on this connection, oldest first */
+    WeatherServerRequest* requests;
+
+    /* woken when a request arrived, a backend progressed or the connection closed */
+    void* context;
+    WeatherServerInstance_OnWake onWake;
 
-} WeatherServerInstance;
+    /* links in the owning WeatherServer's instance list */
+    WeatherServerInstance* prev;
+    WeatherServerInstance* next;
+    /* on the owner's run queue, see WeatherServer */
+    int queued;
+    WeatherServerInstance* readyNext;
+};
 
-int WeatherServerInstance_Initiate(WeatherServerInstance* _Instance, HTTPServerConnection* _Connection);
-int WeatherServerInstance_InitiatePtr(HTTPServerConnection* _Connection, WeatherServerInstance** _InstancePtr);
+int WeatherServerInstance_Initiate(WeatherServerInstance* _Instance, HTTPServerConnection* _Connection, void* _Context,
+                                   WeatherServerInstance_OnWake _OnWake);
+int WeatherServerInstance_InitiatePtr(HTTPServerConnection* _Connection, void* _Context,
+                                      WeatherServerInstance_OnWake _OnWake, WeatherServerInstance** _InstancePtr);
 
-void WeatherServerInstance_Work(WeatherServerInstance* _Instance, uint64_t _MonTime);
+WeatherServerInstance_Run WeatherServerInstance_Work(WeatherServerInstance* _Instance, uint64_t _MonTime);
 
 void WeatherServerInstance_Dispose(WeatherServerInstance* _Instance);
+/* builds the route table and registers the metrics, once before any worker starts */
+int WeatherServerInstance_GlobalInit(void);
+/* TOKEN, or @FILE holding it: the operator routes then answer the clients that
+   present it, from wherever they are, instead of the clients on this host. -1
+   if it is empty, too long or not one header token. Before any worker starts */
+int WeatherServerInstance_SetAdminToken(const char* _Token);
+/* per thread state (body memos), once the thread's instances are gone */
+void WeatherServerInstance_ReleaseThread(void);
 void WeatherServerInstance_DisposePtr(WeatherServerInstance** _InstancePtr);
 
 #endif //__WeatherServerInstance_h_
\ No newline at end of file
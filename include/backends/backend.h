@@ -0,0 +1,19 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+/*
+ * What a backend's work() step leaves it waiting for, the server only steps
+ * it again when asked to: right away, on its next poll, or once the backend
+ * called on_wake (a job finished) or on_done.
+ */
+
+#define BACKEND_WORK_AGAIN 0
+#define BACKEND_WORK_WAIT 1
+// A transfer is in flight that nothing signals, step again on the next poll
+#define BACKEND_WORK_POLL 2
+
+// read() of a streamed body has nothing yet, the server asks again once
+// work() ran (HTTPServerConnection_STREAM_AGAIN)
+#define BACKEND_READ_AGAIN -2
+
+#endif
@@ -1,13 +1,26 @@
 #ifndef _CITIES_H
 #define _CITIES_H
 
+#include <time.h>
+
+#include "backends/backend.h"
 #include "linked_list.h"
+#include "utilities/compress.h"
+#include "utilities/http_validators.h"
+#include "utilities/job_pool.h"
+#include "global_defines.h"
+
+// Every known city in one file, replaced by a rename and only when the list changed
+#ifndef Cities_STORE_PATH
+#define Cities_STORE_PATH Cities_CACHE_DIR "/cities.json"
+#endif
 
 typedef enum {
     Cities_State_Init,
     Cities_State_ReadFiles,
     Cities_State_ReadString,
     Cities_State_SaveToDisk,
+    Cities_State_Wait,
     Cities_State_Convert,
     Cities_State_Done
 } cities_state;
@@ -15,11 +28,17 @@ typedef enum {
 typedef struct cities_t {
     void* ctx;
     void (*on_done)(void* ctx);
+    // A job finished, work() wants to run again
+    void (*on_wake)(void* ctx);
 
     LinkedList* cities_list;
     cities_state state;
     char* buffer;
     int bytesread;
+    // Disk job in flight, NULL when none
+    job_pool_job* job;
+    // The list has cities the store file does not
+    int dirty;
 } cities_t;
 
 typedef struct city_t {
@@ -28,9 +47,70 @@ typedef struct city_t {
     float longitude;
 } city_t;
 
-int cities_init(void** ctx, void** ctx_struct, void (*ondone)(void* context));
+/*
+ * The /GetCities response, built once at startup (and on a reload) and never
+ * changed afterwards: the body in every encoding a client may take and the
+ * ETag of each, so a request is answered by pointing at it. A reload
+ * publishes a new snapshot through utilities/epoch.h and the superseded one
+ * is freed once no loop can be reading it. The bodies are shared blobs, a
+ * response still being sent holds its own reference.
+ */
+typedef struct cities_snapshot {
+    // Shared blobs, NULL for encodings not worth it (small bodies) or that
+    // failed. Identity is NUL terminated.
+    uint8_t* bodies[COMPRESS_ENCODINGS];
+    size_t lengths[COMPRESS_ENCODINGS];
+    char etags[COMPRESS_ENCODINGS][HTTP_ETAG_SIZE];
+    time_t last_modified;
+    // The identity body as CBOR (cbor_from_json) for clients asking for it,
+    // a shared blob; NULL if it could not be made
+    uint8_t* cbor;
+    size_t cbor_length;
+    char cbor_etag[HTTP_ETAG_SIZE];
+
+    // The registry: every city of the body, found by normalized name
+    struct cities_entry* entries;
+    int entry_count;
+    int32_t* index; // open addressing, -1 for empty slots
+    uint32_t index_mask;
+} cities_snapshot;
+
+typedef struct cities_entry {
+    char* name;
+    char* key; // see cities_normalize
+    uint64_t hash;
+    double latitude;
+    double longitude;
+} cities_entry;
+
+// Builds and publishes a new snapshot (blocking, reads the cache folder)
+int cities_reload(void);
+// The current snapshot, NULL until one was built. Valid until the end of
+// the calling loop's pass.
+const cities_snapshot* cities_current(void);
+// The url_codec_key of a name (so "MALMÖ" is "malmö"), a query value
+// comes decoded already; size includes the NUL
+void cities_normalize(const char* name, char* key, size_t size);
+// 0 and the city's location if the registry knows name, -1 otherwise
+int cities_find(const char* name, double* latitude, double* longitude);
+
+// A city of the list from its name and coordinate strings, and its disposer for the list
+int city_init(const char* _Name, const char* _Latitude, const char* _Longitude, city_t** _CityPtr);
+void city_dispose(void* _cityPtr);
+// The list into cities->buffer as the /GetCities JSON (also from tools/backend_bench)
+int cities_convert_to_char_json_buffer(cities_t* cities);
+
+int cities_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
 int cities_get_buffer(void** ctx, char** buffer);
 int cities_work(void** ctx);
 int cities_dispose(void** ctx);
 
+// Builds the snapshot unless there is one already
+int cities_warmup(void);
+// The locations of the built in city list, returns how many were written
+int cities_locations(double* latitudes, double* longitudes, int max);
+// Calls visit for every city of the registry (the built in list until one is built)
+void cities_each(void (*visit)(const char* name, double latitude, double longitude, void* context), void* context);
+void cities_global_dispose(void);
+
 #endif
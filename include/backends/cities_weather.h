@@ -0,0 +1,35 @@
+#ifndef CITIES_WEATHER_H
+#define CITIES_WEATHER_H
+
+#include "backends/weather.h"
+#include "utilities/compress.h"
+#include "global_defines.h"
+
+// Cities of the registry the bundle takes, the first ones if it has more
+#ifndef CitiesWeather_MAX_CITIES
+#define CitiesWeather_MAX_CITIES 64
+#endif
+
+/*
+ * The /GetCitiesWeather body: every city of the registry with its forecast,
+ * [{"name", "latitude", "longitude", "weather": as /GetWeather sends it or
+ * null}], in one response blob per loop with its ETag and every encoding
+ * compressed once. The loop follows each city's location like a subscriber
+ * (weather_subscribe), so the refresher keeps them current and every newer
+ * forecast reaching the loop rebuilds the bundle, at most once a pass. A
+ * request points at the blob, a rebuild leaves the responses still sending
+ * the old one their reference.
+ *
+ * Per loop, like the hot cache it is built from.
+ */
+
+// The bundle in encoding, or identity if it has no such variant; 0 and hit
+// filled in (borrowed for the pass), -1 if it cannot be built. stale is
+// set while one of its forecasts is past its TTL.
+int cities_weather_lookup(compress_encoding encoding, weather_hot_hit* hit);
+// Before the loops start
+void cities_weather_register_metrics(void);
+// Before weather_release_thread, the loop stops following the cities
+void cities_weather_release_thread(void);
+
+#endif
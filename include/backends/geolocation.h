@@ -2,23 +2,82 @@
 #define GEOLOCATION_H
 
 #include <jansson.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "utilities/curl_client.h"
-
-#define METEO_GEOLOCATION_URL "https://geocoding-api.open-meteo.com/v1/search?name=%s&count=%d&language=en&format=json"
+#include "backends/backend.h"
+#include "global_defines.h"
+#include "utilities/access_log.h"
+#include "utilities/heavy_hitters.h"
+#include "utilities/job_pool.h"
+#include "utilities/json_arena.h"
+#include "utilities/json_scan.h"
+#include "utilities/single_flight.h"
+#include "utilities/trace.h"
+
+/*
+ * Search results are kept per normalized (name, count, country) query, in
+ * memory per loop in front of one store file shared by all. Places do not
+ * move, results are kept for a long time; a search with no results is kept
+ * too (as []) but for less long, it may be a name the upstream learns.
+ */
+
+#ifndef Geolocation_CACHE_DIR
+#define Geolocation_CACHE_DIR "cache/geolocation"
+#endif
+#ifndef Geolocation_STORE_PATH
+#define Geolocation_STORE_PATH Geolocation_CACHE_DIR "/geolocation.store"
+#endif
+#ifndef Geolocation_STORE_CAPACITY
+#define Geolocation_STORE_CAPACITY (16 << 20)
+#endif
+#ifndef Geolocation_CACHE_TTL_SECONDS
+#define Geolocation_CACHE_TTL_SECONDS (30 * 24 * 3600)
+#endif
+#ifndef Geolocation_NEGATIVE_TTL_SECONDS
+#define Geolocation_NEGATIVE_TTL_SECONDS (24 * 3600)
+#endif
+#ifndef Geolocation_HOT_CACHE_ENTRIES
+#define Geolocation_HOT_CACHE_ENTRIES 256
+#endif
+#ifndef Geolocation_HOT_CACHE_BYTES
+#define Geolocation_HOT_CACHE_BYTES (2 << 20)
+#endif
+// Table of geolocation_open_shared and the largest value it keeps
+#ifndef Geolocation_SHARED_ENTRIES
+#define Geolocation_SHARED_ENTRIES 4096
+#endif
+#ifndef Geolocation_SHARED_VALUE_SIZE
+#define Geolocation_SHARED_VALUE_SIZE (8 << 10)
+#endif
+// Counters per row of each loop's heavy hitter sketch of searches
+#ifndef Geolocation_HEAVY_HITTERS_WIDTH
+#define Geolocation_HEAVY_HITTERS_WIDTH 4096
+#endif
+// Top results of a search whose forecasts are fetched in the background,
+// the client asks for the first one's next (0 turns it off)
+#ifndef Geolocation_PREFETCH_WEATHER
+#define Geolocation_PREFETCH_WEATHER 1
+#endif
+
+// Geocoding API base, --upstream= replaces it at runtime (tools/mock_meteo)
+#ifndef METEO_GEOLOCATION_API_URL
+#define METEO_GEOLOCATION_API_URL "https://geocoding-api.open-meteo.com/v1/"
+#endif
+#define METEO_GEOLOCATION_API_URL_SIZE 256
+// Behind the base, geolocation_api_url() first
+#define METEO_GEOLOCATION_URL "%ssearch?name=%s&count=%d&language=en&format=json"
 
 typedef enum {
     GeoLocation_State_Init,
-    // GeoLocation_State_LoadFromDisk,
+    GeoLocation_State_LoadFromDisk,
     GeoLocation_State_FetchFromAPI_Init,
-    GeoLocation_State_FetchFromAPI_Request,
     GeoLocation_State_FetchFromAPI_Poll,
     GeoLocation_State_FetchFromAPI_Read,
     GeoLocation_State_ProcessResponse,
-    // GeoLocation_State_SaveToDisk,
+    GeoLocation_State_SaveToDisk,
     GeoLocation_State_Done
 } geolocation_state;
 
@@ -52,8 +111,14 @@ typedef struct location_t {
 typedef struct geolocation_t {
     void* ctx;
     void (*on_done)(void* ctx);
+    void (*on_wake)(void* ctx);
+
+    single_flight_waiter flight;
+    job_pool_job* job;
 
-    curl_client* curl_client;
+    // The normalized query, its hash keys both cache tiers
+    char* query;
+    uint64_t key;
 
     char* location_name;
     int location_count;
@@ -62,18 +127,53 @@ typedef struct geolocation_t {
     geolocation_state state;
     char* buffer;
     int bytesread;
+    // What jansson builds for this search, released when it is disposed
+    arena arena;
+    // Where the results came from, for the access log
+    access_cache cache;
+    // The request's trace when it has one, see geolocation_set_trace
+    trace_context* trace;
+    // Results whose forecasts are prefetched once it is done
+    int prefetch;
 } geolocation_t;
 
+// Process wide result store, open before the loops start
+int geolocation_global_init(void);
+void geolocation_global_dispose(void);
+// The base the search URL starts with, as weather_set_api_url
+const char* geolocation_api_url(void);
+int geolocation_set_api_url(const char* base);
+// The calling loop's result cache
+void geolocation_release_thread(void);
+// Before workers_prefork: new results go to a table in shared memory
+// (utilities/shm_table.h) every worker process reads, asked before the
+// store file, which is only read from then on
+int geolocation_open_shared(void);
+// The up to max searches made most lately on all loops, hottest first,
+// labelled with the normalized query (name|count|country)
+int geolocation_heavy_hitters(heavy_hitters_entry* out, int max);
+// Hot restart, as weather_handoff_freeze, weather_handoff_keys (newest
+// first) and weather_warmup_keys
+void geolocation_handoff_freeze(int frozen);
+int geolocation_handoff_keys(uint64_t* keys, int max);
+int geolocation_warmup_keys(const uint64_t* keys, int count);
+
 // Server functions
 int geolocation_set_parameters(void** ctx, char* location_name, int location_count, char* country_code);
+// Results whose forecasts are prefetched, Geolocation_PREFETCH_WEATHER unless set
+int geolocation_set_prefetch(void** ctx, int results);
 
-int geolocation_init(void** ctx, void** ctx_struct, void (*on_done)(void* context));
+int geolocation_init(void** ctx, void** ctx_struct, void (*on_done)(void* context), void (*onwake)(void* context));
 int geolocation_work(void** ctx);
 int geolocation_get_buffer(void** ctx, char** buffer);
+// Memory, the local datasets, disk, fetched or coalesced with another search
+access_cache geolocation_get_cache_outcome(void** ctx);
+// Stamps the cache lookups and the upstream fetch on trace, which outlives the backend
+void geolocation_set_trace(void** ctx, trace_context* trace);
 int geolocation_dispose(void** ctx);
 
 // Internal parsing functions
-int parse_openmeteo_geo_json_to_location(const json_t* json_obj, location_t* location);
+int parse_openmeteo_geo_json_to_location(json_scan* scan, location_t* location);
 int serialize_location_to_json(const location_t* location, json_t** json_obj);
 void free_location(location_t* location);
 
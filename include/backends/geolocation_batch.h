@@ -0,0 +1,88 @@
+#ifndef GEOLOCATION_BATCH_H
+#define GEOLOCATION_BATCH_H
+
+#include <stddef.h>
+
+#include "backends/backend.h"
+#include "backends/geolocation.h"
+#include "utilities/trace.h"
+
+// Names one request may carry; the query has to fit a URL
+#ifndef Geolocation_BATCH_MAX_NAMES
+#define Geolocation_BATCH_MAX_NAMES 64
+#endif
+// Searches of one batch running at once, the rest start as they finish
+#ifndef Geolocation_BATCH_PARALLEL
+#define Geolocation_BATCH_PARALLEL 8
+#endif
+
+/*
+ * The searches of many names in one response, streamed as newline
+ * delimited JSON: a line {"index": its position in the request, "name",
+ * "results": what /GetLocation sends for it, or null} for each name as soon
+ * as it is answered, in the order they are. Every name runs a search
+ * backend of its own (geolocation.h) through the same caches and local
+ * datasets, so only the misses go upstream; those share the loop's curl
+ * multi and its per host queue and request budget, and a name another
+ * request is fetching already waits for that fetch.
+ *
+ * The response begins as soon as the batch starts, the server keeps
+ * running work() while it is being sent and read() hands out the lines
+ * finished so far.
+ */
+
+typedef enum {
+    GeolocationBatch_State_Init,
+    GeolocationBatch_State_Running,
+    GeolocationBatch_State_Done
+} geolocation_batch_state;
+
+typedef struct geolocation_batch_t geolocation_batch_t;
+
+typedef struct {
+    geolocation_batch_t* batch;
+    // The search running in the slot, NULL when it is free
+    void* geolocation;
+    int index;
+    // Its on_done came, the results are there to take
+    int done;
+} geolocation_batch_search;
+
+struct geolocation_batch_t {
+    void* ctx;
+    void (*on_done)(void* ctx);
+    void (*on_wake)(void* ctx);
+
+    geolocation_batch_state state;
+    char* names[Geolocation_BATCH_MAX_NAMES];
+    int count;
+    int location_count;
+    char* country_code;
+    // The first name not started, and the names answered so far
+    int next;
+    int finished;
+    geolocation_batch_search searches[Geolocation_BATCH_PARALLEL];
+
+    // Lines not read yet, from offset
+    char* pending;
+    size_t pending_length;
+    size_t pending_capacity;
+    size_t pending_offset;
+
+    trace_context* trace;
+};
+
+int geolocation_batch_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
+// Before the first work(): results per name and the country they are
+// limited to (NULL for any), then up to Geolocation_BATCH_MAX_NAMES names
+// (decoded, the batch takes copies)
+int geolocation_batch_set_parameters(void** ctx, int location_count, const char* country_code);
+int geolocation_batch_add_name(void** ctx, const char* name, size_t length);
+int geolocation_batch_work(void** ctx);
+// The next lines, 0 once every name was sent, BACKEND_READ_AGAIN while the
+// ones left are still being searched
+int geolocation_batch_read(void** ctx, uint8_t* buffer, int size);
+void geolocation_batch_set_trace(void** ctx, trace_context* trace);
+int geolocation_batch_dispose(void** ctx);
+
+#endif
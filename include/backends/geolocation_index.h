@@ -0,0 +1,54 @@
+#ifndef GEOLOCATION_INDEX_H
+#define GEOLOCATION_INDEX_H
+
+#include "global_defines.h"
+
+#ifndef Geolocation_INDEX_MAX_ENTRIES
+#define Geolocation_INDEX_MAX_ENTRIES 500000
+#endif
+// Places one search returns at most, the upstream's own limit
+#ifndef Geolocation_INDEX_MAX_RESULTS
+#define Geolocation_INDEX_MAX_RESULTS 100
+#endif
+// A search no name starts with is answered with the names within this many
+// edits of it, and at most 100 - MIN_CONFIDENCE percent of its letters
+#ifndef Geolocation_FUZZY_MAX_EDITS
+#define Geolocation_FUZZY_MAX_EDITS 2
+#endif
+#ifndef Geolocation_FUZZY_MIN_CONFIDENCE
+#define Geolocation_FUZZY_MIN_CONFIDENCE 80
+#endif
+// Names sharing trigrams with a search that are checked at most
+#ifndef Geolocation_FUZZY_MAX_CANDIDATES
+#define Geolocation_FUZZY_MAX_CANDIDATES 65536
+#endif
+
+/*
+ * Prefix index over place names for type-ahead searches: one sorted array
+ * of lower cased names, a search binary searches the first name with the
+ * prefix and keeps the most populous of the run that follows.
+ *
+ * Fed by every geocoding result the server sees and, optionally, a GeoNames
+ * dump loaded at startup. A prefix counts as covered, and is answered here
+ * without the upstream, once a dump is loaded or when the index holds at
+ * least as many matches as were asked for.
+ *
+ * The dump's names also get a trigram index (utilities/trigram_index.h): a
+ * search no name starts with, "stokholm", is answered with the names close
+ * enough to it, fewest edits then most populous first, and does not go to
+ * the upstream either.
+ *
+ * Process wide, searches share a read lock.
+ */
+
+// Loads a GeoNames cities file (tab separated, e.g. cities15000.txt), the
+// number of places or -1; call before the loops start
+int geolocation_index_load_geonames(const char* path);
+// Adds the locations of a client JSON array (our /getlocation body)
+void geolocation_index_add_results(const char* body);
+// 0 and a malloc'd JSON array of at most count places in *body if the
+// prefix is covered, -1 to ask the upstream; country_code may be NULL
+int geolocation_index_search(const char* prefix, int count, const char* country_code, char** body);
+void geolocation_index_dispose(void);
+
+#endif
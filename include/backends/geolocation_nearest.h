@@ -0,0 +1,40 @@
+#ifndef GEOLOCATION_NEAREST_H
+#define GEOLOCATION_NEAREST_H
+
+#include "global_defines.h"
+
+// Places added since the tree was built are scanned one by one, the tree is
+// rebuilt once there are this many of them (or an eighth of the tree)
+#ifndef Geolocation_NEAREST_PENDING_MAX
+#define Geolocation_NEAREST_PENDING_MAX 256
+#endif
+
+/*
+ * Reverse geocoding: the nearest known place to a coordinate. Places are
+ * points on the unit sphere in a 3-d tree, so the nearest by chord is the
+ * nearest by great circle and nothing special happens at the poles or the
+ * antimeridian. A lookup takes O(log n) and never leaves the process.
+ *
+ * Fed with the built in city list, every place the prefix index learns and
+ * the GeoNames dump when one is loaded. Process wide, lookups share a read
+ * lock.
+ */
+
+typedef struct {
+    int id;            // GeoNames id, 0 for the built in cities
+    char name[128];
+    char country_code[4];
+    double latitude;
+    double longitude;
+    double distance_km;
+} geolocation_nearest_place;
+
+void geolocation_nearest_add(int id, const char* name, const char* country_code, double latitude, double longitude);
+// Adds in bulk (a dump) without rebuilding in between, the tree is built
+// when it is turned off
+void geolocation_nearest_bulk(int on);
+// 0 and the nearest place in *place, -1 when nothing is known yet
+int geolocation_nearest_find(double latitude, double longitude, geolocation_nearest_place* place);
+void geolocation_nearest_dispose(void);
+
+#endif
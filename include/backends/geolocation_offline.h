@@ -0,0 +1,93 @@
+#ifndef GEOLOCATION_OFFLINE_H
+#define GEOLOCATION_OFFLINE_H
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Offline geocoding from a GeoNames dataset packed by tools/geonames_pack.c.
+ * The file is mapped read only and used as it is, opening it parses nothing:
+ *
+ *   header | places | names | buckets | strings
+ *
+ * Places are sorted by population, most populous first. Every place has a
+ * name entry per distinct normalized name (name and ASCII name), chained
+ * from a bucket of the name's hash in place order, so the first matches of
+ * a chain are the ones to answer with. Strings are NUL terminated, offset
+ * 0 is the empty string.
+ *
+ * Process wide, searches only read the mapping.
+ */
+
+#define Geolocation_OFFLINE_MAGIC "WGEOPK01"
+#define Geolocation_OFFLINE_NONE UINT32_MAX
+
+typedef struct {
+    char magic[8];
+    uint32_t place_count;
+    uint32_t name_count;
+    uint32_t bucket_count; // a power of two
+    uint32_t reserved;
+    uint64_t places_offset;
+    uint64_t names_offset;
+    uint64_t buckets_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} geolocation_offline_header;
+
+typedef struct {
+    double latitude;
+    double longitude;
+    double elevation;
+    uint32_t id;
+    int32_t population;
+    uint32_t name;
+    uint32_t feature_code;
+    uint32_t timezone;
+    char country_code[4];
+} geolocation_offline_place;
+
+typedef struct {
+    uint32_t key;   // the normalized name
+    uint32_t place;
+    uint32_t next;  // Geolocation_OFFLINE_NONE ends the chain
+} geolocation_offline_name;
+
+// Lower case, trimmed and runs of blanks as one space; the packer and the
+// server have to agree on it
+static inline void geolocation_offline_key(const char* name, char* key, size_t size) {
+    size_t length = 0;
+    int blank = 0;
+    for (const unsigned char* p = (const unsigned char*)name; *p && length + 2 < size; p++) {
+        if (isspace(*p)) {
+            blank = length > 0;
+            continue;
+        }
+        if (blank) key[length++] = ' ';
+        blank = 0;
+        key[length++] = (char)tolower(*p);
+    }
+    key[length] = '\0';
+}
+
+static inline uint32_t geolocation_offline_hash(const char* key) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Maps a packed dataset, -1 if it cannot be read or is not one; call before
+// the loops start
+int geolocation_offline_open(const char* path);
+// 0 and a malloc'd JSON array (the /getlocation shape) of at most count
+// places named name in *body, -1 when the dataset has none or is not open;
+// country_code may be NULL
+int geolocation_offline_search(const char* name, int count, const char* country_code, char** body);
+void geolocation_offline_close(void);
+
+#endif
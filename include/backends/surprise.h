@@ -3,30 +3,142 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+#include "backends/backend.h"
 #include "tinydir.h"
+#include "utilities/http_validators.h"
+
+// How long a file asked for by name may be cached, in seconds. A literal, it
+// is spelled into the Cache-Control header
+#ifndef Surprise_MAX_AGE
+#define Surprise_MAX_AGE 86400
+#endif
+
+// Smaller encodings of the files of Surprise_FOLDER
+#ifndef Surprise_VARIANTS_FOLDER
+#define Surprise_VARIANTS_FOLDER Surprise_FOLDER "variants/"
+#endif
+// Thumbnails of the files, written by `make surprise-variants`, fit this box
+#ifndef Surprise_SMALL_SIZE
+#define Surprise_SMALL_SIZE 160
+#endif
+
+// Formats a client takes besides the originals', from its Accept header
+#define SURPRISE_ACCEPT_WEBP 0x1
+#define SURPRISE_ACCEPT_AVIF 0x2
 
 typedef enum {
     Surprise_State_Init,
-    Surprise_State_Load_From_Disk,
+    Surprise_State_Pick,
     Surprise_State_Done
 } surprise_state;
 
+typedef struct surprise_asset surprise_asset;
+typedef struct surprise_assets surprise_assets;
+
 typedef struct surprise_t {
     void* ctx;
     void (*on_done)(void* ctx);
+    // A job finished, work() wants to run again
+    void (*on_wake)(void* ctx);
 
     surprise_state state;
-    uint8_t* buffer;
-    int bytesread;
+    // The picked file, NULL if the folder had none, and the table it is
+    // from, referenced until dispose as the response is sent from it
+    const surprise_asset* asset;
+    const surprise_assets* assets;
+    // ETag of the file a resumed download wants again, "" for a random one
+    char resume[HTTP_ETAG_SIZE];
+    // The file was asked for by name, its URL always gives the same bytes
+    int named;
+    // What the picked file is sent as: SURPRISE_ACCEPT_* the client takes
+    // and whether it asked for a thumbnail
+    unsigned accepts;
+    int small;
 } surprise_t;
 
-int surprise_init(void** ctx, void** ctx_struct, void (*ondone)(void* context));
+/*
+ * The files of the surprise folder, mapped once at startup and again when
+ * the folder changes (see watcher.h), with everything a response needs
+ * worked out up front, so a request only picks an entry and sends it from
+ * the mapping. A rebuild publishes a new table through utilities/epoch.h,
+ * a superseded one (and its mappings) goes once no loop can be reading it
+ * and the responses still sending from it let go of their references.
+ * Served files are replaced, not edited in place.
+ *
+ * The variants/ subfolder holds smaller encodings of the files, made
+ * offline by `make surprise-variants` with whatever encoders are installed:
+ * <file>.<ext> the whole picture in another format (bonzi.gif.webp) and
+ * <file>.small.<ext> a thumbnail (bonzi.gif.small.gif). They are mapped
+ * with the files and hang off the one they were made from; a response
+ * sends the smallest the client can take, the file itself otherwise.
+ */
+struct surprise_asset {
+  char name[_TINYDIR_FILENAME_MAX];
+  const uint8_t* data; // read only mapping of the whole file
+  int fd; // kept open for sendfile
+  size_t size;
+  time_t mtime;
+  const char* content_type;
+  char etag[HTTP_ETAG_SIZE];
+  // SURPRISE_ACCEPT_* a client needs for this encoding, 0 for the originals'
+  unsigned format;
+  int small; // a thumbnail
+  // of an original, its variants in the table's variants
+  int first_variant;
+  int variant_count;
+};
+
+struct surprise_assets {
+  surprise_asset* assets;
+  int count;
+  surprise_asset* variants;
+  int variant_count;
+  // the publication's and one per surprise_t sending from it
+  int references;
+};
+
+// Maps the folder and publishes the result (blocking), -1 if it cannot be read
+int surprise_reload(void);
+// The current table, NULL until one was built. Valid until the end of the
+// calling loop's pass.
+const surprise_assets* surprise_current(void);
+// A random entry of index, NULL if it is empty or NULL itself
+const surprise_asset* surprise_pick(const surprise_assets* index);
+// The entry with this ETag, NULL if index has none
+const surprise_asset* surprise_find(const surprise_assets* index, const char* etag, size_t length);
+// The entry for a file name, NULL if index has none
+const surprise_asset* surprise_find_name(const surprise_assets* index, const char* name);
+// What asset (an original of index) is best sent as: the smallest of it and
+// its variants in a format of accepts, among the thumbnails if small and
+// there are any
+const surprise_asset* surprise_variant(const surprise_assets* index, const surprise_asset* asset, unsigned accepts,
+                                       int small);
+// The SURPRISE_ACCEPT_* an Accept header names with a quality above 0;
+// wildcards do not count, a client that says */* may not decode them
+unsigned surprise_accepts(const char* accept, size_t length);
+void surprise_global_dispose(void);
+
+int surprise_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
 int surprise_get_buffer(void** ctx, char** buffer);
 int surprise_get_buffer_size(void** ctx, size_t* size);
+// ETag and Last-Modified of the picked file, always 0: the client's copy is checked by the caller
+int surprise_get_validators(void** ctx, const char** etag, time_t* last_modified);
+const char* surprise_get_content_type(void** ctx);
+// The picked file's descriptor when body is its contents (from offset 0)
+int surprise_get_file(void** ctx, const uint8_t* body, off_t* offset);
+// Cache-Control of the response: a named file is cached for Surprise_MAX_AGE,
+// a random pick is revalidated every time since the next may differ
+const char* surprise_get_cache_control(void** ctx);
+// Sends the named file instead of a random one, -1 if there is no such file
+int surprise_set_name(void** ctx, const char* name);
+// If-Range of the request: the file it names is sent instead of a random one
+// while the table still has it, so the range continues the same download
+int surprise_set_resume(void** ctx, const char* etag, size_t length);
+// Sends the picked file as the best variant for the client (surprise_variant)
+int surprise_set_variant(void** ctx, unsigned accepts, int small);
 int surprise_work(void** ctx);
 int surprise_dispose(void** ctx);
 
-int surprise_get_file(uint8_t **buffer_ptr, const char *file_name);
-int surprise_get_random(uint8_t **buffer_ptr);
-
 #endif
\ No newline at end of file
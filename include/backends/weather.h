@@ -1,26 +1,174 @@
 #ifndef WEATHER_H
 #define WEATHER_H
 
-#include <jansson.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#include "utilities/curl_client.h"
+#include "backends/backend.h"
+#include "backends/weather_series.h"
+#include "utilities/access_log.h"
+#include "utilities/cache_store.h"
+#include "utilities/compress.h"
+#include "utilities/heavy_hitters.h"
+#include "utilities/http_validators.h"
+#include "utilities/job_pool.h"
+#include "utilities/record_store.h"
+#include "utilities/response_cache.h"
+#include "utilities/single_flight.h"
+#include "utilities/subscription.h"
+#include "utilities/trace.h"
 
-#define METEO_FORECAST_URL                                                                                                                                     \
-    "https://api.open-meteo.com/v1/"                                                                                                                           \
-    "forecast?latitude=%f&longitude=%f&current=temperature_2m,relative_humidity_2m,apparent_temperature,is_day,precipitation,rain,showers,snowfall,weather_"   \
-    "code,cloud_cover,pressure_msl,surface_pressure,wind_speed_10m,wind_direction_10m,wind_gusts_10m"
+// Forecast API base, --upstream= replaces it at runtime (tools/mock_meteo)
+#ifndef METEO_API_URL
+#define METEO_API_URL "https://api.open-meteo.com/v1/"
+#endif
+// Longest base weather_set_api_url takes, NUL included
+#define METEO_API_URL_SIZE 256
+#define METEO_CURRENT_FIELDS                                                                                                   \
+    "temperature_2m,relative_humidity_2m,apparent_temperature,is_day,precipitation,rain,showers,snowfall,weather_code,"      \
+    "cloud_cover,pressure_msl,surface_pressure,wind_speed_10m,wind_direction_10m,wind_gusts_10m"
+#ifndef Weather_FORECAST_DAYS
+#define Weather_FORECAST_DAYS 7
+#endif
+#define METEO_STRINGIFY_(value) #value
+#define METEO_STRINGIFY(value) METEO_STRINGIFY_(value)
+#define METEO_SERIES_QUERY                                                                                             \
+    "&hourly=" WEATHER_SERIES_HOURLY_FIELDS "&daily=" WEATHER_SERIES_DAILY_FIELDS                                      \
+    "&forecast_days=" METEO_STRINGIFY(Weather_FORECAST_DAYS)
+// Formats behind the base, weather_api_url() first
+#define METEO_FORECAST_URL "%sforecast?latitude=%f&longitude=%f&current=" METEO_CURRENT_FIELDS METEO_SERIES_QUERY
+// The owner of a location on the peer ring (utilities/peer_ring.h) is asked
+// this, host:port first
+#define Weather_PEER_URL "http://%s/peer/weather?lat=%f&lon=%f"
+// Comma separated coordinate lists, the response is an array in the same order
+#define METEO_FORECAST_BATCH_URL "%sforecast?latitude=%s&longitude=%s&current=" METEO_CURRENT_FIELDS METEO_SERIES_QUERY
+
+// What the client JSON starts out with, enough for all but the series
+#ifndef Weather_JSON_INITIAL_SIZE
+#define Weather_JSON_INITIAL_SIZE 2048
+#endif
+
+// Longest unit string read from a response, NUL included
+#ifndef Weather_UNIT_MAX_LENGTH
+#define Weather_UNIT_MAX_LENGTH 64
+#endif
+
+#ifndef Weather_GRID_DEGREES
+#define Weather_GRID_DEGREES 0.05
+#endif
+#ifndef Weather_NEAREST_KM
+#define Weather_NEAREST_KM 0
+#endif
+#ifndef Weather_CACHE_TTL_SECONDS
+#define Weather_CACHE_TTL_SECONDS 900
+#endif
+#ifndef Weather_STALE_WHILE_REVALIDATE_SECONDS
+#define Weather_STALE_WHILE_REVALIDATE_SECONDS 300
+#endif
+#ifndef Weather_STALE_IF_ERROR_SECONDS
+#define Weather_STALE_IF_ERROR_SECONDS 3600
+#endif
+// "weather/LAT,LON" of a quantized location, the surrogate key a CDN in
+// front keeps its forecasts under
+#ifndef Weather_SURROGATE_KEY_SIZE
+#define Weather_SURROGATE_KEY_SIZE 48
+#endif
+#ifndef Weather_REFRESH_MAX_INFLIGHT
+#define Weather_REFRESH_MAX_INFLIGHT 8
+#endif
+#ifndef Weather_REFRESH_POLL_MS
+#define Weather_REFRESH_POLL_MS 1
+#endif
+#ifndef Weather_REFRESH_SWEEP_MS
+#define Weather_REFRESH_SWEEP_MS 10000
+#endif
+#ifndef Weather_REFRESH_HOT_HITS
+#define Weather_REFRESH_HOT_HITS 4
+#endif
+// The step of the model's current block until the first response says
+// otherwise, and how long after a step upstream has its data; a forecast is
+// fresh until the step after the one it was fetched in, plus the lag
+#ifndef Weather_MODEL_INTERVAL_SECONDS
+#define Weather_MODEL_INTERVAL_SECONDS 900
+#endif
+#ifndef Weather_PUBLICATION_LAG_SECONDS
+#define Weather_PUBLICATION_LAG_SECONDS 180
+#endif
+// The sweep refreshes this long (plus up to the jitter) before a forecast
+// expires; below the lag, or it refetches the step it has
+#ifndef Weather_REFRESH_LEAD_SECONDS
+#define Weather_REFRESH_LEAD_SECONDS 60
+#endif
+#ifndef Weather_REFRESH_JITTER_SECONDS
+#define Weather_REFRESH_JITTER_SECONDS 60
+#endif
+// Speculative fetches (weather_prefetch_location) leave this many requests
+// of the upstream budget to clients
+#ifndef Weather_PREFETCH_BUDGET_RESERVE
+#define Weather_PREFETCH_BUDGET_RESERVE 30
+#endif
+#ifndef Weather_STORE_PATH
+#define Weather_STORE_PATH "cache/weather/weather.store"
+#endif
+#ifndef Weather_STORE_CAPACITY
+#define Weather_STORE_CAPACITY (64 << 20)
+#endif
+#ifndef Weather_STORE_BUDGET_BYTES
+#define Weather_STORE_BUDGET_BYTES (32 << 20)
+#endif
+#ifndef Weather_HOT_CACHE_ENTRIES
+#define Weather_HOT_CACHE_ENTRIES 256
+#endif
+#ifndef Weather_HOT_CACHE_BYTES
+#define Weather_HOT_CACHE_BYTES (4 << 20)
+#endif
+// Locations per loop whose version before the hot one is kept for delta
+// polls (weather_delta_lookup), 0 sends every poll the whole forecast
+#ifndef Weather_DELTA_ENTRIES
+#define Weather_DELTA_ENTRIES 128
+#endif
+// With several loops a location's hot entry is kept by the loop owning its
+// key; one asked for this often (sketch estimate 0 - 15) is replicated to
+// the loops asking too, 0 never replicates
+#ifndef Weather_SHARD_REPLICATE_HITS
+#define Weather_SHARD_REPLICATE_HITS 8
+#endif
+#ifndef Weather_SKETCH_WIDTH
+#define Weather_SKETCH_WIDTH 4096
+#endif
+// Counters per row of each loop's heavy hitter sketch; the hottest
+// locations of all loops are refreshed and replicated by their counts
+#ifndef Weather_HEAVY_HITTERS_WIDTH
+#define Weather_HEAVY_HITTERS_WIDTH 4096
+#endif
+// Projected bodies (?fields=) each loop keeps, by location and field set
+#ifndef Weather_PROJECTION_CACHE_ENTRIES
+#define Weather_PROJECTION_CACHE_ENTRIES 256
+#endif
+#ifndef Weather_PROJECTION_CACHE_BYTES
+#define Weather_PROJECTION_CACHE_BYTES (1 << 20)
+#endif
+// Bits of a field set past the current block's members, which take the
+// bits of their place in it. CBOR asks for the body as application/cbor
+// (cbor_from_json), alone it is every field.
+#define WEATHER_FIELDS_CBOR (1u << 29)
+#define WEATHER_FIELDS_HOURLY (1u << 30)
+#define WEATHER_FIELDS_DAILY (1u << 31)
 
 typedef enum {
     Weather_State_Init,
+    Weather_State_AskOwner,
     Weather_State_ValidateFile,
     Weather_State_LoadFromDisk,
+    Weather_State_SharedGet,
+    Weather_State_SharedWait,
+    Weather_State_FetchFromPeer_Init,
+    Weather_State_FetchFromPeer_Poll,
     Weather_State_FetchFromAPI_Init,
-    Weather_State_FetchFromAPI_Request,
     Weather_State_FetchFromAPI_Poll,
     Weather_State_FetchFromAPI_Read,
     Weather_State_ProcessResponse,
+    Weather_State_Processing,
     Weather_State_SaveToDisk,
     Weather_State_Done
 } weather_state;
@@ -28,77 +176,306 @@ typedef enum {
 typedef struct weather_t {
     void* ctx;
     void (*on_done)(void* ctx);
+    // A job finished, work() wants to run again
+    void (*on_wake)(void* ctx);
 
     double latitude;
     double longitude;
 
-    curl_client* curl_client;
+    // Upstream fetch, shared with concurrent requests for the same location
+    single_flight_waiter flight;
+    // Disk or transform job in flight, NULL when none
+    job_pool_job* job;
+    // Output of the transform job, NULL if it failed
+    char* processed;
+    // Cache record of processed, handed to the write-behind queue
+    uint8_t* record;
+    size_t record_length;
 
     char* buffer;
     int bytesread;
 
+    // The client's cached copy, checked against the cache file before it is loaded
+    http_conditional conditional;
+    int not_modified;
+    // The cache file was past its TTL, served (or found current) while a refresh runs
+    int stale;
+    // Where the body came from, for the access log
+    access_cache cache;
+    // The request's trace when it has one, see weather_set_trace
+    trace_context* trace;
+    // Cache file too old to serve but within the stale-if-error window, sent
+    // if the fetch fails. Identity only, NULL if there is none.
+    char* fallback;
+    time_t fallback_modified;
+    // Background refresh without a request, see weather_refresh
+    int refresh_done;
+    // Cache files not newer than this count as missing, set when a refresh
+    // replaces a version another loop may have replaced already
+    time_t refresh_older;
+    // Validators of buffer, "" and 0 when unknown
+    char etag[HTTP_ETAG_SIZE];
+    time_t last_modified;
+    // Content-Encoding the client takes, encoded is buffer in it when one
+    // was stored or could be made
+    compress_encoding encoding;
+    uint8_t* encoded;
+    size_t encoded_length;
+    // A disk hit served in place: buffer or encoded is disk_body, in the
+    // store's mapping and at disk_offset of its file; not freed, the view is
+    // released instead
+    record_store_view disk_view;
+    const uint8_t* disk_body;
+    off_t disk_offset;
+    // The owning loop's hot cache was asked, NULL once it answered
+    struct weather_shard_lookup* shard_lookup;
+    // Its entry (retained) and the variant that goes out, NULL if it had none
+    const response_blob* shard_blob;
+    compress_encoding shard_encoding;
+    // Answering a peer (weather_set_peer): peer_reply is the record it is sent
+    int peer;
+    uint8_t* peer_reply;
+    size_t peer_reply_length;
+    // The location's owner on the peer ring was asked already
+    int peer_asked;
+    // The shared store's lookup (weather_set_shared_store), NULL once it answered
+    cache_store_op* shared_op;
+    int shared_asked;
+    int shared_result;
+    uint8_t* shared_record;
+    size_t shared_record_length;
+    time_t shared_stamp;
+    // Only these fields go out (weather_set_fields), 0 for all of them. The
+    // client's encoding and copy are the projection's, the fetch and the
+    // caches work on the full identity body.
+    uint32_t fields;
+    compress_encoding fields_encoding;
+    http_conditional fields_conditional;
+    // The projected body (retained) and the variant that goes out
+    const response_blob* projection;
+    compress_encoding projection_encoding;
+
     weather_state state;
 } weather_t;
 
 typedef struct {
-    // Location info
+    // The numbers, together so reading a report touches a few cache lines
     double latitude;
     double longitude;
     double generationtime_ms;
-    int utc_offset_seconds;
-    char* timezone;
-    char* timezone_abbreviation;
     double elevation;
-
-    // Units
-    char* unit_time;
-    char* unit_interval;
-    char* unit_temperature_2m;
-    char* unit_relative_humidity_2m;
-    char* unit_apparent_temperature;
-    char* unit_is_day;
-    char* unit_precipitation;
-    char* unit_rain;
-    char* unit_showers;
-    char* unit_snowfall;
-    char* unit_weather_code;
-    char* unit_cloud_cover;
-    char* unit_pressure_msl;
-    char* unit_surface_pressure;
-    char* unit_wind_speed_10m;
-    char* unit_wind_direction_10m;
-    char* unit_wind_gusts_10m;
-
-    // Current weather data
-    char* time;
-    int interval;
     double temperature_2m;
-    int relative_humidity_2m;
     double apparent_temperature;
-    int is_day;
     double precipitation;
     double rain;
     double showers;
     double snowfall;
-    int weather_code;
-    int cloud_cover;
     double pressure_msl;
     double surface_pressure;
     double wind_speed_10m;
-    int wind_direction_10m;
     double wind_gusts_10m;
+    int utc_offset_seconds;
+    int interval;
+    int relative_humidity_2m;
+    int is_day;
+    int weather_code;
+    int cloud_cover;
+    int wind_direction_10m;
+
+    // Location info and time of the current block
+    char* timezone;
+    char* timezone_abbreviation;
+    char* time;
+
+    // Units, interned (see string_intern) and never freed
+    const char* unit_time;
+    const char* unit_interval;
+    const char* unit_temperature_2m;
+    const char* unit_relative_humidity_2m;
+    const char* unit_apparent_temperature;
+    const char* unit_is_day;
+    const char* unit_precipitation;
+    const char* unit_rain;
+    const char* unit_showers;
+    const char* unit_snowfall;
+    const char* unit_weather_code;
+    const char* unit_cloud_cover;
+    const char* unit_pressure_msl;
+    const char* unit_surface_pressure;
+    const char* unit_wind_speed_10m;
+    const char* unit_wind_direction_10m;
+    const char* unit_wind_gusts_10m;
+
+    // Forecast, empty if the response had none
+    weather_series_t hourly;
+    weather_series_t daily;
 } weather_data_t;
 
-int weather_init(void** ctx, void** ctx_struct, void (*ondone)(void* context));
+int weather_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
 int weather_get_buffer(void** ctx, char** buffer);
 int weather_work(void** ctx);
 int weather_dispose(void** ctx);
 
 int weather_set_location(void** ctx, double latitude, double longitude);
+int weather_set_conditional(void** ctx, const http_conditional* conditional);
+int weather_set_encoding(void** ctx, compress_encoding encoding);
+// Sends only fields (weather_fields_parse, WEATHER_FIELDS_CBOR added for the
+// CBOR body) in encoding, in place of weather_set_encoding and before
+// weather_set_conditional
+int weather_set_fields(void** ctx, uint32_t fields, compress_encoding encoding);
+// The request is a peer's that found this node owns the location: the body
+// is the record with its stamp (binary, weather_get_buffer_size long), from
+// the store if it has one inside its TTL and fetched otherwise, never from
+// another peer
+int weather_set_peer(void** ctx);
+int weather_get_buffer_size(void** ctx, size_t* size);
+// Encoding of data, COMPRESS_IDENTITY if there is no encoded body (use weather_get_buffer)
+compress_encoding weather_get_encoded(void** ctx, const uint8_t** data, size_t* length);
+// 1 if the client's copy is current and no body was produced, 0 otherwise
+int weather_get_validators(void** ctx, const char** etag, time_t* last_modified);
+// The owning loop's entry when it answered, sent as it is; NULL otherwise
+const response_blob* weather_get_blob(void** ctx, compress_encoding* encoding);
+// The store file a disk hit's body is in (from offset) for sendfile, -1 for
+// any other body
+int weather_get_file(void** ctx, const uint8_t* body, off_t* offset);
+// The stamp of the forecast that goes out, when it expires and its
+// surrogate key; -1 for a peer's record
+int weather_get_freshness(void** ctx, time_t* stamp, time_t* expires, char* key, size_t size);
+// application/cbor for a WEATHER_FIELDS_CBOR body, NULL for the route's JSON
+const char* weather_get_content_type(void** ctx);
+// Disk, fetched, coalesced with another request's fetch or the stale fallback
+access_cache weather_get_cache_outcome(void** ctx);
+// Stamps the cache lookup and the upstream fetch on trace, which outlives the backend
+void weather_set_trace(void** ctx, trace_context* trace);
+
+// A body this loop sent for the location within its TTL, ready to go out again
+typedef struct {
+    // the entry's variants, retain it to keep them past the next call
+    const response_blob* blob;
+    const uint8_t* body;
+    size_t length;
+    compress_encoding encoding;
+    const char* etag; // NULL if none
+    time_t last_modified;
+    // past the TTL, the caller should weather_refresh the location
+    int stale;
+} weather_hot_hit;
+
+// The surrogate key of a quantized location's forecasts, the refresher has
+// the CDN purge it when it fetched a new one (--cdn-purge)
+void weather_surrogate_key(double latitude, double longitude, char* key, size_t size);
+// Snaps a location to the centre of its Weather_GRID_DEGREES cell, the
+// granularity every weather cache is keyed on
+void weather_quantize(double* latitude, double* longitude);
+// Moves a quantized location to the nearest cell within Weather_NEAREST_KM
+// that has a forecast inside its TTL. 0 if the location has one or was moved,
+// -1 if there is none nearby (or the lookup is off).
+int weather_nearest_fresh(double* latitude, double* longitude);
+// The up to max locations asked for most lately on all loops, hottest
+// first, labelled "latitude,longitude"
+int weather_heavy_hitters(heavy_hitters_entry* out, int max);
+
+// 0 and hit filled (valid until the next call on this thread) if the hot cache has
+// the location in encoding or in one that can stand in for it, -1 otherwise
+int weather_hot_lookup(double latitude, double longitude, compress_encoding encoding, weather_hot_hit* hit);
+// A JSON merge patch (RFC 7396) from the version a client has, named by an
+// ETag of since or, without one, its exact If-Modified-Since date, to the
+// last_modified version weather_hot_lookup found:
+// 0 and *patch (a shared blob, valid until the next call on this thread),
+// -1 if this loop no longer has that version or the patch is not smaller
+int weather_delta_lookup(double latitude, double longitude, time_t last_modified, const http_conditional* since,
+                         const uint8_t** patch, size_t* length);
+// The field set of a ?fields= list: names of the current block's members
+// ("temperature_2m,weather_code"), "hourly" and "daily" for the series.
+// time and interval always come along, the location's root members too.
+// -1 for an empty list or a name it does not know.
+int weather_fields_parse(const char* list, uint32_t* fields);
+// As weather_hot_lookup for the body with only fields: the members of the
+// cached one copied out as they are (and transcoded for WEATHER_FIELDS_CBOR),
+// once per version and field set, and kept in the loop's projection cache
+int weather_projected_lookup(double latitude, double longitude, uint32_t fields, compress_encoding encoding,
+                             weather_hot_hit* hit);
+// Fetches the location into the caches in the background on this loop,
+// at most once at a time per location
+void weather_refresh(double latitude, double longitude);
+// A location a client is likely to ask for next into the caches, disk first,
+// unless the loop has it already. Only with half the loop's refresh slots
+// and more than Weather_PREFETCH_BUDGET_RESERVE upstream requests to spare,
+// it is dropped otherwise.
+void weather_prefetch_location(double latitude, double longitude);
+
+// Follows a quantized location until weather_unsubscribe, which has to come
+// before member goes away. The loop keeps the location refreshed ahead of
+// its TTL as long as anyone follows it. *current is the forecast the loop
+// has (a reference for the caller) or NULL, then one is loaded in the
+// background. Every newer one reaching the loop's hot cache is published to
+// the loop's registry (utilities/subscription.h) and comes through deliver in
+// the loop iteration after, the one copy every subscriber of the location
+// gets; every blob passed on has the identity body. -1 if out of memory.
+int weather_subscribe(subscription* member, double latitude, double longitude, subscription_deliver deliver,
+                      void* context, const response_blob** current);
+void weather_unsubscribe(subscription* member);
+// Frees the calling thread's hot cache and stops its refreshes
+void weather_release_thread(void);
+
+// Process wide, opens the disk store before and closes it after all worker
+// loops. Without it every lookup misses and nothing is stored.
+int weather_global_init(void);
+void weather_global_dispose(void);
+// The base the forecast URLs start with; set before the loops start, 0 or
+// -1 if it is too long
+const char* weather_api_url(void);
+int weather_set_api_url(const char* base);
+// A store every node reaches (utilities/cache_store.h), asked on a miss of
+// the local tiers before the peer ring or upstream and given every fetched
+// record. Before the loops start, -1 if url names no store or it cannot be
+// opened.
+int weather_set_shared_store(const char* url);
+// Before workers_prefork: the store file is only read from, what the worker
+// processes fetch goes to the shared store alone, "shm" unless one was set
+int weather_open_shared(void);
+// Fetches the locations that have no fresh record (blocking, all at once)
+// and loads the newest records for the hot caches of the loops started
+// afterwards. Returns the number of records loaded.
+int weather_warmup(const double* latitudes, const double* longitudes, int count);
+
+// Hot restart, see hot_restart.h. Freezing writes what is queued and stops
+// the store changing; the keys are of the stored locations, most asked for
+// and newest first, at most max of them.
+void weather_handoff_freeze(int frozen);
+int weather_handoff_keys(uint64_t* keys, int max);
+// As weather_warmup from the keys another process handed over, in their
+// order and in place of anything warmed before. After weather_global_init.
+int weather_warmup_keys(const uint64_t* keys, int count);
+
+// Counters of the calling loop's hot cache and of the process wide store
+typedef struct {
+    response_cache_stats hot;
+    uint64_t disk_hits;
+    uint64_t disk_misses;
+    uint64_t disk_evictions;
+    size_t disk_bytes;
+    size_t disk_values;
+} weather_cache_stats;
+
+void weather_get_cache_stats(weather_cache_stats* stats);
+
+// The client JSON (and cache record, NULL if it cannot be made) of each of
+// the count forecasts in a METEO_FORECAST_BATCH_URL response, one parse for
+// all. A location the response lacks is left NULL. Thread safe.
+int weather_transform_batch(const char* api_response, int count, char** bodies, uint8_t** records,
+                            size_t* record_lengths);
+// A forecast fetched for a quantized location into this loop's hot cache and,
+// with persist, queued for the store (record is taken over either way)
+void weather_store_fetched(double latitude, double longitude, const char* body, uint8_t* record, size_t record_length,
+                           int persist);
 
 // ========== Cache Management Functions ==========
 int does_weather_cache_exist(double latitude, double longitude);
 int is_weather_cache_stale(double latitude, double longitude, int max_age_seconds);
+// Until when a forecast fetched at stamp is fresh: the next step of the
+// upstream model plus Weather_PUBLICATION_LAG_SECONDS, never past the TTL
+time_t weather_fresh_until(time_t stamp);
 int weather_cache_time(double latitude, double longitude, long int* time);
 int load_weather_from_cache(double latitude, double longitude, char** json_str);
 int save_weather_to_cache(double latitude, double longitude, const char* json_str);
@@ -0,0 +1,59 @@
+#ifndef WEATHER_ARCHIVE_H
+#define WEATHER_ARCHIVE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "global_defines.h"
+#include "backends/weather.h"
+
+#ifndef Weather_ARCHIVE_PATH
+#define Weather_ARCHIVE_PATH "cache/weather/archive.store"
+#endif
+#ifndef Weather_ARCHIVE_CAPACITY
+#define Weather_ARCHIVE_CAPACITY (64 << 20)
+#endif
+// Days of observations kept per location, and the longest range a query
+// may ask for; below 256, a day's chunk is stored in slot day % 256
+#ifndef Weather_ARCHIVE_RETAIN_DAYS
+#define Weather_ARCHIVE_RETAIN_DAYS 31
+#endif
+// Observations a location's day holds, one every five minutes; the current
+// block upstream moves every fifteen
+#ifndef Weather_ARCHIVE_DAY_SAMPLES
+#define Weather_ARCHIVE_DAY_SAMPLES 288
+#endif
+
+/*
+ * Observation history of every location cell, kept on this node. Each
+ * forecast the store writes adds its current block (the time and the
+ * measurements) to the cell's chunk of that UTC day, unless the chunk has
+ * that time already, so "the last week" is answered without going upstream.
+ *
+ * A chunk is columnar: the times in seconds into the day, then every
+ * measurement as a fixed point integer (hundredths for the reals), each
+ * column its first value and the differences between neighbours in the
+ * narrowest of 1, 2 or 4 bytes that holds them all. A day of a cell is a
+ * few KB.
+ * The chunks live in a record store of their own, memory mapped and append
+ * only (utilities/record_store.h); compaction drops days past the retention.
+ * Host byte order, as the weather records.
+ */
+
+// Opens the store and registers its metrics, before the loops start
+int weather_archive_open(void);
+void weather_archive_close(void);
+
+// The current block of weather for the quantized location into its day,
+// in time order. 0 if stored or already there, -1 if weather has no usable
+// time or the store is full. Called by the store's writer, on the pool.
+int weather_archive_append(double latitude, double longitude, const weather_data_t* weather);
+
+// The observations of the quantized location from from to to (both
+// included, at most Weather_ARCHIVE_RETAIN_DAYS apart) as a malloc'd JSON
+// object of columns: "time" (ISO 8601, UTC) and one array per measurement,
+// in the forecast's units. No observations is an empty set, -1 is out of
+// memory. Thread safe.
+int weather_archive_query(double latitude, double longitude, time_t from, time_t to, char** body, size_t* length);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef WEATHER_BATCH_H
+#define WEATHER_BATCH_H
+
+#include "backends/backend.h"
+#include "backends/weather.h"
+#include "utilities/job_pool.h"
+#include "utilities/single_flight.h"
+
+#ifndef Weather_BATCH_MAX_LOCATIONS
+#define Weather_BATCH_MAX_LOCATIONS 64
+#endif
+
+/*
+ * The forecasts of many locations in one response, a JSON array in request
+ * order with null for a location that could not be had. Hot and stored
+ * forecasts are served as they are; all the others are fetched in a single
+ * upstream request and split into one cache entry per location.
+ */
+
+typedef enum {
+    WeatherBatch_State_Init,
+    WeatherBatch_State_LoadFromDisk,
+    WeatherBatch_State_FetchFromAPI_Init,
+    WeatherBatch_State_FetchFromAPI_Poll,
+    WeatherBatch_State_Processing,
+    WeatherBatch_State_Done
+} weather_batch_state;
+
+typedef struct {
+    double latitude;
+    double longitude;
+    // client JSON, NULL until found
+    char* body;
+} weather_batch_location;
+
+typedef struct weather_batch_t {
+    void* ctx;
+    void (*on_done)(void* ctx);
+    // A job finished, work() wants to run again
+    void (*on_wake)(void* ctx);
+
+    weather_batch_state state;
+    weather_batch_location locations[Weather_BATCH_MAX_LOCATIONS];
+    int count;
+
+    // Locations asked upstream, in the order of the URL and its response
+    int fetch[Weather_BATCH_MAX_LOCATIONS];
+    int fetch_count;
+    char* fetched[Weather_BATCH_MAX_LOCATIONS];
+    uint8_t* records[Weather_BATCH_MAX_LOCATIONS];
+    size_t record_lengths[Weather_BATCH_MAX_LOCATIONS];
+    single_flight_waiter flight;
+
+    char* buffer;
+    // Disk or transform job in flight, NULL when none
+    job_pool_job* job;
+} weather_batch_t;
+
+int weather_batch_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
+// A quantized location, up to Weather_BATCH_MAX_LOCATIONS before the first work()
+int weather_batch_add_location(void** ctx, double latitude, double longitude);
+int weather_batch_work(void** ctx);
+int weather_batch_get_buffer(void** ctx, char** buffer);
+int weather_batch_dispose(void** ctx);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef WEATHER_BY_NAME_H
+#define WEATHER_BY_NAME_H
+
+#include "backends/backend.h"
+#include "backends/geolocation.h"
+#include "backends/weather.h"
+#include "utilities/access_log.h"
+#include "utilities/coroutine.h"
+#include "utilities/trace.h"
+
+/*
+ * A place's forecast from its name in one request: the search and the
+ * forecast backends run one after the other inside this one, each through
+ * its own caches, and the body is {"location": the best match or null,
+ * "weather": its forecast or null}. Saves the client the round trip
+ * between /GetLocation and /GetWeather.
+ */
+
+typedef struct weather_by_name_t {
+    void* ctx;
+    void (*on_done)(void* ctx);
+    void (*on_wake)(void* ctx);
+
+    // Search, then forecast; resumes where it waits on either
+    coroutine co;
+    // The backend running, its on_done sets inner_done
+    void* geolocation;
+    void* weather;
+    int inner_done;
+
+    // The first search result as the search sent it, NULL if there was none
+    char* location;
+    double latitude;
+    double longitude;
+    // The forecast's client JSON, NULL if there is none
+    char* forecast;
+
+    char* buffer;
+    // The forecast's, or the search's if it got no further
+    access_cache cache;
+    trace_context* trace;
+} weather_by_name_t;
+
+int weather_by_name_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
+// Before the first work(), the name decoded; country_code may be NULL
+int weather_by_name_set_parameters(void** ctx, const char* name, const char* country_code);
+int weather_by_name_work(void** ctx);
+int weather_by_name_get_buffer(void** ctx, char** buffer);
+access_cache weather_by_name_get_cache_outcome(void** ctx);
+void weather_by_name_set_trace(void** ctx, trace_context* trace);
+int weather_by_name_dispose(void** ctx);
+
+#endif
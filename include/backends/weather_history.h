@@ -0,0 +1,46 @@
+#ifndef WEATHER_HISTORY_H
+#define WEATHER_HISTORY_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "backends/backend.h"
+#include "backends/weather_archive.h"
+#include "utilities/access_log.h"
+#include "utilities/coroutine.h"
+#include "utilities/job_pool.h"
+
+/*
+ * A location's observations over a time range from the local archive
+ * (weather_archive.h), read and formatted on the pool. Never goes upstream:
+ * what this node did not see is not in the answer.
+ */
+
+typedef struct weather_history_t {
+    void* ctx;
+    void (*on_done)(void* ctx);
+    // A job finished, work() wants to run again
+    void (*on_wake)(void* ctx);
+
+    coroutine co;
+    double latitude;
+    double longitude;
+    time_t from;
+    time_t to;
+
+    // The JSON, NULL if it could not be made
+    char* buffer;
+    size_t length;
+    // Read job in flight, NULL when none
+    job_pool_job* job;
+} weather_history_t;
+
+int weather_history_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context));
+// A quantized location and the range, before the first work()
+int weather_history_set_range(void** ctx, double latitude, double longitude, time_t from, time_t to);
+int weather_history_work(void** ctx);
+int weather_history_get_buffer(void** ctx, char** buffer);
+access_cache weather_history_get_cache_outcome(void** ctx);
+int weather_history_dispose(void** ctx);
+
+#endif
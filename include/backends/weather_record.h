@@ -0,0 +1,32 @@
+#ifndef WEATHER_RECORD_H
+#define WEATHER_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "backends/weather.h"
+
+/*
+ * Binary cache record of a weather report: a fixed header, the fields of
+ * weather_data_t in a fixed layout with the unit strings interned to one
+ * byte each, the forecast series as their raw float columns, and the
+ * compact client JSON. A cache hit sends the stored JSON
+ * as it is, nothing is parsed or serialized.
+ *
+ * Host byte order, records are read back by the machine that wrote them.
+ * A record of any other version is treated as missing.
+ */
+
+#define WEATHER_RECORD_MAGIC 0x43455257u /* "WREC" */
+#define WEATHER_RECORD_VERSION 2
+
+// The record of weather and its JSON body, malloc'd into *record
+int weather_record_encode(const weather_data_t* weather, const char* body, size_t body_length, uint8_t** record,
+                          size_t* length);
+// 0 and body set to the NUL terminated JSON inside record if it is a valid
+// record of this version, -1 otherwise
+int weather_record_body(const uint8_t* record, size_t length, const char** body, size_t* body_length);
+// The fields of record into weather, free with free_weather()
+int weather_record_decode(const uint8_t* record, size_t length, weather_data_t* weather);
+
+#endif
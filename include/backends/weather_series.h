@@ -0,0 +1,57 @@
+#ifndef WEATHER_SERIES_H
+#define WEATHER_SERIES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utilities/json_scan.h"
+
+/*
+ * Forecast series of a location, the hourly and daily blocks of an
+ * open-meteo response, held as columns: one float array per variable in a
+ * single allocation, all of them on one regular time axis (start and step)
+ * so a time maps to an index by arithmetic. Nothing per value is allocated,
+ * the JSON is written straight from the columns.
+ *
+ * The variables asked for are fixed per block, WEATHER_SERIES_*_FIELDS.
+ */
+
+typedef enum {
+    WEATHER_SERIES_HOURLY,
+    WEATHER_SERIES_DAILY,
+    WEATHER_SERIES_KINDS
+} weather_series_kind;
+
+#define WEATHER_SERIES_HOURLY_FIELDS "temperature_2m,relative_humidity_2m,precipitation_probability,precipitation,weather_code,wind_speed_10m"
+#define WEATHER_SERIES_DAILY_FIELDS  "weather_code,temperature_2m_max,temperature_2m_min,precipitation_sum,precipitation_probability_max,wind_speed_10m_max"
+
+typedef struct {
+    // steps on the time axis, 0 for a block the response did not have
+    int count;
+    // seconds between steps
+    int32_t step;
+    // first step as the wall time upstream reports it, in seconds since the epoch
+    int64_t start;
+    // variable v's column at values + v * count, NAN where upstream had null
+    float* values;
+} weather_series_t;
+
+// Most variables a block has
+#define WEATHER_SERIES_MAX_VARIABLES 8
+
+int weather_series_variables(weather_series_kind kind);
+
+// The block object (e.g. "hourly") next at the scanner into series, which
+// starts out zeroed; the block is consumed either way. -1 for one that is
+// malformed or not on a regular axis.
+int weather_series_scan(json_scan* scan, weather_series_kind kind, weather_series_t* series);
+// An empty series of count steps, values all NAN
+int weather_series_alloc(weather_series_t* series, weather_series_kind kind, int count);
+void weather_series_free(weather_series_t* series);
+
+// Appends ,"<kind>_units":{...},"<kind>":{...} to the malloc'd buffer of
+// *length bytes (NUL terminated), growing it. Nothing for an empty series.
+int weather_series_append_json(const weather_series_t* series, weather_series_kind kind, char** buffer,
+                               size_t* length);
+
+#endif
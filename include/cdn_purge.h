@@ -0,0 +1,47 @@
+#ifndef __cdn_purge_h_
+#define __cdn_purge_h_
+
+#include "global_defines.h"
+
+/* keys of one purge request at most, Fastly takes 256 */
+#ifndef CDN_PURGE_MAX_KEYS
+	#define CDN_PURGE_MAX_KEYS 256
+#endif
+
+#ifndef CDN_PURGE_KEY_SIZE
+	#define CDN_PURGE_KEY_SIZE 48
+#endif
+
+/* keys of a loop gathered this long go out in one request */
+#ifndef CDN_PURGE_DELAY_MS
+	#define CDN_PURGE_DELAY_MS 1000
+#endif
+
+#ifndef CDN_PURGE_TIMEOUT_MS
+	#define CDN_PURGE_TIMEOUT_MS 5000
+#endif
+
+/*
+ * Purges by surrogate key of the CDN in front (--cdn-purge=URL). A loop
+ * gathers the keys it is given for CDN_PURGE_DELAY_MS and POSTs them to the
+ * URL in one Surrogate-Key header, space separated, as Fastly's batch purge
+ * takes them; CDN_PURGE_HEADER from the environment is sent along as a
+ * header line ("Fastly-Key: ..."), the token stays off the command line.
+ * The request runs on the job pool, one per loop at a time; keys given
+ * while a loop has CDN_PURGE_MAX_KEYS waiting are dropped and counted, the
+ * CDN's copies still expire at their max-age.
+ */
+
+/* Before the workers start; -1 for a URL that is not http(s) */
+int cdn_purge_configure(const char* _Url);
+/* 1 with a purge URL */
+int cdn_purge_enabled(void);
+
+/* On a loop, after job_pool_attach; _Key is copied */
+void cdn_purge_key(const char* _Key);
+/* Before the loop's job pool detaches, what waits is not sent */
+void cdn_purge_release_thread(void);
+
+void cdn_purge_dispose(void);
+
+#endif //__cdn_purge_h_
@@ -3,7 +3,7 @@
  * Contains the generic struct for a connection (client fd),
  * the generic struct for a listening server (server fd)
  * and the vtables to allow for polymorphic functions
- * for TCP and TLS.
+ * for TCP, TLS, io_uring backed TCP and Unix domain sockets.
  **/
 
 #ifndef __CONNECTION_H__
@@ -16,8 +16,16 @@
 #include "../mbedtls/include/mbedtls/error.h"
 #include "../mbedtls/include/mbedtls/x509_crt.h"
 #include "../mbedtls/include/mbedtls/pk.h"
+#include "../mbedtls/include/mbedtls/ssl_ticket.h"
+#include "../mbedtls/include/mbedtls/ssl_cache.h"
 #include "smw.h"
+#include "uring.h"
+#include "utilities/rate_limiter.h"
+#include <pthread.h>
 #include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 typedef struct conn_vtable conn_vtable_t;
 typedef struct conn conn_t;
@@ -27,6 +35,11 @@ typedef struct conn_listen_server conn_listen_server_t;
 typedef struct conn_listen_server_vtable conn_listen_server_vtable_t;
 typedef struct conn_listen_server_tcp conn_listen_server_tcp_t;
 typedef struct conn_listen_server_tls conn_listen_server_tls_t;
+typedef struct conn_uring conn_uring_t;
+typedef struct conn_listen_server_uring conn_listen_server_uring_t;
+typedef struct conn_listen_server_unix conn_listen_server_unix_t;
+typedef struct conn_accounting conn_accounting_t;
+typedef struct conn_zerocopy_hold conn_zerocopy_hold_t;
 
 ////////////////////////////////////////
 // CONNECTION INTERFACE
@@ -38,10 +51,50 @@ struct conn_vtable
 	/* we need fncptr for:  */
 	int  (*read)(conn_t *self, void *buf, int count);
 	int  (*write)(conn_t *self, const void *buf, int count);
+	/* optional, same contract as write over the concatenated buffers */
+	int  (*writev)(conn_t *self, const struct iovec *iov, int iovcnt);
+	/* optional, iov then count bytes of fd from offset, with the writev
+	   contract over the concatenation. The file goes socket side without
+	   passing through user space; connections that encrypt in user space
+	   leave it NULL and are written the mapped body instead */
+	int  (*sendfile)(conn_t *self, const struct iovec *iov, int iovcnt, int fd, off_t offset, int count);
+	/* optional, writev whose last buffer the kernel goes on reading (not
+	   copying) after it returns, MSG_ZEROCOPY: it has to stay as it is until
+	   hold releases it. The buffers before it are copied. */
+	int  (*writev_zerocopy)(conn_t *self, const struct iovec *iov, int iovcnt);
+	/* with writev_zerocopy, release(owner) once the kernel is done with
+	   every buffer written zero copy so far, right away if it is already;
+	   a connection closed before that keeps its socket until then */
+	void (*hold)(conn_t *self, const void *owner, void (*release)(const void *owner));
+	/* with writev_zerocopy, reads what the kernel is done with and releases
+	   its holds; the task driving the connection calls it on every wake */
+	void (*reap)(conn_t *self);
 	void (*close)(conn_t *self);
+	/* optional, completion based connections wake the task themselves
+	   instead of being watched through the client fd */
+	int  (*watch)(conn_t *self, smw_task *task, uint32_t events);
+	/* optional, drives the protocol handshake: 0 once it's complete,
+	   SMW_READ/SMW_WRITE for the readiness it waits on, CONN_HANDSHAKE_ASYNC
+	   while background work runs (the connection wakes the task watching
+	   it when that is done), -1 on failure */
+	int  (*handshake)(conn_t *self);
+	/* optional, 0-RTT bytes read has yet to hand out. While there are any
+	   read returns nothing but them. */
+	int  (*early_pending)(conn_t *self);
+	/* optional, nothing is expected for a while (keep-alive): memory the
+	   connection can do without until its next read or write goes back */
+	void (*idle)(conn_t *self);
+	/* optional, the protocol ALPN settled on ("h2"), NULL if none was */
+	const char *(*alpn)(conn_t *self);
 	/* these will be match with specific functions for tcp and tls */
 };
 
+/* disjoint from the SMW_ readiness flags */
+#define CONN_HANDSHAKE_ASYNC 0x10
+/* with the readiness the handshake still waits on: 0-RTT data came in, read
+   hands it out meanwhile. The handshake has to run to 0 before a write. */
+#define CONN_HANDSHAKE_EARLY_DATA 0x20
+
 /* this is the base/ parent struct */
 struct conn
 {
@@ -49,12 +102,32 @@ struct conn
 	const conn_vtable_t *vtable;
 	/* it also holds the client fd */
 	int client_fd;
+	/* peer address from accept, used for per client rate limiting */
+	struct sockaddr_storage peer;
+	socklen_t peer_len;
+	/* counters of the listener that admitted it, released on close */
+	conn_accounting_t *accounting;
+	/* monotonic ns of the accept while tracing is on (utilities/trace.h), else 0 */
+	uint64_t accepted_ns;
 };
 
 /* tcp and tls struct embed base/parent */
 struct conn_tcp
 {
 	conn_t base;
+	/* MSG_ZEROCOPY: 1 once SO_ZEROCOPY is on, -1 if the socket refused it
+	   or the kernel copies anyway (loopback), 0 before the first try. The
+	   kernel numbers the sends, zc_done of them are done with. */
+	int zc_state;
+	uint32_t zc_next;
+	uint32_t zc_done;
+	/* bodies of those sends still held, oldest first */
+	conn_zerocopy_hold_t *zc_held;
+	conn_zerocopy_hold_t *zc_held_tail;
+	/* closed with holds left: on the loop's linger list until they are done
+	   with or the deadline goes by */
+	conn_tcp_t *zc_linger_next;
+	uint64_t zc_linger_until;
 };
 
 struct conn_tls
@@ -63,12 +136,135 @@ struct conn_tls
 	/* mbed TLS specifics here */
 	mbedtls_ssl_context ssl;
 	mbedtls_net_context net;	
+	/* task to wake once an offloaded private key operation is done */
+	smw_task *owner;
+	/* TLS 1.2 master secret and randoms, kept until kTLS is set up */
+	struct conn_tls_ktls_secret *ktls_secret;
+	/* owner of the config ssl was set up with, referenced while pooled */
+	struct conn_tls_view *view;
+	/* 0-RTT data received during the handshake, TLS_EARLY_DATA_MAX_BYTES
+	   once the first record arrives */
+	unsigned char *early;
+	int early_len;
+	int early_off;
+	/* dynamic record sizing: bytes written since the connection was last
+	   idle, when it last wrote and the length of a record mbedTLS holds
+	   after WANT_WRITE, which the retry has to ask for again */
+	uint64_t ramp_bytes;
+	uint64_t last_write_ms;
+	int record_pending;
+	/* the record buffers are shrunk, see conn_tls_idle */
+	int idle;
+};
+
+/* received data sitting in a provided uring buffer */
+typedef struct
+{
+	uint16_t bid;
+	uint16_t offset;
+	uint16_t len;
+} conn_uring_chunk_t;
+
+struct conn_uring
+{
+	conn_t base;
+	/* task to wake when data arrives, set through watch */
+	smw_task *owner;
+	uint32_t watch_events;
+	/* multishot recv, final send+close */
+	uring_op recv_op;
+	uring_op send_op;
+	uring_op close_op;
+	uring_flush flush;
+	conn_uring_chunk_t *chunks;
+	int chunk_head;
+	int chunk_count;
+	int chunk_cap;
+	/* bytes written but not yet handed to the kernel */
+	uint8_t *out;
+	int out_len;
+	int out_cap;
+	/* bytes owned by the send request in flight */
+	uint8_t *sending;
+	int sending_len;
+	int recv_armed;
+	int send_failed;
+	int eof;
+	int closing;
+	int close_queued;
+	int close_done;
 };
 
 ////////////////////////////////////////
 // LISTENING SERVER INTERFACE
 ////////////////////////////////////////
 
+/* socket tuning applied to the listen socket, accepted sockets inherit it */
+typedef struct conn_listen_options
+{
+	int backlog;
+	/* booleans */
+	int nodelay;
+	int keepalive;
+	/* only wake on accept once request bytes arrived, seconds (0 = off) */
+	int defer_accept;
+	/* pending TFO queue length (0 = off) */
+	int fastopen_queue;
+	/* TCP_CONGESTION of the clients, "bbr" keeps lossy (mobile) links
+	   from being read as congested; NULL or "" keeps the system's */
+	const char *congestion;
+	/* TCP_NOTSENT_LOWAT: bytes a client's socket holds unsent before it
+	   stops being writable, so what is sent next (another HTTP/2 stream's
+	   frames) is not stuck behind a full buffer (0 = off) */
+	int notsent_lowat;
+	/* bytes, 0 keeps the kernel default */
+	int rcvbuf;
+	int sndbuf;
+	/* keepalive timing in seconds / probes, 0 keeps the kernel default */
+	int keepalive_idle;
+	int keepalive_interval;
+	int keepalive_count;
+	/* live connections per listener before new ones are turned away,
+	   0 = no cap */
+	int max_connections;
+	/* sent to plaintext clients over the cap, NULL (and always for TLS)
+	   resets the connection instead */
+	const char *reject_response;
+	/* SO_INCOMING_CPU: of the listeners sharing the port, this one gets
+	   the connections whose packets the kernel handles on that CPU
+	   (-1 = any) */
+	int incoming_cpu;
+	/* SO_BUSY_POLL / SO_PREFER_BUSY_POLL, inherited by the clients: a
+	   read polls the NIC queue for up to this many us (0 = off) */
+	int busy_poll;
+} conn_listen_options_t;
+
+/* live connections of one listener, only touched by its loop. Outlives
+   the listener until the last connection it admitted is closed. */
+struct conn_accounting
+{
+	const char *name;
+	int active;
+	int peak;
+	int max;
+	uint64_t accepted;
+	uint64_t rejected;
+	int orphaned;
+	conn_accounting_t *next;
+};
+
+/* snapshot for stats */
+typedef struct conn_listen_stats
+{
+	const char *name;
+	int active;
+	int peak;
+	int max;
+	uint64_t accepted;
+	/* turned away at the cap */
+	uint64_t rejected;
+} conn_listen_stats_t;
+
 /* same old callback on accept */
 typedef int (*OnAcceptCallBack)(conn_t *new_conn, void *ctx);
 
@@ -78,6 +274,9 @@ struct conn_listen_server_vtable
 	/* our accept now returns a connection */
 	conn_t *(*accept_client)(conn_listen_server_t *self);
 	void (*dispose)(conn_listen_server_t *self);
+	/* optional, listeners that accept through completions instead of
+	   listen fd readiness */
+	int (*watch)(conn_listen_server_t *self, uint32_t events);
 };
 
 struct conn_listen_server
@@ -90,9 +289,13 @@ struct conn_listen_server
 	/* holds callback to call when a new client is accepted */
 	OnAcceptCallBack on_accept;
 	void *user_ctx;
-	/* timeout */
-	int recent_connections;
-	uint64_t recent_connections_time;
+	/* token buckets per client address, with a global ceiling */
+	rate_limiter limiter;
+	/* fires once the global bucket has tokens again */
+	timer_wheel_timer resume_timer;
+	/* live connection cap and counters */
+	conn_accounting_t *accounting;
+	const char *reject_response;
 };
 
 struct conn_listen_server_tcp
@@ -101,38 +304,481 @@ struct conn_listen_server_tcp
 	conn_listen_server_t base;	
 };
 
-struct conn_listen_server_tls
+/* TLS global state, one per process and shared read-only by all listeners.
+   The DRBG is for threads without a view of their own (the job pool). */
+typedef struct conn_tls_shared
 {
-	conn_listen_server_t base;
-	/* holds TLS global state */
 	mbedtls_entropy_context  entropy;
 	mbedtls_ctr_drbg_context ctr_drbg;
-	mbedtls_ssl_config       conf;
 	mbedtls_x509_crt         srvcert;
 	mbedtls_pk_context       pkey;
+	/* ECDSA P-256 pair offered ahead of srvcert to clients that can use it,
+	   has_ecdsa is 0 when ECDSA_CERT_FILE_PATH is empty */
+	mbedtls_x509_crt         ecdsa_cert;
+	mbedtls_pk_context       ecdsa_pkey;
+	int                      has_ecdsa;
+	/* in order of preference, AES-GCM or ChaCha20 first by what the CPU
+	   does fast, 0 terminated */
+	int                      ciphersuites[16];
+	/* session resumption, tickets with rotating keys plus an id cache */
+	mbedtls_ssl_ticket_context ticket;
+	mbedtls_ssl_cache_context  cache;
+	/* ticket fingerprints seen within the age tolerance, a ticket only
+	   carries 0-RTT data once */
+	struct conn_tls_replay    *replay;
+	pthread_mutex_t            replay_lock;
+	/* listeners, pooled connections and pending key operations holding
+	   a reference, guarded by the module lock */
+	int refcount;
+} conn_tls_shared_t;
+
+/* one per loop with a TLS listener: a config of its own over the shared
+   cert, key, tickets and session cache, with its own DRBG seeded from the
+   shared entropy, so handshakes on different loops share no RNG lock. Held
+   by the listener and the loop's connections, only touched by that loop. */
+typedef struct conn_tls_view
+{
+	mbedtls_ctr_drbg_context ctr_drbg;
+	mbedtls_ssl_config       conf;
+	conn_tls_shared_t       *shared;
+	int refcount;
+} conn_tls_view_t;
+
+struct conn_listen_server_uring
+{
+	/* always embed base */
+	conn_listen_server_t base;
+	/* multishot accept, fds wait here until accept_client hands them out */
+	uring_op accept_op;
+	int *accepted;
+	int accepted_head;
+	int accepted_count;
+	int accepted_cap;
+	int armed;
+	int cancelling;
+	int disposed;
+};
+
+struct conn_listen_server_tls
+{
+	conn_listen_server_t base;
+	/* holds a reference on the loop's TLS config */
+	conn_tls_view_t *view;
+};
+
+/* a unix socket can't be bound once per worker like a port: every loop's
+   listener watches the one socket of the process (listen_fd), whichever
+   accepts first gets the client. Clients are plain tcp connections. */
+struct conn_listen_server_unix
+{
+	conn_listen_server_t base;
 };
 
 ////////////////////////////////////////
 // PUBLIC API
 ////////////////////////////////////////
 
-/* factory functions */
-conn_listen_server_t *conn_listen_server_tcp_init(const char *port, OnAcceptCallBack cb, void *ctx);
-conn_listen_server_t *conn_listen_server_tls_init(const char *port, OnAcceptCallBack cb, void *ctx);
+/* defaults from global_defines.h */
+/* incoming_cpu is the CPU conn_set_loop_cpu gave the calling loop,
+   busy_poll what conn_set_loop_busy_poll did */
+void conn_listen_options_default(conn_listen_options_t *opts);
+/* the CPU the calling thread's loop is pinned to, -1 if it is not */
+void conn_set_loop_cpu(int cpu);
+/* the calling thread's loop busy polls, its listeners' sockets for up to
+   usecs (0 = it sleeps) */
+void conn_set_loop_busy_poll(int usecs);
+/* a listen socket on port, tuned as a listener's own would be, for the
+   master of workers_prefork to bind before it forks; -1 on failure */
+int conn_listen_bind(const char *port);
+/* fd, bound by conn_listen_bind on port, is what the next listener of the
+   process on that port takes instead of binding a socket */
+void conn_listen_inherit(const char *port, int fd);
+/* counters of the listeners on the calling loop, returns how many were
+   copied (at most max) */
+int conn_listen_server_get_stats(conn_listen_stats_t *stats, int max);
+/* the tcp_* metrics families, before the loops start */
+void conn_register_metrics(void);
+/* a response on conn completed: every CONN_TCP_INFO_SAMPLE_EVERY'th of the
+   loop records the socket's TCP_INFO, nothing for unix sockets */
+void conn_sample_tcp_info(conn_t *conn);
+/* 1 if the client of conn is on this host: a unix socket or a loopback
+   address (a proxy on the same host counts as well) */
+int conn_peer_is_local(const conn_t *conn);
+/* factory functions, opts NULL uses the defaults */
+conn_listen_server_t *conn_listen_server_tcp_init(const char *port, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts);
+conn_listen_server_t *conn_listen_server_tls_init(const char *port, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts);
+/* io_uring backed tcp listener, NULL if the ring can't be set up */
+conn_listen_server_t *conn_listen_server_uring_init(const char *port, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts);
+/* unix domain socket listener on path, "@name" for an abstract socket. A
+   path a dead process left behind is replaced, the socket file is removed
+   again with the last listener. Peers are checked with SO_PEERCRED
+   (TCPServer_UNIX_PEER_UID) and not rate limited per client, a reverse
+   proxy is one client for everyone behind it. One path per process. */
+conn_listen_server_t *conn_listen_server_unix_init(const char *path, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts);
+/* shared TLS state, created on first acquire and freed on last release */
+conn_tls_shared_t *conn_tls_shared_acquire(void);
+void conn_tls_shared_release(conn_tls_shared_t *shared);
+/* the calling loop's view of it, as acquire/release */
+conn_tls_view_t *conn_tls_view_acquire(void);
+void conn_tls_view_release(conn_tls_view_t *view);
 /* tcp connection functions */
 int conn_tcp_read(conn_t *self, void *buf, int count);
 int conn_tcp_write(conn_t *self, const void *buf, int count);
+int conn_tcp_writev(conn_t *self, const struct iovec *iov, int iovcnt);
+int conn_tcp_sendfile(conn_t *self, const struct iovec *iov, int iovcnt, int fd, off_t offset, int count);
 void conn_tcp_close(conn_t *self);
+int conn_tcp_writev_zerocopy(conn_t *self, const struct iovec *iov, int iovcnt);
+void conn_tcp_hold(conn_t *self, const void *owner, void (*release)(const void *owner));
+void conn_tcp_reap(conn_t *self);
+/* once the loop is done: closes the connections still lingering for
+   their zerocopy sends and releases what they hold */
+void conn_zerocopy_detach(void);
 /* tls connection functions */
+int conn_tls_handshake(conn_t *self);
+int conn_tls_early_pending(conn_t *self);
+const char *conn_tls_alpn(conn_t *self);
+void conn_tls_idle(conn_t *self);
+int conn_tls_watch(conn_t *self, smw_task *task, uint32_t events);
 int conn_tls_read(conn_t *self, void *buf, int count);
 int conn_tls_write(conn_t *self, const void *buf, int count);
+int conn_tls_writev(conn_t *self, const struct iovec *iov, int iovcnt);
 void conn_tls_close(conn_t *self);
+/* tls connection with the record layer moved into the kernel */
+void conn_ktls_close(conn_t *self);
+/* io_uring connection functions */
+int conn_uring_read(conn_t *self, void *buf, int count);
+int conn_uring_write(conn_t *self, const void *buf, int count);
+void conn_uring_close(conn_t *self);
+int conn_uring_watch(conn_t *self, smw_task *task, uint32_t events);
 /* accept functions */
 conn_t *conn_listen_server_tcp_accept_factory(conn_listen_server_t *self);
 conn_t *conn_listen_server_tls_accept_factory(conn_listen_server_t *self);
+conn_t *conn_listen_server_uring_accept_factory(conn_listen_server_t *self);
+conn_t *conn_listen_server_unix_accept_factory(conn_listen_server_t *self);
+/* server side tls over a socket accepted elsewhere, with view's config;
+   for tools that drive it without a listener (tools/tls_bench.c). NULL
+   on failure, the fd is the caller's to close then */
+conn_t *conn_tls_accept_fd(conn_tls_view_t *view, int client_fd);
+int conn_listen_server_uring_watch(conn_listen_server_t *self, uint32_t events);
 /* clean up functions */
 void conn_listen_server_dispose(conn_listen_server_t *self);
 void conn_listen_server_tcp_dispose(conn_listen_server_t *self);
 void conn_listen_server_tls_dispose(conn_listen_server_t *self);
+void conn_listen_server_uring_dispose(conn_listen_server_t *self);
+void conn_listen_server_unix_dispose(conn_listen_server_t *self);
+
+/* Dispatch. A build that serves one kind of connection only (make
+   CONN_ONLY=tcp behind a TLS terminating proxy, CONN_ONLY=tls) calls its
+   functions directly instead of through the vtable; the vtables stay for
+   the tools and for the listeners' own use. */
+#if defined(CONN_ONLY_TCP) && defined(CONN_ONLY_TLS)
+#error "CONN_ONLY is tcp or tls, not both"
+#elif defined(CONN_ONLY_TCP)
+
+/* plain TCP the only connection there is: the calls go straight to the tcp
+   functions, which -flto inlines into the read, parse and send path */
+static inline int conn_read(conn_t *self, void *buf, int count)
+{
+	return conn_tcp_read(self, buf, count);
+}
+
+static inline int conn_write(conn_t *self, const void *buf, int count)
+{
+	return conn_tcp_write(self, buf, count);
+}
+
+static inline void conn_close(conn_t *self)
+{
+	conn_tcp_close(self);
+}
+
+static inline int conn_watch(conn_t *self, smw_task *task, uint32_t events)
+{
+	return smw_watchFd(task, self->client_fd, events);
+}
+
+static inline int conn_writev(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	return conn_tcp_writev(self, iov, iovcnt);
+}
+
+static inline int conn_can_sendfile(conn_t *self)
+{
+	(void)self;
+	return 1;
+}
+
+static inline int conn_can_zerocopy(conn_t *self)
+{
+	(void)self;
+	return 1;
+}
+
+static inline int conn_writev_zerocopy(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	return conn_tcp_writev_zerocopy(self, iov, iovcnt);
+}
+
+static inline void conn_hold(conn_t *self, const void *owner, void (*release)(const void *owner))
+{
+	conn_tcp_hold(self, owner, release);
+}
+
+static inline void conn_reap(conn_t *self)
+{
+	conn_tcp_reap(self);
+}
+
+static inline int conn_sendfile(conn_t *self, const struct iovec *iov, int iovcnt, int fd, off_t offset, int count)
+{
+	return conn_tcp_sendfile(self, iov, iovcnt, fd, offset, count);
+}
+
+static inline int conn_early_pending(conn_t *self)
+{
+	(void)self;
+	return 0;
+}
+
+static inline void conn_idle(conn_t *self)
+{
+	(void)self;
+}
+
+static inline const char *conn_alpn(conn_t *self)
+{
+	(void)self;
+	return NULL;
+}
+
+static inline int conn_handshake(conn_t *self)
+{
+	(void)self;
+	return 0;
+}
+
+#elif defined(CONN_ONLY_TLS)
+
+/* TLS the only connection there is (without kTLS): the calls go straight
+   to the tls functions */
+static inline int conn_read(conn_t *self, void *buf, int count)
+{
+	return conn_tls_read(self, buf, count);
+}
+
+static inline int conn_write(conn_t *self, const void *buf, int count)
+{
+	return conn_tls_write(self, buf, count);
+}
+
+static inline void conn_close(conn_t *self)
+{
+	conn_tls_close(self);
+}
+
+static inline int conn_watch(conn_t *self, smw_task *task, uint32_t events)
+{
+	return conn_tls_watch(self, task, events);
+}
+
+static inline int conn_writev(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	return conn_tls_writev(self, iov, iovcnt);
+}
+
+/* the records are encrypted in user space, no file or page goes out as it is */
+static inline int conn_can_sendfile(conn_t *self)
+{
+	(void)self;
+	return 0;
+}
+
+static inline int conn_can_zerocopy(conn_t *self)
+{
+	(void)self;
+	return 0;
+}
+
+static inline int conn_writev_zerocopy(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	return conn_tls_writev(self, iov, iovcnt);
+}
+
+static inline void conn_hold(conn_t *self, const void *owner, void (*release)(const void *owner))
+{
+	(void)self;
+	release(owner);
+}
+
+static inline void conn_reap(conn_t *self)
+{
+	(void)self;
+}
+
+static inline int conn_sendfile(conn_t *self, const struct iovec *iov, int iovcnt, int fd, off_t offset, int count)
+{
+	(void)fd;
+	(void)offset;
+	(void)count;
+	return conn_tls_writev(self, iov, iovcnt);
+}
+
+static inline int conn_early_pending(conn_t *self)
+{
+	return conn_tls_early_pending(self);
+}
+
+static inline void conn_idle(conn_t *self)
+{
+	conn_tls_idle(self);
+}
+
+static inline const char *conn_alpn(conn_t *self)
+{
+	return conn_tls_alpn(self);
+}
+
+static inline int conn_handshake(conn_t *self)
+{
+	return conn_tls_handshake(self);
+}
+
+#else
+
+/* bytes read, 0 to retry once readable, -1 on failure or when the peer
+   closed; every read of the servers goes through here */
+static inline int conn_read(conn_t *self, void *buf, int count)
+{
+	return self->vtable->read(self, buf, count);
+}
+
+/* bytes taken, 0 to retry once writable, -1 on failure */
+static inline int conn_write(conn_t *self, const void *buf, int count)
+{
+	return self->vtable->write(self, buf, count);
+}
+
+static inline void conn_close(conn_t *self)
+{
+	self->vtable->close(self);
+}
+
+/* arm readiness interest of the task driving a connection */
+static inline int conn_watch(conn_t *self, smw_task *task, uint32_t events)
+{
+	if (self->vtable->watch)
+	{
+		return self->vtable->watch(self, task, events);
+	}
+	return smw_watchFd(task, self->client_fd, events);
+}
+
+/* bytes taken from the front of iov, 0 to retry once writable, -1 on
+   failure. Without a writev of its own the buffers are written in turn. */
+static inline int conn_writev(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	if (self->vtable->writev)
+	{
+		return self->vtable->writev(self, iov, iovcnt);
+	}
+	int total = 0;
+	for (int i = 0; i < iovcnt; i++)
+	{
+		int n = conn_write(self, iov[i].iov_base, (int)iov[i].iov_len);
+		if (n < 0)
+		{
+			return total > 0 ? total : -1;
+		}
+		total += n;
+		if (n < (int)iov[i].iov_len)
+		{
+			break;
+		}
+	}
+	return total;
+}
+
+static inline int conn_can_sendfile(conn_t *self)
+{
+	return self->vtable->sendfile != NULL;
+}
+
+static inline int conn_can_zerocopy(conn_t *self)
+{
+	return self->vtable->writev_zerocopy != NULL;
+}
+
+/* see conn_vtable, only for connections that conn_can_zerocopy */
+static inline int conn_writev_zerocopy(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	return self->vtable->writev_zerocopy(self, iov, iovcnt);
+}
+
+/* see conn_vtable, released right away by connections without zerocopy */
+static inline void conn_hold(conn_t *self, const void *owner, void (*release)(const void *owner))
+{
+	if (self->vtable->hold)
+	{
+		self->vtable->hold(self, owner, release);
+		return;
+	}
+	release(owner);
+}
+
+/* see conn_vtable */
+static inline void conn_reap(conn_t *self)
+{
+	if (self->vtable->reap)
+	{
+		self->vtable->reap(self);
+	}
+}
+
+/* see conn_vtable, only for connections that conn_can_sendfile */
+static inline int conn_sendfile(conn_t *self, const struct iovec *iov, int iovcnt, int fd, off_t offset, int count)
+{
+	return self->vtable->sendfile(self, iov, iovcnt, fd, offset, count);
+}
+
+/* 0 for connections without 0-RTT data */
+static inline int conn_early_pending(conn_t *self)
+{
+	if (self->vtable->early_pending)
+	{
+		return self->vtable->early_pending(self);
+	}
+	return 0;
+}
+
+/* see conn_vtable */
+static inline void conn_idle(conn_t *self)
+{
+	if (self->vtable->idle)
+	{
+		self->vtable->idle(self);
+	}
+}
+
+/* NULL for connections without ALPN */
+static inline const char *conn_alpn(conn_t *self)
+{
+	if (self->vtable->alpn)
+	{
+		return self->vtable->alpn(self);
+	}
+	return NULL;
+}
+
+/* 0 right away for connections without a handshake */
+static inline int conn_handshake(conn_t *self)
+{
+	if (self->vtable->handshake)
+	{
+		return self->vtable->handshake(self);
+	}
+	return 0;
+}
+
+#endif
 
 #endif /* __CONNECTION_H__ */
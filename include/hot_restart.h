@@ -0,0 +1,66 @@
+#ifndef __hot_restart_h_
+#define __hot_restart_h_
+
+#include "global_defines.h"
+
+#ifndef HOT_RESTART_MAX_FDS
+	#define HOT_RESTART_MAX_FDS 128
+#endif
+#ifndef HOT_RESTART_MAX_KEYS
+	#define HOT_RESTART_MAX_KEYS 65536
+#endif
+#ifndef HOT_RESTART_TIMEOUT_MS
+	#define HOT_RESTART_TIMEOUT_MS 5000
+#endif
+#ifndef HOT_RESTART_READY_TIMEOUT_MS
+	#define HOT_RESTART_READY_TIMEOUT_MS 60000
+#endif
+#ifndef HOT_RESTART_DRAIN_MS
+	#define HOT_RESTART_DRAIN_MS 10000
+#endif
+
+/*
+ * Hands a running server over to a new process without a moment in which
+ * nobody accepts. Every process started with --hot-restart=PATH listens on
+ * the Unix socket PATH once all its workers serve. The next one connects to
+ * it before opening the stores:
+ *
+ *   - the old process writes what its write behind holds, freezes the
+ *     weather and geolocation stores (see record_store_freeze) and sends
+ *     every listen socket it has (SCM_RIGHTS) and the keys of its hot
+ *     weather and geolocation entries, most asked for first
+ *   - the new process opens the same store files, loads those entries for
+ *     its hot caches and starts its workers, which take the listen sockets
+ *     over instead of binding new ones (hot_restart_adopt)
+ *   - once they all serve it says so, the old process stops accepting,
+ *     finishes the requests it has in hand, closes idle keep-alive
+ *     connections and exits, after HOT_RESTART_DRAIN_MS at the latest
+ *
+ * If the new process goes away before that the old one unfreezes its
+ * stores and goes on as before. Only a process of the same user is served.
+ */
+
+/* before the stores open: 1 if a process was listening on _Path and handed
+   over, 0 if none was (a cold start), -1 if the handover failed. _Path is
+   where hot_restart_ready listens afterwards either way. */
+int hot_restart_takeover(const char* _Path);
+/* after the stores open, loads the entries handed over; what was loaded */
+int hot_restart_warm(void);
+/* once every worker serves: releases the old process, closes the listen
+   sockets no worker took and listens on the path for the next one */
+void hot_restart_ready(void);
+/* the next process took over, the workers drain and return */
+int hot_restart_draining(void);
+/* after the workers are gone */
+void hot_restart_close(void);
+
+/* the listen socket on _Port the old process sent, -1 if there is none
+   left. It is registered. */
+int hot_restart_adopt(const char* _Port);
+/* the same for the unix socket on _Path (see conn_listen_server_unix_init) */
+int hot_restart_adopt_unix(const char* _Path);
+/* listen sockets to hand over, safe from any thread */
+void hot_restart_register(int _Fd);
+void hot_restart_unregister(int _Fd);
+
+#endif //__hot_restart_h_
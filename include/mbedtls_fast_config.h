@@ -0,0 +1,38 @@
+#ifndef MBEDTLS_FAST_CONFIG_H
+#define MBEDTLS_FAST_CONFIG_H
+
+/*
+ * mbedTLS options of the CRYPTO=fast build profile, read after
+ * mbedtls/mbedtls_config.h (MBEDTLS_USER_CONFIG_FILE). Everything here buys
+ * speed with memory or code size, or with a CPU the binary may run on:
+ *
+ *   - the Makefile builds for the AES and carry-less multiply instructions
+ *     of the machine it builds on (-maes -mpclmul, +crypto on AArch64), so
+ *     AES-GCM goes straight to them instead of checking for them on every
+ *     call, and the software AES tables are left out
+ *   - without them GCM gets the 4 KB multiplication table per key
+ *   - RSA private key operations use exponent windows of up to 6 bits
+ *     (mbedTLS defaults to 3), 64 precomputed values per exponentiation
+ *   - ECP multiplications by a point other than the generator, the ECDHE
+ *     share of a P-384 client, use 5 bit windows instead of 4
+ *   - SHA-256 and SHA-512 use the ARMv8 instructions where the CPU says it
+ *     has them
+ *
+ * tools/tls_bench.c measures the difference, build it with each profile.
+ */
+
+#if (defined(__AES__) && defined(__PCLMUL__)) || defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)
+#define MBEDTLS_AES_USE_HARDWARE_ONLY
+#else
+#define MBEDTLS_GCM_LARGE_TABLE
+#endif
+
+#define MBEDTLS_MPI_WINDOW_SIZE 6
+#define MBEDTLS_ECP_WINDOW_SIZE 6
+
+#if defined(__aarch64__)
+#define MBEDTLS_SHA256_USE_ARMV8_A_CRYPTO_IF_PRESENT
+#define MBEDTLS_SHA512_USE_A64_CRYPTO_IF_PRESENT
+#endif
+
+#endif
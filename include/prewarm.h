@@ -0,0 +1,77 @@
+#ifndef __prewarm_h_
+#define __prewarm_h_
+
+#include "global_defines.h"
+
+/* local times the region is walked when --prewarm-at does not say: the
+   quiet hours, then the hour before the morning peak */
+#ifndef PREWARM_WINDOWS
+	#define PREWARM_WINDOWS "03:00-05:00,06:00-07:00"
+#endif
+
+#ifndef PREWARM_MAX_WINDOWS
+	#define PREWARM_MAX_WINDOWS 8
+#endif
+
+/* cells of one region at most, a bounding box or a file */
+#ifndef PREWARM_MAX_CELLS
+	#define PREWARM_MAX_CELLS (1 << 20)
+#endif
+
+/* multi location upstream requests in flight at once */
+#ifndef PREWARM_MAX_INFLIGHT
+	#define PREWARM_MAX_INFLIGHT 4
+#endif
+
+/* a request is only started with more than this many left in the upstream
+   budget, above Weather_PREFETCH_BUDGET_RESERVE so prefetches keep theirs
+   and below CURL_CLIENT_RATE_BURST or it never runs */
+#ifndef PREWARM_BUDGET_RESERVE
+	#define PREWARM_BUDGET_RESERVE 40
+#endif
+
+/* asked again after a budget that was too low, and outside the windows */
+#ifndef PREWARM_BUDGET_WAIT_MS
+	#define PREWARM_BUDGET_WAIT_MS 1000
+#endif
+
+#ifndef PREWARM_CHECK_MS
+	#define PREWARM_CHECK_MS 60000
+#endif
+
+/* a pass over the region starts at most this often, the forecasts of the
+   last one only expire with the next model step */
+#ifndef PREWARM_PASS_INTERVAL_MS
+	#define PREWARM_PASS_INTERVAL_MS 900000
+#endif
+
+/*
+ * Scheduled pre-warming of the weather cache for a region, so traffic that
+ * follows the daily curve finds it warm rather than cold from the night.
+ * The region is a bounding box (--prewarm=LAT,LON,LAT,LON, south west and
+ * north east corners, west past east crosses the antimeridian) walked at
+ * Weather_GRID_DEGREES, or a file of LAT,LON lines (--prewarm=@FILE); its
+ * cells are quantized like requests are.
+ *
+ * Inside the windows (--prewarm-at=HH:MM-HH:MM,..., local time, a window
+ * may cross midnight) a task on one loop goes through the cells
+ * Weather_BATCH_MAX_LOCATIONS at a time as weather batches: fresh ones are
+ * skipped, the others fetched in one multi location upstream request each
+ * and stored like any fetch. A request is only started while more than
+ * PREWARM_BUDGET_RESERVE are left in the upstream budget and the cache only
+ * mode is off, client misses and prefetches come first. A window that
+ * closes leaves the pass where it is, the next one goes on from there.
+ */
+
+/* Before the workers start; -1 for a region or windows that do not parse,
+   _Windows NULL for PREWARM_WINDOWS */
+int prewarm_configure(const char* _Region, const char* _Windows);
+
+/* One loop runs it, after smw_init and job_pool_attach; nothing without a
+   region */
+int prewarm_attach(void);
+void prewarm_detach(void);
+
+void prewarm_dispose(void);
+
+#endif //__prewarm_h_
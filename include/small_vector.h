@@ -0,0 +1,53 @@
+#ifndef SMALL_VECTOR_H
+#define SMALL_VECTOR_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/* bytes of entries kept inside the vector itself, 16 entries of two pointers */
+#ifndef SMALL_VECTOR_INLINE_SIZE
+  #define SMALL_VECTOR_INLINE_SIZE 256
+#endif
+
+/*
+  A growable array of fixed size entries stored by value. The first
+  SMALL_VECTOR_INLINE_SIZE bytes of entries live inside the vector, more
+  spill to one heap block that doubles as it fills, so a short list costs
+  no allocation and a lookup is a scan over contiguous memory.
+  The vector points into itself: it is initialized where it stays and is
+  never copied by value.
+  Use LinkedList for lists that insert and remove in the middle.
+*/
+typedef struct {
+  void *items;
+  size_t size;
+  size_t capacity;
+  size_t itemSize;
+  union {
+    void *align;
+    unsigned char bytes[SMALL_VECTOR_INLINE_SIZE];
+  } inlineItems;
+} SmallVector;
+
+#define SmallVector_foreach(vector, type, item) \
+    for (type *item = (type *)(vector)->items; item < (type *)(vector)->items + (vector)->size; item++)
+
+/* An empty vector of _ItemSize byte entries */
+void SmallVector_init(SmallVector *vector, size_t itemSize);
+
+/* Appends a zeroed entry and returns a pointer to it, NULL if out of memory.
+   The pointer is valid until the next append. */
+void *SmallVector_push(SmallVector *vector);
+
+/* The entry at index, NULL if index does not exist */
+void *SmallVector_get(const SmallVector *vector, size_t index);
+
+/*
+  Remove all entries, the heap block (if any) is released
+    free_function is called with a pointer to each entry to release what it owns,
+    not the entry itself. NULL if there is nothing to release.
+*/
+void SmallVector_clear(SmallVector *vector, void (*free_function)(void *));
+
+#endif
@@ -1,41 +1,264 @@
-
 #ifndef __smw_h_
 #define __smw_h_
 
 #include <stdint.h>
 
 #include "global_defines.h"
+#include "timer_wheel.h"
+
+// Tasks are allocated in slabs of `smw_task_slab_size` entries, the table
+// grows by one slab whenever the free-list runs dry. Task pointers stay valid
+// for the lifetime of the task.
+#ifndef smw_task_slab_size
+	#define smw_task_slab_size 64
+#endif
+
+// Upper bound for how long one smw_work() pass may block in epoll_wait when
+// there are polled tasks and when only event driven tasks exist. Polled tasks
+// don't wait at all while the loop makes progress, idle passes back off
+// 1, 2, 4 .. ms up to smw_poll_backoff_max_ms.
+#ifndef smw_poll_backoff_max_ms
+	#define smw_poll_backoff_max_ms 8
+#endif
+#ifndef smw_max_wait_ms
+	#define smw_max_wait_ms 1000
+#endif
+// Readiness events collected per epoll_wait call
+#ifndef smw_epoll_batch
+	#define smw_epoll_batch 256
+#endif
+// Packets the kernel may take off a NIC queue per busy poll, see smw_setBusyPoll
+#ifndef smw_busy_poll_budget
+	#define smw_busy_poll_budget 64
+#endif
+
+// Per task class run time, call counts and a per pass latency histogram.
+// Two clock reads per callback, set to 0 to compile the accounting out.
+#ifndef smw_stats_enabled
+	#define smw_stats_enabled 1
+#endif
+// Distinct task classes (name + callback) tracked, extra ones share the last
+#ifndef smw_stats_max_classes
+	#define smw_stats_max_classes 32
+#endif
+// Pass latency buckets, bucket i counts passes that took [2^i, 2^(i+1)) us
+#define smw_stats_histogram_buckets 20
 
-// `smw_max_tasks` can be set in `global_defines.h` for test configuration. If
-// not defined there, keep the existing default behavior.
-#ifndef smw_max_tasks
-	#define smw_max_tasks 16
+// Passes a ready low priority task may be held back while higher priority
+// work keeps arriving, bounds how long accepts can be deferred under load
+#ifndef smw_low_priority_max_defer
+	#define smw_low_priority_max_defer 8
 #endif
 
+/* Interest flags for smw_watchFd, mapped onto EPOLLIN/EPOLLOUT internally */
+#define SMW_READ  0x1
+#define SMW_WRITE 0x4
+/* Set in revents when the run was caused by the task deadline expiring */
+#define SMW_TIMEOUT 0x8
+
+/*
+ * A task is either polled (legacy behaviour, the callback runs on every pass)
+ * or event driven. Event driven tasks only run when their fd is ready, their
+ * deadline has passed or someone called smw_wakeTask() on them.
+ */
+typedef enum
+{
+	smw_task_mode_poll = 0,
+	smw_task_mode_event
+} smw_task_mode;
+
+/*
+ * Within a pass tasks run by class: high (responses ready to send) before
+ * normal (reading, backend work) before low (accepting new clients).
+ */
+typedef enum
+{
+	smw_priority_high = 0,
+	smw_priority_normal,
+	smw_priority_low,
+	smw_priority_count
+} smw_priority;
+
+/* which run queue a task is linked into */
+typedef enum
+{
+	smw_queue_none = 0,
+	smw_queue_polled,
+	smw_queue_ready,
+	smw_queue_run,
+	smw_queue_free
+} smw_queue;
+
+typedef struct smw_task smw_task;
+
+/* accounting for every task sharing a name and callback */
+typedef struct
+{
+	const char* name;
+	void* callback;
+	uint64_t invocations;
+	uint64_t total_ns;
+	uint64_t max_ns;
+
+} smw_task_stats;
+
 typedef struct
+{
+	uint64_t iterations;
+	/* loop passes by time spent running callbacks */
+	uint64_t pass_histogram[smw_stats_histogram_buckets];
+	uint64_t max_pass_ns;
+	/* longest single callback and who caused it */
+	uint64_t max_stall_ns;
+	const char* max_stall_name;
+
+	smw_task_stats classes[smw_stats_max_classes];
+	int class_count;
+
+} smw_stats;
+
+struct smw_task
 {
 	void* context;
 	void (*callback)(void* context, uint64_t monTime);
 
-} smw_task;
+	smw_task_mode mode;
+	smw_priority priority;
+	int fd;            /* registered fd, -1 if none */
+	uint32_t events;   /* registered SMW_READ/SMW_WRITE interest */
+	uint32_t revents;  /* readiness that caused the current run */
+	uint32_t pending;  /* readiness collected since the last run */
+	uint64_t deadline; /* monotonic ms when the task should wake, 0 = none */
+
+	/* run queue / free-list links */
+	smw_queue queue;
+	smw_task* prev;
+	smw_task* next;
+
+	/* deadline, armed in the smw timer wheel */
+	timer_wheel_timer timer;
+
+	/* label for smw_getStats(), NULL groups the task by callback only */
+	const char* name;
+	smw_task_stats* stats;
+};
+
+typedef struct
+{
+	smw_task* head;
+	smw_task* tail;
 
+} smw_list;
 
 typedef struct
 {
-	smw_task tasks[smw_max_tasks];
+	/* slab storage, never moves once allocated */
+	smw_task** slabs;
+	int slab_count;
+	smw_task* free_list;
+	int task_count;
+
+	smw_list polled;
+	smw_list ready[smw_priority_count];
+	smw_list run[smw_priority_count];
+	/* consecutive passes the low class was held back */
+	int low_deferred;
+	/* current polled task wait, 0 right after a pass made progress */
+	int poll_backoff_ms;
+	int progress;
+
+	/* task deadlines and standalone timers */
+	timer_wheel timers;
+
+	int epoll_fd;
+
+	/* eventfd other threads ring after posting to the loop's inbox, read
+	   on the pass it wakes */
+	int doorbell_fd;
+	/* drained at the top of every pass, before any task runs */
+	int (*inbox)(void* _Context);
+	void* inbox_context;
+	/* the last drain left messages behind, don't block before the next */
+	int inbox_pending;
+
+	/* smw_setBusyPoll: never block in epoll_wait, and when the last
+	   pass's wait returned (ns) for the iteration metric */
+	int busy_poll;
+	uint64_t busy_poll_last_ns;
+	/* passes so far, what a task ran in the same pass as another can tell */
+	uint64_t pass;
+
+	smw_stats stats;
 
 } smw;
 
-extern smw g_smw;
+/* one scheduler per thread, every worker runs its own loop */
+extern __thread smw g_smw;
 
 int smw_init();
 
 smw_task* smw_createTask(void* _Context, void (*_Callback)(void* _Context, uint64_t _MonTime));
 void smw_destroyTask(smw_task* _Task);
 
+/* Switch the task to event mode and (re)register interest in _Fd.
+   _Events = 0 keeps the task parked until a deadline or wake. */
+int smw_watchFd(smw_task* _Task, int _Fd, uint32_t _Events);
+/* Drop the fd registration and return the task to polled mode */
+void smw_pollTask(smw_task* _Task);
+/* Event mode without an fd, the task only runs on wake or deadline */
+void smw_parkTask(smw_task* _Task);
+/* Wake the task at _MonTime with SMW_TIMEOUT in revents (0 cancels) */
+void smw_setDeadline(smw_task* _Task, uint64_t _MonTime);
+/* Make the task runnable on the next pass */
+void smw_wakeTask(smw_task* _Task);
+/* New tasks are smw_priority_normal */
+void smw_setPriority(smw_task* _Task, smw_priority _Priority);
+/* Called by polled tasks that got something done this pass, keeps the loop
+   spinning instead of backing off. Readiness and wakes count on their own. */
+void smw_progress();
+
+/* Standalone timers on the loop's wheel, for work that is not tied to a
+   task (accept resume, cache expiry). The callback runs inside smw_work()
+   and may re-arm the timer. */
+void smw_initTimer(timer_wheel_timer* _Timer, timer_wheel_callback _Callback, void* _Context);
+void smw_armTimer(timer_wheel_timer* _Timer, uint64_t _MonTime);
+void smw_cancelTimer(timer_wheel_timer* _Timer);
+
 void smw_work(uint64_t _MonTime);
 
+/* Busy polling for dedicated hosts: smw_work never blocks, it spins with
+   epoll_wait(0) and the kernel polls the NIC queues of the sockets for up
+   to _Usecs per call (epoll busy-poll parameters, Linux 6.9) rather than
+   waiting for their interrupt. The loop burns its core. Returns -1 if the
+   epoll parameters were refused, the loop spins all the same. */
+int smw_setBusyPoll(int _Usecs);
+
+/* Cross thread handoffs into this loop (utilities/loop_mailbox). _Drain
+   runs at the top of every pass and returns non-zero while messages are
+   left for the next one; NULL removes it. */
+void smw_setInbox(int (*_Drain)(void* _Context), void* _Context);
+/* The loop's doorbell, handed to the threads posting to it */
+int smw_doorbell();
+/* Any thread: wake the loop owning _Doorbell, its next pass drains */
+void smw_ringDoorbell(int _Doorbell);
+/* Outside smw_work (teardown): wait up to _TimeoutMs (-1 forever) for the
+   doorbell, then drain the inbox */
+void smw_awaitInbox(int _TimeoutMs);
+
 int smw_getTaskCount();
+/* the number of the pass running, see smw.pass */
+uint64_t smw_pass();
+
+/* _Name must outlive the task, typically a string literal */
+void smw_setTaskName(smw_task* _Task, const char* _Name);
+/* Snapshot of this loop's counters, zeroed if stats are compiled out */
+void smw_getStats(smw_stats* _Stats);
+void smw_resetStats();
+/* Account work that runs inside another task's callback (a backend step
+   driven by its server task) under its own class */
+void smw_recordSpan(const char* _Name, uint64_t _Nanoseconds);
+/* pass and callback latency of every loop on /metrics, once before the loops start */
+void smw_registerMetrics();
 
 void smw_dispose();
 
@@ -0,0 +1,51 @@
+#ifndef __startup_h_
+#define __startup_h_
+
+#include <stdint.h>
+#include "global_defines.h"
+
+/* Phases kept for the log and /metrics, more are run but not kept */
+#ifndef STARTUP_MAX_PHASES
+	#define STARTUP_MAX_PHASES 16
+#endif
+
+typedef struct
+{
+	const char* name;
+	/* 0 when it worked, what a failure means is the caller's to say */
+	int (*run)(void* _Context);
+	void* context;
+	int result;
+
+} startup_phase;
+
+/*
+ * The startup of the process as named phases, each timed. Phases that do
+ * not depend on each other (the TLS certificate and key, the cities and
+ * surprise assets, the GeoNames index) run at once, one thread each, so
+ * startup takes as long as the slowest of them rather than their sum.
+ * Every phase's milliseconds are logged and in /metrics as
+ * startup_phase_milliseconds{phase}, the time until every worker listened
+ * as startup_ready_milliseconds.
+ *
+ * Call startup_begin first thing in main, the phases from the main thread
+ * before the workers start.
+ */
+void startup_begin(void);
+
+/* Runs the _Count (up to STARTUP_MAX_PHASES) phases at once and waits
+   for all, their results in result; how many failed, -1 for a bad _Count */
+int startup_parallel(startup_phase* _Phases, int _Count);
+
+/* Keeps a phase that ran on the caller since _StartedMS (SystemMonotonicMS),
+   for steps with a control flow of their own */
+void startup_record(const char* _Name, uint64_t _StartedMS, int _Result);
+
+/*
+ * Every worker listens (workers_run's last one to come up calls it): logs
+ * the total and tells the service manager the process is ready, READY=1 on
+ * $NOTIFY_SOCKET as sd_notify(3) has it, for a systemd Type=notify unit.
+ */
+void startup_ready(void);
+
+#endif //__startup_h_
@@ -0,0 +1,66 @@
+#ifndef __timer_wheel_h_
+#define __timer_wheel_h_
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel with 1 ms resolution.
+ * timer_wheel_levels levels of 64 slots each, level n has a granularity of
+ * 64^n ms. With 4 levels timers up to ~4.6 hours out are placed directly,
+ * longer ones are parked in the last level and re-cascaded.
+ * Arm and cancel are O(1), expiry is amortised O(1) per timer.
+ * Timers are intrusive, the owner embeds a timer_wheel_timer.
+ */
+
+#define timer_wheel_levels 4
+#define timer_wheel_slot_bits 6
+#define timer_wheel_slots (1 << timer_wheel_slot_bits)
+
+#define TIMER_WHEEL_NEVER UINT64_MAX
+
+typedef struct timer_wheel_timer timer_wheel_timer;
+
+typedef void (*timer_wheel_callback)(void* _Context, uint64_t _MonTime);
+
+struct timer_wheel_timer
+{
+	uint64_t expires;
+	timer_wheel_callback callback;
+	void* context;
+
+	timer_wheel_timer* prev;
+	timer_wheel_timer* next;
+	/* list head the timer is linked into, NULL when not armed */
+	timer_wheel_timer** slot;
+};
+
+typedef struct
+{
+	uint64_t now;
+	int count;
+	timer_wheel_timer* slots[timer_wheel_levels][timer_wheel_slots];
+	/* timers due in the current advance step */
+	timer_wheel_timer* firing;
+
+} timer_wheel;
+
+void timer_wheel_init(timer_wheel* _Wheel, uint64_t _MonTime);
+
+void timer_wheel_timer_init(timer_wheel_timer* _Timer, timer_wheel_callback _Callback, void* _Context);
+/* (re)arm the timer to fire at _Expires, times in the past fire on the next advance */
+void timer_wheel_arm(timer_wheel* _Wheel, timer_wheel_timer* _Timer, uint64_t _Expires);
+void timer_wheel_cancel(timer_wheel* _Wheel, timer_wheel_timer* _Timer);
+
+static inline int timer_wheel_armed(const timer_wheel_timer* _Timer)
+{
+	return _Timer->slot != 0;
+}
+
+/* run the callbacks of every timer due at or before _MonTime */
+void timer_wheel_advance(timer_wheel* _Wheel, uint64_t _MonTime);
+/* earliest time advance needs to be called, TIMER_WHEEL_NEVER if empty.
+   For timers in the upper levels this is the cascade point, which may be
+   earlier than the real expiry. */
+uint64_t timer_wheel_next_expiry(const timer_wheel* _Wheel);
+
+#endif //__timer_wheel_h_
@@ -0,0 +1,69 @@
+#ifndef __uring_h_
+#define __uring_h_
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+#include "global_defines.h"
+
+/*
+ * Thin per-thread io_uring wrapper for the smw loop (raw syscalls, no
+ * liburing). SQEs prepared during a pass are submitted together by the ring
+ * task on the next pass, completions are reaped when the ring fd becomes
+ * readable and dispatched to the uring_op they were tagged with.
+ * Receives use a ring of provided buffers (buffer group 0).
+ */
+
+#ifndef uring_entries
+	#define uring_entries 256
+#endif
+#ifndef uring_buffer_count
+	#define uring_buffer_count 256 /* power of two */
+#endif
+#ifndef uring_buffer_size
+	#define uring_buffer_size 4096
+#endif
+
+#define URING_BUFFER_GROUP 0
+
+typedef struct uring_op uring_op;
+
+/* _Flags are the cqe flags, IORING_CQE_F_MORE means more completions follow */
+typedef void (*uring_handler)(uring_op* _Op, int32_t _Res, uint32_t _Flags);
+
+/* embed in the object owning the request, it has to outlive the last cqe */
+struct uring_op
+{
+	uring_handler handler;
+	void* context;
+};
+
+typedef struct uring_flush uring_flush;
+
+/* deferred work, runs once right before the ring task submits so writes
+   made during a pass can be coalesced into as few sqes as possible */
+struct uring_flush
+{
+	void (*callback)(uring_flush* _Flush);
+	void* context;
+	uring_flush* next;
+	int queued;
+};
+
+/* lazily sets up this thread's ring, 0 on success */
+int uring_attach();
+/* waits for every request in flight, then tears the ring down */
+void uring_detach();
+int uring_attached();
+
+/* next free sqe, zeroed and tagged with _Op (NULL for fire and forget
+   requests whose completion is ignored). NULL if the ring is unavailable. */
+struct io_uring_sqe* uring_getSqe(uring_op* _Op);
+
+void uring_deferFlush(uring_flush* _Flush);
+
+/* provided receive buffers */
+uint8_t* uring_buffer(uint16_t _Bid);
+void uring_recycleBuffer(uint16_t _Bid);
+
+#endif //__uring_h_
@@ -0,0 +1,109 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * Compact binary access log, one record per response sent, for replaying
+ * production traffic (tools/stress --replay). Records go through the
+ * logger's ring, so the loops never wait on the file; a full ring drops
+ * them (the logger reports how many).
+ *
+ * The file starts with ACCESS_LOG_MAGIC, then records of
+ *   u64 time_us     wall clock when the request came in
+ *   u32 latency_us  until the response was sent
+ *   u16 status
+ *   u8  route       access_log_route
+ *   u8  cache       access_cache, where the body came from
+ *   u8  flags       ACCESS_LOG_TRUNCATED
+ *   u8  reserved
+ *   u16 length      of the target that follows
+ * little endian, ACCESS_LOG_HEADER_SIZE bytes, then the target: the path
+ * and the parameters the route reads, normalized (lat/lon to 4 decimals,
+ * the rest dropped), so the same request always logs the same.
+ */
+
+#define ACCESS_LOG_MAGIC "UBACCES1"
+#define ACCESS_LOG_MAGIC_SIZE 8
+#define ACCESS_LOG_HEADER_SIZE 20
+// Longest target kept, with its terminator; longer ones are cut and flagged
+#define ACCESS_LOG_TARGET_SIZE 224
+
+#define ACCESS_LOG_TRUNCATED 0x01
+
+typedef enum {
+    ACCESS_ROUTE_OTHER,
+    ACCESS_ROUTE_CITIES,
+    ACCESS_ROUTE_LOCATION,
+    ACCESS_ROUTE_NEAREST,
+    ACCESS_ROUTE_WEATHER,
+    ACCESS_ROUTE_WEATHER_BATCH,
+    ACCESS_ROUTE_SURPRISE,
+    ACCESS_ROUTE_STATS,
+    ACCESS_ROUTE_RELOAD_CITIES,
+    ACCESS_ROUTE_METRICS,
+    ACCESS_ROUTE_DEBUG_MEMORY,
+    ACCESS_ROUTE_SUBSCRIBE,
+    ACCESS_ROUTE_CACHE_ONLY,
+    ACCESS_ROUTE_PEER_WEATHER,
+    ACCESS_ROUTE_WEATHER_BY_NAME,
+    ACCESS_ROUTE_CITIES_WEATHER,
+    ACCESS_ROUTE_CONFIG,
+    ACCESS_ROUTE_WEATHER_HISTORY,
+    ACCESS_ROUTE_LOCATION_BATCH,
+    ACCESS_ROUTE_HOT_KEYS,
+    ACCESS_ROUTE_COUNT
+} access_log_route;
+
+typedef enum {
+    ACCESS_CACHE_NONE,      // not cached, or an error
+    ACCESS_CACHE_HOT,       // the loop's memory cache
+    ACCESS_CACHE_STALE,     // a cached copy past its TTL, refreshed behind it
+    ACCESS_CACHE_DISK,      // the disk store
+    ACCESS_CACHE_LOCAL,     // a local dataset (the place index, GeoNames)
+    ACCESS_CACHE_FETCH,     // fetched upstream for this request
+    ACCESS_CACHE_COALESCED, // a fetch another request made
+    ACCESS_CACHE_FALLBACK,  // the fetch failed, an expired copy went out
+    ACCESS_CACHE_UNAVAILABLE, // cache-only, nothing cached and no fetch started
+    ACCESS_CACHE_PEER,      // the location's owner on the peer ring
+    ACCESS_CACHE_SHARED,    // the cache store every node shares (--cache-store)
+    ACCESS_CACHE_COUNT
+} access_cache;
+
+typedef struct {
+    uint64_t time_us;
+    uint32_t latency_us;
+    uint16_t status;
+    uint8_t route;
+    uint8_t cache;
+    uint8_t flags;
+    uint16_t target_length;
+    char target[ACCESS_LOG_TARGET_SIZE];
+} access_log_record;
+
+extern int g_accessLogEnabled;
+
+static inline int access_log_enabled(void) {
+    return __atomic_load_n(&g_accessLogEnabled, __ATOMIC_RELAXED);
+}
+
+// Appends to path (the magic first if it is new), 0 or -1. Before the loops start.
+int access_log_open(const char* path);
+// Once the loops are gone and the logger stopped
+void access_log_close(void);
+void access_log_write(const access_log_record* record);
+
+// The record into out (ACCESS_LOG_HEADER_SIZE + ACCESS_LOG_TARGET_SIZE at
+// least), the bytes written
+int access_log_encode(const access_log_record* record, uint8_t* out);
+// One record from data: the bytes it took, 0 if data ends inside it, -1 if
+// it is not one. The target is terminated.
+int access_log_decode(const uint8_t* data, size_t length, access_log_record* record);
+
+const char* access_log_route_name(int route);
+const char* access_log_cache_name(int cache);
+
+#endif
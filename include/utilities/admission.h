@@ -0,0 +1,50 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+#include "global_defines.h"
+#include "utilities/tuning.h"
+
+// Queue delay a loop is allowed to keep standing, the defaults of
+// tuning's admission_target_ms and admission_interval_ms
+#ifndef ADMISSION_TARGET_MS
+#define ADMISSION_TARGET_MS 5
+#endif
+// How long the delay has to stay above the target before anything is shed
+#ifndef ADMISSION_INTERVAL_MS
+#define ADMISSION_INTERVAL_MS 100
+#endif
+
+/*
+ * Load shedding on queue delay, CoDel style: the time a request waited
+ * between arriving and being started is sampled for every request. A short
+ * burst drains by itself, only an interval in which every request waited
+ * longer than the target means a standing queue; the loop is then
+ * overloaded until a request is started within the target again.
+ *
+ * While overloaded, a request that waited past the target is shed (it is
+ * likely to miss its deadline anyway), the ones that did not are still
+ * started. The queue is held near the target instead of growing until
+ * everything in it times out.
+ *
+ * Not thread safe, every loop keeps its own.
+ */
+
+typedef struct {
+    // end of the interval being measured, 0 before the first sample
+    uint64_t interval_end_ms;
+    int overloaded;
+} admission;
+
+#define ADMISSION_INIT {0, 0}
+
+// A request started now_ms after waiting delay_ms. 1 if the loop has just
+// become overloaded, -1 if it has just recovered, 0 otherwise.
+int admission_observe(admission* controller, uint64_t delay_ms, uint64_t now_ms);
+// 1 to shed a request that waited delay_ms
+static inline int admission_shed(const admission* controller, uint64_t delay_ms) {
+    return controller->overloaded && delay_ms > (uint64_t)tuning_get()->admission_target_ms;
+}
+
+#endif // ADMISSION_H
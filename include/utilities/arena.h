@@ -0,0 +1,68 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+#include "utilities/mem_account.h"
+
+/*
+ * Bump pointer allocator for memory that dies together, e.g. everything a
+ * request builds up until its response is sent. There is no free, the owner
+ * releases it all at once with arena_reset(). One block of the arena's block
+ * size is kept across resets so a reused arena allocates nothing in steady
+ * state, larger allocations get a block of their own that the reset returns.
+ *
+ * Blocks are accounted to the arena's mem_tag (MEM_TAG_ARENAS unless the
+ * owner sets one), when they are allocated and freed, not per allocation.
+ *
+ * Not thread safe, an arena belongs to its owner's loop.
+ *
+ * Blocks of ARENA_POOL_BLOCK_SIZE that arena_trim gives up wait in a pool
+ * of the loop for the next arena that needs one, counted as MEM_TAG_ARENAS
+ * meanwhile.
+ */
+
+#ifndef ARENA_ALIGNMENT
+#define ARENA_ALIGNMENT 16
+#endif
+
+#ifndef ARENA_POOL_BLOCK_SIZE
+#define ARENA_POOL_BLOCK_SIZE 16384
+#endif
+
+typedef struct arena_block arena_block;
+
+struct arena_block {
+    arena_block* next;
+    size_t size;
+    size_t used;
+};
+
+typedef struct {
+    arena_block* blocks;
+    size_t block_size;
+    int tag;
+} arena;
+
+#define ARENA_INIT(block_size) {NULL, (block_size), MEM_TAG_ARENAS}
+
+void arena_init(arena* arena, size_t block_size);
+// What the blocks count as, before the first allocation
+void arena_set_tag(arena* arena, int tag);
+
+// ARENA_ALIGNMENT aligned, NULL if out of memory
+void* arena_alloc(arena* arena, size_t size);
+// NUL terminated copy of length bytes of str
+char* arena_strndup(arena* arena, const char* str, size_t length);
+// 1 if ptr points into one of the arena's blocks
+int arena_owns(const arena* arena, const void* ptr);
+
+// Everything allocated so far is gone, the first block stays for reuse
+void arena_reset(arena* arena);
+// Like arena_reset, and the block it would keep goes too, for an owner
+// that will not allocate for a while (an idle connection)
+void arena_trim(arena* arena);
+void arena_dispose(arena* arena);
+
+#endif
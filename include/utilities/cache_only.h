@@ -0,0 +1,41 @@
+#ifndef CACHE_ONLY_H
+#define CACHE_ONLY_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * Cache-only mode: /getweather, /getweatherbatch and /getlocation answer
+ * from what the caches hold, stale copies included, and start no upstream
+ * fetch (joining one already running is fine); a miss is a 503. Switched
+ * by /admin/cacheonly, or on its own (auto, the default): for every route
+ * while the loop is shedding load, for one upstream while its circuit
+ * breaker is open.
+ *
+ * The setting is process wide, the overload is each loop's own.
+ */
+
+typedef enum {
+    CACHE_ONLY_AUTO = 0,
+    CACHE_ONLY_ON,
+    CACHE_ONLY_OFF,
+    CACHE_ONLY_SETTINGS
+} cache_only_setting;
+
+void cache_only_set(cache_only_setting setting);
+cache_only_setting cache_only_get(void);
+// "auto", "on" or "off"
+const char* cache_only_name(cache_only_setting setting);
+// The setting named name, -1 if there is none
+int cache_only_parse(const char* name, size_t length, cache_only_setting* setting);
+
+// This loop sheds load, from its admission controller
+void cache_only_set_overloaded(int overloaded);
+// 1 if requests on this loop are answered from the caches only
+int cache_only_active(void);
+// 1 if a fetch of url may be started, 0 in cache-only mode or while the
+// breaker of url's upstream is open (auto)
+int cache_only_allows_fetch(const char* url);
+
+#endif // CACHE_ONLY_H
@@ -0,0 +1,117 @@
+#ifndef CACHE_STORE_H
+#define CACHE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global_defines.h"
+#include "utilities/record_store.h"
+#include "utilities/shm_table.h"
+
+// Values the memory store keeps, one per key and slot hashed to it
+#ifndef CACHE_STORE_MEMORY_ENTRIES
+#define CACHE_STORE_MEMORY_ENTRIES 4096
+#endif
+// Buckets of an shm store and the largest value one holds
+#ifndef CACHE_STORE_SHM_ENTRIES
+#define CACHE_STORE_SHM_ENTRIES 4096
+#endif
+#ifndef CACHE_STORE_SHM_VALUE_SIZE
+#define CACHE_STORE_SHM_VALUE_SIZE (32u << 10)
+#endif
+// Log file bound and retention of a file: store
+#ifndef CACHE_STORE_FILE_CAPACITY
+#define CACHE_STORE_FILE_CAPACITY (256u << 20)
+#endif
+#ifndef CACHE_STORE_FILE_RETAIN_S
+#define CACHE_STORE_FILE_RETAIN_S 86400
+#endif
+// Redis: a reply later than this fails the connection, which is tried again
+// no sooner than the retry delay; operations past the pipeline depth fail
+#ifndef CACHE_STORE_REDIS_TIMEOUT_MS
+#define CACHE_STORE_REDIS_TIMEOUT_MS 250
+#endif
+#ifndef CACHE_STORE_REDIS_RETRY_MS
+#define CACHE_STORE_REDIS_RETRY_MS 1000
+#endif
+#ifndef CACHE_STORE_REDIS_MAX_PENDING
+#define CACHE_STORE_REDIS_MAX_PENDING 1024
+#endif
+// Longest name space, NUL included
+#define CACHE_STORE_NAME_SIZE 32
+
+/*
+ * A key value tier behind a vtable, so what keeps the values can change
+ * without its users knowing: memory shared by the loops of the process, a
+ * table in shared memory the processes forked after it was opened all
+ * reach, a record store file, or a Redis server every node shares. Values are
+ * addressed by a 64 bit key and a slot as in a record store and carry a
+ * stamp. The name space keeps a store's keys apart from anyone else's in
+ * an external server.
+ *
+ * Operations run from an smw loop with a mailbox and complete on it: done
+ * runs on a later pass, never inside the call. An operation can be
+ * cancelled until then, done is not called at all after that. One that
+ * could not start returns NULL and done is not called either.
+ */
+
+enum {
+    CACHE_STORE_FAILED = -1,
+    CACHE_STORE_OK = 0,
+    // no value (or none to touch or remove)
+    CACHE_STORE_MISS = 1
+};
+
+typedef struct cache_store cache_store;
+typedef struct cache_store_op cache_store_op;
+
+// data is a get's value, malloc'd and the callee's; NULL unless result is CACHE_STORE_OK
+typedef void (*cache_store_done)(void* context, int result, uint8_t* data, size_t length, time_t stamp);
+
+typedef struct {
+    cache_store_op* (*get)(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done, void* context);
+    // Copies data, kept ttl seconds (0: until it is evicted)
+    cache_store_op* (*put)(cache_store* self, uint64_t key, uint8_t slot, const uint8_t* data, size_t length,
+                           time_t stamp, int ttl, cache_store_done done, void* context);
+    cache_store_op* (*remove)(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done, void* context);
+    // Starts the value's ttl over, the stamp stays; a store without ttls leaves it
+    cache_store_op* (*touch)(cache_store* self, uint64_t key, uint8_t slot, int ttl, cache_store_done done,
+                             void* context);
+    // optional, the calling loop is done with the store: what it has in
+    // flight fails and its connections close
+    void (*release_thread)(cache_store* self);
+    // After every loop released it
+    void (*close)(cache_store* self);
+} cache_store_vtable;
+
+struct cache_store {
+    const cache_store_vtable* vtable;
+    char name_space[CACHE_STORE_NAME_SIZE];
+};
+
+// "memory", "shm", "file:PATH" or "redis://HOST:PORT", NULL if url is none
+// of them or the store cannot be set up. Before the loops start, and for
+// shm before the process forks.
+cache_store* cache_store_open(const char* url, const char* name_space);
+cache_store* cache_store_memory_open(int entries);
+cache_store* cache_store_shm_open(int entries, size_t value_size);
+cache_store* cache_store_file_open(const char* path);
+// Resolved once here, the loops connect on their first operation
+cache_store* cache_store_redis_open(const char* host, const char* port);
+
+// done may be NULL for a put, remove or touch nobody waits for; the
+// operation is not the caller's then
+cache_store_op* cache_store_get(cache_store* store, uint64_t key, uint8_t slot, cache_store_done done, void* context);
+cache_store_op* cache_store_put(cache_store* store, uint64_t key, uint8_t slot, const uint8_t* data, size_t length,
+                                time_t stamp, int ttl, cache_store_done done, void* context);
+cache_store_op* cache_store_remove(cache_store* store, uint64_t key, uint8_t slot, cache_store_done done,
+                                   void* context);
+cache_store_op* cache_store_touch(cache_store* store, uint64_t key, uint8_t slot, int ttl, cache_store_done done,
+                                  void* context);
+// op's done is not called, it may be NULL
+void cache_store_cancel(cache_store_op* op);
+void cache_store_release_thread(cache_store* store);
+void cache_store_close(cache_store** store);
+
+#endif // CACHE_STORE_H
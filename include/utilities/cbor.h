@@ -0,0 +1,31 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+// Containers nested deeper are refused
+#ifndef CBOR_MAX_DEPTH
+#define CBOR_MAX_DEPTH 64
+#endif
+
+/*
+ * Our JSON bodies as CBOR (RFC 8949) for clients that asked for
+ * application/cbor: one json_scan pass over the text, nothing built in
+ * between, so every body the server has as JSON (a cache entry, the cities
+ * snapshot, a backend's buffer) has its CBOR form without the struct it came
+ * from. Maps and arrays get definite lengths, whole numbers are integers and
+ * a real no more precise than its text (7 significant digits or fewer, all
+ * our measurements) goes out as a float32.
+ */
+
+// The CBOR of a JSON text, malloc'd; NULL if it is malformed, has a key
+// with escapes or nests too deep
+uint8_t* cbor_from_json(const char* json, size_t length, size_t* out_length);
+// 1 if an Accept header (NULL when absent) names application/cbor at least as
+// high as the JSON it would otherwise get
+int cbor_negotiate(const char* accept, size_t length);
+
+#endif // CBOR_H
@@ -0,0 +1,95 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+#ifndef CIRCUIT_BREAKER_MAX_HOSTS
+#define CIRCUIT_BREAKER_MAX_HOSTS 8
+#endif
+// Outcomes are judged per window, a window with fewer requests never trips
+#ifndef CIRCUIT_BREAKER_WINDOW_MS
+#define CIRCUIT_BREAKER_WINDOW_MS 10000
+#endif
+#ifndef CIRCUIT_BREAKER_MIN_REQUESTS
+#define CIRCUIT_BREAKER_MIN_REQUESTS 10
+#endif
+// Percent of failed, or of slower than CIRCUIT_BREAKER_SLOW_MS, requests that opens
+#ifndef CIRCUIT_BREAKER_FAILURE_PERCENT
+#define CIRCUIT_BREAKER_FAILURE_PERCENT 50
+#endif
+#ifndef CIRCUIT_BREAKER_SLOW_MS
+#define CIRCUIT_BREAKER_SLOW_MS 2000
+#endif
+// How long an open breaker fails fast before letting one probe through
+#ifndef CIRCUIT_BREAKER_OPEN_MS
+#define CIRCUIT_BREAKER_OPEN_MS 5000
+#endif
+// Adaptive timeout, a multiple of the observed p99 within these bounds
+#ifndef CIRCUIT_BREAKER_TIMEOUT_FACTOR
+#define CIRCUIT_BREAKER_TIMEOUT_FACTOR 3
+#endif
+#ifndef CIRCUIT_BREAKER_MIN_TIMEOUT_MS
+#define CIRCUIT_BREAKER_MIN_TIMEOUT_MS 1000
+#endif
+
+// Latency bucket i holds requests that took [2^i, 2^(i+1)) ms
+#define CIRCUIT_BREAKER_LATENCY_BUCKETS 16
+
+/*
+ * Per upstream host circuit breaker. Closed it lets everything through and
+ * counts outcomes; a window with too many failures or slow responses opens
+ * it and requests fail fast (backends fall back to stale copies). After
+ * CIRCUIT_BREAKER_OPEN_MS it is half open, a single probe goes out and its
+ * outcome closes or reopens it.
+ *
+ * It also keeps a decaying latency histogram and suggests a timeout from
+ * the p99, so a slow upstream is given up on well before the request
+ * timeout.
+ *
+ * Shared by every loop, each breaker has its own lock.
+ */
+
+typedef enum {
+    CIRCUIT_BREAKER_CLOSED = 0,
+    CIRCUIT_BREAKER_OPEN,
+    CIRCUIT_BREAKER_HALF_OPEN
+} circuit_breaker_state;
+
+typedef struct circuit_breaker {
+    char host[128];
+    pthread_mutex_t lock;
+
+    circuit_breaker_state state;
+    uint64_t opened_ms;
+    int probing;
+
+    uint64_t window_start_ms;
+    uint32_t window_requests;
+    uint32_t window_failures;
+    uint32_t window_slow;
+
+    uint32_t latency[CIRCUIT_BREAKER_LATENCY_BUCKETS];
+    uint32_t latency_count;
+} circuit_breaker;
+
+// The breaker of url's host, NULL if the table is full or url has no host
+circuit_breaker* circuit_breaker_for(const char* url);
+// 1 if a request may go out now, 0 to fail it fast; *probe is set when it
+// is the half open probe (its outcome has to be recorded or released)
+int circuit_breaker_allow(circuit_breaker* breaker, uint64_t now_ms, int* probe);
+void circuit_breaker_record(circuit_breaker* breaker, int success, uint64_t latency_ms, int probe, uint64_t now_ms);
+// A request that went out but was dropped before it finished
+void circuit_breaker_release(circuit_breaker* breaker, int probe);
+// Upper bound of the percent-th latency percentile, 0 until enough has been observed
+uint64_t circuit_breaker_latency_ms(circuit_breaker* breaker, int percent);
+// Timeout to give the next request, max_ms until enough has been observed
+long circuit_breaker_timeout_ms(circuit_breaker* breaker, long max_ms);
+// 1 if breaker is open and not yet due for its probe, without locking
+int circuit_breaker_is_open(circuit_breaker* breaker, uint64_t now_ms);
+// Frees the table, after every loop stopped
+void circuit_breaker_global_dispose(void);
+
+#endif
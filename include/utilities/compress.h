@@ -0,0 +1,50 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * Content-Encoding for response bodies: Accept-Encoding negotiation and
+ * one-shot gzip/brotli compression into a caller provided buffer. Meant to
+ * run once per payload, whoever caches a body keeps its compressed variants
+ * next to it. Brotli is only offered when built with COMPRESS_WITH_BROTLI (the
+ * Makefile's BROTLI=1, the default).
+ */
+
+// Bodies smaller than this go out as they are, the headers would eat the gain
+#ifndef COMPRESS_MIN_SIZE
+#define COMPRESS_MIN_SIZE 256
+#endif
+#ifndef COMPRESS_GZIP_LEVEL
+#define COMPRESS_GZIP_LEVEL 6
+#endif
+#ifndef COMPRESS_BROTLI_QUALITY
+#define COMPRESS_BROTLI_QUALITY 9
+#endif
+
+typedef enum {
+    COMPRESS_IDENTITY = 0,
+    COMPRESS_GZIP = 1,
+    COMPRESS_BROTLI = 2,
+    COMPRESS_ENCODINGS
+} compress_encoding;
+
+// Best encoding the client accepts (q > 0), brotli before gzip
+compress_encoding compress_negotiate(const char* accept_encoding, size_t length);
+
+// Content-Encoding token, NULL for identity
+const char* compress_encoding_name(compress_encoding encoding);
+// File suffix of a stored variant, "" for identity
+const char* compress_encoding_suffix(compress_encoding encoding);
+
+// Largest output compress_into() can produce for length bytes
+size_t compress_bound(compress_encoding encoding, size_t length);
+// Compressed size written to out, -1 on failure or if out is too small
+long compress_into(compress_encoding encoding, const void* data, size_t length, uint8_t* out, size_t capacity);
+// The same into a malloc'd buffer, NULL on failure
+uint8_t* compress_alloc(compress_encoding encoding, const void* data, size_t length, size_t* out_length);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+/*
+ * Stackless coroutines for backends' work(), protothread style: the body
+ * of work() is written top to bottom and suspends only where it waits on
+ * something outside (an inner backend, a pool job, a transfer), instead of
+ * a state enum stepped one case per tick. Between suspensions it runs
+ * straight through, a cache hit answers in the tick that asked.
+ *
+ *   int thing_work(void** ctx) {
+ *       thing_t* thing = ...;
+ *       CO_BEGIN(&thing->co);
+ *       thing->job = job_pool_submit(read, read_done, thing);
+ *       CO_AWAIT(&thing->co, !thing->job, BACKEND_WORK_WAIT);
+ *       CO_AWAIT(&thing->co, thing->inner_done, inner_work(&thing->inner));
+ *       thing->on_done(thing->ctx);
+ *       CO_END(&thing->co);
+ *       return BACKEND_WORK_WAIT;
+ *   }
+ *
+ * The resume point is a case label of a switch around the body (the
+ * source line), so: locals do not survive a suspension (keep what is
+ * needed in the struct), the body may not itself switch around an await,
+ * and two awaits may not share a line. Past CO_END the body is skipped.
+ */
+
+typedef struct {
+    // The line to resume at, 0 before the start, CO_FINISHED past the end
+    int line;
+} coroutine;
+
+#define CO_FINISHED -1
+
+#define CO_BEGIN(co)          \
+    switch ((co)->line) {     \
+    case 0:
+
+// Suspends until done holds; step runs each time it does not, its result is
+// what work() returns (AGAIN, WAIT, POLL) while still waiting. step is where
+// an inner backend's work() goes, BACKEND_WORK_WAIT for a job or callback.
+#define CO_AWAIT(co, done, step)                \
+    do {                                        \
+        (co)->line = __LINE__;                  \
+        __attribute__((fallthrough));           \
+    case __LINE__:                              \
+        if (!(done)) {                          \
+            int co_result_ = (step);            \
+            if (!(done)) return co_result_;     \
+        }                                       \
+    } while (0)
+
+// Returns result, the next call resumes right after
+#define CO_YIELD(co, result)                    \
+    do {                                        \
+        (co)->line = __LINE__;                  \
+        return (result);                        \
+    case __LINE__:;                             \
+    } while (0)
+
+#define CO_END(co)                  \
+    (co)->line = CO_FINISHED;       \
+    __attribute__((fallthrough));   \
+    default:;                       \
+    }
+
+// Where it is, for the backend_state probe
+#define CO_LINE(co) ((co)->line)
+
+#endif
@@ -1,27 +1,160 @@
 #ifndef CURL_CLIENT_H
 #define CURL_CLIENT_H
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <curl/curl.h>
 
+#include "global_defines.h"
+#include "timer_wheel.h"
+
+#ifndef CURL_CLIENT_MAX_CONNECTS
+#define CURL_CLIENT_MAX_CONNECTS 16
+#endif
+
+// HTTP/2 streams multiplexed on one upstream connection, and how many
+// connections to one host a loop may open before transfers queue for a stream
+#ifndef CURL_CLIENT_MAX_STREAMS
+#define CURL_CLIENT_MAX_STREAMS 100
+#endif
+
+#ifndef CURL_CLIENT_MAX_HOST_CONNECTIONS
+#define CURL_CLIENT_MAX_HOST_CONNECTIONS 4
+#endif
+
+// A transfer still running at the upstream's p95 is sent a second time,
+// for at most the budget's percent of requests (0 turns hedging off)
+#ifndef CURL_CLIENT_HEDGE_PERCENTILE
+#define CURL_CLIENT_HEDGE_PERCENTILE 95
+#endif
+
+#ifndef CURL_CLIENT_HEDGE_BUDGET_PERCENT
+#define CURL_CLIENT_HEDGE_BUDGET_PERCENT 5
+#endif
+
+// Upstream scheduling: transfers a loop runs at once per host, and the
+// request budget of the whole process (0 for none), open-meteo's free tier
+// allows 600 a minute
+#ifndef CURL_CLIENT_HOST_CONCURRENCY
+#define CURL_CLIENT_HOST_CONCURRENCY 16
+#endif
+
+#ifndef CURL_CLIENT_RATE_PER_MINUTE
+#define CURL_CLIENT_RATE_PER_MINUTE 600
+#endif
+
+#ifndef CURL_CLIENT_RATE_BURST
+#define CURL_CLIENT_RATE_BURST 60
+#endif
+
+// A transfer is not started with less of its request's deadline left than
+// the upstream's median latency, or than this with no latencies yet
+#ifndef CURL_CLIENT_DEADLINE_MIN_MS
+#define CURL_CLIENT_DEADLINE_MIN_MS 20
+#endif
+
+#ifndef CURL_CLIENT_POOL_SIZE
+#define CURL_CLIENT_POOL_SIZE 16
+#endif
+
+/*
+ * A curl_client is one transfer. The thread it runs on owns a single multi
+ * handle shared by all its transfers, so connections (and their TLS
+ * sessions) to an upstream stay open in the multi's cache and the next
+ * request to the same host skips the handshake. HTTPS upstreams are asked
+ * for HTTP/2 and concurrent transfers to one host share a connection as
+ * streams. Easy handles are taken from and given back to a small per-thread
+ * pool. The DNS cache and TLS sessions are shared by all threads, a loop
+ * that lost its connection resumes the session another loop negotiated.
+ *
+ * A loop that attached has its sockets watched by the smw scheduler and
+ * curl's timeouts armed on the smw timer wheel, nothing needs polling: a
+ * transfer finishing calls its client's on_complete. There a transfer
+ * slower than the upstream's p95 is also hedged: the same GET goes out
+ * again and whichever answers first is kept. Transfers wait in a queue per
+ * upstream host when the host has CURL_CLIENT_HOST_CONCURRENCY running or
+ * the process's request budget is used up, hosts take turns so a burst of
+ * geocoding searches cannot starve weather fetches (they are different
+ * hosts). Threads without a loop (warm up) drive their transfers with
+ * curl_client_poll/_wait.
+ *
+ * A transfer made while the loop works on a request with a deadline
+ * (curl_client_set_deadline) has its timeout cut to what is left of it,
+ * and is not made at all when that is less than the upstream usually
+ * takes: make_request fails as it does for an open breaker and the caller
+ * falls back to what it has.
+ *
+ * A client must be cleaned up on the thread that initialized it.
+ */
+
+// Receive buffer for bodies without a Content-Length, grown by doubling
+#ifndef CURL_CLIENT_INITIAL_BUFFER_SIZE
+#define CURL_CLIENT_INITIAL_BUFFER_SIZE (16 * 1024)
+#endif
+
 struct memory_struct {
     char* memory;
     size_t size;
+    size_t capacity;
+    CURL* easy; // asked for the Content-Length on the first chunk
 };
 
 typedef struct curl_client {
-    CURLM* multi_handle;
+    CURLM* multi_handle; // the thread's shared handle, not owned
     CURL* easy_handle;
     int still_running;
+    CURLcode result;
     struct memory_struct mem;
+    // Called once the transfer is done, set before make_request
+    void (*on_complete)(void* context);
+    void* context;
+    // The upstream's breaker while the transfer runs, told how it went
+    struct circuit_breaker* breaker;
+    int probe;
+    uint64_t started_ms;
+    long timeout_ms;
+    // The monotonic ms the request it is made for must be answered by, 0
+    // for none; curl_client_init takes the loop's current one
+    uint64_t deadline_ms;
+    // The duplicate of a slow transfer, the first to answer wins
+    CURL* hedge_handle;
+    struct memory_struct hedge_mem;
+    timer_wheel_timer hedge_timer;
+    // Queued for a slot on its host (still_running is set meanwhile)
+    struct curl_client_host* host;
+    int queued;
+    struct curl_client* queue_next;
+    struct curl_client* queue_prev;
 } curl_client;
 
+int curl_client_global_init(void);
+void curl_client_global_cleanup(void);
+// Has the calling thread's smw loop drive its transfers, after smw_init()
+int curl_client_attach_loop(void);
+// 1 if transfers complete on their own (on_complete), 0 if they need polls
+int curl_client_driven(void);
 int curl_client_init(curl_client** client);
+// -1 right away while the upstream's circuit breaker is open
 int curl_client_make_request(curl_client** client, const char* url);
 int curl_client_poll(curl_client** client);
+// Blocks until there is activity on the thread's transfers or timeout_ms passed
+int curl_client_wait(curl_client** client, int timeout_ms);
+// Hands the NUL terminated response over (free it), NULL if it was empty;
+// a second call gets NULL
 int curl_client_read_response(curl_client** client, char** buffer);
 int curl_client_cleanup(curl_client** client);
+// Requests the process's budget allows right now, INT_MAX without one; for
+// work that can wait, so it leaves the budget to what cannot
+int curl_client_budget_left(void);
+// The deadline (SystemMonotonicMS) of the request the calling thread works
+// on until the next call, 0 once it is done
+void curl_client_set_deadline(uint64_t deadline_ms);
+// 0 if a transfer to url made now would be refused for the deadline
+int curl_client_deadline_allows(const char* url);
+// Closes the calling thread's connections and frees its pooled handles,
+// detaches from the loop before smw_dispose()
+void curl_client_release_thread(void);
 
-#endif
\ No newline at end of file
+#endif
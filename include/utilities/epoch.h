@@ -0,0 +1,39 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "global_defines.h"
+
+// Threads that can be attached at once, every worker loop is one
+#ifndef EPOCH_MAX_THREADS
+#define EPOCH_MAX_THREADS 64
+#endif
+
+/*
+ * Epoch based reclamation for the read-mostly data every request reads and
+ * a reload replaces (the cities snapshot, the surprise table). Readers load
+ * the published pointer, a plain acquire load, and use what it points to
+ * until the end of their loop's pass without a lock or a reference. A
+ * writer publishes the new version and retires the old one, which is
+ * released once every attached loop went through a quiescent point (the
+ * workers call epoch_quiescent between smw passes). The release runs on the
+ * job pool, no loop stalls freeing a large version.
+ *
+ * Whatever has to outlive the pass (a body still being sent) takes a
+ * reference of its own, the version only goes once that is dropped too.
+ */
+
+// Per loop, before it reads anything published. Detached loops hold up nothing.
+int epoch_attach(void);
+void epoch_detach(void);
+// The calling loop holds nothing published before this, no-op if not attached
+void epoch_quiescent(void);
+
+// Swaps version into *slot and returns the one it replaced
+void* epoch_publish(void** slot, void* version);
+// release(version) once no loop can still be reading it. Straight away if no
+// loop is attached, never if out of memory (kept until the process exits).
+void epoch_retire(void* version, void (*release)(void* version));
+// Releases everything retired, after the loops stopped
+void epoch_dispose(void);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef FREQUENCY_SKETCH_H
+#define FREQUENCY_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Approximate access counts of 64 bit keys in fixed memory, the TinyLFU
+ * admission filter. A count-min sketch of four rows of saturating 4 bit
+ * counters (one per byte); once 10 times its width has been counted every
+ * counter is halved, so the estimate follows how popular a key is now
+ * rather than ever was.
+ *
+ * Thread safe, counters are updated with relaxed atomics and an estimate may
+ * miss an increment racing with it.
+ */
+
+typedef struct {
+    uint8_t* counters;
+    // counters per row, a power of two
+    size_t width;
+    uint32_t additions;
+    uint32_t sample;
+} frequency_sketch;
+
+// width is rounded up to a power of two, about the number of keys tracked
+int frequency_sketch_init(frequency_sketch* sketch, size_t width);
+void frequency_sketch_dispose(frequency_sketch* sketch);
+
+void frequency_sketch_increment(frequency_sketch* sketch, uint64_t key);
+// 0 - 15, 0 as well if the sketch is not set up
+int frequency_sketch_estimate(const frequency_sketch* sketch, uint64_t key);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef HEAVY_HITTERS_H
+#define HEAVY_HITTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+#include "utilities/loop_mailbox.h"
+
+// Keys each loop keeps in its heap, and what the merge returns at most
+#ifndef HEAVY_HITTERS_TOP_K
+#define HEAVY_HITTERS_TOP_K 32
+#endif
+// What a key is shown as, cut to fit
+#ifndef HEAVY_HITTERS_LABEL_SIZE
+#define HEAVY_HITTERS_LABEL_SIZE 64
+#endif
+
+/*
+ * The hottest keys and how often they were asked for, in fixed memory. Each
+ * loop has its own count-min sketch (four rows of 32 bit counters, updated
+ * conservatively) and a min-heap of its HEAVY_HITTERS_TOP_K most counted
+ * keys with their labels; once a loop counted 16 times its width every
+ * counter and heap count is halved, so the list follows what is hot now.
+ *
+ * Only the owning loop writes its sketch and heap, an add takes no lock and
+ * no atomic read-modify-write. Any thread reads: heavy_hitters_top merges
+ * the heaps of every loop under a sequence count per heap and sums the
+ * loops' sketches for each key. Adds off a loop are not counted.
+ */
+
+typedef struct {
+    uint64_t key;
+    uint64_t count;
+    // "" when added without one
+    char label[HEAVY_HITTERS_LABEL_SIZE];
+} heavy_hitters_entry;
+
+typedef struct heavy_hitters_shard heavy_hitters_shard;
+
+typedef struct {
+    // counters per row, a power of two
+    size_t width;
+    // made by a loop's first add
+    heavy_hitters_shard* shards[LOOP_MAILBOX_MAX_LOOPS];
+} heavy_hitters;
+
+// width is rounded up to a power of two (at most 65536), about the number
+// of keys a loop tells apart; before the loops start
+int heavy_hitters_init(heavy_hitters* hitters, size_t width);
+// Once the loops are gone
+void heavy_hitters_dispose(heavy_hitters* hitters);
+
+// One access of key on the calling loop, label (may be NULL) is copied if
+// the key enters the heap
+void heavy_hitters_add(heavy_hitters* hitters, uint64_t key, const char* label);
+// Every loop's count of key
+uint64_t heavy_hitters_estimate(const heavy_hitters* hitters, uint64_t key);
+// The up to max hottest keys of all loops, hottest first; how many
+int heavy_hitters_top(const heavy_hitters* hitters, heavy_hitters_entry* out, int max);
+
+#endif
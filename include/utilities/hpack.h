@@ -0,0 +1,60 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * HPACK (RFC 7541), the header compression of HTTP/2. The decoder keeps the
+ * dynamic table the client's encoder fills and takes Huffman coded strings;
+ * the encoder only refers to the static table (no dynamic table of its own,
+ * no Huffman), so what it writes never depends on earlier header blocks.
+ */
+
+// SETTINGS_HEADER_TABLE_SIZE we leave at its default, the most the client may fill
+#define HPACK_TABLE_SIZE 4096
+#ifndef HPACK_STRING_MAX
+#define HPACK_STRING_MAX 8192
+#endif
+
+typedef struct {
+    uint32_t offset;
+    uint32_t name_length;
+    uint32_t value_length;
+} hpack_entry;
+
+typedef struct {
+    // names and values of the entries, oldest first
+    char data[HPACK_TABLE_SIZE];
+    uint32_t used;
+    // a ring, newest is dynamic index 62
+    hpack_entry entries[HPACK_TABLE_SIZE / 32];
+    int newest;
+    int count;
+    // the RFC's size (name + value + 32 per entry) and what it may reach
+    uint32_t size;
+    uint32_t max_size;
+    // a name and a value decoded from Huffman
+    char scratch[HPACK_STRING_MAX];
+} hpack_decoder;
+
+// A header field of the block, the strings are not terminated and only valid
+// during the call. Anything but 0 stops the decoding with that result.
+typedef int (*hpack_emit)(void* context, const char* name, size_t name_length, const char* value, size_t value_length);
+
+void hpack_decoder_init(hpack_decoder* decoder);
+// Every field of a complete header block to emit, in order: 0 once done, -1 on
+// a compression error (the connection's table is lost, it can't go on)
+int hpack_decode(hpack_decoder* decoder, const uint8_t* block, size_t length, hpack_emit emit, void* context);
+
+// The representation of :status into out, indexed when the static table has
+// the code. The bytes written, -1 if they don't fit in size.
+int hpack_encode_status(uint8_t* out, size_t size, int status);
+// A field as a literal not added to any table, its name indexed when the
+// static table has it and else lowercased. -1 if it does not fit in size.
+int hpack_encode_header(uint8_t* out, size_t size, const char* name, size_t name_length, const char* value,
+                        size_t value_length);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * Delimiter search for the request parser: offset of the first byte equal to
+ * any of four delimiters (repeat one to look for fewer), length if there is
+ * none. Vectorized with SSE2/AVX2 on x86 and NEON on aarch64, the widest
+ * variant the CPU supports is picked on first use. The scalar version is the
+ * reference the others have to agree with.
+ */
+
+typedef size_t (*http_scan_fn)(const char* data, size_t length, const char set[4]);
+
+size_t http_scan(const char* data, size_t length, const char set[4]);
+// Name of the variant http_scan() dispatches to
+const char* http_scan_name(void);
+
+size_t http_scan_scalar(const char* data, size_t length, const char set[4]);
+#if defined(__x86_64__)
+size_t http_scan_sse2(const char* data, size_t length, const char set[4]);
+size_t http_scan_avx2(const char* data, size_t length, const char set[4]);
+// 0 if the CPU cannot run http_scan_avx2
+int http_scan_avx2_supported(void);
+#elif defined(__aarch64__)
+size_t http_scan_neon(const char* data, size_t length, const char set[4]);
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef HTTP_VALIDATORS_H
+#define HTTP_VALIDATORS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global_defines.h"
+
+/*
+ * Cache validators for conditional requests: strong ETags, HTTP dates and
+ * the If-None-Match / If-Modified-Since evaluation. Backends get the
+ * client's conditions as an http_conditional so they can decide, before
+ * producing a body, that the client's copy is still current.
+ */
+
+#define HTTP_ETAG_SIZE 40
+#define HTTP_DATE_SIZE 32
+
+typedef struct {
+    // If-None-Match as sent, "" if absent
+    char if_none_match[128];
+    // If-Modified-Since, 0 if absent or unparsable
+    time_t if_modified_since;
+} http_conditional;
+
+// "<mtime>-<size>" in hex, for content identified by a file version
+void http_etag_from_file(char out[HTTP_ETAG_SIZE], time_t mtime, uint64_t size);
+// Hash of the bytes, for generated content
+void http_etag_from_data(char out[HTTP_ETAG_SIZE], const void* data, size_t length);
+
+// Tells a variant of the same content apart (another Content-Encoding),
+// "\"x\"" becomes "\"x-<variant>\""
+void http_etag_variant(char etag[HTTP_ETAG_SIZE], const char* variant);
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+void http_date_format(char out[HTTP_DATE_SIZE], time_t t);
+// 0 on success, -1 if value is no IMF-fixdate
+int http_date_parse(const char* value, size_t length, time_t* t);
+
+// 1 if the client has the representation: any etag in If-None-Match matches
+// (weak comparison, "*" matches all), or without If-None-Match, last_modified
+// is not newer than If-Modified-Since. etag NULL and last_modified 0 if unknown.
+int http_conditional_is_current(const http_conditional* conditional, const char* etag, time_t last_modified);
+// 1 if the client sent any condition
+int http_conditional_present(const http_conditional* conditional);
+
+// The one byte range of a Range header for a body of size bytes, [*start,
+// *end] inclusive: 1 if it is satisfiable, -1 if not (416), 0 if the header
+// is to be ignored (no "bytes=" range, or several of them) and the whole
+// body sent
+int http_range_parse(const char* value, size_t length, uint64_t size, uint64_t* start, uint64_t* end);
+// 1 if If-Range names this representation: the ETag by strong comparison,
+// or a date equal to last_modified
+int http_if_range_matches(const char* value, size_t length, const char* etag, time_t last_modified);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * Memory for the tables that are large and probed at random, the record
+ * store indexes and the geolocation arrays, where a lookup otherwise costs
+ * a TLB miss or two. Explicit mode maps them from the reserved huge page
+ * pool (MAP_HUGETLB, vm.nr_hugepages), transparent mode, and explicit when
+ * the pool is empty, maps them aligned and asks for THP with
+ * madvise(MADV_HUGEPAGE). Whether the kernel really backs them is only seen
+ * in smaps, huge_pages_report reads it from there.
+ *
+ * Tables under HUGE_PAGES_MIN_BYTES, and all of them with the mode off, come
+ * from the heap (calloc); huge_pages_free tells the two apart.
+ */
+
+// 0 off, 1 transparent, 2 explicit
+#ifndef HUGE_PAGES_MODE
+#define HUGE_PAGES_MODE 2
+#endif
+// Size of a huge page, mappings are rounded up to it
+#ifndef HUGE_PAGES_SIZE
+#define HUGE_PAGES_SIZE (2 << 20)
+#endif
+// Smallest table worth a mapping of its own
+#ifndef HUGE_PAGES_MIN_BYTES
+#define HUGE_PAGES_MIN_BYTES (2 << 20)
+#endif
+// Mappings alive at once, beyond that tables come from the heap
+#ifndef HUGE_PAGES_MAX_MAPPINGS
+#define HUGE_PAGES_MAX_MAPPINGS 32
+#endif
+
+typedef enum {
+    HUGE_PAGES_OFF = 0,
+    HUGE_PAGES_TRANSPARENT,
+    HUGE_PAGES_EXPLICIT,
+    HUGE_PAGES_MODES
+} huge_pages_mode;
+
+// Before the first table is allocated
+void huge_pages_set_mode(huge_pages_mode mode);
+huge_pages_mode huge_pages_get_mode(void);
+// "off", "transparent" or "explicit"
+const char* huge_pages_mode_name(huge_pages_mode mode);
+// The mode named name, -1 if there is none
+int huge_pages_parse(const char* name, huge_pages_mode* mode);
+
+// size zeroed bytes for the table region (a name that outlives it), NULL if
+// out of memory
+void* huge_pages_alloc(const char* region, size_t size);
+// The first old_size bytes of ptr moved to a table of size bytes, ptr is
+// freed; NULL if out of memory, ptr is kept then
+void* huge_pages_realloc(const char* region, void* ptr, size_t old_size, size_t size);
+void huge_pages_free(void* ptr);
+
+// The live mappings as a JSON array, what each asked for and how much of it
+// the kernel backs with huge pages; bytes written or -1 if out did not fit
+int huge_pages_report(char* out, size_t size);
+
+#endif // HUGE_PAGES_H
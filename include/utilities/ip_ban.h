@@ -0,0 +1,39 @@
+#ifndef IP_BAN_H
+#define IP_BAN_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "global_defines.h"
+
+// Seconds a client the accept limiter turned away is dropped in the kernel
+#ifndef IP_BAN_SECONDS
+#define IP_BAN_SECONDS 10
+#endif
+
+/*
+ * Addresses banned ahead of the socket. The XDP program of
+ * tools/xdp_ban.bpf.c (make xdp_ban.bpf.o, attached with bpftool) drops the
+ * SYNs of every address in its ban map to the ports in its port map, until
+ * the time stored with it (CLOCK_MONOTONIC ns) has passed. The server
+ * opens both maps where bpftool pinned them (--xdp-ban=DIR), adds its
+ * listening ports and, when the accept limiter turns a client away, puts
+ * the address in for IP_BAN_SECONDS: its next connections cost no accept,
+ * allocation or TLS handshake, not even a socket.
+ *
+ * Without --xdp-ban (or the program) every call is a no-op. The maps are
+ * updated with the bpf(2) syscall, no libbpf; thread safe.
+ */
+
+// Opens DIR/ubweather_bans and DIR/ubweather_ban_ports, before the loops
+// start; -1 if either is missing or not a map this build knows
+int ip_ban_open(const char* dir);
+void ip_ban_close(void);
+
+// A listening port (host order) whose SYNs are checked
+int ip_ban_add_port(uint16_t port);
+// Drops the address's SYNs for seconds from now, a ban already there is
+// extended. IPv4 and IPv6, anything else is ignored.
+void ip_ban_add(const struct sockaddr* addr, uint32_t seconds);
+
+#endif
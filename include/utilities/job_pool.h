@@ -0,0 +1,39 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include "global_defines.h"
+
+#ifndef JOB_POOL_THREADS
+#define JOB_POOL_THREADS 2
+#endif
+
+/*
+ * Completion based thread pool for blocking work (disk I/O, JSON files).
+ *
+ * work() runs on a pool thread, done() runs afterwards on the smw loop that
+ * submitted the job, so backends never block the event loop and never need
+ * locks of their own. Jobs come back through the loop's mailbox, a loop has
+ * to loop_mailbox_attach() and job_pool_attach() before submitting.
+ */
+
+typedef void (*job_pool_work)(void* context);
+typedef void (*job_pool_done)(void* context);
+
+typedef struct job_pool_job job_pool_job;
+
+// Process wide, start before and stop after all worker loops
+int job_pool_init(int threads);
+void job_pool_dispose(void);
+
+// Per smw loop, detach waits for the loop's jobs still in flight
+int job_pool_attach(void);
+void job_pool_detach(void);
+
+// Returned handle is valid until done() has run, NULL on failure
+job_pool_job* job_pool_submit(job_pool_work work, job_pool_done done, void* context);
+
+// The owner goes away while the job is in flight: release() replaces done()
+// and is responsible for freeing the context once the work has finished
+void job_pool_abandon(job_pool_job* job, job_pool_done release);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <jansson.h>
+
+#include "utilities/arena.h"
+#include "global_defines.h"
+
+// Block size of the arenas the backends hand to jansson, about what a page
+// of search results takes
+#ifndef JSON_ARENA_BLOCK_SIZE
+#define JSON_ARENA_BLOCK_SIZE 16384
+#endif
+
+// What a thread's first json_buffer starts at, later ones at its last dump's size
+#ifndef JSON_BUFFER_INITIAL_SIZE
+#define JSON_BUFFER_INITIAL_SIZE 1024
+#endif
+
+/*
+ * jansson's allocations on a thread go to an arena between json_arena_begin
+ * and json_arena_end, so the nodes and strings a backend builds and dumps
+ * while it handles a request cost a bump each and are released with the
+ * arena instead of one free per node. Elsewhere jansson uses the heap.
+ *
+ * Freeing arena memory is a no-op and heap memory is freed as usual, values
+ * made before the scope may be released in it. Values made in it must not
+ * outlive it, json_dumps strings included: dump into a json_buffer (or
+ * json_arena_dumps), which is not jansson's memory. Scopes do not nest.
+ */
+
+// Once, before any thread uses jansson
+void json_arena_install(void);
+
+void json_arena_begin(arena* arena);
+void json_arena_end(void);
+
+/*
+ * Where a dump goes instead of json_dumps' string: jansson writes straight
+ * into the buffer, growing it as it goes, and the text is taken from it as
+ * it is, no copy, by whoever sends or keeps it. Buffers in an arena (the
+ * request's) are released with it, heap ones (arena NULL) are free()d by the
+ * taker. A new buffer starts at the size of the thread's last dump, so most
+ * take one allocation.
+ */
+typedef struct {
+    arena* arena;
+    char* data;
+    size_t length;
+    size_t capacity;
+} json_buffer;
+
+void json_buffer_init(json_buffer* buffer, arena* arena);
+// json into the buffer in place of what it held, NUL terminated, 0 or -1
+int json_buffer_dump(json_buffer* buffer, const json_t* json, size_t flags);
+// The text dumped, now the caller's, and its length; the buffer is left empty
+char* json_buffer_take(json_buffer* buffer, size_t* length);
+void json_buffer_dispose(json_buffer* buffer);
+
+// A heap json_buffer's text, in place of json_dumps: from the heap whether a
+// scope is open or not
+char* json_arena_dumps(const json_t* json, size_t flags);
+
+#endif
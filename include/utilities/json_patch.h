@@ -0,0 +1,19 @@
+#ifndef JSON_PATCH_H
+#define JSON_PATCH_H
+
+#include <jansson.h>
+
+#include "global_defines.h"
+
+/*
+ * JSON merge patches (RFC 7396): an object of the members that changed, a
+ * member that is gone set to null. Arrays and other values are replaced as
+ * a whole, a forecast series that moved on goes out again entirely.
+ */
+
+// The patch that turns from into to, in *patch (NULL if they are equal).
+// -1 if a merge patch cannot say it: a document that is not an object, or a
+// member that changed to null (null removes). Neither value is changed.
+int json_patch_diff(const json_t* from, const json_t* to, json_t** patch);
+
+#endif
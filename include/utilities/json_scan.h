@@ -0,0 +1,80 @@
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Pull tokenizer over a JSON text in memory, for parsers that know the
+ * document they expect: they walk it in one pass, read the values they want
+ * straight into their own structs and skip the rest without allocating.
+ * Nothing is built in between, the only state is the offset, so a value can
+ * be revisited with json_scan_tell/json_scan_seek.
+ *
+ * Every call returns -1 on malformed input and leaves the scanner failed,
+ * later calls fail too, so a parser can check once at the end.
+ */
+
+typedef enum {
+    JSON_SCAN_OBJECT,
+    JSON_SCAN_ARRAY,
+    JSON_SCAN_STRING,
+    JSON_SCAN_NUMBER,
+    JSON_SCAN_TRUE,
+    JSON_SCAN_FALSE,
+    JSON_SCAN_NULL,
+    JSON_SCAN_END,  // nothing but whitespace left
+    JSON_SCAN_ERROR
+} json_scan_type;
+
+typedef struct {
+    const char* data;
+    size_t length;
+    size_t offset;
+    // Just inside an object or array, no comma before the first member
+    int fresh;
+    int failed;
+} json_scan;
+
+void json_scan_init(json_scan* scan, const char* data, size_t length);
+// What the next value is, without consuming it
+json_scan_type json_scan_peek(json_scan* scan);
+
+// Consumes the '{', then json_scan_object_next for each member: 1 with the
+// key (raw, escapes not decoded) and the ':' consumed, the value is next; 0
+// once the '}' is consumed
+int json_scan_object_begin(json_scan* scan);
+int json_scan_object_next(json_scan* scan, const char** key, size_t* length);
+// Consumes the '[', then json_scan_array_next: 1 if an element is next, 0
+// once the ']' is consumed
+int json_scan_array_begin(json_scan* scan);
+int json_scan_array_next(json_scan* scan);
+
+int json_scan_number(json_scan* scan, double* value);
+// A number, truncated if it has a fraction
+int json_scan_int(json_scan* scan, long long* value);
+int json_scan_bool(json_scan* scan, int* value);
+int json_scan_null(json_scan* scan);
+// The string decoded (UTF-8, checked) into out of size bytes with the NUL,
+// its length; -1 as well if it does not fit
+int json_scan_string(json_scan* scan, char* out, size_t size);
+// The string decoded into a malloc'd copy
+char* json_scan_string_dup(json_scan* scan);
+// The next value whatever it is, containers with everything in them
+int json_scan_skip(json_scan* scan);
+
+// Where the next value starts, to come back with json_scan_seek. Seeking
+// back behind a container member leaves it as after the member's value.
+static inline size_t json_scan_tell(json_scan* scan) {
+    return scan->offset;
+}
+static inline void json_scan_seek(json_scan* scan, size_t offset) {
+    scan->offset = offset;
+    scan->fresh = 0;
+}
+
+static inline int json_scan_key_is(const char* key, size_t length, const char* name) {
+    return strlen(name) == length && memcmp(key, name, length) == 0;
+}
+
+#endif
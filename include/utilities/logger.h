@@ -0,0 +1,103 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "global_defines.h"
+
+/*
+ * Leveled logging that keeps the loops off stdout: a message is formatted
+ * into a slot of a lock-free ring and a background thread writes the ring
+ * out, so a slow terminal or pipe costs the caller nothing. A full ring
+ * drops messages instead of blocking (counted and reported), and every call
+ * site lets through LOG_SITE_PER_SECOND messages a second, the rest is
+ * counted into the next one that gets through.
+ *
+ * Levels below LOG_COMPILED_LEVEL are not compiled in (MODE=release leaves
+ * out LOG_DEBUG), the rest is filtered by logger_set_level at run time.
+ * Before logger_start and after logger_stop messages are written directly.
+ *
+ * Binary records (the access log's, the traces) share the ring, unlimited,
+ * each on a channel with its own sink set with logger_set_binary_sink. The
+ * writer thread puts them in the file as they are, or through the channel's
+ * record writer when it has one (to format them off the loops).
+ */
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Messages the ring holds, a power of two
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 1024
+#endif
+
+// Longest message kept, longer ones are cut
+#ifndef LOG_MESSAGE_SIZE
+#define LOG_MESSAGE_SIZE 256
+#endif
+
+// Messages a second one call site may log
+#ifndef LOG_SITE_PER_SECOND
+#define LOG_SITE_PER_SECOND 20
+#endif
+
+// How long the writer sleeps once the ring is empty
+#ifndef LOG_FLUSH_INTERVAL_MS
+#define LOG_FLUSH_INTERVAL_MS 20
+#endif
+
+typedef enum {
+    LOGGER_CHANNEL_ACCESS,
+    LOGGER_CHANNEL_TRACE,
+    LOGGER_CHANNEL_COUNT
+} logger_channel;
+
+// Writes one record of a channel to its file, on the writer thread
+typedef void (*logger_record_writer)(FILE* file, const void* data, int length);
+
+// Rate limit state of a call site, one per LOG_ macro use
+typedef struct {
+    uint32_t window;
+    uint32_t count;
+    uint32_t suppressed;
+} logger_site;
+
+extern int g_loggerLevel;
+
+// Starts the writer thread, 0 or -1 (messages are then written directly)
+int logger_start(void);
+// Writes out what is left and stops the thread
+void logger_stop(void);
+void logger_set_level(int level);
+// LOG_LEVEL_ of "debug", "info", "warn" or "error", -1 for anything else
+int logger_parse_level(const char* name);
+
+void logger_write(logger_site* site, int level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+// Where the records of channel go, NULL drops them; writer NULL writes them
+// as they are. Not changed while they are written.
+void logger_set_binary_sink(int channel, FILE* file, logger_record_writer writer);
+// length bytes, at most LOG_MESSAGE_SIZE, to the channel's sink in one piece
+void logger_write_binary(int channel, const void* data, int length);
+
+#define LOG_AT(level, ...)                                                                      \
+    do {                                                                                        \
+        if ((level) >= LOG_COMPILED_LEVEL && (level) >= __atomic_load_n(&g_loggerLevel, __ATOMIC_RELAXED)) { \
+            static logger_site logger_site_;                                                    \
+            logger_write(&logger_site_, (level), __VA_ARGS__);                                  \
+        }                                                                                       \
+    } while (0)
+
+// One line each, without the newline
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
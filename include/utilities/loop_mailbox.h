@@ -0,0 +1,73 @@
+#ifndef LOOP_MAILBOX_H
+#define LOOP_MAILBOX_H
+
+#include <stdint.h>
+
+#include "global_defines.h"
+
+#ifndef LOOP_MAILBOX_MAX_LOOPS
+#define LOOP_MAILBOX_MAX_LOOPS 64
+#endif
+// Slots in a loop's ring, a power of two
+#ifndef LOOP_MAILBOX_RING_SIZE
+#define LOOP_MAILBOX_RING_SIZE 1024
+#endif
+// Messages run per smw pass before the loop's tasks get their turn
+#ifndef LOOP_MAILBOX_DRAIN_BATCH
+#define LOOP_MAILBOX_DRAIN_BATCH 256
+#endif
+
+/*
+ * Messages into smw loops, the one way work is handed from one thread to a
+ * loop: every worker loop has a mailbox, any thread can post to it and the
+ * loop runs what was posted on its own thread. The mailbox is a bounded
+ * lock-free MPSC ring (Vyukov), a post takes no lock and rings the loop's
+ * smw doorbell at most once per drain. smw drains it in batches at the top
+ * of every pass, before the tasks the messages wake run.
+ *
+ * A full ring is back pressure, not an error: a loop posting keeps the
+ * message in its outbox and retries on its following passes, any other
+ * thread waits for room. Posts a loop makes to itself never touch the ring.
+ *
+ * A key belongs to one loop (loop_mailbox_owner), so state split by key
+ * needs no locks: the owner keeps it and everyone else sends a message.
+ */
+
+typedef struct loop_message loop_message;
+typedef void (*loop_message_run)(loop_message* message);
+
+// Embedded in whatever is sent, run decides what happens to it
+struct loop_message {
+    loop_message* next;
+    // on the receiving loop
+    loop_message_run run;
+    // on the sending loop instead if the message waited in its outbox and
+    // the receiver went away meanwhile, NULL if nothing needs releasing
+    loop_message_run drop;
+    // set by loop_mailbox_post
+    int to;
+};
+
+// Process wide, count loops attach with indexes below it. Before they start.
+int loop_mailbox_init(int count);
+// Loops loop_mailbox_init was told about, 0 before it
+int loop_mailbox_count(void);
+// Post counters on /metrics, once before the loops start
+void loop_mailbox_register_metrics(void);
+
+// Per smw loop, after smw_init. Detach stops taking posts and runs what is
+// queued still, everything the loop's posts depend on has to be up until it.
+int loop_mailbox_attach(int index);
+void loop_mailbox_detach(void);
+
+// The calling loop's index, -1 if it has no mailbox
+int loop_mailbox_self(void);
+// The index of the loop key belongs to, the calling loop's while it is
+// the only one
+int loop_mailbox_owner(uint64_t key);
+
+// Queues message to run on loop index. -1 if that loop has no mailbox
+// (never attached or gone), the message stays the caller's then.
+int loop_mailbox_post(int index, loop_message* message);
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef MEM_ACCOUNT_H
+#define MEM_ACCOUNT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * Bytes and objects held per subsystem, current and peak, for /debug/memory
+ * and the memory_* gauges of /metrics. Only what really reaches the heap is
+ * counted: a pool miss and the destroy of what a full pool turns away, an
+ * arena's blocks, a cache's bodies, a transfer's buffer growing. Objects
+ * going round a pool or an arena cost nothing, so in steady state the
+ * counters are not touched at all; when they are it is a relaxed atomic.
+ * Pooled objects still count, the memory is held all the same.
+ *
+ * Where a free does not know the size (jansson's heap, mbedTLS) the tagged
+ * allocators keep it in front of the block.
+ *
+ * The leak check samples the object counts every interval and reports tags
+ * that grew at every one of the last MEM_ACCOUNT_LEAK_WINDOW samples.
+ */
+
+// Samples a tag has to grow across before the leak check reports it
+#ifndef MEM_ACCOUNT_LEAK_WINDOW
+#define MEM_ACCOUNT_LEAK_WINDOW 8
+#endif
+
+typedef enum {
+    MEM_TAG_CONNECTIONS, // conn_t and HTTPServerConnection, their arenas
+    MEM_TAG_TLS,         // conn_tls_t and everything mbedTLS allocates
+    MEM_TAG_PARSER,      // read buffers and parsed requests
+    MEM_TAG_CACHES,      // response caches, their blobs and bodies
+    MEM_TAG_JANSSON,     // jansson nodes, on the heap or in the JSON arenas
+    MEM_TAG_CURL,        // buffers of upstream transfers in flight
+    MEM_TAG_INSTANCES,   // WeatherServerInstance, its requests and their arenas
+    MEM_TAG_ARENAS,      // blocks of arenas nobody tagged
+    MEM_TAG_COUNT
+} mem_tag;
+
+typedef struct {
+    int64_t bytes;
+    int64_t peak_bytes;
+    int64_t objects;
+    // allocations ever made, pool hits not included
+    uint64_t allocs;
+} mem_account_stats;
+
+typedef struct {
+    int64_t bytes;
+    int64_t peak_bytes;
+    int64_t objects;
+    uint64_t allocs;
+} __attribute__((aligned(64))) mem_account_counter;
+
+extern mem_account_counter g_memAccount[MEM_TAG_COUNT];
+
+static inline void mem_account_alloc(int tag, size_t bytes) {
+    mem_account_counter* counter = &g_memAccount[tag];
+    int64_t now = __atomic_add_fetch(&counter->bytes, (int64_t)bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->objects, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->allocs, 1, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&counter->peak_bytes, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&counter->peak_bytes, &peak, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static inline void mem_account_free(int tag, size_t bytes) {
+    mem_account_counter* counter = &g_memAccount[tag];
+    __atomic_sub_fetch(&counter->bytes, (int64_t)bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&counter->objects, 1, __ATOMIC_RELAXED);
+}
+
+// An accounted object went from old_bytes to new_bytes (0 to 0 is nothing)
+void mem_account_resize(int tag, size_t old_bytes, size_t new_bytes);
+
+// Heap blocks that remember their size, for frees that do not know it
+void* mem_account_malloc(int tag, size_t size);
+void* mem_account_calloc(int tag, size_t count, size_t size);
+// NULL is ignored
+void mem_account_release(int tag, void* ptr);
+
+const char* mem_account_tag_name(int tag);
+void mem_account_get(int tag, mem_account_stats* stats);
+// Resident set of the process, 0 if /proc cannot tell
+int64_t mem_account_rss(void);
+
+// memory_bytes and memory_objects by tag, before the loops start
+void mem_account_register_metrics(void);
+
+// Samples every interval_s seconds on a thread of its own, 0 or -1. After
+// logger_start.
+int mem_account_leak_check_start(unsigned int interval_s);
+// Before logger_stop
+void mem_account_leak_check_stop(void);
+// The interval, 0 when the check is off; samples taken into *samples
+unsigned int mem_account_leak_check_interval(int* samples);
+// Bit 1 << tag set for every tag currently growing
+unsigned int mem_account_growing(void);
+
+#endif
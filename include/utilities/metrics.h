@@ -0,0 +1,110 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * Process wide metrics in the Prometheus text format. Counters and
+ * histograms are split in cache line sized shards, a thread always adds to
+ * its own with a relaxed atomic, so the loops never contend on them; a
+ * scrape sums the shards. Histograms are log-linear (four buckets per power
+ * of two of microseconds, HDR style), relative error stays within a quarter
+ * from 1 us to a minute.
+ *
+ * Metrics are registered before the loops start and never removed, the
+ * registry is read only afterwards. Entries of one name are one family,
+ * told apart by their labels.
+ */
+
+// Shards per counter and histogram, threads beyond it share
+#ifndef METRICS_SHARDS
+#define METRICS_SHARDS 8
+#endif
+
+// Metrics the registry holds, each label set counts
+#ifndef METRICS_MAX_ENTRIES
+#define METRICS_MAX_ENTRIES 192
+#endif
+
+// Finite buckets up to 2^26 us, the last slot counts what is above
+#define METRICS_HISTOGRAM_BUCKETS 101
+// Longest line rendered, the buffer given to metrics_render has to hold one
+#define METRICS_LINE_SIZE 256
+
+typedef enum {
+    METRICS_COUNTER,
+    METRICS_GAUGE,
+    METRICS_HISTOGRAM
+} metrics_type;
+
+typedef struct {
+    uint64_t value;
+} __attribute__((aligned(64))) metrics_counter_shard;
+
+typedef struct {
+    metrics_counter_shard shards[METRICS_SHARDS];
+} metrics_counter;
+
+typedef struct {
+    int64_t value;
+} metrics_gauge;
+
+typedef struct {
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+    uint64_t sum;
+} __attribute__((aligned(64))) metrics_histogram_shard;
+
+typedef struct {
+    metrics_histogram_shard shards[METRICS_SHARDS];
+} metrics_histogram;
+
+// A value read at scrape time, for counts another module keeps already
+typedef int64_t (*metrics_read)(void* context);
+
+// name and help are kept, labels too ("route=\"/getweather\"", NULL for
+// none). 0, or -1 if the registry is full.
+int metrics_register(const char* name, const char* help, metrics_type type, const char* labels, void* metric);
+// A histogram of something other than microseconds: what is recorded is
+// rendered times unit (1 for counts, 1000 for values kept in thousands)
+int metrics_register_histogram(const char* name, const char* help, const char* labels, metrics_histogram* histogram,
+                               double unit);
+// A counter or gauge that is read through read(context) when scraped
+int metrics_register_read(const char* name, const char* help, metrics_type type, const char* labels,
+                          metrics_read read, void* context);
+
+extern __thread int t_metricsShard;
+int metrics_shard_assign(void);
+
+static inline int metrics_shard(void) {
+    int shard = t_metricsShard;
+    return shard >= 0 ? shard : metrics_shard_assign();
+}
+
+static inline void metrics_counter_add(metrics_counter* counter, uint64_t value) {
+    __atomic_fetch_add(&counter->shards[metrics_shard()].value, value, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_gauge_add(metrics_gauge* gauge, int64_t value) {
+    __atomic_fetch_add(&gauge->value, value, __ATOMIC_RELAXED);
+}
+
+void metrics_histogram_record(metrics_histogram* histogram, uint64_t microseconds);
+
+// Where a scrape is, metrics_cursor_init before the first metrics_render
+typedef struct {
+    int entry;
+    int line;
+    // the histogram being written, summed when its first line is
+    uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+    uint64_t sum;
+} metrics_cursor;
+
+void metrics_cursor_init(metrics_cursor* cursor);
+// Writes whole lines into out while they fit (size at least
+// METRICS_LINE_SIZE), the bytes written; 0 once everything is out
+int metrics_render(metrics_cursor* cursor, char* out, int size);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * Free list of fixed size objects for one smw loop.
+ *
+ * Declare pools __thread with OBJECT_POOL_INIT, an object handed back with
+ * object_pool_put() is returned as is by the next object_pool_get() on the
+ * same thread, so owners can keep expensive setup (buffers, TLS contexts)
+ * across reuses. The free list link overwrites the first pointer of the
+ * object. Pools register themselves on first use and object_pool_drain()
+ * releases everything the calling thread still holds.
+ */
+
+#ifndef OBJECT_POOL_MAX_FREE
+#define OBJECT_POOL_MAX_FREE 256
+#endif
+
+typedef struct object_pool object_pool;
+
+struct object_pool {
+    // Releases a pooled object for good, NULL for plain ub_free()
+    void (*destroy)(void* object);
+    void* free_list;
+    int free_count;
+    int registered;
+    object_pool* next;
+};
+
+#define OBJECT_POOL_INIT(destroy) {(destroy), NULL, 0, 0, NULL}
+
+// A recycled object, NULL if the pool is empty and the caller allocates
+void* object_pool_get(object_pool* pool);
+
+// 0 if the pool kept the object, -1 if it is full and the caller frees it
+int object_pool_put(object_pool* pool, void* object);
+
+// Destroys the pooled objects of every pool used by this thread
+void object_pool_drain(void);
+
+#endif
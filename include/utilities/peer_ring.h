@@ -0,0 +1,39 @@
+#ifndef PEER_RING_H
+#define PEER_RING_H
+
+#include <stdint.h>
+
+#include "global_defines.h"
+
+// Nodes in --peers at most
+#ifndef PEER_RING_MAX_PEERS
+#define PEER_RING_MAX_PEERS 32
+#endif
+// Points each node has on the ring, more spread the keys more evenly
+#ifndef PEER_RING_VNODES
+#define PEER_RING_VNODES 128
+#endif
+// host:port, NUL included
+#define PEER_RING_ADDRESS_SIZE 64
+
+/*
+ * The peer tier (--peers): the nodes behind one load balancer share their
+ * caches. Every node is given the same list and places each on a consistent
+ * hash ring, a cache key belongs to the node whose point follows the key's
+ * hash. Adding or removing a node moves only the keys next to its points.
+ * A node asks a key's owner on a miss of its own before going upstream,
+ * the owner fetches it at most once for all of them (single flight).
+ *
+ * Process wide, set up before the loops start and read only afterwards.
+ */
+
+// Builds the ring of peers ("host:port,host:port"), self is this node's
+// entry in it (NULL or not in the list: the node asks, it owns nothing).
+// -1 if an entry is empty or too long, or there are too many.
+int peer_ring_init(const char* peers, const char* self);
+// 1 if --peers was given
+int peer_ring_enabled(void);
+// host:port of the node key belongs to, NULL if it is this one or there is no ring
+const char* peer_ring_owner(uint64_t key);
+
+#endif // PEER_RING_H
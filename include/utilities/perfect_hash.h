@@ -0,0 +1,39 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * Collision free lookup over a fixed set of keys, case insensitive. Build
+ * searches for a seed that puts every case-folded key in a slot of its own,
+ * so a lookup is one hash and one comparison. Built once before the worker
+ * threads start, read only after that.
+ */
+
+#ifndef PERFECT_HASH_MAX_KEYS
+#define PERFECT_HASH_MAX_KEYS 32
+#endif
+#ifndef PERFECT_HASH_MAX_SEEDS
+#define PERFECT_HASH_MAX_SEEDS 4096
+#endif
+
+typedef struct {
+    const char* keys[PERFECT_HASH_MAX_KEYS];
+    int count;
+    uint32_t seed;
+    uint32_t mask;
+    // Key index + 1 per slot, 0 for an empty slot
+    uint8_t slots[PERFECT_HASH_MAX_KEYS * 4];
+} perfect_hash;
+
+// The keys are kept by reference. -1 if they don't fit or no seed separates
+// them (a duplicate key never can)
+int perfect_hash_build(perfect_hash* table, const char* const* keys, int count);
+
+// Index of the key equal to key[0..length) ignoring case, -1 if none
+int perfect_hash_find(const perfect_hash* table, const char* key, size_t length);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+ * USDT static tracepoints (provider "ubweather") for perf and bpftrace. A
+ * probe compiles to a single nop plus an ELF note saying where it is and
+ * where its arguments live; nothing runs unless a tracer attaches, which
+ * needs no rebuild or restart:
+ *
+ *   bpftrace -l 'usdt:./server:ubweather:*'
+ *   bpftrace -e 'usdt:./server:ubweather:response_sent { @[arg1] = count(); }'
+ *
+ * The arguments are evaluated while nobody is attached as well, keep them
+ * to what is at hand already. Built in with USDT=1 (the default) where
+ * <sys/sdt.h> is installed (systemtap-sdt-dev), otherwise left out.
+ *
+ *   task_run         (name, task)                 smw runs a task's callback
+ *   accept           (fd)                         a listener admitted a client
+ *   tls_handshake    (fd, us)                     its TLS handshake finished
+ *   request_parsed   (connection, method, url, url_length)
+ *   backend_state    (backend, context, state)    a backend's work() runs a state
+ *   curl_begin       (client, url)                an upstream transfer is asked for
+ *   curl_end         (client, curl_code, status)  and is done
+ *   response_sent    (connection, status, bytes)  the last byte left
+ */
+
+#if defined(UBWEATHER_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef PROBES_ENABLED
+#define PROBE0(name) DTRACE_PROBE(ubweather, name)
+#define PROBE1(name, a) DTRACE_PROBE1(ubweather, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(ubweather, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(ubweather, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(ubweather, name, a, b, c, d)
+#else
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { (void)(a); } while (0)
+#define PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c) do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d) do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#endif
+
+#endif
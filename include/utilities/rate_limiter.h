@@ -0,0 +1,71 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "global_defines.h"
+
+/*
+ * Token buckets per client address plus a global ceiling, for admission of
+ * new connections. Buckets live in a fixed size open addressing table, when
+ * a probe window is full the least recently seen address is replaced (a
+ * forgotten address simply starts over with a full bucket).
+ *
+ * The same buckets work as cost quotas (rate_limiter_charge): a request is
+ * admitted while its address has a token and pays what it cost once it is
+ * answered, which may leave the bucket in debt until the refill covers it.
+ *
+ * Not thread safe, every listener owns its own limiter.
+ */
+
+#ifndef RATE_LIMITER_TABLE_SIZE
+#define RATE_LIMITER_TABLE_SIZE 1024 /* power of two */
+#endif
+#ifndef RATE_LIMITER_PROBE
+#define RATE_LIMITER_PROBE 8
+#endif
+
+// Tokens are kept in thousandths so a rate per second refills per ms exactly,
+// below zero a charge is not paid off yet
+typedef struct {
+    int64_t tokens;
+    uint64_t last_ms;
+} rate_bucket;
+
+typedef struct {
+    uint8_t addr[16];
+    uint8_t family;
+    uint8_t used;
+    rate_bucket bucket;
+} rate_limiter_entry;
+
+typedef struct {
+    rate_limiter_entry* entries;
+    uint32_t rate;
+    uint32_t burst;
+
+    rate_bucket global;
+    uint32_t global_rate;
+    uint32_t global_burst;
+} rate_limiter;
+
+// rate is tokens per second, burst the bucket size, for both levels
+int rate_limiter_init(rate_limiter* limiter, uint32_t rate, uint32_t burst, uint32_t global_rate,
+                      uint32_t global_burst, uint64_t now_ms);
+void rate_limiter_dispose(rate_limiter* limiter);
+
+// ms until the global bucket has a token again, 0 if one is available now
+uint64_t rate_limiter_global_wait(rate_limiter* limiter, uint64_t now_ms);
+
+// Takes a token from the address and the global bucket, 0 if admitted and
+// -1 if either is empty (nothing is taken then)
+int rate_limiter_allow(rate_limiter* limiter, const struct sockaddr* addr, uint64_t now_ms);
+
+// ms until the address has a token again, 0 if it has one now (or addr is
+// NULL); the global bucket is not looked at
+uint64_t rate_limiter_wait(rate_limiter* limiter, const struct sockaddr* addr, uint64_t now_ms);
+// Takes cost thousandths of a token from the address, as far into debt as it goes
+void rate_limiter_charge(rate_limiter* limiter, const struct sockaddr* addr, uint64_t cost, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef REAL_FORMAT_H
+#define REAL_FORMAT_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * Doubles to the shortest text that reads back to the same value, for the
+ * JSON we write: Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly
+ * and Accurately", with the rounding of its common implementations), and
+ * before it a fixed point path for values of a few decimals, which is what
+ * coordinates and measurements are. The text always reads back to the value,
+ * for about one in two thousand Grisu2 leaves a digit more than the shortest.
+ *
+ * Laid out as jansson does: a whole number keeps ".0" so it stays a real to
+ * a reader, the exponent ("1e-07" is "1e-7") is used below 1e-4 and from
+ * 1e17 on.
+ */
+
+// Room for any double and the NUL, "-2.2250738585072014e-308"
+#define REAL_FORMAT_SIZE 25
+
+// Use real_format for jansson's reals as well (see libs/jansson/strconv.c),
+// 0 leaves jansson's 17 digit printf
+#ifndef JSON_SHORTEST_REALS
+#define JSON_SHORTEST_REALS 1
+#endif
+
+// value (finite) into out of REAL_FORMAT_SIZE bytes, NUL terminated; the length
+int real_format(double value, char* out);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "global_defines.h"
+
+#ifndef RECORD_STORE_MIN_COMPACT_BYTES
+#define RECORD_STORE_MIN_COMPACT_BYTES (1 << 20)
+#endif
+
+/*
+ * Key/value store in one memory mapped, append only log file. A value is
+ * addressed by a 64 bit key and a small slot (one per representation of
+ * the same thing) and carries a stamp, the time it was written.
+ *
+ * Every put appends a checksummed entry and points the in-memory open
+ * addressing index at it, a remove appends an entry that says so. Opening
+ * reads the log once front to back and stops at the first entry that does
+ * not check out, which is where a crash left a write unfinished; the next
+ * put overwrites it. Once superseded, removed and expired entries make up
+ * more than half of the log it is compacted into a new file that replaces
+ * the old one by rename.
+ *
+ * Thread safe, lookups share a read lock and copy the value out, or hand
+ * out a view of it in place: an entry once written is never changed, and a
+ * compaction that replaces the file leaves the old one mapped and open
+ * until the last view of it is released.
+ */
+
+typedef struct record_store record_store;
+typedef struct record_store_file record_store_file;
+
+// A value where it is stored, in the mapping (data) and in the file (fd at
+// offset, for sendfile); both stay valid until record_store_view_release,
+// from any thread
+typedef struct {
+    record_store_file* file;
+    const uint8_t* data;
+    size_t length;
+    time_t stamp;
+    int fd;
+    off_t offset;
+} record_store_view;
+
+// capacity bounds the log file (and its mapping), entries with a stamp
+// older than retain seconds are dropped by compaction
+int record_store_open(record_store** store, const char* path, size_t capacity, time_t retain);
+void record_store_close(record_store** store);
+
+// 0 with stamp and length of the value, -1 if there is none
+int record_store_stat(record_store* store, uint64_t key, uint8_t slot, time_t* stamp, size_t* length);
+// A malloc'd copy of the value, -1 if there is none
+int record_store_get(record_store* store, uint64_t key, uint8_t slot, uint8_t** data, size_t* length, time_t* stamp);
+// The value in place, -1 if there is none
+int record_store_view_get(record_store* store, uint64_t key, uint8_t slot, record_store_view* view);
+// Lets go of the view's file, a zeroed or released view is ignored
+void record_store_view_release(record_store_view* view);
+// Calls each for every value stored in slot, under the read lock (each must
+// not call back into the store)
+void record_store_each(record_store* store, uint8_t slot,
+                       void (*each)(uint64_t key, time_t stamp, size_t length, void* context), void* context);
+// Replaces the value, -1 if it does not fit even after compaction
+int record_store_put(record_store* store, uint64_t key, uint8_t slot, const uint8_t* data, size_t length, time_t stamp);
+// Drops the value, -1 if there is none
+int record_store_remove(record_store* store, uint64_t key, uint8_t slot);
+// While frozen every put and remove fails and the file is left as it is, so
+// another process can open it; lookups go on. NULL is ignored.
+void record_store_freeze(record_store* store, int frozen);
+// Bytes taken by the values still stored (entry headers included) and how
+// many there are, left untouched on a NULL store
+void record_store_usage(record_store* store, size_t* live, size_t* count);
+
+#endif
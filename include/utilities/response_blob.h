@@ -0,0 +1,50 @@
+#ifndef RESPONSE_BLOB_H
+#define RESPONSE_BLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global_defines.h"
+#include "utilities/compress.h"
+#include "utilities/http_validators.h"
+
+/*
+ * A response ready to go out to any number of clients at once: the body in
+ * every encoding it has, the ETag of each and the header lines that go with
+ * it, formatted once. The cache holds a reference and so does every response
+ * sending it, the last release frees it, so a hot entry costs no copy per
+ * client and can be replaced while clients still receive the old one.
+ *
+ * Immutable while shared: setting a variant on a blob others hold sets it on
+ * a copy (the variants are shared blobs, they are not copied themselves).
+ */
+
+// "ETag", "Last-Modified" and "Content-Encoding" lines of a variant
+#define RESPONSE_BLOB_HEADERS_SIZE 160
+
+typedef struct {
+    int references;
+    time_t last_modified; // 0 if unknown
+    // shared blobs (utilities/shared_blob.h), NULL for encodings it does not have
+    const uint8_t* bodies[COMPRESS_ENCODINGS];
+    size_t lengths[COMPRESS_ENCODINGS];
+    // "" if the variant goes out without an ETag
+    char etags[COMPRESS_ENCODINGS][HTTP_ETAG_SIZE];
+    // each line "\r\n" terminated, as they go into the head
+    char headers[COMPRESS_ENCODINGS][RESPONSE_BLOB_HEADERS_SIZE];
+} response_blob;
+
+// Without variants, one reference
+response_blob* response_blob_new(time_t last_modified);
+// The blob with body (retained) as its encoding variant, etag NULL for none.
+// That is blob itself when the caller holds the only reference, otherwise a
+// copy that takes the caller's reference over. NULL if out of memory, the
+// caller still holds blob then.
+response_blob* response_blob_set(response_blob* blob, compress_encoding encoding, const uint8_t* body, size_t length,
+                                 const char* etag);
+void response_blob_retain(const response_blob* blob);
+// Drops a reference, NULL is ignored
+void response_blob_release(const response_blob* blob);
+
+#endif
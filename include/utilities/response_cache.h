@@ -0,0 +1,87 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global_defines.h"
+#include "utilities/compress.h"
+#include "utilities/frequency_sketch.h"
+#include "utilities/http_validators.h"
+#include "utilities/response_blob.h"
+
+/*
+ * Bounded in-memory cache of ready to send response bodies, one entry per
+ * key with a variant per Content-Encoding. Entries expire at a fixed time
+ * and, once the table or the byte budget is full, are evicted by CLOCK: an
+ * entry read since the hand last passed gets another round.
+ *
+ * With an admission sketch a new key only takes the victim's place if the
+ * sketch counts it as more popular (TinyLFU), so a scan over many one-off
+ * keys does not flush the entries in demand.
+ *
+ * Not thread safe, every loop owns its own cache.
+ */
+
+typedef struct {
+    uint64_t key;
+    time_t expires;
+    // version of the content, every variant is of this one
+    time_t last_modified;
+    uint8_t used;
+    uint8_t referenced;
+    // reads, left to the owner to decay
+    uint32_t hits;
+    // next entry in the bucket, -1 ends it
+    int next;
+
+    // NULL until a variant is set, responses sending it keep a reference
+    response_blob* blob;
+} response_cache_entry;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    // new keys turned away by the admission sketch
+    uint64_t rejections;
+    size_t bytes;
+    int entries;
+} response_cache_stats;
+
+typedef struct {
+    response_cache_entry* entries;
+    int* buckets;
+    int capacity;
+    int hand;
+    // 0 leaves only the entry count as the bound
+    size_t max_bytes;
+    const frequency_sketch* admission;
+    response_cache_stats stats;
+} response_cache;
+
+// capacity is rounded up to a power of two, admission may be NULL and has to
+// outlive the cache
+int response_cache_init(response_cache* cache, int capacity, size_t max_bytes, const frequency_sketch* admission);
+void response_cache_dispose(response_cache* cache);
+
+// The live entry of key, NULL if there is none or it expired by now
+response_cache_entry* response_cache_find(response_cache* cache, uint64_t key, time_t now);
+// The entry of key as it is, expired or not, without counting a read
+const response_cache_entry* response_cache_peek(const response_cache* cache, uint64_t key);
+// The entry of key for the last_modified version, variants of another
+// version are dropped. NULL if the cache is not set up or key was not
+// admitted.
+response_cache_entry* response_cache_insert(response_cache* cache, uint64_t key, time_t last_modified, time_t expires);
+// Stores a copy of data as the entry's encoding variant, etag NULL for none
+// (a blob still being sent is left as it is, the entry gets a new one),
+// and evicts others until the cache is within its byte budget again
+int response_cache_set(response_cache* cache, response_cache_entry* entry, compress_encoding encoding,
+                       const uint8_t* data, size_t length, const char* etag);
+// Takes the variants of blob (made elsewhere, of the entry's version) the
+// entry does not have yet, without copying the bodies; blob itself stays
+// the caller's. Evicts like response_cache_set.
+int response_cache_adopt(response_cache* cache, response_cache_entry* entry, const response_blob* blob);
+
+#endif
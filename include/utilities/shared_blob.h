@@ -0,0 +1,25 @@
+#ifndef SHARED_BLOB_H
+#define SHARED_BLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+/*
+ * Reference counted bytes, for bodies a cache holds that go out in responses
+ * as they are: the response takes a reference instead of a copy, so the
+ * entry can be replaced or evicted while the body is still being sent. The
+ * count sits in front of the data, a blob is passed around as its data
+ * pointer. Counting is atomic, the last release frees it on any thread.
+ */
+
+// length bytes (uninitialized) with one reference, NULL if out of memory
+uint8_t* shared_blob_alloc(size_t length);
+// A blob holding a copy of length bytes of data
+uint8_t* shared_blob_copy(const uint8_t* data, size_t length);
+void shared_blob_retain(const uint8_t* blob);
+// Drops a reference, NULL is ignored
+void shared_blob_release(const uint8_t* blob);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef SHM_TABLE_H
+#define SHM_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "global_defines.h"
+
+// A read that keeps meeting writes gives up after this many tries, a miss
+#ifndef SHM_TABLE_READ_TRIES
+#define SHM_TABLE_READ_TRIES 8
+#endif
+// Tables shm_table_release_writer goes through
+#ifndef SHM_TABLE_MAX_TABLES
+#define SHM_TABLE_MAX_TABLES 8
+#endif
+
+/*
+ * Hash table in one shared anonymous mapping, made before the process
+ * forks so every child reads and writes the same memory (see
+ * workers_prefork). Values are addressed by a 64 bit key and a slot as in
+ * a record store and carry a stamp; the table is direct mapped, a value
+ * replaces whatever else hashed to its bucket, and a bucket holds at most
+ * value_size bytes.
+ *
+ * Every bucket has a sequence lock. A writer takes it by moving the
+ * sequence from even to odd with a compare and swap, writes and makes it
+ * even again; a bucket another writer holds is left alone, the put fails.
+ * Readers take no lock: they copy the value out between two loads of the
+ * sequence and try again if it moved. A writer that dies holding a bucket
+ * leaves it odd, the process that forked it empties those buckets with
+ * shm_table_release_writer once it reaped the child.
+ *
+ * Thread and process safe.
+ */
+
+typedef struct shm_table shm_table;
+
+// NULL if the mapping cannot be made; before the fork
+shm_table* shm_table_open(int entries, size_t value_size);
+void shm_table_close(shm_table** table);
+
+// A malloc'd copy of the value, -1 if there is none or it expired
+int shm_table_get(shm_table* table, uint64_t key, uint8_t slot, uint8_t** data, size_t* length, time_t* stamp);
+// Kept ttl seconds (0: until it is replaced), -1 if it is larger than a
+// bucket or the bucket is being written
+int shm_table_put(shm_table* table, uint64_t key, uint8_t slot, const uint8_t* data, size_t length, time_t stamp,
+                  int ttl);
+// -1 if there was no value
+int shm_table_remove(shm_table* table, uint64_t key, uint8_t slot);
+// Starts the value's ttl over, -1 if there is none
+int shm_table_touch(shm_table* table, uint64_t key, uint8_t slot, int ttl);
+
+// pid is gone: the buckets of every table it was writing are emptied
+void shm_table_release_writer(pid_t pid);
+
+#endif
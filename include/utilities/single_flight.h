@@ -0,0 +1,58 @@
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+#ifndef SINGLE_FLIGHT_BUCKETS
+#define SINGLE_FLIGHT_BUCKETS 64 /* power of two */
+#endif
+
+/*
+ * Coalesced upstream GETs: concurrent requests for the same URL on one smw
+ * loop attach to a single transfer and each get a copy of the response.
+ * The oldest waiter drives the transfer by polling, the others are woken
+ * once the response is in or when they are the oldest one left. On a loop
+ * curl is attached to the driver is woken too when the transfer is done. A transfer
+ * nobody waits for any more is cancelled.
+ *
+ * Per thread like the loop it runs on, no locking.
+ */
+
+typedef struct single_flight single_flight;
+
+enum {
+    SINGLE_FLIGHT_FAILED = -1,
+    // Call single_flight_poll again on the next poll
+    SINGLE_FLIGHT_RUNNING = 0,
+    // The transfer is someone else's or runs on its own, on_wake says when to poll again
+    SINGLE_FLIGHT_WAITING = 1,
+    // body/length hold this waiter's copy of the response
+    SINGLE_FLIGHT_DONE = 2
+};
+
+// Embedded in whoever waits, zeroed means not attached
+typedef struct single_flight_waiter {
+    single_flight* flight;
+    struct single_flight_waiter* next;
+    void (*on_wake)(void* context);
+    void* context;
+
+    int status;
+    // The response once DONE, NUL terminated and owned (free) by the waiter, NULL if empty
+    char* body;
+    size_t length;
+    // First waiter served, the one to do the follow-up work once (writing a cache file)
+    int primary;
+} single_flight_waiter;
+
+// Attaches to the transfer of url, starting one if there is none
+int single_flight_join(single_flight_waiter* waiter, const char* url, void (*on_wake)(void* context), void* context);
+int single_flight_poll(single_flight_waiter* waiter);
+// 1 if this loop has a transfer of url in flight, a join would not start one
+int single_flight_running(const char* url);
+// Detaches if still attached, safe to call more than once
+void single_flight_leave(single_flight_waiter* waiter);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef STRING_INTERN_H
+#define STRING_INTERN_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * Process wide table of strings that repeat across many records (units and
+ * the like): each distinct value is stored once, callers keep the pointer,
+ * equal strings get the same one. Lookups take no lock, adding a string
+ * takes a mutex. Entries live until exit, nothing is ever removed, so keep
+ * it to small value sets.
+ */
+
+// Slots of the table, at most three quarters of them are filled
+#ifndef STRING_INTERN_SLOTS
+#define STRING_INTERN_SLOTS 512
+#endif
+
+// The interned copy of length bytes of text, NUL terminated. NULL when out
+// of memory or the table is full.
+const char* string_intern(const char* text, size_t length);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SUBSCRIPTION_H
+#define SUBSCRIPTION_H
+
+#include <stdint.h>
+
+#include "utilities/response_blob.h"
+
+/*
+ * Who follows which key (a cache key), for pushing new versions of it to
+ * open connections: SSE streams, a WebSocket the same way. Every key keeps
+ * its subscribers in one compact array and each subscriber knows its slot,
+ * so leaving (a disconnect) is swapping the last one into it.
+ *
+ * subscription_publish only takes the key's newest blob; subscription_flush,
+ * once per loop iteration, hands every key published since to each of its
+ * subscribers, the same refcounted blob to all of them. A burst of versions
+ * comes out as the last one, and the writes to the sockets all happen in the
+ * loop iteration after.
+ *
+ * Not thread safe: every worker loop owns a registry for the connections it
+ * serves, a key followed on two loops is in both and published by each.
+ */
+
+#ifndef SUBSCRIPTION_INITIAL_KEYS
+#define SUBSCRIPTION_INITIAL_KEYS 64
+#endif
+
+// The subscriber's context and the blob, only borrowed for the call (retain
+// it to keep it). The subscriber may unsubscribe from here.
+typedef void (*subscription_deliver)(void* context, const response_blob* blob);
+
+typedef struct {
+    subscription_deliver deliver;
+    void* context;
+    // index of its key and slot in that key's array, key -1 when not subscribed
+    int key;
+    int slot;
+} subscription;
+
+typedef struct {
+    uint64_t key;
+    subscription** subscribers;
+    int count;
+    int capacity;
+    // next key in the bucket or on the free list, -1 ends it
+    int next;
+    uint8_t used;
+    // published since the last flush, a reference
+    const response_blob* pending;
+} subscription_key;
+
+typedef struct {
+    // subscribers and followed keys right now
+    int subscribers;
+    int keys;
+    uint64_t published;
+    // blobs handed to subscribers
+    uint64_t deliveries;
+} subscription_stats;
+
+typedef struct {
+    subscription_key* keys;
+    int* buckets;
+    int capacity;
+    int free;
+    // indexes of the keys with a pending blob, in publishing order
+    int* dirty;
+    int dirty_count;
+    // the list subscription_flush works through
+    int* spare;
+    // the key it is delivering, -1
+    int flushing;
+    subscription_stats stats;
+} subscription_registry;
+
+// capacity is rounded up to a power of two, the table grows past it
+int subscription_registry_init(subscription_registry* registry, int capacity);
+// Subscribers still in it are left as they are, not notified
+void subscription_registry_dispose(subscription_registry* registry);
+
+// -1 if out of memory, the subscriber is then not subscribed
+int subscription_add(subscription_registry* registry, subscription* member, uint64_t key,
+                     subscription_deliver deliver, void* context);
+// Nothing if it is not subscribed
+void subscription_remove(subscription_registry* registry, subscription* member);
+// Subscribers of key, 0 if nobody follows it
+int subscription_count(const subscription_registry* registry, uint64_t key);
+
+// blob becomes key's pending one, dropped if nobody follows key
+void subscription_publish(subscription_registry* registry, uint64_t key, const response_blob* blob);
+// 1 if something waits for subscription_flush
+static inline int subscription_pending(const subscription_registry* registry) {
+    return registry->dirty_count > 0;
+}
+// Delivers every pending blob, returns how many subscribers got one
+int subscription_flush(subscription_registry* registry);
+
+#endif // SUBSCRIPTION_H
@@ -0,0 +1,103 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global_defines.h"
+
+/*
+ * Per-request phase timestamps. A trace_context rides along with a request
+ * from the accept (conn_t) through HTTPServerConnection into the backend,
+ * every layer stamps the phases it sees with the monotonic clock. A traced
+ * response carries them as a Server-Timing header; the sampled ones, and
+ * the slow ones, go to the trace log as OTLP/JSON, one resourceSpans
+ * document per line, written off the loops by the logger's thread.
+ *
+ * Every TRACE_SAMPLE_EVERY-th request of a loop is sampled, as is one whose
+ * traceparent says so. With TRACE_SLOW_MS set every request is timed and
+ * exported once it took that long. With both 0 nothing reads the clock,
+ * trace_enabled() is one relaxed load per connection and request.
+ */
+
+// One in this many requests per loop is traced and exported, 0 for none
+#ifndef TRACE_SAMPLE_EVERY
+#define TRACE_SAMPLE_EVERY 0
+#endif
+// Requests slower than this are exported whether sampled or not, 0 for none
+#ifndef TRACE_SLOW_MS
+#define TRACE_SLOW_MS 0
+#endif
+// Longest target kept in an exported trace, with its terminator
+#define TRACE_TARGET_SIZE 128
+
+// In the order a request normally passes them
+typedef enum {
+    TRACE_ACCEPTED,    // the listener took the connection
+    TRACE_STARTED,     // its loop picked it up
+    TRACE_HANDSHAKEN,  // TLS done, absent over plain TCP
+    TRACE_READ,        // the first bytes of this request's head
+    TRACE_PARSED,      // the head is complete, handed to the server
+    TRACE_DISPATCHED,  // routed, the backend starts
+    TRACE_CACHED,      // a cache answered, hit or miss
+    TRACE_FETCH_START, // the upstream request was made or joined
+    TRACE_FETCH_DONE,  // its response is in
+    TRACE_BODY,        // the body is ready
+    TRACE_QUEUED,      // the response head is built and queued
+    TRACE_SENT,        // the last byte left
+    TRACE_MARK_COUNT
+} trace_mark_id;
+
+typedef struct {
+    // monotonic ns, 0 where the phase was not seen
+    uint64_t marks[TRACE_MARK_COUNT];
+    uint8_t trace_id[16];
+    uint8_t span_id[8];
+    // the caller's span from traceparent, zero if none came
+    uint8_t parent_id[8];
+    // marks are recorded
+    uint8_t active;
+    // exported however long it took
+    uint8_t sampled;
+} trace_context;
+
+extern int g_traceEnabled;
+
+static inline int trace_enabled(void) {
+    return __atomic_load_n(&g_traceEnabled, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static inline void trace_mark_at(trace_context* trace, int mark, uint64_t ns) {
+    if (trace != NULL && trace->active) trace->marks[mark] = ns;
+}
+
+static inline void trace_mark(trace_context* trace, int mark) {
+    if (trace != NULL && trace->active) trace->marks[mark] = trace_now();
+}
+
+// Sampling, before the loops start; both 0 turns tracing off
+void trace_configure(unsigned int sample_every, unsigned int slow_ms);
+// Appends the exported traces to path, 0 or -1. Before the loops start.
+int trace_log_open(const char* path);
+// Once the loops are gone and the logger stopped
+void trace_log_close(void);
+
+// Decides whether the request is traced, with the caller's traceparent
+// header (NULL if none). 1 if it is, the context is then reset and active.
+int trace_begin(trace_context* trace, const char* traceparent, size_t length);
+// The Server-Timing header value of the phases so far into out, its length
+// (0 if nothing fits)
+int trace_server_timing(const trace_context* trace, char* out, size_t size);
+// Once the response is sent: writes the trace to the log if it was sampled
+// or slow. route and cache are access_log_route and access_cache.
+void trace_export(const trace_context* trace, int head, int status, int route, int cache, const char* target,
+                  int length);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "global_defines.h"
+
+// Posting lists, trigrams are hashed into them; a power of two
+#ifndef TRIGRAM_INDEX_BUCKETS
+#define TRIGRAM_INDEX_BUCKETS (1 << 18)
+#endif
+// Code points of a key that are looked at, longer keys are cut
+#ifndef TRIGRAM_INDEX_MAX_LENGTH
+#define TRIGRAM_INDEX_MAX_LENGTH 64
+#endif
+
+/*
+ * Inverted index of the code point trigrams of a fixed set of keys, for
+ * finding the ones a misspelled key is close to. A key is padded with two
+ * marks in front and one behind, so short keys and first letters count.
+ *
+ * The posting lists are one array of ids, ascending per list, and the
+ * offsets where each list starts: no pointer or allocation per list.
+ * Trigrams hash into TRIGRAM_INDEX_BUCKETS lists, one that collides only
+ * adds a candidate the distance check drops.
+ *
+ * An edit changes at most 3 trigrams of a key, a transposition 4, so a key
+ * within e edits shares all but 4e of the query's; by pigeonhole it is in
+ * one of the shortest lists, whose union are the candidates. Each list is
+ * then intersected with them (SSE2 or NEON, four ids against four) to
+ * count how many each shares. Built once, read by any thread.
+ */
+
+typedef struct {
+    // TRIGRAM_INDEX_BUCKETS + 1, list i is postings[offsets[i]..offsets[i + 1])
+    uint32_t* offsets;
+    uint32_t* postings;
+    uint32_t count;
+} trigram_index;
+
+// keys[i] gets id i; -1 if out of memory
+int trigram_index_build(trigram_index* index, const char* const* keys, uint32_t count);
+void trigram_index_dispose(trigram_index* index);
+
+// Ids of the keys that may be within max_edits of key, ascending, at most
+// max; how many, -1 when there are more than max
+int trigram_index_candidates(const trigram_index* index, const char* key, int max_edits, uint32_t* ids, int max);
+
+// Edits (insert, delete, substitute, swap two neighbours) between two
+// UTF-8 strings, in code points; limit + 1 once it is past limit
+int trigram_index_distance(const char* a, const char* b, int limit);
+// Code points of a UTF-8 string, up to TRIGRAM_INDEX_MAX_LENGTH
+int trigram_index_length(const char* key);
+
+// hits[i]++ for every a[i] in b, both ascending without repeats
+void trigram_index_intersect(const uint32_t* a, size_t a_count, const uint32_t* b, size_t b_count, uint8_t* hits);
+
+#endif
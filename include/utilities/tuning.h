@@ -0,0 +1,65 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * The performance knobs that can change while the server runs: deadlines,
+ * upstream timeouts and limits, the weather TTL, the admission target and
+ * the client quotas. They start from global_defines.h, a config file read
+ * at startup (--config) and /admin/config change them.
+ *
+ * Every change builds a new version and publishes it in one swap, a reader
+ * sees either all of a change or none of it. Readers take tuning_get() and
+ * read it right away, on the loops, the job pool and curl's callbacks
+ * alike; replaced versions are small and kept until tuning_dispose, there is
+ * no telling when a pool thread is done with one.
+ *
+ * The sizes of buffers and tables are fixed when they are allocated, they
+ * stay compile time.
+ */
+
+typedef struct {
+    long header_timeout_ms;
+    long handler_timeout_ms;
+    long write_timeout_ms;
+    long keepalive_timeout_ms;
+    // bytes/s, 0 turns the floor off
+    long min_transfer_rate;
+    long curl_connect_timeout_ms;
+    long curl_request_timeout_ms;
+    long curl_max_response_size;
+    long weather_ttl_seconds;
+    long admission_target_ms;
+    long admission_interval_ms;
+    // 0 turns the quota off
+    long quota_tokens_per_second;
+    long quota_burst;
+    long quota_fetch_cost;
+    long quota_bytes_per_token;
+} tuning;
+
+extern const tuning* g_tuning;
+
+// The values now, never NULL
+static inline const tuning* tuning_get(void) {
+    return __atomic_load_n(&g_tuning, __ATOMIC_ACQUIRE);
+}
+
+// One knob of draft, 0 if set, -1 if there is no knob name, -2 if value is
+// not a number in its range
+int tuning_parse(tuning* draft, const char* name, size_t name_length, const char* value, size_t value_length);
+// Makes draft the values every reader sees from now on, -1 if out of memory
+int tuning_publish(const tuning* draft);
+// "name = value" lines, # starts a comment, applied together once every
+// line parsed. 0, -1 if path cannot be read, else the first bad line's number.
+int tuning_load(const char* path);
+// The values as a JSON object with a trailing newline, its length (as
+// snprintf, the output is cut at size)
+int tuning_format(const tuning* values, char* out, size_t size);
+// Frees the replaced versions, once nothing reads them
+void tuning_dispose(void);
+
+#endif // TUNING_H
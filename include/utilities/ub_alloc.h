@@ -0,0 +1,47 @@
+#ifndef UB_ALLOC_H
+#define UB_ALLOC_H
+
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * The heap under the project's own allocation paths: the tagged allocators
+ * of mem_account (jansson, mbedTLS), arena blocks and the objects pools
+ * destroy. Picked at build time, `make ALLOCATOR=mimalloc` or
+ * `ALLOCATOR=jemalloc`, libc's malloc without.
+ *
+ * Both libraries replace malloc for the whole process once linked, so curl,
+ * jansson's dumps and libc's strdup land on the same heap and a block from
+ * any of them can be freed by any other; ub_* only skip the indirection
+ * where a backend has entry points of its own. Everything keeps per-thread
+ * caches, which is what the loops allocating side by side want.
+ */
+
+#if defined(UB_ALLOCATOR_MIMALLOC)
+#include <mimalloc.h>
+#define UB_ALLOCATOR_NAME "mimalloc"
+static inline void* ub_malloc(size_t size) { return mi_malloc(size); }
+static inline void* ub_calloc(size_t count, size_t size) { return mi_calloc(count, size); }
+static inline void* ub_realloc(void* ptr, size_t size) { return mi_realloc(ptr, size); }
+static inline void ub_free(void* ptr) { mi_free(ptr); }
+static inline char* ub_strdup(const char* text) { return mi_strdup(text); }
+#else
+#include <stdlib.h>
+#if defined(UB_ALLOCATOR_JEMALLOC)
+#define UB_ALLOCATOR_NAME "jemalloc"
+#else
+#define UB_ALLOCATOR_NAME "libc"
+#endif
+static inline void* ub_malloc(size_t size) { return malloc(size); }
+static inline void* ub_calloc(size_t count, size_t size) { return calloc(count, size); }
+static inline void* ub_realloc(void* ptr, size_t size) { return realloc(ptr, size); }
+static inline void ub_free(void* ptr) { free(ptr); }
+static inline char* ub_strdup(const char* text) { return strdup(text); }
+#endif
+
+// The backend's own counters as a JSON object ("backend" and whatever it
+// can tell: bytes handed out, held from the system, resident), its length
+// as snprintf's
+int ub_alloc_stats(char* out, size_t size);
+
+#endif // UB_ALLOC_H
@@ -0,0 +1,37 @@
+#ifndef URL_CODEC_H
+#define URL_CODEC_H
+
+#include <stddef.h>
+
+#include "global_defines.h"
+
+/*
+ * The one normalization stage for query values: %XX escapes and '+'
+ * decoded as a parameter is read, names case folded and blanks collapsed
+ * where a cache key is built, and escaped again for the upstream URL and
+ * the access log. "Malm%C3%B6", "Malmö" and "MALMÖ" all become "malmö".
+ *
+ * Folding covers ASCII and the two byte UTF-8 letters with a simple lower
+ * case of the same length: Latin-1, Latin Extended-A, Greek and Cyrillic.
+ * Anything else is kept as it is.
+ */
+
+// Decodes length bytes of data into out (which may be data, the result is
+// never longer) and returns the decoded length. A '%' not followed by two
+// hex digits is kept. Not terminated.
+size_t url_codec_decode(const char* data, size_t length, char* out);
+
+// data percent-encoded for a query value, everything but RFC 3986's
+// unreserved characters escaped. Terminated if size > 0; the length it
+// needs, like snprintf, so >= size means it was cut.
+size_t url_codec_encode(const char* data, char* out, size_t size);
+
+// Lower case of length bytes of data into out (which may be data), the
+// same length. Not terminated.
+void url_codec_fold(const char* data, size_t length, char* out);
+
+// The cache key of a name: folded, trimmed and runs of blanks as one space.
+// Terminated, size includes the NUL; the key's length.
+size_t url_codec_key(const char* name, char* key, size_t size);
+
+#endif
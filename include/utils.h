@@ -15,6 +15,7 @@
 #include <stdint.h>
 
 uint64_t SystemMonotonicMS();
+uint64_t SystemMonotonicNS();
 
 static inline int create_folder(const char* _Path) {
 #if defined _WIN32
@@ -0,0 +1,27 @@
+#ifndef __warmup_h_
+#define __warmup_h_
+
+#include "global_defines.h"
+
+#ifndef WARMUP_MAX_LOCATIONS
+	#define WARMUP_MAX_LOCATIONS 64
+#endif
+
+typedef struct
+{
+	int weather;
+	int cities;
+	long long milliseconds;
+
+} warmup_report;
+
+/*
+ * Optional startup phase, run before any worker listens. Two threads in
+ * parallel: one fetches the built in city locations that have no fresh
+ * forecast and loads the newest weather records for the hot caches, the
+ * other builds the cities response from cache/cities. Returns 0 when both
+ * finished, what was loaded is in *_Report.
+ */
+int warmup_run(warmup_report* _Report);
+
+#endif //__warmup_h_
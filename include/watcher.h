@@ -0,0 +1,23 @@
+#ifndef __watcher_h_
+#define __watcher_h_
+
+#include "global_defines.h"
+
+/* quiet time after the last change before a rebuild, editors and copies
+   touch a file several times */
+#ifndef WATCHER_DEBOUNCE_MS
+	#define WATCHER_DEBOUNCE_MS 250
+#endif
+
+/*
+ * Watches cache/cities (the cities store) and the surprise folder with
+ * inotify from a task on the calling thread's smw loop. Once a folder has
+ * been quiet for WATCHER_DEBOUNCE_MS its snapshot is rebuilt on the job
+ * pool and swapped in (cities_reload, surprise_reload), requests never read
+ * the folders themselves. One loop runs it, after smw_init and
+ * job_pool_attach.
+ */
+int watcher_attach(void);
+void watcher_detach(void);
+
+#endif //__watcher_h_
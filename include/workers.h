@@ -0,0 +1,73 @@
+#ifndef __workers_h_
+#define __workers_h_
+
+#include "global_defines.h"
+
+#ifndef WORKERS_DEFAULT_COUNT
+	#define WORKERS_DEFAULT_COUNT 1
+#endif
+#ifndef WORKERS_MAX_COUNT
+	#define WORKERS_MAX_COUNT 64
+#endif
+/* workers_prefork: a worker process is forked again no sooner than this
+   after the last time, and the master looks for exited ones this often */
+#ifndef WORKERS_PREFORK_RESTART_MS
+	#define WORKERS_PREFORK_RESTART_MS 1000
+#endif
+#ifndef WORKERS_PREFORK_POLL_MS
+	#define WORKERS_PREFORK_POLL_MS 100
+#endif
+
+/*
+ * Runs _Count event loops, one per thread. Every worker owns its own smw
+ * scheduler (g_smw is thread local) and its own WeatherServer with
+ * SO_REUSEPORT listeners on _Port, so the kernel load balances accepts.
+ * Worker 0 runs on the calling thread. Returns when *_Running drops to 0
+ * and all workers have shut down, or when another process took over (see
+ * hot_restart.h) and every worker drained. The last worker to come up
+ * calls hot_restart_ready and startup_ready.
+ */
+int workers_run(int _Count, char* _Port, volatile int* _Running);
+
+/*
+ * workers_run with processes instead of threads, for hosts whose sandbox
+ * forbids a process more than one. The calling process (the master) binds
+ * a listen socket per worker on _Port and TLS_PORT (conn_listen_bind,
+ * SO_REUSEPORT) and forks _Count worker processes of one loop each, worker
+ * i on the i-th sockets. Only what was made before the fork is shared:
+ * the caches share through tables in shared memory (weather_open_shared,
+ * geolocation_open_shared), the job pool must have no threads and the
+ * logger none either.
+ *
+ * The master serves nothing. A worker that dies is forked again, at most
+ * once per WORKERS_PREFORK_RESTART_MS, on the same sockets: the clients in
+ * their backlog wait for it and the shared tables keep what any worker
+ * fetched. A worker that fails to start stops them all. The master calls
+ * startup_ready once every worker served, and returns when *_Running drops
+ * to 0 and the workers it then sends SIGTERM exited. In a worker process it
+ * returns as well, once that worker's loop is done.
+ */
+int workers_prefork(int _Count, char* _Port, volatile int* _Running);
+
+/*
+ * Pins the workers of workers_run to _List ("0-3,8"), worker i to its
+ * i-th CPU, wrapping around when there are more workers than CPUs; NULL
+ * or "auto" takes the CPUs the process is allowed on, in order. A pinned
+ * worker allocates from its CPU's NUMA node and its listeners ask for the
+ * connections that CPU receives (SO_INCOMING_CPU), so a connection stays
+ * on one core from the NIC queue to the response. Returns -1 if _List is
+ * malformed or names a CPU the process may not run on. Call before
+ * workers_run.
+ */
+int workers_set_cpus(const char* _List);
+
+/*
+ * Every worker of workers_run busy polls (smw_setBusyPoll): its loop never
+ * sleeps and its sockets are polled for up to _Usecs per read and per
+ * epoll_wait rather than waiting on interrupts. Each worker takes a core
+ * whole, for dedicated low latency hosts, best with workers_set_cpus.
+ * 0 turns it off. Call before workers_run.
+ */
+void workers_set_busy_poll(int _Usecs);
+
+#endif //__workers_h_
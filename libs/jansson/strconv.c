@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "utilities/real_format.h"
+
 /* need jansson_private_config.h to get the correct snprintf */
 #ifdef HAVE_CONFIG_H
 #include <jansson_private_config.h>
@@ -188,6 +190,15 @@ int jsonp_dtostr(char *buffer, size_t size, double value, int precision) {
   char *start, *end;
   size_t length;
 
+#if JSON_SHORTEST_REALS
+  /* the shortest digits that read back, without printf and strtod */
+  if (precision == 0) {
+    if (size < REAL_FORMAT_SIZE)
+      return -1;
+    return real_format(value, buffer);
+  }
+#endif
+
   if (precision == 0)
     precision = 17;
 
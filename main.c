@@ -6,6 +6,33 @@
 #include "utils.h"
 #include "global_defines.h"
 #include "WeatherServer.h"
+#include "WeatherServerInstance.h"
+#include "workers.h"
+#include "hot_restart.h"
+#include "warmup.h"
+#include "prewarm.h"
+#include "cdn_purge.h"
+#include "startup.h"
+#include "connection.h"
+#include "utilities/access_log.h"
+#include "utilities/curl_client.h"
+#include "utilities/epoch.h"
+#include "utilities/job_pool.h"
+#include "utilities/json_arena.h"
+#include "utilities/huge_pages.h"
+#include "utilities/ip_ban.h"
+#include "utilities/logger.h"
+#include "utilities/mem_account.h"
+#include "utilities/tuning.h"
+#include "utilities/peer_ring.h"
+#include "utilities/trace.h"
+#include "backends/cities.h"
+#include "backends/geolocation.h"
+#include "backends/geolocation_index.h"
+#include "backends/geolocation_nearest.h"
+#include "backends/surprise.h"
+#include "backends/geolocation_offline.h"
+#include "backends/weather.h"
 
 static volatile int g_running = 1;
 static void signal_handler(int signum)
@@ -14,49 +41,576 @@ static void signal_handler(int signum)
     g_running = 0;
 }
 
+/* the startup phases, what they need and what they found */
+typedef struct
+{
+    const char *path;
+    int places;
+} main_places;
+
+#if !defined(CONN_ONLY_TCP)
+/* certificate and key parsed before the listeners ask, held until exit */
+static conn_tls_shared_t *g_tls = NULL;
+
+static int main_load_tls(void *context)
+{
+    (void)context;
+    g_tls = conn_tls_shared_acquire();
+    return g_tls ? 0 : -1;
+}
+#endif
+
+static int main_load_cities(void *context)
+{
+    (void)context;
+    return cities_reload();
+}
+
+static int main_load_surprise(void *context)
+{
+    (void)context;
+    return surprise_reload();
+}
+
+static int main_load_geonames(void *context)
+{
+    main_places *places = (main_places *)context;
+    places->places = geolocation_index_load_geonames(places->path);
+    return places->places < 0 ? -1 : 0;
+}
+
+static int main_open_geonames_db(void *context)
+{
+    main_places *places = (main_places *)context;
+    places->places = geolocation_offline_open(places->path);
+    return places->places < 0 ? -1 : 0;
+}
+
+static int main_open_weather(void *context)
+{
+    (void)context;
+    return weather_global_init();
+}
+
+static int main_open_geolocation(void *context)
+{
+    (void)context;
+    return geolocation_global_init();
+}
+
 int main(int argc, char *argv[]) {
 
-	if (argc != 2)
+	if (argc < 2 || argc > 20)
 	{
-		printf("Usage: %s <port>\n", argv[0]);
+		printf("Usage: %s <port|unix:PATH> [--workers=N|--prefork=N] [--pin-cpus[=LIST]] [--busy-poll[=USECS]] [--config=FILE] [--warmup] [--geonames=FILE] [--geonames-db=FILE] [--log=LEVEL] [--upstream=URL] [--peers=HOST:PORT,...] [--peer-self=HOST:PORT] [--cache-store=URL] [--access-log=FILE] [--trace-sample=N] [--trace-slow=MS] [--trace-log=FILE] [--mem-leak-check=SECONDS] [--huge-pages=MODE] [--hot-restart=PATH] [--xdp-ban=DIR] [--prewarm=LAT,LON,LAT,LON|@FILE] [--prewarm-at=HH:MM-HH:MM,...] [--cdn-purge=URL] [--admin-token=TOKEN|@FILE]\n", argv[0]);
 		return -1;
 	}
-	for (size_t i = 0; argv[1][i] != '\0'; i++)
+	/* unix:PATH instead of a port, for a reverse proxy on the same host */
+	int on_unix = strncmp(argv[1], HTTPServer_UNIX_PREFIX, strlen(HTTPServer_UNIX_PREFIX)) == 0;
+	char port[LISTEN_ADDRESS_MAX_SIZE] = {0};
+	if (on_unix)
+	{
+		size_t length = strlen(argv[1]) - strlen(HTTPServer_UNIX_PREFIX);
+		if (length == 0 || strlen(argv[1]) > (LISTEN_ADDRESS_MAX_SIZE - 1))
+		{
+			printf("Unix socket path is empty or does not fit in %d characters!\n",
+			       (int)(LISTEN_ADDRESS_MAX_SIZE - 1 - strlen(HTTPServer_UNIX_PREFIX)));
+			return -1;
+		}
+		strncpy(port, argv[1], LISTEN_ADDRESS_MAX_SIZE - 1);
+	}
+	else
+	{
+		for (size_t i = 0; argv[1][i] != '\0'; i++)
+		{
+			if (!isdigit((unsigned char)argv[1][i]))
+			{
+				printf("Expected integer or unix:PATH but got %s.\n", argv[1]);
+				return -1;
+			}
+		}
+		if (strlen(argv[1]) > (LISTEN_PORT_MAX_SIZE - 1))
+		{
+			printf("Given port does not fit in max value!\n");
+			return -1;
+		}
+		strncpy(port, argv[1], LISTEN_PORT_MAX_SIZE - 1);
+		int port_range = atoi(port);
+		if (port_range < 1 || port_range > LISTEN_PORT_RANGE)
+		{
+			printf("Port: %d, is not within range 1 - %d\n", port_range, LISTEN_PORT_RANGE);
+			return -1;
+		}
+	}
+	startup_begin();
+	int workers = WORKERS_DEFAULT_COUNT;
+	int workers_given = 0;
+	int prefork = 0;
+	int warm = 0;
+	const char *geonames = NULL;
+	const char *geonames_db = NULL;
+	const char *access_log = NULL;
+	const char *trace_log = NULL;
+	long trace_sample = TRACE_SAMPLE_EVERY;
+	long trace_slow = TRACE_SLOW_MS;
+	long leak_check = 0;
+	const char *hot_restart = NULL;
+	const char *peers = NULL;
+	const char *peer_self = NULL;
+	const char *prewarm_region = NULL;
+	const char *prewarm_windows = NULL;
+	const char *cdn_purge = NULL;
+	for (int i = 2; i < argc; i++)
 	{
-		if (!isdigit((unsigned char)argv[1][i]))
+		const char *prefix = "--workers=";
+		char *end = NULL;
+		if (strcmp(argv[i], "--warmup") == 0)
+		{
+			warm = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "--pin-cpus") == 0 || strncmp(argv[i], "--pin-cpus=", strlen("--pin-cpus=")) == 0)
+		{
+			const char *list = argv[i][strlen("--pin-cpus")] == '=' ? argv[i] + strlen("--pin-cpus=") : NULL;
+			if (workers_set_cpus(list) != 0)
+			{
+				printf("Pin CPUs: %s, expected auto or a list like 0-3,8 of CPUs the process may run on\n", list ? list : "auto");
+				return -1;
+			}
+			continue;
+		}
+		if (strcmp(argv[i], "--busy-poll") == 0 || strncmp(argv[i], "--busy-poll=", strlen("--busy-poll=")) == 0)
+		{
+			long usecs = WORKERS_BUSY_POLL_USECS;
+			if (argv[i][strlen("--busy-poll")] == '=')
+			{
+				usecs = strtol(argv[i] + strlen("--busy-poll="), &end, 10);
+				if (end == argv[i] + strlen("--busy-poll=") || *end != '\0' || usecs < 1 || usecs > 10000)
+				{
+					printf("Busy poll: %s, expected microseconds per poll, 1 - 10000\n", argv[i] + strlen("--busy-poll="));
+					return -1;
+				}
+			}
+			workers_set_busy_poll((int)usecs);
+			continue;
+		}
+		/* worker processes instead of threads, for hosts that allow one thread */
+		if (strncmp(argv[i], "--prefork=", strlen("--prefork=")) == 0)
+		{
+			long count = strtol(argv[i] + strlen("--prefork="), &end, 10);
+			if (end == argv[i] + strlen("--prefork=") || *end != '\0' || count < 1 || count > WORKERS_MAX_COUNT)
+			{
+				printf("Prefork: %s, is not within range 1 - %d\n", argv[i] + strlen("--prefork="), WORKERS_MAX_COUNT);
+				return -1;
+			}
+			prefork = (int)count;
+			continue;
+		}
+		if (strncmp(argv[i], "--geonames=", strlen("--geonames=")) == 0)
+		{
+			geonames = argv[i] + strlen("--geonames=");
+			continue;
+		}
+		if (strncmp(argv[i], "--geonames-db=", strlen("--geonames-db=")) == 0)
+		{
+			geonames_db = argv[i] + strlen("--geonames-db=");
+			continue;
+		}
+		if (strncmp(argv[i], "--access-log=", strlen("--access-log=")) == 0)
+		{
+			access_log = argv[i] + strlen("--access-log=");
+			continue;
+		}
+		if (strncmp(argv[i], "--config=", strlen("--config=")) == 0)
+		{
+			/* before anything reads the knobs */
+			int line = tuning_load(argv[i] + strlen("--config="));
+			if (line < 0)
+			{
+				printf("Config: %s could not be read\n", argv[i] + strlen("--config="));
+				return -1;
+			}
+			if (line > 0)
+			{
+				printf("Config: %s line %d, expected NAME = VALUE of a knob in its range\n", argv[i] + strlen("--config="), line);
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--hot-restart=", strlen("--hot-restart=")) == 0)
+		{
+			hot_restart = argv[i] + strlen("--hot-restart=");
+			if (*hot_restart == '\0')
+			{
+				printf("Hot restart: expected the path of a socket\n");
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--prewarm=", strlen("--prewarm=")) == 0)
+		{
+			prewarm_region = argv[i] + strlen("--prewarm=");
+			continue;
+		}
+		if (strncmp(argv[i], "--prewarm-at=", strlen("--prewarm-at=")) == 0)
+		{
+			prewarm_windows = argv[i] + strlen("--prewarm-at=");
+			continue;
+		}
+		if (strncmp(argv[i], "--cdn-purge=", strlen("--cdn-purge=")) == 0)
+		{
+			cdn_purge = argv[i] + strlen("--cdn-purge=");
+			continue;
+		}
+		/* operators elsewhere than on this host, TOKEN or @FILE */
+		if (strncmp(argv[i], "--admin-token=", strlen("--admin-token=")) == 0)
+		{
+			if (WeatherServerInstance_SetAdminToken(argv[i] + strlen("--admin-token=")) != 0)
+			{
+				printf("Admin token: expected up to %d printable characters without spaces, or @FILE holding them\n", WeatherServerInstance_ADMIN_TOKEN_MAX);
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--trace-log=", strlen("--trace-log=")) == 0)
+		{
+			trace_log = argv[i] + strlen("--trace-log=");
+			continue;
+		}
+		if (strncmp(argv[i], "--trace-sample=", strlen("--trace-sample=")) == 0)
+		{
+			trace_sample = strtol(argv[i] + strlen("--trace-sample="), &end, 10);
+			if (end == argv[i] + strlen("--trace-sample=") || *end != '\0' || trace_sample < 0 || trace_sample > 1000000)
+			{
+				printf("Trace sample: %s, expected one in N requests, 0 - 1000000\n", argv[i] + strlen("--trace-sample="));
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--trace-slow=", strlen("--trace-slow=")) == 0)
+		{
+			trace_slow = strtol(argv[i] + strlen("--trace-slow="), &end, 10);
+			if (end == argv[i] + strlen("--trace-slow=") || *end != '\0' || trace_slow < 0 || trace_slow > 1000000)
+			{
+				printf("Trace slow: %s, expected milliseconds, 0 - 1000000\n", argv[i] + strlen("--trace-slow="));
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--mem-leak-check=", strlen("--mem-leak-check=")) == 0)
+		{
+			leak_check = strtol(argv[i] + strlen("--mem-leak-check="), &end, 10);
+			if (end == argv[i] + strlen("--mem-leak-check=") || *end != '\0' || leak_check < 1 || leak_check > 86400)
+			{
+				printf("Memory leak check: %s, expected seconds between samples, 1 - 86400\n", argv[i] + strlen("--mem-leak-check="));
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], "--huge-pages=", strlen("--huge-pages=")) == 0)
+		{
+			huge_pages_mode mode;
+			if (huge_pages_parse(argv[i] + strlen("--huge-pages="), &mode) != 0)
+			{
+				printf("Huge pages: %s, is not one of off, transparent, explicit\n", argv[i] + strlen("--huge-pages="));
+				return -1;
+			}
+			huge_pages_set_mode(mode);
+			continue;
+		}
+		if (strncmp(argv[i], "--log=", strlen("--log=")) == 0)
+		{
+			int level = logger_parse_level(argv[i] + strlen("--log="));
+			if (level < 0)
+			{
+				printf("Log level: %s, is not one of debug, info, warn, error\n", argv[i] + strlen("--log="));
+				return -1;
+			}
+			logger_set_level(level);
+			continue;
+		}
+		if (strncmp(argv[i], "--upstream=", strlen("--upstream=")) == 0)
+		{
+			/* both APIs under one origin, as tools/mock_meteo serves them */
+			char base[METEO_API_URL_SIZE];
+			const char *origin = argv[i] + strlen("--upstream=");
+			size_t length = strlen(origin);
+			while (length > 0 && origin[length - 1] == '/')
+				length--;
+			if (length == 0 || length + strlen("/v1/") >= sizeof(base))
+			{
+				printf("Upstream: %s, expected scheme://host[:port]\n", origin);
+				return -1;
+			}
+			snprintf(base, sizeof(base), "%.*s/v1/", (int)length, origin);
+			if (weather_set_api_url(base) != 0 || geolocation_set_api_url(base) != 0)
+			{
+				printf("Upstream: %s is too long\n", origin);
+				return -1;
+			}
+			continue;
+		}
+		/* every node gets the same list, each its own entry in it */
+		if (strncmp(argv[i], "--peers=", strlen("--peers=")) == 0)
+		{
+			peers = argv[i] + strlen("--peers=");
+			continue;
+		}
+		if (strncmp(argv[i], "--peer-self=", strlen("--peer-self=")) == 0)
+		{
+			peer_self = argv[i] + strlen("--peer-self=");
+			continue;
+		}
+		/* memory, file:PATH or redis://HOST:PORT, behind the node's own caches */
+		if (strncmp(argv[i], "--cache-store=", strlen("--cache-store=")) == 0)
+		{
+			const char *url = argv[i] + strlen("--cache-store=");
+			if (weather_set_shared_store(url) != 0)
+			{
+				printf("Cache store: %s, expected memory, file:PATH or redis://HOST:PORT that can be opened\n", url);
+				return -1;
+			}
+			continue;
+		}
+		/* where bpftool pinned the maps of tools/xdp_ban.bpf.c */
+		if (strncmp(argv[i], "--xdp-ban=", strlen("--xdp-ban=")) == 0)
+		{
+			const char *dir = argv[i] + strlen("--xdp-ban=");
+			if (ip_ban_open(dir) != 0 || (!on_unix && ip_ban_add_port((uint16_t)atoi(port)) != 0) ||
+			    ip_ban_add_port((uint16_t)atoi(TLS_PORT)) != 0)
+			{
+				printf("XDP ban: %s, expected the folder of the pinned ubweather_bans and ubweather_ban_ports maps\n", dir);
+				return -1;
+			}
+			continue;
+		}
+		if (strncmp(argv[i], prefix, strlen(prefix)) != 0)
+		{
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+		long count = strtol(argv[i] + strlen(prefix), &end, 10);
+		if (*end != '\0' || count < 1 || count > WORKERS_MAX_COUNT)
 		{
-			printf("Expected integer but got %s.\n", argv[1]);
+			printf("Workers: %s, is not within range 1 - %d\n", argv[i] + strlen(prefix), WORKERS_MAX_COUNT);
 			return -1;
 		}
+		workers = (int)count;
+		workers_given = 1;
 	}
-	if (strlen(argv[1]) > (LISTEN_PORT_MAX_SIZE - 1))
+	/* what would start a thread or is one process handing to another */
+	if (prefork && (workers_given || on_unix || hot_restart || leak_check))
 	{
-		printf("Given port does not fit in max value!\n");
+		printf("Prefork: not with --workers, a unix:PATH listener, --hot-restart or --mem-leak-check\n");
 		return -1;
 	}
-	char port[LISTEN_PORT_MAX_SIZE] = {0};
-	strncpy(port, argv[1], LISTEN_PORT_MAX_SIZE - 1);
-	port[LISTEN_PORT_MAX_SIZE -1] = '\0';
-	int port_range = atoi(port);
-	if (port_range < 1 || port_range > LISTEN_PORT_RANGE)
+	if (prewarm_windows && !prewarm_region)
 	{
-		printf("Port: %d, is not within range 1 - %d\n", port_range, LISTEN_PORT_RANGE);
+		printf("Prewarm: --prewarm-at without a --prewarm region\n");
 		return -1;
 	}
-    
-    smw_init();
-    WeatherServer server;
-    WeatherServer_Initiate(&server, port);
-    printf("Info: server started on port %s\n", port);
+	if (prewarm_region && prewarm_configure(prewarm_region, prewarm_windows) != 0)
+	{
+		printf("Prewarm: expected a region as LAT,LON,LAT,LON or @FILE of up to %d cells and windows as HH:MM-HH:MM,...\n", PREWARM_MAX_CELLS);
+		return -1;
+	}
+	if (cdn_purge && cdn_purge_configure(cdn_purge) != 0)
+	{
+		printf("CDN purge: expected an http:// or https:// URL\n");
+		return -1;
+	}
+	if (peers && peer_ring_init(peers, peer_self) != 0)
+	{
+		printf("Peers: %s, expected at most %d host:port entries separated by commas\n", peers, PEER_RING_MAX_PEERS);
+		return -1;
+	}
+
+    /* process wide, must happen before any worker thread exists */
+    uint64_t started = SystemMonotonicMS();
+    if (curl_client_global_init() != 0)
+    {
+        printf("Failed to initialize libcurl\n");
+        return -1;
+    }
+    json_arena_install();
+    if (WeatherServerInstance_GlobalInit() != 0)
+    {
+        printf("Failed to build the route table\n");
+        curl_client_global_cleanup();
+        return -1;
+    }
+    /* the worker processes of a prefork run the jobs themselves */
+    if (job_pool_init(prefork ? 0 : JOB_POOL_THREADS) != 0)
+    {
+        printf("Failed to start job pool\n");
+        curl_client_global_cleanup();
+        return -1;
+    }
+    /* from here on the loops and the pool log, off their threads; the
+       worker processes of a prefork write their lines themselves */
+    if (!prefork)
+        logger_start();
+    startup_record("libraries", started, 0);
+    /* the access log's records take the same ring */
+    if (access_log && access_log_open(access_log) != 0)
+    {
+        LOG_WARN("Warning: %s could not be opened, no access log is written", access_log);
+    }
+    trace_configure((unsigned int)trace_sample, (unsigned int)trace_slow);
+    if (trace_log && trace_log_open(trace_log) != 0)
+    {
+        LOG_WARN("Warning: %s could not be opened, no traces are written", trace_log);
+    }
+    if (leak_check && mem_account_leak_check_start((unsigned int)leak_check) != 0)
+    {
+        LOG_WARN("Warning: memory leak check not started");
+    }
+
+    /* what does not depend on anything else at once: the certificate and
+       key, the /GetCities body (built once, /admin/reloadcities rebuilds it),
+       the surprise folder and the GeoNames index and dataset */
+    main_places index = {geonames, 0};
+    main_places dataset = {geonames_db, 0};
+    startup_phase loads[5];
+    int load_count = 0;
+#if !defined(CONN_ONLY_TCP)
+    loads[load_count++] = (startup_phase){"tls", main_load_tls, NULL, 0};
+#endif
+    loads[load_count++] = (startup_phase){"cities", main_load_cities, NULL, 0};
+    loads[load_count++] = (startup_phase){"surprise", main_load_surprise, NULL, 0};
+    if (geonames)
+        loads[load_count++] = (startup_phase){"geonames", main_load_geonames, &index, 0};
+    if (geonames_db)
+        loads[load_count++] = (startup_phase){"geonames_db", main_open_geonames_db, &dataset, 0};
+    startup_parallel(loads, load_count);
+    for (int i = 0; i < load_count; i++)
+    {
+        if (loads[i].run == main_load_cities && loads[i].result != 0)
+            LOG_WARN("Warning: cities snapshot not built, /GetCities reads the cache folder per request");
+        if (loads[i].run == main_load_surprise && loads[i].result != 0)
+            LOG_WARN("Warning: %s could not be listed, /GetSurprise has nothing to send", Surprise_FOLDER);
+#if !defined(CONN_ONLY_TCP)
+        if (loads[i].run == main_load_tls && loads[i].result != 0)
+            LOG_WARN("Warning: TLS certificate or key not loaded, each TLS listener tries again");
+#endif
+    }
+    if (geonames)
+    {
+        if (index.places < 0)
+            LOG_WARN("Warning: could not read %s, place searches go upstream", geonames);
+        else
+            LOG_INFO("Info: indexed %d place(s) from %s", index.places, geonames);
+    }
+    if (geonames_db)
+    {
+        if (dataset.places < 0)
+            LOG_WARN("Warning: %s is not a packed GeoNames dataset, place searches go upstream", geonames_db);
+        else
+            LOG_INFO("Info: mapped %d place(s) from %s", dataset.places, geonames_db);
+    }
+    /* from here on the stores of the process on the socket are frozen, they
+       are ours to open */
+    started = SystemMonotonicMS();
+    int taken_over = hot_restart ? hot_restart_takeover(hot_restart) : 0;
+    if (hot_restart)
+        startup_record("takeover", started, taken_over < 0 ? -1 : 0);
+    if (taken_over < 0)
+    {
+        /* it serves on and writes its stores, a second writer would not do */
+        LOG_ERROR("Error: the process on %s did not hand over, not starting", hot_restart);
+#if !defined(CONN_ONLY_TCP)
+        if (g_tls)
+            conn_tls_shared_release(g_tls);
+#endif
+        job_pool_dispose();
+        geolocation_index_dispose();
+        geolocation_nearest_dispose();
+        geolocation_offline_close();
+        cities_global_dispose();
+        surprise_global_dispose();
+        curl_client_global_cleanup();
+        mem_account_leak_check_stop();
+        logger_stop();
+        access_log_close();
+        trace_log_close();
+        return -1;
+    }
+    /* the stores, geolocation's after the cities it learns from */
+    startup_phase stores[2] = {{"weather_store", main_open_weather, NULL, 0},
+                               {"geolocation_store", main_open_geolocation, NULL, 0}};
+    startup_parallel(stores, 2);
+    if (stores[0].result != 0)
+    {
+        LOG_WARN("Warning: weather cache store unavailable, forecasts are not cached on disk");
+    }
+    if (stores[1].result != 0)
+    {
+        LOG_WARN("Warning: geolocation cache store unavailable, search results are not cached on disk");
+    }
+
+    /* listeners only open once the caches are warm */
+    if (warm)
+    {
+        warmup_report report;
+        started = SystemMonotonicMS();
+        warmup_run(&report);
+        startup_record("warmup", started, 0);
+        LOG_INFO("Info: ready after warm up in %lld ms, %d forecast(s), cities %s", report.milliseconds,
+               report.weather, report.cities ? "built" : "not built");
+    }
+
+    /* the hot set of the process we replace, over what --warmup loaded */
+    if (taken_over)
+    {
+        started = SystemMonotonicMS();
+        LOG_INFO("Info: %d cache entries handed over", hot_restart_warm());
+        startup_record("handover_warm", started, 0);
+    }
+
+    /* what the worker processes fetch is kept where all of them and the
+       ones forked after a crash find it, the store files are only read */
+    if (prefork && weather_open_shared() != 0)
+        LOG_WARN("Warning: no shared weather store, worker processes do not see each other's forecasts");
+    if (prefork && geolocation_open_shared() != 0)
+        LOG_WARN("Warning: no shared geolocation table, worker processes do not see each other's search results");
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
-    while (g_running) {
-        uint64_t now = SystemMonotonicMS(); 
-        smw_work(now);
+    int result;
+    if (prefork)
+    {
+        LOG_INFO("Info: server started on port %s with %d worker process(es)", port, prefork);
+        result = workers_prefork(prefork, port, &g_running);
+    }
+    else
+    {
+        LOG_INFO("Info: server started on %s%s with %d worker(s)", on_unix ? "" : "port ", port, workers);
+        result = workers_run(workers, port, &g_running);
     }
+    hot_restart_close();
+#if !defined(CONN_ONLY_TCP)
+    if (g_tls)
+        conn_tls_shared_release(g_tls);
+#endif
 
-    WeatherServer_Dispose(&server);
-    smw_dispose();
+    job_pool_dispose();
+    epoch_dispose();
+    prewarm_dispose();
+    cdn_purge_dispose();
+    weather_global_dispose();
+    geolocation_global_dispose();
+    geolocation_index_dispose();
+    geolocation_nearest_dispose();
+    geolocation_offline_close();
+    cities_global_dispose();
+    surprise_global_dispose();
+    curl_client_global_cleanup();
+    tuning_dispose();
+    mem_account_leak_check_stop();
+    logger_stop();
+    access_log_close();
+    trace_log_close();
+    ip_ban_close();
 
-    return 0;
+    return result;
 }
@@ -4817,6 +4817,31 @@ void mbedtls_ssl_conf_renegotiation_period(mbedtls_ssl_config *conf,
  */
 int mbedtls_ssl_check_pending(const mbedtls_ssl_context *ssl);
 
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH)
+/** Length the record buffers are shrunk to by mbedtls_ssl_set_idle() */
+#define MBEDTLS_SSL_IDLE_BUFFER_LEN 256
+
+/**
+ * \brief          Give the record buffers of a connection back while it sits
+ *                 idle, or grow them again before it is used.
+ *
+ * \note           In between, no function that reads or writes records may
+ *                 be called on \p ssl. mbedtls_ssl_session_reset() and
+ *                 mbedtls_ssl_free() may.
+ *
+ * \param ssl      SSL context, with the handshake over
+ * \param idle     1 to shrink both buffers to MBEDTLS_SSL_IDLE_BUFFER_LEN,
+ *                 0 to restore the lengths the session negotiated
+ *
+ * \return         0 if successful.
+ * \return         #MBEDTLS_ERR_SSL_BAD_INPUT_DATA if \p idle is 1 and
+ *                 the handshake is not over or records are in flight.
+ * \return         #MBEDTLS_ERR_SSL_ALLOC_FAILED if the buffers could not
+ *                 be grown again, \p ssl is then only fit to be freed.
+ */
+int mbedtls_ssl_set_idle(mbedtls_ssl_context *ssl, int idle);
+#endif /* MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH */
+
 /**
  * \brief          Return the number of application data bytes
  *                 remaining to be read from the current record.
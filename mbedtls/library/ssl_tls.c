@@ -1606,6 +1606,30 @@ int mbedtls_ssl_session_reset_int(mbedtls_ssl_context *ssl, int partial)
  * Reset an initialized and used SSL context for re-use while retaining
  * all application-set variables, function pointers and data.
  */
+#if defined(MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH)
+int mbedtls_ssl_set_idle(mbedtls_ssl_context *ssl, int idle)
+{
+    size_t in_len = mbedtls_ssl_get_input_buflen(ssl);
+    size_t out_len = mbedtls_ssl_get_output_buflen(ssl);
+
+    if (idle) {
+        if (!mbedtls_ssl_is_handshake_over(ssl) || ssl->in_left != 0 ||
+            ssl->out_left != 0 || mbedtls_ssl_check_pending(ssl)) {
+            return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+        }
+        handle_buffer_resizing(ssl, 1, MBEDTLS_SSL_IDLE_BUFFER_LEN,
+                               MBEDTLS_SSL_IDLE_BUFFER_LEN);
+        return 0;
+    }
+
+    handle_buffer_resizing(ssl, 0, in_len, out_len);
+    if (ssl->in_buf_len < in_len || ssl->out_buf_len < out_len) {
+        return MBEDTLS_ERR_SSL_ALLOC_FAILED;
+    }
+    return 0;
+}
+#endif /* MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH */
+
 int mbedtls_ssl_session_reset(mbedtls_ssl_context *ssl)
 {
     return mbedtls_ssl_session_reset_int(ssl, 0);
@@ -1,9 +1,15 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "HTTPParser.h"
+#include "utilities/http_scan.h"
+#include "utilities/logger.h"
+#include "utilities/perfect_hash.h"
+#include "utilities/url_codec.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 // strndup wrapper for old parsers that relied on manual substringing
 char* substr(const char* start, const char* end)
@@ -14,7 +20,7 @@ char* substr(const char* start, const char* end)
 HTTPQuery* HTTPQuery_fromstring(const char* URL)
 {
     HTTPQuery* query = calloc(1, sizeof(HTTPQuery));
-    query->Query = LinkedList_create();
+    SmallVector_init(&query->Query, sizeof(HTTPQueryParameter));
     const char* begin = strchr(URL, '?');
     if(begin == NULL)
     {
@@ -31,16 +37,14 @@ HTTPQuery* HTTPQuery_fromstring(const char* URL)
         const char* end = amp ? amp : (URL + strlen(URL));
 
         const char* eq = memchr(pos, '=', end - pos);
-        HTTPQueryParameter* param = calloc(1, sizeof(HTTPQueryParameter));
-        if (eq) {
-            param->Name = strndup(pos, eq - pos);
-            param->Value = strndup(eq + 1, end - eq - 1);
-        } else {
-            param->Name = strndup(pos, end - pos);
-            param->Value = NULL;
-        }
-
-        LinkedList_append(query->Query, param);
+        HTTPQueryParameter* param = (HTTPQueryParameter*)SmallVector_push(&query->Query);
+        if (param == NULL) break;
+        char* name = strndup(pos, (eq ? eq : end) - pos);
+        char* value = eq ? strndup(eq + 1, end - eq - 1) : NULL;
+        if (name) name[url_codec_decode(name, strlen(name), name)] = '\0';
+        if (value) value[url_codec_decode(value, strlen(value), value)] = '\0';
+        param->Name = name;
+        param->Value = value;
 
         if (!amp) break;
         pos = amp + 1;
@@ -49,17 +53,72 @@ HTTPQuery* HTTPQuery_fromstring(const char* URL)
     return query;
 }
 
+int HTTPStringView_equals(HTTPStringView view, const char* str) {
+    return strlen(str) == view.length && memcmp(view.data, str, view.length) == 0;
+}
+
+int HTTPStringView_equalsIgnoreCase(HTTPStringView view, const char* str) {
+    return strlen(str) == view.length && strncasecmp(view.data, str, view.length) == 0;
+}
+
+const char* HTTPStringView_copy(HTTPStringView view, char* out, size_t size) {
+    if (view.length >= size) return NULL;
+    memcpy(out, view.data, view.length);
+    out[view.length] = '\0';
+    return out;
+}
+
+void HTTPQueryView_parse(HTTPQueryView* query, HTTPStringView URL) {
+    const char* end = URL.data + URL.length;
+    const char* begin = URL.length ? memchr(URL.data, '?', URL.length) : NULL;
+
+    query->Count = 0;
+    query->Path.data = URL.data;
+    query->Path.length = (begin ? begin : end) - URL.data;
+    if (begin == NULL) return;
+
+    const char* pos = begin + 1;
+    while (pos < end && query->Count < MAX_QUERY_PARAMETERS) {
+        const char* amp = memchr(pos, '&', end - pos);
+        const char* paramEnd = amp ? amp : end;
+
+        const char* eq = memchr(pos, '=', paramEnd - pos);
+        HTTPQueryViewParameter* param = &query->Query[query->Count++];
+        param->Name.data = pos;
+        param->Name.length = (eq ? eq : paramEnd) - pos;
+        param->HasValue = eq != NULL;
+        param->Value.data = eq ? eq + 1 : paramEnd;
+        param->Value.length = eq ? paramEnd - eq - 1 : 0;
+
+        if (!amp) break;
+        pos = amp + 1;
+    }
+}
+
+const HTTPQueryViewParameter* HTTPQueryView_getParameter(const HTTPQueryView* query, const char* name) {
+    for (int i = 0; i < query->Count; i++) {
+        if (HTTPStringView_equals(query->Query[i].Name, name))
+            return &query->Query[i];
+    }
+    return NULL;
+}
+
+const char* HTTPQueryView_copyParameter(const HTTPQueryView* query, const char* name, char* out, size_t size) {
+    const HTTPQueryViewParameter* param = HTTPQueryView_getParameter(query, name);
+    if (param == NULL || !param->HasValue) return NULL;
+    return HTTPStringView_copy(param->Value, out, size);
+}
+
 void free_query(void* item)
 {
     HTTPQueryParameter* param = (HTTPQueryParameter*)item;
     free((void*)param->Name);
     free((void*)param->Value);
-    free(param);
 }
 void HTTPQuery_Dispose(HTTPQuery** pointer) {
     HTTPQuery* query = *pointer;
     free((void*)query->Path);
-    LinkedList_dispose(&query->Query, free_query);
+    SmallVector_clear(&query->Query, free_query);
     free(query);
     *pointer = NULL;
 }
@@ -80,6 +139,12 @@ const char* InvalidReason_tostring(InvalidReason reason) {
             return "The request protocol was not recognized.";
         case InvalidURL:
             return "The request URL was invalid.";
+        case InvalidHeader:
+            return "A header line was malformed.";
+        case TooManyHeaders:
+            return "The request has too many headers.";
+        case HeadTooLarge:
+            return "The request head is too large.";
         default:
             return "Unknown reason.";
     }
@@ -115,7 +180,21 @@ void free_header(void* context) {
     HTTPHeader* hdr = (HTTPHeader*)context;
     free((void*)hdr->Name);
     free((void*)hdr->Value);
-    free(hdr);
+}
+
+// A header entry owning copies of name and value, 1 if out of memory
+static int HTTPHeader_append(SmallVector* headers, const char* name, const char* value) {
+    char* nameCopy = strdup(name);
+    char* valueCopy = strdup(value);
+    HTTPHeader* header = nameCopy && valueCopy ? (HTTPHeader*)SmallVector_push(headers) : NULL;
+    if (header == NULL) {
+        free(nameCopy);
+        free(valueCopy);
+        return 1;
+    }
+    header->Name = nameCopy;
+    header->Value = valueCopy;
+    return 0;
 }
 
 const char* RequestMethod_tostring(RequestMethod method) {
@@ -143,8 +222,14 @@ const char* CommonResponseMessages(ResponseCode code) {
     switch (code) {
     case 200:
         return "OK";
+    case 202:
+        return "Accepted";
     case 204:
         return "No Content";
+    case 206:
+        return "Partial Content";
+    case 226:
+        return "IM Used";
     case 301:
         return "Moved Permanently";
     case 302:
@@ -163,12 +248,20 @@ const char* CommonResponseMessages(ResponseCode code) {
         return "Method Not Allowed";
     case 413:
         return "Content Too Large";
+    case 416:
+        return "Range Not Satisfiable";
+    case 425:
+        return "Too Early";
+    case 431:
+        return "Request Header Fields Too Large";
     case 500:
         return "Internal Server Error";
     case 501:
         return "Not Implemented";
     case 503:
         return "Service Unavailable";
+    case 504:
+        return "Gateway Timeout";
     default:
         return "";
     }
@@ -185,38 +278,27 @@ HTTPRequest* HTTPRequest_new(RequestMethod method, const char* URL) {
     HTTPRequest* request = calloc(1, sizeof(HTTPRequest));
     request->method = method;
     request->URL = strdup(URL);
-    request->headers = LinkedList_create();
+    SmallVector_init(&request->headers, sizeof(HTTPHeader));
 
     return request;
 }
 
 int HTTPRequest_add_header(HTTPRequest* request, const char* name, const char* value) {
-    if (request->headers == NULL) return 0;
-    HTTPHeader* header = calloc(1, sizeof(HTTPHeader));
-    if (header == NULL) return 0;
-    header->Name = strdup(name);
-    if (header->Name == NULL) return 0;
-    header->Value = strdup(value);
-    if (header->Value == NULL) return 0;
-    return LinkedList_append(request->headers, header);
+    return HTTPHeader_append(&request->headers, name, value);
 }
 
 const char* HTTPRequest_tostring(HTTPRequest* request) {
     const char* method = RequestMethod_tostring(request->method);
     int messageSize = 2 + strlen(method) + strlen(HTTP_VERSION) + strlen(request->URL);
-    if (request->headers != NULL) {
-        LinkedList_foreach(request->headers, node) {
-            HTTPHeader* hdr = (HTTPHeader*)node->item;
-            messageSize += 4 + strlen(hdr->Name) + strlen(hdr->Value);
-        }
+    SmallVector_foreach(&request->headers, HTTPHeader, hdr) {
+        messageSize += 4 + strlen(hdr->Name) + strlen(hdr->Value);
     }
     messageSize += 4; // + strlen(request->body);
     char* status = malloc(messageSize);
     // write first line
     int curPos = snprintf(status, messageSize, "%s %s %s", method, request->URL, HTTP_VERSION);
     // write headers
-    LinkedList_foreach(request->headers, node) {
-        HTTPHeader* hdr = (HTTPHeader*)node->item;
+    SmallVector_foreach(&request->headers, HTTPHeader, hdr) {
         int written = snprintf(&status[curPos], messageSize - curPos, "\r\n%s: %s", hdr->Name, hdr->Value);
         curPos += written;
     }
@@ -231,7 +313,7 @@ const char* HTTPRequest_tostring(HTTPRequest* request) {
 HTTPRequest* HTTPRequest_fromstring(const char* message) {
     HTTPRequest* request = calloc(1, sizeof(HTTPRequest));
     request->reason = Malformed;
-    request->headers = LinkedList_create();
+    SmallVector_init(&request->headers, sizeof(HTTPHeader));
 
     int state = 0;
 
@@ -356,11 +438,13 @@ HTTPRequest* HTTPRequest_fromstring(const char* message) {
                 break;
             }
 
-            HTTPHeader* header = calloc(1, sizeof(HTTPHeader));
+            HTTPHeader* header = (HTTPHeader*)SmallVector_push(&request->headers);
             if (header != NULL) {
                 header->Name = name;
                 header->Value = value;
-                LinkedList_append(request->headers, header);
+            } else {
+                free(name);
+                free(value);
             }
         }
 
@@ -371,11 +455,18 @@ HTTPRequest* HTTPRequest_fromstring(const char* message) {
     return request;
 }
 
+const char* HTTPRequest_getHeader(HTTPRequest* request, const char* name) {
+    SmallVector_foreach(&request->headers, HTTPHeader, header) {
+        if (strcasecmp(header->Name, name) == 0)
+            return header->Value;
+    }
+    return NULL;
+}
+
 const char* HTTPQuery_getParameter(HTTPQuery* query, const char* name)
 {
-    LinkedList_foreach(query->Query, node)
+    SmallVector_foreach(&query->Query, HTTPQueryParameter, param)
     {
-        HTTPQueryParameter* param = (HTTPQueryParameter*)node->item;
         if(strcmp(param->Name, name)==0)
             return param->Value;
     };
@@ -388,90 +479,433 @@ void HTTPRequest_Dispose(HTTPRequest** req) {
         HTTPRequest* request = *req;
         if(request->URL != NULL)
             free((void*)request->URL);
-        LinkedList_dispose(&request->headers, free_header);
+        SmallVector_clear(&request->headers, free_header);
         free(request);
         *req = NULL;
     }
 }
 
-HTTPResponse* HTTPResponse_new(ResponseCode code, uint8_t* body, size_t bodyLength) {
+// In HTTPHeaderId order
+static const char* const HTTPHeader_names[HTTPHeader_KnownCount] = {
+    "Connection", "Host", "Accept-Encoding", "If-None-Match", "If-Modified-Since", "Range", "If-Range", "Upgrade",
+    "traceparent", "Accept", "Content-Length", "Transfer-Encoding",
+};
+static perfect_hash HTTPHeader_table;
+static pthread_once_t HTTPHeader_tableOnce = PTHREAD_ONCE_INIT;
+
+static void HTTPHeader_buildTable(void) {
+    if (perfect_hash_build(&HTTPHeader_table, HTTPHeader_names, HTTPHeader_KnownCount) != 0)
+        LOG_ERROR("HTTPParser: no perfect hash for the known headers, they are looked up by name");
+}
+
+HTTPHeaderId HTTPHeader_id(const char* name, size_t length) {
+    pthread_once(&HTTPHeader_tableOnce, HTTPHeader_buildTable);
+    int index = perfect_hash_find(&HTTPHeader_table, name, length);
+    return index < 0 ? HTTPHeader_Unknown : (HTTPHeaderId)index;
+}
+
+void HTTPRequestParser_init(HTTPRequestParser* parser) {
+    memset(parser, 0, sizeof(HTTPRequestParser));
+    parser->state = HTTPRequestParser_Method;
+    parser->reason = NotInvalid;
+}
+
+static int HTTPRequestParser_fail(HTTPRequestParser* parser, InvalidReason reason) {
+    parser->state = HTTPRequestParser_Invalid;
+    parser->reason = reason;
+    return -1;
+}
+
+// Enum_Method/Enum_Protocol take terminated strings, tokens are short enough for the stack
+static int HTTPRequestParser_token(const char* buffer, uint32_t start, uint32_t end, char* out, size_t size) {
+    if (end - start >= size) return -1;
+    memcpy(out, buffer + start, end - start);
+    out[end - start] = '\0';
+    return 0;
+}
+
+// Inside a token only its delimiters matter, http_scan jumps straight to the next one
+static const char* const HTTPRequestParser_delimiters[] = {
+    [HTTPRequestParser_Method] = " \r\n\n",
+    [HTTPRequestParser_URL] = " \r\n\n",
+    [HTTPRequestParser_Protocol] = " \r\n\n",
+    [HTTPRequestParser_HeaderName] = ": \r\n",
+    [HTTPRequestParser_HeaderValue] = "\r\n\n\n",
+};
+
+int HTTPRequestParser_execute(HTTPRequestParser* parser, const char* buffer, size_t length) {
+    char token[16];
+
+    while (parser->offset < length) {
+        if (parser->state < sizeof(HTTPRequestParser_delimiters) / sizeof(HTTPRequestParser_delimiters[0])
+            && HTTPRequestParser_delimiters[parser->state] != NULL) {
+            parser->offset += http_scan(buffer + parser->offset, length - parser->offset,
+                                        HTTPRequestParser_delimiters[parser->state]);
+            // no need to wait for the rest of it
+            if (parser->state == HTTPRequestParser_URL && parser->offset - parser->urlOffset >= MAX_URL_LEN)
+                return HTTPRequestParser_fail(parser, URLTooLong);
+            if (parser->offset == length) break;
+        }
+        char c = buffer[parser->offset];
+
+        switch (parser->state) {
+        case HTTPRequestParser_Method:
+            if (c == ' ') {
+                if (parser->offset == parser->token) return HTTPRequestParser_fail(parser, Malformed);
+                if (HTTPRequestParser_token(buffer, parser->token, parser->offset, token, sizeof(token)) == 0)
+                    parser->method = Enum_Method(token);
+                if (STRICT_VALIDATION && parser->method == Method_Unknown)
+                    return HTTPRequestParser_fail(parser, InvalidMethod);
+                parser->urlOffset = parser->offset + 1;
+                parser->state = HTTPRequestParser_URL;
+            } else if (c == '\r' || c == '\n') {
+                return HTTPRequestParser_fail(parser, Malformed);
+            }
+            break;
+        case HTTPRequestParser_URL:
+            if (c == ' ') {
+                parser->urlLength = parser->offset - parser->urlOffset;
+                if (parser->urlLength == 0) return HTTPRequestParser_fail(parser, Malformed);
+                if (parser->urlLength >= MAX_URL_LEN) return HTTPRequestParser_fail(parser, URLTooLong);
+                if (STRICT_VALIDATION && buffer[parser->urlOffset] != '/')
+                    return HTTPRequestParser_fail(parser, InvalidURL);
+                parser->token = parser->offset + 1;
+                parser->state = HTTPRequestParser_Protocol;
+            } else if (c == '\r' || c == '\n') {
+                return HTTPRequestParser_fail(parser, Malformed);
+            }
+            break;
+        case HTTPRequestParser_Protocol:
+            if (c == '\r' || c == '\n') {
+                parser->protocol = Protocol_Unknown;
+                if (HTTPRequestParser_token(buffer, parser->token, parser->offset, token, sizeof(token)) == 0)
+                    parser->protocol = Enum_Protocol(token);
+                if (STRICT_VALIDATION && parser->protocol == Protocol_Unknown)
+                    return HTTPRequestParser_fail(parser, InvalidProtocol);
+                parser->state = c == '\r' ? HTTPRequestParser_RequestLineLF : HTTPRequestParser_HeaderStart;
+            } else if (c == ' ') {
+                return HTTPRequestParser_fail(parser, Malformed);
+            }
+            break;
+        case HTTPRequestParser_RequestLineLF:
+            if (c != '\n') return HTTPRequestParser_fail(parser, Malformed);
+            parser->state = HTTPRequestParser_HeaderStart;
+            break;
+        case HTTPRequestParser_HeaderStart:
+            if (c == '\r') {
+                parser->state = HTTPRequestParser_HeadLF;
+            } else if (c == '\n') {
+                parser->state = HTTPRequestParser_Done;
+                parser->offset++;
+                return 1;
+            } else if (c == ':' || c == ' ' || c == '\t') {
+                return HTTPRequestParser_fail(parser, InvalidHeader);
+            } else {
+                if (parser->headerCount == MAX_HEADERS) return HTTPRequestParser_fail(parser, TooManyHeaders);
+                parser->headers[parser->headerCount].nameOffset = parser->offset;
+                parser->state = HTTPRequestParser_HeaderName;
+            }
+            break;
+        case HTTPRequestParser_HeaderName:
+            if (c == ':') {
+                HTTPRequestParser_Header* header = &parser->headers[parser->headerCount];
+                header->nameLength = parser->offset - header->nameOffset;
+                HTTPHeaderId id = HTTPHeader_id(buffer + header->nameOffset, header->nameLength);
+                // A body framed twice is read one way here and another by a
+                // proxy in front, what is left over smuggles a request
+                if ((id == HTTPHeader_ContentLength || id == HTTPHeader_TransferEncoding) && parser->known[id] != 0)
+                    return HTTPRequestParser_fail(parser, InvalidHeader);
+                if (id != HTTPHeader_Unknown && parser->known[id] == 0)
+                    parser->known[id] = (uint8_t)(parser->headerCount + 1);
+                parser->state = HTTPRequestParser_HeaderValueStart;
+            } else if (c == '\r' || c == '\n' || c == ' ') {
+                return HTTPRequestParser_fail(parser, InvalidHeader);
+            }
+            break;
+        case HTTPRequestParser_HeaderValueStart:
+            if (c == ' ' || c == '\t') break;
+            parser->headers[parser->headerCount].valueOffset = parser->offset;
+            parser->state = HTTPRequestParser_HeaderValue;
+            continue; // this byte may already end the (empty) value
+        case HTTPRequestParser_HeaderValue:
+            if (c == '\r' || c == '\n') {
+                HTTPRequestParser_Header* header = &parser->headers[parser->headerCount];
+                uint32_t end = parser->offset;
+                while (end > header->valueOffset && (buffer[end - 1] == ' ' || buffer[end - 1] == '\t')) end--;
+                header->valueLength = end - header->valueOffset;
+                parser->headerCount++;
+                parser->state = c == '\r' ? HTTPRequestParser_HeaderLF : HTTPRequestParser_HeaderStart;
+            }
+            break;
+        case HTTPRequestParser_HeaderLF:
+            if (c != '\n') return HTTPRequestParser_fail(parser, InvalidHeader);
+            parser->state = HTTPRequestParser_HeaderStart;
+            break;
+        case HTTPRequestParser_HeadLF:
+            if (c != '\n') return HTTPRequestParser_fail(parser, Malformed);
+            parser->state = HTTPRequestParser_Done;
+            parser->offset++;
+            return 1;
+        case HTTPRequestParser_Done:
+            return 1;
+        case HTTPRequestParser_Invalid:
+            return -1;
+        }
+        parser->offset++;
+    }
+
+    if (parser->state == HTTPRequestParser_Done) return 1;
+    if (parser->state == HTTPRequestParser_Invalid) return -1;
+    return 0;
+}
+
+HTTPStringView HTTPRequestParser_getURL(const HTTPRequestParser* parser, const char* buffer) {
+    HTTPStringView url = { buffer + parser->urlOffset, parser->urlLength };
+    return url;
+}
+
+const char* HTTPRequestParser_getHeader(const HTTPRequestParser* parser, const char* buffer, const char* name,
+                                        size_t* valueLength) {
+    size_t nameLength = strlen(name);
+    for (int i = 0; i < parser->headerCount; i++) {
+        const HTTPRequestParser_Header* header = &parser->headers[i];
+        if (header->nameLength == nameLength && strncasecmp(buffer + header->nameOffset, name, nameLength) == 0) {
+            if (valueLength) *valueLength = header->valueLength;
+            return buffer + header->valueOffset;
+        }
+    }
+    return NULL;
+}
+
+const char* HTTPRequestParser_getKnownHeader(const HTTPRequestParser* parser, const char* buffer, HTTPHeaderId id,
+                                             size_t* valueLength) {
+    if (id >= HTTPHeader_KnownCount || parser->known[id] == 0) return NULL;
+    const HTTPRequestParser_Header* header = &parser->headers[parser->known[id] - 1];
+    if (valueLength) *valueLength = header->valueLength;
+    return buffer + header->valueOffset;
+}
+
+int HTTPRequestParser_hasBody(const HTTPRequestParser* parser, const char* buffer) {
+    if (parser->known[HTTPHeader_TransferEncoding] != 0) return 1;
+    size_t length = 0;
+    const char* value = HTTPRequestParser_getKnownHeader(parser, buffer, HTTPHeader_ContentLength, &length);
+    if (!value) return 0;
+    if (length == 0) return 1;
+    for (size_t i = 0; i < length; i++) {
+        if (value[i] != '0') return 1;
+    }
+    return 0;
+}
+
+HTTPResponse* HTTPResponse_new_head(ResponseCode code, size_t bodyLength, int cors) {
     HTTPResponse* response = calloc(1, sizeof(HTTPResponse));
     response->responseCode = code;
-    if(body != NULL)
-    {
-        response->body = (uint8_t*)malloc(bodyLength * sizeof(uint8_t));
-        memcpy(response->body, body, bodyLength);
-        response->bodySize = bodyLength;
-    } else {
-        response->bodySize = 0;
-    }
-    response->headers = LinkedList_create();
+    response->bodySize = 0;
+    SmallVector_init(&response->headers, sizeof(HTTPHeader));
 
     char lenStr[32];
-    snprintf(lenStr, sizeof(lenStr), "%zu", response->bodySize);
+    snprintf(lenStr, sizeof(lenStr), "%zu", bodyLength);
     HTTPResponse_add_header(response, "Content-Length", lenStr);
     if(CLOSE_CONNECTIONS)
         HTTPResponse_add_header(response, "Connection", "close");
 
     // CORS headers
-    if(strlen(CORS_ALLOWED_ORIGIN) > 0)
+    if(cors && strlen(CORS_ALLOWED_ORIGIN) > 0)
         HTTPResponse_add_header(response, "Access-Control-Allow-Origin", CORS_ALLOWED_ORIGIN);
-    if(strlen(CORS_ALLOWED_METHODS) > 0)
+    if(cors && strlen(CORS_ALLOWED_METHODS) > 0)
         HTTPResponse_add_header(response, "Access-Control-Allow-Methods", CORS_ALLOWED_METHODS);
-    if(strlen(CORS_ALLOWED_HEADERS) > 0)
+    if(cors && strlen(CORS_ALLOWED_HEADERS) > 0)
         HTTPResponse_add_header(response, "Access-Control-Allow-Headers", CORS_ALLOWED_HEADERS);
 
     return response;
 }
 
+HTTPResponse* HTTPResponse_new(ResponseCode code, uint8_t* body, size_t bodyLength, int cors) {
+    HTTPResponse* response = HTTPResponse_new_head(code, body != NULL ? bodyLength : 0, cors);
+    if(body != NULL)
+    {
+        response->body = (uint8_t*)malloc(bodyLength * sizeof(uint8_t));
+        memcpy(response->body, body, bodyLength);
+        response->bodySize = bodyLength;
+    }
+
+    return response;
+}
+
 int HTTPResponse_add_header(HTTPResponse* response, const char* name, const char* value) {
-    if (response->headers == NULL) return 0;
-    HTTPHeader* header = calloc(1, sizeof(HTTPHeader));
-    if (header == NULL) return 0;
-    header->Name = strdup(name);
-    if (header->Name == NULL) return 0;
-    header->Value = strdup(value);
-    if (header->Value == NULL) return 0;
-    return LinkedList_append(response->headers, header);
+    return HTTPHeader_append(&response->headers, name, value);
 }
 
-const char* HTTPResponse_tostring(HTTPResponse* response, size_t* outSize) {
+// Status line, headers and the blank line, without the terminating null
+static int HTTPResponse_head_size(HTTPResponse* response) {
     const char* message = CommonResponseMessages(response->responseCode);
-    // Count size of everything before allocating
     // 5 = 2 spaces + response code (3 digits) + null term
     int messageSize = 5 + strlen(HTTP_VERSION) + strlen(message);
-    if (response->headers != NULL) {
-        LinkedList_foreach(response->headers, node) {
-            HTTPHeader* hdr = (HTTPHeader*)node->item;
-            messageSize += 4 + strlen(hdr->Name) + strlen(hdr->Value); // 4 = \r\n and symbols between name & value
-        }
+    SmallVector_foreach(&response->headers, HTTPHeader, hdr) {
+        messageSize += 4 + strlen(hdr->Name) + strlen(hdr->Value); // 4 = \r\n and symbols between name & value
     }
-    messageSize += 4 + response->bodySize; // 4 = \r\n\r\n
-    // printf("We have to allocate %i bytes.\n",messageSize);
-    char* status = malloc(messageSize);
+    return messageSize + 4; // 4 = \r\n\r\n
+}
+
+static int HTTPResponse_write_head(HTTPResponse* response, char* status, int messageSize) {
+    const char* message = CommonResponseMessages(response->responseCode);
     // write first line
     int curPos = snprintf(status, messageSize, "%s %d %s", HTTP_VERSION, response->responseCode, message);
     // write headers
-    LinkedList_foreach(response->headers, node) {
-        HTTPHeader* hdr = (HTTPHeader*)node->item;
+    SmallVector_foreach(&response->headers, HTTPHeader, hdr) {
         int written = snprintf(&status[curPos], messageSize - curPos, "\r\n%s: %s", hdr->Name, hdr->Value);
         curPos += written;
     }
-    // write body
     const uint8_t separator[] = {'\r', '\n', '\r', '\n'};
     memcpy(&status[curPos], separator, sizeof(separator));
-    curPos += sizeof(separator);
+    return curPos + sizeof(separator);
+}
+
+const char* HTTPResponse_tostring(HTTPResponse* response, size_t* outSize) {
+    // Count size of everything before allocating
+    int messageSize = HTTPResponse_head_size(response) + response->bodySize;
+    // printf("We have to allocate %i bytes.\n",messageSize);
+    char* status = malloc(messageSize);
+    int curPos = HTTPResponse_write_head(response, status, messageSize);
+    // write body
     if(response->body != NULL)
         memcpy(&status[curPos], response->body, response->bodySize);
     *outSize = messageSize;
     return status;
 }
 
+const char* HTTPResponse_head_tostring(HTTPResponse* response, size_t* outSize) {
+    int messageSize = HTTPResponse_head_size(response);
+    char* status = malloc(messageSize);
+    int curPos = HTTPResponse_write_head(response, status, messageSize);
+    *outSize = curPos;
+    return status;
+}
+
+typedef struct {
+    ResponseCode code;
+    char contentType[64];
+    char connection[16];
+    int cors;
+    int length;
+    char data[RESPONSE_BLOCK_SIZE];
+} HTTPResponse_Block;
+
+static __thread HTTPResponse_Block t_responseBlocks[RESPONSE_BLOCK_CACHE];
+static __thread int t_responseBlockCount = 0;
+
+static int HTTPResponse_append(char* out, size_t size, int pos, const char* name, const char* value) {
+    if (pos < 0 || value == NULL || *value == '\0') return pos;
+    int written = snprintf(out + pos, size - pos, "%s: %s\r\n", name, value);
+    return (written < 0 || (size_t)written >= size - pos) ? -1 : pos + written;
+}
+
+// Everything up to and including "Content-Length: "
+static int HTTPResponse_write_block(char* out, size_t size, ResponseCode code, const char* contentType,
+                                    const char* connection, int cors) {
+    int pos = snprintf(out, size, "%s %d %s\r\n", HTTP_VERSION, code, CommonResponseMessages(code));
+    if (pos < 0 || (size_t)pos >= size) return -1;
+    pos = HTTPResponse_append(out, size, pos, "Content-Type", contentType);
+    pos = HTTPResponse_append(out, size, pos, "Connection", CLOSE_CONNECTIONS ? "close" : connection);
+    if (cors) {
+        pos = HTTPResponse_append(out, size, pos, "Access-Control-Allow-Origin", CORS_ALLOWED_ORIGIN);
+        pos = HTTPResponse_append(out, size, pos, "Access-Control-Allow-Methods", CORS_ALLOWED_METHODS);
+        pos = HTTPResponse_append(out, size, pos, "Access-Control-Allow-Headers", CORS_ALLOWED_HEADERS);
+    }
+    if (pos < 0 || (size_t)pos + 16 >= size) return -1;
+    memcpy(out + pos, "Content-Length: ", 16);
+    return pos + 16;
+}
+
+static const HTTPResponse_Block* HTTPResponse_find_block(ResponseCode code, const char* contentType,
+                                                         const char* connection, int cors) {
+    if (contentType == NULL) contentType = "";
+    if (connection == NULL) connection = "";
+    for (int i = 0; i < t_responseBlockCount; i++) {
+        HTTPResponse_Block* block = &t_responseBlocks[i];
+        if (block->code == code && block->cors == cors && strcmp(block->contentType, contentType) == 0 &&
+            strcmp(block->connection, connection) == 0)
+            return block;
+    }
+
+    // Full or a key too long to keep, the caller formats this one itself
+    if (t_responseBlockCount == RESPONSE_BLOCK_CACHE || strlen(contentType) >= sizeof(t_responseBlocks[0].contentType) ||
+        strlen(connection) >= sizeof(t_responseBlocks[0].connection))
+        return NULL;
+
+    HTTPResponse_Block* block = &t_responseBlocks[t_responseBlockCount];
+    block->length = HTTPResponse_write_block(block->data, sizeof(block->data), code, contentType, connection, cors);
+    if (block->length < 0) return NULL;
+    block->code = code;
+    block->cors = cors;
+    strcpy(block->contentType, contentType);
+    strcpy(block->connection, connection);
+    t_responseBlockCount++;
+    return block;
+}
+
+// The block for the combination into out, -1 if it does not fit. With extra
+// headers they go in front of the block's trailing "Content-Length: ".
+static int HTTPResponse_copy_block(char* out, size_t size, ResponseCode code, const char* contentType,
+                                   const char* connection, int cors, const char* extraHeaders) {
+    const HTTPResponse_Block* block = HTTPResponse_find_block(code, contentType, connection, cors);
+    int length;
+    if (block == NULL) {
+        length = HTTPResponse_write_block(out, size, code, contentType, connection, cors);
+        if (length < 0) return -1;
+    } else {
+        if ((size_t)block->length > size) return -1;
+        memcpy(out, block->data, block->length);
+        length = block->length;
+    }
+    if (extraHeaders == NULL || extraHeaders[0] == '\0') return length;
+
+    size_t extraLength = strlen(extraHeaders);
+    if ((size_t)length + extraLength > size) return -1;
+    length -= 16;
+    memcpy(out + length, extraHeaders, extraLength);
+    memcpy(out + length + extraLength, "Content-Length: ", 16);
+    return length + (int)extraLength + 16;
+}
+
+int HTTPResponse_build_head(char* out, size_t size, ResponseCode code, const char* contentType,
+                            const char* connection, int cors, const char* extraHeaders, size_t bodyLength) {
+    int length = HTTPResponse_copy_block(out, size, code, contentType, connection, cors, extraHeaders);
+    if (length < 0) return -1;
+
+    // Content-Length digits, written backwards
+    char digits[24];
+    int count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + bodyLength % 10);
+        bodyLength /= 10;
+    } while (bodyLength > 0);
+    if ((size_t)length + count + 4 > size) return -1;
+    memcpy(out + length, digits + sizeof(digits) - count, count);
+    memcpy(out + length + count, "\r\n\r\n", 4);
+    return length + count + 4;
+}
+
+int HTTPResponse_build_head_streamed(char* out, size_t size, ResponseCode code, const char* contentType,
+                                     const char* connection, int cors, const char* extraHeaders, int chunked) {
+    static const char encoding[] = "Transfer-Encoding: chunked\r\n\r\n";
+    int length = HTTPResponse_copy_block(out, size, code, contentType, connection, cors, extraHeaders);
+    if (length < 0) return -1;
+
+    // Replaces the trailing "Content-Length: "
+    length -= 16;
+    const char* end = chunked ? encoding : "\r\n";
+    size_t endLength = chunked ? sizeof(encoding) - 1 : 2;
+    if ((size_t)length + endLength > size) return -1;
+    memcpy(out + length, end, endLength);
+    return length + (int)endLength;
+}
+
 // Parse a response from Server -> Client
 HTTPResponse* HTTPResponse_fromstring(const char* message) {
     HTTPResponse* response = calloc(1, sizeof(HTTPResponse));
     response->reason = Malformed;
-    response->headers = LinkedList_create();
+    SmallVector_init(&response->headers, sizeof(HTTPHeader));
 
     int messageLen = strlen(message);
     int state = 0;
@@ -501,7 +935,7 @@ HTTPResponse* HTTPResponse_fromstring(const char* message) {
                 if (*scan == ' ') count++;
             }
             if (count != 2) {
-                printf("INVALID: Response is not formatted with 2 spaces.\n\n");
+                LOG_WARN("INVALID: Response is not formatted with 2 spaces.");
                 free(current_line);
                 break;
             }
@@ -524,7 +958,7 @@ HTTPResponse* HTTPResponse_fromstring(const char* message) {
 
             int codeAsInteger = parseInt(code);
             if (codeAsInteger == -1) {
-                printf("INVALID: Non-numeric response code.\n\n");
+                LOG_WARN("INVALID: Non-numeric response code.");
                 free(current_line);
                 break;
             }
@@ -540,7 +974,7 @@ HTTPResponse* HTTPResponse_fromstring(const char* message) {
         } else {
             const char* sep = strstr(current_line, ": ");
             if (!sep) {
-                printf("INVALID: Header is malformed.\n\n");
+                LOG_WARN("INVALID: Header is malformed.");
                 free(current_line);
                 break;
             }
@@ -556,11 +990,13 @@ HTTPResponse* HTTPResponse_fromstring(const char* message) {
                 break;
             }
 
-            HTTPHeader* header = calloc(1, sizeof(HTTPHeader));
+            HTTPHeader* header = (HTTPHeader*)SmallVector_push(&response->headers);
             if (header != NULL) {
                 header->Name = name;
                 header->Value = value;
-                LinkedList_append(response->headers, header);
+            } else {
+                free(name);
+                free(value);
             }
         }
 
@@ -575,7 +1011,7 @@ void HTTPResponse_Dispose(HTTPResponse** resp) {
     if (resp && *resp) {
         HTTPResponse* response = *resp;
         free(response->body);
-        LinkedList_dispose(&response->headers, free_header);
+        SmallVector_clear(&response->headers, free_header);
         free(response);
         *resp = NULL;
     }
@@ -0,0 +1,866 @@
+#include "../../include/HTTPServer/HTTP2Connection.h"
+#include <stdlib.h>
+#include <string.h>
+#include "utilities/hpack.h"
+#include "utilities/logger.h"
+#include "utilities/mem_account.h"
+#include "utilities/metrics.h"
+#include "utilities/tuning.h"
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_SIZE 24
+#define HTTP2_FRAME_HEADER_SIZE 9
+/* SETTINGS_MAX_FRAME_SIZE and SETTINGS_INITIAL_WINDOW_SIZE as the RFC sets
+   them, we announce neither */
+#define HTTP2_MAX_FRAME_SIZE 16384
+#define HTTP2_DEFAULT_WINDOW 65535
+#define HTTP2_MAX_WINDOW 0x7fffffff
+/* output kept free of DATA and HEADERS for what reading a frame may add:
+   a SETTINGS or PING ack, a WINDOW_UPDATE, a RST_STREAM or a GOAWAY */
+#define HTTP2_CONTROL_RESERVE 64
+
+enum {
+  HTTP2_DATA = 0x0,
+  HTTP2_HEADERS = 0x1,
+  HTTP2_PRIORITY = 0x2,
+  HTTP2_RST_STREAM = 0x3,
+  HTTP2_SETTINGS = 0x4,
+  HTTP2_PUSH_PROMISE = 0x5,
+  HTTP2_PING = 0x6,
+  HTTP2_GOAWAY = 0x7,
+  HTTP2_WINDOW_UPDATE = 0x8,
+  HTTP2_CONTINUATION = 0x9
+};
+
+enum {
+  HTTP2_FLAG_END_STREAM = 0x1,
+  HTTP2_FLAG_ACK = 0x1,
+  HTTP2_FLAG_END_HEADERS = 0x4,
+  HTTP2_FLAG_PADDED = 0x8,
+  HTTP2_FLAG_PRIORITY = 0x20
+};
+
+enum {
+  HTTP2_NO_ERROR = 0x0,
+  HTTP2_PROTOCOL_ERROR = 0x1,
+  HTTP2_INTERNAL_ERROR = 0x2,
+  HTTP2_FLOW_CONTROL_ERROR = 0x3,
+  HTTP2_FRAME_SIZE_ERROR = 0x6,
+  HTTP2_REFUSED_STREAM = 0x7,
+  HTTP2_COMPRESSION_ERROR = 0x9,
+  HTTP2_ENHANCE_YOUR_CALM = 0xb
+};
+
+enum {
+  HTTP2_SETTINGS_ENABLE_PUSH = 0x2,
+  HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  HTTP2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+  HTTP2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+  HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+struct HTTP2Connection {
+  HTTPServerConnection *connection;
+  hpack_decoder decoder;
+
+  /* the client's bytes not yet taken as frames, the largest frame we
+     allow fits */
+  uint8_t in[HTTP2_FRAME_HEADER_SIZE + HTTP2_MAX_FRAME_SIZE];
+  int inLength;
+  int prefaceSeen;
+  int settingsSeen;
+  /* frames to send, written out from outSent on. Only appended to until
+     all of it is out, a TLS write that would block is retried with the
+     same bytes. */
+  uint8_t out[HTTP2Connection_OUTPUT_SIZE];
+  int outLength;
+  int outSent;
+  /* a header block that goes on in CONTINUATION frames */
+  uint8_t *block;
+  int blockLength;
+  uint32_t blockStream;
+  int blockEndStream;
+  /* the head of the stream being opened is rebuilt here */
+  char head[HTTPServerConnection_READBUFFER_SIZE];
+
+  /* the client's settings and the connection's send window */
+  int32_t sendWindow;
+  int32_t initialWindow;
+  uint32_t maxFrame;
+  uint32_t lastStreamId;
+  int streams;
+  /* no stream past lastStreamId is opened, the connection closes once
+     the open ones are answered. failed: at once, when the GOAWAY is out */
+  int closing;
+  int goaway;
+  int failed;
+  /* monotonic ms of the last bytes in or out, and of the last write
+     that moved anything */
+  uint64_t lastActivity;
+  uint64_t lastWrite;
+};
+
+/* the fields of a header block on their way to an HTTP/1.1 style head in
+   head: the values of the pseudo fields, then the lines of the rest */
+typedef struct {
+  HTTP2Connection *http2;
+  size_t length;
+  size_t lines;
+  size_t method, methodLength;
+  size_t path, pathLength;
+  size_t authority, authorityLength;
+  int scheme;
+  int regular;
+  int malformed;
+  int overflow;
+} HTTP2Connection_Fields;
+
+static metrics_counter g_http2Connections;
+static metrics_counter g_http2Streams;
+
+void HTTP2Connection_RegisterMetrics(void) {
+  metrics_register("http2_connections_total", "TLS connections that settled on HTTP/2.", METRICS_COUNTER, NULL,
+                   &g_http2Connections);
+  metrics_register("http2_streams_total", "HTTP/2 streams opened by clients.", METRICS_COUNTER, NULL, &g_http2Streams);
+}
+
+int HTTP2Connection_Negotiated(HTTPServerConnection *_Connection) {
+  const char *protocol = conn_alpn(_Connection->conn);
+  return protocol != NULL && strcmp(protocol, "h2") == 0;
+}
+
+static uint32_t HTTP2Connection_Read32(const uint8_t *_At) {
+  return ((uint32_t)_At[0] << 24) | ((uint32_t)_At[1] << 16) | ((uint32_t)_At[2] << 8) | _At[3];
+}
+
+static void HTTP2Connection_Write32(uint8_t *_At, uint32_t _Value) {
+  _At[0] = (uint8_t)(_Value >> 24);
+  _At[1] = (uint8_t)(_Value >> 16);
+  _At[2] = (uint8_t)(_Value >> 8);
+  _At[3] = (uint8_t)_Value;
+}
+
+static void HTTP2Connection_FrameHeader(uint8_t *_At, uint32_t _Length, uint8_t _Type, uint8_t _Flags, uint32_t _Stream) {
+  _At[0] = (uint8_t)(_Length >> 16);
+  _At[1] = (uint8_t)(_Length >> 8);
+  _At[2] = (uint8_t)_Length;
+  _At[3] = _Type;
+  _At[4] = _Flags;
+  HTTP2Connection_Write32(_At + 5, _Stream);
+}
+
+/* a frame into the output, -1 if there is no room for it */
+static int HTTP2Connection_Queue(HTTP2Connection *_HTTP2, uint8_t _Type, uint8_t _Flags, uint32_t _Stream,
+                                 const uint8_t *_Payload, uint32_t _Length) {
+  if (_HTTP2->outLength + HTTP2_FRAME_HEADER_SIZE + (int)_Length > HTTP2Connection_OUTPUT_SIZE) {
+    _HTTP2->failed = 1;
+    return -1;
+  }
+  HTTP2Connection_FrameHeader(_HTTP2->out + _HTTP2->outLength, _Length, _Type, _Flags, _Stream);
+  if (_Length > 0) memcpy(_HTTP2->out + _HTTP2->outLength + HTTP2_FRAME_HEADER_SIZE, _Payload, _Length);
+  _HTTP2->outLength += HTTP2_FRAME_HEADER_SIZE + (int)_Length;
+  return 0;
+}
+
+/* no stream the client opens after this is taken on. Without an error the
+   connection closes once the open ones are answered, with one as soon as
+   the frame is out: -1 then, so the caller stops reading. */
+static int HTTP2Connection_GoAway(HTTP2Connection *_HTTP2, uint32_t _Error) {
+  if (!_HTTP2->goaway || (_Error != HTTP2_NO_ERROR && !_HTTP2->failed)) {
+    uint8_t payload[8];
+    HTTP2Connection_Write32(payload, _HTTP2->lastStreamId);
+    HTTP2Connection_Write32(payload + 4, _Error);
+    HTTP2Connection_Queue(_HTTP2, HTTP2_GOAWAY, 0, 0, payload, sizeof(payload));
+    _HTTP2->goaway = 1;
+  }
+  _HTTP2->closing = 1;
+  if (_Error == HTTP2_NO_ERROR) return 0;
+  LOG_DEBUG("HTTP/2 connection error %u", (unsigned)_Error);
+  _HTTP2->failed = 1;
+  return -1;
+}
+
+static int HTTP2Connection_Reset(HTTP2Connection *_HTTP2, uint32_t _Stream, uint32_t _Error) {
+  uint8_t payload[4];
+  HTTP2Connection_Write32(payload, _Error);
+  return HTTP2Connection_Queue(_HTTP2, HTTP2_RST_STREAM, 0, _Stream, payload, sizeof(payload));
+}
+
+static HTTPServerConnection_Request *HTTP2Connection_Find(HTTP2Connection *_HTTP2, uint32_t _Stream) {
+  for (HTTPServerConnection_Request *request = _HTTP2->connection->requests; request != NULL; request = request->next) {
+    if (request->http2.id == _Stream) return request;
+  }
+  return NULL;
+}
+
+HTTP2Connection *HTTP2Connection_Create(HTTPServerConnection *_Connection, uint64_t _MonTime) {
+  HTTP2Connection *http2 = (HTTP2Connection *)mem_account_malloc(MEM_TAG_CONNECTIONS, sizeof(HTTP2Connection));
+  if (http2 == NULL) return NULL;
+  http2->connection = _Connection;
+  hpack_decoder_init(&http2->decoder);
+  http2->inLength = 0;
+  http2->prefaceSeen = 0;
+  http2->settingsSeen = 0;
+  http2->outLength = 0;
+  http2->outSent = 0;
+  http2->block = NULL;
+  http2->blockLength = 0;
+  http2->blockStream = 0;
+  http2->blockEndStream = 0;
+  http2->sendWindow = HTTP2_DEFAULT_WINDOW;
+  http2->initialWindow = HTTP2_DEFAULT_WINDOW;
+  http2->maxFrame = HTTP2_MAX_FRAME_SIZE;
+  http2->lastStreamId = 0;
+  http2->streams = 0;
+  http2->closing = 0;
+  http2->goaway = 0;
+  http2->failed = 0;
+  http2->lastActivity = _MonTime;
+  http2->lastWrite = _MonTime;
+
+  /* the server's preface, it may go before the client's arrives */
+  uint8_t settings[12];
+  settings[0] = 0;
+  settings[1] = HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS;
+  HTTP2Connection_Write32(settings + 2, HTTP2Connection_MAX_CONCURRENT_STREAMS);
+  settings[6] = 0;
+  settings[7] = HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE;
+  HTTP2Connection_Write32(settings + 8, HTTPServerConnection_READBUFFER_SIZE);
+  HTTP2Connection_Queue(http2, HTTP2_SETTINGS, 0, 0, settings, sizeof(settings));
+  metrics_counter_add(&g_http2Connections, 1);
+  return http2;
+}
+
+void HTTP2Connection_Dispose(HTTP2Connection *_HTTP2) {
+  if (_HTTP2->block != NULL) mem_account_release(MEM_TAG_PARSER, _HTTP2->block);
+  mem_account_release(MEM_TAG_CONNECTIONS, _HTTP2);
+}
+
+//-----------------------Opening streams-----------------------
+
+/* 1 if the bytes can go into a head line; a path or a method has no spaces */
+static int HTTP2Connection_Clean(const char *_Value, size_t _Length, int _Spaces) {
+  for (size_t i = 0; i < _Length; i++) {
+    char c = _Value[i];
+    if (c == '\r' || c == '\n' || c == '\0' || (!_Spaces && c == ' ')) return 0;
+  }
+  return 1;
+}
+
+static void HTTP2Connection_Append(HTTP2Connection_Fields *_Fields, const char *_Bytes, size_t _Length) {
+  if (_Fields->overflow || _Fields->length + _Length > sizeof(_Fields->http2->head)) {
+    /* the block is still decoded to the end, the table depends on it */
+    _Fields->overflow = 1;
+    return;
+  }
+  memcpy(_Fields->http2->head + _Fields->length, _Bytes, _Length);
+  _Fields->length += _Length;
+}
+
+static int HTTP2Connection_Field(void *_Context, const char *_Name, size_t _NameLength, const char *_Value,
+                                 size_t _ValueLength) {
+  HTTP2Connection_Fields *fields = (HTTP2Connection_Fields *)_Context;
+  if (_NameLength == 0 || !HTTP2Connection_Clean(_Value, _ValueLength, 1)) {
+    fields->malformed = 1;
+    return 0;
+  }
+  if (_Name[0] != ':') {
+    /* names come lowercase and without a colon, they go in as they are */
+    if (memchr(_Name, ':', _NameLength) != NULL || !HTTP2Connection_Clean(_Name, _NameLength, 0)) {
+      fields->malformed = 1;
+      return 0;
+    }
+    if (!fields->regular) {
+      fields->regular = 1;
+      fields->lines = fields->length;
+    }
+    HTTP2Connection_Append(fields, _Name, _NameLength);
+    HTTP2Connection_Append(fields, ": ", 2);
+    HTTP2Connection_Append(fields, _Value, _ValueLength);
+    HTTP2Connection_Append(fields, "\r\n", 2);
+    return 0;
+  }
+
+  /* the pseudo fields all come first, each once */
+  size_t *offset = NULL, *length = NULL;
+  if (_NameLength == 7 && memcmp(_Name, ":method", 7) == 0) {
+    offset = &fields->method;
+    length = &fields->methodLength;
+  } else if (_NameLength == 5 && memcmp(_Name, ":path", 5) == 0) {
+    offset = &fields->path;
+    length = &fields->pathLength;
+  } else if (_NameLength == 10 && memcmp(_Name, ":authority", 10) == 0) {
+    offset = &fields->authority;
+    length = &fields->authorityLength;
+  } else if (_NameLength == 7 && memcmp(_Name, ":scheme", 7) == 0 && !fields->scheme) {
+    fields->scheme = 1;
+    return 0;
+  }
+  if (offset == NULL || fields->regular || *length != 0 || _ValueLength == 0
+      || (offset != &fields->authority && !HTTP2Connection_Clean(_Value, _ValueLength, 0))) {
+    fields->malformed = 1;
+    return 0;
+  }
+  *offset = fields->length;
+  *length = _ValueLength;
+  HTTP2Connection_Append(fields, _Value, _ValueLength);
+  return 0;
+}
+
+/* the head an HTTP/1.1 client would have sent, the request owns it. NULL
+   if it is too large for a head (or out of memory). */
+static char *HTTP2Connection_BuildHead(HTTP2Connection_Fields *_Fields, size_t *_Length) {
+  static const char version[] = " HTTP/2.0\r\n";
+  static const char host[] = "Host: ";
+  const char *head = _Fields->http2->head;
+  if (!_Fields->regular) _Fields->lines = _Fields->length;
+  size_t lines = _Fields->length - _Fields->lines;
+  size_t length = _Fields->methodLength + 1 + _Fields->pathLength + sizeof(version) - 1 + lines + 2;
+  if (_Fields->authorityLength > 0) length += sizeof(host) - 1 + _Fields->authorityLength + 2;
+  if (_Fields->overflow || length > HTTPServerConnection_READBUFFER_SIZE) return NULL;
+
+  char *buffer = (char *)mem_account_malloc(MEM_TAG_PARSER, length + 1);
+  if (buffer == NULL) return NULL;
+  char *at = buffer;
+  memcpy(at, head + _Fields->method, _Fields->methodLength);
+  at += _Fields->methodLength;
+  *at++ = ' ';
+  memcpy(at, head + _Fields->path, _Fields->pathLength);
+  at += _Fields->pathLength;
+  memcpy(at, version, sizeof(version) - 1);
+  at += sizeof(version) - 1;
+  if (_Fields->authorityLength > 0) {
+    memcpy(at, host, sizeof(host) - 1);
+    at += sizeof(host) - 1;
+    memcpy(at, head + _Fields->authority, _Fields->authorityLength);
+    at += _Fields->authorityLength;
+    memcpy(at, "\r\n", 2);
+    at += 2;
+  }
+  memcpy(at, head + _Fields->lines, lines);
+  at += lines;
+  memcpy(at, "\r\n", 3);
+  *_Length = length;
+  return buffer;
+}
+
+/* a complete header block on _Stream: a new stream is queued as a request
+   and handed on like one read over HTTP/1.1. -1 on a connection error. */
+static int HTTP2Connection_OpenStream(HTTP2Connection *_HTTP2, uint32_t _Stream, const uint8_t *_Block, size_t _Length,
+                                      int _EndStream, uint64_t _MonTime) {
+  HTTPServerConnection *connection = _HTTP2->connection;
+  HTTP2Connection_Fields fields;
+  memset(&fields, 0, sizeof(fields));
+  fields.http2 = _HTTP2;
+  if (hpack_decode(&_HTTP2->decoder, _Block, _Length, HTTP2Connection_Field, &fields) != 0)
+    return HTTP2Connection_GoAway(_HTTP2, HTTP2_COMPRESSION_ERROR);
+
+  if (_Stream <= _HTTP2->lastStreamId) {
+    /* trailers of a stream still open, or one already answered */
+    HTTPServerConnection_Request *request = HTTP2Connection_Find(_HTTP2, _Stream);
+    if (request == NULL) return 0;
+    if (!_EndStream && !request->http2.reset) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    request->http2.remoteOpen = 0;
+    return 0;
+  }
+  if (_HTTP2->closing) return 0;
+  _HTTP2->lastStreamId = _Stream;
+  if (connection->pending >= HTTP2Connection_MAX_CONCURRENT_STREAMS)
+    return HTTP2Connection_Reset(_HTTP2, _Stream, HTTP2_REFUSED_STREAM);
+  if (fields.malformed || fields.methodLength == 0 || fields.pathLength == 0 || !fields.scheme)
+    return HTTP2Connection_Reset(_HTTP2, _Stream, HTTP2_PROTOCOL_ERROR);
+
+  HTTPServerConnection_Request *request = HTTPServerConnection_QueueRequest(connection, _MonTime);
+  if (request == NULL) return HTTP2Connection_GoAway(_HTTP2, HTTP2_INTERNAL_ERROR);
+  /* the Connection line of the head is dropped, the stream ends instead */
+  request->keepAlive = 1;
+  request->http2.id = _Stream;
+  request->http2.window = _HTTP2->initialWindow;
+  request->http2.openedAt = _MonTime;
+  request->http2.headLength = -1;
+  request->http2.remoteOpen = !_EndStream;
+  connection->requestCount++;
+  _HTTP2->streams++;
+  metrics_counter_add(&g_http2Streams, 1);
+  /* the connection has served its share, the client moves on to a new one */
+  if (_HTTP2->streams >= HTTP2Connection_MAX_STREAMS) HTTP2Connection_GoAway(_HTTP2, HTTP2_NO_ERROR);
+
+  size_t length = 0;
+  char *head = HTTP2Connection_BuildHead(&fields, &length);
+  if (head == NULL) {
+    LOG_WARN("Dropping invalid HTTP/2 request, reason: %s", InvalidReason_tostring(HeadTooLarge));
+    HTTPServerConnection_SendResponse(request, Request_Header_Fields_Too_Large, "Request header fields too large",
+                                      "text/plain");
+    return 0;
+  }
+  request->headBuffer = head;
+  request->ownsHeadBuffer = 1;
+  HTTPRequestParser_init(&request->head);
+  if (HTTPRequestParser_execute(&request->head, head, length) <= 0) {
+    LOG_WARN("Dropping invalid HTTP/2 request, reason: %s", InvalidReason_tostring(request->head.reason));
+    if (request->head.reason == HeadTooLarge)
+      HTTPServerConnection_SendResponse(request, Request_Header_Fields_Too_Large, "Request header fields too large",
+                                        "text/plain");
+    else
+      HTTPServerConnection_SendResponse(request, 400, "Invalid request received", "text/plain");
+    return 0;
+  }
+  request->url = HTTPRequestParser_getURL(&request->head, head);
+  request->method = request->head.method;
+  HTTPServerConnection_DispatchRequest(request);
+  return 0;
+}
+
+//-------------------------Reading frames-------------------------
+
+static int HTTP2Connection_Settings(HTTP2Connection *_HTTP2, uint8_t _Flags, const uint8_t *_Payload, uint32_t _Length) {
+  if (_Flags & HTTP2_FLAG_ACK) return _Length == 0 ? 0 : HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+  if (_Length % 6 != 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+  for (uint32_t i = 0; i < _Length; i += 6) {
+    uint16_t id = (uint16_t)((_Payload[i] << 8) | _Payload[i + 1]);
+    uint32_t value = HTTP2Connection_Read32(_Payload + i + 2);
+    if (id == HTTP2_SETTINGS_ENABLE_PUSH && value > 1) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    if (id == HTTP2_SETTINGS_INITIAL_WINDOW_SIZE) {
+      if (value > HTTP2_MAX_WINDOW) return HTTP2Connection_GoAway(_HTTP2, HTTP2_FLOW_CONTROL_ERROR);
+      /* the windows of the open streams move by the difference */
+      int64_t delta = (int64_t)value - _HTTP2->initialWindow;
+      for (HTTPServerConnection_Request *request = _HTTP2->connection->requests; request != NULL; request = request->next) {
+        if (request->http2.window + delta > HTTP2_MAX_WINDOW)
+          return HTTP2Connection_GoAway(_HTTP2, HTTP2_FLOW_CONTROL_ERROR);
+        request->http2.window = (int32_t)(request->http2.window + delta);
+      }
+      _HTTP2->initialWindow = (int32_t)value;
+    }
+    if (id == HTTP2_SETTINGS_MAX_FRAME_SIZE) {
+      if (value < HTTP2_MAX_FRAME_SIZE || value > 0xffffff) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+      _HTTP2->maxFrame = value;
+    }
+    /* the table size is the client's decoder's, our encoder never fills one */
+  }
+  return HTTP2Connection_Queue(_HTTP2, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL, 0);
+}
+
+static int HTTP2Connection_WindowUpdate(HTTP2Connection *_HTTP2, uint32_t _Stream, const uint8_t *_Payload,
+                                        uint32_t _Length) {
+  if (_Length != 4) return HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+  uint32_t increment = HTTP2Connection_Read32(_Payload) & 0x7fffffff;
+  if (_Stream == 0) {
+    if (increment == 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    if ((int64_t)_HTTP2->sendWindow + increment > HTTP2_MAX_WINDOW)
+      return HTTP2Connection_GoAway(_HTTP2, HTTP2_FLOW_CONTROL_ERROR);
+    _HTTP2->sendWindow += (int32_t)increment;
+    return 0;
+  }
+  HTTPServerConnection_Request *request = HTTP2Connection_Find(_HTTP2, _Stream);
+  if (request == NULL || request->http2.reset) return 0;
+  if (increment == 0 || (int64_t)request->http2.window + increment > HTTP2_MAX_WINDOW) {
+    request->http2.reset = 1;
+    return HTTP2Connection_Reset(_HTTP2, _Stream, increment == 0 ? HTTP2_PROTOCOL_ERROR : HTTP2_FLOW_CONTROL_ERROR);
+  }
+  request->http2.window += (int32_t)increment;
+  return 0;
+}
+
+/* the frame's padding (and priority) taken off, -1 if it claims more than there is */
+static int HTTP2Connection_Unpad(uint8_t _Flags, int _Priority, const uint8_t **_Payload, uint32_t *_Length) {
+  uint32_t padding = 0;
+  if (_Flags & HTTP2_FLAG_PADDED) {
+    if (*_Length < 1) return -1;
+    padding = (*_Payload)[0];
+    (*_Payload)++;
+    (*_Length)--;
+  }
+  if (_Priority && (_Flags & HTTP2_FLAG_PRIORITY)) {
+    if (*_Length < 5) return -1;
+    *_Payload += 5;
+    *_Length -= 5;
+  }
+  if (padding > *_Length) return -1;
+  *_Length -= padding;
+  return 0;
+}
+
+static int HTTP2Connection_Frame(HTTP2Connection *_HTTP2, uint8_t _Type, uint8_t _Flags, uint32_t _Stream,
+                                 const uint8_t *_Payload, uint32_t _Length, uint64_t _MonTime) {
+  /* the client's preface ends in its SETTINGS */
+  if (!_HTTP2->settingsSeen) {
+    if (_Type != HTTP2_SETTINGS || (_Flags & HTTP2_FLAG_ACK)) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    _HTTP2->settingsSeen = 1;
+  }
+  /* nothing may come between a header block's frames */
+  if (_HTTP2->blockStream != 0) {
+    if (_Type != HTTP2_CONTINUATION || _Stream != _HTTP2->blockStream)
+      return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    if (_HTTP2->blockLength + _Length > HTTPServerConnection_READBUFFER_SIZE)
+      return HTTP2Connection_GoAway(_HTTP2, HTTP2_ENHANCE_YOUR_CALM);
+    memcpy(_HTTP2->block + _HTTP2->blockLength, _Payload, _Length);
+    _HTTP2->blockLength += (int)_Length;
+    if (!(_Flags & HTTP2_FLAG_END_HEADERS)) return 0;
+    _HTTP2->blockStream = 0;
+    return HTTP2Connection_OpenStream(_HTTP2, _Stream, _HTTP2->block, _HTTP2->blockLength, _HTTP2->blockEndStream,
+                                      _MonTime);
+  }
+
+  switch (_Type) {
+  case HTTP2_HEADERS: {
+    if (_Stream == 0 || !(_Stream & 1) || HTTP2Connection_Unpad(_Flags, 1, &_Payload, &_Length) != 0)
+      return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    if (_Flags & HTTP2_FLAG_END_HEADERS)
+      return HTTP2Connection_OpenStream(_HTTP2, _Stream, _Payload, _Length, _Flags & HTTP2_FLAG_END_STREAM, _MonTime);
+    /* rare, browsers fit their heads in one frame */
+    if (_HTTP2->block == NULL) {
+      _HTTP2->block = (uint8_t *)mem_account_malloc(MEM_TAG_PARSER, HTTPServerConnection_READBUFFER_SIZE);
+      if (_HTTP2->block == NULL) return HTTP2Connection_GoAway(_HTTP2, HTTP2_INTERNAL_ERROR);
+    }
+    memcpy(_HTTP2->block, _Payload, _Length);
+    _HTTP2->blockLength = (int)_Length;
+    _HTTP2->blockStream = _Stream;
+    _HTTP2->blockEndStream = _Flags & HTTP2_FLAG_END_STREAM;
+    return 0;
+  }
+  case HTTP2_DATA: {
+    if (_Stream == 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    /* bodies are not taken, what they used of the connection's window goes
+       right back */
+    if (_Length > 0) {
+      uint8_t increment[4];
+      HTTP2Connection_Write32(increment, _Length);
+      if (HTTP2Connection_Queue(_HTTP2, HTTP2_WINDOW_UPDATE, 0, 0, increment, sizeof(increment)) != 0) return -1;
+    }
+    HTTPServerConnection_Request *request = HTTP2Connection_Find(_HTTP2, _Stream);
+    if (request != NULL && (_Flags & HTTP2_FLAG_END_STREAM)) request->http2.remoteOpen = 0;
+    return 0;
+  }
+  case HTTP2_RST_STREAM: {
+    if (_Length != 4) return HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+    if (_Stream == 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    HTTPServerConnection_Request *request = HTTP2Connection_Find(_HTTP2, _Stream);
+    if (request != NULL) {
+      /* the handler still has it, the response is dropped once it comes */
+      request->http2.reset = 1;
+      request->http2.remoteOpen = 0;
+    }
+    return 0;
+  }
+  case HTTP2_SETTINGS:
+    if (_Stream != 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    return HTTP2Connection_Settings(_HTTP2, _Flags, _Payload, _Length);
+  case HTTP2_PING:
+    if (_Length != 8) return HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+    if (_Stream != 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    if (_Flags & HTTP2_FLAG_ACK) return 0;
+    return HTTP2Connection_Queue(_HTTP2, HTTP2_PING, HTTP2_FLAG_ACK, 0, _Payload, _Length);
+  case HTTP2_GOAWAY:
+    /* the client opens nothing more, what it has open is still answered */
+    _HTTP2->closing = 1;
+    return 0;
+  case HTTP2_WINDOW_UPDATE:
+    return HTTP2Connection_WindowUpdate(_HTTP2, _Stream, _Payload, _Length);
+  case HTTP2_PRIORITY:
+    return _Length == 5 ? 0 : HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+  case HTTP2_PUSH_PROMISE:
+  case HTTP2_CONTINUATION:
+    return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+  default:
+    /* unknown types are ignored */
+    return 0;
+  }
+}
+
+/* the frames complete in the input, as long as there is room for what
+   they answer. -1 on a connection error. */
+static int HTTP2Connection_Process(HTTP2Connection *_HTTP2, uint64_t _MonTime) {
+  int offset = 0;
+  if (!_HTTP2->prefaceSeen) {
+    int length = _HTTP2->inLength < HTTP2_PREFACE_SIZE ? _HTTP2->inLength : HTTP2_PREFACE_SIZE;
+    if (memcmp(_HTTP2->in, HTTP2_PREFACE, length) != 0) return HTTP2Connection_GoAway(_HTTP2, HTTP2_PROTOCOL_ERROR);
+    if (length < HTTP2_PREFACE_SIZE) return 0;
+    _HTTP2->prefaceSeen = 1;
+    offset = HTTP2_PREFACE_SIZE;
+  }
+
+  int result = 0;
+  while (_HTTP2->inLength - offset >= HTTP2_FRAME_HEADER_SIZE
+         && _HTTP2->outLength + HTTP2_CONTROL_RESERVE <= HTTP2Connection_OUTPUT_SIZE) {
+    const uint8_t *frame = _HTTP2->in + offset;
+    uint32_t length = ((uint32_t)frame[0] << 16) | ((uint32_t)frame[1] << 8) | frame[2];
+    if (length > HTTP2_MAX_FRAME_SIZE) {
+      result = HTTP2Connection_GoAway(_HTTP2, HTTP2_FRAME_SIZE_ERROR);
+      break;
+    }
+    if ((uint32_t)(_HTTP2->inLength - offset) < HTTP2_FRAME_HEADER_SIZE + length) break;
+    uint32_t stream = HTTP2Connection_Read32(frame + 5) & 0x7fffffff;
+    offset += HTTP2_FRAME_HEADER_SIZE + (int)length;
+    result = HTTP2Connection_Frame(_HTTP2, frame[3], frame[4], stream, frame + HTTP2_FRAME_HEADER_SIZE, length, _MonTime);
+    if (result < 0) break;
+  }
+  _HTTP2->inLength -= offset;
+  memmove(_HTTP2->in, _HTTP2->in + offset, _HTTP2->inLength);
+  return result;
+}
+
+//-----------------------Sending responses-----------------------
+
+/* only mean something to the HTTP/1.1 connection they were built for */
+static int HTTP2Connection_ConnectionField(const char *_Name, size_t _Length) {
+  static const char *names[] = {"connection", "keep-alive", "transfer-encoding", "proxy-connection", "upgrade"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strlen(names[i]) == _Length && strncasecmp(names[i], _Name, _Length) == 0) return 1;
+  }
+  return 0;
+}
+
+/* the HTTP/1.1 head QueueResponse built as the header block of a HEADERS
+   frame into _Out: :status for the status line, the lines as they are but
+   for the connection's own. The length of the block, or -1 if it does not
+   fit in _Size or there is no complete head; *_HeadLength is where the
+   head ends in writeBuffer. */
+static int HTTP2Connection_EncodeHead(HTTPServerConnection_Request *_Request, uint8_t *_Out, int _Size, int *_HeadLength) {
+  const char *head = (const char *)_Request->writeBuffer;
+  const char *end = NULL;
+  for (int i = 0; i + 4 <= _Request->writeBufferSize; i++) {
+    if (head[i] == '\r' && memcmp(head + i, "\r\n\r\n", 4) == 0) {
+      end = head + i + 2;
+      break;
+    }
+  }
+  if (end == NULL) return -1;
+  *_HeadLength = (int)(end - head) + 2;
+
+  /* neither carries a body, a Content-Length would make some clients fail the stream */
+  int bodyless = _Request->status == No_Content || _Request->status == Not_Modified;
+  int n = hpack_encode_status(_Out, _Size, _Request->status);
+  if (n < 0) return -1;
+  const char *line = memchr(head, '\n', end - head);
+  line = line != NULL ? line + 1 : end;
+  while (line < end) {
+    const char *eol = memchr(line, '\r', end - line);
+    const char *colon = memchr(line, ':', eol - line);
+    if (colon != NULL) {
+      const char *value = colon + 1;
+      while (value < eol && *value == ' ') value++;
+      size_t nameLength = colon - line;
+      if (!HTTP2Connection_ConnectionField(line, nameLength)
+          && !(bodyless && nameLength == 14 && strncasecmp(line, "content-length", 14) == 0)) {
+        int m = hpack_encode_header(_Out + n, _Size - n, line, nameLength, value, eol - value);
+        if (m < 0) return -1;
+        n += m;
+      }
+    }
+    line = eol + 2;
+  }
+  return n;
+}
+
+/* as much of the response as the output and the windows take: 1 once it
+   is all queued (or the stream is done with), 0 if it has to wait */
+static int HTTP2Connection_SendStream(HTTP2Connection *_HTTP2, HTTPServerConnection_Request *_Request) {
+  uint32_t id = _Request->http2.id;
+  if (_Request->http2.reset) return 1;
+  if (_Request->writeBuffer == NULL) {
+    HTTP2Connection_Reset(_HTTP2, id, HTTP2_INTERNAL_ERROR);
+    return 1;
+  }
+
+  int room = HTTP2Connection_OUTPUT_SIZE - HTTP2_CONTROL_RESERVE - _HTTP2->outLength - HTTP2_FRAME_HEADER_SIZE;
+  if (_Request->http2.headLength < 0) {
+    if (room <= 0) return 0;
+    if (room > (int)_HTTP2->maxFrame) room = (int)_HTTP2->maxFrame;
+    uint8_t *frame = _HTTP2->out + _HTTP2->outLength;
+    int headLength = 0;
+    int length = HTTP2Connection_EncodeHead(_Request, frame + HTTP2_FRAME_HEADER_SIZE, room, &headLength);
+    if (length < 0) {
+      /* it may fit once the output is out, else it never will */
+      if (_HTTP2->outLength > 0) return 0;
+      LOG_WARN("Response head too large for a HEADERS frame");
+      HTTP2Connection_Reset(_HTTP2, id, HTTP2_INTERNAL_ERROR);
+      return 1;
+    }
+    _Request->http2.headLength = headLength;
+    int end = _Request->writeBufferSize == headLength && _Request->bodySize == 0
+              && (_Request->stream == NULL || _Request->streamDone);
+    HTTP2Connection_FrameHeader(frame, (uint32_t)length, HTTP2_HEADERS,
+                                HTTP2_FLAG_END_HEADERS | (end ? HTTP2_FLAG_END_STREAM : 0), id);
+    _HTTP2->outLength += HTTP2_FRAME_HEADER_SIZE + length;
+    if (end) return 1;
+  }
+
+  for (;;) {
+    /* the body is what writeBuffer holds past the head, then body */
+    int inline_ = _Request->writeBufferSize - _Request->http2.headLength;
+    int available = inline_ + _Request->bodySize - _Request->http2.sent;
+    int more = _Request->stream != NULL && !_Request->streamDone;
+    if (available == 0 && more) {
+      _Request->writeBufferSize = _Request->http2.headLength;
+      _Request->body = NULL;
+      _Request->bodySize = 0;
+      _Request->http2.sent = 0;
+      int result = HTTPServerConnection_FillStream(_Request);
+      if (result < 0) {
+        HTTP2Connection_Reset(_HTTP2, id, HTTP2_INTERNAL_ERROR);
+        return 1;
+      }
+      /* HTTPServerConnection_ResumeStream wakes us */
+      if (result == 0) return 0;
+      continue;
+    }
+
+    int n = available;
+    if (n > _HTTP2->sendWindow) n = _HTTP2->sendWindow;
+    if (n > _Request->http2.window) n = _Request->http2.window;
+    if (n > (int)_HTTP2->maxFrame) n = (int)_HTTP2->maxFrame;
+    room = HTTP2Connection_OUTPUT_SIZE - HTTP2_CONTROL_RESERVE - _HTTP2->outLength - HTTP2_FRAME_HEADER_SIZE;
+    if (room < 0) return 0;
+    if (n > room) n = room;
+    /* a SETTINGS may have taken a window below zero */
+    if (n < 0) n = 0;
+    int end = !more && n == available;
+    if (n == 0 && !end) return 0;
+
+    uint8_t *frame = _HTTP2->out + _HTTP2->outLength;
+    HTTP2Connection_FrameHeader(frame, (uint32_t)n, HTTP2_DATA, end ? HTTP2_FLAG_END_STREAM : 0, id);
+    uint8_t *to = frame + HTTP2_FRAME_HEADER_SIZE;
+    int at = _Request->http2.sent;
+    int left = n;
+    if (at < inline_) {
+      int part = inline_ - at < left ? inline_ - at : left;
+      memcpy(to, _Request->writeBuffer + _Request->http2.headLength + at, part);
+      to += part;
+      at += part;
+      left -= part;
+    }
+    if (left > 0) memcpy(to, _Request->body + (at - inline_), left);
+    _HTTP2->outLength += HTTP2_FRAME_HEADER_SIZE + n;
+    _Request->http2.sent += n;
+    _Request->http2.window -= n;
+    _HTTP2->sendWindow -= n;
+    if (end) return 1;
+  }
+}
+
+/* the ready responses into the output, oldest stream first: 1 if any
+   bytes were added */
+static int HTTP2Connection_Produce(HTTP2Connection *_HTTP2, uint64_t _MonTime) {
+  int before = _HTTP2->outLength;
+  HTTPServerConnection_Request *request = _HTTP2->connection->requests;
+  while (request != NULL) {
+    HTTPServerConnection_Request *next = request->next;
+    if (request->ready && HTTP2Connection_SendStream(_HTTP2, request)) {
+      /* a client still sending a body is told we are done with it */
+      if (request->http2.remoteOpen && !request->http2.reset)
+        HTTP2Connection_Reset(_HTTP2, request->http2.id, HTTP2_NO_ERROR);
+      int sent = request->http2.sent + (request->http2.headLength > 0 ? request->http2.headLength : 0);
+      HTTPServerConnection_CompleteRequest(request, sent);
+      _HTTP2->lastActivity = _MonTime;
+    }
+    request = next;
+  }
+  return _HTTP2->outLength != before;
+}
+
+/* -1 if the socket failed */
+static int HTTP2Connection_Flush(HTTP2Connection *_HTTP2, uint64_t _MonTime) {
+  conn_t *conn = _HTTP2->connection->conn;
+  while (_HTTP2->outSent < _HTTP2->outLength) {
+    int n = conn_write(conn, _HTTP2->out + _HTTP2->outSent, _HTTP2->outLength - _HTTP2->outSent);
+    if (n < 0) return -1;
+    /* the write deadline starts with the first try */
+    if (n > 0 || _HTTP2->outSent == 0) _HTTP2->lastWrite = _MonTime;
+    if (n == 0) return 0;
+    _HTTP2->outSent += n;
+    _HTTP2->lastActivity = _MonTime;
+    HTTPServerConnection_CountSent(n);
+  }
+  _HTTP2->outLength = 0;
+  _HTTP2->outSent = 0;
+  return 0;
+}
+
+//---------------------------Deadlines---------------------------
+
+/* the output has to move within the write timeout, a handler has the
+   handler timeout from its stream's HEADERS and an idle connection the
+   keep-alive one */
+static uint64_t HTTP2Connection_Deadline(HTTP2Connection *_HTTP2) {
+  HTTPServerConnection *connection = _HTTP2->connection;
+  if (_HTTP2->outLength > 0) return _HTTP2->lastWrite + tuning_get()->write_timeout_ms;
+  for (HTTPServerConnection_Request *request = connection->requests; request != NULL; request = request->next) {
+    if (!request->ready) return HTTPServerConnection_HandlerDeadline(request, request->http2.openedAt);
+  }
+  /* every response is in, a stream producer or a client window holds it up */
+  if (connection->pending > 0) return _HTTP2->lastActivity + tuning_get()->handler_timeout_ms;
+  return _HTTP2->lastActivity + tuning_get()->keepalive_timeout_ms;
+}
+
+/* the deadline passed: -1 if the connection is to close right away */
+static int HTTP2Connection_Expire(HTTP2Connection *_HTTP2, uint64_t _MonTime) {
+  HTTPServerConnection *connection = _HTTP2->connection;
+  if (_HTTP2->outLength > 0) {
+    if (_MonTime < _HTTP2->lastWrite + tuning_get()->write_timeout_ms) return 0;
+    LOG_WARN("Connection stalled sending a response");
+    return -1;
+  }
+  int waiting = 0;
+  for (HTTPServerConnection_Request *request = connection->requests; request != NULL; request = request->next) {
+    if (request->ready) continue;
+    /* the late ones are answered in their handler's place, the connection goes on */
+    if (_MonTime >= HTTPServerConnection_HandlerDeadline(request, request->http2.openedAt))
+      HTTPServerConnection_TimeOut(request);
+    else
+      waiting = 1;
+  }
+  if (waiting) return 0;
+  if (connection->pending == 0) {
+    if (_MonTime >= _HTTP2->lastActivity + tuning_get()->keepalive_timeout_ms)
+      HTTP2Connection_GoAway(_HTTP2, HTTP2_NO_ERROR);
+    return 0;
+  }
+  if (_MonTime < _HTTP2->lastActivity + tuning_get()->handler_timeout_ms) return 0;
+  LOG_WARN("HTTP/2 streams stalled");
+  return -1;
+}
+
+int HTTP2Connection_Work(HTTP2Connection *_HTTP2, uint64_t _MonTime) {
+  HTTPServerConnection *connection = _HTTP2->connection;
+  if ((connection->task->revents & SMW_TIMEOUT) && HTTP2Connection_Expire(_HTTP2, _MonTime) < 0) return -1;
+  /* the server is going away, the client takes its next requests elsewhere */
+  if (connection->draining && !_HTTP2->goaway) HTTP2Connection_GoAway(_HTTP2, HTTP2_NO_ERROR);
+
+  /* read while the frames read can be answered, TLS may hold decrypted
+     bytes the fd won't report so until there is nothing */
+  int stalled = 0;
+  while (!_HTTP2->failed) {
+    if (HTTP2Connection_Process(_HTTP2, _MonTime) < 0) break;
+    if (_HTTP2->outLength + HTTP2_CONTROL_RESERVE > HTTP2Connection_OUTPUT_SIZE) {
+      stalled = 1;
+      break;
+    }
+    int n = conn_read(connection->conn, _HTTP2->in + _HTTP2->inLength,
+                       (int)sizeof(_HTTP2->in) - _HTTP2->inLength);
+    if (n < 0) return -1;
+    if (n == 0) break;
+    _HTTP2->inLength += n;
+    _HTTP2->lastActivity = _MonTime;
+  }
+
+  /* responses out as far as the socket takes them */
+  int produced;
+  do {
+    produced = HTTP2Connection_Produce(_HTTP2, _MonTime);
+    if (HTTP2Connection_Flush(_HTTP2, _MonTime) < 0) return -1;
+  } while (produced && _HTTP2->outLength == 0);
+
+  if (_HTTP2->outLength == 0 && (_HTTP2->failed || (_HTTP2->closing && connection->pending == 0))) return -1;
+  /* reading stopped for the output, it drained: read on */
+  if (stalled && _HTTP2->outLength == 0) smw_wakeTask(connection->task);
+
+  uint32_t events = _HTTP2->failed || stalled ? 0 : SMW_READ;
+  if (_HTTP2->outLength > 0) events |= SMW_WRITE;
+  conn_watch(connection->conn, connection->task, events);
+  if (connection->pending == 0 && _HTTP2->outLength == 0 && _HTTP2->inLength == 0) {
+    arena_trim(&connection->arena);
+    conn_idle(connection->conn);
+  }
+  smw_setDeadline(connection->task, HTTP2Connection_Deadline(_HTTP2));
+  return 0;
+}
@@ -1,13 +1,27 @@
 #include "../../include/HTTPServer/HTTPServer.h"
+#include "../../include/utilities/logger.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "../../global_defines.h" // Assumed to contain TLS_PORT macro
 
+/* the direct calls of connection.h know plain TCP and user space TLS only */
+#if (defined(CONN_ONLY_TCP) || defined(CONN_ONLY_TLS)) && (TLS_KTLS_ENABLED || HTTPServer_USE_IO_URING)
+#error "CONN_ONLY builds go without kTLS and io_uring"
+#endif
+
 //-----------------Internal Functions-----------------
 
 static int HTTPServer_OnAccept(conn_t* new_conn, void *user_ctx);
 
+/* what plaintext clients over the connection cap get right after accept */
+static const char HTTPServer_OverloadResponse[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Length: 0\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
 //----------------------------------------------------
 
 // REVERTED IMPLEMENTATION: Uses the passed 'port' for TCP and TLS_PORT for TLS
@@ -19,20 +33,42 @@ int HTTPServer_Initiate(HTTPServer *_Server, void *_Context,
     _Server->context = _Context;
     _Server->tcp_listen_server = NULL;
     _Server->tls_listen_server = NULL;
+
+    conn_listen_options_t opts;
+    conn_listen_options_default(&opts);
+    opts.reject_response = HTTPServer_OverloadResponse;
     
+#ifndef CONN_ONLY_TLS
     // 1. Initialize TCP Listener (HTTP) using the passed 'port'
-    if (port) {
-        _Server->tcp_listen_server = conn_listen_server_tcp_init(port, HTTPServer_OnAccept, _Server);
+    if (port && strncmp(port, HTTPServer_UNIX_PREFIX, strlen(HTTPServer_UNIX_PREFIX)) == 0) {
+        /* plain HTTP for a reverse proxy on the same host */
+        const char *path = port + strlen(HTTPServer_UNIX_PREFIX);
+        _Server->tcp_listen_server = conn_listen_server_unix_init(path, HTTPServer_OnAccept, _Server, &opts);
         if (_Server->tcp_listen_server == NULL) {
-            printf("HTTPServer_Initiate: Failed to initialize TCP listener on port %s\n", port);
+            LOG_ERROR("HTTPServer_Initiate: Failed to initialize unix socket listener on %s", path);
+        }
+    } else if (port) {
+#if HTTPServer_USE_IO_URING
+        _Server->tcp_listen_server = conn_listen_server_uring_init(port, HTTPServer_OnAccept, _Server, &opts);
+        if (_Server->tcp_listen_server == NULL) {
+            LOG_WARN("HTTPServer_Initiate: io_uring unavailable, falling back to epoll on port %s", port);
+            _Server->tcp_listen_server = conn_listen_server_tcp_init(port, HTTPServer_OnAccept, _Server, &opts);
+        }
+#else
+        _Server->tcp_listen_server = conn_listen_server_tcp_init(port, HTTPServer_OnAccept, _Server, &opts);
+#endif
+        if (_Server->tcp_listen_server == NULL) {
+            LOG_ERROR("HTTPServer_Initiate: Failed to initialize TCP listener on port %s", port);
             // Continue to try and start the TLS server
         }
     }
+#endif
     
+#ifndef CONN_ONLY_TCP
     // 2. Initialize TLS Listener (HTTPS) using the global define TLS_PORT
-    _Server->tls_listen_server = conn_listen_server_tls_init(TLS_PORT, HTTPServer_OnAccept, _Server);
+    _Server->tls_listen_server = conn_listen_server_tls_init(TLS_PORT, HTTPServer_OnAccept, _Server, &opts);
     if (_Server->tls_listen_server == NULL) {
-        printf("HTTPServer_Initiate: Failed to initialize TLS listener on global port %s\n", TLS_PORT);
+        LOG_ERROR("HTTPServer_Initiate: Failed to initialize TLS listener on global port %s", TLS_PORT);
         // Clean up the TCP server if TLS failed
         if (_Server->tcp_listen_server) {
             conn_listen_server_dispose(_Server->tcp_listen_server);
@@ -40,10 +76,11 @@ int HTTPServer_Initiate(HTTPServer *_Server, void *_Context,
         }
         return -1;
     }
+#endif
     
     // Final check: did we start at least one server?
     if (!_Server->tcp_listen_server && !_Server->tls_listen_server) {
-        printf("HTTPServer_Initiate: Failed to start both TCP (%s) and TLS (%s) listeners.\n", port, TLS_PORT);
+        LOG_ERROR("HTTPServer_Initiate: Failed to start both TCP (%s) and TLS (%s) listeners.", port, TLS_PORT);
         return -1;
     }
 
@@ -82,8 +119,8 @@ static int HTTPServer_OnAccept(conn_t* new_conn, void *user_ctx) {
     int result = HTTPServerConnection_InitiatePtr(new_conn, &connection);
     
     if (result != 0) {
-        printf("HTTPServer_OnAccept: Failed to initiate connection\n");
-        new_conn->vtable->close(new_conn);
+        LOG_WARN("HTTPServer_OnAccept: Failed to initiate connection");
+        conn_close(new_conn);
         return -1;
     }
 
@@ -93,7 +130,7 @@ static int HTTPServer_OnAccept(conn_t* new_conn, void *user_ctx) {
 	return 0;
 }
 
-void HTTPServer_Dispose(HTTPServer *_Server) {
+void HTTPServer_StopListening(HTTPServer *_Server) {
     if (_Server->tcp_listen_server) {
         conn_listen_server_dispose(_Server->tcp_listen_server);
         _Server->tcp_listen_server = NULL;
@@ -102,6 +139,10 @@ void HTTPServer_Dispose(HTTPServer *_Server) {
         conn_listen_server_dispose(_Server->tls_listen_server);
         _Server->tls_listen_server = NULL;
     }
+}
+
+void HTTPServer_Dispose(HTTPServer *_Server) {
+    HTTPServer_StopListening(_Server);
     
     if (_Server->task) {
         smw_destroyTask(_Server->task);
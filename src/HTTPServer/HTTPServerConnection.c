@@ -1,25 +1,143 @@
 #include "../../include/HTTPServer/HTTPServerConnection.h"
+#include "../../include/HTTPServer/HTTP2Connection.h"
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include "utils.h"
+#include "utilities/mem_account.h"
+#include "utilities/object_pool.h"
+#include "utilities/shared_blob.h"
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+#include "utilities/probes.h"
+#include "utilities/tuning.h"
 
 //-----------------Internal Functions-----------------
 void HTTPServerConnection_TaskWork(void *_Context, uint64_t _MonTime);
 //----------------------------------------------------
 
+_Static_assert(offsetof(HTTPServerConnection, context) <= 128,
+               "what every pass of a connection's task reads has to stay within two cache lines");
+
+static __thread HTTPServerConnection_HandshakeStats t_handshakeStats;
+/* disposed connections, reused with their read buffer by the next accept */
+static void HTTPServerConnection_Destroy(void *_Object);
+static void HTTPServerConnection_DestroyRequest(void *_Object);
+static void HTTPServerConnection_DestroyReadBuffer(void *_Object);
+static __thread object_pool t_connectionPool = OBJECT_POOL_INIT(HTTPServerConnection_Destroy);
+static __thread object_pool t_requestPool = OBJECT_POOL_INIT(HTTPServerConnection_DestroyRequest);
+/* READBUFFER_SIZE buffers for heads that outgrew readInline */
+static __thread object_pool t_readBufferPool = OBJECT_POOL_INIT(HTTPServerConnection_DestroyReadBuffer);
+
+static void HTTPServerConnection_Destroy(void *_Object) {
+  HTTPServerConnection *_Connection = (HTTPServerConnection *)_Object;
+  arena_dispose(&_Connection->arena);
+  mem_account_free(MEM_TAG_CONNECTIONS, sizeof(HTTPServerConnection));
+  free(_Connection);
+}
+
+/* what the pools turn away or drain, counted out of the parser's memory */
+static void HTTPServerConnection_DestroyRequest(void *_Object) {
+  mem_account_free(MEM_TAG_PARSER, sizeof(HTTPServerConnection_Request));
+  free(_Object);
+}
+
+static void HTTPServerConnection_DestroyReadBuffer(void *_Object) {
+  mem_account_free(MEM_TAG_PARSER, READBUFFER_SIZE);
+  free(_Object);
+}
+
+void HTTPServerConnection_GetHandshakeStats(HTTPServerConnection_HandshakeStats *_Stats) {
+  *_Stats = t_handshakeStats;
+}
+
+/* shared by every loop, see utilities/metrics.h */
+static metrics_gauge g_connectionsActive;
+static metrics_counter g_responses[5];
+static metrics_counter g_responseBytes;
+static metrics_counter g_handlerTimeouts;
+static metrics_counter g_deadlinesExceeded;
+static metrics_counter g_bulkDeferred;
+static metrics_counter g_zerocopyBytes;
+static metrics_counter g_slowHeads;
+static metrics_counter g_slowResponses;
+
+void HTTPServerConnection_RegisterMetrics(void) {
+  static const char *classes[5] = {"code=\"1xx\"", "code=\"2xx\"", "code=\"3xx\"", "code=\"4xx\"", "code=\"5xx\""};
+  metrics_register("http_connections_active", "Open client connections.", METRICS_GAUGE, NULL, &g_connectionsActive);
+  for (int i = 0; i < 5; i++)
+    metrics_register("http_responses_total", "Responses sent, by status class.", METRICS_COUNTER, classes[i], &g_responses[i]);
+  metrics_register("http_response_bytes_total", "Bytes written to clients.", METRICS_COUNTER, NULL, &g_responseBytes);
+  metrics_register("http_response_zerocopy_bytes_total", "Bytes written on the zerocopy path, head included; the kernel may have copied them.",
+                   METRICS_COUNTER, NULL, &g_zerocopyBytes);
+  metrics_register("http_handler_timeouts_total", "Requests answered with a 504 in place of their handler.", METRICS_COUNTER,
+                   NULL, &g_handlerTimeouts);
+  metrics_register("http_deadline_exceeded_total", "Requests answered with a 504 once the deadline their client sent ran out.",
+                   METRICS_COUNTER, NULL, &g_deadlinesExceeded);
+  metrics_register("http_bulk_sends_deferred_total", "Turns of bulk responses put off to the next pass, its bulk bytes sent.",
+                   METRICS_COUNTER, NULL, &g_bulkDeferred);
+  metrics_register("http_slow_clients_total", "Connections dropped for moving bytes below min_transfer_rate.",
+                   METRICS_COUNTER, "phase=\"head\"", &g_slowHeads);
+  metrics_register("http_slow_clients_total", "Connections dropped for moving bytes below min_transfer_rate.",
+                   METRICS_COUNTER, "phase=\"response\"", &g_slowResponses);
+  HTTP2Connection_RegisterMetrics();
+  conn_register_metrics();
+}
+
+/* when a transfer that began at start and moved bytes since drops below the
+   rate floor if nothing more moves, 0 with the floor off */
+static uint64_t HTTPServerConnection_RateDeadline(uint64_t start, int bytes) {
+  long floor = tuning_get()->min_transfer_rate;
+  if (floor <= 0) return 0;
+  uint64_t allowed = (uint64_t)bytes * 1000 / (uint64_t)floor;
+  if (allowed < HTTPServerConnection_MIN_RATE_GRACE_MS) allowed = HTTPServerConnection_MIN_RATE_GRACE_MS;
+  return start + allowed;
+}
+
 int HTTPServerConnection_Initiate(HTTPServerConnection *_Connection, conn_t *_Conn) {
   // Store the connection object. HTTPServerConnection now OWNS this object.
   _Connection->conn = _Conn;
 
-  _Connection->url = NULL;
-  _Connection->method = NULL;
+  _Connection->readBuffer = _Connection->readInline;
+  _Connection->readCapacity = HTTPServerConnection_READ_INLINE_SIZE;
   _Connection->bytesRead = 0;
+  _Connection->readStart = 0;
+  _Connection->requestCount = 0;
+  _Connection->closing = 0;
+  _Connection->draining = 0;
+  _Connection->earlyHandshake = 0;
+  _Connection->earlyEnd = 0;
+  _Connection->requests = NULL;
+  _Connection->requestsTail = NULL;
+  _Connection->pending = 0;
   _Connection->state = HTTPServerConnection_State_Init;
   _Connection->startTime = 0;
-  _Connection->writeBuffer = NULL;
+  _Connection->initNs = 0;
+  _Connection->handshakenNs = 0;
+  _Connection->headStartNs = 0;
   _Connection->readBuffer[0] = '\0';
+  HTTPRequestParser_init(&_Connection->parser);
+  _Connection->headResult = 0;
   _Connection->bytesSent = 0;
+  _Connection->context = NULL;
+  _Connection->onRequest = NULL;
+  _Connection->onResponseSent = NULL;
+  _Connection->onClosed = NULL;
+  _Connection->http2 = NULL;
   _Connection->task = smw_createTask(_Connection, HTTPServerConnection_TaskWork);
+  if (_Connection->task == NULL) {
+    /* caller still owns _Conn and has to close it */
+    _Connection->conn = NULL;
+    return -3;
+  }
+  smw_setTaskName(_Connection->task, "http_connection");
+  /* event driven: run Init right away, then only on socket readiness/deadline */
+  conn_watch(_Conn, _Connection->task, SMW_READ);
+  smw_wakeTask(_Connection->task);
+  metrics_gauge_add(&g_connectionsActive, 1);
 
   return 0;
 }
@@ -27,12 +145,20 @@ int HTTPServerConnection_Initiate(HTTPServerConnection *_Connection, conn_t *_Co
 int HTTPServerConnection_InitiatePtr(conn_t *_Conn, HTTPServerConnection **_ConnectionPtr) {
   if (_ConnectionPtr == NULL) return -1;
   
-  HTTPServerConnection *_Connection = (HTTPServerConnection *)malloc(sizeof(HTTPServerConnection));
-  if (_Connection == NULL) return -2;
+  HTTPServerConnection *_Connection = (HTTPServerConnection *)object_pool_get(&t_connectionPool);
+  if (_Connection == NULL) {
+    /* the hot fields start on a cache line */
+    void *memory = NULL;
+    if (posix_memalign(&memory, 64, sizeof(HTTPServerConnection)) != 0) return -2;
+    _Connection = (HTTPServerConnection *)memory;
+    mem_account_alloc(MEM_TAG_CONNECTIONS, sizeof(HTTPServerConnection));
+    arena_init(&_Connection->arena, HTTPServerConnection_ARENA_BLOCK_SIZE);
+    arena_set_tag(&_Connection->arena, MEM_TAG_CONNECTIONS);
+  }
 
   int result = HTTPServerConnection_Initiate(_Connection, _Conn);
   if (result != 0) {
-    free(_Connection);
+    if (object_pool_put(&t_connectionPool, _Connection) != 0) HTTPServerConnection_Destroy(_Connection);
     return result;
   }
 
@@ -41,70 +167,868 @@ int HTTPServerConnection_InitiatePtr(conn_t *_Conn, HTTPServerConnection **_Conn
 }
 
 void HTTPServerConnection_SetCallback(HTTPServerConnection *_Connection, void *_Context,
-                                      HTTPServerConnection_OnRequest _OnRequest) {
-  _Connection->bytesSent = 0;
+                                      HTTPServerConnection_OnRequest _OnRequest,
+                                      HTTPServerConnection_OnResponseSent _OnResponseSent,
+                                      HTTPServerConnection_OnClosed _OnClosed) {
   _Connection->context = _Context;
   _Connection->onRequest = _OnRequest;
+  _Connection->onResponseSent = _OnResponseSent;
+  _Connection->onClosed = _OnClosed;
 }
 
-void HTTPServerConnection_SendResponse_Binary(HTTPServerConnection *_Connection,
-                                       int _responseCode, uint8_t *_responseBody, size_t _responseBodySize, char *_contentType) {
-  if (_Connection->state != HTTPServerConnection_State_Wait) return;
-  
-  int isRedirect = (_responseCode == 301 || _responseCode == 302);
-  HTTPResponse *resp = HTTPResponse_new(_responseCode, isRedirect ? NULL : _responseBody, isRedirect ? 0 : _responseBodySize);
-  
+/* HTTP/1.1 persists unless the client asks for close, 1.0 only on keep-alive */
+static int HTTPServerConnection_ClientKeepAlive(HTTPServerConnection *_Connection) {
+  HTTPRequestParser *parser = &_Connection->parser;
+  int keepAlive = parser->protocol == HTTP_1_1;
+  size_t length = 0;
+  const char *value = HTTPRequestParser_getKnownHeader(parser, _Connection->readBuffer + _Connection->readStart, HTTPHeader_Connection, &length);
+  if (value == NULL) return keepAlive;
+
+  /* a token list, e.g. "keep-alive, Upgrade" */
+  const char *token = value;
+  const char *valueEnd = value + length;
+  while (token < valueEnd) {
+    while (token < valueEnd && (*token == ' ' || *token == ',')) token++;
+    const char *end = token;
+    while (end < valueEnd && *end != ' ' && *end != ',') end++;
+    size_t tokenLength = end - token;
+    if (tokenLength == 5 && strncasecmp(token, "close", 5) == 0) return 0;
+    if (tokenLength == 10 && strncasecmp(token, "keep-alive", 10) == 0) keepAlive = 1;
+    token = end;
+  }
+  return keepAlive;
+}
+
+static void HTTPServerConnection_ReleaseRequest(HTTPServerConnection_Request *_Request) {
+  if (_Request->ownsWriteBuffer) free(_Request->writeBuffer);
+  if (_Request->ownsHeadBuffer) mem_account_release(MEM_TAG_PARSER, (void *)_Request->headBuffer);
+  if (_Request->bodyRelease != NULL) {
+    conn_t *conn = _Request->connection != NULL ? _Request->connection->conn : NULL;
+    if (_Request->zerocopy && conn != NULL)
+      conn_hold(conn, _Request->bodyOwner, _Request->bodyRelease);
+    else
+      _Request->bodyRelease(_Request->bodyOwner);
+  }
+  if (object_pool_put(&t_requestPool, _Request) != 0) HTTPServerConnection_DestroyRequest(_Request);
+}
+
+/* back to readInline, only once every byte read has been parsed */
+static void HTTPServerConnection_ReleaseReadBuffer(HTTPServerConnection *_Connection) {
+  if (_Connection->readBuffer == _Connection->readInline) return;
+  if (object_pool_put(&t_readBufferPool, _Connection->readBuffer) != 0)
+    HTTPServerConnection_DestroyReadBuffer(_Connection->readBuffer);
+  _Connection->readBuffer = _Connection->readInline;
+  _Connection->readCapacity = HTTPServerConnection_READ_INLINE_SIZE;
+}
+
+/* makes room for the next read while no request points into readBuffer:
+   compacts it, spills a head that filled readInline to a pooled buffer and
+   returns an idle connection to readInline. -1 if out of memory. */
+static int HTTPServerConnection_PrepareRead(HTTPServerConnection *_Connection) {
+  if (_Connection->readStart > 0) {
+    _Connection->earlyEnd = _Connection->earlyEnd > _Connection->readStart ? _Connection->earlyEnd - _Connection->readStart : 0;
+    _Connection->bytesRead -= _Connection->readStart;
+    memmove(_Connection->readBuffer, _Connection->readBuffer + _Connection->readStart, _Connection->bytesRead + 1);
+    _Connection->readStart = 0;
+  }
+  if (_Connection->bytesRead == 0) {
+    HTTPServerConnection_ReleaseReadBuffer(_Connection);
+    _Connection->readBuffer[0] = '\0';
+  } else if (_Connection->readBuffer == _Connection->readInline
+             && _Connection->bytesRead >= _Connection->readCapacity - 1) {
+    char *buffer = (char *)object_pool_get(&t_readBufferPool);
+    if (buffer == NULL) {
+      buffer = (char *)malloc(READBUFFER_SIZE);
+      if (buffer == NULL) return -1;
+      mem_account_alloc(MEM_TAG_PARSER, READBUFFER_SIZE);
+    }
+    /* the parser's offsets are relative to readStart, they carry over */
+    memcpy(buffer, _Connection->readInline, _Connection->bytesRead + 1);
+    _Connection->readBuffer = buffer;
+    _Connection->readCapacity = READBUFFER_SIZE;
+  }
+  return 0;
+}
+
+/* picks what to do next once the queue or the read buffer changed */
+/* a surprise GIF rather than a forecast, see BULK_BYTES */
+static int HTTPServerConnection_IsBulk(const HTTPServerConnection_Request *_Request) {
+  return _Request->stream != NULL || _Request->writeBufferSize + _Request->bodySize > HTTPServerConnection_BULK_BYTES;
+}
+
+/* bulk bytes this loop sent in pass t_bulkPass */
+static __thread uint64_t t_bulkPass = 0;
+static __thread int t_bulkBytes = 0;
+
+/* deficit round robin over the loop's bulk responses, with bytes for
+   packets: a turn sends up to the quantum and comes back in the next
+   pass, a full socket ends it early and it keeps nothing for the next.
+   Once a pass sent BULK_PASS_BYTES of bulk the turns wait for the next
+   pass, the small responses woken meanwhile go first in it. 0 to wait,
+   INT_MAX for a small response. */
+static int HTTPServerConnection_SendQuantum(const HTTPServerConnection_Request *_Request) {
+  if (!HTTPServerConnection_IsBulk(_Request)) return INT_MAX;
+  if (t_bulkPass != smw_pass()) {
+    t_bulkPass = smw_pass();
+    t_bulkBytes = 0;
+  }
+  if (t_bulkBytes >= HTTPServerConnection_BULK_PASS_BYTES) {
+    metrics_counter_add(&g_bulkDeferred, 1);
+    return 0;
+  }
+  return HTTPServerConnection_BULK_QUANTUM;
+}
+
+static void HTTPServerConnection_Schedule(HTTPServerConnection *_Connection) {
+  HTTPServerConnection_Request *head = _Connection->requests;
+  if (head != NULL && head->ready) {
+    _Connection->state = HTTPServerConnection_State_Send;
+    /* finishing a response goes ahead of reading and accepting, a bulk
+       one only ahead of accepting */
+    smw_setPriority(_Connection->task, HTTPServerConnection_IsBulk(head) ? smw_priority_normal : smw_priority_high);
+    /* wait for the socket to accept data, and try right away */
+    conn_watch(_Connection->conn, _Connection->task, SMW_WRITE);
+  } else if (_Connection->closing || _Connection->pending >= HTTPServerConnection_PIPELINE_DEPTH
+             || (_Connection->pending > 0 && _Connection->bytesRead >= _Connection->readCapacity - 1)) {
+    /* nothing more is read until responses leave, a full buffer stays
+       pinned by the requests pointing into it */
+    _Connection->state = HTTPServerConnection_State_Wait;
+    smw_setPriority(_Connection->task, smw_priority_normal);
+    conn_watch(_Connection->conn, _Connection->task, 0);
+  } else {
+    /* keep reading while earlier requests are being answered */
+    _Connection->state = HTTPServerConnection_State_Reading;
+    smw_setPriority(_Connection->task, smw_priority_normal);
+    conn_watch(_Connection->conn, _Connection->task, SMW_READ);
+  }
+  smw_wakeTask(_Connection->task);
+}
+
+/* a sampled request starts its trace with what the connection saw, the
+   accept and the handshake only count for the first one */
+static void HTTPServerConnection_BeginTrace(HTTPServerConnection *_Connection, HTTPServerConnection_Request *_Request) {
+  size_t length = 0;
+  const char *parent = HTTPServerConnection_GetKnownHeader(_Request, HTTPHeader_Traceparent, &length);
+  trace_context *trace = &_Request->trace;
+  if (!trace_begin(trace, parent, length)) return;
+  if (_Connection->requestCount == 1) {
+    if (_Connection->conn->accepted_ns != 0) trace_mark_at(trace, TRACE_ACCEPTED, _Connection->conn->accepted_ns);
+    if (_Connection->initNs != 0) trace_mark_at(trace, TRACE_STARTED, _Connection->initNs);
+    if (_Connection->handshakenNs != 0) trace_mark_at(trace, TRACE_HANDSHAKEN, _Connection->handshakenNs);
+  }
+  uint64_t now = trace_now();
+  trace_mark_at(trace, TRACE_READ, _Connection->headStartNs != 0 ? _Connection->headStartNs : now);
+  trace_mark_at(trace, TRACE_PARSED, now);
+}
+
+/* Server-Timing of the phases so far, once the response head is built */
+static void HTTPServerConnection_AddServerTiming(HTTPServerConnection_Request *_Request) {
+  /* a head that failed to build falls back to a 500, once is enough */
+  if (_Request->trace.marks[TRACE_QUEUED] != 0) return;
+  char value[HTTPServerConnection_EXTRA_HEADERS_SIZE];
+  trace_mark(&_Request->trace, TRACE_QUEUED);
+  if (trace_server_timing(&_Request->trace, value, sizeof(value)) > 0)
+    HTTPServerConnection_AddHeader(_Request, "Server-Timing", value);
+}
+
+HTTPServerConnection_Request *HTTPServerConnection_QueueRequest(HTTPServerConnection *_Connection, uint64_t _MonTime) {
+  HTTPServerConnection_Request *request = (HTTPServerConnection_Request *)object_pool_get(&t_requestPool);
+  if (request == NULL) {
+    request = (HTTPServerConnection_Request *)malloc(sizeof(HTTPServerConnection_Request));
+    if (request == NULL) return NULL;
+    mem_account_alloc(MEM_TAG_PARSER, sizeof(HTTPServerConnection_Request));
+  }
+  /* the head is copied in and the inline buffers written before they are
+     read, only the strings have to start out empty */
+  memset(request, 0, offsetof(HTTPServerConnection_Request, head));
+  request->extraHeaders[0] = '\0';
+  request->etag[0] = '\0';
+  request->connection = _Connection;
+  request->bodyFd = -1;
+
+  if (_Connection->requestsTail != NULL) {
+    _Connection->requestsTail->next = request;
+  } else {
+    _Connection->requests = request;
+    /* the oldest request gets the full timeout for its response */
+    smw_setDeadline(_Connection->task, _MonTime + tuning_get()->handler_timeout_ms);
+  }
+  _Connection->requestsTail = request;
+  _Connection->pending++;
+  return request;
+}
+
+/* the client's budget, the oldest request's 504 moves up to it */
+static void HTTPServerConnection_ReadDeadline(HTTPServerConnection_Request *_Request) {
+  size_t length = 0;
+  const char *value = HTTPServerConnection_GetHeader(_Request, HTTPServerConnection_DEADLINE_HEADER, &length);
+  if (value == NULL || length == 0 || length > 9) return;
+  uint64_t budget = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (value[i] < '0' || value[i] > '9') return;
+    budget = budget * 10 + (uint64_t)(value[i] - '0');
+  }
+  if (budget == 0) return;
+  HTTPServerConnection *_Connection = _Request->connection;
+  uint64_t now = SystemMonotonicMS();
+  _Request->deadlineMs = now + budget;
+  if (_Connection->state != HTTPServerConnection_State_HTTP2 && _Connection->requests == _Request)
+    smw_setDeadline(_Connection->task, HTTPServerConnection_HandlerDeadline(_Request, now));
+}
+
+uint64_t HTTPServerConnection_HandlerDeadline(const HTTPServerConnection_Request *_Request, uint64_t _From) {
+  uint64_t deadline = _From + tuning_get()->handler_timeout_ms;
+  return _Request->deadlineMs != 0 && _Request->deadlineMs < deadline ? _Request->deadlineMs : deadline;
+}
+
+void HTTPServerConnection_DispatchRequest(HTTPServerConnection_Request *_Request) {
+  HTTPServerConnection *_Connection = _Request->connection;
+  RequestMethod method = _Request->method;
+  HTTPServerConnection_ReadDeadline(_Request);
+  PROBE4(request_parsed, _Connection, (int)method, _Request->url.data, _Request->url.length);
+  if (trace_enabled()) HTTPServerConnection_BeginTrace(_Connection, _Request);
+  if (method == GET || method == HEAD || method == POST) {
+    /* a HEAD goes through the same handler, only the body stays behind; a
+       POST's body is never read, the connection closes after it */
+    _Connection->onRequest(_Connection->context, _Request);
+  } else if(method == OPTIONS) {
+    LOG_DEBUG("Responding to preflight request for %.*s", (int)_Request->url.length, _Request->url.data);
+    HTTPServerConnection_SendResponse(_Request, 204, "", NULL);
+  } else {
+    LOG_WARN("Unsupported request type '%s' received for %.*s", RequestMethod_tostring(method),
+           (int)_Request->url.length, _Request->url.data);
+    HTTPServerConnection_SendResponse(_Request, 405, "Method unsupported", "text/plain");
+  }
+}
+
+/* queues the request the parser found at the front of readBuffer and hands
+   it on, NULL if out of memory */
+static HTTPServerConnection_Request *HTTPServerConnection_ParseRequest(HTTPServerConnection *_Connection, uint64_t _MonTime) {
+  HTTPServerConnection_Request *request = HTTPServerConnection_QueueRequest(_Connection, _MonTime);
+  if (request == NULL) return NULL;
+
+  HTTPRequestParser *parser = &_Connection->parser;
+  request->head = *parser;
+  if(_Connection->headResult > 0) {
+    request->headBuffer = _Connection->readBuffer + _Connection->readStart;
+    request->url = HTTPRequestParser_getURL(parser, request->headBuffer);
+    RequestMethod method = parser->method;
+    request->method = method;
+    request->earlyData = _Connection->readStart < _Connection->earlyEnd;
+    _Connection->requestCount++;
+    /* the body would stay in the buffer and be parsed as the next request,
+       a request smuggled past whatever is in front: refused, and nothing
+       after it on this connection is read */
+    if ((method == GET || method == HEAD || method == OPTIONS) && HTTPRequestParser_hasBody(parser, request->headBuffer)) {
+      _Connection->closing = 1;
+      LOG_WARN("Dropping %s request with a body for %.*s", RequestMethod_tostring(method), (int)request->url.length,
+               request->url.data);
+      HTTPServerConnection_SendResponse(request, 400, "Request body not allowed", "text/plain");
+      return request;
+    }
+    /* other methods may carry a body we don't consume, close after those */
+    request->keepAlive = !CLOSE_CONNECTIONS && (method == GET || method == HEAD || method == OPTIONS)
+                         && _Connection->requestCount < HTTPServerConnection_KEEPALIVE_MAX_REQUESTS
+                         && !_Connection->draining
+                         && HTTPServerConnection_ClientKeepAlive(_Connection);
+    if (!request->keepAlive) _Connection->closing = 1;
+    HTTPServerConnection_DispatchRequest(request);
+  } else {
+    _Connection->closing = 1;
+    LOG_WARN("Dropping invalid request, reason: %s", InvalidReason_tostring(parser->reason));
+    if (parser->reason == HeadTooLarge)
+      HTTPServerConnection_SendResponse(request, Request_Header_Fields_Too_Large, "Request header fields too large", "text/plain");
+    else
+      HTTPServerConnection_SendResponse(request, 400, "Invalid request received", "text/plain");
+  }
+  return request;
+}
+
+/* redirects need a Location header the prebuilt heads don't carry, and
+   heads too large for them end up here as well */
+static void HTTPServerConnection_BuildResponse(HTTPServerConnection_Request *_Request, int _responseCode,
+                                               uint8_t *_responseBody, size_t _responseBodySize,
+                                               char *_contentType, const char *_connection, int _isRedirect) {
+  HTTPResponse *resp = HTTPResponse_new(_responseCode, _isRedirect ? NULL : _responseBody, _isRedirect ? 0 : _responseBodySize,
+                                        !_Request->noCors);
   if(_contentType != NULL)
     HTTPResponse_add_header(resp, "Content-Type", _contentType);
-  if(isRedirect)
+  if(_isRedirect)
     HTTPResponse_add_header(resp, "Location", (const char*)_responseBody);
-    
+  /* with CLOSE_CONNECTIONS the parser already says close on every response */
+  if(_connection != NULL)
+    HTTPResponse_add_header(resp, "Connection", _connection);
+
   size_t messageSize = 0;
-  char *message = (char*)HTTPResponse_tostring(resp, &messageSize);
-  _Connection->writeBuffer = (uint8_t *)message;
-  _Connection->writeBufferSize = messageSize;
+  _Request->writeBuffer = _Request->method == HEAD ? (uint8_t *)HTTPResponse_head_tostring(resp, &messageSize)
+                                                   : (uint8_t *)HTTPResponse_tostring(resp, &messageSize);
+  _Request->writeBufferSize = messageSize;
+  _Request->ownsWriteBuffer = 1;
   HTTPResponse_Dispose(&resp);
-  _Connection->state = HTTPServerConnection_State_Send;
 }
 
-void HTTPServerConnection_SendResponse(HTTPServerConnection *_Connection,
+/* callers of the text variant free their body right away, it is copied
+   in behind the headers */
+static void HTTPServerConnection_QueueResponse(HTTPServerConnection_Request *_Request, int _responseCode,
+                                               uint8_t *_responseBody, size_t _responseBodySize,
+                                               char *_contentType, int _borrowBody) {
+  if (_Request->ready) return;
+
+  if (_Request->trace.active) HTTPServerConnection_AddServerTiming(_Request);
+  int isRedirect = (_responseCode == 301 || _responseCode == 302);
+  const char *connection = CLOSE_CONNECTIONS ? NULL : (_Request->keepAlive ? "keep-alive" : "close");
+  int headSize = isRedirect ? -1 : HTTPResponse_build_head(_Request->responseInline, sizeof(_Request->responseInline),
+                                                           _responseCode, _contentType, connection, !_Request->noCors,
+                                                           _Request->extraHeaders, _responseBodySize);
+  _Request->body = NULL;
+  _Request->bodySize = 0;
+  if (headSize < 0) {
+    HTTPServerConnection_BuildResponse(_Request, _responseCode, _responseBody, _responseBodySize, _contentType,
+                                       connection, isRedirect);
+  } else if (_Request->method == HEAD) {
+    /* Content-Length still tells what a GET would get */
+    _Request->writeBuffer = (uint8_t *)_Request->responseInline;
+    _Request->writeBufferSize = headSize;
+    _Request->ownsWriteBuffer = 0;
+  } else if (_borrowBody) {
+    _Request->writeBuffer = (uint8_t *)_Request->responseInline;
+    _Request->writeBufferSize = headSize;
+    _Request->ownsWriteBuffer = 0;
+    _Request->body = _responseBody;
+    _Request->bodySize = (int)_responseBodySize;
+  } else if (headSize + _responseBodySize <= sizeof(_Request->responseInline)) {
+    /* small bodies (errors, preflights) go right behind the head */
+    memcpy(_Request->responseInline + headSize, _responseBody, _responseBodySize);
+    _Request->writeBuffer = (uint8_t *)_Request->responseInline;
+    _Request->writeBufferSize = headSize + (int)_responseBodySize;
+    _Request->ownsWriteBuffer = 0;
+  } else {
+    _Request->writeBuffer = (uint8_t *)arena_alloc(&_Request->connection->arena, headSize + _responseBodySize);
+    if (_Request->writeBuffer != NULL) {
+      memcpy(_Request->writeBuffer, _Request->responseInline, headSize);
+      memcpy(_Request->writeBuffer + headSize, _responseBody, _responseBodySize);
+    }
+    _Request->writeBufferSize = headSize + (int)_responseBodySize;
+    _Request->ownsWriteBuffer = 0;
+  }
+  _Request->ready = 1;
+  _Request->status = _responseCode;
+  /* the connection sends it once everything queued ahead of it is out */
+  smw_wakeTask(_Request->connection->task);
+}
+
+void HTTPServerConnection_SendResponse(HTTPServerConnection_Request *_Request,
                                        int _responseCode, char *_responseBody, char *_contentType) {
-  if (_Connection->state != HTTPServerConnection_State_Wait) return;
-  HTTPServerConnection_SendResponse_Binary(_Connection, _responseCode, (uint8_t*)_responseBody, strlen(_responseBody), _contentType);
+  HTTPServerConnection_QueueResponse(_Request, _responseCode, (uint8_t*)_responseBody, strlen(_responseBody), _contentType, 0);
+}
+
+void HTTPServerConnection_SendResponse_Binary(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, uint8_t *_responseBody, size_t _responseBodySize, char *_contentType) {
+  HTTPServerConnection_QueueResponse(_Request, _responseCode, _responseBody, _responseBodySize, _contentType, 1);
+}
+
+static void HTTPServerConnection_FreeBody(const void *_Owner) {
+  free((void *)_Owner);
+}
+
+static void HTTPServerConnection_ReleaseSharedBlob(const void *_Owner) {
+  shared_blob_release((const uint8_t *)_Owner);
+}
+
+static void HTTPServerConnection_ReleaseResponseBlob(const void *_Owner) {
+  response_blob_release((const response_blob *)_Owner);
+}
+
+/* the body is sent in place like a borrowed one, _Owner is released with the request */
+static void HTTPServerConnection_QueueOwned(HTTPServerConnection_Request *_Request, int _responseCode,
+                                            const uint8_t *_responseBody, size_t _responseBodySize, char *_contentType,
+                                            const void *_Owner, void (*_Release)(const void *_Owner)) {
+  if (_Request->ready || _Request->bodyRelease != NULL) {
+    _Release(_Owner);
+    return;
+  }
+  HTTPServerConnection_QueueResponse(_Request, _responseCode, (uint8_t *)_responseBody, _responseBodySize, _contentType, 1);
+  _Request->bodyOwner = _Owner;
+  _Request->bodyRelease = _Release;
+}
+
+void HTTPServerConnection_SendResponse_Take(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, uint8_t *_responseBody, size_t _responseBodySize, char *_contentType) {
+  HTTPServerConnection_QueueOwned(_Request, _responseCode, _responseBody, _responseBodySize, _contentType, _responseBody,
+                                  HTTPServerConnection_FreeBody);
+}
+
+void HTTPServerConnection_SendResponse_Ref(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, const uint8_t *_responseBody, size_t _responseBodySize, char *_contentType) {
+  shared_blob_retain(_responseBody);
+  HTTPServerConnection_QueueOwned(_Request, _responseCode, _responseBody, _responseBodySize, _contentType, _responseBody,
+                                  HTTPServerConnection_ReleaseSharedBlob);
+}
+
+void HTTPServerConnection_SendResponse_Blob(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, const response_blob *_Blob, compress_encoding _Encoding,
+                                       char *_contentType) {
+  if (_Request->ready) return;
+  /* the lines were formatted when the variant was set, all or nothing as with AddHeader */
+  size_t length = strlen(_Request->extraHeaders);
+  size_t lines = strlen(_Blob->headers[_Encoding]);
+  if (length + lines < sizeof(_Request->extraHeaders))
+    memcpy(_Request->extraHeaders + length, _Blob->headers[_Encoding], lines + 1);
+  snprintf(_Request->etag, sizeof(_Request->etag), "%s", _Blob->etags[_Encoding]);
+  _Request->lastModified = _Blob->last_modified;
+
+  response_blob_retain(_Blob);
+  HTTPServerConnection_QueueOwned(_Request, _responseCode, _Blob->bodies[_Encoding], _Blob->lengths[_Encoding],
+                                  _contentType, _Blob, HTTPServerConnection_ReleaseResponseBlob);
+}
+
+void HTTPServerConnection_SendResponse_File(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, const uint8_t *_responseBody, size_t _responseBodySize,
+                                       int _Fd, off_t _FdOffset, char *_contentType) {
+  if (_Request->ready) return;
+  HTTPServerConnection_AddHeader(_Request, "Accept-Ranges", "bytes");
+
+  uint64_t start = 0, end = _responseBodySize ? _responseBodySize - 1 : 0;
+  size_t length = 0;
+  const char *range = _responseCode == OK && _Request->method == GET
+                      ? HTTPServerConnection_GetKnownHeader(_Request, HTTPHeader_Range, &length) : NULL;
+  if (range != NULL) {
+    /* a resume of another version gets the whole of this one */
+    size_t ifRangeLength = 0;
+    const char *ifRange = HTTPServerConnection_GetKnownHeader(_Request, HTTPHeader_IfRange, &ifRangeLength);
+    int result = ifRange != NULL && !http_if_range_matches(ifRange, ifRangeLength, _Request->etag[0] ? _Request->etag : NULL,
+                                                           _Request->lastModified)
+                 ? 0 : http_range_parse(range, length, _responseBodySize, &start, &end);
+    char contentRange[64];
+    if (result < 0) {
+      snprintf(contentRange, sizeof(contentRange), "bytes */%zu", _responseBodySize);
+      HTTPServerConnection_AddHeader(_Request, "Content-Range", contentRange);
+      HTTPServerConnection_QueueResponse(_Request, Range_Not_Satisfiable, (uint8_t *)"Range Not Satisfiable\n", 22,
+                                         "text/plain", 0);
+      return;
+    }
+    if (result > 0) {
+      snprintf(contentRange, sizeof(contentRange), "bytes %llu-%llu/%zu", (unsigned long long)start,
+               (unsigned long long)end, _responseBodySize);
+      HTTPServerConnection_AddHeader(_Request, "Content-Range", contentRange);
+      _responseCode = Partial_Content;
+      _responseBody += start;
+      _responseBodySize = (size_t)(end - start + 1);
+    }
+  }
+
+  HTTPServerConnection_QueueResponse(_Request, _responseCode, (uint8_t *)_responseBody, _responseBodySize, _contentType, 1);
+  /* a HEAD, or a head too large for responseInline, carries no borrowed body */
+  if (_Request->body != NULL) {
+    _Request->bodyFd = _Fd;
+    _Request->bodyFdOffset = _FdOffset + (off_t)start;
+  }
+}
+
+const char *HTTPServerConnection_GetHeader(HTTPServerConnection_Request *_Request, const char *_Name, size_t *_Length) {
+  return HTTPRequestParser_getHeader(&_Request->head, _Request->headBuffer, _Name, _Length);
+}
+
+const char *HTTPServerConnection_GetKnownHeader(HTTPServerConnection_Request *_Request, HTTPHeaderId _Id, size_t *_Length) {
+  return HTTPRequestParser_getKnownHeader(&_Request->head, _Request->headBuffer, _Id, _Length);
+}
+
+void HTTPServerConnection_GetConditional(HTTPServerConnection_Request *_Request, http_conditional *_Conditional) {
+  memset(_Conditional, 0, sizeof(http_conditional));
+  size_t length = 0;
+  const char *value = HTTPServerConnection_GetKnownHeader(_Request, HTTPHeader_IfNoneMatch, &length);
+  /* a list too long to keep is treated as absent, the client gets a full response */
+  if (value != NULL && length < sizeof(_Conditional->if_none_match)) {
+    memcpy(_Conditional->if_none_match, value, length);
+    _Conditional->if_none_match[length] = '\0';
+  }
+  value = HTTPServerConnection_GetKnownHeader(_Request, HTTPHeader_IfModifiedSince, &length);
+  if (value != NULL && http_date_parse(value, length, &_Conditional->if_modified_since) != 0)
+    _Conditional->if_modified_since = 0;
+}
+
+int HTTPServerConnection_AddHeader(HTTPServerConnection_Request *_Request, const char *_Name, const char *_Value) {
+  size_t length = strlen(_Request->extraHeaders);
+  size_t space = sizeof(_Request->extraHeaders) - length;
+  int written = snprintf(_Request->extraHeaders + length, space, "%s: %s\r\n", _Name, _Value);
+  if (written < 0 || (size_t)written >= space) {
+    /* all or nothing, a cut off line would corrupt the head */
+    _Request->extraHeaders[length] = '\0';
+    return -1;
+  }
+  return 0;
+}
+
+void HTTPServerConnection_SetValidators(HTTPServerConnection_Request *_Request, const char *_ETag, time_t _LastModified) {
+  snprintf(_Request->etag, sizeof(_Request->etag), "%s", _ETag != NULL ? _ETag : "");
+  _Request->lastModified = _LastModified;
+  if (_ETag != NULL)
+    HTTPServerConnection_AddHeader(_Request, "ETag", _ETag);
+  if (_LastModified != 0) {
+    char date[HTTP_DATE_SIZE];
+    http_date_format(date, _LastModified);
+    HTTPServerConnection_AddHeader(_Request, "Last-Modified", date);
+  }
+}
+
+void HTTPServerConnection_SendNotModified(HTTPServerConnection_Request *_Request) {
+  if (_Request->ready) return;
+
+  if (_Request->trace.active) HTTPServerConnection_AddServerTiming(_Request);
+  /* no body and no Content-Length, the validators tell the client which copy is current */
+  const char *connection = CLOSE_CONNECTIONS ? NULL : (_Request->keepAlive ? "keep-alive" : "close");
+  int headSize = HTTPResponse_build_head_streamed(_Request->responseInline, sizeof(_Request->responseInline), Not_Modified,
+                                                  NULL, connection, !_Request->noCors, _Request->extraHeaders, 0);
+  if (headSize < 0) {
+    HTTPServerConnection_QueueResponse(_Request, 500, (uint8_t *)"Internal Server Error\n", 22, "text/plain", 0);
+    return;
+  }
+  _Request->writeBuffer = (uint8_t *)_Request->responseInline;
+  _Request->writeBufferSize = headSize;
+  _Request->ownsWriteBuffer = 0;
+  _Request->body = NULL;
+  _Request->bodySize = 0;
+  _Request->ready = 1;
+  _Request->status = Not_Modified;
+  smw_wakeTask(_Request->connection->task);
+}
+
+void HTTPServerConnection_SendResponse_Stream(HTTPServerConnection_Request *_Request,
+                                       int _responseCode, char *_contentType, int64_t _Length,
+                                       HTTPServerConnection_StreamRead _Read, void *_Context) {
+  if (_Request->ready) return;
+  HTTPServerConnection *_Connection = _Request->connection;
+
+  /* room for the chunk size line in front and its CRLF behind, a HEAD sends no chunks */
+  _Request->streamBuffer = _Request->method == HEAD ? NULL
+                           : (uint8_t *)arena_alloc(&_Connection->arena, HTTPServerConnection_STREAM_CHUNK_SIZE + 12);
+  int chunked = _Length < 0 && _Request->head.protocol == HTTP_1_1;
+  /* an HTTP/1.0 client only knows an unsized body has ended when we close,
+     an HTTP/2 one from the stream's END_STREAM */
+  if (_Length < 0 && !chunked && _Request->head.protocol != HTTP_2_0) {
+    _Request->keepAlive = 0;
+    _Connection->closing = 1;
+  }
+  if (_Request->trace.active) HTTPServerConnection_AddServerTiming(_Request);
+  const char *connection = CLOSE_CONNECTIONS ? NULL : (_Request->keepAlive ? "keep-alive" : "close");
+  int headSize = _Length < 0 ? HTTPResponse_build_head_streamed(_Request->responseInline, sizeof(_Request->responseInline),
+                                                                 _responseCode, _contentType, connection, !_Request->noCors,
+                                                                 _Request->extraHeaders, chunked)
+                             : HTTPResponse_build_head(_Request->responseInline, sizeof(_Request->responseInline),
+                                                       _responseCode, _contentType, connection, !_Request->noCors,
+                                                       _Request->extraHeaders, (size_t)_Length);
+  if ((_Request->streamBuffer == NULL && _Request->method != HEAD) || headSize < 0) {
+    HTTPServerConnection_QueueResponse(_Request, 500, (uint8_t *)"Internal Server Error\n", 22, "text/plain", 0);
+    return;
+  }
+  /* the head alone, _Read is never called */
+  if (_Request->method == HEAD) {
+    _Length = 0;
+    chunked = 0;
+  }
+
+  _Request->writeBuffer = (uint8_t *)_Request->responseInline;
+  _Request->writeBufferSize = headSize;
+  _Request->ownsWriteBuffer = 0;
+  _Request->body = NULL;
+  _Request->bodySize = 0;
+  _Request->stream = _Read;
+  _Request->streamContext = _Context;
+  _Request->streamRemaining = _Length;
+  _Request->streamChunked = chunked;
+  _Request->streamDone = _Length == 0;
+  _Request->ready = 1;
+  _Request->status = _responseCode;
+  smw_wakeTask(_Connection->task);
+}
+
+void HTTPServerConnection_ResumeStream(HTTPServerConnection_Request *_Request) {
+  HTTPServerConnection *_Connection = _Request->connection;
+  /* any stream may be waiting, HTTP2Connection_Work finds it */
+  if (_Connection->http2 != NULL) {
+    if (_Connection->task != NULL) smw_wakeTask(_Connection->task);
+    return;
+  }
+  /* only the response being sent can be waiting on its stream */
+  if (_Connection->task == NULL || _Connection->requests != _Request || _Connection->state != HTTPServerConnection_State_Send)
+    return;
+  conn_watch(_Connection->conn, _Connection->task, SMW_WRITE);
+  smw_wakeTask(_Connection->task);
+}
+
+/* the next chunk of a streamed body into body/bodySize: 1 if there is
+   something to send, 0 if the stream has to be waited for, -1 on error */
+int HTTPServerConnection_FillStream(HTTPServerConnection_Request *_Request) {
+  int size = HTTPServerConnection_STREAM_CHUNK_SIZE;
+  if (_Request->streamRemaining >= 0 && _Request->streamRemaining < size) size = (int)_Request->streamRemaining;
+
+  uint8_t *data = _Request->streamBuffer + 10;
+  int n = _Request->stream(_Request->streamContext, data, size);
+  if (n == HTTPServerConnection_STREAM_AGAIN) return 0;
+  if (n < 0 || n > size) return -1;
+
+  if (n == 0) {
+    /* a sized body that ends early would leave the client waiting */
+    if (_Request->streamRemaining > 0) return -1;
+    _Request->streamDone = 1;
+    if (_Request->streamChunked) {
+      _Request->body = (const uint8_t *)"0\r\n\r\n";
+      _Request->bodySize = 5;
+    } else {
+      _Request->body = NULL;
+      _Request->bodySize = 0;
+    }
+    return 1;
+  }
+
+  if (_Request->streamRemaining >= 0) {
+    _Request->streamRemaining -= n;
+    if (_Request->streamRemaining == 0) _Request->streamDone = 1;
+  }
+  if (_Request->streamChunked) {
+    char line[12];
+    int lineLength = snprintf(line, sizeof(line), "%x\r\n", n);
+    memcpy(data - lineLength, line, lineLength);
+    memcpy(data + n, "\r\n", 2);
+    _Request->body = data - lineLength;
+    _Request->bodySize = lineLength + n + 2;
+  } else {
+    _Request->body = data;
+    _Request->bodySize = n;
+  }
+  return 1;
+}
+
+void HTTPServerConnection_TimeOut(HTTPServerConnection_Request *_Request) {
+  _Request->timedOut = 1;
+  /* what the client asked for, not a handler of ours being slow */
+  if (_Request->deadlineMs != 0 && SystemMonotonicMS() >= _Request->deadlineMs) {
+    LOG_DEBUG("Deadline ran out for %.*s", (int)_Request->url.length, _Request->url.data);
+    metrics_counter_add(&g_deadlinesExceeded, 1);
+  } else {
+    LOG_WARN("Handler timed out for %.*s", (int)_Request->url.length, _Request->url.data);
+    metrics_counter_add(&g_handlerTimeouts, 1);
+  }
+  HTTPServerConnection_SendResponse(_Request, Gateway_Timeout, "Gateway Timeout\n", "text/plain");
+}
+
+void HTTPServerConnection_CountSent(int _Bytes) {
+  metrics_counter_add(&g_responseBytes, (uint64_t)_Bytes);
+}
+
+void HTTPServerConnection_CompleteRequest(HTTPServerConnection_Request *_Request, int _Sent) {
+  HTTPServerConnection *_Connection = _Request->connection;
+  /* the oldest one over HTTP/1.x, any over HTTP/2 */
+  HTTPServerConnection_Request **link = &_Connection->requests;
+  HTTPServerConnection_Request *previous = NULL;
+  while (*link != _Request) {
+    previous = *link;
+    link = &previous->next;
+  }
+  *link = _Request->next;
+  if (_Connection->requestsTail == _Request) _Connection->requestsTail = previous;
+  _Connection->pending--;
+
+  if (_Request->status >= 100 && _Request->status < 600) metrics_counter_add(&g_responses[_Request->status / 100 - 1], 1);
+  trace_mark(&_Request->trace, TRACE_SENT);
+  PROBE3(response_sent, _Connection, _Request->status, _Sent);
+  if (_Connection->conn != NULL) conn_sample_tcp_info(_Connection->conn);
+  _Request->sent = _Sent;
+  if (_Connection->onResponseSent) _Connection->onResponseSent(_Connection->context, _Request);
+  HTTPServerConnection_ReleaseRequest(_Request);
+  /* nothing queued points into the arena anymore */
+  if (_Connection->requests == NULL) arena_reset(&_Connection->arena);
+}
+
+/* one step of the TLS handshake: 0 once it is done and counted, -1 if it
+   failed, else conn_handshake's readiness */
+static int HTTPServerConnection_StepHandshake(HTTPServerConnection *_Connection) {
+  uint64_t stepStart = SystemMonotonicNS();
+  int result = conn_handshake(_Connection->conn);
+  uint64_t now = SystemMonotonicNS();
+  /* cpu spent per step, the wall time below includes the round trips */
+  smw_recordSpan("tls_handshake", now - stepStart);
+
+  if (result == 0) {
+    uint64_t us = (now - _Connection->handshakeStartNs) / 1000;
+    t_handshakeStats.completed++;
+    t_handshakeStats.total_us += us;
+    if (us > t_handshakeStats.max_us) t_handshakeStats.max_us = us;
+    if (trace_enabled()) _Connection->handshakenNs = now;
+    PROBE2(tls_handshake, _Connection->conn->client_fd, us);
+    _Connection->earlyHandshake = 0;
+  } else if (result < 0) {
+    t_handshakeStats.failed++;
+  }
+  return result;
 }
 
 void HTTPServerConnection_TaskWork(void *_Context, uint64_t _MonTime) {
   HTTPServerConnection *_Connection = (HTTPServerConnection *)_Context;
+
+  /* zerocopy completions, the bodies the kernel is done with go back */
+  if (_Connection->conn != NULL) conn_reap(_Connection->conn);
+
+  /* the streams keep deadlines of their own */
+  if (_Connection->state == HTTPServerConnection_State_HTTP2) {
+    if (HTTP2Connection_Work(_Connection->http2, _MonTime) < 0) {
+      _Connection->state = HTTPServerConnection_State_Dispose;
+      smw_wakeTask(_Connection->task);
+    }
+    return;
+  }
   
-  if (_Connection->state != HTTPServerConnection_State_Init &&
-      _MonTime - _Connection->startTime >= HTTPSERVER_TIMEOUT_MS) {
+  /* one deadline at a time: the TLS handshake, the oldest request's
+     response, a response the client is not reading or a keep-alive idle
+     period, the timer wheel wakes us with SMW_TIMEOUT once it passes */
+  if (_Connection->task->revents & SMW_TIMEOUT) {
+    HTTPServerConnection_Request *head = _Connection->requests;
+    if (head != NULL && !head->ready && _Connection->state != HTTPServerConnection_State_Failed) {
+      /* the handler is late, answer in its place and close once that is out */
+      head->keepAlive = 0;
+      _Connection->closing = 1;
+      HTTPServerConnection_TimeOut(head);
+      HTTPServerConnection_Schedule(_Connection);
+      return;
+    }
+    if (_Connection->state == HTTPServerConnection_State_Handshake) t_handshakeStats.timed_out++;
+    if (_Connection->state == HTTPServerConnection_State_Send && _Connection->rateDeadline)
+      metrics_counter_add(&g_slowResponses, 1);
+    else if (_Connection->state == HTTPServerConnection_State_Send)
+      LOG_WARN("Connection stalled sending a response");
     _Connection->state = HTTPServerConnection_State_Dispose;
   }
 
   switch (_Connection->state) {
   case HTTPServerConnection_State_Init: {
     _Connection->startTime = _MonTime;
-    _Connection->state = HTTPServerConnection_State_Reading;
+    if (trace_enabled()) _Connection->initNs = trace_now();
+    if (_Connection->conn->vtable->handshake) {
+      /* a stalled handshake is evicted well before the request timeout */
+      _Connection->handshakeStartNs = SystemMonotonicNS();
+      _Connection->state = HTTPServerConnection_State_Handshake;
+      smw_setDeadline(_Connection->task, _MonTime + HTTPServerConnection_HANDSHAKE_TIMEOUT_MS);
+    } else {
+      _Connection->state = HTTPServerConnection_State_Reading;
+      smw_setDeadline(_Connection->task, _MonTime + tuning_get()->header_timeout_ms);
+    }
+    /* the first bytes may already be waiting in the socket */
+    smw_wakeTask(_Connection->task);
+    break;
+  }
+  case HTTPServerConnection_State_Handshake: {
+    int result = HTTPServerConnection_StepHandshake(_Connection);
+    if (result == 0 && HTTP2Connection_Negotiated(_Connection)) {
+      _Connection->http2 = HTTP2Connection_Create(_Connection, _MonTime);
+      _Connection->state = _Connection->http2 != NULL ? HTTPServerConnection_State_HTTP2 : HTTPServerConnection_State_Failed;
+      smw_wakeTask(_Connection->task);
+    } else if (result == 0) {
+      /* the first head gets the full timeout of its own */
+      _Connection->state = HTTPServerConnection_State_Reading;
+      smw_setDeadline(_Connection->task, _MonTime + tuning_get()->header_timeout_ms);
+      conn_watch(_Connection->conn, _Connection->task, SMW_READ);
+      smw_wakeTask(_Connection->task);
+    } else if (result < 0) {
+      _Connection->state = HTTPServerConnection_State_Dispose;
+      smw_wakeTask(_Connection->task);
+    } else if ((result & CONN_HANDSHAKE_EARLY_DATA) && !HTTP2Connection_Negotiated(_Connection)) {
+      /* (HTTP/2 reads its first flight once the handshake is done) */
+      /* the request came along, it is parsed and handled while the
+         client's Finished is on its way */
+      _Connection->earlyHandshake = 1;
+      _Connection->state = HTTPServerConnection_State_Reading;
+      smw_setDeadline(_Connection->task, _MonTime + tuning_get()->header_timeout_ms);
+      conn_watch(_Connection->conn, _Connection->task, SMW_READ | ((uint32_t)result & SMW_WRITE));
+      smw_wakeTask(_Connection->task);
+    } else {
+      /* CONN_HANDSHAKE_ASYNC parks the socket, the connection wakes us */
+      conn_watch(_Connection->conn, _Connection->task, (uint32_t)result & (SMW_READ | SMW_WRITE));
+    }
     break;
   }
   case HTTPServerConnection_State_Reading: {
+    if (_Connection->requests != NULL && _Connection->requests->ready) {
+      HTTPServerConnection_Schedule(_Connection);
+      break;
+    }
+    if (_Connection->earlyHandshake) {
+      int result = HTTPServerConnection_StepHandshake(_Connection);
+      if (result < 0) {
+        _Connection->state = HTTPServerConnection_State_Dispose;
+        smw_wakeTask(_Connection->task);
+        break;
+      }
+      conn_watch(_Connection->conn, _Connection->task, SMW_READ | (result > 0 ? (uint32_t)result & SMW_WRITE : 0));
+    }
+    /* requests in flight point into readBuffer, it is only moved or
+       resized once they are all answered */
+    if (_Connection->pending == 0) {
+      if (HTTPServerConnection_PrepareRead(_Connection) != 0) {
+        _Connection->state = HTTPServerConnection_State_Failed;
+        smw_wakeTask(_Connection->task);
+        break;
+      }
+      if (_Connection->bytesRead >= _Connection->readCapacity - 1 && _Connection->headResult == 0) {
+        /* the largest buffer is full and the head is still not complete */
+        _Connection->parser.state = HTTPRequestParser_Invalid;
+        _Connection->parser.reason = HeadTooLarge;
+        _Connection->headResult = -1;
+      }
+    }
     int read = 0;
-    int read_amount = READBUFFER_SIZE - _Connection->bytesRead - 1;
+    int read_amount = _Connection->readCapacity - _Connection->bytesRead - 1;
     if(read_amount > 0)
     {
-      read = _Connection->conn->vtable->read(_Connection->conn, 
+      /* while there is 0-RTT data read returns that alone */
+      int early = conn_early_pending(_Connection->conn) > 0;
+      read = conn_read(_Connection->conn, 
           (uint8_t *)(_Connection->readBuffer + _Connection->bytesRead), 
           read_amount);
           
       if (read > 0) {
+        /* first bytes after a keep-alive idle period, the head gets the full timeout */
+        if (_Connection->bytesRead == _Connection->readStart && _Connection->requestCount > 0 && _Connection->requests == NULL)
+          smw_setDeadline(_Connection->task, _MonTime + tuning_get()->header_timeout_ms);
+        if (_Connection->bytesRead == _Connection->readStart) _Connection->headStartMs = _MonTime;
+        if (_Connection->bytesRead == _Connection->readStart && trace_enabled())
+          _Connection->headStartNs = trace_now();
         _Connection->bytesRead += read;
         _Connection->readBuffer[_Connection->bytesRead] = '\0';
+        if (early) _Connection->earlyEnd = _Connection->bytesRead;
+        /* only the new bytes are scanned, the parser resumes where it stopped */
+        _Connection->headResult = HTTPRequestParser_execute(&_Connection->parser, _Connection->readBuffer + _Connection->readStart,
+                                                            _Connection->bytesRead - _Connection->readStart);
+        /* TLS may hold decrypted bytes the fd won't report, read again */
+        smw_wakeTask(_Connection->task);
       }
     }
 
-    char *ret = strstr(_Connection->readBuffer, "\r\n\r\n");
-    if (ret != NULL) {
+    /* a head trickling in is only looked at when bytes come, one that
+       stops altogether runs into the header timeout */
+    uint64_t due = read > 0 && _Connection->headResult == 0
+                       ? HTTPServerConnection_RateDeadline(_Connection->headStartMs, _Connection->bytesRead - _Connection->readStart)
+                       : 0;
+    if (due != 0 && due <= _MonTime) {
+      metrics_counter_add(&g_slowHeads, 1);
+      _Connection->state = HTTPServerConnection_State_Dispose;
+      smw_wakeTask(_Connection->task);
+    } else if (_Connection->headResult != 0) {
       _Connection->state = HTTPServerConnection_State_Parsing;
+      /* park the socket while the requests are parsed and handed on */
+      conn_watch(_Connection->conn, _Connection->task, 0);
+      smw_wakeTask(_Connection->task);
+    } else if (read == 0 && _Connection->draining && _Connection->requests == NULL && _Connection->requestCount > 0
+               && _Connection->bytesRead == _Connection->readStart) {
+      /* idle between requests and the server is going away */
+      _Connection->state = HTTPServerConnection_State_Dispose;
+      smw_wakeTask(_Connection->task);
+    } else if (read == 0 && _Connection->requests == NULL && _Connection->requestCount > 0
+               && _Connection->bytesRead == _Connection->readStart) {
+      /* keep-alive, nothing until the client's next request: the arena
+         block and the TLS record buffers go back until then, readBuffer
+         is readInline already */
+      arena_trim(&_Connection->arena);
+      conn_idle(_Connection->conn);
     } else if(read == 0) {
        // Wait for more data (non-blocking return 0)
        // OR if closed: 
@@ -115,98 +1039,248 @@ void HTTPServerConnection_TaskWork(void *_Context, uint64_t _MonTime) {
     // If connection closed or error (read < 0)
     if (read < 0) {
          _Connection->state = HTTPServerConnection_State_Dispose;
+         smw_wakeTask(_Connection->task);
     }
     break;
   }
   case HTTPServerConnection_State_Parsing: {
-     // ... (Existing parsing logic remains the same) ...
-    HTTPRequest *request = HTTPRequest_fromstring(_Connection->readBuffer);
-    if(request->valid) {
-      _Connection->url = strdup(request->URL);
-      RequestMethod method = request->method;
-      HTTPRequest_Dispose(&request);
-      _Connection->method = strdup(RequestMethod_tostring(method));
-      _Connection->state = HTTPServerConnection_State_Wait;
-      if (method == GET) {
-        _Connection->onRequest(_Connection->context);
-      } else if(method == OPTIONS) {
-        printf("Responding to preflight request for %s\n", _Connection->url);
-        HTTPServerConnection_SendResponse(_Connection, 204, "", NULL);
-      } else {
-        printf("Unsupported request type '%s' received for %s\n", _Connection->method, _Connection->url);
-        HTTPServerConnection_SendResponse(_Connection, 405, "Method unsupported", "text/plain");
+    /* every complete request in the buffer, a pipelining client may have
+       sent several before reading any response */
+    while (!_Connection->closing && _Connection->pending < HTTPServerConnection_PIPELINE_DEPTH
+           && _Connection->headResult != 0) {
+      if (HTTPServerConnection_ParseRequest(_Connection, _MonTime) == NULL) {
+        _Connection->state = HTTPServerConnection_State_Failed;
+        break;
       }
-    } else {
-      _Connection->state = HTTPServerConnection_State_Wait;
-      printf("Dropping invalid request, reason: %s\n", InvalidReason_tostring(request->reason));
-      HTTPRequest_Dispose(&request);
-      HTTPServerConnection_SendResponse(_Connection, 400, "Invalid request received", "text/plain");
+      /* nothing after an invalid head can be trusted, the connection closes anyway */
+      _Connection->readStart = _Connection->headResult > 0 ? _Connection->readStart + (int)_Connection->parser.offset
+                                                           : _Connection->bytesRead;
+      HTTPRequestParser_init(&_Connection->parser);
+      _Connection->headResult = HTTPRequestParser_execute(&_Connection->parser, _Connection->readBuffer + _Connection->readStart,
+                                                          _Connection->bytesRead - _Connection->readStart);
+    }
+    if (_Connection->state == HTTPServerConnection_State_Failed) {
+      smw_wakeTask(_Connection->task);
+      break;
     }
+    HTTPServerConnection_Schedule(_Connection);
     break;
   }
   case HTTPServerConnection_State_Send: {
-    if (_Connection->writeBuffer == NULL) {
+    if (_Connection->earlyHandshake) {
+      /* mbedTLS writes nothing before the client's Finished is in */
+      int result = HTTPServerConnection_StepHandshake(_Connection);
+      if (result < 0) {
+        _Connection->state = HTTPServerConnection_State_Dispose;
+        smw_wakeTask(_Connection->task);
+        break;
+      }
+      if (result > 0) {
+        conn_watch(_Connection->conn, _Connection->task, (uint32_t)result & (SMW_READ | SMW_WRITE));
+        break;
+      }
+      conn_watch(_Connection->conn, _Connection->task, SMW_WRITE);
+    }
+    HTTPServerConnection_Request *request = _Connection->requests;
+    if (request == NULL || request->writeBuffer == NULL) {
       _Connection->state = HTTPServerConnection_State_Failed;
+      smw_wakeTask(_Connection->task);
       break;
     }
-    int n = _Connection->conn->vtable->write(_Connection->conn,
-        (uint8_t *)(_Connection->writeBuffer + _Connection->bytesSent),
-        _Connection->writeBufferSize - _Connection->bytesSent);
-        
+    /* a streamed body is pulled once the chunk before it is out, the
+       first one goes with the head */
+    if (request->stream != NULL && !request->streamDone) {
+      int consumed = _Connection->bytesSent >= request->writeBufferSize + request->bodySize;
+      if (consumed || request->bodySize == 0) {
+        if (consumed) {
+          _Connection->bytesSent = 0;
+          request->writeBufferSize = 0;
+          request->body = NULL;
+          request->bodySize = 0;
+        }
+        int result = HTTPServerConnection_FillStream(request);
+        if (result < 0) {
+          _Connection->state = HTTPServerConnection_State_Dispose;
+          smw_wakeTask(_Connection->task);
+          break;
+        }
+        if (result == 0) {
+          /* HTTPServerConnection_ResumeStream watches the socket again, the
+             producer gets the handler timeout to come up with more */
+          smw_setDeadline(_Connection->task, _MonTime + tuning_get()->handler_timeout_ms);
+          conn_watch(_Connection->conn, _Connection->task, 0);
+          break;
+        }
+      }
+    }
+    int quantum = HTTPServerConnection_SendQuantum(request);
+    if (quantum == 0) {
+      smw_wakeTask(_Connection->task);
+      break;
+    }
+    /* headers and the borrowed body leave in one gather, no copy; a bulk
+       body only up to its quantum, the head is well below that */
+    struct iovec iov[2];
+    int iovcnt = 0;
+    int total = request->writeBufferSize + request->bodySize;
+    int headLeft = 0;
+    if (_Connection->bytesSent < request->writeBufferSize) {
+      headLeft = request->writeBufferSize - _Connection->bytesSent;
+      iov[iovcnt].iov_base = request->writeBuffer + _Connection->bytesSent;
+      iov[iovcnt].iov_len = headLeft;
+      iovcnt++;
+    }
+    int bodySent = _Connection->bytesSent > request->writeBufferSize ? _Connection->bytesSent - request->writeBufferSize : 0;
+    int bodyLeft = request->bodySize - bodySent;
+    if (quantum != INT_MAX && bodyLeft > quantum - headLeft) bodyLeft = quantum > headLeft ? quantum - headLeft : 0;
+    int n = 0;
+    if (request->bodyFd >= 0 && conn_can_sendfile(_Connection->conn)) {
+      /* the head from memory, the body straight from the page cache */
+      n = conn_sendfile(_Connection->conn, iov, iovcnt, request->bodyFd, request->bodyFdOffset + bodySent, bodyLeft);
+    } else {
+      if (bodyLeft > 0) {
+        iov[iovcnt].iov_base = (void *)(request->body + bodySent);
+        iov[iovcnt].iov_len = bodyLeft;
+        iovcnt++;
+      }
+      /* a body the request holds a reference to stays put until the kernel
+         is done with its pages, a large one is not worth copying */
+      if (request->bodyRelease != NULL && request->stream == NULL &&
+          bodyLeft >= TCP_ZEROCOPY_MIN_BYTES && conn_can_zerocopy(_Connection->conn)) {
+        n = conn_writev_zerocopy(_Connection->conn, iov, iovcnt);
+        request->zerocopy = 1;
+        if (n > 0) metrics_counter_add(&g_zerocopyBytes, (uint64_t)n);
+      } else {
+        n = iovcnt > 0 ? conn_writev(_Connection->conn, iov, iovcnt) : 0;
+      }
+    }
+
+    /* a large body to a slow client is fine as long as it keeps moving, the
+       write deadline replaces the request's once sending starts */
+    if (n > 0 || _Connection->bytesSent == 0) {
+      uint64_t deadline = _MonTime + tuning_get()->write_timeout_ms;
+      if (_Connection->bytesSent == 0) _Connection->sendStartMs = _MonTime;
+      /* nor may it average below the rate floor: the timer wheel fires the
+         moment it would if nothing more leaves, a streamed body waits on
+         its producer as well and is left to the write timeout */
+      uint64_t due = request->stream == NULL
+                         ? HTTPServerConnection_RateDeadline(_Connection->sendStartMs, _Connection->bytesSent + (n > 0 ? n : 0))
+                         : 0;
+      _Connection->rateDeadline = due != 0 && due < deadline;
+      smw_setDeadline(_Connection->task, _Connection->rateDeadline ? due : deadline);
+    }
+    /* a bulk turn that sent all it could, the socket has room for more */
+    int turnUsed = quantum != INT_MAX && n > 0 && n >= headLeft + bodyLeft;
+    if (quantum != INT_MAX && n > 0) t_bulkBytes += n;
     if (n > 0) {
       _Connection->bytesSent += n;
+      metrics_counter_add(&g_responseBytes, (uint64_t)n);
+    } else if (n < 0) {
+      /* peer went away, an error-ready fd would otherwise keep waking us */
+      _Connection->state = HTTPServerConnection_State_Dispose;
+      smw_wakeTask(_Connection->task);
+      break;
     }
 
-    if (_Connection->bytesSent == _Connection->writeBufferSize) {
-      _Connection->state = HTTPServerConnection_State_Dispose;
+    /* a short write means the socket buffer is full, Schedule watches
+       SMW_WRITE so the loop only comes back once it drains; a bulk turn
+       that sent its quantum comes back in the next pass */
+    if (turnUsed && _Connection->bytesSent < total) {
+      smw_wakeTask(_Connection->task);
+    } else if (_Connection->bytesSent == total && request->stream != NULL && !request->streamDone) {
+      /* on to the next chunk */
+      smw_wakeTask(_Connection->task);
+    } else if (_Connection->bytesSent == total) {
+      _Connection->bytesSent = 0;
+      int keepAlive = request->keepAlive;
+      HTTPServerConnection_CompleteRequest(request, total);
+
+      if (!keepAlive) {
+        _Connection->state = HTTPServerConnection_State_Dispose;
+        smw_wakeTask(_Connection->task);
+      } else {
+        /* the next response gets the full handler timeout, a head still
+           coming in the header one and an idle client the keep-alive one */
+        if (_Connection->requests != NULL)
+          smw_setDeadline(_Connection->task, HTTPServerConnection_HandlerDeadline(_Connection->requests, _MonTime));
+        else if (_Connection->bytesRead > _Connection->readStart)
+          smw_setDeadline(_Connection->task, _MonTime + tuning_get()->header_timeout_ms);
+        else
+          smw_setDeadline(_Connection->task, _MonTime + tuning_get()->keepalive_timeout_ms);
+        HTTPServerConnection_Schedule(_Connection);
+      }
     }
     break;
   }
   case HTTPServerConnection_State_Wait: {
+    if (_Connection->requests != NULL && _Connection->requests->ready)
+      HTTPServerConnection_Schedule(_Connection);
     break;
   }
   case HTTPServerConnection_State_Timeout: {
-    printf("Connection timed out\n");
+    LOG_DEBUG("Connection timed out");
     _Connection->state = HTTPServerConnection_State_Dispose;
+    smw_wakeTask(_Connection->task);
     break;
   }
   case HTTPServerConnection_State_Done: {
     _Connection->state = HTTPServerConnection_State_Dispose;
+    smw_wakeTask(_Connection->task);
     break;
   }
   case HTTPServerConnection_State_Dispose: {
     smw_destroyTask(_Connection->task);
     _Connection->task = NULL;
+    if (_Connection->onClosed) _Connection->onClosed(_Connection->context);
     return;
   }
   case HTTPServerConnection_State_Failed: {
-    printf("Reading failed\n");
+    LOG_DEBUG("Reading failed");
     _Connection->state = HTTPServerConnection_State_Dispose;
+    smw_wakeTask(_Connection->task);
     break;
   }
   default: {
-    printf("Unsupported state\n");
+    LOG_WARN("Unsupported state");
     break;
   }
   }
 }
 
+void HTTPServerConnection_Drain(HTTPServerConnection *_Connection) {
+  _Connection->draining = 1;
+  /* a connection reading comes round to see if it is idle */
+  if (_Connection->task != NULL) smw_wakeTask(_Connection->task);
+}
+
 void HTTPServerConnection_Dispose(HTTPServerConnection *_Connection) {
+  metrics_gauge_add(&g_connectionsActive, -1);
+  smw_destroyTask(_Connection->task);
+  if (_Connection->http2 != NULL) {
+    HTTP2Connection_Dispose(_Connection->http2);
+    _Connection->http2 = NULL;
+  }
+
+  /* requests still waiting on a response, their handler is already gone */
+  while (_Connection->requests != NULL) {
+    HTTPServerConnection_Request *request = _Connection->requests;
+    _Connection->requests = request->next;
+    HTTPServerConnection_ReleaseRequest(request);
+  }
+  _Connection->requestsTail = NULL;
+  /* after the requests, a zerocopy body they held is the conn's to release */
   if (_Connection->conn) {
-      _Connection->conn->vtable->close(_Connection->conn);
+      conn_close(_Connection->conn);
       _Connection->conn = NULL; 
   }
-  
-  smw_destroyTask(_Connection->task);
-
-  if (_Connection->writeBuffer) free(_Connection->writeBuffer);
-  if (_Connection->url) free(_Connection->url);
-  if (_Connection->method) free(_Connection->method);
+  _Connection->pending = 0;
+  arena_reset(&_Connection->arena);
+  HTTPServerConnection_ReleaseReadBuffer(_Connection);
 }
 
 void HTTPServerConnection_DisposePtr(HTTPServerConnection **_ConnectionPtr) {
   if (_ConnectionPtr == NULL || *(_ConnectionPtr) == NULL) return;
   HTTPServerConnection_Dispose(*(_ConnectionPtr));
-  free(*(_ConnectionPtr));
+  if (object_pool_put(&t_connectionPool, *(_ConnectionPtr)) != 0) HTTPServerConnection_Destroy(*(_ConnectionPtr));
   *(_ConnectionPtr) = NULL;
 }
@@ -1,4 +1,5 @@
 #include "WeatherServer.h"
+#include "utilities/logger.h"
 #include <stdlib.h>
 
 //-----------------Internal Functions-----------------
@@ -6,15 +7,95 @@
 void WeatherServer_TaskWork(void* _Context, uint64_t _MonTime);
 int WeatherServer_OnHTTPConnection(void* _Context, HTTPServerConnection* _Connection);
 
+static void WeatherServer_AddInstance(WeatherServer* _Server, WeatherServerInstance* _Instance);
+static void WeatherServer_RemoveInstance(WeatherServer* _Server, WeatherServerInstance* _Instance);
+static void WeatherServer_QueueInstance(WeatherServer* _Server, WeatherServerInstance* _Instance);
+static void WeatherServer_OnInstanceWake(void* _Context, WeatherServerInstance* _Instance);
+
 //----------------------------------------------------
 
+static void WeatherServer_AddInstance(WeatherServer* _Server, WeatherServerInstance* _Instance)
+{
+	_Instance->prev = _Server->instancesTail;
+	_Instance->next = NULL;
+	if(_Server->instancesTail != NULL)
+		_Server->instancesTail->next = _Instance;
+	else
+		_Server->instances = _Instance;
+	_Server->instancesTail = _Instance;
+}
+
+static void WeatherServer_RemoveInstance(WeatherServer* _Server, WeatherServerInstance* _Instance)
+{
+	if(_Instance->prev != NULL)
+		_Instance->prev->next = _Instance->next;
+	else
+		_Server->instances = _Instance->next;
+	if(_Instance->next != NULL)
+		_Instance->next->prev = _Instance->prev;
+	else
+		_Server->instancesTail = _Instance->prev;
+	_Instance->prev = NULL;
+	_Instance->next = NULL;
+
+	/* only the instance being run can get here, it is not normally queued */
+	if(_Instance->queued)
+	{
+		WeatherServerInstance** link = &_Server->ready;
+		WeatherServerInstance* last = NULL;
+		while(*link != NULL && *link != _Instance)
+		{
+			last = *link;
+			link = &(*link)->readyNext;
+		}
+		if(*link != NULL)
+			*link = _Instance->readyNext;
+		if(_Server->readyTail == _Instance)
+			_Server->readyTail = last;
+		_Instance->queued = 0;
+		_Instance->readyNext = NULL;
+	}
+}
+
+static void WeatherServer_QueueInstance(WeatherServer* _Server, WeatherServerInstance* _Instance)
+{
+	if(_Instance->queued)
+		return;
+
+	_Instance->queued = 1;
+	_Instance->readyNext = NULL;
+	if(_Server->readyTail != NULL)
+		_Server->readyTail->readyNext = _Instance;
+	else
+		_Server->ready = _Instance;
+	_Server->readyTail = _Instance;
+}
+
+static void WeatherServer_OnInstanceWake(void* _Context, WeatherServerInstance* _Instance)
+{
+	WeatherServer* _Server = (WeatherServer*)_Context;
+
+	WeatherServer_QueueInstance(_Server, _Instance);
+	smw_wakeTask(_Server->task);
+}
+
 int WeatherServer_Initiate(WeatherServer* _Server, char *port)
 {
 	HTTPServer_Initiate(&_Server->httpServer, _Server, WeatherServer_OnHTTPConnection, port);
 
-	_Server->instances = LinkedList_create();
+	_Server->instances = NULL;
+	_Server->instancesTail = NULL;
+	_Server->ready = NULL;
+	_Server->readyTail = NULL;
 
 	_Server->task = smw_createTask(_Server, WeatherServer_TaskWork);
+	if(_Server->task == NULL)
+	{
+		HTTPServer_Dispose(&_Server->httpServer);
+		return -1;
+	}
+	smw_setTaskName(_Server->task, "weather_server");
+	smw_parkTask(_Server->task);
 
 	return 0;
 }
@@ -45,14 +126,14 @@ int WeatherServer_OnHTTPConnection(void* _Context, HTTPServerConnection* _Connec
 	WeatherServer* _Server = (WeatherServer*)_Context;
 
 	WeatherServerInstance* instance = NULL;
-	int result = WeatherServerInstance_InitiatePtr(_Connection, &instance);
+	int result = WeatherServerInstance_InitiatePtr(_Connection, _Server, WeatherServer_OnInstanceWake, &instance);
 	if(result != 0)
 	{
-		printf("WeatherServer_OnHTTPConnection: Failed to initiate instance\n");
+		LOG_WARN("WeatherServer_OnHTTPConnection: Failed to initiate instance");
 		return -1;
 	}
 
-	LinkedList_append(_Server->instances, instance);
+	WeatherServer_AddInstance(_Server, instance);
 
 	return 0;
 }
@@ -61,32 +142,63 @@ void WeatherServer_TaskWork(void* _Context, uint64_t _MonTime)
 {
 	WeatherServer* _Server = (WeatherServer*)_Context;
 
-	LinkedList *done = LinkedList_create();
-	// First pass: work on all instances
-	LinkedList_foreach(_Server->instances, node)
+	/* instances woken during this pass are queued for the next one */
+	WeatherServerInstance* instance = _Server->ready;
+	_Server->ready = NULL;
+	_Server->readyTail = NULL;
+
+	int polling = 0;
+	while(instance != NULL)
 	{
-		WeatherServerInstance* instance = (WeatherServerInstance*)node->item;
-		WeatherServerInstance_Work(instance, _MonTime);
+		WeatherServerInstance* next = instance->readyNext;
+		instance->queued = 0;
+		instance->readyNext = NULL;
 
+		WeatherServerInstance_Run run = WeatherServerInstance_Work(instance, _MonTime);
 		if (instance->state == WeatherServerInstance_State_This_Is_Actually_The_State_Where_We_Want_This_Struct_To_Be_Disposed)
 		{
-			LinkedList_append(done, node);
+			WeatherServer_RemoveInstance(_Server, instance);
+			WeatherServerInstance_Dispose(instance);
 		}
-
+		else if(run == WeatherServerInstance_Run_Again)
+		{
+			WeatherServer_OnInstanceWake(_Server, instance);
+		}
+		else if(run == WeatherServerInstance_Run_Poll)
+		{
+			WeatherServer_QueueInstance(_Server, instance);
+			polling = 1;
+		}
+		instance = next;
 	}
 
-	LinkedList_foreach(done, node){
-		LinkedList_remove(_Server->instances, node->item, (void (*)(void*))WeatherServerInstance_Dispose);
-	}
+	if(polling)
+		smw_setDeadline(_Server->task, _MonTime + WeatherServer_POLL_INTERVAL_MS);
+}
 
-	LinkedList_dispose(&done, NULL);
+void WeatherServer_Drain(WeatherServer* _Server)
+{
+	HTTPServer_StopListening(&_Server->httpServer);
+	for(WeatherServerInstance* instance = _Server->instances; instance != NULL; instance = instance->next)
+	{
+		if(instance->connection != NULL)
+			HTTPServerConnection_Drain(instance->connection);
+	}
 }
 
 void WeatherServer_Dispose(WeatherServer* _Server)
 {
 	HTTPServer_Dispose(&_Server->httpServer);
 	smw_destroyTask(_Server->task);
-	LinkedList_dispose(&_Server->instances, (void (*)(void*))WeatherServerInstance_Dispose);
+	while(_Server->instances != NULL)
+	{
+		WeatherServerInstance* instance = _Server->instances;
+		WeatherServer_RemoveInstance(_Server, instance);
+		WeatherServerInstance_Dispose(instance);
+	}
+	_Server->ready = NULL;
+	_Server->readyTail = NULL;
+	WeatherServerInstance_ReleaseThread();
 }
 
 void WeatherServer_DisposePtr(WeatherServer** _ServerPtr)
@@ -2,48 +2,1555 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <jansson.h>
 
 #include "backends/cities.h"
+#include "backends/cities_weather.h"
 #include "backends/geolocation.h"
+#include "backends/geolocation_batch.h"
+#include "backends/geolocation_nearest.h"
 #include "backends/surprise.h"
 #include "backends/weather.h"
+#include "backends/weather_batch.h"
+#include "backends/weather_by_name.h"
+#include "backends/weather_history.h"
 #include "utils.h"
+#include "cdn_purge.h"
+#include "utilities/admission.h"
+#include "utilities/cache_only.h"
+#include "utilities/cbor.h"
+#include "utilities/curl_client.h"
+#include "utilities/huge_pages.h"
+#include "utilities/job_pool.h"
+#include "utilities/json_arena.h"
+#include "utilities/loop_mailbox.h"
+#include "utilities/mem_account.h"
+#include "utilities/object_pool.h"
+#include "utilities/perfect_hash.h"
+#include "utilities/rate_limiter.h"
+#include "utilities/response_cache.h"
+#include "utilities/tuning.h"
+#include "utilities/ub_alloc.h"
+#include "utilities/url_codec.h"
 #include "global_defines.h"
+#include "utilities/logger.h"
 
 //-----------------Internal Functions-----------------
 
-int WeatherServerInstance_OnRequest(void* _Context);
+int WeatherServerInstance_OnRequest(void* _Context, HTTPServerConnection_Request* _Request);
+void WeatherServerInstance_OnResponseSent(void* _Context, HTTPServerConnection_Request* _Request);
+void WeatherServerInstance_OnClosed(void* _Context);
 void WeatherServerInstance_OnDone(void* _Context);
+void WeatherServerInstance_OnBackendWake(void* _Context);
+static WeatherServerInstance_Run WeatherServerRequest_Work(WeatherServerRequest* _Request);
+static void WeatherServerRequest_Release(WeatherServerRequest* _Request);
 /*static char* create_uppercase_copy(const char* str);*/
-static char* create_lowercase_copy(const char* str);
+static char* WeatherServerInstance_StatsJson(arena* _Arena);
+static char* WeatherServerInstance_MemoryJson(arena* _Arena);
+static char* WeatherServerInstance_HotKeysJson(arena* _Arena);
+static int WeatherServerRequest_ParseDouble(HTTPStringView _Value, double* _Out);
+static void WeatherServerRequest_Destroy(void* _Object);
+static void WeatherServerInstance_Destroy(void* _Object);
+static int WeatherServerRequest_ReadBody(void* _Context, uint8_t* _Buffer, int _Size);
+static int WeatherServerRequest_CacheOutcome(WeatherServerRequest* _Request);
+static int WeatherServerRequest_AccessTarget(WeatherServerRequest* _Request, char* _Out, size_t _Size);
+static int WeatherServerRequest_Admit(WeatherServerRequest* _Request);
+static int WeatherServerRequest_Forbidden(WeatherServerRequest* _Request);
+static void WeatherServerRequest_DisposeBackend(WeatherServerRequest* _Request);
+static compress_encoding WeatherServerRequest_Encode(WeatherServerRequest* _Request, const uint8_t** _Body,
+                                                     size_t* _Length);
+
+/* disposed instances, reused by the next connection on this loop */
+static __thread object_pool t_instancePool = OBJECT_POOL_INIT(WeatherServerInstance_Destroy);
+/* the cities body when there is no snapshot, it only changes with a restart */
+static __thread WeatherServerBodyMemo t_citiesMemo;
+/* answered requests, reused by the next request on this loop */
+static __thread object_pool t_requestPool = OBJECT_POOL_INIT(WeatherServerRequest_Destroy);
+/* queue delay of this loop's requests, misses are shed while it stands */
+static __thread admission t_admission = ADMISSION_INIT;
+/* what each client address has left to spend on this loop, charged by what
+   its requests cost once answered; set up by the first request */
+static __thread rate_limiter t_quota;
+/* final bodies of the routes with WeatherServerCache_Micro, set up by the
+   first one stored */
+static __thread response_cache t_microCache;
+
+//-----------------------Routes-----------------------
+
+static const WeatherServerBackendOps g_citiesOps = {
+    .init = cities_init,
+    .work = cities_work,
+    .dispose = cities_dispose,
+    .get_buffer = cities_get_buffer,
+};
+
+static const WeatherServerBackendOps g_geolocationOps = {
+    .init = geolocation_init,
+    .work = geolocation_work,
+    .dispose = geolocation_dispose,
+    .get_buffer = geolocation_get_buffer,
+    .get_cache_outcome = geolocation_get_cache_outcome,
+    .set_trace = geolocation_set_trace,
+};
+
+static const WeatherServerBackendOps g_weatherOps = {
+    .init = weather_init,
+    .work = weather_work,
+    .dispose = weather_dispose,
+    .get_buffer = weather_get_buffer,
+    .get_validators = weather_get_validators,
+    .get_encoded = weather_get_encoded,
+    .get_blob = weather_get_blob,
+    .get_content_type = weather_get_content_type,
+    .get_file = weather_get_file,
+    .get_freshness = weather_get_freshness,
+    .get_cache_outcome = weather_get_cache_outcome,
+    .set_trace = weather_set_trace,
+};
+
+/* the owner's record for a peer, see weather_set_peer */
+static const WeatherServerBackendOps g_peerWeatherOps = {
+    .init = weather_init,
+    .work = weather_work,
+    .dispose = weather_dispose,
+    .get_buffer = weather_get_buffer,
+    .get_buffer_size = weather_get_buffer_size,
+    .get_validators = weather_get_validators,
+    .get_cache_outcome = weather_get_cache_outcome,
+    .set_trace = weather_set_trace,
+};
+
+static const WeatherServerBackendOps g_weatherBatchOps = {
+    .init = weather_batch_init,
+    .work = weather_batch_work,
+    .dispose = weather_batch_dispose,
+    .get_buffer = weather_batch_get_buffer,
+};
+
+/* a location's observations from the local archive, see weather_history.h */
+static const WeatherServerBackendOps g_weatherHistoryOps = {
+    .init = weather_history_init,
+    .work = weather_history_work,
+    .dispose = weather_history_dispose,
+    .get_buffer = weather_history_get_buffer,
+    .get_cache_outcome = weather_history_get_cache_outcome,
+};
+
+/* the search then the forecast of its best match, see weather_by_name.h */
+static const WeatherServerBackendOps g_weatherByNameOps = {
+    .init = weather_by_name_init,
+    .work = weather_by_name_work,
+    .dispose = weather_by_name_dispose,
+    .get_buffer = weather_by_name_get_buffer,
+    .get_cache_outcome = weather_by_name_get_cache_outcome,
+    .set_trace = weather_by_name_set_trace,
+};
+
+/* one search per name, the lines streamed as they are answered */
+static const WeatherServerBackendOps g_locationBatchOps = {
+    .init = geolocation_batch_init,
+    .work = geolocation_batch_work,
+    .dispose = geolocation_batch_dispose,
+    .read = geolocation_batch_read,
+    .set_trace = geolocation_batch_set_trace,
+};
+
+static const WeatherServerBackendOps g_surpriseOps = {
+    .init = surprise_init,
+    .work = surprise_work,
+    .dispose = surprise_dispose,
+    .get_buffer = surprise_get_buffer,
+    .get_buffer_size = surprise_get_buffer_size,
+    .get_validators = surprise_get_validators,
+    .get_content_type = surprise_get_content_type,
+    .get_file = surprise_get_file,
+    .get_cache_control = surprise_get_cache_control,
+};
+
+static metrics_counter g_shedRequests;
+static metrics_counter g_overQuota;
+static metrics_counter g_cacheOnlyMisses;
+static metrics_counter g_microHits;
+static metrics_counter g_microMisses;
+static metrics_counter g_routeBusy;
+static metrics_gauge g_overloadedLoops;
+static metrics_histogram g_queueDelay;
+
+/* the cheap answer to what is not served right now, asked again shortly */
+static void WeatherServerRequest_SendUnavailable(WeatherServerRequest* _Request, metrics_counter* _Counter) {
+    char retry_after[16];
+    snprintf(retry_after, sizeof(retry_after), "%d", WeatherServerInstance_RETRY_AFTER_S);
+    HTTPServerConnection_AddHeader(_Request->request, "Retry-After", retry_after);
+    HTTPServerConnection_SendResponse(_Request->request, 503, "Service Unavailable\n", "text/plain");
+    metrics_counter_add(_Counter, 1);
+}
+
+/* the request headers a negotiated body varies with */
+static const char* WeatherServerRequest_Vary(const WeatherServerRequest* _Request) {
+    return _Request->backend.route->negotiate_format ? "Accept, Accept-Encoding" : "Accept-Encoding";
+}
+
+/* the content type of a JSON route's body, CBOR when that was negotiated */
+static const char* WeatherServerRequest_ContentType(const WeatherServerRequest* _Request) {
+    return _Request->cbor ? "application/cbor" : _Request->backend.route->descriptor->content_type;
+}
+
+/* a copy past its TTL answers in place of a fetch, the client is told so */
+static void WeatherServerRequest_FlagStale(WeatherServerRequest* _Request, int _Outcome) {
+    if (_Outcome == ACCESS_CACHE_FALLBACK || (_Outcome == ACCESS_CACHE_STALE && cache_only_active())) {
+        HTTPServerConnection_AddHeader(_Request->request, "Warning", "110 - \"Response is Stale\"");
+    }
+}
+
+/* a forecast made at _Stamp and fresh until _Expires: a CDN in front keeps
+   it as long as the server does, its max-age the whole lifetime and Age
+   what is gone of it, and serves it past that while it revalidates or the
+   server fails as the server would. "weather" purges them all */
+static void WeatherServerRequest_AddFreshness(WeatherServerRequest* _Request, time_t _Stamp, time_t _Expires,
+                                              const char* _Key) {
+    HTTPServerConnection_Request* request = _Request->request;
+    time_t now = time(NULL);
+    char value[128];
+    snprintf(value, sizeof(value), "public, max-age=%ld, stale-while-revalidate=%d, stale-if-error=%d",
+             (long)(_Expires > _Stamp ? _Expires - _Stamp : 0), Weather_STALE_WHILE_REVALIDATE_SECONDS,
+             Weather_STALE_IF_ERROR_SECONDS);
+    HTTPServerConnection_AddHeader(request, "Cache-Control", value);
+    snprintf(value, sizeof(value), "%ld", (long)(now > _Stamp ? now - _Stamp : 0));
+    HTTPServerConnection_AddHeader(request, "Age", value);
+    snprintf(value, sizeof(value), "weather %s", _Key);
+    HTTPServerConnection_AddHeader(request, "Surrogate-Key", value);
+}
+
+/* the address a request's cost is charged to, NULL if it is not (a peer
+   node, a client without one, the quota off) */
+static const struct sockaddr* WeatherServerRequest_QuotaAddress(const WeatherServerRequest* _Request) {
+    const conn_t* conn = _Request->instance->connection->conn;
+    const WeatherServerRoute* route = _Request->backend.route;
+    const tuning* knobs = tuning_get();
+    if (knobs->quota_tokens_per_second == 0 || conn == NULL || conn->peer_len == 0 ||
+        (route != NULL && route->descriptor->cost == WeatherServerCost_Peer)) {
+        return NULL;
+    }
+    if (t_quota.entries == NULL &&
+        rate_limiter_init(&t_quota, (uint32_t)knobs->quota_tokens_per_second, (uint32_t)knobs->quota_burst, 0, 0,
+                          SystemMonotonicMS()) != 0) {
+        return NULL;
+    }
+    /* /admin/config may have changed them, the buckets carry over */
+    t_quota.rate = (uint32_t)knobs->quota_tokens_per_second;
+    t_quota.burst = (uint32_t)knobs->quota_burst;
+    return (const struct sockaddr*)&conn->peer;
+}
+
+/* a client whose earlier requests spent its quota waits for it to refill,
+   1 if it was answered 429 */
+static int WeatherServerRequest_OverQuota(WeatherServerRequest* _Request) {
+    const struct sockaddr* address = WeatherServerRequest_QuotaAddress(_Request);
+    uint64_t wait_ms = address != NULL ? rate_limiter_wait(&t_quota, address, SystemMonotonicMS()) : 0;
+    if (wait_ms == 0) return 0;
+    char retry_after[16];
+    snprintf(retry_after, sizeof(retry_after), "%llu", (unsigned long long)((wait_ms + 999) / 1000));
+    HTTPServerConnection_AddHeader(_Request->request, "Retry-After", retry_after);
+    HTTPServerConnection_SendResponse(_Request->request, Too_Many_Requests, "Too Many Requests\n", "text/plain");
+    metrics_counter_add(&g_overQuota, 1);
+    return 1;
+}
+
+/* once answered the client pays what the request cost: a token, the fetch
+   if it went upstream and the bytes it took */
+static void WeatherServerRequest_ChargeQuota(WeatherServerRequest* _Request, int _Sent) {
+    const struct sockaddr* address = WeatherServerRequest_QuotaAddress(_Request);
+    if (address == NULL) return;
+    const tuning* knobs = tuning_get();
+    uint64_t tokens = 1;
+    int outcome = WeatherServerRequest_CacheOutcome(_Request);
+    if (outcome == ACCESS_CACHE_FETCH || outcome == ACCESS_CACHE_FALLBACK) {
+        tokens += (uint64_t)knobs->quota_fetch_cost;
+    }
+    uint64_t bytes = _Sent > 0 ? (uint64_t)_Sent : 0;
+    uint64_t cost = tokens * 1000 + bytes * 1000 / (uint64_t)knobs->quota_bytes_per_token;
+    rate_limiter_charge(&t_quota, address, cost, SystemMonotonicMS());
+}
+
+/* every route that got past its caches ends up here, so this is where an
+   overloaded loop turns the late ones away, it could not answer them in time,
+   a route at its concurrency limit turns away more, and a client past its
+   quota is told to come back later */
+static int WeatherServerRequest_InitBackend(WeatherServerRequest* _Request) {
+    WeatherServerBackend* backend = &_Request->backend;
+    if (!WeatherServerRequest_Admit(_Request)) return 1;
+    if (WeatherServerRequest_OverQuota(_Request)) return 1;
+    if (backend->route->ops->init((void*)_Request, &backend->backend_struct, WeatherServerInstance_OnDone,
+                                  WeatherServerInstance_OnBackendWake) != 0) {
+        backend->backend_struct = NULL;
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    if (_Request->request->trace.active && backend->route->ops->set_trace != NULL) {
+        backend->route->ops->set_trace(&backend->backend_struct, &_Request->request->trace);
+    }
+    return 0;
+}
+
+/* the snapshot, 1 if sent */
+static int WeatherServerRoute_CitiesAnswer(WeatherServerRequest* _Request) {
+    HTTPServerConnection_Request* request = _Request->request;
+    const cities_snapshot* snapshot = cities_current();
+    if (snapshot != NULL) {
+        // The response holds the body, a reload may retire the snapshot meanwhile
+        _Request->cache = ACCESS_CACHE_HOT;
+        trace_mark(&request->trace, TRACE_CACHED);
+        HTTPServerConnection_AddHeader(request, "Vary", WeatherServerRequest_Vary(_Request));
+        // Small already, the CBOR body goes out as it is
+        if (_Request->cbor && snapshot->cbor != NULL) {
+            HTTPServerConnection_SetValidators(request, snapshot->cbor_etag, snapshot->last_modified);
+            if (http_conditional_is_current(&_Request->conditional, snapshot->cbor_etag, snapshot->last_modified)) {
+                HTTPServerConnection_SendNotModified(request);
+            } else {
+                HTTPServerConnection_SendResponse_Ref(request, 200, snapshot->cbor, snapshot->cbor_length,
+                                                      "application/cbor");
+            }
+            return 1;
+        }
+        _Request->cbor = 0;
+        compress_encoding encoding = _Request->encoding;
+        if (snapshot->bodies[encoding] == NULL) encoding = COMPRESS_IDENTITY;
+        HTTPServerConnection_SetValidators(request, snapshot->etags[encoding], snapshot->last_modified);
+        if (http_conditional_is_current(&_Request->conditional, snapshot->etags[encoding], snapshot->last_modified)) {
+            HTTPServerConnection_SendNotModified(request);
+            return 1;
+        }
+        if (encoding != COMPRESS_IDENTITY) {
+            HTTPServerConnection_AddHeader(request, "Content-Encoding", compress_encoding_name(encoding));
+        }
+        HTTPServerConnection_SendResponse_Ref(request, 200, snapshot->bodies[encoding], snapshot->lengths[encoding],
+                                              "application/json");
+        return 1;
+    }
+    return 0;
+}
+
+static int WeatherServerRoute_Cities(WeatherServerRequest* _Request) {
+    if (WeatherServerRoute_CitiesAnswer(_Request)) return 1;
+    HTTPServerConnection_Request* request = _Request->request;
+
+    // No snapshot (building it failed), the backend reads the folder itself.
+    // The memo is of the JSON, a CBOR body is transcoded for each request.
+    if (_Request->cbor) return WeatherServerRequest_InitBackend(_Request);
+    const char* memo_etag = t_citiesMemo.etags[_Request->encoding];
+    if (memo_etag[0] != '\0' && http_conditional_present(&_Request->conditional) &&
+        http_conditional_is_current(&_Request->conditional, memo_etag, 0)) {
+        HTTPServerConnection_SetValidators(request, memo_etag, 0);
+        HTTPServerConnection_AddHeader(request, "Vary", WeatherServerRequest_Vary(_Request));
+        HTTPServerConnection_SendNotModified(request);
+        return 1;
+    }
+    _Request->backend.memo = &t_citiesMemo;
+    return WeatherServerRequest_InitBackend(_Request);
+}
+
+/* the bundle of every city's forecast, 1 if sent */
+static int WeatherServerRoute_CitiesWeatherAnswer(WeatherServerRequest* _Request) {
+    weather_hot_hit hit;
+    if (cities_weather_lookup(_Request->encoding, &hit) != 0) return 0;
+    HTTPServerConnection_Request* request = _Request->request;
+    _Request->cache = hit.stale ? ACCESS_CACHE_STALE : ACCESS_CACHE_HOT;
+    trace_mark(&request->trace, TRACE_CACHED);
+    HTTPServerConnection_AddHeader(request, "Vary", "Accept-Encoding");
+    WeatherServerRequest_FlagStale(_Request, _Request->cache);
+    if (http_conditional_is_current(&_Request->conditional, hit.etag, hit.last_modified)) {
+        HTTPServerConnection_SetValidators(request, hit.etag, hit.last_modified);
+        HTTPServerConnection_SendNotModified(request);
+        return 1;
+    }
+    // A rebuild may replace the bundle before this response is out
+    HTTPServerConnection_SendResponse_Blob(request, 200, hit.blob, hit.encoding, "application/json");
+    return 1;
+}
+
+static int WeatherServerRoute_CitiesWeather(WeatherServerRequest* _Request) {
+    if (WeatherServerRoute_CitiesWeatherAnswer(_Request)) return 1;
+    HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+    return 1;
+}
+
+static void WeatherServerRoute_ReloadCitiesJob(void* _Context) {
+    (void)_Context;
+    if (cities_reload() != 0) LOG_WARN("WeatherServerInstance: Reloading cities failed");
+}
+
+static int WeatherServerRoute_ReloadCities(WeatherServerRequest* _Request) {
+    if (WeatherServerRequest_Forbidden(_Request)) return 1;
+    if (_Request->request->method != POST) {
+        HTTPServerConnection_AddHeader(_Request->request, "Allow", "POST");
+        HTTPServerConnection_SendResponse(_Request->request, Method_Not_Allowed, "Method Not Allowed\n", "text/plain");
+        return 1;
+    }
+    // Rebuilt on a pool thread, requests keep getting the old snapshot meanwhile
+    if (job_pool_submit(WeatherServerRoute_ReloadCitiesJob, NULL, NULL) == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+    } else {
+        HTTPServerConnection_SendResponse(_Request->request, 202, "Accepted\n", "text/plain");
+    }
+    return 1;
+}
+
+static int WeatherServerRoute_Geolocation(WeatherServerRequest* _Request) {
+    const WeatherServerRequestParams* params = &_Request->params;
+    if (params->name == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Missing 'name' parameter\n", "text/plain");
+        return 1;
+    }
+    int location_count = params->count >= 0 ? params->count : WeatherServerInstance_DEFAULT_LOCATION_COUNT;
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    // The backend takes its own copies
+    geolocation_set_parameters(&_Request->backend.backend_struct, (char*)params->name, location_count,
+                               (char*)params->country_code);
+    return 0;
+}
+
+static int WeatherServerRoute_Nearest(WeatherServerRequest* _Request) {
+    HTTPServerConnection_Request* request = _Request->request;
+    const WeatherServerRequestParams* params = &_Request->params;
+    if (!params->has_location) {
+        HTTPServerConnection_SendResponse(request, 400, "Bad Request: Missing parameters\n", "text/plain");
+        return 1;
+    }
+    geolocation_nearest_place place;
+    if (geolocation_nearest_find(params->latitude, params->longitude, &place) != 0) {
+        HTTPServerConnection_SendResponse(request, 404, "Not Found: No places known\n", "text/plain");
+        return 1;
+    }
+
+    // Built and dumped in the arena, the body lives there until the response is sent
+    json_arena_begin(&_Request->arena);
+    json_t* object = json_pack("{s:i,s:s,s:s?,s:f,s:f,s:f}", "id", place.id, "name", place.name, "country_code",
+                               place.country_code[0] ? place.country_code : NULL, "latitude", place.latitude,
+                               "longitude", place.longitude, "distance_km", place.distance_km);
+    json_buffer body;
+    json_buffer_init(&body, &_Request->arena);
+    int result = object ? json_buffer_dump(&body, object, JSON_COMPACT) : -1;
+    json_decref(object);
+    json_arena_end();
+    if (result != 0) {
+        HTTPServerConnection_SendResponse(request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    size_t length = 0;
+    char* data = json_buffer_take(&body, &length);
+    HTTPServerConnection_SendResponse_Binary(request, 200, (uint8_t*)data, length, "application/json");
+    return 1;
+}
+
+/* the location asked for, 0 if it has none */
+static int WeatherServerRoute_WeatherLocation(WeatherServerRequest* _Request, double* _Latitude, double* _Longitude) {
+    WeatherServerRequestParams* params = &_Request->params;
+    // A known city needs no geocoding
+    if (!params->has_location && params->city != NULL &&
+        cities_find(params->city, &params->latitude, &params->longitude) == 0) {
+        params->has_location = 1;
+    }
+    if (!params->has_location) return 0;
+    *_Latitude = params->latitude;
+    *_Longitude = params->longitude;
+    weather_quantize(_Latitude, _Longitude);
+    return 1;
+}
+
+/* the projection the request asks for, CBOR included; 0 for the whole JSON */
+static uint32_t WeatherServerRequest_FieldSet(const WeatherServerRequest* _Request) {
+    return _Request->params.field_set | (_Request->cbor ? WEATHER_FIELDS_CBOR : 0);
+}
+
+/* 1 and hit filled if the loop has the body the request asks for */
+static int WeatherServerRoute_WeatherLookup(const WeatherServerRequest* _Request, double _Latitude,
+                                            double _Longitude, weather_hot_hit* _Hit) {
+    uint32_t fields = WeatherServerRequest_FieldSet(_Request);
+    if (fields != 0) {
+        return weather_projected_lookup(_Latitude, _Longitude, fields, _Request->encoding, _Hit) == 0;
+    }
+    return weather_hot_lookup(_Latitude, _Longitude, _Request->encoding, _Hit) == 0;
+}
+
+/* 1 if the comma separated list of a header has _Token, parameters aside */
+static int WeatherServerRequest_ListHas(const char* _Value, size_t _Length, const char* _Token) {
+    size_t token_length = strlen(_Token);
+    size_t at = 0;
+    while (at < _Length) {
+        while (at < _Length && (_Value[at] == ' ' || _Value[at] == '\t' || _Value[at] == ',')) at++;
+        size_t start = at;
+        while (at < _Length && _Value[at] != ',' && _Value[at] != ';' && _Value[at] != ' ' && _Value[at] != '\t') at++;
+        if (at - start == token_length && strncasecmp(_Value + start, _Token, token_length) == 0) return 1;
+        while (at < _Length && _Value[at] != ',') at++;
+    }
+    return 0;
+}
+
+/* what changed since the version the client has, a JSON merge patch, or a
+   304 if nothing did; 1 if sent. Asked for with ?since= and the ETag or the
+   Last-Modified date it got, or with its validators and "A-IM: merge-patch"
+   (RFC 3229). A version the loop no longer keeps gets the whole forecast. */
+static int WeatherServerRoute_WeatherDelta(WeatherServerRequest* _Request, double _Latitude, double _Longitude,
+                                           const weather_hot_hit* _Hit) {
+    if (_Request->cbor || _Request->params.field_set != 0 || _Hit->last_modified == 0) return 0;
+    HTTPServerConnection_Request* request = _Request->request;
+    http_conditional since;
+    memset(&since, 0, sizeof(since));
+    const char* version = _Request->params.since;
+    if (version != NULL && version[0] != '\0') {
+        // Quotes are optional in the query
+        int quoted = version[0] == '"' || strncmp(version, "W/", 2) == 0;
+        if (quoted || http_date_parse(version, strlen(version), &since.if_modified_since) != 0) {
+            since.if_modified_since = 0;
+            snprintf(since.if_none_match, sizeof(since.if_none_match), quoted ? "%s" : "\"%s\"", version);
+        }
+    } else {
+        size_t length = 0;
+        const char* im = HTTPServerConnection_GetHeader(request, "A-IM", &length);
+        if (im == NULL || !http_conditional_present(&_Request->conditional) ||
+            !WeatherServerRequest_ListHas(im, length, "merge-patch")) {
+            return 0;
+        }
+        since = _Request->conditional;
+    }
+
+    if (http_conditional_is_current(&since, _Hit->etag, _Hit->last_modified)) {
+        HTTPServerConnection_SetValidators(request, _Hit->etag, _Hit->last_modified);
+        HTTPServerConnection_SendNotModified(request);
+        return 1;
+    }
+    const uint8_t* patch = NULL;
+    size_t length = 0;
+    if (weather_delta_lookup(_Latitude, _Longitude, _Hit->last_modified, &since, &patch, &length) != 0) return 0;
+    // Only of use to the client holding that version
+    HTTPServerConnection_SetValidators(request, _Hit->etag, _Hit->last_modified);
+    HTTPServerConnection_AddHeader(request, "IM", "merge-patch");
+    HTTPServerConnection_AddHeader(request, "Cache-Control", "private, no-cache");
+    HTTPServerConnection_SendResponse_Ref(request, IM_Used, patch, length, "application/merge-patch+json");
+    return 1;
+}
+
+/* from the loop's hot cache, 1 if sent */
+static int WeatherServerRoute_WeatherAnswer(WeatherServerRequest* _Request) {
+    double latitude, longitude;
+    if (!WeatherServerRoute_WeatherLocation(_Request, &latitude, &longitude)) return 0;
+
+    // Sent before within its TTL, no backend and no disk access. Past it the
+    // entry still goes out while a refresh replaces it. A cell nobody asked
+    // for lately may borrow a fresh neighbour's forecast.
+    // A projection comes from the projection cache, cut from the hot entry
+    // if it has none of this version
+    const WeatherServerRequestParams* params = &_Request->params;
+    if (params->fields != NULL && params->field_set == 0) return 0;
+    weather_hot_hit hit;
+    int found = WeatherServerRoute_WeatherLookup(_Request, latitude, longitude, &hit);
+    if (!found && weather_nearest_fresh(&latitude, &longitude) == 0) {
+        found = WeatherServerRoute_WeatherLookup(_Request, latitude, longitude, &hit);
+    }
+    if (found) {
+        if (hit.stale) weather_refresh(latitude, longitude);
+        _Request->cache = hit.stale ? ACCESS_CACHE_STALE : ACCESS_CACHE_HOT;
+        HTTPServerConnection_Request* request = _Request->request;
+        trace_mark(&request->trace, TRACE_CACHED);
+        HTTPServerConnection_AddHeader(request, "Vary", WeatherServerRequest_Vary(_Request));
+        WeatherServerRequest_FlagStale(_Request, _Request->cache);
+        if (WeatherServerRoute_WeatherDelta(_Request, latitude, longitude, &hit)) return 1;
+        if (hit.last_modified > 0) {
+            char key[Weather_SURROGATE_KEY_SIZE];
+            weather_surrogate_key(latitude, longitude, key, sizeof(key));
+            WeatherServerRequest_AddFreshness(_Request, hit.last_modified, weather_fresh_until(hit.last_modified), key);
+        }
+        if (http_conditional_is_current(&_Request->conditional, hit.etag, hit.last_modified)) {
+            HTTPServerConnection_SetValidators(request, hit.etag, hit.last_modified);
+            HTTPServerConnection_SendNotModified(request);
+            return 1;
+        }
+        // A reference, the entry may be replaced before this response is out;
+        // the validator lines come with it
+        HTTPServerConnection_SendResponse_Blob(request, 200, hit.blob, hit.encoding,
+                                               (char*)WeatherServerRequest_ContentType(_Request));
+        return 1;
+    }
+
+    _Request->hot_missed = 1;
+    return 0;
+}
+
+static int WeatherServerRoute_Weather(WeatherServerRequest* _Request) {
+    if (!_Request->hot_missed && WeatherServerRoute_WeatherAnswer(_Request)) return 1;
+    double latitude, longitude;
+    if (!WeatherServerRoute_WeatherLocation(_Request, &latitude, &longitude)) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Missing parameters\n", "text/plain");
+        return 1;
+    }
+    const WeatherServerRequestParams* params = &_Request->params;
+    if (params->fields != NULL && params->field_set == 0) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Unknown field\n", "text/plain");
+        return 1;
+    }
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    void** backend_struct = &_Request->backend.backend_struct;
+    weather_set_location(backend_struct, latitude, longitude);
+    uint32_t fields = WeatherServerRequest_FieldSet(_Request);
+    if (fields != 0) {
+        weather_set_fields(backend_struct, fields, _Request->encoding);
+    } else {
+        weather_set_encoding(backend_struct, _Request->encoding);
+    }
+    weather_set_conditional(backend_struct, &_Request->conditional);
+    return 0;
+}
+
+/* a node that found this one owns the location asks for its record */
+static int WeatherServerRoute_PeerWeather(WeatherServerRequest* _Request) {
+    double latitude, longitude;
+    if (!WeatherServerRoute_WeatherLocation(_Request, &latitude, &longitude)) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Missing parameters\n", "text/plain");
+        return 1;
+    }
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    void** backend_struct = &_Request->backend.backend_struct;
+    weather_set_location(backend_struct, latitude, longitude);
+    weather_set_peer(backend_struct);
+    return 0;
+}
+
+/* the forecast of a place by its name, one request where a client would make two */
+static int WeatherServerRoute_WeatherByName(WeatherServerRequest* _Request) {
+    const WeatherServerRequestParams* params = &_Request->params;
+    if (params->name == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Missing 'name' parameter\n", "text/plain");
+        return 1;
+    }
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    if (weather_by_name_set_parameters(&_Request->backend.backend_struct, params->name, params->country_code) != 0) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    return 0;
+}
+
+/* names is a comma separated list, every name escaped on its own so one
+   may hold a comma (%2C); count and countryCode go for all of them */
+static int WeatherServerRoute_LocationBatch(WeatherServerRequest* _Request) {
+    const WeatherServerRequestParams* params = &_Request->params;
+    HTTPQueryView query;
+    HTTPQueryView_parse(&query, _Request->request->url);
+    HTTPStringView names = {NULL, 0};
+    for (int i = 0; i < query.Count; i++) {
+        const HTTPQueryViewParameter* param = &query.Query[i];
+        if (param->Name.length == 5 && memcmp(param->Name.data, "names", 5) == 0 && param->HasValue) {
+            names = param->Value;
+            break;
+        }
+    }
+    int count = 0;
+    for (size_t i = 0; i < names.length; i++) count += names.data[i] == ',';
+    if (names.length == 0 || count >= Geolocation_BATCH_MAX_NAMES) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Expected a list of names\n",
+                                          "text/plain");
+        return 1;
+    }
+    char* decoded = (char*)arena_alloc(&_Request->arena, names.length);
+    if (decoded == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    void** batch = &_Request->backend.backend_struct;
+    int location_count = params->count >= 0 ? params->count : WeatherServerInstance_DEFAULT_LOCATION_COUNT;
+    int result = geolocation_batch_set_parameters(batch, location_count, params->country_code);
+    size_t start = 0;
+    for (size_t i = 0; i <= names.length && result == 0; i++) {
+        if (i < names.length && names.data[i] != ',') continue;
+        size_t length = url_codec_decode(names.data + start, i - start, decoded);
+        if (length > 0) result = geolocation_batch_add_name(batch, decoded, length);
+        start = i + 1;
+    }
+    if (result != 0) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    return 0;
+}
+
+/* lat and lon are comma separated lists (or repeated), paired in order */
+static int WeatherServerRequest_ParseList(HTTPStringView _Value, double* _Out, int* _Count) {
+    size_t start = 0;
+    for (size_t i = 0; i <= _Value.length; i++) {
+        if (i < _Value.length && _Value.data[i] != ',') continue;
+        HTTPStringView item = {_Value.data + start, i - start};
+        if (*_Count >= Weather_BATCH_MAX_LOCATIONS || item.length == 0 ||
+            WeatherServerRequest_ParseDouble(item, &_Out[(*_Count)++]) != 0) {
+            return -1;
+        }
+        start = i + 1;
+    }
+    return 0;
+}
+
+static int WeatherServerRoute_WeatherBatch(WeatherServerRequest* _Request) {
+    HTTPQueryView query;
+    HTTPQueryView_parse(&query, _Request->request->url);
+    double latitudes[Weather_BATCH_MAX_LOCATIONS];
+    double longitudes[Weather_BATCH_MAX_LOCATIONS];
+    int latitude_count = 0, longitude_count = 0, valid = 1;
+    for (int i = 0; i < query.Count && valid; i++) {
+        const HTTPQueryViewParameter* param = &query.Query[i];
+        if (param->Name.length != 3 || !param->HasValue) continue;
+        /* decoded first, a client may escape the commas */
+        HTTPStringView value = param->Value;
+        char* decoded = arena_strndup(&_Request->arena, value.data, value.length);
+        if (decoded != NULL) {
+            value.length = url_codec_decode(decoded, value.length, decoded);
+            value.data = decoded;
+        }
+        if (memcmp(param->Name.data, "lat", 3) == 0) {
+            valid = WeatherServerRequest_ParseList(value, latitudes, &latitude_count) == 0;
+        } else if (memcmp(param->Name.data, "lon", 3) == 0) {
+            valid = WeatherServerRequest_ParseList(value, longitudes, &longitude_count) == 0;
+        }
+    }
+    if (!valid || latitude_count == 0 || latitude_count != longitude_count) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Expected lat/lon pairs\n", "text/plain");
+        return 1;
+    }
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    for (int i = 0; i < latitude_count; i++) {
+        weather_quantize(&latitudes[i], &longitudes[i]);
+        weather_batch_add_location(&_Request->backend.backend_struct, latitudes[i], longitudes[i]);
+    }
+    return 0;
+}
+
+/* the seconds a from or to stands for: unix seconds, a UTC day and time
+   ("2024-05-01T12:00") or a day, its first second or for _End its last */
+static int WeatherServerRequest_ParseTime(const char* _Text, int _End, time_t* _Out) {
+    char* end = NULL;
+    long long seconds = strtoll(_Text, &end, 10);
+    if (end != _Text && *end == '\0') {
+        *_Out = (time_t)seconds;
+        return 0;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int consumed = 0;
+    int fields = sscanf(_Text, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &consumed);
+    if (fields != 3) return -1;
+    if (_Text[consumed] == 'T') {
+        int length = 0;
+        if (sscanf(_Text + consumed, "T%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &length) != 2) return -1;
+        consumed += length;
+        if (_Text[consumed] == ':') {
+            if (sscanf(_Text + consumed, ":%2d%n", &tm.tm_sec, &length) != 1) return -1;
+            consumed += length;
+        }
+        if (_Text[consumed] == 'Z') consumed++;
+    } else if (_End) {
+        tm.tm_hour = 23;
+        tm.tm_min = 59;
+        tm.tm_sec = 59;
+    }
+    if (_Text[consumed] != '\0' || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31) return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *_Out = timegm(&tm);
+    return 0;
+}
+
+/* a location's observations, the last WeatherServerInstance_HISTORY_DAYS
+   days unless from and to say otherwise; answered from this node alone */
+static int WeatherServerRoute_WeatherHistory(WeatherServerRequest* _Request) {
+    double latitude, longitude;
+    if (!WeatherServerRoute_WeatherLocation(_Request, &latitude, &longitude)) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Missing parameters\n", "text/plain");
+        return 1;
+    }
+    const WeatherServerRequestParams* params = &_Request->params;
+    time_t to = time(NULL);
+    time_t from;
+    if (params->to != NULL && WeatherServerRequest_ParseTime(params->to, 1, &to) != 0) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Invalid 'to'\n", "text/plain");
+        return 1;
+    }
+    from = to - (time_t)WeatherServerInstance_HISTORY_DAYS * 86400;
+    if (params->from != NULL && WeatherServerRequest_ParseTime(params->from, 0, &from) != 0) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Invalid 'from'\n", "text/plain");
+        return 1;
+    }
+    if (from > to || to - from > (time_t)Weather_ARCHIVE_RETAIN_DAYS * 86400) {
+        HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: Range empty or too long\n",
+                                          "text/plain");
+        return 1;
+    }
+
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    weather_history_set_range(&_Request->backend.backend_struct, latitude, longitude, from, to);
+    return 0;
+}
+
+static int WeatherServerRoute_Surprise(WeatherServerRequest* _Request) {
+    if (WeatherServerRequest_InitBackend(_Request) != 0) return 1;
+    // The smallest encoding the client decodes, a thumbnail with ?size=small
+    size_t accept_length = 0;
+    const char* accept = HTTPServerConnection_GetKnownHeader(_Request->request, HTTPHeader_Accept, &accept_length);
+    int small = _Request->params.size != NULL && strcmp(_Request->params.size, "small") == 0;
+    surprise_set_variant(&_Request->backend.backend_struct, surprise_accepts(accept, accept_length), small);
+    HTTPServerConnection_AddHeader(_Request->request, "Vary", "Accept");
+    // A stable URL for each file, what caches can keep
+    if (_Request->params.name != NULL &&
+        surprise_set_name(&_Request->backend.backend_struct, _Request->params.name) != 0) {
+        HTTPServerConnection_SendResponse(_Request->request, 404, "Not Found\n", "text/plain");
+        return 1;
+    }
+    // A resumed download continues the file it started with, not a new pick
+    size_t length = 0;
+    const char* if_range = HTTPServerConnection_GetKnownHeader(_Request->request, HTTPHeader_IfRange, &length);
+    if (if_range != NULL) surprise_set_resume(&_Request->backend.backend_struct, if_range, length);
+    return 0;
+}
+
+/* a chunk of the exposition at a time as the socket drains, a scrape never
+   holds the loop for longer than one chunk takes to render */
+static int WeatherServerRoute_MetricsRead(void* _Context, uint8_t* _Buffer, int _Size) {
+    WeatherServerRequest* request = (WeatherServerRequest*)_Context;
+    return metrics_render(request->metrics, (char*)_Buffer, _Size);
+}
+
+static int WeatherServerRoute_Metrics(WeatherServerRequest* _Request) {
+    _Request->metrics = (metrics_cursor*)arena_alloc(&_Request->arena, sizeof(metrics_cursor));
+    if (_Request->metrics == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    metrics_cursor_init(_Request->metrics);
+    HTTPServerConnection_SendResponse_Stream(_Request->request, 200, "text/plain; version=0.0.4; charset=utf-8", -1,
+                                             WeatherServerRoute_MetricsRead, _Request);
+    return 1;
+}
+
+/* a /subscribeweather stream: every newer forecast of its location is an
+   event, id the forecast's Last-Modified, data its (compact, single line)
+   JSON. next is the newest one not begun yet and sending the one being
+   written, both references; waiting once the connection is left to wait
+   for HTTPServerConnection_ResumeStream. */
+struct WeatherServerSubscription {
+    subscription subscriber;
+    HTTPServerConnection_Request* request;
+    const response_blob* next;
+    const response_blob* sending;
+    char prefix[64];
+    size_t prefix_length;
+    size_t offset;
+    time_t sent;
+    uint64_t last_write;
+    int heartbeat;
+    int waiting;
+    /* the loop's streams, for the heartbeat */
+    WeatherServerSubscription* prev_stream;
+    WeatherServerSubscription* next_stream;
+};
+
+static __thread WeatherServerSubscription* t_streams = NULL;
+static __thread smw_task* t_heartbeatTask = NULL;
+
+static void WeatherServerSubscription_Resume(WeatherServerSubscription* _Subscription) {
+    if (!_Subscription->waiting) return;
+    _Subscription->waiting = 0;
+    HTTPServerConnection_ResumeStream(_Subscription->request);
+}
+
+/* a comment on every stream quiet for half the period, so none goes a whole
+   one (and the connection's timeout) without a write */
+static void WeatherServerSubscription_HeartbeatWork(void* _Context, uint64_t _MonTime) {
+    (void)_Context;
+    for (WeatherServerSubscription* subscription = t_streams; subscription; subscription = subscription->next_stream) {
+        if (_MonTime - subscription->last_write < WeatherServerInstance_SSE_HEARTBEAT_MS / 2) continue;
+        subscription->heartbeat = 1;
+        WeatherServerSubscription_Resume(subscription);
+    }
+    smw_setDeadline(t_heartbeatTask, _MonTime + WeatherServerInstance_SSE_HEARTBEAT_MS);
+}
+
+static void WeatherServerSubscription_OnUpdate(void* _Context, const response_blob* _Blob) {
+    WeatherServerSubscription* subscription = (WeatherServerSubscription*)_Context;
+    const response_blob* newest = subscription->next ? subscription->next : subscription->sending;
+    time_t known = newest ? newest->last_modified : subscription->sent;
+    if (_Blob->last_modified <= known) return;
+    response_blob_retain(_Blob);
+    response_blob_release(subscription->next);
+    subscription->next = _Blob;
+    WeatherServerSubscription_Resume(subscription);
+}
+
+static int WeatherServerSubscription_Read(void* _Context, uint8_t* _Buffer, int _Size) {
+    WeatherServerSubscription* subscription = ((WeatherServerRequest*)_Context)->subscription;
+    if (subscription->sending == NULL && subscription->next != NULL) {
+        subscription->sending = subscription->next;
+        subscription->next = NULL;
+        subscription->offset = 0;
+        subscription->prefix_length = (size_t)snprintf(subscription->prefix, sizeof(subscription->prefix),
+                                                       "id: %lld\nevent: weather\ndata: ",
+                                                       (long long)subscription->sending->last_modified);
+    }
+    subscription->last_write = SystemMonotonicMS();
+
+    if (subscription->sending != NULL) {
+        /* the prefix, the shared body and the blank line ending the event,
+           as far as the chunk takes them */
+        const uint8_t* body = subscription->sending->bodies[COMPRESS_IDENTITY];
+        size_t body_length = subscription->sending->lengths[COMPRESS_IDENTITY];
+        size_t prefix_length = subscription->prefix_length;
+        size_t total = prefix_length + body_length + 2;
+        size_t n = 0;
+        while (n < (size_t)_Size && subscription->offset < total) {
+            size_t at = subscription->offset;
+            const uint8_t* from;
+            size_t length;
+            if (at < prefix_length) {
+                from = (const uint8_t*)subscription->prefix + at;
+                length = prefix_length - at;
+            } else if (at < prefix_length + body_length) {
+                from = body + (at - prefix_length);
+                length = prefix_length + body_length - at;
+            } else {
+                from = (const uint8_t*)"\n\n" + (at - prefix_length - body_length);
+                length = total - at;
+            }
+            if (length > (size_t)_Size - n) length = (size_t)_Size - n;
+            memcpy(_Buffer + n, from, length);
+            n += length;
+            subscription->offset += length;
+        }
+        if (subscription->offset == total) {
+            subscription->sent = subscription->sending->last_modified;
+            response_blob_release(subscription->sending);
+            subscription->sending = NULL;
+            subscription->heartbeat = 0;
+        }
+        return (int)n;
+    }
+    if (subscription->heartbeat) {
+        subscription->heartbeat = 0;
+        memcpy(_Buffer, ":\n\n", 3);
+        return 3;
+    }
+    subscription->waiting = 1;
+    return HTTPServerConnection_STREAM_AGAIN;
+}
+
+static void WeatherServerSubscription_Release(WeatherServerSubscription* _Subscription) {
+    weather_unsubscribe(&_Subscription->subscriber);
+    if (_Subscription->prev_stream) {
+        _Subscription->prev_stream->next_stream = _Subscription->next_stream;
+    } else {
+        t_streams = _Subscription->next_stream;
+    }
+    if (_Subscription->next_stream) _Subscription->next_stream->prev_stream = _Subscription->prev_stream;
+    response_blob_release(_Subscription->next);
+    response_blob_release(_Subscription->sending);
+}
+
+/* text/event-stream of the location's forecasts, the one the loop has
+   first and every newer one as it arrives; the connection stays open */
+static int WeatherServerRoute_Subscribe(WeatherServerRequest* _Request) {
+    HTTPServerConnection_Request* request = _Request->request;
+    WeatherServerRequestParams* params = &_Request->params;
+    if (!params->has_location && params->city != NULL &&
+        cities_find(params->city, &params->latitude, &params->longitude) == 0) {
+        params->has_location = 1;
+    }
+    if (!params->has_location) {
+        HTTPServerConnection_SendResponse(request, 400, "Bad Request: Missing parameters\n", "text/plain");
+        return 1;
+    }
+    if (t_heartbeatTask == NULL) {
+        t_heartbeatTask = smw_createTask(NULL, WeatherServerSubscription_HeartbeatWork);
+        if (t_heartbeatTask != NULL) {
+            smw_setTaskName(t_heartbeatTask, "sse_heartbeat");
+            smw_parkTask(t_heartbeatTask);
+            smw_setDeadline(t_heartbeatTask, SystemMonotonicMS() + WeatherServerInstance_SSE_HEARTBEAT_MS);
+        }
+    }
+    WeatherServerSubscription* subscription =
+        (WeatherServerSubscription*)arena_alloc(&_Request->arena, sizeof(WeatherServerSubscription));
+    if (subscription == NULL || t_heartbeatTask == NULL) {
+        HTTPServerConnection_SendResponse(request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    memset(subscription, 0, sizeof(WeatherServerSubscription));
+    subscription->request = request;
+    subscription->last_write = SystemMonotonicMS();
+    subscription->next_stream = t_streams;
+    if (t_streams) t_streams->prev_stream = subscription;
+    t_streams = subscription;
+    _Request->subscription = subscription;
+
+    double latitude = params->latitude;
+    double longitude = params->longitude;
+    weather_quantize(&latitude, &longitude);
+    if (weather_subscribe(&subscription->subscriber, latitude, longitude, WeatherServerSubscription_OnUpdate,
+                          subscription, &subscription->next) != 0) {
+        HTTPServerConnection_SendResponse(request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    /* proxies pass the events on as they come */
+    HTTPServerConnection_AddHeader(request, "Cache-Control", "no-cache");
+    HTTPServerConnection_SendResponse_Stream(request, 200, "text/event-stream", -1, WeatherServerSubscription_Read,
+                                             _Request);
+    return 1;
+}
+
+/* --admin-token, empty without one */
+static char g_adminToken[WeatherServerInstance_ADMIN_TOKEN_MAX + 1];
+static size_t g_adminTokenLength = 0;
+
+int WeatherServerInstance_SetAdminToken(const char* _Token) {
+    char buffer[WeatherServerInstance_ADMIN_TOKEN_MAX + 2];
+    const char* token = _Token;
+    if (_Token[0] == '@') {
+        FILE* file = fopen(_Token + 1, "r");
+        if (file == NULL) return -1;
+        size_t read = fread(buffer, 1, sizeof(buffer) - 1, file);
+        fclose(file);
+        buffer[read] = '\0';
+        token = buffer;
+    }
+    size_t length = strlen(token);
+    while (length > 0 && (token[length - 1] == '\n' || token[length - 1] == '\r')) length--;
+    if (length == 0 || length > WeatherServerInstance_ADMIN_TOKEN_MAX) return -1;
+    for (size_t i = 0; i < length; i++) {
+        if (token[i] <= ' ' || token[i] >= 0x7f) return -1;
+    }
+    memcpy(g_adminToken, token, length);
+    g_adminToken[length] = '\0';
+    g_adminTokenLength = length;
+    return 0;
+}
+
+/* 1 once a request for an operator route is answered 403. Never for a page in
+   a browser (Origin) or through a proxy, which would make anyone local; then
+   with --admin-token the client presents it, without one it is on this host */
+static int WeatherServerRequest_Forbidden(WeatherServerRequest* _Request) {
+    HTTPServerConnection_Request* request = _Request->request;
+    // Whatever the answer, no page of another origin gets to read it
+    request->noCors = 1;
+    size_t length = 0;
+    int allowed = HTTPServerConnection_GetHeader(request, "Origin", &length) == NULL &&
+                  HTTPServerConnection_GetHeader(request, "Forwarded", &length) == NULL &&
+                  HTTPServerConnection_GetHeader(request, "X-Forwarded-For", &length) == NULL;
+    if (allowed && g_adminTokenLength > 0) {
+        const char* authorization = HTTPServerConnection_GetHeader(request, "Authorization", &length);
+        allowed = authorization != NULL && length == g_adminTokenLength + 7 &&
+                  strncasecmp(authorization, "Bearer ", 7) == 0;
+        // Every byte compared, how long a wrong token took tells nothing
+        unsigned char difference = 0;
+        for (size_t i = 0; allowed && i < g_adminTokenLength; i++) {
+            difference |= (unsigned char)(authorization[7 + i] ^ g_adminToken[i]);
+        }
+        allowed = allowed && difference == 0;
+    } else if (allowed) {
+        allowed = conn_peer_is_local(_Request->instance->connection->conn);
+    }
+    if (allowed) return 0;
+    HTTPServerConnection_SendResponse(request, Forbidden, "Forbidden\n", "text/plain");
+    return 1;
+}
+
+static int WeatherServerRoute_Stats(WeatherServerRequest* _Request) {
+    HTTPServerConnection_Request* request = _Request->request;
+    if (WeatherServerRequest_Forbidden(_Request)) return 1;
+    if (_Request->params.reset && request->method != POST) {
+        HTTPServerConnection_AddHeader(request, "Allow", "POST");
+        HTTPServerConnection_SendResponse(request, Method_Not_Allowed, "Method Not Allowed: reset is a POST\n",
+                                          "text/plain");
+        return 1;
+    }
+    // Loop stats of the worker that happens to serve this request
+    // Lives until the response is sent, no copy needed
+    char* json = WeatherServerInstance_StatsJson(&_Request->arena);
+    if (json == NULL) {
+        HTTPServerConnection_SendResponse(request, 500, "Internal Server Error\n", "text/plain");
+    } else {
+        HTTPServerConnection_SendResponse_Binary(request, 200, (uint8_t*)json, strlen(json), "application/json");
+    }
+    if (_Request->params.reset) smw_resetStats();
+    return 1;
+}
+
+static int WeatherServerRoute_CacheOnly(WeatherServerRequest* _Request) {
+    if (WeatherServerRequest_Forbidden(_Request)) return 1;
+    const char* mode = _Request->params.mode;
+    if (mode != NULL && _Request->request->method != POST) {
+        HTTPServerConnection_AddHeader(_Request->request, "Allow", "POST");
+        HTTPServerConnection_SendResponse(_Request->request, Method_Not_Allowed,
+                                          "Method Not Allowed: a mode is set by POST\n", "text/plain");
+        return 1;
+    }
+    if (mode != NULL) {
+        cache_only_setting setting;
+        if (cache_only_parse(mode, strlen(mode), &setting) != 0) {
+            HTTPServerConnection_SendResponse(_Request->request, 400, "Bad Request: mode is auto, on or off\n",
+                                              "text/plain");
+            return 1;
+        }
+        cache_only_set(setting);
+        LOG_INFO("WeatherServerInstance: Cache-only mode %s", cache_only_name(setting));
+    }
+    // active is this loop's view, auto may differ between loops
+    char* json = (char*)arena_alloc(&_Request->arena, 64);
+    if (json != NULL) {
+        snprintf(json, 64, "{\"mode\":\"%s\",\"active\":%s}\n", cache_only_name(cache_only_get()),
+                 cache_only_active() ? "true" : "false");
+    }
+    if (json == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+    } else {
+        HTTPServerConnection_SendResponse_Binary(_Request->request, 200, (uint8_t*)json, strlen(json),
+                                                 "application/json");
+    }
+    return 1;
+}
+
+static int WeatherServerRoute_Config(WeatherServerRequest* _Request) {
+    if (WeatherServerRequest_Forbidden(_Request)) return 1;
+    // Every knob in the query in one new version, none of them if one is bad
+    HTTPQueryView query;
+    HTTPQueryView_parse(&query, _Request->request->url);
+    if (query.Count > 0 && _Request->request->method != POST) {
+        HTTPServerConnection_AddHeader(_Request->request, "Allow", "POST");
+        HTTPServerConnection_SendResponse(_Request->request, Method_Not_Allowed,
+                                          "Method Not Allowed: knobs are changed by POST\n", "text/plain");
+        return 1;
+    }
+    if (query.Count > 0) {
+        tuning draft = *tuning_get();
+        for (int i = 0; i < query.Count; i++) {
+            const HTTPQueryViewParameter* param = &query.Query[i];
+            if (tuning_parse(&draft, param->Name.data, param->Name.length, param->Value.data, param->Value.length) != 0) {
+                char* message = (char*)arena_alloc(&_Request->arena, 96);
+                if (message != NULL) {
+                    snprintf(message, 96, "Bad Request: %.*s is not a knob or out of its range\n",
+                             (int)(param->Name.length > 48 ? 48 : param->Name.length), param->Name.data);
+                }
+                HTTPServerConnection_SendResponse(_Request->request, 400, message ? message : "Bad Request\n",
+                                                  "text/plain");
+                return 1;
+            }
+        }
+        if (tuning_publish(&draft) != 0) {
+            HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+            return 1;
+        }
+        LOG_INFO("WeatherServerInstance: Tuning changed, %d knobs", query.Count);
+    }
+    int length = tuning_format(tuning_get(), NULL, 0);
+    char* json = length > 0 ? (char*)arena_alloc(&_Request->arena, (size_t)length + 1) : NULL;
+    if (json == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+        return 1;
+    }
+    tuning_format(tuning_get(), json, (size_t)length + 1);
+    HTTPServerConnection_SendResponse_Binary(_Request->request, 200, (uint8_t*)json, (size_t)length, "application/json");
+    return 1;
+}
+
+static int WeatherServerRoute_DebugMemory(WeatherServerRequest* _Request) {
+    if (WeatherServerRequest_Forbidden(_Request)) return 1;
+    char* json = WeatherServerInstance_MemoryJson(&_Request->arena);
+    if (json == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+    } else {
+        HTTPServerConnection_SendResponse_Binary(_Request->request, 200, (uint8_t*)json, strlen(json),
+                                                 "application/json");
+    }
+    return 1;
+}
+
+static int WeatherServerRoute_HotKeys(WeatherServerRequest* _Request) {
+    if (WeatherServerRequest_Forbidden(_Request)) return 1;
+    char* json = WeatherServerInstance_HotKeysJson(&_Request->arena);
+    if (json == NULL) {
+        HTTPServerConnection_SendResponse(_Request->request, 500, "Internal Server Error\n", "text/plain");
+    } else {
+        HTTPServerConnection_SendResponse_Binary(_Request->request, 200, (uint8_t*)json, strlen(json),
+                                                 "application/json");
+    }
+    return 1;
+}
+
+/* content type, cache, TTL, cost, concurrency, streaming */
+static const WeatherServerRouteDescriptor g_citiesRoute = {"application/json", WeatherServerCache_Own, 0,
+                                                           WeatherServerCost_Disk, 0, 0};
+static const WeatherServerRouteDescriptor g_upstreamRoute = {"application/json", WeatherServerCache_Own, 0,
+                                                             WeatherServerCost_Upstream, 0, 0};
+static const WeatherServerRouteDescriptor g_weatherBatchRoute = {
+    "application/json", WeatherServerCache_Micro, WeatherServerInstance_MICRO_CACHE_TTL_S, WeatherServerCost_Upstream,
+    WeatherServerInstance_BATCH_CONCURRENCY, 0};
+static const WeatherServerRouteDescriptor g_weatherByNameRoute = {
+    "application/json", WeatherServerCache_Micro, WeatherServerInstance_MICRO_CACHE_TTL_S, WeatherServerCost_Upstream,
+    0, 0};
+static const WeatherServerRouteDescriptor g_weatherHistoryRoute = {
+    "application/json", WeatherServerCache_Micro, WeatherServerInstance_MICRO_CACHE_TTL_S, WeatherServerCost_Disk, 0, 0};
+static const WeatherServerRouteDescriptor g_locationBatchRoute = {
+    "application/x-ndjson", WeatherServerCache_None, 0, WeatherServerCost_Upstream,
+    WeatherServerInstance_LOCATION_BATCH_CONCURRENCY, 1};
+static const WeatherServerRouteDescriptor g_nearestRoute = {"application/json", WeatherServerCache_None, 0,
+                                                            WeatherServerCost_Local, 0, 0};
+static const WeatherServerRouteDescriptor g_citiesWeatherRoute = {"application/json", WeatherServerCache_Own, 0,
+                                                                  WeatherServerCost_Local, 0, 0};
+static const WeatherServerRouteDescriptor g_surpriseRoute = {"image/png", WeatherServerCache_None, 0,
+                                                             WeatherServerCost_Disk, 0, 0};
+static const WeatherServerRouteDescriptor g_adminRoute = {"application/json", WeatherServerCache_None, 0,
+                                                          WeatherServerCost_Local, 0, 0};
+static const WeatherServerRouteDescriptor g_adminTextRoute = {"text/plain", WeatherServerCache_None, 0,
+                                                              WeatherServerCost_Local, 0, 0};
+static const WeatherServerRouteDescriptor g_metricsRoute = {"text/plain", WeatherServerCache_None, 0,
+                                                            WeatherServerCost_Local, 0, 1};
+static const WeatherServerRouteDescriptor g_subscribeRoute = {"text/event-stream", WeatherServerCache_None, 0,
+                                                              WeatherServerCost_Local, 0, 1};
+static const WeatherServerRouteDescriptor g_peerWeatherRoute = {"application/octet-stream", WeatherServerCache_Own, 0,
+                                                                WeatherServerCost_Peer, 0, 0};
+
+static const WeatherServerRoute g_routes[] = {
+    {"/getcities", WeatherServerRoute_Cities, &g_citiesOps, &g_citiesRoute, 0, 1, "cities_work", ACCESS_ROUTE_CITIES,
+     1, WeatherServerRoute_CitiesAnswer, 1},
+    {"/getlocation", WeatherServerRoute_Geolocation, &g_geolocationOps, &g_upstreamRoute, 0, 1, "geolocation_work",
+     ACCESS_ROUTE_LOCATION, 1, NULL, 1},
+    /* ?names=a,b,..[&count=][&countryCode=], NDJSON as they are found */
+    {"/getlocationbatch", WeatherServerRoute_LocationBatch, &g_locationBatchOps, &g_locationBatchRoute, 0, 0,
+     "geolocation_batch_work", ACCESS_ROUTE_LOCATION_BATCH, 1},
+    {"/getnearest", WeatherServerRoute_Nearest, NULL, &g_nearestRoute, 0, 0, NULL, ACCESS_ROUTE_NEAREST, 1},
+    {"/getweather", WeatherServerRoute_Weather, &g_weatherOps, &g_upstreamRoute, 0, 1, "weather_work",
+     ACCESS_ROUTE_WEATHER, 1, WeatherServerRoute_WeatherAnswer, 1},
+    {"/getweatherbatch", WeatherServerRoute_WeatherBatch, &g_weatherBatchOps, &g_weatherBatchRoute, 0, 1,
+     "weather_batch_work", ACCESS_ROUTE_WEATHER_BATCH, 1},
+    {"/getweatherbyname", WeatherServerRoute_WeatherByName, &g_weatherByNameOps, &g_weatherByNameRoute, 0, 1,
+     "weather_by_name_work", ACCESS_ROUTE_WEATHER_BY_NAME, 1},
+    /* ?lat=&lon=&from=&to=, what this node archived */
+    {"/getweatherhistory", WeatherServerRoute_WeatherHistory, &g_weatherHistoryOps, &g_weatherHistoryRoute, 0, 1,
+     "weather_history_work", ACCESS_ROUTE_WEATHER_HISTORY, 1, NULL, 1},
+    {"/getcitiesweather", WeatherServerRoute_CitiesWeather, NULL, &g_citiesWeatherRoute, 0, 1, NULL,
+     ACCESS_ROUTE_CITIES_WEATHER, 1, WeatherServerRoute_CitiesWeatherAnswer},
+    {"/getsurprise", WeatherServerRoute_Surprise, &g_surpriseOps, &g_surpriseRoute, 1, 0, "surprise_work",
+     ACCESS_ROUTE_SURPRISE, 1},
+    /* a POST of ?reset=1 clears the counters */
+    {"/admin/stats", WeatherServerRoute_Stats, NULL, &g_adminRoute, 0, 0, NULL, ACCESS_ROUTE_STATS, 0},
+    {"/admin/reloadcities", WeatherServerRoute_ReloadCities, NULL, &g_adminTextRoute, 0, 0, NULL,
+     ACCESS_ROUTE_RELOAD_CITIES, 0},
+    /* a POST of ?mode=auto|on|off switches it */
+    {"/admin/cacheonly", WeatherServerRoute_CacheOnly, NULL, &g_adminRoute, 0, 0, NULL, ACCESS_ROUTE_CACHE_ONLY, 0},
+    /* a POST of ?NAME=VALUE&.. changes the knobs of utilities/tuning.h */
+    {"/admin/config", WeatherServerRoute_Config, NULL, &g_adminRoute, 0, 0, NULL, ACCESS_ROUTE_CONFIG, 0},
+    {"/metrics", WeatherServerRoute_Metrics, NULL, &g_metricsRoute, 0, 0, NULL, ACCESS_ROUTE_METRICS, 0},
+    {"/debug/memory", WeatherServerRoute_DebugMemory, NULL, &g_adminRoute, 0, 0, NULL, ACCESS_ROUTE_DEBUG_MEMORY, 0},
+    /* the hottest locations and searches of all loops */
+    {"/admin/hotkeys", WeatherServerRoute_HotKeys, NULL, &g_adminRoute, 0, 0, NULL, ACCESS_ROUTE_HOT_KEYS, 0},
+    {"/subscribeweather", WeatherServerRoute_Subscribe, NULL, &g_subscribeRoute, 0, 0, NULL, ACCESS_ROUTE_SUBSCRIBE,
+     1},
+    /* the peer tier, --peers */
+    {"/peer/weather", WeatherServerRoute_PeerWeather, &g_peerWeatherOps, &g_peerWeatherRoute, 1, 0,
+     "peer_weather_work", ACCESS_ROUTE_PEER_WEATHER, 0},
+};
+#define WeatherServerInstance_ROUTE_COUNT ((int)(sizeof(g_routes) / sizeof(g_routes[0])))
+
+/* paths of g_routes, read only once WeatherServerInstance_GlobalInit returns */
+static perfect_hash g_routeTable;
+/* latency of each route from the request to its response being sent, the
+   last one for paths that matched none */
+static metrics_histogram g_routeLatency[WeatherServerInstance_ROUTE_COUNT + 1];
+static char g_routeLabels[WeatherServerInstance_ROUTE_COUNT + 1][48];
+/* backends of each route running on this loop, for the descriptors'
+   max_concurrency */
+static __thread int t_routeBackends[WeatherServerInstance_ROUTE_COUNT];
+
+/* 1 if the request may start its route's backend, else it was answered 503:
+   the loop sheds what is not answered from memory while overloaded, and a
+   route has at most max_concurrency backends running */
+static int WeatherServerRequest_Admit(WeatherServerRequest* _Request) {
+    const WeatherServerRoute* route = _Request->backend.route;
+    const WeatherServerRouteDescriptor* descriptor = route->descriptor;
+    if (descriptor->cost != WeatherServerCost_Local && admission_shed(&t_admission, _Request->queued_ms)) {
+        WeatherServerRequest_SendUnavailable(_Request, &g_shedRequests);
+        return 0;
+    }
+    int index = (int)(route - g_routes);
+    if (descriptor->max_concurrency > 0 && t_routeBackends[index] >= descriptor->max_concurrency) {
+        WeatherServerRequest_SendUnavailable(_Request, &g_routeBusy);
+        return 0;
+    }
+    t_routeBackends[index]++;
+    _Request->admitted = 1;
+    return 1;
+}
+
+/* stops the backend if it runs and gives its slot back */
+static void WeatherServerRequest_DisposeBackend(WeatherServerRequest* _Request) {
+    WeatherServerBackend* backend = &_Request->backend;
+    if (backend->backend_struct != NULL) {
+        backend->route->ops->dispose(&backend->backend_struct);
+    }
+    if (_Request->admitted) {
+        t_routeBackends[backend->route - g_routes]--;
+        _Request->admitted = 0;
+    }
+}
+
+static void WeatherServerInstance_RegisterMetrics(void) {
+    for (int i = 0; i <= WeatherServerInstance_ROUTE_COUNT; i++) {
+        snprintf(g_routeLabels[i], sizeof(g_routeLabels[i]), "route=\"%s\"",
+                 i < WeatherServerInstance_ROUTE_COUNT ? g_routes[i].path : "other");
+        metrics_register("http_request_duration_seconds", "Time from a request to its response being sent, by route.",
+                         METRICS_HISTOGRAM, g_routeLabels[i], &g_routeLatency[i]);
+    }
+    metrics_register("http_request_queue_seconds", "Time from a request to its route being started.",
+                     METRICS_HISTOGRAM, NULL, &g_queueDelay);
+    metrics_register("http_requests_shed_total", "Cache misses answered 503, queue delay above its target.",
+                     METRICS_COUNTER, NULL, &g_shedRequests);
+    metrics_register("http_requests_over_quota_total", "Cache misses answered 429, the client's cost quota spent.",
+                     METRICS_COUNTER, NULL, &g_overQuota);
+    metrics_register("http_cache_only_misses_total", "Requests answered 503 in cache-only mode, nothing cached.",
+                     METRICS_COUNTER, NULL, &g_cacheOnlyMisses);
+    metrics_register("http_micro_cache_hits_total", "Responses answered from the loop's micro-cache.",
+                     METRICS_COUNTER, NULL, &g_microHits);
+    metrics_register("http_micro_cache_misses_total", "Requests of micro-cached routes the cache had no body for.",
+                     METRICS_COUNTER, NULL, &g_microMisses);
+    metrics_register("http_requests_route_busy_total", "Requests answered 503, their route's backends at its limit.",
+                     METRICS_COUNTER, NULL, &g_routeBusy);
+    metrics_register("http_overloaded_loops", "Loops shedding cache misses right now.", METRICS_GAUGE, NULL,
+                     &g_overloadedLoops);
+    cities_weather_register_metrics();
+    HTTPServerConnection_RegisterMetrics();
+    smw_registerMetrics();
+    loop_mailbox_register_metrics();
+    mem_account_register_metrics();
+}
+
+int WeatherServerInstance_GlobalInit(void) {
+    const char* paths[WeatherServerInstance_ROUTE_COUNT];
+    for (int i = 0; i < WeatherServerInstance_ROUTE_COUNT; i++) {
+        paths[i] = g_routes[i].path;
+        // A streamed body is never whole in one place, nothing could cache it
+        const WeatherServerRouteDescriptor* descriptor = g_routes[i].descriptor;
+        int reads = g_routes[i].ops != NULL && g_routes[i].ops->read != NULL;
+        if ((reads && !descriptor->streaming) ||
+            (descriptor->streaming && descriptor->cache == WeatherServerCache_Micro) ||
+            (descriptor->cache == WeatherServerCache_Micro && descriptor->ttl_s <= 0)) {
+            LOG_ERROR("WeatherServerInstance: route %s contradicts its descriptor", paths[i]);
+            return -1;
+        }
+    }
+    if (perfect_hash_build(&g_routeTable, paths, WeatherServerInstance_ROUTE_COUNT) != 0) return -1;
+    WeatherServerInstance_RegisterMetrics();
+    return 0;
+}
+
+/* a query value as a terminated copy in the arena, NULL if it has none or
+   is longer than _MaxLength */
+static const char* WeatherServerRequest_CopyValue(WeatherServerRequest* _Request, const HTTPQueryViewParameter* _Param,
+                                                  size_t _MaxLength) {
+    if (!_Param->HasValue || _Param->Value.length > _MaxLength) return NULL;
+    char* value = arena_strndup(&_Request->arena, _Param->Value.data, _Param->Value.length);
+    if (value != NULL) value[url_codec_decode(value, _Param->Value.length, value)] = '\0';
+    return value;
+}
+
+static int WeatherServerRequest_ParseDouble(HTTPStringView _Value, double* _Out) {
+    char buffer[32];
+    if (HTTPStringView_copy(_Value, buffer, sizeof(buffer)) == NULL) return -1;
+    buffer[url_codec_decode(buffer, _Value.length, buffer)] = '\0';
+    *_Out = strtod(buffer, NULL);
+    return 0;
+}
+
+/* one pass over the query, names are matched by length first. The first
+   occurrence of a parameter wins, as with HTTPQueryView_getParameter. */
+static void WeatherServerRequest_ParseParams(WeatherServerRequest* _Request) {
+    WeatherServerRequestParams* params = &_Request->params;
+    HTTPQueryView query;
+    HTTPQueryView_parse(&query, _Request->request->url);
+    params->path = query.Path;
+    params->count = -1;
+
+    int has_latitude = 0, has_longitude = 0, has_count = 0, has_reset = 0;
+    for (int i = 0; i < query.Count; i++) {
+        const HTTPQueryViewParameter* param = &query.Query[i];
+        const char* name = param->Name.data;
+        switch (param->Name.length) {
+        case 3:
+            if (!has_latitude && memcmp(name, "lat", 3) == 0 && param->HasValue) {
+                has_latitude = WeatherServerRequest_ParseDouble(param->Value, &params->latitude) == 0;
+            } else if (!has_longitude && memcmp(name, "lon", 3) == 0 && param->HasValue) {
+                has_longitude = WeatherServerRequest_ParseDouble(param->Value, &params->longitude) == 0;
+            }
+            break;
+        case 2:
+            if (params->to == NULL && memcmp(name, "to", 2) == 0) {
+                params->to = WeatherServerRequest_CopyValue(_Request, param, 31);
+            }
+            break;
+        case 4:
+            if (params->from == NULL && memcmp(name, "from", 4) == 0) {
+                params->from = WeatherServerRequest_CopyValue(_Request, param, 31);
+            } else if (params->name == NULL && memcmp(name, "name", 4) == 0) {
+                params->name = WeatherServerRequest_CopyValue(_Request, param, MAX_URL_LEN - 1);
+            } else if (params->city == NULL && memcmp(name, "city", 4) == 0) {
+                params->city = WeatherServerRequest_CopyValue(_Request, param, 255);
+            } else if (params->mode == NULL && memcmp(name, "mode", 4) == 0) {
+                params->mode = WeatherServerRequest_CopyValue(_Request, param, 15);
+            } else if (params->size == NULL && memcmp(name, "size", 4) == 0) {
+                params->size = WeatherServerRequest_CopyValue(_Request, param, 15);
+            }
+            break;
+        case 5:
+            if (!has_count && memcmp(name, "count", 5) == 0) {
+                char buffer[16];
+                has_count = 1;
+                if (param->HasValue && HTTPStringView_copy(param->Value, buffer, sizeof(buffer)) != NULL) {
+                    params->count = (int)strtol(buffer, NULL, 10);
+                }
+            } else if (!has_reset && memcmp(name, "reset", 5) == 0) {
+                has_reset = 1;
+                params->reset = HTTPStringView_equals(param->Value, "1");
+            } else if (params->since == NULL && memcmp(name, "since", 5) == 0) {
+                params->since = WeatherServerRequest_CopyValue(_Request, param, HTTP_DATE_SIZE + HTTP_ETAG_SIZE);
+            }
+            break;
+        case 6:
+            if (params->fields == NULL && memcmp(name, "fields", 6) == 0) {
+                params->fields = WeatherServerRequest_CopyValue(_Request, param, 511);
+                if (params->fields != NULL) weather_fields_parse(params->fields, &params->field_set);
+            }
+            break;
+        case 11:
+            if (params->country_code == NULL && memcmp(name, "countryCode", 11) == 0) {
+                params->country_code = WeatherServerRequest_CopyValue(_Request, param, 15);
+            }
+            break;
+        }
+    }
+    params->has_location = has_latitude && has_longitude;
+}
+
+//-----------------------Micro-cache-----------------------
+
+/* the route, the format and the target the access log records, 0 for a
+   target too long to be worth keeping */
+static uint64_t WeatherServerRequest_MicroKey(WeatherServerRequest* _Request) {
+    char target[MAX_URL_LEN + 64];
+    int length = WeatherServerRequest_AccessTarget(_Request, target, sizeof(target));
+    if (length <= 0 || length >= (int)sizeof(target)) return 0;
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    hash = (hash ^ (uint64_t)(_Request->backend.route - g_routes)) * 1099511628211ULL;
+    hash = (hash ^ (uint64_t)_Request->cbor) * 1099511628211ULL;
+    for (int i = 0; i < length; i++) hash = (hash ^ (unsigned char)target[i]) * 1099511628211ULL;
+    return hash != 0 ? hash : 1;
+}
+
+/* from the loop's micro-cache, 1 if sent. Any route whose descriptor asks
+   for it, no backend runs for a hit. */
+static int WeatherServerRequest_MicroAnswer(WeatherServerRequest* _Request) {
+    const WeatherServerRoute* route = _Request->backend.route;
+    if (route->descriptor->cache != WeatherServerCache_Micro) return 0;
+    _Request->micro_key = WeatherServerRequest_MicroKey(_Request);
+    response_cache_entry* entry =
+        _Request->micro_key != 0 ? response_cache_find(&t_microCache, _Request->micro_key, time(NULL)) : NULL;
+    const response_blob* blob = entry != NULL ? entry->blob : NULL;
+    compress_encoding encoding = _Request->encoding;
+    // A body too small to compress went out as it is to everyone
+    if (blob != NULL && blob->bodies[encoding] == NULL && blob->bodies[COMPRESS_IDENTITY] != NULL &&
+        blob->lengths[COMPRESS_IDENTITY] < COMPRESS_MIN_SIZE) {
+        encoding = COMPRESS_IDENTITY;
+    }
+    if (blob == NULL || blob->bodies[encoding] == NULL) {
+        metrics_counter_add(&g_microMisses, 1);
+        return 0;
+    }
+    metrics_counter_add(&g_microHits, 1);
+
+    _Request->cache = ACCESS_CACHE_HOT;
+    HTTPServerConnection_Request* request = _Request->request;
+    trace_mark(&request->trace, TRACE_CACHED);
+    if (route->negotiate_encoding) {
+        HTTPServerConnection_AddHeader(request, "Vary", WeatherServerRequest_Vary(_Request));
+    }
+    const char* etag = blob->etags[encoding][0] ? blob->etags[encoding] : NULL;
+    if (http_conditional_is_current(&_Request->conditional, etag, 0)) {
+        HTTPServerConnection_SetValidators(request, etag, 0);
+        HTTPServerConnection_SendNotModified(request);
+        return 1;
+    }
+    // A reference, the entry may be replaced before this response is out
+    HTTPServerConnection_SendResponse_Blob(request, 200, blob, encoding,
+                                           (char*)WeatherServerRequest_ContentType(_Request));
+    return 1;
+}
+
+/* keeps the body a backend just made, in the encoding it goes out in. The
+   variants of a key expire together, a TTL after the first was stored. */
+static void WeatherServerRequest_MicroStore(WeatherServerRequest* _Request, compress_encoding _Encoding,
+                                            const uint8_t* _Body, size_t _Length) {
+    if (_Request->micro_key == 0) return;
+    // An expired copy standing in for a failed fetch is not kept any longer
+    int outcome = WeatherServerRequest_CacheOutcome(_Request);
+    if (outcome == ACCESS_CACHE_FALLBACK || outcome == ACCESS_CACHE_UNAVAILABLE) return;
+    if (t_microCache.entries == NULL &&
+        response_cache_init(&t_microCache, WeatherServerInstance_MICRO_CACHE_ENTRIES,
+                            WeatherServerInstance_MICRO_CACHE_BYTES, NULL) != 0) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    const response_cache_entry* live = response_cache_peek(&t_microCache, _Request->micro_key);
+    time_t expires = live != NULL && live->expires > now ? live->expires
+                                                          : now + _Request->backend.route->descriptor->ttl_s;
+    // The bodies carry no Last-Modified, every variant is of version 0
+    response_cache_entry* entry = response_cache_insert(&t_microCache, _Request->micro_key, 0, expires);
+    if (entry != NULL) response_cache_set(&t_microCache, entry, _Encoding, _Body, _Length, _Request->etag);
+}
 
 //----------------------------------------------------
 
-int WeatherServerInstance_Initiate(WeatherServerInstance* _Instance, HTTPServerConnection* _Connection) {
+int WeatherServerInstance_Initiate(WeatherServerInstance* _Instance, HTTPServerConnection* _Connection, void* _Context,
+                                   WeatherServerInstance_OnWake _OnWake) {
     _Instance->connection = _Connection;
     _Instance->state = WeatherServerInstance_State_Waiting;
-    // Initialize backend to safe defaults
-    _Instance->backend.backend_struct = NULL;
-    _Instance->backend.backend_get_buffer = NULL;
-    _Instance->backend.backend_get_buffer_size = NULL;
-    _Instance->backend.backend_work = NULL;
-    _Instance->backend.backend_dispose = NULL;
-    _Instance->backend.binary_mode = 0;
+    _Instance->requests = NULL;
+    _Instance->context = _Context;
+    _Instance->onWake = _OnWake;
+    _Instance->prev = NULL;
+    _Instance->next = NULL;
+    _Instance->queued = 0;
+    _Instance->readyNext = NULL;
 
-    HTTPServerConnection_SetCallback(_Instance->connection, _Instance, WeatherServerInstance_OnRequest);
+    HTTPServerConnection_SetCallback(_Instance->connection, _Instance, WeatherServerInstance_OnRequest,
+                                     WeatherServerInstance_OnResponseSent, WeatherServerInstance_OnClosed);
 
     return 0;
 }
 
-int WeatherServerInstance_InitiatePtr(HTTPServerConnection* _Connection, WeatherServerInstance** _InstancePtr) {
+int WeatherServerInstance_InitiatePtr(HTTPServerConnection* _Connection, void* _Context,
+                                      WeatherServerInstance_OnWake _OnWake, WeatherServerInstance** _InstancePtr) {
     if (_InstancePtr == NULL) return -1;
 
-    WeatherServerInstance* _Instance = (WeatherServerInstance*)malloc(sizeof(WeatherServerInstance));
-    if (_Instance == NULL) return -2;
+    WeatherServerInstance* _Instance = (WeatherServerInstance*)object_pool_get(&t_instancePool);
+    if (_Instance == NULL) {
+        _Instance = (WeatherServerInstance*)malloc(sizeof(WeatherServerInstance));
+        if (_Instance == NULL) return -2;
+        mem_account_alloc(MEM_TAG_INSTANCES, sizeof(WeatherServerInstance));
+    }
 
-    int result = WeatherServerInstance_Initiate(_Instance, _Connection);
+    int result = WeatherServerInstance_Initiate(_Instance, _Connection, _Context, _OnWake);
     if (result != 0) {
-        free(_Instance);
+        if (object_pool_put(&t_instancePool, _Instance) != 0) WeatherServerInstance_Destroy(_Instance);
         return result;
     }
 
@@ -52,161 +1559,558 @@ int WeatherServerInstance_InitiatePtr(HTTPServerConnection* _Connection, Weather
     return 0;
 }
 
-int WeatherServerInstance_OnRequest(void* _Context) {
+/* finds the route, 1 once the request is answered with an error */
+static int WeatherServerRequest_Route(WeatherServerRequest* _Request) {
+    HTTPServerConnection_Request* request = _Request->request;
+    trace_mark(&request->trace, TRACE_DISPATCHED);
+    // The path is a view into the connection's read buffer
+    HTTPStringView path = _Request->params.path;
+    if (path.length == 0) {
+        HTTPServerConnection_SendResponse(request, 400, "Bad Request: malformed URL\n", "text/plain");
+        return 1;
+    }
+
+    // Kept for Done, the backend's validators are only known then
+    HTTPServerConnection_GetConditional(request, &_Request->conditional);
+
+    int index = perfect_hash_find(&g_routeTable, path.data, path.length);
+    if (index < 0) {
+        HTTPServerConnection_SendResponse(request, 404, "Not Found\n", "text/plain");
+        return 1;
+    }
+    const WeatherServerRoute* route = &g_routes[index];
+    _Request->backend.route = route;
+    // Only operator routes change anything, the rest is read with GET
+    if (request->method == POST && strncmp(route->path, "/admin/", 7) != 0) {
+        HTTPServerConnection_AddHeader(request, "Allow", "GET, HEAD");
+        HTTPServerConnection_SendResponse(request, Method_Not_Allowed, "Method Not Allowed\n", "text/plain");
+        return 1;
+    }
+    if (request->earlyData && !route->early_data) {
+        HTTPServerConnection_SendResponse(request, Too_Early, "Too Early\n", "text/plain");
+        return 1;
+    }
+    if (route->negotiate_encoding) {
+        size_t accept_length = 0;
+        const char* accept = HTTPServerConnection_GetKnownHeader(request, HTTPHeader_AcceptEncoding, &accept_length);
+        _Request->encoding = compress_negotiate(accept, accept_length);
+    }
+    if (route->negotiate_format) {
+        size_t accept_length = 0;
+        const char* accept = HTTPServerConnection_GetKnownHeader(request, HTTPHeader_Accept, &accept_length);
+        _Request->cbor = cbor_negotiate(accept, accept_length);
+    }
+    return 0;
+}
+
+int WeatherServerInstance_OnRequest(void* _Context, HTTPServerConnection_Request* _Request) {
     WeatherServerInstance* server = (WeatherServerInstance*)_Context;
 
-    server->state = WeatherServerInstance_State_Init;
+    WeatherServerRequest* request = (WeatherServerRequest*)object_pool_get(&t_requestPool);
+    arena scratch = ARENA_INIT(WeatherServerInstance_REQUEST_ARENA_SIZE);
+    if (request == NULL) {
+        request = (WeatherServerRequest*)malloc(sizeof(WeatherServerRequest));
+        if (request != NULL) mem_account_alloc(MEM_TAG_INSTANCES, sizeof(WeatherServerRequest));
+        arena_set_tag(&scratch, MEM_TAG_INSTANCES);
+    } else {
+        scratch = request->arena;
+    }
+    if (request == NULL) {
+        HTTPServerConnection_SendResponse(_Request, 500, "Internal Server Error\n", "text/plain");
+        return -1;
+    }
+    memset(request, 0, sizeof(WeatherServerRequest));
+    request->arena = scratch;
+    request->instance = server;
+    request->request = _Request;
+    request->state = WeatherServerInstance_State_Init;
+    request->started_ns = SystemMonotonicNS();
+    _Request->context = request;
+    WeatherServerRequest_ParseParams(request);
+
+    // Appended, the connection sends the responses in this order anyway
+    WeatherServerRequest** tail = &server->requests;
+    while (*tail != NULL) tail = &(*tail)->next;
+    *tail = request;
+
+    // Errors and bodies already in memory go out right away, only what needs
+    // a backend waits for the next pass (and counts as queued)
+    const WeatherServerRoute* route = NULL;
+    if (WeatherServerRequest_Route(request) != 0 || WeatherServerRequest_MicroAnswer(request) ||
+        ((route = request->backend.route)->answer != NULL && route->answer(request))) {
+        request->state = WeatherServerInstance_State_Sending;
+        return 0;
+    }
+    server->onWake(server->context, server);
     return 0;
 }
 
-void WeatherServerInstance_OnDone(void* _Context) {
+/* the path and the parameters the route reads, normalized so the same
+   request always logs the same and a replay asks exactly that */
+static int WeatherServerRequest_AccessTarget(WeatherServerRequest* _Request, char* _Out, size_t _Size) {
+    const WeatherServerRoute* route = _Request->backend.route;
+    const WeatherServerRequestParams* params = &_Request->params;
+    HTTPStringView url = _Request->request->url;
+    switch (route != NULL ? route->access : ACCESS_ROUTE_OTHER) {
+    case ACCESS_ROUTE_WEATHER:
+        if (!params->has_location) break;
+        if (params->field_set != 0) {
+            char fields[ACCESS_LOG_TARGET_SIZE];
+            url_codec_encode(params->fields, fields, sizeof(fields));
+            return snprintf(_Out, _Size, "%s?lat=%.4f&lon=%.4f&fields=%s", route->path, params->latitude,
+                            params->longitude, fields);
+        }
+        return snprintf(_Out, _Size, "%s?lat=%.4f&lon=%.4f", route->path, params->latitude, params->longitude);
+    case ACCESS_ROUTE_NEAREST:
+    case ACCESS_ROUTE_SUBSCRIBE:
+        if (!params->has_location) break;
+        return snprintf(_Out, _Size, "%s?lat=%.4f&lon=%.4f", route->path, params->latitude, params->longitude);
+    case ACCESS_ROUTE_LOCATION: {
+        if (params->name == NULL) break;
+        /* decoded when read, escaped again so a replay asks the same */
+        char name[ACCESS_LOG_TARGET_SIZE];
+        char country[48];
+        url_codec_encode(params->name, name, sizeof(name));
+        url_codec_encode(params->country_code ? params->country_code : "", country, sizeof(country));
+        return snprintf(_Out, _Size, "%s?name=%s&count=%d%s%s", route->path, name,
+                        params->count >= 0 ? params->count : WeatherServerInstance_DEFAULT_LOCATION_COUNT,
+                        params->country_code ? "&countryCode=" : "", country);
+    }
+    case ACCESS_ROUTE_WEATHER_BY_NAME: {
+        if (params->name == NULL) break;
+        char name[ACCESS_LOG_TARGET_SIZE];
+        char country[48];
+        url_codec_encode(params->name, name, sizeof(name));
+        url_codec_encode(params->country_code ? params->country_code : "", country, sizeof(country));
+        return snprintf(_Out, _Size, "%s?name=%s%s%s", route->path, name, params->country_code ? "&countryCode=" : "",
+                        country);
+    }
+    case ACCESS_ROUTE_STATS:
+        return snprintf(_Out, _Size, "%s%s", route->path, params->reset ? "?reset=1" : "");
+    case ACCESS_ROUTE_CACHE_ONLY:
+        return snprintf(_Out, _Size, "%s%s%s", route->path, params->mode ? "?mode=" : "", params->mode ? params->mode : "");
+    case ACCESS_ROUTE_CITIES:
+    case ACCESS_ROUTE_SURPRISE:
+    case ACCESS_ROUTE_RELOAD_CITIES:
+    case ACCESS_ROUTE_METRICS:
+        return snprintf(_Out, _Size, "%s", route->path);
+    default:
+        break;
+    }
+    /* the batch's lists and what matched no route, as sent */
+    return snprintf(_Out, _Size, "%.*s", (int)url.length, url.data);
+}
+
+/* where the body came from, the request's own idea or else its backend's */
+static int WeatherServerRequest_CacheOutcome(WeatherServerRequest* _Request) {
+    const WeatherServerRoute* route = _Request->backend.route;
+    if (_Request->cache == ACCESS_CACHE_NONE && _Request->backend.backend_struct != NULL &&
+        route->ops->get_cache_outcome) {
+        return route->ops->get_cache_outcome(&_Request->backend.backend_struct);
+    }
+    return _Request->cache;
+}
+
+static void WeatherServerRequest_ExportTrace(WeatherServerRequest* _Request) {
+    const WeatherServerRoute* route = _Request->backend.route;
+    HTTPServerConnection_Request* request = _Request->request;
+    char target[TRACE_TARGET_SIZE];
+    int length = WeatherServerRequest_AccessTarget(_Request, target, sizeof(target));
+    if (length >= (int)sizeof(target)) length = (int)sizeof(target) - 1;
+    trace_export(&request->trace, request->method == HEAD, request->status,
+                 route != NULL ? route->access : ACCESS_ROUTE_OTHER, WeatherServerRequest_CacheOutcome(_Request), target,
+                 length);
+}
+
+static void WeatherServerRequest_LogAccess(WeatherServerRequest* _Request, uint64_t _ElapsedNS) {
+    const WeatherServerRoute* route = _Request->backend.route;
+    access_log_record record;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.time_us = ((uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec - _ElapsedNS) / 1000;
+    record.latency_us = _ElapsedNS / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(_ElapsedNS / 1000);
+    record.status = (uint16_t)_Request->request->status;
+    record.route = (uint8_t)(route != NULL ? route->access : ACCESS_ROUTE_OTHER);
+    record.cache = (uint8_t)WeatherServerRequest_CacheOutcome(_Request);
+    record.flags = 0;
+    int length = WeatherServerRequest_AccessTarget(_Request, record.target, sizeof(record.target));
+    if (length < 0) length = 0;
+    if (length >= (int)sizeof(record.target)) {
+        length = (int)sizeof(record.target) - 1;
+        record.flags |= ACCESS_LOG_TRUNCATED;
+    }
+    record.target_length = (uint16_t)length;
+    access_log_write(&record);
+}
+
+void WeatherServerInstance_OnResponseSent(void* _Context, HTTPServerConnection_Request* _Request) {
+    WeatherServerInstance* server = (WeatherServerInstance*)_Context;
+    WeatherServerRequest* request = (WeatherServerRequest*)_Request->context;
+    if (request == NULL) return;
+
+    WeatherServerRequest** link = &server->requests;
+    while (*link != NULL && *link != request) link = &(*link)->next;
+    if (*link != NULL) *link = request->next;
+    const WeatherServerRoute* route = request->backend.route;
+    int index = route != NULL ? (int)(route - g_routes) : WeatherServerInstance_ROUTE_COUNT;
+    uint64_t elapsed_ns = SystemMonotonicNS() - request->started_ns;
+    metrics_histogram_record(&g_routeLatency[index], elapsed_ns / 1000);
+    WeatherServerRequest_ChargeQuota(request, _Request->sent);
+    if (access_log_enabled()) WeatherServerRequest_LogAccess(request, elapsed_ns);
+    if (_Request->trace.active) WeatherServerRequest_ExportTrace(request);
+    WeatherServerRequest_Release(request);
+}
+
+void WeatherServerInstance_OnClosed(void* _Context) {
     WeatherServerInstance* server = (WeatherServerInstance*)_Context;
+    server->onWake(server->context, server);
+}
+
+void WeatherServerInstance_OnDone(void* _Context) {
+    WeatherServerRequest* request = (WeatherServerRequest*)_Context;
+
+    request->state = WeatherServerInstance_State_Done;
+    request->instance->onWake(request->instance->context, request->instance);
+}
+
+void WeatherServerInstance_OnBackendWake(void* _Context) {
+    WeatherServerRequest* request = (WeatherServerRequest*)_Context;
+    request->instance->onWake(request->instance->context, request->instance);
+}
+
+static void WeatherServerRequest_Release(WeatherServerRequest* _Request) {
+    WeatherServerRequest_DisposeBackend(_Request);
+    if (_Request->subscription != NULL) WeatherServerSubscription_Release(_Request->subscription);
+    arena_reset(&_Request->arena);
+    if (object_pool_put(&t_requestPool, _Request) != 0) WeatherServerRequest_Destroy(_Request);
+}
 
-    server->state = WeatherServerInstance_State_Done;
+static int WeatherServerRequest_ReadBody(void* _Context, uint8_t* _Buffer, int _Size) {
+    WeatherServerBackend* backend = &((WeatherServerRequest*)_Context)->backend;
+    return backend->route->ops->read(&backend->backend_struct, _Buffer, _Size);
 }
 
-void WeatherServerInstance_Work(WeatherServerInstance* _Server, uint64_t _MonTime) {
+static void WeatherServerBodyMemo_Clear(WeatherServerBodyMemo* _Memo) {
+    for (int i = 0; i < COMPRESS_ENCODINGS; i++) free(_Memo->variants[i]);
+    memset(_Memo, 0, sizeof(WeatherServerBodyMemo));
+}
+
+/* the body in the encoding the client takes, compressed once per thread for
+   memoized routes and per request otherwise. The identity ETag in
+   _Request->etag becomes the variant's. */
+static compress_encoding WeatherServerRequest_Encode(WeatherServerRequest* _Request, const uint8_t** _Body,
+                                                     size_t* _Length) {
+    compress_encoding encoding = _Request->encoding;
+    WeatherServerBodyMemo* memo = _Request->backend.memo;
+    if (memo != NULL && strcmp(memo->etag, _Request->etag) != 0) {
+        WeatherServerBodyMemo_Clear(memo);
+        memcpy(memo->etag, _Request->etag, HTTP_ETAG_SIZE);
+    }
+    if (encoding == COMPRESS_IDENTITY || *_Length < COMPRESS_MIN_SIZE) encoding = COMPRESS_IDENTITY;
+
+    const uint8_t* encoded = NULL;
+    size_t encoded_length = 0;
+    if (encoding != COMPRESS_IDENTITY && memo != NULL) {
+        if (memo->variants[encoding] == NULL) {
+            memo->variants[encoding] = compress_alloc(encoding, *_Body, *_Length, &memo->lengths[encoding]);
+        }
+        // A copy, the memo may be replaced before this response is out
+        uint8_t* copy = memo->variants[encoding] ? (uint8_t*)arena_alloc(&_Request->arena, memo->lengths[encoding]) : NULL;
+        if (copy != NULL) {
+            memcpy(copy, memo->variants[encoding], memo->lengths[encoding]);
+            encoded = copy;
+            encoded_length = memo->lengths[encoding];
+        }
+    } else if (encoding != COMPRESS_IDENTITY) {
+        size_t capacity = compress_bound(encoding, *_Length);
+        uint8_t* out = (uint8_t*)arena_alloc(&_Request->arena, capacity);
+        long written = out ? compress_into(encoding, *_Body, *_Length, out, capacity) : -1;
+        if (written > 0) {
+            encoded = out;
+            encoded_length = (size_t)written;
+        }
+    }
+
+    if (encoded == NULL) {
+        encoding = COMPRESS_IDENTITY;
+    } else {
+        *_Body = encoded;
+        *_Length = encoded_length;
+        http_etag_variant(_Request->etag, compress_encoding_name(encoding));
+    }
+    if (memo != NULL) memcpy(memo->etags[encoding], _Request->etag, HTTP_ETAG_SIZE);
+    return encoding;
+}
+
+void WeatherServerInstance_ReleaseThread(void) {
+    WeatherServerBodyMemo_Clear(&t_citiesMemo);
+    rate_limiter_dispose(&t_quota);
+    response_cache_dispose(&t_microCache);
+    if (t_heartbeatTask != NULL) {
+        smw_destroyTask(t_heartbeatTask);
+        t_heartbeatTask = NULL;
+    }
+    /* its cities are weather subscribers */
+    cities_weather_release_thread();
+    weather_release_thread();
+    geolocation_release_thread();
+    cdn_purge_release_thread();
+    curl_client_release_thread();
+}
+
+static void WeatherServerRequest_Destroy(void* _Object) {
+    WeatherServerRequest* request = (WeatherServerRequest*)_Object;
+    arena_dispose(&request->arena);
+    mem_account_free(MEM_TAG_INSTANCES, sizeof(WeatherServerRequest));
+    free(request);
+}
+
+static void WeatherServerInstance_Destroy(void* _Object) {
+    mem_account_free(MEM_TAG_INSTANCES, sizeof(WeatherServerInstance));
+    free(_Object);
+}
+
+static void WeatherServerInstance_ReleaseRequests(WeatherServerInstance* _Instance) {
+    while (_Instance->requests != NULL) {
+        WeatherServerRequest* request = _Instance->requests;
+        _Instance->requests = request->next;
+        WeatherServerRequest_Release(request);
+    }
+}
+
+WeatherServerInstance_Run WeatherServerInstance_Work(WeatherServerInstance* _Server, uint64_t _MonTime) {
     // Don't access connection if we're disposing or already disposed
     if (_Server->state == WeatherServerInstance_State_Dispose) {
-        WeatherServerBackend* backend = &_Server->backend;
-        if (backend->backend_struct != NULL && backend->backend_dispose != NULL) {
-            backend->backend_dispose(&backend->backend_struct);
-        }
+        WeatherServerInstance_ReleaseRequests(_Server);
         _Server->state = WeatherServerInstance_State_This_Is_Actually_The_State_Where_We_Want_This_Struct_To_Be_Disposed;
-        return;
+        return WeatherServerInstance_Run_Wait;
     }
     
-    if (_Server->connection == NULL) { return; }
+    if (_Server->connection == NULL) { return WeatherServerInstance_Run_Wait; }
     // If the connection task is gone, the connection is disposing - don't use it
     if (_Server->connection->task == NULL) { 
         _Server->state = WeatherServerInstance_State_Dispose;
-        return;
+        return WeatherServerInstance_Run_Again;
     }
-    if (_Server->connection->url == NULL) { return; }
 
-    HTTPQuery* query = HTTPQuery_fromstring(_Server->connection->url);
-    if (!query || !query->Path) {
-        if (_Server->connection) { HTTPServerConnection_SendResponse(_Server->connection, 400, "Bad Request: malformed URL\n", "text/plain"); }
-        if (query) HTTPQuery_Dispose(&query);
-        _Server->state = WeatherServerInstance_State_Sending;
-        return;
+    // Pipelined requests run side by side, the connection orders the responses.
+    // The instance stays runnable as long as any of them has more to do.
+    WeatherServerInstance_Run run = WeatherServerInstance_Run_Wait;
+    for (WeatherServerRequest* request = _Server->requests; request != NULL; request = request->next) {
+        // Its upstream fetches get no more time than the request has left
+        curl_client_set_deadline(
+            HTTPServerConnection_HandlerDeadline(request->request, request->started_ns / 1000000));
+        WeatherServerInstance_Run request_run = WeatherServerRequest_Work(request);
+        if (request_run == WeatherServerInstance_Run_Again || run == WeatherServerInstance_Run_Wait) run = request_run;
     }
+    curl_client_set_deadline(0);
+    return run;
+}
 
-    WeatherServerBackend* backend = &_Server->backend;
+/* a streamed body its backend is still making: the backend keeps being
+   stepped while the response is sent, and the connection asked again for
+   what it has once it ran */
+static WeatherServerInstance_Run WeatherServerRequest_WorkStream(WeatherServerRequest* _Request) {
+    WeatherServerBackend* backend = &_Request->backend;
+    if (backend->backend_struct == NULL || backend->route == NULL || backend->route->ops == NULL ||
+        backend->route->ops->read == NULL || _Request->request->timedOut) {
+        return WeatherServerInstance_Run_Wait;
+    }
+    uint64_t start = SystemMonotonicNS();
+    int result = backend->route->ops->work(&backend->backend_struct);
+    smw_recordSpan(backend->route->name, SystemMonotonicNS() - start);
+    HTTPServerConnection_ResumeStream(_Request->request);
+    if (result == BACKEND_WORK_AGAIN) return WeatherServerInstance_Run_Again;
+    if (result == BACKEND_WORK_POLL) return WeatherServerInstance_Run_Poll;
+    return WeatherServerInstance_Run_Wait;
+}
 
-    const char* lowerURL = create_lowercase_copy(query->Path);
+static WeatherServerInstance_Run WeatherServerRequest_Work(WeatherServerRequest* _Request) {
+    // The response is queued, the connection releases us once it is sent
+    if (_Request->state == WeatherServerInstance_State_Sending) { return WeatherServerRequest_WorkStream(_Request); }
 
-    switch (_Server->state) {
-    case WeatherServerInstance_State_Waiting: {
-        break;
+    HTTPServerConnection_Request* request = _Request->request;
+    WeatherServerBackend* backend = &_Request->backend;
+
+    // Answered with a 504 already, stop the backend and its transfers now
+    if (request->timedOut) {
+        WeatherServerRequest_DisposeBackend(_Request);
+        _Request->state = WeatherServerInstance_State_Sending;
+        return WeatherServerInstance_Run_Wait;
     }
-    case WeatherServerInstance_State_Init: {
-        if (strcmp(lowerURL, "/getcities") == 0) {
-            cities_init((void*)_Server, &backend->backend_struct, WeatherServerInstance_OnDone);
-            backend->backend_get_buffer = cities_get_buffer;
-            backend->backend_work = cities_work;
-            backend->backend_dispose = cities_dispose;
-            backend->binary_mode = 0;
-
-        } else if (strcmp(lowerURL, "/getlocation") == 0) {
-            geolocation_init((void*)_Server, &backend->backend_struct, WeatherServerInstance_OnDone);
-            backend->backend_get_buffer = geolocation_get_buffer;
-            backend->backend_work = geolocation_work;
-            backend->backend_dispose = geolocation_dispose;
-            backend->binary_mode = 0;
-
-            char* location_name = (char*)HTTPQuery_getParameter(query, "name");
-            char* location_count_string = (char*)HTTPQuery_getParameter(query, "count");
-            char* country_code = (char*)HTTPQuery_getParameter(query, "countryCode");
-            
-            if (location_name == NULL) {
-                HTTPServerConnection_SendResponse(_Server->connection, 400, "Bad Request: Missing 'name' parameter\n", "text/plain");
-                _Server->state = WeatherServerInstance_State_Sending;
-                break;
-            }
-            
-            int location_count = location_count_string ? (int)strtol(location_count_string, NULL, 10) : WeatherServerInstance_DEFAULT_LOCATION_COUNT;
-
-            geolocation_set_parameters(&backend->backend_struct, location_name, location_count, country_code);
-
-        }  else if (strcmp(lowerURL, "/getweather") == 0) {
-            weather_init((void*)_Server, &backend->backend_struct, WeatherServerInstance_OnDone);
-            backend->backend_get_buffer = weather_get_buffer;
-            backend->backend_work = weather_work;
-            backend->backend_dispose = weather_dispose;
-            backend->binary_mode = 0;
-
-            const char* lat_str = HTTPQuery_getParameter(query, "lat");
-            const char* lon_str = HTTPQuery_getParameter(query, "lon");
-            if (lat_str == NULL || lon_str == NULL) {
-                HTTPServerConnection_SendResponse(_Server->connection, 400, "Bad Request: Missing parameters\n", "text/plain");
-                _Server->state = WeatherServerInstance_State_Sending;
-                break;
-            }
 
-            double latitude = round(strtod(lat_str, NULL) * 100.0) / 100.0;
-            double longitude = round(strtod(lon_str, NULL) * 100.0) / 100.0;
-            weather_set_location(&backend->backend_struct, latitude, longitude);
-
-        } else if (strcmp(lowerURL, "/getsurprise") == 0) {
-            surprise_init((void*)_Server, &backend->backend_struct, WeatherServerInstance_OnDone);
-            backend->backend_get_buffer = surprise_get_buffer;
-            backend->backend_get_buffer_size = surprise_get_buffer_size;
-            backend->backend_work = surprise_work;
-            backend->backend_dispose = surprise_dispose;
-            backend->binary_mode = 1;
-            
-        } else {
-            HTTPServerConnection_SendResponse(_Server->connection, 404, "Not Found\n", "text/plain");
-            _Server->state = WeatherServerInstance_State_Sending;
+    switch (_Request->state) {
+    case WeatherServerInstance_State_Init: {
+        const WeatherServerRoute* route = backend->route;
+        uint64_t now_ns = SystemMonotonicNS();
+        uint64_t queued_ns = now_ns - _Request->started_ns;
+        _Request->queued_ms = queued_ns / 1000000;
+        metrics_histogram_record(&g_queueDelay, queued_ns / 1000);
+        int change = admission_observe(&t_admission, _Request->queued_ms, now_ns / 1000000);
+        if (change != 0) {
+            metrics_gauge_add(&g_overloadedLoops, change);
+            cache_only_set_overloaded(change > 0);
+        }
+        // Routed when it came in, unless that was the answer already
+        if (route->setup(_Request) != 0) {
+            _Request->state = WeatherServerInstance_State_Sending;
             break;
         }
-        _Server->state = WeatherServerInstance_State_Work;
-        break;
+        _Request->state = WeatherServerInstance_State_Work;
+        return WeatherServerInstance_Run_Again;
     }
     case WeatherServerInstance_State_Work: {
-        printf("WeatherServerInstance: Working...\n");
-        backend->backend_work(&backend->backend_struct);
+        LOG_DEBUG("WeatherServerInstance: Working...");
+        uint64_t start = SystemMonotonicNS();
+        int result = backend->route->ops->work(&backend->backend_struct);
+        smw_recordSpan(backend->route->name, SystemMonotonicNS() - start);
+        // Waiting backends wake us through on_wake or on_done, a failed one
+        // is left to the handler timeout
+        if (result == BACKEND_WORK_AGAIN) return WeatherServerInstance_Run_Again;
+        if (result == BACKEND_WORK_POLL) return WeatherServerInstance_Run_Poll;
         break;
     }
     case WeatherServerInstance_State_Done: {
-        char* buffer;
-        backend->backend_get_buffer(&backend->backend_struct, &buffer);
+        trace_mark(&request->trace, TRACE_BODY);
+        const WeatherServerRoute* route = backend->route;
+        const WeatherServerBackendOps* ops = route->ops;
+        const char* etag = NULL;
+        time_t last_modified = 0;
+        int current = 0;
+        if (ops->get_validators != NULL) {
+            current = ops->get_validators(&backend->backend_struct, &etag, &last_modified) == 1;
+        }
 
-        if (backend->binary_mode == 1) {
-            if (buffer == NULL) {
-                HTTPServerConnection_SendResponse(_Server->connection, 500, "Internal Server Error\n", "text/plain");
-                _Server->state = WeatherServerInstance_State_Sending;
-                break;
+        // Another loop's cache entry, by reference like a hot hit
+        compress_encoding blob_encoding = COMPRESS_IDENTITY;
+        const response_blob* blob = !current && ops->get_blob != NULL
+                                        ? ops->get_blob(&backend->backend_struct, &blob_encoding) : NULL;
+        if (blob != NULL) {
+            if (route->negotiate_encoding) {
+                HTTPServerConnection_AddHeader(request, "Vary", WeatherServerRequest_Vary(_Request));
             }
-            size_t buffer_size;
-            backend->backend_get_buffer_size(&backend->backend_struct, &buffer_size);
-            HTTPServerConnection_SendResponse_Binary(_Server->connection, 200, (uint8_t*)buffer, buffer_size, "image/png");
-            _Server->state = WeatherServerInstance_State_Sending;
-            printf("WeatherServerInstance: Done.\n");
+            WeatherServerRequest_FlagStale(_Request, WeatherServerRequest_CacheOutcome(_Request));
+            const char* blob_type =
+                ops->get_content_type != NULL ? ops->get_content_type(&backend->backend_struct) : NULL;
+            HTTPServerConnection_SendResponse_Blob(request, 200, blob, blob_encoding,
+                                                   (char*)(blob_type != NULL ? blob_type : route->descriptor->content_type));
+            _Request->state = WeatherServerInstance_State_Sending;
             break;
-        } else {
-            if (buffer == NULL) {
-                HTTPServerConnection_SendResponse(_Server->connection, 500, "Internal Server Error\n", "text/plain");
-                _Server->state = WeatherServerInstance_State_Sending;
-                break;
+        }
+
+        // The body to send and its encoding, streamed bodies are read later
+        const uint8_t* body = NULL;
+        size_t body_length = 0;
+        compress_encoding encoding = COMPRESS_IDENTITY;
+        if (!current && ops->read == NULL) {
+            if (ops->get_encoded != NULL) {
+                encoding = ops->get_encoded(&backend->backend_struct, &body, &body_length);
             }
+            if (encoding == COMPRESS_IDENTITY) {
+                char* buffer = NULL;
+                ops->get_buffer(&backend->backend_struct, &buffer);
+                if (buffer == NULL) {
+                    // Nothing cached and nothing fetched for it
+                    if (WeatherServerRequest_CacheOutcome(_Request) == ACCESS_CACHE_UNAVAILABLE) {
+                        WeatherServerRequest_SendUnavailable(_Request, &g_cacheOnlyMisses);
+                    } else {
+                        HTTPServerConnection_SendResponse(request, 500, "Internal Server Error\n", "text/plain");
+                    }
+                    _Request->state = WeatherServerInstance_State_Sending;
+                    break;
+                }
+                body = (const uint8_t*)buffer;
+                if (route->binary_mode == 1) {
+                    ops->get_buffer_size(&backend->backend_struct, &body_length);
+                } else {
+                    body_length = strlen(buffer);
+                }
+                if (route->binary_mode == 0 && ops->get_validators == NULL) {
+                    // Transcoded into the arena, JSON if that fails
+                    size_t cbor_length = 0;
+                    uint8_t* cbor = _Request->cbor ? cbor_from_json((const char*)body, body_length, &cbor_length)
+                                                   : NULL;
+                    uint8_t* copy = cbor ? (uint8_t*)arena_alloc(&_Request->arena, cbor_length) : NULL;
+                    if (copy != NULL) {
+                        memcpy(copy, cbor, cbor_length);
+                        body = copy;
+                        body_length = cbor_length;
+                    } else {
+                        _Request->cbor = 0;
+                    }
+                    free(cbor);
+                    // Generated on the fly, validated by its hash
+                    http_etag_from_data(_Request->etag, body, body_length);
+                    etag = _Request->etag;
+                    encoding = WeatherServerRequest_Encode(_Request, &body, &body_length);
+                    WeatherServerRequest_MicroStore(_Request, encoding, body, body_length);
+                }
+            }
+        }
 
-            HTTPServerConnection_SendResponse(_Server->connection, 200, buffer, "application/json");
-            _Server->state = WeatherServerInstance_State_Sending;
-            printf("WeatherServerInstance: Done.\n");
+        if (etag != NULL || last_modified != 0) {
+            HTTPServerConnection_SetValidators(request, etag, last_modified);
+            current = current || http_conditional_is_current(&_Request->conditional, etag, last_modified);
+        }
+        if (route->negotiate_encoding) {
+            HTTPServerConnection_AddHeader(request, "Vary", WeatherServerRequest_Vary(_Request));
+        }
+        WeatherServerRequest_FlagStale(_Request, WeatherServerRequest_CacheOutcome(_Request));
+        // A 304 carries it as well, it renews what the cache keeps
+        if (ops->get_cache_control != NULL) {
+            const char* cache_control = ops->get_cache_control(&backend->backend_struct);
+            if (cache_control != NULL) HTTPServerConnection_AddHeader(request, "Cache-Control", cache_control);
+        }
+        if (ops->get_freshness != NULL) {
+            time_t stamp = 0, expires = 0;
+            char key[Weather_SURROGATE_KEY_SIZE];
+            if (ops->get_freshness(&backend->backend_struct, &stamp, &expires, key, sizeof(key)) == 0) {
+                WeatherServerRequest_AddFreshness(_Request, stamp, expires, key);
+            }
+        }
+        const char* content_type = WeatherServerRequest_ContentType(_Request);
+        if (ops->get_content_type != NULL) {
+            const char* type = ops->get_content_type(&backend->backend_struct);
+            if (type != NULL) content_type = type;
+        }
+        if (current) {
+            HTTPServerConnection_SendNotModified(request);
+            _Request->state = WeatherServerInstance_State_Sending;
             break;
         }
 
-        break;
-    }
-    case WeatherServerInstance_State_Sending:
-        if (_Server->connection->state == HTTPServerConnection_State_Dispose)
-        {
-            _Server->state = WeatherServerInstance_State_Dispose;
-            break;
+        if (ops->read != NULL) {
+            // The backend stays until the response is sent, it is read as the socket drains
+            size_t length = 0;
+            if (ops->get_buffer_size != NULL && ops->get_buffer_size(&backend->backend_struct, &length) != 0) {
+                HTTPServerConnection_SendResponse(request, 500, "Internal Server Error\n", "text/plain");
+            } else {
+                // Unsized (chunked) without a length
+                HTTPServerConnection_SendResponse_Stream(request, 200, (char*)content_type,
+                                                         ops->get_buffer_size != NULL ? (int64_t)length : -1,
+                                                         WeatherServerRequest_ReadBody, _Request);
+            }
+            _Request->state = WeatherServerInstance_State_Sending;
+            LOG_DEBUG("WeatherServerInstance: Done.");
+            // The backend may still be making the body, see WorkStream
+            return WeatherServerInstance_Run_Again;
+        }
+
+        if (encoding != COMPRESS_IDENTITY) {
+            HTTPServerConnection_AddHeader(request, "Content-Encoding", compress_encoding_name(encoding));
         }
+        // Owned by the backend or the request arena, both outlive the send
+        off_t offset = 0;
+        int fd = ops->get_file != NULL ? ops->get_file(&backend->backend_struct, body, &offset) : -1;
+        if (fd >= 0) {
+            HTTPServerConnection_SendResponse_File(request, 200, body, body_length, fd, offset, (char*)content_type);
+        } else {
+            HTTPServerConnection_SendResponse_Binary(request, 200, (uint8_t*)body, body_length, (char*)content_type);
+        }
+        _Request->state = WeatherServerInstance_State_Sending;
+        LOG_DEBUG("WeatherServerInstance: Done.");
         break;
+    }
     case WeatherServerInstance_State_This_Is_Actually_The_State_Where_We_Want_This_Struct_To_Be_Disposed:
 
         break;
@@ -214,24 +2118,164 @@ void WeatherServerInstance_Work(WeatherServerInstance* _Server, uint64_t _MonTim
         break;
     }
     }
-
-    if (lowerURL) free((void*)lowerURL);
-    if (query) HTTPQuery_Dispose(&query);
+    return WeatherServerInstance_Run_Wait;
 }
 
+/* releases the instance itself as well, back to this loop's pool */
 void WeatherServerInstance_Dispose(WeatherServerInstance* _Instance) {
-    HTTPServerConnection_Dispose(_Instance->connection);
-    free(_Instance->connection);
-    free(_Instance);
+    WeatherServerInstance_ReleaseRequests(_Instance);
+    HTTPServerConnection_DisposePtr(&_Instance->connection);
+    if (object_pool_put(&t_instancePool, _Instance) != 0) WeatherServerInstance_Destroy(_Instance);
 }
 
 void WeatherServerInstance_DisposePtr(WeatherServerInstance** _InstancePtr) {
     if (_InstancePtr == NULL || *(_InstancePtr) == NULL) return;
 
     WeatherServerInstance_Dispose(*(_InstancePtr));
-    free(*(_InstancePtr));
     *(_InstancePtr) = NULL;
 }
+static char* WeatherServerInstance_StatsJson(arena* _Arena) {
+    smw_stats stats;
+    smw_getStats(&stats);
+
+    size_t size = 1792 + (size_t)stats.class_count * 192;
+    char* json = (char*)arena_alloc(_Arena, size);
+    if (!json) return NULL;
+
+    size_t len = 0;
+    len += snprintf(json + len, size - len,
+                    "{\"iterations\":%llu,\"max_pass_us\":%llu,\"max_stall_us\":%llu,\"max_stall_task\":\"%s\",\"pass_histogram_us\":[",
+                    (unsigned long long)stats.iterations, (unsigned long long)(stats.max_pass_ns / 1000),
+                    (unsigned long long)(stats.max_stall_ns / 1000),
+                    stats.max_stall_name ? stats.max_stall_name : "unnamed");
+    for (int i = 0; i < smw_stats_histogram_buckets; i++) {
+        len += snprintf(json + len, size - len, "%s%llu", i ? "," : "", (unsigned long long)stats.pass_histogram[i]);
+    }
+    len += snprintf(json + len, size - len, "],\"tasks\":[");
+    for (int i = 0; i < stats.class_count; i++) {
+        smw_task_stats* entry = &stats.classes[i];
+        uint64_t avg = entry->invocations ? entry->total_ns / entry->invocations : 0;
+        len += snprintf(json + len, size - len,
+                        "%s{\"name\":\"%s\",\"calls\":%llu,\"total_us\":%llu,\"avg_ns\":%llu,\"max_us\":%llu}",
+                        i ? "," : "", entry->name ? entry->name : "unnamed", (unsigned long long)entry->invocations,
+                        (unsigned long long)(entry->total_ns / 1000), (unsigned long long)avg,
+                        (unsigned long long)(entry->max_ns / 1000));
+    }
+    HTTPServerConnection_HandshakeStats handshakes;
+    HTTPServerConnection_GetHandshakeStats(&handshakes);
+    len += snprintf(json + len, size - len,
+             "],\"tls_handshakes\":{\"completed\":%llu,\"failed\":%llu,\"timed_out\":%llu,\"avg_us\":%llu,\"max_us\":%llu},\"listeners\":[",
+             (unsigned long long)handshakes.completed, (unsigned long long)handshakes.failed,
+             (unsigned long long)handshakes.timed_out,
+             (unsigned long long)(handshakes.completed ? handshakes.total_us / handshakes.completed : 0),
+             (unsigned long long)handshakes.max_us);
+    conn_listen_stats_t listeners[4];
+    int listener_count = conn_listen_server_get_stats(listeners, 4);
+    for (int i = 0; i < listener_count; i++) {
+        len += snprintf(json + len, size - len,
+                        "%s{\"name\":\"%s\",\"active\":%d,\"peak\":%d,\"max\":%d,\"accepted\":%llu,\"rejected\":%llu}",
+                        i ? "," : "", listeners[i].name, listeners[i].active, listeners[i].peak, listeners[i].max,
+                        (unsigned long long)listeners[i].accepted, (unsigned long long)listeners[i].rejected);
+    }
+    weather_cache_stats cache;
+    weather_get_cache_stats(&cache);
+    snprintf(json + len, size - len,
+             "],\"weather_cache\":{\"hot\":{\"entries\":%d,\"bytes\":%zu,\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu,"
+             "\"rejections\":%llu},\"disk\":{\"values\":%zu,\"bytes\":%zu,\"hits\":%llu,\"misses\":%llu,\"evictions\":%llu}}}",
+             cache.hot.entries, cache.hot.bytes, (unsigned long long)cache.hot.hits,
+             (unsigned long long)cache.hot.misses, (unsigned long long)cache.hot.evictions,
+             (unsigned long long)cache.hot.rejections, cache.disk_values, cache.disk_bytes,
+             (unsigned long long)cache.disk_hits, (unsigned long long)cache.disk_misses,
+             (unsigned long long)cache.disk_evictions);
+
+    return json;
+}
+
+/* what every subsystem holds process wide, and what the leak check saw */
+static char* WeatherServerInstance_MemoryJson(arena* _Arena) {
+    size_t size = 768 + MEM_TAG_COUNT * 160 + HUGE_PAGES_MAX_MAPPINGS * 256;
+    char* json = (char*)arena_alloc(_Arena, size);
+    if (!json) return NULL;
+
+    int64_t total = 0;
+    size_t len = 0;
+    len += snprintf(json + len, size - len, "{\"tags\":{");
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        mem_account_stats stats;
+        mem_account_get(i, &stats);
+        total += stats.bytes;
+        len += snprintf(json + len, size - len,
+                        "%s\"%s\":{\"bytes\":%lld,\"peak_bytes\":%lld,\"objects\":%lld,\"allocs\":%llu}",
+                        i ? "," : "", mem_account_tag_name(i), (long long)stats.bytes, (long long)stats.peak_bytes,
+                        (long long)stats.objects, (unsigned long long)stats.allocs);
+    }
+    int samples = 0;
+    unsigned int interval = mem_account_leak_check_interval(&samples);
+    unsigned int growing = mem_account_growing();
+    len += snprintf(json + len, size - len,
+                    "},\"total_bytes\":%lld,\"rss_bytes\":%lld,\"leak_check\":{\"interval_s\":%u,\"samples\":%d,"
+                    "\"window\":%d,\"growing\":[",
+                    (long long)total, (long long)mem_account_rss(), interval, samples, MEM_ACCOUNT_LEAK_WINDOW);
+    for (int i = 0, first = 1; i < MEM_TAG_COUNT; i++) {
+        if (!(growing & (1u << i))) continue;
+        len += snprintf(json + len, size - len, "%s\"%s\"", first ? "" : ",", mem_account_tag_name(i));
+        first = 0;
+    }
+    len += snprintf(json + len, size - len, "]},\"huge_pages\":{\"mode\":\"%s\",\"tables\":",
+                    huge_pages_mode_name(huge_pages_get_mode()));
+    int report = huge_pages_report(json + len, size - len);
+    if (report < 0) return NULL;
+    len += (size_t)report;
+    len += snprintf(json + len, size - len, "},\"allocator\":");
+    int allocator = ub_alloc_stats(json + len, size - len);
+    if (allocator < 0 || (size_t)allocator >= size - len) return NULL;
+    len += (size_t)allocator;
+    snprintf(json + len, size - len, "}");
+
+    return json;
+}
+
+/* the entries as [{"key":"label","count":N},..], labels JSON escaped */
+static size_t WeatherServerInstance_HotKeysList(char* _Json, size_t _Size, const heavy_hitters_entry* _Entries,
+                                                int _Count) {
+    size_t len = 0;
+    len += snprintf(_Json + len, _Size - len, "[");
+    for (int i = 0; i < _Count; i++) {
+        len += snprintf(_Json + len, _Size - len, "%s{\"key\":\"", i ? "," : "");
+        for (const unsigned char* p = (const unsigned char*)_Entries[i].label; *p && len + 8 < _Size; p++) {
+            if (*p == '"' || *p == '\\') {
+                _Json[len++] = '\\';
+                _Json[len++] = (char)*p;
+            } else if (*p < 0x20) {
+                len += snprintf(_Json + len, _Size - len, "\\u%04x", *p);
+            } else {
+                _Json[len++] = (char)*p;
+            }
+        }
+        len += snprintf(_Json + len, _Size - len, "\",\"count\":%llu}", (unsigned long long)_Entries[i].count);
+    }
+    len += snprintf(_Json + len, _Size - len, "]");
+    return len;
+}
+
+static char* WeatherServerInstance_HotKeysJson(arena* _Arena) {
+    /* an escaped label takes up to six bytes a character */
+    size_t size = 64 + 2 * HEAVY_HITTERS_TOP_K * (HEAVY_HITTERS_LABEL_SIZE * 6 + 48);
+    char* json = (char*)arena_alloc(_Arena, size);
+    heavy_hitters_entry* entries = (heavy_hitters_entry*)arena_alloc(_Arena, sizeof(heavy_hitters_entry) * HEAVY_HITTERS_TOP_K);
+    if (!json || !entries) return NULL;
+
+    size_t len = 0;
+    len += snprintf(json + len, size - len, "{\"weather\":");
+    len += WeatherServerInstance_HotKeysList(json + len, size - len, entries,
+                                             weather_heavy_hitters(entries, HEAVY_HITTERS_TOP_K));
+    len += snprintf(json + len, size - len, ",\"geolocation\":");
+    len += WeatherServerInstance_HotKeysList(json + len, size - len, entries,
+                                             geolocation_heavy_hitters(entries, HEAVY_HITTERS_TOP_K));
+    snprintf(json + len, size - len, "}\n");
+    return json;
+}
+
 /*
 static char* create_uppercase_copy(const char* str) {
     if (!str) return NULL;
@@ -280,49 +2324,3 @@ static char* create_uppercase_copy(const char* str) {
     return upper_str;
 }
 */
-static char* create_lowercase_copy(const char* str) {
-    if (!str) return NULL;
-
-    size_t len = strlen(str);
-    char* lower_str = malloc(len + 1);
-    if (!lower_str) return NULL;
-
-    for (size_t i = 0; i < len; i++) {
-        unsigned char c = (unsigned char)str[i];
-
-        // Handle UTF-8 encoded Swedish characters
-        if (c == 0xC3 && i + 1 < len) {
-            unsigned char next = (unsigned char)str[i + 1];
-
-            switch (next) {
-            case 0x84: // Ä (UTF-8: C3 84)
-                lower_str[i] = 0xC3;
-                lower_str[i + 1] = 0xA4; // ä (UTF-8: C3 A4)
-                i++;                     // Skip next byte as we've processed it
-                break;
-            case 0x85: // Å (UTF-8: C3 85)
-                lower_str[i] = 0xC3;
-                lower_str[i + 1] = 0xA5; // å (UTF-8: C3 A5)
-                i++;                     // Skip next byte as we've processed it
-                break;
-            case 0x96: // Ö (UTF-8: C3 96)
-                lower_str[i] = 0xC3;
-                lower_str[i + 1] = 0xB6; // ö (UTF-8: C3 B6)
-                i++;                     // Skip next byte as we've processed it
-                break;
-            default:
-                // Copy the C3 and let next iteration handle the following byte
-                lower_str[i] = c;
-                break;
-            }
-        } else {
-            // Regular ASCII character
-            lower_str[i] = tolower(c);
-        }
-    }
-
-    // Null terminate
-    lower_str[len] = '\0';
-
-    return lower_str;
-}
@@ -3,11 +3,22 @@
 #include "tinydir.h"
 #include "utils.h"
 #include <jansson.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "global_defines.h"
+#include "utilities/cbor.h"
+#include "utilities/epoch.h"
+#include "utilities/job_pool.h"
+#include "utilities/json_arena.h"
+#include "utilities/logger.h"
+#include "utilities/probes.h"
+#include "utilities/shared_blob.h"
+#include "utilities/url_codec.h"
 
 // Use centralized cache dir name for easier test configuration
 #define CACHE_DIR Cities_CACHE_DIR // From global_defines.h (original: libs/backends/cities/cities.c)
@@ -31,20 +42,58 @@ const char* cities_list = "Stockholm:59.3293:18.0686\n"
 
 // Forward declarations
 
-int city_init(const char* _Name, const char* _Latitude, const char* _Longitude, city_t** _CityPtr);
-void city_dispose(void* _cityPtr);
-
 int cities_add_city(cities_t* cities, city_t* city);
 
 int cities_load_from_disk(cities_t* cities);
 int cities_read_from_string_list(cities_t* cities);
 int cities_save_to_disk(cities_t* cities);
 
-int cities_convert_to_char_json_buffer(cities_t* cities);
+// Published with release, read with acquire; only cities_reload writes
+static cities_snapshot* g_citiesSnapshot = NULL;
+static pthread_mutex_t g_citiesReloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Disk jobs, the list is only touched by the pool thread while one is in flight
+
+static void cities_load_job_work(void* ctx) {
+    cities_t* cities = (cities_t*)ctx;
+    // The folder is made at startup (cities_reload, weather_global_init)
+    cities_load_from_disk(cities);
+}
+
+static void cities_load_job_done(void* ctx) {
+    cities_t* cities = (cities_t*)ctx;
+    cities->job = NULL;
+    cities->state = Cities_State_ReadString;
+    LOG_DEBUG("Cities: Loaded from disk");
+    cities->on_wake(cities->ctx);
+}
+
+static void cities_save_job_work(void* ctx) {
+    cities_save_to_disk((cities_t*)ctx);
+}
+
+static void cities_save_job_done(void* ctx) {
+    cities_t* cities = (cities_t*)ctx;
+    cities->job = NULL;
+    cities->state = Cities_State_Convert;
+    LOG_DEBUG("Cities: Saved to disk");
+    cities->on_wake(cities->ctx);
+}
+
+static void cities_free(void* ctx) {
+    cities_t* cities = (cities_t*)ctx;
+
+    LinkedList_dispose(&cities->cities_list, city_dispose);
+
+    free(cities->buffer);
+    cities->buffer = NULL;
+
+    free(cities);
+}
 
 // Function implementations
 
-int cities_init(void** ctx, void** ctx_struct, void (*ondone)(void* context)) {
+int cities_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context)) {
     cities_t* cities = (cities_t*)malloc(sizeof(cities_t));
     if (!cities) {
         return -1; // Memory allocation failed
@@ -55,7 +104,10 @@ int cities_init(void** ctx, void** ctx_struct, void (*ondone)(void* context)) {
     cities->state = Cities_State_Init;
     cities->buffer = NULL;
     cities->bytesread = 0;
+    cities->job = NULL;
+    cities->dirty = 0;
     cities->on_done = ondone;
+    cities->on_wake = onwake;
     *ctx_struct = (void*)cities;
 
     return 0;
@@ -126,7 +178,23 @@ int cities_get_city_by_name(cities_t* cities, const char* name, city_t** city_pt
     return -1;
 }
 
-int cities_load_from_disk(cities_t* cities) {
+static void cities_add_from_json(cities_t* cities, json_t* city_json) {
+    const char* name = json_string_value(json_object_get(city_json, "name"));
+    double latitude = json_number_value(json_object_get(city_json, "latitude"));
+    double longitude = json_number_value(json_object_get(city_json, "longitude"));
+
+    char lat_buffer[32];
+    char lon_buffer[32];
+    snprintf(lat_buffer, sizeof(lat_buffer), "%.6f", latitude);
+    snprintf(lon_buffer, sizeof(lon_buffer), "%.6f", longitude);
+
+    city_t* city = NULL;
+    city_init(name, lat_buffer, lon_buffer, &city);
+    if (city) cities_add_city(cities, city);
+}
+
+// One file per city, what older versions wrote; read once and moved into the store
+static int cities_load_legacy_files(cities_t* cities) {
     tinydir_dir dir;
     if (tinydir_open(&dir, CACHE_DIR) == -1) {
         return -1; // Failed to open directory
@@ -139,22 +207,11 @@ int cities_load_from_disk(cities_t* cities) {
             return -1;
         }
 
-        if (!file.is_dir) {
+        if (!file.is_dir && strcmp(file.extension, "json") == 0) {
             json_t* city_json = json_load_file(file.path, 0, NULL);
             if (city_json) {
-                const char* name = json_string_value(json_object_get(city_json, "name"));
-                double latitude = json_number_value(json_object_get(city_json, "latitude"));
-                double longitude = json_number_value(json_object_get(city_json, "longitude"));
-
-                char lat_buffer[32];
-                char lon_buffer[32];
-                snprintf(lat_buffer, sizeof(lat_buffer), "%.6f", latitude);
-                snprintf(lon_buffer, sizeof(lon_buffer), "%.6f", longitude);
-
-                city_t* city = NULL;
-                city_init(name, lat_buffer, lon_buffer, &city);
-                if (city) cities_add_city(cities, city);
-
+                cities_add_from_json(cities, city_json);
+                cities->dirty = 1;
                 json_decref(city_json);
             }
         }
@@ -170,6 +227,20 @@ int cities_load_from_disk(cities_t* cities) {
     return 0;
 }
 
+int cities_load_from_disk(cities_t* cities) {
+    json_t* root = json_load_file(Cities_STORE_PATH, 0, NULL);
+    if (!root) return cities_load_legacy_files(cities);
+
+    size_t index;
+    json_t* city_json;
+    json_array_foreach(root, index, city_json) {
+        cities_add_from_json(cities, city_json);
+    }
+    json_decref(root);
+
+    return 0;
+}
+
 int cities_read_from_string_list(cities_t* cities) {
     if (!cities) return -1;
 
@@ -209,7 +280,10 @@ int cities_read_from_string_list(cities_t* cities) {
 
         city_init(name, lat_str, lon_str, &city);
 
-        if (city) { cities_add_city(cities, city); }
+        if (city) {
+            cities_add_city(cities, city);
+            cities->dirty = 1;
+        }
 
     } while (ptr);
 
@@ -220,29 +294,52 @@ int cities_read_from_string_list(cities_t* cities) {
 
 int cities_save_to_disk(cities_t* cities) {
     if (!cities) return -1;
+    if (!cities->dirty) return 0;
 
+    json_t* root = json_array();
+    if (!root) return -1;
     Node* node = cities->cities_list->head;
     while (node) {
         city_t* city = (city_t*)node->item;
         if (city && city->name) {
-            char filepath[256];
-            snprintf(filepath, sizeof(filepath), "%s/%s.json", Cities_CACHE_DIR, city->name);
-            FILE* file = fopen(filepath, "w");
-            if (file) {
-                json_t* city_json = json_object();
-                json_object_set_new(city_json, "name", json_string(city->name));
-                json_object_set_new(city_json, "latitude", json_real(city->latitude));
-                json_object_set_new(city_json, "longitude", json_real(city->longitude));
-                char* json_str = json_dumps(city_json, JSON_INDENT(4));
-                fprintf(file, "%s", json_str);
-                free(json_str);
-                json_decref(city_json);
-                fclose(file);
-            }
+            json_t* city_json = json_object();
+            json_object_set_new(city_json, "name", json_string(city->name));
+            json_object_set_new(city_json, "latitude", json_real(city->latitude));
+            json_object_set_new(city_json, "longitude", json_real(city->longitude));
+            json_array_append_new(root, city_json);
         }
         node = node->front;
     }
 
+    // Written beside the store and renamed over it, a reader sees the old
+    // file or the new one and two writers never share a temporary
+    char path[256];
+    snprintf(path, sizeof(path), "%s.XXXXXX", Cities_STORE_PATH);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        json_decref(root);
+        return -1;
+    }
+    // mkstemp creates it private, the store is as readable as the files before
+    fchmod(fd, 0644);
+    FILE* file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(path);
+        json_decref(root);
+        return -1;
+    }
+    int result = json_dumpf(root, file, JSON_INDENT(4)) == 0 ? 0 : -1;
+    json_decref(root);
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) result = -1;
+    if (fclose(file) != 0) result = -1;
+    if (result == 0 && rename(path, Cities_STORE_PATH) != 0) result = -1;
+    if (result != 0) {
+        unlink(path);
+        return -1;
+    }
+
+    cities->dirty = 0;
     return 0;
 }
 
@@ -252,39 +349,51 @@ int cities_work(void** ctx) {
         return -1; // Memory allocation failed
     }
 
+    PROBE3(backend_state, "cities", cities, (int)cities->state);
     switch (cities->state) {
-    case Cities_State_Init:
-        create_folder(CACHE_DIR);
+    case Cities_State_Init: {
+        const cities_snapshot* snapshot = cities_current();
+        if (snapshot) {
+            cities->buffer = strdup((const char*)snapshot->bodies[COMPRESS_IDENTITY]);
+            if (cities->buffer) {
+                cities->bytesread = strlen(cities->buffer);
+                cities->state = Cities_State_Done;
+                break;
+            }
+        }
         cities->state = Cities_State_ReadFiles;
-        printf("Cities: Initialized\n");
+        LOG_DEBUG("Cities: Initialized");
         break;
+    }
     case Cities_State_ReadFiles:
-        cities_load_from_disk(cities);
-        cities->state = Cities_State_ReadString;
-        printf("Cities: Loaded from disk\n");
+        cities->job = job_pool_submit(cities_load_job_work, cities_load_job_done, cities);
+        cities->state = cities->job ? Cities_State_Wait : Cities_State_ReadString;
         break;
+    case Cities_State_Wait:
+        // Waiting for a disk job to finish
+        return BACKEND_WORK_WAIT;
     case Cities_State_ReadString:
         cities_read_from_string_list(cities);
         cities->state = Cities_State_SaveToDisk;
-        printf("Cities: Loaded from string list\n");
+        LOG_DEBUG("Cities: Loaded from string list");
         break;
     case Cities_State_SaveToDisk:
-        cities_save_to_disk(cities);
-        cities->state = Cities_State_Convert;
-        printf("Cities: Saved to disk\n");
+        // Nothing new since the store was written, nothing to write
+        cities->job = cities->dirty ? job_pool_submit(cities_save_job_work, cities_save_job_done, cities) : NULL;
+        cities->state = cities->job ? Cities_State_Wait : Cities_State_Convert;
         break;
     case Cities_State_Convert:
         cities_convert_to_char_json_buffer(cities);
         cities->state = Cities_State_Done;
-        printf("Cities: Converted to JSON buffer\n");
+        LOG_DEBUG("Cities: Converted to JSON buffer");
         break;
     case Cities_State_Done:
         cities->on_done(cities->ctx);
-        printf("Cities: Done\n");
-        break;
+        LOG_DEBUG("Cities: Done");
+        return BACKEND_WORK_WAIT;
     }
 
-    return 0;
+    return BACKEND_WORK_AGAIN;
 }
 
 int cities_convert_to_char_json_buffer(cities_t* cities) {
@@ -308,16 +417,18 @@ int cities_convert_to_char_json_buffer(cities_t* cities) {
         node = node->front;
     }
 
-    char* json_str = json_dumps(root_array, JSON_INDENT(2));
-    if (!json_str) {
-        json_decref(root_array);
+    json_buffer body;
+    json_buffer_init(&body, NULL);
+    int result = json_buffer_dump(&body, root_array, JSON_INDENT(2));
+    json_decref(root_array);
+    if (result != 0) {
+        json_buffer_dispose(&body);
         return -1;
     }
 
-    cities->buffer = json_str;
-    cities->bytesread = strlen(json_str);
-
-    json_decref(root_array);
+    size_t length = 0;
+    cities->buffer = json_buffer_take(&body, &length);
+    cities->bytesread = length;
 
     return 0;
 }
@@ -335,13 +446,229 @@ int cities_dispose(void** ctx) {
     cities_t* cities = (cities_t*)(*ctx);
     if (!cities) return -1; // Memory allocation failed
 
-    LinkedList_dispose(&cities->cities_list, city_dispose);
+    // A disk job still walks the list, free it once the job finishes
+    if (cities->job) {
+        job_pool_abandon(cities->job, cities_free);
+    } else {
+        cities_free(cities);
+    }
+    *ctx = NULL;
 
-    free(cities->buffer);
-    cities->buffer = NULL;
+    return 0;
+}
 
-    free(cities);
-    *ctx = NULL;
+static void cities_snapshot_free(cities_snapshot* snapshot) {
+    for (int i = 0; i < COMPRESS_ENCODINGS; i++) shared_blob_release(snapshot->bodies[i]);
+    shared_blob_release(snapshot->cbor);
+    for (int i = 0; i < snapshot->entry_count; i++) {
+        free(snapshot->entries[i].name);
+        free(snapshot->entries[i].key);
+    }
+    free(snapshot->entries);
+    free(snapshot->index);
+    free(snapshot);
+}
+
+static void cities_snapshot_retired(void* snapshot) {
+    cities_snapshot_free((cities_snapshot*)snapshot);
+}
+
+void cities_normalize(const char* name, char* key, size_t size) {
+    url_codec_key(name, key, size);
+}
+
+static uint64_t cities_hash(const char* key) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)key; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// The registry of a snapshot being built, from the merged list
+static int cities_build_registry(cities_snapshot* snapshot, LinkedList* list) {
+    int count = 0;
+    for (Node* node = list->head; node; node = node->front) count++;
+    uint32_t capacity = 16;
+    while (capacity < (uint32_t)count * 2) capacity <<= 1;
+
+    snapshot->entries = (cities_entry*)calloc(count ? count : 1, sizeof(cities_entry));
+    snapshot->index = (int32_t*)malloc(capacity * sizeof(int32_t));
+    if (!snapshot->entries || !snapshot->index) return -1;
+    memset(snapshot->index, 0xff, capacity * sizeof(int32_t));
+    snapshot->index_mask = capacity - 1;
+
+    for (Node* node = list->head; node; node = node->front) {
+        city_t* city = (city_t*)node->item;
+        char key[256];
+        cities_normalize(city->name, key, sizeof(key));
+        cities_entry* entry = &snapshot->entries[snapshot->entry_count];
+        entry->name = strdup(city->name);
+        entry->key = strdup(key);
+        if (!entry->name || !entry->key) {
+            free(entry->name);
+            free(entry->key);
+            return -1;
+        }
+        entry->hash = cities_hash(key);
+        entry->latitude = city->latitude;
+        entry->longitude = city->longitude;
+
+        uint32_t slot = (uint32_t)entry->hash & snapshot->index_mask;
+        while (snapshot->index[slot] >= 0) slot = (slot + 1) & snapshot->index_mask;
+        snapshot->index[slot] = snapshot->entry_count++;
+    }
+    return 0;
+}
+
+int cities_find(const char* name, double* latitude, double* longitude) {
+    const cities_snapshot* snapshot = cities_current();
+    if (!snapshot || !snapshot->index) return -1;
+
+    char key[256];
+    cities_normalize(name, key, sizeof(key));
+    uint64_t hash = cities_hash(key);
+    for (uint32_t slot = (uint32_t)hash & snapshot->index_mask; snapshot->index[slot] >= 0;
+         slot = (slot + 1) & snapshot->index_mask) {
+        const cities_entry* entry = &snapshot->entries[snapshot->index[slot]];
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            *latitude = entry->latitude;
+            *longitude = entry->longitude;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int cities_reload(void) {
+    cities_t cities;
+    memset(&cities, 0, sizeof(cities_t));
+    cities.cities_list = LinkedList_create();
+    if (!cities.cities_list) return -1;
+
+    cities_snapshot* snapshot = (cities_snapshot*)calloc(1, sizeof(cities_snapshot));
+    if (!snapshot) {
+        LinkedList_dispose(&cities.cities_list, city_dispose);
+        return -1;
+    }
+
+    // One reload at a time, the folder is read and written here
+    pthread_mutex_lock(&g_citiesReloadLock);
+    create_folder(CACHE_DIR);
+    // The trees of the store file and of the body are gone with it
+    arena scratch = ARENA_INIT(JSON_ARENA_BLOCK_SIZE);
+    arena_set_tag(&scratch, MEM_TAG_JANSSON);
+    json_arena_begin(&scratch);
+    cities_load_from_disk(&cities);
+    cities_read_from_string_list(&cities);
+    cities_save_to_disk(&cities);
+    int result = cities_convert_to_char_json_buffer(&cities);
+    json_arena_end();
+    arena_dispose(&scratch);
+    if (result == 0 && cities_build_registry(snapshot, cities.cities_list) != 0) result = -1;
+    LinkedList_dispose(&cities.cities_list, city_dispose);
+    if (result != 0) {
+        free(cities.buffer);
+        pthread_mutex_unlock(&g_citiesReloadLock);
+        cities_snapshot_free(snapshot);
+        return -1;
+    }
+
+    // Shared blobs, a response sending one holds it past the snapshot.
+    // Identity keeps its NUL for the backend's copy.
+    snapshot->lengths[COMPRESS_IDENTITY] = (size_t)cities.bytesread;
+    snapshot->bodies[COMPRESS_IDENTITY] =
+        shared_blob_copy((const uint8_t*)cities.buffer, snapshot->lengths[COMPRESS_IDENTITY] + 1);
+    snapshot->last_modified = time(NULL);
+    http_etag_from_data(snapshot->etags[COMPRESS_IDENTITY], cities.buffer, snapshot->lengths[COMPRESS_IDENTITY]);
+    for (int i = COMPRESS_IDENTITY + 1; i < COMPRESS_ENCODINGS && snapshot->bodies[COMPRESS_IDENTITY]; i++) {
+        if (snapshot->lengths[COMPRESS_IDENTITY] < COMPRESS_MIN_SIZE) break;
+        uint8_t* body = compress_alloc((compress_encoding)i, cities.buffer, snapshot->lengths[COMPRESS_IDENTITY],
+                                       &snapshot->lengths[i]);
+        snapshot->bodies[i] = body ? shared_blob_copy(body, snapshot->lengths[i]) : NULL;
+        free(body);
+        memcpy(snapshot->etags[i], snapshot->etags[COMPRESS_IDENTITY], HTTP_ETAG_SIZE);
+        http_etag_variant(snapshot->etags[i], compress_encoding_name((compress_encoding)i));
+    }
+    uint8_t* cbor = cbor_from_json(cities.buffer, snapshot->lengths[COMPRESS_IDENTITY], &snapshot->cbor_length);
+    if (cbor) {
+        snapshot->cbor = shared_blob_copy(cbor, snapshot->cbor_length);
+        http_etag_from_data(snapshot->cbor_etag, cbor, snapshot->cbor_length);
+        free(cbor);
+    }
+    free(cities.buffer);
+    if (!snapshot->bodies[COMPRESS_IDENTITY]) {
+        pthread_mutex_unlock(&g_citiesReloadLock);
+        cities_snapshot_free(snapshot);
+        return -1;
+    }
 
+    // Requests on the loops may still be reading the one it replaces
+    epoch_retire(epoch_publish((void**)&g_citiesSnapshot, snapshot), cities_snapshot_retired);
+    pthread_mutex_unlock(&g_citiesReloadLock);
+    LOG_INFO("Cities: Snapshot built, %zu bytes", snapshot->lengths[COMPRESS_IDENTITY]);
     return 0;
 }
+
+const cities_snapshot* cities_current(void) {
+    return __atomic_load_n(&g_citiesSnapshot, __ATOMIC_ACQUIRE);
+}
+
+int cities_warmup(void) {
+    if (cities_current()) return 0;
+    return cities_reload();
+}
+
+int cities_locations(double* latitudes, double* longitudes, int max) {
+    cities_t cities;
+    memset(&cities, 0, sizeof(cities_t));
+    cities.cities_list = LinkedList_create();
+    if (!cities.cities_list) return 0;
+
+    int count = 0;
+    cities_read_from_string_list(&cities);
+    Node* node = cities.cities_list->head;
+    while (node && count < max) {
+        city_t* city = (city_t*)node->item;
+        latitudes[count] = city->latitude;
+        longitudes[count] = city->longitude;
+        count++;
+        node = node->front;
+    }
+
+    LinkedList_dispose(&cities.cities_list, city_dispose);
+    return count;
+}
+
+void cities_each(void (*visit)(const char* name, double latitude, double longitude, void* context), void* context) {
+    const cities_snapshot* snapshot = cities_current();
+    if (snapshot) {
+        for (int i = 0; i < snapshot->entry_count; i++) {
+            visit(snapshot->entries[i].name, snapshot->entries[i].latitude, snapshot->entries[i].longitude, context);
+        }
+        return;
+    }
+
+    cities_t cities;
+    memset(&cities, 0, sizeof(cities_t));
+    cities.cities_list = LinkedList_create();
+    if (!cities.cities_list) return;
+
+    cities_read_from_string_list(&cities);
+    Node* node = cities.cities_list->head;
+    while (node) {
+        city_t* city = (city_t*)node->item;
+        visit(city->name, city->latitude, city->longitude, context);
+        node = node->front;
+    }
+
+    LinkedList_dispose(&cities.cities_list, city_dispose);
+}
+
+void cities_global_dispose(void) {
+    // The superseded ones went with epoch_dispose
+    if (g_citiesSnapshot) cities_snapshot_free(g_citiesSnapshot);
+    g_citiesSnapshot = NULL;
+}
@@ -0,0 +1,229 @@
+#include "backends/cities_weather.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "backends/cities.h"
+#include "backends/weather.h"
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+#include "utilities/shared_blob.h"
+#include "utilities/subscription.h"
+#include "smw.h"
+
+typedef struct {
+    subscription member;
+    char* name;
+    double latitude;
+    double longitude;
+    // The newest forecast delivered, a reference; NULL until there is one
+    const response_blob* forecast;
+} cities_weather_city;
+
+static __thread cities_weather_city* t_cities = NULL;
+static __thread int t_cityCount = 0;
+// The registry the cities came from, compared only: a reload follows the new list
+static __thread const cities_snapshot* t_source = NULL;
+static __thread response_blob* t_bundle = NULL;
+// Oldest forecast of the bundle, 0 while a city has none
+static __thread time_t t_oldest = 0;
+static __thread int t_dirty = 0;
+static __thread smw_task* t_rebuildTask = NULL;
+
+// Every loop's
+static metrics_counter g_rebuilds;
+
+static void cities_weather_on_update(void* context, const response_blob* blob) {
+    cities_weather_city* city = (cities_weather_city*)context;
+    if (city->forecast && blob->last_modified <= city->forecast->last_modified) return;
+    response_blob_retain(blob);
+    response_blob_release(city->forecast);
+    city->forecast = blob;
+    // Several in one pass come out as one rebuild
+    t_dirty = 1;
+    smw_wakeTask(t_rebuildTask);
+}
+
+static void cities_weather_leave(void) {
+    for (int i = 0; i < t_cityCount; i++) {
+        weather_unsubscribe(&t_cities[i].member);
+        response_blob_release(t_cities[i].forecast);
+        free(t_cities[i].name);
+    }
+    free(t_cities);
+    t_cities = NULL;
+    t_cityCount = 0;
+    t_source = NULL;
+}
+
+static void cities_weather_collect(const char* name, double latitude, double longitude, void* context) {
+    (void)context;
+    if (t_cityCount >= CitiesWeather_MAX_CITIES) return;
+    cities_weather_city* city = &t_cities[t_cityCount];
+    city->name = strdup(name);
+    if (!city->name) return;
+    city->latitude = latitude;
+    city->longitude = longitude;
+    city->member.key = -1;
+    t_cityCount++;
+}
+
+// Follows every city of the registry, what the hot cache has already is the start
+static int cities_weather_join(void) {
+    cities_weather_leave();
+    t_cities = (cities_weather_city*)calloc(CitiesWeather_MAX_CITIES, sizeof(cities_weather_city));
+    if (!t_cities) return -1;
+    t_source = cities_current();
+    cities_each(cities_weather_collect, NULL);
+
+    for (int i = 0; i < t_cityCount; i++) {
+        cities_weather_city* city = &t_cities[i];
+        double latitude = city->latitude;
+        double longitude = city->longitude;
+        weather_quantize(&latitude, &longitude);
+        const response_blob* current = NULL;
+        if (weather_subscribe(&city->member, latitude, longitude, cities_weather_on_update, city, &current) != 0) {
+            LOG_WARN("CitiesWeather: Could not follow %s", city->name);
+            continue;
+        }
+        city->forecast = current;
+    }
+    t_dirty = 1;
+    return 0;
+}
+
+// JSON string contents of value, at most 6 bytes each
+static size_t cities_weather_escape(char* out, const char* value) {
+    size_t n = 0;
+    for (const unsigned char* c = (const unsigned char*)value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)*c;
+        } else if (*c < 0x20) {
+            n += (size_t)sprintf(out + n, "\\u%04x", *c);
+        } else {
+            out[n++] = (char)*c;
+        }
+    }
+    return n;
+}
+
+static int cities_weather_build(void) {
+    size_t size = 3;
+    for (int i = 0; i < t_cityCount; i++) {
+        const response_blob* forecast = t_cities[i].forecast;
+        size += strlen(t_cities[i].name) * 6 + 96 + (forecast ? forecast->lengths[COMPRESS_IDENTITY] : 4);
+    }
+    char* body = (char*)malloc(size);
+    if (!body) return -1;
+
+    size_t length = 0;
+    time_t newest = 0;
+    time_t oldest = 0;
+    int missing = 0;
+    body[length++] = '[';
+    for (int i = 0; i < t_cityCount; i++) {
+        const cities_weather_city* city = &t_cities[i];
+        if (i > 0) body[length++] = ',';
+        length += (size_t)sprintf(body + length, "{\"name\":\"");
+        length += cities_weather_escape(body + length, city->name);
+        length += (size_t)sprintf(body + length, "\",\"latitude\":%.4f,\"longitude\":%.4f,\"weather\":",
+                                  city->latitude, city->longitude);
+        if (city->forecast) {
+            memcpy(body + length, city->forecast->bodies[COMPRESS_IDENTITY], city->forecast->lengths[COMPRESS_IDENTITY]);
+            length += city->forecast->lengths[COMPRESS_IDENTITY];
+            if (city->forecast->last_modified > newest) newest = city->forecast->last_modified;
+            if (oldest == 0 || city->forecast->last_modified < oldest) oldest = city->forecast->last_modified;
+        } else {
+            memcpy(body + length, "null", 4);
+            length += 4;
+            missing++;
+        }
+        body[length++] = '}';
+    }
+    body[length++] = ']';
+
+    // A city's forecast only gets newer, the newest one dates the bundle
+    response_blob* bundle = response_blob_new(newest);
+    char etag[HTTP_ETAG_SIZE];
+    http_etag_from_data(etag, body, length);
+    uint8_t* identity = bundle ? shared_blob_copy((const uint8_t*)body, length) : NULL;
+    response_blob* set = identity ? response_blob_set(bundle, COMPRESS_IDENTITY, identity, length, etag) : NULL;
+    shared_blob_release(identity);
+    if (!set) {
+        response_blob_release(bundle);
+        free(body);
+        return -1;
+    }
+    bundle = set;
+    for (int i = COMPRESS_IDENTITY + 1; i < COMPRESS_ENCODINGS && length >= COMPRESS_MIN_SIZE; i++) {
+        size_t encoded_length = 0;
+        uint8_t* encoded = compress_alloc((compress_encoding)i, body, length, &encoded_length);
+        uint8_t* shared = encoded ? shared_blob_copy(encoded, encoded_length) : NULL;
+        free(encoded);
+        if (!shared) continue;
+        char variant[HTTP_ETAG_SIZE];
+        memcpy(variant, etag, HTTP_ETAG_SIZE);
+        http_etag_variant(variant, compress_encoding_name((compress_encoding)i));
+        // Only this loop holds it yet, set is the bundle itself
+        set = response_blob_set(bundle, (compress_encoding)i, shared, encoded_length, variant);
+        shared_blob_release(shared);
+        if (set) bundle = set;
+    }
+    free(body);
+
+    response_blob_release(t_bundle);
+    t_bundle = bundle;
+    t_oldest = missing ? 0 : oldest;
+    t_dirty = 0;
+    metrics_counter_add(&g_rebuilds, 1);
+    LOG_DEBUG("CitiesWeather: Rebuilt, %zu bytes, %d of %d without a forecast", length, missing, t_cityCount);
+    return 0;
+}
+
+static void cities_weather_rebuild_taskwork(void* context, uint64_t monTime) {
+    (void)context;
+    (void)monTime;
+    if (t_dirty) cities_weather_build();
+}
+
+int cities_weather_lookup(compress_encoding encoding, weather_hot_hit* hit) {
+    if (!t_rebuildTask) {
+        t_rebuildTask = smw_createTask(NULL, cities_weather_rebuild_taskwork);
+        if (!t_rebuildTask) return -1;
+        smw_setTaskName(t_rebuildTask, "cities_weather_rebuild");
+        smw_parkTask(t_rebuildTask);
+    }
+    // The first request, or the registry was reloaded since
+    if ((!t_cities || cities_current() != t_source) && cities_weather_join() != 0) return -1;
+    // Not waiting for the task, this request gets what the loop has now
+    if (t_dirty && cities_weather_build() != 0 && !t_bundle) return -1;
+
+    if (!t_bundle->bodies[encoding]) encoding = COMPRESS_IDENTITY;
+    hit->blob = t_bundle;
+    hit->body = t_bundle->bodies[encoding];
+    hit->length = t_bundle->lengths[encoding];
+    hit->encoding = encoding;
+    hit->etag = t_bundle->etags[encoding];
+    hit->last_modified = t_bundle->last_modified;
+    hit->stale = t_oldest != 0 && time(NULL) > weather_fresh_until(t_oldest);
+    return 0;
+}
+
+void cities_weather_register_metrics(void) {
+    metrics_register("cities_weather_rebuilds_total", "Times a loop rebuilt the all-cities forecast bundle.",
+                     METRICS_COUNTER, NULL, &g_rebuilds);
+}
+
+void cities_weather_release_thread(void) {
+    cities_weather_leave();
+    response_blob_release(t_bundle);
+    t_bundle = NULL;
+    t_dirty = 0;
+    if (t_rebuildTask) {
+        smw_destroyTask(t_rebuildTask);
+        t_rebuildTask = NULL;
+    }
+}
@@ -1,109 +1,544 @@
 #include "backends/geolocation.h"
 
+#include <ctype.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "backends/cities.h"
+#include "backends/geolocation_index.h"
+#include "backends/geolocation_nearest.h"
+#include "backends/geolocation_offline.h"
+#include "backends/weather.h"
+#include "utils.h"
+#include "utilities/cache_only.h"
+#include "utilities/record_store.h"
+#include "utilities/metrics.h"
+#include "utilities/probes.h"
+#include "utilities/response_cache.h"
+#include "utilities/shm_table.h"
+#include "utilities/url_codec.h"
+#include "utilities/logger.h"
+
 int process_openmeteo_geo_response(const char* api_response, char** client_response);
 
-int geolocation_set_parameters(void** ctx, char* location_name, int location_count, char* country_code) {
-    geolocation_t* geolocation = (geolocation_t*)(*ctx);
-    if (!geolocation) return -1;
+// ========== Result Cache ==========
+// A value is the query, a NUL and the client JSON, the query is compared on
+// every hit so two queries sharing a hash never see each other's results
+
+static record_store* g_geolocationStore = NULL;
+// Shared by the worker processes, see geolocation_open_shared; the file
+// is not written then, with or without the table
+static shm_table* g_sharedTable = NULL;
+static int g_storeReadOnly = 0;
+static __thread response_cache t_geolocationCache;
+
+static void geolocation_add_city(const char* name, double latitude, double longitude, void* context) {
+    (void)context;
+    // The built in list is Swedish cities
+    geolocation_nearest_add(0, name, "SE", latitude, longitude);
+}
 
-    if (location_name) {
-        geolocation->location_name = strdup(location_name);
-    } else return -1;
+// Lookups of every loop's hot cache and of the store
+static metrics_counter g_hotHits;
+static metrics_counter g_hotMisses;
+// Searches per loop with counts, for /admin/hotkeys
+static heavy_hitters g_geolocationHitters;
+static metrics_counter g_storeHits;
+static metrics_counter g_storeMisses;
+static metrics_counter g_sharedHits;
+static metrics_counter g_sharedMisses;
+
+static void geolocation_register_metrics(void) {
+    const char* help = "Cache lookups, by cache and result.";
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"geolocation_hot\",result=\"hit\"", &g_hotHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"geolocation_hot\",result=\"miss\"",
+                     &g_hotMisses);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"geolocation_disk\",result=\"hit\"",
+                     &g_storeHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"geolocation_disk\",result=\"miss\"",
+                     &g_storeMisses);
+}
 
-    if (location_count) {
-        geolocation->location_count = location_count;
-    } else {
-        geolocation->location_count = 5;
-    }
+// Written by main before the loops start, only read afterwards
+static char g_geolocationApiUrl[METEO_GEOLOCATION_API_URL_SIZE] = METEO_GEOLOCATION_API_URL;
 
-    if (country_code) {
-        geolocation->country_code = strdup(country_code);
-    }
+const char* geolocation_api_url(void) {
+    return g_geolocationApiUrl;
+}
 
+int geolocation_set_api_url(const char* base) {
+    if (strlen(base) >= sizeof(g_geolocationApiUrl)) return -1;
+    strcpy(g_geolocationApiUrl, base);
     return 0;
 }
 
-int parse_openmeteo_geo_json_to_location(const json_t* json_obj, location_t* location) {
-    if (!json_obj || !location) return -1;
+int geolocation_global_init(void) {
+    geolocation_register_metrics();
+    if (heavy_hitters_init(&g_geolocationHitters, Geolocation_HEAVY_HITTERS_WIDTH) != 0) return -1;
+    // Reverse lookups know the built in cities before any search ran
+    cities_each(geolocation_add_city, NULL);
+    create_folder(Geolocation_CACHE_DIR);
+    return record_store_open(&g_geolocationStore, Geolocation_STORE_PATH, Geolocation_STORE_CAPACITY,
+                             Geolocation_CACHE_TTL_SECONDS);
+}
 
-    memset(location, 0, sizeof(location_t));
+static void geolocation_warm_free(void);
+
+int geolocation_open_shared(void) {
+    g_storeReadOnly = 1;
+    g_sharedTable = shm_table_open(Geolocation_SHARED_ENTRIES, Geolocation_SHARED_VALUE_SIZE);
+    if (!g_sharedTable) return -1;
+    const char* help = "Cache lookups, by cache and result.";
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"geolocation_shared\",result=\"hit\"",
+                     &g_sharedHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"geolocation_shared\",result=\"miss\"",
+                     &g_sharedMisses);
+    return 0;
+}
 
-    json_t* val;
+void geolocation_global_dispose(void) {
+    record_store_close(&g_geolocationStore);
+    shm_table_close(&g_sharedTable);
+    geolocation_warm_free();
+    heavy_hitters_dispose(&g_geolocationHitters);
+}
 
-    val = json_object_get(json_obj, "id");
-    location->id = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+int geolocation_heavy_hitters(heavy_hitters_entry* out, int max) {
+    return heavy_hitters_top(&g_geolocationHitters, out, max);
+}
 
-    val = json_object_get(json_obj, "name");
-    location->name = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+void geolocation_release_thread(void) {
+    response_cache_dispose(&t_geolocationCache);
+}
 
-    val = json_object_get(json_obj, "latitude");
-    location->latitude = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+// The name's url_codec_key, the count, and the country upper case
+static char* geolocation_normalize(const geolocation_t* geolocation) {
+    size_t name_length = strlen(geolocation->location_name);
+    char* query = (char*)malloc(name_length + 32);
+    if (!query) return NULL;
 
-    val = json_object_get(json_obj, "longitude");
-    location->longitude = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+    size_t length = url_codec_key(geolocation->location_name, query, name_length + 1);
+    length += snprintf(query + length, 32, "|%d|", geolocation->location_count);
+    for (const char* p = geolocation->country_code; p && *p && length < name_length + 31; p++) {
+        query[length++] = (char)toupper((unsigned char)*p);
+    }
+    query[length] = '\0';
+    return query;
+}
 
-    val = json_object_get(json_obj, "elevation");
-    location->elevation = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+static uint64_t geolocation_hash(const char* query) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)query; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-    val = json_object_get(json_obj, "feature_code");
-    location->feature_code = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+// The body of a cached value if it is for this query and still good, a malloc'd copy
+static char* geolocation_cached_body(const geolocation_t* geolocation, const uint8_t* value, size_t length,
+                                     time_t stamp, time_t now) {
+    size_t query_length = strlen(geolocation->query);
+    if (length <= query_length || memcmp(value, geolocation->query, query_length + 1) != 0) return NULL;
+
+    const char* body = (const char*)value + query_length + 1;
+    size_t body_length = length - query_length - 1;
+    int negative = body_length == 2 && memcmp(body, "[]", 2) == 0;
+    if (now - stamp > (negative ? Geolocation_NEGATIVE_TTL_SECONDS : Geolocation_CACHE_TTL_SECONDS)) return NULL;
+
+    char* copy = (char*)malloc(body_length + 1);
+    if (!copy) return NULL;
+    memcpy(copy, body, body_length);
+    copy[body_length] = '\0';
+    return copy;
+}
 
-    val = json_object_get(json_obj, "country_code");
-    location->country_code = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+static uint8_t* geolocation_cache_value(const geolocation_t* geolocation, size_t* length) {
+    size_t query_length = strlen(geolocation->query);
+    size_t body_length = strlen(geolocation->buffer);
+    uint8_t* value = (uint8_t*)malloc(query_length + 1 + body_length);
+    if (!value) return NULL;
+    memcpy(value, geolocation->query, query_length + 1);
+    memcpy(value + query_length + 1, geolocation->buffer, body_length);
+    *length = query_length + 1 + body_length;
+    return value;
+}
 
-    val = json_object_get(json_obj, "admin1_id");
-    location->admin1_id = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+// ========== Hot Restart ==========
+// Values loaded by geolocation_warmup_keys before the workers start, read
+// only once it returns. Every loop's hot cache starts out with a copy.
+
+typedef struct {
+    uint64_t key;
+    time_t stamp;
+    time_t expires;
+    uint8_t* value;
+    size_t length;
+} geolocation_warm_entry;
+
+static geolocation_warm_entry* g_warm = NULL;
+static int g_warmCount = 0;
+
+static void geolocation_warm_free(void) {
+    for (int i = 0; i < g_warmCount; i++) free(g_warm[i].value);
+    free(g_warm);
+    g_warm = NULL;
+    g_warmCount = 0;
+}
 
-    val = json_object_get(json_obj, "admin2_id");
-    location->admin2_id = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+// The first use of the loop's hot cache
+static int geolocation_hot_init(void) {
+    if (t_geolocationCache.entries) return 0;
+    if (response_cache_init(&t_geolocationCache, Geolocation_HOT_CACHE_ENTRIES, Geolocation_HOT_CACHE_BYTES, NULL) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < g_warmCount; i++) {
+        const geolocation_warm_entry* warm = &g_warm[i];
+        response_cache_entry* entry = response_cache_insert(&t_geolocationCache, warm->key, warm->stamp, warm->expires);
+        if (!entry) break;
+        response_cache_set(&t_geolocationCache, entry, COMPRESS_IDENTITY, warm->value, warm->length, NULL);
+        // Loaded, not asked for
+        entry->hits = 0;
+    }
+    return 0;
+}
 
-    val = json_object_get(json_obj, "admin3_id");
-    location->admin3_id = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+void geolocation_handoff_freeze(int frozen) {
+    record_store_freeze(g_geolocationStore, frozen);
+}
 
-    val = json_object_get(json_obj, "admin4_id");
-    location->admin4_id = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+typedef struct {
+    uint64_t key;
+    time_t stamp;
+} geolocation_handoff_candidate;
+
+typedef struct {
+    geolocation_handoff_candidate* candidates;
+    int count;
+    int capacity;
+    time_t now;
+} geolocation_handoff_scan;
+
+static void geolocation_handoff_collect(uint64_t key, time_t stamp, size_t length, void* context) {
+    (void)length;
+    geolocation_handoff_scan* scan = (geolocation_handoff_scan*)context;
+    if (stamp + Geolocation_CACHE_TTL_SECONDS <= scan->now) return;
+    if (scan->count == scan->capacity) {
+        int capacity = scan->capacity ? scan->capacity * 2 : 64;
+        geolocation_handoff_candidate* grown =
+            (geolocation_handoff_candidate*)realloc(scan->candidates, capacity * sizeof(geolocation_handoff_candidate));
+        if (!grown) return;
+        scan->candidates = grown;
+        scan->capacity = capacity;
+    }
+    scan->candidates[scan->count].key = key;
+    scan->candidates[scan->count].stamp = stamp;
+    scan->count++;
+}
 
-    val = json_object_get(json_obj, "timezone");
-    location->timezone = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+static int geolocation_handoff_newest_first(const void* a, const void* b) {
+    time_t stamp_a = ((const geolocation_handoff_candidate*)a)->stamp;
+    time_t stamp_b = ((const geolocation_handoff_candidate*)b)->stamp;
+    return stamp_a < stamp_b ? 1 : (stamp_a > stamp_b ? -1 : 0);
+}
 
-    val = json_object_get(json_obj, "population");
-    location->population = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+int geolocation_handoff_keys(uint64_t* keys, int max) {
+    geolocation_handoff_scan scan = {NULL, 0, 0, time(NULL)};
+    record_store_each(g_geolocationStore, 0, geolocation_handoff_collect, &scan);
+    qsort(scan.candidates, scan.count, sizeof(geolocation_handoff_candidate), geolocation_handoff_newest_first);
+    int count = scan.count < max ? scan.count : max;
+    for (int i = 0; i < count; i++) keys[i] = scan.candidates[i].key;
+    free(scan.candidates);
+    return count;
+}
 
-    val = json_object_get(json_obj, "postcodes");
-    if (json_is_array(val)) {
-        size_t count = json_array_size(val);
-        location->postcodes_count = count;
-        location->postcodes = (char**)malloc(count * sizeof(char*));
-        if (location->postcodes) {
-            for (size_t i = 0; i < count; i++) {
-                json_t* postcode = json_array_get(val, i);
-                location->postcodes[i] = (json_is_string(postcode) && json_string_value(postcode)) 
-                    ? strdup(json_string_value(postcode)) : NULL;
+int geolocation_warmup_keys(const uint64_t* keys, int count) {
+    if (!g_geolocationStore) return 0;
+    geolocation_warm_free();
+    // A loop's hot cache holds no more than this
+    int keep = count < Geolocation_HOT_CACHE_ENTRIES ? count : Geolocation_HOT_CACHE_ENTRIES;
+    if (keep > 0) g_warm = (geolocation_warm_entry*)calloc(keep, sizeof(geolocation_warm_entry));
+    if (!g_warm) return 0;
+
+    time_t now = time(NULL);
+    for (int i = 0; i < count && g_warmCount < keep; i++) {
+        geolocation_warm_entry* warm = &g_warm[g_warmCount];
+        if (record_store_get(g_geolocationStore, keys[i], 0, &warm->value, &warm->length, &warm->stamp) != 0) continue;
+        // The query, a NUL and the body, as geolocation_cached_body reads it
+        const uint8_t* body = memchr(warm->value, '\0', warm->length);
+        size_t body_length = body ? warm->length - (size_t)(body + 1 - warm->value) : 0;
+        int negative = body_length == 2 && memcmp(body + 1, "[]", 2) == 0;
+        warm->key = keys[i];
+        warm->expires = warm->stamp + (negative ? Geolocation_NEGATIVE_TTL_SECONDS : Geolocation_CACHE_TTL_SECONDS);
+        if (!body || warm->expires <= now) {
+            free(warm->value);
+            memset(warm, 0, sizeof(geolocation_warm_entry));
+            continue;
+        }
+        g_warmCount++;
+    }
+    LOG_INFO("GeoLocation: Warmed %d of %d entries handed over", g_warmCount, count);
+    return g_warmCount;
+}
+
+// ========== Hot Cache ==========
+
+static int geolocation_hot_lookup(geolocation_t* geolocation) {
+    if (g_warmCount > 0) geolocation_hot_init();
+    heavy_hitters_add(&g_geolocationHitters, geolocation->key, geolocation->query);
+    time_t now = time(NULL);
+    response_cache_entry* entry =
+        t_geolocationCache.entries ? response_cache_find(&t_geolocationCache, geolocation->key, now) : NULL;
+    if (!entry || !entry->blob || !entry->blob->bodies[COMPRESS_IDENTITY]) {
+        metrics_counter_add(&g_hotMisses, 1);
+        return -1;
+    }
+    metrics_counter_add(&g_hotHits, 1);
+    geolocation->buffer = geolocation_cached_body(geolocation, entry->blob->bodies[COMPRESS_IDENTITY],
+                                                  entry->blob->lengths[COMPRESS_IDENTITY], entry->last_modified, now);
+    return geolocation->buffer ? 0 : -1;
+}
+
+static void geolocation_hot_store(const geolocation_t* geolocation, time_t stamp) {
+    if (geolocation_hot_init() != 0) return;
+    int negative = strcmp(geolocation->buffer, "[]") == 0;
+    time_t expires = stamp + (negative ? Geolocation_NEGATIVE_TTL_SECONDS : Geolocation_CACHE_TTL_SECONDS);
+    response_cache_entry* entry = response_cache_insert(&t_geolocationCache, geolocation->key, stamp, expires);
+    if (!entry) return;
+
+    size_t length = 0;
+    uint8_t* value = geolocation_cache_value(geolocation, &length);
+    if (!value) return;
+    response_cache_set(&t_geolocationCache, entry, COMPRESS_IDENTITY, value, length, NULL);
+    free(value);
+}
+
+// Pool thread, the loop waits in GeoLocation_State_LoadFromDisk
+static void geolocation_load_job_work(void* ctx) {
+    geolocation_t* geolocation = (geolocation_t*)ctx;
+    uint8_t* value = NULL;
+    size_t length = 0;
+    time_t stamp = 0;
+    // What any worker process fetched, then the file
+    int shared = g_sharedTable && shm_table_get(g_sharedTable, geolocation->key, 0, &value, &length, &stamp) == 0;
+    if (g_sharedTable) metrics_counter_add(shared ? &g_sharedHits : &g_sharedMisses, 1);
+    if (!shared) {
+        if (!g_geolocationStore ||
+            record_store_get(g_geolocationStore, geolocation->key, 0, &value, &length, &stamp) != 0) {
+            metrics_counter_add(&g_storeMisses, 1);
+            return;
+        }
+        metrics_counter_add(&g_storeHits, 1);
+    }
+    geolocation->buffer = geolocation_cached_body(geolocation, value, length, stamp, time(NULL));
+    free(value);
+    // Results stored by an earlier run feed the type-ahead index
+    if (geolocation->buffer) geolocation_index_add_results(geolocation->buffer);
+}
+
+static void geolocation_load_job_done(void* ctx) {
+    geolocation_t* geolocation = (geolocation_t*)ctx;
+    geolocation->job = NULL;
+    trace_mark(geolocation->trace, TRACE_CACHED);
+    if (geolocation->buffer) {
+        // Next time this loop answers from memory
+        geolocation_hot_store(geolocation, time(NULL));
+        LOG_DEBUG("GeoLocation: Loaded From Disk");
+        geolocation->cache = ACCESS_CACHE_DISK;
+        geolocation->state = GeoLocation_State_Done;
+    } else {
+        geolocation->state = GeoLocation_State_FetchFromAPI_Init;
+    }
+    geolocation->on_wake(geolocation->ctx);
+}
+
+// Pool thread, the loop waits in GeoLocation_State_SaveToDisk
+static void geolocation_save_job_work(void* ctx) {
+    geolocation_t* geolocation = (geolocation_t*)ctx;
+    size_t length = 0;
+    uint8_t* value = geolocation_cache_value(geolocation, &length);
+    if (!value) return;
+    // Worker processes do not write the file, one writer per file
+    if (g_sharedTable) {
+        if (shm_table_put(g_sharedTable, geolocation->key, 0, value, length, time(NULL), 0) != 0)
+            LOG_DEBUG("GeoLocation: Not Kept In Shared Memory");
+    } else if (!g_storeReadOnly && record_store_put(g_geolocationStore, geolocation->key, 0, value, length, time(NULL)) != 0) {
+        LOG_WARN("GeoLocation: Saving To Disk Failed");
+    }
+    free(value);
+}
+
+static void geolocation_save_job_done(void* ctx) {
+    geolocation_t* geolocation = (geolocation_t*)ctx;
+    geolocation->job = NULL;
+    geolocation->state = GeoLocation_State_Done;
+    geolocation->on_wake(geolocation->ctx);
+}
+
+// ========== Weather Prefetch ==========
+// Forecasts of the top results, for the /GetWeather that follows a search
+
+static void geolocation_prefetch_weather(geolocation_t* geolocation) {
+    if (geolocation->prefetch <= 0 || !geolocation->buffer) return;
+    json_scan scan;
+    json_scan_init(&scan, geolocation->buffer, strlen(geolocation->buffer));
+    if (json_scan_array_begin(&scan) != 0) return;
+    for (int i = 0; i < geolocation->prefetch && json_scan_array_next(&scan) == 1; i++) {
+        double latitude = 0.0;
+        double longitude = 0.0;
+        int found = 0;
+        if (json_scan_object_begin(&scan) != 0) return;
+        const char* key;
+        size_t length;
+        while (json_scan_object_next(&scan, &key, &length) == 1) {
+            if (json_scan_key_is(key, length, "latitude")) {
+                found |= json_scan_number(&scan, &latitude) == 0 ? 1 : 0;
+            } else if (json_scan_key_is(key, length, "longitude")) {
+                found |= json_scan_number(&scan, &longitude) == 0 ? 2 : 0;
+            } else {
+                json_scan_skip(&scan);
             }
         }
+        if (scan.failed) return;
+        if (found == 3) weather_prefetch_location(latitude, longitude);
     }
+}
 
-    val = json_object_get(json_obj, "country_id");
-    location->country_id = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+// ========== Backend ==========
 
-    val = json_object_get(json_obj, "country");
-    location->country = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+int geolocation_set_prefetch(void** ctx, int results) {
+    geolocation_t* geolocation = (geolocation_t*)(*ctx);
+    if (!geolocation) return -1;
+    geolocation->prefetch = results;
+    return 0;
+}
 
-    val = json_object_get(json_obj, "admin1");
-    location->admin1 = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+int geolocation_set_parameters(void** ctx, char* location_name, int location_count, char* country_code) {
+    geolocation_t* geolocation = (geolocation_t*)(*ctx);
+    if (!geolocation) return -1;
 
-    val = json_object_get(json_obj, "admin2");
-    location->admin2 = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+    if (location_name) {
+        geolocation->location_name = strdup(location_name);
+    } else return -1;
 
-    val = json_object_get(json_obj, "admin3");
-    location->admin3 = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+    if (location_count) {
+        geolocation->location_count = location_count;
+    } else {
+        geolocation->location_count = 5;
+    }
 
-    val = json_object_get(json_obj, "admin4");
-    location->admin4 = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+    if (country_code) {
+        geolocation->country_code = strdup(country_code);
+    }
 
     return 0;
 }
 
+// What is read of a result, other members are stepped over
+typedef enum { GEOLOCATION_FIELD_INT, GEOLOCATION_FIELD_REAL, GEOLOCATION_FIELD_STRING } geolocation_field_type;
+
+typedef struct {
+    const char* name;
+    size_t offset;
+    geolocation_field_type type;
+} geolocation_field;
+
+#define GEOLOCATION_FIELD(member, type) {#member, offsetof(location_t, member), type}
+
+static const geolocation_field geolocation_fields[] = {
+    GEOLOCATION_FIELD(id, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(name, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(latitude, GEOLOCATION_FIELD_REAL),
+    GEOLOCATION_FIELD(longitude, GEOLOCATION_FIELD_REAL),
+    GEOLOCATION_FIELD(elevation, GEOLOCATION_FIELD_REAL),
+    GEOLOCATION_FIELD(feature_code, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(country_code, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(admin1_id, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(admin2_id, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(admin3_id, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(admin4_id, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(timezone, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(population, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(country_id, GEOLOCATION_FIELD_INT),
+    GEOLOCATION_FIELD(country, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(admin1, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(admin2, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(admin3, GEOLOCATION_FIELD_STRING),
+    GEOLOCATION_FIELD(admin4, GEOLOCATION_FIELD_STRING),
+};
+
+// The postcodes array next at the scanner, the strings of it
+static void geolocation_scan_postcodes(json_scan* scan, location_t* location) {
+    if (json_scan_peek(scan) != JSON_SCAN_ARRAY) {
+        json_scan_skip(scan);
+        return;
+    }
+    size_t capacity = location->postcodes_count;
+    json_scan_array_begin(scan);
+    while (json_scan_array_next(scan) > 0) {
+        if (json_scan_peek(scan) != JSON_SCAN_STRING) {
+            json_scan_skip(scan);
+            continue;
+        }
+        if (location->postcodes_count == capacity) {
+            size_t grown = capacity ? capacity * 2 : 4;
+            char** postcodes = (char**)realloc(location->postcodes, grown * sizeof(char*));
+            if (!postcodes) {
+                json_scan_skip(scan);
+                continue;
+            }
+            location->postcodes = postcodes;
+            capacity = grown;
+        }
+        char* postcode = json_scan_string_dup(scan);
+        if (postcode) location->postcodes[location->postcodes_count++] = postcode;
+    }
+}
+
+int parse_openmeteo_geo_json_to_location(json_scan* scan, location_t* location) {
+    if (!scan || !location) return -1;
+
+    memset(location, 0, sizeof(location_t));
+    if (json_scan_object_begin(scan) != 0) return -1;
+
+    const char* key;
+    size_t length;
+    while (json_scan_object_next(scan, &key, &length) > 0) {
+        if (json_scan_key_is(key, length, "postcodes")) {
+            geolocation_scan_postcodes(scan, location);
+            continue;
+        }
+        const geolocation_field* field = NULL;
+        for (size_t i = 0; i < sizeof(geolocation_fields) / sizeof(geolocation_fields[0]) && !field; i++) {
+            if (json_scan_key_is(key, length, geolocation_fields[i].name)) field = &geolocation_fields[i];
+        }
+
+        char* base = (char*)location;
+        json_scan_type type = json_scan_peek(scan);
+        double number;
+        if (field && field->type == GEOLOCATION_FIELD_STRING && type == JSON_SCAN_STRING) {
+            char** value = (char**)(base + field->offset);
+            free(*value);
+            *value = json_scan_string_dup(scan);
+        } else if (field && field->type != GEOLOCATION_FIELD_STRING && type == JSON_SCAN_NUMBER &&
+                   json_scan_number(scan, &number) == 0) {
+            if (field->type == GEOLOCATION_FIELD_REAL) {
+                *(double*)(base + field->offset) = number;
+            } else {
+                *(int*)(base + field->offset) = (int)number;
+            }
+        } else {
+            json_scan_skip(scan);
+        }
+    }
+    if (scan->failed) {
+        free_location(location);
+        return -1;
+    }
+    return 0;
+}
+
 int serialize_location_to_json(const location_t* location, json_t** json_obj) {
     if (!location || !json_obj) return -1;
 
@@ -147,45 +582,51 @@ int serialize_location_to_json(const location_t* location, json_t** json_obj) {
 }
 
 int process_openmeteo_geo_response(const char* api_response, char** client_response) {
-    json_error_t error;
-    json_t* root_api = json_loads(api_response, 0, &error);
-    if (!root_api) return -1;
-
-    // The API returns {"results": [array of locations]}
-    json_t* results_array = json_object_get(root_api, "results");
-    if (!json_is_array(results_array) || json_array_size(results_array) == 0) {
-        json_decref(root_api);
-        return -1;
-    }
+    json_scan scan;
+    json_scan_init(&scan, api_response, strlen(api_response));
+    if (json_scan_object_begin(&scan) != 0) return -1;
 
-    // Create an array to hold all location results
     json_t* client_array = json_array();
-    if (!client_array) {
-        json_decref(root_api);
-        return -1;
-    }
-
-    // Process all results
-    size_t num_results = json_array_size(results_array);
-    for (size_t i = 0; i < num_results; i++) {
-        json_t* result_item = json_array_get(results_array, i);
-        if (!result_item) continue;
-
-        location_t location;
-        if (parse_openmeteo_geo_json_to_location(result_item, &location) == 0) {
-            json_t* location_json;
-            if (serialize_location_to_json(&location, &location_json) == 0) {
-                json_array_append_new(client_array, location_json);
+    if (!client_array) return -1;
+
+    // The API returns {"results": [array of locations]}, without results
+    // when nothing matched and {"error": true, ...} when it failed. Each
+    // result goes to the client array as soon as it is read.
+    int error = 0;
+    const char* key;
+    size_t length;
+    while (json_scan_object_next(&scan, &key, &length) > 0) {
+        if (json_scan_key_is(key, length, "error") && json_scan_peek(&scan) == JSON_SCAN_TRUE) {
+            error = 1;
+            json_scan_skip(&scan);
+        } else if (json_scan_key_is(key, length, "results") && json_scan_peek(&scan) == JSON_SCAN_ARRAY) {
+            json_scan_array_begin(&scan);
+            while (json_scan_array_next(&scan) > 0) {
+                location_t location;
+                if (json_scan_peek(&scan) != JSON_SCAN_OBJECT) {
+                    json_scan_skip(&scan);
+                    continue;
+                }
+                if (parse_openmeteo_geo_json_to_location(&scan, &location) != 0) break;
+                json_t* location_json;
+                if (serialize_location_to_json(&location, &location_json) == 0) {
+                    json_array_append_new(client_array, location_json);
+                }
+                free_location(&location);
             }
-            free_location(&location);
+        } else {
+            json_scan_skip(&scan);
         }
     }
 
-    *client_response = json_dumps(client_array, JSON_COMPACT);
+    if (error || scan.failed || json_scan_peek(&scan) != JSON_SCAN_END) {
+        json_decref(client_array);
+        return -1;
+    }
+    *client_response = json_arena_dumps(client_array, JSON_COMPACT);
     json_decref(client_array);
-    json_decref(root_api);
-    
-    return 0;
+
+    return *client_response ? 0 : -1;
 }
 
 void free_location(location_t* location) {
@@ -211,22 +652,25 @@ void free_location(location_t* location) {
     memset(location, 0, sizeof(location_t));
 }
 
-int geolocation_init(void** ctx, void** ctx_struct, void (*on_done)(void* context)) {
+int geolocation_init(void** ctx, void** ctx_struct, void (*on_done)(void* context), void (*on_wake)(void* context)) {
     geolocation_t* geolocation = (geolocation_t*)malloc(sizeof(geolocation_t));
     if (!geolocation) { return -1; }
 
     memset(geolocation, 0, sizeof(geolocation_t));
     geolocation->ctx = ctx;
     geolocation->on_done = on_done;
+    geolocation->on_wake = on_wake;
 
-    geolocation->curl_client = (curl_client*)malloc(sizeof(curl_client));
-    memset(geolocation->curl_client, 0, sizeof(curl_client));
 
     geolocation->location_name = NULL;
     geolocation->location_count = 0;
     geolocation->country_code = NULL;
 
+    geolocation->prefetch = Geolocation_PREFETCH_WEATHER;
+
     geolocation->state = GeoLocation_State_Init;
+    arena_init(&geolocation->arena, JSON_ARENA_BLOCK_SIZE);
+    arena_set_tag(&geolocation->arena, MEM_TAG_JANSSON);
     *ctx_struct = (void*)geolocation;
 
     return 0;
@@ -236,89 +680,156 @@ int geolocation_work(void** ctx) {
     geolocation_t* geolocation = (geolocation_t*)(*ctx);
     if (!geolocation) { return -1; }
 
+    PROBE3(backend_state, "geolocation", geolocation, (int)geolocation->state);
     switch (geolocation->state) {
         case GeoLocation_State_Init: {
-            printf("GeoLocation: Initialized\n");
-            geolocation->state = GeoLocation_State_FetchFromAPI_Init;
+            LOG_DEBUG("GeoLocation: Initialized");
+            geolocation->query = geolocation_normalize(geolocation);
+            if (!geolocation->query) {
+                geolocation->state = GeoLocation_State_FetchFromAPI_Init;
+                break;
+            }
+            geolocation->key = geolocation_hash(geolocation->query);
+            if (geolocation_hot_lookup(geolocation) == 0) {
+                trace_mark(geolocation->trace, TRACE_CACHED);
+                LOG_DEBUG("GeoLocation: Served From Memory");
+                geolocation->cache = ACCESS_CACHE_HOT;
+                geolocation->state = GeoLocation_State_Done;
+                break;
+            }
+            json_arena_begin(&geolocation->arena);
+            int offline = geolocation_offline_search(geolocation->location_name, geolocation->location_count,
+                                                     geolocation->country_code, &geolocation->buffer);
+            json_arena_end();
+            if (offline == 0) {
+                LOG_DEBUG("GeoLocation: Served From Offline Dataset");
+                geolocation->cache = ACCESS_CACHE_LOCAL;
+                geolocation->state = GeoLocation_State_Done;
+                break;
+            }
+            if (geolocation_index_search(geolocation->location_name, geolocation->location_count,
+                                         geolocation->country_code, &geolocation->buffer) == 0) {
+                LOG_DEBUG("GeoLocation: Served From Index");
+                geolocation->cache = ACCESS_CACHE_LOCAL;
+                geolocation->state = GeoLocation_State_Done;
+                break;
+            }
+            geolocation->job = g_geolocationStore || g_sharedTable
+                                   ? job_pool_submit(geolocation_load_job_work, geolocation_load_job_done, geolocation)
+                                   : NULL;
+            geolocation->state = geolocation->job ? GeoLocation_State_LoadFromDisk : GeoLocation_State_FetchFromAPI_Init;
             break;
         }
+        case GeoLocation_State_LoadFromDisk: {
+            // Waiting for geolocation_load_job_done
+            return BACKEND_WORK_WAIT;
+        }
         case GeoLocation_State_FetchFromAPI_Init: {
-            if (curl_client_init(&geolocation->curl_client) != 0) {
+            LOG_DEBUG("GeoLocation: Fetching From API");
+            // The name arrives decoded, it goes upstream escaped again
+            char name[4096];
+            if (url_codec_encode(geolocation->location_name, name, sizeof(name)) >= sizeof(name)) {
+                LOG_WARN("GeoLocation: Name too long to search for");
                 geolocation->state = GeoLocation_State_Done;
                 break;
             }
-            printf("GeoLocation: Fetching From API\n");
-            geolocation->state = GeoLocation_State_FetchFromAPI_Request;
-            break;
-        }
-        case GeoLocation_State_FetchFromAPI_Request: {
-            printf("GeoLocation: Making API Request\n");
             char url[4096];
-            snprintf(url, sizeof(url), METEO_GEOLOCATION_URL, geolocation->location_name, geolocation->location_count);
+            snprintf(url, sizeof(url), METEO_GEOLOCATION_URL, g_geolocationApiUrl, name, geolocation->location_count);
             
             // Append country code if provided
             if (geolocation->country_code) {
-                char country_param[64];
-                snprintf(country_param, sizeof(country_param), "&country=%s", geolocation->country_code);
+                char country[64];
+                char country_param[80];
+                url_codec_encode(geolocation->country_code, country, sizeof(country));
+                snprintf(country_param, sizeof(country_param), "&country=%s", country);
                 strcat(url, country_param);
             }
 
-            if (curl_client_make_request(&geolocation->curl_client, url) != 0) {
-                printf("GeoLocation: Failed to make API request\n");
+            // Cache only, nothing new goes upstream
+            if (!cache_only_allows_fetch(url) && !single_flight_running(url)) {
+                geolocation->cache = ACCESS_CACHE_UNAVAILABLE;
                 geolocation->state = GeoLocation_State_Done;
                 break;
             }
+            // Identical searches in flight share one request
+            if (single_flight_join(&geolocation->flight, url, geolocation->on_wake, geolocation->ctx) != 0) {
+                LOG_WARN("GeoLocation: Failed to make API request");
+                geolocation->state = GeoLocation_State_Done;
+                break;
+            }
+            trace_mark(geolocation->trace, TRACE_FETCH_START);
             geolocation->state = GeoLocation_State_FetchFromAPI_Poll;
             break;
         }
         case GeoLocation_State_FetchFromAPI_Poll: {
-            printf("GeoLocation: Polling API Response\n");
-            if (curl_client_poll(&geolocation->curl_client) != 0) {
-                printf("GeoLocation: Polling failed\n");
+            int status = single_flight_poll(&geolocation->flight);
+            if (status == SINGLE_FLIGHT_RUNNING) return BACKEND_WORK_POLL;
+            if (status == SINGLE_FLIGHT_WAITING) return BACKEND_WORK_WAIT;
+            trace_mark(geolocation->trace, TRACE_FETCH_DONE);
+            if (status != SINGLE_FLIGHT_DONE) {
+                LOG_WARN("GeoLocation: Polling failed");
                 geolocation->state = GeoLocation_State_Done;
                 break;
             }
-            if (geolocation->curl_client->still_running) {
-                break;
-            } else {
-                geolocation->state = GeoLocation_State_FetchFromAPI_Read;
-            }
+            geolocation->state = GeoLocation_State_FetchFromAPI_Read;
             break;
         }
         case GeoLocation_State_FetchFromAPI_Read: {
-            printf("GeoLocation: Reading API Response\n");
-            if (curl_client_read_response(&geolocation->curl_client, &geolocation->buffer)) {
-                printf("GeoLocation: Failed to read response\n");
-                geolocation->state = GeoLocation_State_Done;
-                break;
-            }
-            curl_client_cleanup(&geolocation->curl_client);
+            LOG_DEBUG("GeoLocation: Reading API Response");
+            geolocation->buffer = geolocation->flight.body;
+            geolocation->flight.body = NULL;
+            geolocation->cache = geolocation->flight.primary ? ACCESS_CACHE_FETCH : ACCESS_CACHE_COALESCED;
             geolocation->state = GeoLocation_State_ProcessResponse;
             break;
         }
         case GeoLocation_State_ProcessResponse: {
             char* client_response = NULL;
-            if (process_openmeteo_geo_response(geolocation->buffer, &client_response) != 0) {
-                printf("GeoLocation: Processing Response Failed\n");
+            json_arena_begin(&geolocation->arena);
+            int result = process_openmeteo_geo_response(geolocation->buffer, &client_response);
+            if (result == 0) geolocation_index_add_results(client_response);
+            json_arena_end();
+            if (result != 0) {
+                LOG_WARN("GeoLocation: Processing Response Failed");
                 free(geolocation->buffer);
                 geolocation->buffer = NULL;
                 geolocation->state = GeoLocation_State_Done;
             } else {
                 free(geolocation->buffer);
                 geolocation->buffer = client_response;
-                geolocation->state = GeoLocation_State_Done;
-                printf("GeoLocation: Processing Response Succeeded\n");
+                geolocation->state = GeoLocation_State_SaveToDisk;
+                LOG_DEBUG("GeoLocation: Processing Response Succeeded");
             }
             break;
         }
+        case GeoLocation_State_SaveToDisk: {
+            if (geolocation->job) {
+                // Waiting for geolocation_save_job_done
+                return BACKEND_WORK_WAIT;
+            }
+            if (!geolocation->query) {
+                geolocation->state = GeoLocation_State_Done;
+                break;
+            }
+            geolocation_hot_store(geolocation, time(NULL));
+            geolocation->job = g_geolocationStore || g_sharedTable
+                                   ? job_pool_submit(geolocation_save_job_work, geolocation_save_job_done, geolocation)
+                                   : NULL;
+            if (!geolocation->job) {
+                geolocation->state = GeoLocation_State_Done;
+                break;
+            }
+            LOG_DEBUG("GeoLocation: Saving To Disk");
+            return BACKEND_WORK_WAIT;
+        }
         case GeoLocation_State_Done: {
-            printf("GeoLocation: Done\n");
+            LOG_DEBUG("GeoLocation: Done");
+            geolocation_prefetch_weather(geolocation);
             geolocation->on_done(geolocation->ctx);
-            break;
+            return BACKEND_WORK_WAIT;
         }
     }
 
-    return 0;
+    return BACKEND_WORK_AGAIN;
 }
 
 int geolocation_get_buffer(void** ctx, char** buffer) {
@@ -328,19 +839,40 @@ int geolocation_get_buffer(void** ctx, char** buffer) {
     return 0;
 }
 
-int geolocation_dispose(void** ctx) {
+access_cache geolocation_get_cache_outcome(void** ctx) {
     geolocation_t* geolocation = (geolocation_t*)(*ctx);
-    if (!geolocation) { return -1; }
+    return geolocation ? geolocation->cache : ACCESS_CACHE_NONE;
+}
+
+void geolocation_set_trace(void** ctx, trace_context* trace) {
+    geolocation_t* geolocation = (geolocation_t*)(*ctx);
+    if (geolocation) geolocation->trace = trace;
+}
 
-    curl_client_cleanup(&geolocation->curl_client);
-    free(geolocation->curl_client);
-    geolocation->curl_client = NULL;
+static void geolocation_free(void* ctx) {
+    geolocation_t* geolocation = (geolocation_t*)ctx;
+    free(geolocation->flight.body);
 
     free(geolocation->buffer);
+    free(geolocation->query);
     free(geolocation->location_name);
     free(geolocation->country_code);
+    arena_dispose(&geolocation->arena);
 
     free(geolocation);
+}
+
+int geolocation_dispose(void** ctx) {
+    geolocation_t* geolocation = (geolocation_t*)(*ctx);
+    if (!geolocation) { return -1; }
+
+    // A cache job still uses the struct, it is freed once the job finishes
+    single_flight_leave(&geolocation->flight);
+    if (geolocation->job) {
+        job_pool_abandon(geolocation->job, geolocation_free);
+    } else {
+        geolocation_free(geolocation);
+    }
     *ctx = NULL;
 
     return 0;
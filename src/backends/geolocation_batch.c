@@ -0,0 +1,226 @@
+#include "backends/geolocation_batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_defines.h"
+#include "utilities/logger.h"
+#include "utilities/probes.h"
+
+// The searches report to these, the server only knows the batch
+
+static void geolocation_batch_inner_done(void* ctx) {
+    geolocation_batch_search* search = (geolocation_batch_search*)ctx;
+    search->done = 1;
+    search->batch->on_wake(search->batch->ctx);
+}
+
+static void geolocation_batch_inner_wake(void* ctx) {
+    geolocation_batch_search* search = (geolocation_batch_search*)ctx;
+    search->batch->on_wake(search->batch->ctx);
+}
+
+static int geolocation_batch_reserve(geolocation_batch_t* batch, size_t length) {
+    if (batch->pending_length + length <= batch->pending_capacity) return 0;
+    size_t capacity = batch->pending_capacity ? batch->pending_capacity : 4096;
+    while (capacity < batch->pending_length + length) capacity *= 2;
+    char* pending = (char*)realloc(batch->pending, capacity);
+    if (!pending) return -1;
+    batch->pending = pending;
+    batch->pending_capacity = capacity;
+    return 0;
+}
+
+// The name as a JSON string, its bytes as they are but for what JSON escapes
+static size_t geolocation_batch_quote(char* out, const char* name) {
+    size_t length = 0;
+    out[length++] = '"';
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            out[length++] = '\\';
+            out[length++] = (char)*p;
+        } else if (*p < 0x20) {
+            length += (size_t)sprintf(out + length, "\\u%04x", *p);
+        } else {
+            out[length++] = (char)*p;
+        }
+    }
+    out[length++] = '"';
+    return length;
+}
+
+// The line of a finished search, null results for one that failed
+static int geolocation_batch_append(geolocation_batch_t* batch, int index, const char* results) {
+    if (!results) results = "null";
+    const char* name = batch->names[index];
+    size_t results_length = strlen(results);
+    // Six bytes for each escaped name byte at most
+    size_t size = 48 + strlen(name) * 6 + results_length;
+    if (geolocation_batch_reserve(batch, size) != 0) return -1;
+
+    char* line = batch->pending + batch->pending_length;
+    size_t length = (size_t)sprintf(line, "{\"index\":%d,\"name\":", index);
+    length += geolocation_batch_quote(line + length, name);
+    length += (size_t)sprintf(line + length, ",\"results\":");
+    memcpy(line + length, results, results_length);
+    length += results_length;
+    line[length++] = '}';
+    line[length++] = '\n';
+    batch->pending_length += length;
+    return 0;
+}
+
+static int geolocation_batch_start(geolocation_batch_t* batch, geolocation_batch_search* search) {
+    search->index = batch->next++;
+    search->done = 0;
+    if (geolocation_init((void**)search, &search->geolocation, geolocation_batch_inner_done,
+                         geolocation_batch_inner_wake) != 0) {
+        search->geolocation = NULL;
+        return -1;
+    }
+    geolocation_set_parameters(&search->geolocation, batch->names[search->index], batch->location_count,
+                               batch->country_code);
+    // A list being imported, not a client about to ask for the forecast
+    geolocation_set_prefetch(&search->geolocation, 0);
+    if (batch->trace) geolocation_set_trace(&search->geolocation, batch->trace);
+    return 0;
+}
+
+// Steps every search, starts the next names in the slots that finished.
+// AGAIN if one asked for it, POLL if one polls a transfer, WAIT otherwise.
+static int geolocation_batch_step(geolocation_batch_t* batch) {
+    int again = 0;
+    int poll = 0;
+    for (int i = 0; i < Geolocation_BATCH_PARALLEL; i++) {
+        geolocation_batch_search* search = &batch->searches[i];
+        if (!search->geolocation) {
+            if (batch->next >= batch->count) continue;
+            if (geolocation_batch_start(batch, search) != 0) {
+                geolocation_batch_append(batch, search->index, NULL);
+                batch->finished++;
+                again = 1;
+                continue;
+            }
+        }
+        if (!search->done) {
+            int result = geolocation_work(&search->geolocation);
+            if (!search->done) {
+                again |= result == BACKEND_WORK_AGAIN;
+                poll |= result == BACKEND_WORK_POLL;
+                continue;
+            }
+        }
+        char* results = NULL;
+        geolocation_get_buffer(&search->geolocation, &results);
+        geolocation_batch_append(batch, search->index, results);
+        geolocation_dispose(&search->geolocation);
+        batch->finished++;
+        // The slot takes the next name right away
+        again = 1;
+    }
+    return again ? BACKEND_WORK_AGAIN : poll ? BACKEND_WORK_POLL : BACKEND_WORK_WAIT;
+}
+
+// Function implementations
+
+int geolocation_batch_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context)) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)calloc(1, sizeof(geolocation_batch_t));
+    if (!batch) return -1;
+    batch->ctx = ctx;
+    batch->on_done = ondone;
+    batch->on_wake = onwake;
+    batch->state = GeolocationBatch_State_Init;
+    batch->location_count = 1;
+    for (int i = 0; i < Geolocation_BATCH_PARALLEL; i++) batch->searches[i].batch = batch;
+    *ctx_struct = (void*)batch;
+
+    return 0;
+}
+
+int geolocation_batch_set_parameters(void** ctx, int location_count, const char* country_code) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)(*ctx);
+    if (!batch) return -1;
+    batch->location_count = location_count;
+    if (country_code) {
+        batch->country_code = strdup(country_code);
+        if (!batch->country_code) return -1;
+    }
+
+    return 0;
+}
+
+int geolocation_batch_add_name(void** ctx, const char* name, size_t length) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)(*ctx);
+    if (!batch || batch->count >= Geolocation_BATCH_MAX_NAMES) return -1;
+    batch->names[batch->count] = strndup(name, length);
+    if (!batch->names[batch->count]) return -1;
+    batch->count++;
+
+    return 0;
+}
+
+int geolocation_batch_work(void** ctx) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)(*ctx);
+    if (!batch) return -1;
+
+    PROBE3(backend_state, "geolocation_batch", batch, (int)batch->state);
+    switch (batch->state) {
+    case GeolocationBatch_State_Init:
+        // The response begins now, the lines follow as the names are answered
+        batch->state = batch->count ? GeolocationBatch_State_Running : GeolocationBatch_State_Done;
+        batch->on_done(batch->ctx);
+        LOG_DEBUG("GeolocationBatch: Searching %d names", batch->count);
+        break;
+    case GeolocationBatch_State_Running: {
+        int result = geolocation_batch_step(batch);
+        if (batch->finished < batch->count) return result;
+        batch->state = GeolocationBatch_State_Done;
+        LOG_DEBUG("GeolocationBatch: Done");
+        return BACKEND_WORK_WAIT;
+    }
+    case GeolocationBatch_State_Done:
+        return BACKEND_WORK_WAIT;
+    }
+
+    return BACKEND_WORK_AGAIN;
+}
+
+int geolocation_batch_read(void** ctx, uint8_t* buffer, int size) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)(*ctx);
+    if (!batch) return -1;
+
+    size_t left = batch->pending_length - batch->pending_offset;
+    if (left == 0) return batch->state == GeolocationBatch_State_Done ? 0 : BACKEND_READ_AGAIN;
+    size_t n = left < (size_t)size ? left : (size_t)size;
+    memcpy(buffer, batch->pending + batch->pending_offset, n);
+    batch->pending_offset += n;
+    // All read, the next lines start over at the front
+    if (batch->pending_offset == batch->pending_length) {
+        batch->pending_offset = 0;
+        batch->pending_length = 0;
+    }
+    return (int)n;
+}
+
+void geolocation_batch_set_trace(void** ctx, trace_context* trace) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)(*ctx);
+    if (batch) batch->trace = trace;
+}
+
+int geolocation_batch_dispose(void** ctx) {
+    geolocation_batch_t* batch = (geolocation_batch_t*)(*ctx);
+    if (!batch) return -1;
+
+    // Each search frees itself once the job it may still have in flight finishes
+    for (int i = 0; i < Geolocation_BATCH_PARALLEL; i++) {
+        if (batch->searches[i].geolocation) geolocation_dispose(&batch->searches[i].geolocation);
+    }
+    for (int i = 0; i < batch->count; i++) free(batch->names[i]);
+    free(batch->country_code);
+    free(batch->pending);
+    free(batch);
+    *ctx = NULL;
+
+    return 0;
+}
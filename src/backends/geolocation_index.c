@@ -0,0 +1,411 @@
+#include "backends/geolocation_index.h"
+
+#include <jansson.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backends/geolocation.h"
+#include "backends/geolocation_nearest.h"
+#include "utilities/huge_pages.h"
+#include "utilities/metrics.h"
+#include "utilities/trigram_index.h"
+#include "utilities/url_codec.h"
+
+typedef struct {
+    char* key;  // lower cased name
+    char* json; // the location as /getlocation sends it
+    char country_code[4];
+    int id;
+    int population;
+} geolocation_index_entry;
+
+// Sorted by key, then by id
+static geolocation_index_entry* g_indexEntries = NULL;
+static int g_indexCount = 0;
+static int g_indexCapacity = 0;
+// A dump was loaded, every prefix is answered here
+static int g_indexComplete = 0;
+static pthread_rwlock_t g_indexLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// A place of the dump, by its trigram index id
+typedef struct {
+    const char* key; // its entry's, kept until dispose
+    int id;
+    int population;
+    char country_code[4];
+} geolocation_index_place;
+
+static trigram_index g_fuzzyIndex;
+static geolocation_index_place* g_fuzzyPlaces = NULL;
+static uint32_t g_fuzzyCount = 0;
+static metrics_counter g_fuzzyMatched;
+static metrics_counter g_fuzzyUnmatched;
+
+// The url_codec_key, like the cache query
+static void geolocation_index_key(const char* name, char* key, size_t size) {
+    url_codec_key(name, key, size);
+}
+
+static int geolocation_index_compare(const void* a, const void* b) {
+    const geolocation_index_entry* left = (const geolocation_index_entry*)a;
+    const geolocation_index_entry* right = (const geolocation_index_entry*)b;
+    int order = strcmp(left->key, right->key);
+    if (order != 0) return order;
+    return (left->id > right->id) - (left->id < right->id);
+}
+
+// First entry whose key is not below key
+static int geolocation_index_lower_bound(const char* key) {
+    int low = 0;
+    int high = g_indexCount;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (strcmp(g_indexEntries[middle].key, key) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int geolocation_index_reserve(int count) {
+    if (count <= g_indexCapacity) return 0;
+    if (count > Geolocation_INDEX_MAX_ENTRIES) return -1;
+    int capacity = g_indexCapacity ? g_indexCapacity * 2 : 1024;
+    if (capacity < count) capacity = count;
+    if (capacity > Geolocation_INDEX_MAX_ENTRIES) capacity = Geolocation_INDEX_MAX_ENTRIES;
+    geolocation_index_entry* entries = (geolocation_index_entry*)huge_pages_realloc(
+        "geolocation index", g_indexEntries, g_indexCapacity * sizeof(geolocation_index_entry),
+        capacity * sizeof(geolocation_index_entry));
+    if (!entries) return -1;
+    g_indexEntries = entries;
+    g_indexCapacity = capacity;
+    return 0;
+}
+
+static int geolocation_index_fill(geolocation_index_entry* entry, int id, const char* name, const char* country_code,
+                                  int population, char* json) {
+    char key[256];
+    geolocation_index_key(name, key, sizeof(key));
+    if (key[0] == '\0') return -1;
+    entry->key = strdup(key);
+    if (!entry->key) return -1;
+    entry->json = json;
+    entry->id = id;
+    entry->population = population;
+    snprintf(entry->country_code, sizeof(entry->country_code), "%s", country_code ? country_code : "");
+    return 0;
+}
+
+static void geolocation_index_free_entry(geolocation_index_entry* entry) {
+    free(entry->key);
+    free(entry->json);
+}
+
+// Under the write lock, keeps the array sorted, a place seen before is
+// refreshed; 1 if it is new
+static int geolocation_index_insert(geolocation_index_entry* entry) {
+    int position = geolocation_index_lower_bound(entry->key);
+    for (int i = position; i < g_indexCount && strcmp(g_indexEntries[i].key, entry->key) == 0; i++) {
+        if (g_indexEntries[i].id != entry->id) continue;
+        free(g_indexEntries[i].json);
+        g_indexEntries[i].json = entry->json;
+        g_indexEntries[i].population = entry->population;
+        free(entry->key);
+        return 0;
+    }
+    if (geolocation_index_reserve(g_indexCount + 1) != 0) {
+        geolocation_index_free_entry(entry);
+        return 0;
+    }
+    memmove(&g_indexEntries[position + 1], &g_indexEntries[position],
+            (g_indexCount - position) * sizeof(geolocation_index_entry));
+    g_indexEntries[position] = *entry;
+    g_indexCount++;
+    return 1;
+}
+
+// Splits a tab separated line in place, empty fields included
+static int geolocation_index_fields(char* line, char** fields, int max) {
+    int count = 0;
+    char* field = line;
+    while (count < max) {
+        fields[count++] = field;
+        char* tab = strchr(field, '\t');
+        if (!tab) break;
+        *tab = '\0';
+        field = tab + 1;
+    }
+    return count;
+}
+
+// The trigram index over what is in now, the dump
+static void geolocation_index_build_fuzzy(void) {
+    trigram_index_dispose(&g_fuzzyIndex);
+    free(g_fuzzyPlaces);
+    g_fuzzyCount = 0;
+    g_fuzzyPlaces = (geolocation_index_place*)malloc((g_indexCount ? g_indexCount : 1) * sizeof(geolocation_index_place));
+    const char** keys = (const char**)malloc((g_indexCount ? g_indexCount : 1) * sizeof(const char*));
+    if (!g_fuzzyPlaces || !keys) {
+        free(g_fuzzyPlaces);
+        free(keys);
+        g_fuzzyPlaces = NULL;
+        return;
+    }
+    for (int i = 0; i < g_indexCount; i++) {
+        geolocation_index_place* place = &g_fuzzyPlaces[i];
+        place->key = g_indexEntries[i].key;
+        place->id = g_indexEntries[i].id;
+        place->population = g_indexEntries[i].population;
+        memcpy(place->country_code, g_indexEntries[i].country_code, sizeof(place->country_code));
+        keys[i] = place->key;
+    }
+    int built = trigram_index_build(&g_fuzzyIndex, keys, (uint32_t)g_indexCount);
+    free(keys);
+    if (built != 0) {
+        free(g_fuzzyPlaces);
+        g_fuzzyPlaces = NULL;
+        return;
+    }
+    g_fuzzyCount = (uint32_t)g_indexCount;
+
+    static int registered = 0;
+    if (registered++) return;
+    const char* help = "Searches no name starts with, answered with names a few edits away or not.";
+    metrics_register("geolocation_fuzzy_searches_total", help, METRICS_COUNTER, "result=\"matched\"", &g_fuzzyMatched);
+    metrics_register("geolocation_fuzzy_searches_total", help, METRICS_COUNTER, "result=\"unmatched\"",
+                     &g_fuzzyUnmatched);
+}
+
+// Under the read lock: entries close enough to key in best, fewest edits
+// then most populous first; how many
+static int geolocation_index_fuzzy(const char* key, int count, const char* country_code, int* best) {
+    if (g_fuzzyCount == 0) return 0;
+    int edits = trigram_index_length(key) * (100 - Geolocation_FUZZY_MIN_CONFIDENCE) / 100;
+    if (edits > Geolocation_FUZZY_MAX_EDITS) edits = Geolocation_FUZZY_MAX_EDITS;
+    if (edits == 0) return 0;
+
+    uint32_t* ids = (uint32_t*)malloc(Geolocation_FUZZY_MAX_CANDIDATES * sizeof(uint32_t));
+    if (!ids) return 0;
+    int candidates = trigram_index_candidates(&g_fuzzyIndex, key, edits, ids, Geolocation_FUZZY_MAX_CANDIDATES);
+
+    const geolocation_index_place* places[Geolocation_INDEX_MAX_RESULTS];
+    int distances[Geolocation_INDEX_MAX_RESULTS];
+    int found = 0;
+    for (int i = 0; i < candidates; i++) {
+        const geolocation_index_place* place = &g_fuzzyPlaces[ids[i]];
+        if (country_code && strcasecmp(place->country_code, country_code) != 0) continue;
+        int distance = trigram_index_distance(key, place->key, edits);
+        if (distance > edits) continue;
+
+        int slot = found < count ? found++ : count;
+        if (slot == count && (distances[count - 1] < distance ||
+                              (distances[count - 1] == distance && places[count - 1]->population >= place->population))) {
+            continue;
+        }
+        if (slot == count) slot = count - 1;
+        while (slot > 0 && (distances[slot - 1] > distance ||
+                            (distances[slot - 1] == distance && places[slot - 1]->population < place->population))) {
+            places[slot] = places[slot - 1];
+            distances[slot] = distances[slot - 1];
+            slot--;
+        }
+        places[slot] = place;
+        distances[slot] = distance;
+    }
+    free(ids);
+
+    // Back to the entries, their JSON
+    int kept = 0;
+    for (int i = 0; i < found; i++) {
+        for (int at = geolocation_index_lower_bound(places[i]->key);
+             at < g_indexCount && strcmp(g_indexEntries[at].key, places[i]->key) == 0; at++) {
+            if (g_indexEntries[at].id != places[i]->id) continue;
+            best[kept++] = at;
+            break;
+        }
+    }
+    metrics_counter_add(kept > 0 ? &g_fuzzyMatched : &g_fuzzyUnmatched, 1);
+    return kept;
+}
+
+int geolocation_index_load_geonames(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+
+    char line[16384];
+    int loaded = 0;
+    geolocation_nearest_bulk(1);
+    pthread_rwlock_wrlock(&g_indexLock);
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        // geonameid, name, asciiname, alternatenames, latitude, longitude,
+        // feature class, feature code, country code, cc2, admin1-4 codes,
+        // population, elevation, dem, timezone, modification date
+        char* fields[19];
+        if (geolocation_index_fields(line, fields, 19) < 18) continue;
+
+        location_t location;
+        memset(&location, 0, sizeof(location_t));
+        location.id = atoi(fields[0]);
+        location.name = fields[1];
+        location.latitude = atof(fields[4]);
+        location.longitude = atof(fields[5]);
+        location.feature_code = fields[7];
+        location.country_code = fields[8];
+        location.population = atoi(fields[14]);
+        location.elevation = atof(fields[15][0] ? fields[15] : fields[16]);
+        location.timezone = fields[17];
+
+        json_t* object = NULL;
+        if (serialize_location_to_json(&location, &object) != 0) continue;
+        char* json = json_arena_dumps(object, JSON_COMPACT);
+        json_decref(object);
+        if (!json) continue;
+
+        if (geolocation_index_reserve(g_indexCount + 1) != 0) {
+            free(json);
+            break;
+        }
+        if (geolocation_index_fill(&g_indexEntries[g_indexCount], location.id, location.name, location.country_code,
+                                   location.population, json) != 0) {
+            free(json);
+            continue;
+        }
+        g_indexCount++;
+        loaded++;
+        geolocation_nearest_add(location.id, location.name, location.country_code, location.latitude,
+                                location.longitude);
+    }
+    fclose(file);
+
+    // Appended unsorted, sort once and drop what was in there twice
+    qsort(g_indexEntries, g_indexCount, sizeof(geolocation_index_entry), geolocation_index_compare);
+    int kept = 0;
+    for (int i = 0; i < g_indexCount; i++) {
+        if (kept > 0 && geolocation_index_compare(&g_indexEntries[kept - 1], &g_indexEntries[i]) == 0) {
+            geolocation_index_free_entry(&g_indexEntries[i]);
+            continue;
+        }
+        g_indexEntries[kept++] = g_indexEntries[i];
+    }
+    g_indexCount = kept;
+    if (loaded > 0) {
+        g_indexComplete = 1;
+        geolocation_index_build_fuzzy();
+    }
+    pthread_rwlock_unlock(&g_indexLock);
+    geolocation_nearest_bulk(0);
+    return loaded;
+}
+
+void geolocation_index_add_results(const char* body) {
+    json_error_t error;
+    json_t* root = json_loads(body, 0, &error);
+    if (!root) return;
+    if (!json_is_array(root) || json_array_size(root) == 0) {
+        json_decref(root);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&g_indexLock);
+    size_t index;
+    json_t* object;
+    json_array_foreach(root, index, object) {
+        const char* name = json_string_value(json_object_get(object, "name"));
+        if (!name) continue;
+        char* json = json_arena_dumps(object, JSON_COMPACT);
+        if (!json) continue;
+
+        int id = (int)json_integer_value(json_object_get(object, "id"));
+        const char* country_code = json_string_value(json_object_get(object, "country_code"));
+        geolocation_index_entry entry;
+        if (geolocation_index_fill(&entry, id, name, country_code,
+                                   (int)json_integer_value(json_object_get(object, "population")), json) != 0) {
+            free(json);
+            continue;
+        }
+        if (geolocation_index_insert(&entry)) {
+            geolocation_nearest_add(id, name, country_code, json_number_value(json_object_get(object, "latitude")),
+                                    json_number_value(json_object_get(object, "longitude")));
+        }
+    }
+    pthread_rwlock_unlock(&g_indexLock);
+    json_decref(root);
+}
+
+int geolocation_index_search(const char* prefix, int count, const char* country_code, char** body) {
+    char key[256];
+    geolocation_index_key(prefix, key, sizeof(key));
+    size_t length = strlen(key);
+    if (length == 0 || count <= 0) return -1;
+    if (count > Geolocation_INDEX_MAX_RESULTS) count = Geolocation_INDEX_MAX_RESULTS;
+
+    // The most populous matches so far, descending
+    int best[Geolocation_INDEX_MAX_RESULTS];
+    int found = 0;
+    int matches = 0;
+
+    pthread_rwlock_rdlock(&g_indexLock);
+    for (int i = geolocation_index_lower_bound(key); i < g_indexCount; i++) {
+        const geolocation_index_entry* entry = &g_indexEntries[i];
+        if (strncmp(entry->key, key, length) != 0) break;
+        if (country_code && strcasecmp(entry->country_code, country_code) != 0) continue;
+        matches++;
+
+        int slot = found < count ? found++ : count;
+        if (slot == count && g_indexEntries[best[count - 1]].population >= entry->population) continue;
+        if (slot == count) slot = count - 1;
+        while (slot > 0 && g_indexEntries[best[slot - 1]].population < entry->population) {
+            best[slot] = best[slot - 1];
+            slot--;
+        }
+        best[slot] = i;
+    }
+
+    // No name starts with it, maybe a misspelling of one of the dump
+    if (matches == 0) found = geolocation_index_fuzzy(key, count, country_code, best);
+    if (found == 0 && !g_indexComplete && matches < count) {
+        pthread_rwlock_unlock(&g_indexLock);
+        return -1;
+    }
+
+    size_t size = 3;
+    for (int i = 0; i < found; i++) size += strlen(g_indexEntries[best[i]].json) + 1;
+    char* out = (char*)malloc(size);
+    if (out) {
+        size_t used = 0;
+        out[used++] = '[';
+        for (int i = 0; i < found; i++) {
+            if (i > 0) out[used++] = ',';
+            size_t json_length = strlen(g_indexEntries[best[i]].json);
+            memcpy(out + used, g_indexEntries[best[i]].json, json_length);
+            used += json_length;
+        }
+        out[used++] = ']';
+        out[used] = '\0';
+    }
+    pthread_rwlock_unlock(&g_indexLock);
+
+    if (!out) return -1;
+    *body = out;
+    return 0;
+}
+
+void geolocation_index_dispose(void) {
+    pthread_rwlock_wrlock(&g_indexLock);
+    for (int i = 0; i < g_indexCount; i++) geolocation_index_free_entry(&g_indexEntries[i]);
+    huge_pages_free(g_indexEntries);
+    g_indexEntries = NULL;
+    g_indexCount = 0;
+    g_indexCapacity = 0;
+    g_indexComplete = 0;
+    trigram_index_dispose(&g_fuzzyIndex);
+    free(g_fuzzyPlaces);
+    g_fuzzyPlaces = NULL;
+    g_fuzzyCount = 0;
+    pthread_rwlock_unlock(&g_indexLock);
+}
@@ -0,0 +1,187 @@
+#include "backends/geolocation_nearest.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/huge_pages.h"
+
+#define GEOLOCATION_NEAREST_EARTH_RADIUS_KM 6371.0
+
+typedef struct {
+    double point[3]; // on the unit sphere
+    double latitude;
+    double longitude;
+    char* name;
+    char country_code[4];
+    int id;
+} geolocation_nearest_entry;
+
+// [0, g_nearestTreeCount) is the tree, each range's median at its middle
+// split on depth % 3; the rest are pending places added since
+static geolocation_nearest_entry* g_nearestEntries = NULL;
+static int g_nearestCount = 0;
+static int g_nearestCapacity = 0;
+static int g_nearestTreeCount = 0;
+static int g_nearestBulk = 0;
+static pthread_rwlock_t g_nearestLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void geolocation_nearest_point(double latitude, double longitude, double* point) {
+    double phi = latitude * M_PI / 180.0;
+    double lambda = longitude * M_PI / 180.0;
+    point[0] = cos(phi) * cos(lambda);
+    point[1] = cos(phi) * sin(lambda);
+    point[2] = sin(phi);
+}
+
+static double geolocation_nearest_chord2(const double* a, const double* b) {
+    double x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+    return x * x + y * y + z * z;
+}
+
+static void geolocation_nearest_swap(int a, int b) {
+    geolocation_nearest_entry entry = g_nearestEntries[a];
+    g_nearestEntries[a] = g_nearestEntries[b];
+    g_nearestEntries[b] = entry;
+}
+
+// Quickselect, [low, high) ends up split around nth on axis
+static void geolocation_nearest_select(int low, int high, int nth, int axis) {
+    while (high - low > 1) {
+        int middle = low + (high - low) / 2;
+        double pivot = g_nearestEntries[middle].point[axis];
+        geolocation_nearest_swap(middle, high - 1);
+        int store = low;
+        for (int i = low; i < high - 1; i++) {
+            if (g_nearestEntries[i].point[axis] < pivot) geolocation_nearest_swap(i, store++);
+        }
+        geolocation_nearest_swap(store, high - 1);
+        if (store == nth) return;
+        if (nth < store) {
+            high = store;
+        } else {
+            low = store + 1;
+        }
+    }
+}
+
+static void geolocation_nearest_build_range(int low, int high, int depth) {
+    if (high - low <= 1) return;
+    int middle = low + (high - low) / 2;
+    geolocation_nearest_select(low, high, middle, depth % 3);
+    geolocation_nearest_build_range(low, middle, depth + 1);
+    geolocation_nearest_build_range(middle + 1, high, depth + 1);
+}
+
+// Under the write lock
+static void geolocation_nearest_build(void) {
+    geolocation_nearest_build_range(0, g_nearestCount, 0);
+    g_nearestTreeCount = g_nearestCount;
+}
+
+void geolocation_nearest_add(int id, const char* name, const char* country_code, double latitude, double longitude) {
+    if (!name || !name[0]) return;
+    pthread_rwlock_wrlock(&g_nearestLock);
+    if (g_nearestCount == g_nearestCapacity) {
+        int capacity = g_nearestCapacity ? g_nearestCapacity * 2 : 1024;
+        geolocation_nearest_entry* entries = (geolocation_nearest_entry*)huge_pages_realloc(
+            "geolocation nearest", g_nearestEntries, g_nearestCapacity * sizeof(geolocation_nearest_entry),
+            capacity * sizeof(geolocation_nearest_entry));
+        if (!entries) {
+            pthread_rwlock_unlock(&g_nearestLock);
+            return;
+        }
+        g_nearestEntries = entries;
+        g_nearestCapacity = capacity;
+    }
+    geolocation_nearest_entry* entry = &g_nearestEntries[g_nearestCount];
+    entry->name = strdup(name);
+    if (entry->name) {
+        geolocation_nearest_point(latitude, longitude, entry->point);
+        entry->latitude = latitude;
+        entry->longitude = longitude;
+        entry->id = id;
+        snprintf(entry->country_code, sizeof(entry->country_code), "%s", country_code ? country_code : "");
+        g_nearestCount++;
+    }
+
+    int pending = g_nearestCount - g_nearestTreeCount;
+    if (!g_nearestBulk && pending >= Geolocation_NEAREST_PENDING_MAX && pending >= g_nearestTreeCount / 8) {
+        geolocation_nearest_build();
+    }
+    pthread_rwlock_unlock(&g_nearestLock);
+}
+
+void geolocation_nearest_bulk(int on) {
+    pthread_rwlock_wrlock(&g_nearestLock);
+    g_nearestBulk = on;
+    if (!on && g_nearestTreeCount != g_nearestCount) geolocation_nearest_build();
+    pthread_rwlock_unlock(&g_nearestLock);
+}
+
+static void geolocation_nearest_search(int low, int high, int depth, const double* point, int* best, double* best2) {
+    while (high > low) {
+        int middle = low + (high - low) / 2;
+        double distance2 = geolocation_nearest_chord2(g_nearestEntries[middle].point, point);
+        if (distance2 < *best2) {
+            *best2 = distance2;
+            *best = middle;
+        }
+        int axis = depth % 3;
+        double delta = point[axis] - g_nearestEntries[middle].point[axis];
+        depth++;
+        // The near side first, the far one only if the splitting plane is closer than the best
+        if (delta < 0) {
+            geolocation_nearest_search(low, middle, depth, point, best, best2);
+            if (delta * delta >= *best2) return;
+            low = middle + 1;
+        } else {
+            geolocation_nearest_search(middle + 1, high, depth, point, best, best2);
+            if (delta * delta >= *best2) return;
+            high = middle;
+        }
+    }
+}
+
+int geolocation_nearest_find(double latitude, double longitude, geolocation_nearest_place* place) {
+    double point[3];
+    geolocation_nearest_point(latitude, longitude, point);
+
+    pthread_rwlock_rdlock(&g_nearestLock);
+    int best = -1;
+    double best2 = INFINITY;
+    geolocation_nearest_search(0, g_nearestTreeCount, 0, point, &best, &best2);
+    for (int i = g_nearestTreeCount; i < g_nearestCount; i++) {
+        double distance2 = geolocation_nearest_chord2(g_nearestEntries[i].point, point);
+        if (distance2 < best2) {
+            best2 = distance2;
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        const geolocation_nearest_entry* entry = &g_nearestEntries[best];
+        place->id = entry->id;
+        snprintf(place->name, sizeof(place->name), "%s", entry->name);
+        memcpy(place->country_code, entry->country_code, sizeof(place->country_code));
+        place->latitude = entry->latitude;
+        place->longitude = entry->longitude;
+        // Chord to central angle
+        double chord = sqrt(best2);
+        place->distance_km = 2.0 * asin(chord > 2.0 ? 1.0 : chord / 2.0) * GEOLOCATION_NEAREST_EARTH_RADIUS_KM;
+    }
+    pthread_rwlock_unlock(&g_nearestLock);
+    return best >= 0 ? 0 : -1;
+}
+
+void geolocation_nearest_dispose(void) {
+    pthread_rwlock_wrlock(&g_nearestLock);
+    for (int i = 0; i < g_nearestCount; i++) free(g_nearestEntries[i].name);
+    huge_pages_free(g_nearestEntries);
+    g_nearestEntries = NULL;
+    g_nearestCount = 0;
+    g_nearestCapacity = 0;
+    g_nearestTreeCount = 0;
+    pthread_rwlock_unlock(&g_nearestLock);
+}
@@ -0,0 +1,138 @@
+#include "backends/geolocation_offline.h"
+
+#include <fcntl.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "backends/geolocation.h"
+#include "backends/geolocation_index.h"
+
+static const uint8_t* g_offlineMap = NULL;
+static size_t g_offlineSize = 0;
+static const geolocation_offline_header* g_offlineHeader = NULL;
+static const geolocation_offline_place* g_offlinePlaces = NULL;
+static const geolocation_offline_name* g_offlineNames = NULL;
+static const uint32_t* g_offlineBuckets = NULL;
+static const char* g_offlineStrings = NULL;
+
+static int geolocation_offline_section(uint64_t offset, uint64_t count, size_t size) {
+    if (offset > g_offlineSize || offset % 8 != 0) return -1;
+    return count > (g_offlineSize - offset) / size ? -1 : 0;
+}
+
+int geolocation_offline_open(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(geolocation_offline_header)) {
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    g_offlineMap = (const uint8_t*)map;
+    g_offlineSize = info.st_size;
+    const geolocation_offline_header* header = (const geolocation_offline_header*)map;
+
+    // Checked once here so a search can trust the offsets it follows
+    if (memcmp(header->magic, Geolocation_OFFLINE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        geolocation_offline_section(header->places_offset, header->place_count, sizeof(geolocation_offline_place)) != 0 ||
+        geolocation_offline_section(header->names_offset, header->name_count, sizeof(geolocation_offline_name)) != 0 ||
+        geolocation_offline_section(header->buckets_offset, header->bucket_count, sizeof(uint32_t)) != 0 ||
+        geolocation_offline_section(header->strings_offset, header->strings_size, 1) != 0 ||
+        header->strings_size == 0 || g_offlineMap[header->strings_offset + header->strings_size - 1] != '\0') {
+        geolocation_offline_close();
+        return -1;
+    }
+
+    g_offlineHeader = header;
+    g_offlinePlaces = (const geolocation_offline_place*)(g_offlineMap + header->places_offset);
+    g_offlineNames = (const geolocation_offline_name*)(g_offlineMap + header->names_offset);
+    g_offlineBuckets = (const uint32_t*)(g_offlineMap + header->buckets_offset);
+    g_offlineStrings = (const char*)(g_offlineMap + header->strings_offset);
+    return (int)header->place_count;
+}
+
+static const char* geolocation_offline_string(uint32_t offset) {
+    if (offset == 0 || offset >= g_offlineHeader->strings_size) return NULL;
+    return g_offlineStrings + offset;
+}
+
+static json_t* geolocation_offline_json(const geolocation_offline_place* place) {
+    char country_code[sizeof(place->country_code) + 1];
+    memcpy(country_code, place->country_code, sizeof(place->country_code));
+    country_code[sizeof(place->country_code)] = '\0';
+
+    // Points into the mapping, serialize_location_to_json only reads
+    location_t location;
+    memset(&location, 0, sizeof(location_t));
+    location.id = (int)place->id;
+    location.name = (char*)geolocation_offline_string(place->name);
+    location.latitude = place->latitude;
+    location.longitude = place->longitude;
+    location.elevation = place->elevation;
+    location.feature_code = (char*)geolocation_offline_string(place->feature_code);
+    location.country_code = country_code[0] ? country_code : NULL;
+    location.timezone = (char*)geolocation_offline_string(place->timezone);
+    location.population = place->population;
+
+    json_t* object = NULL;
+    if (serialize_location_to_json(&location, &object) != 0) return NULL;
+    return object;
+}
+
+int geolocation_offline_search(const char* name, int count, const char* country_code, char** body) {
+    if (!g_offlineHeader || count <= 0) return -1;
+    if (count > Geolocation_INDEX_MAX_RESULTS) count = Geolocation_INDEX_MAX_RESULTS;
+
+    char key[256];
+    geolocation_offline_key(name, key, sizeof(key));
+    if (key[0] == '\0') return -1;
+
+    json_t* array = json_array();
+    if (!array) return -1;
+
+    uint32_t entry = g_offlineBuckets[geolocation_offline_hash(key) & (g_offlineHeader->bucket_count - 1)];
+    // A chain is never longer than the table, a corrupt loop ends there
+    for (uint32_t steps = 0; entry < g_offlineHeader->name_count && steps < g_offlineHeader->name_count; steps++) {
+        const geolocation_offline_name* candidate = &g_offlineNames[entry];
+        entry = candidate->next;
+        if (candidate->place >= g_offlineHeader->place_count || candidate->key >= g_offlineHeader->strings_size) continue;
+        if (strcmp(g_offlineStrings + candidate->key, key) != 0) continue;
+
+        const geolocation_offline_place* place = &g_offlinePlaces[candidate->place];
+        if (country_code && strncasecmp(place->country_code, country_code, sizeof(place->country_code)) != 0) continue;
+
+        json_t* object = geolocation_offline_json(place);
+        if (object) json_array_append_new(array, object);
+        if ((int)json_array_size(array) >= count) break;
+    }
+
+    if (json_array_size(array) == 0) {
+        json_decref(array);
+        return -1;
+    }
+    *body = json_arena_dumps(array, JSON_COMPACT);
+    json_decref(array);
+    return *body ? 0 : -1;
+}
+
+void geolocation_offline_close(void) {
+    if (g_offlineMap) munmap((void*)g_offlineMap, g_offlineSize);
+    g_offlineMap = NULL;
+    g_offlineSize = 0;
+    g_offlineHeader = NULL;
+    g_offlinePlaces = NULL;
+    g_offlineNames = NULL;
+    g_offlineBuckets = NULL;
+    g_offlineStrings = NULL;
+}
@@ -1,89 +1,334 @@
 #include "backends/surprise.h"
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "global_defines.h"
+#include "utils.h"
+#include "utilities/epoch.h"
+#include "utilities/logger.h"
+#include "utilities/probes.h"
 
 // Map local names to central test configuration values
 #define IMAGE_NAME Surprise_IMAGE_NAME // From global_defines.h (original: libs/backends/surprise/surprise.c)
 #define SURPRISE_FOLDER Surprise_FOLDER // From global_defines.h (original: libs/backends/surprise/surprise.c)
 
-int surprise_get_file(uint8_t **buffer_ptr, const char *file_name) {
-  // Open specified file i mode "rb" - read binary
-  char *folder_file = (char*)malloc(sizeof(char) * (strlen(SURPRISE_FOLDER) + strlen(file_name) + 1));
-  sprintf(folder_file, "%s%s", SURPRISE_FOLDER, file_name);
+#define SURPRISE_STRINGIFY_(x) #x
+#define SURPRISE_STRINGIFY(x) SURPRISE_STRINGIFY_(x)
 
-  FILE *fptr = fopen(folder_file, "rb");
-  free(folder_file);
-  if (!fptr)
+// Published with epoch_publish, read with acquire; only surprise_reload writes
+static surprise_assets* g_surpriseAssets = NULL;
+static pthread_mutex_t g_surpriseReloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+// xorshift64* state of this thread's loop, seeded on first use
+static __thread uint64_t t_surpriseRandom = 0;
+
+static const char* surprise_content_type(const char* name) {
+  static const struct {
+    const char* extension;
+    const char* type;
+  } types[] = {
+    {"png", "image/png"},   {"gif", "image/gif"},      {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"}, {"webp", "image/webp"},    {"avif", "image/avif"},
+    {"svg", "image/svg+xml"}, {"txt", "text/plain"},   {"html", "text/html"},
+  };
+  const char* dot = strrchr(name, '.');
+  if (dot) {
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+      if (strcasecmp(dot + 1, types[i].extension) == 0) return types[i].type;
+    }
+  }
+  return "application/octet-stream";
+}
+
+// Maps the whole file of folder, 0 on success. Empty files have nothing to map and are left out
+static int surprise_map_file(surprise_asset* asset, const char* folder) {
+  char path[sizeof(Surprise_VARIANTS_FOLDER) + _TINYDIR_FILENAME_MAX];
+  snprintf(path, sizeof(path), "%s%s", folder, asset->name);
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return -1;
+  }
+  // Faulted in here, on the reload's thread, instead of by the first request on a loop
+  void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
     return -1;
+  }
 
-  // find end of file and calculate file size
-  fseek(fptr, 0, SEEK_END);
-  long file_size = ftell(fptr);
-  fseek(fptr, 0, SEEK_SET);
+  asset->data = (const uint8_t*)data;
+  asset->fd = fd;
+  asset->size = (size_t)st.st_size;
+  asset->mtime = st.st_mtime;
+  asset->content_type = surprise_content_type(asset->name);
+  http_etag_from_file(asset->etag, asset->mtime, asset->size);
+  return 0;
+}
+
+// 1 if name is a variant of original: "<original>.<ext>" or "<original>.small.<ext>"
+static int surprise_variant_of(const char* name, const char* original, int* small) {
+  size_t length = strlen(original);
+  if (strncmp(name, original, length) != 0 || name[length] != '.') return 0;
+  const char* rest = name + length + 1;
+  *small = strncmp(rest, "small.", 6) == 0;
+  if (*small) rest += 6;
+  return *rest != '\0' && strchr(rest, '.') == NULL;
+}
 
-  uint8_t *buffer = (uint8_t *)malloc(sizeof(uint8_t) * file_size);
-  if (!buffer) {
-    // Failed to allocated memory
-    fclose(fptr);
-    return -2;
+// Maps the variants of the index's files, in the order of the files so each
+// one's are next to each other. A missing folder is no variants.
+static void surprise_map_variants(surprise_assets* index, size_t* bytes) {
+  tinydir_dir dir;
+  if (tinydir_open_sorted(&dir, Surprise_VARIANTS_FOLDER) != 0) return;
+  index->variants = (surprise_asset*)calloc(dir.n_files ? dir.n_files : 1, sizeof(surprise_asset));
+  if (!index->variants) {
+    tinydir_close(&dir);
+    return;
   }
 
-  size_t bytes_read = fread(buffer, 1, file_size, fptr);
-  if (bytes_read != file_size) {
-    // Failed to read file
-    free(buffer);
-    fclose(fptr);
-    return -2;
+  // A handful of each, a scan per file is all it takes
+  for (int i = 0; i < index->count; i++) {
+    surprise_asset* original = &index->assets[i];
+    original->first_variant = index->variant_count;
+    for (size_t j = 0; j < dir.n_files; j++) {
+      int small = 0;
+      if (!dir._files[j].is_reg || !surprise_variant_of(dir._files[j].name, original->name, &small)) continue;
+      surprise_asset* variant = &index->variants[index->variant_count];
+      snprintf(variant->name, sizeof(variant->name), "%s", dir._files[j].name);
+      if (surprise_map_file(variant, Surprise_VARIANTS_FOLDER) != 0) continue;
+      variant->small = small;
+      variant->format = strcmp(variant->content_type, "image/webp") == 0   ? SURPRISE_ACCEPT_WEBP
+                        : strcmp(variant->content_type, "image/avif") == 0 ? SURPRISE_ACCEPT_AVIF
+                                                                            : 0;
+      *bytes += variant->size;
+      index->variant_count++;
+    }
+    original->variant_count = index->variant_count - original->first_variant;
   }
+  tinydir_close(&dir);
+}
 
-  *buffer_ptr = buffer;
+static void surprise_assets_free(surprise_assets* index) {
+  for (int i = 0; i < index->count; i++) {
+    munmap((void*)index->assets[i].data, index->assets[i].size);
+    close(index->assets[i].fd);
+  }
+  for (int i = 0; i < index->variant_count; i++) {
+    munmap((void*)index->variants[i].data, index->variants[i].size);
+    close(index->variants[i].fd);
+  }
+  free(index->assets);
+  free(index->variants);
+  free(index);
+}
 
-  fclose(fptr);
+static void surprise_assets_retain(const surprise_assets* index) {
+  __atomic_add_fetch(&((surprise_assets*)index)->references, 1, __ATOMIC_RELAXED);
+}
+
+// The last one unmaps, on whichever thread that is
+static void surprise_assets_release(const surprise_assets* index) {
+  if (index && __atomic_sub_fetch(&((surprise_assets*)index)->references, 1, __ATOMIC_ACQ_REL) == 0)
+    surprise_assets_free((surprise_assets*)index);
+}
 
-  return file_size;
+static void surprise_assets_retired(void* index) {
+  surprise_assets_release((const surprise_assets*)index);
 }
 
-int surprise_get_random(uint8_t **buffer_ptr){
+int surprise_reload(void) {
   tinydir_dir dir;
-  tinydir_open_sorted(&dir, SURPRISE_FOLDER);
+  if (tinydir_open_sorted(&dir, SURPRISE_FOLDER) != 0) {
+    return -1;
+  }
 
-  if (dir.n_files == 0) { // Surprise folder not found
+  surprise_assets* index = (surprise_assets*)calloc(1, sizeof(surprise_assets));
+  if (index) {
+    index->assets = (surprise_asset*)calloc(dir.n_files ? dir.n_files : 1, sizeof(surprise_asset));
+  }
+  if (!index || !index->assets) {
+    free(index);
     tinydir_close(&dir);
     return -1;
   }
 
-  int n_files = 0;
-  for (int i = 0; i < dir.n_files; i++){
-    n_files += dir._files[i].is_reg; // count number of files in folder
+  size_t bytes = 0;
+  for (size_t i = 0; i < dir.n_files; i++) {
+    if (!dir._files[i].is_reg) continue;
+    surprise_asset* asset = &index->assets[index->count];
+    snprintf(asset->name, sizeof(asset->name), "%s", dir._files[i].name);
+    if (surprise_map_file(asset, SURPRISE_FOLDER) == 0) {
+      bytes += asset->size;
+      index->count++;
+    }
+  }
+  tinydir_close(&dir);
+  surprise_map_variants(index, &bytes);
+
+  index->references = 1;
+  pthread_mutex_lock(&g_surpriseReloadLock);
+  // Requests on the loops may still be reading the one it replaces
+  epoch_retire(epoch_publish((void**)&g_surpriseAssets, index), surprise_assets_retired);
+  pthread_mutex_unlock(&g_surpriseReloadLock);
+  LOG_INFO("Surprise: Indexed %d file(s) and %d variant(s), %zu bytes mapped", index->count, index->variant_count,
+           bytes);
+  return 0;
+}
+
+const surprise_assets* surprise_current(void) {
+  return __atomic_load_n(&g_surpriseAssets, __ATOMIC_ACQUIRE);
+}
+
+void surprise_global_dispose(void) {
+  // The superseded ones went with epoch_dispose
+  surprise_assets_release(g_surpriseAssets);
+  g_surpriseAssets = NULL;
+}
+
+static uint64_t surprise_random(void) {
+  uint64_t x = t_surpriseRandom;
+  if (x == 0) {
+    // splitmix64 of the time and the thread, so loops started together differ
+    x = SystemMonotonicNS() ^ (uint64_t)(uintptr_t)&t_surpriseRandom;
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    if (x == 0) x = 1;
   }
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  t_surpriseRandom = x;
+  return x * 0x2545F4914F6CDD1Dull;
+}
 
-  if (n_files == 0) {// Surprise folder is empty
-    tinydir_close(&dir);
-    return -2;
+const surprise_asset* surprise_pick(const surprise_assets* index) {
+  if (!index) // Surprise folder not found
+    return NULL;
+  if (index->count == 0) // Surprise folder is empty
+    return NULL;
+
+  // The high 32 bits scaled to the count, no modulo bias worth speaking of
+  uint64_t r = surprise_random() >> 32;
+  return &index->assets[(r * (uint64_t)index->count) >> 32];
+}
+
+const surprise_asset* surprise_find(const surprise_assets* index, const char* etag, size_t length) {
+  if (!index)
+    return NULL;
+
+  // A handful of files, a scan is all it takes
+  for (int i = 0; i < index->count; i++) {
+    const surprise_asset* asset = &index->assets[i];
+    if (strlen(asset->etag) == length && memcmp(asset->etag, etag, length) == 0)
+      return asset;
   }
+  for (int i = 0; i < index->variant_count; i++) {
+    const surprise_asset* variant = &index->variants[i];
+    if (strlen(variant->etag) == length && memcmp(variant->etag, etag, length) == 0)
+      return variant;
+  }
+  return NULL;
+}
+
+const surprise_asset* surprise_find_name(const surprise_assets* index, const char* name) {
+  if (!index)
+    return NULL;
+
+  for (int i = 0; i < index->count; i++) {
+    if (strcmp(index->assets[i].name, name) == 0)
+      return &index->assets[i];
+  }
+  return NULL;
+}
 
-  srand(time(NULL));
-  int index = rand() % n_files + 1;
+const surprise_asset* surprise_variant(const surprise_assets* index, const surprise_asset* asset, unsigned accepts,
+                                       int small) {
+  const surprise_asset* variants = index->variants + asset->first_variant;
+  // A thumbnail if the client can take one, the whole picture otherwise
+  int thumbnail = 0;
+  for (int i = 0; small && i < asset->variant_count; i++) {
+    if (variants[i].small && (variants[i].format & ~accepts) == 0) thumbnail = 1;
+  }
 
-  for (int i = 0; i < dir.n_files; i++){
-    index -= dir._files[i].is_reg; // Decrement index each time we iterate past a file
-    if (index == 0){
-      int result = surprise_get_file(buffer_ptr, dir._files[i].name);
-      tinydir_close(&dir);
-      return result;
+  const surprise_asset* best = thumbnail ? NULL : asset;
+  for (int i = 0; i < asset->variant_count; i++) {
+    const surprise_asset* variant = &variants[i];
+    if (variant->small != thumbnail || (variant->format & ~accepts) != 0) continue;
+    if (!best || variant->size < best->size) best = variant;
+  }
+  return best;
+}
+
+static int surprise_quality_zero(const char* p, const char* end) {
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == ';')) p++;
+    if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+      for (p += 2; p < end && *p != ';'; p++) {
+        if (*p >= '1' && *p <= '9') return 0;
+      }
+      return 1;
     }
+    while (p < end && *p != ';') p++;
   }
+  return 0;
+}
 
-  tinydir_close(&dir);
+unsigned surprise_accepts(const char* accept, size_t length) {
+  if (!accept) return 0;
+
+  unsigned accepts = 0;
+  const char* p = accept;
+  const char* end = accept + length;
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == ',')) p++;
+    const char* token = p;
+    while (p < end && *p != ',' && *p != ';' && *p != ' ') p++;
+    size_t token_length = p - token;
+    const char* params = p;
+    while (p < end && *p != ',') p++;
+    if (surprise_quality_zero(params, p)) continue;
 
-  return -1;
+    if (token_length == 10 && strncasecmp(token, "image/webp", 10) == 0) accepts |= SURPRISE_ACCEPT_WEBP;
+    else if (token_length == 10 && strncasecmp(token, "image/avif", 10) == 0) accepts |= SURPRISE_ACCEPT_AVIF;
+  }
+  return accepts;
 }
 
-int surprise_init(void** ctx, void** ctx_struct, void (*ondone)(void* context))
+// The entry of index named name, with the ETag or a random one, and a
+// reference on index if there is one. A file by name or at random is sent as
+// its variant for the client, the ETag names what was sent already.
+static void surprise_hold(surprise_t* surprise, const surprise_assets* index, const char* name, const char* etag,
+                          size_t length) {
+  const surprise_asset* asset = name   ? surprise_find_name(index, name)
+                                : etag ? surprise_find(index, etag, length)
+                                       : surprise_pick(index);
+  if (!asset)
+    return;
+  if (!etag)
+    asset = surprise_variant(index, asset, surprise->accepts, surprise->small);
+  surprise_assets_retain(index);
+  surprise_assets_release(surprise->assets);
+  surprise->assets = index;
+  surprise->asset = asset;
+}
+
+int surprise_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context))
 {
   surprise_t* surprise = (surprise_t*)malloc(sizeof(surprise_t));
   if (!surprise) {
@@ -91,12 +336,17 @@ int surprise_init(void** ctx, void** ctx_struct, void (*ondone)(void* context))
   }
   surprise->ctx = ctx;
   surprise->state = Surprise_State_Init;
-  surprise->buffer = NULL;
-  surprise->bytesread = 0;
+  surprise->asset = NULL;
+  surprise->assets = NULL;
+  surprise->resume[0] = '\0';
+  surprise->named = 0;
+  surprise->accepts = 0;
+  surprise->small = 0;
   surprise->on_done = ondone;
+  surprise->on_wake = onwake;
   *ctx_struct = (void*)surprise;
 
-  printf("Surprise: Initialized struct\n");
+  LOG_DEBUG("Surprise: Initialized struct");
 
   return 0;
 }
@@ -107,7 +357,8 @@ int surprise_get_buffer(void** ctx, char** buffer)
     if (!surprise) {
         return -1; // Memory allocation failed
     }
-    *buffer = (char*)surprise->buffer;
+    // The mapping, surprise->assets keeps it until dispose
+    *buffer = surprise->asset ? (char*)surprise->asset->data : NULL;
     
     return 0;
 }
@@ -117,11 +368,94 @@ int surprise_get_buffer_size(void** ctx, size_t* size) {
   if (!surprise) {
       return -1; // Memory allocation failed
   }
-  *size = surprise->bytesread;
+  if (!surprise->asset) {
+    return -1; // Nothing was picked
+  }
+  *size = surprise->asset->size;
   
   return 0;
 }
 
+int surprise_get_validators(void** ctx, const char** etag, time_t* last_modified)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise || !surprise->asset) {
+    return -1;
+  }
+  *etag = surprise->asset->etag;
+  *last_modified = surprise->asset->mtime;
+
+  return 0;
+}
+
+const char* surprise_get_content_type(void** ctx)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise || !surprise->asset) {
+    return NULL;
+  }
+
+  return surprise->asset->content_type;
+}
+
+int surprise_get_file(void** ctx, const uint8_t* body, off_t* offset)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise || !surprise->asset || body != surprise->asset->data) {
+    return -1;
+  }
+
+  *offset = 0;
+  return surprise->asset->fd;
+}
+
+const char* surprise_get_cache_control(void** ctx)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise || !surprise->asset) {
+    return NULL;
+  }
+
+  return surprise->named ? "public, max-age=" SURPRISE_STRINGIFY(Surprise_MAX_AGE) : "no-cache";
+}
+
+int surprise_set_name(void** ctx, const char* name)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise) {
+    return -1;
+  }
+  // Looked up now, the reference keeps the entry after a reload replaced its table
+  surprise_hold(surprise, surprise_current(), name, NULL, 0);
+  surprise->named = surprise->asset != NULL;
+
+  return surprise->asset ? 0 : -1;
+}
+
+int surprise_set_resume(void** ctx, const char* etag, size_t length)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise || length >= sizeof(surprise->resume)) {
+    return -1;
+  }
+  memcpy(surprise->resume, etag, length);
+  surprise->resume[length] = '\0';
+
+  return 0;
+}
+
+int surprise_set_variant(void** ctx, unsigned accepts, int small)
+{
+  surprise_t* surprise = (surprise_t*)(*ctx);
+  if (!surprise) {
+    return -1;
+  }
+  surprise->accepts = accepts;
+  surprise->small = small;
+
+  return 0;
+}
+
 int surprise_work(void** ctx)
 {
   surprise_t* surprise = (surprise_t*)(*ctx);
@@ -129,37 +463,37 @@ int surprise_work(void** ctx)
         return -1; // Memory allocation failed
     }
 
+    PROBE3(backend_state, "surprise", surprise, (int)surprise->state);
     switch (surprise->state) {
     case Surprise_State_Init:
-        surprise->state = Surprise_State_Load_From_Disk;
-        printf("Surprise: Initialized\n");
+        surprise->state = Surprise_State_Pick;
+        LOG_DEBUG("Surprise: Initialized");
         break;
-    case Surprise_State_Load_From_Disk:
-        surprise->bytesread = surprise_get_random(&surprise->buffer);
+    case Surprise_State_Pick:
+        // Everything is in memory already, nothing to wait for
+        if (!surprise->asset && surprise->resume[0]) {
+          surprise_hold(surprise, surprise_current(), NULL, surprise->resume, strlen(surprise->resume));
+        }
+        if (!surprise->asset) {
+          surprise_hold(surprise, surprise_current(), NULL, NULL, 0);
+        }
         surprise->state = Surprise_State_Done;
-        printf("Surprise: Loaded from disk\n");
         break;
     case Surprise_State_Done:
         surprise->on_done(surprise->ctx);
-        printf("Surprise: Done\n");
-        break;
+        LOG_DEBUG("Surprise: Done");
+        return BACKEND_WORK_WAIT;
     }
 
-    return 0;
+    return BACKEND_WORK_AGAIN;
 }
 
 int surprise_dispose(void** ctx)
 {
   if (!ctx || !*ctx) return 0; // Already disposed or NULL
-  
-  surprise_t* surprise = (surprise_t*)(*ctx);
-
-  if (surprise->buffer) {
-    free(surprise->buffer);
-    surprise->buffer = NULL;
-  }
 
-  free(surprise);
+  surprise_assets_release(((surprise_t*)*ctx)->assets);
+  free(*ctx);
   *ctx = NULL;
 
   return 0;
@@ -1,55 +1,1923 @@
 #include <ctype.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "utils.h"
+#include "cdn_purge.h"
 #include "backends/weather.h"
+#include "backends/weather_archive.h"
+#include "backends/weather_record.h"
+#include "utilities/cache_only.h"
+#include "utilities/cbor.h"
+#include "utilities/cache_store.h"
+#include "utilities/compress.h"
+#include "utilities/curl_client.h"
+#include "utilities/frequency_sketch.h"
+#include "utilities/job_pool.h"
+#include "utilities/json_patch.h"
+#include "utilities/loop_mailbox.h"
+#include "utilities/metrics.h"
+#include "utilities/peer_ring.h"
+#include "utilities/probes.h"
+#include "utilities/real_format.h"
+#include "utilities/record_store.h"
+#include "utilities/shared_blob.h"
+#include "utilities/single_flight.h"
+#include "utilities/string_intern.h"
+#include "utilities/tuning.h"
+#include "smw.h"
 
 #include "global_defines.h"
+#include "utilities/logger.h"
 
 // Use centralized cache dir name for easier test configuration
 #define CACHE_DIR Weather_CACHE_DIR // From global_defines.h (original: libs/backends/weather/weather.c)
 
-int parse_openmeteo_json_to_weather(const json_t* json_obj, weather_data_t* weather);
-int serialize_weather_to_json(const weather_data_t* weather, json_t** json_obj);
+static int weather_scan_object(json_scan* scan, weather_data_t* weather);
+static int weather_transform(const char* api_response, char** client_response, uint8_t** record, size_t* record_length);
+static int weather_transform_object(json_scan* scan, char** client_response, uint8_t** record,
+                                    size_t* record_length);
+static void weather_write_behind(double latitude, double longitude, uint8_t* record, size_t length, time_t stamp);
+static char* weather_serialize(const weather_data_t* weather);
+static int weather_read_record(double latitude, double longitude, uint8_t** record, size_t* length, time_t* stamp);
+static void weather_peer_load(weather_t* weather);
+static void weather_peer_reply(weather_t* weather, const uint8_t* record, size_t length, time_t stamp);
+static int weather_peer_take(weather_t* weather);
+static int weather_record_take(weather_t* weather, const uint8_t* record, size_t length, time_t stamp,
+                               access_cache outcome, int persist);
+static void weather_shared_put(double latitude, double longitude, const uint8_t* record, size_t length, time_t stamp);
+// --cache-store, set by main before the loops start
+static cache_store* g_sharedStore = NULL;
+// Set before a prefork, the processes would all append to the one file
+static int g_storeReadOnly = 0;
+
+// Weather_CACHE_TTL_SECONDS unless /admin/config changed it
+static inline time_t weather_ttl(void) {
+    return (time_t)tuning_get()->weather_ttl_seconds;
+}
 
-static void get_cache_file_path(double latitude, double longitude, char* path, size_t path_size) {
-    long long lat_key = llround(latitude * 1000000.0);
-    long long lon_key = llround(longitude * 1000000.0);
-    snprintf(path, path_size, "%s/%lld_%lld.json", CACHE_DIR, lat_key, lon_key);
+// ========== Model Steps ==========
+// Upstream's current block moves every interval seconds, on a grid the first
+// responses show (current.time and current.interval). A forecast holds the
+// step it was fetched in until the next one is published, so that is when it
+// expires, not a TTL after the fetch. The lag grows by a step's worth of
+// margin whenever a fetch past it still got the previous step.
+
+static int g_modelInterval = Weather_MODEL_INTERVAL_SECONDS;
+static int g_modelOffset = 0;
+static int g_modelLag = Weather_PUBLICATION_LAG_SECONDS;
+static metrics_counter g_modelLate;
+
+// The start of the step stamp falls in
+static time_t weather_model_step(time_t stamp, time_t interval, time_t offset) {
+    time_t into = (stamp - offset) % interval;
+    if (into < 0) into += interval;
+    return stamp - into;
 }
 
-int does_weather_cache_exist(double latitude, double longitude) {
-    create_folder(CACHE_DIR);
+time_t weather_fresh_until(time_t stamp) {
+    time_t interval = __atomic_load_n(&g_modelInterval, __ATOMIC_RELAXED);
+    time_t offset = __atomic_load_n(&g_modelOffset, __ATOMIC_RELAXED);
+    time_t lag = __atomic_load_n(&g_modelLag, __ATOMIC_RELAXED);
+    time_t until = weather_model_step(stamp, interval, offset) + interval + lag;
+    // /admin/config may want them shorter than a step
+    time_t longest = stamp + weather_ttl() + lag;
+    return until < longest ? until : longest;
+}
+
+// The grid and lag from a forecast fetched just now, on the pool thread
+static void weather_model_observe(const weather_data_t* weather) {
+    if (weather->interval < 60 || weather->interval > 86400 || !weather->time) return;
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(weather->time, "%4d-%2d-%2dT%2d:%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min) != 5) {
+        return;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time_t current = timegm(&tm);
+    if (current == (time_t)-1) return;
+    // The time is the location's own
+    current -= weather->utc_offset_seconds;
+
+    time_t interval = weather->interval;
+    time_t offset = current % interval;
+    __atomic_store_n(&g_modelInterval, (int)interval, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_modelOffset, (int)offset, __ATOMIC_RELAXED);
+
+    time_t now = time(NULL);
+    time_t step = weather_model_step(now, interval, offset);
+    int lag = __atomic_load_n(&g_modelLag, __ATOMIC_RELAXED);
+    if (current != step - interval || now - step < lag) return;
+    metrics_counter_add(&g_modelLate, 1);
+    int later = lag + Weather_PUBLICATION_LAG_SECONDS / 2;
+    if (later > interval / 2) later = (int)(interval / 2);
+    if (later > lag) {
+        __atomic_store_n(&g_modelLag, later, __ATOMIC_RELAXED);
+        LOG_INFO("Weather: Upstream publishes later than %ds after a step, waiting %ds", lag, later);
+    }
+}
+
+// ========== Hot Cache ==========
+// What was sent for a location, per loop in front of the disk cache. Entries
+// expire with the forecast they hold.
+
+static __thread response_cache t_hotCache;
+// Bodies cut to a ?fields= set from the entries above, see Projection
+static __thread response_cache t_projectionCache;
+
+// How often each location was asked for lately, shared by every loop's hot
+// cache (admission) and the store (eviction)
+static frequency_sketch g_weatherSketch;
+// The same accesses per loop with counts, for /admin/hotkeys and the
+// refresh and replication of the hottest (see weather_refresh_sweep)
+static heavy_hitters g_weatherHitters;
+
+// Every cache of a location is keyed by its coordinates in micro degrees
+static uint64_t weather_cache_key(double latitude, double longitude) {
+    uint32_t lat_key = (uint32_t)(int32_t)llround(latitude * 1000000.0);
+    uint32_t lon_key = (uint32_t)(int32_t)llround(longitude * 1000000.0);
+    return ((uint64_t)lat_key << 32) | lon_key;
+}
+
+void weather_surrogate_key(double latitude, double longitude, char* key, size_t size) {
+    snprintf(key, size, "weather/%.6g,%.6g", latitude, longitude);
+}
 
-    char cache_path[512];
-    get_cache_file_path(latitude, longitude, cache_path, sizeof(cache_path));
+void weather_quantize(double* latitude, double* longitude) {
+    double lat = round(*latitude / Weather_GRID_DEGREES) * Weather_GRID_DEGREES;
+    double lon = round(*longitude / Weather_GRID_DEGREES) * Weather_GRID_DEGREES;
+    if (lat > 90.0) lat = 90.0;
+    if (lat < -90.0) lat = -90.0;
+    if (lon >= 180.0) lon -= 360.0;
+    if (lon < -180.0) lon += 360.0;
+    // Through the key and back, every caller gets the same bits for a cell
+    *latitude = llround(lat * 1000000.0) / 1000000.0;
+    *longitude = llround(lon * 1000000.0) / 1000000.0;
+}
+
+static void weather_hot_location(uint64_t key, double* latitude, double* longitude) {
+    *latitude = (int32_t)(uint32_t)(key >> 32) / 1000000.0;
+    *longitude = (int32_t)(uint32_t)key / 1000000.0;
+}
+
+static void weather_refresh_start(void);
+static void weather_refresh_location(double latitude, double longitude, time_t older);
+static int weather_heavy_hitter(uint64_t key, uint64_t hits);
+static int weather_shard_remote(uint64_t key);
+static int weather_shard_fill(int owner, uint64_t key, const weather_t* weather, time_t expires);
+
+// ========== Subscriptions ==========
+// Clients following a location on this loop, see weather_subscribe. A newer
+// forecast reaching the hot cache is published as that entry's blob, a task
+// of its own hands out what was published once per loop iteration.
+
+static __thread subscription_registry t_subscriptions;
+static __thread smw_task* t_publishTask = NULL;
 
+// Every loop's subscribers and blobs handed to them
+static metrics_gauge g_subscribers;
+static metrics_counter g_deliveries;
+
+static int weather_followed(uint64_t key) {
+    return subscription_count(&t_subscriptions, key) > 0;
+}
+
+static void weather_publish_taskwork(void* context, uint64_t monTime) {
+    (void)context;
+    (void)monTime;
+    int delivered = subscription_flush(&t_subscriptions);
+    if (delivered > 0) metrics_counter_add(&g_deliveries, (uint64_t)delivered);
+}
+
+static void weather_notify(uint64_t key, const response_blob* blob) {
+    if (!blob->bodies[COMPRESS_IDENTITY]) {
+        // Only the variant a client took was loaded, the record next to it
+        // comes in as identity with the same version
+        double latitude, longitude;
+        weather_hot_location(key, &latitude, &longitude);
+        weather_refresh_location(latitude, longitude, blob->last_modified - 1);
+        return;
+    }
+    subscription_publish(&t_subscriptions, key, blob);
+    if (subscription_pending(&t_subscriptions)) smw_wakeTask(t_publishTask);
+}
+
+// ========== Warm Up ==========
+// Records loaded by weather_warmup before the workers start, read only once
+// it returns. Every loop's hot cache starts out with a copy.
+
+typedef struct {
+    uint64_t key;
+    time_t stamp;
+    uint8_t* bodies[COMPRESS_ENCODINGS];
+    size_t lengths[COMPRESS_ENCODINGS];
+    char etags[COMPRESS_ENCODINGS][HTTP_ETAG_SIZE];
+} weather_warm_entry;
+
+static weather_warm_entry* g_warm = NULL;
+static int g_warmCount = 0;
+
+static void weather_warm_free(void) {
+    for (int i = 0; i < g_warmCount; i++) {
+        for (int encoding = 0; encoding < COMPRESS_ENCODINGS; encoding++) free(g_warm[i].bodies[encoding]);
+    }
+    free(g_warm);
+    g_warm = NULL;
+    g_warmCount = 0;
+}
+
+// The first use of the loop's hot cache
+static int weather_hot_init(void) {
+    if (t_hotCache.entries) return 0;
+    if (response_cache_init(&t_hotCache, Weather_HOT_CACHE_ENTRIES, Weather_HOT_CACHE_BYTES, &g_weatherSketch) != 0) {
+        return -1;
+    }
+    weather_refresh_start();
+
+    for (int i = 0; i < g_warmCount; i++) {
+        const weather_warm_entry* warm = &g_warm[i];
+        // Another loop's to keep
+        if (weather_shard_remote(warm->key) >= 0) continue;
+        response_cache_entry* entry =
+            response_cache_insert(&t_hotCache, warm->key, warm->stamp,
+                                  weather_fresh_until(warm->stamp) + Weather_STALE_WHILE_REVALIDATE_SECONDS);
+        if (!entry) break;
+        for (int encoding = 0; encoding < COMPRESS_ENCODINGS; encoding++) {
+            if (!warm->bodies[encoding]) continue;
+            response_cache_set(&t_hotCache, entry, (compress_encoding)encoding, warm->bodies[encoding], warm->lengths[encoding],
+                               warm->etags[encoding]);
+        }
+        // Loaded, not asked for
+        entry->hits = 0;
+    }
+    return 0;
+}
+
+// ========== Deltas ==========
+// The version of a hot entry before the current one, per loop, so a client
+// polling with the ETag it has gets what changed since (weather_delta_lookup).
+// One slot per hash of the key, a colliding location takes it over.
+
+typedef struct {
+    uint64_t key;
+    // the hot entry's version and its identity body, NULL until one is seen
+    time_t modified;
+    char* current;
+    // the version before, with the ETag of every variant it was sent in
+    time_t previous_modified;
+    char* previous;
+    char previous_etags[COMPRESS_ENCODINGS][HTTP_ETAG_SIZE];
+    // previous to current as a shared blob, made on the first ask; -1 in
+    // patch_length if the whole body is as small
+    uint8_t* patch;
+    long patch_length;
+} weather_delta;
+
+static __thread weather_delta* t_deltas = NULL;
+
+static metrics_counter g_deltaHits;
+static metrics_counter g_deltaMisses;
+
+static void weather_delta_clear_patch(weather_delta* delta) {
+    shared_blob_release(delta->patch);
+    delta->patch = NULL;
+    delta->patch_length = 0;
+}
+
+static void weather_delta_clear(weather_delta* delta) {
+    weather_delta_clear_patch(delta);
+    free(delta->current);
+    free(delta->previous);
+    memset(delta, 0, sizeof(weather_delta));
+}
+
+// The slot of key, taken over if another location had it; NULL if off
+static weather_delta* weather_delta_slot(uint64_t key, int take) {
+    if (Weather_DELTA_ENTRIES <= 0) return NULL;
+    if (!t_deltas) {
+        if (!take) return NULL;
+        t_deltas = (weather_delta*)calloc(Weather_DELTA_ENTRIES, sizeof(weather_delta));
+        if (!t_deltas) return NULL;
+    }
+    weather_delta* delta = &t_deltas[(key * 0x9E3779B97F4A7C15ULL >> 32) % Weather_DELTA_ENTRIES];
+    if (delta->key == key) return delta;
+    if (!take) return NULL;
+    weather_delta_clear(delta);
+    delta->key = key;
+    return delta;
+}
+
+// Before the hot entry of key becomes the last_modified version: the one
+// it has now is kept as the previous
+static void weather_delta_version(uint64_t key, time_t last_modified) {
+    weather_delta* delta = weather_delta_slot(key, 1);
+    if (!delta) return;
+    const response_cache_entry* entry = response_cache_peek(&t_hotCache, key);
+    const response_blob* blob = entry && entry->blob ? entry->blob : NULL;
+    if (delta->modified == 0 && blob) delta->modified = entry->last_modified;
+    if (last_modified <= delta->modified) return;
+
+    if (blob && entry->last_modified == delta->modified) {
+        if (!delta->current && blob->bodies[COMPRESS_IDENTITY]) {
+            delta->current = strndup((const char*)blob->bodies[COMPRESS_IDENTITY], blob->lengths[COMPRESS_IDENTITY]);
+        }
+        if (delta->current) {
+            free(delta->previous);
+            delta->previous = delta->current;
+            delta->current = NULL;
+            delta->previous_modified = delta->modified;
+            memcpy(delta->previous_etags, blob->etags, sizeof(delta->previous_etags));
+        }
+    }
+    free(delta->current);
+    delta->current = NULL;
+    weather_delta_clear_patch(delta);
+    delta->modified = last_modified;
+}
+
+// The identity body of the last_modified version of key, copied. A version
+// is only known by its second: a body refetched within it (a purge) takes
+// the place of the one kept, one that is not known drops it
+static void weather_delta_keep(uint64_t key, time_t last_modified, const char* body, size_t length) {
+    weather_delta* delta = weather_delta_slot(key, 0);
+    if (!delta || delta->modified != last_modified) return;
+    if (delta->current) {
+        if (body && strlen(delta->current) == length && memcmp(delta->current, body, length) == 0) return;
+        free(delta->current);
+        delta->current = NULL;
+        weather_delta_clear_patch(delta);
+    }
+    if (body) delta->current = strndup(body, length);
+}
+
+// response_cache_insert into the hot cache, the version it replaces goes to
+// the deltas
+static response_cache_entry* weather_hot_insert(uint64_t key, time_t last_modified, time_t expires) {
+    weather_delta_version(key, last_modified);
+    return response_cache_insert(&t_hotCache, key, last_modified, expires);
+}
+
+static void weather_delta_release_thread(void) {
+    if (!t_deltas) return;
+    for (int i = 0; i < Weather_DELTA_ENTRIES; i++) weather_delta_clear(&t_deltas[i]);
+    free(t_deltas);
+    t_deltas = NULL;
+}
+
+// The merge patch of delta, -1 if there is none worth sending
+static int weather_delta_patch(weather_delta* delta) {
+    if (delta->patch || delta->patch_length < 0) return delta->patch ? 0 : -1;
+    delta->patch_length = -1;
     json_error_t error;
-    json_t* json_obj = json_load_file(cache_path, 0, &error);
+    json_t* from = json_loads(delta->previous, 0, &error);
+    json_t* to = from ? json_loads(delta->current, 0, &error) : NULL;
+    json_t* patch = NULL;
+    int diffed = to ? json_patch_diff(from, to, &patch) : -1;
+    json_decref(from);
+    json_decref(to);
+    if (diffed != 0) return -1;
+
+    // Nothing changed but the version: an empty patch
+    char* text = patch ? json_dumps(patch, JSON_COMPACT) : strdup("{}");
+    json_decref(patch);
+    size_t length = text ? strlen(text) : 0;
+    if (text && length < strlen(delta->current)) {
+        delta->patch = shared_blob_copy((const uint8_t*)text, length);
+        if (delta->patch) delta->patch_length = (long)length;
+    }
+    free(text);
+    return delta->patch ? 0 : -1;
+}
+
+int weather_delta_lookup(double latitude, double longitude, time_t last_modified, const http_conditional* since,
+                         const uint8_t** patch, size_t* length) {
+    weather_delta* delta = weather_delta_slot(weather_cache_key(latitude, longitude), 0);
+    int found = 0;
+    if (delta && delta->modified == last_modified && delta->previous && delta->current) {
+        // Fetched forecasts go out with their date only
+        found = !since->if_none_match[0] && since->if_modified_since == delta->previous_modified;
+        for (int encoding = 0; encoding < COMPRESS_ENCODINGS && !found; encoding++) {
+            found = delta->previous_etags[encoding][0] &&
+                    http_conditional_is_current(since, delta->previous_etags[encoding], 0);
+        }
+    }
+    if (!found || weather_delta_patch(delta) != 0) {
+        metrics_counter_add(&g_deltaMisses, 1);
+        return -1;
+    }
+    metrics_counter_add(&g_deltaHits, 1);
+    *patch = delta->patch;
+    *length = (size_t)delta->patch_length;
+    return 0;
+}
+
+// The representation the backend produced, unless it is none or a failure
+static void weather_hot_store(weather_t* weather) {
+    // The owner's entry already
+    if (weather->not_modified || weather->last_modified == 0 || weather->shard_blob) return;
+    // A stale-if-error copy is past serving from here
+    time_t expires = weather_fresh_until(weather->last_modified) + Weather_STALE_WHILE_REVALIDATE_SECONDS;
+    if (expires <= time(NULL)) return;
+    if (weather_hot_init() != 0) return;
+
+    uint64_t key = weather_cache_key(weather->latitude, weather->longitude);
+    int followed = weather_followed(key);
+    // Kept by the owning loop, here only for this loop's subscribers
+    int owner = weather_shard_remote(key);
+    if (owner >= 0 && weather_shard_fill(owner, key, weather, expires) == 0 && !followed) return;
+    // What the subscribers were told last, the insert may clear it
+    const response_cache_entry* previous = followed ? response_cache_peek(&t_hotCache, key) : NULL;
+    time_t previous_modified = previous && previous->blob ? previous->last_modified : 0;
+    int previous_identity = previous_modified && previous->blob->bodies[COMPRESS_IDENTITY];
+    response_cache_entry* entry = weather_hot_insert(key, weather->last_modified, expires);
+    if (!entry) {
+        // Turned away by the admission sketch, the subscribers get it anyway
+        if (followed && weather->buffer) {
+            response_blob* blob = response_blob_new(weather->last_modified);
+            response_blob* set = blob ? response_blob_set(blob, COMPRESS_IDENTITY, (const uint8_t*)weather->buffer,
+                                                          strlen(weather->buffer), NULL)
+                                      : NULL;
+            if (set) weather_notify(key, set);
+            response_blob_release(set ? set : blob);
+        }
+        return;
+    }
+    const char* etag = weather->etag[0] ? weather->etag : NULL;
+    if (weather->encoded) {
+        response_cache_set(&t_hotCache, entry, weather->encoding, weather->encoded, weather->encoded_length, etag);
+        // Subscribers take identity, etag is the variant's
+        if (followed && weather->buffer) {
+            response_cache_set(&t_hotCache, entry, COMPRESS_IDENTITY, (const uint8_t*)weather->buffer,
+                               strlen(weather->buffer), NULL);
+        }
+    } else if (weather->buffer) {
+        response_cache_set(&t_hotCache, entry, COMPRESS_IDENTITY, (const uint8_t*)weather->buffer, strlen(weather->buffer), etag);
+    }
+    weather_delta_keep(key, weather->last_modified, weather->buffer, weather->buffer ? strlen(weather->buffer) : 0);
+    // Once per version, a request storing what the cache had already is no news
+    if (followed && entry->blob && (weather->last_modified > previous_modified || !previous_identity)) {
+        weather_notify(key, entry->blob);
+    }
+}
+
+// Lookups of every loop's hot cache
+static metrics_counter g_hotHits;
+static metrics_counter g_hotMisses;
+
+// The encoding of entry that goes out for encoding: its variant, compressed
+// from the identity body once, or identity standing in for it
+static compress_encoding weather_hot_variant(response_cache* cache, response_cache_entry* entry,
+                                             compress_encoding encoding) {
+    const response_blob* blob = entry->blob;
+    if (blob->bodies[encoding] || encoding == COMPRESS_IDENTITY || !blob->bodies[COMPRESS_IDENTITY]) return encoding;
+    // Small bodies stand in as they are
+    size_t length = blob->lengths[COMPRESS_IDENTITY];
+    if (length < COMPRESS_MIN_SIZE) return COMPRESS_IDENTITY;
+    size_t encoded_length = 0;
+    uint8_t* encoded = compress_alloc(encoding, blob->bodies[COMPRESS_IDENTITY], length, &encoded_length);
+    char etag[HTTP_ETAG_SIZE];
+    memcpy(etag, blob->etags[COMPRESS_IDENTITY], HTTP_ETAG_SIZE);
+    if (etag[0]) http_etag_variant(etag, compress_encoding_name(encoding));
+    // entry gets a new blob if responses were still sending the old
+    if (!encoded || response_cache_set(cache, entry, encoding, encoded, encoded_length, etag[0] ? etag : NULL) != 0) {
+        encoding = COMPRESS_IDENTITY;
+    }
+    free(encoded);
+    return encoding;
+}
+
+// The entry of key in encoding or one standing in for it, on this loop
+static response_cache_entry* weather_hot_find(uint64_t key, compress_encoding encoding, weather_hot_hit* hit) {
+    time_t now = time(NULL);
+    response_cache_entry* entry = response_cache_find(&t_hotCache, key, now);
+    if (!entry || !entry->blob) return NULL;
+
+    encoding = weather_hot_variant(&t_hotCache, entry, encoding);
+    const response_blob* blob = entry->blob;
+    if (!blob->bodies[encoding]) return NULL;
+
+    hit->blob = blob;
+    hit->body = blob->bodies[encoding];
+    hit->length = blob->lengths[encoding];
+    hit->encoding = encoding;
+    hit->etag = blob->etags[encoding][0] ? blob->etags[encoding] : NULL;
+    hit->last_modified = entry->last_modified;
+    hit->stale = now > weather_fresh_until(entry->last_modified);
+    return entry;
+}
 
-    if (json_obj) {
-        json_decref(json_obj);
+int weather_hot_lookup(double latitude, double longitude, compress_encoding encoding, weather_hot_hit* hit) {
+    if (g_warmCount > 0) weather_hot_init();
+    uint64_t key = weather_cache_key(latitude, longitude);
+    frequency_sketch_increment(&g_weatherSketch, key);
+    heavy_hitters_add(&g_weatherHitters, key, NULL);
+    if (!weather_hot_find(key, encoding, hit)) {
+        metrics_counter_add(&g_hotMisses, 1);
+        return -1;
+    }
+    metrics_counter_add(&g_hotHits, 1);
+    return 0;
+}
+
+// ========== Sharding ==========
+// With several loops a location's hot entry lives on the loop owning its key
+// (loop_mailbox_owner). The others ask the owner through its mailbox before
+// going to disk and hand what they fetched over to it, so one copy serves
+// every loop and no cache takes a lock. A location in demand is replicated,
+// read only, to the loops asking for it until the replica expires.
+
+typedef struct weather_shard_lookup {
+    loop_message message;
+    // the asking weather_t and the message in flight
+    int references;
+    int from;
+    uint64_t key;
+    compress_encoding encoding;
+    // the owner's answer, hit.blob retained, NULL for a miss
+    weather_hot_hit hit;
+    time_t expires;
+    int answered;
+    // on the asking loop only, NULL once the weather_t went away
+    weather_t* waiter;
+} weather_shard_lookup;
+
+typedef struct {
+    loop_message message;
+    uint64_t key;
+    time_t expires;
+    response_blob* blob;
+} weather_shard_fill_message;
+
+static metrics_counter g_shardHits;
+static metrics_counter g_shardMisses;
+static metrics_counter g_shardFills;
+static metrics_counter g_shardReplicas;
+// The loop's caches are gone (weather_release_thread), its mailbox still
+// runs until the job pool let go of it
+static __thread int t_shardClosed = 0;
+
+// The loop to ask for key, -1 if it is this one's (or the only one)
+static int weather_shard_remote(uint64_t key) {
+    int self = loop_mailbox_self();
+    int owner = loop_mailbox_owner(key);
+    return self < 0 || owner < 0 || owner == self ? -1 : owner;
+}
+
+static void weather_shard_lookup_release(weather_shard_lookup* lookup) {
+    if (__atomic_sub_fetch(&lookup->references, 1, __ATOMIC_ACQ_REL) != 0) return;
+    response_blob_release(lookup->hit.blob);
+    free(lookup);
+}
+
+// The answer outlived the asking loop
+static void weather_shard_lookup_drop(loop_message* message) {
+    weather_shard_lookup_release((weather_shard_lookup*)message);
+}
+
+// Back on the asking loop, also as a miss if the owner went away before
+// the question reached it
+static void weather_shard_lookup_answer(loop_message* message) {
+    weather_shard_lookup* lookup = (weather_shard_lookup*)message;
+    lookup->answered = 1;
+    if (lookup->waiter) lookup->waiter->on_wake(lookup->waiter->ctx);
+    weather_shard_lookup_release(lookup);
+}
+
+// On the owner, the hot lookup the asking loop would have done
+static void weather_shard_lookup_run(loop_message* message) {
+    weather_shard_lookup* lookup = (weather_shard_lookup*)message;
+    response_cache_entry* entry = !t_shardClosed && weather_hot_init() == 0
+                                      ? weather_hot_find(lookup->key, lookup->encoding, &lookup->hit)
+                                      : NULL;
+    if (entry) {
+        response_blob_retain(lookup->hit.blob);
+        lookup->expires = entry->expires;
+        // Refreshed here, where the entry is
+        if (lookup->hit.stale) {
+            double latitude, longitude;
+            weather_hot_location(lookup->key, &latitude, &longitude);
+            weather_refresh(latitude, longitude);
+        }
+    } else {
+        memset(&lookup->hit, 0, sizeof(lookup->hit));
+    }
+    lookup->message.run = weather_shard_lookup_answer;
+    lookup->message.drop = weather_shard_lookup_drop;
+    if (loop_mailbox_post(lookup->from, &lookup->message) != 0) weather_shard_lookup_release(lookup);
+}
+
+// Asks the owner of the weather's location, -1 if that is this loop or it
+// cannot be reached
+static int weather_shard_ask(weather_t* weather) {
+    uint64_t key = weather_cache_key(weather->latitude, weather->longitude);
+    int owner = weather_shard_remote(key);
+    if (owner < 0) return -1;
+
+    weather_shard_lookup* lookup = (weather_shard_lookup*)calloc(1, sizeof(weather_shard_lookup));
+    if (!lookup) return -1;
+    lookup->message.run = weather_shard_lookup_run;
+    lookup->message.drop = weather_shard_lookup_answer;
+    lookup->references = 2;
+    lookup->from = loop_mailbox_self();
+    lookup->key = key;
+    lookup->encoding = weather->encoding;
+    lookup->waiter = weather;
+    if (loop_mailbox_post(owner, &lookup->message) != 0) {
+        free(lookup);
+        return -1;
+    }
+    weather->shard_lookup = lookup;
+    return 0;
+}
+
+// The owner's answer, 0 if it had the location
+static int weather_shard_take(weather_t* weather) {
+    weather_shard_lookup* lookup = weather->shard_lookup;
+    weather->shard_lookup = NULL;
+    const weather_hot_hit* hit = &lookup->hit;
+    if (!hit->blob) {
+        metrics_counter_add(&g_shardMisses, 1);
+        weather_shard_lookup_release(lookup);
+        return -1;
+    }
+    metrics_counter_add(&g_shardHits, 1);
+
+    response_blob_retain(hit->blob);
+    weather->shard_blob = hit->blob;
+    weather->shard_encoding = hit->encoding;
+    snprintf(weather->etag, sizeof(weather->etag), "%s", hit->etag ? hit->etag : "");
+    weather->last_modified = hit->last_modified;
+    weather->not_modified = http_conditional_is_current(&weather->conditional, hit->etag, hit->last_modified);
+    weather->cache = hit->stale ? ACCESS_CACHE_STALE : ACCESS_CACHE_HOT;
+
+    // Asked for often enough to keep a copy here as well, or one of the
+    // hottest of all loops (the sketch saturates and ages process wide)
+    if (Weather_SHARD_REPLICATE_HITS > 0 &&
+        (weather_heavy_hitter(lookup->key, Weather_SHARD_REPLICATE_HITS) ||
+         frequency_sketch_estimate(&g_weatherSketch, lookup->key) >= Weather_SHARD_REPLICATE_HITS) &&
+        weather_hot_init() == 0) {
+        response_cache_entry* entry = weather_hot_insert(lookup->key, hit->last_modified, lookup->expires);
+        weather_delta_keep(lookup->key, hit->last_modified, (const char*)hit->blob->bodies[COMPRESS_IDENTITY],
+                           hit->blob->lengths[COMPRESS_IDENTITY]);
+        if (entry && response_cache_adopt(&t_hotCache, entry, hit->blob) == 0) metrics_counter_add(&g_shardReplicas, 1);
+    }
+    weather_shard_lookup_release(lookup);
+    return 0;
+}
+
+static void weather_shard_fill_drop(loop_message* message) {
+    weather_shard_fill_message* fill = (weather_shard_fill_message*)message;
+    response_blob_release(fill->blob);
+    free(fill);
+}
+
+// On the owner, what another loop fetched or loaded
+static void weather_shard_fill_run(loop_message* message) {
+    weather_shard_fill_message* fill = (weather_shard_fill_message*)message;
+    if (!t_shardClosed && weather_hot_init() == 0) {
+        int followed = weather_followed(fill->key);
+        const response_cache_entry* previous = followed ? response_cache_peek(&t_hotCache, fill->key) : NULL;
+        time_t previous_modified = previous && previous->blob ? previous->last_modified : 0;
+        response_cache_entry* entry = weather_hot_insert(fill->key, fill->blob->last_modified, fill->expires);
+        weather_delta_keep(fill->key, fill->blob->last_modified, (const char*)fill->blob->bodies[COMPRESS_IDENTITY],
+                           fill->blob->lengths[COMPRESS_IDENTITY]);
+        if (entry && response_cache_adopt(&t_hotCache, entry, fill->blob) == 0 && followed &&
+            entry->blob->bodies[COMPRESS_IDENTITY] && fill->blob->last_modified > previous_modified) {
+            weather_notify(fill->key, entry->blob);
+        }
+    }
+    weather_shard_fill_drop(message);
+}
+
+// Hands the weather's body over to the owner of key, -1 if it stays here
+static int weather_shard_fill(int owner, uint64_t key, const weather_t* weather, time_t expires) {
+    weather_shard_fill_message* fill = (weather_shard_fill_message*)calloc(1, sizeof(weather_shard_fill_message));
+    response_blob* blob = fill ? response_blob_new(weather->last_modified) : NULL;
+    if (!blob) {
+        free(fill);
+        return -1;
+    }
+    const char* etag = weather->etag[0] ? weather->etag : NULL;
+    struct {
+        compress_encoding encoding;
+        const uint8_t* data;
+        size_t length;
+        const char* etag;
+    } variants[2] = {
+        {weather->encoding, weather->encoded, weather->encoded_length, etag},
+        // Identity's own etag only when it is the one the client took
+        {COMPRESS_IDENTITY, (const uint8_t*)weather->buffer, weather->buffer ? strlen(weather->buffer) : 0,
+         weather->encoded ? NULL : etag},
+    };
+    for (int i = 0; i < 2 && blob; i++) {
+        if (!variants[i].data) continue;
+        uint8_t* copy = shared_blob_copy(variants[i].data, variants[i].length);
+        response_blob* set = copy ? response_blob_set(blob, variants[i].encoding, copy, variants[i].length,
+                                                      variants[i].etag) : NULL;
+        shared_blob_release(copy);
+        if (!set) {
+            response_blob_release(blob);
+            blob = NULL;
+        } else {
+            blob = set;
+        }
+    }
+    if (!blob) {
+        free(fill);
+        return -1;
+    }
+
+    fill->message.run = weather_shard_fill_run;
+    fill->message.drop = weather_shard_fill_drop;
+    fill->key = key;
+    fill->expires = expires;
+    fill->blob = blob;
+    if (loop_mailbox_post(owner, &fill->message) != 0) {
+        response_blob_release(blob);
+        free(fill);
+        return -1;
+    }
+    metrics_counter_add(&g_shardFills, 1);
+    return 0;
+}
+
+// ========== Background Refresh ==========
+// Detached weather_t's that end up in both caches, stepped by a task of
+// their own on the loop that asked for them. The same task sweeps the hot
+// cache and refreshes the entries in demand before they expire, so popular
+// locations neither go cold nor all hit upstream in the same second.
+// Weather_REFRESH_MAX_INFLIGHT is the loop's upstream budget for both.
+
+static __thread weather_t* t_refreshing[Weather_REFRESH_MAX_INFLIGHT];
+static __thread int t_refreshCount = 0;
+static __thread smw_task* t_refreshTask = NULL;
+static __thread uint64_t t_nextSweep = 0;
+static __thread unsigned int t_refreshSeed = 0;
+// The hottest locations of all loops and their counts as of the last sweep
+static __thread uint64_t t_heavyKeys[HEAVY_HITTERS_TOP_K];
+static __thread uint64_t t_heavyCounts[HEAVY_HITTERS_TOP_K];
+static __thread int t_heavyCount = 0;
+static metrics_counter g_prefetches;
+
+static void weather_refresh_on_wake(void* ctx) {
+    smw_wakeTask(t_refreshTask);
+}
+
+static void weather_refresh_on_done(void* ctx) {
+    ((weather_t*)ctx)->refresh_done = 1;
+    smw_wakeTask(t_refreshTask);
+}
+
+static void weather_refresh_sweep(void) {
+    time_t now = time(NULL);
+    for (int i = 0; i < t_hotCache.capacity; i++) {
+        response_cache_entry* entry = &t_hotCache.entries[i];
+        if (!entry->used) continue;
+        int hot = entry->hits >= Weather_REFRESH_HOT_HITS;
+        entry->hits >>= 1;
+        if (!hot || t_refreshCount >= Weather_REFRESH_MAX_INFLIGHT) continue;
+        // A replica, the owner refreshes it (followed ones are seen to below)
+        if (weather_shard_remote(entry->key) >= 0) continue;
+
+        // Jittered per sweep, loops sharing a location rarely pick the same one
+        time_t lead = Weather_REFRESH_LEAD_SECONDS + rand_r(&t_refreshSeed) % (Weather_REFRESH_JITTER_SECONDS + 1);
+        if (weather_fresh_until(entry->last_modified) - now > lead) continue;
+
+        double latitude, longitude;
+        weather_hot_location(entry->key, &latitude, &longitude);
+        weather_refresh_location(latitude, longitude, entry->last_modified);
+    }
+
+    // Followed locations stay current whatever their hits, one that fell out
+    // of the cache is loaded again (disk first)
+    for (int i = 0; i < t_subscriptions.capacity; i++) {
+        const subscription_key* followed = &t_subscriptions.keys[i];
+        if (!followed->used || followed->count == 0) continue;
+        if (t_refreshCount >= Weather_REFRESH_MAX_INFLIGHT) break;
+        const response_cache_entry* entry = response_cache_peek(&t_hotCache, followed->key);
+        time_t lead = Weather_REFRESH_LEAD_SECONDS + rand_r(&t_refreshSeed) % (Weather_REFRESH_JITTER_SECONDS + 1);
+        if (entry && weather_fresh_until(entry->last_modified) - now > lead) continue;
+
+        double latitude, longitude;
+        weather_hot_location(followed->key, &latitude, &longitude);
+        weather_refresh_location(latitude, longitude, entry ? entry->last_modified : 1);
+    }
+
+    // So are the hottest locations of every loop this loop owns, whether
+    // its hot cache still has them or not
+    heavy_hitters_entry hottest[HEAVY_HITTERS_TOP_K];
+    t_heavyCount = heavy_hitters_top(&g_weatherHitters, hottest, HEAVY_HITTERS_TOP_K);
+    for (int i = 0; i < t_heavyCount; i++) {
+        t_heavyKeys[i] = hottest[i].key;
+        t_heavyCounts[i] = hottest[i].count;
+    }
+    for (int i = 0; i < t_heavyCount; i++) {
+        // hottest first
+        if (t_heavyCounts[i] < Weather_REFRESH_HOT_HITS || t_refreshCount >= Weather_REFRESH_MAX_INFLIGHT) break;
+        if (weather_shard_remote(t_heavyKeys[i]) >= 0) continue;
+        const response_cache_entry* entry = response_cache_peek(&t_hotCache, t_heavyKeys[i]);
+        time_t lead = Weather_REFRESH_LEAD_SECONDS + rand_r(&t_refreshSeed) % (Weather_REFRESH_JITTER_SECONDS + 1);
+        if (entry && weather_fresh_until(entry->last_modified) - now > lead) continue;
+
+        double latitude, longitude;
+        weather_hot_location(t_heavyKeys[i], &latitude, &longitude);
+        weather_refresh_location(latitude, longitude, entry ? entry->last_modified : 1);
+    }
+}
+
+// Among the hottest locations at the last sweep with at least hits
+static int weather_heavy_hitter(uint64_t key, uint64_t hits) {
+    for (int i = 0; i < t_heavyCount && t_heavyCounts[i] >= hits; i++) {
+        if (t_heavyKeys[i] == key) return 1;
+    }
+    return 0;
+}
+
+static void weather_refresh_taskwork(void* context, uint64_t monTime) {
+    if (monTime >= t_nextSweep) {
+        weather_refresh_sweep();
+        t_nextSweep = monTime + Weather_REFRESH_SWEEP_MS;
+    }
+
+    int polling = 0;
+    for (int i = 0; i < t_refreshCount;) {
+        weather_t* weather = t_refreshing[i];
+        int result = weather->refresh_done ? BACKEND_WORK_WAIT : weather_work((void**)&weather);
+        if (weather->refresh_done) {
+            LOG_DEBUG("Weather: Refreshed %.2f,%.2f", weather->latitude, weather->longitude);
+            // A new forecast, the copies a CDN keeps of the old one go
+            if (cdn_purge_enabled() &&
+                (weather->cache == ACCESS_CACHE_FETCH || weather->cache == ACCESS_CACHE_COALESCED)) {
+                char key[Weather_SURROGATE_KEY_SIZE];
+                weather_surrogate_key(weather->latitude, weather->longitude, key, sizeof(key));
+                cdn_purge_key(key);
+            }
+            weather_dispose((void**)&weather);
+            t_refreshing[i] = t_refreshing[--t_refreshCount];
+            continue;
+        }
+        if (result == BACKEND_WORK_AGAIN) smw_wakeTask(t_refreshTask);
+        if (result == BACKEND_WORK_POLL) polling = 1;
+        i++;
+    }
+    smw_setDeadline(t_refreshTask, polling ? monTime + Weather_REFRESH_POLL_MS : t_nextSweep);
+}
+
+static void weather_refresh_start(void) {
+    if (t_refreshTask) return;
+    t_refreshTask = smw_createTask(NULL, weather_refresh_taskwork);
+    if (!t_refreshTask) return;
+    smw_setTaskName(t_refreshTask, "weather_refresh");
+    smw_parkTask(t_refreshTask);
+
+    uint64_t monTime = SystemMonotonicMS();
+    t_refreshSeed = (unsigned int)(monTime ^ (uintptr_t)&t_refreshSeed);
+    t_nextSweep = monTime + Weather_REFRESH_SWEEP_MS;
+    smw_setDeadline(t_refreshTask, t_nextSweep);
+}
+
+// older 0 fetches right away, otherwise the disk cache is checked first
+// for a version newer than older
+static void weather_refresh_location(double latitude, double longitude, time_t older) {
+    for (int i = 0; i < t_refreshCount; i++) {
+        if (t_refreshing[i]->latitude == latitude && t_refreshing[i]->longitude == longitude) return;
+    }
+    if (t_refreshCount >= Weather_REFRESH_MAX_INFLIGHT) return;
+    weather_refresh_start();
+    if (!t_refreshTask) return;
+
+    void* weather_struct = NULL;
+    if (weather_init(NULL, &weather_struct, weather_refresh_on_done, weather_refresh_on_wake) != 0) return;
+    weather_t* weather = (weather_t*)weather_struct;
+    weather->ctx = weather;
+    weather->latitude = latitude;
+    weather->longitude = longitude;
+    weather->refresh_older = older;
+    weather->state = older ? Weather_State_Init : Weather_State_FetchFromAPI_Init;
+
+    t_refreshing[t_refreshCount++] = weather;
+    smw_wakeTask(t_refreshTask);
+}
+
+void weather_refresh(double latitude, double longitude) {
+    // Served stale until the mode ends, the next request refreshes it
+    if (cache_only_active()) return;
+    weather_refresh_location(latitude, longitude, 0);
+}
+
+void weather_prefetch_location(double latitude, double longitude) {
+    if (cache_only_active() || t_refreshCount >= Weather_REFRESH_MAX_INFLIGHT / 2) return;
+    weather_quantize(&latitude, &longitude);
+    // Peeked, a guess must not make the entry look in demand
+    if (response_cache_peek(&t_hotCache, weather_cache_key(latitude, longitude)) != NULL) return;
+    if (curl_client_budget_left() <= Weather_PREFETCH_BUDGET_RESERVE) return;
+    metrics_counter_add(&g_prefetches, 1);
+    // Any stored version will do
+    weather_refresh_location(latitude, longitude, 1);
+}
+
+int weather_subscribe(subscription* member, double latitude, double longitude, subscription_deliver deliver,
+                      void* context, const response_blob** current) {
+    *current = NULL;
+    if (!t_publishTask) {
+        if (subscription_registry_init(&t_subscriptions, SUBSCRIPTION_INITIAL_KEYS) != 0) return -1;
+        t_publishTask = smw_createTask(NULL, weather_publish_taskwork);
+        if (!t_publishTask) {
+            subscription_registry_dispose(&t_subscriptions);
+            return -1;
+        }
+        smw_setTaskName(t_publishTask, "weather_publish");
+        smw_parkTask(t_publishTask);
+    }
+    if (subscription_add(&t_subscriptions, member, weather_cache_key(latitude, longitude), deliver, context) != 0) {
+        return -1;
+    }
+    metrics_gauge_add(&g_subscribers, 1);
+
+    weather_hot_hit hit;
+    if (weather_hot_lookup(latitude, longitude, COMPRESS_IDENTITY, &hit) != 0) {
+        // Whatever the disk has, the sweep keeps it current from there
+        weather_refresh_location(latitude, longitude, 1);
         return 0;
     }
+    if (hit.stale) weather_refresh(latitude, longitude);
+    response_blob_retain(hit.blob);
+    *current = hit.blob;
+    return 0;
+}
+
+void weather_unsubscribe(subscription* member) {
+    // A connection outliving the loop's registry has nothing to leave
+    if (member->key < 0 || !t_subscriptions.keys) return;
+    subscription_remove(&t_subscriptions, member);
+    metrics_gauge_add(&g_subscribers, -1);
+}
+
+void weather_release_thread(void) {
+    while (t_refreshCount > 0) {
+        weather_t* weather = t_refreshing[--t_refreshCount];
+        weather_dispose((void**)&weather);
+    }
+    if (t_refreshTask) {
+        smw_destroyTask(t_refreshTask);
+        t_refreshTask = NULL;
+    }
+    if (t_publishTask) {
+        smw_destroyTask(t_publishTask);
+        t_publishTask = NULL;
+    }
+    subscription_registry_dispose(&t_subscriptions);
+    response_cache_dispose(&t_hotCache);
+    response_cache_dispose(&t_projectionCache);
+    weather_delta_release_thread();
+    // After the refreshes, which may have been waiting for it
+    cache_store_release_thread(g_sharedStore);
+    t_shardClosed = 1;
+}
 
-    return -1;
+// ========== Disk Store ==========
+// Every location's record and its encoded variants (slot = encoding) live in
+// one store file shared by all threads
+
+static record_store* g_weatherStore = NULL;
+static uint64_t g_storeHits = 0;
+static uint64_t g_storeMisses = 0;
+static uint64_t g_storeEvictions = 0;
+static metrics_counter g_storeInPlace;
+// Answers of the locations' owners on the peer ring
+static metrics_counter g_peerHits;
+static metrics_counter g_peerMisses;
+static metrics_counter g_sharedHits;
+static metrics_counter g_sharedMisses;
+
+static void weather_write_drain(void);
+
+static int64_t weather_metrics_load(void* context) {
+    return (int64_t)__atomic_load_n((uint64_t*)context, __ATOMIC_RELAXED);
+}
+
+static int64_t weather_metrics_store_bytes(void* context) {
+    (void)context;
+    size_t bytes = 0;
+    record_store_usage(g_weatherStore, &bytes, NULL);
+    return (int64_t)bytes;
+}
+
+static void weather_register_metrics(void) {
+    const char* help = "Cache lookups, by cache and result.";
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_hot\",result=\"hit\"", &g_hotHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_hot\",result=\"miss\"", &g_hotMisses);
+    metrics_register_read("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_disk\",result=\"hit\"",
+                          weather_metrics_load, &g_storeHits);
+    metrics_register_read("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_disk\",result=\"miss\"",
+                          weather_metrics_load, &g_storeMisses);
+    metrics_register("weather_disk_in_place_total", "Disk hits sent from the store file as they are, not copied.",
+                     METRICS_COUNTER, NULL, &g_storeInPlace);
+    metrics_register_read("cache_evictions_total", "Entries evicted for room, by cache.", METRICS_COUNTER,
+                          "cache=\"weather_disk\"", weather_metrics_load, &g_storeEvictions);
+    metrics_register_read("cache_bytes", "Bytes of live entries, by cache.", METRICS_GAUGE, "cache=\"weather_disk\"",
+                          weather_metrics_store_bytes, NULL);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_shard\",result=\"hit\"",
+                     &g_shardHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_shard\",result=\"miss\"",
+                     &g_shardMisses);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_peer\",result=\"hit\"",
+                     &g_peerHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_peer\",result=\"miss\"",
+                     &g_peerMisses);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_shared\",result=\"hit\"",
+                     &g_sharedHits);
+    metrics_register("cache_requests_total", help, METRICS_COUNTER, "cache=\"weather_shared\",result=\"miss\"",
+                     &g_sharedMisses);
+    metrics_register("weather_shard_fills_total", "Forecasts handed to the loop owning their location.",
+                     METRICS_COUNTER, NULL, &g_shardFills);
+    metrics_register("weather_deltas_total", "Delta polls, answered with a merge patch or, their version gone, in full.",
+                     METRICS_COUNTER, "result=\"patch\"", &g_deltaHits);
+    metrics_register("weather_deltas_total", "Delta polls, answered with a merge patch or, their version gone, in full.",
+                     METRICS_COUNTER, "result=\"full\"", &g_deltaMisses);
+    metrics_register("weather_shard_replicas_total", "Entries in demand copied from their owner's hot cache.",
+                     METRICS_COUNTER, NULL, &g_shardReplicas);
+    metrics_register("weather_prefetches_total", "Forecasts fetched ahead of a request likely to follow.",
+                     METRICS_COUNTER, NULL, &g_prefetches);
+    metrics_register("weather_subscribers", "Clients following a location, on every loop.", METRICS_GAUGE, NULL,
+                     &g_subscribers);
+    metrics_register("weather_deliveries_total", "Newer forecasts handed to subscribers.", METRICS_COUNTER, NULL,
+                     &g_deliveries);
+    metrics_register("weather_model_late_total", "Fetches past the publication lag that got the previous step.",
+                     METRICS_COUNTER, NULL, &g_modelLate);
+}
+
+// Written by main before the loops start, only read afterwards
+static char g_weatherApiUrl[METEO_API_URL_SIZE] = METEO_API_URL;
+
+const char* weather_api_url(void) {
+    return g_weatherApiUrl;
+}
+
+int weather_set_api_url(const char* base) {
+    if (strlen(base) >= sizeof(g_weatherApiUrl)) return -1;
+    strcpy(g_weatherApiUrl, base);
+    return 0;
+}
+
+int weather_set_shared_store(const char* url) {
+    cache_store* store = cache_store_open(url, "weather");
+    if (!store) return -1;
+    cache_store_close(&g_sharedStore);
+    g_sharedStore = store;
+    return 0;
+}
+
+int weather_open_shared(void) {
+    g_storeReadOnly = 1;
+    return g_sharedStore || weather_set_shared_store("shm") == 0 ? 0 : -1;
+}
+
+int weather_global_init(void) {
+    weather_register_metrics();
+    if (frequency_sketch_init(&g_weatherSketch, Weather_SKETCH_WIDTH) != 0) return -1;
+    if (heavy_hitters_init(&g_weatherHitters, Weather_HEAVY_HITTERS_WIDTH) != 0) return -1;
+    create_folder(CACHE_DIR);
+    if (record_store_open(&g_weatherStore, Weather_STORE_PATH, Weather_STORE_CAPACITY,
+                          weather_ttl() + Weather_STALE_IF_ERROR_SECONDS) != 0) {
+        return -1;
+    }
+    // History queries answer with nothing without it, the forecasts go on
+    if (weather_archive_open() != 0) LOG_WARN("Weather: History archive unavailable");
+    return 0;
+}
+
+void weather_global_dispose(void) {
+    // The pool is gone by now, what is still queued is written here
+    weather_write_drain();
+    record_store_close(&g_weatherStore);
+    weather_archive_close();
+    cache_store_close(&g_sharedStore);
+    weather_warm_free();
+    frequency_sketch_dispose(&g_weatherSketch);
+    heavy_hitters_dispose(&g_weatherHitters);
+}
+
+int weather_heavy_hitters(heavy_hitters_entry* out, int max) {
+    int count = heavy_hitters_top(&g_weatherHitters, out, max);
+    for (int i = 0; i < count; i++) {
+        double latitude, longitude;
+        weather_hot_location(out[i].key, &latitude, &longitude);
+        snprintf(out[i].label, sizeof(out[i].label), "%.6g,%.6g", latitude, longitude);
+    }
+    return count;
+}
+
+void weather_get_cache_stats(weather_cache_stats* stats) {
+    memset(stats, 0, sizeof(weather_cache_stats));
+    stats->hot = t_hotCache.stats;
+    stats->disk_hits = __atomic_load_n(&g_storeHits, __ATOMIC_RELAXED);
+    stats->disk_misses = __atomic_load_n(&g_storeMisses, __ATOMIC_RELAXED);
+    stats->disk_evictions = __atomic_load_n(&g_storeEvictions, __ATOMIC_RELAXED);
+    record_store_usage(g_weatherStore, &stats->disk_bytes, &stats->disk_values);
+}
+
+// ========== Store Eviction ==========
+// Past Weather_STORE_BUDGET_BYTES the locations the sketch counts least
+// (the oldest of those first) go, with all their variants, until the store
+// is down to seven eighths of the budget so this does not run on every write.
+
+typedef struct {
+    uint64_t key;
+    time_t stamp;
+    int frequency;
+} weather_evict_candidate;
+
+typedef struct {
+    weather_evict_candidate* candidates;
+    int count;
+    int capacity;
+} weather_evict_scan;
+
+static void weather_evict_collect(uint64_t key, time_t stamp, size_t length, void* context) {
+    weather_evict_scan* scan = (weather_evict_scan*)context;
+    if (scan->count == scan->capacity) {
+        int capacity = scan->capacity ? scan->capacity * 2 : 256;
+        weather_evict_candidate* grown =
+            (weather_evict_candidate*)realloc(scan->candidates, capacity * sizeof(weather_evict_candidate));
+        if (!grown) return;
+        scan->candidates = grown;
+        scan->capacity = capacity;
+    }
+    scan->candidates[scan->count].key = key;
+    scan->candidates[scan->count].stamp = stamp;
+    scan->candidates[scan->count].frequency = frequency_sketch_estimate(&g_weatherSketch, key);
+    scan->count++;
+}
+
+static int weather_evict_order(const void* a, const void* b) {
+    const weather_evict_candidate* left = (const weather_evict_candidate*)a;
+    const weather_evict_candidate* right = (const weather_evict_candidate*)b;
+    if (left->frequency != right->frequency) return left->frequency - right->frequency;
+    return left->stamp < right->stamp ? -1 : (left->stamp > right->stamp ? 1 : 0);
+}
+
+static void weather_store_evict(void) {
+    size_t live = 0;
+    record_store_usage(g_weatherStore, &live, NULL);
+    if (Weather_STORE_BUDGET_BYTES <= 0 || live <= (size_t)Weather_STORE_BUDGET_BYTES) return;
+
+    weather_evict_scan scan = {NULL, 0, 0};
+    record_store_each(g_weatherStore, COMPRESS_IDENTITY, weather_evict_collect, &scan);
+    qsort(scan.candidates, scan.count, sizeof(weather_evict_candidate), weather_evict_order);
+
+    size_t target = (size_t)Weather_STORE_BUDGET_BYTES / 8 * 7;
+    int evicted = 0;
+    for (int i = 0; i < scan.count && live > target; i++) {
+        for (int encoding = 0; encoding < COMPRESS_ENCODINGS; encoding++) {
+            record_store_remove(g_weatherStore, scan.candidates[i].key, (uint8_t)encoding);
+        }
+        record_store_usage(g_weatherStore, &live, NULL);
+        evicted++;
+    }
+    free(scan.candidates);
+    __atomic_add_fetch(&g_storeEvictions, evicted, __ATOMIC_RELAXED);
+    LOG_INFO("Weather: Evicted %d locations from the store", evicted);
+}
+
+// Great circle distance in km
+static double weather_distance_km(double lat1, double lon1, double lat2, double lon2) {
+    const double radians = M_PI / 180.0;
+    double dlat = (lat2 - lat1) * radians;
+    double dlon = (lon2 - lon1) * radians;
+    double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1 * radians) * cos(lat2 * radians) * sin(dlon / 2) * sin(dlon / 2);
+    return 6371.0 * 2.0 * atan2(sqrt(a), sqrt(1.0 - a));
+}
+
+static int weather_cell_fresh(double latitude, double longitude, time_t now) {
+    time_t stamp;
+    if (record_store_stat(g_weatherStore, weather_cache_key(latitude, longitude), COMPRESS_IDENTITY, &stamp, NULL) != 0) {
+        return 0;
+    }
+    return now <= weather_fresh_until(stamp);
+}
+
+int weather_nearest_fresh(double* latitude, double* longitude) {
+    if (Weather_NEAREST_KM <= 0 || !g_weatherStore) return -1;
+    time_t now = time(NULL);
+    if (weather_cell_fresh(*latitude, *longitude, now)) return 0;
+
+    // The grid is the spatial index, the cells around the location are probed
+    double cos_lat = cos(*latitude * M_PI / 180.0);
+    int rows = (int)ceil(Weather_NEAREST_KM / (111.2 * Weather_GRID_DEGREES));
+    int cols = cos_lat > 0.01 ? (int)ceil(Weather_NEAREST_KM / (111.2 * cos_lat * Weather_GRID_DEGREES)) : rows;
+    double best_distance = Weather_NEAREST_KM;
+    double best_latitude = 0.0;
+    double best_longitude = 0.0;
+    int found = 0;
+    for (int row = -rows; row <= rows; row++) {
+        for (int col = -cols; col <= cols; col++) {
+            if (row == 0 && col == 0) continue;
+            double lat = *latitude + row * Weather_GRID_DEGREES;
+            double lon = *longitude + col * Weather_GRID_DEGREES;
+            weather_quantize(&lat, &lon);
+            double distance = weather_distance_km(*latitude, *longitude, lat, lon);
+            if (distance > best_distance || (found && distance == best_distance)) continue;
+            if (!weather_cell_fresh(lat, lon, now)) continue;
+            best_distance = distance;
+            best_latitude = lat;
+            best_longitude = lon;
+            found = 1;
+        }
+    }
+    if (!found) return -1;
+    *latitude = best_latitude;
+    *longitude = best_longitude;
+    return 0;
+}
+
+// ========== Disk Jobs ==========
+// Cache file access runs on the job pool, the state machine waits in
+// Weather_State_LoadFromDisk until weather_cache_job_done() moves it on.
+
+// A stored variant is only good if written after the record it was made from,
+// served from where it is stored
+static int weather_load_variant(time_t record_stamp, weather_t* weather) {
+    record_store_view view;
+    if (record_store_view_get(g_weatherStore, weather_cache_key(weather->latitude, weather->longitude),
+                              weather->encoding, &view) != 0) {
+        return -1;
+    }
+    if (view.stamp < record_stamp || view.length == 0) {
+        record_store_view_release(&view);
+        return -1;
+    }
+    weather->disk_view = view;
+    weather->disk_body = view.data;
+    weather->disk_offset = view.offset;
+    weather->encoded = (uint8_t*)view.data;
+    weather->encoded_length = view.length;
+    return 0;
+}
+
+// The record's body in place, -1 if it has none
+static int weather_load_body(weather_t* weather) {
+    record_store_view view;
+    if (record_store_view_get(g_weatherStore, weather_cache_key(weather->latitude, weather->longitude), COMPRESS_IDENTITY,
+                              &view) != 0) {
+        return -1;
+    }
+    const char* body;
+    size_t body_length;
+    if (weather_record_body(view.data, view.length, &body, &body_length) != 0) {
+        record_store_view_release(&view);
+        return -1;
+    }
+    weather->disk_view = view;
+    weather->disk_body = (const uint8_t*)body;
+    weather->disk_offset = view.offset + (off_t)((const uint8_t*)body - view.data);
+    weather->buffer = (char*)body;
+    return 0;
+}
+
+static void weather_store_variant(double latitude, double longitude, compress_encoding encoding, const uint8_t* data,
+                                  size_t length) {
+    if (g_storeReadOnly) return;
+    record_store_put(g_weatherStore, weather_cache_key(latitude, longitude), encoding, data, length, time(NULL));
+}
+
+// Compresses buffer into the encoding the client takes, on the pool thread
+static void weather_encode(weather_t* weather) {
+    if (weather->encoding == COMPRESS_IDENTITY || !weather->buffer || weather->encoded) return;
+    size_t length = strlen(weather->buffer);
+    if (length < COMPRESS_MIN_SIZE) return;
+    weather->encoded = compress_alloc(weather->encoding, weather->buffer, length, &weather->encoded_length);
+}
+
+static void weather_cache_job_work(void* ctx) {
+    weather_t* weather = (weather_t*)ctx;
+    if (weather->peer) {
+        weather_peer_load(weather);
+        return;
+    }
+
+    time_t stamp;
+    size_t length;
+    if (record_store_stat(g_weatherStore, weather_cache_key(weather->latitude, weather->longitude), COMPRESS_IDENTITY,
+                          &stamp, &length) != 0 ||
+        stamp <= weather->refresh_older) {
+        __atomic_add_fetch(&g_storeMisses, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    time_t now = time(NULL);
+    time_t expires = weather_fresh_until(stamp);
+    if (now > expires + Weather_STALE_WHILE_REVALIDATE_SECONDS) {
+        __atomic_add_fetch(&g_storeMisses, 1, __ATOMIC_RELAXED);
+        // Too old to serve, but better than an error if the fetch fails
+        if (now <= expires + Weather_STALE_IF_ERROR_SECONDS &&
+            load_weather_from_cache(weather->latitude, weather->longitude, &weather->fallback) == 0) {
+            weather->fallback_modified = stamp;
+        }
+        return;
+    }
+    __atomic_add_fetch(&g_storeHits, 1, __ATOMIC_RELAXED);
+    weather->stale = now > expires;
+
+    // The record version is the validator, a client that has it needs nothing loaded
+    weather->last_modified = stamp;
+    http_etag_from_file(weather->etag, stamp, (uint64_t)length);
+    // Each encoding is a representation of its own
+    if (weather->encoding != COMPRESS_IDENTITY) http_etag_variant(weather->etag, compress_encoding_name(weather->encoding));
+    if (http_conditional_is_current(&weather->conditional, weather->etag, weather->last_modified)) {
+        weather->not_modified = 1;
+        return;
+    }
+
+    // Compressed once by the save job, served as stored
+    if (weather->encoding != COMPRESS_IDENTITY && weather_load_variant(stamp, weather) == 0) {
+        return;
+    }
+
+    if (weather_load_body(weather) == 0) {
+        // Cache written before variants were stored, or one went missing
+        weather_encode(weather);
+        if (weather->encoded) {
+            weather_store_variant(weather->latitude, weather->longitude, weather->encoding, weather->encoded,
+                                  weather->encoded_length);
+        } else {
+            // Too small to compress or failed, goes out as identity
+            http_etag_from_file(weather->etag, stamp, (uint64_t)length);
+        }
+    } else {
+        weather->last_modified = 0;
+        weather->etag[0] = '\0';
+    }
+}
+
+static void weather_cache_job_done(void* ctx) {
+    weather_t* weather = (weather_t*)ctx;
+    weather->job = NULL;
+    // Served from the file all the same, the next request gets a fresh one
+    if (weather->stale) weather_refresh(weather->latitude, weather->longitude);
+    int loaded = weather->buffer || weather->encoded || weather->peer_reply;
+    if (weather->not_modified || loaded) {
+        weather->cache = weather->stale ? ACCESS_CACHE_STALE : ACCESS_CACHE_DISK;
+    }
+    if (weather->not_modified) {
+        weather->state = Weather_State_Done;
+        LOG_DEBUG("Weather: Client Copy Current");
+    } else if (loaded) {
+        weather->state = Weather_State_Done;
+        LOG_DEBUG("Weather: Loaded From Disk");
+    } else {
+        weather->state = Weather_State_FetchFromAPI_Init;
+    }
+    weather->on_wake(weather->ctx);
+}
+
+// The API response to client JSON transform is the CPU heavy step, it runs
+// on the shared pool so a burst on one worker spreads over every pool thread
+static void weather_process_job_work(void* ctx) {
+    weather_t* weather = (weather_t*)ctx;
+    if (weather_transform(weather->buffer, &weather->processed, &weather->record, &weather->record_length) != 0) {
+        weather->processed = NULL;
+        return;
+    }
+    if (weather->encoding != COMPRESS_IDENTITY && strlen(weather->processed) >= COMPRESS_MIN_SIZE) {
+        weather->encoded = compress_alloc(weather->encoding, weather->processed, strlen(weather->processed),
+                                          &weather->encoded_length);
+    }
+}
+
+static void weather_process_job_done(void* ctx) {
+    weather_t* weather = (weather_t*)ctx;
+    weather->job = NULL;
+    if (!weather->processed) {
+        weather->state = Weather_State_Done;
+        LOG_WARN("Weather: Processing Response Failed");
+        weather->on_wake(weather->ctx);
+        return;
+    }
+    free(weather->buffer);
+    weather->buffer = weather->processed;
+    weather->processed = NULL;
+    // About when the cache write will stamp the file
+    weather->last_modified = time(NULL);
+    weather->state = Weather_State_SaveToDisk;
+    LOG_DEBUG("Weather: Processing Response Succeeded");
+    weather->on_wake(weather->ctx);
+}
+
+// ========== Write Behind ==========
+// Records to persist, process wide and drained by one pool job at a time.
+// A location written again before the job gets to it only keeps the newer
+// record, a burst of refreshes ends up as one append per location.
+
+typedef struct weather_write {
+    double latitude;
+    double longitude;
+    uint8_t* record;
+    size_t length;
+    time_t stamp;
+    struct weather_write* next;
+} weather_write;
+
+static pthread_mutex_t g_writeLock = PTHREAD_MUTEX_INITIALIZER;
+static weather_write* g_writes = NULL;
+static int g_writeScheduled = 0;
+
+static void weather_write_one(weather_write* write) {
+    if (record_store_put(g_weatherStore, weather_cache_key(write->latitude, write->longitude), COMPRESS_IDENTITY,
+                         write->record, write->length, write->stamp) != 0) {
+        LOG_WARN("Weather: Saving To Disk Failed");
+        return;
+    }
+
+    // Its current block goes into the location's history as well
+    weather_data_t data;
+    if (weather_record_decode(write->record, write->length, &data) == 0) {
+        weather_archive_append(write->latitude, write->longitude, &data);
+        free_weather(&data);
+    }
+
+    // Every encoding is stored next to the record, cache hits never compress
+    const char* body;
+    size_t length;
+    if (weather_record_body(write->record, write->length, &body, &length) != 0 || length < COMPRESS_MIN_SIZE) return;
+    for (int encoding = COMPRESS_GZIP; encoding < COMPRESS_ENCODINGS; encoding++) {
+        size_t encoded_length = 0;
+        uint8_t* encoded = compress_alloc((compress_encoding)encoding, body, length, &encoded_length);
+        if (encoded) weather_store_variant(write->latitude, write->longitude, (compress_encoding)encoding, encoded, encoded_length);
+        free(encoded);
+    }
+}
+
+// Takes whatever is queued until nothing is
+static void weather_write_drain(void) {
+    for (;;) {
+        pthread_mutex_lock(&g_writeLock);
+        weather_write* writes = g_writes;
+        g_writes = NULL;
+        if (!writes) g_writeScheduled = 0;
+        pthread_mutex_unlock(&g_writeLock);
+        if (!writes) return;
+
+        while (writes) {
+            weather_write* write = writes;
+            writes = write->next;
+            weather_write_one(write);
+            free(write->record);
+            free(write);
+        }
+        weather_store_evict();
+    }
+}
+
+static void weather_write_job_work(void* ctx) {
+    weather_write_drain();
+}
+
+static void weather_write_job_done(void* ctx) {
+}
+
+// Queues record (taken over) for the location, stored as of stamp; the
+// caller does not wait
+static void weather_write_behind(double latitude, double longitude, uint8_t* record, size_t length, time_t stamp) {
+    if (g_storeReadOnly) {
+        free(record);
+        return;
+    }
+    weather_write* write = (weather_write*)malloc(sizeof(weather_write));
+    if (!write) {
+        free(record);
+        return;
+    }
+    write->latitude = latitude;
+    write->longitude = longitude;
+    write->record = record;
+    write->length = length;
+    write->stamp = stamp;
+    write->next = NULL;
+
+    pthread_mutex_lock(&g_writeLock);
+    weather_write** link = &g_writes;
+    while (*link && ((*link)->latitude != latitude || (*link)->longitude != longitude)) link = &(*link)->next;
+    if (*link) {
+        // Coalesced, only the newer record is kept (a peer's may be older)
+        if ((*link)->stamp > stamp) {
+            free(record);
+        } else {
+            free((*link)->record);
+            (*link)->record = record;
+            (*link)->length = length;
+            (*link)->stamp = stamp;
+        }
+        free(write);
+    } else {
+        *link = write;
+    }
+    int schedule = !g_writeScheduled;
+    g_writeScheduled = 1;
+    pthread_mutex_unlock(&g_writeLock);
+
+    if (schedule && !job_pool_submit(weather_write_job_work, weather_write_job_done, NULL)) {
+        // Left queued for the next write or the shutdown drain
+        pthread_mutex_lock(&g_writeLock);
+        g_writeScheduled = 0;
+        pthread_mutex_unlock(&g_writeLock);
+    }
+}
+
+// ========== Peer Tier ==========
+// A node asks the owner of a location it has no fresh record of, see
+// utilities/peer_ring.h. The answer is the owner's record behind this
+// header: the peer stores it as it is, under the owner's stamp, so the
+// location expires on every node at once and the validators stay the same.
+// Records are host byte order, peers of another one fail the magic check.
+
+#define Weather_PEER_MAGIC 0x52455057u /* "WPER" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t length;
+    int64_t stamp;
+} weather_peer_header;
+
+// The record queued for the location, newer than any stored; NULL if none
+static uint8_t* weather_write_pending(double latitude, double longitude, size_t* length, time_t* stamp) {
+    uint8_t* record = NULL;
+    pthread_mutex_lock(&g_writeLock);
+    for (weather_write* write = g_writes; write; write = write->next) {
+        if (write->latitude != latitude || write->longitude != longitude) continue;
+        record = (uint8_t*)malloc(write->length);
+        if (record) {
+            memcpy(record, write->record, write->length);
+            *length = write->length;
+            *stamp = write->stamp;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&g_writeLock);
+    return record;
+}
+
+// Pool thread, the record within its TTL for a peer to take. One just
+// fetched may still wait for its write, the peers asking right after the
+// fetch would go upstream again.
+static void weather_peer_load(weather_t* weather) {
+    size_t length = 0;
+    time_t stamp = 0;
+    uint8_t* record = weather_write_pending(weather->latitude, weather->longitude, &length, &stamp);
+    if (!record && weather_read_record(weather->latitude, weather->longitude, &record, &length, &stamp) != 0) {
+        record = NULL;
+    }
+    // A peer keeps what it is sent as it is, it gets nothing stale
+    if (!record || time(NULL) > weather_fresh_until(stamp)) {
+        __atomic_add_fetch(&g_storeMisses, 1, __ATOMIC_RELAXED);
+        free(record);
+        return;
+    }
+    __atomic_add_fetch(&g_storeHits, 1, __ATOMIC_RELAXED);
+    weather_peer_reply(weather, record, length, stamp);
+    weather->last_modified = stamp;
+    free(record);
+}
+
+static void weather_peer_reply(weather_t* weather, const uint8_t* record, size_t length, time_t stamp) {
+    uint8_t* reply = (uint8_t*)malloc(sizeof(weather_peer_header) + length);
+    if (!reply) return;
+    weather_peer_header header = {Weather_PEER_MAGIC, (uint32_t)length, (int64_t)stamp};
+    memcpy(reply, &header, sizeof(header));
+    memcpy(reply + sizeof(header), record, length);
+    free(weather->peer_reply);
+    weather->peer_reply = reply;
+    weather->peer_reply_length = sizeof(header) + length;
+}
+
+// 0 if the owner's answer in flight.body is a record newer than what this
+// node has, then buffer is its body and the first waiter stores it
+static int weather_peer_take(weather_t* weather) {
+    weather_peer_header header;
+    const uint8_t* answer = (const uint8_t*)weather->flight.body;
+    if (!answer || weather->flight.length < sizeof(header)) return -1;
+    memcpy(&header, answer, sizeof(header));
+    if (header.magic != Weather_PEER_MAGIC || header.length != weather->flight.length - sizeof(header)) return -1;
+    return weather_record_take(weather, answer + sizeof(header), header.length, (time_t)header.stamp,
+                               ACCESS_CACHE_PEER, weather->flight.primary);
+}
+
+// 0 if record, stamped at stamp and from outcome, is newer than what this
+// node has: buffer is its body (or peer_reply the record, for a peer) and
+// with persist a copy is queued for the store
+static int weather_record_take(weather_t* weather, const uint8_t* record, size_t length, time_t stamp,
+                               access_cache outcome, int persist) {
+    const char* body;
+    size_t body_length;
+    if (stamp <= weather->refresh_older || weather_record_body(record, length, &body, &body_length) != 0) return -1;
+
+    if (weather->peer) {
+        weather_peer_reply(weather, record, length, stamp);
+        if (!weather->peer_reply) return -1;
+    } else {
+        char* buffer = (char*)malloc(body_length + 1);
+        if (!buffer) return -1;
+        memcpy(buffer, body, body_length + 1);
+        free(weather->buffer);
+        weather->buffer = buffer;
+    }
+    // As a disk read here will validate it once the record is written
+    weather->last_modified = stamp;
+    http_etag_from_file(weather->etag, weather->last_modified, (uint64_t)length);
+    weather->cache = outcome;
+
+    if (persist) {
+        uint8_t* copy = (uint8_t*)malloc(length);
+        if (copy) {
+            memcpy(copy, record, length);
+            weather_write_behind(weather->latitude, weather->longitude, copy, length, weather->last_modified);
+        }
+    }
+    return 0;
+}
+
+// ========== Shared Store ==========
+// --cache-store, a tier behind the node's own that every node reaches. The
+// values are the store's records under their stamps, as the peer tier
+// hands them over, and expire from it after the stale-while-revalidate
+// window too. A node that cannot reach it goes on without it.
+
+// The store answered weather's lookup, on its loop
+static void weather_shared_done(void* context, int result, uint8_t* data, size_t length, time_t stamp) {
+    weather_t* weather = (weather_t*)context;
+    weather->shared_op = NULL;
+    weather->shared_result = result;
+    weather->shared_record = data;
+    weather->shared_record_length = length;
+    weather->shared_stamp = stamp;
+    weather->on_wake(weather->ctx);
+}
+
+// 0 if the store had a record within its TTL, taken as weather_record_take
+static int weather_shared_take(weather_t* weather) {
+    int taken = weather->shared_result == CACHE_STORE_OK &&
+                time(NULL) <= weather_fresh_until(weather->shared_stamp) &&
+                weather_record_take(weather, weather->shared_record, weather->shared_record_length,
+                                    weather->shared_stamp, ACCESS_CACHE_SHARED, 1) == 0;
+    free(weather->shared_record);
+    weather->shared_record = NULL;
+    metrics_counter_add(taken ? &g_sharedHits : &g_sharedMisses, 1);
+    return taken ? 0 : -1;
+}
+
+// A record fetched upstream, nobody waits for the write
+static void weather_shared_put(double latitude, double longitude, const uint8_t* record, size_t length, time_t stamp) {
+    if (!g_sharedStore) return;
+    cache_store_put(g_sharedStore, weather_cache_key(latitude, longitude), 0, record, length, stamp,
+                    weather_fresh_until(stamp) - stamp + Weather_STALE_WHILE_REVALIDATE_SECONDS, NULL, NULL);
+}
+
+// ========== Warm Up Loading ==========
+
+typedef struct {
+    uint64_t key;
+    time_t stamp;
+    size_t length;
+} weather_warm_candidate;
+
+typedef struct {
+    weather_warm_candidate* candidates;
+    int count;
+    int capacity;
+    time_t now;
+} weather_warm_scan;
+
+static void weather_warm_collect(uint64_t key, time_t stamp, size_t length, void* context) {
+    weather_warm_scan* scan = (weather_warm_scan*)context;
+    if (weather_fresh_until(stamp) + Weather_STALE_WHILE_REVALIDATE_SECONDS <= scan->now) return;
+    if (scan->count == scan->capacity) {
+        int capacity = scan->capacity ? scan->capacity * 2 : 64;
+        weather_warm_candidate* grown =
+            (weather_warm_candidate*)realloc(scan->candidates, capacity * sizeof(weather_warm_candidate));
+        if (!grown) return;
+        scan->candidates = grown;
+        scan->capacity = capacity;
+    }
+    scan->candidates[scan->count].key = key;
+    scan->candidates[scan->count].stamp = stamp;
+    scan->candidates[scan->count].length = length;
+    scan->count++;
+}
+
+static int weather_warm_newest_first(const void* a, const void* b) {
+    time_t stamp_a = ((const weather_warm_candidate*)a)->stamp;
+    time_t stamp_b = ((const weather_warm_candidate*)b)->stamp;
+    return stamp_a < stamp_b ? 1 : (stamp_a > stamp_b ? -1 : 0);
+}
+
+static void weather_warm_load(weather_warm_entry* warm, const weather_warm_candidate* candidate) {
+    memset(warm, 0, sizeof(weather_warm_entry));
+    warm->key = candidate->key;
+    warm->stamp = candidate->stamp;
+
+    uint8_t* record = NULL;
+    size_t length = 0;
+    const char* body;
+    size_t body_length;
+    if (record_store_get(g_weatherStore, candidate->key, COMPRESS_IDENTITY, &record, &length, NULL) != 0) return;
+    if (weather_record_body(record, length, &body, &body_length) != 0) {
+        free(record);
+        return;
+    }
+    memmove(record, body, body_length + 1);
+    warm->bodies[COMPRESS_IDENTITY] = record;
+    warm->lengths[COMPRESS_IDENTITY] = body_length;
+    // Same validators the disk path gives the record
+    http_etag_from_file(warm->etags[COMPRESS_IDENTITY], candidate->stamp, (uint64_t)length);
+
+    for (int encoding = COMPRESS_GZIP; encoding < COMPRESS_ENCODINGS; encoding++) {
+        uint8_t* data = NULL;
+        size_t data_length = 0;
+        time_t stamp = 0;
+        if (record_store_get(g_weatherStore, candidate->key, (uint8_t)encoding, &data, &data_length, &stamp) != 0) continue;
+        if (stamp < candidate->stamp || data_length == 0) {
+            free(data);
+            continue;
+        }
+        warm->bodies[encoding] = data;
+        warm->lengths[encoding] = data_length;
+        memcpy(warm->etags[encoding], warm->etags[COMPRESS_IDENTITY], HTTP_ETAG_SIZE);
+        http_etag_variant(warm->etags[encoding], compress_encoding_name((compress_encoding)encoding));
+    }
+}
+
+// The first candidates, as many as a loop's hot cache holds, in place of
+// anything warmed before
+static void weather_warm_keep(const weather_warm_scan* scan) {
+    weather_warm_free();
+    int keep = scan->count < Weather_HOT_CACHE_ENTRIES ? scan->count : Weather_HOT_CACHE_ENTRIES;
+    if (keep > 0) g_warm = (weather_warm_entry*)calloc(keep, sizeof(weather_warm_entry));
+    if (!g_warm) return;
+    for (int i = 0; i < keep; i++) weather_warm_load(&g_warm[i], &scan->candidates[i]);
+    g_warmCount = keep;
+}
+
+// Fetches every location without a fresh record at once, blocking
+static int weather_prefetch(const double* latitudes, const double* longitudes, int count) {
+    time_t now = time(NULL);
+    curl_client* clients = (curl_client*)calloc(count, sizeof(curl_client));
+    int* running = (int*)calloc(count, sizeof(int));
+    if (!clients || !running) {
+        free(clients);
+        free(running);
+        return 0;
+    }
+
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+        time_t stamp;
+        double latitude = latitudes[i];
+        double longitude = longitudes[i];
+        weather_quantize(&latitude, &longitude);
+        if (record_store_stat(g_weatherStore, weather_cache_key(latitude, longitude), COMPRESS_IDENTITY, &stamp, NULL) == 0 &&
+            now <= weather_fresh_until(stamp)) {
+            continue;
+        }
+        curl_client* client = &clients[i];
+        char url[512];
+        snprintf(url, sizeof(url), METEO_FORECAST_URL, g_weatherApiUrl, latitude, longitude);
+        if (curl_client_init(&client) != 0) continue;
+        curl_client_make_request(&client, url);
+        running[i] = 1;
+        pending++;
+    }
+
+    int fetched = 0;
+    while (pending > 0) {
+        int progressed = 0;
+        for (int i = 0; i < count; i++) {
+            if (!running[i]) continue;
+            curl_client* client = &clients[i];
+            if (curl_client_poll(&client) == 0 && client->still_running) continue;
+            running[i] = 0;
+            pending--;
+            progressed = 1;
+
+            char* response = NULL;
+            char* body = NULL;
+            weather_write write = {0};
+            write.latitude = latitudes[i];
+            write.longitude = longitudes[i];
+            weather_quantize(&write.latitude, &write.longitude);
+            if (curl_client_read_response(&client, &response) == 0 && response &&
+                weather_transform(response, &body, &write.record, &write.length) == 0 && write.record) {
+                weather_write_one(&write);
+                fetched++;
+            }
+            free(write.record);
+            free(body);
+            free(response);
+            curl_client_cleanup(&client);
+        }
+        if (!progressed) usleep(1000);
+    }
+    free(clients);
+    free(running);
+    return fetched;
+}
+
+int weather_warmup(const double* latitudes, const double* longitudes, int count) {
+    if (!g_weatherStore) return 0;
+    int fetched = count > 0 ? weather_prefetch(latitudes, longitudes, count) : 0;
+
+    weather_warm_scan scan = {NULL, 0, 0, time(NULL)};
+    record_store_each(g_weatherStore, COMPRESS_IDENTITY, weather_warm_collect, &scan);
+    qsort(scan.candidates, scan.count, sizeof(weather_warm_candidate), weather_warm_newest_first);
+    weather_warm_keep(&scan);
+    free(scan.candidates);
+    LOG_INFO("Weather: Warmed %d entries, fetched %d", g_warmCount, fetched);
+    return g_warmCount;
+}
+
+// ========== Hot Restart ==========
+// The process handing over freezes the store and names its hot locations,
+// the one taking over opens the same file and loads them
+
+void weather_handoff_freeze(int frozen) {
+    // What write behind still holds goes in first, the next process reads it
+    if (frozen) weather_write_drain();
+    record_store_freeze(g_weatherStore, frozen);
+}
+
+static int weather_handoff_order(const void* a, const void* b) {
+    return weather_evict_order(b, a);
+}
+
+int weather_handoff_keys(uint64_t* keys, int max) {
+    weather_evict_scan scan = {NULL, 0, 0};
+    record_store_each(g_weatherStore, COMPRESS_IDENTITY, weather_evict_collect, &scan);
+    qsort(scan.candidates, scan.count, sizeof(weather_evict_candidate), weather_handoff_order);
+    int count = scan.count < max ? scan.count : max;
+    for (int i = 0; i < count; i++) keys[i] = scan.candidates[i].key;
+    free(scan.candidates);
+    return count;
+}
+
+int weather_warmup_keys(const uint64_t* keys, int count) {
+    if (!g_weatherStore) return 0;
+    weather_warm_scan scan = {NULL, 0, 0, time(NULL)};
+    for (int i = 0; i < count; i++) {
+        time_t stamp;
+        size_t length;
+        if (record_store_stat(g_weatherStore, keys[i], COMPRESS_IDENTITY, &stamp, &length) != 0) continue;
+        weather_warm_collect(keys[i], stamp, length, &scan);
+    }
+    // In the order they came, the most asked for first
+    weather_warm_keep(&scan);
+    free(scan.candidates);
+    LOG_INFO("Weather: Warmed %d of %d entries handed over", g_warmCount, count);
+    return g_warmCount;
+}
+
+// The identity record, checked to be one of this version; stamp may be NULL
+static int weather_read_record(double latitude, double longitude, uint8_t** record, size_t* length, time_t* stamp) {
+    uint8_t* data = NULL;
+    size_t size = 0;
+    if (record_store_get(g_weatherStore, weather_cache_key(latitude, longitude), COMPRESS_IDENTITY, &data, &size, stamp) != 0) {
+        return -1;
+    }
+
+    const char* body;
+    size_t body_length;
+    if (weather_record_body(data, size, &body, &body_length) != 0) {
+        free(data);
+        return -1;
+    }
+    *record = data;
+    *length = size;
+    return 0;
+}
+
+int does_weather_cache_exist(double latitude, double longitude) {
+    uint8_t* record = NULL;
+    size_t length = 0;
+    if (weather_read_record(latitude, longitude, &record, &length, NULL) != 0) return -1;
+    free(record);
+    return 0;
 }
 
 int is_weather_cache_stale(double latitude, double longitude, int max_age_seconds) {
     if (max_age_seconds < 0) return 1;
 
-    char cache_path[512];
-    get_cache_file_path(latitude, longitude, cache_path, sizeof(cache_path));
-
-    struct stat file_stat;
-    if (stat(cache_path, &file_stat) != 0) { return -1; }
+    time_t stamp;
+    if (record_store_stat(g_weatherStore, weather_cache_key(latitude, longitude), COMPRESS_IDENTITY, &stamp, NULL) != 0) {
+        return -1;
+    }
 
     time_t current_time = time(NULL);
-    time_t file_age = current_time - file_stat.st_mtime;
+    time_t file_age = current_time - stamp;
 
     return file_age > max_age_seconds ? 1 : 0;
 }
@@ -57,13 +1925,12 @@ int is_weather_cache_stale(double latitude, double longitude, int max_age_second
 int weather_cache_time(double latitude, double longitude, long int* time) {
     if (!time) return -1;
 
-    char cache_path[512];
-    get_cache_file_path(latitude, longitude, cache_path, sizeof(cache_path));
-
-    struct stat file_stat;
-    if (stat(cache_path, &file_stat) != 0) { return -1; }
+    time_t stamp;
+    if (record_store_stat(g_weatherStore, weather_cache_key(latitude, longitude), COMPRESS_IDENTITY, &stamp, NULL) != 0) {
+        return -1;
+    }
 
-    *time = file_stat.st_mtime;
+    *time = stamp;
 
     return 0;
 }
@@ -71,100 +1938,174 @@ int weather_cache_time(double latitude, double longitude, long int* time) {
 int load_weather_from_cache(double latitude, double longitude, char** json_str) {
     if (!json_str) return -1;
 
-    char cache_path[512];
-    get_cache_file_path(latitude, longitude, cache_path, sizeof(cache_path));
+    uint8_t* record = NULL;
+    size_t length = 0;
+    if (weather_read_record(latitude, longitude, &record, &length, NULL) != 0) return -1;
 
-    json_error_t error;
-    json_t* json_obj = json_load_file(cache_path, 0, &error);
-    if (!json_obj) { return -1; }
-
-    *json_str = json_dumps(json_obj, JSON_COMPACT);
-    json_decref(json_obj);
-
-    return *json_str ? 0 : -1;
+    // The stored body is the response, moved to the front of the same allocation
+    const char* body;
+    size_t body_length;
+    weather_record_body(record, length, &body, &body_length);
+    memmove(record, body, body_length + 1);
+    *json_str = (char*)record;
+    return 0;
 }
 
 int save_weather_to_cache(double latitude, double longitude, const char* json_str) {
     if (!json_str) return -1;
 
-    char cache_path[512];
-    get_cache_file_path(latitude, longitude, cache_path, sizeof(cache_path));
-
-    json_error_t error;
-    json_t* json_obj = json_loads(json_str, 0, &error);
-    if (!json_obj) { return -1; }
-
-    int result = json_dump_file(json_obj, cache_path, JSON_INDENT(2));
-    json_decref(json_obj);
+    weather_data_t data;
+    if (deserialize_weather_response(json_str, &data) != 0) return -1;
+    uint8_t* record = NULL;
+    size_t length = 0;
+    int result = weather_record_encode(&data, json_str, strlen(json_str), &record, &length);
+    free_weather(&data);
+    if (result != 0) return -1;
 
-    return result == 0 ? 0 : -1;
+    // Appended to the store, readers see the old record or the new one
+    result = record_store_put(g_weatherStore, weather_cache_key(latitude, longitude), COMPRESS_IDENTITY, record, length,
+                              time(NULL));
+    free(record);
+    return result;
 }
 
 int fetch_weather_from_openmeteo(double latitude, double longitude, char** api_response) {
-    // CURL* curl;
-    // CURLcode res;
-
-    // struct memory_struct chunk;
-    // chunk.memory = malloc(1);
-    // chunk.size = 0;
-
-    // curl_global_init(CURL_GLOBAL_DEFAULT);
-    // curl = curl_easy_init();
-    // if (!curl) {
-    //     free(chunk.memory);
-    //     return -1;
-    // }
-
-    // char url[256];
-    // snprintf(url, sizeof(url), METEO_FORECAST_URL, latitude, longitude);
-    // curl_easy_setopt(curl, CURLOPT_URL, url);
-    // curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_memory_callback);
-    // curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&chunk);
-    // res = curl_easy_perform(curl);
-    // if (res != CURLE_OK) {
-    //     curl_easy_cleanup(curl);
-    //     free(chunk.memory);
-    //     return -1;
-    // }
+    if (!api_response) return -1;
+    *api_response = NULL;
+
+    curl_client client_data;
+    curl_client* client = &client_data;
+    memset(client, 0, sizeof(curl_client));
+    if (curl_client_init(&client) != 0) return -1;
+
+    char url[512];
+    snprintf(url, sizeof(url), METEO_FORECAST_URL, g_weatherApiUrl, latitude, longitude);
+    int result = curl_client_make_request(&client, url);
+    // Blocking, for callers outside the loops (warm up)
+    do {
+        if (result == 0) result = curl_client_poll(&client);
+        if (result == 0 && client->still_running) curl_client_wait(&client, 100);
+    } while (result == 0 && client->still_running);
+
+    if (result == 0) result = curl_client_read_response(&client, api_response);
+    curl_client_cleanup(&client);
+    return result == 0 && *api_response ? 0 : -1;
+}
 
-    // curl_easy_cleanup(curl);
-    // *api_response = chunk.memory;
+int process_openmeteo_response(const char* api_response, char** client_response) {
+    return weather_transform(api_response, client_response, NULL, NULL);
+}
 
-    return 0;
+// The client JSON and, if record is set, the cache record of it from one parse.
+// A record that cannot be made is left NULL, the response stands.
+static int weather_transform(const char* api_response, char** client_response, uint8_t** record, size_t* record_length) {
+
+    json_scan scan;
+    json_scan_init(&scan, api_response, strlen(api_response));
+
+    uint8_t* made = NULL;
+    size_t made_length = 0;
+    int result = weather_transform_object(&scan, client_response, &made, &made_length);
+    if (result == 0 && json_scan_peek(&scan) != JSON_SCAN_END) {
+        free(*client_response);
+        free(made);
+        *client_response = NULL;
+        made = NULL;
+        result = -1;
+    }
+    if (record) {
+        *record = made;
+        *record_length = made_length;
+    } else {
+        free(made);
+    }
+    return result;
 }
 
-int process_openmeteo_response(const char* api_response, char** client_response) {
+// The forecast object next at the scanner to the client JSON and its record
+static int weather_transform_object(json_scan* scan, char** client_response, uint8_t** record,
+                                    size_t* record_length) {
     weather_data_t weather;
+    *client_response = NULL;
+    *record = NULL;
+    if (weather_scan_object(scan, &weather) != 0) return -1;
+    weather_model_observe(&weather);
 
-    json_error_t error;
-    json_t* root_api = json_loads(api_response, 0, &error);
-    if (!root_api) return -1;
+    *client_response = weather_serialize(&weather);
 
-    int result = parse_openmeteo_json_to_weather(root_api, &weather);
-    json_decref(root_api);
-    if (result != 0) return -1;
+    if (*client_response &&
+        weather_record_encode(&weather, *client_response, strlen(*client_response), record, record_length) != 0) {
+        *record = NULL;
+    }
+    free_weather(&weather);
+    return *client_response ? 0 : -1;
+}
 
-    json_t* root_client;
-    if (serialize_weather_to_json(&weather, &root_client) != 0) {
-        free_weather(&weather);
+int weather_transform_batch(const char* api_response, int count, char** bodies, uint8_t** records,
+                            size_t* record_lengths) {
+    for (int i = 0; i < count; i++) {
+        bodies[i] = NULL;
+        records[i] = NULL;
+        record_lengths[i] = 0;
+    }
+    json_scan scan;
+    json_scan_init(&scan, api_response, strlen(api_response));
+
+    // A single location comes back as the object itself
+    int transformed = 0;
+    json_scan_type type = json_scan_peek(&scan);
+    if (type == JSON_SCAN_ARRAY) {
+        json_scan_array_begin(&scan);
+        for (int i = 0; json_scan_array_next(&scan) > 0; i++) {
+            if (i < count) {
+                transformed += weather_transform_object(&scan, &bodies[i], &records[i], &record_lengths[i]) == 0;
+            } else {
+                json_scan_skip(&scan);
+            }
+        }
+    } else if (type == JSON_SCAN_OBJECT && count == 1) {
+        transformed = weather_transform_object(&scan, &bodies[0], &records[0], &record_lengths[0]) == 0;
+    }
+    // Bodies of a response that turns out truncated are not trusted either
+    if (scan.failed) {
+        for (int i = 0; i < count; i++) {
+            free(bodies[i]);
+            free(records[i]);
+            bodies[i] = NULL;
+            records[i] = NULL;
+            record_lengths[i] = 0;
+        }
         return -1;
     }
-    *client_response = json_dumps(root_client, JSON_COMPACT);
-    json_decref(root_client);
+    return transformed > 0 ? 0 : -1;
+}
 
-    free_weather(&weather);
-    return 0;
+void weather_store_fetched(double latitude, double longitude, const char* body, uint8_t* record, size_t record_length,
+                           int persist) {
+    time_t now = time(NULL);
+    if (weather_hot_init() == 0) {
+        uint64_t key = weather_cache_key(latitude, longitude);
+        response_cache_entry* entry =
+            weather_hot_insert(key, now, weather_fresh_until(now) + Weather_STALE_WHILE_REVALIDATE_SECONDS);
+        if (entry) response_cache_set(&t_hotCache, entry, COMPRESS_IDENTITY, (const uint8_t*)body, strlen(body), NULL);
+        weather_delta_keep(key, now, body, strlen(body));
+    }
+    if (persist && record) {
+        weather_shared_put(latitude, longitude, record, record_length, now);
+        weather_write_behind(latitude, longitude, record, record_length, now);
+    } else {
+        free(record);
+    }
 }
 
 int deserialize_weather_response(const char* client_response, weather_data_t* weather) {
-    json_error_t error;
-    json_t* root = json_loads(client_response, 0, &error);
-    if (!root) return -1;
-
-    int result = parse_openmeteo_json_to_weather(root, weather);
-    json_decref(root);
-    if (result != 0) return -1;
-
+    json_scan scan;
+    json_scan_init(&scan, client_response, strlen(client_response));
+    if (weather_scan_object(&scan, weather) != 0) return -1;
+    if (json_scan_peek(&scan) != JSON_SCAN_END) {
+        free_weather(weather);
+        return -1;
+    }
     return 0;
 }
 
@@ -200,251 +2141,552 @@ int weather_print_pretty(const weather_data_t* weather) {
     return 0;
 }
 
-int parse_openmeteo_json_to_weather(const json_t* json_obj, weather_data_t* weather) {
-    if (!json_obj || !weather) return -1;
-
-    memset(weather, 0, sizeof(weather_data_t));
-
-    json_t* val;
-
-    val = json_object_get(json_obj, "latitude");
-    weather->latitude = json_is_real(val) ? json_real_value(val) : 0.0;
-
-    val = json_object_get(json_obj, "longitude");
-    weather->longitude = json_is_real(val) ? json_real_value(val) : 0.0;
-
-    val = json_object_get(json_obj, "generationtime_ms");
-    weather->generationtime_ms = json_is_real(val) ? json_real_value(val) : 0.0;
-
-    val = json_object_get(json_obj, "utc_offset_seconds");
-    weather->utc_offset_seconds = json_is_integer(val) ? (int)json_integer_value(val) : 0;
-
-    val = json_object_get(json_obj, "timezone");
-    weather->timezone = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-    val = json_object_get(json_obj, "timezone_abbreviation");
-    weather->timezone_abbreviation = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-    val = json_object_get(json_obj, "elevation");
-    weather->elevation = json_is_real(val) ? json_real_value(val) : 0.0;
-
-    json_t* units_obj = json_object_get(json_obj, "current_units");
-    if (json_is_object(units_obj)) {
-        val = json_object_get(units_obj, "time");
-        weather->unit_time = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "interval");
-        weather->unit_interval = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "temperature_2m");
-        weather->unit_temperature_2m = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "relative_humidity_2m");
-        weather->unit_relative_humidity_2m = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "apparent_temperature");
-        weather->unit_apparent_temperature = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "is_day");
-        weather->unit_is_day = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "precipitation");
-        weather->unit_precipitation = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "rain");
-        weather->unit_rain = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "showers");
-        weather->unit_showers = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "snowfall");
-        weather->unit_snowfall = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "weather_code");
-        weather->unit_weather_code = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "cloud_cover");
-        weather->unit_cloud_cover = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "pressure_msl");
-        weather->unit_pressure_msl = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "surface_pressure");
-        weather->unit_surface_pressure = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "wind_speed_10m");
-        weather->unit_wind_speed_10m = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
-
-        val = json_object_get(units_obj, "wind_direction_10m");
-        weather->unit_wind_direction_10m = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+// ========== Client JSON ==========
+// Written straight from weather_data_t into one buffer, keys in a fixed
+// order, no json_t in between; the same tables say what is read from an
+// upstream response. Same document jansson made of it, except that
+// reals are written in the fewest digits that read back to the same double.
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} weather_json_writer;
+
+// A unit is a string as well, read into the intern table instead of a copy
+typedef enum { WEATHER_JSON_REAL, WEATHER_JSON_INT, WEATHER_JSON_STRING, WEATHER_JSON_UNIT } weather_json_type;
+
+typedef struct {
+    // the separator and quoted key, e.g. ",\"rain\":"
+    const char* key;
+    size_t key_length;
+    size_t offset;
+    weather_json_type type;
+    // for a NULL string: written instead, or null if this is NULL too
+    const char* fallback;
+} weather_json_field;
+
+#define WEATHER_JSON_FIELD(key, member, type, fallback) \
+    {key, sizeof(key) - 1, offsetof(weather_data_t, member), type, fallback}
+
+static const weather_json_field weather_json_root[] = {
+    WEATHER_JSON_FIELD("{\"latitude\":", latitude, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"longitude\":", longitude, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"generationtime_ms\":", generationtime_ms, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"utc_offset_seconds\":", utc_offset_seconds, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"timezone\":", timezone, WEATHER_JSON_STRING, "GMT"),
+    WEATHER_JSON_FIELD(",\"timezone_abbreviation\":", timezone_abbreviation, WEATHER_JSON_STRING, "GMT"),
+    WEATHER_JSON_FIELD(",\"elevation\":", elevation, WEATHER_JSON_REAL, NULL),
+};
+
+static const weather_json_field weather_json_units[] = {
+    WEATHER_JSON_FIELD(",\"current_units\":{\"time\":", unit_time, WEATHER_JSON_UNIT, "iso8601"),
+    WEATHER_JSON_FIELD(",\"interval\":", unit_interval, WEATHER_JSON_UNIT, "seconds"),
+    WEATHER_JSON_FIELD(",\"temperature_2m\":", unit_temperature_2m, WEATHER_JSON_UNIT, "°C"),
+    WEATHER_JSON_FIELD(",\"relative_humidity_2m\":", unit_relative_humidity_2m, WEATHER_JSON_UNIT, "%"),
+    WEATHER_JSON_FIELD(",\"apparent_temperature\":", unit_apparent_temperature, WEATHER_JSON_UNIT, "°C"),
+    WEATHER_JSON_FIELD(",\"is_day\":", unit_is_day, WEATHER_JSON_UNIT, ""),
+    WEATHER_JSON_FIELD(",\"precipitation\":", unit_precipitation, WEATHER_JSON_UNIT, "mm"),
+    WEATHER_JSON_FIELD(",\"rain\":", unit_rain, WEATHER_JSON_UNIT, "mm"),
+    WEATHER_JSON_FIELD(",\"showers\":", unit_showers, WEATHER_JSON_UNIT, "mm"),
+    WEATHER_JSON_FIELD(",\"snowfall\":", unit_snowfall, WEATHER_JSON_UNIT, "cm"),
+    WEATHER_JSON_FIELD(",\"weather_code\":", unit_weather_code, WEATHER_JSON_UNIT, "wmo code"),
+    WEATHER_JSON_FIELD(",\"cloud_cover\":", unit_cloud_cover, WEATHER_JSON_UNIT, "%"),
+    WEATHER_JSON_FIELD(",\"pressure_msl\":", unit_pressure_msl, WEATHER_JSON_UNIT, "hPa"),
+    WEATHER_JSON_FIELD(",\"surface_pressure\":", unit_surface_pressure, WEATHER_JSON_UNIT, "hPa"),
+    WEATHER_JSON_FIELD(",\"wind_speed_10m\":", unit_wind_speed_10m, WEATHER_JSON_UNIT, "km/h"),
+    WEATHER_JSON_FIELD(",\"wind_direction_10m\":", unit_wind_direction_10m, WEATHER_JSON_UNIT, "°"),
+    WEATHER_JSON_FIELD(",\"wind_gusts_10m\":", unit_wind_gusts_10m, WEATHER_JSON_UNIT, "km/h"),
+};
+
+static const weather_json_field weather_json_current[] = {
+    WEATHER_JSON_FIELD("},\"current\":{\"time\":", time, WEATHER_JSON_STRING, NULL),
+    WEATHER_JSON_FIELD(",\"interval\":", interval, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"temperature_2m\":", temperature_2m, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"relative_humidity_2m\":", relative_humidity_2m, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"apparent_temperature\":", apparent_temperature, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"is_day\":", is_day, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"precipitation\":", precipitation, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"rain\":", rain, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"showers\":", showers, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"snowfall\":", snowfall, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"weather_code\":", weather_code, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"cloud_cover\":", cloud_cover, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"pressure_msl\":", pressure_msl, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"surface_pressure\":", surface_pressure, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"wind_speed_10m\":", wind_speed_10m, WEATHER_JSON_REAL, NULL),
+    WEATHER_JSON_FIELD(",\"wind_direction_10m\":", wind_direction_10m, WEATHER_JSON_INT, NULL),
+    WEATHER_JSON_FIELD(",\"wind_gusts_10m\":", wind_gusts_10m, WEATHER_JSON_REAL, NULL),
+};
+
+#define WEATHER_JSON_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// ========== Upstream JSON ==========
+// Read in one pass with json_scan: the members the field tables know go
+// straight into weather_data_t, hourly and daily into their columns, all
+// else is stepped over without being built.
+
+// The field of the table whose key (the name in its quotes before the
+// ':') is key, NULL if none is
+static const weather_json_field* weather_scan_field(const weather_json_field* fields, size_t count, const char* key,
+                                                    size_t length) {
+    for (size_t i = 0; i < count; i++) {
+        const weather_json_field* field = &fields[i];
+        if (field->key_length < length + 3) continue;
+        const char* name = field->key + field->key_length - 2 - length;
+        if (name[-1] == '"' && memcmp(name, key, length) == 0) return field;
+    }
+    return NULL;
+}
 
-        val = json_object_get(units_obj, "wind_gusts_10m");
-        weather->unit_wind_gusts_10m = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+// The value next at the scanner into field, other types leave it as it is
+static void weather_scan_value(json_scan* scan, weather_data_t* weather, const weather_json_field* field) {
+    char* base = (char*)weather;
+    json_scan_type type = json_scan_peek(scan);
+    if (field->type == WEATHER_JSON_STRING && type == JSON_SCAN_STRING) {
+        char** value = (char**)(base + field->offset);
+        free(*value);
+        *value = json_scan_string_dup(scan);
+        return;
+    }
+    if (field->type == WEATHER_JSON_UNIT && type == JSON_SCAN_STRING) {
+        char unit[Weather_UNIT_MAX_LENGTH];
+        int length = json_scan_string(scan, unit, sizeof(unit));
+        // One too long or a full table leaves the default unit
+        *(const char**)(base + field->offset) = length >= 0 ? string_intern(unit, (size_t)length) : NULL;
+        return;
+    }
+    if ((field->type == WEATHER_JSON_REAL || field->type == WEATHER_JSON_INT) && type == JSON_SCAN_NUMBER) {
+        double value;
+        if (json_scan_number(scan, &value) != 0) return;
+        if (field->type == WEATHER_JSON_REAL) {
+            *(double*)(base + field->offset) = value;
+        } else {
+            *(int*)(base + field->offset) = (int)value;
+        }
+        return;
     }
+    json_scan_skip(scan);
+}
 
-    json_t* current_obj = json_object_get(json_obj, "current");
-    if (json_is_object(current_obj)) {
-        val = json_object_get(current_obj, "time");
-        weather->time = (json_is_string(val) && json_string_value(val)) ? strdup(json_string_value(val)) : NULL;
+// The members of the object next at the scanner the table has
+static void weather_scan_fields(json_scan* scan, weather_data_t* weather, const weather_json_field* fields,
+                                size_t count) {
+    if (json_scan_peek(scan) != JSON_SCAN_OBJECT) {
+        json_scan_skip(scan);
+        return;
+    }
+    const char* key;
+    size_t length;
+    json_scan_object_begin(scan);
+    while (json_scan_object_next(scan, &key, &length) > 0) {
+        const weather_json_field* field = weather_scan_field(fields, count, key, length);
+        if (field) {
+            weather_scan_value(scan, weather, field);
+        } else {
+            json_scan_skip(scan);
+        }
+    }
+}
 
-        val = json_object_get(current_obj, "interval");
-        weather->interval = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+// The forecast object next at the scanner into weather, which it zeroes
+static int weather_scan_object(json_scan* scan, weather_data_t* weather) {
+    memset(weather, 0, sizeof(weather_data_t));
+    if (json_scan_object_begin(scan) != 0) return -1;
+
+    const char* key;
+    size_t length;
+    while (json_scan_object_next(scan, &key, &length) > 0) {
+        if (json_scan_key_is(key, length, "current_units")) {
+            weather_scan_fields(scan, weather, weather_json_units, WEATHER_JSON_COUNT(weather_json_units));
+        } else if (json_scan_key_is(key, length, "current")) {
+            weather_scan_fields(scan, weather, weather_json_current, WEATHER_JSON_COUNT(weather_json_current));
+        } else if (json_scan_key_is(key, length, "hourly") || json_scan_key_is(key, length, "daily")) {
+            // A block that does not fit stays empty
+            weather_series_kind kind = key[0] == 'h' ? WEATHER_SERIES_HOURLY : WEATHER_SERIES_DAILY;
+            weather_series_t* series = kind == WEATHER_SERIES_HOURLY ? &weather->hourly : &weather->daily;
+            weather_series_free(series);
+            weather_series_scan(scan, kind, series);
+        } else {
+            const weather_json_field* field =
+                weather_scan_field(weather_json_root, WEATHER_JSON_COUNT(weather_json_root), key, length);
+            if (field) {
+                weather_scan_value(scan, weather, field);
+            } else {
+                json_scan_skip(scan);
+            }
+        }
+    }
+    if (scan->failed) {
+        free_weather(weather);
+        return -1;
+    }
+    return 0;
+}
 
-        val = json_object_get(current_obj, "temperature_2m");
-        weather->temperature_2m = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+// Room for n more bytes and the NUL
+static char* weather_json_reserve(weather_json_writer* writer, size_t n) {
+    if (writer->failed) return NULL;
+    if (writer->length + n + 1 > writer->capacity) {
+        size_t capacity = writer->capacity * 2 + n + 1;
+        char* grown = (char*)realloc(writer->data, capacity);
+        if (!grown) {
+            writer->failed = 1;
+            return NULL;
+        }
+        writer->data = grown;
+        writer->capacity = capacity;
+    }
+    return writer->data + writer->length;
+}
 
-        val = json_object_get(current_obj, "relative_humidity_2m");
-        weather->relative_humidity_2m = json_is_integer(val) ? (int)json_integer_value(val) : (json_is_real(val) ? (int)json_real_value(val) : 0);
+static void weather_json_raw(weather_json_writer* writer, const char* data, size_t length) {
+    char* out = weather_json_reserve(writer, length);
+    if (!out) return;
+    memcpy(out, data, length);
+    writer->length += length;
+}
 
-        val = json_object_get(current_obj, "apparent_temperature");
-        weather->apparent_temperature = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+static void weather_json_int(weather_json_writer* writer, long long value) {
+    char* out = weather_json_reserve(writer, 24);
+    if (!out) return;
+    // Digits backwards, then turned around
+    unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+    char digits[24];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    size_t length = 0;
+    if (value < 0) out[length++] = '-';
+    while (count > 0) out[length++] = digits[--count];
+    writer->length += length;
+}
 
-        val = json_object_get(current_obj, "is_day");
-        weather->is_day = json_is_integer(val) ? (int)json_integer_value(val) : 0;
+static void weather_json_real(weather_json_writer* writer, double value) {
+    // JSON has no NaN or infinity
+    if (!isfinite(value)) {
+        weather_json_raw(writer, "null", 4);
+        return;
+    }
+    char* out = weather_json_reserve(writer, REAL_FORMAT_SIZE);
+    if (!out) return;
+    writer->length += real_format(value, out);
+}
 
-        val = json_object_get(current_obj, "precipitation");
-        weather->precipitation = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+static void weather_json_string(weather_json_writer* writer, const char* value) {
+    static const char hex[] = "0123456789abcdef";
+    size_t length = strlen(value);
+    // Every byte escaped is the worst case
+    char* out = weather_json_reserve(writer, length * 6 + 2);
+    if (!out) return;
+    size_t n = 0;
+    out[n++] = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)value[i];
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        } else if (c >= 0x20) {
+            // UTF-8 passes as is, json_scan validated it when it read the response
+            out[n++] = (char)c;
+        } else {
+            out[n++] = '\\';
+            switch (c) {
+            case '\b': out[n++] = 'b'; break;
+            case '\f': out[n++] = 'f'; break;
+            case '\n': out[n++] = 'n'; break;
+            case '\r': out[n++] = 'r'; break;
+            case '\t': out[n++] = 't'; break;
+            default:
+                out[n++] = 'u';
+                out[n++] = '0';
+                out[n++] = '0';
+                out[n++] = hex[c >> 4];
+                out[n++] = hex[c & 15];
+                break;
+            }
+        }
+    }
+    out[n++] = '"';
+    writer->length += n;
+}
 
-        val = json_object_get(current_obj, "rain");
-        weather->rain = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+static void weather_json_fields(weather_json_writer* writer, const weather_data_t* weather,
+                                const weather_json_field* fields, size_t count) {
+    const char* base = (const char*)weather;
+    for (size_t i = 0; i < count; i++) {
+        const weather_json_field* field = &fields[i];
+        weather_json_raw(writer, field->key, field->key_length);
+        switch (field->type) {
+        case WEATHER_JSON_REAL:
+            weather_json_real(writer, *(const double*)(base + field->offset));
+            break;
+        case WEATHER_JSON_INT:
+            weather_json_int(writer, *(const int*)(base + field->offset));
+            break;
+        case WEATHER_JSON_STRING:
+        case WEATHER_JSON_UNIT: {
+            const char* value = *(const char* const*)(base + field->offset);
+            if (!value) value = field->fallback;
+            if (value) {
+                weather_json_string(writer, value);
+            } else {
+                weather_json_raw(writer, "null", 4);
+            }
+            break;
+        }
+        }
+    }
+}
 
-        val = json_object_get(current_obj, "showers");
-        weather->showers = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+// The client JSON of weather, malloc'd
+static char* weather_serialize(const weather_data_t* weather) {
+    // Fits the fixed part, the series grow it once to their own estimate
+    weather_json_writer writer = {(char*)malloc(Weather_JSON_INITIAL_SIZE), 0, Weather_JSON_INITIAL_SIZE, 0};
+    if (!writer.data) return NULL;
+
+    weather_json_fields(&writer, weather, weather_json_root, WEATHER_JSON_COUNT(weather_json_root));
+    weather_json_fields(&writer, weather, weather_json_units, WEATHER_JSON_COUNT(weather_json_units));
+    weather_json_fields(&writer, weather, weather_json_current, WEATHER_JSON_COUNT(weather_json_current));
+    // Closes current, the object itself is closed after the series
+    weather_json_raw(&writer, "}", 1);
+    if (writer.failed) {
+        free(writer.data);
+        return NULL;
+    }
+    writer.data[writer.length] = '\0';
 
-        val = json_object_get(current_obj, "snowfall");
-        weather->snowfall = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+    if (weather_series_append_json(&weather->hourly, WEATHER_SERIES_HOURLY, &writer.data, &writer.length) != 0 ||
+        weather_series_append_json(&weather->daily, WEATHER_SERIES_DAILY, &writer.data, &writer.length) != 0) {
+        free(writer.data);
+        return NULL;
+    }
+    // The series may have moved the buffer, its capacity is theirs now
+    char* closed = (char*)realloc(writer.data, writer.length + 2);
+    if (!closed) {
+        free(writer.data);
+        return NULL;
+    }
+    closed[writer.length] = '}';
+    closed[writer.length + 1] = '\0';
+    return closed;
+}
 
-        val = json_object_get(current_obj, "weather_code");
-        weather->weather_code = json_is_integer(val) ? (int)json_integer_value(val) : (json_is_real(val) ? (int)json_real_value(val) : 0);
+void free_weather(weather_data_t* weather) {
+    if (!weather) return;
 
-        val = json_object_get(current_obj, "cloud_cover");
-        weather->cloud_cover = json_is_integer(val) ? (int)json_integer_value(val) : (json_is_real(val) ? (int)json_real_value(val) : 0);
+    free(weather->timezone);
+    free(weather->timezone_abbreviation);
+    free(weather->time);
+    weather_series_free(&weather->hourly);
+    weather_series_free(&weather->daily);
 
-        val = json_object_get(current_obj, "pressure_msl");
-        weather->pressure_msl = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+    memset(weather, 0, sizeof(weather_data_t));
+}
 
-        val = json_object_get(current_obj, "surface_pressure");
-        weather->surface_pressure = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+// ========== Projection ==========
+// ?fields= bodies cut from the full one. Its members are the fragments: a
+// projection copies the ones of the field set as they are, nothing is
+// parsed into a report or serialized again. Kept per loop next to the hot
+// cache, by location and field set, each for the version it was cut from.
 
-        val = json_object_get(current_obj, "wind_speed_10m");
-        weather->wind_speed_10m = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+_Static_assert(WEATHER_JSON_COUNT(weather_json_current) < 29, "the current block's members take the low bits of a field set");
 
-        val = json_object_get(current_obj, "wind_direction_10m");
-        weather->wind_direction_10m = json_is_integer(val) ? (int)json_integer_value(val) : (json_is_real(val) ? (int)json_real_value(val) : 0);
+static uint64_t weather_projection_key(uint64_t key, uint32_t fields) {
+    return key ^ ((uint64_t)fields * 0x9E3779B97F4A7C15ull);
+}
 
-        val = json_object_get(current_obj, "wind_gusts_10m");
-        weather->wind_gusts_10m = json_is_real(val) ? json_real_value(val) : (json_is_integer(val) ? (double)json_integer_value(val) : 0.0);
+int weather_fields_parse(const char* list, uint32_t* fields) {
+    uint32_t set = 0;
+    const char* name = list;
+    while (*name) {
+        const char* end = strchr(name, ',');
+        size_t length = end ? (size_t)(end - name) : strlen(name);
+        const weather_json_field* field =
+            length ? weather_scan_field(weather_json_current, WEATHER_JSON_COUNT(weather_json_current), name, length)
+                   : NULL;
+        if (field) {
+            set |= 1u << (field - weather_json_current);
+        } else if (length == 6 && memcmp(name, "hourly", 6) == 0) {
+            set |= WEATHER_FIELDS_HOURLY;
+        } else if (length == 5 && memcmp(name, "daily", 5) == 0) {
+            set |= WEATHER_FIELDS_DAILY;
+        } else if (length > 0) {
+            return -1;
+        }
+        name += length + (end ? 1 : 0);
     }
-
+    if (set == 0) return -1;
+    // time and interval
+    *fields = set | 3u;
     return 0;
 }
 
-int serialize_weather_to_json(const weather_data_t* weather, json_t** json_obj) {
-    if (!weather || !json_obj) return -1;
-
-    *json_obj = json_object();
-    if (!*json_obj) return -1;
+// The members of a current or current_units object the field set keeps
+static void weather_project_block(json_scan* scan, const char* body, uint32_t fields, weather_json_writer* writer) {
+    const char* key;
+    size_t length;
+    int members = 0;
+    json_scan_object_begin(scan);
+    while (json_scan_object_next(scan, &key, &length) > 0) {
+        // A member starts at its key's opening quote
+        const char* start = key - 1;
+        const weather_json_field* field =
+            weather_scan_field(weather_json_current, WEATHER_JSON_COUNT(weather_json_current), key, length);
+        json_scan_skip(scan);
+        if (!field || !(fields & (1u << (field - weather_json_current)))) continue;
+        if (members++) weather_json_raw(writer, ",", 1);
+        weather_json_raw(writer, start, (size_t)(body + json_scan_tell(scan) - start));
+    }
+}
 
-    json_object_set_new(*json_obj, "latitude", json_real(weather->latitude));
-    json_object_set_new(*json_obj, "longitude", json_real(weather->longitude));
-    json_object_set_new(*json_obj, "generationtime_ms", json_real(weather->generationtime_ms));
-    json_object_set_new(*json_obj, "utc_offset_seconds", json_integer(weather->utc_offset_seconds));
-    json_object_set_new(*json_obj, "timezone", weather->timezone ? json_string(weather->timezone) : json_string("GMT"));
-    json_object_set_new(*json_obj, "timezone_abbreviation", weather->timezone_abbreviation ? json_string(weather->timezone_abbreviation) : json_string("GMT"));
-    json_object_set_new(*json_obj, "elevation", json_real(weather->elevation));
+// body (the full client JSON) with only the members fields keeps, malloc'd
+// and NUL terminated
+static char* weather_project(const char* body, size_t length, uint32_t fields, size_t* out_length) {
+    weather_json_writer writer = {(char*)malloc(length + 1), 0, length + 1, 0};
+    if (!writer.data) return NULL;
+    json_scan scan;
+    json_scan_init(&scan, body, length);
+    const char* key;
+    size_t key_length;
+    int members = 0;
+    weather_json_raw(&writer, "{", 1);
+    json_scan_object_begin(&scan);
+    while (json_scan_object_next(&scan, &key, &key_length) > 0) {
+        const char* start = key - 1;
+        if ((json_scan_key_is(key, key_length, "current") || json_scan_key_is(key, key_length, "current_units")) &&
+            json_scan_peek(&scan) == JSON_SCAN_OBJECT) {
+            if (members++) weather_json_raw(&writer, ",", 1);
+            weather_json_raw(&writer, start, key_length + 2);
+            weather_json_raw(&writer, ":{", 2);
+            weather_project_block(&scan, body, fields, &writer);
+            weather_json_raw(&writer, "}", 1);
+            continue;
+        }
+        // A series' units go with it
+        uint32_t series = 0;
+        if (json_scan_key_is(key, key_length, "hourly") || json_scan_key_is(key, key_length, "hourly_units")) {
+            series = WEATHER_FIELDS_HOURLY;
+        } else if (json_scan_key_is(key, key_length, "daily") || json_scan_key_is(key, key_length, "daily_units")) {
+            series = WEATHER_FIELDS_DAILY;
+        }
+        json_scan_skip(&scan);
+        if (series && !(fields & series)) continue;
+        if (members++) weather_json_raw(&writer, ",", 1);
+        weather_json_raw(&writer, start, (size_t)(body + json_scan_tell(&scan) - start));
+    }
+    weather_json_raw(&writer, "}", 1);
+    if (scan.failed || writer.failed) {
+        free(writer.data);
+        return NULL;
+    }
+    writer.data[writer.length] = '\0';
+    *out_length = writer.length;
+    return writer.data;
+}
 
-    json_t* units_obj = json_object();
-    if (!units_obj) {
-        json_decref(*json_obj);
-        return -1;
+// The projection of a full body of the location into this loop's cache,
+// NULL if it cannot be made
+static response_cache_entry* weather_projection_store(uint64_t key, uint32_t fields, const uint8_t* body, size_t length,
+                                                      time_t last_modified) {
+    if (!t_projectionCache.entries && response_cache_init(&t_projectionCache, Weather_PROJECTION_CACHE_ENTRIES,
+                                                          Weather_PROJECTION_CACHE_BYTES, NULL) != 0) {
+        return NULL;
     }
-    json_object_set_new(units_obj, "time", weather->unit_time ? json_string(weather->unit_time) : json_string("iso8601"));
-    json_object_set_new(units_obj, "interval", weather->unit_interval ? json_string(weather->unit_interval) : json_string("seconds"));
-    json_object_set_new(units_obj, "temperature_2m", weather->unit_temperature_2m ? json_string(weather->unit_temperature_2m) : json_string("°C"));
-    json_object_set_new(units_obj, "relative_humidity_2m",
-                        weather->unit_relative_humidity_2m ? json_string(weather->unit_relative_humidity_2m) : json_string("%"));
-    json_object_set_new(units_obj, "apparent_temperature",
-                        weather->unit_apparent_temperature ? json_string(weather->unit_apparent_temperature) : json_string("°C"));
-    json_object_set_new(units_obj, "is_day", weather->unit_is_day ? json_string(weather->unit_is_day) : json_string(""));
-    json_object_set_new(units_obj, "precipitation", weather->unit_precipitation ? json_string(weather->unit_precipitation) : json_string("mm"));
-    json_object_set_new(units_obj, "rain", weather->unit_rain ? json_string(weather->unit_rain) : json_string("mm"));
-    json_object_set_new(units_obj, "showers", weather->unit_showers ? json_string(weather->unit_showers) : json_string("mm"));
-    json_object_set_new(units_obj, "snowfall", weather->unit_snowfall ? json_string(weather->unit_snowfall) : json_string("cm"));
-    json_object_set_new(units_obj, "weather_code", weather->unit_weather_code ? json_string(weather->unit_weather_code) : json_string("wmo code"));
-    json_object_set_new(units_obj, "cloud_cover", weather->unit_cloud_cover ? json_string(weather->unit_cloud_cover) : json_string("%"));
-    json_object_set_new(units_obj, "pressure_msl", weather->unit_pressure_msl ? json_string(weather->unit_pressure_msl) : json_string("hPa"));
-    json_object_set_new(units_obj, "surface_pressure", weather->unit_surface_pressure ? json_string(weather->unit_surface_pressure) : json_string("hPa"));
-    json_object_set_new(units_obj, "wind_speed_10m", weather->unit_wind_speed_10m ? json_string(weather->unit_wind_speed_10m) : json_string("km/h"));
-    json_object_set_new(units_obj, "wind_direction_10m", weather->unit_wind_direction_10m ? json_string(weather->unit_wind_direction_10m) : json_string("°"));
-    json_object_set_new(units_obj, "wind_gusts_10m", weather->unit_wind_gusts_10m ? json_string(weather->unit_wind_gusts_10m) : json_string("km/h"));
-    json_object_set_new(*json_obj, "current_units", units_obj);
-
-    json_t* current_obj = json_object();
-    if (!current_obj) {
-        json_decref(*json_obj);
-        return -1;
+    // CBOR alone is the whole body transcoded
+    size_t projected_length = length;
+    char* projected = (char*)body;
+    if (fields & ~WEATHER_FIELDS_CBOR) {
+        projected = weather_project((const char*)body, length, fields, &projected_length);
+        if (!projected) return NULL;
+    }
+    if (fields & WEATHER_FIELDS_CBOR) {
+        size_t cbor_length = 0;
+        char* cbor = (char*)cbor_from_json(projected, projected_length, &cbor_length);
+        if (projected != (char*)body) free(projected);
+        if (!cbor) return NULL;
+        projected = cbor;
+        projected_length = cbor_length;
+    }
+    response_cache_entry* entry =
+        response_cache_insert(&t_projectionCache, weather_projection_key(key, fields), last_modified,
+                              weather_fresh_until(last_modified) + Weather_STALE_WHILE_REVALIDATE_SECONDS);
+    char etag[HTTP_ETAG_SIZE];
+    http_etag_from_data(etag, projected, projected_length);
+    if (entry && response_cache_set(&t_projectionCache, entry, COMPRESS_IDENTITY, (const uint8_t*)projected,
+                                    projected_length, etag) != 0) {
+        entry = NULL;
     }
-    json_object_set_new(current_obj, "time", weather->time ? json_string(weather->time) : json_null());
-    json_object_set_new(current_obj, "interval", json_integer(weather->interval));
-    json_object_set_new(current_obj, "temperature_2m", json_real(weather->temperature_2m));
-    json_object_set_new(current_obj, "relative_humidity_2m", json_integer(weather->relative_humidity_2m));
-    json_object_set_new(current_obj, "apparent_temperature", json_real(weather->apparent_temperature));
-    json_object_set_new(current_obj, "is_day", json_integer(weather->is_day));
-    json_object_set_new(current_obj, "precipitation", json_real(weather->precipitation));
-    json_object_set_new(current_obj, "rain", json_real(weather->rain));
-    json_object_set_new(current_obj, "showers", json_real(weather->showers));
-    json_object_set_new(current_obj, "snowfall", json_real(weather->snowfall));
-    json_object_set_new(current_obj, "weather_code", json_integer(weather->weather_code));
-    json_object_set_new(current_obj, "cloud_cover", json_integer(weather->cloud_cover));
-    json_object_set_new(current_obj, "pressure_msl", json_real(weather->pressure_msl));
-    json_object_set_new(current_obj, "surface_pressure", json_real(weather->surface_pressure));
-    json_object_set_new(current_obj, "wind_speed_10m", json_real(weather->wind_speed_10m));
-    json_object_set_new(current_obj, "wind_direction_10m", json_integer(weather->wind_direction_10m));
-    json_object_set_new(current_obj, "wind_gusts_10m", json_real(weather->wind_gusts_10m));
-    json_object_set_new(*json_obj, "current", current_obj);
+    if (projected != (char*)body) free(projected);
+    return entry;
+}
 
+int weather_projected_lookup(double latitude, double longitude, uint32_t fields, compress_encoding encoding,
+                             weather_hot_hit* hit) {
+    uint64_t key = weather_cache_key(latitude, longitude);
+    time_t now = time(NULL);
+    response_cache_entry* entry =
+        t_projectionCache.entries ? response_cache_find(&t_projectionCache, weather_projection_key(key, fields), now)
+                                  : NULL;
+    // The full entry tells the version, and counts the demand its refresh goes by
+    weather_hot_hit full;
+    if (weather_hot_lookup(latitude, longitude, COMPRESS_IDENTITY, &full) == 0) {
+        if (!entry || entry->last_modified != full.last_modified) {
+            entry = weather_projection_store(key, fields, full.body, full.length, full.last_modified);
+        }
+    } else if (entry && now > weather_fresh_until(entry->last_modified)) {
+        // Another loop's location, only the backend finds out what is newer
+        entry = NULL;
+    }
+    if (!entry || !entry->blob) return -1;
+
+    encoding = weather_hot_variant(&t_projectionCache, entry, encoding);
+    const response_blob* blob = entry->blob;
+    if (!blob->bodies[encoding]) return -1;
+    hit->blob = blob;
+    hit->body = blob->bodies[encoding];
+    hit->length = blob->lengths[encoding];
+    hit->encoding = encoding;
+    hit->etag = blob->etags[encoding][0] ? blob->etags[encoding] : NULL;
+    hit->last_modified = entry->last_modified;
+    hit->stale = now > weather_fresh_until(entry->last_modified);
     return 0;
 }
 
-void free_weather(weather_data_t* weather) {
-    if (!weather) return;
-
-    free(weather->timezone);
-    free(weather->timezone_abbreviation);
-    free(weather->unit_time);
-    free(weather->unit_interval);
-    free(weather->unit_temperature_2m);
-    free(weather->unit_relative_humidity_2m);
-    free(weather->unit_apparent_temperature);
-    free(weather->unit_is_day);
-    free(weather->unit_precipitation);
-    free(weather->unit_rain);
-    free(weather->unit_showers);
-    free(weather->unit_snowfall);
-    free(weather->unit_weather_code);
-    free(weather->unit_cloud_cover);
-    free(weather->unit_pressure_msl);
-    free(weather->unit_surface_pressure);
-    free(weather->unit_wind_speed_10m);
-    free(weather->unit_wind_direction_10m);
-    free(weather->unit_wind_gusts_10m);
-    free(weather->time);
-
-    memset(weather, 0, sizeof(weather_data_t));
+// The backend's body cut to its field set, what goes out in place of it
+static void weather_project_result(weather_t* weather) {
+    const uint8_t* body = NULL;
+    size_t length = 0;
+    if (weather->shard_blob && weather->shard_blob->bodies[COMPRESS_IDENTITY]) {
+        body = weather->shard_blob->bodies[COMPRESS_IDENTITY];
+        length = weather->shard_blob->lengths[COMPRESS_IDENTITY];
+    } else if (weather->buffer) {
+        body = (const uint8_t*)weather->buffer;
+        length = strlen(weather->buffer);
+    }
+    if (!body) return;
+    response_cache_entry* entry = weather_projection_store(weather_cache_key(weather->latitude, weather->longitude),
+                                                           weather->fields, body, length, weather->last_modified);
+    if (!entry || !entry->blob) return;
+    weather->projection_encoding = weather_hot_variant(&t_projectionCache, entry, weather->fields_encoding);
+    response_blob_retain(entry->blob);
+    weather->projection = entry->blob;
 }
 
-int weather_init(void** ctx, void** ctx_struct, void (*ondone)(void* context)) {
+int weather_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context)) {
     weather_t* weather = (weather_t*)malloc(sizeof(weather_t));
     if (!weather) { return -1; }
     memset(weather, 0, sizeof(weather_t));
     weather->ctx = ctx;
     weather->on_done = ondone;
+    weather->on_wake = onwake;
 
     weather->latitude = 0.0;
     weather->longitude = 0.0;
 
-    weather->curl_client = (curl_client*)malloc(sizeof(curl_client));
-    memset(weather->curl_client, 0, sizeof(curl_client));
 
     weather->buffer = NULL;
     weather->bytesread = 0;
@@ -458,120 +2700,358 @@ int weather_init(void** ctx, void** ctx_struct, void (*ondone)(void* context)) {
 int weather_get_buffer(void** ctx, char** buffer) {
     weather_t* weather = (weather_t*)(*ctx);
     if (!weather) { return -1; }
-    *buffer = weather->buffer;
+    // Projected, the blob is the body; none means it could not be made
+    if (weather->fields) {
+        *buffer = NULL;
+        return 0;
+    }
+    *buffer = weather->peer ? (char*)weather->peer_reply : weather->buffer;
+    return 0;
+}
+
+int weather_get_buffer_size(void** ctx, size_t* size) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return -1;
+    *size = weather->peer ? weather->peer_reply_length : (weather->buffer ? strlen(weather->buffer) : 0);
     return 0;
 }
 
 int weather_work(void** ctx) {
     weather_t* weather = (weather_t*)(*ctx);
     if (!weather) { return -1; }
-    char* json_str = NULL;
     char* client_response = NULL;
 
+    PROBE3(backend_state, "weather", weather, (int)weather->state);
     switch (weather->state) {
     case Weather_State_Init:
-        create_folder(CACHE_DIR);
-        weather->state = Weather_State_ValidateFile;
-        printf("Weather: Initialized\n");
+        // A refresh is after a newer version than any cache has, a peer
+        // after the record the hot caches do not keep
+        weather->state = !weather->refresh_older && !weather->peer && weather_shard_ask(weather) == 0
+                             ? Weather_State_AskOwner
+                             : Weather_State_ValidateFile;
+        LOG_DEBUG("Weather: Initialized");
+        break;
+    case Weather_State_AskOwner:
+        // Woken by weather_shard_lookup_answer
+        if (!weather->shard_lookup->answered) return BACKEND_WORK_WAIT;
+        weather->state = weather_shard_take(weather) == 0 ? Weather_State_Done : Weather_State_ValidateFile;
         break;
     case Weather_State_ValidateFile:
-        if (does_weather_cache_exist(weather->latitude, weather->longitude) == 0 && is_weather_cache_stale(weather->latitude, weather->longitude, 900) == 0) {
-            weather->state = Weather_State_LoadFromDisk;
-        } else {
+        weather->job = job_pool_submit(weather_cache_job_work, weather_cache_job_done, weather);
+        if (!weather->job) {
             weather->state = Weather_State_FetchFromAPI_Init;
+            break;
         }
-        printf("Weather: Validating File\n");
+        weather->state = Weather_State_LoadFromDisk;
+        LOG_DEBUG("Weather: Validating File");
         break;
     case Weather_State_LoadFromDisk:
-        if (load_weather_from_cache(weather->latitude, weather->longitude, &json_str) == 0) {
-            weather->buffer = json_str;
-        } else {
-            weather->buffer = NULL;
-        }
-        weather->state = Weather_State_Done;
-        printf("Weather: Loading From Disk\n");
+        // Waiting for weather_cache_job_done
+        return BACKEND_WORK_WAIT;
+    case Weather_State_SharedGet:
+        weather->shared_asked = 1;
+        weather->shared_op = cache_store_get(g_sharedStore, weather_cache_key(weather->latitude, weather->longitude),
+                                             0, weather_shared_done, weather);
+        weather->state = weather->shared_op ? Weather_State_SharedWait : Weather_State_FetchFromAPI_Init;
+        LOG_DEBUG("Weather: Asking Shared Store");
         break;
-    case Weather_State_FetchFromAPI_Init:
-        if (curl_client_init(&weather->curl_client) != 0) {
-            weather->state = Weather_State_Done;
+    case Weather_State_SharedWait:
+        // Woken by weather_shared_done
+        if (weather->shared_op) return BACKEND_WORK_WAIT;
+        weather->state = weather_shared_take(weather) == 0 ? Weather_State_Done : Weather_State_FetchFromAPI_Init;
+        break;
+    case Weather_State_FetchFromPeer_Init: {
+        weather->peer_asked = 1;
+        const char* owner = peer_ring_owner(weather_cache_key(weather->latitude, weather->longitude));
+        char url[256];
+        snprintf(url, sizeof(url), Weather_PEER_URL, owner, weather->latitude, weather->longitude);
+        // Concurrent misses of this loop ask once
+        weather->state = single_flight_join(&weather->flight, url, weather->on_wake, weather->ctx) == 0
+                             ? Weather_State_FetchFromPeer_Poll
+                             : Weather_State_FetchFromAPI_Init;
+        LOG_DEBUG("Weather: Asking Peer");
+        break;
+    }
+    case Weather_State_FetchFromPeer_Poll: {
+        int status = single_flight_poll(&weather->flight);
+        if (status == SINGLE_FLIGHT_RUNNING) return BACKEND_WORK_POLL;
+        if (status == SINGLE_FLIGHT_WAITING) return BACKEND_WORK_WAIT;
+        int taken = status == SINGLE_FLIGHT_DONE && weather_peer_take(weather) == 0;
+        metrics_counter_add(taken ? &g_peerHits : &g_peerMisses, 1);
+        // The waiter is joined again if it goes upstream after all
+        free(weather->flight.body);
+        weather->flight.body = NULL;
+        weather->state = taken ? Weather_State_Done : Weather_State_FetchFromAPI_Init;
+        break;
+    }
+    case Weather_State_FetchFromAPI_Init: {
+        // Every node's fetches end up in the shared store, it goes first
+        if (g_sharedStore && !weather->shared_asked) {
+            weather->state = Weather_State_SharedGet;
             break;
         }
-        weather->state = Weather_State_FetchFromAPI_Request;
-        printf("Weather: Fetching From API\n");
-        break;
-    case Weather_State_FetchFromAPI_Request:
-        printf("Weather: Making API Request\n");
+        // Whoever owns the location on the peer ring fetches it for every node
+        if (!weather->peer && !weather->peer_asked &&
+            peer_ring_owner(weather_cache_key(weather->latitude, weather->longitude)) != NULL) {
+            weather->state = Weather_State_FetchFromPeer_Init;
+            break;
+        }
+        // The coordinates are rounded already, the URL is the cache key
         char url[512];
-        snprintf(url, sizeof(url), METEO_FORECAST_URL, weather->latitude, weather->longitude);
-
-        if (curl_client_make_request(&weather->curl_client, url) != 0) {
+        snprintf(url, sizeof(url), METEO_FORECAST_URL, g_weatherApiUrl, weather->latitude, weather->longitude);
+        // Cache only, a fetch in flight is joined but none is started
+        if (!cache_only_allows_fetch(url) && !single_flight_running(url)) {
+            weather->cache = ACCESS_CACHE_UNAVAILABLE;
+            weather->state = Weather_State_Done;
+            break;
+        }
+        if (single_flight_join(&weather->flight, url, weather->on_wake, weather->ctx) != 0) {
             weather->state = Weather_State_Done;
             break;
         }
         weather->state = Weather_State_FetchFromAPI_Poll;
+        LOG_DEBUG("Weather: Fetching From API");
         break;
+    }
     case Weather_State_FetchFromAPI_Poll:
-        printf("Weather: Polling API Response\n");
-        if (curl_client_poll(&weather->curl_client) != 0) {
-            weather->state = Weather_State_Done;
+        switch (single_flight_poll(&weather->flight)) {
+        case SINGLE_FLIGHT_RUNNING:
+            return BACKEND_WORK_POLL;
+        case SINGLE_FLIGHT_WAITING:
+            // Another request for the same location fetches it
+            return BACKEND_WORK_WAIT;
+        case SINGLE_FLIGHT_DONE:
+            weather->state = Weather_State_FetchFromAPI_Read;
             break;
-        }
-        if (weather->curl_client->still_running) {
+        default:
+            weather->state = Weather_State_Done;
             break;
-        } else {
-            weather->state = Weather_State_FetchFromAPI_Read;
         }
         break;
     case Weather_State_FetchFromAPI_Read:
-        printf("Weather: Reading API Response\n");
-        if (curl_client_read_response(&weather->curl_client, &weather->buffer) != 0) {
-            weather->state = Weather_State_Done;
-            break;
-        }
-        // curl_client_cleanup(&weather->curl_client);
+        LOG_DEBUG("Weather: Reading API Response");
+        weather->buffer = weather->flight.body;
+        weather->flight.body = NULL;
+        weather->cache = weather->flight.primary ? ACCESS_CACHE_FETCH : ACCESS_CACHE_COALESCED;
         weather->state = Weather_State_ProcessResponse;
         break;
     case Weather_State_ProcessResponse:
-        if (process_openmeteo_response(weather->buffer, &client_response) != 0) {
+        weather->job = job_pool_submit(weather_process_job_work, weather_process_job_done, weather);
+        if (weather->job) {
+            weather->state = Weather_State_Processing;
+            break;
+        }
+        // Pool unavailable, transform on the loop
+        if (weather_transform(weather->buffer, &client_response, &weather->record, &weather->record_length) != 0) {
             weather->state = Weather_State_Done;
-            printf("Weather: Processing Response Failed\n");
+            LOG_WARN("Weather: Processing Response Failed");
         } else {
             free(weather->buffer);
             weather->buffer = client_response;
+            weather->last_modified = time(NULL);
             weather->state = Weather_State_SaveToDisk;
-            printf("Weather: Processing Response Succeeded\n");
+            LOG_DEBUG("Weather: Processing Response Succeeded");
         }
         break;
-    case Weather_State_SaveToDisk:
-        if (save_weather_to_cache(weather->latitude, weather->longitude, weather->buffer) != 0) { 
-            printf("Weather: Saving To Disk Failed\n"); 
+    case Weather_State_Processing:
+        // Waiting for weather_process_job_done
+        return BACKEND_WORK_WAIT;
+    case Weather_State_SaveToDisk: {
+        // Before the record is handed over, every peer that shared the fetch gets it
+        if (weather->peer && weather->record) {
+            weather_peer_reply(weather, weather->record, weather->record_length, weather->last_modified);
+        }
+        // Requests that shared the fetch leave the write to the first of them
+        if (!weather->flight.primary) {
+            weather->state = Weather_State_Done;
+            break;
+        }
+        // The response does not wait for the cache write
+        if (weather->record) {
+            weather_shared_put(weather->latitude, weather->longitude, weather->record, weather->record_length,
+                               weather->last_modified);
+            weather_write_behind(weather->latitude, weather->longitude, weather->record, weather->record_length,
+                                 weather->last_modified);
+            weather->record = NULL;
+        } else {
+            LOG_WARN("Weather: Saving To Disk Failed");
         }
         weather->state = Weather_State_Done;
         break;
+    }
     case Weather_State_Done:
+        if (weather->last_modified == 0 && weather->fallback) {
+            // The fetch failed, stale-if-error
+            LOG_INFO("Weather: Serving Stale Copy");
+            weather->cache = ACCESS_CACHE_FALLBACK;
+            free(weather->buffer);
+            weather->buffer = weather->fallback;
+            weather->fallback = NULL;
+            weather->last_modified = weather->fallback_modified;
+        }
+        // A record loaded for a peer has no body to keep
+        if (weather->buffer || weather->encoded) weather_hot_store(weather);
+        if (weather->fields) weather_project_result(weather);
         weather->on_done(weather->ctx);
-        printf("Weather: Done\n");
-        break;
+        LOG_DEBUG("Weather: Done");
+        return BACKEND_WORK_WAIT;
     }
 
-    return 0;
+    return BACKEND_WORK_AGAIN;
+}
+
+static void weather_free(void* ctx) {
+    weather_t* weather = (weather_t*)ctx;
+
+    single_flight_leave(&weather->flight);
+    free(weather->flight.body);
+    free(weather->fallback);
+    free(weather->record);
+    if ((const uint8_t*)weather->buffer != weather->disk_body) free(weather->buffer);
+    free(weather->processed);
+    if (weather->encoded != weather->disk_body) free(weather->encoded);
+    record_store_view_release(&weather->disk_view);
+    free(weather->peer_reply);
+    free(weather->shared_record);
+    response_blob_release(weather->shard_blob);
+    response_blob_release(weather->projection);
+    
+    free(weather);
 }
 
 int weather_dispose(void** ctx) {
     weather_t* weather = (weather_t*)(*ctx);
     if (!weather) return -1;
 
-    curl_client_cleanup(&weather->curl_client);
-    free(weather->curl_client);
-    weather->curl_client = NULL;
-    free(weather->buffer);
-    
-    free(weather);
+    // A cache or transform job still uses the struct, it is freed once the job finishes
+    single_flight_leave(&weather->flight);
+    // The shared store's answer too
+    cache_store_cancel(weather->shared_op);
+    // The owner's answer is dropped when it comes
+    if (weather->shard_lookup) {
+        weather->shard_lookup->waiter = NULL;
+        weather_shard_lookup_release(weather->shard_lookup);
+        weather->shard_lookup = NULL;
+    }
+    if (weather->job) {
+        job_pool_abandon(weather->job, weather_free);
+    } else {
+        weather_free(weather);
+    }
     *ctx = NULL;
 
     return 0;
 }
 
+int weather_set_conditional(void** ctx, const http_conditional* conditional) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return -1;
+    // The client's copy is of the projection, the caches' validators are not its
+    if (weather->fields) {
+        weather->fields_conditional = *conditional;
+    } else {
+        weather->conditional = *conditional;
+    }
+
+    return 0;
+}
+
+int weather_set_peer(void** ctx) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return -1;
+    weather->peer = 1;
+
+    return 0;
+}
+
+int weather_set_encoding(void** ctx, compress_encoding encoding) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return -1;
+    weather->encoding = encoding;
+
+    return 0;
+}
+
+int weather_set_fields(void** ctx, uint32_t fields, compress_encoding encoding) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return -1;
+    weather->fields = fields;
+    weather->fields_encoding = encoding;
+
+    return 0;
+}
+
+compress_encoding weather_get_encoded(void** ctx, const uint8_t** data, size_t* length) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather || !weather->encoded) return COMPRESS_IDENTITY;
+    *data = weather->encoded;
+    *length = weather->encoded_length;
+
+    return weather->encoding;
+}
+
+int weather_get_validators(void** ctx, const char** etag, time_t* last_modified) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return -1;
+    if (weather->fields) {
+        const response_blob* projection = weather->projection;
+        const char* projected = projection ? projection->etags[weather->projection_encoding] : "";
+        *etag = projected[0] ? projected : NULL;
+        *last_modified = projection ? projection->last_modified : 0;
+        return projection && http_conditional_is_current(&weather->fields_conditional, *etag, *last_modified);
+    }
+    *etag = weather->etag[0] ? weather->etag : NULL;
+    *last_modified = weather->last_modified;
+
+    return weather->not_modified;
+}
+
+const response_blob* weather_get_blob(void** ctx, compress_encoding* encoding) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather) return NULL;
+    if (weather->fields) {
+        *encoding = weather->projection_encoding;
+        return weather->projection;
+    }
+    if (!weather->shard_blob) return NULL;
+    *encoding = weather->shard_encoding;
+    return weather->shard_blob;
+}
+
+int weather_get_file(void** ctx, const uint8_t* body, off_t* offset) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather || !weather->disk_body || body != weather->disk_body) return -1;
+    metrics_counter_add(&g_storeInPlace, 1);
+    *offset = weather->disk_offset;
+    return weather->disk_view.fd;
+}
+
+int weather_get_freshness(void** ctx, time_t* stamp, time_t* expires, char* key, size_t size) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (!weather || weather->peer) return -1;
+    time_t modified = weather->fields && weather->projection ? weather->projection->last_modified : weather->last_modified;
+    if (modified <= 0) return -1;
+    *stamp = modified;
+    *expires = weather_fresh_until(modified);
+    weather_surrogate_key(weather->latitude, weather->longitude, key, size);
+    return 0;
+}
+
+const char* weather_get_content_type(void** ctx) {
+    weather_t* weather = (weather_t*)(*ctx);
+    return weather && (weather->fields & WEATHER_FIELDS_CBOR) ? "application/cbor" : NULL;
+}
+
+access_cache weather_get_cache_outcome(void** ctx) {
+    weather_t* weather = (weather_t*)(*ctx);
+    return weather ? weather->cache : ACCESS_CACHE_NONE;
+}
+
+void weather_set_trace(void** ctx, trace_context* trace) {
+    weather_t* weather = (weather_t*)(*ctx);
+    if (weather) weather->trace = trace;
+}
+
 int weather_set_location(void** ctx, double latitude, double longitude) {
     weather_t* weather = (weather_t*)(*ctx);
     if (!weather) return -1;
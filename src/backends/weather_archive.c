@@ -0,0 +1,477 @@
+#include "backends/weather_archive.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+#include "utilities/real_format.h"
+#include "utilities/record_store.h"
+
+_Static_assert(Weather_ARCHIVE_RETAIN_DAYS > 0 && Weather_ARCHIVE_RETAIN_DAYS < 256,
+               "a day's chunk is stored in slot day % 256");
+
+#define WEATHER_ARCHIVE_MAGIC 0x43524157u /* "WARC" */
+#define WEATHER_ARCHIVE_VERSION 1
+#define WEATHER_ARCHIVE_DAY_SECONDS 86400
+// Reals are kept in hundredths, what open-meteo reports them in and more
+#define WEATHER_ARCHIVE_REAL_SCALE 100.0
+
+typedef struct {
+    const char* name;
+    size_t offset;
+    // a double of weather_data_t, else an int
+    int real;
+} weather_archive_column;
+
+// The measurements of the current block, in the order of the JSON. Append
+// only, the index is part of the format.
+static const weather_archive_column g_archiveColumns[] = {
+    {"temperature_2m", offsetof(weather_data_t, temperature_2m), 1},
+    {"relative_humidity_2m", offsetof(weather_data_t, relative_humidity_2m), 0},
+    {"apparent_temperature", offsetof(weather_data_t, apparent_temperature), 1},
+    {"is_day", offsetof(weather_data_t, is_day), 0},
+    {"precipitation", offsetof(weather_data_t, precipitation), 1},
+    {"rain", offsetof(weather_data_t, rain), 1},
+    {"showers", offsetof(weather_data_t, showers), 1},
+    {"snowfall", offsetof(weather_data_t, snowfall), 1},
+    {"weather_code", offsetof(weather_data_t, weather_code), 0},
+    {"cloud_cover", offsetof(weather_data_t, cloud_cover), 0},
+    {"pressure_msl", offsetof(weather_data_t, pressure_msl), 1},
+    {"surface_pressure", offsetof(weather_data_t, surface_pressure), 1},
+    {"wind_speed_10m", offsetof(weather_data_t, wind_speed_10m), 1},
+    {"wind_direction_10m", offsetof(weather_data_t, wind_direction_10m), 0},
+    {"wind_gusts_10m", offsetof(weather_data_t, wind_gusts_10m), 1},
+};
+#define WEATHER_ARCHIVE_MEASUREMENTS ((int)(sizeof(g_archiveColumns) / sizeof(g_archiveColumns[0])))
+// The time in seconds into the day first, then the measurements
+#define WEATHER_ARCHIVE_COLUMNS (WEATHER_ARCHIVE_MEASUREMENTS + 1)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    // days since the epoch, and the cell in micro degrees; a chunk of
+    // another day or cell in the slot is one the day replaces
+    int32_t day;
+    int32_t latitude;
+    int32_t longitude;
+    uint8_t widths[WEATHER_ARCHIVE_COLUMNS];
+} weather_archive_header;
+
+// A day of a cell decoded, column by column
+typedef struct {
+    int count;
+    int32_t values[WEATHER_ARCHIVE_COLUMNS][Weather_ARCHIVE_DAY_SAMPLES];
+} weather_archive_day;
+
+static record_store* g_archive = NULL;
+// Appends read, change and put a day back, one at a time
+static pthread_mutex_t g_archiveLock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_counter g_archiveObservations;
+
+static int64_t weather_archive_metrics_bytes(void* context) {
+    (void)context;
+    size_t bytes = 0;
+    record_store_usage(g_archive, &bytes, NULL);
+    return (int64_t)bytes;
+}
+
+int weather_archive_open(void) {
+    metrics_register("weather_archive_observations_total", "Observations added to the local history.",
+                     METRICS_COUNTER, NULL, &g_archiveObservations);
+    metrics_register_read("cache_bytes", "Bytes of live entries, by cache.", METRICS_GAUGE,
+                          "cache=\"weather_archive\"", weather_archive_metrics_bytes, NULL);
+    return record_store_open(&g_archive, Weather_ARCHIVE_PATH, Weather_ARCHIVE_CAPACITY,
+                             (time_t)Weather_ARCHIVE_RETAIN_DAYS * WEATHER_ARCHIVE_DAY_SECONDS);
+}
+
+void weather_archive_close(void) {
+    record_store_close(&g_archive);
+}
+
+// ========== Columns ==========
+
+// Bytes each difference of the column takes
+static int weather_archive_width(const int32_t* values, int count) {
+    int width = 1;
+    for (int i = 1; i < count; i++) {
+        int32_t delta = (int32_t)((uint32_t)values[i] - (uint32_t)values[i - 1]);
+        if (delta < INT16_MIN || delta > INT16_MAX) return 4;
+        if (delta < INT8_MIN || delta > INT8_MAX) width = 2;
+    }
+    return width;
+}
+
+static uint8_t* weather_archive_encode_column(const int32_t* values, int count, int width, uint8_t* out) {
+    memcpy(out, &values[0], sizeof(int32_t));
+    out += sizeof(int32_t);
+    for (int i = 1; i < count; i++) {
+        int32_t delta = (int32_t)((uint32_t)values[i] - (uint32_t)values[i - 1]);
+        if (width == 1) {
+            *out = (uint8_t)(int8_t)delta;
+        } else if (width == 2) {
+            int16_t narrow = (int16_t)delta;
+            memcpy(out, &narrow, sizeof(narrow));
+        } else {
+            memcpy(out, &delta, sizeof(delta));
+        }
+        out += width;
+    }
+    return out;
+}
+
+// The differences widened to out, then summed up. Widening has no
+// dependency between samples and is vectorized (-O2, gcc 12 on); the
+// running sum is the one chain left.
+static void weather_archive_decode_column(const uint8_t* data, int width, int count, int32_t* out) {
+    memcpy(&out[0], data, sizeof(int32_t));
+    data += sizeof(int32_t);
+    int32_t* deltas = out + 1;
+    int n = count - 1;
+    if (width == 1) {
+        for (int i = 0; i < n; i++) deltas[i] = (int8_t)data[i];
+    } else if (width == 2) {
+        for (int i = 0; i < n; i++) {
+            int16_t narrow;
+            memcpy(&narrow, data + 2 * i, sizeof(narrow));
+            deltas[i] = narrow;
+        }
+    } else {
+        memcpy(deltas, data, (size_t)n * sizeof(int32_t));
+    }
+    uint32_t sum = (uint32_t)out[0];
+    for (int i = 1; i < count; i++) {
+        sum += (uint32_t)out[i];
+        out[i] = (int32_t)sum;
+    }
+}
+
+// The chunk into day if it is the one of day number and the cell, else day
+// is left empty. -1 if the chunk is not one.
+static int weather_archive_decode(const uint8_t* chunk, size_t length, int32_t number, int32_t latitude,
+                                  int32_t longitude, weather_archive_day* day) {
+    day->count = 0;
+    weather_archive_header header;
+    if (length < sizeof(header)) return -1;
+    memcpy(&header, chunk, sizeof(header));
+    if (header.magic != WEATHER_ARCHIVE_MAGIC || header.version != WEATHER_ARCHIVE_VERSION ||
+        header.count == 0 || header.count > Weather_ARCHIVE_DAY_SAMPLES) {
+        return -1;
+    }
+    if (header.day != number || header.latitude != latitude || header.longitude != longitude) return 0;
+
+    const uint8_t* cursor = chunk + sizeof(header);
+    const uint8_t* end = chunk + length;
+    for (int column = 0; column < WEATHER_ARCHIVE_COLUMNS; column++) {
+        int width = header.widths[column];
+        if ((width != 1 && width != 2 && width != 4) ||
+            (size_t)(end - cursor) < sizeof(int32_t) + (size_t)(header.count - 1) * (size_t)width) {
+            return -1;
+        }
+        weather_archive_decode_column(cursor, width, header.count, day->values[column]);
+        cursor += sizeof(int32_t) + (size_t)(header.count - 1) * (size_t)width;
+    }
+    day->count = header.count;
+    return 0;
+}
+
+// The chunk of day, malloc'd
+static uint8_t* weather_archive_encode(const weather_archive_day* day, int32_t number, int32_t latitude,
+                                       int32_t longitude, size_t* length) {
+    uint8_t* chunk = (uint8_t*)malloc(sizeof(weather_archive_header) +
+                                      WEATHER_ARCHIVE_COLUMNS * (size_t)day->count * sizeof(int32_t));
+    if (!chunk) return NULL;
+    weather_archive_header header = {WEATHER_ARCHIVE_MAGIC, WEATHER_ARCHIVE_VERSION, (uint16_t)day->count,
+                                     number, latitude, longitude, {0}};
+    uint8_t* cursor = chunk + sizeof(header);
+    for (int column = 0; column < WEATHER_ARCHIVE_COLUMNS; column++) {
+        header.widths[column] = (uint8_t)weather_archive_width(day->values[column], day->count);
+        cursor = weather_archive_encode_column(day->values[column], day->count, header.widths[column], cursor);
+    }
+    memcpy(chunk, &header, sizeof(header));
+    *length = (size_t)(cursor - chunk);
+    return chunk;
+}
+
+// ========== Appending ==========
+
+static int32_t weather_archive_micro(double degrees) {
+    return (int32_t)llround(degrees * 1000000.0);
+}
+
+// Same key as the weather caches, the day picks the slot
+static uint64_t weather_archive_key(int32_t latitude, int32_t longitude) {
+    return ((uint64_t)(uint32_t)latitude << 32) | (uint32_t)longitude;
+}
+
+static uint8_t weather_archive_slot(int32_t day) {
+    return (uint8_t)(uint32_t)day;
+}
+
+static int32_t weather_archive_day_of(time_t when) {
+    time_t day = when / WEATHER_ARCHIVE_DAY_SECONDS;
+    if (when < 0 && when % WEATHER_ARCHIVE_DAY_SECONDS != 0) day--;
+    return (int32_t)day;
+}
+
+// "2024-05-01T12:15" as the seconds it stands for, read as UTC
+static int weather_archive_parse_time(const char* text, time_t* when) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (!text || sscanf(text, "%4d-%2d-%2dT%2d:%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min) != 5) {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *when = timegm(&tm);
+    return *when == (time_t)-1 ? -1 : 0;
+}
+
+int weather_archive_append(double latitude, double longitude, const weather_data_t* weather) {
+    time_t when;
+    if (!g_archive || weather_archive_parse_time(weather->time, &when) != 0) return -1;
+    // The time is the location's own when the forecast was asked for one
+    when -= weather->utc_offset_seconds;
+    int32_t number = weather_archive_day_of(when);
+    int32_t second = (int32_t)(when - (time_t)number * WEATHER_ARCHIVE_DAY_SECONDS);
+    int32_t lat = weather_archive_micro(latitude);
+    int32_t lon = weather_archive_micro(longitude);
+    uint64_t key = weather_archive_key(lat, lon);
+    uint8_t slot = weather_archive_slot(number);
+
+    weather_archive_day* day = (weather_archive_day*)malloc(sizeof(weather_archive_day));
+    if (!day) return -1;
+    day->count = 0;
+
+    pthread_mutex_lock(&g_archiveLock);
+    uint8_t* chunk = NULL;
+    size_t length = 0;
+    time_t stamp;
+    if (record_store_get(g_archive, key, slot, &chunk, &length, &stamp) == 0) {
+        if (weather_archive_decode(chunk, length, number, lat, lon, day) != 0) {
+            LOG_WARN("WeatherArchive: Dropping an unreadable chunk");
+        }
+        free(chunk);
+    }
+
+    // Forecasts mostly come in time order, a peer's may be older
+    int at = day->count;
+    while (at > 0 && day->values[0][at - 1] > second) at--;
+    int result = 0;
+    if (at > 0 && day->values[0][at - 1] == second) {
+        result = 0;
+    } else if (day->count == Weather_ARCHIVE_DAY_SAMPLES) {
+        result = -1;
+    } else {
+        for (int column = 0; column < WEATHER_ARCHIVE_COLUMNS; column++) {
+            int32_t* values = day->values[column];
+            memmove(&values[at + 1], &values[at], (size_t)(day->count - at) * sizeof(int32_t));
+        }
+        day->values[0][at] = second;
+        for (int i = 0; i < WEATHER_ARCHIVE_MEASUREMENTS; i++) {
+            const char* field = (const char*)weather + g_archiveColumns[i].offset;
+            int32_t value;
+            if (g_archiveColumns[i].real) {
+                double real;
+                memcpy(&real, field, sizeof(real));
+                value = isfinite(real) ? (int32_t)llround(real * WEATHER_ARCHIVE_REAL_SCALE) : 0;
+            } else {
+                int integer;
+                memcpy(&integer, field, sizeof(integer));
+                value = integer;
+            }
+            day->values[i + 1][at] = value;
+        }
+        day->count++;
+
+        chunk = weather_archive_encode(day, number, lat, lon, &length);
+        // Stamped with the end of the day, it is kept that long past it
+        time_t end = ((time_t)number + 1) * WEATHER_ARCHIVE_DAY_SECONDS - 1;
+        result = chunk && record_store_put(g_archive, key, slot, chunk, length, end) == 0 ? 0 : -1;
+        if (result == 0) metrics_counter_add(&g_archiveObservations, 1);
+        free(chunk);
+    }
+    pthread_mutex_unlock(&g_archiveLock);
+
+    free(day);
+    return result;
+}
+
+// ========== Queries ==========
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} weather_archive_buffer;
+
+// Room for size more bytes, -1 if out of memory
+static int weather_archive_reserve(weather_archive_buffer* buffer, size_t size) {
+    if (buffer->length + size <= buffer->capacity) return 0;
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + size) capacity *= 2;
+    char* data = (char*)realloc(buffer->data, capacity);
+    if (!data) return -1;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static void weather_archive_put(weather_archive_buffer* buffer, const char* text, size_t length) {
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+}
+
+static void weather_archive_put_int(weather_archive_buffer* buffer, int32_t value) {
+    char digits[12];
+    int length = 0;
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    do {
+        digits[sizeof(digits) - 1 - length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) digits[sizeof(digits) - 1 - length++] = '-';
+    weather_archive_put(buffer, digits + sizeof(digits) - length, (size_t)length);
+}
+
+static void weather_archive_put_real(weather_archive_buffer* buffer, double value) {
+    char text[REAL_FORMAT_SIZE];
+    int length = real_format(value, text);
+    weather_archive_put(buffer, text, (size_t)length);
+}
+
+// The samples of every day, column by column
+typedef struct {
+    int count;
+    int capacity;
+    int64_t* times;
+    int32_t* values[WEATHER_ARCHIVE_MEASUREMENTS];
+} weather_archive_range;
+
+static int weather_archive_gather(weather_archive_range* range, const weather_archive_day* day, int32_t number,
+                                  time_t from, time_t to) {
+    int first = 0;
+    int last = day->count;
+    int64_t base = (int64_t)number * WEATHER_ARCHIVE_DAY_SECONDS;
+    while (first < last && base + day->values[0][first] < from) first++;
+    while (last > first && base + day->values[0][last - 1] > to) last--;
+    int count = last - first;
+    if (count == 0) return 0;
+
+    if (range->count + count > range->capacity) {
+        int capacity = range->capacity ? range->capacity * 2 : Weather_ARCHIVE_DAY_SAMPLES;
+        while (capacity < range->count + count) capacity *= 2;
+        int64_t* times = (int64_t*)realloc(range->times, (size_t)capacity * sizeof(int64_t));
+        if (!times) return -1;
+        range->times = times;
+        for (int i = 0; i < WEATHER_ARCHIVE_MEASUREMENTS; i++) {
+            int32_t* values = (int32_t*)realloc(range->values[i], (size_t)capacity * sizeof(int32_t));
+            if (!values) return -1;
+            range->values[i] = values;
+        }
+        range->capacity = capacity;
+    }
+    for (int i = 0; i < count; i++) range->times[range->count + i] = base + day->values[0][first + i];
+    for (int i = 0; i < WEATHER_ARCHIVE_MEASUREMENTS; i++) {
+        memcpy(&range->values[i][range->count], &day->values[i + 1][first], (size_t)count * sizeof(int32_t));
+    }
+    range->count += count;
+    return 0;
+}
+
+static void weather_archive_range_free(weather_archive_range* range) {
+    free(range->times);
+    for (int i = 0; i < WEATHER_ARCHIVE_MEASUREMENTS; i++) free(range->values[i]);
+}
+
+static int weather_archive_format(const weather_archive_range* range, double latitude, double longitude,
+                                  weather_archive_buffer* buffer) {
+    // A time is 19 bytes with its quotes and comma, a value at most 26;
+    // the names and the location on top
+    size_t size = 256 + (size_t)range->count * (19 + 26 * WEATHER_ARCHIVE_MEASUREMENTS);
+    for (int i = 0; i < WEATHER_ARCHIVE_MEASUREMENTS; i++) size += strlen(g_archiveColumns[i].name) + 8;
+    if (weather_archive_reserve(buffer, size) != 0) return -1;
+
+    weather_archive_put(buffer, "{\"latitude\":", 12);
+    weather_archive_put_real(buffer, latitude);
+    weather_archive_put(buffer, ",\"longitude\":", 13);
+    weather_archive_put_real(buffer, longitude);
+    weather_archive_put(buffer, ",\"count\":", 9);
+    weather_archive_put_int(buffer, range->count);
+    weather_archive_put(buffer, ",\"time\":[", 9);
+    for (int i = 0; i < range->count; i++) {
+        time_t when = (time_t)range->times[i];
+        struct tm tm;
+        gmtime_r(&when, &tm);
+        char text[24];
+        int length = snprintf(text, sizeof(text), "%s\"%04d-%02d-%02dT%02d:%02d\"", i ? "," : "", tm.tm_year + 1900,
+                              tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min);
+        weather_archive_put(buffer, text, (size_t)length);
+    }
+    weather_archive_put(buffer, "]", 1);
+    for (int column = 0; column < WEATHER_ARCHIVE_MEASUREMENTS; column++) {
+        const char* name = g_archiveColumns[column].name;
+        weather_archive_put(buffer, ",\"", 2);
+        weather_archive_put(buffer, name, strlen(name));
+        weather_archive_put(buffer, "\":[", 3);
+        const int32_t* values = range->values[column];
+        for (int i = 0; i < range->count; i++) {
+            if (i) weather_archive_put(buffer, ",", 1);
+            // Divided, not multiplied by 0.01: the quotient is the double
+            // nearest to the decimal, which prints as it was reported
+            if (g_archiveColumns[column].real) {
+                weather_archive_put_real(buffer, values[i] / WEATHER_ARCHIVE_REAL_SCALE);
+            } else {
+                weather_archive_put_int(buffer, values[i]);
+            }
+        }
+        weather_archive_put(buffer, "]", 1);
+    }
+    weather_archive_put(buffer, "}", 1);
+    buffer->data[buffer->length] = '\0';
+    return 0;
+}
+
+int weather_archive_query(double latitude, double longitude, time_t from, time_t to, char** body, size_t* length) {
+    if (to - from > (time_t)Weather_ARCHIVE_RETAIN_DAYS * WEATHER_ARCHIVE_DAY_SECONDS) {
+        from = to - (time_t)Weather_ARCHIVE_RETAIN_DAYS * WEATHER_ARCHIVE_DAY_SECONDS;
+    }
+    int32_t lat = weather_archive_micro(latitude);
+    int32_t lon = weather_archive_micro(longitude);
+    uint64_t key = weather_archive_key(lat, lon);
+
+    weather_archive_day* day = (weather_archive_day*)malloc(sizeof(weather_archive_day));
+    if (!day) return -1;
+    weather_archive_range range;
+    memset(&range, 0, sizeof(range));
+    int result = 0;
+    for (int32_t number = weather_archive_day_of(from); g_archive && number <= weather_archive_day_of(to); number++) {
+        uint8_t* chunk = NULL;
+        size_t chunk_length = 0;
+        time_t stamp;
+        if (record_store_get(g_archive, key, weather_archive_slot(number), &chunk, &chunk_length, &stamp) != 0) continue;
+        weather_archive_decode(chunk, chunk_length, number, lat, lon, day);
+        free(chunk);
+        if (weather_archive_gather(&range, day, number, from, to) != 0) {
+            result = -1;
+            break;
+        }
+    }
+    free(day);
+
+    weather_archive_buffer buffer = {NULL, 0, 0};
+    if (result == 0) result = weather_archive_format(&range, latitude, longitude, &buffer);
+    weather_archive_range_free(&range);
+    if (result != 0) {
+        free(buffer.data);
+        return -1;
+    }
+    *body = buffer.data;
+    *length = buffer.length;
+    return 0;
+}
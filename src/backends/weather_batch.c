@@ -0,0 +1,247 @@
+#include "backends/weather_batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "global_defines.h"
+#include "utilities/cache_only.h"
+#include "utilities/logger.h"
+#include "utilities/probes.h"
+
+// Disk jobs, the locations are only touched by the pool thread while one is in flight
+
+static void weather_batch_load_job_work(void* ctx) {
+    weather_batch_t* batch = (weather_batch_t*)ctx;
+    for (int i = 0; i < batch->count; i++) {
+        weather_batch_location* location = &batch->locations[i];
+        if (location->body) continue;
+        long int stamp;
+        if (weather_cache_time(location->latitude, location->longitude, &stamp) != 0 ||
+            time(NULL) > weather_fresh_until((time_t)stamp)) {
+            continue;
+        }
+        load_weather_from_cache(location->latitude, location->longitude, &location->body);
+    }
+}
+
+static void weather_batch_load_job_done(void* ctx) {
+    weather_batch_t* batch = (weather_batch_t*)ctx;
+    batch->job = NULL;
+    batch->state = WeatherBatch_State_FetchFromAPI_Init;
+    batch->on_wake(batch->ctx);
+}
+
+static void weather_batch_process_job_work(void* ctx) {
+    weather_batch_t* batch = (weather_batch_t*)ctx;
+    weather_transform_batch(batch->flight.body, batch->fetch_count, batch->fetched, batch->records,
+                            batch->record_lengths);
+}
+
+// Every location the response had goes into the caches, on the loop
+static void weather_batch_process_job_done(void* ctx) {
+    weather_batch_t* batch = (weather_batch_t*)ctx;
+    batch->job = NULL;
+    for (int i = 0; i < batch->fetch_count; i++) {
+        weather_batch_location* location = &batch->locations[batch->fetch[i]];
+        if (!batch->fetched[i]) continue;
+        // Requests that shared the fetch leave the write to the first of them
+        weather_store_fetched(location->latitude, location->longitude, batch->fetched[i], batch->records[i],
+                              batch->record_lengths[i], batch->flight.primary);
+        batch->records[i] = NULL;
+        location->body = batch->fetched[i];
+        batch->fetched[i] = NULL;
+    }
+    batch->state = WeatherBatch_State_Done;
+    batch->on_wake(batch->ctx);
+}
+
+// The comma separated coordinates of the locations still missing
+static int weather_batch_url(weather_batch_t* batch, char* url, size_t size) {
+    char latitudes[Weather_BATCH_MAX_LOCATIONS * 16];
+    char longitudes[Weather_BATCH_MAX_LOCATIONS * 16];
+    size_t lat_length = 0;
+    size_t lon_length = 0;
+    batch->fetch_count = 0;
+    for (int i = 0; i < batch->count; i++) {
+        const weather_batch_location* location = &batch->locations[i];
+        if (location->body) continue;
+        const char* separator = batch->fetch_count ? "," : "";
+        lat_length += snprintf(latitudes + lat_length, sizeof(latitudes) - lat_length, "%s%.6f", separator,
+                               location->latitude);
+        lon_length += snprintf(longitudes + lon_length, sizeof(longitudes) - lon_length, "%s%.6f", separator,
+                               location->longitude);
+        batch->fetch[batch->fetch_count++] = i;
+    }
+    if (batch->fetch_count == 0) return -1;
+    int length = snprintf(url, size, METEO_FORECAST_BATCH_URL, weather_api_url(), latitudes, longitudes);
+    return length > 0 && (size_t)length < size ? 0 : -1;
+}
+
+static int weather_batch_build_buffer(weather_batch_t* batch) {
+    size_t size = 3;
+    for (int i = 0; i < batch->count; i++) {
+        size += (batch->locations[i].body ? strlen(batch->locations[i].body) : 4) + 1;
+    }
+    char* buffer = (char*)malloc(size);
+    if (!buffer) return -1;
+
+    size_t length = 0;
+    buffer[length++] = '[';
+    for (int i = 0; i < batch->count; i++) {
+        const char* body = batch->locations[i].body ? batch->locations[i].body : "null";
+        size_t body_length = strlen(body);
+        if (i) buffer[length++] = ',';
+        memcpy(buffer + length, body, body_length);
+        length += body_length;
+    }
+    buffer[length++] = ']';
+    buffer[length] = '\0';
+    batch->buffer = buffer;
+    return 0;
+}
+
+static void weather_batch_free(void* ctx) {
+    weather_batch_t* batch = (weather_batch_t*)ctx;
+
+    single_flight_leave(&batch->flight);
+    free(batch->flight.body);
+    for (int i = 0; i < batch->count; i++) free(batch->locations[i].body);
+    for (int i = 0; i < batch->fetch_count; i++) {
+        free(batch->fetched[i]);
+        free(batch->records[i]);
+    }
+    free(batch->buffer);
+
+    free(batch);
+}
+
+// Function implementations
+
+int weather_batch_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context)) {
+    weather_batch_t* batch = (weather_batch_t*)calloc(1, sizeof(weather_batch_t));
+    if (!batch) return -1;
+    batch->ctx = ctx;
+    batch->on_done = ondone;
+    batch->on_wake = onwake;
+    batch->state = WeatherBatch_State_Init;
+    *ctx_struct = (void*)batch;
+
+    return 0;
+}
+
+int weather_batch_add_location(void** ctx, double latitude, double longitude) {
+    weather_batch_t* batch = (weather_batch_t*)(*ctx);
+    if (!batch || batch->count >= Weather_BATCH_MAX_LOCATIONS) return -1;
+    batch->locations[batch->count].latitude = latitude;
+    batch->locations[batch->count].longitude = longitude;
+    batch->count++;
+
+    return 0;
+}
+
+int weather_batch_work(void** ctx) {
+    weather_batch_t* batch = (weather_batch_t*)(*ctx);
+    if (!batch) return -1;
+
+    PROBE3(backend_state, "weather_batch", batch, (int)batch->state);
+    switch (batch->state) {
+    case WeatherBatch_State_Init: {
+        // What this loop sent lately needs neither disk nor upstream
+        int missing = 0;
+        for (int i = 0; i < batch->count; i++) {
+            weather_batch_location* location = &batch->locations[i];
+            weather_hot_hit hit;
+            if (weather_hot_lookup(location->latitude, location->longitude, COMPRESS_IDENTITY, &hit) != 0) {
+                missing++;
+                continue;
+            }
+            if (hit.stale) weather_refresh(location->latitude, location->longitude);
+            location->body = strndup((const char*)hit.body, hit.length);
+            if (!location->body) missing++;
+        }
+        if (missing == 0) {
+            batch->state = WeatherBatch_State_Done;
+            break;
+        }
+        batch->job = job_pool_submit(weather_batch_load_job_work, weather_batch_load_job_done, batch);
+        batch->state = batch->job ? WeatherBatch_State_LoadFromDisk : WeatherBatch_State_FetchFromAPI_Init;
+        break;
+    }
+    case WeatherBatch_State_LoadFromDisk:
+        // Waiting for weather_batch_load_job_done
+        return BACKEND_WORK_WAIT;
+    case WeatherBatch_State_FetchFromAPI_Init: {
+        char url[Weather_BATCH_MAX_LOCATIONS * 32 + 512];
+        // Cache only, the locations missing come out as null
+        if (weather_batch_url(batch, url, sizeof(url)) != 0 || (!cache_only_allows_fetch(url) && !single_flight_running(url)) ||
+            single_flight_join(&batch->flight, url, batch->on_wake, batch->ctx) != 0) {
+            batch->state = WeatherBatch_State_Done;
+            break;
+        }
+        batch->state = WeatherBatch_State_FetchFromAPI_Poll;
+        LOG_DEBUG("WeatherBatch: Fetching %d of %d locations from API", batch->fetch_count, batch->count);
+        break;
+    }
+    case WeatherBatch_State_FetchFromAPI_Poll:
+        switch (single_flight_poll(&batch->flight)) {
+        case SINGLE_FLIGHT_RUNNING:
+            return BACKEND_WORK_POLL;
+        case SINGLE_FLIGHT_WAITING:
+            // Another request for the same locations fetches them
+            return BACKEND_WORK_WAIT;
+        case SINGLE_FLIGHT_DONE:
+            if (!batch->flight.body) {
+                batch->state = WeatherBatch_State_Done;
+                break;
+            }
+            batch->job = job_pool_submit(weather_batch_process_job_work, weather_batch_process_job_done, batch);
+            if (batch->job) {
+                batch->state = WeatherBatch_State_Processing;
+                break;
+            }
+            // Pool unavailable, transform on the loop
+            weather_batch_process_job_work(batch);
+            weather_batch_process_job_done(batch);
+            break;
+        default:
+            batch->state = WeatherBatch_State_Done;
+            break;
+        }
+        break;
+    case WeatherBatch_State_Processing:
+        // Waiting for weather_batch_process_job_done
+        return BACKEND_WORK_WAIT;
+    case WeatherBatch_State_Done:
+        if (!batch->buffer) weather_batch_build_buffer(batch);
+        batch->on_done(batch->ctx);
+        LOG_DEBUG("WeatherBatch: Done");
+        return BACKEND_WORK_WAIT;
+    }
+
+    return BACKEND_WORK_AGAIN;
+}
+
+int weather_batch_get_buffer(void** ctx, char** buffer) {
+    weather_batch_t* batch = (weather_batch_t*)(*ctx);
+    if (!batch) return -1;
+    *buffer = batch->buffer;
+    return 0;
+}
+
+int weather_batch_dispose(void** ctx) {
+    weather_batch_t* batch = (weather_batch_t*)(*ctx);
+    if (!batch) return -1;
+
+    // A job still uses the struct, it is freed once the job finishes
+    single_flight_leave(&batch->flight);
+    if (batch->job) {
+        job_pool_abandon(batch->job, weather_batch_free);
+    } else {
+        weather_batch_free(batch);
+    }
+    *ctx = NULL;
+
+    return 0;
+}
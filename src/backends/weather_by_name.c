@@ -0,0 +1,188 @@
+#include "backends/weather_by_name.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_defines.h"
+#include "utilities/json_scan.h"
+#include "utilities/logger.h"
+#include "utilities/probes.h"
+
+// The inner backends report to these, the server only knows this one. Done
+// wakes the server too, it may come from a job finishing.
+
+static void weather_by_name_inner_done(void* ctx) {
+    weather_by_name_t* byname = (weather_by_name_t*)ctx;
+    byname->inner_done = 1;
+    byname->on_wake(byname->ctx);
+}
+
+static void weather_by_name_inner_wake(void* ctx) {
+    weather_by_name_t* byname = (weather_by_name_t*)ctx;
+    byname->on_wake(byname->ctx);
+}
+
+// The first result of the search body, its text kept as it is; -1 if it has none
+static int weather_by_name_take_location(weather_by_name_t* byname, const char* results) {
+    json_scan scan;
+    json_scan_init(&scan, results, strlen(results));
+    if (json_scan_array_begin(&scan) != 0 || json_scan_array_next(&scan) != 1) return -1;
+    size_t start = json_scan_tell(&scan);
+    int found = 0;
+    if (json_scan_object_begin(&scan) != 0) return -1;
+    const char* key;
+    size_t length;
+    while (json_scan_object_next(&scan, &key, &length) == 1) {
+        if (json_scan_key_is(key, length, "latitude")) {
+            found |= json_scan_number(&scan, &byname->latitude) == 0 ? 1 : 0;
+        } else if (json_scan_key_is(key, length, "longitude")) {
+            found |= json_scan_number(&scan, &byname->longitude) == 0 ? 2 : 0;
+        } else {
+            json_scan_skip(&scan);
+        }
+    }
+    if (scan.failed || found != 3) return -1;
+    byname->location = strndup(results + start, json_scan_tell(&scan) - start);
+    return byname->location ? 0 : -1;
+}
+
+static int weather_by_name_build_buffer(weather_by_name_t* byname) {
+    const char* location = byname->location ? byname->location : "null";
+    const char* forecast = byname->forecast ? byname->forecast : "null";
+    size_t size = strlen("{\"location\":,\"weather\":}") + strlen(location) + strlen(forecast) + 1;
+    byname->buffer = (char*)malloc(size);
+    if (!byname->buffer) return -1;
+    snprintf(byname->buffer, size, "{\"location\":%s,\"weather\":%s}", location, forecast);
+    return 0;
+}
+
+// Function implementations
+
+int weather_by_name_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context)) {
+    weather_by_name_t* byname = (weather_by_name_t*)calloc(1, sizeof(weather_by_name_t));
+    if (!byname) return -1;
+    byname->ctx = ctx;
+    byname->on_done = ondone;
+    byname->on_wake = onwake;
+    *ctx_struct = (void*)byname;
+
+    return 0;
+}
+
+int weather_by_name_set_parameters(void** ctx, const char* name, const char* country_code) {
+    weather_by_name_t* byname = (weather_by_name_t*)(*ctx);
+    if (!byname || byname->geolocation) return -1;
+    if (geolocation_init((void**)byname, &byname->geolocation, weather_by_name_inner_done,
+                         weather_by_name_inner_wake) != 0) {
+        byname->geolocation = NULL;
+        return -1;
+    }
+    // Only the best match is forecast, the search takes its own copies
+    geolocation_set_parameters(&byname->geolocation, (char*)name, 1, (char*)country_code);
+    // The forecast is asked for right after, not left to a guess
+    geolocation_set_prefetch(&byname->geolocation, 0);
+    if (byname->trace) geolocation_set_trace(&byname->geolocation, byname->trace);
+
+    return 0;
+}
+
+int weather_by_name_work(void** ctx) {
+    weather_by_name_t* byname = (weather_by_name_t*)(*ctx);
+    if (!byname) return -1;
+
+    PROBE3(backend_state, "weather_by_name", byname, CO_LINE(&byname->co));
+    CO_BEGIN(&byname->co);
+    if (!byname->geolocation) goto done;
+
+    CO_AWAIT(&byname->co, byname->inner_done, geolocation_work(&byname->geolocation));
+    byname->inner_done = 0;
+    byname->cache = geolocation_get_cache_outcome(&byname->geolocation);
+    char* results = NULL;
+    geolocation_get_buffer(&byname->geolocation, &results);
+    // Not found is an answer, a failed search is not
+    if (!results) goto done;
+    if (weather_by_name_take_location(byname, results) != 0) {
+        weather_by_name_build_buffer(byname);
+        goto done;
+    }
+    geolocation_dispose(&byname->geolocation);
+    weather_quantize(&byname->latitude, &byname->longitude);
+    LOG_DEBUG("WeatherByName: Found %f, %f", byname->latitude, byname->longitude);
+
+    // Sent lately, nothing to run
+    weather_hot_hit hit;
+    if (weather_hot_lookup(byname->latitude, byname->longitude, COMPRESS_IDENTITY, &hit) == 0 &&
+        hit.encoding == COMPRESS_IDENTITY) {
+        if (hit.stale) weather_refresh(byname->latitude, byname->longitude);
+        byname->cache = hit.stale ? ACCESS_CACHE_STALE : ACCESS_CACHE_HOT;
+        byname->forecast = strndup((const char*)hit.body, hit.length);
+        weather_by_name_build_buffer(byname);
+        goto done;
+    }
+    if (weather_init((void**)byname, &byname->weather, weather_by_name_inner_done, weather_by_name_inner_wake) != 0) {
+        byname->weather = NULL;
+        weather_by_name_build_buffer(byname);
+        goto done;
+    }
+    weather_set_location(&byname->weather, byname->latitude, byname->longitude);
+    weather_set_encoding(&byname->weather, COMPRESS_IDENTITY);
+    if (byname->trace) weather_set_trace(&byname->weather, byname->trace);
+
+    CO_AWAIT(&byname->co, byname->inner_done, weather_work(&byname->weather));
+    byname->inner_done = 0;
+    byname->cache = weather_get_cache_outcome(&byname->weather);
+    // Cache only and nothing cached, the server answers 503 for it
+    if (byname->cache != ACCESS_CACHE_UNAVAILABLE) {
+        char* forecast = NULL;
+        compress_encoding encoding = COMPRESS_IDENTITY;
+        const response_blob* blob = weather_get_blob(&byname->weather, &encoding);
+        if (blob && encoding == COMPRESS_IDENTITY) {
+            byname->forecast = strndup((const char*)blob->bodies[encoding], blob->lengths[encoding]);
+        } else if (weather_get_buffer(&byname->weather, &forecast) == 0 && forecast) {
+            byname->forecast = strdup(forecast);
+        }
+        weather_by_name_build_buffer(byname);
+    }
+    weather_dispose(&byname->weather);
+
+done:
+    byname->on_done(byname->ctx);
+    LOG_DEBUG("WeatherByName: Done");
+    CO_END(&byname->co);
+
+    return BACKEND_WORK_WAIT;
+}
+
+int weather_by_name_get_buffer(void** ctx, char** buffer) {
+    weather_by_name_t* byname = (weather_by_name_t*)(*ctx);
+    if (!byname) return -1;
+    *buffer = byname->buffer;
+    return 0;
+}
+
+access_cache weather_by_name_get_cache_outcome(void** ctx) {
+    weather_by_name_t* byname = (weather_by_name_t*)(*ctx);
+    return byname ? byname->cache : ACCESS_CACHE_NONE;
+}
+
+void weather_by_name_set_trace(void** ctx, trace_context* trace) {
+    weather_by_name_t* byname = (weather_by_name_t*)(*ctx);
+    if (byname) byname->trace = trace;
+}
+
+int weather_by_name_dispose(void** ctx) {
+    weather_by_name_t* byname = (weather_by_name_t*)(*ctx);
+    if (!byname) return -1;
+
+    // Each frees itself once the job it may still have in flight finishes
+    if (byname->geolocation) geolocation_dispose(&byname->geolocation);
+    if (byname->weather) weather_dispose(&byname->weather);
+    free(byname->location);
+    free(byname->forecast);
+    free(byname->buffer);
+    free(byname);
+    *ctx = NULL;
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "backends/weather_history.h"
+
+#include <stdlib.h>
+
+#include "utilities/logger.h"
+#include "utilities/probes.h"
+
+static void weather_history_read_job_work(void* ctx) {
+    weather_history_t* history = (weather_history_t*)ctx;
+    if (weather_archive_query(history->latitude, history->longitude, history->from, history->to, &history->buffer,
+                              &history->length) != 0) {
+        history->buffer = NULL;
+    }
+}
+
+static void weather_history_read_job_done(void* ctx) {
+    weather_history_t* history = (weather_history_t*)ctx;
+    history->job = NULL;
+    history->on_wake(history->ctx);
+}
+
+static void weather_history_free(void* ctx) {
+    weather_history_t* history = (weather_history_t*)ctx;
+    free(history->buffer);
+    free(history);
+}
+
+int weather_history_init(void** ctx, void** ctx_struct, void (*ondone)(void* context), void (*onwake)(void* context)) {
+    weather_history_t* history = (weather_history_t*)calloc(1, sizeof(weather_history_t));
+    if (!history) return -1;
+    history->ctx = ctx;
+    history->on_done = ondone;
+    history->on_wake = onwake;
+    *ctx_struct = (void*)history;
+
+    return 0;
+}
+
+int weather_history_set_range(void** ctx, double latitude, double longitude, time_t from, time_t to) {
+    weather_history_t* history = (weather_history_t*)(*ctx);
+    if (!history) return -1;
+    history->latitude = latitude;
+    history->longitude = longitude;
+    history->from = from;
+    history->to = to;
+
+    return 0;
+}
+
+int weather_history_work(void** ctx) {
+    weather_history_t* history = (weather_history_t*)(*ctx);
+    if (!history) return -1;
+
+    PROBE3(backend_state, "weather_history", history, CO_LINE(&history->co));
+    CO_BEGIN(&history->co);
+    history->job = job_pool_submit(weather_history_read_job_work, weather_history_read_job_done, history);
+    if (history->job) {
+        // Until weather_history_read_job_done
+        CO_AWAIT(&history->co, !history->job, BACKEND_WORK_WAIT);
+    } else {
+        // Pool unavailable, read on the loop
+        weather_history_read_job_work(history);
+    }
+    history->on_done(history->ctx);
+    LOG_DEBUG("WeatherHistory: Done");
+    CO_END(&history->co);
+
+    return BACKEND_WORK_WAIT;
+}
+
+int weather_history_get_buffer(void** ctx, char** buffer) {
+    weather_history_t* history = (weather_history_t*)(*ctx);
+    if (!history) return -1;
+    *buffer = history->buffer;
+    return 0;
+}
+
+access_cache weather_history_get_cache_outcome(void** ctx) {
+    (void)ctx;
+    return ACCESS_CACHE_DISK;
+}
+
+int weather_history_dispose(void** ctx) {
+    weather_history_t* history = (weather_history_t*)(*ctx);
+    if (!history) return -1;
+
+    // A job still uses the struct, it is freed once the job finishes
+    if (history->job) {
+        job_pool_abandon(history->job, weather_history_free);
+    } else {
+        weather_history_free(history);
+    }
+    *ctx = NULL;
+
+    return 0;
+}
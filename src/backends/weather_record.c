@@ -0,0 +1,311 @@
+#include "backends/weather_record.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/string_intern.h"
+
+// magic, version, unit count, body length, strings length, series length
+#define WEATHER_RECORD_HEADER_SIZE 20
+// count, step and start in front of each series' columns
+#define WEATHER_RECORD_SERIES_HEADER_SIZE 16
+// Length of a NULL string, anything this long or longer is not stored
+#define WEATHER_RECORD_STRING_NULL 0xFFFF
+#define WEATHER_RECORD_UNIT_NULL 0
+#define WEATHER_RECORD_UNIT_LITERAL 0xFF
+
+static const size_t weather_record_doubles[] = {
+    offsetof(weather_data_t, latitude),         offsetof(weather_data_t, longitude),
+    offsetof(weather_data_t, generationtime_ms), offsetof(weather_data_t, elevation),
+    offsetof(weather_data_t, temperature_2m),   offsetof(weather_data_t, apparent_temperature),
+    offsetof(weather_data_t, precipitation),    offsetof(weather_data_t, rain),
+    offsetof(weather_data_t, showers),          offsetof(weather_data_t, snowfall),
+    offsetof(weather_data_t, pressure_msl),     offsetof(weather_data_t, surface_pressure),
+    offsetof(weather_data_t, wind_speed_10m),   offsetof(weather_data_t, wind_gusts_10m),
+};
+
+static const size_t weather_record_ints[] = {
+    offsetof(weather_data_t, utc_offset_seconds), offsetof(weather_data_t, interval),
+    offsetof(weather_data_t, relative_humidity_2m), offsetof(weather_data_t, is_day),
+    offsetof(weather_data_t, weather_code),       offsetof(weather_data_t, cloud_cover),
+    offsetof(weather_data_t, wind_direction_10m),
+};
+
+static const size_t weather_record_units[] = {
+    offsetof(weather_data_t, unit_time),                 offsetof(weather_data_t, unit_interval),
+    offsetof(weather_data_t, unit_temperature_2m),       offsetof(weather_data_t, unit_relative_humidity_2m),
+    offsetof(weather_data_t, unit_apparent_temperature), offsetof(weather_data_t, unit_is_day),
+    offsetof(weather_data_t, unit_precipitation),        offsetof(weather_data_t, unit_rain),
+    offsetof(weather_data_t, unit_showers),              offsetof(weather_data_t, unit_snowfall),
+    offsetof(weather_data_t, unit_weather_code),         offsetof(weather_data_t, unit_cloud_cover),
+    offsetof(weather_data_t, unit_pressure_msl),         offsetof(weather_data_t, unit_surface_pressure),
+    offsetof(weather_data_t, unit_wind_speed_10m),       offsetof(weather_data_t, unit_wind_direction_10m),
+    offsetof(weather_data_t, unit_wind_gusts_10m),
+};
+
+// Everything open-meteo reports the current block in, index + 1 is stored.
+// Append only, the index is part of the format.
+static const char* const weather_record_unit_names[] = {
+    "iso8601", "seconds", "°C", "%", "mm", "cm", "wmo code", "hPa", "km/h", "°", "", "°F", "inch", "mp/h", "m/s", "kn",
+};
+
+static const size_t weather_record_strings[] = {
+    offsetof(weather_data_t, timezone),
+    offsetof(weather_data_t, timezone_abbreviation),
+    offsetof(weather_data_t, time),
+};
+
+#define WEATHER_RECORD_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+#define WEATHER_RECORD_FIXED_SIZE                                                                                        \
+    (WEATHER_RECORD_HEADER_SIZE + WEATHER_RECORD_COUNT(weather_record_doubles) * sizeof(double) +                       \
+     WEATHER_RECORD_COUNT(weather_record_ints) * sizeof(int32_t) + WEATHER_RECORD_COUNT(weather_record_units))
+
+#define WEATHER_FIELD(weather, offset, type) (*(type*)((char*)(weather) + (offset)))
+
+static const weather_series_t* weather_record_series(const weather_data_t* weather, int kind) {
+    return kind == WEATHER_SERIES_HOURLY ? &weather->hourly : &weather->daily;
+}
+
+static size_t weather_record_series_size(const weather_series_t* series, int kind) {
+    return WEATHER_RECORD_SERIES_HEADER_SIZE + (size_t)series->count * weather_series_variables(kind) * sizeof(float);
+}
+
+static uint8_t weather_record_unit_index(const char* unit) {
+    if (!unit) return WEATHER_RECORD_UNIT_NULL;
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_unit_names); i++) {
+        if (strcmp(unit, weather_record_unit_names[i]) == 0) return (uint8_t)(i + 1);
+    }
+    return WEATHER_RECORD_UNIT_LITERAL;
+}
+
+static size_t weather_record_string_size(const char* string) {
+    return sizeof(uint16_t) + (string ? strlen(string) : 0);
+}
+
+static uint8_t* weather_record_put_string(uint8_t* cursor, const char* string) {
+    uint16_t length = string ? (uint16_t)strlen(string) : WEATHER_RECORD_STRING_NULL;
+    memcpy(cursor, &length, sizeof(length));
+    cursor += sizeof(length);
+    if (string) {
+        memcpy(cursor, string, strlen(string));
+        cursor += strlen(string);
+    }
+    return cursor;
+}
+
+// A copy of the next string in [*cursor, end), NULL for a stored NULL.
+// -1 if it runs past end or out of memory.
+static int weather_record_get_string(const uint8_t** cursor, const uint8_t* end, char** string) {
+    uint16_t length;
+    if (end - *cursor < (ptrdiff_t)sizeof(length)) return -1;
+    memcpy(&length, *cursor, sizeof(length));
+    *cursor += sizeof(length);
+    *string = NULL;
+    if (length == WEATHER_RECORD_STRING_NULL) return 0;
+    if (end - *cursor < (ptrdiff_t)length) return -1;
+
+    *string = (char*)malloc(length + 1);
+    if (!*string) return -1;
+    memcpy(*string, *cursor, length);
+    (*string)[length] = '\0';
+    *cursor += length;
+    return 0;
+}
+
+int weather_record_encode(const weather_data_t* weather, const char* body, size_t body_length, uint8_t** record,
+                          size_t* length) {
+    if (!weather || !body || !record || !length || body_length > UINT32_MAX) return -1;
+
+    uint8_t units[WEATHER_RECORD_COUNT(weather_record_units)];
+    size_t strings_length = 0;
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_strings); i++) {
+        const char* string = WEATHER_FIELD(weather, weather_record_strings[i], char*);
+        if (string && strlen(string) >= WEATHER_RECORD_STRING_NULL) return -1;
+        strings_length += weather_record_string_size(string);
+    }
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_units); i++) {
+        const char* unit = WEATHER_FIELD(weather, weather_record_units[i], const char*);
+        units[i] = weather_record_unit_index(unit);
+        if (units[i] != WEATHER_RECORD_UNIT_LITERAL) continue;
+        if (strlen(unit) >= WEATHER_RECORD_STRING_NULL) return -1;
+        strings_length += weather_record_string_size(unit);
+    }
+
+    size_t series_length = 0;
+    for (int kind = 0; kind < WEATHER_SERIES_KINDS; kind++) {
+        series_length += weather_record_series_size(weather_record_series(weather, kind), kind);
+    }
+    if (series_length > UINT32_MAX) return -1;
+
+    size_t size = WEATHER_RECORD_FIXED_SIZE + strings_length + series_length + body_length + 1;
+    uint8_t* data = (uint8_t*)malloc(size);
+    if (!data) return -1;
+
+    uint32_t magic = WEATHER_RECORD_MAGIC;
+    uint16_t version = WEATHER_RECORD_VERSION;
+    uint16_t unit_count = (uint16_t)WEATHER_RECORD_COUNT(weather_record_units);
+    uint32_t body_size = (uint32_t)body_length;
+    uint32_t strings_size = (uint32_t)strings_length;
+    uint32_t series_size = (uint32_t)series_length;
+    uint8_t* cursor = data;
+    memcpy(cursor, &magic, sizeof(magic));
+    cursor += sizeof(magic);
+    memcpy(cursor, &version, sizeof(version));
+    cursor += sizeof(version);
+    memcpy(cursor, &unit_count, sizeof(unit_count));
+    cursor += sizeof(unit_count);
+    memcpy(cursor, &body_size, sizeof(body_size));
+    cursor += sizeof(body_size);
+    memcpy(cursor, &strings_size, sizeof(strings_size));
+    cursor += sizeof(strings_size);
+    memcpy(cursor, &series_size, sizeof(series_size));
+    cursor += sizeof(series_size);
+
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_doubles); i++) {
+        memcpy(cursor, &WEATHER_FIELD(weather, weather_record_doubles[i], double), sizeof(double));
+        cursor += sizeof(double);
+    }
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_ints); i++) {
+        int32_t value = WEATHER_FIELD(weather, weather_record_ints[i], int);
+        memcpy(cursor, &value, sizeof(value));
+        cursor += sizeof(value);
+    }
+    memcpy(cursor, units, sizeof(units));
+    cursor += sizeof(units);
+
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_strings); i++) {
+        cursor = weather_record_put_string(cursor, WEATHER_FIELD(weather, weather_record_strings[i], char*));
+    }
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_units); i++) {
+        if (units[i] == WEATHER_RECORD_UNIT_LITERAL) {
+            cursor = weather_record_put_string(cursor, WEATHER_FIELD(weather, weather_record_units[i], char*));
+        }
+    }
+
+    for (int kind = 0; kind < WEATHER_SERIES_KINDS; kind++) {
+        const weather_series_t* series = weather_record_series(weather, kind);
+        int32_t count = series->count;
+        size_t values = (size_t)series->count * weather_series_variables(kind) * sizeof(float);
+        memcpy(cursor, &count, sizeof(count));
+        memcpy(cursor + 4, &series->step, sizeof(series->step));
+        memcpy(cursor + 8, &series->start, sizeof(series->start));
+        cursor += WEATHER_RECORD_SERIES_HEADER_SIZE;
+        if (values) memcpy(cursor, series->values, values);
+        cursor += values;
+    }
+
+    memcpy(cursor, body, body_length);
+    cursor[body_length] = '\0';
+
+    *record = data;
+    *length = size;
+    return 0;
+}
+
+// Validates the header, the sections it describes must fill record exactly
+static int weather_record_layout(const uint8_t* record, size_t length, uint32_t* body_length,
+                                 uint32_t* strings_length, uint32_t* series_length) {
+    if (!record || length < WEATHER_RECORD_FIXED_SIZE + 1) return -1;
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t unit_count;
+    memcpy(&magic, record, sizeof(magic));
+    memcpy(&version, record + 4, sizeof(version));
+    memcpy(&unit_count, record + 6, sizeof(unit_count));
+    memcpy(body_length, record + 8, sizeof(*body_length));
+    memcpy(strings_length, record + 12, sizeof(*strings_length));
+    memcpy(series_length, record + 16, sizeof(*series_length));
+    if (magic != WEATHER_RECORD_MAGIC || version != WEATHER_RECORD_VERSION ||
+        unit_count != WEATHER_RECORD_COUNT(weather_record_units)) {
+        return -1;
+    }
+    if ((uint64_t)WEATHER_RECORD_FIXED_SIZE + *strings_length + *series_length + *body_length + 1 != length) return -1;
+    return record[length - 1] == '\0' ? 0 : -1;
+}
+
+int weather_record_body(const uint8_t* record, size_t length, const char** body, size_t* body_length) {
+    uint32_t body_size;
+    uint32_t strings_size;
+    uint32_t series_size;
+    if (!body || !body_length || weather_record_layout(record, length, &body_size, &strings_size, &series_size) != 0) {
+        return -1;
+    }
+
+    *body = (const char*)record + WEATHER_RECORD_FIXED_SIZE + strings_size + series_size;
+    *body_length = body_size;
+    return 0;
+}
+
+int weather_record_decode(const uint8_t* record, size_t length, weather_data_t* weather) {
+    uint32_t body_size;
+    uint32_t strings_size;
+    uint32_t series_size;
+    if (!weather || weather_record_layout(record, length, &body_size, &strings_size, &series_size) != 0) return -1;
+
+    memset(weather, 0, sizeof(weather_data_t));
+    const uint8_t* cursor = record + WEATHER_RECORD_HEADER_SIZE;
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_doubles); i++) {
+        memcpy(&WEATHER_FIELD(weather, weather_record_doubles[i], double), cursor, sizeof(double));
+        cursor += sizeof(double);
+    }
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_ints); i++) {
+        int32_t value;
+        memcpy(&value, cursor, sizeof(value));
+        WEATHER_FIELD(weather, weather_record_ints[i], int) = value;
+        cursor += sizeof(value);
+    }
+    const uint8_t* units = cursor;
+    cursor += WEATHER_RECORD_COUNT(weather_record_units);
+
+    const uint8_t* end = cursor + strings_size;
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_strings); i++) {
+        if (weather_record_get_string(&cursor, end, &WEATHER_FIELD(weather, weather_record_strings[i], char*)) != 0) {
+            free_weather(weather);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < WEATHER_RECORD_COUNT(weather_record_units); i++) {
+        const char** unit = &WEATHER_FIELD(weather, weather_record_units[i], const char*);
+        int failed = 0;
+        if (units[i] == WEATHER_RECORD_UNIT_LITERAL) {
+            char* literal = NULL;
+            failed = weather_record_get_string(&cursor, end, &literal) != 0 || !literal ||
+                     !(*unit = string_intern(literal, strlen(literal)));
+            free(literal);
+        } else if (units[i] != WEATHER_RECORD_UNIT_NULL) {
+            const char* name = units[i] > WEATHER_RECORD_COUNT(weather_record_unit_names)
+                                   ? NULL
+                                   : weather_record_unit_names[units[i] - 1];
+            failed = !name || !(*unit = string_intern(name, strlen(name)));
+        }
+        if (failed) {
+            free_weather(weather);
+            return -1;
+        }
+    }
+
+    cursor = end;
+    end = cursor + series_size;
+    for (int kind = 0; kind < WEATHER_SERIES_KINDS; kind++) {
+        weather_series_t* series = kind == WEATHER_SERIES_HOURLY ? &weather->hourly : &weather->daily;
+        int32_t count;
+        if (end - cursor < WEATHER_RECORD_SERIES_HEADER_SIZE) {
+            free_weather(weather);
+            return -1;
+        }
+        memcpy(&count, cursor, sizeof(count));
+        cursor += WEATHER_RECORD_SERIES_HEADER_SIZE;
+        if (count == 0) continue;
+        size_t values = (size_t)count * weather_series_variables(kind) * sizeof(float);
+        if (count < 0 || (size_t)(end - cursor) < values || weather_series_alloc(series, kind, count) != 0) {
+            free_weather(weather);
+            return -1;
+        }
+        memcpy(&series->step, cursor - 12, sizeof(series->step));
+        memcpy(&series->start, cursor - 8, sizeof(series->start));
+        memcpy(series->values, cursor, values);
+        cursor += values;
+    }
+    return 0;
+}
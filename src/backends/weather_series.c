@@ -0,0 +1,275 @@
+#include "backends/weather_series.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    const char* name;
+    // default unit for the variable, nothing overrides it in the request
+    const char* unit;
+} weather_series_variable;
+
+static const weather_series_variable weather_series_hourly[] = {
+    {"temperature_2m", "°C"},        {"relative_humidity_2m", "%"}, {"precipitation_probability", "%"},
+    {"precipitation", "mm"},         {"weather_code", "wmo code"},  {"wind_speed_10m", "km/h"},
+};
+
+static const weather_series_variable weather_series_daily[] = {
+    {"weather_code", "wmo code"},  {"temperature_2m_max", "°C"},          {"temperature_2m_min", "°C"},
+    {"precipitation_sum", "mm"},   {"precipitation_probability_max", "%"}, {"wind_speed_10m_max", "km/h"},
+};
+
+typedef struct {
+    const char* name;
+    const weather_series_variable* variables;
+    int count;
+    // strftime format of the time axis as upstream writes it
+    const char* time_format;
+} weather_series_block;
+
+static const weather_series_block weather_series_blocks[WEATHER_SERIES_KINDS] = {
+    {"hourly", weather_series_hourly, (int)(sizeof(weather_series_hourly) / sizeof(weather_series_hourly[0])),
+     "%Y-%m-%dT%H:%M"},
+    {"daily", weather_series_daily, (int)(sizeof(weather_series_daily) / sizeof(weather_series_daily[0])), "%Y-%m-%d"},
+};
+
+int weather_series_variables(weather_series_kind kind) {
+    return weather_series_blocks[kind].count;
+}
+
+// "2026-01-01T00:00" or "2026-01-01" to seconds, -1 if it is neither
+static int weather_series_time(const char* text, int64_t* seconds) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int minutes = 0;
+    int parsed = sscanf(text, "%d-%d-%dT%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &minutes);
+    if (parsed != 3 && parsed != 5) return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_min = minutes;
+    *seconds = (int64_t)timegm(&tm);
+    return 0;
+}
+
+int weather_series_alloc(weather_series_t* series, weather_series_kind kind, int count) {
+    memset(series, 0, sizeof(weather_series_t));
+    if (count <= 0) return -1;
+    size_t values = (size_t)count * weather_series_blocks[kind].count;
+    series->values = (float*)malloc(values * sizeof(float));
+    if (!series->values) return -1;
+    for (size_t i = 0; i < values; i++) series->values[i] = NAN;
+    series->count = count;
+    return 0;
+}
+
+void weather_series_free(weather_series_t* series) {
+    free(series->values);
+    memset(series, 0, sizeof(weather_series_t));
+}
+
+// The column of variable v, which is next at the scanner, into series
+static void weather_series_column(json_scan* scan, weather_series_t* series, int v) {
+    if (json_scan_peek(scan) != JSON_SCAN_ARRAY) {
+        json_scan_skip(scan);
+        return;
+    }
+    float* values = series->values + (size_t)v * series->count;
+    json_scan_array_begin(scan);
+    for (int i = 0; json_scan_array_next(scan) > 0; i++) {
+        double value;
+        if (i < series->count && json_scan_peek(scan) == JSON_SCAN_NUMBER && json_scan_number(scan, &value) == 0) {
+            values[i] = (float)value;
+        } else {
+            json_scan_skip(scan);
+        }
+    }
+}
+
+// The time array next at the scanner to its axis, -1 if it is not a regular one
+static int weather_series_axis(json_scan* scan, int* count, int64_t* start, int32_t* step) {
+    *count = 0;
+    *step = 0;
+    if (json_scan_peek(scan) != JSON_SCAN_ARRAY) {
+        json_scan_skip(scan);
+        return -1;
+    }
+
+    // The axis is kept as start and step, every time has to be on it
+    int regular = 1;
+    int64_t previous = 0;
+    json_scan_array_begin(scan);
+    while (json_scan_array_next(scan) > 0) {
+        char text[32];
+        int64_t seconds;
+        if (!regular || json_scan_peek(scan) != JSON_SCAN_STRING) {
+            regular = 0;
+            json_scan_skip(scan);
+            continue;
+        }
+        if (json_scan_string(scan, text, sizeof(text)) < 0 || weather_series_time(text, &seconds) != 0) {
+            regular = 0;
+        } else if (*count == 0) {
+            *start = seconds;
+        } else if (*count == 1) {
+            *step = (int32_t)(seconds - previous);
+            if (*step <= 0) regular = 0;
+        } else if (seconds - previous != *step) {
+            regular = 0;
+        }
+        previous = seconds;
+        (*count)++;
+    }
+    return regular && *count > 0 && !scan->failed ? 0 : -1;
+}
+
+int weather_series_scan(json_scan* scan, weather_series_kind kind, weather_series_t* series) {
+    memset(series, 0, sizeof(weather_series_t));
+    if (json_scan_peek(scan) != JSON_SCAN_OBJECT) {
+        json_scan_skip(scan);
+        return -1;
+    }
+
+    // The columns go straight into the series once the time array sized it;
+    // upstream sends that first, one that comes before is read again after
+    const weather_series_block* layout = &weather_series_blocks[kind];
+    size_t pending[WEATHER_SERIES_MAX_VARIABLES];
+    int pending_count = 0;
+    int pending_variable[WEATHER_SERIES_MAX_VARIABLES];
+    int timed = 0;
+    int usable = 1;
+
+    const char* key;
+    size_t length;
+    json_scan_object_begin(scan);
+    while (json_scan_object_next(scan, &key, &length) > 0) {
+        int v = -1;
+        if (json_scan_key_is(key, length, "time")) {
+            int count;
+            int64_t start = 0;
+            int32_t step;
+            if (weather_series_axis(scan, &count, &start, &step) != 0 || timed ||
+                weather_series_alloc(series, kind, count) != 0) {
+                usable = 0;
+                continue;
+            }
+            timed = 1;
+            series->start = start;
+            series->step = step ? step : 86400;
+            continue;
+        }
+        for (int i = 0; i < layout->count && v < 0; i++) {
+            if (json_scan_key_is(key, length, layout->variables[i].name)) v = i;
+        }
+        if (v >= 0 && timed && usable) {
+            weather_series_column(scan, series, v);
+        } else {
+            if (v >= 0 && pending_count < WEATHER_SERIES_MAX_VARIABLES) {
+                pending_variable[pending_count] = v;
+                pending[pending_count++] = json_scan_tell(scan);
+            }
+            json_scan_skip(scan);
+        }
+    }
+
+    if (scan->failed || !usable || !timed) {
+        weather_series_free(series);
+        return -1;
+    }
+    size_t after = json_scan_tell(scan);
+    for (int i = 0; i < pending_count; i++) {
+        json_scan_seek(scan, pending[i]);
+        weather_series_column(scan, series, pending_variable[i]);
+    }
+    json_scan_seek(scan, after);
+    return 0;
+}
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    int failed;
+} weather_series_writer;
+
+static void weather_series_write(weather_series_writer* writer, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void weather_series_write(weather_series_writer* writer, const char* format, ...) {
+    if (writer->failed) return;
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(writer->data + writer->length, writer->capacity - writer->length, format, args);
+        va_end(args);
+        if (written < 0) {
+            writer->failed = 1;
+            return;
+        }
+        if ((size_t)written < writer->capacity - writer->length) {
+            writer->length += (size_t)written;
+            return;
+        }
+        size_t capacity = writer->capacity * 2 + (size_t)written;
+        char* grown = (char*)realloc(writer->data, capacity);
+        if (!grown) {
+            writer->failed = 1;
+            return;
+        }
+        writer->data = grown;
+        writer->capacity = capacity;
+    }
+}
+
+int weather_series_append_json(const weather_series_t* series, weather_series_kind kind, char** buffer,
+                               size_t* length) {
+    if (series->count == 0) return 0;
+    const weather_series_block* layout = &weather_series_blocks[kind];
+
+    // About what a hourly week takes, grown if not
+    weather_series_writer writer = {*buffer, *length, *length + 1, 0};
+    size_t estimate = *length + 64 + (size_t)series->count * (layout->count + 1) * 12;
+    char* grown = (char*)realloc(writer.data, estimate);
+    if (!grown) return -1;
+    writer.data = grown;
+    writer.capacity = estimate;
+
+    weather_series_write(&writer, ",\"%s_units\":{\"time\":\"iso8601\"", layout->name);
+    for (int v = 0; v < layout->count; v++) {
+        weather_series_write(&writer, ",\"%s\":\"%s\"", layout->variables[v].name, layout->variables[v].unit);
+    }
+    weather_series_write(&writer, "},\"%s\":{\"time\":[", layout->name);
+    for (int i = 0; i < series->count; i++) {
+        time_t seconds = (time_t)(series->start + (int64_t)i * series->step);
+        struct tm tm;
+        char text[32];
+        gmtime_r(&seconds, &tm);
+        strftime(text, sizeof(text), layout->time_format, &tm);
+        weather_series_write(&writer, "%s\"%s\"", i ? "," : "", text);
+    }
+    weather_series_write(&writer, "]");
+    for (int v = 0; v < layout->count; v++) {
+        const float* values = series->values + (size_t)v * series->count;
+        weather_series_write(&writer, ",\"%s\":[", layout->variables[v].name);
+        for (int i = 0; i < series->count; i++) {
+            if (isnan(values[i])) {
+                weather_series_write(&writer, "%snull", i ? "," : "");
+            } else {
+                weather_series_write(&writer, "%s%g", i ? "," : "", (double)values[i]);
+            }
+        }
+        weather_series_write(&writer, "]");
+    }
+    weather_series_write(&writer, "}");
+
+    *buffer = writer.data;
+    if (writer.failed) {
+        (*buffer)[*length] = '\0';
+        return -1;
+    }
+    *length = writer.length;
+    return 0;
+}
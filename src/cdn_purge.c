@@ -0,0 +1,248 @@
+#include "cdn_purge.h"
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smw.h"
+#include "utils.h"
+#include "utilities/job_pool.h"
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+
+typedef struct
+{
+	/* "Surrogate-Key: " and the keys, space separated */
+	char* header;
+	int count;
+	/* the response's status, 0 if there was none */
+	long status;
+
+} cdn_purge_batch;
+
+typedef struct
+{
+	char* url;
+	/* CDN_PURGE_HEADER, NULL without it */
+	char* extra;
+
+} cdn_purge;
+
+static cdn_purge g_purge;
+
+static metrics_counter g_requests;
+static metrics_counter g_keys;
+static metrics_counter g_failures;
+static metrics_counter g_dropped;
+
+/* the keys the loop gathers, space separated */
+static __thread char* t_pending = NULL;
+static __thread size_t t_pendingLength = 0;
+static __thread int t_pendingCount = 0;
+static __thread smw_task* t_task = NULL;
+/* the request in flight, NULL when none */
+static __thread job_pool_job* t_job = NULL;
+
+//-----------------Internal Functions-----------------
+
+static size_t cdn_purge_discard(char* _Data, size_t _Size, size_t _Count, void* _Context)
+{
+	(void)_Data;
+	(void)_Context;
+	return _Size * _Count;
+}
+
+static void cdn_purge_batch_free(cdn_purge_batch* _Batch)
+{
+	free(_Batch->header);
+	free(_Batch);
+}
+
+/* on a pool thread */
+static void cdn_purge_job_work(void* _Context)
+{
+	cdn_purge_batch* _Batch = (cdn_purge_batch*)_Context;
+	CURL* easy = curl_easy_init();
+	if(easy == NULL)
+		return;
+
+	struct curl_slist* headers = curl_slist_append(NULL, _Batch->header);
+	if(headers != NULL && g_purge.extra != NULL)
+		headers = curl_slist_append(headers, g_purge.extra);
+	curl_easy_setopt(easy, CURLOPT_URL, g_purge.url);
+	curl_easy_setopt(easy, CURLOPT_POSTFIELDS, "");
+	curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, cdn_purge_discard);
+	curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, (long)CDN_PURGE_TIMEOUT_MS);
+	curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+	if(headers != NULL && curl_easy_perform(easy) == CURLE_OK)
+		curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &_Batch->status);
+
+	curl_slist_free_all(headers);
+	curl_easy_cleanup(easy);
+}
+
+static void cdn_purge_job_done(void* _Context)
+{
+	cdn_purge_batch* _Batch = (cdn_purge_batch*)_Context;
+	metrics_counter_add(&g_requests, 1);
+	if(_Batch->status >= 200 && _Batch->status < 300)
+	{
+		metrics_counter_add(&g_keys, (uint64_t)_Batch->count);
+	}
+	else
+	{
+		metrics_counter_add(&g_failures, 1);
+		LOG_WARN("CDN purge: %d key(s) not purged, status %ld", _Batch->count, _Batch->status);
+	}
+	cdn_purge_batch_free(_Batch);
+	t_job = NULL;
+	/* what was gathered meanwhile */
+	if(t_pendingCount > 0 && t_task != NULL)
+		smw_wakeTask(t_task);
+}
+
+static void cdn_purge_job_release(void* _Context)
+{
+	cdn_purge_batch_free((cdn_purge_batch*)_Context);
+}
+
+static void cdn_purge_taskwork(void* _Context, uint64_t _MonTime)
+{
+	(void)_Context;
+	if(t_pendingCount == 0 || t_job != NULL)
+		return;
+
+	cdn_purge_batch* batch = (cdn_purge_batch*)calloc(1, sizeof(cdn_purge_batch));
+	size_t size = strlen("Surrogate-Key: ") + t_pendingLength + 1;
+	char* header = batch != NULL ? (char*)malloc(size) : NULL;
+	if(header == NULL)
+	{
+		free(batch);
+		smw_setDeadline(t_task, _MonTime + CDN_PURGE_DELAY_MS);
+		return;
+	}
+	snprintf(header, size, "Surrogate-Key: %s", t_pending);
+	batch->header = header;
+	batch->count = t_pendingCount;
+	t_job = job_pool_submit(cdn_purge_job_work, cdn_purge_job_done, batch);
+	if(t_job == NULL)
+	{
+		cdn_purge_batch_free(batch);
+		smw_setDeadline(t_task, _MonTime + CDN_PURGE_DELAY_MS);
+		return;
+	}
+	t_pendingLength = 0;
+	t_pendingCount = 0;
+	t_pending[0] = '\0';
+}
+
+static int cdn_purge_start(void)
+{
+	if(t_task != NULL)
+		return 0;
+	t_pending = (char*)malloc(CDN_PURGE_MAX_KEYS * CDN_PURGE_KEY_SIZE);
+	if(t_pending == NULL)
+		return -1;
+	t_pending[0] = '\0';
+	t_task = smw_createTask(NULL, cdn_purge_taskwork);
+	if(t_task == NULL)
+	{
+		free(t_pending);
+		t_pending = NULL;
+		return -1;
+	}
+	smw_setTaskName(t_task, "cdn_purge");
+	/* runs on its deadline, set by the first key of a batch */
+	smw_parkTask(t_task);
+	return 0;
+}
+
+/* 1 if the loop gathered _Key already */
+static int cdn_purge_pending(const char* _Key, size_t _Length)
+{
+	const char* at = t_pending;
+	while((at = strstr(at, _Key)) != NULL)
+	{
+		if((at == t_pending || at[-1] == ' ') && (at[_Length] == ' ' || at[_Length] == '\0'))
+			return 1;
+		at += _Length;
+	}
+	return 0;
+}
+
+//----------------------------------------------------
+
+int cdn_purge_configure(const char* _Url)
+{
+	cdn_purge_dispose();
+	if(strncmp(_Url, "http://", 7) != 0 && strncmp(_Url, "https://", 8) != 0)
+		return -1;
+	g_purge.url = strdup(_Url);
+	const char* extra = getenv("CDN_PURGE_HEADER");
+	if(extra != NULL && extra[0] != '\0')
+		g_purge.extra = strdup(extra);
+	if(g_purge.url == NULL || (extra != NULL && extra[0] != '\0' && g_purge.extra == NULL))
+	{
+		cdn_purge_dispose();
+		return -1;
+	}
+
+	metrics_register("cdn_purge_requests_total", "Purge requests sent to the CDN.", METRICS_COUNTER, NULL, &g_requests);
+	metrics_register("cdn_purged_keys_total", "Surrogate keys the CDN accepted a purge of.", METRICS_COUNTER, NULL,
+	                 &g_keys);
+	metrics_register("cdn_purge_failures_total", "Purge requests that failed or were refused.", METRICS_COUNTER, NULL,
+	                 &g_failures);
+	metrics_register("cdn_purge_dropped_total", "Keys not purged for a loop with CDN_PURGE_MAX_KEYS waiting.",
+	                 METRICS_COUNTER, NULL, &g_dropped);
+	LOG_INFO("CDN purge: %s%s", g_purge.url, g_purge.extra != NULL ? " with CDN_PURGE_HEADER" : "");
+	return 0;
+}
+
+int cdn_purge_enabled(void)
+{
+	return g_purge.url != NULL;
+}
+
+void cdn_purge_key(const char* _Key)
+{
+	size_t length = strlen(_Key);
+	if(g_purge.url == NULL || length == 0 || length >= CDN_PURGE_KEY_SIZE || cdn_purge_start() != 0)
+		return;
+	if(cdn_purge_pending(_Key, length))
+		return;
+	if(t_pendingCount >= CDN_PURGE_MAX_KEYS)
+	{
+		metrics_counter_add(&g_dropped, 1);
+		return;
+	}
+
+	if(t_pendingCount > 0)
+		t_pending[t_pendingLength++] = ' ';
+	memcpy(t_pending + t_pendingLength, _Key, length + 1);
+	t_pendingLength += length;
+	/* the first of a batch sets when it goes out */
+	if(t_pendingCount++ == 0)
+		smw_setDeadline(t_task, SystemMonotonicMS() + CDN_PURGE_DELAY_MS);
+}
+
+void cdn_purge_release_thread(void)
+{
+	if(t_job != NULL)
+		job_pool_abandon(t_job, cdn_purge_job_release);
+	t_job = NULL;
+	if(t_task != NULL)
+		smw_destroyTask(t_task);
+	t_task = NULL;
+	free(t_pending);
+	t_pending = NULL;
+	t_pendingLength = 0;
+	t_pendingCount = 0;
+}
+
+void cdn_purge_dispose(void)
+{
+	free(g_purge.url);
+	free(g_purge.extra);
+	g_purge.url = NULL;
+	g_purge.extra = NULL;
+}
@@ -5,25 +5,74 @@
  * and listening servers
  **/
 
+/* accept4 */
+#define _GNU_SOURCE
+
 #include "../include/connection.h"
 #include "../global_defines.h"
+#include "../include/utils.h"
+#include "../include/hot_restart.h"
+#include "../include/utilities/ip_ban.h"
+#include "../include/utilities/job_pool.h"
+#include "../include/utilities/logger.h"
+#include "../include/utilities/mem_account.h"
+#include "../include/utilities/metrics.h"
+#include "../include/utilities/object_pool.h"
+#include "../include/utilities/probes.h"
+#include "../include/utilities/trace.h"
+#include "../mbedtls/include/mbedtls/platform.h"
+#include "../mbedtls/include/mbedtls/platform_util.h"
 
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <linux/errqueue.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
 /* forward declarations */
 void static conn_listen_server_base_cleanup(conn_listen_server_t *self);
 void static conn_listen_server_tcp_cleanup(conn_listen_server_t *self);
 void static conn_listen_server_tls_cleanup(conn_listen_server_t *self);
 void conn_listen_server_dispose(conn_listen_server_t *self);
+static void conn_tls_shared_retain(conn_tls_shared_t *shared);
+static void conn_tcp_destroy(void *object);
+static conn_t *conn_tcp_wrap(int client_fd, const struct sockaddr_storage *peer, socklen_t peer_len);
+static void conn_tls_destroy(void *object);
+#if TLS_KTLS_ENABLED
+static void conn_tls_ktls_export_keys(void *p_expkey, mbedtls_ssl_key_export_type type,
+	                                  const unsigned char *secret, size_t secret_len,
+	                                  const unsigned char client_random[32],
+	                                  const unsigned char server_random[32],
+	                                  mbedtls_tls_prf_types tls_prf_type);
+static int conn_tls_ktls_enable(conn_tls_t *tls);
+#endif
 
 ////////////////////////////////////////
 // VTABLE DEFINITION
@@ -32,16 +81,41 @@ void conn_listen_server_dispose(conn_listen_server_t *self);
 /* set each vtable to correct functions */
 const conn_vtable_t TCP_CONN_VTABLE =
 {
-	.read  = conn_tcp_read,
-	.write = conn_tcp_write,
-	.close = conn_tcp_close	
+	.read   = conn_tcp_read,
+	.write  = conn_tcp_write,
+	.writev   = conn_tcp_writev,
+	.sendfile = conn_tcp_sendfile,
+	.writev_zerocopy = conn_tcp_writev_zerocopy,
+	.hold     = conn_tcp_hold,
+	.reap     = conn_tcp_reap,
+	.close    = conn_tcp_close
 };
 
 const conn_vtable_t TLS_CONN_VTABLE =
 {
-	.read  = conn_tls_read,
-	.write = conn_tls_write,
-	.close = conn_tls_close
+	.read      = conn_tls_read,
+	.write     = conn_tls_write,
+	.writev    = conn_tls_writev,
+	.close     = conn_tls_close,
+	.watch     = conn_tls_watch,
+	.handshake = conn_tls_handshake,
+	.early_pending = conn_tls_early_pending,
+	.idle      = conn_tls_idle,
+	.alpn      = conn_tls_alpn
+};
+
+/* a tls connection after kTLS took over, the kernel encrypts plain
+   send/recv (and sendfile) so the tcp functions apply, ssl is kept for
+   the close only */
+const conn_vtable_t KTLS_CONN_VTABLE =
+{
+	.read   = conn_tcp_read,
+	.write  = conn_tcp_write,
+	.writev   = conn_tcp_writev,
+	.sendfile = conn_tcp_sendfile,
+	.close    = conn_ktls_close,
+	.watch    = conn_tls_watch,
+	.alpn     = conn_tls_alpn
 };
 
 const conn_listen_server_vtable_t TCP_LISTEN_SERVER_VTABLE =
@@ -56,6 +130,32 @@ const conn_listen_server_vtable_t TLS_LISTEN_SERVER_VTABLE =
 	.dispose       = conn_listen_server_tls_dispose
 };
 
+const conn_vtable_t URING_CONN_VTABLE =
+{
+	.read  = conn_uring_read,
+	.write = conn_uring_write,
+	.close = conn_uring_close,
+	.watch = conn_uring_watch
+};
+
+const conn_listen_server_vtable_t UNIX_LISTEN_SERVER_VTABLE =
+{
+	.accept_client = conn_listen_server_unix_accept_factory,
+	.dispose       = conn_listen_server_unix_dispose
+};
+
+const conn_listen_server_vtable_t URING_LISTEN_SERVER_VTABLE =
+{
+	.accept_client = conn_listen_server_uring_accept_factory,
+	.dispose       = conn_listen_server_uring_dispose,
+	.watch         = conn_listen_server_uring_watch
+};
+
+/* closed connections of this loop, a pooled tls connection keeps its ssl
+   context set up (and a reference on the view its config lives in) */
+static __thread object_pool t_tcp_pool = OBJECT_POOL_INIT(conn_tcp_destroy);
+static __thread object_pool t_tls_pool = OBJECT_POOL_INIT(conn_tls_destroy);
+
 ////////////////////////////////////////
 // HELPER FUNCTION
 ////////////////////////////////////////
@@ -89,6 +189,9 @@ static int conn_bind_fd(const char *port)
 		}
 		/* yes is boolean, turns ON reuseaddr @ socket level */
 		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		/* every worker binds its own socket on the same port and the
+		   kernel spreads incoming connections across them */
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
 		if (bind(listen_fd, rp->ai_addr, rp->ai_addrlen) == 0)
 		{
 			break; 
@@ -100,471 +203,3316 @@ static int conn_bind_fd(const char *port)
 	return listen_fd;
 }
 
-////////////////////////////////////////
-// CLEANUP IMPLEMENTATION
-////////////////////////////////////////
+/* where this thread's loop runs, its listeners ask for the connections
+   that arrive there */
+static __thread int t_loop_cpu = -1;
 
-static void conn_listen_server_base_cleanup(conn_listen_server_t *self)
+void conn_set_loop_cpu(int cpu)
 {
-    if (self->task)
-	{
-        smw_destroyTask(self->task);
-        self->task = NULL;
-    }
-    if (self->listen_fd >= 0)
-	{
-        close(self->listen_fd);
-        self->listen_fd = -1;
-    }
-    free(self);
+	t_loop_cpu = cpu;
 }
 
-static void conn_listen_server_tcp_cleanup(conn_listen_server_t *self)
-{
-    conn_listen_server_base_cleanup(self);
-}
+/* and whether it spins, its sockets busy poll as well */
+static __thread int t_loop_busy_poll = 0;
 
-static void conn_listen_server_tls_cleanup(conn_listen_server_t *self)
+void conn_set_loop_busy_poll(int usecs)
 {
-    conn_listen_server_tls_t *tls_server = (conn_listen_server_tls_t*)self;
-    // Clean up mbedTLS global contexts
-    mbedtls_ssl_config_free(&tls_server->conf);
-    mbedtls_x509_crt_free(&tls_server->srvcert);
-    mbedtls_pk_free(&tls_server->pkey);
-    mbedtls_ctr_drbg_free(&tls_server->ctr_drbg);
-    mbedtls_entropy_free(&tls_server->entropy);
-    
-    conn_listen_server_base_cleanup(self);
+	t_loop_busy_poll = usecs;
 }
 
-void conn_listen_server_tcp_dispose(conn_listen_server_t *self)
+void conn_listen_options_default(conn_listen_options_t *opts)
 {
-    conn_listen_server_tcp_cleanup(self);
+	memset(opts, 0, sizeof(*opts));
+	opts->backlog            = TCPServer_LISTEN_BACKLOG;
+	opts->nodelay            = TCPServer_TCP_NODELAY;
+	opts->defer_accept       = TCPServer_DEFER_ACCEPT_SECONDS;
+	opts->fastopen_queue     = TCPServer_FASTOPEN_QUEUE;
+	opts->congestion         = TCPServer_CONGESTION;
+	opts->notsent_lowat      = TCPServer_NOTSENT_LOWAT;
+	opts->rcvbuf             = TCPServer_SOCKET_RCVBUF;
+	opts->sndbuf             = TCPServer_SOCKET_SNDBUF;
+	opts->keepalive          = TCPServer_KEEPALIVE;
+	opts->keepalive_idle     = TCPServer_KEEPALIVE_IDLE_SECONDS;
+	opts->keepalive_interval = TCPServer_KEEPALIVE_INTERVAL_SECONDS;
+	opts->keepalive_count    = TCPServer_KEEPALIVE_COUNT;
+	opts->max_connections    = TCPServer_MAX_CONNECTIONS;
+	opts->incoming_cpu       = t_loop_cpu;
+	opts->busy_poll          = t_loop_busy_poll;
 }
 
-void conn_listen_server_tls_dispose(conn_listen_server_t *self)
+static void conn_set_opt(int fd, int level, int name, int value, const char *what)
 {
-    conn_listen_server_tls_cleanup(self);
+	if (setsockopt(fd, level, name, &value, sizeof(value)) != 0)
+	{
+		/* tuning only, the listener works without it */
+		LOG_WARN("Listener: failed to set %s (errno %d)", what, errno);
+	}
 }
 
-void conn_listen_server_dispose(conn_listen_server_t *self)
+/* the module may not be loaded, or not in
+   net.ipv4.tcp_allowed_congestion_control for an unprivileged process:
+   said once, every listener after would fail the same way */
+static void conn_set_congestion(int fd, const char *name)
 {
-    if (self && self->vtable && self->vtable->dispose)
+	static int warned = 0;
+	if (!name || name[0] == '\0')
 	{
-        self->vtable->dispose(self);
-    }
+		return;
+	}
+	if (setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, name, (socklen_t)strlen(name)) != 0 &&
+	    !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+	{
+		LOG_WARN("Listener: congestion control %s not available (errno %d), the system's is used", name, errno);
+	}
 }
 
-////////////////////////////////////////
-// MAIN WORK FUNCTION
-////////////////////////////////////////
-/* checking rate limiting here instead of inside accept
-   also handles polymorphic dispatch and hand-off to http
-*/
-void conn_listen_server_taskwork(void *ctx, uint64_t montime)
+/* accepted sockets inherit both; over net.core.busy_read SO_BUSY_POLL
+   needs CAP_NET_ADMIN, without it reads only see what the interrupts
+   brought while the loop spins */
+static void conn_set_busy_poll(int fd, int usecs)
 {
-	conn_listen_server_t *server = (conn_listen_server_t*)ctx;
-	/* check limit */
-	if (montime >= server->recent_connections_time + TCPServer_MAX_CONNECTIONS_WINDOW_SECONDS * 1000)
+	if (usecs <= 0)
 	{
-		server->recent_connections      = 0;
-		server->recent_connections_time = montime;		
+		return;
 	}
-	if (server->recent_connections >= TCPServer_MAX_CONNECTIONS_PER_WINDOW)
+	conn_set_opt(fd, SOL_SOCKET, SO_BUSY_POLL, usecs, "SO_BUSY_POLL");
+	conn_set_opt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL");
+}
+
+/* the master's listen sockets a prefork worker process takes instead of
+   binding its own, by port; written before the process' loop starts */
+static struct
+{
+	int port;
+	int fd;
+} g_inherited[CONN_LISTEN_MAX_INHERITED];
+static int g_inherited_count = 0;
+
+void conn_listen_inherit(const char *port, int fd)
+{
+	if (g_inherited_count < CONN_LISTEN_MAX_INHERITED)
 	{
-		/* we've accepted to many clients, do nothing */
-		return;
+		g_inherited[g_inherited_count].port = atoi(port);
+		g_inherited[g_inherited_count].fd   = fd;
+		g_inherited_count++;
 	}
+}
 
-	/* polymorphic factory call to accept */
-	conn_t *new_conn = server->vtable->accept_client(server);
-	if (new_conn)
+static int conn_listen_take_inherited(const char *port)
+{
+	int number = atoi(port);
+	for (int i = 0; i < g_inherited_count; i++)
 	{
-		/* we got another client */
-		server->recent_connections++;
-		if (server->on_accept)
+		if (g_inherited[i].port != number)
 		{
-			/* call back to http layer */
-			server->on_accept(new_conn, server->user_ctx);
+			continue;
 		}
-		else
+		int fd = g_inherited[i].fd;
+		g_inherited[i] = g_inherited[--g_inherited_count];
+		return fd;
+	}
+	return -1;
+}
+
+/* bind, tune and listen, -1 on failure */
+static int conn_listen_fd(const char *port, const conn_listen_options_t *opts)
+{
+	conn_listen_options_t defaults;
+	if (!opts)
+	{
+		conn_listen_options_default(&defaults);
+		opts = &defaults;
+	}
+
+	/* handed over by the process we replace, tuned and listening already;
+	   only which CPU it belongs to and how it waits are ours to say */
+	int listen_fd = hot_restart_adopt(port);
+	/* or bound by the prefork master, the same */
+	if (listen_fd < 0)
+	{
+		listen_fd = conn_listen_take_inherited(port);
+	}
+	if (listen_fd >= 0)
+	{
+		if (opts->incoming_cpu >= 0)
 		{
-			/* no cb (should not happen), close connection to avoid leaks */
-			new_conn->vtable->close(new_conn);
+			conn_set_opt(listen_fd, SOL_SOCKET, SO_INCOMING_CPU, opts->incoming_cpu, "SO_INCOMING_CPU");
 		}
+		conn_set_busy_poll(listen_fd, opts->busy_poll);
+		return listen_fd;
 	}
-}
 
-////////////////////////////////////////
-// TCP IMPLEMENTATION
-////////////////////////////////////////
+	listen_fd = conn_bind_fd(port);
+	if (listen_fd < 0)
+	{
+		return -1;
+	}
 
-conn_t *conn_listen_server_tcp_accept_factory(conn_listen_server_t *self)
-{
-	int client_fd = accept(self->listen_fd, NULL, NULL);
-	if (client_fd < 0)
+	if (opts->nodelay)
 	{
-		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		conn_set_opt(listen_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	}
+	if (opts->defer_accept > 0)
+	{
+		conn_set_opt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts->defer_accept, "TCP_DEFER_ACCEPT");
+	}
+	if (opts->fastopen_queue > 0)
+	{
+		conn_set_opt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, opts->fastopen_queue, "TCP_FASTOPEN");
+	}
+	conn_set_congestion(listen_fd, opts->congestion);
+	if (opts->notsent_lowat > 0)
+	{
+		conn_set_opt(listen_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, opts->notsent_lowat, "TCP_NOTSENT_LOWAT");
+	}
+	if (opts->rcvbuf > 0)
+	{
+		conn_set_opt(listen_fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, "SO_RCVBUF");
+	}
+	if (opts->sndbuf > 0)
+	{
+		conn_set_opt(listen_fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, "SO_SNDBUF");
+	}
+	if (opts->incoming_cpu >= 0)
+	{
+		conn_set_opt(listen_fd, SOL_SOCKET, SO_INCOMING_CPU, opts->incoming_cpu, "SO_INCOMING_CPU");
+	}
+	conn_set_busy_poll(listen_fd, opts->busy_poll);
+	if (opts->keepalive)
+	{
+		conn_set_opt(listen_fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+		if (opts->keepalive_idle > 0)
 		{
-			/* no new client */
-			return NULL;
+			conn_set_opt(listen_fd, IPPROTO_TCP, TCP_KEEPIDLE, opts->keepalive_idle, "TCP_KEEPIDLE");
+		}
+		if (opts->keepalive_interval > 0)
+		{
+			conn_set_opt(listen_fd, IPPROTO_TCP, TCP_KEEPINTVL, opts->keepalive_interval, "TCP_KEEPINTVL");
+		}
+		if (opts->keepalive_count > 0)
+		{
+			conn_set_opt(listen_fd, IPPROTO_TCP, TCP_KEEPCNT, opts->keepalive_count, "TCP_KEEPCNT");
 		}
-		perror("accept tcp");
-		return NULL;
 	}
-	/* set new connection to nonblocking */
-	conn_set_nonblocking(client_fd);	
-	/* allocate for new connection, freed in conn_tcp_close */
-	conn_tcp_t *new_conn = (conn_tcp_t*)malloc(sizeof(conn_tcp_t));
-	if (!new_conn)
+
+	if (listen(listen_fd, opts->backlog > 0 ? opts->backlog : TCPServer_LISTEN_BACKLOG) < 0)
 	{
-		close(client_fd);
-		return NULL;
+		close(listen_fd);
+		return -1;
 	}
-	/* wire it up */
-	new_conn->base.vtable = &TCP_CONN_VTABLE;
-	new_conn->base.client_fd = client_fd;
-	return &new_conn->base;
+	hot_restart_register(listen_fd);
+	return listen_fd;
 }
 
-int conn_tcp_read(conn_t *self, void *buf, int count)
+int conn_listen_bind(const char *port)
 {
-	return recv(self->client_fd, buf, count, 0);
+	int listen_fd = conn_listen_fd(port, NULL);
+	/* the worker processes listen on it, there is nothing to hand over */
+	if (listen_fd >= 0)
+	{
+		hot_restart_unregister(listen_fd);
+	}
+	return listen_fd;
 }
-int conn_tcp_write(conn_t *self, const void *buf, int count)
+
+/* no longer one to hand over; the listener's task is gone by now, a
+   socket handed over stays open in the next process and epoll would go
+   on reporting its clients to this loop otherwise */
+static void conn_listen_close(int listen_fd)
 {
-	return send(self->client_fd, buf, count, 0);
+	hot_restart_unregister(listen_fd);
+	close(listen_fd);
 }
-void conn_tcp_close(conn_t *self)
+
+/* listen fd readiness unless the listener brings its own wakeups */
+static int conn_listen_server_watch(conn_listen_server_t *server, uint32_t events)
 {
-	close(self->client_fd);
-	/* this frees allocation done in tcp factory */
-	free(self);
+	if (server->vtable->watch)
+	{
+		return server->vtable->watch(server, events);
+	}
+	return smw_watchFd(server->task, server->listen_fd, events);
 }
 
 ////////////////////////////////////////
-// TLS IMPLEMENTATION (mbed TLS)
+// ADMISSION CONTROL
 ////////////////////////////////////////
 
-conn_t *conn_listen_server_tls_accept_factory(conn_listen_server_t *self)
+/* accounting blocks of this loop's listeners */
+static __thread conn_accounting_t *t_accounting = NULL;
+
+static int conn_listen_server_admission_init(conn_listen_server_t *server, const char *name, const conn_listen_options_t *opts)
 {
-	conn_listen_server_tls_t *server_tls = (conn_listen_server_tls_t*)self;
-	int client_fd = accept(self->listen_fd, NULL, NULL);
-	if (client_fd < 0)
+	conn_listen_options_t defaults;
+	if (!opts)
 	{
-		if (errno == EAGAIN || errno == EWOULDBLOCK)
-		{
-			/* no new client */
-			return NULL;
-		}
-		perror("accept tls");
-		return NULL;
+		conn_listen_options_default(&defaults);
+		opts = &defaults;
+	}
+	conn_accounting_t *accounting = (conn_accounting_t*)calloc(1, sizeof(conn_accounting_t));
+	if (!accounting)
+	{
+		return -1;
+	}
+	/* every listener limits on its own, with several workers a client
+	   spreads over their listeners by the SO_REUSEPORT hash */
+	if (rate_limiter_init(&server->limiter, TCPServer_CLIENT_RATE_PER_SECOND, TCPServer_CLIENT_BURST,
+	                      TCPServer_GLOBAL_RATE_PER_SECOND, TCPServer_GLOBAL_BURST, SystemMonotonicMS()) != 0)
+	{
+		free(accounting);
+		return -1;
 	}
+	accounting->name = name;
+	accounting->max  = opts->max_connections;
+	accounting->next = t_accounting;
+	t_accounting     = accounting;
+	server->accounting      = accounting;
+	server->reject_response = opts->reject_response;
+	return 0;
+}
 
-	conn_set_nonblocking(client_fd);
-	/* allocate for new connection, freed in conn_tcp_close */
-	conn_tls_t *new_conn_tls = (conn_tls_t*)malloc(sizeof(conn_tls_t));
-	if (!new_conn_tls)
+static void conn_listen_server_admission_dispose(conn_listen_server_t *server)
+{
+	smw_cancelTimer(&server->resume_timer);
+	rate_limiter_dispose(&server->limiter);
+
+	conn_accounting_t *accounting = server->accounting;
+	if (!accounting)
 	{
-		close(client_fd);
-		return NULL;
+		return;
 	}
-	/* wire it up */
-	new_conn_tls->base.vtable    = &TLS_CONN_VTABLE;
-	new_conn_tls->base.client_fd = client_fd;
-	/* init tls for this connection */
-	/* Initialize a context Just makes the context ready to be used or freed safely. */
-	mbedtls_net_init(&new_conn_tls->net);
-	/* Initialize an SSL context Just makes the context ready for mbedtls_ssl_setup() or mbedtls_ssl_free() */
-	mbedtls_ssl_init(&new_conn_tls->ssl);
-	/* mbedtls_net_context: Wrapper type for sockets. */
-	new_conn_tls->net.fd = client_fd;
-	/* Set up an SSL context for use.
-	   param:  ssl  - SSL context
-	   param:  conf - SSL configuration to use
-	   return: 0 if succesfull  */	  
-	if (mbedtls_ssl_setup(&new_conn_tls->ssl, &server_tls->conf) != 0)
+	server->accounting = NULL;
+	conn_accounting_t **link = &t_accounting;
+	while (*link && *link != accounting)
 	{
-		close(client_fd);
-		free(new_conn_tls);
-		return NULL;
+		link = &(*link)->next;
+	}
+	if (*link)
+	{
+		*link = accounting->next;
+	}
+	if (accounting->active == 0)
+	{
+		free(accounting);
+	}
+	else
+	{
+		accounting->orphaned = 1;
 	}
-	/* Set the underlying BIO callbacks for write, read and read-with-timeout.
-	   param: ssl    – SSL context
-	   param: p_bio  – parameter (context) shared by BIO callbacks
-	   param: f_send – write callback
-	   param: f_recv – read callback
-	   param: f_recv_timeout – blocking read callback with timeout.
-	 */
-	mbedtls_ssl_set_bio(&new_conn_tls->ssl,
-		                &new_conn_tls->net,
-		                mbedtls_net_send,
-		                mbedtls_net_recv,
-		                NULL); /* we're nonblocking */
-	/* we asume handshake is done and return, if handshake is missing
-	   when HTTPServerConnection calls conn_tls_read() for the first time
-	   mbedtls_ssl_read() will detect the handskae is missing and attempt
-	   to perform it, lazy-mode is e-z mode */
-	return &new_conn_tls->base;
-	
 }
-int conn_tls_read(conn_t *self, void *buf, int count)
+
+/* every close function starts with this */
+static void conn_account_close(conn_t *self)
 {
-	conn_tls_t *tls = (conn_tls_t*)self;
-	/* Read at most ‘len’ application data bytes.
-	   param:  ssl – SSL context
-	   param:  buf – buffer that will hold the data
-	   param:  len – maximum number of bytes to read
-	   return: The (positive) number of bytes read if successful.
-	 */
-	int bytes_read = mbedtls_ssl_read(&tls->ssl, (unsigned char*)buf, count);
-	/* MBEDTLS_ERR_SSL_WANT_READ or MBEDTLS_ERR_SSL_WANT_WRITE if the handshake
-	   is incomplete and waiting for data to be available for reading from or
-	   writing to the underlying transport - in this case you must call this
-	   function again when the underlying transport is ready for the operation.	  
-	 */
-	if (bytes_read == MBEDTLS_ERR_SSL_WANT_READ ||
-		bytes_read == MBEDTLS_ERR_SSL_WANT_WRITE)
+	conn_accounting_t *accounting = self->accounting;
+	if (!accounting)
 	{
-		/* no data aviable, return and try again later */
-		return 0;
+		return;
 	}
-	if (bytes_read < 0)
+	self->accounting = NULL;
+	accounting->active--;
+	if (accounting->orphaned && accounting->active == 0)
 	{
-		/* connection error/ closed */
-		return -1;
+		free(accounting);
 	}
-	
-	return bytes_read;
 }
-int conn_tls_write(conn_t *self, const void *buf, int count)
+
+/* over the cap: a plaintext client gets the canned response, anything
+   else (or without one) a reset, neither costs more than a syscall or two */
+static void conn_reject(conn_t *conn, const char *response)
 {
-	conn_tls_t *tls = (conn_tls_t*)self;
-	int bytes_sent = mbedtls_ssl_write(&tls->ssl, (const unsigned char*)buf, count);
-	if (bytes_sent == MBEDTLS_ERR_SSL_WANT_READ ||
-		bytes_sent == MBEDTLS_ERR_SSL_WANT_WRITE)
+	if (response && !conn->vtable->handshake)
 	{
-		return 0;
+		/* take in what the request already sent, closing with unread bytes
+		   would reset the connection before the response is seen */
+		char sink[1024];
+		for (int i = 0; i < 4 && conn->vtable->read(conn, sink, sizeof(sink)) > 0; i++)
+		{
+		}
+		conn->vtable->write(conn, response, (int)strlen(response));
 	}
-	if (bytes_sent < 0)
+	else
 	{
-		return -1;
+		struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+		setsockopt(conn->client_fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
 	}
-	
-	return bytes_sent;
+	conn->vtable->close(conn);
 }
-void conn_tls_close(conn_t *self)
+
+int conn_listen_server_get_stats(conn_listen_stats_t *stats, int max)
 {
-	conn_tls_t *tls = (conn_tls_t*)self;
-	/* Notify the peer that the connection is being closed.
-	   param:  ssl – SSL context
-	   return: 0 if successful, or a specific SSL error code.
-	 */
-	mbedtls_ssl_close_notify(&tls->ssl);
-	mbedtls_ssl_free(&tls->ssl);
-	mbedtls_net_free(&tls->net);
-	close(self->client_fd);
-	free(self);
+	int count = 0;
+	for (conn_accounting_t *accounting = t_accounting; accounting && count < max; accounting = accounting->next)
+	{
+		conn_listen_stats_t *entry = &stats[count++];
+		entry->name     = accounting->name;
+		entry->active   = accounting->active;
+		entry->peak     = accounting->peak;
+		entry->max      = accounting->max;
+		entry->accepted = accounting->accepted;
+		entry->rejected = accounting->rejected;
+	}
+	return count;
 }
 
 ////////////////////////////////////////
-// INITIALIZATION FUNCTIONS
+// TCP TELEMETRY
 ////////////////////////////////////////
 
-conn_listen_server_t *conn_listen_server_tcp_init(const char *port, OnAcceptCallBack cb, void *ctx)
+/* the struct tcp_info of glibc stops at tcpi_total_retrans, the kernel's
+   has gone on since; its layout up to the delivery rate */
+typedef struct
 {
-	int listening_fd = conn_bind_fd(port);
-	if (listening_fd < 0)
-	{
-		return NULL;
+	struct tcp_info info;
+	uint64_t pacing_rate;
+	uint64_t max_pacing_rate;
+	uint64_t bytes_acked;
+	uint64_t bytes_received;
+	uint32_t segs_out;
+	uint32_t segs_in;
+	uint32_t notsent_bytes;
+	uint32_t min_rtt;
+	uint32_t data_segs_in;
+	uint32_t data_segs_out;
+	uint64_t delivery_rate;
+} conn_tcp_info_t;
+
+/* per listener kind, TCP (io_uring too) and TLS */
+typedef struct
+{
+	metrics_histogram rtt;
+	metrics_histogram retransmits;
+	metrics_histogram cwnd;
+	metrics_histogram delivery_rate;
+	metrics_histogram queue_depth;
+	metrics_counter queue_full;
+} conn_telemetry_t;
+
+static conn_telemetry_t g_telemetry[2];
+static const char *const conn_telemetry_labels[2] = {"listener=\"tcp\"", "listener=\"tls\""};
+
+/* responses of this loop since its last sample */
+static __thread int t_tcp_info_count = 0;
+
+static conn_telemetry_t *conn_telemetry_of(const conn_accounting_t *accounting)
+{
+	return &g_telemetry[accounting && strcmp(accounting->name, "tls") == 0 ? 1 : 0];
+}
+
+/* one field of the TcpExt lines of /proc/net/netstat, names on the first
+   and values on the second; 0 if it is not there */
+static int64_t conn_netstat_read(void *context)
+{
+	const char *field = (const char*)context;
+	FILE *file = fopen("/proc/net/netstat", "r");
+	if (!file)
+	{
+		return 0;
+	}
+	char names[4096];
+	char values[4096];
+	int64_t value = 0;
+	while (fgets(names, sizeof(names), file))
+	{
+		if (strncmp(names, "TcpExt:", 7) != 0)
+		{
+			continue;
+		}
+		if (!fgets(values, sizeof(values), file))
+		{
+			break;
+		}
+		char *name_save = NULL;
+		char *value_save = NULL;
+		char *name = strtok_r(names, " \n", &name_save);
+		char *number = strtok_r(values, " \n", &value_save);
+		while (name && number)
+		{
+			if (strcmp(name, field) == 0)
+			{
+				value = strtoll(number, NULL, 10);
+				break;
+			}
+			name = strtok_r(NULL, " \n", &name_save);
+			number = strtok_r(NULL, " \n", &value_save);
+		}
+		break;
+	}
+	fclose(file);
+	return value;
+}
+
+void conn_register_metrics(void)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		conn_telemetry_t *telemetry = &g_telemetry[i];
+		const char *labels = conn_telemetry_labels[i];
+		metrics_register("tcp_rtt_seconds", "Smoothed round trip time of client sockets, sampled as responses complete.",
+		                 METRICS_HISTOGRAM, labels, &telemetry->rtt);
+		metrics_register_histogram("tcp_retransmitted_segments", "Segments a client socket retransmitted so far, sampled as responses complete.",
+		                           labels, &telemetry->retransmits, 1);
+		metrics_register_histogram("tcp_congestion_window_segments", "Congestion window of client sockets, sampled as responses complete.",
+		                           labels, &telemetry->cwnd, 1);
+		metrics_register_histogram("tcp_delivery_rate_bytes_per_second", "Recent delivery rate of client sockets, sampled as responses complete.",
+		                           labels, &telemetry->delivery_rate, 1000);
+		metrics_register_histogram("tcp_listen_queue_depth", "Connections waiting in the accept queue when an accept pass starts.",
+		                           labels, &telemetry->queue_depth, 1);
+		metrics_register("tcp_listen_queue_full_total", "Accept passes that found the accept queue at its backlog.",
+		                 METRICS_COUNTER, labels, &telemetry->queue_full);
+	}
+	metrics_register_read("tcp_listen_overflows_total", "Handshakes the host dropped for a full accept queue (TcpExt ListenOverflows).",
+	                      METRICS_COUNTER, NULL, conn_netstat_read, (void*)"ListenOverflows");
+	metrics_register_read("tcp_listen_drops_total", "Connections the host dropped on a listener for any reason (TcpExt ListenDrops).",
+	                      METRICS_COUNTER, NULL, conn_netstat_read, (void*)"ListenDrops");
+}
+
+int conn_peer_is_local(const conn_t *conn)
+{
+	if (!conn)
+	{
+		return 0;
+	}
+	/* unix sockets are known by their own end, accept leaves their peer empty */
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if (getsockname(conn->client_fd, (struct sockaddr*)&address, &length) != 0)
+	{
+		return 0;
+	}
+	if (address.ss_family == AF_UNIX)
+	{
+		return 1;
+	}
+	if (conn->peer_len > 0)
+	{
+		memcpy(&address, &conn->peer, sizeof(address));
+	}
+	else
+	{
+		length = sizeof(address);
+		if (getpeername(conn->client_fd, (struct sockaddr*)&address, &length) != 0)
+		{
+			return 0;
+		}
+	}
+	if (address.ss_family == AF_INET)
+	{
+		return (ntohl(((const struct sockaddr_in*)&address)->sin_addr.s_addr) >> 24) == 127;
+	}
+	if (address.ss_family == AF_INET6)
+	{
+		const struct in6_addr *in6 = &((const struct sockaddr_in6*)&address)->sin6_addr;
+		return IN6_IS_ADDR_LOOPBACK(in6) || (IN6_IS_ADDR_V4MAPPED(in6) && in6->s6_addr[12] == 127);
+	}
+	return 0;
+}
+
+void conn_sample_tcp_info(conn_t *conn)
+{
+	if (CONN_TCP_INFO_SAMPLE_EVERY <= 0 || ++t_tcp_info_count < CONN_TCP_INFO_SAMPLE_EVERY)
+	{
+		return;
+	}
+	t_tcp_info_count = 0;
+	/* unix sockets have no peer address and no tcp_info */
+	if (!conn || conn->peer_len == 0)
+	{
+		return;
+	}
+	conn_tcp_info_t sample;
+	socklen_t length = sizeof(sample);
+	memset(&sample, 0, sizeof(sample));
+	if (getsockopt(conn->client_fd, IPPROTO_TCP, TCP_INFO, &sample, &length) != 0 || length < sizeof(struct tcp_info))
+	{
+		return;
+	}
+	conn_telemetry_t *telemetry = conn_telemetry_of(conn->accounting);
+	metrics_histogram_record(&telemetry->rtt, sample.info.tcpi_rtt);
+	metrics_histogram_record(&telemetry->retransmits, sample.info.tcpi_total_retrans);
+	metrics_histogram_record(&telemetry->cwnd, sample.info.tcpi_snd_cwnd);
+	/* kernels before 4.9 do not have it */
+	if (length >= offsetof(conn_tcp_info_t, delivery_rate) + sizeof(sample.delivery_rate))
+	{
+		metrics_histogram_record(&telemetry->delivery_rate, sample.delivery_rate / 1000);
+	}
+}
+
+/* on a listen socket tcpi_unacked is the accept queue and tcpi_sacked the
+   backlog it may grow to */
+static void conn_listen_server_sample_queue(conn_listen_server_t *server)
+{
+	struct tcp_info info;
+	socklen_t length = sizeof(info);
+	if (server->listen_fd < 0 || getsockopt(server->listen_fd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+	{
+		return;
+	}
+	conn_telemetry_t *telemetry = conn_telemetry_of(server->accounting);
+	metrics_histogram_record(&telemetry->queue_depth, info.tcpi_unacked);
+	if (info.tcpi_sacked > 0 && info.tcpi_unacked >= info.tcpi_sacked)
+	{
+		metrics_counter_add(&telemetry->queue_full, 1);
+	}
+}
+
+////////////////////////////////////////
+// CLEANUP IMPLEMENTATION
+////////////////////////////////////////
+
+static void conn_listen_server_base_cleanup(conn_listen_server_t *self)
+{
+    conn_listen_server_admission_dispose(self);
+    if (self->task)
+	{
+        smw_destroyTask(self->task);
+        self->task = NULL;
+    }
+    if (self->listen_fd >= 0)
+	{
+        conn_listen_close(self->listen_fd);
+        self->listen_fd = -1;
+    }
+    free(self);
+}
+
+static void conn_listen_server_tcp_cleanup(conn_listen_server_t *self)
+{
+    conn_listen_server_base_cleanup(self);
+}
+
+static void conn_listen_server_tls_cleanup(conn_listen_server_t *self)
+{
+    conn_listen_server_tls_t *tls_server = (conn_listen_server_tls_t*)self;
+    // Drop our reference on the loop's mbedTLS config
+    if (tls_server->view)
+    {
+        conn_tls_view_release(tls_server->view);
+        tls_server->view = NULL;
+    }
+
+    conn_listen_server_base_cleanup(self);
+}
+
+void conn_listen_server_tcp_dispose(conn_listen_server_t *self)
+{
+    conn_listen_server_tcp_cleanup(self);
+}
+
+void conn_listen_server_tls_dispose(conn_listen_server_t *self)
+{
+    conn_listen_server_tls_cleanup(self);
+}
+
+void conn_listen_server_dispose(conn_listen_server_t *self)
+{
+    if (self && self->vtable && self->vtable->dispose)
+	{
+        self->vtable->dispose(self);
+    }
+}
+
+////////////////////////////////////////
+// MAIN WORK FUNCTION
+////////////////////////////////////////
+/* checking rate limiting here instead of inside accept
+   also handles polymorphic dispatch and hand-off to http
+*/
+static void conn_listen_server_resume(void *ctx, uint64_t montime)
+{
+	(void)montime;
+	conn_listen_server_t *server = (conn_listen_server_t*)ctx;
+	/* resume accepting, anything queued in the backlog is picked up right away */
+	conn_listen_server_watch(server, SMW_READ);
+	smw_wakeTask(server->task);
+}
+
+void conn_listen_server_taskwork(void *ctx, uint64_t montime)
+{
+	conn_listen_server_t *server = (conn_listen_server_t*)ctx;
+	/* how full the accept queue got before this pass drains it */
+	conn_listen_server_sample_queue(server);
+	/* drain the backlog, bounded so a flood can't hog the pass */
+	for (int i = 0; i < TCPServer_ACCEPT_BUDGET; i++)
+	{
+		uint64_t wait = rate_limiter_global_wait(&server->limiter, montime);
+		if (wait > 0)
+		{
+			/* over the global ceiling, stop listening for readiness until the
+			   bucket refills so a full backlog can't spin the loop */
+			conn_listen_server_watch(server, 0);
+			smw_armTimer(&server->resume_timer, montime + wait);
+			return;
+		}
+
+		/* polymorphic factory call to accept */
+		conn_t *new_conn = server->vtable->accept_client(server);
+		if (!new_conn)
+		{
+			/* backlog is empty */
+			return;
+		}
+		/* pooled connections still point at their previous listener */
+		new_conn->accounting = NULL;
+		/* a noisy client only runs out of its own tokens, drop it right
+		   away instead of letting it sit in the backlog */
+		if (rate_limiter_allow(&server->limiter, new_conn->peer_len > 0 ? (struct sockaddr*)&new_conn->peer : NULL, montime) != 0)
+		{
+			/* with the XDP program its next SYNs never get this far */
+			ip_ban_add(new_conn->peer_len > 0 ? (struct sockaddr*)&new_conn->peer : NULL, IP_BAN_SECONDS);
+			new_conn->vtable->close(new_conn);
+			continue;
+		}
+		/* at capacity, fail fast instead of slowing everyone down */
+		conn_accounting_t *accounting = server->accounting;
+		if (accounting->max > 0 && accounting->active >= accounting->max)
+		{
+			accounting->rejected++;
+			conn_reject(new_conn, server->reject_response);
+			continue;
+		}
+		accounting->accepted++;
+		if (++accounting->active > accounting->peak)
+		{
+			accounting->peak = accounting->active;
+		}
+		new_conn->accounting = accounting;
+		new_conn->accepted_ns = trace_enabled() ? trace_now() : 0;
+		PROBE1(accept, new_conn->client_fd);
+		if (server->on_accept)
+		{
+			/* call back to http layer */
+			server->on_accept(new_conn, server->user_ctx);
+		}
+		else
+		{
+			/* no cb (should not happen), close connection to avoid leaks */
+			new_conn->vtable->close(new_conn);
+		}
+	}
+	/* budget used up, the listen fd is still readable and we run again
+	   next pass */
+}
+
+////////////////////////////////////////
+// TCP IMPLEMENTATION
+////////////////////////////////////////
+
+conn_t *conn_listen_server_tcp_accept_factory(conn_listen_server_t *self)
+{
+	struct sockaddr_storage peer;
+	socklen_t peer_len = sizeof(peer);
+	int client_fd = accept4(self->listen_fd, (struct sockaddr*)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			/* no new client */
+			return NULL;
+		}
+		perror("accept tcp");
+		return NULL;
+	}
+	return conn_tcp_wrap(client_fd, &peer, peer_len);
+}
+
+/* a plain connection on client_fd, which is closed if that fails */
+static conn_t *conn_tcp_wrap(int client_fd, const struct sockaddr_storage *peer, socklen_t peer_len)
+{
+	/* allocate for new connection, recycled in conn_tcp_close */
+	conn_tcp_t *new_conn = (conn_tcp_t*)object_pool_get(&t_tcp_pool);
+	if (!new_conn)
+	{
+		new_conn = (conn_tcp_t*)malloc(sizeof(conn_tcp_t));
+		if (new_conn)
+		{
+			mem_account_alloc(MEM_TAG_CONNECTIONS, sizeof(conn_tcp_t));
+		}
+	}
+	if (!new_conn)
+	{
+		close(client_fd);
+		return NULL;
+	}
+	/* wire it up */
+	new_conn->base.vtable = &TCP_CONN_VTABLE;
+	new_conn->base.client_fd = client_fd;
+	memcpy(&new_conn->base.peer, peer, sizeof(*peer));
+	new_conn->base.peer_len  = peer_len;
+	/* unix sockets (no peer address) have no zerocopy */
+	new_conn->zc_state = TCP_ZEROCOPY_ENABLED && peer_len > 0 ? 0 : -1;
+	new_conn->zc_next  = 0;
+	new_conn->zc_done  = 0;
+	new_conn->zc_held  = NULL;
+	new_conn->zc_held_tail = NULL;
+	new_conn->zc_linger_next = NULL;
+	return &new_conn->base;
+}
+
+/* same contract as the tls variants: 0 means try again later,
+   -1 means the connection is closed or broken */
+int conn_tcp_read(conn_t *self, void *buf, int count)
+{
+	int bytes_read = recv(self->client_fd, buf, count, 0);
+	if (bytes_read < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			/* no data aviable, wait for readiness */
+			return 0;
+		}
+		return -1;
+	}
+	if (bytes_read == 0 && count > 0)
+	{
+		/* peer closed */
+		return -1;
+	}
+	return bytes_read;
+}
+int conn_tcp_write(conn_t *self, const void *buf, int count)
+{
+	int bytes_sent = send(self->client_fd, buf, count, MSG_NOSIGNAL);
+	if (bytes_sent < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return 0;
+		}
+		return -1;
+	}
+	return bytes_sent;
+}
+int conn_tcp_writev(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = (struct iovec*)iov;
+	msg.msg_iovlen = iovcnt;
+	int bytes_sent = (int)sendmsg(self->client_fd, &msg, MSG_NOSIGNAL);
+	if (bytes_sent < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return 0;
+		}
+		return -1;
+	}
+	return bytes_sent;
+}
+int conn_tcp_sendfile(conn_t *self, const struct iovec *iov, int iovcnt, int fd, off_t offset, int count)
+{
+	/* the head is held back (MSG_MORE) to leave with the first of the file */
+	int head = 0;
+	if (iovcnt > 0)
+	{
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = (struct iovec*)iov;
+		msg.msg_iovlen = iovcnt;
+		head = (int)sendmsg(self->client_fd, &msg, MSG_NOSIGNAL | MSG_MORE);
+		if (head < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+				return 0;
+			}
+			return -1;
+		}
+		size_t length = 0;
+		for (int i = 0; i < iovcnt; i++)
+		{
+			length += iov[i].iov_len;
+		}
+		if ((size_t)head < length)
+		{
+			return head;
+		}
+	}
+	if (count == 0)
+	{
+		return head;
+	}
+	ssize_t bytes_sent = sendfile(self->client_fd, fd, &offset, (size_t)count);
+	if (bytes_sent < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return head;
+		}
+		return head > 0 ? head : -1;
+	}
+	return head + (int)bytes_sent;
+}
+
+////////////////////////////////////////
+// TCP ZEROCOPY SENDS
+////////////////////////////////////////
+
+/* a body the kernel may still be reading, released once it is done with
+   the sends numbered below seq */
+struct conn_zerocopy_hold
+{
+	conn_zerocopy_hold_t *next;
+	uint32_t seq;
+	const void *owner;
+	void (*release)(const void *owner);
+};
+
+/* closed connections waiting for their holds, and the timer looking at them */
+static __thread conn_tcp_t *t_zc_lingering = NULL;
+static __thread timer_wheel_timer t_zc_linger_timer;
+static __thread int t_zc_linger_timer_ready = 0;
+
+/* releases the holds the kernel is done with, all of them when everything is */
+static void conn_tcp_zerocopy_release(conn_tcp_t *tcp, int everything)
+{
+	while (tcp->zc_held && (everything || (int32_t)(tcp->zc_done - tcp->zc_held->seq) >= 0))
+	{
+		conn_zerocopy_hold_t *hold = tcp->zc_held;
+		tcp->zc_held = hold->next;
+		hold->release(hold->owner);
+		free(hold);
+	}
+	if (!tcp->zc_held)
+	{
+		tcp->zc_held_tail = NULL;
+	}
+}
+
+void conn_tcp_reap(conn_t *self)
+{
+	conn_tcp_t *tcp = (conn_tcp_t*)self;
+	while (tcp->zc_done != tcp->zc_next)
+	{
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(self->client_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+		{
+			/* EAGAIN, nothing more is done yet */
+			break;
+		}
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+			      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+			{
+				continue;
+			}
+			const struct sock_extended_err *err = (const struct sock_extended_err*)CMSG_DATA(cmsg);
+			if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			{
+				continue;
+			}
+			/* sends ee_info to ee_data; TCP acknowledges in order, so the
+			   ranges come in order as well */
+			if ((int32_t)(err->ee_data + 1 - tcp->zc_done) > 0)
+			{
+				tcp->zc_done = err->ee_data + 1;
+			}
+			if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			{
+				/* it copied anyway and pinning the pages was for nothing */
+				tcp->zc_state = -1;
+			}
+		}
+	}
+	conn_tcp_zerocopy_release(tcp, 0);
+}
+
+int conn_tcp_writev_zerocopy(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	conn_tcp_t *tcp = (conn_tcp_t*)self;
+	if (tcp->zc_state == 0)
+	{
+		int one = 1;
+		tcp->zc_state = setsockopt(self->client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0 ? 1 : -1;
+	}
+	if (tcp->zc_state < 0 || iovcnt == 0)
+	{
+		return conn_tcp_writev(self, iov, iovcnt);
+	}
+
+	/* the head's buffer is reused once it is out, it is copied and held
+	   back (MSG_MORE) to leave with the body */
+	int head = 0;
+	if (iovcnt > 1)
+	{
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov    = (struct iovec*)iov;
+		msg.msg_iovlen = iovcnt - 1;
+		head = (int)sendmsg(self->client_fd, &msg, MSG_NOSIGNAL | MSG_MORE);
+		if (head < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+				return 0;
+			}
+			return -1;
+		}
+		size_t length = 0;
+		for (int i = 0; i < iovcnt - 1; i++)
+		{
+			length += iov[i].iov_len;
+		}
+		if ((size_t)head < length)
+		{
+			return head;
+		}
+	}
+	const struct iovec *body = &iov[iovcnt - 1];
+	ssize_t bytes_sent = send(self->client_fd, body->iov_base, body->iov_len, MSG_NOSIGNAL | MSG_ZEROCOPY);
+	if (bytes_sent < 0 && errno == ENOBUFS)
+	{
+		/* too much pinned for the socket's option memory, this one is copied */
+		bytes_sent = send(self->client_fd, body->iov_base, body->iov_len, MSG_NOSIGNAL);
+	}
+	else if (bytes_sent > 0)
+	{
+		tcp->zc_next++;
+	}
+	if (bytes_sent < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		{
+			return head;
+		}
+		return head > 0 ? head : -1;
+	}
+	return head + (int)bytes_sent;
+}
+
+void conn_tcp_hold(conn_t *self, const void *owner, void (*release)(const void *owner))
+{
+	conn_tcp_t *tcp = (conn_tcp_t*)self;
+	conn_tcp_reap(self);
+	if (tcp->zc_done == tcp->zc_next)
+	{
+		release(owner);
+		return;
+	}
+	conn_zerocopy_hold_t *hold = (conn_zerocopy_hold_t*)malloc(sizeof(conn_zerocopy_hold_t));
+	if (!hold)
+	{
+		/* kept for good rather than freed under the kernel */
+		LOG_WARN("conn: no memory to hold a zerocopy body, it is leaked");
+		return;
+	}
+	hold->next = NULL;
+	hold->seq = tcp->zc_next;
+	hold->owner = owner;
+	hold->release = release;
+	if (tcp->zc_held_tail)
+	{
+		tcp->zc_held_tail->next = hold;
+	}
+	else
+	{
+		tcp->zc_held = hold;
+	}
+	tcp->zc_held_tail = hold;
+}
+
+/* the socket goes and the connection back to the pool */
+static void conn_tcp_finish(conn_tcp_t *tcp)
+{
+	close(tcp->base.client_fd);
+	/* this frees allocation done in tcp factory */
+	if (object_pool_put(&t_tcp_pool, tcp) != 0)
+	{
+		conn_tcp_destroy(tcp);
+	}
+}
+
+/* past the deadline the client is not taking the rest: a reset drops the
+   unsent data, and the pages with it, before the holds are released */
+static void conn_tcp_abort(conn_tcp_t *tcp)
+{
+	struct linger reset = {1, 0};
+	setsockopt(tcp->base.client_fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+	close(tcp->base.client_fd);
+	tcp->base.client_fd = -1;
+	conn_tcp_zerocopy_release(tcp, 1);
+	if (object_pool_put(&t_tcp_pool, tcp) != 0)
+	{
+		conn_tcp_destroy(tcp);
+	}
+}
+
+static void conn_tcp_linger_work(void *context, uint64_t montime)
+{
+	(void)context;
+	conn_tcp_t **link = &t_zc_lingering;
+	while (*link)
+	{
+		conn_tcp_t *tcp = *link;
+		conn_tcp_reap(&tcp->base);
+		if (!tcp->zc_held || montime >= tcp->zc_linger_until)
+		{
+			*link = tcp->zc_linger_next;
+			if (tcp->zc_held)
+			{
+				conn_tcp_abort(tcp);
+			}
+			else
+			{
+				conn_tcp_finish(tcp);
+			}
+			continue;
+		}
+		link = &tcp->zc_linger_next;
+	}
+	if (t_zc_lingering)
+	{
+		smw_armTimer(&t_zc_linger_timer, montime + TCP_ZEROCOPY_REAP_MS);
+	}
+}
+
+void conn_tcp_close(conn_t *self)
+{
+	conn_tcp_t *tcp = (conn_tcp_t*)self;
+	conn_account_close(self);
+	conn_tcp_reap(self);
+	if (!tcp->zc_held)
+	{
+		conn_tcp_finish(tcp);
+		return;
+	}
+	/* the kernel still reads bodies from memory, the socket stays open
+	   (and sends what it has) until it is done with them */
+	shutdown(self->client_fd, SHUT_RD);
+	uint64_t now = SystemMonotonicMS();
+	tcp->zc_linger_until = now + TCP_ZEROCOPY_LINGER_MS;
+	tcp->zc_linger_next = t_zc_lingering;
+	t_zc_lingering = tcp;
+	if (!t_zc_linger_timer_ready)
+	{
+		smw_initTimer(&t_zc_linger_timer, conn_tcp_linger_work, NULL);
+		t_zc_linger_timer_ready = 1;
+	}
+	smw_armTimer(&t_zc_linger_timer, now + TCP_ZEROCOPY_REAP_MS);
+}
+
+void conn_zerocopy_detach(void)
+{
+	if (t_zc_linger_timer_ready)
+	{
+		smw_cancelTimer(&t_zc_linger_timer);
+		t_zc_linger_timer_ready = 0;
+	}
+	while (t_zc_lingering)
+	{
+		conn_tcp_t *tcp = t_zc_lingering;
+		t_zc_lingering = tcp->zc_linger_next;
+		conn_tcp_abort(tcp);
+	}
+}
+
+/* object_pool destroy, also for connections the pool can't take */
+static void conn_tcp_destroy(void *object)
+{
+	mem_account_free(MEM_TAG_CONNECTIONS, sizeof(conn_tcp_t));
+	free(object);
+}
+
+////////////////////////////////////////
+// TLS IMPLEMENTATION (mbed TLS)
+////////////////////////////////////////
+
+/* mbedtls_net_send, but a peer that already reset the connection is an
+   error and not a SIGPIPE: HTTP/2 writes frames the client never waits for
+   (SETTINGS acks, a GOAWAY) and may be the one that finds it gone */
+static int conn_tls_net_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	int fd = ((mbedtls_net_context*)ctx)->fd;
+	ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+	if (n >= 0)
+		return (int)n;
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return MBEDTLS_ERR_SSL_WANT_WRITE;
+	if (errno == EPIPE || errno == ECONNRESET)
+		return MBEDTLS_ERR_NET_CONN_RESET;
+	return MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+/* one time setup of a tls connection, reused until it leaves the pool */
+static conn_tls_t *conn_tls_create(conn_tls_view_t *view)
+{
+	conn_tls_t *tls = (conn_tls_t*)malloc(sizeof(conn_tls_t));
+	if (!tls)
+	{
+		return NULL;
+	}
+	mem_account_alloc(MEM_TAG_TLS, sizeof(conn_tls_t));
+	/* init tls for this connection */
+	/* Initialize a context Just makes the context ready to be used or freed safely. */
+	mbedtls_net_init(&tls->net);
+	/* Initialize an SSL context Just makes the context ready for mbedtls_ssl_setup() or mbedtls_ssl_free() */
+	mbedtls_ssl_init(&tls->ssl);
+	/* Set up an SSL context for use.
+	   param:  ssl  - SSL context
+	   param:  conf - SSL configuration to use
+	   return: 0 if succesfull  */	  
+	if (mbedtls_ssl_setup(&tls->ssl, &view->conf) != 0)
+	{
+		mbedtls_ssl_free(&tls->ssl);
+		mem_account_free(MEM_TAG_TLS, sizeof(conn_tls_t));
+		free(tls);
+		return NULL;
+	}
+	/* Set the underlying BIO callbacks for write, read and read-with-timeout.
+	   param: ssl    – SSL context
+	   param: p_bio  – parameter (context) shared by BIO callbacks
+	   param: f_send – write callback
+	   param: f_recv – read callback
+	   param: f_recv_timeout – blocking read callback with timeout.
+	 */
+	mbedtls_ssl_set_bio(&tls->ssl,
+		                &tls->net,
+		                conn_tls_net_send,
+		                mbedtls_net_recv,
+		                NULL); /* we're nonblocking */
+	/* the async private key callbacks find the connection through this */
+	mbedtls_ssl_set_user_data_p(&tls->ssl, tls);
+#if TLS_KTLS_ENABLED
+	mbedtls_ssl_set_export_keys_cb(&tls->ssl, conn_tls_ktls_export_keys, tls);
+#endif
+	view->refcount++;
+	tls->view = view;
+	return tls;
+}
+
+/* object_pool destroy, also for connections the pool can't take */
+static void conn_tls_destroy(void *object)
+{
+	conn_tls_t *tls = (conn_tls_t*)object;
+	mbedtls_ssl_free(&tls->ssl);
+	mbedtls_net_free(&tls->net);
+	conn_tls_view_release(tls->view);
+	mem_account_free(MEM_TAG_TLS, sizeof(conn_tls_t));
+	free(tls);
+}
+
+/* session reset keeps buffers, bio and callbacks for the next client */
+static void conn_tls_recycle(conn_tls_t *tls)
+{
+	free(tls->ktls_secret);
+	tls->ktls_secret = NULL;
+	mem_account_release(MEM_TAG_TLS, tls->early);
+	tls->early     = NULL;
+	tls->early_len = 0;
+	tls->early_off = 0;
+	/* the next handshake grows the buffers back */
+	tls->idle      = 0;
+	if (mbedtls_ssl_session_reset(&tls->ssl) != 0 ||
+		object_pool_put(&t_tls_pool, tls) != 0)
+	{
+		conn_tls_destroy(tls);
+	}
+}
+
+conn_t *conn_listen_server_tls_accept_factory(conn_listen_server_t *self)
+{
+	conn_listen_server_tls_t *server_tls = (conn_listen_server_tls_t*)self;
+	struct sockaddr_storage peer;
+	socklen_t peer_len = sizeof(peer);
+	int client_fd = accept4(self->listen_fd, (struct sockaddr*)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client_fd < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			/* no new client */
+			return NULL;
+		}
+		perror("accept tls");
+		return NULL;
+	}
+	conn_t *new_conn = conn_tls_accept_fd(server_tls->view, client_fd);
+	if (!new_conn)
+	{
+		close(client_fd);
+		return NULL;
+	}
+	memcpy(&new_conn->peer, &peer, sizeof(peer));
+	new_conn->peer_len = peer_len;
+	return new_conn;
+}
+
+conn_t *conn_tls_accept_fd(conn_tls_view_t *view, int client_fd)
+{
+	/* recycled in conn_tls_close, set up once per allocation */
+	conn_tls_t *new_conn_tls = (conn_tls_t*)object_pool_get(&t_tls_pool);
+	if (new_conn_tls && new_conn_tls->view != view)
+	{
+		/* set up for a config that's gone since */
+		conn_tls_destroy(new_conn_tls);
+		new_conn_tls = NULL;
+	}
+	if (!new_conn_tls)
+	{
+		new_conn_tls = conn_tls_create(view);
+	}
+	if (!new_conn_tls)
+	{
+		return NULL;
+	}
+	/* wire it up */
+	new_conn_tls->base.vtable    = &TLS_CONN_VTABLE;
+	new_conn_tls->base.client_fd = client_fd;
+	new_conn_tls->base.peer_len  = 0;
+	new_conn_tls->base.accounting  = NULL;
+	new_conn_tls->base.accepted_ns = 0;
+	new_conn_tls->owner          = NULL;
+	new_conn_tls->ktls_secret    = NULL;
+	new_conn_tls->early          = NULL;
+	new_conn_tls->early_len      = 0;
+	new_conn_tls->early_off      = 0;
+	new_conn_tls->ramp_bytes     = 0;
+	new_conn_tls->last_write_ms  = 0;
+	new_conn_tls->record_pending = 0;
+	new_conn_tls->idle           = 0;
+	/* mbedtls_net_context: Wrapper type for sockets. */
+	new_conn_tls->net.fd = client_fd;
+	/* the handshake is driven through conn_tls_handshake() by the owner,
+	   which gives it a deadline of its own */
+	return &new_conn_tls->base;
+}
+#if TLS_EARLY_DATA_ENABLED
+/* appends the 0-RTT record mbedTLS holds, mbedTLS stops the client at the
+   max_early_data_size the buffer is sized to */
+static int conn_tls_read_early(conn_tls_t *tls)
+{
+	if (!tls->early)
+	{
+		tls->early = (unsigned char*)mem_account_malloc(MEM_TAG_TLS, TLS_EARLY_DATA_MAX_BYTES);
+		if (!tls->early)
+		{
+			return -1;
+		}
+	}
+	int n = mbedtls_ssl_read_early_data(&tls->ssl, tls->early + tls->early_len,
+		                                TLS_EARLY_DATA_MAX_BYTES - tls->early_len);
+	if (n < 0)
+	{
+		return -1;
+	}
+	tls->early_len += n;
+	return 0;
+}
+#endif
+
+int conn_tls_handshake(conn_t *self)
+{
+	conn_tls_t *tls = (conn_tls_t*)self;
+	/* Perform the SSL handshake, one step as far as the socket allows.
+	   return: 0 if successful, MBEDTLS_ERR_SSL_WANT_READ/WRITE if it has
+	   to be called again once the transport is ready.
+	 */
+	int rv = mbedtls_ssl_handshake(&tls->ssl);
+#if TLS_EARLY_DATA_ENABLED
+	/* each 0-RTT record has to be taken out before the handshake goes on */
+	while (rv == MBEDTLS_ERR_SSL_RECEIVED_EARLY_DATA)
+	{
+		if (conn_tls_read_early(tls) < 0)
+		{
+			return -1;
+		}
+		rv = mbedtls_ssl_handshake(&tls->ssl);
+	}
+	int early = tls->early ? CONN_HANDSHAKE_EARLY_DATA : 0;
+#else
+	int early = 0;
+#endif
+	if (rv == 0)
+	{
+#if TLS_KTLS_ENABLED
+		if (conn_tls_ktls_enable(tls) < 0)
+		{
+			return -1;
+		}
+#endif
+		return 0;
+	}
+	if (rv == MBEDTLS_ERR_SSL_WANT_READ)
+	{
+		return SMW_READ | early;
+	}
+	if (rv == MBEDTLS_ERR_SSL_WANT_WRITE)
+	{
+		return SMW_WRITE | early;
+	}
+	if (rv == MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS)
+	{
+		/* the signature is computed on the job pool, see conn_tls_async_done */
+		return CONN_HANDSHAKE_ASYNC;
+	}
+	return -1;
+}
+int conn_tls_early_pending(conn_t *self)
+{
+	conn_tls_t *tls = (conn_tls_t*)self;
+	return tls->early_len - tls->early_off;
+}
+const char *conn_tls_alpn(conn_t *self)
+{
+	conn_tls_t *tls = (conn_tls_t*)self;
+	return mbedtls_ssl_get_alpn_protocol(&tls->ssl);
+}
+void conn_tls_idle(conn_t *self)
+{
+#if TLS_IDLE_RELEASE_BUFFERS
+	/* two record buffers of up to 16 KB each are most of what an idle
+	   keep-alive client costs, they are shrunk to almost nothing and only
+	   grown again by the read that comes next (mbedTLS keeps the cipher
+	   state, so nothing is renegotiated) */
+	conn_tls_t *tls = (conn_tls_t*)self;
+	if (tls->idle || tls->record_pending != 0 || tls->early_off < tls->early_len ||
+		mbedtls_ssl_get_bytes_avail(&tls->ssl) != 0)
+	{
+		return;
+	}
+	if (mbedtls_ssl_set_idle(&tls->ssl, 1) == 0)
+	{
+		tls->idle = 1;
+	}
+#else
+	(void)self;
+#endif
+}
+/* before mbedTLS reads or writes a record again */
+static int conn_tls_wake(conn_tls_t *tls)
+{
+#if TLS_IDLE_RELEASE_BUFFERS
+	if (tls->idle)
+	{
+		tls->idle = 0;
+		if (mbedtls_ssl_set_idle(&tls->ssl, 0) != 0)
+		{
+			return -1;
+		}
+	}
+#else
+	(void)tls;
+#endif
+	return 0;
+}
+int conn_tls_watch(conn_t *self, smw_task *task, uint32_t events)
+{
+	conn_tls_t *tls = (conn_tls_t*)self;
+	tls->owner = task;
+	return smw_watchFd(task, self->client_fd, events);
+}
+int conn_tls_read(conn_t *self, void *buf, int count)
+{
+	conn_tls_t *tls = (conn_tls_t*)self;
+	/* Read at most ‘len’ application data bytes.
+	   param:  ssl – SSL context
+	   param:  buf – buffer that will hold the data
+	   param:  len – maximum number of bytes to read
+	   return: The (positive) number of bytes read if successful.
+	 */
+#if TLS_EARLY_DATA_ENABLED
+	/* 0-RTT data first, nothing else arrives until the handshake is done */
+	if (tls->early_off < tls->early_len)
+	{
+		int take = tls->early_len - tls->early_off;
+		if (take > count)
+		{
+			take = count;
+		}
+		memcpy(buf, tls->early + tls->early_off, take);
+		tls->early_off += take;
+		return take;
+	}
+	if (!mbedtls_ssl_is_handshake_over(&tls->ssl))
+	{
+		return 0;
+	}
+#endif
+	if (conn_tls_wake(tls) < 0)
+	{
+		return -1;
+	}
+	int bytes_read = mbedtls_ssl_read(&tls->ssl, (unsigned char*)buf, count);
+	/* MBEDTLS_ERR_SSL_WANT_READ or MBEDTLS_ERR_SSL_WANT_WRITE if the handshake
+	   is incomplete and waiting for data to be available for reading from or
+	   writing to the underlying transport - in this case you must call this
+	   function again when the underlying transport is ready for the operation.	  
+	 */
+	if (bytes_read == MBEDTLS_ERR_SSL_WANT_READ ||
+		bytes_read == MBEDTLS_ERR_SSL_WANT_WRITE)
+	{
+		/* no data aviable, return and try again later */
+		return 0;
+	}
+	if (bytes_read < 0)
+	{
+		/* connection error/ closed */
+		return -1;
+	}
+	
+	return bytes_read;
+}
+int conn_tls_write(conn_t *self, const void *buf, int count)
+{
+	conn_tls_t *tls = (conn_tls_t*)self;
+	if (conn_tls_wake(tls) < 0)
+	{
+		return -1;
+	}
+#if TLS_DYNAMIC_RECORDS
+	/* a 16 KB record is only decoded once all of it is in, on a slow or
+	   fresh link that is several round trips. The first bytes after an
+	   idle period go in records of one segment each, then in full ones
+	   once the window has opened. */
+	uint64_t now = SystemMonotonicMS();
+	if (tls->record_pending == 0 && now - tls->last_write_ms > TLS_RECORD_IDLE_MS)
+	{
+		tls->ramp_bytes = 0;
+	}
+	int total = 0;
+	while (total < count)
+	{
+		int chunk = count - total;
+		if (tls->record_pending > 0)
+		{
+			/* the retry mbedTLS expects, the caller passes the same bytes */
+			if (chunk > tls->record_pending)
+			{
+				chunk = tls->record_pending;
+			}
+		}
+		else if (tls->ramp_bytes >= TLS_RECORD_RAMP_BYTES)
+		{
+			/* full records, one call takes them all */
+		}
+		else if (chunk > TLS_RECORD_SMALL_BYTES)
+		{
+			chunk = TLS_RECORD_SMALL_BYTES;
+		}
+		int bytes_sent = mbedtls_ssl_write(&tls->ssl, (const unsigned char*)buf + total, chunk);
+		if (bytes_sent == MBEDTLS_ERR_SSL_WANT_READ ||
+			bytes_sent == MBEDTLS_ERR_SSL_WANT_WRITE)
+		{
+			tls->record_pending = chunk;
+			break;
+		}
+		if (bytes_sent < 0)
+		{
+			return -1;
+		}
+		tls->record_pending = 0;
+		tls->ramp_bytes    += bytes_sent;
+		tls->last_write_ms  = now;
+		total += bytes_sent;
+	}
+	return total;
+#else
+	int bytes_sent = mbedtls_ssl_write(&tls->ssl, (const unsigned char*)buf, count);
+	if (bytes_sent == MBEDTLS_ERR_SSL_WANT_READ ||
+		bytes_sent == MBEDTLS_ERR_SSL_WANT_WRITE)
+	{
+		return 0;
+	}
+	if (bytes_sent < 0)
+	{
+		return -1;
+	}
+	
+	return bytes_sent;
+#endif
+}
+int conn_tls_writev(conn_t *self, const struct iovec *iov, int iovcnt)
+{
+	/* a record per buffer would put a small header block in a record of
+	   its own, gather the front into one record instead. A leading buffer
+	   that fills a record by itself goes out without the copy. */
+	static __thread unsigned char stage[TLS_WRITEV_COALESCE_BYTES];
+	if (iovcnt == 0)
+	{
+		return 0;
+	}
+	if (iovcnt == 1 || iov[0].iov_len >= sizeof(stage))
+	{
+		return conn_tls_write(self, iov[0].iov_base, (int)iov[0].iov_len);
+	}
+	size_t staged = 0;
+	for (int i = 0; i < iovcnt && staged < sizeof(stage); i++)
+	{
+		size_t take = iov[i].iov_len;
+		if (take > sizeof(stage) - staged)
+		{
+			take = sizeof(stage) - staged;
+		}
+		memcpy(stage + staged, iov[i].iov_base, take);
+		staged += take;
+	}
+	/* a retry after WANT_WRITE stages the very same bytes again, which is
+	   what mbedtls_ssl_write expects */
+	return conn_tls_write(self, stage, (int)staged);
+}
+void conn_tls_close(conn_t *self)
+{
+	conn_account_close(self);
+	conn_tls_t *tls = (conn_tls_t*)self;
+	/* Notify the peer that the connection is being closed.
+	   param:  ssl – SSL context
+	   return: 0 if successful, or a specific SSL error code.
+	   Without its buffers back there is no alert to send.
+	 */
+	if (conn_tls_wake(tls) == 0)
+	{
+		mbedtls_ssl_close_notify(&tls->ssl);
+	}
+	/* closed here, once */
+	tls->net.fd = -1;
+	close(self->client_fd);
+	conn_tls_recycle(tls);
+}
+void conn_ktls_close(conn_t *self)
+{
+	conn_account_close(self);
+	conn_tls_t *tls = (conn_tls_t*)self;
+	/* mbedTLS' record state is stale, the alert has to go through the
+	   kernel as a record of its own type: warning, close_notify */
+	unsigned char alert[2] = { 1, 0 };
+	char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+	struct iovec iov = { .iov_base = alert, .iov_len = sizeof(alert) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	memset(cbuf, 0, sizeof(cbuf));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type  = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cmsg) = MBEDTLS_SSL_MSG_ALERT;
+	sendmsg(self->client_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	tls->net.fd = -1;
+	close(self->client_fd);
+	conn_tls_recycle(tls);
+}
+
+////////////////////////////////////////
+// KERNEL TLS OFFLOAD
+////////////////////////////////////////
+
+#if TLS_KTLS_ENABLED
+
+/* After the handshake the record layer can move into the kernel: the
+   negotiated keys are handed to the socket (TCP_ULP "tls") and the
+   connection continues with plain send/recv, which also leaves the door
+   open for sendfile. Only TLS 1.2 AES-GCM is handed over, anything else
+   or a kernel without the tls module stays on mbedTLS. */
+struct conn_tls_ktls_secret
+{
+	mbedtls_tls_prf_types prf;
+	unsigned char master[48];
+	/* server random first, the order the key expansion wants */
+	unsigned char randoms[64];
+};
+
+static void conn_tls_ktls_export_keys(void *p_expkey, mbedtls_ssl_key_export_type type,
+	                                  const unsigned char *secret, size_t secret_len,
+	                                  const unsigned char client_random[32],
+	                                  const unsigned char server_random[32],
+	                                  mbedtls_tls_prf_types tls_prf_type)
+{
+	conn_tls_t *tls = (conn_tls_t*)p_expkey;
+	if (type != MBEDTLS_SSL_KEY_EXPORT_TLS12_MASTER_SECRET || secret_len != 48)
+	{
+		return;
+	}
+	if (!tls->ktls_secret)
+	{
+		tls->ktls_secret = (struct conn_tls_ktls_secret*)malloc(sizeof(struct conn_tls_ktls_secret));
+		if (!tls->ktls_secret)
+		{
+			return;
+		}
+	}
+	tls->ktls_secret->prf = tls_prf_type;
+	memcpy(tls->ktls_secret->master, secret, 48);
+	memcpy(tls->ktls_secret->randoms, server_random, 32);
+	memcpy(tls->ktls_secret->randoms + 32, client_random, 32);
+}
+
+/* AES-GCM key length of the negotiated suite, 0 if kTLS can't take it */
+static size_t conn_tls_ktls_key_len(int ciphersuite)
+{
+	switch (ciphersuite)
+	{
+		case MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256:
+		case MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+		case MBEDTLS_TLS_DHE_RSA_WITH_AES_128_GCM_SHA256:
+		case MBEDTLS_TLS_RSA_WITH_AES_128_GCM_SHA256:
+			return 16;
+		case MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384:
+		case MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384:
+		case MBEDTLS_TLS_DHE_RSA_WITH_AES_256_GCM_SHA384:
+		case MBEDTLS_TLS_RSA_WITH_AES_256_GCM_SHA384:
+			return 32;
+		default:
+			return 0;
+	}
+}
+
+/* one direction, key_len is 16 or 32 */
+static int conn_tls_ktls_set(int fd, int direction, const unsigned char *key, size_t key_len,
+	                         const unsigned char salt[4], const unsigned char rec_seq[8])
+{
+	if (key_len == 16)
+	{
+		struct tls12_crypto_info_aes_gcm_128 info;
+		memset(&info, 0, sizeof(info));
+		info.info.version     = TLS_1_2_VERSION;
+		info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		memcpy(info.key, key, 16);
+		memcpy(info.salt, salt, 4);
+		memcpy(info.rec_seq, rec_seq, 8);
+		/* explicit nonces continue from the record sequence like mbedTLS' */
+		memcpy(info.iv, rec_seq, 8);
+		int rv = setsockopt(fd, SOL_TLS, direction, &info, sizeof(info));
+		mbedtls_platform_zeroize(&info, sizeof(info));
+		return rv;
+	}
+	struct tls12_crypto_info_aes_gcm_256 info;
+	memset(&info, 0, sizeof(info));
+	info.info.version     = TLS_1_2_VERSION;
+	info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+	memcpy(info.key, key, 32);
+	memcpy(info.salt, salt, 4);
+	memcpy(info.rec_seq, rec_seq, 8);
+	memcpy(info.iv, rec_seq, 8);
+	int rv = setsockopt(fd, SOL_TLS, direction, &info, sizeof(info));
+	mbedtls_platform_zeroize(&info, sizeof(info));
+	return rv;
+}
+
+/* 0 when the connection stays usable (offloaded or not), -1 if the socket
+   is left half offloaded and has to be closed */
+static int conn_tls_ktls_enable(conn_tls_t *tls)
+{
+	struct conn_tls_ktls_secret *secret = tls->ktls_secret;
+	tls->ktls_secret = NULL;
+	if (!secret)
+	{
+		return 0;
+	}
+	int rv = 0;
+	size_t key_len = conn_tls_ktls_key_len(mbedtls_ssl_get_ciphersuite_id_from_ssl(&tls->ssl));
+	/* mbedTLS reads records exactly, anything buffered would be lost */
+	if (key_len == 0 ||
+		mbedtls_ssl_get_version_number(&tls->ssl) != MBEDTLS_SSL_VERSION_TLS1_2 ||
+		mbedtls_ssl_get_bytes_avail(&tls->ssl) != 0)
+	{
+		goto done;
+	}
+
+	/* AEAD key block: client key, server key, client salt, server salt */
+	unsigned char block[2 * 32 + 2 * 4];
+	if (mbedtls_ssl_tls_prf(secret->prf, secret->master, sizeof(secret->master), "key expansion",
+		                    secret->randoms, sizeof(secret->randoms), block, 2 * key_len + 8) != 0)
+	{
+		goto done;
+	}
+	const unsigned char *client_key  = block;
+	const unsigned char *server_key  = block + key_len;
+	const unsigned char *client_salt = block + 2 * key_len;
+	const unsigned char *server_salt = block + 2 * key_len + 4;
+	/* each side sent exactly one record (Finished) under the new keys */
+	const unsigned char rec_seq[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	int fd = tls->base.client_fd;
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0)
+	{
+		/* the ulp alone is transparent, only a lone TX key breaks the stream */
+		if (conn_tls_ktls_set(fd, TLS_TX, server_key, key_len, server_salt, rec_seq) == 0)
+		{
+			if (conn_tls_ktls_set(fd, TLS_RX, client_key, key_len, client_salt, rec_seq) == 0)
+			{
+				tls->base.vtable = &KTLS_CONN_VTABLE;
+#if TLS_IDLE_RELEASE_BUFFERS
+				/* mbedTLS won't touch a record again, only the reset for
+				   the next client grows its buffers back */
+				if (mbedtls_ssl_set_idle(&tls->ssl, 1) == 0)
+				{
+					tls->idle = 1;
+				}
+#endif
+			}
+			else
+			{
+				rv = -1;
+			}
+		}
+	}
+	mbedtls_platform_zeroize(block, sizeof(block));
+
+done:
+	mbedtls_platform_zeroize(secret, sizeof(*secret));
+	free(secret);
+	return rv;
+}
+#endif
+
+////////////////////////////////////////
+// INITIALIZATION FUNCTIONS
+////////////////////////////////////////
+
+conn_listen_server_t *conn_listen_server_tcp_init(const char *port, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts)
+{
+	int listening_fd = conn_listen_fd(port, opts);
+	if (listening_fd < 0)
+	{
+		return NULL;
+	}
+	conn_set_nonblocking(listening_fd);
+	conn_listen_server_tcp_t *new_server = (conn_listen_server_tcp_t*)malloc(sizeof(conn_listen_server_tcp_t));
+	if (!new_server)
+	{
+		conn_listen_close(listening_fd);
+		return NULL;
+	}
+	/* wire up base/ parent */
+	new_server->base.vtable    = &TCP_LISTEN_SERVER_VTABLE;
+	new_server->base.listen_fd = listening_fd;
+	/* setting call back here */
+	new_server->base.on_accept = cb;
+	new_server->base.user_ctx  = ctx;
+	smw_initTimer(&new_server->base.resume_timer, conn_listen_server_resume, &new_server->base);
+	if (conn_listen_server_admission_init(&new_server->base, "tcp", opts) != 0)
+	{
+		conn_listen_close(listening_fd);
+		free(new_server);
+		return NULL;
+	}
+	/* add to scheduler  */
+	new_server->base.task = smw_createTask(&new_server->base, conn_listen_server_taskwork);
+	if (!new_server->base.task)
+	{
+		LOG_ERROR("TCP failed to create task for TCP listener server");
+		conn_listen_server_tcp_cleanup(&new_server->base);
+		return NULL;
+	}
+	smw_setTaskName(new_server->base.task, "tcp_listener");
+	/* new clients wait until in progress requests had their turn */
+	smw_setPriority(new_server->base.task, smw_priority_low);
+	/* only wake the listener when a client is waiting in the backlog */
+	smw_watchFd(new_server->base.task, listening_fd, SMW_READ);
+	
+	return &new_server->base;
+}
+
+////////////////////////////////////////
+// UNIX SOCKET IMPLEMENTATION
+////////////////////////////////////////
+
+/* the process' unix listen socket, bound by the first listener and
+   closed with the last, guarded by the lock */
+static pthread_mutex_t g_unix_lock  = PTHREAD_MUTEX_INITIALIZER;
+static int             g_unix_fd    = -1;
+static int             g_unix_users = 0;
+static char            g_unix_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+/* "@name" is an abstract socket, nothing on the filesystem; -1 if path
+   does not fit */
+static int conn_unix_address(const char *path, struct sockaddr_un *addr, socklen_t *addr_len)
+{
+	size_t length = strlen(path);
+	if (length == 0 || length >= sizeof(addr->sun_path) || (path[0] == '@' && length == 1))
+	{
+		return -1;
+	}
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path, length);
+	if (path[0] == '@')
+	{
+		addr->sun_path[0] = '\0';
+		*addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length);
+	}
+	else
+	{
+		*addr_len = (socklen_t)sizeof(*addr);
+	}
+	return 0;
+}
+
+/* 1 if nobody listens on a socket file that is in the way */
+static int conn_unix_stale(const struct sockaddr_un *addr, socklen_t addr_len)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	int stale = connect(fd, (const struct sockaddr*)addr, addr_len) != 0 && errno == ECONNREFUSED;
+	close(fd);
+	return stale;
+}
+
+static int conn_unix_listen_fd(const char *path, const conn_listen_options_t *opts)
+{
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+	if (conn_unix_address(path, &addr, &addr_len) != 0)
+	{
+		LOG_ERROR("Listener: unix socket path %s is empty or too long", path);
+		return -1;
+	}
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+	{
+		return -1;
+	}
+	int bound = bind(listen_fd, (struct sockaddr*)&addr, addr_len) == 0;
+	if (!bound && errno == EADDRINUSE && path[0] != '@' && conn_unix_stale(&addr, addr_len) &&
+	    unlink(addr.sun_path) == 0)
+	{
+		/* left behind by a process that is gone */
+		bound = bind(listen_fd, (struct sockaddr*)&addr, addr_len) == 0;
+	}
+	if (!bound)
+	{
+		LOG_ERROR("Listener: failed to bind unix socket %s (errno %d)", path, errno);
+		close(listen_fd);
+		return -1;
+	}
+	if (path[0] != '@' && chmod(addr.sun_path, TCPServer_UNIX_SOCKET_MODE) != 0)
+	{
+		LOG_WARN("Listener: failed to set the mode of %s (errno %d)", path, errno);
+	}
+	if (opts->rcvbuf > 0)
+	{
+		conn_set_opt(listen_fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, "SO_RCVBUF");
+	}
+	if (opts->sndbuf > 0)
+	{
+		conn_set_opt(listen_fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, "SO_SNDBUF");
+	}
+	if (listen(listen_fd, opts->backlog > 0 ? opts->backlog : TCPServer_LISTEN_BACKLOG) < 0)
+	{
+		close(listen_fd);
+		if (path[0] != '@')
+		{
+			unlink(addr.sun_path);
+		}
+		return -1;
+	}
+	hot_restart_register(listen_fd);
+	return listen_fd;
+}
+
+/* a reference on the process' socket, -1 on failure */
+static int conn_unix_acquire(const char *path, const conn_listen_options_t *opts)
+{
+	int listen_fd = -1;
+	pthread_mutex_lock(&g_unix_lock);
+	if (g_unix_fd < 0)
+	{
+		/* handed over by the process we replace, listening already */
+		int fd = hot_restart_adopt_unix(path);
+		if (fd < 0)
+		{
+			fd = conn_unix_listen_fd(path, opts);
+		}
+		if (fd >= 0)
+		{
+			conn_set_nonblocking(fd);
+			g_unix_fd = fd;
+			snprintf(g_unix_path, sizeof(g_unix_path), "%s", path);
+		}
+	}
+	else if (strcmp(g_unix_path, path) != 0)
+	{
+		LOG_ERROR("Listener: unix socket %s is open already, %s is not", g_unix_path, path);
+		pthread_mutex_unlock(&g_unix_lock);
+		return -1;
+	}
+	if (g_unix_fd >= 0)
+	{
+		g_unix_users++;
+		listen_fd = g_unix_fd;
+	}
+	pthread_mutex_unlock(&g_unix_lock);
+	return listen_fd;
+}
+
+static void conn_unix_release(void)
+{
+	pthread_mutex_lock(&g_unix_lock);
+	if (--g_unix_users == 0)
+	{
+		conn_listen_close(g_unix_fd);
+		g_unix_fd = -1;
+		/* after a handover the file is the next process' socket */
+		if (g_unix_path[0] != '@' && !hot_restart_draining())
+		{
+			unlink(g_unix_path);
+		}
+	}
+	pthread_mutex_unlock(&g_unix_lock);
+}
+
+conn_t *conn_listen_server_unix_accept_factory(conn_listen_server_t *self)
+{
+	for (;;)
+	{
+		int client_fd = accept4(self->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_fd < 0)
+		{
+			/* EAGAIN as well when another loop took the client first */
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				perror("accept unix");
+			}
+			return NULL;
+		}
+		/* the socket's mode lets a group in, this narrows it to the proxy */
+		struct ucred cred;
+		socklen_t cred_len = sizeof(cred);
+		if (TCPServer_UNIX_PEER_UID >= 0 &&
+		    (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+		     (cred.uid != (uid_t)TCPServer_UNIX_PEER_UID && cred.uid != geteuid())))
+		{
+			self->accounting->rejected++;
+			close(client_fd);
+			continue;
+		}
+		/* no address: only the global ceiling applies, every client of the
+		   proxy comes in as this one */
+		struct sockaddr_storage peer;
+		memset(&peer, 0, sizeof(peer));
+		peer.ss_family = AF_UNIX;
+		return conn_tcp_wrap(client_fd, &peer, 0);
+	}
+}
+
+void conn_listen_server_unix_dispose(conn_listen_server_t *self)
+{
+	/* the socket is shared, base cleanup must not close it */
+	int listen_fd = self->listen_fd;
+	self->listen_fd = -1;
+	conn_listen_server_base_cleanup(self);
+	if (listen_fd >= 0)
+	{
+		conn_unix_release();
+	}
+}
+
+conn_listen_server_t *conn_listen_server_unix_init(const char *path, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts)
+{
+	conn_listen_options_t defaults;
+	if (!opts)
+	{
+		conn_listen_options_default(&defaults);
+		opts = &defaults;
+	}
+	int listening_fd = conn_unix_acquire(path, opts);
+	if (listening_fd < 0)
+	{
+		return NULL;
+	}
+	conn_listen_server_unix_t *new_server = (conn_listen_server_unix_t*)malloc(sizeof(conn_listen_server_unix_t));
+	if (!new_server)
+	{
+		conn_unix_release();
+		return NULL;
+	}
+	new_server->base.vtable    = &UNIX_LISTEN_SERVER_VTABLE;
+	new_server->base.listen_fd = listening_fd;
+	new_server->base.on_accept = cb;
+	new_server->base.user_ctx  = ctx;
+	new_server->base.task      = NULL;
+	smw_initTimer(&new_server->base.resume_timer, conn_listen_server_resume, &new_server->base);
+	if (conn_listen_server_admission_init(&new_server->base, "unix", opts) != 0)
+	{
+		conn_unix_release();
+		free(new_server);
+		return NULL;
+	}
+	new_server->base.task = smw_createTask(&new_server->base, conn_listen_server_taskwork);
+	if (!new_server->base.task)
+	{
+		LOG_ERROR("Listener: failed to create task for unix listener");
+		conn_listen_server_unix_dispose(&new_server->base);
+		return NULL;
+	}
+	smw_setTaskName(new_server->base.task, "unix_listener");
+	smw_setPriority(new_server->base.task, smw_priority_low);
+	smw_watchFd(new_server->base.task, listening_fd, SMW_READ);
+
+	return &new_server->base;
+}
+
+////////////////////////////////////////
+// SHARED TLS STATE
+////////////////////////////////////////
+
+/* one set of mbedTLS contexts per process, created by the first TLS listener
+   and freed with the last one. Only the DRBGs, the ticket keys and the
+   session cache are written after setup, mbedTLS locks each internally
+   (MBEDTLS_THREADING_C). */
+static conn_tls_shared_t *g_tls_shared = NULL;
+static pthread_mutex_t    g_tls_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the loop's view and its DRBG, NULL on threads without one */
+static __thread conn_tls_view_t          *t_tls_view = NULL;
+static __thread mbedtls_ctr_drbg_context *t_tls_drbg = NULL;
+
+/* the calling loop's DRBG, the shared one elsewhere: ticket keys and IVs
+   are drawn on whichever loop issues the ticket */
+static int conn_tls_random(void *context, unsigned char *output, size_t length)
+{
+	conn_tls_shared_t *shared = (conn_tls_shared_t*)context;
+	return mbedtls_ctr_drbg_random(t_tls_drbg ? t_tls_drbg : &shared->ctr_drbg, output, length);
+}
+
+#if TLS_EARLY_DATA_ENABLED
+
+/* RFC 8446 8.1: a ticket carries 0-RTT data once. mbedTLS already refuses a
+   ticket whose age is off by more than the tolerance, so a fingerprint only
+   has to be remembered for twice that: a replay any later is no resumption
+   at all. A full neighbourhood turns 0-RTT down rather than forgetting. */
+#define CONN_TLS_REPLAY_WINDOW_MS (2 * MBEDTLS_SSL_TLS1_3_TICKET_AGE_TOLERANCE)
+#define CONN_TLS_REPLAY_PROBES 8
+
+struct conn_tls_replay
+{
+	uint64_t fingerprint;
+	uint64_t expires_ms;
+};
+
+/* 1 the first time the fingerprint is seen within the window, 0 after */
+static int conn_tls_replay_first(conn_tls_shared_t *shared, uint64_t fingerprint)
+{
+	uint64_t now = SystemMonotonicMS();
+	size_t mask = TLS_EARLY_DATA_REPLAY_ENTRIES - 1;
+	struct conn_tls_replay *free_slot = NULL;
+	int first = 1;
+	pthread_mutex_lock(&shared->replay_lock);
+	for (size_t i = 0; i < CONN_TLS_REPLAY_PROBES; i++)
+	{
+		struct conn_tls_replay *slot = &shared->replay[(fingerprint + i) & mask];
+		if (slot->expires_ms <= now)
+		{
+			if (!free_slot)
+			{
+				free_slot = slot;
+			}
+		}
+		else if (slot->fingerprint == fingerprint)
+		{
+			first = 0;
+			break;
+		}
+	}
+	if (first && free_slot)
+	{
+		free_slot->fingerprint = fingerprint;
+		free_slot->expires_ms  = now + CONN_TLS_REPLAY_WINDOW_MS;
+	}
+	pthread_mutex_unlock(&shared->replay_lock);
+	return first && free_slot != NULL;
+}
+
+/* mbedtls_ssl_ticket_parse, and the early data permission taken from
+   tickets seen before. Hashed up front, the parse decrypts in place. */
+static int conn_tls_ticket_parse(void *p_ticket, mbedtls_ssl_session *session,
+	                             unsigned char *buf, size_t len)
+{
+	conn_tls_shared_t *shared = (conn_tls_shared_t*)((char*)p_ticket - offsetof(conn_tls_shared_t, ticket));
+	/* FNV-1a */
+	uint64_t fingerprint = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++)
+	{
+		fingerprint = (fingerprint ^ buf[i]) * 1099511628211ULL;
+	}
+	int rv = mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+	if (rv == 0 && session->MBEDTLS_PRIVATE(tls_version) == MBEDTLS_SSL_VERSION_TLS1_3 &&
+		!conn_tls_replay_first(shared, fingerprint))
+	{
+		session->MBEDTLS_PRIVATE(ticket_flags) &= ~MBEDTLS_SSL_TLS1_3_TICKET_ALLOW_EARLY_DATA;
+	}
+	return rv;
+}
+
+#endif
+
+/* X25519 is the cheapest key exchange there is, P-256 for clients without */
+static const uint16_t g_tls_groups[] =
+{
+	MBEDTLS_SSL_IANA_TLS_GROUP_X25519,
+	MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+	MBEDTLS_SSL_IANA_TLS_GROUP_SECP384R1,
+	MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+};
+
+#if TLS_ALPN_HTTP2
+/* in our order, a client without ALPN stays on HTTP/1.1 as well */
+static const char *g_tls_alpn[] = { "h2", "http/1.1", NULL };
+#endif
+
+/* RFC 6066 code of a record length, anything else keeps full records */
+static unsigned char conn_tls_mfl_code(int bytes)
+{
+	switch (bytes)
+	{
+	case 512:  return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+	case 1024: return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+	case 2048: return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+	case 4096: return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+	default:   return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+	}
+}
+
+/* AES-GCM beats ChaCha20-Poly1305 only with AES instructions */
+static int conn_tls_cpu_has_aes(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("aes");
+#elif defined(__aarch64__) && defined(HWCAP_AES)
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+	return 0;
+#endif
+}
+
+/* TLS 1.3 first, then ECDSA ahead of RSA for TLS 1.2: the ECDSA suites
+   only match when that certificate is loaded. Fits conn_tls_shared_t's
+   ciphersuites. */
+static void conn_tls_ciphersuites(int *suites)
+{
+	int aes = conn_tls_cpu_has_aes();
+	int n = 0;
+	suites[n++] = aes ? MBEDTLS_TLS1_3_AES_128_GCM_SHA256 : MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256;
+	suites[n++] = aes ? MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256 : MBEDTLS_TLS1_3_AES_128_GCM_SHA256;
+	suites[n++] = MBEDTLS_TLS1_3_AES_256_GCM_SHA384;
+	suites[n++] = aes ? MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256 : MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256;
+	suites[n++] = aes ? MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256 : MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256;
+	suites[n++] = MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384;
+	suites[n++] = aes ? MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 : MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256;
+	suites[n++] = aes ? MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256 : MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256;
+	suites[n++] = MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384;
+	suites[n] = 0;
+}
+
+#if !SKIP_TLS_CERT_FOR_DEV
+/* reads the whole file and parses it, mbedtls_pk_parse_keyfile failed on
+   our keys. 0 or an mbedTLS error. */
+static int conn_tls_load_key(mbedtls_pk_context *pkey, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+	{
+		LOG_ERROR("TLS failed to open private key file %s", path);
+		return MBEDTLS_ERR_PK_FILE_IO_ERROR;
+	}
+	fseek(f, 0, SEEK_END);
+	long file_size = ftell(f);
+	rewind(f);
+	if (file_size < 0)
+	{
+		LOG_ERROR("TLS failed to get private key file size %s", path);
+		fclose(f);
+		return MBEDTLS_ERR_PK_FILE_IO_ERROR;
+	}
+	/* +1 for the terminator PEM parsing wants */
+	unsigned char *key_buffer = (unsigned char *)malloc(file_size + 1);
+	if (key_buffer == NULL)
+	{
+		LOG_ERROR("TLS failed to allocate memory for private key");
+		fclose(f);
+		return MBEDTLS_ERR_PK_ALLOC_FAILED;
+	}
+	if (fread(key_buffer, 1, file_size, f) != (size_t)file_size)
+	{
+		LOG_ERROR("TLS failed to read private key file content %s", path);
+		free(key_buffer);
+		fclose(f);
+		return MBEDTLS_ERR_PK_FILE_IO_ERROR;
+	}
+	fclose(f);
+	key_buffer[file_size] = '\0';
+
+	int rv = mbedtls_pk_parse_key(pkey, key_buffer, file_size + 1, NULL, 0, NULL, NULL);
+	mbedtls_platform_zeroize(key_buffer, file_size + 1);
+	free(key_buffer);
+	return rv;
+}
+#endif
+
+/* an extra reference for holders that outlive the listener */
+static void conn_tls_shared_retain(conn_tls_shared_t *shared)
+{
+	pthread_mutex_lock(&g_tls_shared_lock);
+	shared->refcount++;
+	pthread_mutex_unlock(&g_tls_shared_lock);
+}
+
+static void conn_tls_shared_free(conn_tls_shared_t *shared)
+{
+	mbedtls_ssl_cache_free(&shared->cache);
+	mbedtls_ssl_ticket_free(&shared->ticket);
+	free(shared->replay);
+	pthread_mutex_destroy(&shared->replay_lock);
+	mbedtls_x509_crt_free(&shared->srvcert);
+	mbedtls_pk_free(&shared->pkey);
+	mbedtls_x509_crt_free(&shared->ecdsa_cert);
+	mbedtls_pk_free(&shared->ecdsa_pkey);
+	mbedtls_ctr_drbg_free(&shared->ctr_drbg);
+	mbedtls_entropy_free(&shared->entropy);
+	free(shared);
+}
+
+////////////////////////////////////////
+// ASYNC PRIVATE KEY OPERATIONS
+////////////////////////////////////////
+
+/* The server signature of a full TLS 1.2 handshake is by far its most
+   expensive step, it runs on the job pool so the loop keeps serving other
+   connections meanwhile. mbedTLS hands us the hash and picks the result up
+   through resume once conn_tls_async_done has woken the connection.
+   TLS 1.3 has no async hook in mbedTLS and still signs inline. */
+typedef struct
+{
+	conn_tls_t *tls;
+	/* keeps the keys and the DRBG alive while a pool thread uses them */
+	conn_tls_shared_t *shared;
+	/* the key of the certificate the handshake picked */
+	mbedtls_pk_context *pkey;
+	job_pool_job *job;
+	mbedtls_md_type_t md_alg;
+	unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+	size_t hash_len;
+	unsigned char sig[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
+	size_t sig_len;
+	int result;
+	int done;
+} conn_tls_async_op_t;
+
+static void conn_tls_async_free(conn_tls_async_op_t *op)
+{
+	conn_tls_shared_release(op->shared);
+	free(op);
+}
+
+/* pool thread, both contexts are locked internally (MBEDTLS_THREADING_C);
+   no loop's view here, the shared DRBG is only drawn on by the pool */
+static void conn_tls_async_work(void *context)
+{
+	conn_tls_async_op_t *op = (conn_tls_async_op_t*)context;
+	op->result = mbedtls_pk_sign(op->pkey, op->md_alg, op->hash, op->hash_len,
+		                         op->sig, sizeof(op->sig), &op->sig_len,
+		                         conn_tls_random, op->shared);
+}
+
+/* back on the loop of the connection */
+static void conn_tls_async_done(void *context)
+{
+	conn_tls_async_op_t *op = (conn_tls_async_op_t*)context;
+	op->job  = NULL;
+	op->done = 1;
+	if (op->tls->owner)
+	{
+		smw_wakeTask(op->tls->owner);
+	}
+}
+
+/* the connection went away first */
+static void conn_tls_async_release(void *context)
+{
+	conn_tls_async_free((conn_tls_async_op_t*)context);
+}
+
+static int conn_tls_async_sign(mbedtls_ssl_context *ssl, mbedtls_x509_crt *cert,
+	                           mbedtls_md_type_t md_alg, const unsigned char *hash, size_t hash_len)
+{
+	conn_tls_shared_t *shared = (conn_tls_shared_t*)mbedtls_ssl_conf_get_async_config_data(mbedtls_ssl_context_get_config(ssl));
+	if (hash_len > MBEDTLS_MD_MAX_SIZE)
+	{
+		return MBEDTLS_ERR_SSL_HW_ACCEL_FALLTHROUGH;
+	}
+	conn_tls_async_op_t *op = (conn_tls_async_op_t*)calloc(1, sizeof(conn_tls_async_op_t));
+	if (!op)
+	{
+		/* sign inline instead */
+		return MBEDTLS_ERR_SSL_HW_ACCEL_FALLTHROUGH;
+	}
+	op->tls      = (conn_tls_t*)mbedtls_ssl_get_user_data_p(ssl);
+	op->md_alg   = md_alg;
+	op->hash_len = hash_len;
+	memcpy(op->hash, hash, hash_len);
+
+	conn_tls_shared_retain(shared);
+	op->shared = shared;
+	op->pkey   = cert == &shared->ecdsa_cert ? &shared->ecdsa_pkey : &shared->pkey;
+
+	op->job = job_pool_submit(conn_tls_async_work, conn_tls_async_done, op);
+	if (!op->job)
+	{
+		conn_tls_async_free(op);
+		return MBEDTLS_ERR_SSL_HW_ACCEL_FALLTHROUGH;
+	}
+	mbedtls_ssl_set_async_operation_data(ssl, op);
+	return 0;
+}
+
+static int conn_tls_async_resume(mbedtls_ssl_context *ssl, unsigned char *output,
+	                             size_t *output_len, size_t output_size)
+{
+	conn_tls_async_op_t *op = (conn_tls_async_op_t*)mbedtls_ssl_get_async_operation_data(ssl);
+	if (!op->done)
+	{
+		return MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS;
+	}
+	int rv = op->result;
+	if (rv == 0)
+	{
+		if (op->sig_len > output_size)
+		{
+			rv = MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+		}
+		else
+		{
+			memcpy(output, op->sig, op->sig_len);
+			*output_len = op->sig_len;
+		}
+	}
+	mbedtls_ssl_set_async_operation_data(ssl, NULL);
+	conn_tls_async_free(op);
+	return rv;
+}
+
+/* handshake freed while the operation is pending */
+static void conn_tls_async_cancel(mbedtls_ssl_context *ssl)
+{
+	conn_tls_async_op_t *op = (conn_tls_async_op_t*)mbedtls_ssl_get_async_operation_data(ssl);
+	if (!op)
+	{
+		return;
+	}
+	mbedtls_ssl_set_async_operation_data(ssl, NULL);
+	if (op->job)
+	{
+		job_pool_abandon(op->job, conn_tls_async_release);
+	}
+	else
+	{
+		conn_tls_async_free(op);
+	}
+}
+
+/* everything mbedTLS allocates counts as tls memory; its frees don't know
+   the size, the tagged allocator keeps it */
+static void *conn_tls_calloc(size_t count, size_t size)
+{
+	return mem_account_calloc(MEM_TAG_TLS, count, size);
+}
+
+static void conn_tls_free(void *ptr)
+{
+	mem_account_release(MEM_TAG_TLS, ptr);
+}
+
+static conn_tls_shared_t *conn_tls_shared_create(void)
+{
+	/* the first mbedTLS call of the process, under g_tls_shared_lock */
+	static int allocator_set = 0;
+	if (!allocator_set)
+	{
+		mbedtls_platform_set_calloc_free(conn_tls_calloc, conn_tls_free);
+		allocator_set = 1;
+	}
+	conn_tls_shared_t *shared = (conn_tls_shared_t*)calloc(1, sizeof(conn_tls_shared_t));
+	if (!shared)
+	{
+		return NULL;
+	}
+	/* initialization of embedtls global state */
+	mbedtls_x509_crt_init(&shared->srvcert);
+	pthread_mutex_init(&shared->replay_lock, NULL);
+	mbedtls_x509_crt_init(&shared->ecdsa_cert);
+	mbedtls_pk_init(&shared->ecdsa_pkey);
+	mbedtls_pk_init(&shared->pkey);
+	mbedtls_entropy_init(&shared->entropy);
+	mbedtls_ctr_drbg_init(&shared->ctr_drbg);
+	mbedtls_ssl_ticket_init(&shared->ticket);
+	mbedtls_ssl_cache_init(&shared->cache);
+	/* rng and cert setup */
+	int rv;
+	const char *pers = "https_server";
+	/* The personalization string is a small protection against a lack of startup
+	   entropy and ensures each application has at least a different starting point.
+	*/
+	rv = mbedtls_ctr_drbg_seed(&shared->ctr_drbg, mbedtls_entropy_func,
+		                       &shared->entropy, (const unsigned char *)pers, strlen(pers));
+	if (rv != 0)
+	{
+		LOG_ERROR("TLS failed to seed Random Number Generator (error: %d)", rv);
+		conn_tls_shared_free(shared);
+		return NULL;	   
+	}
+
+#if SKIP_TLS_CERT_FOR_DEV
+	/* Skip certificate and key loading for development */
+	LOG_WARN("\033[1;31mWARNING: Running TLS server without certificates (development mode)\033[0m");
+	LOG_WARN("\033[1;31mWARNING: Running TLS server without certificates (development mode)\033[0m");
+	LOG_WARN("\033[1;31mWARNING: Running TLS server without certificates (development mode)\033[0m");
+
+#else
+	/* load cert */
+	rv = mbedtls_x509_crt_parse_file(&shared->srvcert, CERT_FILE_PATH);
+	if (rv != 0)
+	{
+		LOG_ERROR("TLS failed to load cert %s (error: %d)", CERT_FILE_PATH, rv);
+		conn_tls_shared_free(shared);
+		return NULL;
+	}
+	
+	/* load private key */
+	rv = conn_tls_load_key(&shared->pkey, PRIVKEY_FILE_PATH);
+	if (rv != 0)
+	{
+		LOG_ERROR("TLS failed to load private key %s (error: %d)", PRIVKEY_FILE_PATH, rv);
+		conn_tls_shared_free(shared);
+		return NULL;
+	}
+
+	/* an ECDSA signature costs a fraction of an RSA one, clients that take
+	   it get this pair and RSA is left as the fallback */
+	if (ECDSA_CERT_FILE_PATH[0] != '\0')
+	{
+		rv = mbedtls_x509_crt_parse_file(&shared->ecdsa_cert, ECDSA_CERT_FILE_PATH);
+		if (rv != 0)
+		{
+			LOG_ERROR("TLS failed to load cert %s (error: %d)", ECDSA_CERT_FILE_PATH, rv);
+			conn_tls_shared_free(shared);
+			return NULL;
+		}
+		rv = conn_tls_load_key(&shared->ecdsa_pkey, ECDSA_PRIVKEY_FILE_PATH);
+		if (rv != 0)
+		{
+			LOG_ERROR("TLS failed to load private key %s (error: %d)", ECDSA_PRIVKEY_FILE_PATH, rv);
+			conn_tls_shared_free(shared);
+			return NULL;
+		}
+		if (!mbedtls_pk_can_do(&shared->ecdsa_pkey, MBEDTLS_PK_ECDSA))
+		{
+			LOG_ERROR("TLS key %s is not an ECDSA key", ECDSA_PRIVKEY_FILE_PATH);
+			conn_tls_shared_free(shared);
+			return NULL;
+		}
+		shared->has_ecdsa = 1;
+	}
+#endif
+	conn_tls_ciphersuites(shared->ciphersuites);
+
+	/* Every request is a new connection, let returning clients skip the full
+	   handshake. The ticket key is replaced every lifetime, tickets sealed
+	   with the previous key stay valid for one more period. Shared so a
+	   ticket issued on one loop resumes on any other. */
+	rv = mbedtls_ssl_ticket_setup(&shared->ticket, conn_tls_random, shared,
+		                          MBEDTLS_CIPHER_AES_256_GCM, TLS_TICKET_LIFETIME_SECONDS);
+	if (rv != 0)
+	{
+		LOG_ERROR("TLS failed to set up session tickets (error: %d)", rv);
+		conn_tls_shared_free(shared);
+		return NULL;
+	}
+#if TLS_EARLY_DATA_ENABLED
+	shared->replay = (struct conn_tls_replay*)calloc(TLS_EARLY_DATA_REPLAY_ENTRIES, sizeof(struct conn_tls_replay));
+	if (!shared->replay)
+	{
+		LOG_ERROR("TLS failed to allocate the 0-RTT replay table");
+		conn_tls_shared_free(shared);
+		return NULL;
+	}
+#endif
+#if TLS_SESSION_CACHE_ENABLED
+	/* session id resumption for clients without ticket support */
+	mbedtls_ssl_cache_set_max_entries(&shared->cache, TLS_SESSION_CACHE_MAX_ENTRIES);
+	mbedtls_ssl_cache_set_timeout(&shared->cache, TLS_SESSION_CACHE_TIMEOUT_SECONDS);
+#endif
+
+	return shared;
+}
+
+static void conn_tls_view_free(conn_tls_view_t *view)
+{
+	mbedtls_ssl_config_free(&view->conf);
+	mbedtls_ctr_drbg_free(&view->ctr_drbg);
+	if (view->shared)
+	{
+		conn_tls_shared_release(view->shared);
+	}
+	mem_account_free(MEM_TAG_TLS, sizeof(conn_tls_view_t));
+	free(view);
+}
+
+static conn_tls_view_t *conn_tls_view_create(void)
+{
+	conn_tls_view_t *view = (conn_tls_view_t*)calloc(1, sizeof(conn_tls_view_t));
+	if (!view)
+	{
+		return NULL;
+	}
+	mem_account_alloc(MEM_TAG_TLS, sizeof(conn_tls_view_t));
+	mbedtls_ctr_drbg_init(&view->ctr_drbg);
+	mbedtls_ssl_config_init(&view->conf);
+	view->shared = conn_tls_shared_acquire();
+	if (!view->shared)
+	{
+		conn_tls_view_free(view);
+		return NULL;
+	}
+	conn_tls_shared_t *shared = view->shared;
+
+	/* seeded, and reseeded, from the one entropy source; a personalization
+	   of its own keeps the loops apart even if that ever repeated */
+	char pers[64];
+	snprintf(pers, sizeof(pers), "https_server %p", (void*)view);
+	int rv = mbedtls_ctr_drbg_seed(&view->ctr_drbg, mbedtls_entropy_func,
+		                           &shared->entropy, (const unsigned char *)pers, strlen(pers));
+	if (rv != 0)
+	{
+		LOG_ERROR("TLS failed to seed the loop's Random Number Generator (error: %d)", rv);
+		conn_tls_view_free(view);
+		return NULL;
+	}
+
+	/* Load reasonable default SSL configuration values.
+	   param: conf – SSL configuration context
+	   param: endpoint – MBEDTLS_SSL_IS_CLIENT or MBEDTLS_SSL_IS_SERVER
+	   param: transport – MBEDTLS_SSL_TRANSPORT_STREAM for TLS, or MBEDTLS_SSL_TRANSPORT_DATAGRAM for DTLS
+	   param: preset – a MBEDTLS_SSL_PRESET_XXX value
+	   return: 0 if successful, or MBEDTLS_ERR_XXX_ALLOC_FAILED on memory allocation error. 
+	 */
+	rv = mbedtls_ssl_config_defaults(&view->conf,
+		                             MBEDTLS_SSL_IS_SERVER,
+		                             MBEDTLS_SSL_TRANSPORT_STREAM,
+		                             MBEDTLS_SSL_PRESET_DEFAULT);
+	if (rv != 0)
+	{
+		LOG_ERROR("TLS failed to set config defaults (error: %d)", rv);
+		conn_tls_view_free(view);
+		return NULL;
+	}
+#if !SKIP_TLS_CERT_FOR_DEV
+	/* assign the loaded cert/key to configuration, the first one that fits
+	   the suite and the client's signature algorithms is served */
+	if (shared->has_ecdsa)
+	{
+		mbedtls_ssl_conf_own_cert(&view->conf, &shared->ecdsa_cert, &shared->ecdsa_pkey);
+	}
+	mbedtls_ssl_conf_own_cert(&view->conf, &shared->srvcert, &shared->pkey);
+#endif
+	/* forward secret suites only, in our order rather than the client's */
+	mbedtls_ssl_conf_ciphersuites(&view->conf, shared->ciphersuites);
+	mbedtls_ssl_conf_groups(&view->conf, g_tls_groups);
+	/* the output buffer of every connection is sized to the records sent,
+	   a client's max_fragment_length takes both buffers lower */
+	mbedtls_ssl_conf_max_frag_len(&view->conf, conn_tls_mfl_code(TLS_MAX_FRAGMENT_BYTES));
+#if TLS_ALPN_HTTP2
+	/* HTTPServerConnection hands a connection that settles on h2 to
+	   HTTP2Connection once the handshake is done */
+	mbedtls_ssl_conf_alpn_protocols(&view->conf, g_tls_alpn);
+#endif
+	/* assign the rng */
+	mbedtls_ssl_conf_rng(&view->conf, mbedtls_ctr_drbg_random, &view->ctr_drbg);
+#if TLS_EARLY_DATA_ENABLED
+	mbedtls_ssl_conf_session_tickets_cb(&view->conf, mbedtls_ssl_ticket_write, conn_tls_ticket_parse, &shared->ticket);
+	/* 0-RTT requests of returning clients, the routes decide what they
+	   answer from it (HTTPServerConnection_Request's earlyData) */
+	mbedtls_ssl_conf_early_data(&view->conf, MBEDTLS_SSL_EARLY_DATA_ENABLED);
+	mbedtls_ssl_conf_max_early_data_size(&view->conf, TLS_EARLY_DATA_MAX_BYTES);
+#else
+	mbedtls_ssl_conf_session_tickets_cb(&view->conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse, &shared->ticket);
+#endif
+#if TLS_SESSION_CACHE_ENABLED
+	mbedtls_ssl_conf_session_cache(&view->conf, &shared->cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+#endif
+#if TLS_ASYNC_PRIVATE_KEY
+	/* RSA key exchange is left to decrypt inline, only ECDHE suites sign */
+	mbedtls_ssl_conf_async_private_cb(&view->conf, conn_tls_async_sign, NULL,
+		                              conn_tls_async_resume, conn_tls_async_cancel, shared);
+#endif
+
+	return view;
+}
+
+conn_tls_shared_t *conn_tls_shared_acquire(void)
+{
+	pthread_mutex_lock(&g_tls_shared_lock);
+	if (!g_tls_shared)
+	{
+		g_tls_shared = conn_tls_shared_create();
+	}
+	if (g_tls_shared)
+	{
+		g_tls_shared->refcount++;
+	}
+	conn_tls_shared_t *shared = g_tls_shared;
+	pthread_mutex_unlock(&g_tls_shared_lock);
+	return shared;
+}
+
+void conn_tls_shared_release(conn_tls_shared_t *shared)
+{
+	pthread_mutex_lock(&g_tls_shared_lock);
+	if (--shared->refcount == 0)
+	{
+		conn_tls_shared_free(shared);
+		g_tls_shared = NULL;
+	}
+	pthread_mutex_unlock(&g_tls_shared_lock);
+}
+
+conn_tls_view_t *conn_tls_view_acquire(void)
+{
+	if (!t_tls_view)
+	{
+		t_tls_view = conn_tls_view_create();
+		t_tls_drbg = t_tls_view ? &t_tls_view->ctr_drbg : NULL;
+	}
+	if (t_tls_view)
+	{
+		t_tls_view->refcount++;
+	}
+	return t_tls_view;
+}
+
+void conn_tls_view_release(conn_tls_view_t *view)
+{
+	if (--view->refcount > 0)
+	{
+		return;
+	}
+	if (view == t_tls_view)
+	{
+		t_tls_view = NULL;
+		t_tls_drbg = NULL;
+	}
+	conn_tls_view_free(view);
+}
+
+conn_listen_server_t *conn_listen_server_tls_init(const char *port, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts)
+{
+	(void)port;	
+	int listen_fd = conn_listen_fd(TLS_PORT, opts);
+	if (listen_fd < 0)
+	{
+		return NULL;
+	}
+	conn_set_nonblocking(listen_fd);
+	conn_listen_server_tls_t *new_server = (conn_listen_server_tls_t*)calloc(1, sizeof(conn_listen_server_tls_t));
+	if (!new_server)
+	{
+		conn_listen_close(listen_fd);
+		return NULL;
+	}
+	new_server->base.listen_fd = listen_fd;
+	/* the loop's own config and DRBG over the cert and key every worker's
+	   listener shares */
+	new_server->view = conn_tls_view_acquire();
+	if (!new_server->view)
+	{
+		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
+		return NULL;
+	}
+	
+	/* finally wire up base/ parent */
+	new_server->base.vtable    = &TLS_LISTEN_SERVER_VTABLE;
+	new_server->base.on_accept = cb;
+	new_server->base.user_ctx  = ctx;
+	smw_initTimer(&new_server->base.resume_timer, conn_listen_server_resume, &new_server->base);
+	if (conn_listen_server_admission_init(&new_server->base, "tls", opts) != 0)
+	{
+		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
+		return NULL;
+	}
+	new_server->base.task      = smw_createTask(&new_server->base, conn_listen_server_taskwork);
+	if (!new_server->base.task)
+	{
+		LOG_ERROR("TLS failed to create task for TLS listener server");
+		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
+		return NULL;
+	}
+	smw_setTaskName(new_server->base.task, "tls_listener");
+	smw_setPriority(new_server->base.task, smw_priority_low);
+	smw_watchFd(new_server->base.task, listen_fd, SMW_READ);
+		
+	return &new_server->base;
+}
+////////////////////////////////////////
+// IO_URING IMPLEMENTATION
+////////////////////////////////////////
+/* completion based tcp: one multishot accept per listener, one multishot
+   recv per connection filling provided buffers, writes are coalesced and
+   sent once per loop pass, and the last send is linked to the close.
+   Every request is queued on the worker's ring and submitted together. */
+
+static void conn_uring_try_free(conn_uring_t *conn)
+{
+	/* the kernel may still write into us until the last completion */
+	if (!conn->closing || !conn->close_done || conn->recv_armed || conn->sending)
+	{
+		return;
+	}
+	for (int i = 0; i < conn->chunk_count; i++)
+	{
+		uring_recycleBuffer(conn->chunks[conn->chunk_head + i].bid);
+	}
+	free(conn->chunks);
+	free(conn->out);
+	mem_account_free(MEM_TAG_CONNECTIONS, sizeof(conn_uring_t));
+	free(conn);
+}
+
+static int conn_uring_push_chunk(conn_uring_t *conn, uint16_t bid, uint16_t len)
+{
+	if (conn->chunk_head + conn->chunk_count == conn->chunk_cap)
+	{
+		if (conn->chunk_head > 0)
+		{
+			/* slide the unread chunks back to the front */
+			memmove(conn->chunks, conn->chunks + conn->chunk_head, conn->chunk_count * sizeof(conn_uring_chunk_t));
+			conn->chunk_head = 0;
+		}
+		else
+		{
+			int cap = conn->chunk_cap ? conn->chunk_cap * 2 : 4;
+			conn_uring_chunk_t *chunks = (conn_uring_chunk_t*)realloc(conn->chunks, cap * sizeof(conn_uring_chunk_t));
+			if (!chunks)
+			{
+				return -1;
+			}
+			conn->chunks    = chunks;
+			conn->chunk_cap = cap;
+		}
+	}
+	conn_uring_chunk_t *chunk = &conn->chunks[conn->chunk_head + conn->chunk_count++];
+	chunk->bid    = bid;
+	chunk->offset = 0;
+	chunk->len    = len;
+	return 0;
+}
+
+static void conn_uring_cancel(uring_op *op)
+{
+	struct io_uring_sqe *sqe = uring_getSqe(NULL);
+	if (sqe)
+	{
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr   = (uint64_t)(uintptr_t)op;
+	}
+}
+
+static void conn_uring_arm_recv(conn_uring_t *conn)
+{
+	struct io_uring_sqe *sqe = uring_getSqe(&conn->recv_op);
+	if (!sqe)
+	{
+		/* no way to receive anything, let the owner dispose it */
+		conn->eof = 1;
+		return;
+	}
+	sqe->opcode    = IORING_OP_RECV;
+	sqe->fd        = conn->base.client_fd;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	conn->recv_armed = 1;
+}
+
+static void conn_uring_on_recv(uring_op *op, int32_t res, uint32_t flags)
+{
+	conn_uring_t *conn = (conn_uring_t*)op->context;
+	if (!(flags & IORING_CQE_F_MORE))
+	{
+		conn->recv_armed = 0;
 	}
-	if (listen(listening_fd, TCPServer_MAX_CLIENTS) < 0)
+
+	if (flags & IORING_CQE_F_BUFFER)
 	{
-		close(listening_fd);
-		return NULL;
+		uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+		if (res <= 0 || conn->closing || conn_uring_push_chunk(conn, bid, (uint16_t)res) != 0)
+		{
+			uring_recycleBuffer(bid);
+		}
 	}
-	conn_set_nonblocking(listening_fd);
-	conn_listen_server_tcp_t *new_server = (conn_listen_server_tcp_t*)malloc(sizeof(conn_listen_server_tcp_t));
-	if (!new_server)
+	if (res == 0 || (res < 0 && res != -ENOBUFS && res != -ECANCELED))
 	{
-		close(listening_fd);
-		return NULL;
+		/* peer closed or the socket broke */
+		conn->eof = 1;
+	}
+	/* -ENOBUFS: every buffer is taken, read() re-arms once some are back */
+
+	if (conn->closing)
+	{
+		conn_uring_try_free(conn);
+		return;
+	}
+	if (conn->owner && (conn->watch_events & SMW_READ))
+	{
+		smw_wakeTask(conn->owner);
 	}
-	/* wire up base/ parent */
-	new_server->base.vtable    = &TCP_LISTEN_SERVER_VTABLE;
-	new_server->base.listen_fd = listening_fd;
-	/* setting call back here */
-	new_server->base.on_accept = cb;
-	new_server->base.user_ctx  = ctx;
-	new_server->base.recent_connections      = 0;
-	new_server->base.recent_connections_time = 0;
-	/* add to scheduler  */
-	new_server->base.task = smw_createTask(&new_server->base, conn_listen_server_taskwork);
-	
-	return &new_server->base;
 }
 
-conn_listen_server_t *conn_listen_server_tls_init(const char *port, OnAcceptCallBack cb, void *ctx)
+static void conn_uring_queue_close(conn_uring_t *conn, int linked)
 {
-	(void)port;	
-	int listen_fd = conn_bind_fd(TLS_PORT);
-	if (listen_fd < 0)
+	struct io_uring_sqe *sqe = uring_getSqe(&conn->close_op);
+	if (!sqe)
 	{
-		return NULL;
+		/* ring is full, close it the old fashioned way */
+		if (!linked)
+		{
+			close(conn->base.client_fd);
+			conn->close_queued = 1;
+			conn->close_done   = 1;
+		}
+		return;
 	}
-	if (listen(listen_fd, TCPServer_MAX_CLIENTS) < 0)
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd     = conn->base.client_fd;
+	conn->close_queued = 1;
+}
+
+static void conn_uring_flush(uring_flush *flush)
+{
+	conn_uring_t *conn = (conn_uring_t*)flush->context;
+	int linked = 0;
+
+	/* one send in flight at a time, its completion flushes whatever
+	   was written in the meantime */
+	if (!conn->sending && conn->out_len > 0 && !conn->send_failed)
 	{
-		close(listen_fd);
-		return NULL;
+		struct io_uring_sqe *sqe = uring_getSqe(&conn->send_op);
+		if (!sqe)
+		{
+			conn->send_failed = 1;
+		}
+		else
+		{
+			conn->sending     = conn->out;
+			conn->sending_len = conn->out_len;
+			conn->out         = NULL;
+			conn->out_len     = 0;
+			conn->out_cap     = 0;
+
+			sqe->opcode    = IORING_OP_SEND;
+			sqe->fd        = conn->base.client_fd;
+			sqe->addr      = (uint64_t)(uintptr_t)conn->sending;
+			sqe->len       = conn->sending_len;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			if (conn->closing)
+			{
+				/* the response is complete, close right behind it */
+				sqe->flags |= IOSQE_IO_LINK;
+				linked = 1;
+			}
+		}
 	}
-	conn_set_nonblocking(listen_fd);
-	conn_listen_server_tls_t *new_server = (conn_listen_server_tls_t*)calloc(1, sizeof(conn_listen_server_tls_t));
-	if (!new_server)
+
+	if (conn->closing && !conn->close_queued && (linked || !conn->sending))
 	{
-		close(listen_fd);
-		return NULL;
+		/* if the ring is full the send completion queues it instead */
+		conn_uring_queue_close(conn, linked);
 	}
-	/* initialization of embedtls global state */
-	mbedtls_ssl_config_init(&new_server->conf);
-	mbedtls_x509_crt_init(&new_server->srvcert);
-	mbedtls_pk_init(&new_server->pkey);
-	mbedtls_entropy_init(&new_server->entropy);
-	mbedtls_ctr_drbg_init(&new_server->ctr_drbg);
-	/* rng and cert setup */
-	int rv;
-	const char *pers = "https_server";
-	/* The personalization string is a small protection against a lack of startup
-	   entropy and ensures each application has at least a different starting point.
-	*/
-	rv = mbedtls_ctr_drbg_seed(&new_server->ctr_drbg, mbedtls_entropy_func,
-		                       &new_server->entropy, (const unsigned char *)pers, strlen(pers));
-	if (rv != 0)
+	if (conn->closing)
 	{
-		printf("TLS failed to seed Random Number Generator (error: %d)\n", rv);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
-		return NULL;	   
+		conn_uring_try_free(conn);
 	}
+}
 
-#if SKIP_TLS_CERT_FOR_DEV
-	/* Skip certificate and key loading for development */
-	printf("\033[1;31mWARNING: Running TLS server without certificates (development mode)\033[0m\n");
-	printf("\033[1;31mWARNING: Running TLS server without certificates (development mode)\033[0m\n");
-	printf("\033[1;31mWARNING: Running TLS server without certificates (development mode)\033[0m\n");
+static void conn_uring_on_send(uring_op *op, int32_t res, uint32_t flags)
+{
+	(void)flags;
+	conn_uring_t *conn = (conn_uring_t*)op->context;
+	free(conn->sending);
+	conn->sending     = NULL;
+	conn->sending_len = 0;
+	if (res < 0)
+	{
+		/* nothing written after this will reach the peer */
+		conn->send_failed = 1;
+		conn->out_len     = 0;
+	}
 
-#else
-	/* load cert */
-	rv = mbedtls_x509_crt_parse_file(&new_server->srvcert, CERT_FILE_PATH);
-	if (rv != 0)
+	if (conn->out_len > 0 || (conn->closing && !conn->close_queued))
 	{
-		printf("TLS failed to load cert %s (error: %d)\n", CERT_FILE_PATH, rv);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
-		return NULL;
+		uring_deferFlush(&conn->flush);
 	}
-	
-	/* load private key */
-	/* Did not work
-	  rv = mbedtls_pk_parse_keyfile(&new_server->pkey, PRIVKEY_FILE_PATH, NULL);*/
-	// START FIX: Manually read key file content and use mbedtls_pk_parse_key (robust method)
-	// Friendly AI sloop
-	FILE *f = NULL;
-	long file_size = -1;
-	unsigned char *key_buffer = NULL;
-	// 1. Open the file
-	f = fopen(PRIVKEY_FILE_PATH, "rb");
-	if (f == NULL)
+	if (conn->closing)
 	{
-		printf("TLS failed to open private key file %s\n", PRIVKEY_FILE_PATH);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
-		return NULL;
+		conn_uring_try_free(conn);
 	}
-	// 2. Get file size
-	fseek(f, 0, SEEK_END);
-	file_size = ftell(f);
-	rewind(f);
-	if (file_size < 0)
+}
+
+static void conn_uring_on_close(uring_op *op, int32_t res, uint32_t flags)
+{
+	(void)flags;
+	conn_uring_t *conn = (conn_uring_t*)op->context;
+	if (res == -ECANCELED)
+	{
+		/* the linked send failed and took the close with it */
+		close(conn->base.client_fd);
+	}
+	conn->close_done = 1;
+	conn_uring_try_free(conn);
+}
+
+static conn_uring_t *conn_uring_create(int client_fd)
+{
+	conn_uring_t *conn = (conn_uring_t*)calloc(1, sizeof(conn_uring_t));
+	if (!conn)
 	{
-		printf("TLS failed to get private key file size %s\n", PRIVKEY_FILE_PATH);
-		fclose(f);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
 		return NULL;
 	}
-	// 3. Allocate buffer (+1 for null terminator, required by mbedTLS in some cases)
-	key_buffer = (unsigned char *)malloc(file_size + 1); 
-	if (key_buffer == NULL)
+	mem_account_alloc(MEM_TAG_CONNECTIONS, sizeof(conn_uring_t));
+	conn->base.vtable     = &URING_CONN_VTABLE;
+	conn->base.client_fd  = client_fd;
+	/* multishot accept doesn't report the peer */
+	conn->base.peer_len   = sizeof(conn->base.peer);
+	if (getpeername(client_fd, (struct sockaddr*)&conn->base.peer, &conn->base.peer_len) != 0)
 	{
-		printf("TLS failed to allocate memory for private key\n");
-		fclose(f);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
+		conn->base.peer_len = 0;
+	}
+	conn->recv_op.handler  = conn_uring_on_recv;
+	conn->recv_op.context  = conn;
+	conn->send_op.handler  = conn_uring_on_send;
+	conn->send_op.context  = conn;
+	conn->close_op.handler = conn_uring_on_close;
+	conn->close_op.context = conn;
+	conn->flush.callback   = conn_uring_flush;
+	conn->flush.context    = conn;
+	conn_uring_arm_recv(conn);
+	return conn;
+}
+
+int conn_uring_read(conn_t *self, void *buf, int count)
+{
+	conn_uring_t *conn = (conn_uring_t*)self;
+	int total = 0;
+	while (total < count && conn->chunk_count > 0)
+	{
+		conn_uring_chunk_t *chunk = &conn->chunks[conn->chunk_head];
+		int n = chunk->len - chunk->offset;
+		if (n > count - total)
+		{
+			n = count - total;
+		}
+		memcpy((uint8_t*)buf + total, uring_buffer(chunk->bid) + chunk->offset, n);
+		chunk->offset += n;
+		total         += n;
+		if (chunk->offset == chunk->len)
+		{
+			/* hand the buffer back to the kernel */
+			uring_recycleBuffer(chunk->bid);
+			conn->chunk_head++;
+			if (--conn->chunk_count == 0)
+			{
+				conn->chunk_head = 0;
+			}
+		}
+	}
+	/* multishot recv stops when it ran out of buffers */
+	if (!conn->recv_armed && !conn->eof && !conn->closing)
+	{
+		conn_uring_arm_recv(conn);
+	}
+	if (total > 0)
+	{
+		return total;
+	}
+	return conn->eof ? -1 : 0;
+}
+
+int conn_uring_write(conn_t *self, const void *buf, int count)
+{
+	conn_uring_t *conn = (conn_uring_t*)self;
+	if (conn->send_failed)
+	{
+		return -1;
+	}
+	if (count <= 0)
+	{
+		return 0;
+	}
+	if (conn->out_len + count > conn->out_cap)
+	{
+		int cap = conn->out_cap ? conn->out_cap : 1024;
+		while (cap < conn->out_len + count)
+		{
+			cap *= 2;
+		}
+		uint8_t *out = (uint8_t*)realloc(conn->out, cap);
+		if (!out)
+		{
+			/* nothing taken, get the queued bytes moving first */
+			uring_deferFlush(&conn->flush);
+			return 0;
+		}
+		conn->out     = out;
+		conn->out_cap = cap;
+	}
+	memcpy(conn->out + conn->out_len, buf, count);
+	conn->out_len += count;
+	/* all writes made during this pass go out as one send */
+	uring_deferFlush(&conn->flush);
+	return count;
+}
+
+void conn_uring_close(conn_t *self)
+{
+	conn_account_close(self);
+	conn_uring_t *conn = (conn_uring_t*)self;
+	conn->closing = 1;
+	conn->owner   = NULL;
+	if (conn->recv_armed)
+	{
+		conn_uring_cancel(&conn->recv_op);
+	}
+	/* pending bytes still go out, the flush queues the close after them */
+	uring_deferFlush(&conn->flush);
+}
+
+int conn_uring_watch(conn_t *self, smw_task *task, uint32_t events)
+{
+	conn_uring_t *conn = (conn_uring_t*)self;
+	/* completions wake the task, it must not sit on a stale fd */
+	smw_parkTask(task);
+	conn->owner        = task;
+	conn->watch_events = events;
+	if ((events & SMW_READ) && (conn->chunk_count > 0 || conn->eof))
+	{
+		smw_wakeTask(task);
+	}
+	/* writes are buffered, the connection is always writable */
+	if (events & SMW_WRITE)
+	{
+		smw_wakeTask(task);
+	}
+	return 0;
+}
+
+static void conn_listen_server_uring_finalize(conn_listen_server_uring_t *server)
+{
+	for (int i = 0; i < server->accepted_count; i++)
+	{
+		close(server->accepted[server->accepted_head + i]);
+	}
+	free(server->accepted);
+	if (server->base.listen_fd >= 0)
+	{
+		conn_listen_close(server->base.listen_fd);
+	}
+	free(server);
+}
+
+static void conn_listen_server_uring_arm(conn_listen_server_uring_t *server)
+{
+	struct io_uring_sqe *sqe = uring_getSqe(&server->accept_op);
+	if (!sqe)
+	{
+		return;
+	}
+	sqe->opcode       = IORING_OP_ACCEPT;
+	sqe->fd           = server->base.listen_fd;
+	sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	server->armed = 1;
+}
+
+static int conn_listen_server_uring_push(conn_listen_server_uring_t *server, int fd)
+{
+	if (server->accepted_head + server->accepted_count == server->accepted_cap)
+	{
+		if (server->accepted_head > 0)
+		{
+			memmove(server->accepted, server->accepted + server->accepted_head, server->accepted_count * sizeof(int));
+			server->accepted_head = 0;
+		}
+		else
+		{
+			int cap = server->accepted_cap ? server->accepted_cap * 2 : 16;
+			int *accepted = (int*)realloc(server->accepted, cap * sizeof(int));
+			if (!accepted)
+			{
+				return -1;
+			}
+			server->accepted     = accepted;
+			server->accepted_cap = cap;
+		}
+	}
+	server->accepted[server->accepted_head + server->accepted_count++] = fd;
+	return 0;
+}
+
+static void conn_listen_server_uring_on_accept(uring_op *op, int32_t res, uint32_t flags)
+{
+	conn_listen_server_uring_t *server = (conn_listen_server_uring_t*)op->context;
+	if (!(flags & IORING_CQE_F_MORE))
+	{
+		server->armed      = 0;
+		server->cancelling = 0;
+	}
+
+	if (res >= 0)
+	{
+		if (server->disposed || conn_listen_server_uring_push(server, res) != 0)
+		{
+			close(res);
+		}
+	}
+	else if (res != -ECANCELED)
+	{
+		LOG_WARN("uring accept failed (error: %d)", -res);
+	}
+
+	if (server->disposed)
+	{
+		if (!server->armed)
+		{
+			conn_listen_server_uring_finalize(server);
+		}
+		return;
+	}
+	/* enough clients waiting, let the kernel backlog hold the rest */
+	if (server->armed && !server->cancelling && server->accepted_count >= TCPServer_MAX_CLIENTS)
+	{
+		conn_uring_cancel(&server->accept_op);
+		server->cancelling = 1;
+	}
+	smw_wakeTask(server->base.task);
+}
+
+conn_t *conn_listen_server_uring_accept_factory(conn_listen_server_t *self)
+{
+	conn_listen_server_uring_t *server = (conn_listen_server_uring_t*)self;
+	if (!server->armed && server->accepted_count < TCPServer_MAX_CLIENTS)
+	{
+		conn_listen_server_uring_arm(server);
+	}
+	if (server->accepted_count == 0)
+	{
+		/* no new client */
 		return NULL;
 	}
-	// 4. Read file content
-	if (fread(key_buffer, 1, file_size, f) != file_size)
+
+	int client_fd = server->accepted[server->accepted_head++];
+	if (--server->accepted_count == 0)
+	{
+		server->accepted_head = 0;
+	}
+	else
 	{
-		printf("TLS failed to read private key file content %s\n", PRIVKEY_FILE_PATH);
-		free(key_buffer);
-		fclose(f);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
+		/* hand out the rest on the next passes */
+		smw_wakeTask(self->task);
+	}
+
+	conn_uring_t *new_conn = conn_uring_create(client_fd);
+	if (!new_conn)
+	{
+		close(client_fd);
 		return NULL;
 	}
-	fclose(f);
-	key_buffer[file_size] = '\0'; // Null-terminate the buffer
+	return &new_conn->base;
+}
 
-	/* load private key from buffer */
-	// Use mbedtls_pk_parse_key with 7 arguments
-	rv = mbedtls_pk_parse_key(&new_server->pkey, 
-							  key_buffer, 
-							  file_size + 1, // Pass length including null terminator
-							  NULL, 0, NULL, NULL);
+int conn_listen_server_uring_watch(conn_listen_server_t *self, uint32_t events)
+{
+	conn_listen_server_uring_t *server = (conn_listen_server_uring_t*)self;
+	/* accept completions wake the task, paused listeners just stay asleep */
+	smw_parkTask(self->task);
+	if ((events & SMW_READ) && server->accepted_count > 0)
+	{
+		smw_wakeTask(self->task);
+	}
+	return 0;
+}
 
-	// 5. Cleanup buffer
-	free(key_buffer);
-	
-	// END FIX
-	if (rv != 0)
+void conn_listen_server_uring_dispose(conn_listen_server_t *self)
+{
+	conn_listen_server_uring_t *server = (conn_listen_server_uring_t*)self;
+	conn_listen_server_admission_dispose(self);
+	if (self->task)
+	{
+		smw_destroyTask(self->task);
+		self->task = NULL;
+	}
+	server->disposed = 1;
+	if (!server->armed)
+	{
+		conn_listen_server_uring_finalize(server);
+		return;
+	}
+	/* the final accept completion frees it */
+	if (!server->cancelling)
+	{
+		conn_uring_cancel(&server->accept_op);
+		server->cancelling = 1;
+	}
+}
+
+conn_listen_server_t *conn_listen_server_uring_init(const char *port, OnAcceptCallBack cb, void *ctx, const conn_listen_options_t *opts)
+{
+	if (uring_attach() != 0)
 	{
-		printf("TLS failed to load private key %s (error: %d)\n", PRIVKEY_FILE_PATH, rv);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
 		return NULL;
 	}
-	
-	/* assign the loaded cert/key to configuration */
-	mbedtls_ssl_conf_own_cert(&new_server->conf, &new_server->srvcert, &new_server->pkey);
-#endif
-	
-	/* Load reasonable default SSL configuration values.
-	   param: conf – SSL configuration context
-	   param: endpoint – MBEDTLS_SSL_IS_CLIENT or MBEDTLS_SSL_IS_SERVER
-	   param: transport – MBEDTLS_SSL_TRANSPORT_STREAM for TLS, or MBEDTLS_SSL_TRANSPORT_DATAGRAM for DTLS
-	   param: preset – a MBEDTLS_SSL_PRESET_XXX value
-	   return: 0 if successful, or MBEDTLS_ERR_XXX_ALLOC_FAILED on memory allocation error. 
-	 */
-	rv = mbedtls_ssl_config_defaults(&new_server->conf,
-		                             MBEDTLS_SSL_IS_SERVER,
-		                             MBEDTLS_SSL_TRANSPORT_STREAM,
-		                             MBEDTLS_SSL_PRESET_DEFAULT);
-	if (rv != 0)
+	int listening_fd = conn_listen_fd(port, opts);
+	if (listening_fd < 0)
 	{
-		printf("TLS failed to set config defaults (error: %d)\n", rv);
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
 		return NULL;
 	}
-	/* assign the rng */
-	mbedtls_ssl_conf_rng(&new_server->conf, mbedtls_ctr_drbg_random, &new_server->ctr_drbg);
-	
-	/* finally wire up base/ parent */
-	new_server->base.vtable    = &TLS_LISTEN_SERVER_VTABLE;
-	new_server->base.listen_fd = listen_fd;
+	conn_set_nonblocking(listening_fd);
+	conn_listen_server_uring_t *new_server = (conn_listen_server_uring_t*)calloc(1, sizeof(conn_listen_server_uring_t));
+	if (!new_server)
+	{
+		conn_listen_close(listening_fd);
+		return NULL;
+	}
+	/* wire up base/ parent */
+	new_server->base.vtable    = &URING_LISTEN_SERVER_VTABLE;
+	new_server->base.listen_fd = listening_fd;
 	new_server->base.on_accept = cb;
 	new_server->base.user_ctx  = ctx;
-	new_server->base.recent_connections      = 0;
-	new_server->base.recent_connections_time = 0;
-	new_server->base.task      = smw_createTask(&new_server->base, conn_listen_server_taskwork);
+	smw_initTimer(&new_server->base.resume_timer, conn_listen_server_resume, &new_server->base);
+	if (conn_listen_server_admission_init(&new_server->base, "uring", opts) != 0)
+	{
+		conn_listen_server_uring_finalize(new_server);
+		return NULL;
+	}
+	new_server->accept_op.handler = conn_listen_server_uring_on_accept;
+	new_server->accept_op.context = new_server;
+	new_server->base.task = smw_createTask(&new_server->base, conn_listen_server_taskwork);
 	if (!new_server->base.task)
 	{
-		printf("TLS failed to create task for TLS listener server\n");
-		conn_listen_server_tls_cleanup((conn_listen_server_t*)new_server);
+		LOG_ERROR("URING failed to create task for listener server");
+		conn_listen_server_admission_dispose(&new_server->base);
+		conn_listen_server_uring_finalize(new_server);
 		return NULL;
 	}
-		
+	smw_setTaskName(new_server->base.task, "uring_listener");
+	smw_setPriority(new_server->base.task, smw_priority_low);
+	smw_parkTask(new_server->base.task);
+	conn_listen_server_uring_arm(new_server);
+	if (!new_server->armed)
+	{
+		smw_destroyTask(new_server->base.task);
+		conn_listen_server_admission_dispose(&new_server->base);
+		conn_listen_server_uring_finalize(new_server);
+		return NULL;
+	}
+
 	return &new_server->base;
-}
\ No newline at end of file
+}
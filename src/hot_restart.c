@@ -0,0 +1,520 @@
+/* SO_PEERCRED, accept4, pipe2 */
+#define _GNU_SOURCE
+#include "hot_restart.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "utilities/logger.h"
+#include "backends/geolocation.h"
+#include "backends/weather.h"
+
+/* "UBWR", bumped with the layout of what is handed over */
+#define HOT_RESTART_MAGIC 0x55425752u
+/* all the new process ever sends: its workers serve */
+#define HOT_RESTART_READY 'R'
+
+/* sent with the listen sockets, the keys follow: weather then geolocation */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t fds;
+	uint32_t weather;
+	uint32_t geolocation;
+
+} hot_restart_offer;
+
+typedef union
+{
+	struct cmsghdr header;
+	char buffer[CMSG_SPACE(sizeof(int) * HOT_RESTART_MAX_FDS)];
+
+} hot_restart_control;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+/* listen sockets of this process, and the ones handed over no worker took yet */
+static int g_listenFds[HOT_RESTART_MAX_FDS];
+static int g_listenCount = 0;
+static int g_inheritedFds[HOT_RESTART_MAX_FDS];
+static int g_inheritedCount = 0;
+/* the client the thread serves, shut down by hot_restart_close */
+static int g_clientFd = -1;
+
+/* what was handed over, until hot_restart_warm */
+static uint64_t* g_keys = NULL;
+static int g_weatherCount = 0;
+static int g_geolocationCount = 0;
+
+static char g_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+/* the old process, until hot_restart_ready releases it */
+static int g_peerFd = -1;
+/* the socket at g_path, the thread serving it and how to stop it */
+static int g_serverFd = -1;
+static int g_stopPipe[2] = {-1, -1};
+static pthread_t g_thread;
+static int g_threadStarted = 0;
+static int g_draining = 0;
+
+//-----------------Internal Functions-----------------
+
+static void hot_restart_timeout(int _Fd, int _Milliseconds)
+{
+	struct timeval timeout;
+	timeout.tv_sec = _Milliseconds / 1000;
+	timeout.tv_usec = (_Milliseconds % 1000) * 1000;
+	setsockopt(_Fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(_Fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static int hot_restart_write_all(int _Fd, const void* _Data, size_t _Size)
+{
+	const char* data = (const char*)_Data;
+	while(_Size > 0)
+	{
+		ssize_t sent = send(_Fd, data, _Size, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent <= 0)
+			return -1;
+		data += sent;
+		_Size -= (size_t)sent;
+	}
+	return 0;
+}
+
+/* -1 on an error, the timeout or the peer closing early */
+static int hot_restart_read_all(int _Fd, void* _Data, size_t _Size)
+{
+	char* data = (char*)_Data;
+	while(_Size > 0)
+	{
+		ssize_t received = recv(_Fd, data, _Size, 0);
+		if(received < 0 && errno == EINTR)
+			continue;
+		if(received <= 0)
+			return -1;
+		data += received;
+		_Size -= (size_t)received;
+	}
+	return 0;
+}
+
+static int hot_restart_port_of(int _Fd)
+{
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if(getsockname(_Fd, (struct sockaddr*)&address, &length) != 0)
+		return -1;
+	if(address.ss_family == AF_INET)
+		return ntohs(((struct sockaddr_in*)&address)->sin_port);
+	if(address.ss_family == AF_INET6)
+		return ntohs(((struct sockaddr_in6*)&address)->sin6_port);
+	return -1;
+}
+
+/* 1 if _Fd is bound to the unix socket _Path, "@name" for an abstract one */
+static int hot_restart_is_unix(int _Fd, const char* _Path)
+{
+	struct sockaddr_un address;
+	socklen_t length = sizeof(address);
+	if(getsockname(_Fd, (struct sockaddr*)&address, &length) != 0 || address.sun_family != AF_UNIX)
+		return 0;
+	size_t name = length - offsetof(struct sockaddr_un, sun_path);
+	if(_Path[0] == '@')
+		return name == strlen(_Path) && address.sun_path[0] == '\0' &&
+		       memcmp(address.sun_path + 1, _Path + 1, name - 1) == 0;
+	return strncmp(address.sun_path, _Path, sizeof(address.sun_path)) == 0;
+}
+
+static void hot_restart_close_inherited(void)
+{
+	pthread_mutex_lock(&g_lock);
+	if(g_inheritedCount > 0)
+		LOG_WARN("Hot restart: %d listen socket(s) handed over were not taken, their queued connections are reset",
+		         g_inheritedCount);
+	for(int i = 0; i < g_inheritedCount; i++)
+		close(g_inheritedFds[i]);
+	g_inheritedCount = 0;
+	pthread_mutex_unlock(&g_lock);
+}
+
+static int hot_restart_same_user(int _Fd)
+{
+	struct ucred credentials;
+	socklen_t length = sizeof(credentials);
+	if(getsockopt(_Fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+		return 0;
+	return credentials.uid == getuid();
+}
+
+/* the old process's side: 0 once the new one serves, -1 if it gave up */
+static int hot_restart_hand_over(int _Fd)
+{
+	hot_restart_timeout(_Fd, HOT_RESTART_TIMEOUT_MS);
+
+	/* from here on the store files are the new process's to write */
+	weather_handoff_freeze(1);
+	geolocation_handoff_freeze(1);
+
+	int result = -1;
+	uint64_t* keys = (uint64_t*)malloc((Weather_HOT_CACHE_ENTRIES + Geolocation_HOT_CACHE_ENTRIES) * sizeof(uint64_t));
+	if(keys != NULL)
+	{
+		int weather = weather_handoff_keys(keys, Weather_HOT_CACHE_ENTRIES);
+		int geolocation = geolocation_handoff_keys(keys + weather, Geolocation_HOT_CACHE_ENTRIES);
+
+		hot_restart_offer offer = {HOT_RESTART_MAGIC, 0, (uint32_t)weather, (uint32_t)geolocation};
+		struct iovec iov = {&offer, sizeof(offer)};
+		hot_restart_control control;
+		memset(&control, 0, sizeof(control));
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+
+		/* held across the send so no listener closes a socket being sent */
+		pthread_mutex_lock(&g_lock);
+		offer.fds = (uint32_t)g_listenCount;
+		if(g_listenCount > 0)
+		{
+			message.msg_control = control.buffer;
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * g_listenCount);
+			struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(int) * g_listenCount);
+			memcpy(CMSG_DATA(header), g_listenFds, sizeof(int) * g_listenCount);
+		}
+		ssize_t sent;
+		do
+			sent = sendmsg(_Fd, &message, MSG_NOSIGNAL);
+		while(sent < 0 && errno == EINTR);
+		pthread_mutex_unlock(&g_lock);
+
+		if(sent == (ssize_t)sizeof(offer) &&
+		   hot_restart_write_all(_Fd, keys, (size_t)(weather + geolocation) * sizeof(uint64_t)) == 0)
+		{
+			LOG_INFO("Hot restart: sent %u listen socket(s), %d forecast(s) and %d search(es)", offer.fds, weather,
+			         geolocation);
+			/* it opens the stores, warms up and starts its workers first */
+			hot_restart_timeout(_Fd, HOT_RESTART_READY_TIMEOUT_MS);
+			char ready = 0;
+			if(hot_restart_read_all(_Fd, &ready, 1) == 0 && ready == HOT_RESTART_READY)
+				result = 0;
+		}
+		free(keys);
+	}
+
+	if(result != 0)
+	{
+		weather_handoff_freeze(0);
+		geolocation_handoff_freeze(0);
+	}
+	return result;
+}
+
+static void* hot_restart_thread(void* _Context)
+{
+	(void)_Context;
+	struct pollfd fds[2] = {{g_serverFd, POLLIN, 0}, {g_stopPipe[0], POLLIN, 0}};
+	for(;;)
+	{
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		if(fds[1].revents != 0)
+			break;
+
+		int client = accept4(g_serverFd, NULL, NULL, SOCK_CLOEXEC);
+		if(client < 0)
+			continue;
+		if(!hot_restart_same_user(client))
+		{
+			LOG_WARN("Hot restart: refused a process of another user");
+			close(client);
+			continue;
+		}
+
+		LOG_INFO("Hot restart: a new process takes over");
+		pthread_mutex_lock(&g_lock);
+		g_clientFd = client;
+		pthread_mutex_unlock(&g_lock);
+		int result = hot_restart_hand_over(client);
+		pthread_mutex_lock(&g_lock);
+		g_clientFd = -1;
+		pthread_mutex_unlock(&g_lock);
+		close(client);
+
+		if(result == 0)
+		{
+			LOG_INFO("Hot restart: the new process serves, draining");
+			__atomic_store_n(&g_draining, 1, __ATOMIC_RELEASE);
+			break;
+		}
+		LOG_WARN("Hot restart: the new process did not take over, serving on");
+	}
+	return NULL;
+}
+
+static int hot_restart_listen(void)
+{
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, g_path, strlen(g_path));
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+	/* a socket left behind, or the one of the process that handed over */
+	unlink(g_path);
+	if(bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || chmod(g_path, 0600) != 0 || listen(fd, 4) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	if(pipe2(g_stopPipe, O_CLOEXEC) != 0)
+	{
+		close(fd);
+		unlink(g_path);
+		return -1;
+	}
+	g_serverFd = fd;
+	if(pthread_create(&g_thread, NULL, hot_restart_thread, NULL) != 0)
+		return -1;
+	g_threadStarted = 1;
+	return 0;
+}
+
+//----------------------------------------------------
+
+int hot_restart_takeover(const char* _Path)
+{
+	if(strlen(_Path) == 0 || strlen(_Path) >= sizeof(g_path))
+		return -1;
+	strcpy(g_path, _Path);
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, g_path, strlen(g_path));
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+	if(connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		int error = errno;
+		close(fd);
+		/* nobody serves there, a stale socket is replaced once we are up */
+		return error == ENOENT || error == ECONNREFUSED ? 0 : -1;
+	}
+	hot_restart_timeout(fd, HOT_RESTART_TIMEOUT_MS);
+
+	hot_restart_offer offer;
+	struct iovec iov = {&offer, sizeof(offer)};
+	hot_restart_control control;
+	memset(&control, 0, sizeof(control));
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	ssize_t received;
+	do
+		received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+	while(received < 0 && errno == EINTR);
+
+	/* whatever came is ours to close, even from an offer that is not used */
+	int count = 0;
+	for(struct cmsghdr* header = received > 0 ? CMSG_FIRSTHDR(&message) : NULL; header != NULL;
+	    header = CMSG_NXTHDR(&message, header))
+	{
+		if(header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+			continue;
+		int* fds = (int*)CMSG_DATA(header);
+		int n = (int)((header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		for(int i = 0; i < n; i++)
+		{
+			if(count < HOT_RESTART_MAX_FDS)
+				g_inheritedFds[count++] = fds[i];
+			else
+				close(fds[i]);
+		}
+	}
+	g_inheritedCount = count;
+
+	int valid = received == (ssize_t)sizeof(offer) && offer.magic == HOT_RESTART_MAGIC && offer.fds == (uint32_t)count &&
+	            !(message.msg_flags & MSG_CTRUNC) && offer.weather <= HOT_RESTART_MAX_KEYS &&
+	            offer.geolocation <= HOT_RESTART_MAX_KEYS;
+	size_t keys = valid ? (size_t)offer.weather + offer.geolocation : 0;
+	if(valid && keys > 0)
+	{
+		g_keys = (uint64_t*)malloc(keys * sizeof(uint64_t));
+		valid = g_keys != NULL && hot_restart_read_all(fd, g_keys, keys * sizeof(uint64_t)) == 0;
+	}
+	if(!valid)
+	{
+		hot_restart_close_inherited();
+		free(g_keys);
+		g_keys = NULL;
+		close(fd);
+		return -1;
+	}
+
+	g_weatherCount = (int)offer.weather;
+	g_geolocationCount = (int)offer.geolocation;
+	g_peerFd = fd;
+	LOG_INFO("Hot restart: took over %d listen socket(s)", count);
+	return 1;
+}
+
+int hot_restart_warm(void)
+{
+	int loaded = 0;
+	if(g_keys != NULL)
+	{
+		loaded += weather_warmup_keys(g_keys, g_weatherCount);
+		loaded += geolocation_warmup_keys(g_keys + g_weatherCount, g_geolocationCount);
+	}
+	free(g_keys);
+	g_keys = NULL;
+	g_weatherCount = 0;
+	g_geolocationCount = 0;
+	return loaded;
+}
+
+void hot_restart_ready(void)
+{
+	if(g_peerFd >= 0)
+	{
+		char ready = HOT_RESTART_READY;
+		if(hot_restart_write_all(g_peerFd, &ready, 1) != 0)
+			LOG_WARN("Hot restart: the old process is gone or gave up, it may still be serving");
+		close(g_peerFd);
+		g_peerFd = -1;
+	}
+	hot_restart_close_inherited();
+
+	if(g_path[0] != '\0' && hot_restart_listen() != 0)
+		LOG_WARN("Hot restart: could not listen on %s, the next process starts cold", g_path);
+}
+
+int hot_restart_draining(void)
+{
+	return __atomic_load_n(&g_draining, __ATOMIC_ACQUIRE);
+}
+
+void hot_restart_close(void)
+{
+	if(g_threadStarted)
+	{
+		char stop = 0;
+		if(write(g_stopPipe[1], &stop, 1) < 0)
+			LOG_WARN("Hot restart: could not wake the handover thread");
+		pthread_mutex_lock(&g_lock);
+		if(g_clientFd >= 0)
+			shutdown(g_clientFd, SHUT_RDWR);
+		pthread_mutex_unlock(&g_lock);
+		pthread_join(g_thread, NULL);
+		g_threadStarted = 0;
+	}
+	if(g_serverFd >= 0)
+	{
+		close(g_serverFd);
+		g_serverFd = -1;
+		/* after a handover the path is the new process's socket */
+		if(!hot_restart_draining())
+			unlink(g_path);
+	}
+	for(int i = 0; i < 2; i++)
+	{
+		if(g_stopPipe[i] >= 0)
+			close(g_stopPipe[i]);
+		g_stopPipe[i] = -1;
+	}
+	/* never got to serve, the old process serves on */
+	if(g_peerFd >= 0)
+	{
+		close(g_peerFd);
+		g_peerFd = -1;
+	}
+	hot_restart_close_inherited();
+	free(g_keys);
+	g_keys = NULL;
+}
+
+int hot_restart_adopt(const char* _Port)
+{
+	int port = atoi(_Port);
+	int fd = -1;
+	pthread_mutex_lock(&g_lock);
+	for(int i = 0; i < g_inheritedCount; i++)
+	{
+		if(hot_restart_port_of(g_inheritedFds[i]) != port)
+			continue;
+		fd = g_inheritedFds[i];
+		g_inheritedFds[i] = g_inheritedFds[--g_inheritedCount];
+		break;
+	}
+	if(fd >= 0 && g_listenCount < HOT_RESTART_MAX_FDS)
+		g_listenFds[g_listenCount++] = fd;
+	pthread_mutex_unlock(&g_lock);
+	return fd;
+}
+
+int hot_restart_adopt_unix(const char* _Path)
+{
+	int fd = -1;
+	pthread_mutex_lock(&g_lock);
+	for(int i = 0; i < g_inheritedCount; i++)
+	{
+		if(!hot_restart_is_unix(g_inheritedFds[i], _Path))
+			continue;
+		fd = g_inheritedFds[i];
+		g_inheritedFds[i] = g_inheritedFds[--g_inheritedCount];
+		break;
+	}
+	if(fd >= 0 && g_listenCount < HOT_RESTART_MAX_FDS)
+		g_listenFds[g_listenCount++] = fd;
+	pthread_mutex_unlock(&g_lock);
+	return fd;
+}
+
+void hot_restart_register(int _Fd)
+{
+	pthread_mutex_lock(&g_lock);
+	if(g_listenCount < HOT_RESTART_MAX_FDS)
+		g_listenFds[g_listenCount++] = _Fd;
+	pthread_mutex_unlock(&g_lock);
+}
+
+void hot_restart_unregister(int _Fd)
+{
+	pthread_mutex_lock(&g_lock);
+	for(int i = 0; i < g_listenCount; i++)
+	{
+		if(g_listenFds[i] != _Fd)
+			continue;
+		g_listenFds[i] = g_listenFds[--g_listenCount];
+		break;
+	}
+	pthread_mutex_unlock(&g_lock);
+}
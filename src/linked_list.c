@@ -1,4 +1,5 @@
 #include "linked_list.h"
+#include "utilities/logger.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -6,7 +7,7 @@ LinkedList *LinkedList_create() {
   LinkedList *newList =
       calloc(1, sizeof(LinkedList)); /* zeroed allocation, just what we need */
   if (!newList) {
-    printf("[LinkedList] Allocation error in LinkedList_create\n");
+    LOG_ERROR("[LinkedList] Allocation error in LinkedList_create");
     return NULL;
   }
   return newList;
@@ -0,0 +1,363 @@
+#include "prewarm.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "smw.h"
+#include "utils.h"
+#include "backends/weather.h"
+#include "backends/weather_batch.h"
+#include "utilities/cache_only.h"
+#include "utilities/curl_client.h"
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+
+typedef struct
+{
+	/* a weather batch, NULL when the slot is free */
+	void* batch;
+	int done;
+
+} prewarm_slot;
+
+typedef struct
+{
+	/* the bounding box in cells, or the cells of a file (latitude and
+	   longitude after each other) */
+	double south;
+	double west;
+	int columns;
+	double* cells;
+	int count;
+
+	/* minutes of the day, an end before its start crosses midnight */
+	int starts[PREWARM_MAX_WINDOWS];
+	int ends[PREWARM_MAX_WINDOWS];
+	int windowCount;
+
+	smw_task* task;
+	prewarm_slot slots[PREWARM_MAX_INFLIGHT];
+	/* the next cell, a window that closes leaves it where it is */
+	int cursor;
+	uint64_t passStartedMS;
+	uint64_t nextPassMS;
+	int passFetched;
+
+} prewarm;
+
+static prewarm g_prewarm;
+
+static metrics_counter g_cells;
+static metrics_counter g_fetched;
+static metrics_counter g_requests;
+static metrics_counter g_deferred;
+
+//-----------------Internal Functions-----------------
+
+static void prewarm_cell(const prewarm* _Prewarm, int _Index, double* _Latitude, double* _Longitude)
+{
+	if(_Prewarm->cells != NULL)
+	{
+		*_Latitude = _Prewarm->cells[_Index * 2];
+		*_Longitude = _Prewarm->cells[_Index * 2 + 1];
+		return;
+	}
+	*_Latitude = _Prewarm->south + (_Index / _Prewarm->columns) * Weather_GRID_DEGREES;
+	*_Longitude = _Prewarm->west + (_Index % _Prewarm->columns) * Weather_GRID_DEGREES;
+	weather_quantize(_Latitude, _Longitude);
+}
+
+static int prewarm_parse_box(prewarm* _Prewarm, const char* _Region)
+{
+	double south, west, north, east;
+	char rest;
+	if(sscanf(_Region, "%lf,%lf,%lf,%lf%c", &south, &west, &north, &east, &rest) != 4)
+		return -1;
+	if(south > north)
+	{
+		double swap = south;
+		south = north;
+		north = swap;
+	}
+	if(south < -90.0 || north > 90.0 || west < -180.0 || west > 180.0 || east < -180.0 || east > 180.0)
+		return -1;
+
+	double width = east >= west ? east - west : east + 360.0 - west;
+	double rows = round((north - south) / Weather_GRID_DEGREES) + 1;
+	double columns = round(width / Weather_GRID_DEGREES) + 1;
+	if(rows * columns > PREWARM_MAX_CELLS)
+		return -1;
+
+	/* the corner on the grid, every cell after it is too */
+	weather_quantize(&south, &west);
+	_Prewarm->south = south;
+	_Prewarm->west = west;
+	_Prewarm->columns = (int)columns;
+	_Prewarm->count = (int)(rows * columns);
+	return 0;
+}
+
+static int prewarm_load_cells(prewarm* _Prewarm, const char* _Path)
+{
+	FILE* file = fopen(_Path, "r");
+	if(file == NULL)
+		return -1;
+
+	int capacity = 0;
+	char line[256];
+	while(fgets(line, sizeof(line), file) != NULL)
+	{
+		double latitude, longitude;
+		if(line[0] == '#' || sscanf(line, "%lf,%lf", &latitude, &longitude) != 2)
+			continue;
+		if(latitude < -90.0 || latitude > 90.0 || longitude < -180.0 || longitude > 180.0)
+			continue;
+		if(_Prewarm->count == PREWARM_MAX_CELLS)
+			break;
+		if(_Prewarm->count == capacity)
+		{
+			int grown = capacity ? capacity * 2 : 1024;
+			double* cells = (double*)realloc(_Prewarm->cells, (size_t)grown * 2 * sizeof(double));
+			if(cells == NULL)
+				break;
+			_Prewarm->cells = cells;
+			capacity = grown;
+		}
+		weather_quantize(&latitude, &longitude);
+		_Prewarm->cells[_Prewarm->count * 2] = latitude;
+		_Prewarm->cells[_Prewarm->count * 2 + 1] = longitude;
+		_Prewarm->count++;
+	}
+	fclose(file);
+	return _Prewarm->count > 0 ? 0 : -1;
+}
+
+static int prewarm_parse_windows(prewarm* _Prewarm, const char* _Windows)
+{
+	const char* p = _Windows;
+	while(*p != '\0')
+	{
+		int startHour, startMinute, endHour, endMinute, length = 0;
+		if(_Prewarm->windowCount == PREWARM_MAX_WINDOWS ||
+		   sscanf(p, "%d:%d-%d:%d%n", &startHour, &startMinute, &endHour, &endMinute, &length) != 4)
+			return -1;
+		int start = startHour * 60 + startMinute;
+		int end = endHour * 60 + endMinute;
+		/* 24:00 ends a window at midnight */
+		if(startHour < 0 || startHour > 23 || startMinute < 0 || startMinute > 59 || endHour < 0 || endMinute < 0 ||
+		   endMinute > 59 || end > 24 * 60 || start == end)
+			return -1;
+		_Prewarm->starts[_Prewarm->windowCount] = start;
+		_Prewarm->ends[_Prewarm->windowCount] = end;
+		_Prewarm->windowCount++;
+
+		p += length;
+		if(*p == ',')
+			p++;
+		else if(*p != '\0')
+			return -1;
+	}
+	return _Prewarm->windowCount > 0 ? 0 : -1;
+}
+
+static int prewarm_in_window(const prewarm* _Prewarm)
+{
+	time_t now = time(NULL);
+	struct tm local;
+	if(localtime_r(&now, &local) == NULL)
+		return 0;
+	int minute = local.tm_hour * 60 + local.tm_min;
+	for(int i = 0; i < _Prewarm->windowCount; i++)
+	{
+		int start = _Prewarm->starts[i];
+		int end = _Prewarm->ends[i];
+		if(start < end ? minute >= start && minute < end : minute >= start || minute < end)
+			return 1;
+	}
+	return 0;
+}
+
+static void prewarm_on_wake(void* _Context)
+{
+	(void)_Context;
+	smw_wakeTask(g_prewarm.task);
+}
+
+static void prewarm_on_done(void* _Context)
+{
+	((prewarm_slot*)_Context)->done = 1;
+	smw_wakeTask(g_prewarm.task);
+}
+
+static int prewarm_busy(const prewarm* _Prewarm)
+{
+	for(int i = 0; i < PREWARM_MAX_INFLIGHT; i++)
+	{
+		if(_Prewarm->slots[i].batch != NULL)
+			return 1;
+	}
+	return 0;
+}
+
+/* the next Weather_BATCH_MAX_LOCATIONS cells into a batch in _Slot */
+static int prewarm_start_batch(prewarm* _Prewarm, prewarm_slot* _Slot)
+{
+	if(weather_batch_init(NULL, &_Slot->batch, prewarm_on_done, prewarm_on_wake) != 0)
+		return -1;
+	((weather_batch_t*)_Slot->batch)->ctx = _Slot;
+	_Slot->done = 0;
+
+	int added = 0;
+	while(added < Weather_BATCH_MAX_LOCATIONS && _Prewarm->cursor < _Prewarm->count)
+	{
+		double latitude, longitude;
+		prewarm_cell(_Prewarm, _Prewarm->cursor++, &latitude, &longitude);
+		weather_batch_add_location(&_Slot->batch, latitude, longitude);
+		added++;
+	}
+	metrics_counter_add(&g_cells, (uint64_t)added);
+	return 0;
+}
+
+/* starts what the window and the budget allow, the time to look again */
+static uint64_t prewarm_start(prewarm* _Prewarm, uint64_t _MonTime)
+{
+	if(_MonTime < _Prewarm->nextPassMS)
+		return _Prewarm->nextPassMS;
+	if(cache_only_active() || !prewarm_in_window(_Prewarm))
+		return _MonTime + PREWARM_CHECK_MS;
+
+	for(int i = 0; i < PREWARM_MAX_INFLIGHT; i++)
+	{
+		prewarm_slot* slot = &_Prewarm->slots[i];
+		if(slot->batch != NULL)
+			continue;
+
+		if(_Prewarm->cursor == _Prewarm->count)
+		{
+			/* the pass is over once its last batches are */
+			if(prewarm_busy(_Prewarm))
+				break;
+			LOG_INFO("Prewarm: pass over %d cells in %llu ms, %d fetched", _Prewarm->count,
+			         (unsigned long long)(_MonTime - _Prewarm->passStartedMS), _Prewarm->passFetched);
+			_Prewarm->cursor = 0;
+			_Prewarm->nextPassMS = _MonTime + PREWARM_PASS_INTERVAL_MS;
+			return _Prewarm->nextPassMS;
+		}
+
+		if(curl_client_budget_left() <= PREWARM_BUDGET_RESERVE)
+		{
+			metrics_counter_add(&g_deferred, 1);
+			return _MonTime + PREWARM_BUDGET_WAIT_MS;
+		}
+
+		if(_Prewarm->cursor == 0)
+		{
+			_Prewarm->passStartedMS = _MonTime;
+			_Prewarm->passFetched = 0;
+		}
+		if(prewarm_start_batch(_Prewarm, slot) != 0)
+			return _MonTime + PREWARM_BUDGET_WAIT_MS;
+		smw_wakeTask(_Prewarm->task);
+	}
+	return _MonTime + PREWARM_CHECK_MS;
+}
+
+static void prewarm_taskwork(void* _Context, uint64_t _MonTime)
+{
+	prewarm* _Prewarm = (prewarm*)_Context;
+
+	int polling = 0;
+	for(int i = 0; i < PREWARM_MAX_INFLIGHT; i++)
+	{
+		prewarm_slot* slot = &_Prewarm->slots[i];
+		if(slot->batch == NULL)
+			continue;
+		int result = slot->done ? BACKEND_WORK_WAIT : weather_batch_work(&slot->batch);
+		if(slot->done)
+		{
+			/* the cells asked upstream, none when all of them were fresh */
+			int fetched = ((weather_batch_t*)slot->batch)->fetch_count;
+			if(fetched > 0)
+			{
+				metrics_counter_add(&g_requests, 1);
+				metrics_counter_add(&g_fetched, (uint64_t)fetched);
+				_Prewarm->passFetched += fetched;
+			}
+			weather_batch_dispose(&slot->batch);
+			continue;
+		}
+		if(result == BACKEND_WORK_AGAIN)
+			smw_wakeTask(_Prewarm->task);
+		if(result == BACKEND_WORK_POLL)
+			polling = 1;
+	}
+
+	uint64_t next = prewarm_start(_Prewarm, _MonTime);
+	smw_setDeadline(_Prewarm->task, polling ? _MonTime + Weather_REFRESH_POLL_MS : next);
+}
+
+//----------------------------------------------------
+
+int prewarm_configure(const char* _Region, const char* _Windows)
+{
+	prewarm* _Prewarm = &g_prewarm;
+	prewarm_dispose();
+
+	int result = _Region[0] == '@' ? prewarm_load_cells(_Prewarm, _Region + 1) : prewarm_parse_box(_Prewarm, _Region);
+	if(result != 0 || prewarm_parse_windows(_Prewarm, _Windows ? _Windows : PREWARM_WINDOWS) != 0)
+	{
+		prewarm_dispose();
+		return -1;
+	}
+	/* the zone is read here rather than by the loop's first localtime_r */
+	tzset();
+
+	metrics_register("prewarm_cells_total", "Cells of the pre-warm region looked at, fresh ones cost no request.",
+	                 METRICS_COUNTER, NULL, &g_cells);
+	metrics_register("prewarm_fetched_total", "Cells the pre-warm fetched from upstream.", METRICS_COUNTER, NULL,
+	                 &g_fetched);
+	metrics_register("prewarm_requests_total", "Multi location upstream requests of the pre-warm.", METRICS_COUNTER,
+	                 NULL, &g_requests);
+	metrics_register("prewarm_deferred_total", "Times the pre-warm waited for the upstream budget.", METRICS_COUNTER,
+	                 NULL, &g_deferred);
+	LOG_INFO("Prewarm: %d cells, %d window(s)", _Prewarm->count, _Prewarm->windowCount);
+	return 0;
+}
+
+int prewarm_attach(void)
+{
+	prewarm* _Prewarm = &g_prewarm;
+	if(_Prewarm->count == 0 || _Prewarm->task != NULL)
+		return 0;
+
+	_Prewarm->task = smw_createTask(_Prewarm, prewarm_taskwork);
+	if(_Prewarm->task == NULL)
+		return -1;
+	smw_setTaskName(_Prewarm->task, "prewarm");
+	/* runs on its deadlines and wakes, the first right away */
+	smw_parkTask(_Prewarm->task);
+	smw_wakeTask(_Prewarm->task);
+	return 0;
+}
+
+void prewarm_detach(void)
+{
+	prewarm* _Prewarm = &g_prewarm;
+	for(int i = 0; i < PREWARM_MAX_INFLIGHT; i++)
+	{
+		if(_Prewarm->slots[i].batch != NULL)
+			weather_batch_dispose(&_Prewarm->slots[i].batch);
+	}
+	if(_Prewarm->task != NULL)
+		smw_destroyTask(_Prewarm->task);
+	_Prewarm->task = NULL;
+}
+
+void prewarm_dispose(void)
+{
+	prewarm_detach();
+	free(g_prewarm.cells);
+	memset(&g_prewarm, 0, sizeof(g_prewarm));
+}
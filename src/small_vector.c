@@ -0,0 +1,60 @@
+#include "small_vector.h"
+#include "utilities/logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+void SmallVector_init(SmallVector *vector, size_t itemSize) {
+  vector->items = vector->inlineItems.bytes;
+  vector->size = 0;
+  vector->itemSize = itemSize;
+  vector->capacity = itemSize > 0 ? SMALL_VECTOR_INLINE_SIZE / itemSize : 0;
+}
+
+void *SmallVector_push(SmallVector *vector) {
+  if (vector == NULL || vector->itemSize == 0)
+    return NULL;
+
+  if (vector->size == vector->capacity) {
+    size_t capacity = vector->capacity ? vector->capacity * 2 : 4;
+    void *items = NULL;
+    if (vector->items == vector->inlineItems.bytes) {
+      items = malloc(capacity * vector->itemSize);
+      if (items != NULL)
+        memcpy(items, vector->items, vector->size * vector->itemSize);
+    } else {
+      items = realloc(vector->items, capacity * vector->itemSize);
+    }
+    if (items == NULL) {
+      LOG_ERROR("[SmallVector] Allocation error in SmallVector_push");
+      return NULL;
+    }
+    vector->items = items;
+    vector->capacity = capacity;
+  }
+
+  void *item = (unsigned char *)vector->items + vector->size * vector->itemSize;
+  memset(item, 0, vector->itemSize);
+  vector->size++;
+  return item;
+}
+
+void *SmallVector_get(const SmallVector *vector, size_t index) {
+  if (vector == NULL || index >= vector->size)
+    return NULL;
+  return (unsigned char *)vector->items + index * vector->itemSize;
+}
+
+void SmallVector_clear(SmallVector *vector, void (*free_function)(void *)) {
+  if (vector == NULL)
+    return;
+  if (free_function != NULL) {
+    for (size_t i = 0; i < vector->size; i++)
+      free_function((unsigned char *)vector->items + i * vector->itemSize);
+  }
+  if (vector->items != vector->inlineItems.bytes)
+    free(vector->items);
+
+  vector->items = vector->inlineItems.bytes;
+  vector->size = 0;
+  vector->capacity = vector->itemSize > 0 ? SMALL_VECTOR_INLINE_SIZE / vector->itemSize : 0;
+}
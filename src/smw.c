@@ -1,93 +1,735 @@
 #include "smw.h"
+#include <stdlib.h>
 #include <string.h>
-#include "utilities/misc_utils.h"
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include "utils.h"
+#include "utilities/metrics.h"
+#include "utilities/probes.h"
 
-smw g_smw;
+__thread smw g_smw;
 
-int smw_init()
+/* linux/eventpoll.h of 6.9, not every libc has it */
+#ifndef EPIOCSPARAMS
+struct epoll_params
 {
-	memset(&g_smw, 0, sizeof(g_smw));
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+//-----------------Internal Functions-----------------
+
+static void smw_list_append(smw_list* _List, smw_task* _Task, smw_queue _Queue)
+{
+	_Task->prev = _List->tail;
+	_Task->next = NULL;
+	if(_List->tail != NULL)
+		_List->tail->next = _Task;
+	else
+		_List->head = _Task;
+	_List->tail = _Task;
+	_Task->queue = _Queue;
+}
+
+static void smw_list_unlink(smw_list* _List, smw_task* _Task)
+{
+	if(_Task->prev != NULL)
+		_Task->prev->next = _Task->next;
+	else
+		_List->head = _Task->next;
+
+	if(_Task->next != NULL)
+		_Task->next->prev = _Task->prev;
+	else
+		_List->tail = _Task->prev;
+
+	_Task->prev = NULL;
+	_Task->next = NULL;
+	_Task->queue = smw_queue_none;
+}
+
+/* move every task of _From to the end of _To */
+static void smw_list_splice(smw_list* _To, smw_list* _From, smw_queue _Queue)
+{
+	smw_task* task;
+	for(task = _From->head; task != NULL; task = task->next)
+		task->queue = _Queue;
+
+	if(_From->head == NULL)
+		return;
+
+	if(_To->tail != NULL)
+	{
+		_To->tail->next = _From->head;
+		_From->head->prev = _To->tail;
+	}
+	else
+	{
+		_To->head = _From->head;
+	}
+	_To->tail = _From->tail;
+	_From->head = NULL;
+	_From->tail = NULL;
+}
+
+static smw_list* smw_queueList(smw_task* _Task)
+{
+	switch(_Task->queue)
+	{
+		case smw_queue_polled: return &g_smw.polled;
+		case smw_queue_ready:  return &g_smw.ready[_Task->priority];
+		case smw_queue_run:    return &g_smw.run[_Task->priority];
+		default:               return NULL;
+	}
+}
+
+static void smw_unqueue(smw_task* _Task)
+{
+	smw_list* list = smw_queueList(_Task);
+	if(list != NULL)
+		smw_list_unlink(list, _Task);
+}
+
+static void smw_timerUnlink(smw_task* _Task)
+{
+	timer_wheel_cancel(&g_smw.timers, &_Task->timer);
+	_Task->deadline = 0;
+}
+
+static void smw_deadlineExpired(void* _Context, uint64_t _MonTime)
+{
+	smw_task* task = (smw_task*)_Context;
+	task->deadline = 0;
+	task->pending |= SMW_TIMEOUT;
+	smw_wakeTask(task);
+}
+
+static void smw_resetTask(smw_task* _Task)
+{
+	memset(_Task, 0, sizeof(smw_task));
+	_Task->mode = smw_task_mode_poll;
+	_Task->priority = smw_priority_normal;
+	_Task->fd = -1;
+}
+
+static int smw_grow()
+{
+	smw_task** slabs = (smw_task**)realloc(g_smw.slabs, sizeof(smw_task*) * (g_smw.slab_count + 1));
+	if(slabs == NULL)
+		return -1;
+	g_smw.slabs = slabs;
+
+	smw_task* slab = (smw_task*)calloc(smw_task_slab_size, sizeof(smw_task));
+	if(slab == NULL)
+		return -1;
+	g_smw.slabs[g_smw.slab_count++] = slab;
 
+	/* push back to front so tasks are handed out in address order */
 	int i;
-	for(i = 0; i < smw_max_tasks; i++)
+	for(i = smw_task_slab_size - 1; i >= 0; i--)
 	{
-		g_smw.tasks[i].context = NULL;
-		g_smw.tasks[i].callback = NULL;
+		smw_resetTask(&slab[i]);
+		slab[i].queue = smw_queue_free;
+		slab[i].next = g_smw.free_list;
+		g_smw.free_list = &slab[i];
 	}
 
 	return 0;
 }
 
-smw_task* smw_createTask(void* _Context, void (*_Callback)(void* _Context, uint64_t _MonTime))
+#if smw_stats_enabled
+static smw_task_stats* smw_statsClass(const char* _Name, void* _Callback)
 {
+	smw_stats* stats = &g_smw.stats;
 	int i;
-	for(i = 0; i < smw_max_tasks; i++)
+	for(i = 0; i < stats->class_count; i++)
 	{
-		if(g_smw.tasks[i].context == NULL && g_smw.tasks[i].callback == NULL)
-		{
-			g_smw.tasks[i].context = _Context;
-			g_smw.tasks[i].callback = _Callback;
-			return &g_smw.tasks[i];
-		}
+		smw_task_stats* entry = &stats->classes[i];
+		if(entry->callback != _Callback)
+			continue;
+		if(entry->name == _Name || (entry->name != NULL && _Name != NULL && strcmp(entry->name, _Name) == 0))
+			return entry;
+	}
+
+	/* table full, the last entry collects everything else */
+	if(stats->class_count == smw_stats_max_classes)
+	{
+		smw_task_stats* other = &stats->classes[smw_stats_max_classes - 1];
+		other->name = "other";
+		other->callback = NULL;
+		return other;
 	}
 
-	return NULL;
+	smw_task_stats* entry = &stats->classes[stats->class_count++];
+	entry->name = _Name;
+	entry->callback = _Callback;
+	return entry;
+}
+
+/* every loop's passes and callbacks together, g_smw.stats is one loop's */
+static metrics_histogram g_smwPassLatency;
+static metrics_histogram g_smwTaskLatency;
+static metrics_histogram g_smwBusyPollIteration;
+
+static void smw_statsRecord(smw_task_stats* _Entry, uint64_t _Nanoseconds)
+{
+	_Entry->invocations++;
+	_Entry->total_ns += _Nanoseconds;
+	if(_Nanoseconds > _Entry->max_ns)
+		_Entry->max_ns = _Nanoseconds;
+
+	if(_Nanoseconds > g_smw.stats.max_stall_ns)
+	{
+		g_smw.stats.max_stall_ns = _Nanoseconds;
+		g_smw.stats.max_stall_name = _Entry->name;
+	}
+}
+
+static void smw_statsPass(uint64_t _Nanoseconds)
+{
+	smw_stats* stats = &g_smw.stats;
+	uint64_t us = _Nanoseconds / 1000;
+	int bucket = 0;
+	while(us > 1 && bucket < smw_stats_histogram_buckets - 1)
+	{
+		us >>= 1;
+		bucket++;
+	}
+
+	stats->iterations++;
+	stats->pass_histogram[bucket]++;
+	metrics_histogram_record(&g_smwPassLatency, _Nanoseconds / 1000);
+	if(_Nanoseconds > stats->max_pass_ns)
+		stats->max_pass_ns = _Nanoseconds;
+}
+#endif
+
+static uint32_t smw_toEpoll(uint32_t _Events)
+{
+	uint32_t ev = 0;
+	if(_Events & SMW_READ)
+		ev |= EPOLLIN;
+	if(_Events & SMW_WRITE)
+		ev |= EPOLLOUT;
+	return ev;
+}
+
+//----------------------------------------------------
+
+int smw_init()
+{
+	memset(&g_smw, 0, sizeof(g_smw));
+	g_smw.doorbell_fd = -1;
+	timer_wheel_init(&g_smw.timers, SystemMonotonicMS());
+
+	if(smw_grow() != 0)
+		return -1;
+
+	g_smw.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(g_smw.epoll_fd < 0)
+		return -1;
+
+	/* not a task, smw_work recognizes it by its data pointer */
+	g_smw.doorbell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(g_smw.doorbell_fd < 0)
+		return -1;
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &g_smw.doorbell_fd;
+	if(epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_ADD, g_smw.doorbell_fd, &ev) != 0)
+		return -1;
+
+	return 0;
+}
+
+smw_task* smw_createTask(void* _Context, void (*_Callback)(void* _Context, uint64_t _MonTime))
+{
+	if(g_smw.free_list == NULL && smw_grow() != 0)
+		return NULL;
+
+	smw_task* task = g_smw.free_list;
+	g_smw.free_list = task->next;
+
+	smw_resetTask(task);
+	task->context = _Context;
+	task->callback = _Callback;
+	timer_wheel_timer_init(&task->timer, smw_deadlineExpired, task);
+	/* new tasks start polled, i.e. they run on the next pass */
+	smw_list_append(&g_smw.polled, task, smw_queue_polled);
+	g_smw.task_count++;
+
+	return task;
 }
 
 void smw_destroyTask(smw_task* _Task)
+{
+	if(_Task == NULL || _Task->queue == smw_queue_free)
+		return;
+
+	/* the fd may already be closed, in which case the kernel dropped it */
+	if(_Task->fd >= 0)
+		epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_DEL, _Task->fd, NULL);
+
+	smw_unqueue(_Task);
+	smw_timerUnlink(_Task);
+	smw_resetTask(_Task);
+
+	_Task->queue = smw_queue_free;
+	_Task->next = g_smw.free_list;
+	g_smw.free_list = _Task;
+	g_smw.task_count--;
+}
+
+int smw_watchFd(smw_task* _Task, int _Fd, uint32_t _Events)
+{
+	if(_Task == NULL || _Fd < 0)
+		return -1;
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = smw_toEpoll(_Events);
+	ev.data.ptr = _Task;
+
+	if(_Task->fd == _Fd)
+	{
+		if(_Task->events != _Events && epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_MOD, _Fd, &ev) != 0)
+			return -1;
+	}
+	else
+	{
+		if(_Task->fd >= 0)
+			epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_DEL, _Task->fd, NULL);
+
+		_Task->fd = -1;
+		if(epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_ADD, _Fd, &ev) != 0)
+			return -1;
+		_Task->fd = _Fd;
+	}
+
+	_Task->events = _Events;
+	_Task->mode = smw_task_mode_event;
+	if(_Task->queue == smw_queue_polled)
+		smw_list_unlink(&g_smw.polled, _Task);
+
+	return 0;
+}
+
+void smw_pollTask(smw_task* _Task)
+{
+	if(_Task == NULL)
+		return;
+
+	if(_Task->fd >= 0)
+		epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_DEL, _Task->fd, NULL);
+
+	_Task->fd = -1;
+	_Task->events = 0;
+	_Task->mode = smw_task_mode_poll;
+
+	if(_Task->queue == smw_queue_none || _Task->queue == smw_queue_ready)
+	{
+		smw_unqueue(_Task);
+		smw_list_append(&g_smw.polled, _Task, smw_queue_polled);
+	}
+}
+
+void smw_parkTask(smw_task* _Task)
 {
 	if(_Task == NULL)
 		return;
 
+	if(_Task->fd >= 0)
+		epoll_ctl(g_smw.epoll_fd, EPOLL_CTL_DEL, _Task->fd, NULL);
+
+	_Task->fd = -1;
+	_Task->events = 0;
+	_Task->mode = smw_task_mode_event;
+	if(_Task->queue == smw_queue_polled)
+		smw_list_unlink(&g_smw.polled, _Task);
+}
+
+void smw_setDeadline(smw_task* _Task, uint64_t _MonTime)
+{
+	if(_Task == NULL)
+		return;
+
+	if(_MonTime == 0)
+	{
+		smw_timerUnlink(_Task);
+		return;
+	}
+
+	_Task->deadline = _MonTime;
+	timer_wheel_arm(&g_smw.timers, &_Task->timer, _MonTime);
+}
+
+void smw_initTimer(timer_wheel_timer* _Timer, timer_wheel_callback _Callback, void* _Context)
+{
+	timer_wheel_timer_init(_Timer, _Callback, _Context);
+}
+
+void smw_armTimer(timer_wheel_timer* _Timer, uint64_t _MonTime)
+{
+	timer_wheel_arm(&g_smw.timers, _Timer, _MonTime);
+}
+
+void smw_cancelTimer(timer_wheel_timer* _Timer)
+{
+	timer_wheel_cancel(&g_smw.timers, _Timer);
+}
+
+void smw_wakeTask(smw_task* _Task)
+{
+	if(_Task == NULL)
+		return;
+
+	/* polled, queued or running-this-pass tasks will run anyway */
+	if(_Task->queue == smw_queue_none)
+		smw_list_append(&g_smw.ready[_Task->priority], _Task, smw_queue_ready);
+}
+
+void smw_setPriority(smw_task* _Task, smw_priority _Priority)
+{
+	if(_Task == NULL || _Priority >= smw_priority_count || _Task->priority == _Priority)
+		return;
+
+	/* queued tasks move along to the list of their new class */
+	smw_queue queue = _Task->queue;
+	if(queue == smw_queue_ready || queue == smw_queue_run)
+		smw_list_unlink(smw_queueList(_Task), _Task);
+
+	_Task->priority = _Priority;
+
+	if(queue == smw_queue_ready)
+		smw_list_append(&g_smw.ready[_Priority], _Task, queue);
+	else if(queue == smw_queue_run)
+		smw_list_append(&g_smw.run[_Priority], _Task, queue);
+}
+
+/* how long epoll_wait may block before some task needs to run */
+static int smw_computeTimeout(uint64_t _MonTime)
+{
+	if(g_smw.inbox_pending || g_smw.busy_poll)
+		return 0;
+
 	int i;
-	for(i = 0; i < smw_max_tasks; i++)
+	for(i = 0; i < smw_priority_count; i++)
 	{
-		if(&g_smw.tasks[i] == _Task)
-		{
-			g_smw.tasks[i].context = NULL;
-			g_smw.tasks[i].callback = NULL;
-			break;
-		}
+		if(g_smw.ready[i].head != NULL)
+			return 0;
+	}
+
+	int timeout = g_smw.polled.head != NULL ? g_smw.poll_backoff_ms : smw_max_wait_ms;
+
+	/* sleep exactly until the next timer is due */
+	uint64_t next = timer_wheel_next_expiry(&g_smw.timers);
+	if(next != TIMER_WHEEL_NEVER)
+	{
+		if(next <= _MonTime)
+			return 0;
+		if(next - _MonTime < (uint64_t)timeout)
+			timeout = (int)(next - _MonTime);
+	}
+
+	return timeout;
+}
+
+static void smw_runList(smw_priority _Priority, uint64_t _MonTime, uint64_t* _Clock)
+{
+	smw_list* list = &g_smw.run[_Priority];
+	smw_task* task;
+	while((task = list->head) != NULL)
+	{
+		smw_list_unlink(list, task);
+		if(task->mode == smw_task_mode_poll)
+			smw_list_append(&g_smw.polled, task, smw_queue_polled);
+
+		task->revents = task->pending;
+		task->pending = 0;
+
+#if smw_stats_enabled
+		if(task->stats == NULL)
+			task->stats = smw_statsClass(task->name, (void*)task->callback);
+		smw_task_stats* stats = task->stats;
+#endif
+
+		PROBE2(task_run, task->name, task);
+		/* the callback may destroy the task, don't touch it afterwards */
+		task->callback(task->context, _MonTime);
+
+#if smw_stats_enabled
+		uint64_t run_end = SystemMonotonicNS();
+		smw_statsRecord(stats, run_end - *_Clock);
+		metrics_histogram_record(&g_smwTaskLatency, (run_end - *_Clock) / 1000);
+		*_Clock = run_end;
+#else
+		(void)_Clock;
+#endif
 	}
 }
 
 void smw_work(uint64_t _MonTime)
 {
+	struct epoll_event events[smw_epoll_batch];
+
+	g_smw.pass++;
+	int timeout = smw_computeTimeout(_MonTime);
+	int n = epoll_wait(g_smw.epoll_fd, events, smw_epoll_batch, timeout);
+	if(n < 0)
+		n = 0;
+
+#if smw_stats_enabled
+	/* a spinning loop's iteration is how long a ready socket can go unseen */
+	if(g_smw.busy_poll)
+	{
+		uint64_t polled = SystemMonotonicNS();
+		if(g_smw.busy_poll_last_ns != 0)
+			metrics_histogram_record(&g_smwBusyPollIteration, (polled - g_smw.busy_poll_last_ns) / 1000);
+		g_smw.busy_poll_last_ns = polled;
+	}
+#endif
+
 	int i;
-	for(i = 0; i < smw_max_tasks; i++)
+	for(i = 0; i < n; i++)
 	{
-		
-		// TODO: make linked list
-		if(g_smw.tasks[i].callback != NULL)
+		if(events[i].data.ptr == &g_smw.doorbell_fd)
 		{
-			g_smw.tasks[i].callback(g_smw.tasks[i].context, _MonTime);
-			/* Throttle worker loop slightly to avoid busy spins */
-			misc_sleep_1ms();
+			uint64_t count;
+			while(read(g_smw.doorbell_fd, &count, sizeof(count)) > 0)
+			{
+			}
+			continue;
 		}
 
+		smw_task* task = (smw_task*)events[i].data.ptr;
+		/* a stale event for a recycled slot only causes a spurious wakeup */
+		if(task->queue == smw_queue_free)
+			continue;
+
+		if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			task->pending |= SMW_READ;
+		if(events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+			task->pending |= SMW_WRITE;
+
+		smw_wakeTask(task);
+	}
+
+	if(timeout > 0)
+		_MonTime = SystemMonotonicMS();
+
+	/* expire deadlines and timers, woken tasks run this pass */
+	timer_wheel_advance(&g_smw.timers, _MonTime);
+
+	/* messages from other threads in one batch, the tasks they wake run
+	   this pass */
+	if(g_smw.inbox != NULL)
+		g_smw.inbox_pending = g_smw.inbox(g_smw.inbox_context);
+
+	/* woken tasks mean real work, polled tasks have to say so themselves */
+	g_smw.progress = n > 0;
+	for(i = 0; i < smw_priority_count; i++)
+	{
+		if(g_smw.ready[i].head != NULL)
+			g_smw.progress = 1;
+	}
+
+	/* everything runnable this pass, sorted by class; whatever gets woken
+	   while we run goes to the ready lists and waits for the next pass */
+	smw_task* task;
+	while((task = g_smw.polled.head) != NULL)
+	{
+		smw_list_unlink(&g_smw.polled, task);
+		smw_list_append(&g_smw.run[task->priority], task, smw_queue_run);
+	}
+	for(i = 0; i < smw_priority_count; i++)
+		smw_list_splice(&g_smw.run[i], &g_smw.ready[i], smw_queue_run);
+
+#if smw_stats_enabled
+	uint64_t pass_start = SystemMonotonicNS();
+	uint64_t run_start = pass_start;
+#else
+	uint64_t run_start = 0;
+#endif
+
+	smw_runList(smw_priority_high, _MonTime, &run_start);
+	smw_runList(smw_priority_normal, _MonTime, &run_start);
+
+	/* in progress work already queued up again, hold new clients back a
+	   few passes so it can finish first */
+	int busy = g_smw.ready[smw_priority_high].head != NULL || g_smw.ready[smw_priority_normal].head != NULL;
+	if(g_smw.run[smw_priority_low].head != NULL && busy && g_smw.low_deferred < smw_low_priority_max_defer)
+	{
+		smw_list_splice(&g_smw.ready[smw_priority_low], &g_smw.run[smw_priority_low], smw_queue_ready);
+		g_smw.low_deferred++;
+	}
+	else
+	{
+		g_smw.low_deferred = 0;
+		smw_runList(smw_priority_low, _MonTime, &run_start);
 	}
+
+#if smw_stats_enabled
+	smw_statsPass(run_start - pass_start);
+#endif
+
+	if(g_smw.progress)
+		g_smw.poll_backoff_ms = 0;
+	else if(g_smw.poll_backoff_ms == 0)
+		g_smw.poll_backoff_ms = 1;
+	else if(g_smw.poll_backoff_ms * 2 <= smw_poll_backoff_max_ms)
+		g_smw.poll_backoff_ms *= 2;
+	else
+		g_smw.poll_backoff_ms = smw_poll_backoff_max_ms;
 }
 
-int smw_getTaskCount()
+int smw_setBusyPoll(int _Usecs)
 {
-	int counter = 0;
-	int i;
-	for(i = 0; i < smw_max_tasks; i++)
+	g_smw.busy_poll = 1;
+	g_smw.busy_poll_last_ns = 0;
+
+	struct epoll_params params;
+	memset(&params, 0, sizeof(params));
+	params.busy_poll_usecs = (uint32_t)_Usecs;
+	params.busy_poll_budget = smw_busy_poll_budget;
+	params.prefer_busy_poll = 1;
+	return ioctl(g_smw.epoll_fd, EPIOCSPARAMS, &params) == 0 ? 0 : -1;
+}
+
+void smw_setInbox(int (*_Drain)(void* _Context), void* _Context)
+{
+	g_smw.inbox = _Drain;
+	g_smw.inbox_context = _Context;
+	g_smw.inbox_pending = 0;
+}
+
+int smw_doorbell()
+{
+	return g_smw.doorbell_fd;
+}
+
+void smw_ringDoorbell(int _Doorbell)
+{
+	uint64_t one = 1;
+	/* a full counter (EAGAIN) has woken the loop already */
+	if(write(_Doorbell, &one, sizeof(one)) < 0)
+		return;
+}
+
+void smw_awaitInbox(int _TimeoutMs)
+{
+	if(!g_smw.inbox_pending)
 	{
-		if(g_smw.tasks[i].callback != NULL)
-			counter++;
+		struct pollfd pfd = {.fd = g_smw.doorbell_fd, .events = POLLIN};
+		if(poll(&pfd, 1, _TimeoutMs) <= 0)
+			return;
 
+		uint64_t count;
+		while(read(g_smw.doorbell_fd, &count, sizeof(count)) > 0)
+		{
+		}
 	}
 
-	return counter;
+	if(g_smw.inbox != NULL)
+		g_smw.inbox_pending = g_smw.inbox(g_smw.inbox_context);
 }
 
-void smw_dispose()
+void smw_progress()
+{
+	g_smw.progress = 1;
+}
+
+uint64_t smw_pass()
+{
+	return g_smw.pass;
+}
+
+int smw_getTaskCount()
+{
+	return g_smw.task_count;
+}
+
+void smw_setTaskName(smw_task* _Task, const char* _Name)
+{
+	if(_Task == NULL)
+		return;
+
+	_Task->name = _Name;
+	/* resolved again on the next run */
+	_Task->stats = NULL;
+}
+
+void smw_registerMetrics()
+{
+#if smw_stats_enabled
+	metrics_register("loop_pass_duration_seconds", "Time an event loop pass took, running every ready task.",
+		METRICS_HISTOGRAM, NULL, &g_smwPassLatency);
+	metrics_register("loop_task_duration_seconds", "Time a task's callback held its loop.", METRICS_HISTOGRAM, NULL,
+		&g_smwTaskLatency);
+	metrics_register("loop_busy_poll_iteration_seconds", "Time between two polls of a busy polling loop.",
+		METRICS_HISTOGRAM, NULL, &g_smwBusyPollIteration);
+#endif
+}
+
+void smw_getStats(smw_stats* _Stats)
+{
+	if(_Stats == NULL)
+		return;
+
+	memcpy(_Stats, &g_smw.stats, sizeof(smw_stats));
+}
+
+void smw_resetStats()
 {
 	int i;
-	for(i = 0; i < smw_max_tasks; i++)
+	smw_stats* stats = &g_smw.stats;
+	stats->iterations = 0;
+	memset(stats->pass_histogram, 0, sizeof(stats->pass_histogram));
+	stats->max_pass_ns = 0;
+	stats->max_stall_ns = 0;
+	stats->max_stall_name = NULL;
+
+	/* tasks keep pointing at their class, only clear the counters */
+	for(i = 0; i < stats->class_count; i++)
 	{
-		g_smw.tasks[i].context = NULL;
-		g_smw.tasks[i].callback = NULL;
+		stats->classes[i].invocations = 0;
+		stats->classes[i].total_ns = 0;
+		stats->classes[i].max_ns = 0;
 	}
 }
+
+void smw_recordSpan(const char* _Name, uint64_t _Nanoseconds)
+{
+#if smw_stats_enabled
+	smw_statsRecord(smw_statsClass(_Name, NULL), _Nanoseconds);
+#else
+	(void)_Name;
+	(void)_Nanoseconds;
+#endif
+}
+
+void smw_dispose()
+{
+	int i;
+	for(i = 0; i < g_smw.slab_count; i++)
+		free(g_smw.slabs[i]);
+	free(g_smw.slabs);
+
+	if(g_smw.epoll_fd >= 0)
+		close(g_smw.epoll_fd);
+	if(g_smw.doorbell_fd >= 0)
+		close(g_smw.doorbell_fd);
+
+	memset(&g_smw, 0, sizeof(g_smw));
+	g_smw.epoll_fd = -1;
+	g_smw.doorbell_fd = -1;
+}
@@ -0,0 +1,150 @@
+#include "startup.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "utils.h"
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+
+typedef struct
+{
+	const char* name;
+	char labels[64];
+	int64_t milliseconds;
+
+} startup_entry;
+
+typedef struct
+{
+	startup_phase* phase;
+	uint64_t milliseconds;
+
+} startup_job;
+
+/* Written from the main thread before the workers start, read after */
+static startup_entry g_entries[STARTUP_MAX_PHASES];
+static int g_entryCount = 0;
+static uint64_t g_beganMS = 0;
+static int64_t g_readyMS = 0;
+
+//-----------------Internal Functions-----------------
+
+static int64_t startup_read(void* _Context)
+{
+	return ((startup_entry*)_Context)->milliseconds;
+}
+
+static int64_t startup_read_ready(void* _Context)
+{
+	(void)_Context;
+	return __atomic_load_n(&g_readyMS, __ATOMIC_RELAXED);
+}
+
+static void* startup_job_run(void* _Context)
+{
+	startup_job* job = (startup_job*)_Context;
+	uint64_t started = SystemMonotonicMS();
+	job->phase->result = job->phase->run(job->phase->context);
+	job->milliseconds = SystemMonotonicMS() - started;
+	return NULL;
+}
+
+static void startup_keep(const char* _Name, uint64_t _Milliseconds, int _Result)
+{
+	/* what a failure means is for the caller to say */
+	LOG_INFO("Startup: %s in %llu ms%s", _Name, (unsigned long long)_Milliseconds, _Result != 0 ? ", failed" : "");
+
+	if(g_entryCount == STARTUP_MAX_PHASES)
+		return;
+	startup_entry* entry = &g_entries[g_entryCount++];
+	entry->name = _Name;
+	entry->milliseconds = (int64_t)_Milliseconds;
+	snprintf(entry->labels, sizeof(entry->labels), "phase=\"%s\"", _Name);
+	metrics_register_read("startup_phase_milliseconds", "Time a startup phase took, phases of one step ran at once.",
+	                      METRICS_GAUGE, entry->labels, startup_read, entry);
+}
+
+/* sd_notify(3) without libsystemd: one datagram to the socket systemd
+   passes, @ for the abstract namespace */
+static void startup_notify(const char* _State)
+{
+	const char* path = getenv("NOTIFY_SOCKET");
+	if(path == NULL || path[0] == '\0')
+		return;
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	size_t length = strlen(path);
+	if(length >= sizeof(address.sun_path))
+		return;
+	memcpy(address.sun_path, path, length);
+	if(address.sun_path[0] == '@')
+		address.sun_path[0] = '\0';
+
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return;
+	if(sendto(fd, _State, strlen(_State), MSG_NOSIGNAL, (struct sockaddr*)&address,
+	          (socklen_t)(offsetof(struct sockaddr_un, sun_path) + length)) < 0)
+		LOG_WARN("Startup: the service manager on %s was not told we are ready", path);
+	close(fd);
+}
+
+//----------------------------------------------------
+
+void startup_begin(void)
+{
+	g_beganMS = SystemMonotonicMS();
+	metrics_register_read("startup_ready_milliseconds", "Time from the start of the process until every worker listened, 0 before.",
+	                      METRICS_GAUGE, NULL, startup_read_ready, NULL);
+}
+
+int startup_parallel(startup_phase* _Phases, int _Count)
+{
+	if(_Count < 1 || _Count > STARTUP_MAX_PHASES)
+		return -1;
+
+	startup_job jobs[STARTUP_MAX_PHASES];
+	pthread_t threads[STARTUP_MAX_PHASES];
+	int threaded[STARTUP_MAX_PHASES];
+	int i;
+	for(i = 0; i < _Count; i++)
+	{
+		jobs[i].phase = &_Phases[i];
+		/* the last one on the caller, it would only wait otherwise */
+		threaded[i] = i < _Count - 1 && pthread_create(&threads[i], NULL, startup_job_run, &jobs[i]) == 0;
+		if(!threaded[i])
+			startup_job_run(&jobs[i]);
+	}
+
+	int failed = 0;
+	for(i = 0; i < _Count; i++)
+	{
+		if(threaded[i])
+			pthread_join(threads[i], NULL);
+		startup_keep(_Phases[i].name, jobs[i].milliseconds, _Phases[i].result);
+		if(_Phases[i].result != 0)
+			failed++;
+	}
+	return failed;
+}
+
+void startup_record(const char* _Name, uint64_t _StartedMS, int _Result)
+{
+	startup_keep(_Name, SystemMonotonicMS() - _StartedMS, _Result);
+}
+
+void startup_ready(void)
+{
+	int64_t milliseconds = (int64_t)(SystemMonotonicMS() - g_beganMS);
+	/* 0 is what a scrape before reads */
+	__atomic_store_n(&g_readyMS, milliseconds > 0 ? milliseconds : 1, __ATOMIC_RELAXED);
+	LOG_INFO("Startup: ready after %lld ms", (long long)milliseconds);
+	startup_notify("READY=1");
+}
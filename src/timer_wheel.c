@@ -0,0 +1,210 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+#define TW_MASK (timer_wheel_slots - 1)
+
+static inline int timer_wheel_shift(int _Level)
+{
+	return timer_wheel_slot_bits * _Level;
+}
+
+static void timer_wheel_link(timer_wheel_timer** _Head, timer_wheel_timer* _Timer)
+{
+	_Timer->prev = NULL;
+	_Timer->next = *_Head;
+	if(*_Head != NULL)
+		(*_Head)->prev = _Timer;
+	*_Head = _Timer;
+	_Timer->slot = _Head;
+}
+
+static void timer_wheel_unlink(timer_wheel_timer* _Timer)
+{
+	if(_Timer->prev != NULL)
+		_Timer->prev->next = _Timer->next;
+	else
+		*_Timer->slot = _Timer->next;
+	if(_Timer->next != NULL)
+		_Timer->next->prev = _Timer->prev;
+
+	_Timer->prev = NULL;
+	_Timer->next = NULL;
+	_Timer->slot = NULL;
+}
+
+static void timer_wheel_place(timer_wheel* _Wheel, timer_wheel_timer* _Timer)
+{
+	uint64_t expires = _Timer->expires;
+	if(expires <= _Wheel->now)
+		expires = _Wheel->now + 1;
+
+	/* lowest level whose slot for `expires` is still ahead of the cursor,
+	   so the slot gets cascaded (or fired) before the timer is due */
+	int level;
+	uint64_t key = 0;
+	for(level = 0; level < timer_wheel_levels; level++)
+	{
+		key = expires >> timer_wheel_shift(level);
+		if(key - (_Wheel->now >> timer_wheel_shift(level)) < timer_wheel_slots)
+			break;
+	}
+
+	/* too far out, park it in the furthest slot of the last level */
+	if(level == timer_wheel_levels)
+	{
+		level = timer_wheel_levels - 1;
+		key = (_Wheel->now >> timer_wheel_shift(level)) + timer_wheel_slots - 1;
+	}
+
+	timer_wheel_link(&_Wheel->slots[level][key & TW_MASK], _Timer);
+}
+
+void timer_wheel_init(timer_wheel* _Wheel, uint64_t _MonTime)
+{
+	memset(_Wheel, 0, sizeof(timer_wheel));
+	_Wheel->now = _MonTime;
+}
+
+void timer_wheel_timer_init(timer_wheel_timer* _Timer, timer_wheel_callback _Callback, void* _Context)
+{
+	memset(_Timer, 0, sizeof(timer_wheel_timer));
+	_Timer->callback = _Callback;
+	_Timer->context = _Context;
+}
+
+void timer_wheel_arm(timer_wheel* _Wheel, timer_wheel_timer* _Timer, uint64_t _Expires)
+{
+	if(_Timer->slot != NULL)
+		timer_wheel_unlink(_Timer);
+	else
+		_Wheel->count++;
+
+	_Timer->expires = _Expires;
+	timer_wheel_place(_Wheel, _Timer);
+}
+
+void timer_wheel_cancel(timer_wheel* _Wheel, timer_wheel_timer* _Timer)
+{
+	if(_Timer->slot == NULL)
+		return;
+
+	timer_wheel_unlink(_Timer);
+	_Wheel->count--;
+}
+
+/* re-place every timer of an upper level slot one level further down */
+static void timer_wheel_cascade(timer_wheel* _Wheel, int _Level, int _Index)
+{
+	timer_wheel_timer* timer = _Wheel->slots[_Level][_Index];
+	_Wheel->slots[_Level][_Index] = NULL;
+
+	while(timer != NULL)
+	{
+		timer_wheel_timer* next = timer->next;
+		timer->prev = NULL;
+		timer->next = NULL;
+		timer->slot = NULL;
+		if(timer->expires <= _Wheel->now)
+			timer_wheel_link(&_Wheel->firing, timer);
+		else
+			timer_wheel_place(_Wheel, timer);
+		timer = next;
+	}
+}
+
+void timer_wheel_advance(timer_wheel* _Wheel, uint64_t _MonTime)
+{
+	if(_Wheel->count == 0)
+	{
+		if(_MonTime > _Wheel->now)
+			_Wheel->now = _MonTime;
+		return;
+	}
+
+	while(_Wheel->now < _MonTime)
+	{
+		/* every slot before the next expiry is empty, skip straight to it */
+		uint64_t next = timer_wheel_next_expiry(_Wheel);
+		if(next > _MonTime)
+		{
+			_Wheel->now = _MonTime;
+			break;
+		}
+		_Wheel->now = next;
+		uint64_t tick = next;
+
+		int level;
+		for(level = 1; level < timer_wheel_levels; level++)
+		{
+			if((tick & (((uint64_t)1 << timer_wheel_shift(level)) - 1)) != 0)
+				break;
+			timer_wheel_cascade(_Wheel, level, (int)((tick >> timer_wheel_shift(level)) & TW_MASK));
+		}
+
+		/* move the due slot to the firing list so callbacks can cancel
+		   or re-arm any timer, including the ones about to fire */
+		timer_wheel_timer** slot = &_Wheel->slots[0][tick & TW_MASK];
+		while(*slot != NULL)
+		{
+			timer_wheel_timer* timer = *slot;
+			timer_wheel_unlink(timer);
+			timer_wheel_link(&_Wheel->firing, timer);
+		}
+
+		while(_Wheel->firing != NULL)
+		{
+			timer_wheel_timer* timer = _Wheel->firing;
+			timer_wheel_unlink(timer);
+			_Wheel->count--;
+
+			if(timer->callback != NULL)
+				timer->callback(timer->context, tick);
+		}
+
+		if(_Wheel->count == 0)
+		{
+			_Wheel->now = _MonTime;
+			break;
+		}
+	}
+}
+
+uint64_t timer_wheel_next_expiry(const timer_wheel* _Wheel)
+{
+	if(_Wheel->count == 0)
+		return TIMER_WHEEL_NEVER;
+
+	/* level 0 holds exact expiry times for the next 64 ms */
+	uint64_t next = TIMER_WHEEL_NEVER;
+	int i;
+	for(i = 1; i <= timer_wheel_slots; i++)
+	{
+		uint64_t tick = _Wheel->now + i;
+		if(_Wheel->slots[0][tick & TW_MASK] != NULL)
+		{
+			next = tick;
+			break;
+		}
+	}
+
+	/* an upper level slot needing cascading earlier comes first, advance
+	   skips every tick before the one returned */
+	int level;
+	for(level = 1; level < timer_wheel_levels; level++)
+	{
+		int shift = timer_wheel_slot_bits * level;
+		uint64_t base = _Wheel->now >> shift;
+		for(i = 1; i <= timer_wheel_slots; i++)
+		{
+			uint64_t index = base + i;
+			if(_Wheel->slots[level][index & TW_MASK] != NULL)
+			{
+				if((index << shift) < next)
+					next = index << shift;
+				break;
+			}
+		}
+	}
+
+	return next != TIMER_WHEEL_NEVER ? next : _Wheel->now + 1;
+}
@@ -0,0 +1,341 @@
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "smw.h"
+
+typedef struct
+{
+	int ring_fd;
+	unsigned sq_entries;
+
+	/* shared with the kernel */
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ptr;
+	size_t sq_len;
+	void* cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+
+	/* sqes prepared but not yet published to the kernel */
+	unsigned sqe_tail;
+	/* requests whose final cqe has not been seen yet */
+	int inflight;
+
+	struct io_uring_buf_ring* buf_ring;
+	size_t buf_ring_len;
+	uint8_t* buffers;
+	uint16_t buf_tail;
+
+	uring_flush* flushes;
+
+	smw_task* task;
+
+} uring;
+
+static __thread uring* t_uring = NULL;
+
+//-----------------Internal Functions-----------------
+
+static int uring_enter(unsigned _ToSubmit, unsigned _MinComplete, unsigned _Flags)
+{
+	return (int)syscall(__NR_io_uring_enter, t_uring->ring_fd, _ToSubmit, _MinComplete, _Flags, NULL, 0);
+}
+
+/* hand every prepared sqe to the kernel in a single syscall */
+static void uring_submit()
+{
+	uring* ring = t_uring;
+	unsigned pending = ring->sqe_tail - *ring->sq_tail;
+	if(pending == 0)
+		return;
+
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	while(uring_enter(pending, 0, 0) < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+	{
+		/* completion queue is backed up, make room and retry */
+		if(errno != EINTR)
+			uring_enter(0, 1, IORING_ENTER_GETEVENTS);
+	}
+}
+
+static void uring_reap()
+{
+	uring* ring = t_uring;
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	while(head != tail)
+	{
+		struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+		uring_op* op = (uring_op*)(uintptr_t)cqe->user_data;
+		int32_t res = cqe->res;
+		uint32_t flags = cqe->flags;
+		head++;
+		/* free the slot before the handler so it may queue new work */
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		if(op == NULL)
+			continue;
+		if(!(flags & IORING_CQE_F_MORE))
+			ring->inflight--;
+		op->handler(op, res, flags);
+
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	}
+}
+
+static void uring_runFlushes()
+{
+	uring_flush* flush;
+	while((flush = t_uring->flushes) != NULL)
+	{
+		t_uring->flushes = flush->next;
+		flush->next = NULL;
+		flush->queued = 0;
+		flush->callback(flush);
+	}
+}
+
+static void uring_taskwork(void* _Context, uint64_t _MonTime)
+{
+	uring_runFlushes();
+	uring_submit();
+	uring_reap();
+	/* handlers may have queued follow-up requests */
+	if(t_uring->sqe_tail != *t_uring->sq_tail)
+		smw_wakeTask(t_uring->task);
+}
+
+static void uring_free(uring* _Ring)
+{
+	if(_Ring->buffers != NULL)
+		free(_Ring->buffers);
+	if(_Ring->buf_ring != NULL)
+		munmap(_Ring->buf_ring, _Ring->buf_ring_len);
+	if(_Ring->sqes != NULL)
+		munmap(_Ring->sqes, _Ring->sqes_len);
+	if(_Ring->cq_ptr != NULL && _Ring->cq_ptr != _Ring->sq_ptr)
+		munmap(_Ring->cq_ptr, _Ring->cq_len);
+	if(_Ring->sq_ptr != NULL)
+		munmap(_Ring->sq_ptr, _Ring->sq_len);
+	if(_Ring->ring_fd >= 0)
+		close(_Ring->ring_fd);
+	free(_Ring);
+}
+
+static int uring_setupBuffers(uring* _Ring)
+{
+	_Ring->buf_ring_len = sizeof(struct io_uring_buf) * uring_buffer_count;
+	void* mem = mmap(NULL, _Ring->buf_ring_len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(mem == MAP_FAILED)
+		return -1;
+	_Ring->buf_ring = (struct io_uring_buf_ring*)mem;
+
+	_Ring->buffers = (uint8_t*)malloc((size_t)uring_buffer_count * uring_buffer_size);
+	if(_Ring->buffers == NULL)
+		return -1;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)_Ring->buf_ring;
+	reg.ring_entries = uring_buffer_count;
+	reg.bgid = URING_BUFFER_GROUP;
+	if(syscall(__NR_io_uring_register, _Ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		return -1;
+
+	int i;
+	for(i = 0; i < uring_buffer_count; i++)
+	{
+		struct io_uring_buf* buf = &_Ring->buf_ring->bufs[i];
+		buf->addr = (uint64_t)(uintptr_t)(_Ring->buffers + (size_t)i * uring_buffer_size);
+		buf->len = uring_buffer_size;
+		buf->bid = (uint16_t)i;
+	}
+	_Ring->buf_tail = uring_buffer_count;
+	__atomic_store_n(&_Ring->buf_ring->tail, _Ring->buf_tail, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+//----------------------------------------------------
+
+int uring_attach()
+{
+	if(t_uring != NULL)
+		return 0;
+
+	uring* ring = (uring*)calloc(1, sizeof(uring));
+	if(ring == NULL)
+		return -1;
+	ring->ring_fd = -1;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_SUBMIT_ALL;
+
+	ring->ring_fd = (int)syscall(__NR_io_uring_setup, uring_entries, &params);
+	if(ring->ring_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		uring_free(ring);
+		return -1;
+	}
+
+	ring->sq_entries = params.sq_entries;
+	ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if(ring->cq_len > ring->sq_len)
+		ring->sq_len = ring->cq_len;
+	ring->cq_len = ring->sq_len;
+
+	void* ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+	if(ptr == MAP_FAILED)
+	{
+		uring_free(ring);
+		return -1;
+	}
+	ring->sq_ptr = ptr;
+	ring->cq_ptr = ptr;
+
+	ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+	if(ptr == MAP_FAILED)
+	{
+		uring_free(ring);
+		return -1;
+	}
+	ring->sqes = (struct io_uring_sqe*)ptr;
+
+	uint8_t* sq = (uint8_t*)ring->sq_ptr;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->cq_head = (unsigned*)(sq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(sq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(sq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(sq + params.cq_off.cqes);
+
+	/* sqes are always filled in order, map the index array 1:1 once */
+	unsigned* array = (unsigned*)(sq + params.sq_off.array);
+	unsigned i;
+	for(i = 0; i < params.sq_entries; i++)
+		array[i] = i;
+	ring->sqe_tail = *ring->sq_tail;
+
+	if(uring_setupBuffers(ring) != 0)
+	{
+		uring_free(ring);
+		return -1;
+	}
+
+	ring->task = smw_createTask(ring, uring_taskwork);
+	if(ring->task == NULL || smw_watchFd(ring->task, ring->ring_fd, SMW_READ) != 0)
+	{
+		smw_destroyTask(ring->task);
+		uring_free(ring);
+		return -1;
+	}
+
+	smw_setTaskName(ring->task, "uring");
+
+	t_uring = ring;
+	return 0;
+}
+
+void uring_detach()
+{
+	uring* ring = t_uring;
+	if(ring == NULL)
+		return;
+
+	/* closing connections queued cancels and closes, let them finish so
+	   every owner gets its final completion */
+	uring_runFlushes();
+	uring_submit();
+	uring_reap();
+	while(ring->inflight > 0)
+	{
+		if(uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+			break;
+		uring_reap();
+		uring_runFlushes();
+		uring_submit();
+	}
+
+	smw_destroyTask(ring->task);
+	uring_free(ring);
+	t_uring = NULL;
+}
+
+int uring_attached()
+{
+	return t_uring != NULL;
+}
+
+struct io_uring_sqe* uring_getSqe(uring_op* _Op)
+{
+	uring* ring = t_uring;
+	if(ring == NULL)
+		return NULL;
+
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if(ring->sqe_tail - head >= ring->sq_entries)
+	{
+		/* submission queue full, flush what we have */
+		uring_submit();
+		head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		if(ring->sqe_tail - head >= ring->sq_entries)
+			return NULL;
+	}
+
+	struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = (uint64_t)(uintptr_t)_Op;
+	ring->sqe_tail++;
+
+	if(_Op != NULL)
+		ring->inflight++;
+
+	/* batch with everything else queued this pass */
+	smw_wakeTask(ring->task);
+
+	return sqe;
+}
+
+void uring_deferFlush(uring_flush* _Flush)
+{
+	if(t_uring == NULL || _Flush->queued)
+		return;
+
+	_Flush->queued = 1;
+	_Flush->next = t_uring->flushes;
+	t_uring->flushes = _Flush;
+	smw_wakeTask(t_uring->task);
+}
+
+uint8_t* uring_buffer(uint16_t _Bid)
+{
+	return t_uring->buffers + (size_t)_Bid * uring_buffer_size;
+}
+
+void uring_recycleBuffer(uint16_t _Bid)
+{
+	uring* ring = t_uring;
+	struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (uring_buffer_count - 1)];
+	buf->addr = (uint64_t)(uintptr_t)uring_buffer(_Bid);
+	buf->len = uring_buffer_size;
+	buf->bid = _Bid;
+	ring->buf_tail++;
+	__atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
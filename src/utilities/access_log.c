@@ -0,0 +1,109 @@
+#include "utilities/access_log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "utilities/logger.h"
+
+_Static_assert(ACCESS_LOG_HEADER_SIZE + ACCESS_LOG_TARGET_SIZE <= LOG_MESSAGE_SIZE,
+               "an access log record has to fit a logger slot");
+
+int g_accessLogEnabled = 0;
+
+static FILE* g_accessLogFile = NULL;
+
+static const char* g_accessRouteNames[ACCESS_ROUTE_COUNT] = {
+    "other", "cities", "location", "nearest", "weather", "weather_batch", "surprise", "stats", "reload_cities",
+    "metrics", "debug_memory", "subscribe", "cache_only", "peer_weather",
+    "weather_by_name", "cities_weather", "config", "weather_history",
+    "location_batch", "hot_keys",
+};
+
+static const char* g_accessCacheNames[ACCESS_CACHE_COUNT] = {
+    "none", "hot", "stale", "disk", "local", "fetch", "coalesced", "fallback",
+    "unavailable", "peer", "shared",
+};
+
+int access_log_open(const char* path) {
+    FILE* file = fopen(path, "ab");
+    if (file == NULL) return -1;
+    if (fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return -1;
+    }
+    // A new file starts with the magic, an existing one is continued
+    if (ftell(file) == 0 && fwrite(ACCESS_LOG_MAGIC, 1, ACCESS_LOG_MAGIC_SIZE, file) != ACCESS_LOG_MAGIC_SIZE) {
+        fclose(file);
+        return -1;
+    }
+    g_accessLogFile = file;
+    logger_set_binary_sink(LOGGER_CHANNEL_ACCESS, file, NULL);
+    __atomic_store_n(&g_accessLogEnabled, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void access_log_close(void) {
+    if (g_accessLogFile == NULL) return;
+    __atomic_store_n(&g_accessLogEnabled, 0, __ATOMIC_RELAXED);
+    logger_set_binary_sink(LOGGER_CHANNEL_ACCESS, NULL, NULL);
+    fclose(g_accessLogFile);
+    g_accessLogFile = NULL;
+}
+
+void access_log_write(const access_log_record* record) {
+    uint8_t data[ACCESS_LOG_HEADER_SIZE + ACCESS_LOG_TARGET_SIZE];
+    logger_write_binary(LOGGER_CHANNEL_ACCESS, data, access_log_encode(record, data));
+}
+
+static void access_log_put(uint8_t* out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) out[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t access_log_get(const uint8_t* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) value |= (uint64_t)data[i] << (8 * i);
+    return value;
+}
+
+int access_log_encode(const access_log_record* record, uint8_t* out) {
+    size_t length = record->target_length;
+    if (length > ACCESS_LOG_TARGET_SIZE - 1) length = ACCESS_LOG_TARGET_SIZE - 1;
+    access_log_put(out, record->time_us, 8);
+    access_log_put(out + 8, record->latency_us, 4);
+    access_log_put(out + 12, record->status, 2);
+    out[14] = record->route;
+    out[15] = record->cache;
+    out[16] = record->flags;
+    out[17] = 0;
+    access_log_put(out + 18, length, 2);
+    memcpy(out + ACCESS_LOG_HEADER_SIZE, record->target, length);
+    return ACCESS_LOG_HEADER_SIZE + (int)length;
+}
+
+int access_log_decode(const uint8_t* data, size_t length, access_log_record* record) {
+    if (length < ACCESS_LOG_HEADER_SIZE) return 0;
+    size_t target_length = (size_t)access_log_get(data + 18, 2);
+    if (target_length > ACCESS_LOG_TARGET_SIZE - 1 || data[14] >= ACCESS_ROUTE_COUNT ||
+        data[15] >= ACCESS_CACHE_COUNT) {
+        return -1;
+    }
+    if (length < ACCESS_LOG_HEADER_SIZE + target_length) return 0;
+    record->time_us = access_log_get(data, 8);
+    record->latency_us = (uint32_t)access_log_get(data + 8, 4);
+    record->status = (uint16_t)access_log_get(data + 12, 2);
+    record->route = data[14];
+    record->cache = data[15];
+    record->flags = data[16];
+    record->target_length = (uint16_t)target_length;
+    memcpy(record->target, data + ACCESS_LOG_HEADER_SIZE, target_length);
+    record->target[target_length] = '\0';
+    return ACCESS_LOG_HEADER_SIZE + (int)target_length;
+}
+
+const char* access_log_route_name(int route) {
+    return route >= 0 && route < ACCESS_ROUTE_COUNT ? g_accessRouteNames[route] : "unknown";
+}
+
+const char* access_log_cache_name(int cache) {
+    return cache >= 0 && cache < ACCESS_CACHE_COUNT ? g_accessCacheNames[cache] : "unknown";
+}
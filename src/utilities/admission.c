@@ -0,0 +1,24 @@
+#include "utilities/admission.h"
+
+#include "utilities/tuning.h"
+
+int admission_observe(admission* controller, uint64_t delay_ms, uint64_t now_ms) {
+    int was = controller->overloaded;
+    const tuning* knobs = tuning_get();
+    uint64_t interval_ms = (uint64_t)knobs->admission_interval_ms;
+    if (delay_ms <= (uint64_t)knobs->admission_target_ms) {
+        // The queue emptied at least once, start over from here
+        controller->overloaded = 0;
+        controller->interval_end_ms = now_ms + interval_ms;
+        return was ? -1 : 0;
+    }
+
+    if (controller->interval_end_ms == 0) controller->interval_end_ms = now_ms + interval_ms;
+    if (now_ms >= controller->interval_end_ms) {
+        // A whole interval above the target, a quiet stretch with no samples
+        // in it is not held against the next one
+        if (now_ms - controller->interval_end_ms < interval_ms) controller->overloaded = 1;
+        controller->interval_end_ms = now_ms + interval_ms;
+    }
+    return controller->overloaded && !was ? 1 : 0;
+}
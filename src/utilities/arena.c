@@ -0,0 +1,142 @@
+#include "utilities/arena.h"
+
+#include <string.h>
+
+#include "utilities/object_pool.h"
+#include "utilities/ub_alloc.h"
+
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define ARENA_HEADER ARENA_ALIGN(sizeof(arena_block))
+
+static void arena_block_destroy(void* object) {
+    mem_account_free(MEM_TAG_ARENAS, ARENA_HEADER + ARENA_POOL_BLOCK_SIZE);
+    ub_free(object);
+}
+
+/* ARENA_POOL_BLOCK_SIZE blocks trimmed arenas gave up */
+static __thread object_pool t_blockPool = OBJECT_POOL_INIT(arena_block_destroy);
+
+static arena_block* arena_block_new(const arena* arena, size_t size) {
+    arena_block* block = size == ARENA_POOL_BLOCK_SIZE ? (arena_block*)object_pool_get(&t_blockPool) : NULL;
+    if (block) {
+        mem_account_free(MEM_TAG_ARENAS, ARENA_HEADER + size);
+    } else {
+        block = (arena_block*)ub_malloc(ARENA_HEADER + size);
+        if (!block) return NULL;
+    }
+    mem_account_alloc(arena->tag, ARENA_HEADER + size);
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static void arena_block_free(const arena* arena, arena_block* block) {
+    mem_account_free(arena->tag, ARENA_HEADER + block->size);
+    ub_free(block);
+}
+
+void arena_init(arena* arena, size_t block_size) {
+    arena->blocks = NULL;
+    arena->block_size = block_size;
+    arena->tag = MEM_TAG_ARENAS;
+}
+
+void arena_set_tag(arena* arena, int tag) {
+    arena->tag = tag;
+}
+
+void* arena_alloc(arena* arena, size_t size) {
+    size = ARENA_ALIGN(size ? size : 1);
+
+    arena_block* block = arena->blocks;
+    if (block && block->size - block->used >= size) {
+        void* ptr = (char*)block + ARENA_HEADER + block->used;
+        block->used += size;
+        return ptr;
+    }
+
+    if (size > arena->block_size / 2) {
+        // A block of its own, behind the current one so the rest of that
+        // stays in use
+        arena_block* large = arena_block_new(arena, size);
+        if (!large) return NULL;
+        large->used = size;
+        if (block) {
+            large->next = block->next;
+            block->next = large;
+        } else {
+            arena->blocks = large;
+        }
+        return (char*)large + ARENA_HEADER;
+    }
+
+    block = arena_block_new(arena, arena->block_size);
+    if (!block) return NULL;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    block->used = size;
+    return (char*)block + ARENA_HEADER;
+}
+
+char* arena_strndup(arena* arena, const char* str, size_t length) {
+    char* copy = (char*)arena_alloc(arena, length + 1);
+    if (!copy) return NULL;
+
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+int arena_owns(const arena* arena, const void* ptr) {
+    const char* p = (const char*)ptr;
+    for (const arena_block* block = arena->blocks; block; block = block->next) {
+        const char* data = (const char*)block + ARENA_HEADER;
+        if (p >= data && p < data + block->size) return 1;
+    }
+    return 0;
+}
+
+void arena_reset(arena* arena) {
+    arena_block* keep = NULL;
+    arena_block* block = arena->blocks;
+    while (block) {
+        arena_block* next = block->next;
+        if (!keep && block->size == arena->block_size) {
+            keep = block;
+        } else {
+            arena_block_free(arena, block);
+        }
+        block = next;
+    }
+
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+    arena->blocks = keep;
+}
+
+void arena_trim(arena* arena) {
+    arena_reset(arena);
+    arena_block* block = arena->blocks;
+    if (!block) return;
+
+    arena->blocks = NULL;
+    mem_account_free(arena->tag, ARENA_HEADER + block->size);
+    if (block->size != ARENA_POOL_BLOCK_SIZE) {
+        ub_free(block);
+        return;
+    }
+    mem_account_alloc(MEM_TAG_ARENAS, ARENA_HEADER + block->size);
+    if (object_pool_put(&t_blockPool, block) != 0) arena_block_destroy(block);
+}
+
+void arena_dispose(arena* arena) {
+    while (arena->blocks) {
+        arena_block* next = arena->blocks->next;
+        arena_block_free(arena, arena->blocks);
+        arena->blocks = next;
+    }
+}
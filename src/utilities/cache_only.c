@@ -0,0 +1,55 @@
+#include "utilities/cache_only.h"
+
+#include <string.h>
+
+#include "utils.h"
+#include "utilities/circuit_breaker.h"
+
+static int g_cacheOnlySetting = CACHE_ONLY_AUTO;
+static __thread int t_overloaded = 0;
+
+static const char* g_cacheOnlyNames[CACHE_ONLY_SETTINGS] = {"auto", "on", "off"};
+
+void cache_only_set(cache_only_setting setting) {
+    __atomic_store_n(&g_cacheOnlySetting, (int)setting, __ATOMIC_RELAXED);
+}
+
+cache_only_setting cache_only_get(void) {
+    return (cache_only_setting)__atomic_load_n(&g_cacheOnlySetting, __ATOMIC_RELAXED);
+}
+
+const char* cache_only_name(cache_only_setting setting) {
+    return setting >= 0 && setting < CACHE_ONLY_SETTINGS ? g_cacheOnlyNames[setting] : "unknown";
+}
+
+int cache_only_parse(const char* name, size_t length, cache_only_setting* setting) {
+    for (int i = 0; i < CACHE_ONLY_SETTINGS; i++) {
+        if (strlen(g_cacheOnlyNames[i]) == length && memcmp(g_cacheOnlyNames[i], name, length) == 0) {
+            *setting = (cache_only_setting)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void cache_only_set_overloaded(int overloaded) {
+    t_overloaded = overloaded;
+}
+
+int cache_only_active(void) {
+    switch (cache_only_get()) {
+    case CACHE_ONLY_ON:
+        return 1;
+    case CACHE_ONLY_OFF:
+        return 0;
+    default:
+        return t_overloaded;
+    }
+}
+
+int cache_only_allows_fetch(const char* url) {
+    if (cache_only_active()) return 0;
+    if (cache_only_get() != CACHE_ONLY_AUTO) return 1;
+    circuit_breaker* breaker = circuit_breaker_for(url);
+    return !breaker || !circuit_breaker_is_open(breaker, SystemMonotonicMS());
+}
@@ -0,0 +1,907 @@
+#include "utilities/cache_store.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "smw.h"
+#include "utils.h"
+#include "utilities/job_pool.h"
+#include "utilities/logger.h"
+#include "utilities/loop_mailbox.h"
+
+typedef enum {
+    CACHE_STORE_GET,
+    CACHE_STORE_PUT,
+    CACHE_STORE_REMOVE,
+    CACHE_STORE_TOUCH
+} cache_store_kind;
+
+struct cache_store_op {
+    // back on the loop that started it (memory), the next reply awaited (redis)
+    loop_message message;
+    cache_store_op* next;
+    cache_store_done done;
+    void* context;
+
+    cache_store* store;
+    cache_store_kind kind;
+    uint64_t key;
+    uint8_t slot;
+    int ttl;
+    // a put's copy of its value (file), sent already for redis
+    uint8_t* value;
+    size_t value_length;
+    time_t value_stamp;
+    // monotonic ms it went out (redis)
+    uint64_t started_ms;
+
+    int result;
+    uint8_t* data;
+    size_t length;
+    time_t stamp;
+};
+
+static cache_store_op* cache_store_op_new(cache_store* store, cache_store_kind kind, uint64_t key, uint8_t slot,
+                                          cache_store_done done, void* context) {
+    // Completions come back through the loop's mailbox or job pool
+    if (loop_mailbox_self() < 0) return NULL;
+    cache_store_op* op = (cache_store_op*)calloc(1, sizeof(cache_store_op));
+    if (!op) return NULL;
+    op->store = store;
+    op->kind = kind;
+    op->key = key;
+    op->slot = slot;
+    op->done = done;
+    op->context = context;
+    op->result = CACHE_STORE_FAILED;
+    return op;
+}
+
+static void cache_store_op_free(cache_store_op* op) {
+    free(op->value);
+    free(op->data);
+    free(op);
+}
+
+// Hands the result over, unless the op was cancelled
+static void cache_store_op_finish(cache_store_op* op) {
+    if (op->done) {
+        op->done(op->context, op->result, op->data, op->length, op->stamp);
+        op->data = NULL;
+    }
+    cache_store_op_free(op);
+}
+
+static void cache_store_op_run(loop_message* message) {
+    cache_store_op_finish((cache_store_op*)((char*)message - offsetof(cache_store_op, message)));
+}
+
+// The result is known already, it is handed over on the next pass
+static cache_store_op* cache_store_op_post(cache_store_op* op) {
+    op->message.run = cache_store_op_run;
+    op->message.drop = NULL;
+    if (loop_mailbox_post(loop_mailbox_self(), &op->message) != 0) {
+        cache_store_op_free(op);
+        return NULL;
+    }
+    return op;
+}
+
+// ========== Memory ==========
+// Direct mapped, a value replaces whatever else hashed to its entry. One
+// lock for the whole table, every operation is a lookup and a copy.
+
+typedef struct {
+    int used;
+    uint64_t key;
+    uint8_t slot;
+    uint8_t* data;
+    size_t length;
+    time_t stamp;
+    // 0 if it does not expire
+    time_t expires;
+} cache_store_memory_entry;
+
+typedef struct {
+    cache_store base;
+    pthread_mutex_t lock;
+    cache_store_memory_entry* entries;
+    int count;
+} cache_store_memory;
+
+static cache_store_memory_entry* cache_store_memory_entry_of(cache_store_memory* memory, uint64_t key, uint8_t slot) {
+    uint64_t hash = (key ^ ((uint64_t)slot << 56)) * 0x9e3779b97f4a7c15ULL;
+    return &memory->entries[(hash >> 32) % (uint64_t)memory->count];
+}
+
+static void cache_store_memory_clear(cache_store_memory_entry* entry) {
+    free(entry->data);
+    memset(entry, 0, sizeof(cache_store_memory_entry));
+}
+
+// The entry of key and slot if it holds a live value, under the lock
+static cache_store_memory_entry* cache_store_memory_find(cache_store_memory* memory, uint64_t key, uint8_t slot) {
+    cache_store_memory_entry* entry = cache_store_memory_entry_of(memory, key, slot);
+    if (!entry->used || entry->key != key || entry->slot != slot) return NULL;
+    if (entry->expires && entry->expires <= time(NULL)) {
+        cache_store_memory_clear(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+static cache_store_op* cache_store_memory_get(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                              void* context) {
+    cache_store_memory* memory = (cache_store_memory*)self;
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_GET, key, slot, done, context);
+    if (!op) return NULL;
+    pthread_mutex_lock(&memory->lock);
+    cache_store_memory_entry* entry = cache_store_memory_find(memory, key, slot);
+    op->result = CACHE_STORE_MISS;
+    if (entry) {
+        op->data = (uint8_t*)malloc(entry->length ? entry->length : 1);
+        if (op->data) {
+            memcpy(op->data, entry->data, entry->length);
+            op->length = entry->length;
+            op->stamp = entry->stamp;
+            op->result = CACHE_STORE_OK;
+        } else {
+            op->result = CACHE_STORE_FAILED;
+        }
+    }
+    pthread_mutex_unlock(&memory->lock);
+    return cache_store_op_post(op);
+}
+
+static cache_store_op* cache_store_memory_put(cache_store* self, uint64_t key, uint8_t slot, const uint8_t* data,
+                                              size_t length, time_t stamp, int ttl, cache_store_done done,
+                                              void* context) {
+    cache_store_memory* memory = (cache_store_memory*)self;
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_PUT, key, slot, done, context);
+    if (!op) return NULL;
+    // Copied before the lock is taken
+    uint8_t* copy = (uint8_t*)malloc(length ? length : 1);
+    if (copy) {
+        memcpy(copy, data, length);
+        pthread_mutex_lock(&memory->lock);
+        cache_store_memory_entry* entry = cache_store_memory_entry_of(memory, key, slot);
+        cache_store_memory_clear(entry);
+        entry->used = 1;
+        entry->key = key;
+        entry->slot = slot;
+        entry->data = copy;
+        entry->length = length;
+        entry->stamp = stamp;
+        entry->expires = ttl > 0 ? time(NULL) + ttl : 0;
+        pthread_mutex_unlock(&memory->lock);
+        op->result = CACHE_STORE_OK;
+    }
+    return cache_store_op_post(op);
+}
+
+static cache_store_op* cache_store_memory_remove(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                                 void* context) {
+    cache_store_memory* memory = (cache_store_memory*)self;
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_REMOVE, key, slot, done, context);
+    if (!op) return NULL;
+    pthread_mutex_lock(&memory->lock);
+    cache_store_memory_entry* entry = cache_store_memory_find(memory, key, slot);
+    if (entry) cache_store_memory_clear(entry);
+    pthread_mutex_unlock(&memory->lock);
+    op->result = entry ? CACHE_STORE_OK : CACHE_STORE_MISS;
+    return cache_store_op_post(op);
+}
+
+static cache_store_op* cache_store_memory_touch(cache_store* self, uint64_t key, uint8_t slot, int ttl,
+                                                cache_store_done done, void* context) {
+    cache_store_memory* memory = (cache_store_memory*)self;
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_TOUCH, key, slot, done, context);
+    if (!op) return NULL;
+    pthread_mutex_lock(&memory->lock);
+    cache_store_memory_entry* entry = cache_store_memory_find(memory, key, slot);
+    if (entry) entry->expires = ttl > 0 ? time(NULL) + ttl : 0;
+    pthread_mutex_unlock(&memory->lock);
+    op->result = entry ? CACHE_STORE_OK : CACHE_STORE_MISS;
+    return cache_store_op_post(op);
+}
+
+static void cache_store_memory_close(cache_store* self) {
+    cache_store_memory* memory = (cache_store_memory*)self;
+    for (int i = 0; i < memory->count; i++) free(memory->entries[i].data);
+    free(memory->entries);
+    pthread_mutex_destroy(&memory->lock);
+    free(memory);
+}
+
+static const cache_store_vtable g_memoryVtable = {
+    .get = cache_store_memory_get,
+    .put = cache_store_memory_put,
+    .remove = cache_store_memory_remove,
+    .touch = cache_store_memory_touch,
+    .close = cache_store_memory_close,
+};
+
+cache_store* cache_store_memory_open(int entries) {
+    if (entries < 1) return NULL;
+    cache_store_memory* memory = (cache_store_memory*)calloc(1, sizeof(cache_store_memory));
+    if (!memory) return NULL;
+    memory->entries = (cache_store_memory_entry*)calloc((size_t)entries, sizeof(cache_store_memory_entry));
+    if (!memory->entries) {
+        free(memory);
+        return NULL;
+    }
+    memory->count = entries;
+    pthread_mutex_init(&memory->lock, NULL);
+    memory->base.vtable = &g_memoryVtable;
+    return &memory->base;
+}
+
+// ========== Shared memory ==========
+// utilities/shm_table.h, read and written on the loop: a copy in or out
+
+typedef struct {
+    cache_store base;
+    shm_table* table;
+} cache_store_shm;
+
+static cache_store_op* cache_store_shm_get(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                           void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_GET, key, slot, done, context);
+    if (!op) return NULL;
+    op->result = shm_table_get(((cache_store_shm*)self)->table, key, slot, &op->data, &op->length, &op->stamp) == 0
+                     ? CACHE_STORE_OK
+                     : CACHE_STORE_MISS;
+    return cache_store_op_post(op);
+}
+
+static cache_store_op* cache_store_shm_put(cache_store* self, uint64_t key, uint8_t slot, const uint8_t* data,
+                                           size_t length, time_t stamp, int ttl, cache_store_done done,
+                                           void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_PUT, key, slot, done, context);
+    if (!op) return NULL;
+    op->result = shm_table_put(((cache_store_shm*)self)->table, key, slot, data, length, stamp, ttl) == 0
+                     ? CACHE_STORE_OK
+                     : CACHE_STORE_FAILED;
+    return cache_store_op_post(op);
+}
+
+static cache_store_op* cache_store_shm_remove(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                              void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_REMOVE, key, slot, done, context);
+    if (!op) return NULL;
+    op->result = shm_table_remove(((cache_store_shm*)self)->table, key, slot) == 0 ? CACHE_STORE_OK : CACHE_STORE_MISS;
+    return cache_store_op_post(op);
+}
+
+static cache_store_op* cache_store_shm_touch(cache_store* self, uint64_t key, uint8_t slot, int ttl,
+                                             cache_store_done done, void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_TOUCH, key, slot, done, context);
+    if (!op) return NULL;
+    op->result =
+        shm_table_touch(((cache_store_shm*)self)->table, key, slot, ttl) == 0 ? CACHE_STORE_OK : CACHE_STORE_MISS;
+    return cache_store_op_post(op);
+}
+
+static void cache_store_shm_close(cache_store* self) {
+    cache_store_shm* shm = (cache_store_shm*)self;
+    shm_table_close(&shm->table);
+    free(shm);
+}
+
+static const cache_store_vtable g_shmVtable = {
+    .get = cache_store_shm_get,
+    .put = cache_store_shm_put,
+    .remove = cache_store_shm_remove,
+    .touch = cache_store_shm_touch,
+    .close = cache_store_shm_close,
+};
+
+cache_store* cache_store_shm_open(int entries, size_t value_size) {
+    cache_store_shm* shm = (cache_store_shm*)calloc(1, sizeof(cache_store_shm));
+    if (!shm) return NULL;
+    shm->table = shm_table_open(entries, value_size);
+    if (!shm->table) {
+        free(shm);
+        return NULL;
+    }
+    shm->base.vtable = &g_shmVtable;
+    return &shm->base;
+}
+
+// ========== File ==========
+// A record store of its own, read and written on the job pool
+
+typedef struct {
+    cache_store base;
+    record_store* records;
+} cache_store_file;
+
+// Pool thread
+static void cache_store_file_work(void* context) {
+    cache_store_op* op = (cache_store_op*)context;
+    record_store* records = ((cache_store_file*)op->store)->records;
+    switch (op->kind) {
+    case CACHE_STORE_GET:
+        op->result = record_store_get(records, op->key, op->slot, &op->data, &op->length, &op->stamp) == 0
+                         ? CACHE_STORE_OK
+                         : CACHE_STORE_MISS;
+        break;
+    case CACHE_STORE_PUT:
+        op->result = record_store_put(records, op->key, op->slot, op->value, op->value_length, op->value_stamp) == 0
+                         ? CACHE_STORE_OK
+                         : CACHE_STORE_FAILED;
+        break;
+    case CACHE_STORE_REMOVE:
+        op->result = record_store_remove(records, op->key, op->slot) == 0 ? CACHE_STORE_OK : CACHE_STORE_MISS;
+        break;
+    case CACHE_STORE_TOUCH:
+        // Values stay until the retention drops them, by their stamp
+        op->result = record_store_stat(records, op->key, op->slot, NULL, NULL) == 0 ? CACHE_STORE_OK
+                                                                                   : CACHE_STORE_MISS;
+        break;
+    }
+}
+
+static void cache_store_file_done(void* context) {
+    cache_store_op_finish((cache_store_op*)context);
+}
+
+static cache_store_op* cache_store_file_submit(cache_store_op* op) {
+    if (!job_pool_submit(cache_store_file_work, cache_store_file_done, op)) {
+        cache_store_op_free(op);
+        return NULL;
+    }
+    return op;
+}
+
+static cache_store_op* cache_store_file_get(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                            void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_GET, key, slot, done, context);
+    return op ? cache_store_file_submit(op) : NULL;
+}
+
+static cache_store_op* cache_store_file_put(cache_store* self, uint64_t key, uint8_t slot, const uint8_t* data,
+                                            size_t length, time_t stamp, int ttl, cache_store_done done,
+                                            void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_PUT, key, slot, done, context);
+    if (!op) return NULL;
+    op->value = (uint8_t*)malloc(length ? length : 1);
+    if (!op->value) {
+        cache_store_op_free(op);
+        return NULL;
+    }
+    memcpy(op->value, data, length);
+    op->value_length = length;
+    op->value_stamp = stamp;
+    return cache_store_file_submit(op);
+}
+
+static cache_store_op* cache_store_file_remove(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                               void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_REMOVE, key, slot, done, context);
+    return op ? cache_store_file_submit(op) : NULL;
+}
+
+static cache_store_op* cache_store_file_touch(cache_store* self, uint64_t key, uint8_t slot, int ttl,
+                                              cache_store_done done, void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_TOUCH, key, slot, done, context);
+    return op ? cache_store_file_submit(op) : NULL;
+}
+
+static void cache_store_file_close(cache_store* self) {
+    cache_store_file* file = (cache_store_file*)self;
+    record_store_close(&file->records);
+    free(file);
+}
+
+static const cache_store_vtable g_fileVtable = {
+    .get = cache_store_file_get,
+    .put = cache_store_file_put,
+    .remove = cache_store_file_remove,
+    .touch = cache_store_file_touch,
+    .close = cache_store_file_close,
+};
+
+cache_store* cache_store_file_open(const char* path) {
+    cache_store_file* file = (cache_store_file*)calloc(1, sizeof(cache_store_file));
+    if (!file) return NULL;
+    if (record_store_open(&file->records, path, CACHE_STORE_FILE_CAPACITY, CACHE_STORE_FILE_RETAIN_S) != 0) {
+        free(file);
+        return NULL;
+    }
+    file->base.vtable = &g_fileVtable;
+    return &file->base;
+}
+
+// ========== Redis ==========
+// One connection per loop, opened on its first operation. Commands are
+// written to the connection's buffer as they come and go out together
+// once the loop gets to the connection's task, the replies come back in
+// order and complete the operations waiting for them. A value is its stamp
+// (host order) followed by the data.
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+} cache_store_buffer;
+
+typedef struct cache_store_redis cache_store_redis;
+
+typedef struct {
+    cache_store_redis* store;
+    int fd;
+    int connecting;
+    smw_task* task;
+    cache_store_buffer out;
+    size_t out_sent;
+    cache_store_buffer in;
+    // sent or about to be, oldest first
+    cache_store_op* head;
+    cache_store_op* tail;
+    int pending;
+    // monotonic ms, no connection is tried before it after one failed
+    uint64_t retry_ms;
+} cache_store_redis_conn;
+
+struct cache_store_redis {
+    cache_store base;
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    // by loop index, each only touched by its loop
+    cache_store_redis_conn* conns[LOOP_MAILBOX_MAX_LOOPS];
+};
+
+static int cache_store_buffer_reserve(cache_store_buffer* buffer, size_t more) {
+    if (buffer->length + more <= buffer->capacity) return 0;
+    size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+    while (capacity < buffer->length + more) capacity *= 2;
+    uint8_t* data = (uint8_t*)realloc(buffer->data, capacity);
+    if (!data) return -1;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static int cache_store_buffer_append(cache_store_buffer* buffer, const void* data, size_t length) {
+    if (cache_store_buffer_reserve(buffer, length) != 0) return -1;
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    return 0;
+}
+
+static int cache_store_redis_header(cache_store_buffer* buffer, char type, size_t value) {
+    char line[32];
+    int length = snprintf(line, sizeof(line), "%c%zu\r\n", type, value);
+    return cache_store_buffer_append(buffer, line, (size_t)length);
+}
+
+// A bulk string argument, data may be split in two parts (stamp and value)
+static int cache_store_redis_argument(cache_store_buffer* buffer, const void* first, size_t first_length,
+                                      const void* second, size_t second_length) {
+    if (cache_store_redis_header(buffer, '$', first_length + second_length) != 0 ||
+        cache_store_buffer_append(buffer, first, first_length) != 0 ||
+        (second_length && cache_store_buffer_append(buffer, second, second_length) != 0)) {
+        return -1;
+    }
+    return cache_store_buffer_append(buffer, "\r\n", 2);
+}
+
+static int cache_store_redis_key(cache_store_buffer* buffer, const cache_store* store, uint64_t key, uint8_t slot) {
+    char name[CACHE_STORE_NAME_SIZE + 32];
+    int length = snprintf(name, sizeof(name), "%s:%016llx:%u", store->name_space, (unsigned long long)key,
+                          (unsigned int)slot);
+    return cache_store_redis_argument(buffer, name, (size_t)length, NULL, 0);
+}
+
+static void cache_store_redis_watch(cache_store_redis_conn* conn) {
+    uint32_t events = SMW_READ;
+    if (conn->connecting || conn->out_sent < conn->out.length) events |= SMW_WRITE;
+    smw_watchFd(conn->task, conn->fd, events);
+    smw_setDeadline(conn->task, conn->head ? conn->head->started_ms + CACHE_STORE_REDIS_TIMEOUT_MS : 0);
+}
+
+// Closes the connection and fails everything it waited for
+static void cache_store_redis_fail(cache_store_redis_conn* conn, const char* reason) {
+    if (conn->fd >= 0) {
+        LOG_WARN("CacheStore: Redis connection failed (%s), retrying in %d ms", reason, CACHE_STORE_REDIS_RETRY_MS);
+        smw_parkTask(conn->task);
+        smw_setDeadline(conn->task, 0);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->connecting = 0;
+    conn->out.length = 0;
+    conn->out_sent = 0;
+    conn->in.length = 0;
+    conn->retry_ms = SystemMonotonicMS() + CACHE_STORE_REDIS_RETRY_MS;
+
+    // Taken off first, a done starting an operation finds the connection closed
+    cache_store_op* op = conn->head;
+    conn->head = conn->tail = NULL;
+    conn->pending = 0;
+    while (op) {
+        cache_store_op* next = op->next;
+        op->result = CACHE_STORE_FAILED;
+        cache_store_op_finish(op);
+        op = next;
+    }
+}
+
+// Bytes of the reply at data for op, 0 if it is not complete, -1 if it is
+// not a reply
+static long cache_store_redis_reply(const uint8_t* data, size_t length, cache_store_op* op) {
+    const uint8_t* end = (const uint8_t*)memchr(data, '\n', length);
+    if (!end) return 0;
+    size_t line = (size_t)(end - data) + 1;
+    if (line < 3 || end[-1] != '\r') return -1;
+
+    switch (data[0]) {
+    case '+':
+        op->result = CACHE_STORE_OK;
+        return (long)line;
+    case '-':
+        op->result = CACHE_STORE_FAILED;
+        return (long)line;
+    case ':':
+        op->result = data[1] == '0' ? CACHE_STORE_MISS : CACHE_STORE_OK;
+        return (long)line;
+    case '$': {
+        if (data[1] == '-') {
+            op->result = CACHE_STORE_MISS;
+            return (long)line;
+        }
+        char* after = NULL;
+        unsigned long long size = strtoull((const char*)data + 1, &after, 10);
+        if ((const uint8_t*)after != end - 1) return -1;
+        if (length - line < size + 2) return 0;
+        const uint8_t* value = data + line;
+        int64_t stamp = 0;
+        if (op->kind != CACHE_STORE_GET || size < sizeof(stamp)) {
+            op->result = CACHE_STORE_FAILED;
+        } else {
+            memcpy(&stamp, value, sizeof(stamp));
+            op->length = (size_t)size - sizeof(stamp);
+            op->data = (uint8_t*)malloc(op->length ? op->length : 1);
+            if (op->data) {
+                memcpy(op->data, value + sizeof(stamp), op->length);
+                op->stamp = (time_t)stamp;
+                op->result = CACHE_STORE_OK;
+            } else {
+                op->result = CACHE_STORE_FAILED;
+            }
+        }
+        return (long)(line + size + 2);
+    }
+    default:
+        // Nothing sent has an array or anything else for a reply
+        return -1;
+    }
+}
+
+static void cache_store_redis_read(cache_store_redis_conn* conn) {
+    for (;;) {
+        if (cache_store_buffer_reserve(&conn->in, 16384) != 0) {
+            cache_store_redis_fail(conn, "out of memory");
+            return;
+        }
+        ssize_t received = recv(conn->fd, conn->in.data + conn->in.length, conn->in.capacity - conn->in.length, 0);
+        if (received > 0) {
+            conn->in.length += (size_t)received;
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (received < 0 && errno == EINTR) continue;
+        cache_store_redis_fail(conn, received == 0 ? "closed" : strerror(errno));
+        return;
+    }
+
+    size_t offset = 0;
+    while (conn->head) {
+        long used = cache_store_redis_reply(conn->in.data + offset, conn->in.length - offset, conn->head);
+        if (used < 0) {
+            cache_store_redis_fail(conn, "protocol error");
+            return;
+        }
+        if (used == 0) break;
+        offset += (size_t)used;
+        cache_store_op* op = conn->head;
+        conn->head = op->next;
+        if (!conn->head) conn->tail = NULL;
+        conn->pending--;
+        cache_store_op_finish(op);
+        // done may have failed the connection starting another operation
+        if (conn->fd < 0) return;
+    }
+    if (offset < conn->in.length && !conn->head) {
+        cache_store_redis_fail(conn, "reply nobody asked for");
+        return;
+    }
+    memmove(conn->in.data, conn->in.data + offset, conn->in.length - offset);
+    conn->in.length -= offset;
+}
+
+static void cache_store_redis_taskwork(void* context, uint64_t monTime) {
+    cache_store_redis_conn* conn = (cache_store_redis_conn*)context;
+    if (conn->fd < 0) return;
+    uint32_t revents = conn->task->revents;
+
+    if (conn->head && monTime >= conn->head->started_ms + CACHE_STORE_REDIS_TIMEOUT_MS) {
+        cache_store_redis_fail(conn, "timed out");
+        return;
+    }
+    if (conn->connecting) {
+        if (!(revents & SMW_WRITE)) return;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            cache_store_redis_fail(conn, strerror(error ? error : errno));
+            return;
+        }
+        conn->connecting = 0;
+    }
+
+    // Everything queued since the last pass goes out in one write
+    while (conn->out_sent < conn->out.length) {
+        ssize_t sent = send(conn->fd, conn->out.data + conn->out_sent, conn->out.length - conn->out_sent, MSG_NOSIGNAL);
+        if (sent > 0) {
+            conn->out_sent += (size_t)sent;
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (sent < 0 && errno == EINTR) continue;
+        cache_store_redis_fail(conn, strerror(errno));
+        return;
+    }
+    if (conn->out_sent == conn->out.length) {
+        conn->out.length = 0;
+        conn->out_sent = 0;
+    }
+
+    if (revents & SMW_READ) {
+        cache_store_redis_read(conn);
+        if (conn->fd < 0) return;
+    }
+    cache_store_redis_watch(conn);
+}
+
+static int cache_store_redis_connect(cache_store_redis_conn* conn) {
+    if (SystemMonotonicMS() < conn->retry_ms) return -1;
+    int fd = socket(conn->store->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (const struct sockaddr*)&conn->store->address, conn->store->address_length) != 0 &&
+        errno != EINPROGRESS) {
+        close(fd);
+        conn->retry_ms = SystemMonotonicMS() + CACHE_STORE_REDIS_RETRY_MS;
+        return -1;
+    }
+    conn->fd = fd;
+    conn->connecting = 1;
+    return 0;
+}
+
+// The calling loop's connection, opened if it is not; NULL while it cannot be
+static cache_store_redis_conn* cache_store_redis_conn_of(cache_store_redis* redis) {
+    int index = loop_mailbox_self();
+    if (index < 0) return NULL;
+    cache_store_redis_conn* conn = redis->conns[index];
+    if (!conn) {
+        conn = (cache_store_redis_conn*)calloc(1, sizeof(cache_store_redis_conn));
+        if (!conn) return NULL;
+        conn->task = smw_createTask(conn, cache_store_redis_taskwork);
+        if (!conn->task) {
+            free(conn);
+            return NULL;
+        }
+        smw_setTaskName(conn->task, "cache_store_redis");
+        conn->store = redis;
+        conn->fd = -1;
+        redis->conns[index] = conn;
+    }
+    if (conn->fd < 0 && cache_store_redis_connect(conn) != 0) return NULL;
+    return conn;
+}
+
+// Queued once its command is written, the task sends it on its next run
+static cache_store_op* cache_store_redis_queue(cache_store_redis_conn* conn, cache_store_op* op) {
+    op->started_ms = SystemMonotonicMS();
+    if (conn->tail) {
+        conn->tail->next = op;
+    } else {
+        conn->head = op;
+    }
+    conn->tail = op;
+    conn->pending++;
+    cache_store_redis_watch(conn);
+    return op;
+}
+
+// Starts op with command: its name, the key, the value if there is one, then
+// option and argument if given. NULL and op freed if it cannot.
+static cache_store_op* cache_store_redis_start(cache_store* self, cache_store_op* op, const char* command,
+                                               const void* value, size_t value_length, const char* option,
+                                               const char* argument) {
+    if (!op) return NULL;
+    cache_store_redis_conn* conn = cache_store_redis_conn_of((cache_store_redis*)self);
+    if (!conn || conn->pending >= CACHE_STORE_REDIS_MAX_PENDING) {
+        cache_store_op_free(op);
+        return NULL;
+    }
+    size_t start = conn->out.length;
+    int64_t stamp = (int64_t)op->value_stamp;
+    size_t argc = 2 + (value ? 1 : 0) + (option ? 1 : 0) + (argument ? 1 : 0);
+    int written = cache_store_redis_header(&conn->out, '*', argc) == 0 &&
+                  cache_store_redis_argument(&conn->out, command, strlen(command), NULL, 0) == 0 &&
+                  cache_store_redis_key(&conn->out, self, op->key, op->slot) == 0;
+    if (written && value) {
+        written = cache_store_redis_argument(&conn->out, &stamp, sizeof(stamp), value, value_length) == 0;
+    }
+    if (written && option) written = cache_store_redis_argument(&conn->out, option, strlen(option), NULL, 0) == 0;
+    if (written && argument) {
+        written = cache_store_redis_argument(&conn->out, argument, strlen(argument), NULL, 0) == 0;
+    }
+    if (!written) {
+        // Whatever part of it was written never went out
+        conn->out.length = start;
+        cache_store_op_free(op);
+        return NULL;
+    }
+    return cache_store_redis_queue(conn, op);
+}
+
+static cache_store_op* cache_store_redis_get(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                             void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_GET, key, slot, done, context);
+    return cache_store_redis_start(self, op, "GET", NULL, 0, NULL, NULL);
+}
+
+static cache_store_op* cache_store_redis_put(cache_store* self, uint64_t key, uint8_t slot, const uint8_t* data,
+                                             size_t length, time_t stamp, int ttl, cache_store_done done,
+                                             void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_PUT, key, slot, done, context);
+    if (!op) return NULL;
+    op->value_stamp = stamp;
+    char seconds[16];
+    snprintf(seconds, sizeof(seconds), "%d", ttl);
+    return cache_store_redis_start(self, op, "SET", data, length, ttl > 0 ? "EX" : NULL,
+                                   ttl > 0 ? seconds : NULL);
+}
+
+static cache_store_op* cache_store_redis_remove(cache_store* self, uint64_t key, uint8_t slot, cache_store_done done,
+                                                void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_REMOVE, key, slot, done, context);
+    return cache_store_redis_start(self, op, "DEL", NULL, 0, NULL, NULL);
+}
+
+static cache_store_op* cache_store_redis_touch(cache_store* self, uint64_t key, uint8_t slot, int ttl,
+                                               cache_store_done done, void* context) {
+    cache_store_op* op = cache_store_op_new(self, CACHE_STORE_TOUCH, key, slot, done, context);
+    if (!op) return NULL;
+    char seconds[16];
+    snprintf(seconds, sizeof(seconds), "%d", ttl);
+    // PERSIST takes the expiry off, what a ttl of 0 means
+    if (ttl <= 0) return cache_store_redis_start(self, op, "PERSIST", NULL, 0, NULL, NULL);
+    return cache_store_redis_start(self, op, "EXPIRE", NULL, 0, NULL, seconds);
+}
+
+static void cache_store_redis_release_thread(cache_store* self) {
+    cache_store_redis* redis = (cache_store_redis*)self;
+    int index = loop_mailbox_self();
+    if (index < 0 || !redis->conns[index]) return;
+    cache_store_redis_conn* conn = redis->conns[index];
+    cache_store_redis_fail(conn, "loop stopping");
+    smw_destroyTask(conn->task);
+    free(conn->out.data);
+    free(conn->in.data);
+    free(conn);
+    redis->conns[index] = NULL;
+}
+
+static void cache_store_redis_close(cache_store* self) {
+    free(self);
+}
+
+static const cache_store_vtable g_redisVtable = {
+    .get = cache_store_redis_get,
+    .put = cache_store_redis_put,
+    .remove = cache_store_redis_remove,
+    .touch = cache_store_redis_touch,
+    .release_thread = cache_store_redis_release_thread,
+    .close = cache_store_redis_close,
+};
+
+cache_store* cache_store_redis_open(const char* host, const char* port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* found = NULL;
+    if (getaddrinfo(host, port, &hints, &found) != 0 || !found) return NULL;
+
+    cache_store_redis* redis = (cache_store_redis*)calloc(1, sizeof(cache_store_redis));
+    if (redis && found->ai_addrlen <= sizeof(redis->address)) {
+        memcpy(&redis->address, found->ai_addr, found->ai_addrlen);
+        redis->address_length = (socklen_t)found->ai_addrlen;
+        redis->base.vtable = &g_redisVtable;
+    } else {
+        free(redis);
+        redis = NULL;
+    }
+    freeaddrinfo(found);
+    return redis ? &redis->base : NULL;
+}
+
+// ========== Interface ==========
+
+cache_store* cache_store_open(const char* url, const char* name_space) {
+    cache_store* store = NULL;
+    if (strcmp(url, "memory") == 0) {
+        store = cache_store_memory_open(CACHE_STORE_MEMORY_ENTRIES);
+    } else if (strcmp(url, "shm") == 0) {
+        store = cache_store_shm_open(CACHE_STORE_SHM_ENTRIES, CACHE_STORE_SHM_VALUE_SIZE);
+    } else if (strncmp(url, "file:", strlen("file:")) == 0 && url[strlen("file:")] != '\0') {
+        store = cache_store_file_open(url + strlen("file:"));
+    } else if (strncmp(url, "redis://", strlen("redis://")) == 0) {
+        // host:port, [v6]:port or host alone for the default port
+        char host[256];
+        const char* address = url + strlen("redis://");
+        const char* colon = strrchr(address, ':');
+        if (colon && strchr(colon, ']')) colon = NULL;
+        size_t length = colon ? (size_t)(colon - address) : strcspn(address, "/");
+        if (length == 0 || length >= sizeof(host)) return NULL;
+        memcpy(host, address, length);
+        host[length] = '\0';
+        if (host[0] == '[' && host[length - 1] == ']') {
+            memmove(host, host + 1, length - 2);
+            host[length - 2] = '\0';
+        }
+        char port[16] = "6379";
+        if (colon) snprintf(port, sizeof(port), "%.*s", (int)strcspn(colon + 1, "/"), colon + 1);
+        store = cache_store_redis_open(host, port);
+    }
+    if (store) snprintf(store->name_space, sizeof(store->name_space), "%s", name_space);
+    return store;
+}
+
+cache_store_op* cache_store_get(cache_store* store, uint64_t key, uint8_t slot, cache_store_done done, void* context) {
+    return store->vtable->get(store, key, slot, done, context);
+}
+
+cache_store_op* cache_store_put(cache_store* store, uint64_t key, uint8_t slot, const uint8_t* data, size_t length,
+                                time_t stamp, int ttl, cache_store_done done, void* context) {
+    return store->vtable->put(store, key, slot, data, length, stamp, ttl, done, context);
+}
+
+cache_store_op* cache_store_remove(cache_store* store, uint64_t key, uint8_t slot, cache_store_done done,
+                                   void* context) {
+    return store->vtable->remove(store, key, slot, done, context);
+}
+
+cache_store_op* cache_store_touch(cache_store* store, uint64_t key, uint8_t slot, int ttl, cache_store_done done,
+                                  void* context) {
+    return store->vtable->touch(store, key, slot, ttl, done, context);
+}
+
+void cache_store_cancel(cache_store_op* op) {
+    if (op) op->done = NULL;
+}
+
+void cache_store_release_thread(cache_store* store) {
+    if (store && store->vtable->release_thread) store->vtable->release_thread(store);
+}
+
+void cache_store_close(cache_store** store) {
+    if (!store || !*store) return;
+    (*store)->vtable->close(*store);
+    *store = NULL;
+}
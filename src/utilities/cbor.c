@@ -0,0 +1,297 @@
+#include "utilities/cbor.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "utilities/json_scan.h"
+
+enum {
+    CBOR_UNSIGNED = 0,
+    CBOR_NEGATIVE = 1,
+    CBOR_TEXT = 3,
+    CBOR_ARRAY = 4,
+    CBOR_MAP = 5,
+    CBOR_SIMPLE = 7
+};
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+    int failed;
+    // Decoded strings, as long as the whole text so any of them fits
+    char* scratch;
+    size_t scratch_size;
+} cbor_writer;
+
+static uint8_t* cbor_reserve(cbor_writer* writer, size_t n) {
+    if (writer->failed) return NULL;
+    if (writer->length + n > writer->capacity) {
+        size_t capacity = writer->capacity * 2 + n;
+        uint8_t* grown = (uint8_t*)realloc(writer->data, capacity);
+        if (!grown) {
+            writer->failed = 1;
+            return NULL;
+        }
+        writer->data = grown;
+        writer->capacity = capacity;
+    }
+    return writer->data + writer->length;
+}
+
+static size_t cbor_head_size(uint64_t value) {
+    if (value < 24) return 1;
+    if (value <= 0xff) return 2;
+    if (value <= 0xffff) return 3;
+    if (value <= 0xffffffffu) return 5;
+    return 9;
+}
+
+// The head of major with value as its argument, at out
+static void cbor_head_at(uint8_t* out, int major, uint64_t value) {
+    size_t size = cbor_head_size(value);
+    if (size == 1) {
+        out[0] = (uint8_t)(major << 5 | value);
+        return;
+    }
+    static const uint8_t info[] = {0, 0, 24, 25, 0, 26, 0, 0, 0, 27};
+    out[0] = (uint8_t)(major << 5 | info[size]);
+    // Big endian
+    for (size_t i = size - 1; i > 0; i--) {
+        out[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+static void cbor_head(cbor_writer* writer, int major, uint64_t value) {
+    uint8_t* out = cbor_reserve(writer, 9);
+    if (!out) return;
+    cbor_head_at(out, major, value);
+    writer->length += cbor_head_size(value);
+}
+
+static void cbor_text(cbor_writer* writer, const char* text, size_t length) {
+    cbor_head(writer, CBOR_TEXT, length);
+    uint8_t* out = cbor_reserve(writer, length);
+    if (!out) return;
+    memcpy(out, text, length);
+    writer->length += length;
+}
+
+// Significant digits of a number's text, 0 if it has more than a float32 keeps
+static int cbor_digits(const char* text, size_t length) {
+    int digits = 0;
+    int leading = 1;
+    for (size_t i = 0; i < length && text[i] != 'e' && text[i] != 'E'; i++) {
+        if (text[i] < '0' || text[i] > '9') continue;
+        if (leading && text[i] == '0') continue;
+        leading = 0;
+        digits++;
+    }
+    return digits > 7 ? 0 : (digits == 0 ? 1 : digits);
+}
+
+static void cbor_number(cbor_writer* writer, json_scan* scan) {
+    size_t start = json_scan_tell(scan);
+    double value;
+    if (json_scan_number(scan, &value) != 0) return;
+    const char* text = scan->data + start;
+    size_t length = json_scan_tell(scan) - start;
+    while (length > 0 && (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r')) {
+        text++;
+        length--;
+    }
+
+    if (!memchr(text, '.', length) && !memchr(text, 'e', length) && !memchr(text, 'E', length) &&
+        fabs(value) < 9007199254740992.0) {
+        if (value >= 0) {
+            cbor_head(writer, CBOR_UNSIGNED, (uint64_t)value);
+        } else {
+            cbor_head(writer, CBOR_NEGATIVE, (uint64_t)(-value) - 1);
+        }
+        return;
+    }
+
+    float single = (float)value;
+    int digits = cbor_digits(text, length);
+    int narrow = (double)single == value;
+    if (!narrow && digits > 0 && isfinite(single)) {
+        // Reads back as the text did with its own number of digits
+        char shortest[32];
+        snprintf(shortest, sizeof(shortest), "%.*g", digits, (double)single);
+        narrow = strtod(shortest, NULL) == value;
+    }
+    uint8_t* out = cbor_reserve(writer, 9);
+    if (!out) return;
+    if (narrow) {
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        out[0] = (uint8_t)(CBOR_SIMPLE << 5 | 26);
+        for (int i = 4; i > 0; i--, bits >>= 8) out[i] = (uint8_t)bits;
+        writer->length += 5;
+    } else {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        out[0] = (uint8_t)(CBOR_SIMPLE << 5 | 27);
+        for (int i = 8; i > 0; i--, bits >>= 8) out[i] = (uint8_t)bits;
+        writer->length += 9;
+    }
+}
+
+// A map or array's count goes in front once known: one byte is held for it
+// and the members move up if it needs more
+static void cbor_close(cbor_writer* writer, size_t at, int major, uint64_t count) {
+    if (writer->failed) return;
+    size_t size = cbor_head_size(count);
+    if (size > 1) {
+        if (!cbor_reserve(writer, size - 1)) return;
+        memmove(writer->data + at + size, writer->data + at + 1, writer->length - at - 1);
+        writer->length += size - 1;
+    }
+    cbor_head_at(writer->data + at, major, count);
+}
+
+static void cbor_value(cbor_writer* writer, json_scan* scan, int depth) {
+    if (depth > CBOR_MAX_DEPTH) {
+        writer->failed = 1;
+        return;
+    }
+    switch (json_scan_peek(scan)) {
+    case JSON_SCAN_OBJECT: {
+        size_t at = writer->length;
+        if (!cbor_reserve(writer, 1)) return;
+        writer->length++;
+        uint64_t count = 0;
+        const char* key;
+        size_t length;
+        json_scan_object_begin(scan);
+        while (!writer->failed && json_scan_object_next(scan, &key, &length) > 0) {
+            // Our keys are plain names, one with escapes is not worth decoding
+            if (memchr(key, '\\', length)) {
+                writer->failed = 1;
+                return;
+            }
+            cbor_text(writer, key, length);
+            cbor_value(writer, scan, depth + 1);
+            count++;
+        }
+        cbor_close(writer, at, CBOR_MAP, count);
+        break;
+    }
+    case JSON_SCAN_ARRAY: {
+        size_t at = writer->length;
+        if (!cbor_reserve(writer, 1)) return;
+        writer->length++;
+        uint64_t count = 0;
+        json_scan_array_begin(scan);
+        while (!writer->failed && json_scan_array_next(scan) > 0) {
+            cbor_value(writer, scan, depth + 1);
+            count++;
+        }
+        cbor_close(writer, at, CBOR_ARRAY, count);
+        break;
+    }
+    case JSON_SCAN_STRING: {
+        int length = json_scan_string(scan, writer->scratch, writer->scratch_size);
+        if (length < 0) {
+            writer->failed = 1;
+            return;
+        }
+        cbor_text(writer, writer->scratch, (size_t)length);
+        break;
+    }
+    case JSON_SCAN_NUMBER:
+        cbor_number(writer, scan);
+        break;
+    case JSON_SCAN_TRUE:
+    case JSON_SCAN_FALSE: {
+        int value = 0;
+        json_scan_bool(scan, &value);
+        cbor_head(writer, CBOR_SIMPLE, value ? 21 : 20);
+        break;
+    }
+    case JSON_SCAN_NULL:
+        json_scan_null(scan);
+        cbor_head(writer, CBOR_SIMPLE, 22);
+        break;
+    default:
+        writer->failed = 1;
+        break;
+    }
+}
+
+uint8_t* cbor_from_json(const char* json, size_t length, size_t* out_length) {
+    // CBOR comes out smaller than the text, rarely more than its length
+    cbor_writer writer = {(uint8_t*)malloc(length + 16), 0, length + 16, 0, (char*)malloc(length + 1), length + 1};
+    if (!writer.data || !writer.scratch) {
+        free(writer.data);
+        free(writer.scratch);
+        return NULL;
+    }
+    json_scan scan;
+    json_scan_init(&scan, json, length);
+    cbor_value(&writer, &scan, 0);
+    free(writer.scratch);
+    if (writer.failed || scan.failed || json_scan_peek(&scan) != JSON_SCAN_END) {
+        free(writer.data);
+        return NULL;
+    }
+    *out_length = writer.length;
+    return writer.data;
+}
+
+// q of a media range's parameters ("; charset=utf-8; q=0.5"), 1000ths
+static int cbor_quality(const char* p, const char* end) {
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ';')) p++;
+        if (end - p >= 2 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+            p += 2;
+            if (p < end && *p == '1') return 1000;
+            int value = 0;
+            int scale = 1000;
+            if (p < end && *p == '0') p++;
+            if (p < end && *p == '.') {
+                p++;
+                while (p < end && *p >= '0' && *p <= '9' && scale > 1) {
+                    scale /= 10;
+                    value += (*p - '0') * scale;
+                    p++;
+                }
+            }
+            return value;
+        }
+        while (p < end && *p != ';') p++;
+    }
+    return 1000;
+}
+
+int cbor_negotiate(const char* accept, size_t length) {
+    if (!accept) return 0;
+
+    int cbor = -1;
+    int json = -1;
+    int application = -1;
+    int any = -1;
+    const char* p = accept;
+    const char* end = accept + length;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) p++;
+        const char* token = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ') p++;
+        size_t token_length = p - token;
+        const char* params = p;
+        while (p < end && *p != ',') p++;
+        int quality = cbor_quality(params, p);
+
+        if (token_length == 16 && strncasecmp(token, "application/cbor", 16) == 0) cbor = quality;
+        else if (token_length == 16 && strncasecmp(token, "application/json", 16) == 0) json = quality;
+        else if (token_length == 13 && strncasecmp(token, "application/*", 13) == 0) application = quality;
+        else if (token_length == 3 && strncmp(token, "*/*", 3) == 0) any = quality;
+    }
+    // JSON stays the default, CBOR goes only to clients that name it
+    if (json < 0) json = application >= 0 ? application : any;
+    return cbor > 0 && cbor >= json;
+}
@@ -0,0 +1,175 @@
+#include "utilities/circuit_breaker.h"
+#include "utilities/logger.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Appended to only, readers scan up to the published count without the lock
+static circuit_breaker g_breakers[CIRCUIT_BREAKER_MAX_HOSTS];
+static int g_breakerCount = 0;
+static pthread_mutex_t g_breakersLock = PTHREAD_MUTEX_INITIALIZER;
+
+// "scheme://host[:port]/..." to host[:port]
+static int circuit_breaker_host(const char* url, char* host, size_t size) {
+    const char* start = strstr(url, "://");
+    start = start ? start + 3 : url;
+    size_t length = strcspn(start, "/?#");
+    if (length == 0 || length >= size) return -1;
+    memcpy(host, start, length);
+    host[length] = '\0';
+    return 0;
+}
+
+static circuit_breaker* circuit_breaker_find(const char* host, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(g_breakers[i].host, host) == 0) return &g_breakers[i];
+    }
+    return NULL;
+}
+
+circuit_breaker* circuit_breaker_for(const char* url) {
+    char host[sizeof(g_breakers[0].host)];
+    if (circuit_breaker_host(url, host, sizeof(host)) != 0) return NULL;
+
+    circuit_breaker* breaker = circuit_breaker_find(host, __atomic_load_n(&g_breakerCount, __ATOMIC_ACQUIRE));
+    if (breaker) return breaker;
+
+    pthread_mutex_lock(&g_breakersLock);
+    breaker = circuit_breaker_find(host, g_breakerCount);
+    if (!breaker && g_breakerCount < CIRCUIT_BREAKER_MAX_HOSTS) {
+        breaker = &g_breakers[g_breakerCount];
+        memset(breaker, 0, sizeof(circuit_breaker));
+        strcpy(breaker->host, host);
+        pthread_mutex_init(&breaker->lock, NULL);
+        __atomic_store_n(&g_breakerCount, g_breakerCount + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g_breakersLock);
+    return breaker;
+}
+
+static void circuit_breaker_reset_window(circuit_breaker* breaker, uint64_t now_ms) {
+    breaker->window_start_ms = now_ms;
+    breaker->window_requests = 0;
+    breaker->window_failures = 0;
+    breaker->window_slow = 0;
+}
+
+static void circuit_breaker_open(circuit_breaker* breaker, uint64_t now_ms) {
+    if (breaker->state != CIRCUIT_BREAKER_OPEN) LOG_WARN("CircuitBreaker: %s open", breaker->host);
+    breaker->state = CIRCUIT_BREAKER_OPEN;
+    breaker->opened_ms = now_ms;
+    circuit_breaker_reset_window(breaker, now_ms);
+}
+
+int circuit_breaker_allow(circuit_breaker* breaker, uint64_t now_ms, int* probe) {
+    *probe = 0;
+    pthread_mutex_lock(&breaker->lock);
+    int allow = 1;
+    if (breaker->state == CIRCUIT_BREAKER_OPEN && now_ms - breaker->opened_ms >= CIRCUIT_BREAKER_OPEN_MS) {
+        breaker->state = CIRCUIT_BREAKER_HALF_OPEN;
+    }
+    if (breaker->state == CIRCUIT_BREAKER_OPEN) {
+        allow = 0;
+    } else if (breaker->state == CIRCUIT_BREAKER_HALF_OPEN) {
+        // One request finds out whether the upstream is back
+        allow = !breaker->probing;
+        if (allow) {
+            breaker->probing = 1;
+            *probe = 1;
+        }
+    }
+    pthread_mutex_unlock(&breaker->lock);
+    return allow;
+}
+
+void circuit_breaker_record(circuit_breaker* breaker, int success, uint64_t latency_ms, int probe, uint64_t now_ms) {
+    pthread_mutex_lock(&breaker->lock);
+
+    if (success) {
+        int bucket = 0;
+        while (bucket < CIRCUIT_BREAKER_LATENCY_BUCKETS - 1 && (latency_ms >> (bucket + 1)) != 0) bucket++;
+        breaker->latency[bucket]++;
+        // Decays, the timeout follows the upstream as it is now
+        if (++breaker->latency_count >= 1024) {
+            breaker->latency_count = 0;
+            for (int i = 0; i < CIRCUIT_BREAKER_LATENCY_BUCKETS; i++) {
+                breaker->latency[i] >>= 1;
+                breaker->latency_count += breaker->latency[i];
+            }
+        }
+    }
+
+    if (probe) {
+        breaker->probing = 0;
+        if (success && latency_ms < CIRCUIT_BREAKER_SLOW_MS) {
+            LOG_INFO("CircuitBreaker: %s closed", breaker->host);
+            breaker->state = CIRCUIT_BREAKER_CLOSED;
+            circuit_breaker_reset_window(breaker, now_ms);
+        } else {
+            circuit_breaker_open(breaker, now_ms);
+        }
+    } else if (breaker->state == CIRCUIT_BREAKER_CLOSED) {
+        if (now_ms - breaker->window_start_ms >= CIRCUIT_BREAKER_WINDOW_MS) circuit_breaker_reset_window(breaker, now_ms);
+        breaker->window_requests++;
+        if (!success) breaker->window_failures++;
+        if (latency_ms >= CIRCUIT_BREAKER_SLOW_MS) breaker->window_slow++;
+
+        uint32_t limit = breaker->window_requests * CIRCUIT_BREAKER_FAILURE_PERCENT / 100;
+        if (breaker->window_requests >= CIRCUIT_BREAKER_MIN_REQUESTS &&
+            (breaker->window_failures >= limit || breaker->window_slow >= limit)) {
+            circuit_breaker_open(breaker, now_ms);
+        }
+    }
+
+    pthread_mutex_unlock(&breaker->lock);
+}
+
+void circuit_breaker_release(circuit_breaker* breaker, int probe) {
+    if (!probe) return;
+    pthread_mutex_lock(&breaker->lock);
+    breaker->probing = 0;
+    pthread_mutex_unlock(&breaker->lock);
+}
+
+uint64_t circuit_breaker_latency_ms(circuit_breaker* breaker, int percent) {
+    pthread_mutex_lock(&breaker->lock);
+    uint32_t total = 0;
+    for (int i = 0; i < CIRCUIT_BREAKER_LATENCY_BUCKETS; i++) total += breaker->latency[i];
+
+    uint64_t latency = 0;
+    if (total >= CIRCUIT_BREAKER_MIN_REQUESTS) {
+        uint32_t below = 0;
+        int bucket = 0;
+        for (; bucket < CIRCUIT_BREAKER_LATENCY_BUCKETS - 1; bucket++) {
+            below += breaker->latency[bucket];
+            if ((uint64_t)below * 100 >= (uint64_t)total * percent) break;
+        }
+        // The bucket's upper bound, the percentile is somewhere below it
+        latency = 1ULL << (bucket + 1);
+    }
+    pthread_mutex_unlock(&breaker->lock);
+    return latency;
+}
+
+long circuit_breaker_timeout_ms(circuit_breaker* breaker, long max_ms) {
+    uint64_t p99 = circuit_breaker_latency_ms(breaker, 99);
+    if (p99 == 0) return max_ms;
+
+    long timeout = (long)p99 * CIRCUIT_BREAKER_TIMEOUT_FACTOR;
+    if (timeout < CIRCUIT_BREAKER_MIN_TIMEOUT_MS) timeout = CIRCUIT_BREAKER_MIN_TIMEOUT_MS;
+    if (timeout > max_ms) timeout = max_ms;
+    return timeout;
+}
+
+int circuit_breaker_is_open(circuit_breaker* breaker, uint64_t now_ms) {
+    // A breaker read mid-update is off by one request at most
+    return __atomic_load_n(&breaker->state, __ATOMIC_RELAXED) == CIRCUIT_BREAKER_OPEN &&
+           now_ms - __atomic_load_n(&breaker->opened_ms, __ATOMIC_RELAXED) < CIRCUIT_BREAKER_OPEN_MS;
+}
+
+void circuit_breaker_global_dispose(void) {
+    pthread_mutex_lock(&g_breakersLock);
+    for (int i = 0; i < g_breakerCount; i++) pthread_mutex_destroy(&g_breakers[i].lock);
+    __atomic_store_n(&g_breakerCount, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_breakersLock);
+}
@@ -0,0 +1,148 @@
+#include "utilities/compress.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#ifdef COMPRESS_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+// q value of the coding at token .. end ("gzip;q=0.5"), 1000ths
+static int compress_quality(const char* params, const char* end) {
+    const char* q = params;
+    while (q < end && (*q == ' ' || *q == ';')) q++;
+    if (end - q < 2 || (q[0] != 'q' && q[0] != 'Q') || q[1] != '=') return 1000;
+    q += 2;
+
+    int value = 0;
+    int scale = 1000;
+    if (q < end && *q == '1') return 1000;
+    if (q < end && *q == '0') q++;
+    if (q < end && *q == '.') {
+        q++;
+        while (q < end && *q >= '0' && *q <= '9' && scale > 1) {
+            scale /= 10;
+            value += (*q - '0') * scale;
+            q++;
+        }
+    }
+    return value;
+}
+
+compress_encoding compress_negotiate(const char* accept_encoding, size_t length) {
+    if (!accept_encoding) return COMPRESS_IDENTITY;
+
+    int gzip = -1;
+    int brotli = -1;
+    int any = 0;
+    const char* p = accept_encoding;
+    const char* end = accept_encoding + length;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) p++;
+        const char* token = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ') p++;
+        size_t token_length = p - token;
+        const char* params = p;
+        while (p < end && *p != ',') p++;
+        int quality = compress_quality(params, p);
+
+        if (token_length == 4 && strncasecmp(token, "gzip", 4) == 0) gzip = quality;
+        else if (token_length == 2 && strncasecmp(token, "br", 2) == 0) brotli = quality;
+        else if (token_length == 1 && *token == '*') any = quality;
+    }
+    // "*" stands for every coding not listed by name
+    if (gzip < 0) gzip = any;
+    if (brotli < 0) brotli = any;
+
+#ifdef COMPRESS_WITH_BROTLI
+    if (brotli > 0 && brotli >= gzip) return COMPRESS_BROTLI;
+#endif
+    if (gzip > 0) return COMPRESS_GZIP;
+    return COMPRESS_IDENTITY;
+}
+
+const char* compress_encoding_name(compress_encoding encoding) {
+    switch (encoding) {
+    case COMPRESS_GZIP:
+        return "gzip";
+    case COMPRESS_BROTLI:
+        return "br";
+    default:
+        return NULL;
+    }
+}
+
+const char* compress_encoding_suffix(compress_encoding encoding) {
+    switch (encoding) {
+    case COMPRESS_GZIP:
+        return ".gz";
+    case COMPRESS_BROTLI:
+        return ".br";
+    default:
+        return "";
+    }
+}
+
+size_t compress_bound(compress_encoding encoding, size_t length) {
+    switch (encoding) {
+    case COMPRESS_GZIP:
+        // deflateBound plus the gzip header and trailer
+        return compressBound(length) + 18;
+#ifdef COMPRESS_WITH_BROTLI
+    case COMPRESS_BROTLI:
+        return BrotliEncoderMaxCompressedSize(length);
+#endif
+    default:
+        return length;
+    }
+}
+
+static long compress_gzip(const void* data, size_t length, uint8_t* out, size_t capacity) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 15 + 16: zlib window with a gzip wrapper
+    if (deflateInit2(&stream, COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = (uInt)length;
+    stream.next_out = out;
+    stream.avail_out = (uInt)capacity;
+    int result = deflate(&stream, Z_FINISH);
+    long written = (long)stream.total_out;
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? written : -1;
+}
+
+long compress_into(compress_encoding encoding, const void* data, size_t length, uint8_t* out, size_t capacity) {
+    switch (encoding) {
+    case COMPRESS_GZIP:
+        return compress_gzip(data, length, out, capacity);
+#ifdef COMPRESS_WITH_BROTLI
+    case COMPRESS_BROTLI: {
+        size_t written = capacity;
+        if (!BrotliEncoderCompress(COMPRESS_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, length,
+                                   (const uint8_t*)data, &written, out))
+            return -1;
+        return (long)written;
+    }
+#endif
+    default:
+        return -1;
+    }
+}
+
+uint8_t* compress_alloc(compress_encoding encoding, const void* data, size_t length, size_t* out_length) {
+    size_t capacity = compress_bound(encoding, length);
+    uint8_t* out = (uint8_t*)malloc(capacity);
+    if (!out) return NULL;
+
+    long written = compress_into(encoding, data, length, out, capacity);
+    if (written < 0) {
+        free(out);
+        return NULL;
+    }
+    *out_length = (size_t)written;
+    return out;
+}
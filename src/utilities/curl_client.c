@@ -1,5 +1,16 @@
 #include "utilities/curl_client.h"
+
+#include <limits.h>
+#include <pthread.h>
+
 #include "global_defines.h"
+#include "smw.h"
+#include "utils.h"
+#include "utilities/circuit_breaker.h"
+#include "utilities/mem_account.h"
+#include "utilities/metrics.h"
+#include "utilities/probes.h"
+#include "utilities/tuning.h"
 
 int write_memory_callback(void* contents, size_t size, size_t nmemb, void* user_p) {
     size_t real_size = size * nmemb;
@@ -7,16 +18,33 @@ int write_memory_callback(void* contents, size_t size, size_t nmemb, void* user_
     struct memory_struct* mem = (struct memory_struct*)user_p;
 
     // Prevent exceeding centralized max response size
+    size_t max_size = (size_t)tuning_get()->curl_max_response_size;
     size_t new_size = mem->size + real_size;
-    if (new_size > CURL_CLIENT_MAX_RESPONSE_SIZE) {
+    if (new_size > max_size) {
         // Signal write failure to libcurl by returning 0
         return 0;
     }
 
-    char* ptr = realloc(mem->memory, new_size + 1);
-    if (ptr == NULL) { return 0; }
+    if (new_size + 1 > mem->capacity) {
+        size_t capacity = mem->capacity * 2;
+        if (mem->capacity == 0) {
+            // The headers are in by the first chunk, size for the whole body
+            curl_off_t expected = -1;
+            curl_easy_getinfo(mem->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &expected);
+            capacity = expected > 0 && (size_t)expected <= max_size ? (size_t)expected + 1
+                                                                    : CURL_CLIENT_INITIAL_BUFFER_SIZE;
+        }
+        if (capacity < new_size + 1) capacity = new_size + 1;
+        if (capacity > max_size + 1) capacity = max_size + 1;
+
+        char* ptr = realloc(mem->memory, capacity);
+        if (ptr == NULL) { return 0; }
+        // Counted while the transfer holds it, not once it is read out
+        mem_account_resize(MEM_TAG_CURL, mem->capacity, capacity);
+        mem->memory = ptr;
+        mem->capacity = capacity;
+    }
 
-    mem->memory = ptr;
     memcpy(&(mem->memory[mem->size]), contents, real_size);
     mem->size = new_size;
     mem->memory[mem->size] = 0;
@@ -24,59 +52,593 @@ int write_memory_callback(void* contents, size_t size, size_t nmemb, void* user_
     return real_size;
 }
 
-int curl_client_init(curl_client** client) {
+// Resolved hosts and TLS sessions of every loop, one lock per kind of data
+static CURLSH* g_share = NULL;
+static pthread_mutex_t g_shareLocks[CURL_LOCK_DATA_LAST];
+
+static void curl_client_share_lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* user_p) {
+    pthread_mutex_lock(&g_shareLocks[data]);
+}
+
+static void curl_client_share_unlock(CURL* handle, curl_lock_data data, void* user_p) {
+    pthread_mutex_unlock(&g_shareLocks[data]);
+}
+
+// Every loop's transfers, from start to finished (or failed)
+static metrics_histogram g_upstreamLatency;
+static metrics_counter g_upstreamOk;
+static metrics_counter g_upstreamFailed;
+static metrics_counter g_upstreamSkipped;
+
+static void curl_client_register_metrics(void) {
+    metrics_register("upstream_request_duration_seconds", "Time an upstream request took, hedges included.",
+                     METRICS_HISTOGRAM, NULL, &g_upstreamLatency);
+    metrics_register("upstream_requests_total", "Upstream requests finished, failed ones are errors, 429s and 5xxs.",
+                     METRICS_COUNTER, "result=\"ok\"", &g_upstreamOk);
+    metrics_register("upstream_requests_total", "Upstream requests finished, failed ones are errors, 429s and 5xxs.",
+                     METRICS_COUNTER, "result=\"failed\"", &g_upstreamFailed);
+    metrics_register("upstream_deadline_skipped_total",
+                     "Upstream requests not made or not started, their request's deadline was too close.",
+                     METRICS_COUNTER, NULL, &g_upstreamSkipped);
+}
+
+int curl_client_global_init(void) {
+    // Not thread safe, called once from main before any worker starts
     CURLcode res = curl_global_init(CURL_GLOBAL_DEFAULT);
     if (res != CURLE_OK) { return -1; }
 
-    (*client)->easy_handle = curl_easy_init();
-    if (!(*client)->easy_handle) { return -1; }
+    // Without the share every loop just resolves and handshakes on its own
+    g_share = curl_share_init();
+    if (g_share) {
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) pthread_mutex_init(&g_shareLocks[i], NULL);
+        curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, curl_client_share_lock);
+        curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, curl_client_share_unlock);
+        curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    curl_client_register_metrics();
 
-    (*client)->multi_handle = curl_multi_init();
-    if (!(*client)->multi_handle) {
-        curl_easy_cleanup((*client)->easy_handle);
-        return -1;
+    return 0;
+}
+
+void curl_client_global_cleanup(void) {
+    // Still in use means a handle leaked, leave the locks to it
+    if (g_share && curl_share_cleanup(g_share) == CURLSHE_OK) {
+        g_share = NULL;
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) pthread_mutex_destroy(&g_shareLocks[i]);
     }
+    circuit_breaker_global_dispose();
+    curl_global_cleanup();
+}
 
-    (*client)->mem.memory = malloc(1);
-    if (!(*client)->mem.memory) {
-        curl_multi_cleanup((*client)->multi_handle);
-        curl_easy_cleanup((*client)->easy_handle);
-        return -1;
+// One of curl's sockets, watched by its own smw task
+typedef struct curl_client_socket {
+    curl_socket_t fd;
+    smw_task* task;
+    struct curl_client_socket* next;
+    struct curl_client_socket* prev;
+} curl_client_socket;
+
+// The loop's transfers share one multi handle and its connection cache
+static __thread CURLM* t_multi = NULL;
+static __thread CURL* t_pool[CURL_CLIENT_POOL_SIZE];
+static __thread int t_poolCount = 0;
+// Set once the loop attached, curl then runs on socket and timer events
+static __thread int t_driven = 0;
+static __thread timer_wheel_timer t_timer;
+static __thread curl_client_socket* t_sockets = NULL;
+// Requests and hedges sent by this loop, halved now and then
+static __thread uint32_t t_hedgeRequests = 0;
+static __thread uint32_t t_hedges = 0;
+// The deadline of the request the loop is working on, see curl_client_set_deadline
+static __thread uint64_t t_deadline = 0;
+
+// Transfers of the loop to one upstream host, running and waiting their turn
+typedef struct curl_client_host {
+    circuit_breaker* breaker;
+    int active;
+    curl_client* head;
+    curl_client* tail;
+} curl_client_host;
+
+// One per breaker at most, hosts are served round robin
+static __thread curl_client_host t_hosts[CIRCUIT_BREAKER_MAX_HOSTS];
+static __thread int t_hostCount = 0;
+static __thread int t_nextHost = 0;
+static __thread timer_wheel_timer t_dispatchTimer;
+
+// The upstream quota is the process's, every loop takes from one bucket.
+// A token is 60000 units and a ms refills CURL_CLIENT_RATE_PER_MINUTE.
+#define CURL_CLIENT_TOKEN 60000ULL
+static pthread_mutex_t g_budgetLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t g_budgetTokens = (uint64_t)CURL_CLIENT_RATE_BURST * CURL_CLIENT_TOKEN;
+static uint64_t g_budgetLast = 0;
+
+static CURLM* curl_client_multi(void) {
+    if (t_multi) return t_multi;
+    t_multi = curl_multi_init();
+    if (!t_multi) return NULL;
+    curl_multi_setopt(t_multi, CURLMOPT_MAXCONNECTS, (long)CURL_CLIENT_MAX_CONNECTS);
+    curl_multi_setopt(t_multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(t_multi, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)CURL_CLIENT_MAX_STREAMS);
+    curl_multi_setopt(t_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)CURL_CLIENT_MAX_HOST_CONNECTIONS);
+    return t_multi;
+}
+
+static void curl_client_drop(curl_client* client, int hedge);
+static uint64_t curl_client_budget_take(uint64_t now);
+static void curl_client_dispatch(uint64_t now);
+static void curl_client_dispatch_fire(void* context, uint64_t monTime);
+
+// Marks every transfer curl reports done, on any client of the loop
+static void curl_client_collect(void) {
+    CURLMsg* msg;
+    int queued;
+    while ((msg = curl_multi_info_read(t_multi, &queued)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL* easy = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        curl_client* done = NULL;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char**)&done);
+        if (!done) continue;
+
+        if (done->hedge_handle) {
+            int hedge = easy == done->hedge_handle;
+            CURL* other = hedge ? done->easy_handle : done->hedge_handle;
+            // Failed while the other one still runs, it may make it
+            if (result != CURLE_OK && other) {
+                curl_client_drop(done, hedge);
+                continue;
+            }
+            curl_client_drop(done, !hedge);
+            if (hedge) {
+                // Nothing writes to either buffer any more, the winner moves in
+                done->easy_handle = done->hedge_handle;
+                done->mem = done->hedge_mem;
+                done->hedge_handle = NULL;
+                memset(&done->hedge_mem, 0, sizeof(struct memory_struct));
+            }
+        }
+        smw_cancelTimer(&done->hedge_timer);
+
+        done->still_running = 0;
+        done->result = result;
+        if (done->host) {
+            done->host->active--;
+            done->host = NULL;
+        }
+        // Overloaded or failing upstreams answer 429 and 5xx, those count as failures too
+        long status = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+        int success = done->result == CURLE_OK && status < 500 && status != 429;
+        PROBE3(curl_end, done, (int)result, status);
+        uint64_t now = SystemMonotonicMS();
+        metrics_histogram_record(&g_upstreamLatency, (now - done->started_ms) * 1000);
+        metrics_counter_add(success ? &g_upstreamOk : &g_upstreamFailed, 1);
+        if (done->breaker) {
+            circuit_breaker_record(done->breaker, success, now - done->started_ms, done->probe, now);
+            done->breaker = NULL;
+        }
+        if (done->on_complete) done->on_complete(done->context);
     }
-    (*client)->mem.size = 0;
+    // Finished transfers free up their hosts for queued ones
+    if (t_driven) curl_client_dispatch(SystemMonotonicMS());
+}
+
+static void curl_client_socket_taskwork(void* context, uint64_t monTime) {
+    curl_client_socket* sock = (curl_client_socket*)context;
+    uint32_t revents = sock->task->revents;
+    int flags = 0;
+    if (revents & SMW_READ) flags |= CURL_CSELECT_IN;
+    if (revents & SMW_WRITE) flags |= CURL_CSELECT_OUT;
 
-    curl_easy_setopt((*client)->easy_handle, CURLOPT_WRITEFUNCTION, (void*)write_memory_callback);
-    curl_easy_setopt((*client)->easy_handle, CURLOPT_WRITEDATA, (void*)&((*client)->mem));
+    // May remove (and free) sock through curl_client_socket_callback
+    int running = 0;
+    curl_multi_socket_action(t_multi, sock->fd, flags, &running);
+    curl_client_collect();
+}
+
+static void curl_client_timer_fire(void* context, uint64_t monTime) {
+    int running = 0;
+    curl_multi_socket_action(t_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    curl_client_collect();
+}
+
+static void curl_client_socket_free(curl_client_socket* sock) {
+    if (sock->prev) sock->prev->next = sock->next;
+    else t_sockets = sock->next;
+    if (sock->next) sock->next->prev = sock->prev;
+    smw_destroyTask(sock->task);
+    free(sock);
+}
+
+static int curl_client_socket_callback(CURL* easy, curl_socket_t fd, int what, void* user_p, void* socket_p) {
+    curl_client_socket* sock = (curl_client_socket*)socket_p;
+    if (what == CURL_POLL_REMOVE) {
+        if (sock) curl_client_socket_free(sock);
+        return 0;
+    }
+
+    if (!sock) {
+        sock = (curl_client_socket*)calloc(1, sizeof(curl_client_socket));
+        if (!sock) return -1;
+        sock->fd = fd;
+        sock->task = smw_createTask(sock, curl_client_socket_taskwork);
+        if (!sock->task) {
+            free(sock);
+            return -1;
+        }
+        smw_setTaskName(sock->task, "curl");
+        sock->next = t_sockets;
+        if (t_sockets) t_sockets->prev = sock;
+        t_sockets = sock;
+        curl_multi_assign(t_multi, fd, sock);
+    }
+
+    uint32_t events = 0;
+    if (what & CURL_POLL_IN) events |= SMW_READ;
+    if (what & CURL_POLL_OUT) events |= SMW_WRITE;
+    if (smw_watchFd(sock->task, fd, events) != 0) return -1;
+    return 0;
+}
+
+static int curl_client_timer_callback(CURLM* multi, long timeout_ms, void* user_p) {
+    if (timeout_ms < 0) {
+        smw_cancelTimer(&t_timer);
+    } else {
+        // 0 asks for a call as soon as possible, that is the next pass
+        smw_armTimer(&t_timer, SystemMonotonicMS() + (uint64_t)timeout_ms);
+    }
+    return 0;
+}
+
+int curl_client_attach_loop(void) {
+    if (t_driven) return 0;
+    if (!curl_client_multi()) return -1;
+
+    smw_initTimer(&t_timer, curl_client_timer_fire, NULL);
+    smw_initTimer(&t_dispatchTimer, curl_client_dispatch_fire, NULL);
+    curl_multi_setopt(t_multi, CURLMOPT_SOCKETFUNCTION, curl_client_socket_callback);
+    curl_multi_setopt(t_multi, CURLMOPT_TIMERFUNCTION, curl_client_timer_callback);
+    t_driven = 1;
+    return 0;
+}
+
+int curl_client_driven(void) {
+    return t_driven;
+}
+
+static CURL* curl_client_acquire_easy(void) {
+    if (t_poolCount > 0) return t_pool[--t_poolCount];
+    return curl_easy_init();
+}
+
+static void curl_client_release_easy(CURL* easy) {
+    if (t_poolCount < CURL_CLIENT_POOL_SIZE) {
+        // Reset drops the options but keeps what it learnt (DNS, TLS sessions)
+        curl_easy_reset(easy);
+        t_pool[t_poolCount++] = easy;
+    } else {
+        curl_easy_cleanup(easy);
+    }
+}
+
+static void curl_client_setup_easy(curl_client* client, CURL* easy, struct memory_struct* mem) {
+    // Allocated by the first chunk, once the body's size is known
+    mem->memory = NULL;
+    mem->size = 0;
+    mem->capacity = 0;
+    mem->easy = easy;
+
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, (void*)write_memory_callback);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, (void*)mem);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, (void*)client);
+    if (g_share) curl_easy_setopt(easy, CURLOPT_SHARE, g_share);
 
     // Apply centralized timeout settings
-    curl_easy_setopt((*client)->easy_handle, CURLOPT_CONNECTTIMEOUT, CURL_CONNECT_TIMEOUT_SEC);
-    curl_easy_setopt((*client)->easy_handle, CURLOPT_TIMEOUT, CURL_REQUEST_TIMEOUT_SEC);
+    const tuning* knobs = tuning_get();
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, knobs->curl_connect_timeout_ms);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, knobs->curl_request_timeout_ms);
+    // Workers run in threads, keep libcurl away from signals/alarm()
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    // Idle pooled connections would otherwise be dropped silently by NATs
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    // h2 over TLS (plain HTTP stays 1.1), a burst of misses waits for the
+    // first connection to say whether it multiplexes rather than opening more
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+}
+
+// Stops one of the client's two transfers and forgets what it received
+static void curl_client_drop(curl_client* client, int hedge) {
+    CURL** easy = hedge ? &client->hedge_handle : &client->easy_handle;
+    struct memory_struct* mem = hedge ? &client->hedge_mem : &client->mem;
+    if (*easy) {
+        curl_multi_remove_handle(client->multi_handle, *easy);
+        curl_client_release_easy(*easy);
+        *easy = NULL;
+    }
+    mem_account_resize(MEM_TAG_CURL, mem->capacity, 0);
+    free(mem->memory);
+    memset(mem, 0, sizeof(struct memory_struct));
+}
+
+// The first transfer is slower than most, ask again and take whichever
+// answers first
+static void curl_client_hedge_fire(void* context, uint64_t monTime) {
+    curl_client* client = (curl_client*)context;
+    if (!client->still_running || client->hedge_handle || !client->easy_handle) return;
+    // Within the budget, a slow upstream must not see its load doubled
+    if ((t_hedges + 1) * 100 > t_hedgeRequests * CURL_CLIENT_HEDGE_BUDGET_PERCENT) return;
+    if (curl_client_budget_take(monTime) != 0) return;
+
+    long remaining = client->timeout_ms - (long)(monTime - client->started_ms);
+    char* url = NULL;
+    curl_easy_getinfo(client->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
+    if (!url || remaining <= 0) return;
+
+    CURL* easy = curl_client_acquire_easy();
+    if (!easy) return;
+    curl_client_setup_easy(client, easy, &client->hedge_mem);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, remaining);
+    curl_easy_setopt(easy, CURLOPT_URL, url);
+    if (curl_multi_add_handle(client->multi_handle, easy) != CURLM_OK) {
+        curl_client_release_easy(easy);
+        return;
+    }
+    client->hedge_handle = easy;
+    t_hedges++;
+}
+
+// Tokens refilled up to now, under g_budgetLock
+static void curl_client_budget_refill(uint64_t now) {
+    if (now > g_budgetLast) {
+        if (g_budgetLast != 0) g_budgetTokens += (now - g_budgetLast) * CURL_CLIENT_RATE_PER_MINUTE;
+        g_budgetLast = now;
+    }
+    if (g_budgetTokens > (uint64_t)CURL_CLIENT_RATE_BURST * CURL_CLIENT_TOKEN) {
+        g_budgetTokens = (uint64_t)CURL_CLIENT_RATE_BURST * CURL_CLIENT_TOKEN;
+    }
+}
+
+int curl_client_budget_left(void) {
+    if (CURL_CLIENT_RATE_PER_MINUTE <= 0) return INT_MAX;
+    pthread_mutex_lock(&g_budgetLock);
+    curl_client_budget_refill(SystemMonotonicMS());
+    int left = (int)(g_budgetTokens / CURL_CLIENT_TOKEN);
+    pthread_mutex_unlock(&g_budgetLock);
+    return left;
+}
+
+// 0 with a token taken, otherwise the ms until there is one
+static uint64_t curl_client_budget_take(uint64_t now) {
+    if (CURL_CLIENT_RATE_PER_MINUTE <= 0) return 0;
+
+    uint64_t wait = 0;
+    pthread_mutex_lock(&g_budgetLock);
+    curl_client_budget_refill(now);
+    if (g_budgetTokens >= CURL_CLIENT_TOKEN) {
+        g_budgetTokens -= CURL_CLIENT_TOKEN;
+    } else {
+        wait = (CURL_CLIENT_TOKEN - g_budgetTokens + CURL_CLIENT_RATE_PER_MINUTE - 1) / CURL_CLIENT_RATE_PER_MINUTE;
+    }
+    pthread_mutex_unlock(&g_budgetLock);
+    return wait;
+}
+
+static curl_client_host* curl_client_host_for(circuit_breaker* breaker) {
+    for (int i = 0; i < t_hostCount; i++) {
+        if (t_hosts[i].breaker == breaker) return &t_hosts[i];
+    }
+    if (t_hostCount == CIRCUIT_BREAKER_MAX_HOSTS) return NULL;
+    curl_client_host* host = &t_hosts[t_hostCount++];
+    memset(host, 0, sizeof(curl_client_host));
+    host->breaker = breaker;
+    return host;
+}
+
+static void curl_client_unqueue(curl_client* client) {
+    curl_client_host* host = client->host;
+    if (client->queue_prev) client->queue_prev->queue_next = client->queue_next;
+    else host->head = client->queue_next;
+    if (client->queue_next) client->queue_next->queue_prev = client->queue_prev;
+    else host->tail = client->queue_prev;
+    client->queue_next = NULL;
+    client->queue_prev = NULL;
+    client->queued = 0;
+}
+
+// 1 if what is left until deadline is too little for the upstream to answer in
+static int curl_client_deadline_short(uint64_t deadline, circuit_breaker* breaker, uint64_t now) {
+    if (deadline == 0) return 0;
+    if (deadline <= now) return 1;
+    uint64_t needed = breaker ? circuit_breaker_latency_ms(breaker, 50) : 0;
+    if (needed < CURL_CLIENT_DEADLINE_MIN_MS) needed = CURL_CLIENT_DEADLINE_MIN_MS;
+    return deadline - now < needed;
+}
+
+static int curl_client_start(curl_client* client) {
+    // Curl counts the timeout from here, a transfer that queued gets what is left
+    if (client->deadline_ms) {
+        uint64_t now = SystemMonotonicMS();
+        long left = client->deadline_ms > now ? (long)(client->deadline_ms - now) : 1;
+        curl_easy_setopt(client->easy_handle, CURLOPT_TIMEOUT_MS, left < client->timeout_ms ? left : client->timeout_ms);
+        if (left < client->timeout_ms) client->timeout_ms = left;
+    }
+    if (curl_multi_add_handle(client->multi_handle, client->easy_handle) != CURLM_OK) { return -1; }
+    client->still_running = 1;
+    client->started_ms = SystemMonotonicMS();
+    if (client->host) client->host->active++;
+
+    // Only loops have the timers to hedge with
+    if (t_driven && client->breaker && CURL_CLIENT_HEDGE_BUDGET_PERCENT > 0) {
+        if (++t_hedgeRequests >= 1024) {
+            t_hedgeRequests >>= 1;
+            t_hedges >>= 1;
+        }
+        uint64_t delay = circuit_breaker_latency_ms(client->breaker, CURL_CLIENT_HEDGE_PERCENTILE);
+        if (delay > 0) smw_armTimer(&client->hedge_timer, client->started_ms + delay);
+    }
+    return 0;
+}
+
+// Starts queued transfers, oldest first per host and the hosts in turn,
+// while their hosts have room and the budget has tokens
+static void curl_client_dispatch(uint64_t now) {
+    int idle = 0;
+    while (t_hostCount > 0 && idle < t_hostCount) {
+        int index = t_nextHost;
+        curl_client_host* host = &t_hosts[index];
+        t_nextHost = (t_nextHost + 1) % t_hostCount;
+        if (!host->head || host->active >= CURL_CLIENT_HOST_CONCURRENCY) {
+            idle++;
+            continue;
+        }
+
+        uint64_t wait = curl_client_budget_take(now);
+        if (wait > 0) {
+            // This host's turn comes first once there is a token
+            t_nextHost = index;
+            smw_armTimer(&t_dispatchTimer, now + wait);
+            return;
+        }
+        idle = 0;
+
+        curl_client* client = host->head;
+        curl_client_unqueue(client);
+        // Queued past its deadline, a start now would only be thrown away
+        int skipped = client->deadline_ms && client->deadline_ms <= now;
+        if (skipped) metrics_counter_add(&g_upstreamSkipped, 1);
+        if (skipped || curl_client_start(client) != 0) {
+            client->still_running = 0;
+            client->result = skipped ? CURLE_OPERATION_TIMEDOUT : CURLE_FAILED_INIT;
+            client->host = NULL;
+            if (client->breaker) {
+                circuit_breaker_release(client->breaker, client->probe);
+                client->breaker = NULL;
+            }
+            if (client->on_complete) client->on_complete(client->context);
+        }
+    }
+}
+
+static void curl_client_dispatch_fire(void* context, uint64_t monTime) {
+    curl_client_dispatch(monTime);
+}
+
+int curl_client_init(curl_client** client) {
+    (*client)->multi_handle = curl_client_multi();
+    if (!(*client)->multi_handle) { return -1; }
+
+    (*client)->easy_handle = curl_client_acquire_easy();
+    if (!(*client)->easy_handle) { return -1; }
+
+    (*client)->still_running = 0;
+    (*client)->result = CURLE_OK;
+    (*client)->breaker = NULL;
+    (*client)->probe = 0;
+    (*client)->deadline_ms = t_deadline;
+    (*client)->hedge_handle = NULL;
+    memset(&(*client)->hedge_mem, 0, sizeof(struct memory_struct));
+    (*client)->host = NULL;
+    (*client)->queued = 0;
+    (*client)->queue_next = NULL;
+    (*client)->queue_prev = NULL;
+
+    curl_client_setup_easy(*client, (*client)->easy_handle, &(*client)->mem);
+    smw_initTimer(&(*client)->hedge_timer, curl_client_hedge_fire, *client);
 
     return 0;
 }
 
 int curl_client_make_request(curl_client** client, const char* url) {
+    // An upstream known to be down fails fast, callers fall back to what they have
+    circuit_breaker* breaker = circuit_breaker_for(url);
+    (*client)->timeout_ms = tuning_get()->curl_request_timeout_ms;
+    // So does one that could not answer before its request's deadline
+    if (curl_client_deadline_short((*client)->deadline_ms, breaker, SystemMonotonicMS())) {
+        metrics_counter_add(&g_upstreamSkipped, 1);
+        return -1;
+    }
+    if (breaker) {
+        if (!circuit_breaker_allow(breaker, SystemMonotonicMS(), &(*client)->probe)) { return -1; }
+        (*client)->timeout_ms = circuit_breaker_timeout_ms(breaker, (*client)->timeout_ms);
+        curl_easy_setopt((*client)->easy_handle, CURLOPT_TIMEOUT_MS, (*client)->timeout_ms);
+    }
+
     curl_easy_setopt((*client)->easy_handle, CURLOPT_URL, url);
-    curl_multi_add_handle((*client)->multi_handle, (*client)->easy_handle);
+    (*client)->breaker = breaker;
+    PROBE2(curl_begin, *client, url);
+
+    // Loops queue behind the host's limit and the budget, warm up only
+    // takes from the budget what is there
+    curl_client_host* host = t_driven && breaker ? curl_client_host_for(breaker) : NULL;
+    uint64_t now = SystemMonotonicMS();
+    if (host && (host->head || host->active >= CURL_CLIENT_HOST_CONCURRENCY || curl_client_budget_take(now) != 0)) {
+        (*client)->host = host;
+        (*client)->queued = 1;
+        (*client)->still_running = 1;
+        (*client)->queue_prev = host->tail;
+        if (host->tail) host->tail->queue_next = *client;
+        else host->head = *client;
+        host->tail = *client;
+        curl_client_dispatch(now);
+        return 0;
+    }
+    if (!host) curl_client_budget_take(now);
+
+    (*client)->host = host;
+    if (curl_client_start(*client) != 0) {
+        (*client)->host = NULL;
+        (*client)->breaker = NULL;
+        if (breaker) circuit_breaker_release(breaker, (*client)->probe);
+        return -1;
+    }
+
+    return 0;
+}
+
+void curl_client_set_deadline(uint64_t deadline_ms) {
+    t_deadline = deadline_ms;
+}
 
+int curl_client_deadline_allows(const char* url) {
+    if (!curl_client_deadline_short(t_deadline, circuit_breaker_for(url), SystemMonotonicMS())) return 1;
+    metrics_counter_add(&g_upstreamSkipped, 1);
     return 0;
 }
 
 int curl_client_poll(curl_client** client) {
-    CURLMcode mc = curl_multi_perform((*client)->multi_handle, &(*client)->still_running);
-    if (mc != CURLM_OK) { return -1; }
+    // An attached loop moves the transfer along on its own
+    if (!t_driven) {
+        int running = 0;
+        CURLMcode mc = curl_multi_perform((*client)->multi_handle, &running);
+        if (mc != CURLM_OK) { return -1; }
+        curl_client_collect();
+    }
+
+    if (!(*client)->still_running && (*client)->result != CURLE_OK) { return -1; }
+
+    return 0;
+}
+
+int curl_client_wait(curl_client** client, int timeout_ms) {
+    if (curl_multi_wait((*client)->multi_handle, NULL, 0, timeout_ms, NULL) != CURLM_OK) { return -1; }
 
     return 0;
 }
 
 int curl_client_read_response(curl_client** client, char** buffer) {
+    *buffer = NULL;
+    if ((*client)->result != CURLE_OK) { return -1; }
+
     if ((*client)->mem.size > 0) {
-        *buffer = (char*)malloc((*client)->mem.size + 1);
-        if (!*buffer) { return -1; }
-        memcpy(*buffer, (*client)->mem.memory, (*client)->mem.size);
-        (*buffer)[(*client)->mem.size] = '\0';
-    } else {
-        *buffer = NULL;
+        // NUL terminated by the write callback already
+        *buffer = (*client)->mem.memory;
+        mem_account_resize(MEM_TAG_CURL, (*client)->mem.capacity, 0);
+        (*client)->mem.memory = NULL;
+        (*client)->mem.size = 0;
+        (*client)->mem.capacity = 0;
     }
 
     return 0;
@@ -84,20 +646,53 @@ int curl_client_read_response(curl_client** client, char** buffer) {
 
 int curl_client_cleanup(curl_client** client) {
     if ((*client)->mem.memory) {
+        mem_account_resize(MEM_TAG_CURL, (*client)->mem.capacity, 0);
         free((*client)->mem.memory);
         (*client)->mem.memory = NULL;
     }
     (*client)->mem.size = 0;
+    (*client)->mem.capacity = 0;
+
+    if ((*client)->breaker) {
+        circuit_breaker_release((*client)->breaker, (*client)->probe);
+        (*client)->breaker = NULL;
+    }
+    smw_cancelTimer(&(*client)->hedge_timer);
+    if ((*client)->multi_handle) curl_client_drop(*client, 1);
+    if ((*client)->queued) {
+        curl_client_unqueue(*client);
+    } else if ((*client)->host) {
+        (*client)->host->active--;
+        curl_client_dispatch(SystemMonotonicMS());
+    }
+    (*client)->host = NULL;
 
     if ((*client)->easy_handle) {
-        curl_easy_cleanup((*client)->easy_handle);
+        // A transfer may still be in flight when its request is dropped,
+        // detaching it also drops a completion not read yet
+        if ((*client)->multi_handle) curl_multi_remove_handle((*client)->multi_handle, (*client)->easy_handle);
+        curl_client_release_easy((*client)->easy_handle);
         (*client)->easy_handle = NULL;
     }
-    if ((*client)->multi_handle) {
-        curl_multi_cleanup((*client)->multi_handle);
-        (*client)->multi_handle = NULL;
-    }
-    curl_global_cleanup();
+    (*client)->multi_handle = NULL;
+    (*client)->still_running = 0;
 
     return 0;
 }
+
+void curl_client_release_thread(void) {
+    while (t_poolCount > 0) curl_easy_cleanup(t_pool[--t_poolCount]);
+    if (t_multi) {
+        curl_multi_cleanup(t_multi);
+        t_multi = NULL;
+    }
+    // Whatever curl did not report removed on cleanup
+    while (t_sockets) curl_client_socket_free(t_sockets);
+    if (t_driven) {
+        smw_cancelTimer(&t_timer);
+        smw_cancelTimer(&t_dispatchTimer);
+        t_driven = 0;
+    }
+    t_hostCount = 0;
+    t_nextHost = 0;
+}
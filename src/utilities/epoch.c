@@ -0,0 +1,135 @@
+#include "utilities/epoch.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "utilities/job_pool.h"
+#include "utilities/logger.h"
+
+typedef struct {
+    // the global epoch at the loop's last quiescent point, 0 while unused
+    uint64_t seen;
+} __attribute__((aligned(64))) epoch_record;
+
+typedef struct epoch_retired {
+    void* version;
+    void (*release)(void* version);
+    // released once every attached loop has seen this epoch
+    uint64_t epoch;
+    struct epoch_retired* next;
+} epoch_retired;
+
+static epoch_record g_records[EPOCH_MAX_THREADS];
+static uint64_t g_epoch = 1;
+static __thread epoch_record* t_record = NULL;
+
+static pthread_mutex_t g_retiredLock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_retired* g_retired = NULL;
+// read without the lock by every quiescent point
+static int g_retiredCount = 0;
+
+static void epoch_release_job(void* context) {
+    epoch_retired* retired = (epoch_retired*)context;
+    retired->release(retired->version);
+    free(retired);
+}
+
+// Releases what no attached loop can see any more, on the job pool if
+// offload is set and the calling loop has one
+static void epoch_collect(int offload) {
+    if (pthread_mutex_trylock(&g_retiredLock) != 0) return;
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+        uint64_t seen = __atomic_load_n(&g_records[i].seen, __ATOMIC_ACQUIRE);
+        if (seen != 0 && seen < oldest) oldest = seen;
+    }
+    epoch_retired* done = NULL;
+    epoch_retired** link = &g_retired;
+    while (*link) {
+        epoch_retired* retired = *link;
+        if (retired->epoch <= oldest) {
+            *link = retired->next;
+            retired->next = done;
+            done = retired;
+            __atomic_sub_fetch(&g_retiredCount, 1, __ATOMIC_RELAXED);
+        } else {
+            link = &retired->next;
+        }
+    }
+    pthread_mutex_unlock(&g_retiredLock);
+
+    while (done) {
+        epoch_retired* next = done->next;
+        if (!offload || job_pool_submit(epoch_release_job, NULL, done) == NULL) epoch_release_job(done);
+        done = next;
+    }
+}
+
+int epoch_attach(void) {
+    if (t_record) return 0;
+    uint64_t epoch = __atomic_load_n(&g_epoch, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++) {
+        uint64_t unused = 0;
+        if (__atomic_compare_exchange_n(&g_records[i].seen, &unused, epoch, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            t_record = &g_records[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void epoch_detach(void) {
+    if (!t_record) return;
+    __atomic_store_n(&t_record->seen, 0, __ATOMIC_RELEASE);
+    t_record = NULL;
+    epoch_collect(0);
+}
+
+void epoch_quiescent(void) {
+    if (!t_record) return;
+    // Reads of this pass come before the store, reads after it find what
+    // was published up to the epoch stored
+    __atomic_store_n(&t_record->seen, __atomic_load_n(&g_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    if (__atomic_load_n(&g_retiredCount, __ATOMIC_RELAXED) > 0) epoch_collect(1);
+}
+
+void* epoch_publish(void** slot, void* version) {
+    return __atomic_exchange_n(slot, version, __ATOMIC_SEQ_CST);
+}
+
+void epoch_retire(void* version, void (*release)(void* version)) {
+    if (!version) return;
+    epoch_retired* retired = (epoch_retired*)malloc(sizeof(epoch_retired));
+    if (!retired) {
+        LOG_WARN("Epoch: Out of memory, a retired version is kept");
+        return;
+    }
+    retired->version = version;
+    retired->release = release;
+
+    pthread_mutex_lock(&g_retiredLock);
+    // A loop that stores this epoch loaded it after the publish
+    retired->epoch = __atomic_add_fetch(&g_epoch, 1, __ATOMIC_SEQ_CST);
+    retired->next = g_retired;
+    g_retired = retired;
+    __atomic_add_fetch(&g_retiredCount, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&g_retiredLock);
+
+    // Nothing may be reading it if no loop is attached
+    epoch_collect(0);
+}
+
+void epoch_dispose(void) {
+    pthread_mutex_lock(&g_retiredLock);
+    epoch_retired* retired = g_retired;
+    g_retired = NULL;
+    g_retiredCount = 0;
+    pthread_mutex_unlock(&g_retiredLock);
+
+    while (retired) {
+        epoch_retired* next = retired->next;
+        epoch_release_job(retired);
+        retired = next;
+    }
+}
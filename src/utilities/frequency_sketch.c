@@ -0,0 +1,77 @@
+#include "utilities/frequency_sketch.h"
+
+#include <stdlib.h>
+
+#define FREQUENCY_SKETCH_DEPTH 4
+#define FREQUENCY_SKETCH_MAX 15
+
+static const uint64_t frequency_sketch_seeds[FREQUENCY_SKETCH_DEPTH] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL};
+
+static size_t frequency_sketch_index(const frequency_sketch* sketch, uint64_t key, int row) {
+    // splitmix64 finalizer, one seed per row
+    key += frequency_sketch_seeds[row];
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t)row * sketch->width + ((size_t)key & (sketch->width - 1));
+}
+
+// Halves every counter, the one that passed the sample size does it
+static void frequency_sketch_age(frequency_sketch* sketch) {
+    size_t count = sketch->width * FREQUENCY_SKETCH_DEPTH;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t value = __atomic_load_n(&sketch->counters[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&sketch->counters[i], (uint8_t)(value >> 1), __ATOMIC_RELAXED);
+    }
+}
+
+int frequency_sketch_init(frequency_sketch* sketch, size_t width) {
+    size_t size = 16;
+    while (size < width) size <<= 1;
+
+    sketch->counters = (uint8_t*)calloc(size * FREQUENCY_SKETCH_DEPTH, 1);
+    if (!sketch->counters) return -1;
+    sketch->width = size;
+    sketch->additions = 0;
+    sketch->sample = (uint32_t)(size * 10);
+    return 0;
+}
+
+void frequency_sketch_dispose(frequency_sketch* sketch) {
+    free(sketch->counters);
+    sketch->counters = NULL;
+    sketch->width = 0;
+}
+
+void frequency_sketch_increment(frequency_sketch* sketch, uint64_t key) {
+    if (!sketch->counters) return;
+
+    // Conservative update, only the smallest counters grow
+    int minimum = frequency_sketch_estimate(sketch, key);
+    if (minimum >= FREQUENCY_SKETCH_MAX) return;
+    for (int row = 0; row < FREQUENCY_SKETCH_DEPTH; row++) {
+        uint8_t* counter = &sketch->counters[frequency_sketch_index(sketch, key, row)];
+        if (__atomic_load_n(counter, __ATOMIC_RELAXED) == minimum) {
+            __atomic_store_n(counter, (uint8_t)(minimum + 1), __ATOMIC_RELAXED);
+        }
+    }
+
+    if (__atomic_add_fetch(&sketch->additions, 1, __ATOMIC_RELAXED) == sketch->sample) {
+        frequency_sketch_age(sketch);
+        __atomic_store_n(&sketch->additions, sketch->sample / 2, __ATOMIC_RELAXED);
+    }
+}
+
+int frequency_sketch_estimate(const frequency_sketch* sketch, uint64_t key) {
+    if (!sketch->counters) return 0;
+
+    int minimum = FREQUENCY_SKETCH_MAX;
+    for (int row = 0; row < FREQUENCY_SKETCH_DEPTH; row++) {
+        int value = __atomic_load_n(&sketch->counters[frequency_sketch_index(sketch, key, row)], __ATOMIC_RELAXED);
+        if (value < minimum) minimum = value;
+    }
+    return minimum;
+}
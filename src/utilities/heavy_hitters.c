@@ -0,0 +1,228 @@
+#include "utilities/heavy_hitters.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HEAVY_HITTERS_DEPTH 4
+#define HEAVY_HITTERS_MAX_WIDTH 65536
+// A read that keeps meeting the loop's writes gives up on its heap
+#define HEAVY_HITTERS_READ_TRIES 8
+
+struct heavy_hitters_shard {
+    uint32_t* counters;
+    uint64_t additions;
+    // odd while the loop changes the heap
+    uint32_t sequence;
+    int count;
+    heavy_hitters_entry heap[HEAVY_HITTERS_TOP_K];
+};
+
+static const uint64_t heavy_hitters_seeds[HEAVY_HITTERS_DEPTH] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL};
+
+static size_t heavy_hitters_index(size_t width, uint64_t key, int row) {
+    // splitmix64 finalizer, one seed per row
+    key += heavy_hitters_seeds[row];
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t)row * width + ((size_t)key & (width - 1));
+}
+
+static uint32_t heavy_hitters_shard_estimate(const heavy_hitters_shard* shard, size_t width, uint64_t key) {
+    uint32_t minimum = UINT32_MAX;
+    for (int row = 0; row < HEAVY_HITTERS_DEPTH; row++) {
+        uint32_t value = __atomic_load_n(&shard->counters[heavy_hitters_index(width, key, row)], __ATOMIC_RELAXED);
+        if (value < minimum) minimum = value;
+    }
+    return minimum;
+}
+
+// The calling loop's shard, made on its first add
+static heavy_hitters_shard* heavy_hitters_local(heavy_hitters* hitters) {
+    int loop = loop_mailbox_self();
+    if (loop < 0 || loop >= LOOP_MAILBOX_MAX_LOOPS || hitters->width == 0) return NULL;
+    heavy_hitters_shard* shard = hitters->shards[loop];
+    if (shard) return shard;
+
+    shard = (heavy_hitters_shard*)calloc(1, sizeof(heavy_hitters_shard));
+    if (!shard) return NULL;
+    shard->counters = (uint32_t*)calloc(hitters->width * HEAVY_HITTERS_DEPTH, sizeof(uint32_t));
+    if (!shard->counters) {
+        free(shard);
+        return NULL;
+    }
+    __atomic_store_n(&hitters->shards[loop], shard, __ATOMIC_RELEASE);
+    return shard;
+}
+
+static void heavy_hitters_swap(heavy_hitters_entry* heap, int a, int b) {
+    heavy_hitters_entry entry = heap[a];
+    heap[a] = heap[b];
+    heap[b] = entry;
+}
+
+static void heavy_hitters_sift_down(heavy_hitters_shard* shard, int at) {
+    for (;;) {
+        int smallest = at;
+        int left = at * 2 + 1;
+        int right = left + 1;
+        if (left < shard->count && shard->heap[left].count < shard->heap[smallest].count) smallest = left;
+        if (right < shard->count && shard->heap[right].count < shard->heap[smallest].count) smallest = right;
+        if (smallest == at) return;
+        heavy_hitters_swap(shard->heap, at, smallest);
+        at = smallest;
+    }
+}
+
+static void heavy_hitters_sift_up(heavy_hitters_shard* shard, int at) {
+    while (at > 0 && shard->heap[(at - 1) / 2].count > shard->heap[at].count) {
+        heavy_hitters_swap(shard->heap, at, (at - 1) / 2);
+        at = (at - 1) / 2;
+    }
+}
+
+// Halves the counters and the heap, the loop's own
+static void heavy_hitters_age(heavy_hitters_shard* shard, size_t width) {
+    for (size_t i = 0; i < width * HEAVY_HITTERS_DEPTH; i++) {
+        __atomic_store_n(&shard->counters[i], shard->counters[i] >> 1, __ATOMIC_RELAXED);
+    }
+    // halving keeps the heap order
+    for (int i = 0; i < shard->count; i++) shard->heap[i].count >>= 1;
+}
+
+static void heavy_hitters_keep(heavy_hitters_shard* shard, uint64_t key, uint64_t count, const char* label) {
+    // Below the least of a full heap, so not in it with a lower count either
+    if (shard->count == HEAVY_HITTERS_TOP_K && count <= shard->heap[0].count) return;
+
+    int at = 0;
+    while (at < shard->count && shard->heap[at].key != key) at++;
+    if (at < shard->count) {
+        shard->heap[at].count = count;
+        heavy_hitters_sift_down(shard, at);
+        return;
+    }
+    if (shard->count < HEAVY_HITTERS_TOP_K) {
+        at = shard->count++;
+    } else {
+        at = 0;
+    }
+    heavy_hitters_entry* entry = &shard->heap[at];
+    entry->key = key;
+    entry->count = count;
+    entry->label[0] = '\0';
+    if (label) {
+        strncpy(entry->label, label, HEAVY_HITTERS_LABEL_SIZE - 1);
+        entry->label[HEAVY_HITTERS_LABEL_SIZE - 1] = '\0';
+    }
+    if (at == 0 && shard->count == HEAVY_HITTERS_TOP_K) {
+        heavy_hitters_sift_down(shard, 0);
+    } else {
+        heavy_hitters_sift_up(shard, at);
+    }
+}
+
+// A copy of the shard's heap, 0 entries if it kept changing
+static int heavy_hitters_copy(const heavy_hitters_shard* shard, heavy_hitters_entry* out) {
+    for (int tries = 0; tries < HEAVY_HITTERS_READ_TRIES; tries++) {
+        uint32_t before = __atomic_load_n(&shard->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        int count = __atomic_load_n(&shard->count, __ATOMIC_RELAXED);
+        if (count > HEAVY_HITTERS_TOP_K) continue;
+        memcpy(out, shard->heap, (size_t)count * sizeof(heavy_hitters_entry));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->sequence, __ATOMIC_RELAXED) == before) return count;
+    }
+    return 0;
+}
+
+static int heavy_hitters_hottest_first(const void* a, const void* b) {
+    uint64_t left = ((const heavy_hitters_entry*)a)->count;
+    uint64_t right = ((const heavy_hitters_entry*)b)->count;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+int heavy_hitters_init(heavy_hitters* hitters, size_t width) {
+    memset(hitters, 0, sizeof(heavy_hitters));
+    if (width == 0 || width > HEAVY_HITTERS_MAX_WIDTH) return -1;
+    size_t size = 16;
+    while (size < width) size <<= 1;
+    hitters->width = size;
+    return 0;
+}
+
+void heavy_hitters_dispose(heavy_hitters* hitters) {
+    for (int i = 0; i < LOOP_MAILBOX_MAX_LOOPS; i++) {
+        if (!hitters->shards[i]) continue;
+        free(hitters->shards[i]->counters);
+        free(hitters->shards[i]);
+        hitters->shards[i] = NULL;
+    }
+    hitters->width = 0;
+}
+
+void heavy_hitters_add(heavy_hitters* hitters, uint64_t key, const char* label) {
+    heavy_hitters_shard* shard = heavy_hitters_local(hitters);
+    if (!shard) return;
+
+    // Conservative update, only the smallest counters grow
+    size_t width = hitters->width;
+    uint32_t count = heavy_hitters_shard_estimate(shard, width, key);
+    if (count == UINT32_MAX) return;
+    count++;
+    for (int row = 0; row < HEAVY_HITTERS_DEPTH; row++) {
+        uint32_t* counter = &shard->counters[heavy_hitters_index(width, key, row)];
+        if (*counter < count) __atomic_store_n(counter, count, __ATOMIC_RELAXED);
+    }
+
+    int aging = ++shard->additions >= width * 16;
+    if (!aging && shard->count == HEAVY_HITTERS_TOP_K && count <= shard->heap[0].count) return;
+    __atomic_store_n(&shard->sequence, shard->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    heavy_hitters_keep(shard, key, count, label);
+    if (aging) {
+        heavy_hitters_age(shard, width);
+        shard->additions = 0;
+    }
+    __atomic_store_n(&shard->sequence, shard->sequence + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t heavy_hitters_estimate(const heavy_hitters* hitters, uint64_t key) {
+    uint64_t count = 0;
+    for (int i = 0; i < LOOP_MAILBOX_MAX_LOOPS; i++) {
+        const heavy_hitters_shard* shard = __atomic_load_n(&hitters->shards[i], __ATOMIC_ACQUIRE);
+        if (shard) count += heavy_hitters_shard_estimate(shard, hitters->width, key);
+    }
+    return count;
+}
+
+int heavy_hitters_top(const heavy_hitters* hitters, heavy_hitters_entry* out, int max) {
+    if (max <= 0) return 0;
+    heavy_hitters_entry* candidates =
+        (heavy_hitters_entry*)malloc(sizeof(heavy_hitters_entry) * HEAVY_HITTERS_TOP_K * LOOP_MAILBOX_MAX_LOOPS);
+    if (!candidates) return 0;
+
+    // Every loop's heap, a key two loops keep only once
+    int count = 0;
+    heavy_hitters_entry heap[HEAVY_HITTERS_TOP_K];
+    for (int i = 0; i < LOOP_MAILBOX_MAX_LOOPS; i++) {
+        const heavy_hitters_shard* shard = __atomic_load_n(&hitters->shards[i], __ATOMIC_ACQUIRE);
+        if (!shard) continue;
+        int kept = heavy_hitters_copy(shard, heap);
+        for (int k = 0; k < kept; k++) {
+            int seen = 0;
+            while (seen < count && candidates[seen].key != heap[k].key) seen++;
+            if (seen == count) candidates[count++] = heap[k];
+        }
+    }
+    // A loop's heap only has its own share of a key, the sketches have all
+    for (int i = 0; i < count; i++) candidates[i].count = heavy_hitters_estimate(hitters, candidates[i].key);
+    qsort(candidates, count, sizeof(heavy_hitters_entry), heavy_hitters_hottest_first);
+
+    if (count > max) count = max;
+    memcpy(out, candidates, (size_t)count * sizeof(heavy_hitters_entry));
+    free(candidates);
+    return count;
+}
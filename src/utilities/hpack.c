@@ -0,0 +1,382 @@
+#include "utilities/hpack.h"
+
+#include <string.h>
+#include <strings.h>
+
+typedef struct {
+    const char* name;
+    uint8_t name_length;
+    const char* value;
+    uint8_t value_length;
+} hpack_static_entry;
+
+#define HPACK_ENTRY(name, value) {name, sizeof(name) - 1, value, sizeof(value) - 1}
+
+// RFC 7541 Appendix A, index 1 first
+static const hpack_static_entry g_hpackStatic[61] = {
+    HPACK_ENTRY(":authority", ""),
+    HPACK_ENTRY(":method", "GET"),
+    HPACK_ENTRY(":method", "POST"),
+    HPACK_ENTRY(":path", "/"),
+    HPACK_ENTRY(":path", "/index.html"),
+    HPACK_ENTRY(":scheme", "http"),
+    HPACK_ENTRY(":scheme", "https"),
+    HPACK_ENTRY(":status", "200"),
+    HPACK_ENTRY(":status", "204"),
+    HPACK_ENTRY(":status", "206"),
+    HPACK_ENTRY(":status", "304"),
+    HPACK_ENTRY(":status", "400"),
+    HPACK_ENTRY(":status", "404"),
+    HPACK_ENTRY(":status", "500"),
+    HPACK_ENTRY("accept-charset", ""),
+    HPACK_ENTRY("accept-encoding", "gzip, deflate"),
+    HPACK_ENTRY("accept-language", ""),
+    HPACK_ENTRY("accept-ranges", ""),
+    HPACK_ENTRY("accept", ""),
+    HPACK_ENTRY("access-control-allow-origin", ""),
+    HPACK_ENTRY("age", ""),
+    HPACK_ENTRY("allow", ""),
+    HPACK_ENTRY("authorization", ""),
+    HPACK_ENTRY("cache-control", ""),
+    HPACK_ENTRY("content-disposition", ""),
+    HPACK_ENTRY("content-encoding", ""),
+    HPACK_ENTRY("content-language", ""),
+    HPACK_ENTRY("content-length", ""),
+    HPACK_ENTRY("content-location", ""),
+    HPACK_ENTRY("content-range", ""),
+    HPACK_ENTRY("content-type", ""),
+    HPACK_ENTRY("cookie", ""),
+    HPACK_ENTRY("date", ""),
+    HPACK_ENTRY("etag", ""),
+    HPACK_ENTRY("expect", ""),
+    HPACK_ENTRY("expires", ""),
+    HPACK_ENTRY("from", ""),
+    HPACK_ENTRY("host", ""),
+    HPACK_ENTRY("if-match", ""),
+    HPACK_ENTRY("if-modified-since", ""),
+    HPACK_ENTRY("if-none-match", ""),
+    HPACK_ENTRY("if-range", ""),
+    HPACK_ENTRY("if-unmodified-since", ""),
+    HPACK_ENTRY("last-modified", ""),
+    HPACK_ENTRY("link", ""),
+    HPACK_ENTRY("location", ""),
+    HPACK_ENTRY("max-forwards", ""),
+    HPACK_ENTRY("proxy-authenticate", ""),
+    HPACK_ENTRY("proxy-authorization", ""),
+    HPACK_ENTRY("range", ""),
+    HPACK_ENTRY("referer", ""),
+    HPACK_ENTRY("refresh", ""),
+    HPACK_ENTRY("retry-after", ""),
+    HPACK_ENTRY("server", ""),
+    HPACK_ENTRY("set-cookie", ""),
+    HPACK_ENTRY("strict-transport-security", ""),
+    HPACK_ENTRY("transfer-encoding", ""),
+    HPACK_ENTRY("user-agent", ""),
+    HPACK_ENTRY("vary", ""),
+    HPACK_ENTRY("via", ""),
+    HPACK_ENTRY("www-authenticate", ""),
+};
+
+// The Huffman code of Appendix B is canonical: codes of one length are
+// consecutive and in symbol order, so how many there are of each length and
+// the symbols sorted by (length, symbol) are all decoding needs. EOS is the
+// one 30 bit code past the last.
+static const uint8_t g_huffmanCounts[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 3,
+};
+
+static const uint8_t g_huffmanSymbols[256] = {
+    48,  49,  50,  97,  99,  101, 105, 111, 115, 116, 32,  37,  45,  46,  47,  51,
+    52,  53,  54,  55,  56,  57,  61,  65,  95,  98,  100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+    77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,  106, 107, 113, 118,
+    119, 120, 121, 122, 38,  42,  44,  59,  88,  90,  33,  34,  40,  41,  63,  39,
+    43,  124, 35,  62,  0,   36,  64,  91,  93,  126, 94,  125, 60,  96,  123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1,   135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9,   142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2,   3,   4,   5,   6,   7,   8,   11,  12,  14,  15,  16,  17,  18,  19,  20,
+    21,  23,  24,  25,  26,  27,  28,  29,  30,  31,  127, 220, 249, 10,  13,  22,
+};
+
+void hpack_decoder_init(hpack_decoder* decoder) {
+    decoder->used = 0;
+    decoder->newest = 0;
+    decoder->count = 0;
+    decoder->size = 0;
+    decoder->max_size = HPACK_TABLE_SIZE;
+}
+
+//------------------------Dynamic table------------------------
+
+static hpack_entry* hpack_entry_at(hpack_decoder* decoder, int age) {
+    int n = HPACK_TABLE_SIZE / 32;
+    return &decoder->entries[(decoder->newest - age + n) % n];
+}
+
+static void hpack_evict(hpack_decoder* decoder, uint32_t max_size) {
+    while (decoder->count > 0 && decoder->size > max_size) {
+        hpack_entry* oldest = hpack_entry_at(decoder, decoder->count - 1);
+        decoder->size -= oldest->name_length + oldest->value_length + 32;
+        decoder->count--;
+    }
+    if (decoder->count == 0) decoder->used = 0;
+}
+
+// name may point into the table itself, the caller copied it out if so
+static void hpack_insert(hpack_decoder* decoder, const char* name, size_t name_length, const char* value,
+                         size_t value_length) {
+    uint32_t size = (uint32_t)(name_length + value_length + 32);
+    if (size > decoder->max_size) {
+        // not an error, it just leaves the table empty
+        hpack_evict(decoder, 0);
+        return;
+    }
+    hpack_evict(decoder, decoder->max_size - size);
+
+    uint32_t length = (uint32_t)(name_length + value_length);
+    if (decoder->used + length > sizeof(decoder->data)) {
+        // move what is left to the front, the entries stay in order
+        uint32_t base = hpack_entry_at(decoder, decoder->count - 1)->offset;
+        memmove(decoder->data, decoder->data + base, decoder->used - base);
+        for (int i = 0; i < decoder->count; i++) hpack_entry_at(decoder, i)->offset -= base;
+        decoder->used -= base;
+    }
+    memcpy(decoder->data + decoder->used, name, name_length);
+    memcpy(decoder->data + decoder->used + name_length, value, value_length);
+
+    decoder->newest = (decoder->newest + 1) % (HPACK_TABLE_SIZE / 32);
+    hpack_entry* entry = hpack_entry_at(decoder, 0);
+    entry->offset = decoder->used;
+    entry->name_length = (uint32_t)name_length;
+    entry->value_length = (uint32_t)value_length;
+    decoder->used += length;
+    decoder->count++;
+    decoder->size += size;
+}
+
+// Index 1..61 static, from 62 on dynamic. -1 if there is no such entry.
+static int hpack_lookup(hpack_decoder* decoder, uint32_t index, const char** name, size_t* name_length,
+                        const char** value, size_t* value_length) {
+    if (index == 0) return -1;
+    if (index <= 61) {
+        const hpack_static_entry* entry = &g_hpackStatic[index - 1];
+        *name = entry->name;
+        *name_length = entry->name_length;
+        *value = entry->value;
+        *value_length = entry->value_length;
+        return 0;
+    }
+    if (index - 62 >= (uint32_t)decoder->count) return -1;
+    hpack_entry* entry = hpack_entry_at(decoder, (int)(index - 62));
+    *name = decoder->data + entry->offset;
+    *name_length = entry->name_length;
+    *value = *name + entry->name_length;
+    *value_length = entry->value_length;
+    return 0;
+}
+
+//---------------------------Decoding---------------------------
+
+// An integer with an N bit prefix (5.1), -1 if it runs past the block or gets
+// larger than anything a header block of ours can mean
+static int hpack_integer(const uint8_t** at, const uint8_t* end, int prefix_bits, uint32_t* out) {
+    if (*at >= end) return -1;
+    uint32_t mask = (1u << prefix_bits) - 1;
+    uint32_t value = **at & mask;
+    (*at)++;
+    if (value < mask) {
+        *out = value;
+        return 0;
+    }
+    for (int shift = 0; shift <= 21; shift += 7) {
+        if (*at >= end) return -1;
+        uint8_t byte = **at;
+        (*at)++;
+        value += (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *out = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Huffman coded bytes into out, their length or -1 if they are no valid code
+// (EOS, or padding longer than 7 bits or not all ones) or do not fit
+static int hpack_huffman_decode(const uint8_t* in, size_t length, char* out, size_t size) {
+    size_t written = 0;
+    uint32_t code = 0, first = 0;
+    int bits = 0, index = 0;
+    for (size_t i = 0; i < length; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            code = (code << 1) | ((in[i] >> bit) & 1);
+            bits++;
+            uint32_t count = g_huffmanCounts[bits];
+            if (code - first < count) {
+                if (written == size) return -1;
+                out[written++] = (char)g_huffmanSymbols[index + code - first];
+                code = first = 0;
+                bits = index = 0;
+            } else {
+                if (bits == 30) return -1;
+                index += count;
+                first = (first + count) << 1;
+            }
+        }
+    }
+    if (bits > 7 || code != (1u << bits) - 1) return -1;
+    return (int)written;
+}
+
+// A string literal (5.2), raw ones are pointed to in place and Huffman coded
+// ones decoded to scratch at *used
+static int hpack_string(hpack_decoder* decoder, const uint8_t** at, const uint8_t* end, size_t* used,
+                        const char** out, size_t* out_length) {
+    if (*at >= end) return -1;
+    int huffman = **at & 0x80;
+    uint32_t length;
+    if (hpack_integer(at, end, 7, &length) != 0 || length > (size_t)(end - *at)) return -1;
+    if (!huffman) {
+        *out = (const char*)*at;
+        *out_length = length;
+    } else {
+        int n = hpack_huffman_decode(*at, length, decoder->scratch + *used, sizeof(decoder->scratch) - *used);
+        if (n < 0) return -1;
+        *out = decoder->scratch + *used;
+        *out_length = (size_t)n;
+        *used += (size_t)n;
+    }
+    *at += length;
+    return 0;
+}
+
+int hpack_decode(hpack_decoder* decoder, const uint8_t* block, size_t length, hpack_emit emit, void* context) {
+    const uint8_t* at = block;
+    const uint8_t* end = block + length;
+    int fields = 0;
+    while (at < end) {
+        uint8_t byte = *at;
+        const char *name, *value;
+        size_t name_length, value_length;
+        uint32_t index;
+
+        if (byte & 0x80) {
+            // indexed field
+            if (hpack_integer(&at, end, 7, &index) != 0 ||
+                hpack_lookup(decoder, index, &name, &name_length, &value, &value_length) != 0)
+                return -1;
+        } else if ((byte & 0xe0) == 0x20) {
+            // table size update, only ahead of the fields and within what SETTINGS allows
+            if (fields > 0 || hpack_integer(&at, end, 5, &index) != 0 || index > HPACK_TABLE_SIZE) return -1;
+            decoder->max_size = index;
+            hpack_evict(decoder, index);
+            continue;
+        } else {
+            // literal, with incremental indexing (01), without (0000) or never indexed (0001)
+            int indexing = (byte & 0xc0) == 0x40;
+            size_t used = 0;
+            if (hpack_integer(&at, end, indexing ? 6 : 4, &index) != 0) return -1;
+            if (index != 0) {
+                if (hpack_lookup(decoder, index, &name, &name_length, &value, &value_length) != 0) return -1;
+                if (indexing && index > 61) {
+                    // the insert may evict the entry the name comes from
+                    if (name_length > sizeof(decoder->scratch)) return -1;
+                    memcpy(decoder->scratch, name, name_length);
+                    name = decoder->scratch;
+                    used = name_length;
+                }
+            } else if (hpack_string(decoder, &at, end, &used, &name, &name_length) != 0) {
+                return -1;
+            }
+            if (hpack_string(decoder, &at, end, &used, &value, &value_length) != 0) return -1;
+            if (indexing) {
+                int result = emit(context, name, name_length, value, value_length);
+                if (result != 0) return result;
+                hpack_insert(decoder, name, name_length, value, value_length);
+                fields++;
+                continue;
+            }
+        }
+        int result = emit(context, name, name_length, value, value_length);
+        if (result != 0) return result;
+        fields++;
+    }
+    return 0;
+}
+
+//---------------------------Encoding---------------------------
+
+static int hpack_write_integer(uint8_t* out, size_t size, uint8_t first, int prefix_bits, uint32_t value) {
+    uint32_t mask = (1u << prefix_bits) - 1;
+    if (size == 0) return -1;
+    if (value < mask) {
+        out[0] = first | (uint8_t)value;
+        return 1;
+    }
+    out[0] = first | (uint8_t)mask;
+    value -= mask;
+    size_t n = 1;
+    while (value >= 0x80) {
+        if (n == size) return -1;
+        out[n++] = (uint8_t)(value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (n == size) return -1;
+    out[n++] = (uint8_t)value;
+    return (int)n;
+}
+
+// A raw string literal, lowercased for names
+static int hpack_write_string(uint8_t* out, size_t size, const char* string, size_t length, int lower) {
+    int n = hpack_write_integer(out, size, 0, 7, (uint32_t)length);
+    if (n < 0 || (size_t)n + length > size) return -1;
+    for (size_t i = 0; i < length; i++) {
+        char c = string[i];
+        out[n + i] = (uint8_t)(lower && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+    }
+    return n + (int)length;
+}
+
+int hpack_encode_status(uint8_t* out, size_t size, int status) {
+    char digits[4];
+    digits[0] = (char)('0' + status / 100 % 10);
+    digits[1] = (char)('0' + status / 10 % 10);
+    digits[2] = (char)('0' + status % 10);
+    // :status in 8..14
+    for (int i = 7; i < 14; i++) {
+        if (memcmp(g_hpackStatic[i].value, digits, 3) == 0) return hpack_write_integer(out, size, 0x80, 7, i + 1);
+    }
+    int n = hpack_write_integer(out, size, 0, 4, 8);
+    if (n < 0) return -1;
+    int m = hpack_write_string(out + n, size - n, digits, 3, 0);
+    return m < 0 ? -1 : n + m;
+}
+
+int hpack_encode_header(uint8_t* out, size_t size, const char* name, size_t name_length, const char* value,
+                        size_t value_length) {
+    int index = 0;
+    // the pseudo fields and the request ones at the front never match a response header
+    for (int i = 14; i < 61; i++) {
+        const hpack_static_entry* entry = &g_hpackStatic[i];
+        if (entry->name_length != name_length || strncasecmp(entry->name, name, name_length) != 0) continue;
+        if (entry->value_length == value_length && memcmp(entry->value, value, value_length) == 0)
+            return hpack_write_integer(out, size, 0x80, 7, i + 1);
+        index = i + 1;
+        break;
+    }
+    int n = hpack_write_integer(out, size, 0, 4, (uint32_t)index);
+    if (n < 0) return -1;
+    if (index == 0) {
+        int m = hpack_write_string(out + n, size - n, name, name_length, 1);
+        if (m < 0) return -1;
+        n += m;
+    }
+    int m = hpack_write_string(out + n, size - n, value, value_length, 0);
+    return m < 0 ? -1 : n + m;
+}
@@ -0,0 +1,128 @@
+#include "utilities/http_scan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static http_scan_fn http_scan_impl = NULL;
+static const char* http_scan_impl_name = NULL;
+
+size_t http_scan_scalar(const char* data, size_t length, const char set[4]) {
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (c == set[0] || c == set[1] || c == set[2] || c == set[3]) return i;
+    }
+    return length;
+}
+
+#if defined(__x86_64__)
+
+size_t http_scan_sse2(const char* data, size_t length, const char set[4]) {
+    const __m128i s0 = _mm_set1_epi8(set[0]);
+    const __m128i s1 = _mm_set1_epi8(set[1]);
+    const __m128i s2 = _mm_set1_epi8(set[2]);
+    const __m128i s3 = _mm_set1_epi8(set[3]);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, s0), _mm_cmpeq_epi8(v, s1)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, s2), _mm_cmpeq_epi8(v, s3)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + http_scan_scalar(data + i, length - i, set);
+}
+
+__attribute__((target("avx2"))) size_t http_scan_avx2(const char* data, size_t length, const char set[4]) {
+    const __m256i s0 = _mm256_set1_epi8(set[0]);
+    const __m256i s1 = _mm256_set1_epi8(set[1]);
+    const __m256i s2 = _mm256_set1_epi8(set[2]);
+    const __m256i s3 = _mm256_set1_epi8(set[3]);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, s0), _mm256_cmpeq_epi8(v, s1)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, s2), _mm256_cmpeq_epi8(v, s3)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    // Most tokens are shorter than 32 bytes, take 16 at a time here rather
+    // than calling http_scan_sse2: legacy SSE code right after 256 bit
+    // instructions pays for the AVX state transition
+    if (i + 16 <= length) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(s0)),
+                                                _mm_cmpeq_epi8(v, _mm256_castsi256_si128(s1))),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(s2)),
+                                                _mm_cmpeq_epi8(v, _mm256_castsi256_si128(s3))));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+    return i + http_scan_scalar(data + i, length - i, set);
+}
+
+int http_scan_avx2_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#elif defined(__aarch64__)
+
+size_t http_scan_neon(const char* data, size_t length, const char set[4]) {
+    const uint8x16_t s0 = vdupq_n_u8((uint8_t)set[0]);
+    const uint8x16_t s1 = vdupq_n_u8((uint8_t)set[1]);
+    const uint8x16_t s2 = vdupq_n_u8((uint8_t)set[2]);
+    const uint8x16_t s3 = vdupq_n_u8((uint8_t)set[3]);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)(data + i));
+        uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, s0), vceqq_u8(v, s1)),
+                                  vorrq_u8(vceqq_u8(v, s2), vceqq_u8(v, s3)));
+        // narrow to 4 bits per byte, there is no movemask on NEON
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask) return i + (__builtin_ctzll(mask) >> 2);
+    }
+    return i + http_scan_scalar(data + i, length - i, set);
+}
+
+#endif
+
+static void http_scan_select(void) {
+    http_scan_fn impl = http_scan_scalar;
+    const char* name = "scalar";
+#if defined(__x86_64__)
+    if (http_scan_avx2_supported()) {
+        impl = http_scan_avx2;
+        name = "avx2";
+    } else {
+        impl = http_scan_sse2;
+        name = "sse2";
+    }
+#elif defined(__aarch64__)
+    impl = http_scan_neon;
+    name = "neon";
+#endif
+    // every thread picks the same, a race only stores the same values twice
+    __atomic_store_n(&http_scan_impl_name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&http_scan_impl, impl, __ATOMIC_RELEASE);
+}
+
+size_t http_scan(const char* data, size_t length, const char set[4]) {
+    http_scan_fn impl = __atomic_load_n(&http_scan_impl, __ATOMIC_ACQUIRE);
+    if (impl == NULL) {
+        http_scan_select();
+        impl = http_scan_impl;
+    }
+    return impl(data, length, set);
+}
+
+const char* http_scan_name(void) {
+    if (__atomic_load_n(&http_scan_impl, __ATOMIC_ACQUIRE) == NULL) http_scan_select();
+    return http_scan_impl_name;
+}
@@ -0,0 +1,186 @@
+#include "utilities/http_validators.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+static const char* http_date_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char* http_date_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+void http_etag_from_file(char out[HTTP_ETAG_SIZE], time_t mtime, uint64_t size) {
+    snprintf(out, HTTP_ETAG_SIZE, "\"%llx-%llx\"", (unsigned long long)mtime, (unsigned long long)size);
+}
+
+void http_etag_from_data(char out[HTTP_ETAG_SIZE], const void* data, size_t length) {
+    // FNV-1a, 64 bit
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    snprintf(out, HTTP_ETAG_SIZE, "\"%016llx-%llx\"", (unsigned long long)hash, (unsigned long long)length);
+}
+
+void http_etag_variant(char etag[HTTP_ETAG_SIZE], const char* variant) {
+    size_t length = strlen(etag);
+    size_t variant_length = strlen(variant);
+    if (length < 2 || etag[length - 1] != '"' || length + variant_length + 1 >= HTTP_ETAG_SIZE) return;
+
+    etag[length - 1] = '-';
+    memcpy(etag + length, variant, variant_length);
+    etag[length + variant_length] = '"';
+    etag[length + variant_length + 1] = '\0';
+}
+
+void http_date_format(char out[HTTP_DATE_SIZE], time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(out, HTTP_DATE_SIZE, "%s, %02d %s %04d %02d:%02d:%02d GMT", http_date_days[tm.tm_wday], tm.tm_mday,
+             http_date_months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+int http_date_parse(const char* value, size_t length, time_t* t) {
+    // Only the IMF-fixdate form, the obsolete ones are no longer sent
+    char buffer[HTTP_DATE_SIZE];
+    if (length >= sizeof(buffer)) return -1;
+    memcpy(buffer, value, length);
+    buffer[length] = '\0';
+
+    char day[4], month[4];
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(buffer, "%3s, %d %3s %d %d:%d:%d GMT", day, &tm.tm_mday, month, &tm.tm_year, &tm.tm_hour, &tm.tm_min,
+               &tm.tm_sec) != 7)
+        return -1;
+
+    tm.tm_mon = -1;
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(month, http_date_months[i]) == 0) tm.tm_mon = i;
+    }
+    if (tm.tm_mon < 0 || tm.tm_year < 1970) return -1;
+    tm.tm_year -= 1900;
+
+    *t = timegm(&tm);
+    return 0;
+}
+
+// Opaque part of an entity tag, without W/ and quotes
+static void http_etag_opaque(const char* tag, size_t length, const char** opaque, size_t* opaque_length) {
+    if (length >= 2 && tag[0] == 'W' && tag[1] == '/') {
+        tag += 2;
+        length -= 2;
+    }
+    if (length >= 2 && tag[0] == '"' && tag[length - 1] == '"') {
+        tag++;
+        length -= 2;
+    }
+    *opaque = tag;
+    *opaque_length = length;
+}
+
+static int http_etag_list_matches(const char* list, const char* etag) {
+    const char* want;
+    size_t want_length;
+    http_etag_opaque(etag, strlen(etag), &want, &want_length);
+
+    const char* p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (!*p) break;
+        const char* start = p;
+        // a comma may only appear inside the quotes
+        int quoted = 0;
+        while (*p && (quoted || *p != ',')) {
+            if (*p == '"') quoted = !quoted;
+            p++;
+        }
+        const char* end = p;
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+
+        if (end - start == 1 && *start == '*') return 1;
+        const char* have;
+        size_t have_length;
+        http_etag_opaque(start, end - start, &have, &have_length);
+        if (have_length == want_length && memcmp(have, want, want_length) == 0) return 1;
+    }
+    return 0;
+}
+
+int http_conditional_present(const http_conditional* conditional) {
+    return conditional->if_none_match[0] != '\0' || conditional->if_modified_since != 0;
+}
+
+int http_conditional_is_current(const http_conditional* conditional, const char* etag, time_t last_modified) {
+    // If-None-Match takes precedence, If-Modified-Since is ignored when it is sent
+    if (conditional->if_none_match[0] != '\0') {
+        if (strcmp(conditional->if_none_match, "*") == 0) return 1;
+        return etag != NULL && http_etag_list_matches(conditional->if_none_match, etag);
+    }
+    if (conditional->if_modified_since != 0 && last_modified != 0) {
+        return last_modified <= conditional->if_modified_since;
+    }
+    return 0;
+}
+
+// Decimal digits at *p, -1 if there are none or too many
+static int64_t http_range_number(const char** p, const char* end) {
+    const char* start = *p;
+    int64_t value = 0;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        if (value > (INT64_MAX - 9) / 10) return -1;
+        value = value * 10 + (**p - '0');
+        (*p)++;
+    }
+    return *p == start ? -1 : value;
+}
+
+int http_range_parse(const char* value, size_t length, uint64_t size, uint64_t* start, uint64_t* end) {
+    const char* p = value;
+    const char* stop = value + length;
+    if (length < 6 || strncasecmp(value, "bytes=", 6) != 0) return 0;
+    p += 6;
+    while (p < stop && (*p == ' ' || *p == '\t')) p++;
+    // Multipart answers are not worth it, the whole body is as valid a reply
+    if (memchr(p, ',', stop - p) != NULL) return 0;
+
+    int64_t first = -1, last = -1;
+    if (p < stop && *p == '-') {
+        // Suffix range, the last n bytes
+        p++;
+        int64_t suffix = http_range_number(&p, stop);
+        while (p < stop && (*p == ' ' || *p == '\t')) p++;
+        if (suffix < 0 || p != stop) return 0;
+        if (suffix == 0 || size == 0) return -1;
+        *start = (uint64_t)suffix >= size ? 0 : size - (uint64_t)suffix;
+        *end = size - 1;
+        return 1;
+    }
+    first = http_range_number(&p, stop);
+    if (first < 0 || p >= stop || *p != '-') return 0;
+    p++;
+    if (p < stop && *p >= '0' && *p <= '9') {
+        last = http_range_number(&p, stop);
+        if (last < 0) return 0;
+    }
+    while (p < stop && (*p == ' ' || *p == '\t')) p++;
+    if (p != stop || (last >= 0 && last < first)) return 0;
+
+    if ((uint64_t)first >= size) return -1;
+    *start = (uint64_t)first;
+    *end = last < 0 || (uint64_t)last >= size ? size - 1 : (uint64_t)last;
+    return 1;
+}
+
+int http_if_range_matches(const char* value, size_t length, const char* etag, time_t last_modified) {
+    while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t')) length--;
+    if (length > 0 && (value[0] == '"' || value[0] == 'W')) {
+        // Weak tags never match here, a range of another version would corrupt the copy
+        if (etag == NULL || value[0] == 'W' || etag[0] == 'W') return 0;
+        return strlen(etag) == length && memcmp(value, etag, length) == 0;
+    }
+    time_t date;
+    if (last_modified == 0 || http_date_parse(value, length, &date) != 0) return 0;
+    return date == last_modified;
+}
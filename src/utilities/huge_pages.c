@@ -0,0 +1,199 @@
+#include "utilities/huge_pages.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "utilities/logger.h"
+
+typedef struct {
+    // HUGE_PAGES_SIZE aligned, NULL for a free slot
+    uint8_t* data;
+    size_t length;
+    // what the table asked for
+    size_t size;
+    const char* region;
+    // explicit or transparent, off if the kernel refused the advice
+    huge_pages_mode backing;
+} huge_pages_mapping;
+
+static int g_hugePagesMode = HUGE_PAGES_MODE;
+static huge_pages_mapping g_mappings[HUGE_PAGES_MAX_MAPPINGS];
+static pthread_mutex_t g_mappingsLock = PTHREAD_MUTEX_INITIALIZER;
+// The pool was found empty, said once
+static int g_poolEmptyLogged = 0;
+
+static const char* g_hugePagesModeNames[HUGE_PAGES_MODES] = {"off", "transparent", "explicit"};
+
+void huge_pages_set_mode(huge_pages_mode mode) {
+    __atomic_store_n(&g_hugePagesMode, (int)mode, __ATOMIC_RELAXED);
+}
+
+huge_pages_mode huge_pages_get_mode(void) {
+    return (huge_pages_mode)__atomic_load_n(&g_hugePagesMode, __ATOMIC_RELAXED);
+}
+
+const char* huge_pages_mode_name(huge_pages_mode mode) {
+    return mode >= 0 && mode < HUGE_PAGES_MODES ? g_hugePagesModeNames[mode] : "unknown";
+}
+
+int huge_pages_parse(const char* name, huge_pages_mode* mode) {
+    for (int i = 0; i < HUGE_PAGES_MODES; i++) {
+        if (strcmp(g_hugePagesModeNames[i], name) == 0) {
+            *mode = (huge_pages_mode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// length bytes, HUGE_PAGES_SIZE aligned; backing comes in as the mode to try
+// and goes out as what was done
+static uint8_t* huge_pages_map(size_t length, huge_pages_mode* backing) {
+    if (*backing == HUGE_PAGES_EXPLICIT) {
+        void* data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED) return (uint8_t*)data;
+        if (!__atomic_exchange_n(&g_poolEmptyLogged, 1, __ATOMIC_RELAXED)) {
+            LOG_INFO("Huge pages: no %zu KB left in the reserved pool (vm.nr_hugepages), using transparent ones",
+                     length >> 10);
+        }
+        *backing = HUGE_PAGES_TRANSPARENT;
+    }
+
+    // A huge page more than needed, so an aligned start can be cut out of it;
+    // THP only backs whole aligned extents
+    size_t raw_length = length + HUGE_PAGES_SIZE;
+    void* raw = mmap(NULL, raw_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    uint8_t* start = (uint8_t*)raw;
+    uint8_t* data = (uint8_t*)(((uintptr_t)start + HUGE_PAGES_SIZE - 1) & ~(uintptr_t)(HUGE_PAGES_SIZE - 1));
+    if (data > start) munmap(start, (size_t)(data - start));
+    size_t tail = (size_t)(start + raw_length - (data + length));
+    if (tail > 0) munmap(data + length, tail);
+
+    if (madvise(data, length, MADV_HUGEPAGE) != 0) *backing = HUGE_PAGES_OFF;
+    return data;
+}
+
+void* huge_pages_alloc(const char* region, size_t size) {
+    huge_pages_mode mode = huge_pages_get_mode();
+    if (mode == HUGE_PAGES_OFF || size < HUGE_PAGES_MIN_BYTES) return calloc(1, size ? size : 1);
+
+    size_t length = (size + HUGE_PAGES_SIZE - 1) & ~(size_t)(HUGE_PAGES_SIZE - 1);
+    pthread_mutex_lock(&g_mappingsLock);
+    huge_pages_mapping* mapping = NULL;
+    for (int i = 0; i < HUGE_PAGES_MAX_MAPPINGS && !mapping; i++) {
+        if (!g_mappings[i].data) mapping = &g_mappings[i];
+    }
+    uint8_t* data = mapping ? huge_pages_map(length, &mode) : NULL;
+    if (data) {
+        mapping->data = data;
+        mapping->length = length;
+        mapping->size = size;
+        mapping->region = region;
+        mapping->backing = mode;
+    }
+    pthread_mutex_unlock(&g_mappingsLock);
+
+    if (!data) return calloc(1, size);
+    LOG_DEBUG("Huge pages: %s, %zu KB %s", region, length >> 10,
+              mode == HUGE_PAGES_EXPLICIT      ? "from the reserved pool"
+              : mode == HUGE_PAGES_TRANSPARENT ? "advised for transparent huge pages"
+                                               : "in normal pages, the kernel has no transparent ones");
+    return data;
+}
+
+void* huge_pages_realloc(const char* region, void* ptr, size_t old_size, size_t size) {
+    void* table = huge_pages_alloc(region, size);
+    if (!table) return NULL;
+    if (ptr) memcpy(table, ptr, old_size < size ? old_size : size);
+    huge_pages_free(ptr);
+    return table;
+}
+
+void huge_pages_free(void* ptr) {
+    if (!ptr) return;
+
+    size_t length = 0;
+    pthread_mutex_lock(&g_mappingsLock);
+    for (int i = 0; i < HUGE_PAGES_MAX_MAPPINGS; i++) {
+        if (g_mappings[i].data != ptr) continue;
+        length = g_mappings[i].length;
+        g_mappings[i].data = NULL;
+        break;
+    }
+    pthread_mutex_unlock(&g_mappingsLock);
+
+    if (length > 0) {
+        munmap(ptr, length);
+    } else {
+        free(ptr);
+    }
+}
+
+// AnonHugePages of the areas overlapping each transparent mapping; an area
+// the kernel merged from neighbours is counted to each at most as far as
+// it overlaps, so the figure can be high when two tables share one
+static void huge_pages_scan_smaps(const huge_pages_mapping* mappings, int count, size_t* huge) {
+    FILE* file = fopen("/proc/self/smaps", "r");
+    if (!file) return;
+
+    char line[512];
+    uintptr_t start = 0;
+    uintptr_t end = 0;
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long from = 0;
+        unsigned long to = 0;
+        if (sscanf(line, "%lx-%lx ", &from, &to) == 2) {
+            start = (uintptr_t)from;
+            end = (uintptr_t)to;
+            continue;
+        }
+        unsigned long kilobytes = 0;
+        if (sscanf(line, "AnonHugePages: %lu kB", &kilobytes) != 1 || kilobytes == 0) continue;
+        for (int i = 0; i < count; i++) {
+            uintptr_t low = (uintptr_t)mappings[i].data;
+            uintptr_t high = low + mappings[i].length;
+            if (mappings[i].backing != HUGE_PAGES_TRANSPARENT || high <= start || low >= end) continue;
+            size_t overlap = (size_t)((high < end ? high : end) - (low > start ? low : start));
+            size_t bytes = (size_t)kilobytes << 10;
+            huge[i] += bytes < overlap ? bytes : overlap;
+        }
+    }
+    fclose(file);
+}
+
+int huge_pages_report(char* out, size_t size) {
+    huge_pages_mapping mappings[HUGE_PAGES_MAX_MAPPINGS];
+    int count = 0;
+    pthread_mutex_lock(&g_mappingsLock);
+    for (int i = 0; i < HUGE_PAGES_MAX_MAPPINGS; i++) {
+        if (g_mappings[i].data) mappings[count++] = g_mappings[i];
+    }
+    pthread_mutex_unlock(&g_mappingsLock);
+
+    size_t huge[HUGE_PAGES_MAX_MAPPINGS] = {0};
+    for (int i = 0; i < count; i++) {
+        // Reserved at mmap, the pool's pages are huge or the table had none
+        if (mappings[i].backing == HUGE_PAGES_EXPLICIT) huge[i] = mappings[i].length;
+    }
+    huge_pages_scan_smaps(mappings, count, huge);
+
+    size_t len = 0;
+    int written = snprintf(out, size, "[");
+    for (int i = 0; i < count && written >= 0 && (size_t)written < size - len; i++) {
+        len += (size_t)written;
+        written = snprintf(out + len, size - len,
+                           "%s{\"region\":\"%s\",\"bytes\":%zu,\"mapped_bytes\":%zu,\"backing\":\"%s\",\"huge_bytes\":%zu}",
+                           i ? "," : "", mappings[i].region, mappings[i].size, mappings[i].length,
+                           huge_pages_mode_name(mappings[i].backing), huge[i]);
+    }
+    if (written < 0 || (size_t)written >= size - len) return -1;
+    len += (size_t)written;
+    written = snprintf(out + len, size - len, "]");
+    if (written < 0 || (size_t)written >= size - len) return -1;
+    return (int)(len + (size_t)written);
+}
@@ -0,0 +1,124 @@
+#include "utilities/ip_ban.h"
+
+#include <errno.h>
+#include <linux/bpf.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+
+// Keys and values as tools/xdp_ban.bpf.c has them: IPv4 is mapped into
+// IPv6 (::ffff:a.b.c.d), the expiry is bpf_ktime_get_ns()'s clock
+typedef struct {
+    uint8_t addr[16];
+} ip_ban_key;
+
+// Set by ip_ban_open before the loops start, only read afterwards
+static int g_banFd = -1;
+static int g_portFd = -1;
+static metrics_counter g_bans;
+static metrics_counter g_banErrors;
+
+static long ip_ban_bpf(int command, union bpf_attr* attr) {
+    return syscall(__NR_bpf, command, attr, sizeof(*attr));
+}
+
+static int ip_ban_map_get(const char* dir, const char* name, uint32_t key_size, uint32_t value_size) {
+    char path[512];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) return -1;
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uint64_t)(uintptr_t)path;
+    int fd = (int)ip_ban_bpf(BPF_OBJ_GET, &attr);
+    if (fd < 0) {
+        LOG_ERROR("IPBan: %s could not be opened (%s)", path, strerror(errno));
+        return -1;
+    }
+
+    // A map of another build of the program would be written wrong
+    struct bpf_map_info info;
+    memset(&info, 0, sizeof(info));
+    memset(&attr, 0, sizeof(attr));
+    attr.info.bpf_fd = (uint32_t)fd;
+    attr.info.info_len = sizeof(info);
+    attr.info.info = (uint64_t)(uintptr_t)&info;
+    if (ip_ban_bpf(BPF_OBJ_GET_INFO_BY_FD, &attr) != 0 || info.key_size != key_size ||
+        info.value_size != value_size) {
+        LOG_ERROR("IPBan: %s is not the map tools/xdp_ban.bpf.c makes", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int ip_ban_update(int fd, const void* key, const void* value) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)fd;
+    attr.key = (uint64_t)(uintptr_t)key;
+    attr.value = (uint64_t)(uintptr_t)value;
+    attr.flags = BPF_ANY;
+    return ip_ban_bpf(BPF_MAP_UPDATE_ELEM, &attr) == 0 ? 0 : -1;
+}
+
+int ip_ban_open(const char* dir) {
+    g_banFd = ip_ban_map_get(dir, "ubweather_bans", sizeof(ip_ban_key), sizeof(uint64_t));
+    if (g_banFd < 0) return -1;
+    g_portFd = ip_ban_map_get(dir, "ubweather_ban_ports", sizeof(uint16_t), sizeof(uint8_t));
+    if (g_portFd < 0) {
+        ip_ban_close();
+        return -1;
+    }
+    metrics_register("xdp_bans_total", "Client addresses handed to the XDP program to drop.", METRICS_COUNTER, NULL,
+                     &g_bans);
+    metrics_register("xdp_ban_errors_total", "Bans the kernel did not take (map full or gone).", METRICS_COUNTER,
+                     NULL, &g_banErrors);
+    LOG_INFO("IPBan: Dropping banned clients in XDP (%s)", dir);
+    return 0;
+}
+
+void ip_ban_close(void) {
+    if (g_banFd >= 0) close(g_banFd);
+    if (g_portFd >= 0) close(g_portFd);
+    g_banFd = -1;
+    g_portFd = -1;
+}
+
+int ip_ban_add_port(uint16_t port) {
+    if (g_portFd < 0) return 0;
+    // The program compares it as it is on the wire
+    uint16_t key = htons(port);
+    uint8_t on = 1;
+    return ip_ban_update(g_portFd, &key, &on);
+}
+
+void ip_ban_add(const struct sockaddr* addr, uint32_t seconds) {
+    if (g_banFd < 0 || !addr) return;
+
+    ip_ban_key key;
+    memset(&key, 0, sizeof(key));
+    if (addr->sa_family == AF_INET) {
+        key.addr[10] = 0xff;
+        key.addr[11] = 0xff;
+        memcpy(&key.addr[12], &((const struct sockaddr_in*)addr)->sin_addr, 4);
+    } else if (addr->sa_family == AF_INET6) {
+        memcpy(key.addr, &((const struct sockaddr_in6*)addr)->sin6_addr, 16);
+    } else {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t until = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec + (uint64_t)seconds * 1000000000ull;
+    if (ip_ban_update(g_banFd, &key, &until) != 0) {
+        metrics_counter_add(&g_banErrors, 1);
+        return;
+    }
+    metrics_counter_add(&g_bans, 1);
+}
@@ -0,0 +1,164 @@
+#include "utilities/job_pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smw.h"
+#include "utilities/logger.h"
+#include "utilities/loop_mailbox.h"
+
+struct job_pool_job {
+    // sent back to the submitting loop once the work is done
+    loop_message message;
+    job_pool_work work;
+    job_pool_done done;
+    void* context;
+
+    job_pool_job* next;
+};
+
+typedef struct {
+    pthread_t* threads;
+    int thread_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    job_pool_job* queue_head;
+    job_pool_job* queue_tail;
+    int stopping;
+} job_pool;
+
+static job_pool g_pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+static __thread int t_attached = 0;
+// jobs of this loop whose done() has not run yet
+static __thread int t_inFlight = 0;
+
+// On the submitting loop
+static void job_pool_finished(loop_message* message) {
+    job_pool_job* job = (job_pool_job*)message;
+    t_inFlight--;
+    if (job->done) job->done(job->context);
+    free(job);
+}
+
+static void job_pool_complete(job_pool_job* job) {
+    // The loop stays attached to its mailbox until its jobs are back, a
+    // full ring only makes this thread wait
+    if (loop_mailbox_post(job->message.to, &job->message) != 0) {
+        LOG_ERROR("Job pool: Failed to hand a job back to loop %d", job->message.to);
+    }
+}
+
+static void* job_pool_thread(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&g_pool.lock);
+        while (!g_pool.queue_head && !g_pool.stopping) {
+            pthread_cond_wait(&g_pool.cond, &g_pool.lock);
+        }
+        if (!g_pool.queue_head) {
+            pthread_mutex_unlock(&g_pool.lock);
+            break;
+        }
+        job_pool_job* job = g_pool.queue_head;
+        g_pool.queue_head = job->next;
+        if (!g_pool.queue_head) g_pool.queue_tail = NULL;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        job->work(job->context);
+        job_pool_complete(job);
+    }
+
+    return NULL;
+}
+
+int job_pool_init(int threads) {
+    if (threads < 0) return -1;
+
+    g_pool.threads = (pthread_t*)calloc(threads > 0 ? threads : 1, sizeof(pthread_t));
+    if (!g_pool.threads) return -1;
+
+    g_pool.stopping = 0;
+    g_pool.thread_count = 0;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&g_pool.threads[i], NULL, job_pool_thread, NULL) != 0) {
+            LOG_ERROR("Job pool: Failed to start thread %d", i);
+            break;
+        }
+        g_pool.thread_count++;
+    }
+
+    return 0;
+}
+
+void job_pool_dispose(void) {
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.stopping = 1;
+    pthread_cond_broadcast(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    for (int i = 0; i < g_pool.thread_count; i++) {
+        pthread_join(g_pool.threads[i], NULL);
+    }
+
+    free(g_pool.threads);
+    g_pool.threads = NULL;
+    g_pool.thread_count = 0;
+}
+
+int job_pool_attach(void) {
+    if (loop_mailbox_self() < 0) return -1;
+    t_attached = 1;
+    return 0;
+}
+
+void job_pool_detach(void) {
+    if (!t_attached) return;
+
+    // pool threads still hold jobs of this loop, wait them out
+    while (t_inFlight > 0) smw_awaitInbox(-1);
+    t_attached = 0;
+}
+
+job_pool_job* job_pool_submit(job_pool_work work, job_pool_done done, void* context) {
+    if (!t_attached || !work) return NULL;
+
+    job_pool_job* job = (job_pool_job*)calloc(1, sizeof(job_pool_job));
+    if (!job) return NULL;
+
+    job->work = work;
+    job->done = done;
+    job->context = context;
+    job->message.run = job_pool_finished;
+    job->message.to = loop_mailbox_self();
+    t_inFlight++;
+
+    // Without pool threads the work runs inline, done() is still deferred
+    // to the loop so callers see the same ordering either way
+    if (g_pool.thread_count == 0) {
+        job->work(job->context);
+        job_pool_complete(job);
+        return job;
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.queue_tail) {
+        g_pool.queue_tail->next = job;
+    } else {
+        g_pool.queue_head = job;
+    }
+    g_pool.queue_tail = job;
+    pthread_cond_signal(&g_pool.cond);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    return job;
+}
+
+void job_pool_abandon(job_pool_job* job, job_pool_done release) {
+    if (!job) return;
+    job->done = release;
+}
@@ -0,0 +1,111 @@
+#include "utilities/json_arena.h"
+
+#include <string.h>
+
+#include "utilities/mem_account.h"
+#include "utilities/ub_alloc.h"
+
+static __thread arena* t_jsonArena = NULL;
+
+// Outside a scope jansson's nodes are counted one by one, inside the
+// arena's blocks are (tagged jansson by their owners)
+static void* json_arena_malloc(size_t size) {
+    return t_jsonArena ? arena_alloc(t_jsonArena, size) : mem_account_malloc(MEM_TAG_JANSSON, size);
+}
+
+static void json_arena_free(void* ptr) {
+    if (t_jsonArena && arena_owns(t_jsonArena, ptr)) return;
+    mem_account_release(MEM_TAG_JANSSON, ptr);
+}
+
+void json_arena_install(void) {
+    // Without a realloc jansson grows buffers by malloc, copy and free,
+    // which is what an arena can do
+    json_set_alloc_funcs(json_arena_malloc, json_arena_free);
+}
+
+void json_arena_begin(arena* arena) {
+    t_jsonArena = arena;
+}
+
+void json_arena_end(void) {
+    t_jsonArena = NULL;
+}
+
+static __thread size_t t_jsonBufferHint = JSON_BUFFER_INITIAL_SIZE;
+
+void json_buffer_init(json_buffer* buffer, arena* arena) {
+    buffer->arena = arena;
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+static int json_buffer_reserve(json_buffer* buffer, size_t needed) {
+    if (needed <= buffer->capacity) return 0;
+    size_t capacity = buffer->capacity ? buffer->capacity : t_jsonBufferHint;
+    while (capacity < needed) capacity *= 2;
+    char* data;
+    if (buffer->arena) {
+        // Nothing to give back, the old bytes stay in the arena until its reset
+        data = (char*)arena_alloc(buffer->arena, capacity);
+        if (data && buffer->length) memcpy(data, buffer->data, buffer->length);
+    } else {
+        data = (char*)ub_realloc(buffer->data, capacity);
+    }
+    if (!data) return -1;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+static int json_buffer_append(const char* text, size_t size, void* context) {
+    json_buffer* buffer = (json_buffer*)context;
+    // One more for the NUL
+    if (json_buffer_reserve(buffer, buffer->length + size + 1) != 0) return -1;
+    memcpy(buffer->data + buffer->length, text, size);
+    buffer->length += size;
+    return 0;
+}
+
+int json_buffer_dump(json_buffer* buffer, const json_t* json, size_t flags) {
+    buffer->length = 0;
+    if (json_dump_callback(json, json_buffer_append, buffer, flags) != 0 ||
+        json_buffer_reserve(buffer, buffer->length + 1) != 0) {
+        buffer->length = 0;
+        return -1;
+    }
+    buffer->data[buffer->length] = '\0';
+    t_jsonBufferHint = buffer->length + 1 > JSON_BUFFER_INITIAL_SIZE ? buffer->length + 1 : JSON_BUFFER_INITIAL_SIZE;
+    return 0;
+}
+
+char* json_buffer_take(json_buffer* buffer, size_t* length) {
+    char* data = buffer->length ? buffer->data : NULL;
+    if (length) *length = buffer->length;
+    if (!buffer->arena) {
+        // Kept as long as the text is, without the room to grow; shrinking stays in place
+        if (!data) ub_free(buffer->data);
+        else if (buffer->capacity > buffer->length + 1) {
+            char* trimmed = (char*)ub_realloc(data, buffer->length + 1);
+            if (trimmed) data = trimmed;
+        }
+    }
+    json_buffer_init(buffer, buffer->arena);
+    return data;
+}
+
+void json_buffer_dispose(json_buffer* buffer) {
+    if (!buffer->arena) ub_free(buffer->data);
+    json_buffer_init(buffer, buffer->arena);
+}
+
+char* json_arena_dumps(const json_t* json, size_t flags) {
+    json_buffer buffer;
+    json_buffer_init(&buffer, NULL);
+    if (json_buffer_dump(&buffer, json, flags) != 0) {
+        json_buffer_dispose(&buffer);
+        return NULL;
+    }
+    return json_buffer_take(&buffer, NULL);
+}
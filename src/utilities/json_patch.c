@@ -0,0 +1,39 @@
+#include "utilities/json_patch.h"
+
+int json_patch_diff(const json_t* from, const json_t* to, json_t** patch) {
+    *patch = NULL;
+    if (!json_is_object(from) || !json_is_object(to)) return -1;
+
+    json_t* changes = json_object();
+    if (!changes) return -1;
+    const char* name;
+    json_t* value;
+    // const in all but name, jansson's iteration takes them mutable
+    json_object_foreach((json_t*)from, name, value) {
+        if (!json_object_get(to, name) && json_object_set_new(changes, name, json_null()) != 0) goto failed;
+    }
+    json_object_foreach((json_t*)to, name, value) {
+        json_t* before = json_object_get(from, name);
+        if (before && json_equal(before, value)) continue;
+        if (json_is_null(value)) goto failed;
+        json_t* change = NULL;
+        if (before && json_is_object(before) && json_is_object(value)) {
+            if (json_patch_diff(before, value, &change) != 0) goto failed;
+        } else {
+            change = json_deep_copy(value);
+            if (!change) goto failed;
+        }
+        if (change && json_object_set_new(changes, name, change) != 0) goto failed;
+    }
+
+    if (json_object_size(changes) == 0) {
+        json_decref(changes);
+        return 0;
+    }
+    *patch = changes;
+    return 0;
+
+failed:
+    json_decref(changes);
+    return -1;
+}
@@ -0,0 +1,396 @@
+#include "utilities/json_scan.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Containers skipped at once, deeper documents are refused
+#define JSON_SCAN_SKIP_DEPTH 64
+
+static int json_scan_fail(json_scan* scan) {
+    scan->failed = 1;
+    return -1;
+}
+
+static void json_scan_space(json_scan* scan) {
+    while (scan->offset < scan->length) {
+        char c = scan->data[scan->offset];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        scan->offset++;
+    }
+}
+
+// Consumes c after whitespace
+static int json_scan_expect(json_scan* scan, char c) {
+    if (scan->failed) return -1;
+    json_scan_space(scan);
+    if (scan->offset >= scan->length || scan->data[scan->offset] != c) return json_scan_fail(scan);
+    scan->offset++;
+    return 0;
+}
+
+void json_scan_init(json_scan* scan, const char* data, size_t length) {
+    scan->data = data;
+    scan->length = length;
+    scan->offset = 0;
+    scan->fresh = 0;
+    scan->failed = 0;
+}
+
+json_scan_type json_scan_peek(json_scan* scan) {
+    if (scan->failed) return JSON_SCAN_ERROR;
+    json_scan_space(scan);
+    if (scan->offset >= scan->length) return JSON_SCAN_END;
+    switch (scan->data[scan->offset]) {
+    case '{':
+        return JSON_SCAN_OBJECT;
+    case '[':
+        return JSON_SCAN_ARRAY;
+    case '"':
+        return JSON_SCAN_STRING;
+    case 't':
+        return JSON_SCAN_TRUE;
+    case 'f':
+        return JSON_SCAN_FALSE;
+    case 'n':
+        return JSON_SCAN_NULL;
+    default: {
+        char c = scan->data[scan->offset];
+        return c == '-' || (c >= '0' && c <= '9') ? JSON_SCAN_NUMBER : JSON_SCAN_ERROR;
+    }
+    }
+}
+
+int json_scan_object_begin(json_scan* scan) {
+    if (json_scan_expect(scan, '{') != 0) return -1;
+    scan->fresh = 1;
+    return 0;
+}
+
+int json_scan_array_begin(json_scan* scan) {
+    if (json_scan_expect(scan, '[') != 0) return -1;
+    scan->fresh = 1;
+    return 0;
+}
+
+// The closing quote of the string whose opening one is at offset, -1 if it
+// is not closed
+static long json_scan_string_end(const json_scan* scan, size_t offset) {
+    for (size_t i = offset + 1; i < scan->length; i++) {
+        char c = scan->data[i];
+        if (c == '\\') {
+            i++;
+        } else if (c == '"') {
+            return (long)i;
+        } else if ((unsigned char)c < 0x20) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+// Consumes the separator in front of a member or element: 0 if one follows,
+// 1 if close was consumed instead
+static int json_scan_member(json_scan* scan, char close) {
+    if (scan->failed) return -1;
+    json_scan_space(scan);
+    if (scan->offset < scan->length && scan->data[scan->offset] == close) {
+        scan->offset++;
+        scan->fresh = 0;
+        return 1;
+    }
+    if (!scan->fresh && json_scan_expect(scan, ',') != 0) return -1;
+    scan->fresh = 0;
+    return 0;
+}
+
+int json_scan_object_next(json_scan* scan, const char** key, size_t* length) {
+    int closed = json_scan_member(scan, '}');
+    if (closed != 0) return closed > 0 ? 0 : -1;
+
+    json_scan_space(scan);
+    if (scan->offset >= scan->length || scan->data[scan->offset] != '"') return json_scan_fail(scan);
+    long end = json_scan_string_end(scan, scan->offset);
+    if (end < 0) return json_scan_fail(scan);
+    *key = scan->data + scan->offset + 1;
+    *length = (size_t)end - scan->offset - 1;
+    scan->offset = (size_t)end + 1;
+    return json_scan_expect(scan, ':') == 0 ? 1 : -1;
+}
+
+int json_scan_array_next(json_scan* scan) {
+    int closed = json_scan_member(scan, ']');
+    if (closed != 0) return closed > 0 ? 0 : -1;
+    return 1;
+}
+
+// The number token at the offset, its end
+static size_t json_scan_number_end(const json_scan* scan) {
+    size_t i = scan->offset;
+    while (i < scan->length) {
+        char c = scan->data[i];
+        if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E')) break;
+        i++;
+    }
+    return i;
+}
+
+int json_scan_number(json_scan* scan, double* value) {
+    if (json_scan_peek(scan) != JSON_SCAN_NUMBER) return json_scan_fail(scan);
+    size_t end = json_scan_number_end(scan);
+    const char* p = scan->data + scan->offset;
+    size_t length = end - scan->offset;
+
+    // Whole numbers of a few digits are most of what comes, no strtod for them
+    size_t i = p[0] == '-';
+    if (length - i > 0 && length - i <= 15) {
+        int64_t whole = 0;
+        size_t j = i;
+        while (j < length && p[j] >= '0' && p[j] <= '9') whole = whole * 10 + (p[j++] - '0');
+        if (j == length) {
+            *value = (double)(i ? -whole : whole);
+            scan->offset = end;
+            return 0;
+        }
+    }
+
+    char buffer[64];
+    if (length >= sizeof(buffer)) return json_scan_fail(scan);
+    memcpy(buffer, p, length);
+    buffer[length] = '\0';
+    char* parsed = NULL;
+    *value = strtod(buffer, &parsed);
+    if (parsed != buffer + length) return json_scan_fail(scan);
+    scan->offset = end;
+    return 0;
+}
+
+int json_scan_int(json_scan* scan, long long* value) {
+    double number;
+    if (json_scan_number(scan, &number) != 0) return -1;
+    *value = (long long)number;
+    return 0;
+}
+
+// Consumes the literal word if it is next
+static int json_scan_literal(json_scan* scan, const char* word, size_t length) {
+    if (scan->failed) return -1;
+    json_scan_space(scan);
+    if (scan->length - scan->offset < length || memcmp(scan->data + scan->offset, word, length) != 0)
+        return json_scan_fail(scan);
+    scan->offset += length;
+    return 0;
+}
+
+int json_scan_bool(json_scan* scan, int* value) {
+    json_scan_type type = json_scan_peek(scan);
+    if (type == JSON_SCAN_TRUE) {
+        *value = 1;
+        return json_scan_literal(scan, "true", 4);
+    }
+    if (type == JSON_SCAN_FALSE) {
+        *value = 0;
+        return json_scan_literal(scan, "false", 5);
+    }
+    return json_scan_fail(scan);
+}
+
+int json_scan_null(json_scan* scan) {
+    return json_scan_literal(scan, "null", 4);
+}
+
+static int json_scan_hex4(const char* p, uint32_t* value) {
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return -1;
+        *value = *value << 4 | (uint32_t)digit;
+    }
+    return 0;
+}
+
+static size_t json_scan_utf8(uint32_t code, char* out) {
+    if (code < 0x80) {
+        out[0] = (char)code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | code >> 6);
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | code >> 12);
+        out[1] = (char)(0x80 | (code >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | code >> 18);
+    out[1] = (char)(0x80 | (code >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (code >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+// Bytes of the UTF-8 sequence at p (at most available), 0 if it is invalid
+static size_t json_scan_utf8_length(const unsigned char* p, size_t available) {
+    size_t length = p[0] >= 0xF0 && p[0] <= 0xF4 ? 4 : p[0] >= 0xE0 ? 3 : p[0] >= 0xC2 && p[0] < 0xE0 ? 2 : 0;
+    if (length == 0 || length > available) return 0;
+    for (size_t i = 1; i < length; i++) {
+        if ((p[i] & 0xC0) != 0x80) return 0;
+    }
+    return length;
+}
+
+// Decodes the string between the quotes at start and end into out, which has
+// room for the raw length; the decoded length, -1 if it is malformed
+static long json_scan_decode(const json_scan* scan, size_t start, size_t end, char* out) {
+    const char* p = scan->data + start + 1;
+    const char* stop = scan->data + end;
+    size_t n = 0;
+    while (p < stop) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x80) {
+            size_t length = json_scan_utf8_length((const unsigned char*)p, (size_t)(stop - p));
+            if (length == 0) return -1;
+            memcpy(out + n, p, length);
+            n += length;
+            p += length;
+            continue;
+        }
+        if (c != '\\') {
+            out[n++] = (char)c;
+            p++;
+            continue;
+        }
+        if (stop - p < 2) return -1;
+        char escape = p[1];
+        p += 2;
+        switch (escape) {
+        case '"': out[n++] = '"'; break;
+        case '\\': out[n++] = '\\'; break;
+        case '/': out[n++] = '/'; break;
+        case 'b': out[n++] = '\b'; break;
+        case 'f': out[n++] = '\f'; break;
+        case 'n': out[n++] = '\n'; break;
+        case 'r': out[n++] = '\r'; break;
+        case 't': out[n++] = '\t'; break;
+        case 'u': {
+            uint32_t code;
+            if (stop - p < 4 || json_scan_hex4(p, &code) != 0) return -1;
+            p += 4;
+            if (code >= 0xD800 && code < 0xDC00) {
+                // A surrogate pair, six raw bytes become four
+                uint32_t low;
+                if (stop - p < 6 || p[0] != '\\' || p[1] != 'u' || json_scan_hex4(p + 2, &low) != 0 || low < 0xDC00 ||
+                    low >= 0xE000)
+                    return -1;
+                p += 6;
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            } else if (code >= 0xDC00 && code < 0xE000) {
+                return -1;
+            }
+            // \u0000 would end the C string early
+            if (code == 0) return -1;
+            n += json_scan_utf8(code, out + n);
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+    out[n] = '\0';
+    return (long)n;
+}
+
+int json_scan_string(json_scan* scan, char* out, size_t size) {
+    if (json_scan_peek(scan) != JSON_SCAN_STRING) return json_scan_fail(scan);
+    long end = json_scan_string_end(scan, scan->offset);
+    if (end < 0) return json_scan_fail(scan);
+    size_t raw = (size_t)end - scan->offset - 1;
+    // Decoding never grows a string, the raw length is enough
+    char stage[256];
+    char* target = raw < size ? out : raw < sizeof(stage) ? stage : NULL;
+    if (target == NULL) {
+        scan->offset = (size_t)end + 1;
+        return -1;
+    }
+    long length = json_scan_decode(scan, scan->offset, (size_t)end, target);
+    if (length < 0) return json_scan_fail(scan);
+    scan->offset = (size_t)end + 1;
+    if ((size_t)length >= size) return -1;
+    if (target != out) memcpy(out, target, (size_t)length + 1);
+    return (int)length;
+}
+
+char* json_scan_string_dup(json_scan* scan) {
+    if (json_scan_peek(scan) != JSON_SCAN_STRING) {
+        json_scan_fail(scan);
+        return NULL;
+    }
+    long end = json_scan_string_end(scan, scan->offset);
+    if (end < 0) {
+        json_scan_fail(scan);
+        return NULL;
+    }
+    char* copy = (char*)malloc((size_t)end - scan->offset);
+    if (!copy) return NULL;
+    if (json_scan_decode(scan, scan->offset, (size_t)end, copy) < 0) {
+        free(copy);
+        json_scan_fail(scan);
+        return NULL;
+    }
+    scan->offset = (size_t)end + 1;
+    return copy;
+}
+
+int json_scan_skip(json_scan* scan) {
+    switch (json_scan_peek(scan)) {
+    case JSON_SCAN_STRING: {
+        long end = json_scan_string_end(scan, scan->offset);
+        if (end < 0) return json_scan_fail(scan);
+        scan->offset = (size_t)end + 1;
+        return 0;
+    }
+    case JSON_SCAN_NUMBER: {
+        double ignored;
+        return json_scan_number(scan, &ignored);
+    }
+    case JSON_SCAN_TRUE:
+        return json_scan_literal(scan, "true", 4);
+    case JSON_SCAN_FALSE:
+        return json_scan_literal(scan, "false", 5);
+    case JSON_SCAN_NULL:
+        return json_scan_null(scan);
+    case JSON_SCAN_OBJECT:
+    case JSON_SCAN_ARRAY:
+        break;
+    default:
+        return json_scan_fail(scan);
+    }
+
+    // Brackets are matched against a bit per level, 1 for an object; the
+    // members are not checked beyond their strings
+    uint64_t objects = 0;
+    int depth = 0;
+    while (scan->offset < scan->length) {
+        char c = scan->data[scan->offset];
+        if (c == '"') {
+            long end = json_scan_string_end(scan, scan->offset);
+            if (end < 0) return json_scan_fail(scan);
+            scan->offset = (size_t)end + 1;
+            continue;
+        }
+        scan->offset++;
+        if (c == '{' || c == '[') {
+            if (depth == JSON_SCAN_SKIP_DEPTH) return json_scan_fail(scan);
+            objects = objects << 1 | (c == '{');
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if ((objects & 1) != (c == '}')) return json_scan_fail(scan);
+            objects >>= 1;
+            if (--depth == 0) return 0;
+        }
+    }
+    return json_scan_fail(scan);
+}
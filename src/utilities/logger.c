@@ -0,0 +1,243 @@
+#include "utilities/logger.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// Bounded MPSC ring (Vyukov): a slot is free for the producer whose position
+// equals its sequence and ready for the writer at position + 1
+typedef struct {
+    size_t sequence;
+    int length;
+    // a logger_write_binary record, its channel + 1
+    int binary;
+    char text[LOG_MESSAGE_SIZE];
+} logger_slot;
+
+int g_loggerLevel = LOG_COMPILED_LEVEL;
+
+static logger_slot g_loggerRing[LOG_RING_SLOTS];
+static size_t g_loggerHead = 0;
+// Only the writer thread moves it
+static size_t g_loggerTail = 0;
+static uint32_t g_loggerDropped = 0;
+static uint32_t g_loggerBinaryDropped = 0;
+typedef struct {
+    FILE* file;
+    logger_record_writer writer;
+    int wrote;
+} logger_sink;
+
+static logger_sink g_loggerSinks[LOGGER_CHANNEL_COUNT];
+static int g_loggerRunning = 0;
+static int g_loggerStopping = 0;
+static pthread_t g_loggerThread;
+
+void logger_set_binary_sink(int channel, FILE* file, logger_record_writer writer) {
+    if (channel < 0 || channel >= LOGGER_CHANNEL_COUNT) return;
+    g_loggerSinks[channel].writer = writer;
+    __atomic_store_n(&g_loggerSinks[channel].file, file, __ATOMIC_RELEASE);
+}
+
+static void logger_sink_write(logger_sink* sink, const void* data, int length) {
+    FILE* file = __atomic_load_n(&sink->file, __ATOMIC_ACQUIRE);
+    if (file == NULL) return;
+    if (sink->writer) {
+        sink->writer(file, data, length);
+    } else {
+        fwrite(data, 1, (size_t)length, file);
+    }
+    sink->wrote = 1;
+}
+
+void logger_set_level(int level) {
+    __atomic_store_n(&g_loggerLevel, level, __ATOMIC_RELAXED);
+}
+
+int logger_parse_level(const char* name) {
+    static const char* names[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 4; i++) {
+        if (strcasecmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// 1 if the site may log now; the messages it held back since are in *suppressed
+static int logger_site_allow(logger_site* site, uint32_t* suppressed) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint32_t now = (uint32_t)ts.tv_sec;
+    uint32_t window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+    *suppressed = 0;
+    if (window != now && __atomic_compare_exchange_n(&site->window, &window, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+        *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= LOG_SITE_PER_SECOND) {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+static int logger_format(char* out, uint32_t suppressed, const char* format, va_list args) {
+    int length = vsnprintf(out, LOG_MESSAGE_SIZE, format, args);
+    if (length < 0) length = 0;
+    if (length >= LOG_MESSAGE_SIZE) length = LOG_MESSAGE_SIZE - 1;
+    if (suppressed) {
+        int added = snprintf(out + length, LOG_MESSAGE_SIZE - length, " (%u more suppressed)", suppressed);
+        if (added > 0) length += added;
+        if (length >= LOG_MESSAGE_SIZE) length = LOG_MESSAGE_SIZE - 1;
+    }
+    return length;
+}
+
+// The next free slot and its position, NULL if the ring is full
+static logger_slot* logger_claim(size_t* claimed) {
+    size_t position = __atomic_load_n(&g_loggerHead, __ATOMIC_RELAXED);
+    for (;;) {
+        logger_slot* slot = &g_loggerRing[position & (LOG_RING_SLOTS - 1)];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (__atomic_compare_exchange_n(&g_loggerHead, &position, position + 1, 1, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                *claimed = position;
+                return slot;
+            }
+        } else if (difference < 0) {
+            // Full, the writer is behind
+            return NULL;
+        } else {
+            position = __atomic_load_n(&g_loggerHead, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void logger_write(logger_site* site, int level, const char* format, ...) {
+    (void)level;
+    uint32_t suppressed = 0;
+    if (!logger_site_allow(site, &suppressed)) return;
+
+    va_list args;
+    va_start(args, format);
+    if (!__atomic_load_n(&g_loggerRunning, __ATOMIC_ACQUIRE)) {
+        char text[LOG_MESSAGE_SIZE];
+        int length = logger_format(text, suppressed, format, args);
+        va_end(args);
+        text[length] = '\n';
+        // One write per message, processes sharing the file (workers_prefork)
+        // never split one
+        fwrite(text, 1, (size_t)length + 1, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    size_t position = 0;
+    logger_slot* slot = logger_claim(&position);
+    if (slot == NULL) {
+        va_end(args);
+        __atomic_fetch_add(&g_loggerDropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot->binary = 0;
+    slot->length = logger_format(slot->text, suppressed, format, args);
+    va_end(args);
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+void logger_write_binary(int channel, const void* data, int length) {
+    if (length <= 0 || length > LOG_MESSAGE_SIZE || channel < 0 || channel >= LOGGER_CHANNEL_COUNT) return;
+    if (!__atomic_load_n(&g_loggerRunning, __ATOMIC_ACQUIRE)) {
+        logger_sink_write(&g_loggerSinks[channel], data, length);
+        FILE* file = __atomic_load_n(&g_loggerSinks[channel].file, __ATOMIC_ACQUIRE);
+        if (file) fflush(file);
+        return;
+    }
+    size_t position = 0;
+    logger_slot* slot = logger_claim(&position);
+    if (slot == NULL) {
+        __atomic_fetch_add(&g_loggerBinaryDropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot->binary = channel + 1;
+    slot->length = length;
+    memcpy(slot->text, data, (size_t)length);
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+// Writes out every message ready, 1 if there was any
+static int logger_drain(void) {
+    int wrote = 0;
+    int wrote_binary = 0;
+    for (;;) {
+        logger_slot* slot = &g_loggerRing[g_loggerTail & (LOG_RING_SLOTS - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != g_loggerTail + 1) break;
+        if (slot->binary) {
+            logger_sink_write(&g_loggerSinks[slot->binary - 1], slot->text, slot->length);
+            wrote_binary = 1;
+        } else {
+            slot->text[slot->length] = '\n';
+            fwrite(slot->text, 1, (size_t)slot->length + 1, stdout);
+        }
+        // Free for the producer that comes around the ring to it next
+        __atomic_store_n(&slot->sequence, g_loggerTail + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        g_loggerTail++;
+        wrote = 1;
+    }
+    uint32_t dropped = __atomic_exchange_n(&g_loggerDropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        fprintf(stdout, "Logger: dropped %u message(s), the ring was full\n", dropped);
+        wrote = 1;
+    }
+    dropped = __atomic_exchange_n(&g_loggerBinaryDropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        fprintf(stdout, "Logger: dropped %u binary record(s), the ring was full\n", dropped);
+        wrote = 1;
+    }
+    if (wrote) fflush(stdout);
+    for (int i = 0; i < LOGGER_CHANNEL_COUNT; i++) {
+        logger_sink* sink = &g_loggerSinks[i];
+        if (!sink->wrote) continue;
+        sink->wrote = 0;
+        FILE* file = __atomic_load_n(&sink->file, __ATOMIC_ACQUIRE);
+        if (file) fflush(file);
+    }
+    return wrote || wrote_binary;
+}
+
+static void* logger_thread(void* arg) {
+    (void)arg;
+    const struct timespec interval = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+    for (;;) {
+        int stopping = __atomic_load_n(&g_loggerStopping, __ATOMIC_ACQUIRE);
+        if (logger_drain()) continue;
+        if (stopping) break;
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+int logger_start(void) {
+    if (g_loggerRunning) return 0;
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++) g_loggerRing[i].sequence = i;
+    g_loggerHead = 0;
+    g_loggerTail = 0;
+    g_loggerStopping = 0;
+    fflush(stdout);
+    if (pthread_create(&g_loggerThread, NULL, logger_thread, NULL) != 0) return -1;
+    __atomic_store_n(&g_loggerRunning, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void logger_stop(void) {
+    if (!g_loggerRunning) return;
+    // Callers from here on write directly, the thread takes what is queued
+    __atomic_store_n(&g_loggerRunning, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_loggerStopping, 1, __ATOMIC_RELEASE);
+    pthread_join(g_loggerThread, NULL);
+    fflush(stdout);
+}
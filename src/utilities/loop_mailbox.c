@@ -0,0 +1,250 @@
+#include "utilities/loop_mailbox.h"
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "smw.h"
+#include "utilities/metrics.h"
+
+typedef struct {
+    // slot i is free for the post numbered sequence, taken for sequence - 1
+    uint64_t sequence;
+    loop_message* message;
+} loop_mailbox_slot;
+
+typedef struct {
+    // read by every poster, set on attach
+    loop_mailbox_slot* slots;
+    int doorbell;
+
+    // producers claim slots here
+    uint64_t tail __attribute__((aligned(64)));
+    // the doorbell was rung since the last drain
+    int signalled;
+    // posts are taken, and posts between the check and the push
+    int active;
+    int posters;
+
+    // consumer side, only the owning loop
+    uint64_t head __attribute__((aligned(64)));
+    // posts the loop made to itself
+    loop_message* local_head;
+    loop_message* local_tail;
+    // posts it made that found the receiver's ring full, in order
+    loop_message* outbox_head;
+    loop_message* outbox_tail;
+} loop_mailbox;
+
+static loop_mailbox g_mailboxes[LOOP_MAILBOX_MAX_LOOPS];
+static int g_mailboxCount = 0;
+static __thread int t_mailboxIndex = -1;
+
+static metrics_counter g_postsSent;
+static metrics_counter g_postsDeferred;
+
+static void loop_mailbox_append(loop_message** head, loop_message** tail, loop_message* message) {
+    message->next = NULL;
+    if (*tail) {
+        (*tail)->next = message;
+    } else {
+        *head = message;
+    }
+    *tail = message;
+}
+
+// -1 if the ring is full
+static int loop_mailbox_push(loop_mailbox* box, loop_message* message) {
+    uint64_t tail = __atomic_load_n(&box->tail, __ATOMIC_RELAXED);
+    loop_mailbox_slot* slot;
+    for (;;) {
+        slot = &box->slots[tail & (LOOP_MAILBOX_RING_SIZE - 1)];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t behind = (int64_t)(sequence - tail);
+        if (behind == 0) {
+            if (__atomic_compare_exchange_n(&box->tail, &tail, tail + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (behind < 0) {
+            // the slot still holds the post a lap ago
+            return -1;
+        } else {
+            tail = __atomic_load_n(&box->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->message = message;
+    __atomic_store_n(&slot->sequence, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// The oldest message, NULL if there is none or its poster is half way
+// through writing it
+static loop_message* loop_mailbox_pop(loop_mailbox* box) {
+    loop_mailbox_slot* slot = &box->slots[box->head & (LOOP_MAILBOX_RING_SIZE - 1)];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != box->head + 1) return NULL;
+    loop_message* message = slot->message;
+    __atomic_store_n(&slot->sequence, box->head + LOOP_MAILBOX_RING_SIZE, __ATOMIC_RELEASE);
+    box->head++;
+    return message;
+}
+
+// 0 once message is in box's ring, -1 if box takes no posts, 1 if the ring
+// is full and wait is not set
+static int loop_mailbox_send(loop_mailbox* box, loop_message* message, int wait) {
+    __atomic_add_fetch(&box->posters, 1, __ATOMIC_SEQ_CST);
+    int result = __atomic_load_n(&box->active, __ATOMIC_SEQ_CST) ? 0 : -1;
+    while (result == 0 && loop_mailbox_push(box, message) != 0) {
+        if (!wait) {
+            result = 1;
+        } else {
+            sched_yield();
+        }
+        // checked on every try, a loop detaching waits for its posters
+        if (!__atomic_load_n(&box->active, __ATOMIC_SEQ_CST)) result = -1;
+    }
+    if (result == 0 && !__atomic_exchange_n(&box->signalled, 1, __ATOMIC_SEQ_CST)) smw_ringDoorbell(box->doorbell);
+    __atomic_sub_fetch(&box->posters, 1, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+// Retries the outbox, in order, until a ring is still full
+static void loop_mailbox_flush(loop_mailbox* self) {
+    while (self->outbox_head) {
+        loop_message* message = self->outbox_head;
+        loop_message* next = message->next;
+        int sent = loop_mailbox_send(&g_mailboxes[message->to], message, 0);
+        if (sent > 0) return;
+        // the receiver may have run and freed it already
+        self->outbox_head = next;
+        if (!next) self->outbox_tail = NULL;
+        if (sent < 0 && message->drop) message->drop(message);
+    }
+}
+
+// Runs everything posted to itself before this call, 1 if more is left
+static int loop_mailbox_run(loop_mailbox* box, int batch) {
+    int count = 0;
+    loop_message* message;
+    while (count < batch && (message = loop_mailbox_pop(box)) != NULL) {
+        message->run(message);
+        count++;
+    }
+
+    loop_message* local = box->local_head;
+    box->local_head = NULL;
+    box->local_tail = NULL;
+    while (local) {
+        loop_message* next = local->next;
+        local->run(local);
+        local = next;
+    }
+
+    return box->local_head || box->outbox_head || __atomic_load_n(&box->tail, __ATOMIC_ACQUIRE) != box->head;
+}
+
+// smw's inbox, at the top of every pass
+static int loop_mailbox_drain(void* context) {
+    loop_mailbox* box = (loop_mailbox*)context;
+    // Posts from here on ring again
+    __atomic_store_n(&box->signalled, 0, __ATOMIC_SEQ_CST);
+    loop_mailbox_flush(box);
+    return loop_mailbox_run(box, LOOP_MAILBOX_DRAIN_BATCH);
+}
+
+int loop_mailbox_init(int count) {
+    if (count < 1 || count > LOOP_MAILBOX_MAX_LOOPS) return -1;
+    g_mailboxCount = count;
+    return 0;
+}
+
+int loop_mailbox_count(void) {
+    return g_mailboxCount;
+}
+
+void loop_mailbox_register_metrics(void) {
+    metrics_register("loop_messages_total", "Messages posted between threads and loops, deferred ones met a full ring.",
+                     METRICS_COUNTER, "result=\"sent\"", &g_postsSent);
+    metrics_register("loop_messages_total", "Messages posted between threads and loops, deferred ones met a full ring.",
+                     METRICS_COUNTER, "result=\"deferred\"", &g_postsDeferred);
+}
+
+int loop_mailbox_attach(int index) {
+    if (index < 0 || index >= g_mailboxCount || t_mailboxIndex >= 0) return -1;
+    loop_mailbox* box = &g_mailboxes[index];
+    box->slots = (loop_mailbox_slot*)calloc(LOOP_MAILBOX_RING_SIZE, sizeof(loop_mailbox_slot));
+    if (!box->slots) return -1;
+    for (uint64_t i = 0; i < LOOP_MAILBOX_RING_SIZE; i++) box->slots[i].sequence = i;
+    box->head = 0;
+    box->tail = 0;
+    box->signalled = 0;
+    box->local_head = box->local_tail = NULL;
+    box->outbox_head = box->outbox_tail = NULL;
+    box->doorbell = smw_doorbell();
+    smw_setInbox(loop_mailbox_drain, box);
+
+    t_mailboxIndex = index;
+    __atomic_store_n(&box->active, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+void loop_mailbox_detach(void) {
+    if (t_mailboxIndex < 0) return;
+    loop_mailbox* box = &g_mailboxes[t_mailboxIndex];
+
+    // Posters check active after announcing themselves, once none is left
+    // nothing can be pushed any more. What the loop still has to send goes
+    // out (or is dropped) meanwhile, the loops it waits for may wait for it.
+    __atomic_store_n(&box->active, 0, __ATOMIC_SEQ_CST);
+    for (;;) {
+        loop_mailbox_flush(box);
+        int left = loop_mailbox_run(box, LOOP_MAILBOX_RING_SIZE);
+        if (!left && __atomic_load_n(&box->posters, __ATOMIC_SEQ_CST) == 0 &&
+            __atomic_load_n(&box->tail, __ATOMIC_SEQ_CST) == box->head) {
+            break;
+        }
+        sched_yield();
+    }
+
+    smw_setInbox(NULL, NULL);
+    free(box->slots);
+    box->slots = NULL;
+    t_mailboxIndex = -1;
+}
+
+int loop_mailbox_self(void) {
+    return t_mailboxIndex;
+}
+
+int loop_mailbox_owner(uint64_t key) {
+    if (g_mailboxCount <= 1) return t_mailboxIndex;
+    // splitmix64 finalizer, neighbouring keys land on different loops
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (int)(key % (uint64_t)g_mailboxCount);
+}
+
+int loop_mailbox_post(int index, loop_message* message) {
+    if (index < 0 || index >= g_mailboxCount) return -1;
+    message->to = index;
+
+    loop_mailbox* self = t_mailboxIndex >= 0 ? &g_mailboxes[t_mailboxIndex] : NULL;
+    if (self && index == t_mailboxIndex) {
+        loop_mailbox_append(&self->local_head, &self->local_tail, message);
+        metrics_counter_add(&g_postsSent, 1);
+        return 0;
+    }
+
+    loop_mailbox* box = &g_mailboxes[index];
+    // Behind what is waiting already, a loop's posts arrive in order
+    int sent = self && self->outbox_head ? 1 : loop_mailbox_send(box, message, self == NULL);
+    if (sent < 0) return -1;
+    if (sent > 0) {
+        if (!__atomic_load_n(&box->active, __ATOMIC_SEQ_CST)) return -1;
+        loop_mailbox_append(&self->outbox_head, &self->outbox_tail, message);
+        metrics_counter_add(&g_postsDeferred, 1);
+        return 0;
+    }
+    metrics_counter_add(&g_postsSent, 1);
+    return 0;
+}
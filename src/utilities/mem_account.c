@@ -0,0 +1,227 @@
+#include "utilities/mem_account.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+#include "utilities/ub_alloc.h"
+
+mem_account_counter g_memAccount[MEM_TAG_COUNT];
+
+static const char* const g_memTagNames[MEM_TAG_COUNT] = {
+    "connections", "tls", "parser", "caches", "jansson", "curl", "instances", "arenas",
+};
+
+// In front of a tagged heap block, sized so the data stays as aligned as malloc's
+typedef union {
+    size_t size;
+    max_align_t align;
+} mem_account_header;
+
+void mem_account_resize(int tag, size_t old_bytes, size_t new_bytes) {
+    if (old_bytes == new_bytes) return;
+    if (old_bytes == 0) {
+        mem_account_alloc(tag, new_bytes);
+        return;
+    }
+    if (new_bytes == 0) {
+        mem_account_free(tag, old_bytes);
+        return;
+    }
+    mem_account_counter* counter = &g_memAccount[tag];
+    int64_t now = __atomic_add_fetch(&counter->bytes, (int64_t)new_bytes - (int64_t)old_bytes, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&counter->peak_bytes, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&counter->peak_bytes, &peak, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void* mem_account_malloc(int tag, size_t size) {
+    mem_account_header* header = (mem_account_header*)ub_malloc(sizeof(mem_account_header) + size);
+    if (!header) return NULL;
+    header->size = size;
+    mem_account_alloc(tag, size);
+    return header + 1;
+}
+
+void* mem_account_calloc(int tag, size_t count, size_t size) {
+    if (size != 0 && count > (SIZE_MAX - sizeof(mem_account_header)) / size) return NULL;
+    mem_account_header* header = (mem_account_header*)ub_calloc(1, sizeof(mem_account_header) + count * size);
+    if (!header) return NULL;
+    header->size = count * size;
+    mem_account_alloc(tag, count * size);
+    return header + 1;
+}
+
+void mem_account_release(int tag, void* ptr) {
+    if (!ptr) return;
+    mem_account_header* header = (mem_account_header*)ptr - 1;
+    mem_account_free(tag, header->size);
+    ub_free(header);
+}
+
+const char* mem_account_tag_name(int tag) {
+    return tag >= 0 && tag < MEM_TAG_COUNT ? g_memTagNames[tag] : "unknown";
+}
+
+void mem_account_get(int tag, mem_account_stats* stats) {
+    const mem_account_counter* counter = &g_memAccount[tag];
+    stats->bytes = __atomic_load_n(&counter->bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&counter->peak_bytes, __ATOMIC_RELAXED);
+    stats->objects = __atomic_load_n(&counter->objects, __ATOMIC_RELAXED);
+    stats->allocs = __atomic_load_n(&counter->allocs, __ATOMIC_RELAXED);
+}
+
+int64_t mem_account_rss(void) {
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+    long long size = 0, resident = 0;
+    int read = fscanf(file, "%lld %lld", &size, &resident);
+    fclose(file);
+    if (read != 2) return 0;
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+//-------------------------Metrics-------------------------
+
+static char g_memLabels[MEM_TAG_COUNT][32];
+
+static int64_t mem_account_read_bytes(void* context) {
+    return __atomic_load_n(&((mem_account_counter*)context)->bytes, __ATOMIC_RELAXED);
+}
+
+static int64_t mem_account_read_objects(void* context) {
+    return __atomic_load_n(&((mem_account_counter*)context)->objects, __ATOMIC_RELAXED);
+}
+
+static int64_t mem_account_read_rss(void* context) {
+    (void)context;
+    return mem_account_rss();
+}
+
+// User and system time of every thread, for what a load costs the process
+static int64_t mem_account_read_cpu(void* context) {
+    (void)context;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec +
+           usage.ru_stime.tv_usec;
+}
+
+void mem_account_register_metrics(void) {
+    metrics_register_read("process_resident_memory_bytes", "Resident set size of the process.", METRICS_GAUGE, NULL,
+                          mem_account_read_rss, NULL);
+    metrics_register_read("process_cpu_microseconds_total", "User and system CPU time of the process.",
+                          METRICS_COUNTER, NULL, mem_account_read_cpu, NULL);
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        snprintf(g_memLabels[i], sizeof(g_memLabels[i]), "tag=\"%s\"", g_memTagNames[i]);
+        metrics_register_read("memory_bytes", "Heap bytes held, by subsystem.", METRICS_GAUGE, g_memLabels[i],
+                              mem_account_read_bytes, &g_memAccount[i]);
+    }
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        metrics_register_read("memory_objects", "Heap objects held, by subsystem.", METRICS_GAUGE, g_memLabels[i],
+                              mem_account_read_objects, &g_memAccount[i]);
+    }
+}
+
+//------------------------Leak check------------------------
+
+static pthread_t g_leakThread;
+static pthread_mutex_t g_leakLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_leakWake = PTHREAD_COND_INITIALIZER;
+static int g_leakStopping = 0;
+static unsigned int g_leakInterval = 0;
+static int g_leakSamples = 0;
+static unsigned int g_leakGrowing = 0;
+// object counts of the last samples, a ring
+static int64_t g_leakHistory[MEM_ACCOUNT_LEAK_WINDOW][MEM_TAG_COUNT];
+
+// 1 if every sample in the window has more objects than the one before
+static int mem_account_leak_grew(int tag, int newest) {
+    for (int i = 0; i < MEM_ACCOUNT_LEAK_WINDOW - 1; i++) {
+        int current = (newest - i + MEM_ACCOUNT_LEAK_WINDOW) % MEM_ACCOUNT_LEAK_WINDOW;
+        int previous = (current - 1 + MEM_ACCOUNT_LEAK_WINDOW) % MEM_ACCOUNT_LEAK_WINDOW;
+        if (g_leakHistory[current][tag] <= g_leakHistory[previous][tag]) return 0;
+    }
+    return 1;
+}
+
+static void mem_account_leak_sample(void) {
+    int newest = g_leakSamples % MEM_ACCOUNT_LEAK_WINDOW;
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        g_leakHistory[newest][i] = __atomic_load_n(&g_memAccount[i].objects, __ATOMIC_RELAXED);
+    }
+    g_leakSamples++;
+    if (g_leakSamples < MEM_ACCOUNT_LEAK_WINDOW) return;
+
+    unsigned int growing = 0;
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        if (!mem_account_leak_grew(i, newest)) continue;
+        growing |= 1u << i;
+        // Once when it starts, not every interval it keeps on
+        if (!(g_leakGrowing & (1u << i))) {
+            int first = (newest + 1) % MEM_ACCOUNT_LEAK_WINDOW;
+            LOG_WARN("Warning: %s objects grew at each of the last %d samples, %lld to %lld",
+                     g_memTagNames[i], MEM_ACCOUNT_LEAK_WINDOW, (long long)g_leakHistory[first][i],
+                     (long long)g_leakHistory[newest][i]);
+        }
+    }
+    __atomic_store_n(&g_leakGrowing, growing, __ATOMIC_RELAXED);
+}
+
+static void* mem_account_leak_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_leakLock);
+    while (!g_leakStopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += g_leakInterval;
+        while (!g_leakStopping && pthread_cond_timedwait(&g_leakWake, &g_leakLock, &until) == 0) {
+        }
+        if (g_leakStopping) break;
+        mem_account_leak_sample();
+    }
+    pthread_mutex_unlock(&g_leakLock);
+    return NULL;
+}
+
+int mem_account_leak_check_start(unsigned int interval_s) {
+    if (interval_s == 0 || g_leakInterval != 0) return 0;
+    g_leakStopping = 0;
+    g_leakSamples = 0;
+    g_leakGrowing = 0;
+    g_leakInterval = interval_s;
+    if (pthread_create(&g_leakThread, NULL, mem_account_leak_thread, NULL) != 0) {
+        g_leakInterval = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void mem_account_leak_check_stop(void) {
+    if (g_leakInterval == 0) return;
+    pthread_mutex_lock(&g_leakLock);
+    g_leakStopping = 1;
+    pthread_cond_signal(&g_leakWake);
+    pthread_mutex_unlock(&g_leakLock);
+    pthread_join(g_leakThread, NULL);
+    g_leakInterval = 0;
+}
+
+unsigned int mem_account_leak_check_interval(int* samples) {
+    pthread_mutex_lock(&g_leakLock);
+    unsigned int interval = g_leakInterval;
+    *samples = g_leakSamples;
+    pthread_mutex_unlock(&g_leakLock);
+    return interval;
+}
+
+unsigned int mem_account_growing(void) {
+    return __atomic_load_n(&g_leakGrowing, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,192 @@
+#include "utilities/metrics.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utilities/real_format.h"
+
+typedef struct {
+    const char* name;
+    const char* help;
+    metrics_type type;
+    const char* labels;
+    void* metric;
+    metrics_read read;
+    void* context;
+    // a histogram's recorded unit in what it is rendered in
+    double unit;
+} metrics_entry;
+
+// Filled from main before the loops start, read only from then on. The
+// startup phases that run at once register from threads of their own.
+static pthread_mutex_t g_metricsLock = PTHREAD_MUTEX_INITIALIZER;
+static metrics_entry g_metrics[METRICS_MAX_ENTRIES];
+static int g_metricsCount = 0;
+static int g_metricsNextShard = 0;
+
+__thread int t_metricsShard = -1;
+
+int metrics_shard_assign(void) {
+    t_metricsShard = __atomic_fetch_add(&g_metricsNextShard, 1, __ATOMIC_RELAXED) % METRICS_SHARDS;
+    return t_metricsShard;
+}
+
+static int metrics_add(const metrics_entry* entry) {
+    pthread_mutex_lock(&g_metricsLock);
+    if (g_metricsCount == METRICS_MAX_ENTRIES) {
+        pthread_mutex_unlock(&g_metricsLock);
+        return -1;
+    }
+    // Behind the last of its family, a family is rendered under one header
+    int at = g_metricsCount;
+    for (int i = 0; i < g_metricsCount; i++) {
+        if (strcmp(g_metrics[i].name, entry->name) == 0) at = i + 1;
+    }
+    memmove(&g_metrics[at + 1], &g_metrics[at], (size_t)(g_metricsCount - at) * sizeof(metrics_entry));
+    g_metrics[at] = *entry;
+    g_metricsCount++;
+    pthread_mutex_unlock(&g_metricsLock);
+    return 0;
+}
+
+int metrics_register(const char* name, const char* help, metrics_type type, const char* labels, void* metric) {
+    metrics_entry entry = {name, help, type, labels, metric, NULL, NULL, 1e-6};
+    return metrics_add(&entry);
+}
+
+int metrics_register_histogram(const char* name, const char* help, const char* labels, metrics_histogram* histogram,
+                               double unit) {
+    metrics_entry entry = {name, help, METRICS_HISTOGRAM, labels, histogram, NULL, NULL, unit};
+    return metrics_add(&entry);
+}
+
+int metrics_register_read(const char* name, const char* help, metrics_type type, const char* labels,
+                          metrics_read read, void* context) {
+    if (type == METRICS_HISTOGRAM) return -1;
+    metrics_entry entry = {name, help, type, labels, NULL, read, context, 1e-6};
+    return metrics_add(&entry);
+}
+
+// Bucket i holds the microseconds in (upper(i - 1), upper(i)], counted from
+// value - 1 so that the bound is inclusive as Prometheus has it
+static int metrics_bucket(uint64_t microseconds) {
+    uint64_t value = microseconds ? microseconds - 1 : 0;
+    if (value < 4) return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    int index = (exponent - 1) * 4 + (int)((value >> (exponent - 2)) & 3);
+    return index < METRICS_HISTOGRAM_BUCKETS - 1 ? index : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t metrics_bucket_upper(int index) {
+    if (index < 4) return (uint64_t)index + 1;
+    int exponent = index / 4 + 1;
+    return (uint64_t)(4 + index % 4 + 1) << (exponent - 2);
+}
+
+void metrics_histogram_record(metrics_histogram* histogram, uint64_t microseconds) {
+    metrics_histogram_shard* shard = &histogram->shards[metrics_shard()];
+    __atomic_fetch_add(&shard->buckets[metrics_bucket(microseconds)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->sum, microseconds, __ATOMIC_RELAXED);
+}
+
+static int64_t metrics_value(const metrics_entry* entry) {
+    if (entry->read) return entry->read(entry->context);
+    if (entry->type == METRICS_GAUGE) return __atomic_load_n(&((metrics_gauge*)entry->metric)->value, __ATOMIC_RELAXED);
+    const metrics_counter* counter = (const metrics_counter*)entry->metric;
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_SHARDS; i++) total += __atomic_load_n(&counter->shards[i].value, __ATOMIC_RELAXED);
+    return (int64_t)total;
+}
+
+static void metrics_snapshot(metrics_cursor* cursor, const metrics_histogram* histogram) {
+    memset(cursor->buckets, 0, sizeof(cursor->buckets));
+    cursor->sum = 0;
+    for (int i = 0; i < METRICS_SHARDS; i++) {
+        const metrics_histogram_shard* shard = &histogram->shards[i];
+        for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+            cursor->buckets[b] += __atomic_load_n(&shard->buckets[b], __ATOMIC_RELAXED);
+        }
+        cursor->sum += __atomic_load_n(&shard->sum, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_cursor_init(metrics_cursor* cursor) {
+    cursor->entry = 0;
+    cursor->line = 0;
+}
+
+// Line cursor->line of the entry into out, -1 once the entry has no more
+// Divided by the inverse of a fractional unit, so microseconds come out as
+// the seconds they were before units (10 * 1e-6 is not 1e-5)
+static double metrics_scaled(double value, double unit) {
+    return unit < 1 ? value / (1 / unit) : value * unit;
+}
+
+static int metrics_line(metrics_cursor* cursor, const metrics_entry* entry, char* out) {
+    const char* labels = entry->labels ? entry->labels : "";
+    const char* open = entry->labels ? "{" : "";
+    const char* close = entry->labels ? "}" : "";
+    int line = cursor->line;
+
+    if (line == 0) {
+        // The family header, with its first member
+        if (cursor->entry > 0 && strcmp(g_metrics[cursor->entry - 1].name, entry->name) == 0) return 0;
+        static const char* types[] = {"counter", "gauge", "histogram"};
+        return snprintf(out, METRICS_LINE_SIZE, "# HELP %s %s\n# TYPE %s %s\n", entry->name, entry->help, entry->name,
+                        types[entry->type]);
+    }
+    if (entry->type != METRICS_HISTOGRAM) {
+        if (line > 1) return -1;
+        return snprintf(out, METRICS_LINE_SIZE, "%s%s%s%s %lld\n", entry->name, open, labels, close,
+                        (long long)metrics_value(entry));
+    }
+
+    // Cumulative finite buckets, +Inf, _sum and _count
+    const char* separator = entry->labels ? "," : "";
+    int finite = METRICS_HISTOGRAM_BUCKETS - 1;
+    if (line == 1) {
+        metrics_snapshot(cursor, (const metrics_histogram*)entry->metric);
+        for (int b = 1; b < METRICS_HISTOGRAM_BUCKETS; b++) cursor->buckets[b] += cursor->buckets[b - 1];
+    }
+    char number[REAL_FORMAT_SIZE];
+    if (line <= finite) {
+        real_format(metrics_scaled((double)metrics_bucket_upper(line - 1), entry->unit), number);
+        return snprintf(out, METRICS_LINE_SIZE, "%s_bucket{%s%sle=\"%s\"} %llu\n", entry->name, labels, separator,
+                        number, (unsigned long long)cursor->buckets[line - 1]);
+    }
+    uint64_t count = cursor->buckets[METRICS_HISTOGRAM_BUCKETS - 1];
+    if (line == finite + 1) {
+        return snprintf(out, METRICS_LINE_SIZE, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", entry->name, labels, separator,
+                        (unsigned long long)count);
+    }
+    if (line == finite + 2) {
+        real_format(metrics_scaled((double)cursor->sum, entry->unit), number);
+        return snprintf(out, METRICS_LINE_SIZE, "%s_sum%s%s%s %s\n", entry->name, open, labels, close, number);
+    }
+    if (line == finite + 3) {
+        return snprintf(out, METRICS_LINE_SIZE, "%s_count%s%s%s %llu\n", entry->name, open, labels, close,
+                        (unsigned long long)count);
+    }
+    return -1;
+}
+
+int metrics_render(metrics_cursor* cursor, char* out, int size) {
+    int written = 0;
+    char line[METRICS_LINE_SIZE];
+    while (cursor->entry < g_metricsCount) {
+        int length = metrics_line(cursor, &g_metrics[cursor->entry], line);
+        if (length < 0) {
+            cursor->entry++;
+            cursor->line = 0;
+            continue;
+        }
+        if (length >= METRICS_LINE_SIZE) length = METRICS_LINE_SIZE - 1;
+        // The rest goes in the next call, this line is written again then
+        if (written + length > size) break;
+        memcpy(out + written, line, (size_t)length);
+        written += length;
+        cursor->line++;
+    }
+    return written;
+}
@@ -0,0 +1,47 @@
+#include "utilities/object_pool.h"
+
+#include "utilities/ub_alloc.h"
+
+static __thread object_pool* t_pools = NULL;
+
+void* object_pool_get(object_pool* pool) {
+    void* object = pool->free_list;
+    if (!object) return NULL;
+
+    pool->free_list = *(void**)object;
+    pool->free_count--;
+    return object;
+}
+
+int object_pool_put(object_pool* pool, void* object) {
+    if (pool->free_count >= OBJECT_POOL_MAX_FREE) return -1;
+
+    if (!pool->registered) {
+        pool->registered = 1;
+        pool->next = t_pools;
+        t_pools = pool;
+    }
+
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->free_count++;
+    return 0;
+}
+
+void object_pool_drain(void) {
+    while (t_pools) {
+        object_pool* pool = t_pools;
+        t_pools = pool->next;
+
+        void* object;
+        while ((object = object_pool_get(pool)) != NULL) {
+            if (pool->destroy) {
+                pool->destroy(object);
+            } else {
+                ub_free(object);
+            }
+        }
+        pool->registered = 0;
+        pool->next = NULL;
+    }
+}
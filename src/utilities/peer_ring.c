@@ -0,0 +1,102 @@
+#include "utilities/peer_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t hash;
+    // index into g_peers
+    int peer;
+} peer_ring_point;
+
+static char g_peers[PEER_RING_MAX_PEERS][PEER_RING_ADDRESS_SIZE];
+static int g_peerCount = 0;
+// this node's index, -1 if it is not on the ring
+static int g_self = -1;
+static peer_ring_point g_points[PEER_RING_MAX_PEERS * PEER_RING_VNODES];
+static int g_pointCount = 0;
+
+// splitmix64 finalizer, as loop_mailbox_owner spreads keys over the loops
+static uint64_t peer_ring_mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+// FNV-1a, every node has to place a peer on the same points
+static uint64_t peer_ring_hash_address(const char* address) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char* c = address; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int peer_ring_point_order(const void* a, const void* b) {
+    const peer_ring_point* left = (const peer_ring_point*)a;
+    const peer_ring_point* right = (const peer_ring_point*)b;
+    if (left->hash != right->hash) return left->hash < right->hash ? -1 : 1;
+    // Ties broken the same way everywhere, by address
+    return strcmp(g_peers[left->peer], g_peers[right->peer]);
+}
+
+int peer_ring_init(const char* peers, const char* self) {
+    g_peerCount = 0;
+    g_pointCount = 0;
+    g_self = -1;
+    if (!peers) return 0;
+
+    const char* start = peers;
+    for (;;) {
+        const char* end = strchr(start, ',');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        if (length == 0 || length >= PEER_RING_ADDRESS_SIZE || g_peerCount == PEER_RING_MAX_PEERS) {
+            g_peerCount = 0;
+            return -1;
+        }
+        memcpy(g_peers[g_peerCount], start, length);
+        g_peers[g_peerCount][length] = '\0';
+        g_peerCount++;
+        if (!end) break;
+        start = end + 1;
+    }
+
+    // The points depend on the address alone, every node places them alike
+    for (int i = 0; i < g_peerCount; i++) {
+        if (self && strcmp(g_peers[i], self) == 0) g_self = i;
+        uint64_t hash = peer_ring_hash_address(g_peers[i]);
+        for (int v = 0; v < PEER_RING_VNODES; v++) {
+            g_points[g_pointCount].hash = peer_ring_mix(hash + (uint64_t)v);
+            g_points[g_pointCount].peer = i;
+            g_pointCount++;
+        }
+    }
+    qsort(g_points, (size_t)g_pointCount, sizeof(peer_ring_point), peer_ring_point_order);
+    return 0;
+}
+
+int peer_ring_enabled(void) {
+    return g_peerCount > 0;
+}
+
+const char* peer_ring_owner(uint64_t key) {
+    if (g_pointCount == 0) return NULL;
+    uint64_t hash = peer_ring_mix(key);
+    // The first point at or after the hash, the ring wraps around
+    int low = 0;
+    int high = g_pointCount;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (g_points[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    int peer = g_points[low == g_pointCount ? 0 : low].peer;
+    return peer == g_self ? NULL : g_peers[peer];
+}
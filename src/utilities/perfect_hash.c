@@ -0,0 +1,55 @@
+#include "utilities/perfect_hash.h"
+
+#include <string.h>
+#include <strings.h>
+
+static uint32_t perfect_hash_fold(const char* key, size_t length, uint32_t seed) {
+    // FNV-1a over the ASCII lower case bytes, seeded through the basis
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)key[i];
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        hash ^= c;
+        hash *= 16777619u;
+    }
+    // FNV's low bits mix poorly, the slot is taken from them
+    return hash ^ (hash >> 15);
+}
+
+int perfect_hash_build(perfect_hash* table, const char* const* keys, int count) {
+    if (count < 0 || count > PERFECT_HASH_MAX_KEYS) return -1;
+
+    memset(table, 0, sizeof(perfect_hash));
+    table->count = count;
+    for (int i = 0; i < count; i++) table->keys[i] = keys[i];
+
+    // Four slots per key at most, fewer while a seed is easy to find
+    uint32_t size = 1;
+    while (size < (uint32_t)count * 2) size <<= 1;
+    for (; size <= sizeof(table->slots); size <<= 1) {
+        table->mask = size - 1;
+        for (uint32_t seed = 0; seed < PERFECT_HASH_MAX_SEEDS; seed++) {
+            memset(table->slots, 0, sizeof(table->slots));
+            int i = 0;
+            for (; i < count; i++) {
+                uint32_t slot = perfect_hash_fold(keys[i], strlen(keys[i]), seed) & table->mask;
+                if (table->slots[slot] != 0) break;
+                table->slots[slot] = (uint8_t)(i + 1);
+            }
+            if (i == count) {
+                table->seed = seed;
+                return 0;
+            }
+        }
+    }
+    return -1;
+}
+
+int perfect_hash_find(const perfect_hash* table, const char* key, size_t length) {
+    if (table->count == 0) return -1;
+    int index = table->slots[perfect_hash_fold(key, length, table->seed) & table->mask] - 1;
+    if (index < 0) return -1;
+    const char* candidate = table->keys[index];
+    if (strlen(candidate) != length || strncasecmp(candidate, key, length) != 0) return -1;
+    return index;
+}
@@ -0,0 +1,134 @@
+#include "utilities/rate_limiter.h"
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void rate_bucket_refill(rate_bucket* bucket, uint32_t rate, uint32_t burst, uint64_t now_ms) {
+    if (now_ms > bucket->last_ms) {
+        bucket->tokens += (int64_t)((now_ms - bucket->last_ms) * rate);
+        bucket->last_ms = now_ms;
+    }
+    if (bucket->tokens > (int64_t)burst * 1000) bucket->tokens = (int64_t)burst * 1000;
+}
+
+// ms until bucket holds a whole token at rate
+static uint64_t rate_bucket_wait(const rate_bucket* bucket, uint32_t rate) {
+    if (bucket->tokens >= 1000) return 0;
+    if (rate == 0) return UINT64_MAX;
+    // round up to the ms the next full token is in
+    return ((uint64_t)(1000 - bucket->tokens) + rate - 1) / rate;
+}
+
+// Normalized key, v4-mapped v6 peers count as their v4 address
+static int rate_limiter_key(const struct sockaddr* addr, uint8_t key[16], uint8_t* family) {
+    memset(key, 0, 16);
+    if (addr->sa_family == AF_INET) {
+        memcpy(key, &((const struct sockaddr_in*)addr)->sin_addr, 4);
+        *family = AF_INET;
+        return 0;
+    }
+    if (addr->sa_family == AF_INET6) {
+        const struct in6_addr* a6 = &((const struct sockaddr_in6*)addr)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(a6)) {
+            memcpy(key, &a6->s6_addr[12], 4);
+            *family = AF_INET;
+        } else {
+            memcpy(key, a6, 16);
+            *family = AF_INET6;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static uint32_t rate_limiter_hash(const uint8_t key[16], uint8_t family) {
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ family;
+    for (int i = 0; i < 16; i++) {
+        hash ^= key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static rate_limiter_entry* rate_limiter_lookup(rate_limiter* limiter, const uint8_t key[16], uint8_t family) {
+    uint32_t hash = rate_limiter_hash(key, family);
+    rate_limiter_entry* victim = NULL;
+
+    for (int i = 0; i < RATE_LIMITER_PROBE; i++) {
+        rate_limiter_entry* entry = &limiter->entries[(hash + i) & (RATE_LIMITER_TABLE_SIZE - 1)];
+        if (!entry->used) {
+            if (!victim || victim->used) victim = entry;
+            continue;
+        }
+        if (entry->family == family && memcmp(entry->addr, key, 16) == 0) return entry;
+        if (!victim || (victim->used && entry->bucket.last_ms < victim->bucket.last_ms)) victim = entry;
+    }
+
+    // New address, or one we forgot: start with a full bucket
+    memcpy(victim->addr, key, 16);
+    victim->family = family;
+    victim->used = 1;
+    victim->bucket.tokens = (int64_t)limiter->burst * 1000;
+    victim->bucket.last_ms = 0;
+    return victim;
+}
+
+int rate_limiter_init(rate_limiter* limiter, uint32_t rate, uint32_t burst, uint32_t global_rate,
+                      uint32_t global_burst, uint64_t now_ms) {
+    limiter->entries = (rate_limiter_entry*)calloc(RATE_LIMITER_TABLE_SIZE, sizeof(rate_limiter_entry));
+    if (!limiter->entries) return -1;
+
+    limiter->rate = rate;
+    limiter->burst = burst;
+    limiter->global_rate = global_rate;
+    limiter->global_burst = global_burst;
+    limiter->global.tokens = (int64_t)global_burst * 1000;
+    limiter->global.last_ms = now_ms;
+    return 0;
+}
+
+void rate_limiter_dispose(rate_limiter* limiter) {
+    free(limiter->entries);
+    limiter->entries = NULL;
+}
+
+uint64_t rate_limiter_global_wait(rate_limiter* limiter, uint64_t now_ms) {
+    rate_bucket_refill(&limiter->global, limiter->global_rate, limiter->global_burst, now_ms);
+    return rate_bucket_wait(&limiter->global, limiter->global_rate);
+}
+
+// The address's bucket refilled up to now_ms, NULL for addresses without one
+static rate_bucket* rate_limiter_bucket(rate_limiter* limiter, const struct sockaddr* addr, uint64_t now_ms) {
+    uint8_t key[16];
+    uint8_t family;
+    if (!addr || rate_limiter_key(addr, key, &family) != 0) return NULL;
+    rate_limiter_entry* entry = rate_limiter_lookup(limiter, key, family);
+    if (entry->bucket.last_ms == 0) entry->bucket.last_ms = now_ms;
+    rate_bucket_refill(&entry->bucket, limiter->rate, limiter->burst, now_ms);
+    return &entry->bucket;
+}
+
+int rate_limiter_allow(rate_limiter* limiter, const struct sockaddr* addr, uint64_t now_ms) {
+    if (rate_limiter_global_wait(limiter, now_ms) != 0) return -1;
+
+    rate_bucket* bucket = rate_limiter_bucket(limiter, addr, now_ms);
+    if (bucket) {
+        if (bucket->tokens < 1000) return -1;
+        bucket->tokens -= 1000;
+    }
+
+    limiter->global.tokens -= 1000;
+    return 0;
+}
+
+uint64_t rate_limiter_wait(rate_limiter* limiter, const struct sockaddr* addr, uint64_t now_ms) {
+    rate_bucket* bucket = rate_limiter_bucket(limiter, addr, now_ms);
+    return bucket ? rate_bucket_wait(bucket, limiter->rate) : 0;
+}
+
+void rate_limiter_charge(rate_limiter* limiter, const struct sockaddr* addr, uint64_t cost, uint64_t now_ms) {
+    rate_bucket* bucket = rate_limiter_bucket(limiter, addr, now_ms);
+    if (bucket) bucket->tokens -= (int64_t)cost;
+}
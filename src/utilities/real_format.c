@@ -0,0 +1,262 @@
+#include "utilities/real_format.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// A double as f * 2^e, f of 64 bits
+typedef struct {
+    uint64_t f;
+    int e;
+} real_format_fp;
+
+#define REAL_FORMAT_HIDDEN_BIT 0x0010000000000000ull
+#define REAL_FORMAT_SIGNIFICAND 0x000FFFFFFFFFFFFFull
+
+// 10^k normalized, for k = -348, -340, ... 340, rounded to the nearest
+static const real_format_fp real_format_powers[] = {
+    {0xFA8FD5A0081C0288ull, -1220}, {0xBAAEE17FA23EBF76ull, -1193}, {0x8B16FB203055AC76ull, -1166},
+    {0xCF42894A5DCE35EAull, -1140}, {0x9A6BB0AA55653B2Dull, -1113}, {0xE61ACF033D1A45DFull, -1087},
+    {0xAB70FE17C79AC6CAull, -1060}, {0xFF77B1FCBEBCDC4Full, -1034}, {0xBE5691EF416BD60Cull, -1007},
+    {0x8DD01FAD907FFC3Cull, -980}, {0xD3515C2831559A83ull, -954}, {0x9D71AC8FADA6C9B5ull, -927},
+    {0xEA9C227723EE8BCBull, -901}, {0xAECC49914078536Dull, -874}, {0x823C12795DB6CE57ull, -847},
+    {0xC21094364DFB5637ull, -821}, {0x9096EA6F3848984Full, -794}, {0xD77485CB25823AC7ull, -768},
+    {0xA086CFCD97BF97F4ull, -741}, {0xEF340A98172AACE5ull, -715}, {0xB23867FB2A35B28Eull, -688},
+    {0x84C8D4DFD2C63F3Bull, -661}, {0xC5DD44271AD3CDBAull, -635}, {0x936B9FCEBB25C996ull, -608},
+    {0xDBAC6C247D62A584ull, -582}, {0xA3AB66580D5FDAF6ull, -555}, {0xF3E2F893DEC3F126ull, -529},
+    {0xB5B5ADA8AAFF80B8ull, -502}, {0x87625F056C7C4A8Bull, -475}, {0xC9BCFF6034C13053ull, -449},
+    {0x964E858C91BA2655ull, -422}, {0xDFF9772470297EBDull, -396}, {0xA6DFBD9FB8E5B88Full, -369},
+    {0xF8A95FCF88747D94ull, -343}, {0xB94470938FA89BCFull, -316}, {0x8A08F0F8BF0F156Bull, -289},
+    {0xCDB02555653131B6ull, -263}, {0x993FE2C6D07B7FACull, -236}, {0xE45C10C42A2B3B06ull, -210},
+    {0xAA242499697392D3ull, -183}, {0xFD87B5F28300CA0Eull, -157}, {0xBCE5086492111AEBull, -130},
+    {0x8CBCCC096F5088CCull, -103}, {0xD1B71758E219652Cull, -77}, {0x9C40000000000000ull, -50},
+    {0xE8D4A51000000000ull, -24}, {0xAD78EBC5AC620000ull, 3}, {0x813F3978F8940984ull, 30},
+    {0xC097CE7BC90715B3ull, 56}, {0x8F7E32CE7BEA5C70ull, 83}, {0xD5D238A4ABE98068ull, 109},
+    {0x9F4F2726179A2245ull, 136}, {0xED63A231D4C4FB27ull, 162}, {0xB0DE65388CC8ADA8ull, 189},
+    {0x83C7088E1AAB65DBull, 216}, {0xC45D1DF942711D9Aull, 242}, {0x924D692CA61BE758ull, 269},
+    {0xDA01EE641A708DEAull, 295}, {0xA26DA3999AEF774Aull, 322}, {0xF209787BB47D6B85ull, 348},
+    {0xB454E4A179DD1877ull, 375}, {0x865B86925B9BC5C2ull, 402}, {0xC83553C5C8965D3Dull, 428},
+    {0x952AB45CFA97A0B3ull, 455}, {0xDE469FBD99A05FE3ull, 481}, {0xA59BC234DB398C25ull, 508},
+    {0xF6C69A72A3989F5Cull, 534}, {0xB7DCBF5354E9BECEull, 561}, {0x88FCF317F22241E2ull, 588},
+    {0xCC20CE9BD35C78A5ull, 614}, {0x98165AF37B2153DFull, 641}, {0xE2A0B5DC971F303Aull, 667},
+    {0xA8D9D1535CE3B396ull, 694}, {0xFB9B7CD9A4A7443Cull, 720}, {0xBB764C4CA7A44410ull, 747},
+    {0x8BAB8EEFB6409C1Aull, 774}, {0xD01FEF10A657842Cull, 800}, {0x9B10A4E5E9913129ull, 827},
+    {0xE7109BFBA19C0C9Dull, 853}, {0xAC2820D9623BF429ull, 880}, {0x80444B5E7AA7CF85ull, 907},
+    {0xBF21E44003ACDD2Dull, 933}, {0x8E679C2F5E44FF8Full, 960}, {0xD433179D9C8CB841ull, 986},
+    {0x9E19DB92B4E31BA9ull, 1013}, {0xEB96BF6EBADF77D9ull, 1039}, {0xAF87023B9BF0EE6Bull, 1066},
+};
+
+static const uint64_t real_format_pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+    10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+    100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull,
+};
+
+static real_format_fp real_format_multiply(real_format_fp a, real_format_fp b) {
+    unsigned __int128 product = (unsigned __int128)a.f * b.f;
+    uint64_t high = (uint64_t)(product >> 64);
+    // Rounded on the highest bit dropped
+    high += (uint64_t)product >> 63;
+    return (real_format_fp){high, a.e + b.e + 64};
+}
+
+static real_format_fp real_format_normalize(real_format_fp x) {
+    int shift = __builtin_clzll(x.f);
+    return (real_format_fp){x.f << shift, x.e - shift};
+}
+
+// The boundaries halfway to the neighbouring doubles, on the same exponent
+static void real_format_boundaries(real_format_fp v, real_format_fp* minus, real_format_fp* plus) {
+    real_format_fp high = {(v.f << 1) + 1, v.e - 1};
+    while (!(high.f & (REAL_FORMAT_HIDDEN_BIT << 1))) {
+        high.f <<= 1;
+        high.e--;
+    }
+    high.f <<= 64 - 52 - 2;
+    high.e -= 64 - 52 - 2;
+    // The gap below a power of two is half the one above
+    real_format_fp low = v.f == REAL_FORMAT_HIDDEN_BIT ? (real_format_fp){(v.f << 2) - 1, v.e - 2}
+                                                       : (real_format_fp){(v.f << 1) - 1, v.e - 1};
+    low.f <<= low.e - high.e;
+    low.e = high.e;
+    *minus = low;
+    *plus = high;
+}
+
+// The cached power c that brings a number of exponent e into [-60, -32]
+// once multiplied, 10^-k is c
+static real_format_fp real_format_cached_power(int e, int* k) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ceiling = (int)dk;
+    if (dk - ceiling > 0.0) ceiling++;
+    int index = (ceiling >> 3) + 1;
+    *k = -(-348 + index * 8);
+    return real_format_powers[index];
+}
+
+// Moves the last digit down while that brings it closer to w and stays in range
+static void real_format_round(char* digits, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa,
+                              uint64_t wp_w) {
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int real_format_count_digits(uint32_t n) {
+    int count = 1;
+    while (count < 10 && n >= real_format_pow10[count]) count++;
+    return count;
+}
+
+// The shortest digits in (Mp - delta, Mp] closest to W, *k their exponent
+static int real_format_digits(real_format_fp w, real_format_fp mp, uint64_t delta, char* digits, int* k) {
+    real_format_fp one = {1ull << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = real_format_count_digits(p1);
+    int length = 0;
+
+    while (kappa > 0) {
+        uint32_t divisor = (uint32_t)real_format_pow10[kappa - 1];
+        uint32_t d = p1 / divisor;
+        p1 %= divisor;
+        if (d || length) digits[length++] = (char)('0' + d);
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *k += kappa;
+            real_format_round(digits, length, delta, rest, real_format_pow10[kappa] << -one.e, wp_w);
+            return length;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || length) digits[length++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            int index = -kappa;
+            real_format_round(digits, length, delta, p2, one.f, index < 20 ? wp_w * real_format_pow10[index] : 0);
+            return length;
+        }
+    }
+}
+
+// Digits of positive, finite value and their exponent: value is digits * 10^k
+static int real_format_grisu2(double value, char* digits, int* k) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased = (int)(bits >> 52 & 0x7FF);
+    uint64_t significand = bits & REAL_FORMAT_SIGNIFICAND;
+    real_format_fp v = biased ? (real_format_fp){significand | REAL_FORMAT_HIDDEN_BIT, biased - 1075}
+                              : (real_format_fp){significand, -1074};
+
+    real_format_fp minus, plus;
+    real_format_boundaries(v, &minus, &plus);
+    real_format_fp c = real_format_cached_power(plus.e, k);
+    real_format_fp w = real_format_multiply(real_format_normalize(v), c);
+    real_format_fp wp = real_format_multiply(plus, c);
+    real_format_fp wm = real_format_multiply(minus, c);
+    // One unit in from each end, what the rounding of the products may be off
+    wm.f++;
+    wp.f--;
+    return real_format_digits(w, wp, wp.f - wm.f, digits, k);
+}
+
+static int real_format_exponent(char* out, int exponent) {
+    int length = 0;
+    out[length++] = 'e';
+    if (exponent < 0) {
+        out[length++] = '-';
+        exponent = -exponent;
+    }
+    if (exponent >= 100) out[length++] = (char)('0' + exponent / 100);
+    if (exponent >= 10) out[length++] = (char)('0' + exponent / 10 % 10);
+    out[length++] = (char)('0' + exponent % 10);
+    return length;
+}
+
+// length digits d1d2... times 10^k laid out into out
+static int real_format_layout(const char* digits, int length, int k, char* out) {
+    // Where the decimal point goes, counted from the first digit
+    int point = length + k;
+    int n = 0;
+    if (point - 1 < -4 || point - 1 >= 17) {
+        out[n++] = digits[0];
+        if (length > 1) {
+            out[n++] = '.';
+            memcpy(out + n, digits + 1, (size_t)length - 1);
+            n += length - 1;
+        }
+        return n + real_format_exponent(out + n, point - 1);
+    }
+    if (point <= 0) {
+        out[n++] = '0';
+        out[n++] = '.';
+        memset(out + n, '0', (size_t)-point);
+        n += -point;
+        memcpy(out + n, digits, (size_t)length);
+        return n + length;
+    }
+    if (point >= length) {
+        memcpy(out + n, digits, (size_t)length);
+        n += length;
+        memset(out + n, '0', (size_t)(point - length));
+        n += point - length;
+        out[n++] = '.';
+        out[n++] = '0';
+        return n;
+    }
+    memcpy(out + n, digits, (size_t)point);
+    n += point;
+    out[n++] = '.';
+    memcpy(out + n, digits + point, (size_t)(length - point));
+    return n + length - point;
+}
+
+int real_format(double value, char* out) {
+    int n = 0;
+    if (signbit(value)) {
+        out[n++] = '-';
+        value = -value;
+    }
+    if (value == 0.0) {
+        memcpy(out + n, "0.0", 4);
+        return n + 3;
+    }
+
+    char digits[20];
+    int length;
+    int k = 0;
+
+    // A whole number of millionths: dividing back is correctly rounded, so
+    // when that gives value again its digits are the shortest that read back
+    long long scaled = value < 1e9 ? llround(value * 1e6) : 0;
+    if (scaled > 0 && (double)scaled / 1e6 == value) {
+        length = 0;
+        char reversed[20];
+        while (scaled) {
+            reversed[length++] = (char)('0' + scaled % 10);
+            scaled /= 10;
+        }
+        k = -6;
+        while (reversed[0] == '0') {
+            memmove(reversed, reversed + 1, (size_t)--length);
+            k++;
+        }
+        for (int i = 0; i < length; i++) digits[i] = reversed[length - 1 - i];
+    } else {
+        length = real_format_grisu2(value, digits, &k);
+    }
+
+    n += real_format_layout(digits, length, k, out + n);
+    out[n] = '\0';
+    return n;
+}
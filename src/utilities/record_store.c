@@ -0,0 +1,484 @@
+#include "utilities/record_store.h"
+#include "utilities/huge_pages.h"
+#include "utilities/logger.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define RECORD_STORE_MAGIC 0x4f545352u /* "RSTO" */
+#define RECORD_STORE_ENTRY_MAGIC 0x52544e45u /* "ENTR" */
+#define RECORD_STORE_VERSION 1
+#define RECORD_STORE_HEADER_SIZE 16
+// The file grows by at least this much at a time
+#define RECORD_STORE_GROW_BYTES (1 << 20)
+#define RECORD_STORE_INDEX_MIN 64
+// Set in the slot of an entry that removes key/slot instead of storing it
+#define RECORD_STORE_TOMBSTONE 0x80000000u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t length;
+    uint64_t key;
+    int64_t stamp;
+    uint32_t slot;
+    // crc32 of this header with checksum 0, then the value
+    uint32_t checksum;
+} record_store_entry;
+
+typedef struct {
+    uint64_t key;
+    size_t offset;
+    uint8_t slot;
+    uint8_t used;
+} record_store_index_slot;
+
+// One generation of the log file and its mapping, unmapped and closed once
+// neither the store nor a view holds it any more
+struct record_store_file {
+    int fd;
+    uint8_t* map;
+    size_t capacity;
+    int refs;
+};
+
+struct record_store {
+    pthread_rwlock_t lock;
+    char* path;
+    record_store_file* file;
+    // file's, for short
+    int fd;
+    uint8_t* map;
+    size_t capacity;
+    // file size, the log ends at tail and is zero after it
+    size_t size;
+    size_t tail;
+    // bytes of the entries the index points at
+    size_t live;
+    time_t retain;
+    // puts and removes fail, nothing is compacted, see record_store_freeze
+    int frozen;
+
+    record_store_index_slot* index;
+    size_t index_capacity;
+    size_t index_count;
+};
+
+static size_t record_store_entry_size(size_t length) {
+    return (sizeof(record_store_entry) + length + 7) & ~(size_t)7;
+}
+
+static uint32_t record_store_checksum(const record_store_entry* header, const uint8_t* data) {
+    record_store_entry copy = *header;
+    copy.checksum = 0;
+    uLong crc = crc32(0L, (const Bytef*)&copy, sizeof(copy));
+    return (uint32_t)crc32(crc, (const Bytef*)data, header->length);
+}
+
+static size_t record_store_hash(uint64_t key, uint8_t slot) {
+    // splitmix64 finalizer
+    key ^= (uint64_t)slot * 0x9e3779b97f4a7c15ULL;
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t)key;
+}
+
+static record_store_index_slot* record_store_find(record_store* store, uint64_t key, uint8_t slot) {
+    if (!store->index) return NULL;
+    size_t mask = store->index_capacity - 1;
+    for (size_t i = record_store_hash(key, slot) & mask;; i = (i + 1) & mask) {
+        record_store_index_slot* entry = &store->index[i];
+        if (!entry->used) return NULL;
+        if (entry->key == key && entry->slot == slot) return entry;
+    }
+}
+
+static int record_store_index_grow(record_store* store) {
+    size_t capacity = store->index_capacity ? store->index_capacity * 2 : RECORD_STORE_INDEX_MIN;
+    // Probed at random on every lookup, huge pages spare the TLB
+    record_store_index_slot* index =
+        (record_store_index_slot*)huge_pages_alloc(store->path, capacity * sizeof(record_store_index_slot));
+    if (!index) return -1;
+
+    for (size_t i = 0; i < store->index_capacity; i++) {
+        record_store_index_slot* entry = &store->index[i];
+        if (!entry->used) continue;
+        size_t j = record_store_hash(entry->key, entry->slot) & (capacity - 1);
+        while (index[j].used) j = (j + 1) & (capacity - 1);
+        index[j] = *entry;
+    }
+    huge_pages_free(store->index);
+    store->index = index;
+    store->index_capacity = capacity;
+    return 0;
+}
+
+// Points key/slot at the entry at offset, the one it replaces stops being live
+static int record_store_index_set(record_store* store, uint64_t key, uint8_t slot, size_t offset) {
+    record_store_index_slot* entry = record_store_find(store, key, slot);
+    if (!entry) {
+        if ((store->index_count + 1) * 4 > store->index_capacity * 3 && record_store_index_grow(store) != 0) return -1;
+        size_t mask = store->index_capacity - 1;
+        size_t i = record_store_hash(key, slot) & mask;
+        while (store->index[i].used) i = (i + 1) & mask;
+        entry = &store->index[i];
+        entry->key = key;
+        entry->slot = slot;
+        entry->used = 1;
+        store->index_count++;
+    } else {
+        const record_store_entry* old = (const record_store_entry*)(store->map + entry->offset);
+        store->live -= record_store_entry_size(old->length);
+    }
+    const record_store_entry* header = (const record_store_entry*)(store->map + offset);
+    entry->offset = offset;
+    store->live += record_store_entry_size(header->length);
+    return 0;
+}
+
+// Drops key/slot from the index, later entries of the same probe run move up
+static void record_store_index_delete(record_store* store, uint64_t key, uint8_t slot) {
+    record_store_index_slot* entry = record_store_find(store, key, slot);
+    if (!entry) return;
+    const record_store_entry* old = (const record_store_entry*)(store->map + entry->offset);
+    store->live -= record_store_entry_size(old->length);
+    store->index_count--;
+
+    size_t mask = store->index_capacity - 1;
+    size_t hole = (size_t)(entry - store->index);
+    for (size_t i = (hole + 1) & mask; store->index[i].used; i = (i + 1) & mask) {
+        size_t home = record_store_hash(store->index[i].key, store->index[i].slot) & mask;
+        // Stays if its home lies cyclically in (hole, i]
+        if (((i - home) & mask) < ((i - hole) & mask)) continue;
+        store->index[hole] = store->index[i];
+        hole = i;
+    }
+    store->index[hole].used = 0;
+}
+
+static void record_store_file_release(record_store_file* file) {
+    if (__atomic_sub_fetch(&file->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+    if (file->map) munmap(file->map, file->capacity);
+    close(file->fd);
+    free(file);
+}
+
+static void record_store_unmap(record_store* store) {
+    if (store->file) {
+        record_store_file_release(store->file);
+    } else if (store->fd >= 0) {
+        close(store->fd);
+    }
+    huge_pages_free(store->index);
+    store->file = NULL;
+    store->map = NULL;
+    store->fd = -1;
+    store->index = NULL;
+    store->index_capacity = 0;
+    store->index_count = 0;
+    store->size = 0;
+    store->tail = 0;
+    store->live = 0;
+}
+
+// Maps path and indexes its entries in one sequential pass
+static int record_store_load(record_store* store) {
+    store->fd = open(store->path, O_RDWR | O_CREAT, 0644);
+    if (store->fd < 0) return -1;
+
+    struct stat file_stat;
+    if (fstat(store->fd, &file_stat) != 0) return -1;
+    store->size = (size_t)file_stat.st_size;
+    if (store->size > store->capacity) return -1;
+
+    uint32_t header[4];
+    if (store->size >= RECORD_STORE_HEADER_SIZE && pread(store->fd, header, sizeof(header), 0) == sizeof(header) &&
+        (header[0] != RECORD_STORE_MAGIC || header[1] != RECORD_STORE_VERSION)) {
+        // Another format, the cache starts over
+        store->size = 0;
+    }
+    if (store->size < RECORD_STORE_HEADER_SIZE) {
+        uint32_t fresh[4] = {RECORD_STORE_MAGIC, RECORD_STORE_VERSION, 0, 0};
+        if (ftruncate(store->fd, 0) != 0 || pwrite(store->fd, fresh, sizeof(fresh), 0) != sizeof(fresh)) return -1;
+        store->size = RECORD_STORE_HEADER_SIZE;
+    }
+
+    store->map = (uint8_t*)mmap(NULL, store->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (store->map == MAP_FAILED) {
+        store->map = NULL;
+        return -1;
+    }
+    store->file = (record_store_file*)malloc(sizeof(record_store_file));
+    if (!store->file) {
+        munmap(store->map, store->capacity);
+        store->map = NULL;
+        return -1;
+    }
+    store->file->fd = store->fd;
+    store->file->map = store->map;
+    store->file->capacity = store->capacity;
+    store->file->refs = 1;
+    madvise(store->map, store->size, MADV_SEQUENTIAL);
+
+    size_t offset = RECORD_STORE_HEADER_SIZE;
+    while (offset + sizeof(record_store_entry) <= store->size) {
+        const record_store_entry* entry = (const record_store_entry*)(store->map + offset);
+        if (entry->magic != RECORD_STORE_ENTRY_MAGIC || (entry->slot & ~RECORD_STORE_TOMBSTONE) > UINT8_MAX ||
+            entry->length > store->size - offset - sizeof(record_store_entry)) {
+            break;
+        }
+        if (record_store_checksum(entry, (const uint8_t*)(entry + 1)) != entry->checksum) break;
+        if (entry->slot & RECORD_STORE_TOMBSTONE) {
+            record_store_index_delete(store, entry->key, (uint8_t)entry->slot);
+        } else if (record_store_index_set(store, entry->key, (uint8_t)entry->slot, offset) != 0) {
+            return -1;
+        }
+        offset += record_store_entry_size(entry->length);
+    }
+    store->tail = offset < store->size ? offset : store->size;
+    // Whatever a crash left after the log is cleared so the next scan stops there
+    if (store->tail < store->size) memset(store->map + store->tail, 0, store->size - store->tail);
+
+    madvise(store->map, store->size, MADV_RANDOM);
+    return 0;
+}
+
+// Writes the live, retained entries to a new log and swaps it in
+static int record_store_compact(record_store* store) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.compact", store->path);
+    FILE* file = fopen(path, "wb");
+    if (!file) return -1;
+
+    uint32_t header[4] = {RECORD_STORE_MAGIC, RECORD_STORE_VERSION, 0, 0};
+    int result = fwrite(header, sizeof(header), 1, file) == 1 ? 0 : -1;
+    time_t oldest = time(NULL) - store->retain;
+    static const uint8_t padding[8] = {0};
+    for (size_t i = 0; i < store->index_capacity && result == 0; i++) {
+        if (!store->index[i].used) continue;
+        const record_store_entry* entry = (const record_store_entry*)(store->map + store->index[i].offset);
+        if (entry->stamp < oldest) continue;
+        size_t size = record_store_entry_size(entry->length);
+        size_t pad = size - sizeof(record_store_entry) - entry->length;
+        if (fwrite(entry, sizeof(record_store_entry) + entry->length, 1, file) != 1 ||
+            (pad && fwrite(padding, pad, 1, file) != 1)) {
+            result = -1;
+        }
+    }
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) result = -1;
+    if (fclose(file) != 0) result = -1;
+    if (result == 0 && rename(path, store->path) != 0) result = -1;
+    if (result != 0) {
+        unlink(path);
+        return -1;
+    }
+
+    size_t before = store->tail;
+    record_store_unmap(store);
+    if (record_store_load(store) != 0) {
+        record_store_unmap(store);
+        return -1;
+    }
+    LOG_INFO("RecordStore: Compacted %s from %zu to %zu bytes", store->path, before, store->tail);
+    return 0;
+}
+
+int record_store_open(record_store** store, const char* path, size_t capacity, time_t retain) {
+    if (!store || !path) return -1;
+    record_store* opened = (record_store*)calloc(1, sizeof(record_store));
+    if (!opened) return -1;
+    opened->fd = -1;
+    opened->capacity = capacity;
+    opened->retain = retain;
+    opened->path = strdup(path);
+    if (!opened->path || pthread_rwlock_init(&opened->lock, NULL) != 0) {
+        free(opened->path);
+        free(opened);
+        return -1;
+    }
+    if (record_store_load(opened) != 0) {
+        record_store_close(&opened);
+        return -1;
+    }
+    // A restart is the time to drop what expired meanwhile
+    if (opened->tail > RECORD_STORE_MIN_COMPACT_BYTES) record_store_compact(opened);
+    *store = opened;
+    return 0;
+}
+
+void record_store_close(record_store** store) {
+    if (!store || !*store) return;
+    record_store_unmap(*store);
+    pthread_rwlock_destroy(&(*store)->lock);
+    free((*store)->path);
+    free(*store);
+    *store = NULL;
+}
+
+int record_store_stat(record_store* store, uint64_t key, uint8_t slot, time_t* stamp, size_t* length) {
+    if (!store) return -1;
+    pthread_rwlock_rdlock(&store->lock);
+    record_store_index_slot* entry = record_store_find(store, key, slot);
+    if (entry) {
+        const record_store_entry* header = (const record_store_entry*)(store->map + entry->offset);
+        if (stamp) *stamp = (time_t)header->stamp;
+        if (length) *length = header->length;
+    }
+    pthread_rwlock_unlock(&store->lock);
+    return entry ? 0 : -1;
+}
+
+int record_store_get(record_store* store, uint64_t key, uint8_t slot, uint8_t** data, size_t* length, time_t* stamp) {
+    if (!store || !data || !length) return -1;
+    int result = -1;
+    pthread_rwlock_rdlock(&store->lock);
+    record_store_index_slot* entry = record_store_find(store, key, slot);
+    if (entry) {
+        const record_store_entry* header = (const record_store_entry*)(store->map + entry->offset);
+        *data = (uint8_t*)malloc(header->length ? header->length : 1);
+        if (*data) {
+            memcpy(*data, header + 1, header->length);
+            *length = header->length;
+            if (stamp) *stamp = (time_t)header->stamp;
+            result = 0;
+        }
+    }
+    pthread_rwlock_unlock(&store->lock);
+    return result;
+}
+
+int record_store_view_get(record_store* store, uint64_t key, uint8_t slot, record_store_view* view) {
+    if (!store || !view) return -1;
+    int result = -1;
+    pthread_rwlock_rdlock(&store->lock);
+    record_store_index_slot* entry = record_store_find(store, key, slot);
+    if (entry) {
+        const record_store_entry* header = (const record_store_entry*)(store->map + entry->offset);
+        __atomic_add_fetch(&store->file->refs, 1, __ATOMIC_RELAXED);
+        view->file = store->file;
+        view->data = (const uint8_t*)(header + 1);
+        view->length = header->length;
+        view->stamp = (time_t)header->stamp;
+        view->fd = store->fd;
+        view->offset = (off_t)(entry->offset + sizeof(record_store_entry));
+        result = 0;
+    }
+    pthread_rwlock_unlock(&store->lock);
+    return result;
+}
+
+void record_store_view_release(record_store_view* view) {
+    if (!view || !view->file) return;
+    record_store_file_release(view->file);
+    memset(view, 0, sizeof(*view));
+    view->fd = -1;
+}
+
+void record_store_each(record_store* store, uint8_t slot,
+                       void (*each)(uint64_t key, time_t stamp, size_t length, void* context), void* context) {
+    if (!store || !each) return;
+    pthread_rwlock_rdlock(&store->lock);
+    for (size_t i = 0; i < store->index_capacity; i++) {
+        const record_store_index_slot* entry = &store->index[i];
+        if (!entry->used || entry->slot != slot) continue;
+        const record_store_entry* header = (const record_store_entry*)(store->map + entry->offset);
+        each(entry->key, (time_t)header->stamp, header->length, context);
+    }
+    pthread_rwlock_unlock(&store->lock);
+}
+
+// The entry appended at the tail, under the write lock. NULL if it does not
+// fit even after compaction.
+static record_store_entry* record_store_append(record_store* store, uint64_t key, uint32_t slot, const uint8_t* data,
+                                               size_t length, time_t stamp) {
+    size_t size = record_store_entry_size(length);
+    if (store->map && store->tail + size > store->capacity) record_store_compact(store);
+    if (!store->map || store->tail + size > store->capacity) return NULL;
+    if (store->tail + size > store->size) {
+        size_t grown = store->tail + size;
+        if (grown < store->size + RECORD_STORE_GROW_BYTES) grown = store->size + RECORD_STORE_GROW_BYTES;
+        if (grown > store->capacity) grown = store->capacity;
+        if (ftruncate(store->fd, (off_t)grown) != 0) return NULL;
+        store->size = grown;
+    }
+
+    record_store_entry* entry = (record_store_entry*)(store->map + store->tail);
+    entry->magic = RECORD_STORE_ENTRY_MAGIC;
+    entry->length = (uint32_t)length;
+    entry->key = key;
+    entry->stamp = (int64_t)stamp;
+    entry->slot = slot;
+    if (length) memcpy(entry + 1, data, length);
+    entry->checksum = record_store_checksum(entry, (const uint8_t*)(entry + 1));
+    return entry;
+}
+
+// Mostly superseded or removed entries, rewrite what is left
+static void record_store_maybe_compact(record_store* store) {
+    if (!store->frozen && store->tail > RECORD_STORE_MIN_COMPACT_BYTES && store->tail - store->live > store->live) {
+        record_store_compact(store);
+    }
+}
+
+int record_store_put(record_store* store, uint64_t key, uint8_t slot, const uint8_t* data, size_t length, time_t stamp) {
+    if (!store || (!data && length) || length > UINT32_MAX) return -1;
+
+    pthread_rwlock_wrlock(&store->lock);
+    if (store->frozen) {
+        pthread_rwlock_unlock(&store->lock);
+        return -1;
+    }
+    record_store_entry* entry = record_store_append(store, key, slot, data, length, stamp);
+    int result = entry ? record_store_index_set(store, key, slot, store->tail) : -1;
+    if (result == 0) {
+        store->tail += record_store_entry_size(length);
+    } else if (entry) {
+        memset(entry, 0, sizeof(record_store_entry));
+    }
+    record_store_maybe_compact(store);
+    pthread_rwlock_unlock(&store->lock);
+    return result;
+}
+
+int record_store_remove(record_store* store, uint64_t key, uint8_t slot) {
+    if (!store) return -1;
+
+    pthread_rwlock_wrlock(&store->lock);
+    int result = -1;
+    if (!store->frozen && record_store_find(store, key, slot)) {
+        // Logged so the value stays gone after a restart
+        record_store_entry* entry = record_store_append(store, key, slot | RECORD_STORE_TOMBSTONE, NULL, 0, time(NULL));
+        if (entry) {
+            store->tail += record_store_entry_size(0);
+            record_store_index_delete(store, key, slot);
+            result = 0;
+        }
+    }
+    record_store_maybe_compact(store);
+    pthread_rwlock_unlock(&store->lock);
+    return result;
+}
+
+void record_store_freeze(record_store* store, int frozen) {
+    if (!store) return;
+    pthread_rwlock_wrlock(&store->lock);
+    store->frozen = frozen;
+    pthread_rwlock_unlock(&store->lock);
+}
+
+void record_store_usage(record_store* store, size_t* live, size_t* count) {
+    if (!store) return;
+    pthread_rwlock_rdlock(&store->lock);
+    if (live) *live = store->live;
+    if (count) *count = store->index_count;
+    pthread_rwlock_unlock(&store->lock);
+}
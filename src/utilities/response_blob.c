@@ -0,0 +1,72 @@
+#include "utilities/response_blob.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/mem_account.h"
+#include "utilities/shared_blob.h"
+
+response_blob* response_blob_new(time_t last_modified) {
+    response_blob* blob = (response_blob*)calloc(1, sizeof(response_blob));
+    if (!blob) return NULL;
+    mem_account_alloc(MEM_TAG_CACHES, sizeof(response_blob));
+    blob->references = 1;
+    blob->last_modified = last_modified;
+    return blob;
+}
+
+static void response_blob_format_headers(response_blob* blob, compress_encoding encoding) {
+    char* out = blob->headers[encoding];
+    size_t length = 0;
+    if (blob->etags[encoding][0]) {
+        length += snprintf(out + length, RESPONSE_BLOB_HEADERS_SIZE - length, "ETag: %s\r\n", blob->etags[encoding]);
+    }
+    if (blob->last_modified != 0) {
+        char date[HTTP_DATE_SIZE];
+        http_date_format(date, blob->last_modified);
+        length += snprintf(out + length, RESPONSE_BLOB_HEADERS_SIZE - length, "Last-Modified: %s\r\n", date);
+    }
+    if (encoding != COMPRESS_IDENTITY) {
+        snprintf(out + length, RESPONSE_BLOB_HEADERS_SIZE - length, "Content-Encoding: %s\r\n",
+                 compress_encoding_name(encoding));
+    }
+}
+
+response_blob* response_blob_set(response_blob* blob, compress_encoding encoding, const uint8_t* body, size_t length,
+                                 const char* etag) {
+    response_blob* target = blob;
+    if (__atomic_load_n(&blob->references, __ATOMIC_ACQUIRE) > 1) {
+        // Responses still send this one as it is
+        target = (response_blob*)malloc(sizeof(response_blob));
+        if (!target) return NULL;
+        mem_account_alloc(MEM_TAG_CACHES, sizeof(response_blob));
+        memcpy(target, blob, sizeof(response_blob));
+        target->references = 1;
+        for (int i = 0; i < COMPRESS_ENCODINGS; i++) {
+            if (target->bodies[i]) shared_blob_retain(target->bodies[i]);
+        }
+        response_blob_release(blob);
+    }
+
+    shared_blob_retain(body);
+    shared_blob_release(target->bodies[encoding]);
+    target->bodies[encoding] = body;
+    target->lengths[encoding] = length;
+    snprintf(target->etags[encoding], HTTP_ETAG_SIZE, "%s", etag ? etag : "");
+    response_blob_format_headers(target, encoding);
+    return target;
+}
+
+void response_blob_retain(const response_blob* blob) {
+    __atomic_add_fetch(&((response_blob*)blob)->references, 1, __ATOMIC_RELAXED);
+}
+
+void response_blob_release(const response_blob* blob) {
+    if (!blob) return;
+    response_blob* owned = (response_blob*)blob;
+    if (__atomic_sub_fetch(&owned->references, 1, __ATOMIC_ACQ_REL) != 0) return;
+    for (int i = 0; i < COMPRESS_ENCODINGS; i++) shared_blob_release(owned->bodies[i]);
+    mem_account_free(MEM_TAG_CACHES, sizeof(response_blob));
+    free(owned);
+}
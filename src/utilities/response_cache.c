@@ -0,0 +1,211 @@
+#include "utilities/response_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/mem_account.h"
+#include "utilities/shared_blob.h"
+
+static uint32_t response_cache_bucket(const response_cache* cache, uint64_t key) {
+    // splitmix64 finalizer, quantized coordinates differ in few low bits
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (uint32_t)key & (uint32_t)(cache->capacity - 1);
+}
+
+static void response_cache_clear(response_cache* cache, response_cache_entry* entry) {
+    if (!entry->blob) return;
+    for (int i = 0; i < COMPRESS_ENCODINGS; i++) cache->stats.bytes -= entry->blob->lengths[i];
+    response_blob_release(entry->blob);
+    entry->blob = NULL;
+}
+
+static void response_cache_remove(response_cache* cache, int index) {
+    response_cache_entry* entry = &cache->entries[index];
+    int* link = &cache->buckets[response_cache_bucket(cache, entry->key)];
+    while (*link != -1 && *link != index) link = &cache->entries[*link].next;
+    if (*link != -1) *link = entry->next;
+    response_cache_clear(cache, entry);
+    cache->stats.entries--;
+    entry->used = 0;
+    entry->referenced = 0;
+    entry->hits = 0;
+    entry->next = -1;
+}
+
+// A free slot, or the first one the hand finds unreferenced (still in use)
+static int response_cache_victim(response_cache* cache) {
+    for (;;) {
+        int index = cache->hand;
+        response_cache_entry* entry = &cache->entries[index];
+        cache->hand = (cache->hand + 1) & (cache->capacity - 1);
+        if (!entry->used || !entry->referenced) return index;
+        entry->referenced = 0;
+    }
+}
+
+// Evicts entries other than keep until the bodies fit max_bytes
+static void response_cache_shrink(response_cache* cache, int keep) {
+    // Two rounds clear every reference bit, after that all are candidates
+    for (int step = 0; step < cache->capacity * 2 + 1 && cache->stats.bytes > cache->max_bytes; step++) {
+        int index = cache->hand;
+        response_cache_entry* entry = &cache->entries[index];
+        cache->hand = (cache->hand + 1) & (cache->capacity - 1);
+        if (!entry->used || index == keep) continue;
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+        response_cache_remove(cache, index);
+        cache->stats.evictions++;
+    }
+}
+
+int response_cache_init(response_cache* cache, int capacity, size_t max_bytes, const frequency_sketch* admission) {
+    int size = 1;
+    while (size < capacity) size <<= 1;
+
+    cache->entries = (response_cache_entry*)calloc(size, sizeof(response_cache_entry));
+    cache->buckets = (int*)malloc(size * sizeof(int));
+    if (!cache->entries || !cache->buckets) {
+        free(cache->entries);
+        free(cache->buckets);
+        cache->entries = NULL;
+        cache->buckets = NULL;
+        return -1;
+    }
+    // The table counts as one object, the blobs it holds as theirs
+    mem_account_alloc(MEM_TAG_CACHES, size * (sizeof(response_cache_entry) + sizeof(int)));
+    for (int i = 0; i < size; i++) {
+        cache->buckets[i] = -1;
+        cache->entries[i].next = -1;
+    }
+    cache->capacity = size;
+    cache->hand = 0;
+    cache->max_bytes = max_bytes;
+    cache->admission = admission;
+    memset(&cache->stats, 0, sizeof(response_cache_stats));
+    return 0;
+}
+
+void response_cache_dispose(response_cache* cache) {
+    if (!cache->entries) return;
+    for (int i = 0; i < cache->capacity; i++) response_cache_clear(cache, &cache->entries[i]);
+    mem_account_free(MEM_TAG_CACHES, cache->capacity * (sizeof(response_cache_entry) + sizeof(int)));
+    free(cache->entries);
+    free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->capacity = 0;
+}
+
+response_cache_entry* response_cache_find(response_cache* cache, uint64_t key, time_t now) {
+    if (!cache->entries) return NULL;
+
+    int index = cache->buckets[response_cache_bucket(cache, key)];
+    while (index != -1 && cache->entries[index].key != key) index = cache->entries[index].next;
+    if (index == -1) {
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    response_cache_entry* entry = &cache->entries[index];
+    if (now >= entry->expires) {
+        response_cache_remove(cache, index);
+        cache->stats.misses++;
+        return NULL;
+    }
+    entry->referenced = 1;
+    entry->hits++;
+    cache->stats.hits++;
+    return entry;
+}
+
+const response_cache_entry* response_cache_peek(const response_cache* cache, uint64_t key) {
+    if (!cache->entries) return NULL;
+
+    int index = cache->buckets[response_cache_bucket(cache, key)];
+    while (index != -1 && cache->entries[index].key != key) index = cache->entries[index].next;
+    return index == -1 ? NULL : &cache->entries[index];
+}
+
+response_cache_entry* response_cache_insert(response_cache* cache, uint64_t key, time_t last_modified, time_t expires) {
+    if (!cache->entries) return NULL;
+
+    uint32_t bucket = response_cache_bucket(cache, key);
+    int index = cache->buckets[bucket];
+    while (index != -1 && cache->entries[index].key != key) index = cache->entries[index].next;
+
+    response_cache_entry* entry;
+    if (index != -1) {
+        entry = &cache->entries[index];
+        if (entry->last_modified != last_modified) response_cache_clear(cache, entry);
+    } else {
+        index = response_cache_victim(cache);
+        entry = &cache->entries[index];
+        if (entry->used) {
+            // Full, the newcomer has to be asked for more often than what it replaces
+            if (cache->admission &&
+                frequency_sketch_estimate(cache->admission, key) <= frequency_sketch_estimate(cache->admission, entry->key)) {
+                cache->stats.rejections++;
+                return NULL;
+            }
+            response_cache_remove(cache, index);
+            cache->stats.evictions++;
+        }
+        cache->stats.entries++;
+        entry->key = key;
+        entry->used = 1;
+        entry->next = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+    }
+    entry->last_modified = last_modified;
+    entry->expires = expires;
+    entry->referenced = 1;
+    return entry;
+}
+
+int response_cache_set(response_cache* cache, response_cache_entry* entry, compress_encoding encoding,
+                       const uint8_t* data, size_t length, const char* etag) {
+    response_blob* blob = entry->blob ? entry->blob : response_blob_new(entry->last_modified);
+    size_t replaced = entry->blob ? entry->blob->lengths[encoding] : 0;
+    uint8_t* copy = blob ? shared_blob_copy(data, length) : NULL;
+    response_blob* updated = copy ? response_blob_set(blob, encoding, copy, length, etag) : NULL;
+    // The blob holds its own reference now
+    shared_blob_release(copy);
+    if (!updated) {
+        if (blob != entry->blob) response_blob_release(blob);
+        return -1;
+    }
+
+    entry->blob = updated;
+    cache->stats.bytes += length - replaced;
+    if (cache->max_bytes && cache->stats.bytes > cache->max_bytes) {
+        response_cache_shrink(cache, (int)(entry - cache->entries));
+    }
+    return 0;
+}
+
+int response_cache_adopt(response_cache* cache, response_cache_entry* entry, const response_blob* blob) {
+    if (!entry->blob) {
+        response_blob_retain(blob);
+        entry->blob = (response_blob*)blob;
+        for (int i = 0; i < COMPRESS_ENCODINGS; i++) cache->stats.bytes += blob->lengths[i];
+    } else {
+        for (int i = 0; i < COMPRESS_ENCODINGS; i++) {
+            if (!blob->bodies[i] || entry->blob->bodies[i]) continue;
+            response_blob* updated = response_blob_set(entry->blob, (compress_encoding)i, blob->bodies[i],
+                                                       blob->lengths[i], blob->etags[i][0] ? blob->etags[i] : NULL);
+            if (!updated) return -1;
+            entry->blob = updated;
+            cache->stats.bytes += blob->lengths[i];
+        }
+    }
+    if (cache->max_bytes && cache->stats.bytes > cache->max_bytes) {
+        response_cache_shrink(cache, (int)(entry - cache->entries));
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include "utilities/shared_blob.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/mem_account.h"
+
+// In front of the data, sized so the data stays as aligned as malloc's
+typedef union {
+    struct {
+        int references;
+        // what it counts for in MEM_TAG_CACHES
+        size_t size;
+    };
+    max_align_t align;
+} shared_blob_header;
+
+static shared_blob_header* shared_blob_header_of(const uint8_t* blob) {
+    return (shared_blob_header*)(blob - sizeof(shared_blob_header));
+}
+
+uint8_t* shared_blob_alloc(size_t length) {
+    size_t size = sizeof(shared_blob_header) + (length ? length : 1);
+    shared_blob_header* header = (shared_blob_header*)malloc(size);
+    if (!header) return NULL;
+    header->references = 1;
+    header->size = size;
+    mem_account_alloc(MEM_TAG_CACHES, size);
+    return (uint8_t*)(header + 1);
+}
+
+uint8_t* shared_blob_copy(const uint8_t* data, size_t length) {
+    uint8_t* blob = shared_blob_alloc(length);
+    if (blob && length) memcpy(blob, data, length);
+    return blob;
+}
+
+void shared_blob_retain(const uint8_t* blob) {
+    __atomic_add_fetch(&shared_blob_header_of(blob)->references, 1, __ATOMIC_RELAXED);
+}
+
+void shared_blob_release(const uint8_t* blob) {
+    if (!blob) return;
+    shared_blob_header* header = shared_blob_header_of(blob);
+    // The last one sees every write made through the others
+    if (__atomic_sub_fetch(&header->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        mem_account_free(MEM_TAG_CACHES, header->size);
+        free(header);
+    }
+}
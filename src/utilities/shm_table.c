@@ -0,0 +1,188 @@
+#include "utilities/shm_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The lock word: the sequence in the low half, odd while a write is under
+// way, and the pid of the writer in the high half, so a dead writer's
+// buckets can be told apart from those of a live one
+typedef struct {
+    uint64_t lock;
+    uint64_t key;
+    uint32_t length;
+    uint8_t slot;
+    uint8_t used;
+    int64_t stamp;
+    // 0 if it does not expire
+    int64_t expires;
+} shm_table_bucket;
+
+struct shm_table {
+    uint8_t* map;
+    size_t map_size;
+    int entries;
+    size_t value_size;
+    // header and value, rounded up to a cache line
+    size_t stride;
+};
+
+// Made before the fork, a child's copy of the list is never walked
+static shm_table* g_tables[SHM_TABLE_MAX_TABLES];
+
+static shm_table_bucket* shm_table_bucket_of(shm_table* table, uint64_t key, uint8_t slot) {
+    uint64_t hash = (key ^ ((uint64_t)slot << 56)) * 0x9e3779b97f4a7c15ULL;
+    return (shm_table_bucket*)(table->map + ((hash >> 32) % (uint64_t)table->entries) * table->stride);
+}
+
+static uint8_t* shm_table_value_of(shm_table_bucket* bucket) {
+    return (uint8_t*)(bucket + 1);
+}
+
+// The bucket for a write, -1 if someone else writes it
+static int shm_table_lock(shm_table_bucket* bucket, uint32_t* sequence) {
+    uint64_t word = __atomic_load_n(&bucket->lock, __ATOMIC_RELAXED);
+    if (word & 1) return -1;
+    *sequence = (uint32_t)word + 1;
+    uint64_t held = ((uint64_t)(uint32_t)getpid() << 32) | *sequence;
+    if (!__atomic_compare_exchange_n(&bucket->lock, &word, held, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return -1;
+    // The acquire alone lets the bucket's stores go out before the odd
+    // sequence; a reader that sees one of them must see the lock moved
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+static void shm_table_unlock(shm_table_bucket* bucket, uint32_t sequence) {
+    __atomic_store_n(&bucket->lock, (uint64_t)(uint32_t)(sequence + 1), __ATOMIC_RELEASE);
+}
+
+// Under the bucket's lock
+static int shm_table_holds(shm_table_bucket* bucket, uint64_t key, uint8_t slot, time_t now) {
+    return bucket->used && bucket->key == key && bucket->slot == slot && (!bucket->expires || bucket->expires > now);
+}
+
+shm_table* shm_table_open(int entries, size_t value_size) {
+    if (entries < 1 || value_size == 0 || value_size > UINT32_MAX) return NULL;
+    int index = 0;
+    while (index < SHM_TABLE_MAX_TABLES && g_tables[index]) index++;
+    if (index == SHM_TABLE_MAX_TABLES) return NULL;
+
+    shm_table* table = (shm_table*)calloc(1, sizeof(shm_table));
+    if (!table) return NULL;
+    table->entries = entries;
+    table->value_size = value_size;
+    table->stride = (sizeof(shm_table_bucket) + value_size + 63) & ~(size_t)63;
+    table->map_size = table->stride * (size_t)entries;
+    // Zero filled, every bucket starts empty and unlocked; the pages are
+    // only backed once written
+    void* map = mmap(NULL, table->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        free(table);
+        return NULL;
+    }
+    table->map = (uint8_t*)map;
+    g_tables[index] = table;
+    return table;
+}
+
+void shm_table_close(shm_table** table) {
+    if (!table || !*table) return;
+    for (int i = 0; i < SHM_TABLE_MAX_TABLES; i++) {
+        if (g_tables[i] == *table) g_tables[i] = NULL;
+    }
+    munmap((*table)->map, (*table)->map_size);
+    free(*table);
+    *table = NULL;
+}
+
+int shm_table_get(shm_table* table, uint64_t key, uint8_t slot, uint8_t** data, size_t* length, time_t* stamp) {
+    shm_table_bucket* bucket = shm_table_bucket_of(table, key, slot);
+    uint8_t* copy = NULL;
+    size_t capacity = 0;
+    for (int tries = 0; tries < SHM_TABLE_READ_TRIES; tries++) {
+        uint64_t before = __atomic_load_n(&bucket->lock, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        // The header is only trusted once the sequence has not moved, a
+        // write under way could show a key that is not there
+        int used = __atomic_load_n(&bucket->used, __ATOMIC_RELAXED);
+        uint64_t value_key = __atomic_load_n(&bucket->key, __ATOMIC_RELAXED);
+        uint8_t value_slot = __atomic_load_n(&bucket->slot, __ATOMIC_RELAXED);
+        size_t value_length = __atomic_load_n(&bucket->length, __ATOMIC_RELAXED);
+        time_t value_stamp = (time_t)__atomic_load_n(&bucket->stamp, __ATOMIC_RELAXED);
+        time_t expires = (time_t)__atomic_load_n(&bucket->expires, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&bucket->lock, __ATOMIC_RELAXED) != before) continue;
+        if (!used || value_key != key || value_slot != slot) break;
+        if (value_length > table->value_size) continue;
+        if (value_length + 1 > capacity) {
+            free(copy);
+            capacity = value_length + 1;
+            copy = (uint8_t*)malloc(capacity);
+            if (!copy) return -1;
+        }
+        memcpy(copy, shm_table_value_of(bucket), value_length);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&bucket->lock, __ATOMIC_RELAXED) != before) continue;
+
+        if (expires && expires <= time(NULL)) break;
+        *data = copy;
+        *length = value_length;
+        if (stamp) *stamp = value_stamp;
+        return 0;
+    }
+    free(copy);
+    return -1;
+}
+
+int shm_table_put(shm_table* table, uint64_t key, uint8_t slot, const uint8_t* data, size_t length, time_t stamp,
+                  int ttl) {
+    if (length > table->value_size) return -1;
+    shm_table_bucket* bucket = shm_table_bucket_of(table, key, slot);
+    uint32_t sequence = 0;
+    if (shm_table_lock(bucket, &sequence) != 0) return -1;
+    __atomic_store_n(&bucket->used, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->slot, slot, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->length, (uint32_t)length, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->stamp, (int64_t)stamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->expires, ttl > 0 ? (int64_t)(time(NULL) + ttl) : 0, __ATOMIC_RELAXED);
+    memcpy(shm_table_value_of(bucket), data, length);
+    shm_table_unlock(bucket, sequence);
+    return 0;
+}
+
+int shm_table_remove(shm_table* table, uint64_t key, uint8_t slot) {
+    shm_table_bucket* bucket = shm_table_bucket_of(table, key, slot);
+    uint32_t sequence = 0;
+    if (shm_table_lock(bucket, &sequence) != 0) return -1;
+    int held = shm_table_holds(bucket, key, slot, time(NULL));
+    if (held) __atomic_store_n(&bucket->used, 0, __ATOMIC_RELAXED);
+    shm_table_unlock(bucket, sequence);
+    return held ? 0 : -1;
+}
+
+int shm_table_touch(shm_table* table, uint64_t key, uint8_t slot, int ttl) {
+    shm_table_bucket* bucket = shm_table_bucket_of(table, key, slot);
+    uint32_t sequence = 0;
+    if (shm_table_lock(bucket, &sequence) != 0) return -1;
+    int held = shm_table_holds(bucket, key, slot, time(NULL));
+    if (held) __atomic_store_n(&bucket->expires, ttl > 0 ? (int64_t)(time(NULL) + ttl) : 0, __ATOMIC_RELAXED);
+    shm_table_unlock(bucket, sequence);
+    return held ? 0 : -1;
+}
+
+void shm_table_release_writer(pid_t pid) {
+    for (int i = 0; i < SHM_TABLE_MAX_TABLES; i++) {
+        shm_table* table = g_tables[i];
+        if (!table) continue;
+        for (int entry = 0; entry < table->entries; entry++) {
+            shm_table_bucket* bucket = (shm_table_bucket*)(table->map + (size_t)entry * table->stride);
+            uint64_t word = __atomic_load_n(&bucket->lock, __ATOMIC_ACQUIRE);
+            if (!(word & 1) || (pid_t)(word >> 32) != pid) continue;
+            // Whatever it got to write is not trusted
+            __atomic_store_n(&bucket->used, 0, __ATOMIC_RELAXED);
+            shm_table_unlock(bucket, (uint32_t)word);
+        }
+    }
+}
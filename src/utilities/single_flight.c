@@ -0,0 +1,192 @@
+#include "utilities/single_flight.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/curl_client.h"
+
+struct single_flight {
+    char* url;
+    uint32_t hash;
+    curl_client* client;
+
+    // oldest first, the head drives the transfer
+    single_flight_waiter* waiters;
+    single_flight_waiter* waiters_tail;
+
+    single_flight* next;
+};
+
+static __thread single_flight* t_flights[SINGLE_FLIGHT_BUCKETS];
+
+static uint32_t single_flight_hash(const char* url) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)url; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void single_flight_unlink(single_flight* flight) {
+    single_flight** link = &t_flights[flight->hash & (SINGLE_FLIGHT_BUCKETS - 1)];
+    while (*link && *link != flight) link = &(*link)->next;
+    if (*link) *link = flight->next;
+    flight->next = NULL;
+}
+
+static void single_flight_free(single_flight* flight) {
+    if (flight->client) {
+        curl_client_cleanup(&flight->client);
+        free(flight->client);
+    }
+    free(flight->url);
+    free(flight);
+}
+
+// Driven transfers say when they are done, the driver picks the response up
+static void single_flight_on_complete(void* context) {
+    single_flight* flight = (single_flight*)context;
+    if (flight->waiters) flight->waiters->on_wake(flight->waiters->context);
+}
+
+static single_flight* single_flight_start(const char* url, uint32_t hash) {
+    // Too late for the request that would start it, those joining later
+    // have their own deadlines and leave when they run out
+    if (!curl_client_deadline_allows(url)) return NULL;
+    single_flight* flight = (single_flight*)calloc(1, sizeof(single_flight));
+    if (!flight) return NULL;
+    flight->hash = hash;
+    flight->url = strdup(url);
+    flight->client = (curl_client*)calloc(1, sizeof(curl_client));
+    if (!flight->url || !flight->client || curl_client_init(&flight->client) != 0) {
+        free(flight->client);
+        flight->client = NULL;
+        single_flight_free(flight);
+        return NULL;
+    }
+    flight->client->deadline_ms = 0;
+    flight->client->on_complete = single_flight_on_complete;
+    flight->client->context = flight;
+    if (curl_client_make_request(&flight->client, url) != 0) {
+        single_flight_free(flight);
+        return NULL;
+    }
+
+    single_flight** bucket = &t_flights[hash & (SINGLE_FLIGHT_BUCKETS - 1)];
+    flight->next = *bucket;
+    *bucket = flight;
+    return flight;
+}
+
+// Hands every waiter its copy and retires the flight, the waiters other
+// than driver are woken to pick theirs up
+static void single_flight_finish(single_flight* flight, int status, single_flight_waiter* driver) {
+    single_flight_unlink(flight);
+
+    // The first waiter takes the response itself, the others get copies
+    char* response = NULL;
+    size_t length = flight->client->mem.size;
+    if (status == SINGLE_FLIGHT_DONE && curl_client_read_response(&flight->client, &response) != 0) response = NULL;
+    single_flight_waiter* waiters = flight->waiters;
+    int primary = 1;
+    for (single_flight_waiter* waiter = waiters; waiter; waiter = waiter->next) {
+        waiter->flight = NULL;
+        waiter->status = status;
+        waiter->primary = primary;
+        primary = 0;
+        if (status != SINGLE_FLIGHT_DONE || !response) continue;
+        if (waiter == waiters) {
+            waiter->body = response;
+            waiter->length = length;
+            continue;
+        }
+        waiter->body = (char*)malloc(length + 1);
+        if (!waiter->body) {
+            waiter->status = SINGLE_FLIGHT_FAILED;
+            continue;
+        }
+        memcpy(waiter->body, response, length + 1);
+        waiter->length = length;
+    }
+    single_flight_free(flight);
+
+    while (waiters) {
+        single_flight_waiter* waiter = waiters;
+        waiters = waiter->next;
+        waiter->next = NULL;
+        if (waiter != driver) waiter->on_wake(waiter->context);
+    }
+}
+
+static single_flight* single_flight_find(const char* url, uint32_t hash) {
+    single_flight* flight = t_flights[hash & (SINGLE_FLIGHT_BUCKETS - 1)];
+    while (flight && (flight->hash != hash || strcmp(flight->url, url) != 0)) flight = flight->next;
+    return flight;
+}
+
+int single_flight_join(single_flight_waiter* waiter, const char* url, void (*on_wake)(void* context), void* context) {
+    memset(waiter, 0, sizeof(single_flight_waiter));
+    waiter->on_wake = on_wake;
+    waiter->context = context;
+
+    uint32_t hash = single_flight_hash(url);
+    single_flight* flight = single_flight_find(url, hash);
+    if (!flight) flight = single_flight_start(url, hash);
+    if (!flight) return -1;
+
+    waiter->flight = flight;
+    if (flight->waiters_tail) {
+        flight->waiters_tail->next = waiter;
+    } else {
+        flight->waiters = waiter;
+    }
+    flight->waiters_tail = waiter;
+    return 0;
+}
+
+int single_flight_running(const char* url) {
+    return single_flight_find(url, single_flight_hash(url)) != NULL;
+}
+
+int single_flight_poll(single_flight_waiter* waiter) {
+    single_flight* flight = waiter->flight;
+    if (!flight) return waiter->status;
+    if (flight->waiters != waiter) return SINGLE_FLIGHT_WAITING;
+
+    if (curl_client_poll(&flight->client) != 0) {
+        single_flight_finish(flight, SINGLE_FLIGHT_FAILED, waiter);
+    } else if (flight->client->still_running) {
+        return curl_client_driven() ? SINGLE_FLIGHT_WAITING : SINGLE_FLIGHT_RUNNING;
+    } else {
+        single_flight_finish(flight, SINGLE_FLIGHT_DONE, waiter);
+    }
+    return waiter->status;
+}
+
+void single_flight_leave(single_flight_waiter* waiter) {
+    single_flight* flight = waiter->flight;
+    if (!flight) return;
+
+    single_flight_waiter** link = &flight->waiters;
+    single_flight_waiter* previous = NULL;
+    while (*link && *link != waiter) {
+        previous = *link;
+        link = &(*link)->next;
+    }
+    if (*link) *link = waiter->next;
+    if (flight->waiters_tail == waiter) flight->waiters_tail = previous;
+    waiter->flight = NULL;
+    waiter->next = NULL;
+
+    if (!flight->waiters) {
+        // Nobody wants the response any more
+        single_flight_unlink(flight);
+        single_flight_free(flight);
+    } else if (!previous) {
+        // The driver left, the next in line takes over polling
+        flight->waiters->on_wake(flight->waiters->context);
+    }
+}
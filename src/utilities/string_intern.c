@@ -0,0 +1,60 @@
+#include "utilities/string_intern.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    size_t length;
+    char text[];
+} string_intern_entry;
+
+// Published with a release store once the entry is written, slots are
+// never cleared
+static string_intern_entry* g_internSlots[STRING_INTERN_SLOTS];
+static int g_internCount = 0;
+static pthread_mutex_t g_internLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t string_intern_hash(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+    return hash;
+}
+
+// The slot holding text or the empty one where it would go, -1 if the probe
+// ran through the whole table
+static int string_intern_probe(const char* text, size_t length, uint32_t hash, string_intern_entry** found) {
+    for (int i = 0; i < STRING_INTERN_SLOTS; i++) {
+        int slot = (int)((hash + (uint32_t)i) & (STRING_INTERN_SLOTS - 1));
+        string_intern_entry* entry = __atomic_load_n(&g_internSlots[slot], __ATOMIC_ACQUIRE);
+        if (!entry || (entry->length == length && memcmp(entry->text, text, length) == 0)) {
+            *found = entry;
+            return slot;
+        }
+    }
+    *found = NULL;
+    return -1;
+}
+
+const char* string_intern(const char* text, size_t length) {
+    uint32_t hash = string_intern_hash(text, length);
+    string_intern_entry* entry;
+    if (string_intern_probe(text, length, hash, &entry) >= 0 && entry) return entry->text;
+
+    // Looked up again under the lock, another thread may have added it
+    pthread_mutex_lock(&g_internLock);
+    int slot = string_intern_probe(text, length, hash, &entry);
+    if (slot >= 0 && !entry && g_internCount < STRING_INTERN_SLOTS / 4 * 3) {
+        entry = (string_intern_entry*)malloc(sizeof(string_intern_entry) + length + 1);
+        if (entry) {
+            entry->length = length;
+            memcpy(entry->text, text, length);
+            entry->text[length] = '\0';
+            g_internCount++;
+            __atomic_store_n(&g_internSlots[slot], entry, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&g_internLock);
+    return entry ? entry->text : NULL;
+}
@@ -0,0 +1,226 @@
+#include "utilities/subscription.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utilities/mem_account.h"
+
+static uint32_t subscription_bucket(const subscription_registry* registry, uint64_t key) {
+    // splitmix64 finalizer, as the response cache, the keys are the same
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (uint32_t)key & (uint32_t)(registry->capacity - 1);
+}
+
+static size_t subscription_table_bytes(int capacity) {
+    // keys, buckets and both dirty lists
+    return (size_t)capacity * (sizeof(subscription_key) + 3 * sizeof(int));
+}
+
+static int subscription_find(const subscription_registry* registry, uint64_t key) {
+    if (!registry->keys) return -1;
+    int index = registry->buckets[subscription_bucket(registry, key)];
+    while (index != -1 && registry->keys[index].key != key) index = registry->keys[index].next;
+    return index;
+}
+
+// Doubles the table, indexes stay what they were
+static int subscription_grow(subscription_registry* registry) {
+    int capacity = registry->capacity * 2;
+    subscription_key* keys = (subscription_key*)realloc(registry->keys, capacity * sizeof(subscription_key));
+    if (keys) registry->keys = keys;
+    int* buckets = (int*)realloc(registry->buckets, capacity * sizeof(int));
+    if (buckets) registry->buckets = buckets;
+    int* dirty = (int*)realloc(registry->dirty, capacity * sizeof(int));
+    if (dirty) registry->dirty = dirty;
+    int* spare = (int*)realloc(registry->spare, capacity * sizeof(int));
+    if (spare) registry->spare = spare;
+    // Whatever did move is as good as the old, just larger than it needs
+    if (!keys || !buckets || !dirty || !spare) return -1;
+
+    mem_account_resize(MEM_TAG_CONNECTIONS, subscription_table_bytes(registry->capacity),
+                       subscription_table_bytes(capacity));
+    memset(&registry->keys[registry->capacity], 0, (capacity - registry->capacity) * sizeof(subscription_key));
+    for (int i = capacity - 1; i >= registry->capacity; i--) {
+        registry->keys[i].next = registry->free;
+        registry->free = i;
+    }
+    registry->capacity = capacity;
+    for (int i = 0; i < capacity; i++) registry->buckets[i] = -1;
+    for (int i = 0; i < capacity; i++) {
+        subscription_key* entry = &registry->keys[i];
+        if (!entry->used) continue;
+        int* bucket = &registry->buckets[subscription_bucket(registry, entry->key)];
+        entry->next = *bucket;
+        *bucket = i;
+    }
+    return 0;
+}
+
+static void subscription_drop(subscription_registry* registry, int index) {
+    subscription_key* entry = &registry->keys[index];
+    int* link = &registry->buckets[subscription_bucket(registry, entry->key)];
+    while (*link != -1 && *link != index) link = &registry->keys[*link].next;
+    if (*link != -1) *link = entry->next;
+
+    mem_account_resize(MEM_TAG_CONNECTIONS, entry->capacity * sizeof(subscription*), 0);
+    free(entry->subscribers);
+    memset(entry, 0, sizeof(subscription_key));
+    entry->next = registry->free;
+    registry->free = index;
+    registry->stats.keys--;
+}
+
+int subscription_registry_init(subscription_registry* registry, int capacity) {
+    memset(registry, 0, sizeof(subscription_registry));
+    int size = 1;
+    while (size < capacity) size <<= 1;
+
+    registry->keys = (subscription_key*)calloc(size, sizeof(subscription_key));
+    registry->buckets = (int*)malloc(size * sizeof(int));
+    registry->dirty = (int*)malloc(size * sizeof(int));
+    registry->spare = (int*)malloc(size * sizeof(int));
+    if (!registry->keys || !registry->buckets || !registry->dirty || !registry->spare) {
+        free(registry->keys);
+        free(registry->buckets);
+        free(registry->dirty);
+        free(registry->spare);
+        memset(registry, 0, sizeof(subscription_registry));
+        return -1;
+    }
+    mem_account_alloc(MEM_TAG_CONNECTIONS, subscription_table_bytes(size));
+    registry->capacity = size;
+    registry->free = -1;
+    for (int i = size - 1; i >= 0; i--) {
+        registry->buckets[i] = -1;
+        registry->keys[i].next = registry->free;
+        registry->free = i;
+    }
+    registry->flushing = -1;
+    return 0;
+}
+
+void subscription_registry_dispose(subscription_registry* registry) {
+    if (!registry->keys) return;
+    for (int i = 0; i < registry->capacity; i++) {
+        subscription_key* entry = &registry->keys[i];
+        if (!entry->used) continue;
+        response_blob_release(entry->pending);
+        mem_account_resize(MEM_TAG_CONNECTIONS, entry->capacity * sizeof(subscription*), 0);
+        free(entry->subscribers);
+    }
+    mem_account_free(MEM_TAG_CONNECTIONS, subscription_table_bytes(registry->capacity));
+    free(registry->keys);
+    free(registry->buckets);
+    free(registry->dirty);
+    free(registry->spare);
+    memset(registry, 0, sizeof(subscription_registry));
+}
+
+int subscription_add(subscription_registry* registry, subscription* member, uint64_t key,
+                     subscription_deliver deliver, void* context) {
+    member->key = -1;
+    if (!registry->keys) return -1;
+    int index = subscription_find(registry, key);
+    if (index == -1) {
+        if (registry->free == -1 && subscription_grow(registry) != 0) return -1;
+        index = registry->free;
+        subscription_key* entry = &registry->keys[index];
+        registry->free = entry->next;
+        entry->key = key;
+        entry->used = 1;
+        int* bucket = &registry->buckets[subscription_bucket(registry, key)];
+        entry->next = *bucket;
+        *bucket = index;
+        registry->stats.keys++;
+    }
+
+    subscription_key* entry = &registry->keys[index];
+    if (entry->count == entry->capacity) {
+        int capacity = entry->capacity ? entry->capacity * 2 : 4;
+        subscription** subscribers = (subscription**)realloc(entry->subscribers, capacity * sizeof(subscription*));
+        if (!subscribers) {
+            if (entry->count == 0 && !entry->pending) subscription_drop(registry, index);
+            return -1;
+        }
+        mem_account_resize(MEM_TAG_CONNECTIONS, entry->capacity * sizeof(subscription*), capacity * sizeof(subscription*));
+        entry->subscribers = subscribers;
+        entry->capacity = capacity;
+    }
+    member->deliver = deliver;
+    member->context = context;
+    member->key = index;
+    member->slot = entry->count;
+    entry->subscribers[entry->count++] = member;
+    registry->stats.subscribers++;
+    return 0;
+}
+
+void subscription_remove(subscription_registry* registry, subscription* member) {
+    if (member->key < 0) return;
+    int index = member->key;
+    subscription_key* entry = &registry->keys[index];
+    subscription* last = entry->subscribers[--entry->count];
+    entry->subscribers[member->slot] = last;
+    last->slot = member->slot;
+    member->key = -1;
+    registry->stats.subscribers--;
+
+    // The key being flushed is dropped by the flush once it is done with it
+    if (entry->count == 0 && !entry->pending && index != registry->flushing) subscription_drop(registry, index);
+}
+
+int subscription_count(const subscription_registry* registry, uint64_t key) {
+    int index = subscription_find(registry, key);
+    return index == -1 ? 0 : registry->keys[index].count;
+}
+
+void subscription_publish(subscription_registry* registry, uint64_t key, const response_blob* blob) {
+    int index = subscription_find(registry, key);
+    if (index == -1 || registry->keys[index].count == 0) return;
+    subscription_key* entry = &registry->keys[index];
+    response_blob_retain(blob);
+    if (entry->pending) {
+        response_blob_release(entry->pending);
+    } else {
+        // A key is on the list once, with its pending blob set
+        registry->dirty[registry->dirty_count++] = index;
+    }
+    entry->pending = blob;
+    registry->stats.published++;
+}
+
+int subscription_flush(subscription_registry* registry) {
+    // Publishing from a delivery goes to the next flush, on the other list
+    int count = registry->dirty_count;
+    int* list = registry->dirty;
+    registry->dirty = registry->spare;
+    registry->spare = list;
+    registry->dirty_count = 0;
+
+    int delivered = 0;
+    for (int i = 0; i < count; i++) {
+        // Re-read on every step, a delivery may subscribe and grow the table
+        int index = registry->spare[i];
+        const response_blob* blob = registry->keys[index].pending;
+        registry->keys[index].pending = NULL;
+        registry->flushing = index;
+        // From the back, a subscriber leaving swaps in one already done
+        for (int slot = registry->keys[index].count - 1; slot >= 0; slot--) {
+            subscription_key* entry = &registry->keys[index];
+            if (slot >= entry->count) continue;
+            subscription* member = entry->subscribers[slot];
+            member->deliver(member->context, blob);
+            delivered++;
+        }
+        registry->flushing = -1;
+        response_blob_release(blob);
+        subscription_key* entry = &registry->keys[index];
+        if (entry->count == 0 && !entry->pending) subscription_drop(registry, index);
+    }
+    registry->stats.deliveries += delivered;
+    return delivered;
+}
@@ -0,0 +1,359 @@
+#include "utilities/trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "utilities/access_log.h"
+#include "utilities/logger.h"
+
+int g_traceEnabled = 0;
+
+static unsigned int g_traceSampleEvery = TRACE_SAMPLE_EVERY;
+static uint64_t g_traceSlowNs = (uint64_t)TRACE_SLOW_MS * 1000000ull;
+static FILE* g_traceLogFile = NULL;
+
+// Requests until this loop samples the next one, and its id generator
+static __thread unsigned int t_traceCountdown = 0;
+static __thread uint64_t t_traceRandom = 0;
+
+#define TRACE_RECORD_SAMPLED 0x01
+#define TRACE_RECORD_SLOW 0x02
+#define TRACE_RECORD_HEAD 0x04
+#define TRACE_RECORD_TRUNCATED 0x08
+
+// What goes through the logger's ring, formatted on its thread
+typedef struct {
+    uint8_t trace_id[16];
+    uint8_t span_id[8];
+    uint8_t parent_id[8];
+    // wall clock of the earliest mark
+    uint64_t start_unix_ns;
+    // from the earliest mark, UINT32_MAX where absent
+    uint32_t offsets_us[TRACE_MARK_COUNT];
+    uint16_t status;
+    uint8_t route;
+    uint8_t cache;
+    uint8_t flags;
+    uint8_t target_length;
+    char target[TRACE_TARGET_SIZE];
+} trace_record;
+
+_Static_assert(sizeof(trace_record) <= LOG_MESSAGE_SIZE, "a trace record has to fit a logger slot");
+
+#define TRACE_ABSENT UINT32_MAX
+
+// The phases between two marks, for Server-Timing and the child spans
+typedef struct {
+    const char* name;
+    uint8_t from;
+    uint8_t to;
+} trace_phase;
+
+static const trace_phase g_tracePhases[] = {
+    {"accept", TRACE_ACCEPTED, TRACE_STARTED},     {"tls", TRACE_STARTED, TRACE_HANDSHAKEN},
+    {"read", TRACE_READ, TRACE_PARSED},            {"dispatch", TRACE_PARSED, TRACE_DISPATCHED},
+    {"cache", TRACE_DISPATCHED, TRACE_CACHED},     {"upstream", TRACE_FETCH_START, TRACE_FETCH_DONE},
+    {"backend", TRACE_DISPATCHED, TRACE_BODY},     {"respond", TRACE_BODY, TRACE_QUEUED},
+    {"send", TRACE_QUEUED, TRACE_SENT},
+};
+
+#define TRACE_PHASE_COUNT (int)(sizeof(g_tracePhases) / sizeof(g_tracePhases[0]))
+
+static void trace_update_enabled(void) {
+    int enabled = g_traceSampleEvery > 0 || g_traceSlowNs > 0;
+    __atomic_store_n(&g_traceEnabled, enabled, __ATOMIC_RELAXED);
+}
+
+void trace_configure(unsigned int sample_every, unsigned int slow_ms) {
+    g_traceSampleEvery = sample_every;
+    g_traceSlowNs = (uint64_t)slow_ms * 1000000ull;
+    trace_update_enabled();
+}
+
+// xorshift64* seeded per thread, ids only have to be unique enough
+static uint64_t trace_random(void) {
+    uint64_t x = t_traceRandom;
+    if (x == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        x = ((uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec) ^ (uint64_t)(uintptr_t)&t_traceRandom;
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        x ^= x >> 31;
+        if (x == 0) x = 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    t_traceRandom = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static void trace_random_bytes(uint8_t* out, size_t length) {
+    for (size_t i = 0; i < length; i += 8) {
+        uint64_t value = trace_random();
+        size_t count = length - i < 8 ? length - i : 8;
+        memcpy(out + i, &value, count);
+    }
+}
+
+static int trace_hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// count bytes of lower case hex, 0 or -1; an all zero id is invalid too
+static int trace_parse_hex(const char* text, uint8_t* out, size_t count) {
+    uint8_t any = 0;
+    for (size_t i = 0; i < count; i++) {
+        int high = trace_hex_value(text[2 * i]);
+        int low = trace_hex_value(text[2 * i + 1]);
+        if (high < 0 || low < 0) return -1;
+        out[i] = (uint8_t)(high << 4 | low);
+        any |= out[i];
+    }
+    return any ? 0 : -1;
+}
+
+// W3C traceparent, version 00: 00-<32 hex trace id>-<16 hex parent>-<2 hex flags>
+static int trace_parse_parent(trace_context* trace, const char* text, size_t length, int* sampled) {
+    uint8_t flags = 0;
+    if (length < 55 || text[2] != '-' || text[35] != '-' || text[52] != '-') return -1;
+    if (text[0] != '0' || text[1] != '0') return -1;
+    if (trace_parse_hex(text + 3, trace->trace_id, 16) != 0 || trace_parse_hex(text + 36, trace->parent_id, 8) != 0) {
+        memset(trace->trace_id, 0, sizeof(trace->trace_id));
+        memset(trace->parent_id, 0, sizeof(trace->parent_id));
+        return -1;
+    }
+    int high = trace_hex_value(text[53]), low = trace_hex_value(text[54]);
+    if (high >= 0 && low >= 0) flags = (uint8_t)(high << 4 | low);
+    *sampled = flags & 0x01;
+    return 0;
+}
+
+int trace_begin(trace_context* trace, const char* traceparent, size_t length) {
+    int sampled = 0;
+    if (g_traceSampleEvery > 0) {
+        if (t_traceCountdown == 0) {
+            t_traceCountdown = g_traceSampleEvery;
+            sampled = 1;
+        }
+        t_traceCountdown--;
+    }
+    memset(trace, 0, sizeof(*trace));
+    int parent_sampled = 0;
+    int has_parent = traceparent != NULL && trace_parse_parent(trace, traceparent, length, &parent_sampled) == 0;
+    sampled = sampled || parent_sampled;
+    if (!sampled && g_traceSlowNs == 0) return 0;
+    if (!has_parent) trace_random_bytes(trace->trace_id, sizeof(trace->trace_id));
+    trace_random_bytes(trace->span_id, sizeof(trace->span_id));
+    trace->active = 1;
+    trace->sampled = (uint8_t)sampled;
+    return 1;
+}
+
+int trace_server_timing(const trace_context* trace, char* out, size_t size) {
+    size_t length = 0;
+    for (int i = 0; i <= TRACE_PHASE_COUNT; i++) {
+        uint64_t from, to;
+        const char* name;
+        if (i < TRACE_PHASE_COUNT) {
+            name = g_tracePhases[i].name;
+            from = trace->marks[g_tracePhases[i].from];
+            to = trace->marks[g_tracePhases[i].to];
+        } else {
+            // what this request took so far, the connection's setup aside
+            name = "total";
+            from = trace->marks[TRACE_READ];
+            to = trace->marks[TRACE_QUEUED];
+        }
+        if (from == 0 || to < from) continue;
+        int written = snprintf(out + length, size - length, "%s%s;dur=%.3f", length ? ", " : "", name,
+                               (double)(to - from) / 1e6);
+        if (written < 0 || (size_t)written >= size - length) break;
+        length += (size_t)written;
+    }
+    if (length < size) out[length] = '\0';
+    return (int)length;
+}
+
+void trace_export(const trace_context* trace, int head, int status, int route, int cache, const char* target,
+                  int length) {
+    if (!trace->active || g_traceLogFile == NULL) return;
+    uint64_t first = 0, last = 0;
+    for (int i = 0; i < TRACE_MARK_COUNT; i++) {
+        uint64_t mark = trace->marks[i];
+        if (mark == 0) continue;
+        if (first == 0 || mark < first) first = mark;
+        if (mark > last) last = mark;
+    }
+    if (first == 0) return;
+    int slow = g_traceSlowNs > 0 && last - first >= g_traceSlowNs;
+    if (!trace->sampled && !slow) return;
+
+    trace_record record;
+    memcpy(record.trace_id, trace->trace_id, sizeof(record.trace_id));
+    memcpy(record.span_id, trace->span_id, sizeof(record.span_id));
+    memcpy(record.parent_id, trace->parent_id, sizeof(record.parent_id));
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.start_unix_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec - (trace_now() - first);
+    for (int i = 0; i < TRACE_MARK_COUNT; i++) {
+        uint64_t offset = (trace->marks[i] - first) / 1000;
+        if (trace->marks[i] == 0) {
+            record.offsets_us[i] = TRACE_ABSENT;
+        } else {
+            record.offsets_us[i] = offset < TRACE_ABSENT ? (uint32_t)offset : TRACE_ABSENT - 1;
+        }
+    }
+    record.status = (uint16_t)status;
+    record.route = (uint8_t)route;
+    record.cache = (uint8_t)cache;
+    record.flags = (trace->sampled ? TRACE_RECORD_SAMPLED : 0) | (slow ? TRACE_RECORD_SLOW : 0) |
+                   (head ? TRACE_RECORD_HEAD : 0);
+    if (length < 0) length = 0;
+    if (length > TRACE_TARGET_SIZE - 1) {
+        length = TRACE_TARGET_SIZE - 1;
+        record.flags |= TRACE_RECORD_TRUNCATED;
+    }
+    record.target_length = (uint8_t)length;
+    memcpy(record.target, target, (size_t)length);
+    logger_write_binary(LOGGER_CHANNEL_TRACE, &record,
+                        (int)(offsetof(trace_record, target) + (size_t)length));
+}
+
+// ========== OTLP/JSON ==========
+// Written on the logger's thread, one ExportTraceServiceRequest per line as
+// the OpenTelemetry collector's file receiver reads them.
+
+static void trace_write_hex(FILE* file, const uint8_t* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < length; i++) {
+        fputc(digits[data[i] >> 4], file);
+        fputc(digits[data[i] & 0x0f], file);
+    }
+}
+
+static void trace_write_string(FILE* file, const char* text, size_t length) {
+    fputc('"', file);
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void trace_write_time(FILE* file, const char* key, const trace_record* record, uint32_t offset_us) {
+    fprintf(file, ",\"%s\":\"%llu\"", key,
+            (unsigned long long)(record->start_unix_ns + (uint64_t)offset_us * 1000ull));
+}
+
+// A child span's id, derived from the root's so a record needs only the one
+static void trace_child_id(const trace_record* record, int phase, uint8_t* out) {
+    uint64_t x = 0;
+    memcpy(&x, record->span_id, sizeof(x));
+    x += 0x9E3779B97F4A7C15ull * (uint64_t)(phase + 1);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    memcpy(out, &x, sizeof(x));
+}
+
+static void trace_write_record(FILE* file, const void* data, int length) {
+    trace_record record;
+    if (length < (int)offsetof(trace_record, target) || length > (int)sizeof(record)) return;
+    memcpy(&record, data, (size_t)length);
+    size_t target_length = record.target_length;
+    if (offsetof(trace_record, target) + target_length > (size_t)length) return;
+
+    uint32_t end = 0;
+    for (int i = 0; i < TRACE_MARK_COUNT; i++) {
+        if (record.offsets_us[i] != TRACE_ABSENT && record.offsets_us[i] > end) end = record.offsets_us[i];
+    }
+    const char* query = memchr(record.target, '?', target_length);
+    size_t path_length = query ? (size_t)(query - record.target) : target_length;
+    static const uint8_t no_parent[8] = {0};
+
+    fputs("{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":"
+          "\"ubweather\"}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"ubweather\"},\"spans\":[",
+          file);
+
+    // The request as the server saw it, from its earliest mark to the last
+    const char* method = record.flags & TRACE_RECORD_HEAD ? "HEAD" : "GET";
+    fputs("{\"traceId\":\"", file);
+    trace_write_hex(file, record.trace_id, sizeof(record.trace_id));
+    fputs("\",\"spanId\":\"", file);
+    trace_write_hex(file, record.span_id, sizeof(record.span_id));
+    fputc('"', file);
+    if (memcmp(record.parent_id, no_parent, sizeof(no_parent)) != 0) {
+        fputs(",\"parentSpanId\":\"", file);
+        trace_write_hex(file, record.parent_id, sizeof(record.parent_id));
+        fputc('"', file);
+    }
+    fprintf(file, ",\"name\":\"%s %.*s\",\"kind\":2", method, (int)path_length, record.target);
+    trace_write_time(file, "startTimeUnixNano", &record, 0);
+    trace_write_time(file, "endTimeUnixNano", &record, end);
+    fprintf(file, ",\"attributes\":[{\"key\":\"http.request.method\",\"value\":{\"stringValue\":\"%s\"}}", method);
+    fprintf(file, ",{\"key\":\"http.response.status_code\",\"value\":{\"intValue\":\"%u\"}}", record.status);
+    fputs(",{\"key\":\"url.path\",\"value\":{\"stringValue\":", file);
+    trace_write_string(file, record.target, path_length);
+    fputs("}}", file);
+    if (query) {
+        fputs(",{\"key\":\"url.query\",\"value\":{\"stringValue\":", file);
+        trace_write_string(file, query + 1, target_length - path_length - 1);
+        fputs("}}", file);
+    }
+    fprintf(file, ",{\"key\":\"ubweather.route\",\"value\":{\"stringValue\":\"%s\"}}",
+            access_log_route_name(record.route));
+    fprintf(file, ",{\"key\":\"ubweather.cache\",\"value\":{\"stringValue\":\"%s\"}}",
+            access_log_cache_name(record.cache));
+    fprintf(file, ",{\"key\":\"ubweather.trace.reason\",\"value\":{\"stringValue\":\"%s\"}}",
+            record.flags & TRACE_RECORD_SLOW ? "slow" : "sampled");
+    fputs("]", file);
+    if (record.status >= 500) fputs(",\"status\":{\"code\":2}", file);
+    fputs("}", file);
+
+    // A child for each phase both ends of were seen
+    for (int i = 0; i < TRACE_PHASE_COUNT; i++) {
+        uint32_t from = record.offsets_us[g_tracePhases[i].from];
+        uint32_t to = record.offsets_us[g_tracePhases[i].to];
+        if (from == TRACE_ABSENT || to == TRACE_ABSENT || to < from) continue;
+        uint8_t id[8];
+        trace_child_id(&record, i, id);
+        fputs(",{\"traceId\":\"", file);
+        trace_write_hex(file, record.trace_id, sizeof(record.trace_id));
+        fputs("\",\"spanId\":\"", file);
+        trace_write_hex(file, id, sizeof(id));
+        fputs("\",\"parentSpanId\":\"", file);
+        trace_write_hex(file, record.span_id, sizeof(record.span_id));
+        fprintf(file, "\",\"name\":\"%s\",\"kind\":1", g_tracePhases[i].name);
+        trace_write_time(file, "startTimeUnixNano", &record, from);
+        trace_write_time(file, "endTimeUnixNano", &record, to);
+        fputs("}", file);
+    }
+    fputs("]}]}]}\n", file);
+}
+
+int trace_log_open(const char* path) {
+    FILE* file = fopen(path, "a");
+    if (file == NULL) return -1;
+    g_traceLogFile = file;
+    logger_set_binary_sink(LOGGER_CHANNEL_TRACE, file, trace_write_record);
+    return 0;
+}
+
+void trace_log_close(void) {
+    if (g_traceLogFile == NULL) return;
+    logger_set_binary_sink(LOGGER_CHANNEL_TRACE, NULL, NULL);
+    fclose(g_traceLogFile);
+    g_traceLogFile = NULL;
+}
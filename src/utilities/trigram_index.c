@@ -0,0 +1,242 @@
+#include "utilities/trigram_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Distinct trigrams of a key at most, its code points plus the padding
+#define TRIGRAM_INDEX_MAX_TRIGRAMS (TRIGRAM_INDEX_MAX_LENGTH + 1)
+#define TRIGRAM_INDEX_PAD 1u
+
+// Code points of a UTF-8 key, invalid bytes taken as they are
+static int trigram_index_decode(const char* key, uint32_t* points, int max) {
+    const unsigned char* in = (const unsigned char*)key;
+    int count = 0;
+    while (*in && count < max) {
+        uint32_t c = *in++;
+        int more = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+        if (more) c &= 0x3F >> more;
+        while (more-- > 0 && (*in & 0xC0) == 0x80) c = (c << 6) | (*in++ & 0x3F);
+        points[count++] = c;
+    }
+    return count;
+}
+
+static uint32_t trigram_index_bucket(uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t hash = a * 0x9E3779B1u ^ (b * 0x85EBCA77u + 0x165667B1u) ^ (c * 0xC2B2AE3Du + 0x27D4EB2Fu);
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+    return hash & (TRIGRAM_INDEX_BUCKETS - 1);
+}
+
+static int trigram_index_compare_u32(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*)a;
+    uint32_t right = *(const uint32_t*)b;
+    return (left > right) - (left < right);
+}
+
+// The distinct lists a key is in, ascending; how many
+static int trigram_index_buckets(const char* key, uint32_t* buckets) {
+    uint32_t points[TRIGRAM_INDEX_MAX_LENGTH + 3];
+    points[0] = TRIGRAM_INDEX_PAD;
+    points[1] = TRIGRAM_INDEX_PAD;
+    int length = trigram_index_decode(key, points + 2, TRIGRAM_INDEX_MAX_LENGTH);
+    if (length == 0) return 0;
+    points[length + 2] = TRIGRAM_INDEX_PAD;
+
+    int count = 0;
+    for (int i = 0; i + 2 < length + 3; i++) buckets[count++] = trigram_index_bucket(points[i], points[i + 1], points[i + 2]);
+    qsort(buckets, count, sizeof(uint32_t), trigram_index_compare_u32);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (kept == 0 || buckets[kept - 1] != buckets[i]) buckets[kept++] = buckets[i];
+    }
+    return kept;
+}
+
+int trigram_index_build(trigram_index* index, const char* const* keys, uint32_t count) {
+    memset(index, 0, sizeof(trigram_index));
+    index->offsets = (uint32_t*)calloc(TRIGRAM_INDEX_BUCKETS + 1, sizeof(uint32_t));
+    if (!index->offsets) return -1;
+
+    // Counted first, then every list filled in id order
+    uint32_t buckets[TRIGRAM_INDEX_MAX_TRIGRAMS];
+    size_t total = 0;
+    for (uint32_t id = 0; id < count; id++) {
+        int found = trigram_index_buckets(keys[id], buckets);
+        for (int i = 0; i < found; i++) index->offsets[buckets[i] + 1]++;
+        total += (size_t)found;
+    }
+    if (total > UINT32_MAX) {
+        trigram_index_dispose(index);
+        return -1;
+    }
+    for (uint32_t i = 0; i < TRIGRAM_INDEX_BUCKETS; i++) index->offsets[i + 1] += index->offsets[i];
+    index->postings = (uint32_t*)malloc((total ? total : 1) * sizeof(uint32_t));
+    uint32_t* next = (uint32_t*)malloc(TRIGRAM_INDEX_BUCKETS * sizeof(uint32_t));
+    if (!index->postings || !next) {
+        free(next);
+        trigram_index_dispose(index);
+        return -1;
+    }
+    memcpy(next, index->offsets, TRIGRAM_INDEX_BUCKETS * sizeof(uint32_t));
+    for (uint32_t id = 0; id < count; id++) {
+        int found = trigram_index_buckets(keys[id], buckets);
+        for (int i = 0; i < found; i++) index->postings[next[buckets[i]]++] = id;
+    }
+    free(next);
+    index->count = count;
+    return 0;
+}
+
+void trigram_index_dispose(trigram_index* index) {
+    free(index->offsets);
+    free(index->postings);
+    memset(index, 0, sizeof(trigram_index));
+}
+
+static void trigram_index_intersect_scalar(const uint32_t* a, size_t a_count, const uint32_t* b, size_t b_count,
+                                           uint8_t* hits, size_t i, size_t j) {
+    while (i < a_count && j < b_count) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            hits[i++]++;
+            j++;
+        }
+    }
+}
+
+void trigram_index_intersect(const uint32_t* a, size_t a_count, const uint32_t* b, size_t b_count, uint8_t* hits) {
+    size_t i = 0;
+    size_t j = 0;
+#if defined(__x86_64__) || defined(__aarch64__)
+    // Four of a against every rotation of four of b, the block with the
+    // lower last id moves on; an id of a is only ever equal to one of b
+    while (i + 4 <= a_count && j + 4 <= b_count) {
+#if defined(__x86_64__)
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        __m128i equal = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(equal));
+#else
+        uint32x4_t va = vld1q_u32(a + i);
+        uint32x4_t vb = vld1q_u32(b + j);
+        uint32x4_t equal = vorrq_u32(vorrq_u32(vceqq_u32(va, vb), vceqq_u32(va, vextq_u32(vb, vb, 1))),
+                                     vorrq_u32(vceqq_u32(va, vextq_u32(vb, vb, 2)), vceqq_u32(va, vextq_u32(vb, vb, 3))));
+        int mask = (int)((vgetq_lane_u32(equal, 0) & 1) | (vgetq_lane_u32(equal, 1) & 2) |
+                         (vgetq_lane_u32(equal, 2) & 4) | (vgetq_lane_u32(equal, 3) & 8));
+#endif
+        while (mask) {
+            hits[i + __builtin_ctz(mask)]++;
+            mask &= mask - 1;
+        }
+        uint32_t a_last = a[i + 3];
+        uint32_t b_last = b[j + 3];
+        if (a_last <= b_last) i += 4;
+        if (b_last <= a_last) j += 4;
+    }
+#endif
+    trigram_index_intersect_scalar(a, a_count, b, b_count, hits, i, j);
+}
+
+int trigram_index_candidates(const trigram_index* index, const char* key, int max_edits, uint32_t* ids, int max) {
+    if (!index->offsets || max <= 0) return 0;
+    uint32_t buckets[TRIGRAM_INDEX_MAX_TRIGRAMS];
+    int lists = trigram_index_buckets(key, buckets);
+    if (lists == 0) return 0;
+    int needed = lists - 4 * max_edits;
+    if (needed < 1) needed = 1;
+
+    // Shortest lists first, a candidate is in one of the first lists - needed + 1
+    for (int i = 1; i < lists; i++) {
+        uint32_t bucket = buckets[i];
+        uint32_t length = index->offsets[bucket + 1] - index->offsets[bucket];
+        int at = i;
+        while (at > 0 && index->offsets[buckets[at - 1] + 1] - index->offsets[buckets[at - 1]] > length) {
+            buckets[at] = buckets[at - 1];
+            at--;
+        }
+        buckets[at] = bucket;
+    }
+    int count = 0;
+    for (int i = 0; i < lists - needed + 1; i++) {
+        uint32_t start = index->offsets[buckets[i]];
+        uint32_t length = index->offsets[buckets[i] + 1] - start;
+        if ((size_t)count + length > (size_t)max) return -1;
+        memcpy(ids + count, index->postings + start, length * sizeof(uint32_t));
+        count += (int)length;
+    }
+    qsort(ids, count, sizeof(uint32_t), trigram_index_compare_u32);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique == 0 || ids[unique - 1] != ids[i]) ids[unique++] = ids[i];
+    }
+    if (needed == 1) return unique;
+
+    uint8_t* hits = (uint8_t*)calloc(unique ? unique : 1, 1);
+    if (!hits) return -1;
+    for (int i = 0; i < lists; i++) {
+        uint32_t start = index->offsets[buckets[i]];
+        trigram_index_intersect(ids, unique, index->postings + start, index->offsets[buckets[i] + 1] - start, hits);
+    }
+    int kept = 0;
+    for (int i = 0; i < unique; i++) {
+        if (hits[i] >= needed) ids[kept++] = ids[i];
+    }
+    free(hits);
+    return kept;
+}
+
+int trigram_index_length(const char* key) {
+    uint32_t points[TRIGRAM_INDEX_MAX_LENGTH];
+    return trigram_index_decode(key, points, TRIGRAM_INDEX_MAX_LENGTH);
+}
+
+int trigram_index_distance(const char* a, const char* b, int limit) {
+    uint32_t left[TRIGRAM_INDEX_MAX_LENGTH];
+    uint32_t right[TRIGRAM_INDEX_MAX_LENGTH];
+    int n = trigram_index_decode(a, left, TRIGRAM_INDEX_MAX_LENGTH);
+    int m = trigram_index_decode(b, right, TRIGRAM_INDEX_MAX_LENGTH);
+    if (abs(n - m) > limit) return limit + 1;
+
+    // Three rows of the optimal string alignment table
+    int rows[3][TRIGRAM_INDEX_MAX_LENGTH + 1];
+    int* before = rows[0];
+    int* previous = rows[1];
+    int* current = rows[2];
+    for (int j = 0; j <= m; j++) previous[j] = j;
+    for (int i = 1; i <= n; i++) {
+        current[0] = i;
+        int smallest = i;
+        for (int j = 1; j <= m; j++) {
+            int cost = left[i - 1] != right[j - 1];
+            int value = previous[j - 1] + cost;
+            if (previous[j] + 1 < value) value = previous[j] + 1;
+            if (current[j - 1] + 1 < value) value = current[j - 1] + 1;
+            if (i > 1 && j > 1 && left[i - 1] == right[j - 2] && left[i - 2] == right[j - 1] &&
+                before[j - 2] + 1 < value) {
+                value = before[j - 2] + 1;
+            }
+            current[j] = value;
+            if (value < smallest) smallest = value;
+        }
+        if (smallest > limit) return limit + 1;
+        int* rotate = before;
+        before = previous;
+        previous = current;
+        current = rotate;
+    }
+    return previous[m] > limit ? limit + 1 : previous[m];
+}
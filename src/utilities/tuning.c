@@ -0,0 +1,167 @@
+#include "utilities/tuning.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const tuning g_tuningDefaults = {
+    .header_timeout_ms = HTTPServerConnection_HEADER_TIMEOUT_MS,
+    .handler_timeout_ms = HTTPServerConnection_HANDLER_TIMEOUT_MS,
+    .write_timeout_ms = HTTPServerConnection_WRITE_TIMEOUT_MS,
+    .keepalive_timeout_ms = HTTPServerConnection_KEEPALIVE_TIMEOUT_MS,
+    .min_transfer_rate = HTTPServerConnection_MIN_RATE_BYTES_PER_SECOND,
+    .curl_connect_timeout_ms = CURL_CONNECT_TIMEOUT_SEC * 1000L,
+    .curl_request_timeout_ms = CURL_REQUEST_TIMEOUT_SEC * 1000L,
+    .curl_max_response_size = CURL_CLIENT_MAX_RESPONSE_SIZE,
+    .weather_ttl_seconds = Weather_CACHE_TTL_SECONDS,
+    .admission_target_ms = ADMISSION_TARGET_MS,
+    .admission_interval_ms = ADMISSION_INTERVAL_MS,
+    .quota_tokens_per_second = WeatherServerInstance_QUOTA_TOKENS_PER_SECOND,
+    .quota_burst = WeatherServerInstance_QUOTA_BURST,
+    .quota_fetch_cost = WeatherServerInstance_QUOTA_FETCH_COST,
+    .quota_bytes_per_token = WeatherServerInstance_QUOTA_BYTES_PER_TOKEN,
+};
+
+const tuning* g_tuning = &g_tuningDefaults;
+
+typedef struct {
+    const char* name;
+    size_t offset;
+    long min;
+    long max;
+} tuning_knob;
+
+#define TUNING_KNOB(field, min, max) {#field, offsetof(tuning, field), (min), (max)}
+
+static const tuning_knob g_tuningKnobs[] = {
+    TUNING_KNOB(header_timeout_ms, 100, 600000),
+    TUNING_KNOB(handler_timeout_ms, 100, 600000),
+    TUNING_KNOB(write_timeout_ms, 100, 600000),
+    TUNING_KNOB(keepalive_timeout_ms, 100, 3600000),
+    TUNING_KNOB(min_transfer_rate, 0, 1L << 30),
+    TUNING_KNOB(curl_connect_timeout_ms, 100, 600000),
+    TUNING_KNOB(curl_request_timeout_ms, 100, 600000),
+    TUNING_KNOB(curl_max_response_size, 4096, 1L << 30),
+    TUNING_KNOB(weather_ttl_seconds, 10, 86400),
+    TUNING_KNOB(admission_target_ms, 1, 60000),
+    TUNING_KNOB(admission_interval_ms, 1, 60000),
+    TUNING_KNOB(quota_tokens_per_second, 0, 1000000),
+    TUNING_KNOB(quota_burst, 1, 100000000),
+    TUNING_KNOB(quota_fetch_cost, 0, 1000000),
+    TUNING_KNOB(quota_bytes_per_token, 1, 1L << 30),
+};
+#define TUNING_KNOB_COUNT ((int)(sizeof(g_tuningKnobs) / sizeof(g_tuningKnobs[0])))
+
+/* versions published so far, the current one first; writers only */
+typedef struct tuning_version tuning_version;
+struct tuning_version {
+    tuning values;
+    tuning_version* next;
+};
+
+static pthread_mutex_t g_tuningLock = PTHREAD_MUTEX_INITIALIZER;
+static tuning_version* g_tuningVersions = NULL;
+
+int tuning_parse(tuning* draft, const char* name, size_t name_length, const char* value, size_t value_length) {
+    for (int i = 0; i < TUNING_KNOB_COUNT; i++) {
+        const tuning_knob* knob = &g_tuningKnobs[i];
+        if (strlen(knob->name) != name_length || memcmp(knob->name, name, name_length) != 0) continue;
+
+        char buffer[24];
+        if (value_length == 0 || value_length >= sizeof(buffer)) return -2;
+        memcpy(buffer, value, value_length);
+        buffer[value_length] = '\0';
+        char* end = NULL;
+        errno = 0;
+        long number = strtol(buffer, &end, 10);
+        if (errno != 0 || *end != '\0' || number < knob->min || number > knob->max) return -2;
+        *(long*)((char*)draft + knob->offset) = number;
+        return 0;
+    }
+    return -1;
+}
+
+int tuning_publish(const tuning* draft) {
+    tuning_version* version = (tuning_version*)malloc(sizeof(tuning_version));
+    if (version == NULL) return -1;
+    version->values = *draft;
+
+    pthread_mutex_lock(&g_tuningLock);
+    version->next = g_tuningVersions;
+    g_tuningVersions = version;
+    __atomic_store_n(&g_tuning, &version->values, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_tuningLock);
+    return 0;
+}
+
+static int tuning_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int tuning_load(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    tuning draft = *tuning_get();
+    char line[256];
+    int number = 0;
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char* start = line;
+        while (tuning_is_space(*start)) start++;
+        if (*start == '\0') continue;
+        char* equals = strchr(start, '=');
+        if (equals == NULL) {
+            result = number;
+            break;
+        }
+        char* name_end = equals;
+        while (name_end > start && tuning_is_space(name_end[-1])) name_end--;
+        char* value = equals + 1;
+        while (tuning_is_space(*value)) value++;
+        char* value_end = value + strlen(value);
+        while (value_end > value && tuning_is_space(value_end[-1])) value_end--;
+
+        if (tuning_parse(&draft, start, (size_t)(name_end - start), value, (size_t)(value_end - value)) != 0) {
+            result = number;
+        }
+    }
+    fclose(file);
+
+    if (result == 0 && tuning_publish(&draft) != 0) result = -1;
+    return result;
+}
+
+/* past size only counts */
+#define TUNING_AT(out, size, length) ((size_t)(length) < (size) ? (out) + (length) : NULL)
+#define TUNING_LEFT(size, length) ((size_t)(length) < (size) ? (size) - (size_t)(length) : 0)
+
+int tuning_format(const tuning* values, char* out, size_t size) {
+    int length = 0;
+    for (int i = 0; i < TUNING_KNOB_COUNT; i++) {
+        const tuning_knob* knob = &g_tuningKnobs[i];
+        int n = snprintf(TUNING_AT(out, size, length), TUNING_LEFT(size, length), "%s\"%s\":%ld", i == 0 ? "{" : ",",
+                         knob->name, *(const long*)((const char*)values + knob->offset));
+        if (n < 0) return n;
+        length += n;
+    }
+    int n = snprintf(TUNING_AT(out, size, length), TUNING_LEFT(size, length), "}\n");
+    return n < 0 ? n : length + n;
+}
+
+void tuning_dispose(void) {
+    pthread_mutex_lock(&g_tuningLock);
+    __atomic_store_n(&g_tuning, &g_tuningDefaults, __ATOMIC_RELEASE);
+    while (g_tuningVersions != NULL) {
+        tuning_version* next = g_tuningVersions->next;
+        free(g_tuningVersions);
+        g_tuningVersions = next;
+    }
+    pthread_mutex_unlock(&g_tuningLock);
+}
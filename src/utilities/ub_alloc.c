@@ -0,0 +1,46 @@
+#include "utilities/ub_alloc.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(UB_ALLOCATOR_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+
+static size_t ub_alloc_jemalloc_stat(const char* name) {
+    size_t value = 0;
+    size_t length = sizeof(value);
+    return mallctl(name, &value, &length, NULL, 0) == 0 ? value : 0;
+}
+#elif !defined(UB_ALLOCATOR_MIMALLOC)
+#include <malloc.h>
+#endif
+
+int ub_alloc_stats(char* out, size_t size) {
+#if defined(UB_ALLOCATOR_MIMALLOC)
+    size_t elapsed_ms, user_ms, system_ms, rss, peak_rss, committed, peak_committed, page_faults;
+    mi_process_info(&elapsed_ms, &user_ms, &system_ms, &rss, &peak_rss, &committed, &peak_committed, &page_faults);
+    return snprintf(out, size,
+                    "{\"backend\":\"%s\",\"version\":%d,\"committed_bytes\":%zu,\"peak_committed_bytes\":%zu,"
+                    "\"resident_bytes\":%zu,\"peak_resident_bytes\":%zu,\"page_faults\":%zu}",
+                    UB_ALLOCATOR_NAME, mi_version(), committed, peak_committed, rss, peak_rss, page_faults);
+#elif defined(UB_ALLOCATOR_JEMALLOC)
+    // The totals are refreshed by bumping the epoch
+    uint64_t epoch = 1;
+    size_t length = sizeof(epoch);
+    mallctl("epoch", &epoch, &length, &epoch, length);
+    return snprintf(out, size,
+                    "{\"backend\":\"%s\",\"allocated_bytes\":%zu,\"active_bytes\":%zu,\"metadata_bytes\":%zu,"
+                    "\"resident_bytes\":%zu,\"mapped_bytes\":%zu,\"retained_bytes\":%zu}",
+                    UB_ALLOCATOR_NAME, ub_alloc_jemalloc_stat("stats.allocated"),
+                    ub_alloc_jemalloc_stat("stats.active"), ub_alloc_jemalloc_stat("stats.metadata"),
+                    ub_alloc_jemalloc_stat("stats.resident"), ub_alloc_jemalloc_stat("stats.mapped"),
+                    ub_alloc_jemalloc_stat("stats.retained"));
+#else
+    // Walks every arena under their locks, fine for a debug endpoint
+    struct mallinfo2 info = mallinfo2();
+    return snprintf(out, size,
+                    "{\"backend\":\"%s\",\"allocated_bytes\":%zu,\"free_bytes\":%zu,\"heap_bytes\":%zu,"
+                    "\"mmapped_bytes\":%zu,\"releasable_bytes\":%zu}",
+                    UB_ALLOCATOR_NAME, info.uordblks, info.fordblks, info.arena, info.hblkhd, info.keepcost);
+#endif
+}
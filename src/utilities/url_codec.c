@@ -0,0 +1,125 @@
+#include "utilities/url_codec.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "utilities/http_scan.h"
+
+static int url_codec_hex(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+size_t url_codec_decode(const char* data, size_t length, char* out) {
+    static const char special[4] = {'%', '+', '%', '+'};
+    size_t written = 0;
+    size_t i = 0;
+    while (i < length) {
+        // Most values have nothing to decode, the plain runs are found vectorized
+        size_t run = http_scan(data + i, length - i, special);
+        if (run > 0) {
+            if (out + written != data + i) memmove(out + written, data + i, run);
+            written += run;
+            i += run;
+            if (i >= length) break;
+        }
+        if (data[i] == '+') {
+            out[written++] = ' ';
+            i++;
+        } else if (i + 2 < length && url_codec_hex(data[i + 1]) >= 0 && url_codec_hex(data[i + 2]) >= 0) {
+            out[written++] = (char)(url_codec_hex(data[i + 1]) * 16 + url_codec_hex(data[i + 2]));
+            i += 3;
+        } else {
+            out[written++] = '%';
+            i++;
+        }
+    }
+    return written;
+}
+
+size_t url_codec_encode(const char* data, char* out, size_t size) {
+    static const char digits[] = "0123456789ABCDEF";
+    size_t length = 0;
+    // what fits, an escape is never cut in half
+    size_t written = 0;
+    for (const unsigned char* p = (const unsigned char*)data; *p; p++) {
+        int plain = isalnum(*p) || *p == '-' || *p == '.' || *p == '_' || *p == '~';
+        size_t need = plain ? 1 : 3;
+        if (written == length && length + need < size) {
+            if (plain) {
+                out[length] = (char)*p;
+            } else {
+                out[length] = '%';
+                out[length + 1] = digits[*p >> 4];
+                out[length + 2] = digits[*p & 15];
+            }
+            written += need;
+        }
+        length += need;
+    }
+    if (size > 0) out[written] = '\0';
+    return length;
+}
+
+// Lower case of a code point written in two UTF-8 bytes, the code point
+// itself if it has none of the same length
+static uint32_t url_codec_lower(uint32_t cp) {
+    if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) return cp + 0x20;
+    if (cp >= 0x100 && cp <= 0x17F) {
+        // Latin Extended-A pairs upper and lower case, on even code points
+        // and then, from Ĺ to Ň and again from Ź, on odd ones
+        if (cp == 0x130 || cp == 0x131 || cp == 0x138 || cp == 0x149 || cp == 0x17F) return cp;
+        if (cp == 0x178) return 0xFF;
+        int odd = (cp >= 0x139 && cp <= 0x148) || cp >= 0x179;
+        return (cp & 1) == (uint32_t)odd ? cp + 1 : cp;
+    }
+    if (cp >= 0x391 && cp <= 0x3A9 && cp != 0x3A2) return cp + 0x20;
+    if (cp == 0x386) return 0x3AC;
+    if (cp >= 0x388 && cp <= 0x38A) return cp + 0x25;
+    if (cp == 0x38C) return 0x3CC;
+    if (cp == 0x38E || cp == 0x38F) return cp + 0x3F;
+    if (cp >= 0x400 && cp <= 0x40F) return cp + 0x50;
+    if (cp >= 0x410 && cp <= 0x42F) return cp + 0x20;
+    return cp;
+}
+
+void url_codec_fold(const char* data, size_t length, char* out) {
+    const unsigned char* in = (const unsigned char*)data;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = in[i];
+        if (c < 0x80) {
+            out[i] = (char)tolower(c);
+        } else if ((c & 0xE0) == 0xC0 && i + 1 < length && (in[i + 1] & 0xC0) == 0x80) {
+            uint32_t cp = url_codec_lower(((uint32_t)(c & 0x1F) << 6) | (in[i + 1] & 0x3F));
+            out[i] = (char)(0xC0 | (cp >> 6));
+            out[i + 1] = (char)(0x80 | (cp & 0x3F));
+            i++;
+        } else {
+            out[i] = (char)c;
+        }
+    }
+}
+
+size_t url_codec_key(const char* name, char* key, size_t size) {
+    if (size == 0) return 0;
+    size_t name_length = strnlen(name, size - 1);
+    url_codec_fold(name, name_length, key);
+
+    size_t length = 0;
+    int blank = 0;
+    for (size_t i = 0; i < name_length; i++) {
+        unsigned char c = (unsigned char)key[i];
+        if (isspace(c)) {
+            blank = length > 0;
+            continue;
+        }
+        if (blank) key[length++] = ' ';
+        blank = 0;
+        key[length++] = (char)c;
+    }
+    key[length] = '\0';
+    return length;
+}
@@ -16,6 +16,17 @@ uint64_t SystemMonotonicMS() {
   return result;
 }
 
+uint64_t SystemMonotonicNS() {
+  struct timespec spec;
+  clock_gettime(CLOCK_MONOTONIC, &spec);
+
+  uint64_t result = spec.tv_sec;
+  result *= 1000000000;
+  result += spec.tv_nsec;
+
+  return result;
+}
+
 uint8_t* readFileToBuffer(const char* path, size_t* outSize) {
     FILE* f = fopen(path, "rb");
     if (!f) return NULL;
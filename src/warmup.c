@@ -0,0 +1,52 @@
+#include "warmup.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "utils.h"
+#include "backends/cities.h"
+#include "backends/weather.h"
+#include "utilities/curl_client.h"
+
+//-----------------Internal Functions-----------------
+
+static void* warmup_weather(void* _Context)
+{
+	warmup_report* _Report = (warmup_report*)_Context;
+	double latitudes[WARMUP_MAX_LOCATIONS];
+	double longitudes[WARMUP_MAX_LOCATIONS];
+
+	int count = cities_locations(latitudes, longitudes, WARMUP_MAX_LOCATIONS);
+	_Report->weather = weather_warmup(latitudes, longitudes, count);
+	return NULL;
+}
+
+static void* warmup_cities(void* _Context)
+{
+	warmup_report* _Report = (warmup_report*)_Context;
+
+	_Report->cities = cities_warmup() == 0 ? 1 : 0;
+	return NULL;
+}
+
+//----------------------------------------------------
+
+int warmup_run(warmup_report* _Report)
+{
+	memset(_Report, 0, sizeof(warmup_report));
+	uint64_t started = SystemMonotonicMS();
+
+	pthread_t thread;
+	int threaded = pthread_create(&thread, NULL, warmup_cities, _Report) == 0;
+	if(!threaded)
+		warmup_cities(_Report);
+
+	warmup_weather(_Report);
+	// The connections warm up opened are of no use to the workers
+	curl_client_release_thread();
+
+	if(threaded)
+		pthread_join(thread, NULL);
+
+	_Report->milliseconds = (long long)(SystemMonotonicMS() - started);
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include "watcher.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "smw.h"
+#include "backends/cities.h"
+#include "backends/surprise.h"
+#include "utilities/job_pool.h"
+#include "utilities/logger.h"
+
+typedef struct
+{
+	int fd;
+	smw_task* task;
+	int citiesWatch;
+	int surpriseWatch;
+	/* its variants/ subfolder, -1 until there is one */
+	int variantsWatch;
+	/* changed since the last rebuild */
+	int citiesChanged;
+	int surpriseChanged;
+
+} watcher;
+
+#define WATCHER_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE)
+
+static watcher g_watcher = {-1, NULL, -1, -1, -1, 0, 0};
+
+//-----------------Internal Functions-----------------
+
+static void watcher_reload_cities(void* _Context)
+{
+	(void)_Context;
+	if(cities_reload() != 0)
+		LOG_WARN("Watcher: rebuilding the cities snapshot failed");
+}
+
+static void watcher_reload_surprise(void* _Context)
+{
+	(void)_Context;
+	if(surprise_reload() != 0)
+		LOG_WARN("Watcher: rebuilding the surprise index failed");
+}
+
+static void watcher_read(watcher* _Watcher)
+{
+	/* aligned as inotify_event, several events per read */
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const char* store = strrchr(Cities_STORE_PATH, '/');
+	store = store ? store + 1 : Cities_STORE_PATH;
+
+	for(;;)
+	{
+		ssize_t length = read(_Watcher->fd, buffer, sizeof(buffer));
+		if(length <= 0)
+			break;
+
+		for(char* p = buffer; p < buffer + length;)
+		{
+			const struct inotify_event* event = (const struct inotify_event*)p;
+			p += sizeof(struct inotify_event) + event->len;
+
+			/* in cache/cities only the store counts, its temporaries and
+			   other files come and go with every save */
+			if(event->wd == _Watcher->citiesWatch && event->len > 0 && strcmp(event->name, store) == 0)
+				_Watcher->citiesChanged = 1;
+			else if(event->wd == _Watcher->surpriseWatch || event->wd == _Watcher->variantsWatch)
+				_Watcher->surpriseChanged = 1;
+			/* the folder went, watched again once it is back */
+			if(event->wd == _Watcher->variantsWatch && (event->mask & IN_IGNORED))
+				_Watcher->variantsWatch = -1;
+		}
+	}
+}
+
+static void watcher_taskwork(void* _Context, uint64_t _MonTime)
+{
+	watcher* _Watcher = (watcher*)_Context;
+	smw_task* task = _Watcher->task;
+
+	if(task->revents & SMW_READ)
+	{
+		watcher_read(_Watcher);
+		/* restarts the quiet period */
+		if(_Watcher->citiesChanged || _Watcher->surpriseChanged)
+			smw_setDeadline(task, _MonTime + WATCHER_DEBOUNCE_MS);
+		return;
+	}
+
+	if(task->revents & SMW_TIMEOUT)
+	{
+		if(_Watcher->citiesChanged)
+		{
+			LOG_INFO("Watcher: cities changed, rebuilding");
+			job_pool_submit(watcher_reload_cities, NULL, NULL);
+		}
+		if(_Watcher->surpriseChanged)
+		{
+			/* made after the start, by make surprise-variants */
+			if(_Watcher->variantsWatch < 0)
+				_Watcher->variantsWatch = inotify_add_watch(_Watcher->fd, Surprise_VARIANTS_FOLDER, WATCHER_MASK);
+			LOG_INFO("Watcher: surprise folder changed, rebuilding");
+			job_pool_submit(watcher_reload_surprise, NULL, NULL);
+		}
+		_Watcher->citiesChanged = 0;
+		_Watcher->surpriseChanged = 0;
+	}
+}
+
+//----------------------------------------------------
+
+int watcher_attach(void)
+{
+	watcher* _Watcher = &g_watcher;
+	if(_Watcher->fd >= 0)
+		return 0;
+
+	_Watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_Watcher->fd < 0)
+		return -1;
+
+	_Watcher->citiesWatch = inotify_add_watch(_Watcher->fd, Cities_CACHE_DIR, WATCHER_MASK);
+	_Watcher->surpriseWatch = inotify_add_watch(_Watcher->fd, Surprise_FOLDER, WATCHER_MASK);
+	_Watcher->variantsWatch = inotify_add_watch(_Watcher->fd, Surprise_VARIANTS_FOLDER, WATCHER_MASK);
+	if(_Watcher->citiesWatch < 0 && _Watcher->surpriseWatch < 0)
+	{
+		watcher_detach();
+		return -1;
+	}
+
+	_Watcher->task = smw_createTask(_Watcher, watcher_taskwork);
+	if(_Watcher->task == NULL || smw_watchFd(_Watcher->task, _Watcher->fd, SMW_READ) != 0)
+	{
+		watcher_detach();
+		return -1;
+	}
+	smw_setTaskName(_Watcher->task, "watcher");
+	return 0;
+}
+
+void watcher_detach(void)
+{
+	watcher* _Watcher = &g_watcher;
+	if(_Watcher->task != NULL)
+		smw_destroyTask(_Watcher->task);
+	if(_Watcher->fd >= 0)
+		close(_Watcher->fd);
+
+	_Watcher->fd = -1;
+	_Watcher->task = NULL;
+	_Watcher->citiesWatch = -1;
+	_Watcher->surpriseWatch = -1;
+	_Watcher->variantsWatch = -1;
+	_Watcher->citiesChanged = 0;
+	_Watcher->surpriseChanged = 0;
+}
@@ -0,0 +1,647 @@
+#define _GNU_SOURCE
+#include "workers.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "smw.h"
+#include "utils.h"
+#include "WeatherServer.h"
+#include "hot_restart.h"
+#include "startup.h"
+#include "utilities/curl_client.h"
+#include "utilities/epoch.h"
+#include "utilities/job_pool.h"
+#include "utilities/loop_mailbox.h"
+#include "utilities/object_pool.h"
+#include "uring.h"
+#include "watcher.h"
+#include "prewarm.h"
+#include "connection.h"
+#include "utilities/logger.h"
+#include "utilities/metrics.h"
+#include "utilities/shm_table.h"
+
+/* set_mempolicy(2) mode, not every libc has the numaif.h of libnuma */
+#ifndef MPOL_LOCAL
+	#define MPOL_LOCAL 4
+#endif
+
+typedef struct
+{
+	int index;
+	/* its mailbox, index with threads, 0 in a process of its own */
+	int loop;
+	/* a process of workers_prefork, the master says when all are ready */
+	int prefork;
+	char* port;
+	volatile int* running;
+	/* shared by all workers: how many there are, how many got as far as
+	   serving or failing, and whether worker 0 failed */
+	int count;
+	int* settled;
+	int* failed;
+	pthread_t thread;
+	int started;
+	int result;
+
+} worker;
+
+/* what the prefork master and its workers share, made before the fork */
+typedef struct
+{
+	/* per worker as worker.settled and worker.failed, reset on each fork */
+	int settled[WORKERS_MAX_COUNT];
+	int failed[WORKERS_MAX_COUNT];
+	int64_t restarts;
+
+} workers_shared;
+
+/* the prefork master's: its sockets, worker i's ports at fds[i * portCount] */
+typedef struct
+{
+	int count;
+	char* port;
+	volatile int* running;
+	const char* ports[2];
+	int portCount;
+	int fds[WORKERS_MAX_COUNT * 2];
+	pid_t pids[WORKERS_MAX_COUNT];
+	uint64_t forkedMS[WORKERS_MAX_COUNT];
+	workers_shared* shared;
+
+} workers_master;
+
+/* the CPUs workers_set_cpus picked, worker i runs on g_cpus[i % g_cpuCount];
+   none leaves the threads to the scheduler */
+static int g_cpus[WORKERS_MAX_COUNT];
+static int g_cpuCount = 0;
+/* us every worker busy polls for, 0 = the loops sleep */
+static int g_busyPollUsecs = 0;
+
+//-----------------Internal Functions-----------------
+
+/* keeps the calling worker on its CPU and what it allocates from here on
+   (the loop's pools, arenas and caches, touched first by this thread) on
+   that CPU's node. Failing either only costs locality */
+static void workers_pin(worker* _Worker)
+{
+	if(g_cpuCount == 0)
+		return;
+
+	int cpu = g_cpus[_Worker->index % g_cpuCount];
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+	{
+		LOG_WARN("Worker %d: could not be pinned to CPU %d", _Worker->index, cpu);
+		return;
+	}
+	if(syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0UL) != 0)
+		LOG_WARN("Worker %d: memory policy not set, allocations may be remote", _Worker->index);
+
+	/* its listeners ask for the connections the kernel handles on it */
+	conn_set_loop_cpu(cpu);
+
+	unsigned int node = 0;
+	if(syscall(SYS_getcpu, NULL, &node, NULL) != 0)
+		node = 0;
+	LOG_INFO("Worker %d: pinned to CPU %d, node %u", _Worker->index, cpu, node);
+}
+
+/* the last worker to get there releases the process we replace, unless
+   worker 0 failed and we are about to exit */
+static void workers_settle(worker* _Worker, int _Failed)
+{
+	if(_Failed && _Worker->loop == 0)
+		__atomic_store_n(_Worker->failed, 1, __ATOMIC_RELEASE);
+	if(__atomic_add_fetch(_Worker->settled, 1, __ATOMIC_ACQ_REL) == _Worker->count &&
+	   !__atomic_load_n(_Worker->failed, __ATOMIC_ACQUIRE) && !_Worker->prefork)
+	{
+		hot_restart_ready();
+		startup_ready();
+	}
+}
+
+static void* workers_loop(void* _Context)
+{
+	worker* _Worker = (worker*)_Context;
+
+	workers_pin(_Worker);
+
+	if(smw_init() != 0)
+	{
+		printf("Worker %d: failed to initialize scheduler\n", _Worker->index);
+		_Worker->result = -1;
+		workers_settle(_Worker, 1);
+		return NULL;
+	}
+
+	/* before any listener exists, they take the loop's socket options */
+	if(g_busyPollUsecs > 0)
+	{
+		if(smw_setBusyPoll(g_busyPollUsecs) != 0)
+			LOG_WARN("Worker %d: epoll busy poll parameters refused, spinning without them", _Worker->index);
+		conn_set_loop_busy_poll(g_busyPollUsecs);
+	}
+
+	/* every handoff into the loop arrives through it, the job pool's too */
+	if(loop_mailbox_attach(_Worker->loop) != 0)
+	{
+		printf("Worker %d: failed to attach a mailbox\n", _Worker->index);
+		smw_dispose();
+		_Worker->result = -1;
+		workers_settle(_Worker, 1);
+		return NULL;
+	}
+
+	if(job_pool_attach() != 0)
+	{
+		printf("Worker %d: failed to attach to job pool\n", _Worker->index);
+		loop_mailbox_detach();
+		smw_dispose();
+		_Worker->result = -1;
+		workers_settle(_Worker, 1);
+		return NULL;
+	}
+
+	/* the snapshots a reload replaces wait for every attached loop */
+	if(epoch_attach() != 0)
+	{
+		printf("Worker %d: failed to attach to the reload epochs\n", _Worker->index);
+		job_pool_detach();
+		loop_mailbox_detach();
+		smw_dispose();
+		_Worker->result = -1;
+		workers_settle(_Worker, 1);
+		return NULL;
+	}
+
+	if(curl_client_attach_loop() != 0)
+	{
+		printf("Worker %d: failed to attach curl to the loop\n", _Worker->index);
+		epoch_detach();
+		job_pool_detach();
+		loop_mailbox_detach();
+		smw_dispose();
+		_Worker->result = -1;
+		workers_settle(_Worker, 1);
+		return NULL;
+	}
+
+	/* one loop is enough to notice the folders change, one per process */
+	if(_Worker->loop == 0 && watcher_attach() != 0)
+		printf("Worker %d: not watching the asset folders, changes need a restart\n", _Worker->index);
+
+	WeatherServer server;
+	if(WeatherServer_Initiate(&server, _Worker->port) != 0)
+	{
+		printf("Worker %d: failed to start server\n", _Worker->index);
+		if(_Worker->loop == 0)
+			watcher_detach();
+		curl_client_release_thread();
+		uring_detach();
+		epoch_detach();
+		job_pool_detach();
+		loop_mailbox_detach();
+		smw_dispose();
+		_Worker->result = -1;
+		workers_settle(_Worker, 1);
+		return NULL;
+	}
+
+	workers_settle(_Worker, 0);
+
+	/* the first worker walks the region, in a prefork the process of index 0 */
+	if(_Worker->index == 0 && prewarm_attach() != 0)
+		printf("Worker %d: failed to start the pre-warm, the region is not warmed\n", _Worker->index);
+
+	/* once another process took the listeners over, until what was
+	   accepted before is answered or HOT_RESTART_DRAIN_MS passed */
+	uint64_t drainUntil = 0;
+	while(*_Worker->running)
+	{
+		uint64_t now = SystemMonotonicMS();
+		if(hot_restart_draining())
+		{
+			if(drainUntil == 0)
+			{
+				WeatherServer_Drain(&server);
+				drainUntil = now + HOT_RESTART_DRAIN_MS;
+			}
+			if(server.instances == NULL || now >= drainUntil)
+				break;
+		}
+		smw_work(now);
+		/* nothing published is held from one pass to the next */
+		epoch_quiescent();
+	}
+
+	if(_Worker->index == 0)
+		prewarm_detach();
+	WeatherServer_Dispose(&server);
+	epoch_detach();
+	if(_Worker->loop == 0)
+		watcher_detach();
+	/* closing uring connections still have sends and closes in flight */
+	uring_detach();
+	/* and closing tcp ones zerocopy bodies the kernel has not let go of */
+	conn_zerocopy_detach();
+	/* runs the release of jobs abandoned by disposed backends */
+	job_pool_detach();
+	/* what other loops still ask finds the caches gone, a miss */
+	loop_mailbox_detach();
+	/* pooled connections and instances of this loop */
+	object_pool_drain();
+	smw_dispose();
+
+	_Worker->result = 0;
+	return NULL;
+}
+
+//----------------------------------------------------
+
+int workers_set_cpus(const char* _List)
+{
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return -1;
+
+	int cpus[WORKERS_MAX_COUNT];
+	int count = 0;
+	if(_List == NULL || strcmp(_List, "auto") == 0)
+	{
+		/* the CPUs the process may run on, in order */
+		int cpu;
+		for(cpu = 0; cpu < CPU_SETSIZE && count < WORKERS_MAX_COUNT; cpu++)
+		{
+			if(CPU_ISSET(cpu, &allowed))
+				cpus[count++] = cpu;
+		}
+	}
+	else
+	{
+		/* 0-3,8: single CPUs and ranges */
+		const char* next = _List;
+		while(*next != '\0')
+		{
+			char* end = NULL;
+			long first = strtol(next, &end, 10);
+			if(end == next || first < 0 || first >= CPU_SETSIZE)
+				return -1;
+			long last = first;
+			if(*end == '-')
+			{
+				next = end + 1;
+				last = strtol(next, &end, 10);
+				if(end == next || last < first || last >= CPU_SETSIZE)
+					return -1;
+			}
+			long cpu;
+			for(cpu = first; cpu <= last; cpu++)
+			{
+				if(!CPU_ISSET((int)cpu, &allowed) || count == WORKERS_MAX_COUNT)
+					return -1;
+				cpus[count++] = (int)cpu;
+			}
+			if(*end == ',')
+				end++;
+			else if(*end != '\0')
+				return -1;
+			next = end;
+		}
+	}
+	if(count == 0)
+		return -1;
+
+	memcpy(g_cpus, cpus, sizeof(int) * count);
+	g_cpuCount = count;
+	return 0;
+}
+
+void workers_set_busy_poll(int _Usecs)
+{
+	g_busyPollUsecs = _Usecs > 0 ? _Usecs : 0;
+}
+
+int workers_run(int _Count, char* _Port, volatile int* _Running)
+{
+	if(_Count < 1 || _Count > WORKERS_MAX_COUNT)
+		return -1;
+
+	/* every worker's mailbox, cache keys are split between them */
+	if(loop_mailbox_init(_Count) != 0)
+		return -1;
+
+	worker* workers = (worker*)calloc(_Count, sizeof(worker));
+	if(workers == NULL)
+		return -1;
+
+	/* signals are handled by the main thread only, block them for the
+	   workers we spawn (the mask is inherited) */
+	sigset_t block, old;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+
+	int settled = 0;
+	int failed = 0;
+	int i;
+	for(i = 0; i < _Count; i++)
+	{
+		workers[i].index = i;
+		workers[i].loop = i;
+		workers[i].port = _Port;
+		workers[i].running = _Running;
+		workers[i].count = _Count;
+		workers[i].settled = &settled;
+		workers[i].failed = &failed;
+	}
+
+	for(i = 1; i < _Count; i++)
+	{
+		if(pthread_create(&workers[i].thread, NULL, workers_loop, &workers[i]) != 0)
+		{
+			printf("Worker %d: failed to create thread\n", i);
+			workers_settle(&workers[i], 1);
+			continue;
+		}
+		workers[i].started = 1;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	workers_loop(&workers[0]);
+
+	/* worker 0 failing to start stops everyone, draining the others
+	   finish on their own */
+	if(!hot_restart_draining())
+		*_Running = 0;
+
+	int result = workers[0].result;
+	for(i = 1; i < _Count; i++)
+	{
+		if(!workers[i].started)
+			continue;
+		pthread_join(workers[i].thread, NULL);
+		if(workers[i].result != 0)
+			result = workers[i].result;
+	}
+
+	free(workers);
+	return result;
+}
+
+//-----------------Prefork-----------------
+
+static int64_t workers_read_restarts(void* _Context)
+{
+	return __atomic_load_n(&((workers_shared*)_Context)->restarts, __ATOMIC_RELAXED);
+}
+
+/* in the forked process: worker _Index on its own sockets, what
+   workers_prefork returns there */
+static int workers_child(workers_master* _Master, int _Index)
+{
+	/* the master going away takes its workers along */
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+	/* the other workers' sockets are theirs */
+	int i, p;
+	for(i = 0; i < _Master->count; i++)
+	{
+		for(p = 0; p < _Master->portCount; p++)
+		{
+			int fd = _Master->fds[i * _Master->portCount + p];
+			if(fd < 0)
+				continue;
+			if(i == _Index)
+				conn_listen_inherit(_Master->ports[p], fd);
+			else
+				close(fd);
+		}
+	}
+
+	worker self;
+	memset(&self, 0, sizeof(self));
+	self.index = _Index;
+	self.loop = 0;
+	self.prefork = 1;
+	self.port = _Master->port;
+	self.running = _Master->running;
+	self.count = 1;
+	self.settled = &_Master->shared->settled[_Index];
+	self.failed = &_Master->shared->failed[_Index];
+
+	/* the one loop of the process, every cache key is its own */
+	if(loop_mailbox_init(1) != 0)
+	{
+		printf("Worker %d: failed to set up its mailbox\n", _Index);
+		workers_settle(&self, 1);
+		return -1;
+	}
+	workers_loop(&self);
+	return self.result;
+}
+
+/* 0 in the master, 1 in the new worker process (which has served by the
+   time it returns, with its result in *_Result), -1 if fork failed */
+static int workers_fork(workers_master* _Master, int _Index, int* _Result)
+{
+	__atomic_store_n(&_Master->shared->settled[_Index], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_Master->shared->failed[_Index], 0, __ATOMIC_RELAXED);
+	_Master->forkedMS[_Index] = SystemMonotonicMS();
+	/* nothing buffered is written twice */
+	fflush(NULL);
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+		LOG_ERROR("Worker %d: could not be forked (errno %d)", _Index, errno);
+		return -1;
+	}
+	if(pid == 0)
+	{
+		*_Result = workers_child(_Master, _Index);
+		return 1;
+	}
+	_Master->pids[_Index] = pid;
+	return 0;
+}
+
+/* a worker exited: 0 to fork it again, -1 if it never got to serve */
+static int workers_reap(workers_master* _Master, pid_t _Pid, int _Status)
+{
+	int i;
+	for(i = 0; i < _Master->count && _Master->pids[i] != _Pid; i++)
+		;
+	if(i == _Master->count)
+		return 0;
+	_Master->pids[i] = 0;
+	/* what it was writing when it died is not trusted */
+	shm_table_release_writer(_Pid);
+
+	if(__atomic_load_n(&_Master->shared->failed[i], __ATOMIC_ACQUIRE))
+	{
+		LOG_ERROR("Worker %d: failed to start, stopping", i);
+		return -1;
+	}
+	if(WIFSIGNALED(_Status))
+		LOG_WARN("Worker %d: process %d killed by signal %d, forking it again", i, (int)_Pid, WTERMSIG(_Status));
+	else
+		LOG_WARN("Worker %d: process %d exited with %d, forking it again", i, (int)_Pid, WEXITSTATUS(_Status));
+	return 0;
+}
+
+int workers_prefork(int _Count, char* _Port, volatile int* _Running)
+{
+	if(_Count < 1 || _Count > WORKERS_MAX_COUNT)
+		return -1;
+
+	workers_master master;
+	memset(&master, 0, sizeof(master));
+	master.count = _Count;
+	master.port = _Port;
+	master.running = _Running;
+#ifndef CONN_ONLY_TLS
+	master.ports[master.portCount++] = _Port;
+#endif
+#ifndef CONN_ONLY_TCP
+	master.ports[master.portCount++] = TLS_PORT;
+#endif
+
+	int i, p;
+	int result = 0;
+	for(i = 0; i < _Count * master.portCount; i++)
+		master.fds[i] = -1;
+	for(i = 0; i < _Count && result == 0; i++)
+	{
+		for(p = 0; p < master.portCount; p++)
+		{
+			int fd = conn_listen_bind(master.ports[p]);
+			master.fds[i * master.portCount + p] = fd;
+			if(fd < 0)
+			{
+				LOG_ERROR("Prefork: could not listen on port %s for worker %d", master.ports[p], i);
+				result = -1;
+			}
+		}
+	}
+
+	master.shared = (workers_shared*)mmap(NULL, sizeof(workers_shared), PROT_READ | PROT_WRITE,
+	                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(master.shared == (workers_shared*)MAP_FAILED)
+	{
+		master.shared = NULL;
+		result = -1;
+	}
+	if(result != 0)
+	{
+		for(i = 0; i < _Count * master.portCount; i++)
+		{
+			if(master.fds[i] >= 0)
+				close(master.fds[i]);
+		}
+		if(master.shared)
+			munmap(master.shared, sizeof(workers_shared));
+		return -1;
+	}
+	metrics_register_read("workers_restarts_total", "Worker processes forked again after one exited.",
+	                      METRICS_COUNTER, NULL, workers_read_restarts, master.shared);
+
+	int child = 0;
+	for(i = 0; i < _Count && child == 0; i++)
+	{
+		child = workers_fork(&master, i, &result);
+		if(child < 0)
+		{
+			/* those forked already are stopped below */
+			child = 0;
+			*_Running = 0;
+			result = -1;
+			break;
+		}
+	}
+
+	int ready = 0;
+	const struct timespec interval = {0, WORKERS_PREFORK_POLL_MS * 1000000L};
+	while(child == 0 && *_Running)
+	{
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if(pid > 0)
+		{
+			if(workers_reap(&master, pid, status) != 0)
+			{
+				*_Running = 0;
+				result = -1;
+			}
+			continue;
+		}
+
+		if(!ready)
+		{
+			int settled = 0;
+			for(i = 0; i < _Count; i++)
+				settled += __atomic_load_n(&master.shared->settled[i], __ATOMIC_ACQUIRE) > 0;
+			if(settled == _Count)
+			{
+				ready = 1;
+				startup_ready();
+			}
+		}
+
+		uint64_t now = SystemMonotonicMS();
+		for(i = 0; i < _Count && child == 0; i++)
+		{
+			if(master.pids[i] != 0 || now - master.forkedMS[i] < WORKERS_PREFORK_RESTART_MS)
+				continue;
+			__atomic_add_fetch(&master.shared->restarts, 1, __ATOMIC_RELAXED);
+			child = workers_fork(&master, i, &result);
+			if(child < 0)
+				child = 0;
+		}
+		if(child == 0)
+			nanosleep(&interval, NULL);
+	}
+
+	/* a worker process is done, the master's memory is its own to free */
+	if(child != 0)
+		return result;
+
+	/* the workers answer what they have in hand and exit */
+	for(i = 0; i < _Count; i++)
+	{
+		if(master.pids[i] > 0)
+			kill(master.pids[i], SIGTERM);
+	}
+	for(i = 0; i < _Count; i++)
+	{
+		if(master.pids[i] <= 0)
+			continue;
+		int status = 0;
+		while(waitpid(master.pids[i], &status, 0) < 0 && errno == EINTR)
+			;
+		shm_table_release_writer(master.pids[i]);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			LOG_WARN("Worker %d: process %d did not exit cleanly", i, (int)master.pids[i]);
+	}
+	for(i = 0; i < _Count * master.portCount; i++)
+	{
+		if(master.fds[i] >= 0)
+			close(master.fds[i]);
+	}
+	/* the shared counters stay mapped, the metric reads them */
+	return result;
+}
@@ -0,0 +1,338 @@
+// Times the CPU heavy steps of the backends over a corpus of open-meteo
+// responses: the forecast transform (single and batched), the forecast
+// parse (of the client body), the search result parse and serialize, and the /GetCities build.
+// Reports responses a second, input MB a second and the heap allocations
+// per response (the library's own, see bench_alloc.h).
+//
+// The corpus is a folder of forecast-*.json, batch-*.json and search-*.json
+// as the upstream sent them; `make corpus` records it from the live APIs
+// over the URLs `./backend_bench --urls` prints, the same the server asks.
+// Build with `make backend_bench`, MODE=release for numbers worth reading;
+// --json=FILE also writes them for perfcheck.
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "backends/cities.h"
+#include "backends/geolocation.h"
+#include "backends/weather.h"
+#include "bench_alloc.h"
+#include "bench_report.h"
+#include "linked_list.h"
+#include "utilities/json_arena.h"
+#include "utilities/json_scan.h"
+
+#define BENCH_CORPUS_DIR "tools/corpus"
+#define BENCH_MIN_NS 300000000ull
+#define BENCH_MAX_FILES 256
+#define BENCH_BATCH_MAX 64
+
+// ========== Corpus ==========
+
+typedef struct {
+    char* name;
+    char* data;
+    size_t length;
+} bench_file;
+
+typedef struct {
+    bench_file files[BENCH_MAX_FILES];
+    int count;
+} bench_set;
+
+static bench_set g_forecasts;
+static bench_set g_batches;
+static bench_set g_searches;
+// The client bodies process_openmeteo_response made of the forecasts
+static bench_set g_bodies;
+
+static char* bench_read(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (data && fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    if (data) {
+        data[size] = '\0';
+        *length = (size_t)size;
+    }
+    return data;
+}
+
+static int bench_compare_files(const void* a, const void* b) {
+    return strcmp(((const bench_file*)a)->name, ((const bench_file*)b)->name);
+}
+
+static int bench_load(const char* folder) {
+    DIR* dir = opendir(folder);
+    if (dir == NULL) return -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        size_t length = strlen(name);
+        if (length < 5 || strcmp(name + length - 5, ".json") != 0) continue;
+        bench_set* set = strncmp(name, "forecast-", 9) == 0 ? &g_forecasts
+                         : strncmp(name, "batch-", 6) == 0  ? &g_batches
+                         : strncmp(name, "search-", 7) == 0 ? &g_searches
+                                                            : NULL;
+        if (set == NULL || set->count == BENCH_MAX_FILES) continue;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", folder, name);
+        bench_file* file = &set->files[set->count];
+        file->data = bench_read(path, &file->length);
+        if (file->data == NULL) continue;
+        file->name = strdup(name);
+        set->count++;
+    }
+    closedir(dir);
+    qsort(g_forecasts.files, (size_t)g_forecasts.count, sizeof(bench_file), bench_compare_files);
+    qsort(g_batches.files, (size_t)g_batches.count, sizeof(bench_file), bench_compare_files);
+    qsort(g_searches.files, (size_t)g_searches.count, sizeof(bench_file), bench_compare_files);
+    return 0;
+}
+
+// ========== Recording ==========
+
+typedef struct {
+    const char* file;
+    const char* name; // URL encoded
+} bench_search;
+
+static const bench_search bench_searches[] = {
+    {"search-stockholm.json", "Stockholm"}, {"search-goteborg.json", "G%C3%B6teborg"},
+    {"search-s.json", "S"},                 {"search-springfield.json", "Springfield"},
+    {"search-new-york.json", "New%20York"}, {"search-none.json", "Nowhere%20Like%20This"},
+};
+
+// "file URL" lines for `make corpus`: a forecast per built in city, one
+// batch of the first four and the searches
+static void bench_print_urls(void) {
+    double latitudes[BENCH_BATCH_MAX];
+    double longitudes[BENCH_BATCH_MAX];
+    int count = cities_locations(latitudes, longitudes, BENCH_BATCH_MAX);
+    char url[4096];
+    for (int i = 0; i < count; i++) {
+        snprintf(url, sizeof(url), METEO_FORECAST_URL, weather_api_url(), latitudes[i], longitudes[i]);
+        printf("forecast-%.4f_%.4f.json %s\n", latitudes[i], longitudes[i], url);
+    }
+    char lats[256] = "";
+    char lons[256] = "";
+    for (int i = 0; i < count && i < 4; i++) {
+        snprintf(lats + strlen(lats), sizeof(lats) - strlen(lats), "%s%.6f", i ? "," : "", latitudes[i]);
+        snprintf(lons + strlen(lons), sizeof(lons) - strlen(lons), "%s%.6f", i ? "," : "", longitudes[i]);
+    }
+    snprintf(url, sizeof(url), METEO_FORECAST_BATCH_URL, weather_api_url(), lats, lons);
+    printf("batch-4.json %s\n", url);
+    for (size_t i = 0; i < sizeof(bench_searches) / sizeof(bench_searches[0]); i++) {
+        snprintf(url, sizeof(url), METEO_GEOLOCATION_URL, geolocation_api_url(), bench_searches[i].name, 10);
+        printf("%s %s\n", bench_searches[i].file, url);
+    }
+}
+
+// ========== Benchmarks ==========
+
+// One response, -1 if it did not go through
+typedef int (*bench_fn)(const bench_file* file);
+
+static int bench_process_forecast(const bench_file* file) {
+    char* body = NULL;
+    int result = process_openmeteo_response(file->data, &body);
+    free(body);
+    return result;
+}
+
+static int bench_transform_batch(const bench_file* file) {
+    char* bodies[BENCH_BATCH_MAX];
+    uint8_t* records[BENCH_BATCH_MAX];
+    size_t lengths[BENCH_BATCH_MAX];
+    int result = weather_transform_batch(file->data, BENCH_BATCH_MAX, bodies, records, lengths);
+    for (int i = 0; i < BENCH_BATCH_MAX; i++) {
+        free(bodies[i]);
+        free(records[i]);
+    }
+    return result;
+}
+
+static int bench_deserialize_forecast(const bench_file* file) {
+    weather_data_t weather;
+    if (deserialize_weather_response(file->data, &weather) != 0) return -1;
+    free_weather(&weather);
+    return 0;
+}
+
+// Every result of the search parsed and serialized, as the backend does
+static int bench_search_locations(const bench_file* file) {
+    json_scan scan;
+    json_scan_init(&scan, file->data, file->length);
+    if (json_scan_object_begin(&scan) != 0) return -1;
+    const char* key;
+    size_t length;
+    while (json_scan_object_next(&scan, &key, &length) > 0) {
+        if (!json_scan_key_is(key, length, "results") || json_scan_peek(&scan) != JSON_SCAN_ARRAY) {
+            json_scan_skip(&scan);
+            continue;
+        }
+        json_scan_array_begin(&scan);
+        while (json_scan_array_next(&scan) > 0) {
+            location_t location;
+            json_t* json = NULL;
+            if (parse_openmeteo_geo_json_to_location(&scan, &location) != 0) return -1;
+            if (serialize_location_to_json(&location, &json) == 0) json_decref(json);
+            free_location(&location);
+        }
+    }
+    return scan.failed ? -1 : 0;
+}
+
+static cities_t g_cities;
+
+static void bench_add_city(const char* name, double latitude, double longitude, void* context) {
+    (void)context;
+    char lat[32], lon[32];
+    snprintf(lat, sizeof(lat), "%.4f", latitude);
+    snprintf(lon, sizeof(lon), "%.4f", longitude);
+    city_t* city = NULL;
+    if (city_init(name, lat, lon, &city) == 0) LinkedList_append(g_cities.cities_list, city);
+}
+
+static int bench_cities(const bench_file* file) {
+    (void)file;
+    if (cities_convert_to_char_json_buffer(&g_cities) != 0) return -1;
+    free(g_cities.buffer);
+    g_cities.buffer = NULL;
+    return 0;
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Rounds over the set doubling until a run is long enough to trust
+static int bench_run(const char* name, bench_fn fn, const bench_set* set) {
+    if (set->count == 0) {
+        printf("%-34s %s\n", name, "(no input in the corpus)");
+        return 0;
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < set->count; i++) {
+        if (fn(&set->files[i]) != 0) {
+            printf("%-34s %s does not go through\n", name, set->files[i].name ? set->files[i].name : "list");
+            return -1;
+        }
+        bytes += set->files[i].length;
+    }
+    uint64_t rounds = 1;
+    for (;;) {
+        uint64_t allocations = g_benchAllocations;
+        uint64_t allocated = g_benchAllocatedBytes;
+        uint64_t start = bench_now_ns();
+        for (uint64_t r = 0; r < rounds; r++) {
+            for (int i = 0; i < set->count; i++) fn(&set->files[i]);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        if (elapsed >= BENCH_MIN_NS || rounds >= (1ull << 24)) {
+            double responses = (double)rounds * set->count;
+            double seconds = (double)elapsed / 1e9;
+            double allocs = (double)(g_benchAllocations - allocations) / responses;
+            double kib = (double)(g_benchAllocatedBytes - allocated) / responses / 1024.0;
+            printf("%-34s %12.0f %10.1f %12.1f %12.1f\n", name, responses / seconds,
+                   (double)bytes * rounds / seconds / 1e6, allocs, kib);
+            bench_report("rate", "responses/s", responses / seconds, "%s/responses_per_second", name);
+            bench_report("allocs", "allocs", allocs, "%s/allocs_per_response", name);
+            bench_report("allocs", "KiB", kib, "%s/kib_per_response", name);
+            return 0;
+        }
+        rounds *= 2;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    json_arena_install();
+    if (argc >= 2 && strcmp(argv[1], "--urls") == 0) {
+        // --upstream= as the server takes it, both APIs under one origin
+        if (argc == 3 && strncmp(argv[2], "--upstream=", strlen("--upstream=")) == 0) {
+            char base[METEO_API_URL_SIZE];
+            const char* origin = argv[2] + strlen("--upstream=");
+            size_t length = strlen(origin);
+            while (length > 0 && origin[length - 1] == '/') length--;
+            snprintf(base, sizeof(base), "%.*s/v1/", (int)length, origin);
+            if (length == 0 || weather_set_api_url(base) != 0 || geolocation_set_api_url(base) != 0) {
+                printf("Upstream: %s, expected scheme://host[:port]\n", origin);
+                return 1;
+            }
+        } else if (argc != 2) {
+            printf("Usage: %s --urls [--upstream=URL]\n", argv[0]);
+            return 1;
+        }
+        bench_print_urls();
+        return 0;
+    }
+    const char* folder = BENCH_CORPUS_DIR;
+    const char* json = NULL;
+    int usage = 0, folders = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--json=", 7) == 0) json = argv[i] + 7;
+        else if (argv[i][0] != '-' && folders++ == 0) folder = argv[i];
+        else usage = 1;
+    }
+    if (usage) {
+        printf("Usage: %s [--json=FILE] [corpus folder (%s)] | --urls [--upstream=URL]\n", argv[0], BENCH_CORPUS_DIR);
+        return 1;
+    }
+    if (bench_load(folder) != 0) {
+        printf("Corpus: %s can not be read\n", folder);
+        return 1;
+    }
+
+    // The built in list, its JSON stands in for a file
+    g_cities.cities_list = LinkedList_create();
+    cities_each(bench_add_city, NULL);
+    bench_set cities = {.count = 1};
+    if (cities_convert_to_char_json_buffer(&g_cities) == 0) cities.files[0].length = (size_t)g_cities.bytesread;
+    free(g_cities.buffer);
+    g_cities.buffer = NULL;
+
+    for (int i = 0; i < g_forecasts.count; i++) {
+        bench_file* body = &g_bodies.files[g_bodies.count];
+        if (process_openmeteo_response(g_forecasts.files[i].data, &body->data) != 0 || body->data == NULL) continue;
+        body->name = strdup(g_forecasts.files[i].name);
+        body->length = strlen(body->data);
+        g_bodies.count++;
+    }
+
+    printf("%s: %d forecast(s), %d batch(es), %d search(es)\n", folder, g_forecasts.count, g_batches.count,
+           g_searches.count);
+    printf("%-34s %12s %10s %12s %12s\n", "", "responses/s", "MB/s", "allocs/resp", "KiB/resp");
+    int failed = 0;
+    failed |= bench_run("process_openmeteo_response", bench_process_forecast, &g_forecasts);
+    failed |= bench_run("weather_transform_batch", bench_transform_batch, &g_batches);
+    failed |= bench_run("deserialize_weather_response", bench_deserialize_forecast, &g_bodies);
+    failed |= bench_run("parse_openmeteo_geo+serialize_loc", bench_search_locations, &g_searches);
+    failed |= bench_run("cities_convert_to_char_json_buffer", bench_cities, &cities);
+
+    LinkedList_dispose(&g_cities.cities_list, city_dispose);
+    bench_set* sets[] = {&g_forecasts, &g_batches, &g_searches, &g_bodies};
+    for (int s = 0; s < 4; s++) {
+        bench_set* set = sets[s];
+        for (int i = 0; i < set->count; i++) {
+            free(set->files[i].name);
+            free(set->files[i].data);
+        }
+    }
+    if (json && bench_report_write(json, "backend_bench") != 0) {
+        printf("%s can not be written\n", json);
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
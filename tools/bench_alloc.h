@@ -0,0 +1,51 @@
+#ifndef BENCH_ALLOC_H
+#define BENCH_ALLOC_H
+
+// Heap allocations made by the library's objects, for the benchmarks that
+// report them. Linked with BENCH_WRAP (-Wl,--wrap=malloc,...) every call the
+// archive makes comes here first; libc's own (and the sanitizer's) do not.
+// Include it in one file of the tool. Sizes are what was asked for.
+
+#include <stdint.h>
+#include <string.h>
+
+static uint64_t g_benchAllocations = 0;
+static uint64_t g_benchAllocatedBytes = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+char* __real_strdup(const char* text);
+char* __real_strndup(const char* text, size_t length);
+
+void* __wrap_malloc(size_t size) {
+    g_benchAllocations++;
+    g_benchAllocatedBytes += size;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    g_benchAllocations++;
+    g_benchAllocatedBytes += count * size;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+    g_benchAllocations++;
+    g_benchAllocatedBytes += size;
+    return __real_realloc(pointer, size);
+}
+
+char* __wrap_strdup(const char* text) {
+    g_benchAllocations++;
+    g_benchAllocatedBytes += strlen(text) + 1;
+    return __real_strdup(text);
+}
+
+char* __wrap_strndup(const char* text, size_t length) {
+    g_benchAllocations++;
+    g_benchAllocatedBytes += strnlen(text, length) + 1;
+    return __real_strndup(text, length);
+}
+
+#endif
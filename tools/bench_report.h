@@ -0,0 +1,73 @@
+#ifndef BENCH_REPORT_H
+#define BENCH_REPORT_H
+
+// Machine readable results for `make perfcheck`. A tool given --json=FILE
+// adds its numbers with bench_report() and writes them once at the end with
+// bench_report_write(); the text it prints stays as it is. The kind tells
+// perfcheck which way is better and how much a number may move:
+//   time     ns per operation, lower is better
+//   rate     per second, higher is better
+//   latency  ms of a percentile, lower is better, noisier than time
+//   allocs   heap allocations or bytes per operation, they do not jitter
+//   count    events that should not happen more often (errors)
+// Include it in one file of the tool.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#define BENCH_REPORT_MAX 128
+#define BENCH_REPORT_NAME_SIZE 96
+
+typedef struct {
+    char name[BENCH_REPORT_NAME_SIZE];
+    const char* kind;
+    const char* unit;
+    double value;
+} bench_metric;
+
+static bench_metric g_benchMetrics[BENCH_REPORT_MAX];
+static int g_benchMetricCount = 0;
+
+// One number, its name printf style; past BENCH_REPORT_MAX they are dropped
+static void __attribute__((format(printf, 4, 5)))
+bench_report(const char* kind, const char* unit, double value, const char* format, ...) {
+    if (g_benchMetricCount == BENCH_REPORT_MAX) return;
+    bench_metric* metric = &g_benchMetrics[g_benchMetricCount++];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(metric->name, sizeof(metric->name), format, args);
+    va_end(args);
+    metric->kind = kind;
+    metric->unit = unit;
+    metric->value = value;
+}
+
+static void bench_report_string(FILE* file, const char* text) {
+    fputc('"', file);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\') fputc('\\', file);
+        if ((unsigned char)*text >= 0x20) fputc(*text, file);
+    }
+    fputc('"', file);
+}
+
+// {"bench": ..., "metrics": [{"name", "kind", "unit", "value"}, ...]} to
+// path, 0 or -1
+static int bench_report_write(const char* path, const char* bench) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return -1;
+    fprintf(file, "{\"bench\": ");
+    bench_report_string(file, bench);
+    fprintf(file, ", \"metrics\": [");
+    for (int i = 0; i < g_benchMetricCount; i++) {
+        const bench_metric* metric = &g_benchMetrics[i];
+        fprintf(file, "%s\n  {\"name\": ", i ? "," : "");
+        bench_report_string(file, metric->name);
+        fprintf(file, ", \"kind\": \"%s\", \"unit\": \"%s\", \"value\": %.17g}", metric->kind, metric->unit,
+                metric->value);
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,200 @@
+// Packs a GeoNames dump (allCountries.txt, cities15000.txt, ...) into the
+// file the server maps with --geonames-db, see backends/geolocation_offline.h.
+// Build with `make geonames_pack`, run as `geonames_pack <in.txt> <out.bin>`.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backends/geolocation_offline.h"
+
+typedef struct {
+    geolocation_offline_place place;
+    uint32_t ascii_name; // string offset, names are chained once places are sorted
+} pack_place;
+
+static char* g_strings = NULL;
+static size_t g_stringsSize = 0;
+static size_t g_stringsCapacity = 0;
+
+static uint32_t pack_string(const char* value) {
+    if (!value || !value[0]) return 0;
+    size_t length = strlen(value) + 1;
+    if (g_stringsSize + length > g_stringsCapacity) {
+        size_t capacity = g_stringsCapacity * 2;
+        while (capacity < g_stringsSize + length) capacity *= 2;
+        char* strings = (char*)realloc(g_strings, capacity);
+        if (!strings) return 0;
+        g_strings = strings;
+        g_stringsCapacity = capacity;
+    }
+    if (g_stringsSize + length > UINT32_MAX) return 0;
+    uint32_t offset = (uint32_t)g_stringsSize;
+    memcpy(g_strings + g_stringsSize, value, length);
+    g_stringsSize += length;
+    return offset;
+}
+
+static int pack_compare(const void* a, const void* b) {
+    const pack_place* left = (const pack_place*)a;
+    const pack_place* right = (const pack_place*)b;
+    if (left->place.population != right->place.population) {
+        return left->place.population > right->place.population ? -1 : 1;
+    }
+    return (left->place.id > right->place.id) - (left->place.id < right->place.id);
+}
+
+static int pack_fields(char* line, char** fields, int max) {
+    int count = 0;
+    char* field = line;
+    while (count < max) {
+        fields[count++] = field;
+        char* tab = strchr(field, '\t');
+        if (!tab) break;
+        *tab = '\0';
+        field = tab + 1;
+    }
+    return count;
+}
+
+static int pack_write(FILE* file, const void* data, size_t size) {
+    static const char padding[8] = {0};
+    if (size && fwrite(data, 1, size, file) != size) return -1;
+    size_t pad = (8 - size % 8) % 8;
+    return pad && fwrite(padding, 1, pad, file) != pad ? -1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <geonames.txt> <out.bin>\n", argv[0]);
+        return 1;
+    }
+    FILE* in = fopen(argv[1], "r");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // Offset 0 is the empty string
+    g_stringsCapacity = 1 << 20;
+    g_strings = (char*)calloc(1, g_stringsCapacity);
+    g_stringsSize = 1;
+    if (!g_strings) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    pack_place* places = NULL;
+    size_t place_count = 0;
+    size_t place_capacity = 0;
+    char line[16384];
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        // geonameid, name, asciiname, alternatenames, latitude, longitude,
+        // feature class, feature code, country code, cc2, admin1-4 codes,
+        // population, elevation, dem, timezone, modification date
+        char* fields[19];
+        if (pack_fields(line, fields, 19) < 18) continue;
+
+        if (place_count == place_capacity) {
+            place_capacity = place_capacity ? place_capacity * 2 : 65536;
+            pack_place* grown = (pack_place*)realloc(places, place_capacity * sizeof(pack_place));
+            if (!grown) {
+                fprintf(stderr, "Out of memory after %zu places\n", place_count);
+                return 1;
+            }
+            places = grown;
+        }
+        pack_place* entry = &places[place_count++];
+        memset(entry, 0, sizeof(pack_place));
+        entry->place.id = (uint32_t)strtoul(fields[0], NULL, 10);
+        entry->place.name = pack_string(fields[1]);
+        entry->place.latitude = atof(fields[4]);
+        entry->place.longitude = atof(fields[5]);
+        entry->place.feature_code = pack_string(fields[7]);
+        strncpy(entry->place.country_code, fields[8], sizeof(entry->place.country_code));
+        entry->place.population = atoi(fields[14]);
+        entry->place.elevation = atof(fields[15][0] ? fields[15] : fields[16]);
+        entry->place.timezone = pack_string(fields[17]);
+
+        char name_key[256];
+        char ascii_key[256];
+        geolocation_offline_key(fields[1], name_key, sizeof(name_key));
+        geolocation_offline_key(fields[2], ascii_key, sizeof(ascii_key));
+        entry->ascii_name = strcmp(name_key, ascii_key) != 0 ? pack_string(ascii_key) : 0;
+        if (!entry->place.name || !name_key[0]) place_count--;
+    }
+    fclose(in);
+
+    qsort(places, place_count, sizeof(pack_place), pack_compare);
+
+    uint32_t bucket_count = 1024;
+    while (bucket_count < place_count * 2 && bucket_count < (1u << 30)) bucket_count <<= 1;
+    uint32_t* buckets = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    uint32_t* tails = (uint32_t*)malloc(bucket_count * sizeof(uint32_t));
+    geolocation_offline_name* names = (geolocation_offline_name*)malloc(place_count * 2 * sizeof(geolocation_offline_name));
+    geolocation_offline_place* packed = (geolocation_offline_place*)malloc(place_count * sizeof(geolocation_offline_place) + 1);
+    if (!buckets || !tails || !names || !packed) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memset(buckets, 0xff, bucket_count * sizeof(uint32_t));
+
+    // Appended at the tail, a chain lists the most populous place first
+    uint32_t name_count = 0;
+    for (size_t i = 0; i < place_count; i++) {
+        packed[i] = places[i].place;
+        char key[256];
+        geolocation_offline_key(g_strings + places[i].place.name, key, sizeof(key));
+        uint32_t keys[2] = {pack_string(key), places[i].ascii_name};
+        for (int k = 0; k < 2; k++) {
+            if (!keys[k]) continue;
+            uint32_t bucket = geolocation_offline_hash(g_strings + keys[k]) & (bucket_count - 1);
+            names[name_count] = (geolocation_offline_name){keys[k], (uint32_t)i, Geolocation_OFFLINE_NONE};
+            if (buckets[bucket] == Geolocation_OFFLINE_NONE) {
+                buckets[bucket] = name_count;
+            } else {
+                names[tails[bucket]].next = name_count;
+            }
+            tails[bucket] = name_count++;
+        }
+    }
+
+    geolocation_offline_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, Geolocation_OFFLINE_MAGIC, sizeof(header.magic));
+    header.place_count = (uint32_t)place_count;
+    header.name_count = name_count;
+    header.bucket_count = bucket_count;
+    header.places_offset = sizeof(header);
+    header.names_offset = header.places_offset + place_count * sizeof(geolocation_offline_place);
+    header.names_offset += (8 - header.names_offset % 8) % 8;
+    header.buckets_offset = header.names_offset + name_count * sizeof(geolocation_offline_name);
+    header.buckets_offset += (8 - header.buckets_offset % 8) % 8;
+    header.strings_offset = header.buckets_offset + bucket_count * sizeof(uint32_t);
+    header.strings_offset += (8 - header.strings_offset % 8) % 8;
+    header.strings_size = g_stringsSize;
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    if (pack_write(out, &header, sizeof(header)) != 0 ||
+        pack_write(out, packed, place_count * sizeof(geolocation_offline_place)) != 0 ||
+        pack_write(out, names, name_count * sizeof(geolocation_offline_name)) != 0 ||
+        pack_write(out, buckets, bucket_count * sizeof(uint32_t)) != 0 ||
+        pack_write(out, g_strings, g_stringsSize) != 0 || fclose(out) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    printf("Packed %zu places, %u names, %u buckets into %s\n", place_count, name_count, bucket_count, argv[2]);
+
+    free(places);
+    free(packed);
+    free(names);
+    free(buckets);
+    free(tails);
+    free(g_strings);
+    return 0;
+}
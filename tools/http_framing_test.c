@@ -0,0 +1,127 @@
+// Requests whose body framing could smuggle a second request past the
+// server: the parser's view of them and, given a server, what it answers.
+// Build with `make http_framing_test`; `make test` runs it against a server
+// of its own. Without host and port only the parser is checked.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "HTTPParser.h"
+
+// What is smuggled in the body, answered with a 404 if it gets parsed
+#define FRAMING_SMUGGLED "GET /nope HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+static int g_failures = 0;
+
+static void framing_expect(int condition, const char* what) {
+    printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+    if (!condition) g_failures++;
+}
+
+// -1 if the head is invalid, else whether it announces a body
+static int framing_parse(const char* head) {
+    HTTPRequestParser parser;
+    HTTPRequestParser_init(&parser);
+    int result = HTTPRequestParser_execute(&parser, head, strlen(head));
+    if (result < 0) return -1;
+    if (result == 0) return -2;
+    return HTTPRequestParser_hasBody(&parser, head);
+}
+
+static void framing_parser_checks(void) {
+    framing_expect(framing_parse("GET / HTTP/1.1\r\nHost: a\r\n\r\n") == 0, "parser: no body without framing");
+    framing_expect(framing_parse("GET / HTTP/1.1\r\ncontent-length: 0\r\n\r\n") == 0, "parser: Content-Length 0");
+    framing_expect(framing_parse("GET / HTTP/1.1\r\nContent-Length: 12\r\n\r\n") == 1, "parser: Content-Length body");
+    framing_expect(framing_parse("GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n") == 1,
+                   "parser: Content-Length that is no number");
+    framing_expect(framing_parse("GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n") == 1,
+                   "parser: chunked body");
+    framing_expect(framing_parse("GET / HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 40\r\n\r\n") == -1,
+                   "parser: repeated Content-Length is invalid");
+    framing_expect(framing_parse("GET / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: x\r\n\r\n") == -1,
+                   "parser: repeated Transfer-Encoding is invalid");
+}
+
+// Sends request and reads until the server closes; the bytes read, -1 if
+// the connection failed or stayed open
+static int framing_exchange(const char* host, int port, const char* request, char* response, size_t size) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct timeval timeout = {3, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    if (inet_pton(AF_INET, host, &address.sin_addr) != 1 ||
+        connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        send(fd, request, strlen(request), 0) != (ssize_t)strlen(request)) {
+        close(fd);
+        return -1;
+    }
+    size_t total = 0;
+    for (;;) {
+        ssize_t got = recv(fd, response + total, size - 1 - total, 0);
+        if (got == 0) break;
+        if (got < 0 || total + (size_t)got >= size - 1) {
+            close(fd);
+            return -1;
+        }
+        total += (size_t)got;
+    }
+    close(fd);
+    response[total] = '\0';
+    return (int)total;
+}
+
+static int framing_count(const char* text, const char* needle) {
+    int count = 0;
+    for (const char* at = strstr(text, needle); at; at = strstr(at + 1, needle)) count++;
+    return count;
+}
+
+// One 400 and a closed connection, the smuggled request never answered
+static void framing_server_check(const char* host, int port, const char* request, const char* what) {
+    static char response[65536];
+    int length = framing_exchange(host, port, request, response, sizeof(response));
+    char line[128];
+    snprintf(line, sizeof(line), "server: %s is refused and the connection closed", what);
+    framing_expect(length > 0 && strncmp(response, "HTTP/1.1 400", 12) == 0 && framing_count(response, "HTTP/1.1 ") == 1,
+                   line);
+}
+
+static void framing_server_checks(const char* host, int port) {
+    char request[512];
+    snprintf(request, sizeof(request),
+             "GET /GetCities HTTP/1.1\r\nHost: localhost\r\nContent-Length: %zu\r\n\r\n" FRAMING_SMUGGLED,
+             strlen(FRAMING_SMUGGLED));
+    framing_server_check(host, port, request, "GET with Content-Length");
+    snprintf(request, sizeof(request),
+             "GET /GetCities HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n%zx\r\n" FRAMING_SMUGGLED
+             "\r\n0\r\n\r\n",
+             strlen(FRAMING_SMUGGLED));
+    framing_server_check(host, port, request, "chunked GET");
+    snprintf(request, sizeof(request),
+             "HEAD /GetCities HTTP/1.1\r\nHost: localhost\r\nContent-Length: %zu\r\n\r\n" FRAMING_SMUGGLED,
+             strlen(FRAMING_SMUGGLED));
+    framing_server_check(host, port, request, "HEAD with Content-Length");
+    framing_server_check(host, port,
+                         "GET /GetCities HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n"
+                         "Content-Length: 40\r\n\r\n" FRAMING_SMUGGLED,
+                         "repeated Content-Length");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 1 && argc != 3) {
+        printf("Usage: %s [host port]\n", argv[0]);
+        return 1;
+    }
+    framing_parser_checks();
+    if (argc == 3) framing_server_checks(argv[1], atoi(argv[2]));
+    printf("%d failure(s)\n", g_failures);
+    return g_failures ? 1 : 0;
+}
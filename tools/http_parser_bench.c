@@ -0,0 +1,213 @@
+// Times the request parsers, the query splitters and the response builders
+// on a corpus of requests as browsers and apps send them, in ns and heap
+// allocations per operation (the library's own, see bench_alloc.h).
+// Build with `make http_parser_bench`, MODE=release for numbers worth reading;
+// --json=FILE also writes them for perfcheck.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "HTTPParser.h"
+#include "bench_alloc.h"
+#include "bench_report.h"
+
+#define BENCH_MIN_NS 200000000ull
+
+// ========== Corpus ==========
+
+static const char* bench_requests[] = {
+    // Firefox on a dashboard
+    "GET /GetWeather?lat=59.3293&lon=18.0686 HTTP/1.1\r\n"
+    "Host: weather.example.org\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: sv-SE,sv;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://dashboard.example.org/cities/stockholm\r\n"
+    "Origin: https://dashboard.example.org\r\n"
+    "Connection: keep-alive\r\n"
+    "Sec-Fetch-Dest: empty\r\n"
+    "Sec-Fetch-Mode: cors\r\n"
+    "Sec-Fetch-Site: same-site\r\n"
+    "If-None-Match: \"5f2a9c0e81d3b7a4-1f40\"\r\n"
+    "\r\n",
+    // Chrome with a long, tracked search link
+    "GET /GetLocation?name=G%C3%B6teborg&count=10&language=sv&format=json&country=SE"
+    "&utm_source=newsletter&utm_medium=email&utm_campaign=autumn_2026&utm_content=hero_button"
+    "&fbclid=IwAR2v8sQpZk3x9Ld7Yq1FhT0bN4mK6cR5eW2uJ8oP3aS1dG7hL9zX0cV4nB6mQ HTTP/1.1\r\n"
+    "Host: weather.example.org\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"129\", \"Not=A?Brand\";v=\"8\", \"Google Chrome\";v=\"129\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+    "Chrome/129.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-GB,en;q=0.9,sv;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1728900000; _ga_ABCDEF1234=GS1.1.1728900000.1.1.1728900100.0.0.0; "
+    "theme=dark; units=metric\r\n"
+    "\r\n",
+    // A phone app
+    "GET /GetWeather?lat=57.7089&lon=11.9746&days=7&hourly=1 HTTP/1.1\r\n"
+    "Host: api.weather.example.org\r\n"
+    "Accept: application/json\r\n"
+    "Accept-Encoding: gzip\r\n"
+    "User-Agent: WeatherApp/3.14.2 (iPhone; iOS 18.0; Scale/3.00)\r\n"
+    "Accept-Language: sv-SE;q=1, en-SE;q=0.9\r\n"
+    "X-Request-Id: 7d9c2f4e-1b3a-4c5d-8e6f-0a1b2c3d4e5f\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    // curl
+    "GET /GetCities HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/8.9.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+};
+#define BENCH_REQUEST_COUNT ((int)(sizeof(bench_requests) / sizeof(bench_requests[0])))
+
+// The URLs of the corpus, as the server hands them to the query splitters
+static char bench_urls[BENCH_REQUEST_COUNT][1024];
+static const char* bench_parameters[] = {"lat", "lon", "name", "count", "country"};
+
+static const char bench_body[] =
+    "{\"city\":\"Stockholm\",\"lat\":59.3293,\"lon\":18.0686,\"temperature\":-3.5,\"humidity\":81,"
+    "\"wind\":12.3,\"code\":3,\"description\":\"Overcast\"}";
+
+// ========== Benchmarks ==========
+
+typedef size_t (*bench_fn)(int index);
+
+static size_t bench_request_fromstring(int index) {
+    HTTPRequest* request = HTTPRequest_fromstring(bench_requests[index]);
+    size_t checksum = request->valid ? strlen(request->URL) : 0;
+    HTTPRequest_Dispose(&request);
+    return checksum;
+}
+
+static size_t bench_request_parser(int index) {
+    HTTPRequestParser parser;
+    HTTPRequestParser_init(&parser);
+    const char* request = bench_requests[index];
+    if (HTTPRequestParser_execute(&parser, request, strlen(request)) != 1) return 0;
+    size_t length = 0;
+    const char* host = HTTPRequestParser_getHeader(&parser, request, "Host", &length);
+    return HTTPRequestParser_getURL(&parser, request).length + (host ? length : 0);
+}
+
+static size_t bench_query_fromstring(int index) {
+    HTTPQuery* query = HTTPQuery_fromstring(bench_urls[index]);
+    size_t checksum = 0;
+    for (size_t i = 0; i < sizeof(bench_parameters) / sizeof(bench_parameters[0]); i++) {
+        const char* value = HTTPQuery_getParameter(query, bench_parameters[i]);
+        if (value) checksum += strlen(value);
+    }
+    HTTPQuery_Dispose(&query);
+    return checksum;
+}
+
+static size_t bench_query_view(int index) {
+    HTTPQueryView query;
+    HTTPStringView url = {bench_urls[index], strlen(bench_urls[index])};
+    HTTPQueryView_parse(&query, url);
+    size_t checksum = 0;
+    for (size_t i = 0; i < sizeof(bench_parameters) / sizeof(bench_parameters[0]); i++) {
+        const HTTPQueryViewParameter* parameter = HTTPQueryView_getParameter(&query, bench_parameters[i]);
+        if (parameter) checksum += parameter->Value.length;
+    }
+    return checksum;
+}
+
+static size_t bench_response_tostring(int index) {
+    (void)index;
+    HTTPResponse* response = HTTPResponse_new(OK, (uint8_t*)bench_body, sizeof(bench_body) - 1, 1);
+    HTTPResponse_add_header(response, "Content-Type", "application/json");
+    HTTPResponse_add_header(response, "Connection", "keep-alive");
+    HTTPResponse_add_header(response, "ETag", "\"5f2a9c0e81d3b7a4-1f40\"");
+    size_t size = 0;
+    const char* text = HTTPResponse_tostring(response, &size);
+    free((void*)text);
+    HTTPResponse_Dispose(&response);
+    return size;
+}
+
+static size_t bench_response_build_head(int index) {
+    (void)index;
+    char head[512];
+    int length = HTTPResponse_build_head(head, sizeof(head), OK, "application/json", "keep-alive", 1,
+                                         "ETag: \"5f2a9c0e81d3b7a4-1f40\"\r\n", sizeof(bench_body) - 1);
+    return length > 0 ? (size_t)length : 0;
+}
+
+typedef struct {
+    const char* name;
+    bench_fn fn;
+} bench_case;
+
+static const bench_case bench_cases[] = {
+    {"HTTPRequest_fromstring", bench_request_fromstring},
+    {"HTTPRequestParser_execute", bench_request_parser},
+    {"HTTPQuery_fromstring+get", bench_query_fromstring},
+    {"HTTPQueryView_parse+get", bench_query_view},
+    {"HTTPResponse_tostring", bench_response_tostring},
+    {"HTTPResponse_build_head", bench_response_build_head},
+};
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char* argv[]) {
+    const char* json = NULL;
+    if (argc == 2 && strncmp(argv[1], "--json=", 7) == 0) {
+        json = argv[1] + 7;
+    } else if (argc != 1) {
+        printf("Usage: %s [--json=FILE]\n", argv[0]);
+        return 1;
+    }
+    for (int i = 0; i < BENCH_REQUEST_COUNT; i++) {
+        const char* url = strchr(bench_requests[i], ' ') + 1;
+        size_t length = (size_t)(strchr(url, ' ') - url);
+        memcpy(bench_urls[i], url, length);
+        bench_urls[i][length] = '\0';
+    }
+
+    printf("%d requests, %d to %d bytes, every case runs the whole corpus\n", BENCH_REQUEST_COUNT,
+           (int)strlen(bench_requests[3]), (int)strlen(bench_requests[1]));
+    printf("%-26s %10s %10s\n", "", "ns/op", "allocs/op");
+    for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++) {
+        const bench_case* bench = &bench_cases[c];
+        volatile size_t sink = 0;
+        // Warm up (the response head blocks are built once per thread), then
+        // double the rounds until a run is long enough to trust
+        for (int i = 0; i < BENCH_REQUEST_COUNT; i++) sink += bench->fn(i);
+        uint64_t rounds = 1024;
+        uint64_t elapsed = 0;
+        uint64_t allocations = 0;
+        for (;;) {
+            uint64_t before = g_benchAllocations;
+            uint64_t start = bench_now_ns();
+            for (uint64_t r = 0; r < rounds; r++) sink += bench->fn((int)(r % BENCH_REQUEST_COUNT));
+            elapsed = bench_now_ns() - start;
+            allocations = g_benchAllocations - before;
+            if (elapsed >= BENCH_MIN_NS || rounds >= (1ull << 30)) break;
+            rounds *= 2;
+        }
+        printf("%-26s %10.1f %10.2f\n", bench->name, (double)elapsed / (double)rounds,
+               (double)allocations / (double)rounds);
+        bench_report("time", "ns", (double)elapsed / (double)rounds, "%s/ns_per_op", bench->name);
+        bench_report("allocs", "allocs", (double)allocations / (double)rounds, "%s/allocs_per_op", bench->name);
+        (void)sink;
+    }
+    if (json && bench_report_write(json, "http_parser_bench") != 0) {
+        printf("%s can not be written\n", json);
+        return 1;
+    }
+    return 0;
+}
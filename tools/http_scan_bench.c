@@ -0,0 +1,107 @@
+// Compares the http_scan variants on request-like input.
+// Build with `make http_scan_bench`, MODE=release for numbers worth reading;
+// --json=FILE also writes them for perfcheck.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_report.h"
+#include "utilities/http_scan.h"
+
+#define BENCH_ROUNDS 200000
+
+typedef struct {
+    const char* name;
+    http_scan_fn fn;
+} bench_variant;
+
+static const char bench_request[] =
+    "GET /GetWeather?lat=59.33&lon=18.07 HTTP/1.1\r\n"
+    "Host: weather.example.org\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: sv-SE,sv;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Referer: https://dashboard.example.org/cities/stockholm\r\n"
+    "Origin: https://dashboard.example.org\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Walks the request line by line and token by token, like the parser does
+static size_t bench_walk(http_scan_fn fn, const char* data, size_t length) {
+    static const char line_end[4] = {'\r', '\n', '\n', '\n'};
+    static const char token_end[4] = {' ', ':', '\r', '\n'};
+    size_t checksum = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        size_t token = fn(data + pos, length - pos, token_end);
+        size_t line = fn(data + pos, length - pos, line_end);
+        checksum += token + line;
+        pos += line + 1;
+    }
+    return checksum;
+}
+
+int main(int argc, char* argv[]) {
+    const char* json = NULL;
+    if (argc == 2 && strncmp(argv[1], "--json=", 7) == 0) {
+        json = argv[1] + 7;
+    } else if (argc != 1) {
+        printf("Usage: %s [--json=FILE]\n", argv[0]);
+        return 1;
+    }
+    bench_variant variants[4];
+    int count = 0;
+    variants[count++] = (bench_variant){"scalar", http_scan_scalar};
+#if defined(__x86_64__)
+    variants[count++] = (bench_variant){"sse2", http_scan_sse2};
+    if (http_scan_avx2_supported()) variants[count++] = (bench_variant){"avx2", http_scan_avx2};
+#elif defined(__aarch64__)
+    variants[count++] = (bench_variant){"neon", http_scan_neon};
+#endif
+
+    size_t length = strlen(bench_request);
+
+    // every variant has to agree with the reference at every offset and length
+    static const char sets[][4] = {{'\r', '\n', '\n', '\n'}, {' ', ':', '\r', '\n'}, {'?', '&', '=', '='}};
+    for (int v = 1; v < count; v++) {
+        for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+            for (size_t start = 0; start < length; start++) {
+                for (size_t len = 0; start + len <= length; len++) {
+                    size_t want = http_scan_scalar(bench_request + start, len, sets[s]);
+                    size_t got = variants[v].fn(bench_request + start, len, sets[s]);
+                    if (want != got) {
+                        printf("%s disagrees at offset %zu length %zu: %zu, expected %zu\n", variants[v].name, start,
+                               len, got, want);
+                        return 1;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("http_scan dispatches to %s, %zu byte request, %d rounds\n", http_scan_name(), length, BENCH_ROUNDS);
+    for (int v = 0; v < count; v++) {
+        volatile size_t sink = 0;
+        uint64_t start = bench_now_ns();
+        for (int i = 0; i < BENCH_ROUNDS; i++) sink += bench_walk(variants[v].fn, bench_request, length);
+        uint64_t elapsed = bench_now_ns() - start;
+        printf("%-8s %8.1f ns/request %6.2f ns/byte\n", variants[v].name, (double)elapsed / BENCH_ROUNDS,
+               (double)elapsed / BENCH_ROUNDS / length);
+        bench_report("time", "ns", (double)elapsed / BENCH_ROUNDS, "%s/ns_per_request", variants[v].name);
+        (void)sink;
+    }
+    if (json && bench_report_write(json, "http_scan_bench") != 0) {
+        printf("%s can not be written\n", json);
+        return 1;
+    }
+    return 0;
+}
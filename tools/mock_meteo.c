@@ -0,0 +1,654 @@
+// Stand-in for api.open-meteo.com and geocoding-api.open-meteo.com, so
+// benchmarks neither depend on the real upstream nor spend its quota. Serves
+// /v1/forecast (single and comma separated batches) and /v1/search with
+// canned payloads of the real shape, derived from the query only, so a run
+// is the same every time. Latency, errors, dropped connections and bodies
+// trickled out in small pieces are drawn per request from --seed.
+// GET /mock/stats answers at once with what was served so far.
+//
+// Build with `make mock_meteo`, then ./server 8080 --upstream=http://127.0.0.1:18999
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MOCK_MAX_CONNECTIONS 1024
+#define MOCK_REQUEST_SIZE 8192
+
+typedef enum { MOCK_FIXED, MOCK_UNIFORM, MOCK_EXPONENTIAL, MOCK_LOGNORMAL } mock_distribution;
+
+typedef struct {
+    mock_distribution type;
+    double a;
+    double b;
+} mock_latency;
+
+typedef struct {
+    int port;
+    mock_latency latency;
+    double error_rate;
+    int error_status;
+    double drop_rate;
+    double drip_rate;
+    int drip_bytes;
+    int drip_ms;
+    uint64_t seed;
+} mock_options;
+
+typedef struct {
+    uint64_t requests;
+    uint64_t forecasts;
+    uint64_t locations;
+    uint64_t searches;
+    uint64_t errors;
+    uint64_t drops;
+    uint64_t drips;
+    uint64_t bytes;
+} mock_stats;
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} mock_buffer;
+
+typedef enum { MOCK_READING, MOCK_WAITING, MOCK_WRITING, MOCK_CLOSED } mock_state;
+
+typedef struct {
+    int fd;
+    uint32_t events;
+    mock_state state;
+    char request[MOCK_REQUEST_SIZE];
+    int request_length;
+    mock_buffer response;
+    size_t sent;
+    // when the next bytes go out
+    uint64_t send_ns;
+    // bytes per write while dripping, 0 for all at once
+    int drip;
+    int drop;
+    int close_after;
+} mock_connection;
+
+static mock_options g_options;
+static mock_stats g_stats;
+static uint64_t g_random;
+static int g_epoll;
+static volatile sig_atomic_t g_running = 1;
+
+static uint64_t mock_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, one stream, drawn in the order requests arrive
+static double mock_uniform(void) {
+    uint64_t x = g_random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    g_random = x;
+    return (double)((x * 0x2545f4914f6cdd1dull) >> 11) / 9007199254740992.0;
+}
+
+static double mock_latency_ms(const mock_latency* latency) {
+    switch (latency->type) {
+    case MOCK_FIXED:
+        return latency->a;
+    case MOCK_UNIFORM:
+        return latency->a + mock_uniform() * (latency->b - latency->a);
+    case MOCK_EXPONENTIAL:
+        return -log(1.0 - mock_uniform()) * latency->a;
+    case MOCK_LOGNORMAL: {
+        double u = mock_uniform();
+        double v = mock_uniform();
+        double normal = sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * M_PI * v);
+        return latency->a * exp(latency->b * normal);
+    }
+    }
+    return 0;
+}
+
+// ========== Payloads ==========
+
+static int mock_append(mock_buffer* buffer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static int mock_append(mock_buffer* buffer, const char* format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        size_t room = buffer->capacity - buffer->length;
+        int n = vsnprintf(buffer->data ? buffer->data + buffer->length : NULL, room, format, args);
+        va_end(args);
+        if (n < 0) return -1;
+        if ((size_t)n < room) {
+            buffer->length += (size_t)n;
+            return 0;
+        }
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 16384;
+        while (capacity - buffer->length <= (size_t)n) capacity *= 2;
+        char* data = realloc(buffer->data, capacity);
+        if (data == NULL) return -1;
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
+// The value of name in the query, NULL if it is not there
+static const char* mock_query(const char* query, const char* name, int* length) {
+    size_t name_length = strlen(name);
+    const char* at = query;
+    while (at && *at) {
+        if (strncmp(at, name, name_length) == 0 && at[name_length] == '=') {
+            const char* value = at + name_length + 1;
+            const char* end = strchr(value, '&');
+            *length = end ? (int)(end - value) : (int)strlen(value);
+            return value;
+        }
+        at = strchr(at, '&');
+        if (at) at++;
+    }
+    return NULL;
+}
+
+static void mock_time(char* out, size_t size, time_t when, int with_hour) {
+    struct tm tm;
+    gmtime_r(&when, &tm);
+    strftime(out, size, with_hour ? "%Y-%m-%dT%H:00" : "%Y-%m-%d", &tm);
+}
+
+// One location as open-meteo sends it, the values follow the coordinates
+static void mock_forecast_one(mock_buffer* out, double latitude, double longitude, int days) {
+    time_t now = time(NULL);
+    time_t hour = now - now % 3600;
+    time_t day = now - now % 86400;
+    char stamp[32];
+    double base = 25.0 - fabs(latitude) * 0.45;
+    int code = ((int)fabs(latitude * 7 + longitude * 3)) % 4 == 0 ? 61 : 3;
+
+    mock_time(stamp, sizeof(stamp), now - now % 900, 1);
+    mock_append(out,
+                "{\"latitude\":%.4f,\"longitude\":%.4f,\"generationtime_ms\":0.05,\"utc_offset_seconds\":0,"
+                "\"timezone\":\"GMT\",\"timezone_abbreviation\":\"GMT\",\"elevation\":28.0,"
+                "\"current_units\":{\"time\":\"iso8601\",\"interval\":\"seconds\",\"temperature_2m\":\"°C\","
+                "\"relative_humidity_2m\":\"%%\",\"apparent_temperature\":\"°C\",\"is_day\":\"\","
+                "\"precipitation\":\"mm\",\"rain\":\"mm\",\"showers\":\"mm\",\"snowfall\":\"cm\","
+                "\"weather_code\":\"wmo code\",\"cloud_cover\":\"%%\",\"pressure_msl\":\"hPa\","
+                "\"surface_pressure\":\"hPa\",\"wind_speed_10m\":\"km/h\",\"wind_direction_10m\":\"°\","
+                "\"wind_gusts_10m\":\"km/h\"},"
+                "\"current\":{\"time\":\"%s\",\"interval\":900,\"temperature_2m\":%.1f,\"relative_humidity_2m\":%d,"
+                "\"apparent_temperature\":%.1f,\"is_day\":1,\"precipitation\":%.1f,\"rain\":%.1f,\"showers\":0.0,"
+                "\"snowfall\":0.0,\"weather_code\":%d,\"cloud_cover\":%d,\"pressure_msl\":1013.2,"
+                "\"surface_pressure\":1001.4,\"wind_speed_10m\":%.1f,\"wind_direction_10m\":%d,"
+                "\"wind_gusts_10m\":%.1f},",
+                latitude, longitude, stamp, base, 60 + (int)fabs(latitude) % 30, base - 2.5,
+                code == 61 ? 0.4 : 0.0, code == 61 ? 0.4 : 0.0, code, code == 61 ? 100 : 75,
+                8.0 + fabs(longitude) * 0.05, (int)(fabs(longitude) * 10) % 360, 14.0 + fabs(longitude) * 0.08);
+
+    int hours = days * 24;
+    mock_append(out, "\"hourly_units\":{\"time\":\"iso8601\",\"temperature_2m\":\"°C\",\"relative_humidity_2m\":\"%%\","
+                     "\"precipitation_probability\":\"%%\",\"precipitation\":\"mm\",\"weather_code\":\"wmo code\","
+                     "\"wind_speed_10m\":\"km/h\"},\"hourly\":{\"time\":[");
+    for (int h = 0; h < hours; h++) {
+        mock_time(stamp, sizeof(stamp), hour + h * 3600, 1);
+        mock_append(out, "%s\"%s\"", h ? "," : "", stamp);
+    }
+    static const char* series[] = {"temperature_2m", "relative_humidity_2m", "precipitation_probability", "precipitation",
+                                   "weather_code", "wind_speed_10m"};
+    for (int s = 0; s < 6; s++) {
+        mock_append(out, "],\"%s\":[", series[s]);
+        for (int h = 0; h < hours; h++) {
+            double swing = sin((double)(h % 24) / 24.0 * 2.0 * M_PI);
+            const char* comma = h ? "," : "";
+            switch (s) {
+            case 0: mock_append(out, "%s%.1f", comma, base + swing * 4.0); break;
+            case 1: mock_append(out, "%s%d", comma, 70 + (int)(swing * 15)); break;
+            case 2: mock_append(out, "%s%d", comma, (h * 7) % 60); break;
+            case 3: mock_append(out, "%s%.1f", comma, (h % 9 == 0) ? 0.3 : 0.0); break;
+            case 4: mock_append(out, "%s%d", comma, (h % 9 == 0) ? 61 : code); break;
+            default: mock_append(out, "%s%.1f", comma, 9.0 + swing * 3.0); break;
+            }
+        }
+    }
+    mock_append(out, "]},\"daily_units\":{\"time\":\"iso8601\",\"weather_code\":\"wmo code\","
+                     "\"temperature_2m_max\":\"°C\",\"temperature_2m_min\":\"°C\",\"precipitation_sum\":\"mm\","
+                     "\"precipitation_probability_max\":\"%%\",\"wind_speed_10m_max\":\"km/h\"},\"daily\":{\"time\":[");
+    for (int d = 0; d < days; d++) {
+        mock_time(stamp, sizeof(stamp), day + d * 86400, 0);
+        mock_append(out, "%s\"%s\"", d ? "," : "", stamp);
+    }
+    mock_append(out, "],\"weather_code\":[");
+    for (int d = 0; d < days; d++) mock_append(out, "%s%d", d ? "," : "", d % 3 ? code : 61);
+    mock_append(out, "],\"temperature_2m_max\":[");
+    for (int d = 0; d < days; d++) mock_append(out, "%s%.1f", d ? "," : "", base + 4.0 + d % 3);
+    mock_append(out, "],\"temperature_2m_min\":[");
+    for (int d = 0; d < days; d++) mock_append(out, "%s%.1f", d ? "," : "", base - 4.0 - d % 2);
+    mock_append(out, "],\"precipitation_sum\":[");
+    for (int d = 0; d < days; d++) mock_append(out, "%s%.1f", d ? "," : "", d % 3 ? 0.0 : 2.7);
+    mock_append(out, "],\"precipitation_probability_max\":[");
+    for (int d = 0; d < days; d++) mock_append(out, "%s%d", d ? "," : "", d % 3 ? 10 : 80);
+    mock_append(out, "],\"wind_speed_10m_max\":[");
+    for (int d = 0; d < days; d++) mock_append(out, "%s%.1f", d ? "," : "", 12.0 + d);
+    mock_append(out, "]}}");
+}
+
+static int mock_forecast(mock_buffer* body, const char* query) {
+    int lat_length = 0, lon_length = 0, days_length = 0;
+    const char* latitudes = mock_query(query, "latitude", &lat_length);
+    const char* longitudes = mock_query(query, "longitude", &lon_length);
+    const char* days_value = mock_query(query, "forecast_days", &days_length);
+    if (latitudes == NULL || longitudes == NULL) return 400;
+    int days = days_value ? atoi(days_value) : 7;
+    if (days < 1 || days > 16) days = 7;
+
+    // A list of coordinates is answered with an array in the same order
+    int batch = memchr(latitudes, ',', (size_t)lat_length) != NULL;
+    const char* lat = latitudes;
+    const char* lon = longitudes;
+    if (batch) mock_append(body, "[");
+    for (int i = 0;; i++) {
+        char* lat_end = NULL;
+        char* lon_end = NULL;
+        double latitude = strtod(lat, &lat_end);
+        double longitude = strtod(lon, &lon_end);
+        if (lat_end == lat || lon_end == lon) return 400;
+        if (i) mock_append(body, ",");
+        mock_forecast_one(body, latitude, longitude, days);
+        g_stats.locations++;
+        if (*lat_end != ',' || *lon_end != ',') break;
+        lat = lat_end + 1;
+        lon = lon_end + 1;
+    }
+    if (batch) mock_append(body, "]");
+    g_stats.forecasts++;
+    return 200;
+}
+
+typedef struct {
+    const char* name;
+    const char* country_code;
+    const char* country;
+    const char* admin1;
+    double latitude;
+    double longitude;
+    int population;
+} mock_place;
+
+static const mock_place mock_places[] = {
+    {"Stockholm", "SE", "Sweden", "Stockholm", 59.32938, 18.06871, 1515017},
+    {"Goteborg", "SE", "Sweden", "Vastra Gotaland", 57.70716, 11.96679, 572799},
+    {"Malmo", "SE", "Sweden", "Skane", 55.60587, 13.00073, 301706},
+    {"Uppsala", "SE", "Sweden", "Uppsala", 59.85882, 17.63889, 133117},
+    {"Umea", "SE", "Sweden", "Vasterbotten", 63.82842, 20.25972, 83249},
+    {"London", "GB", "United Kingdom", "England", 51.50853, -0.12574, 7556900},
+    {"Paris", "FR", "France", "Ile-de-France", 48.85341, 2.3488, 2138551},
+    {"Berlin", "DE", "Germany", "Land Berlin", 52.52437, 13.41053, 3426354},
+    {"Oslo", "NO", "Norway", "Oslo", 59.91273, 10.74609, 580000},
+    {"Copenhagen", "DK", "Denmark", "Capital Region", 55.67594, 12.56553, 1153615},
+    {"Helsinki", "FI", "Finland", "Uusimaa", 60.16952, 24.93545, 558457},
+    {"Madrid", "ES", "Spain", "Madrid", 40.4165, -3.70256, 3255944},
+    {"Rome", "IT", "Italy", "Lazio", 41.89193, 12.51133, 2318895},
+    {"New York", "US", "United States", "New York", 40.71427, -74.00597, 8175133},
+    {"Tokyo", "JP", "Japan", "Tokyo", 35.6895, 139.69171, 8336599},
+    {"Sydney", "AU", "Australia", "New South Wales", -33.86785, 151.20732, 4627345},
+};
+#define MOCK_PLACE_COUNT ((int)(sizeof(mock_places) / sizeof(mock_places[0])))
+
+// Places whose name starts with the query (case blind, %20 and + as a
+// space); an unknown name has no "results", as the real API answers
+static int mock_search(mock_buffer* body, const char* query) {
+    int name_length = 0, count_length = 0;
+    const char* raw = mock_query(query, "name", &name_length);
+    const char* count_value = mock_query(query, "count", &count_length);
+    if (raw == NULL) return 400;
+    char name[128];
+    int length = 0;
+    for (int i = 0; i < name_length && length < (int)sizeof(name) - 1; i++) {
+        if (raw[i] == '+') {
+            name[length++] = ' ';
+        } else if (raw[i] == '%' && i + 2 < name_length) {
+            char hex[3] = {raw[i + 1], raw[i + 2], '\0'};
+            name[length++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else {
+            name[length++] = raw[i];
+        }
+    }
+    name[length] = '\0';
+    int count = count_value ? atoi(count_value) : 10;
+
+    int found = 0;
+    for (int i = 0; i < MOCK_PLACE_COUNT && found < count; i++) {
+        const mock_place* place = &mock_places[i];
+        if (length == 0 || strncasecmp(place->name, name, (size_t)length) != 0) continue;
+        mock_append(body,
+                    "%s{\"id\":%d,\"name\":\"%s\",\"latitude\":%.5f,\"longitude\":%.5f,\"elevation\":20.0,"
+                    "\"feature_code\":\"PPLC\",\"country_code\":\"%s\",\"timezone\":\"Europe/Stockholm\","
+                    "\"population\":%d,\"country\":\"%s\",\"admin1\":\"%s\"}",
+                    found ? "," : "{\"results\":[", 2600000 + i, place->name, place->latitude, place->longitude,
+                    place->country_code, place->population, place->country, place->admin1);
+        found++;
+    }
+    mock_append(body, found ? "],\"generationtime_ms\":0.4}" : "{\"generationtime_ms\":0.4}");
+    g_stats.searches++;
+    return 200;
+}
+
+static void mock_stats_body(mock_buffer* body) {
+    mock_append(body,
+                "{\"requests\":%llu,\"forecasts\":%llu,\"locations\":%llu,\"searches\":%llu,\"errors\":%llu,"
+                "\"drops\":%llu,\"drips\":%llu,\"bytes\":%llu}\n",
+                (unsigned long long)g_stats.requests, (unsigned long long)g_stats.forecasts,
+                (unsigned long long)g_stats.locations, (unsigned long long)g_stats.searches,
+                (unsigned long long)g_stats.errors, (unsigned long long)g_stats.drops,
+                (unsigned long long)g_stats.drips, (unsigned long long)g_stats.bytes);
+}
+
+// ========== Connections ==========
+
+static void mock_watch(mock_connection* connection, uint32_t events) {
+    if (connection->events == events) return;
+    struct epoll_event event = {.events = events, .data.ptr = connection};
+    epoll_ctl(g_epoll, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+}
+
+// Freed by the main loop once this pass is through with it
+static void mock_close(mock_connection* connection) {
+    close(connection->fd);
+    connection->fd = -1;
+    connection->state = MOCK_CLOSED;
+}
+
+static const char* mock_reason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Error";
+    }
+}
+
+// Answers the request at the front of the buffer, 1 if there was a whole
+// one, 0 if more has to be read and -1 if it is malformed
+static int mock_answer(mock_connection* connection) {
+    connection->request[connection->request_length] = '\0';
+    char* end = strstr(connection->request, "\r\n\r\n");
+    if (end == NULL) return connection->request_length >= MOCK_REQUEST_SIZE - 1 ? -1 : 0;
+    int consumed = (int)(end - connection->request) + 4;
+
+    char path[MOCK_REQUEST_SIZE];
+    if (sscanf(connection->request, "GET %8190s HTTP/1.", path) != 1) return -1;
+    connection->close_after = strcasestr(connection->request, "\r\nConnection: close") != NULL;
+    char* query = strchr(path, '?');
+    if (query) *query++ = '\0';
+
+    mock_buffer body = {0};
+    int status = 404;
+    int immediate = strcmp(path, "/mock/stats") == 0;
+    g_stats.requests += !immediate;
+    connection->drop = 0;
+    connection->drip = 0;
+    double delay = immediate ? 0 : mock_latency_ms(&g_options.latency);
+    if (immediate) {
+        mock_stats_body(&body);
+        status = 200;
+    } else if (mock_uniform() < g_options.drop_rate) {
+        connection->drop = 1;
+        g_stats.drops++;
+    } else if (mock_uniform() < g_options.error_rate) {
+        status = g_options.error_status;
+        mock_append(&body, "{\"error\":true,\"reason\":\"mock upstream error\"}");
+        g_stats.errors++;
+    } else if (strcmp(path, "/v1/forecast") == 0) {
+        status = mock_forecast(&body, query ? query : "");
+    } else if (strcmp(path, "/v1/search") == 0) {
+        status = mock_search(&body, query ? query : "");
+    }
+    if (!immediate && !connection->drop && mock_uniform() < g_options.drip_rate) {
+        connection->drip = g_options.drip_bytes;
+        g_stats.drips++;
+    }
+    if (status == 400 || status == 404) {
+        body.length = 0;
+        mock_append(&body, "{\"error\":true,\"reason\":\"%s\"}", mock_reason(status));
+    }
+
+    connection->response.length = 0;
+    if (!connection->drop) {
+        mock_append(&connection->response,
+                    "HTTP/1.1 %d %s\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: %zu\r\n%s\r\n",
+                    status, mock_reason(status), body.length, connection->close_after ? "Connection: close\r\n" : "");
+        mock_append(&connection->response, "%.*s", (int)body.length, body.data ? body.data : "");
+        g_stats.bytes += connection->response.length;
+    }
+    free(body.data);
+
+    memmove(connection->request, connection->request + consumed, (size_t)(connection->request_length - consumed));
+    connection->request_length -= consumed;
+    connection->sent = 0;
+    connection->state = MOCK_WAITING;
+    connection->send_ns = mock_now_ns() + (uint64_t)(delay > 0 ? delay * 1e6 : 0);
+    mock_watch(connection, 0);
+    return 1;
+}
+
+// Writes what is due, 0 while the connection stays and -1 once it is closed
+static int mock_write(mock_connection* connection, uint64_t now) {
+    if (connection->drop) {
+        mock_close(connection);
+        return -1;
+    }
+    while (connection->sent < connection->response.length) {
+        size_t length = connection->response.length - connection->sent;
+        if (connection->drip && length > (size_t)connection->drip) length = (size_t)connection->drip;
+        ssize_t n = send(connection->fd, connection->response.data + connection->sent, length, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            connection->state = MOCK_WRITING;
+            mock_watch(connection, EPOLLOUT);
+            return 0;
+        }
+        if (n <= 0) {
+            mock_close(connection);
+            return -1;
+        }
+        connection->sent += (size_t)n;
+        if (connection->drip && connection->sent < connection->response.length) {
+            connection->state = MOCK_WAITING;
+            connection->send_ns = now + (uint64_t)g_options.drip_ms * 1000000ull;
+            mock_watch(connection, 0);
+            return 0;
+        }
+    }
+    if (connection->close_after) {
+        mock_close(connection);
+        return -1;
+    }
+    connection->state = MOCK_READING;
+    mock_watch(connection, EPOLLIN);
+    // A pipelined request may be waiting in the buffer already
+    if (mock_answer(connection) < 0) {
+        mock_close(connection);
+        return -1;
+    }
+    return 0;
+}
+
+static void mock_read(mock_connection* connection) {
+    for (;;) {
+        ssize_t n = recv(connection->fd, connection->request + connection->request_length,
+                         (size_t)(MOCK_REQUEST_SIZE - 1 - connection->request_length), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            mock_close(connection);
+            return;
+        }
+        connection->request_length += (int)n;
+        int answered = mock_answer(connection);
+        if (answered < 0) {
+            mock_close(connection);
+            return;
+        }
+        if (answered) return;
+    }
+}
+
+// ========== Main ==========
+
+static int mock_parse_latency(const char* text, mock_latency* latency) {
+    double a = 0, b = 0;
+    if (sscanf(text, "fixed:%lf", &a) == 1) *latency = (mock_latency){MOCK_FIXED, a, 0};
+    else if (sscanf(text, "uniform:%lf:%lf", &a, &b) == 2 && b >= a) *latency = (mock_latency){MOCK_UNIFORM, a, b};
+    else if (sscanf(text, "exp:%lf", &a) == 1) *latency = (mock_latency){MOCK_EXPONENTIAL, a, 0};
+    else if (sscanf(text, "lognormal:%lf:%lf", &a, &b) == 2 && b >= 0) *latency = (mock_latency){MOCK_LOGNORMAL, a, b};
+    else if (sscanf(text, "%lf", &a) == 1) *latency = (mock_latency){MOCK_FIXED, a, 0};
+    else return -1;
+    return a >= 0 ? 0 : -1;
+}
+
+static void mock_usage(const char* name) {
+    printf("Usage: %s [options] [port]   (port 18999)\n"
+           "  --latency=D      before the first byte, ms: fixed:M, uniform:LO:HI, exp:MEAN or\n"
+           "                   lognormal:MEDIAN:SIGMA (fixed:0)\n"
+           "  --errors=P       share of requests answered with --error-status (0)\n"
+           "  --error-status=N status of those (503)\n"
+           "  --drops=P        share of connections closed without an answer (0)\n"
+           "  --drip=P:B:MS    share of responses sent B bytes at a time, MS apart (0:64:50)\n"
+           "  --seed=N         seed of the draws (1)\n",
+           name);
+}
+
+static int mock_parse(int argc, char* argv[], mock_options* options) {
+    *options = (mock_options){18999, {MOCK_FIXED, 0, 0}, 0, 503, 0, 0, 64, 50, 1};
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--latency=", 10) == 0) {
+            if (mock_parse_latency(arg + 10, &options->latency) != 0) return -1;
+        } else if (strncmp(arg, "--errors=", 9) == 0) options->error_rate = atof(arg + 9);
+        else if (strncmp(arg, "--error-status=", 15) == 0) options->error_status = atoi(arg + 15);
+        else if (strncmp(arg, "--drops=", 8) == 0) options->drop_rate = atof(arg + 8);
+        else if (strncmp(arg, "--drip=", 7) == 0) {
+            if (sscanf(arg + 7, "%lf:%d:%d", &options->drip_rate, &options->drip_bytes, &options->drip_ms) != 3 ||
+                options->drip_bytes < 1 || options->drip_ms < 0)
+                return -1;
+        } else if (strncmp(arg, "--seed=", 7) == 0) options->seed = strtoull(arg + 7, NULL, 10);
+        else if (arg[0] == '-') return -1;
+        else options->port = atoi(arg);
+    }
+    if (options->port < 1 || options->port > 65535 || options->error_status < 100 || options->error_status > 599)
+        return -1;
+    return 0;
+}
+
+static void mock_stop(int signum) {
+    (void)signum;
+    g_running = 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (mock_parse(argc, argv, &g_options) != 0) {
+        mock_usage(argv[0]);
+        return 1;
+    }
+    g_random = (g_options.seed + 1) * 0x9e3779b97f4a7c15ull;
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons((uint16_t)g_options.port),
+                                  .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 1024) != 0) {
+        fprintf(stderr, "mock_meteo: cannot listen on 127.0.0.1:%d: %s\n", g_options.port, strerror(errno));
+        return 1;
+    }
+    g_epoll = epoll_create1(0);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(g_epoll, EPOLL_CTL_ADD, listener, &event);
+    signal(SIGINT, mock_stop);
+    signal(SIGTERM, mock_stop);
+    printf("mock_meteo: listening on 127.0.0.1:%d\n", g_options.port);
+    fflush(stdout);
+
+    // Every open connection, the waiting ones are checked after each wake up
+    mock_connection* connections[MOCK_MAX_CONNECTIONS];
+    int open = 0;
+    struct epoll_event events[64];
+    while (g_running) {
+        uint64_t now = mock_now_ns();
+        int timeout = 100;
+        for (int i = 0; i < open; i++) {
+            if (connections[i]->state != MOCK_WAITING) continue;
+            uint64_t due = connections[i]->send_ns;
+            int ms = due > now ? (int)((due - now + 999999) / 1000000) : 0;
+            if (ms < timeout) timeout = ms;
+        }
+        int count = epoll_wait(g_epoll, events, 64, timeout);
+        for (int i = 0; i < count; i++) {
+            mock_connection* connection = events[i].data.ptr;
+            if (connection == NULL) {
+                int fd;
+                while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    if (open == MOCK_MAX_CONNECTIONS) {
+                        close(fd);
+                        continue;
+                    }
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    connection = calloc(1, sizeof(mock_connection));
+                    connection->fd = fd;
+                    connection->events = EPOLLIN;
+                    connection->state = MOCK_READING;
+                    struct epoll_event add = {.events = EPOLLIN, .data.ptr = connection};
+                    epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &add);
+                    connections[open++] = connection;
+                }
+                continue;
+            }
+            if (connection->state == MOCK_READING) mock_read(connection);
+            else if (connection->state == MOCK_WRITING) mock_write(connection, mock_now_ns());
+        }
+
+        now = mock_now_ns();
+        int kept = 0;
+        for (int i = 0; i < open; i++) {
+            mock_connection* connection = connections[i];
+            if (connection->state == MOCK_WAITING && connection->send_ns <= now) mock_write(connection, now);
+            if (connection->state == MOCK_CLOSED) {
+                free(connection->response.data);
+                free(connection);
+                continue;
+            }
+            connections[kept++] = connection;
+        }
+        open = kept;
+    }
+    for (int i = 0; i < open; i++) {
+        if (connections[i]->fd >= 0) close(connections[i]->fd);
+        free(connections[i]->response.data);
+        free(connections[i]);
+    }
+    close(g_epoll);
+    close(listener);
+    printf("mock_meteo: ");
+    mock_buffer stats = {0};
+    mock_stats_body(&stats);
+    fputs(stats.data, stdout);
+    free(stats.data);
+    return 0;
+}
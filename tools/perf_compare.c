@@ -0,0 +1,363 @@
+// Folds benchmark runs into medians and compares them with a stored
+// baseline, for `make perfcheck`. Every RUN.json is what a tool wrote with
+// --json (see bench_report.h); the runs of a bench are taken together per
+// metric, as the median and the spread, half the range relative to the
+// median. A metric regresses when it moved the bad way by more than its
+// kind allows (times --tolerance) plus twice the larger spread of baseline
+// and runs, so a noisy machine widens the band instead of failing:
+//   time, rate  5%
+//   latency     20%, percentiles under load move more
+//   allocs      1% and at least 0.05 absolute, they do not jitter
+//   count       any increase
+//
+// Times and rates are held against the machine's speed at the time: with
+// --calibrate=FILE it times a fixed loop into a run file of its own, and
+// when baseline and runs both have one, their baselines are scaled by how
+// much faster or slower that loop got. A box that runs slower as a whole
+// (clock, neighbours) does not read as a regression of everything.
+//
+// perf_compare [--baseline=FILE] [--update] [--results=FILE] [--tolerance=X] RUN.json...
+// perf_compare --calibrate=FILE
+//
+// --results writes the folded runs, --update writes them as the baseline.
+// Exit status 1 on a regression, 2 on bad input or no baseline.
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_report.h"
+#include "jansson.h"
+
+#define PERFCHECK_BASELINE "tools/perf-baseline.json"
+#define PERFCHECK_MAX_RUNS 64
+#define PERFCHECK_CALIBRATION "calibration"
+#define PERFCHECK_CALIBRATION_METRIC "crc32/ns_per_kib"
+#define PERFCHECK_CALIBRATION_BYTES 65536
+#define PERFCHECK_CALIBRATION_ROUNDS 400
+
+typedef struct {
+    const char* name;
+    double tolerance; // relative
+    double slack;     // absolute, smaller moves never count
+    int higher_is_better;
+} perf_kind;
+
+static const perf_kind perf_kinds[] = {
+    {"time", 0.05, 0, 0}, {"rate", 0.05, 0, 1}, {"latency", 0.20, 0, 0}, {"allocs", 0.01, 0.05, 0}, {"count", 0, 0, 0},
+};
+
+typedef struct {
+    char* bench;
+    char* name;
+    const perf_kind* kind;
+    char* unit;
+    double values[PERFCHECK_MAX_RUNS];
+    int runs;
+    double median;
+    double spread;
+} perf_metric;
+
+typedef struct {
+    perf_metric* items;
+    int count;
+    int capacity;
+} perf_set;
+
+static const perf_kind* perf_kind_find(const char* name) {
+    for (size_t i = 0; i < sizeof(perf_kinds) / sizeof(perf_kinds[0]); i++) {
+        if (strcmp(perf_kinds[i].name, name) == 0) return &perf_kinds[i];
+    }
+    return NULL;
+}
+
+static perf_metric* perf_find(perf_set* set, const char* bench, const char* name) {
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->items[i].bench, bench) == 0 && strcmp(set->items[i].name, name) == 0) return &set->items[i];
+    }
+    return NULL;
+}
+
+static perf_metric* perf_add(perf_set* set, const char* bench, const char* name, const perf_kind* kind,
+                             const char* unit) {
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 64;
+        perf_metric* items = realloc(set->items, (size_t)capacity * sizeof(perf_metric));
+        if (items == NULL) return NULL;
+        set->items = items;
+        set->capacity = capacity;
+    }
+    perf_metric* metric = &set->items[set->count++];
+    memset(metric, 0, sizeof(*metric));
+    metric->bench = strdup(bench);
+    metric->name = strdup(name);
+    metric->kind = kind;
+    metric->unit = strdup(unit);
+    return metric;
+}
+
+static void perf_dispose(perf_set* set) {
+    for (int i = 0; i < set->count; i++) {
+        free(set->items[i].bench);
+        free(set->items[i].name);
+        free(set->items[i].unit);
+    }
+    free(set->items);
+    memset(set, 0, sizeof(*set));
+}
+
+static const char* perf_string(json_t* object, const char* key) {
+    return json_string_value(json_object_get(object, key));
+}
+
+// ========== Runs ==========
+
+static int perf_load_run(perf_set* set, const char* path) {
+    json_error_t error;
+    json_t* root = json_load_file(path, 0, &error);
+    if (root == NULL) {
+        printf("perf_compare: %s: %s (line %d)\n", path, error.text, error.line);
+        return -1;
+    }
+    const char* bench = perf_string(root, "bench");
+    json_t* metrics = json_object_get(root, "metrics");
+    int result = bench && json_is_array(metrics) ? 0 : -1;
+    for (size_t i = 0; result == 0 && i < json_array_size(metrics); i++) {
+        json_t* entry = json_array_get(metrics, i);
+        const char* name = perf_string(entry, "name");
+        const char* kind_name = perf_string(entry, "kind");
+        const char* unit = perf_string(entry, "unit");
+        json_t* value = json_object_get(entry, "value");
+        const perf_kind* kind = kind_name ? perf_kind_find(kind_name) : NULL;
+        if (name == NULL || kind == NULL || unit == NULL || !json_is_number(value)) {
+            result = -1;
+            break;
+        }
+        perf_metric* metric = perf_find(set, bench, name);
+        if (metric == NULL) metric = perf_add(set, bench, name, kind, unit);
+        if (metric == NULL || metric->runs == PERFCHECK_MAX_RUNS) {
+            result = -1;
+            break;
+        }
+        metric->values[metric->runs++] = json_number_value(value);
+    }
+    if (result != 0) printf("perf_compare: %s is not a benchmark result\n", path);
+    json_decref(root);
+    return result;
+}
+
+static int perf_compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void perf_fold(perf_set* set) {
+    for (int i = 0; i < set->count; i++) {
+        perf_metric* metric = &set->items[i];
+        double sorted[PERFCHECK_MAX_RUNS];
+        memcpy(sorted, metric->values, (size_t)metric->runs * sizeof(double));
+        qsort(sorted, (size_t)metric->runs, sizeof(double), perf_compare_doubles);
+        int middle = metric->runs / 2;
+        metric->median = metric->runs % 2 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2;
+        double range = sorted[metric->runs - 1] - sorted[0];
+        metric->spread = metric->median != 0 ? range / 2 / fabs(metric->median) : 0;
+    }
+}
+
+// ========== Baseline ==========
+
+// {"metrics": [{"bench", "name", "kind", "unit", "median", "spread", "runs"}, ...]}
+static int perf_write(const perf_set* set, const char* path) {
+    json_t* metrics = json_array();
+    for (int i = 0; i < set->count; i++) {
+        const perf_metric* metric = &set->items[i];
+        json_array_append_new(metrics, json_pack("{s:s, s:s, s:s, s:s, s:f, s:f, s:i}", "bench", metric->bench,
+                                                 "name", metric->name, "kind", metric->kind->name, "unit",
+                                                 metric->unit, "median", metric->median, "spread", metric->spread,
+                                                 "runs", metric->runs));
+    }
+    json_t* root = json_pack("{s:o}", "metrics", metrics);
+    int result = json_dump_file(root, path, JSON_INDENT(1) | JSON_PRESERVE_ORDER);
+    json_decref(root);
+    if (result != 0) printf("perf_compare: %s can not be written\n", path);
+    return result;
+}
+
+static int perf_load_baseline(perf_set* set, const char* path) {
+    json_t* root = json_load_file(path, 0, NULL);
+    if (root == NULL) return -1;
+    json_t* metrics = json_object_get(root, "metrics");
+    int result = json_is_array(metrics) ? 0 : -1;
+    for (size_t i = 0; result == 0 && i < json_array_size(metrics); i++) {
+        json_t* entry = json_array_get(metrics, i);
+        const char* bench = perf_string(entry, "bench");
+        const char* name = perf_string(entry, "name");
+        const char* kind_name = perf_string(entry, "kind");
+        const char* unit = perf_string(entry, "unit");
+        const perf_kind* kind = kind_name ? perf_kind_find(kind_name) : NULL;
+        perf_metric* metric = bench && name && kind && unit ? perf_add(set, bench, name, kind, unit) : NULL;
+        if (metric == NULL) {
+            result = -1;
+            break;
+        }
+        metric->median = json_number_value(json_object_get(entry, "median"));
+        metric->spread = json_number_value(json_object_get(entry, "spread"));
+        metric->runs = (int)json_integer_value(json_object_get(entry, "runs"));
+    }
+    json_decref(root);
+    return result;
+}
+
+// ========== Calibration ==========
+
+static uint64_t perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// A table driven CRC-32 over a buffer that stays in cache: loads, shifts
+// and a dependency chain, close to what the parsers spend their time on.
+// The median of five passes, ns per KiB.
+static int perf_calibrate(const char* path) {
+    static uint8_t buffer[PERFCHECK_CALIBRATION_BYTES];
+    uint32_t table[256];
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = crc & 1 ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+        table[i] = crc;
+    }
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buffer[i] = (uint8_t)state;
+    }
+    double passes[5];
+    volatile uint32_t sink = 0;
+    for (int p = 0; p < 5; p++) {
+        uint64_t start = perf_now_ns();
+        for (int round = 0; round < PERFCHECK_CALIBRATION_ROUNDS; round++) {
+            uint32_t crc = 0xffffffffu;
+            for (size_t i = 0; i < sizeof(buffer); i++) crc = table[(crc ^ buffer[i]) & 0xff] ^ (crc >> 8);
+            sink += crc;
+        }
+        passes[p] = (double)(perf_now_ns() - start) / PERFCHECK_CALIBRATION_ROUNDS / (sizeof(buffer) / 1024);
+    }
+    (void)sink;
+    qsort(passes, 5, sizeof(double), perf_compare_doubles);
+    bench_report("time", "ns", passes[2], PERFCHECK_CALIBRATION_METRIC);
+    if (bench_report_write(path, PERFCHECK_CALIBRATION) != 0) {
+        printf("perf_compare: %s can not be written\n", path);
+        return 2;
+    }
+    return 0;
+}
+
+// ========== Compare ==========
+
+// Prints every metric against the baseline, the regressions
+static int perf_report(const perf_set* baseline, perf_set* current, double tolerance) {
+    int regressions = 0, improvements = 0;
+    // How much slower this machine runs than when the baseline was taken
+    double speed = 1, speed_noise = 0;
+    const perf_metric* calibrated = perf_find((perf_set*)baseline, PERFCHECK_CALIBRATION, PERFCHECK_CALIBRATION_METRIC);
+    const perf_metric* calibration = perf_find(current, PERFCHECK_CALIBRATION, PERFCHECK_CALIBRATION_METRIC);
+    if (calibrated && calibration && calibrated->median > 0 && calibration->median > 0) {
+        speed = calibration->median / calibrated->median;
+        speed_noise = calibration->spread + calibrated->spread;
+        printf("calibration: %.2fx the baseline's time, time and rate baselines are scaled by it\n\n", speed);
+    }
+    printf("%-18s %-52s %12s %12s %8s %8s\n", "bench", "metric", "baseline", "current", "change", "allowed");
+    for (int i = 0; i < current->count; i++) {
+        const perf_metric* now = &current->items[i];
+        const perf_metric* then = perf_find((perf_set*)baseline, now->bench, now->name);
+        if (then == NULL) {
+            printf("%-18s %-52s %12s %12.4g %8s %8s  new\n", now->bench, now->name, "-", now->median, "", "");
+            continue;
+        }
+        if (now == calibration) continue;
+        const perf_kind* kind = now->kind;
+        int scaled = kind == perf_kind_find("time") || kind == perf_kind_find("rate");
+        double expected = then->median;
+        if (scaled) expected = kind->higher_is_better ? expected / speed : expected * speed;
+        double worse = kind->higher_is_better ? expected - now->median : now->median - expected;
+        double relative = worse / fabs(expected);
+        if (expected == 0) relative = worse > 0 ? INFINITY : worse < 0 ? -INFINITY : 0;
+        double noise = (now->spread > then->spread ? now->spread : then->spread) + (scaled ? speed_noise : 0);
+        double allowed = kind->tolerance * tolerance + 2 * noise;
+        const char* verdict = "";
+        if (worse > kind->slack && relative > allowed) {
+            verdict = "  REGRESSED";
+            regressions++;
+        } else if (-worse > kind->slack && -relative > allowed) {
+            verdict = "  improved";
+            improvements++;
+        }
+        double change = expected != 0 ? 100 * (now->median - expected) / fabs(expected) : 0;
+        printf("%-18s %-52s %12.4g %12.4g %+7.1f%% %7.1f%%%s\n", now->bench, now->name, expected, now->median, change,
+               100 * allowed, verdict);
+    }
+    for (int i = 0; i < baseline->count; i++) {
+        const perf_metric* then = &baseline->items[i];
+        if (perf_find(current, then->bench, then->name) == NULL) {
+            printf("%-18s %-52s %12.4g %12s %8s %8s  missing\n", then->bench, then->name, then->median, "-", "", "");
+        }
+    }
+    printf("\n%d metric(s), %d regressed, %d improved\n", current->count, regressions, improvements);
+    if (improvements > 0 && regressions == 0) printf("make perfcheck-baseline keeps the improvements\n");
+    return regressions;
+}
+
+// ========== Main ==========
+
+int main(int argc, char* argv[]) {
+    const char* baseline_path = PERFCHECK_BASELINE;
+    const char* results_path = NULL;
+    double tolerance = 1;
+    int update = 0, usage = 0;
+    perf_set current = {0};
+    int runs = 0;
+    for (int i = 1; i < argc && !usage; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--calibrate=", 12) == 0 && argc == 2) return perf_calibrate(arg + 12);
+        else if (strncmp(arg, "--baseline=", 11) == 0) baseline_path = arg + 11;
+        else if (strncmp(arg, "--results=", 10) == 0) results_path = arg + 10;
+        else if (strncmp(arg, "--tolerance=", 12) == 0) tolerance = atof(arg + 12);
+        else if (strcmp(arg, "--update") == 0) update = 1;
+        else if (arg[0] == '-') usage = 1;
+        else if (perf_load_run(&current, arg) != 0) return 2;
+        else runs++;
+    }
+    if (usage || runs == 0 || tolerance <= 0) {
+        printf("Usage: %s [--baseline=FILE (%s)] [--update] [--results=FILE] [--tolerance=X (1)] RUN.json...\n"
+               "       %s --calibrate=FILE\n",
+               argv[0], PERFCHECK_BASELINE, argv[0]);
+        perf_dispose(&current);
+        return 2;
+    }
+    perf_fold(&current);
+    if (results_path && perf_write(&current, results_path) != 0) return 2;
+
+    if (update) {
+        int result = perf_write(&current, baseline_path);
+        if (result == 0) printf("%s: %d metric(s) from %d run file(s)\n", baseline_path, current.count, runs);
+        perf_dispose(&current);
+        return result ? 2 : 0;
+    }
+
+    perf_set baseline = {0};
+    if (perf_load_baseline(&baseline, baseline_path) != 0) {
+        printf("perf_compare: no baseline at %s, make perfcheck-baseline records one\n", baseline_path);
+        perf_dispose(&baseline);
+        perf_dispose(&current);
+        return 2;
+    }
+    int regressions = perf_report(&baseline, &current, tolerance);
+    perf_dispose(&baseline);
+    perf_dispose(&current);
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// Compares real_format with the ways of printing reals it replaced.
+// Build with `make real_format_bench`, MODE=release for numbers worth reading;
+// --json=FILE also writes them for perfcheck.
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_report.h"
+#include "utilities/real_format.h"
+
+#define BENCH_VALUES 4096
+#define BENCH_ROUNDS 200
+
+// see libs/jansson/dtoa.c
+char* dtoa_r(double dd, int mode, int ndigits, int* decpt, int* sign, char** rve, char* buf, size_t blen);
+
+typedef int (*bench_format_fn)(double value, char* out);
+
+typedef struct {
+    const char* name;
+    bench_format_fn fn;
+} bench_variant;
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// jansson's printf path, 17 digits
+static int bench_printf17(double value, char* out) {
+    return snprintf(out, 32, "%.17g", value);
+}
+
+// What the weather serializer did before: 15 digits, 17 if those don't read back
+static int bench_printf_shortest(double value, char* out) {
+    int length = snprintf(out, 32, "%.15g", value);
+    if (strtod(out, NULL) != value) length = snprintf(out, 32, "%.17g", value);
+    return length;
+}
+
+// The shortest digits from David Gay's dtoa, left undecorated
+static int bench_dtoa(double value, char* out) {
+    char digits[32];
+    char* end;
+    int point, sign;
+    if (!dtoa_r(value, 0, 0, &point, &sign, &end, digits, sizeof(digits))) return -1;
+    int length = (int)(end - digits);
+    memcpy(out, digits, length);
+    return length + snprintf(out + length, 16, "e%d", point - length);
+}
+
+static double bench_run(bench_format_fn fn, const double* values, size_t count) {
+    char out[32];
+    volatile size_t sink = 0;
+    uint64_t start = bench_now_ns();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < count; i++) sink += fn(values[i], out);
+    }
+    (void)sink;
+    return (double)(bench_now_ns() - start) / BENCH_ROUNDS / count;
+}
+
+int main(int argc, char* argv[]) {
+    const char* json = NULL;
+    if (argc == 2 && strncmp(argv[1], "--json=", 7) == 0) {
+        json = argv[1] + 7;
+    } else if (argc != 1) {
+        printf("Usage: %s [--json=FILE]\n", argv[0]);
+        return 1;
+    }
+    static const bench_variant variants[] = {
+        {"real_format", real_format},
+        {"%.17g", bench_printf17},
+        {"%.15g/17g", bench_printf_shortest},
+        {"dtoa", bench_dtoa},
+    };
+    static double coordinates[BENCH_VALUES];
+    static double arbitrary[BENCH_VALUES];
+
+    // Coordinates and measurements as open-meteo sends them, and doubles of any bits
+    uint64_t state = 88172645463325252ull;
+    for (size_t i = 0; i < BENCH_VALUES; i++) {
+        coordinates[i] = (double)((int64_t)(bench_random(&state) % 36000000) - 18000000) / 1e5;
+        double value;
+        do {
+            uint64_t bits = bench_random(&state);
+            memcpy(&value, &bits, sizeof(value));
+        } while (!isfinite(value));
+        arbitrary[i] = value;
+    }
+
+    // real_format has to read back to every value
+    const double* sets[] = {coordinates, arbitrary};
+    for (size_t s = 0; s < 2; s++) {
+        for (size_t i = 0; i < BENCH_VALUES; i++) {
+            char out[REAL_FORMAT_SIZE];
+            real_format(sets[s][i], out);
+            if (strtod(out, NULL) != sets[s][i]) {
+                printf("real_format wrote %s for %.17g\n", out, sets[s][i]);
+                return 1;
+            }
+        }
+    }
+
+    printf("%d values, %d rounds\n", BENCH_VALUES, BENCH_ROUNDS);
+    printf("%-12s %14s %14s\n", "", "coordinates", "arbitrary");
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        double fixed = bench_run(variants[v].fn, coordinates, BENCH_VALUES);
+        double any = bench_run(variants[v].fn, arbitrary, BENCH_VALUES);
+        printf("%-12s %8.1f ns/op %8.1f ns/op\n", variants[v].name, fixed, any);
+        bench_report("time", "ns", fixed, "%s/coordinates_ns_per_op", variants[v].name);
+        bench_report("time", "ns", any, "%s/arbitrary_ns_per_op", variants[v].name);
+    }
+    if (json && bench_report_write(json, "real_format_bench") != 0) {
+        printf("%s can not be written\n", json);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,672 @@
+// Simulation of one worker loop serving forecasts, on a virtual clock. The
+// server's own scheduler (smw), timer wheel and hot cache (response_cache
+// with its admission sketch) run as they do in a worker; the clients, their
+// sockets, the CPU time of each step and upstream are models. A request
+// arrives whole, is parsed, answered from the hot cache or waits for a fetch
+// (one per key, the others coalesce) until the handler timeout, and costs
+// CPU to send. Time only moves when the loop would sleep or a step spends
+// CPU, so an hour of load runs in seconds and a run with the same --seed is
+// the same every time: runs that differ in --ttl, --timeout, --latency or
+// --policy compare like for like.
+//
+// The clock is the linker's doing: the archive's SystemMonotonicMS/NS and
+// epoll_wait are wrapped (see `make sim`), epoll_wait polls without
+// blocking and moves the clock on by the timeout the loop asked for.
+//
+// Build with `make sim`, then ./sim --duration=3600 --rate=200 --ttl=300
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "HTTPServer/HTTPServerConnection.h"
+#include "backends/weather.h"
+#include "smw.h"
+#include "utilities/access_log.h"
+#include "utilities/frequency_sketch.h"
+#include "utilities/response_cache.h"
+#include "utils.h"
+#include "bench_report.h"
+
+// Buckets of the in-flight fetch table, chained
+#define SIM_FETCH_BUCKETS 4096
+// Wall clock second the virtual one starts at, for the cache's expiry times
+#define SIM_EPOCH 1700000000
+
+typedef enum { SIM_FIXED, SIM_UNIFORM, SIM_EXPONENTIAL, SIM_LOGNORMAL } sim_distribution;
+
+typedef struct {
+    sim_distribution type;
+    double a;
+    double b;
+} sim_latency;
+
+// Microseconds of CPU each step takes
+typedef struct {
+    double parse;
+    double hit;
+    double transform;
+    double send;
+} sim_costs;
+
+typedef enum { SIM_POLICY_CLASSES, SIM_POLICY_FIFO } sim_policy;
+
+typedef struct {
+    double duration;
+    double rate;
+    int keys;
+    double zipf;
+    const char* replay;
+    double speed;
+    int ttl;
+    int hot_entries;
+    int admission;
+    int timeout_ms;
+    sim_latency latency;
+    double error_rate;
+    int coalesce;
+    sim_policy policy;
+    sim_costs costs;
+    int body_bytes;
+    uint64_t seed;
+    const char* json;
+} sim_options;
+
+typedef enum { SIM_HIT, SIM_FETCHED, SIM_COALESCED, SIM_TIMEOUT, SIM_FAILED, SIM_OUTCOMES } sim_outcome;
+
+static const char* g_outcomeNames[SIM_OUTCOMES] = {"hot hits", "fetched", "coalesced", "timed out", "failed"};
+
+typedef struct sim_request sim_request;
+
+// One upstream fetch, held by its timer and each request waiting on it
+typedef struct sim_fetch {
+    uint64_t key;
+    timer_wheel_timer timer;
+    int done;
+    int failed;
+    int refs;
+    sim_request* waiters;
+    struct sim_fetch* next;
+} sim_fetch;
+
+typedef enum { SIM_PARSE, SIM_WAIT, SIM_SEND } sim_state;
+
+struct sim_request {
+    smw_task* task;
+    sim_state state;
+    uint64_t key;
+    uint64_t arrived_ns;
+    sim_outcome outcome;
+    sim_fetch* fetch;
+    // made the fetch, transforms and stores the result
+    int primary;
+    sim_request* next_waiter;
+};
+
+// What --replay read, the arrival offsets already scaled by --speed
+typedef struct {
+    uint64_t offset_ns;
+    uint64_t key;
+} sim_arrival;
+
+static sim_options g_options;
+static uint64_t g_random;
+// The virtual clock every wrapped reading returns
+static uint64_t g_nowNs = 1000000000ull;
+
+static response_cache g_cache;
+static frequency_sketch g_sketch;
+static uint8_t* g_body;
+static double* g_zipfCdf;
+static sim_fetch* g_fetches[SIM_FETCH_BUCKETS];
+
+static sim_arrival* g_replay;
+static size_t g_replayCount;
+static size_t g_replayNext;
+static uint64_t g_startNs;
+static uint64_t g_endNs;
+static uint64_t g_nextArrivalNs;
+static int g_arriving = 1;
+static timer_wheel_timer g_arrivalTimer;
+static int g_open = 0;
+
+static uint64_t g_outcomes[SIM_OUTCOMES];
+static uint64_t g_fetchCount;
+static uint64_t g_fetchErrors;
+static uint32_t* g_latencies;
+static size_t g_latencyCount;
+static size_t g_latencyCapacity;
+
+// ========== Virtual Clock ==========
+
+// Only the linker refers to them, LTO would drop them otherwise
+#define SIM_WRAPPER __attribute__((used, externally_visible))
+
+SIM_WRAPPER uint64_t __wrap_SystemMonotonicMS(void) {
+    return g_nowNs / 1000000ull;
+}
+
+SIM_WRAPPER uint64_t __wrap_SystemMonotonicNS(void) {
+    return g_nowNs;
+}
+
+int __real_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout);
+
+// Whatever is ready now, else the loop sleeps: to the start of the
+// millisecond it asked to wake in
+SIM_WRAPPER int __wrap_epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    int n = __real_epoll_wait(epfd, events, maxevents, 0);
+    if (n == 0 && timeout > 0) g_nowNs = (g_nowNs / 1000000ull + (uint64_t)timeout) * 1000000ull;
+    return n;
+}
+
+// CPU the step running takes
+static void sim_spend(double microseconds) {
+    g_nowNs += (uint64_t)(microseconds * 1000.0);
+}
+
+static time_t sim_wall(void) {
+    return (time_t)(SIM_EPOCH + g_nowNs / 1000000000ull);
+}
+
+// ========== Draws ==========
+
+// xorshift64*, one stream, drawn in the order events happen
+static double sim_uniform(void) {
+    uint64_t x = g_random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    g_random = x;
+    return (double)((x * 0x2545f4914f6cdd1dull) >> 11) / 9007199254740992.0;
+}
+
+static double sim_latency_ms(const sim_latency* latency) {
+    switch (latency->type) {
+    case SIM_FIXED:
+        return latency->a;
+    case SIM_UNIFORM:
+        return latency->a + sim_uniform() * (latency->b - latency->a);
+    case SIM_EXPONENTIAL:
+        return -log(1.0 - sim_uniform()) * latency->a;
+    case SIM_LOGNORMAL: {
+        double u = sim_uniform();
+        double v = sim_uniform();
+        double normal = sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * M_PI * v);
+        return latency->a * exp(latency->b * normal);
+    }
+    }
+    return 0;
+}
+
+static uint64_t sim_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static int sim_zipf_init(int keys, double exponent) {
+    g_zipfCdf = malloc((size_t)keys * sizeof(double));
+    if (g_zipfCdf == NULL) return -1;
+    double sum = 0;
+    for (int i = 0; i < keys; i++) {
+        sum += 1.0 / pow((double)(i + 1), exponent);
+        g_zipfCdf[i] = sum;
+    }
+    for (int i = 0; i < keys; i++) g_zipfCdf[i] /= sum;
+    return 0;
+}
+
+// The rank drawn, as a cache key
+static uint64_t sim_zipf_key(void) {
+    double u = sim_uniform();
+    int low = 0, high = g_options.keys - 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (g_zipfCdf[middle] < u) low = middle + 1;
+        else high = middle;
+    }
+    return sim_mix((uint64_t)low + 1);
+}
+
+// ========== Fetches ==========
+
+static sim_fetch** sim_fetch_slot(uint64_t key) {
+    sim_fetch** slot = &g_fetches[key % SIM_FETCH_BUCKETS];
+    while (*slot != NULL && (*slot)->key != key) slot = &(*slot)->next;
+    return slot;
+}
+
+static void sim_fetch_release(sim_fetch* fetch) {
+    if (--fetch->refs == 0) free(fetch);
+}
+
+static void sim_fetch_done(void* context, uint64_t now) {
+    (void)now;
+    sim_fetch* fetch = (sim_fetch*)context;
+    sim_fetch** slot = &g_fetches[fetch->key % SIM_FETCH_BUCKETS];
+    while (*slot != fetch) slot = &(*slot)->next;
+    *slot = fetch->next;
+    fetch->done = 1;
+    for (sim_request* waiter = fetch->waiters; waiter != NULL; waiter = waiter->next_waiter) smw_wakeTask(waiter->task);
+    sim_fetch_release(fetch);
+}
+
+// The fetch of key the request waits on, a new one unless one is running
+// and coalescing is on. Every running fetch is in the table, several of
+// a key without coalescing.
+static sim_fetch* sim_fetch_join(sim_request* request) {
+    sim_fetch* fetch = g_options.coalesce ? *sim_fetch_slot(request->key) : NULL;
+    if (fetch == NULL) {
+        fetch = calloc(1, sizeof(sim_fetch));
+        if (fetch == NULL) return NULL;
+        fetch->key = request->key;
+        fetch->refs = 1;
+        fetch->failed = sim_uniform() < g_options.error_rate;
+        g_fetchCount++;
+        if (fetch->failed) g_fetchErrors++;
+        sim_fetch** slot = &g_fetches[request->key % SIM_FETCH_BUCKETS];
+        fetch->next = *slot;
+        *slot = fetch;
+        smw_initTimer(&fetch->timer, sim_fetch_done, fetch);
+        smw_armTimer(&fetch->timer, SystemMonotonicMS() + (uint64_t)ceil(sim_latency_ms(&g_options.latency)));
+        request->primary = 1;
+    }
+    fetch->refs++;
+    request->next_waiter = fetch->waiters;
+    fetch->waiters = request;
+    return fetch;
+}
+
+static void sim_fetch_leave(sim_request* request) {
+    sim_fetch* fetch = request->fetch;
+    for (sim_request** waiter = &fetch->waiters; *waiter != NULL; waiter = &(*waiter)->next_waiter) {
+        if (*waiter == request) {
+            *waiter = request->next_waiter;
+            break;
+        }
+    }
+    request->fetch = NULL;
+    sim_fetch_release(fetch);
+}
+
+// ========== Requests ==========
+
+static void sim_record(uint64_t latency_ns) {
+    if (g_latencyCount == g_latencyCapacity) {
+        size_t capacity = g_latencyCapacity ? g_latencyCapacity * 2 : 65536;
+        uint32_t* latencies = realloc(g_latencies, capacity * sizeof(uint32_t));
+        if (latencies == NULL) return;
+        g_latencies = latencies;
+        g_latencyCapacity = capacity;
+    }
+    uint64_t microseconds = latency_ns / 1000;
+    g_latencies[g_latencyCount++] = microseconds > UINT32_MAX ? UINT32_MAX : (uint32_t)microseconds;
+}
+
+static void sim_finish(sim_request* request) {
+    g_outcomes[request->outcome]++;
+    sim_record(SystemMonotonicNS() - request->arrived_ns);
+    smw_destroyTask(request->task);
+    free(request);
+    g_open--;
+}
+
+// The response is ready, sent on the next pass: first thing under the
+// server's classes, in turn with everything else without them
+static void sim_respond(sim_request* request, sim_outcome outcome) {
+    request->outcome = outcome;
+    request->state = SIM_SEND;
+    smw_setDeadline(request->task, 0);
+    if (g_options.policy == SIM_POLICY_CLASSES) smw_setPriority(request->task, smw_priority_high);
+    smw_wakeTask(request->task);
+}
+
+static void sim_request_run(void* context, uint64_t now) {
+    (void)now;
+    sim_request* request = (sim_request*)context;
+    switch (request->state) {
+    case SIM_PARSE: {
+        sim_spend(g_options.costs.parse);
+        if (g_options.admission) frequency_sketch_increment(&g_sketch, request->key);
+        response_cache_entry* entry = response_cache_find(&g_cache, request->key, sim_wall());
+        if (entry != NULL && entry->blob != NULL) {
+            sim_spend(g_options.costs.hit);
+            sim_respond(request, SIM_HIT);
+            return;
+        }
+        request->fetch = sim_fetch_join(request);
+        if (request->fetch == NULL) {
+            sim_respond(request, SIM_FAILED);
+            return;
+        }
+        request->state = SIM_WAIT;
+        smw_setDeadline(request->task, request->arrived_ns / 1000000ull + (uint64_t)g_options.timeout_ms);
+        return;
+    }
+    case SIM_WAIT: {
+        sim_fetch* fetch = request->fetch;
+        if (!fetch->done) {
+            if (!(request->task->revents & SMW_TIMEOUT)) return;
+            sim_fetch_leave(request);
+            sim_respond(request, SIM_TIMEOUT);
+            return;
+        }
+        int failed = fetch->failed;
+        sim_fetch_leave(request);
+        if (failed) {
+            sim_respond(request, SIM_FAILED);
+            return;
+        }
+        if (request->primary) {
+            sim_spend(g_options.costs.transform);
+            time_t wall = sim_wall();
+            response_cache_entry* entry = response_cache_insert(&g_cache, request->key, wall, wall + g_options.ttl);
+            if (entry != NULL) {
+                response_cache_set(&g_cache, entry, COMPRESS_IDENTITY, g_body, (size_t)g_options.body_bytes, NULL);
+            }
+        }
+        sim_respond(request, request->primary ? SIM_FETCHED : SIM_COALESCED);
+        return;
+    }
+    case SIM_SEND:
+        sim_spend(g_options.costs.send);
+        sim_finish(request);
+        return;
+    }
+}
+
+static void sim_arrive(uint64_t key) {
+    sim_request* request = calloc(1, sizeof(sim_request));
+    if (request == NULL) return;
+    request->task = smw_createTask(request, sim_request_run);
+    if (request->task == NULL) {
+        free(request);
+        return;
+    }
+    request->key = key;
+    request->arrived_ns = SystemMonotonicNS();
+    request->state = SIM_PARSE;
+    smw_setTaskName(request->task, "sim_request");
+    smw_parkTask(request->task);
+    smw_wakeTask(request->task);
+    g_open++;
+}
+
+// ========== Arrivals ==========
+
+// Every arrival due by now, then the timer for the next: Poisson at --rate,
+// or when --replay recorded them
+static void sim_arrivals(void* context, uint64_t now) {
+    (void)context;
+    (void)now;
+    uint64_t clock = SystemMonotonicNS();
+    while (g_arriving && g_nextArrivalNs <= clock) {
+        if (g_replay != NULL) {
+            sim_arrive(g_replay[g_replayNext++].key);
+            if (g_replayNext == g_replayCount) g_arriving = 0;
+            else g_nextArrivalNs = g_startNs + g_replay[g_replayNext].offset_ns;
+        } else {
+            sim_arrive(sim_zipf_key());
+            g_nextArrivalNs += (uint64_t)(-log(1.0 - sim_uniform()) / g_options.rate * 1e9);
+            if (g_nextArrivalNs >= g_endNs) g_arriving = 0;
+        }
+    }
+    if (g_arriving) smw_armTimer(&g_arrivalTimer, (g_nextArrivalNs + 999999) / 1000000ull);
+}
+
+static uint64_t sim_target_key(const char* target) {
+    // FNV-1a, the same normalized target is the same location
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (; *target; target++) hash = (hash ^ (uint8_t)*target) * 0x100000001b3ull;
+    return hash;
+}
+
+// The forecast requests of an access log (--access-log), their offsets from
+// the first divided by --speed
+static int sim_replay_load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = size > 0 ? malloc((size_t)size) : NULL;
+    int read_all = data && fread(data, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if (!read_all || size < ACCESS_LOG_MAGIC_SIZE || memcmp(data, ACCESS_LOG_MAGIC, ACCESS_LOG_MAGIC_SIZE) != 0) {
+        free(data);
+        return -1;
+    }
+
+    g_replay = malloc((size_t)size / ACCESS_LOG_HEADER_SIZE * sizeof(sim_arrival));
+    if (g_replay == NULL) {
+        free(data);
+        return -1;
+    }
+    uint64_t first_us = 0;
+    size_t offset = ACCESS_LOG_MAGIC_SIZE;
+    while (offset < (size_t)size) {
+        access_log_record record;
+        int used = access_log_decode(data + offset, (size_t)size - offset, &record);
+        if (used <= 0) break;
+        offset += (size_t)used;
+        if (record.route != ACCESS_ROUTE_WEATHER || (record.flags & ACCESS_LOG_TRUNCATED)) continue;
+        if (g_replayCount == 0 || record.time_us < first_us) first_us = record.time_us;
+        g_replay[g_replayCount].offset_ns = record.time_us;
+        g_replay[g_replayCount].key = sim_target_key(record.target);
+        g_replayCount++;
+    }
+    free(data);
+    for (size_t i = 0; i < g_replayCount; i++) {
+        g_replay[i].offset_ns = (uint64_t)((double)(g_replay[i].offset_ns - first_us) * 1000.0 / g_options.speed);
+    }
+    return g_replayCount > 0 ? 0 : -1;
+}
+
+// ========== Report ==========
+
+static int sim_compare_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double sim_percentile_ms(double percentile) {
+    if (g_latencyCount == 0) return 0;
+    size_t index = (size_t)(percentile / 100.0 * (double)(g_latencyCount - 1) + 0.5);
+    return g_latencies[index] / 1000.0;
+}
+
+static void sim_report(double simulated, double wall) {
+    uint64_t requests = 0;
+    for (int i = 0; i < SIM_OUTCOMES; i++) requests += g_outcomes[i];
+    qsort(g_latencies, g_latencyCount, sizeof(uint32_t), sim_compare_latency);
+
+    smw_stats stats;
+    smw_getStats(&stats);
+    printf("sim: %.0f s simulated in %.2f s (%.0fx), seed %llu\n", simulated, wall, wall > 0 ? simulated / wall : 0,
+           (unsigned long long)g_options.seed);
+    printf("requests      %llu (%.1f/s)\n", (unsigned long long)requests, simulated > 0 ? requests / simulated : 0);
+    for (int i = 0; i < SIM_OUTCOMES; i++) {
+        printf("  %-11s %llu (%.2f%%)\n", g_outcomeNames[i], (unsigned long long)g_outcomes[i],
+               requests ? 100.0 * (double)g_outcomes[i] / (double)requests : 0);
+    }
+    printf("upstream      %llu fetches, %llu failed\n", (unsigned long long)g_fetchCount,
+           (unsigned long long)g_fetchErrors);
+    printf("hot cache     %d entries, %llu evictions, %llu turned away\n", g_cache.stats.entries,
+           (unsigned long long)g_cache.stats.evictions, (unsigned long long)g_cache.stats.rejections);
+    printf("latency ms    p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n", sim_percentile_ms(50),
+           sim_percentile_ms(90), sim_percentile_ms(99), sim_percentile_ms(99.9), sim_percentile_ms(100));
+    printf("loop          %llu passes, longest %.3f ms\n", (unsigned long long)stats.iterations,
+           stats.max_pass_ns / 1e6);
+
+    if (g_options.json == NULL) return;
+    bench_report("rate", "req/s", simulated > 0 ? requests / simulated : 0, "sim requests");
+    bench_report("count", "requests", (double)g_outcomes[SIM_TIMEOUT], "sim timed out");
+    bench_report("count", "requests", (double)g_outcomes[SIM_FAILED], "sim failed");
+    bench_report("count", "fetches", (double)g_fetchCount, "sim upstream fetches");
+    bench_report("latency", "ms", sim_percentile_ms(50), "sim p50");
+    bench_report("latency", "ms", sim_percentile_ms(99), "sim p99");
+    if (bench_report_write(g_options.json, "sim") != 0) fprintf(stderr, "sim: cannot write %s\n", g_options.json);
+}
+
+// ========== Main ==========
+
+static int sim_parse_latency(const char* text, sim_latency* latency) {
+    double a = 0, b = 0;
+    if (sscanf(text, "fixed:%lf", &a) == 1) *latency = (sim_latency){SIM_FIXED, a, 0};
+    else if (sscanf(text, "uniform:%lf:%lf", &a, &b) == 2 && b >= a) *latency = (sim_latency){SIM_UNIFORM, a, b};
+    else if (sscanf(text, "exp:%lf", &a) == 1) *latency = (sim_latency){SIM_EXPONENTIAL, a, 0};
+    else if (sscanf(text, "lognormal:%lf:%lf", &a, &b) == 2 && b >= 0) *latency = (sim_latency){SIM_LOGNORMAL, a, b};
+    else if (sscanf(text, "%lf", &a) == 1) *latency = (sim_latency){SIM_FIXED, a, 0};
+    else return -1;
+    return a >= 0 ? 0 : -1;
+}
+
+static void sim_usage(const char* name) {
+    printf("Usage: %s [options]\n"
+           "  --duration=S     virtual seconds of arrivals (600)\n"
+           "  --rate=R         requests per virtual second, Poisson (100)\n"
+           "  --keys=N         locations asked for (10000)\n"
+           "  --zipf=S         their popularity exponent (0.9)\n"
+           "  --replay=FILE    the forecast requests of a server's --access-log instead\n"
+           "  --speed=X        replayed that many times faster (1)\n"
+           "  --ttl=S          hot cache TTL (Weather_CACHE_TTL_SECONDS)\n"
+           "  --hot=N          hot cache entries (Weather_HOT_CACHE_ENTRIES)\n"
+           "  --admission=0|1  TinyLFU admission sketch (1)\n"
+           "  --timeout=MS     handler timeout (HTTPServerConnection_HANDLER_TIMEOUT_MS)\n"
+           "  --latency=D      upstream, ms: fixed:M, uniform:LO:HI, exp:MEAN or\n"
+           "                   lognormal:MEDIAN:SIGMA (lognormal:80:0.6)\n"
+           "  --errors=P       share of fetches that fail (0)\n"
+           "  --coalesce=0|1   one fetch per location at a time (1)\n"
+           "  --policy=P       classes: ready responses first, as the server runs;\n"
+           "                   fifo: every task in one class (classes)\n"
+           "  --cost=P:H:T:S   CPU us to parse, answer a hit, transform a fetch and\n"
+           "                   send (20:10:400:15)\n"
+           "  --body=B         response bytes, against the cache's byte budget (8192)\n"
+           "  --seed=N         seed of the draws (1)\n"
+           "  --json=FILE      the numbers for perf_compare\n",
+           name);
+}
+
+static int sim_parse(int argc, char* argv[], sim_options* options) {
+    *options = (sim_options){.duration = 600,
+                             .rate = 100,
+                             .keys = 10000,
+                             .zipf = 0.9,
+                             .speed = 1,
+                             .ttl = Weather_CACHE_TTL_SECONDS,
+                             .hot_entries = Weather_HOT_CACHE_ENTRIES,
+                             .admission = 1,
+                             .timeout_ms = HTTPServerConnection_HANDLER_TIMEOUT_MS,
+                             .latency = {SIM_LOGNORMAL, 80, 0.6},
+                             .coalesce = 1,
+                             .policy = SIM_POLICY_CLASSES,
+                             .costs = {20, 10, 400, 15},
+                             .body_bytes = 8192,
+                             .seed = 1};
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--duration=", 11) == 0) options->duration = atof(arg + 11);
+        else if (strncmp(arg, "--rate=", 7) == 0) options->rate = atof(arg + 7);
+        else if (strncmp(arg, "--keys=", 7) == 0) options->keys = atoi(arg + 7);
+        else if (strncmp(arg, "--zipf=", 7) == 0) options->zipf = atof(arg + 7);
+        else if (strncmp(arg, "--replay=", 9) == 0) options->replay = arg + 9;
+        else if (strncmp(arg, "--speed=", 8) == 0) options->speed = atof(arg + 8);
+        else if (strncmp(arg, "--ttl=", 6) == 0) options->ttl = atoi(arg + 6);
+        else if (strncmp(arg, "--hot=", 6) == 0) options->hot_entries = atoi(arg + 6);
+        else if (strncmp(arg, "--admission=", 12) == 0) options->admission = atoi(arg + 12);
+        else if (strncmp(arg, "--timeout=", 10) == 0) options->timeout_ms = atoi(arg + 10);
+        else if (strncmp(arg, "--latency=", 10) == 0) {
+            if (sim_parse_latency(arg + 10, &options->latency) != 0) return -1;
+        } else if (strncmp(arg, "--errors=", 9) == 0) options->error_rate = atof(arg + 9);
+        else if (strncmp(arg, "--coalesce=", 11) == 0) options->coalesce = atoi(arg + 11);
+        else if (strcmp(arg, "--policy=classes") == 0) options->policy = SIM_POLICY_CLASSES;
+        else if (strcmp(arg, "--policy=fifo") == 0) options->policy = SIM_POLICY_FIFO;
+        else if (strncmp(arg, "--cost=", 7) == 0) {
+            sim_costs* costs = &options->costs;
+            if (sscanf(arg + 7, "%lf:%lf:%lf:%lf", &costs->parse, &costs->hit, &costs->transform, &costs->send) != 4 ||
+                costs->parse < 0 || costs->hit < 0 || costs->transform < 0 || costs->send < 0)
+                return -1;
+        } else if (strncmp(arg, "--body=", 7) == 0) options->body_bytes = atoi(arg + 7);
+        else if (strncmp(arg, "--seed=", 7) == 0) options->seed = strtoull(arg + 7, NULL, 10);
+        else if (strncmp(arg, "--json=", 7) == 0) options->json = arg + 7;
+        else return -1;
+    }
+    if (options->duration <= 0 || options->rate <= 0 || options->keys < 1 || options->speed <= 0 ||
+        options->ttl < 1 || options->hot_entries < 1 || options->timeout_ms < 1 || options->body_bytes < 1)
+        return -1;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (sim_parse(argc, argv, &g_options) != 0) {
+        sim_usage(argv[0]);
+        return 1;
+    }
+    g_random = (g_options.seed + 1) * 0x9e3779b97f4a7c15ull;
+
+    if (smw_init() != 0) {
+        fprintf(stderr, "sim: the loop could not be set up\n");
+        return 1;
+    }
+    // An LTO build may have bound the calls before the linker wrapped them
+    if (g_smw.timers.now != __wrap_SystemMonotonicMS()) {
+        fprintf(stderr, "sim: the loop does not run on the virtual clock, the linker did not wrap its calls\n");
+        return 1;
+    }
+    g_body = calloc(1, (size_t)g_options.body_bytes);
+    if (g_body == NULL || frequency_sketch_init(&g_sketch, Weather_SKETCH_WIDTH) != 0 ||
+        response_cache_init(&g_cache, g_options.hot_entries, Weather_HOT_CACHE_BYTES,
+                            g_options.admission ? &g_sketch : NULL) != 0) {
+        fprintf(stderr, "sim: out of memory\n");
+        return 1;
+    }
+    if (g_options.replay != NULL) {
+        if (sim_replay_load(g_options.replay) != 0) {
+            fprintf(stderr, "sim: %s has no forecast requests\n", g_options.replay);
+            return 1;
+        }
+    } else if (sim_zipf_init(g_options.keys, g_options.zipf) != 0) {
+        fprintf(stderr, "sim: out of memory\n");
+        return 1;
+    }
+
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    g_startNs = g_nowNs;
+    g_endNs = g_startNs + (uint64_t)(g_options.duration * 1e9);
+    g_nextArrivalNs = g_replay != NULL ? g_startNs : g_startNs + (uint64_t)(-log(1.0 - sim_uniform()) / g_options.rate * 1e9);
+    smw_initTimer(&g_arrivalTimer, sim_arrivals, NULL);
+    smw_armTimer(&g_arrivalTimer, (g_nextArrivalNs + 999999) / 1000000ull);
+
+    while (g_arriving || g_open > 0) smw_work(SystemMonotonicMS());
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall = (double)(wall_end.tv_sec - wall_start.tv_sec) + (double)(wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    sim_report((double)(g_nowNs - g_startNs) / 1e9, wall);
+
+    // Fetches nobody waits for any more
+    for (int i = 0; i < SIM_FETCH_BUCKETS; i++) {
+        while (g_fetches[i] != NULL) {
+            sim_fetch* fetch = g_fetches[i];
+            g_fetches[i] = fetch->next;
+            smw_cancelTimer(&fetch->timer);
+            free(fetch);
+        }
+    }
+    response_cache_dispose(&g_cache);
+    frequency_sketch_dispose(&g_sketch);
+    smw_dispose();
+    free(g_body);
+    free(g_zipfCdf);
+    free(g_replay);
+    free(g_latencies);
+    return 0;
+}
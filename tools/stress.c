@@ -0,0 +1,1432 @@
+// HTTP load generator for the server: many connections on a few threads,
+// each an epoll loop, driving /GetWeather, /GetLocation, /GetCities and
+// /GetSurprise over plain TCP or TLS. Closed loop by default (every
+// connection sends its next request once the last is answered), or open
+// loop at --rate requests a second, where latency counts from when a
+// request was due so a stalled server is not hidden by clients waiting on
+// it. Locations follow what clients send: mostly the big cities, some
+// around them and a tail anywhere (--hot keeps to the cities themselves).
+//
+// --replay=FILE sends what a server's --access-log recorded instead, at the
+// recorded times sped up --speed times, and reads the server's cache
+// counters off /metrics before and after, so hit rate and tail latency can
+// be measured under the skew real clients have.
+//
+// --idle=N holds N more connections open that only send a request every
+// --idle-ping ms to stay inside the server's keep-alive timeout, the many
+// idle clients of a real deployment, while the others load it as usual; it
+// reports what the server's RSS and CPU grow by per idle connection (off
+// /metrics) and the active ones' latency under them.
+//
+// --json=FILE writes throughput, latency and errors for perfcheck.
+//
+// Build with `make stress` (MODE=release for numbers worth comparing),
+// `make bench` runs it against a server started separately.
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench_report.h"
+#include "utilities/access_log.h"
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "psa/crypto.h"
+
+#define STRESS_KINDS 5
+#define STRESS_HEAD_SIZE 8192
+#define STRESS_READ_SIZE 65536
+// Latency histogram: 32 buckets per power of two of microseconds, up to 2^30
+#define STRESS_SUB_BITS 5
+#define STRESS_BUCKETS ((30 - STRESS_SUB_BITS + 1) << STRESS_SUB_BITS)
+
+// STRESS_OTHER is only replayed, the other routes of a recorded log
+typedef enum { STRESS_WEATHER, STRESS_LOCATION, STRESS_CITIES, STRESS_SURPRISE, STRESS_OTHER } stress_kind;
+
+static const char* stress_kind_names[STRESS_KINDS] = {"weather", "location", "cities", "surprise", "other"};
+
+typedef struct {
+    const char* host;
+    const char* port;
+    int connections;
+    int threads;
+    int duration;
+    double rate;
+    int keepalive;
+    int tls;
+    int gzip;
+    int timeout_ms;
+    int mix[STRESS_KINDS];
+    uint64_t seed;
+    const char* replay;
+    double speed;
+    const char* json;
+    int hot;
+    int idle;
+    int idle_ping_ms;
+} stress_options;
+
+typedef struct {
+    uint64_t buckets[STRESS_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} stress_histogram;
+
+typedef struct {
+    stress_histogram latency[STRESS_KINDS];
+    uint64_t requests[STRESS_KINDS];
+    uint64_t status[6];
+    uint64_t bytes;
+    uint64_t connects;
+    uint64_t connect_errors;
+    uint64_t resets;
+    uint64_t io_errors;
+    uint64_t timeouts;
+    // requests of the idle connections, kept out of the latencies
+    uint64_t idle_requests;
+} stress_stats;
+
+typedef enum {
+    STRESS_IDLE,
+    STRESS_CONNECTING,
+    STRESS_HANDSHAKE,
+    STRESS_SENDING,
+    STRESS_HEAD,
+    STRESS_BODY
+} stress_state;
+
+typedef enum { STRESS_LENGTH, STRESS_CHUNKED, STRESS_UNTIL_CLOSE } stress_framing;
+
+typedef enum { STRESS_CHUNK_SIZE, STRESS_CHUNK_DATA, STRESS_CHUNK_CRLF, STRESS_CHUNK_TRAILER } stress_chunk_state;
+
+typedef struct stress_thread stress_thread;
+
+typedef struct {
+    stress_thread* thread;
+    int fd;
+    uint32_t events;
+    stress_state state;
+    int ssl_active;
+    mbedtls_ssl_context ssl;
+
+    // the request in flight, due_ns is when it was meant to go out
+    stress_kind kind;
+    uint64_t due_ns;
+    // replayed, the recorded request's target
+    const char* target;
+    char request[1024];
+    int request_length;
+    int request_sent;
+
+    // after a failure, not before this
+    uint64_t retry_ns;
+    // sent on a kept alive connection, the server may have closed it since
+    int reused;
+    // one of --idle, and it had its first answer
+    int idle;
+    int idle_ready;
+
+    char head[STRESS_HEAD_SIZE];
+    int head_length;
+    int status;
+    int close_after;
+    stress_framing framing;
+    int64_t remaining;
+    stress_chunk_state chunk;
+    int chunk_line;
+} stress_connection;
+
+struct stress_thread {
+    const stress_options* options;
+    const struct addrinfo* address;
+    mbedtls_ssl_config* ssl_config;
+    int epoll;
+    stress_connection* connections;
+    int count;
+    // open loop spacing of one connection's requests, 0 for closed loop
+    double interval_ns;
+    // when the idle ones connect, after the active ones warmed the server
+    uint64_t idle_start_ns;
+    uint64_t random;
+    uint64_t end_ns;
+    stress_stats stats;
+    pthread_t handle;
+};
+
+static uint64_t stress_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// xorshift64*, every thread its own stream from --seed
+static uint64_t stress_random(stress_thread* thread) {
+    uint64_t x = thread->random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    thread->random = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static double stress_uniform(stress_thread* thread) {
+    return (double)(stress_random(thread) >> 11) / 9007199254740992.0;
+}
+
+static double stress_gaussian(stress_thread* thread) {
+    double u = stress_uniform(thread);
+    double v = stress_uniform(thread);
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * M_PI * v);
+}
+
+// ========== Histogram ==========
+
+static int stress_bucket(uint64_t microseconds) {
+    uint64_t sub = 1ull << STRESS_SUB_BITS;
+    if (microseconds < sub) return (int)microseconds;
+    int exponent = 63 - __builtin_clzll(microseconds);
+    int index = ((exponent - STRESS_SUB_BITS + 1) << STRESS_SUB_BITS) +
+                (int)((microseconds >> (exponent - STRESS_SUB_BITS)) & (sub - 1));
+    return index < STRESS_BUCKETS ? index : STRESS_BUCKETS - 1;
+}
+
+// The largest value bucket index holds
+static uint64_t stress_bucket_value(int index) {
+    uint64_t sub = 1ull << STRESS_SUB_BITS;
+    if (index < (int)sub) return (uint64_t)index;
+    int exponent = (index >> STRESS_SUB_BITS) + STRESS_SUB_BITS - 1;
+    uint64_t lower = (sub + (uint64_t)(index & (int)(sub - 1))) << (exponent - STRESS_SUB_BITS);
+    return lower + (1ull << (exponent - STRESS_SUB_BITS)) - 1;
+}
+
+static void stress_histogram_record(stress_histogram* histogram, uint64_t microseconds) {
+    histogram->buckets[stress_bucket(microseconds)]++;
+    histogram->count++;
+    if (microseconds > histogram->max) histogram->max = microseconds;
+}
+
+static void stress_histogram_merge(stress_histogram* into, const stress_histogram* from) {
+    for (int i = 0; i < STRESS_BUCKETS; i++) into->buckets[i] += from->buckets[i];
+    into->count += from->count;
+    if (from->max > into->max) into->max = from->max;
+}
+
+static double stress_percentile_ms(const stress_histogram* histogram, double percentile) {
+    if (histogram->count == 0) return 0;
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * (double)histogram->count);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < STRESS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t value = stress_bucket_value(i);
+            return (double)(value < histogram->max ? value : histogram->max) / 1000.0;
+        }
+    }
+    return (double)histogram->max / 1000.0;
+}
+
+// ========== Replay ==========
+
+typedef struct {
+    uint64_t offset_ns; // from the first request, sped up
+    stress_kind kind;
+    char* target;
+} stress_replay_entry;
+
+// Read before the threads start, then only g_replayNext moves
+static stress_replay_entry* g_replay = NULL;
+// Idle connections that had their first answer, over every thread
+static int g_idleReady = 0;
+// What they send, a forecast a warmed server has hot
+static const char g_idleTarget[] = "/GetWeather?lat=59.3293&lon=18.0686";
+
+static int g_replayCount = 0;
+static int g_replayNext = 0;
+static uint64_t g_replayStart = 0;
+
+static stress_kind stress_replay_kind(int route) {
+    switch (route) {
+    case ACCESS_ROUTE_WEATHER:
+        return STRESS_WEATHER;
+    case ACCESS_ROUTE_LOCATION:
+        return STRESS_LOCATION;
+    case ACCESS_ROUTE_CITIES:
+        return STRESS_CITIES;
+    case ACCESS_ROUTE_SURPRISE:
+        return STRESS_SURPRISE;
+    default:
+        return STRESS_OTHER;
+    }
+}
+
+static int stress_compare_records(const void* a, const void* b) {
+    uint64_t x = ((const access_log_record*)a)->time_us, y = ((const access_log_record*)b)->time_us;
+    return x < y ? -1 : x > y;
+}
+
+// The log into g_replay, what it recorded into recorded (latency by route
+// and outcomes by cache). Admin routes and cut targets are left out.
+static int stress_replay_load(const stress_options* options, stress_histogram* recorded,
+                              uint64_t cache[ACCESS_CACHE_COUNT]) {
+    FILE* file = fopen(options->replay, "rb");
+    if (file == NULL) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = size > 0 ? malloc((size_t)size) : NULL;
+    int read_all = data && fread(data, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if (!read_all || size < ACCESS_LOG_MAGIC_SIZE || memcmp(data, ACCESS_LOG_MAGIC, ACCESS_LOG_MAGIC_SIZE) != 0) {
+        free(data);
+        return -1;
+    }
+
+    size_t capacity = (size_t)size / ACCESS_LOG_HEADER_SIZE;
+    access_log_record* records = malloc(capacity * sizeof(access_log_record));
+    g_replay = malloc(capacity * sizeof(stress_replay_entry));
+    if (records == NULL || g_replay == NULL) {
+        free(records);
+        free(data);
+        return -1;
+    }
+    size_t offset = ACCESS_LOG_MAGIC_SIZE;
+    int count = 0;
+    while (offset < (size_t)size) {
+        access_log_record* record = &records[count];
+        int used = access_log_decode(data + offset, (size_t)size - offset, record);
+        // A record cut off at the end (the server was killed) ends it
+        if (used <= 0) break;
+        offset += (size_t)used;
+        if ((record->flags & ACCESS_LOG_TRUNCATED) || record->route == ACCESS_ROUTE_STATS ||
+            record->route == ACCESS_ROUTE_RELOAD_CITIES || record->route == ACCESS_ROUTE_METRICS ||
+            record->route == ACCESS_ROUTE_DEBUG_MEMORY || record->route == ACCESS_ROUTE_SUBSCRIBE ||
+            record->route == ACCESS_ROUTE_CACHE_ONLY || record->route == ACCESS_ROUTE_CONFIG ||
+            record->route == ACCESS_ROUTE_HOT_KEYS) {
+            continue;
+        }
+        count++;
+    }
+    free(data);
+    qsort(records, (size_t)count, sizeof(access_log_record), stress_compare_records);
+    for (int i = 0; i < count; i++) {
+        const access_log_record* record = &records[i];
+        stress_replay_entry* entry = &g_replay[i];
+        entry->offset_ns = (uint64_t)((double)(record->time_us - records[0].time_us) * 1000.0 / options->speed);
+        entry->kind = stress_replay_kind(record->route);
+        entry->target = strdup(record->target);
+        stress_histogram_record(&recorded[entry->kind], record->latency_us);
+        cache[record->cache]++;
+    }
+    g_replayCount = count;
+    free(records);
+    return 0;
+}
+
+// The next recorded request once it is due, NULL before and after
+static const stress_replay_entry* stress_replay_take(uint64_t now) {
+    int next = __atomic_load_n(&g_replayNext, __ATOMIC_RELAXED);
+    while (next < g_replayCount && g_replayStart + g_replay[next].offset_ns <= now) {
+        if (__atomic_compare_exchange_n(&g_replayNext, &next, next + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return &g_replay[next];
+        }
+    }
+    return NULL;
+}
+
+// ========== Requests ==========
+
+typedef struct {
+    const char* name;
+    double latitude;
+    double longitude;
+} stress_city;
+
+// Weighted by rank, the first ones are most of the traffic
+static const stress_city stress_cities[] = {
+    {"Stockholm", 59.3293, 18.0686}, {"Goteborg", 57.7089, 11.9746}, {"Malmo", 55.6050, 13.0038},
+    {"London", 51.5074, -0.1278},    {"Paris", 48.8566, 2.3522},     {"Berlin", 52.5200, 13.4050},
+    {"Uppsala", 59.8586, 17.6389},   {"Oslo", 59.9139, 10.7522},     {"Copenhagen", 55.6761, 12.5683},
+    {"Helsinki", 60.1699, 24.9384},  {"Madrid", 40.4168, -3.7038},   {"Rome", 41.9028, 12.4964},
+    {"New York", 40.7128, -74.0060}, {"Tokyo", 35.6762, 139.6503},   {"Sydney", -33.8688, 151.2093},
+    {"Umea", 63.8258, 20.2630},
+};
+#define STRESS_CITY_COUNT ((int)(sizeof(stress_cities) / sizeof(stress_cities[0])))
+
+static const stress_city* stress_pick_city(stress_thread* thread) {
+    // Zipf over the rank
+    static double total = 0;
+    if (total == 0) {
+        for (int i = 0; i < STRESS_CITY_COUNT; i++) total += 1.0 / (i + 1);
+    }
+    double pick = stress_uniform(thread) * total;
+    for (int i = 0; i < STRESS_CITY_COUNT; i++) {
+        pick -= 1.0 / (i + 1);
+        if (pick <= 0) return &stress_cities[i];
+    }
+    return &stress_cities[STRESS_CITY_COUNT - 1];
+}
+
+static stress_kind stress_pick_kind(stress_thread* thread) {
+    const int* mix = thread->options->mix;
+    int total = mix[0] + mix[1] + mix[2] + mix[3];
+    int pick = (int)(stress_uniform(thread) * total);
+    for (int i = 0; i < STRESS_KINDS; i++) {
+        if (pick < mix[i]) return (stress_kind)i;
+        pick -= mix[i];
+    }
+    return STRESS_WEATHER;
+}
+
+static void stress_build_request(stress_connection* connection) {
+    stress_thread* thread = connection->thread;
+    const stress_options* options = thread->options;
+    char path[256];
+    if (connection->target != NULL) {
+        snprintf(path, sizeof(path), "%s", connection->target);
+    } else {
+        connection->kind = stress_pick_kind(thread);
+    }
+    switch (connection->target != NULL ? STRESS_OTHER : connection->kind) {
+    case STRESS_WEATHER: {
+        // Six in ten the city itself, three nearby, one anywhere
+        const stress_city* city = stress_pick_city(thread);
+        double latitude = city->latitude, longitude = city->longitude;
+        double where = options->hot ? 0 : stress_uniform(thread);
+        if (where >= 0.9) {
+            latitude = -60.0 + stress_uniform(thread) * 130.0;
+            longitude = -180.0 + stress_uniform(thread) * 360.0;
+        } else if (where >= 0.6) {
+            latitude += stress_gaussian(thread) * 0.05;
+            longitude += stress_gaussian(thread) * 0.05;
+        }
+        snprintf(path, sizeof(path), "/GetWeather?lat=%.4f&lon=%.4f", latitude, longitude);
+        break;
+    }
+    case STRESS_LOCATION: {
+        // Sometimes only what was typed so far
+        const stress_city* city = stress_pick_city(thread);
+        int length = (int)strlen(city->name);
+        if (stress_uniform(thread) < 0.3 && length > 3) length = 3 + (int)(stress_uniform(thread) * (length - 3));
+        char name[64];
+        int out = 0;
+        for (int i = 0; i < length && out < (int)sizeof(name) - 4; i++) {
+            if (city->name[i] == ' ') {
+                memcpy(name + out, "%20", 3);
+                out += 3;
+            } else {
+                name[out++] = city->name[i];
+            }
+        }
+        name[out] = '\0';
+        snprintf(path, sizeof(path), "/GetLocation?name=%s&count=5", name);
+        break;
+    }
+    case STRESS_CITIES:
+        snprintf(path, sizeof(path), "/GetCities");
+        break;
+    case STRESS_SURPRISE:
+        snprintf(path, sizeof(path), "/GetSurprise");
+        break;
+    case STRESS_OTHER:
+        break;
+    }
+    connection->request_length =
+        snprintf(connection->request, sizeof(connection->request),
+                 "GET %s HTTP/1.1\r\n"
+                 "Host: %s:%s\r\n"
+                 "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+                 "Accept: application/json, text/plain, */*\r\n"
+                 "Accept-Language: sv-SE,sv;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+                 "%s"
+                 "Connection: %s\r\n"
+                 "\r\n",
+                 path, options->host, options->port, options->gzip ? "Accept-Encoding: gzip, deflate, br\r\n" : "",
+                 options->keepalive || connection->idle ? "keep-alive" : "close");
+    connection->request_sent = 0;
+}
+
+// ========== Connections ==========
+
+static int stress_tls_send(void* context, const unsigned char* data, size_t length) {
+    ssize_t n = send(*(int*)context, data, length, MSG_NOSIGNAL);
+    if (n >= 0) return (int)n;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+static int stress_tls_recv(void* context, unsigned char* data, size_t length) {
+    ssize_t n = recv(*(int*)context, data, length, 0);
+    if (n >= 0) return (int)n;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+static void stress_watch(stress_connection* connection, uint32_t events) {
+    if (connection->events == events) return;
+    struct epoll_event event = {.events = events, .data.ptr = connection};
+    epoll_ctl(connection->thread->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+    connection->events = events;
+}
+
+static void stress_close(stress_connection* connection) {
+    if (connection->fd < 0) return;
+    if (connection->ssl_active) {
+        mbedtls_ssl_free(&connection->ssl);
+        connection->ssl_active = 0;
+    }
+    close(connection->fd);
+    connection->fd = -1;
+    connection->state = STRESS_IDLE;
+}
+
+static int stress_connect(stress_connection* connection) {
+    stress_thread* thread = connection->thread;
+    const struct addrinfo* address = thread->address;
+    int fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, address->ai_addr, address->ai_addrlen) != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    connection->fd = fd;
+    connection->events = EPOLLOUT;
+    struct epoll_event event = {.events = EPOLLOUT, .data.ptr = connection};
+    epoll_ctl(thread->epoll, EPOLL_CTL_ADD, fd, &event);
+    connection->state = STRESS_CONNECTING;
+    thread->stats.connects++;
+
+    if (thread->options->tls) {
+        mbedtls_ssl_init(&connection->ssl);
+        if (mbedtls_ssl_setup(&connection->ssl, thread->ssl_config) != 0) {
+            mbedtls_ssl_free(&connection->ssl);
+            stress_close(connection);
+            return -1;
+        }
+        mbedtls_ssl_set_hostname(&connection->ssl, thread->options->host);
+        mbedtls_ssl_set_bio(&connection->ssl, &connection->fd, stress_tls_send, stress_tls_recv, NULL);
+        connection->ssl_active = 1;
+    }
+    return 0;
+}
+
+static int stress_write(stress_connection* connection, const char* data, int length) {
+    if (connection->ssl_active) {
+        int n = mbedtls_ssl_write(&connection->ssl, (const unsigned char*)data, (size_t)length);
+        if (n == MBEDTLS_ERR_SSL_WANT_WRITE || n == MBEDTLS_ERR_SSL_WANT_READ) return 0;
+        return n;
+    }
+    ssize_t n = send(connection->fd, data, (size_t)length, MSG_NOSIGNAL);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    return (int)n;
+}
+
+// Bytes read, 0 if none yet, -1 on an error and -2 once the peer closed
+static int stress_read(stress_connection* connection, char* data, int size) {
+    if (connection->ssl_active) {
+        int n = mbedtls_ssl_read(&connection->ssl, (unsigned char*)data, (size_t)size);
+        if (n == MBEDTLS_ERR_SSL_WANT_READ || n == MBEDTLS_ERR_SSL_WANT_WRITE) return 0;
+        // TLS 1.3 tickets arrive after the handshake, nothing to read yet
+        if (n == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) return 0;
+        if (n == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY || n == 0) return -2;
+        return n < 0 ? -1 : n;
+    }
+    ssize_t n = recv(connection->fd, data, (size_t)size, 0);
+    if (n == 0) return -2;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    return (int)n;
+}
+
+// ========== Responses ==========
+
+static const char* stress_header(const char* head, int length, const char* name, int* value_length) {
+    size_t name_length = strlen(name);
+    const char* end = head + length;
+    const char* line = memchr(head, '\n', (size_t)length);
+    while (line != NULL && line + 1 < end) {
+        line++;
+        if ((size_t)(end - line) > name_length && strncasecmp(line, name, name_length) == 0 &&
+            line[name_length] == ':') {
+            const char* value = line + name_length + 1;
+            while (value < end && *value == ' ') value++;
+            const char* stop = memchr(value, '\r', (size_t)(end - value));
+            *value_length = (int)((stop ? stop : end) - value);
+            return value;
+        }
+        line = memchr(line, '\n', (size_t)(end - line));
+    }
+    return NULL;
+}
+
+// Parses the head at the front of head, the body bytes that came with it
+// are left behind it. -1 if it is malformed.
+static int stress_parse_head(stress_connection* connection, int head_end) {
+    if (head_end < 12 || strncmp(connection->head, "HTTP/1.", 7) != 0) return -1;
+    connection->status = atoi(connection->head + 9);
+    int length = 0;
+    const char* value = stress_header(connection->head, head_end, "Connection", &length);
+    connection->close_after = !connection->thread->options->keepalive ||
+                              (value && length == 5 && strncasecmp(value, "close", 5) == 0);
+    connection->framing = STRESS_UNTIL_CLOSE;
+    connection->remaining = 0;
+    if (connection->status == 304 || connection->status == 204 || connection->status < 200) {
+        connection->framing = STRESS_LENGTH;
+    } else if ((value = stress_header(connection->head, head_end, "Transfer-Encoding", &length)) != NULL &&
+               length == 7 && strncasecmp(value, "chunked", 7) == 0) {
+        connection->framing = STRESS_CHUNKED;
+        connection->chunk = STRESS_CHUNK_SIZE;
+        connection->chunk_line = 0;
+    } else if ((value = stress_header(connection->head, head_end, "Content-Length", &length)) != NULL) {
+        connection->framing = STRESS_LENGTH;
+        connection->remaining = strtoll(value, NULL, 10);
+    }
+    return 0;
+}
+
+// Takes body bytes, 1 once the body is complete
+static int stress_consume(stress_connection* connection, const char* data, int length) {
+    connection->thread->stats.bytes += (uint64_t)length;
+    if (connection->framing == STRESS_UNTIL_CLOSE) return 0;
+    if (connection->framing == STRESS_LENGTH) {
+        connection->remaining -= length;
+        return connection->remaining <= 0;
+    }
+    for (int i = 0; i < length; i++) {
+        char c = data[i];
+        switch (connection->chunk) {
+        case STRESS_CHUNK_SIZE:
+            if (c == '\n') {
+                connection->chunk = connection->remaining ? STRESS_CHUNK_DATA : STRESS_CHUNK_TRAILER;
+                connection->chunk_line = 0;
+            } else if (connection->chunk_line >= 0) {
+                int digit = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : -1;
+                // Extensions after ';' and the CR are skipped
+                if (digit < 0) connection->chunk_line = -1;
+                else connection->remaining = connection->remaining * 16 + digit;
+            }
+            break;
+        case STRESS_CHUNK_DATA: {
+            int take = length - i < connection->remaining ? length - i : (int)connection->remaining;
+            connection->remaining -= take;
+            i += take - 1;
+            if (connection->remaining == 0) connection->chunk = STRESS_CHUNK_CRLF;
+            break;
+        }
+        case STRESS_CHUNK_CRLF:
+            if (c == '\n') {
+                connection->chunk = STRESS_CHUNK_SIZE;
+                connection->chunk_line = 0;
+            }
+            break;
+        case STRESS_CHUNK_TRAILER:
+            // Up to the empty line that ends the trailers
+            if (c == '\n') {
+                if (connection->chunk_line == 0) return 1;
+                connection->chunk_line = 0;
+            } else if (c != '\r') {
+                connection->chunk_line++;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+// ========== Loop ==========
+
+static void stress_next(stress_connection* connection, uint64_t now);
+
+static void stress_complete(stress_connection* connection) {
+    stress_stats* stats = &connection->thread->stats;
+    uint64_t now = stress_now_ns();
+    if (connection->idle) {
+        stats->idle_requests++;
+        if (!connection->idle_ready) __atomic_add_fetch(&g_idleReady, 1, __ATOMIC_RELAXED);
+        connection->idle_ready = 1;
+        if (connection->close_after) stress_close(connection);
+        stress_next(connection, now);
+        return;
+    }
+    stats->requests[connection->kind]++;
+    int status = connection->status / 100;
+    stats->status[status >= 1 && status <= 5 ? status : 0]++;
+    stress_histogram_record(&stats->latency[connection->kind], (now - connection->due_ns) / 1000);
+    if (connection->close_after) stress_close(connection);
+    stress_next(connection, now);
+}
+
+// The request is lost, the connection tries again after a pause
+static void stress_fail(stress_connection* connection, uint64_t* counter) {
+    stress_thread* thread = connection->thread;
+    (*counter)++;
+    stress_close(connection);
+    uint64_t now = stress_now_ns();
+    connection->retry_ns = now + 100000000ull;
+    if (thread->interval_ns > 0) {
+        connection->due_ns += (uint64_t)(-log(1.0 - stress_uniform(thread)) * thread->interval_ns);
+        if (connection->due_ns < connection->retry_ns) connection->due_ns = connection->retry_ns;
+    }
+}
+
+// A kept alive connection closed by the server while idle is no error, the
+// request goes out again on a new one. A new connection closed before any
+// answer was refused, as the server's per client limits do. -1 then.
+static int stress_retry(stress_connection* connection) {
+    stress_stats* stats = &connection->thread->stats;
+    if (!connection->reused) {
+        stress_fail(connection, &stats->resets);
+        return -1;
+    }
+    stress_close(connection);
+    connection->reused = 0;
+    if (stress_connect(connection) != 0) {
+        stress_fail(connection, &stats->connect_errors);
+        return -1;
+    }
+    connection->request_sent = 0;
+    return 0;
+}
+
+// Drives the connection until it would block
+static void stress_advance(stress_connection* connection, uint64_t now) {
+    char buffer[STRESS_READ_SIZE];
+    stress_stats* stats = &connection->thread->stats;
+    for (;;) {
+        switch (connection->state) {
+        case STRESS_IDLE:
+            // Only an error or hangup is watched for while idle
+            stress_close(connection);
+            return;
+        case STRESS_CONNECTING: {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error == EINPROGRESS) return;
+            if (error != 0) {
+                stress_fail(connection, &stats->connect_errors);
+                return;
+            }
+            connection->state = connection->ssl_active ? STRESS_HANDSHAKE : STRESS_SENDING;
+            break;
+        }
+        case STRESS_HANDSHAKE: {
+            int result = mbedtls_ssl_handshake(&connection->ssl);
+            if (result == MBEDTLS_ERR_SSL_WANT_READ) {
+                stress_watch(connection, EPOLLIN);
+                return;
+            }
+            if (result == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                stress_watch(connection, EPOLLOUT);
+                return;
+            }
+            if (result != 0) {
+                stress_fail(connection, &stats->connect_errors);
+                return;
+            }
+            connection->state = STRESS_SENDING;
+            break;
+        }
+        case STRESS_SENDING: {
+            int n = stress_write(connection, connection->request + connection->request_sent,
+                                 connection->request_length - connection->request_sent);
+            if (n < 0) {
+                if (stress_retry(connection) != 0) return;
+                break;
+            }
+            connection->request_sent += n;
+            if (connection->request_sent < connection->request_length) {
+                stress_watch(connection, EPOLLOUT);
+                return;
+            }
+            connection->state = STRESS_HEAD;
+            connection->head_length = 0;
+            stress_watch(connection, EPOLLIN);
+            break;
+        }
+        case STRESS_HEAD: {
+            int n = stress_read(connection, connection->head + connection->head_length,
+                                STRESS_HEAD_SIZE - 1 - connection->head_length);
+            if (n == 0) return;
+            if (n < 0) {
+                if (connection->head_length > 0) {
+                    stress_fail(connection, &stats->io_errors);
+                    return;
+                }
+                if (stress_retry(connection) != 0) return;
+                break;
+            }
+            connection->head_length += n;
+            connection->head[connection->head_length] = '\0';
+            char* end = strstr(connection->head, "\r\n\r\n");
+            if (end == NULL) {
+                if (connection->head_length == STRESS_HEAD_SIZE - 1) stress_fail(connection, &stats->io_errors);
+                break;
+            }
+            int head_end = (int)(end - connection->head) + 4;
+            if (stress_parse_head(connection, head_end) != 0) {
+                stress_fail(connection, &stats->io_errors);
+                return;
+            }
+            connection->state = STRESS_BODY;
+            int extra = connection->head_length - head_end;
+            if (stress_consume(connection, connection->head + head_end, extra) ||
+                (connection->framing == STRESS_LENGTH && connection->remaining <= 0)) {
+                stress_complete(connection);
+                return;
+            }
+            break;
+        }
+        case STRESS_BODY: {
+            int n = stress_read(connection, buffer, sizeof(buffer));
+            if (n == 0) return;
+            if (n == -2 && connection->framing == STRESS_UNTIL_CLOSE) {
+                connection->close_after = 1;
+                stress_complete(connection);
+                return;
+            }
+            if (n < 0) {
+                stress_fail(connection, &stats->io_errors);
+                return;
+            }
+            if (stress_consume(connection, buffer, n)) {
+                stress_complete(connection);
+                return;
+            }
+            break;
+        }
+        }
+    }
+}
+
+// Sends the request that is due, connecting first when needed
+static void stress_issue(stress_connection* connection, uint64_t now) {
+    stress_thread* thread = connection->thread;
+    stress_build_request(connection);
+    connection->reused = connection->fd >= 0;
+    if (connection->fd < 0 && stress_connect(connection) != 0) {
+        stress_fail(connection, &thread->stats.connect_errors);
+        return;
+    }
+    if (connection->state == STRESS_IDLE) connection->state = STRESS_SENDING;
+    stress_advance(connection, now);
+}
+
+// A recorded request, late by however long it waited for a connection
+static void stress_replay_issue(stress_connection* connection, const stress_replay_entry* entry, uint64_t now) {
+    connection->kind = entry->kind;
+    connection->target = entry->target;
+    connection->due_ns = g_replayStart + entry->offset_ns;
+    stress_issue(connection, now);
+}
+
+// The connection's next request, now or, open loop, once it is due
+static void stress_next(stress_connection* connection, uint64_t now) {
+    stress_thread* thread = connection->thread;
+    connection->state = STRESS_IDLE;
+    if (connection->fd >= 0) stress_watch(connection, 0);
+    if (now >= thread->end_ns) {
+        stress_close(connection);
+        return;
+    }
+    if (connection->idle) {
+        // Kept open, the sweep sends the next ping once it is due
+        connection->due_ns = now + (uint64_t)(thread->options->idle_ping_ms * (0.9 + 0.2 * stress_uniform(thread)) * 1e6);
+        return;
+    }
+    if (g_replay != NULL) {
+        const stress_replay_entry* entry = stress_replay_take(now);
+        if (entry == NULL) return;
+        stress_replay_issue(connection, entry, now);
+        return;
+    }
+    if (thread->interval_ns > 0) {
+        // Poisson arrivals, a connection that fell behind goes back to back
+        connection->due_ns += (uint64_t)(-log(1.0 - stress_uniform(thread)) * thread->interval_ns);
+        if (connection->due_ns > now) return;
+    } else {
+        connection->due_ns = now;
+    }
+    stress_issue(connection, now);
+}
+
+static void* stress_thread_run(void* argument) {
+    stress_thread* thread = (stress_thread*)argument;
+    const stress_options* options = thread->options;
+    uint64_t now = stress_now_ns();
+    for (int i = 0; i < thread->count; i++) {
+        stress_connection* connection = &thread->connections[i];
+        connection->thread = thread;
+        connection->fd = -1;
+        connection->state = STRESS_IDLE;
+        if (connection->idle) {
+            // All connect at once, how long they take to be up is reported
+            connection->kind = STRESS_OTHER;
+            connection->target = g_idleTarget;
+            connection->due_ns = thread->idle_start_ns;
+            continue;
+        }
+        // Open loop the first ones are spread over one interval
+        connection->due_ns = now + (uint64_t)(stress_uniform(thread) * thread->interval_ns);
+        if (thread->interval_ns <= 0 && g_replay == NULL) stress_issue(connection, now);
+    }
+
+    struct epoll_event events[64];
+    uint64_t timeout_ns = (uint64_t)options->timeout_ms * 1000000ull;
+    uint64_t last_sweep = now;
+    while ((now = stress_now_ns()) < thread->end_ns) {
+        int open_loop = thread->interval_ns > 0 || g_replay != NULL;
+        int count = epoll_wait(thread->epoll, events, 64, open_loop ? 1 : 10);
+        now = stress_now_ns();
+        for (int i = 0; i < count; i++) stress_advance((stress_connection*)events[i].data.ptr, now);
+
+        // Requests that are due, connections after a failure and requests
+        // that took too long; closed loop only the latter two, less often
+        if (!open_loop && now - last_sweep < 10000000ull) continue;
+        last_sweep = now;
+        int busy = 0;
+        for (int i = 0; i < thread->count; i++) {
+            stress_connection* connection = &thread->connections[i];
+            if (connection->state != STRESS_IDLE) {
+                if (now > connection->due_ns + timeout_ns) stress_fail(connection, &thread->stats.timeouts);
+                busy = 1;
+                continue;
+            }
+            if (now < connection->retry_ns) continue;
+            if (connection->idle) {
+                if (connection->due_ns <= now) stress_issue(connection, now);
+            } else if (g_replay != NULL) {
+                const stress_replay_entry* entry = stress_replay_take(now);
+                if (entry != NULL) {
+                    stress_replay_issue(connection, entry, now);
+                    busy = 1;
+                }
+            } else if (thread->interval_ns > 0) {
+                if (connection->due_ns <= now) stress_issue(connection, now);
+            } else if (connection->fd < 0) {
+                connection->due_ns = now;
+                stress_issue(connection, now);
+            }
+        }
+        // The log is through and every answer is in
+        if (g_replay != NULL && !busy && __atomic_load_n(&g_replayNext, __ATOMIC_RELAXED) >= g_replayCount) break;
+    }
+    for (int i = 0; i < thread->count; i++) stress_close(&thread->connections[i]);
+    return NULL;
+}
+
+// ========== Server counters ==========
+
+#define STRESS_CACHES 16
+
+// cache_requests_total by cache as the server's /metrics has them
+typedef struct {
+    char names[STRESS_CACHES][32];
+    uint64_t hits[STRESS_CACHES];
+    uint64_t misses[STRESS_CACHES];
+    int count;
+    // the server process, for --idle
+    uint64_t rss;
+    uint64_t cpu_us;
+    uint64_t connections;
+} stress_cache_counts;
+
+static int stress_gauge(const char* line, size_t length, const char* name, uint64_t* value) {
+    size_t name_length = strlen(name);
+    if (length <= name_length || memcmp(line, name, name_length) != 0) return 0;
+    *value = (uint64_t)strtod(line + name_length, NULL);
+    return 1;
+}
+
+static void stress_count_line(stress_cache_counts* counts, const char* line, size_t length) {
+    static const char prefix[] = "cache_requests_total{";
+    if (stress_gauge(line, length, "process_resident_memory_bytes ", &counts->rss) ||
+        stress_gauge(line, length, "process_cpu_microseconds_total ", &counts->cpu_us) ||
+        stress_gauge(line, length, "http_connections_active ", &counts->connections)) {
+        return;
+    }
+    char text[256];
+    if (length >= sizeof(text) || length < sizeof(prefix) || memcmp(line, prefix, sizeof(prefix) - 1) != 0) return;
+    memcpy(text, line, length);
+    text[length] = '\0';
+    const char* cache = strstr(text, "cache=\"");
+    const char* result = strstr(text, "result=\"");
+    const char* value = strstr(text, "} ");
+    if (cache == NULL || result == NULL || value == NULL) return;
+    cache += 7;
+    const char* cache_end = strchr(cache, '"');
+    if (cache_end == NULL || cache_end - cache >= 32) return;
+    int index = 0;
+    while (index < counts->count && (strncmp(counts->names[index], cache, (size_t)(cache_end - cache)) != 0 ||
+                                     counts->names[index][cache_end - cache] != '\0')) {
+        index++;
+    }
+    if (index == counts->count) {
+        if (counts->count == STRESS_CACHES) return;
+        memcpy(counts->names[index], cache, (size_t)(cache_end - cache));
+        counts->names[index][cache_end - cache] = '\0';
+        counts->hits[index] = counts->misses[index] = 0;
+        counts->count++;
+    }
+    uint64_t number = strtoull(value + 2, NULL, 10);
+    if (strncmp(result + 8, "hit\"", 4) == 0) counts->hits[index] = number;
+    else if (strncmp(result + 8, "miss\"", 5) == 0) counts->misses[index] = number;
+}
+
+// GET /metrics on a plain connection of its own, -1 if it could not be read
+static int stress_scrape(const stress_options* options, const struct addrinfo* address, stress_cache_counts* counts) {
+    memset(counts, 0, sizeof(*counts));
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) return -1;
+    struct timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[256];
+    int length = snprintf(request, sizeof(request), "GET /metrics HTTP/1.1\r\nHost: %s:%s\r\nConnection: close\r\n\r\n",
+                          options->host, options->port);
+    if (connect(fd, address->ai_addr, address->ai_addrlen) != 0 || send(fd, request, (size_t)length, MSG_NOSIGNAL) != length) {
+        close(fd);
+        return -1;
+    }
+    size_t size = 0, capacity = 65536;
+    char* data = malloc(capacity + 1);
+    ssize_t n;
+    while (data != NULL && (n = recv(fd, data + size, capacity - size, 0)) > 0) {
+        size += (size_t)n;
+        if (size == capacity) {
+            char* grown = capacity < (16u << 20) ? realloc(data, capacity * 2 + 1) : NULL;
+            if (grown == NULL) break;
+            data = grown;
+            capacity *= 2;
+        }
+    }
+    close(fd);
+    if (data == NULL) return -1;
+    data[size] = '\0';
+    char* body = strstr(data, "\r\n\r\n");
+    if (body == NULL || strncmp(data, "HTTP/1.1 200", 12) != 0) {
+        free(data);
+        return -1;
+    }
+    int value_length = 0;
+    const char* encoding = stress_header(data, (int)(body - data) + 2, "Transfer-Encoding", &value_length);
+    body += 4;
+    char* end = data + size;
+    if (encoding != NULL && value_length == 7 && strncasecmp(encoding, "chunked", 7) == 0) {
+        // Joined in place, the chunks only ever move forward
+        char* in = body;
+        char* out = body;
+        for (;;) {
+            char* line_end = strstr(in, "\r\n");
+            if (line_end == NULL) break;
+            size_t chunk = strtoul(in, NULL, 16);
+            in = line_end + 2;
+            if (chunk == 0 || in + chunk > end) break;
+            memmove(out, in, chunk);
+            out += chunk;
+            in += chunk + 2;
+        }
+        end = out;
+    }
+    for (char* line = body; line < end;) {
+        char* newline = memchr(line, '\n', (size_t)(end - line));
+        char* stop = newline ? newline : end;
+        stress_count_line(counts, line, (size_t)(stop - line));
+        line = stop + 1;
+    }
+    free(data);
+    return 0;
+}
+
+static void stress_report_caches(const stress_cache_counts* before, const stress_cache_counts* after) {
+    printf("\nserver cache           hits     misses  hit rate   (from /metrics, during the run)\n");
+    for (int i = 0; i < after->count; i++) {
+        uint64_t hits = after->hits[i], misses = after->misses[i];
+        for (int k = 0; k < before->count; k++) {
+            if (strcmp(before->names[k], after->names[i]) != 0) continue;
+            hits -= before->hits[k];
+            misses -= before->misses[k];
+        }
+        if (hits + misses == 0) continue;
+        printf("%-18s %10llu %10llu %8.1f%%\n", after->names[i], (unsigned long long)hits, (unsigned long long)misses,
+               100.0 * (double)hits / (double)(hits + misses));
+    }
+}
+
+// What the idle connections cost the server: its RSS before them against
+// once they were up, its CPU over the time they were held (the active
+// connections' share included, run without them for the idle cost alone)
+static void stress_report_idle(const stress_options* options, const stress_cache_counts* before,
+                               const stress_cache_counts* loaded, const stress_cache_counts* held, int ready,
+                               double ramp, double hold, uint64_t pings) {
+    printf("\nidle connections: %d of %d up in %.1f s, %llu pings, the server holds %llu connections\n", ready,
+           options->idle, ramp, (unsigned long long)pings, (unsigned long long)loaded->connections);
+    if (ready == 0 || before->rss == 0 || loaded->rss == 0) return;
+    double rss = ((double)loaded->rss - (double)before->rss) / ready;
+    printf("server RSS  %.1f MB before, %.1f MB with them, %.0f bytes per connection\n", before->rss / 1e6,
+           loaded->rss / 1e6, rss);
+    bench_report("allocs", "bytes", rss, "idle/rss_bytes_per_connection");
+    if (hold <= 0 || held->cpu_us < loaded->cpu_us) return;
+    double cpu = (double)(held->cpu_us - loaded->cpu_us) / hold;
+    printf("server CPU  %.1f%% of a core while held, %.2f us/s per idle connection (the active ones' included)\n",
+           cpu / 1e4, cpu / ready);
+    bench_report("time", "ns", cpu * 1e3 / ready, "idle/cpu_ns_per_connection_second");
+}
+
+// What the log recorded, to hold the replay against
+static void stress_report_recorded(const stress_histogram* recorded, const uint64_t cache[ACCESS_CACHE_COUNT]) {
+    stress_histogram all;
+    memset(&all, 0, sizeof(all));
+    uint64_t total = 0;
+    for (int i = 0; i < STRESS_KINDS; i++) stress_histogram_merge(&all, &recorded[i]);
+    for (int i = 0; i < ACCESS_CACHE_COUNT; i++) total += cache[i];
+    printf("\nrecorded ms      count      p50      p90      p99    p99.9      max\n");
+    for (int i = 0; i <= STRESS_KINDS; i++) {
+        const stress_histogram* histogram = i < STRESS_KINDS ? &recorded[i] : &all;
+        if (histogram->count == 0) continue;
+        printf("%-10s %11llu %8.3f %8.3f %8.3f %8.3f %8.3f\n", i < STRESS_KINDS ? stress_kind_names[i] : "all",
+               (unsigned long long)histogram->count, stress_percentile_ms(histogram, 50),
+               stress_percentile_ms(histogram, 90), stress_percentile_ms(histogram, 99),
+               stress_percentile_ms(histogram, 99.9), (double)histogram->max / 1000.0);
+    }
+    printf("recorded bodies ");
+    for (int i = 0; i < ACCESS_CACHE_COUNT && total > 0; i++) {
+        if (cache[i]) printf(" %s %.1f%%", access_log_cache_name(i), 100.0 * (double)cache[i] / (double)total);
+    }
+    printf("\n");
+}
+
+// ========== Main ==========
+
+static void stress_usage(const char* name) {
+    printf("Usage: %s [options] <host> <port>\n"
+           "  --connections=N  open connections (64)\n"
+           "  --threads=N      event loops the connections are spread over (2)\n"
+           "  --duration=S     seconds to run (10)\n"
+           "  --rate=R         requests a second in total, open loop; 0 waits for each response (0)\n"
+           "  --keepalive=0|1  reuse connections, 0 connects (and handshakes) per request (1)\n"
+           "  --tls            TLS, certificates are not verified\n"
+           "  --gzip=0|1       send Accept-Encoding (1)\n"
+           "  --timeout=MS     a request taking longer counts as timed out (5000)\n"
+           "  --mix=W,L,C,S    weights of weather, location, cities and surprise (70,10,15,5)\n"
+           "  --seed=N         seed of the request sequence (1)\n"
+           "  --hot            weather for the cities only, a warmed server answers all from its cache\n"
+           "  --replay=FILE    send the requests of a server --access-log at their recorded times\n"
+           "  --speed=X        replay X times faster, 1 to 100 (1)\n"
+           "  --idle=N         N more kept alive connections that only ping, for what they cost the server (0)\n"
+           "  --idle-ping=MS   how often an idle connection sends a request, under the keep-alive timeout (4000)\n"
+           "  --json=FILE      also write the results for perfcheck\n",
+           name);
+}
+
+static int stress_parse(int argc, char* argv[], stress_options* options) {
+    *options = (stress_options){NULL, NULL, 64, 2, 10, 0, 1, 0, 1, 5000, {70, 10, 15, 5, 0}, 1, NULL, 1, NULL, 0, 0, 4000};
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--connections=", 14) == 0) options->connections = atoi(arg + 14);
+        else if (strncmp(arg, "--threads=", 10) == 0) options->threads = atoi(arg + 10);
+        else if (strncmp(arg, "--duration=", 11) == 0) options->duration = atoi(arg + 11);
+        else if (strncmp(arg, "--rate=", 7) == 0) options->rate = atof(arg + 7);
+        else if (strncmp(arg, "--keepalive=", 12) == 0) options->keepalive = atoi(arg + 12);
+        else if (strcmp(arg, "--tls") == 0) options->tls = 1;
+        else if (strcmp(arg, "--hot") == 0) options->hot = 1;
+        else if (strncmp(arg, "--gzip=", 7) == 0) options->gzip = atoi(arg + 7);
+        else if (strncmp(arg, "--timeout=", 10) == 0) options->timeout_ms = atoi(arg + 10);
+        else if (strncmp(arg, "--seed=", 7) == 0) options->seed = strtoull(arg + 7, NULL, 10);
+        else if (strncmp(arg, "--replay=", 9) == 0) options->replay = arg + 9;
+        else if (strncmp(arg, "--speed=", 8) == 0) options->speed = atof(arg + 8);
+        else if (strncmp(arg, "--json=", 7) == 0) options->json = arg + 7;
+        else if (strncmp(arg, "--idle=", 7) == 0) options->idle = atoi(arg + 7);
+        else if (strncmp(arg, "--idle-ping=", 12) == 0) options->idle_ping_ms = atoi(arg + 12);
+        else if (strncmp(arg, "--mix=", 6) == 0) {
+            if (sscanf(arg + 6, "%d,%d,%d,%d", &options->mix[0], &options->mix[1], &options->mix[2], &options->mix[3]) != 4)
+                return -1;
+        } else if (arg[0] == '-') return -1;
+        else if (positional == 0) options->host = argv[i], positional++;
+        else if (positional == 1) options->port = argv[i], positional++;
+        else return -1;
+    }
+    int weights = options->mix[0] + options->mix[1] + options->mix[2] + options->mix[3];
+    if (positional != 2 || options->connections < 1 || options->threads < 1 || options->duration < 1 ||
+        options->rate < 0 || options->timeout_ms < 1 || weights <= 0 || options->speed < 1 || options->speed > 100 ||
+        options->idle < 0 || options->idle_ping_ms < 1) {
+        return -1;
+    }
+    for (int i = 0; i < STRESS_KINDS; i++) {
+        if (options->mix[i] < 0) return -1;
+    }
+    // The log sets the pace
+    if (options->replay) options->rate = 0;
+    return 0;
+}
+
+static void stress_report(const stress_options* options, const stress_stats* stats, double seconds) {
+    stress_histogram all;
+    memset(&all, 0, sizeof(all));
+    uint64_t requests = 0;
+    for (int i = 0; i < STRESS_KINDS; i++) {
+        stress_histogram_merge(&all, &stats->latency[i]);
+        requests += stats->requests[i];
+    }
+    printf("\n%llu requests in %.1f s, %.1f req/s, %.2f MB/s received\n", (unsigned long long)requests, seconds,
+           (double)requests / seconds, (double)stats->bytes / seconds / 1e6);
+    printf("responses  1xx %llu  2xx %llu  3xx %llu  4xx %llu  5xx %llu\n", (unsigned long long)stats->status[1],
+           (unsigned long long)stats->status[2], (unsigned long long)stats->status[3],
+           (unsigned long long)stats->status[4], (unsigned long long)stats->status[5]);
+    printf("errors     connect %llu  reset %llu  io %llu  timeout %llu  (%llu connections opened)\n",
+           (unsigned long long)stats->connect_errors, (unsigned long long)stats->resets,
+           (unsigned long long)stats->io_errors,
+           (unsigned long long)stats->timeouts, (unsigned long long)stats->connects);
+    // Open loop it is the rate asked for, falling behind shows in the latency
+    if (options->rate == 0 && !options->replay) {
+        bench_report("rate", "requests/s", (double)requests / seconds, "requests_per_second");
+    }
+    uint64_t errors = stats->connect_errors + stats->resets + stats->io_errors + stats->timeouts;
+    bench_report("count", "requests", (double)errors, "errors");
+    bench_report("count", "responses", (double)stats->status[5], "status_5xx");
+
+    printf("\nlatency ms       count      p50      p90      p99    p99.9      max\n");
+    for (int i = 0; i <= STRESS_KINDS; i++) {
+        const stress_histogram* histogram = i < STRESS_KINDS ? &stats->latency[i] : &all;
+        if (i < STRESS_KINDS && (options->replay ? histogram->count == 0 : options->mix[i] == 0)) continue;
+        printf("%-10s %11llu %8.3f %8.3f %8.3f %8.3f %8.3f\n", i < STRESS_KINDS ? stress_kind_names[i] : "all",
+               (unsigned long long)histogram->count, stress_percentile_ms(histogram, 50),
+               stress_percentile_ms(histogram, 90), stress_percentile_ms(histogram, 99),
+               stress_percentile_ms(histogram, 99.9), (double)histogram->max / 1000.0);
+        // The tail only over all, a kind's has too few samples to hold still
+        const char* name = i < STRESS_KINDS ? stress_kind_names[i] : "all";
+        bench_report("latency", "ms", stress_percentile_ms(histogram, 50), "%s/p50_ms", name);
+        if (i == STRESS_KINDS) {
+            bench_report("latency", "ms", stress_percentile_ms(histogram, 90), "all/p90_ms");
+            bench_report("latency", "ms", stress_percentile_ms(histogram, 99), "all/p99_ms");
+        }
+    }
+
+    // The distribution by power of two, bars scaled to the fullest
+    if (all.count == 0) return;
+    uint64_t octaves[32] = {0};
+    uint64_t fullest = 0;
+    int first = -1, last = 0;
+    for (int b = 0; b < STRESS_BUCKETS; b++) {
+        if (all.buckets[b] == 0) continue;
+        uint64_t value = stress_bucket_value(b);
+        int octave = value ? 64 - __builtin_clzll(value) : 0;
+        octaves[octave] += all.buckets[b];
+        if (first < 0) first = octave;
+        last = octave;
+    }
+    for (int o = first; o <= last; o++) {
+        if (octaves[o] > fullest) fullest = octaves[o];
+    }
+    printf("\n");
+    for (int o = first; o <= last; o++) {
+        char bar[41];
+        int width = (int)(octaves[o] * 40 / fullest);
+        memset(bar, '#', (size_t)width);
+        bar[width] = '\0';
+        printf("  < %10.3f ms %6.2f%% %s\n", (double)(1ull << o) / 1000.0, 100.0 * (double)octaves[o] / (double)all.count,
+               bar);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    stress_options options;
+    if (stress_parse(argc, argv, &options) != 0) {
+        stress_usage(argv[0]);
+        return 1;
+    }
+    if (options.threads > options.connections) options.threads = options.connections;
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* address = NULL;
+    int result = getaddrinfo(options.host, options.port, &hints, &address);
+    if (result != 0) {
+        fprintf(stderr, "stress: %s:%s: %s\n", options.host, options.port, gai_strerror(result));
+        return 1;
+    }
+
+    stress_histogram* recorded = calloc(STRESS_KINDS, sizeof(stress_histogram));
+    uint64_t recorded_cache[ACCESS_CACHE_COUNT] = {0};
+    if (recorded == NULL || (options.replay && stress_replay_load(&options, recorded, recorded_cache) != 0)) {
+        fprintf(stderr, "stress: %s is not an access log\n", options.replay);
+        return 1;
+    }
+    if (options.replay && g_replayCount == 0) {
+        fprintf(stderr, "stress: %s holds no requests to replay\n", options.replay);
+        return 1;
+    }
+
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_ssl_config config;
+    if (options.tls) {
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+        // TLS 1.3 runs on PSA
+        if (psa_crypto_init() != PSA_SUCCESS) {
+            fprintf(stderr, "stress: psa_crypto_init failed\n");
+            return 1;
+        }
+#endif
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&drbg);
+        mbedtls_ssl_config_init(&config);
+        if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)"stress", 6) != 0 ||
+            mbedtls_ssl_config_defaults(&config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                        MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+            fprintf(stderr, "stress: TLS setup failed\n");
+            return 1;
+        }
+        // A load generator, whoever answers is fine
+        mbedtls_ssl_conf_authmode(&config, MBEDTLS_SSL_VERIFY_NONE);
+        mbedtls_ssl_conf_rng(&config, mbedtls_ctr_drbg_random, &drbg);
+    }
+
+    if (options.replay) {
+        // As long as the log lasts at this speed, and the last answers
+        double span = (double)g_replay[g_replayCount - 1].offset_ns / 1e9;
+        options.duration = (int)ceil(span + options.timeout_ms / 1000.0);
+        printf("stress: replaying %d request(s) of %s, %.1f s at %gx\n", g_replayCount, options.replay, span,
+               options.speed);
+    }
+    printf("stress: %d connections on %d threads, %s, %s%s, %d s against %s:%s\n", options.connections,
+           options.threads, options.replay ? "replay" : options.rate > 0 ? "open loop" : "closed loop",
+           options.keepalive ? "keep-alive" : "a connection per request", options.tls ? ", TLS" : "",
+           options.duration, options.host, options.port);
+    if (options.rate > 0) printf("stress: %.0f requests a second\n", options.rate);
+    int total_connections = options.connections + options.idle;
+    if (options.idle > 0) {
+        printf("stress: %d idle connections more, a request each every %d ms\n", options.idle, options.idle_ping_ms);
+        // A descriptor each, and the epolls and the scrapes
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)total_connections + 64) {
+            limit.rlim_cur = limit.rlim_max < (rlim_t)total_connections + 64 ? limit.rlim_max : (rlim_t)total_connections + 64;
+            setrlimit(RLIMIT_NOFILE, &limit);
+            if (limit.rlim_cur < (rlim_t)total_connections + 64) {
+                fprintf(stderr, "stress: only %llu descriptors, raise ulimit -n\n", (unsigned long long)limit.rlim_cur);
+            }
+        }
+    }
+    // The server's cache counters around the run, plain HTTP only
+    stress_cache_counts before, after;
+    int scraped = !options.tls && stress_scrape(&options, address, &before) == 0;
+
+    stress_thread* threads = calloc((size_t)options.threads, sizeof(stress_thread));
+    stress_connection* connections = calloc((size_t)total_connections, sizeof(stress_connection));
+    if (threads == NULL || connections == NULL) {
+        fprintf(stderr, "stress: out of memory\n");
+        return 1;
+    }
+    uint64_t start = stress_now_ns();
+    g_replayStart = start;
+    // A quarter of the run, at most a second, to have the server's caches and
+    // heap at their steady size before the idle connections come on top
+    uint64_t idle_start = start + (uint64_t)options.duration * 250000000ull;
+    if (idle_start > start + 1000000000ull) idle_start = start + 1000000000ull;
+    int assigned = 0;
+    for (int i = 0; i < options.threads; i++) {
+        stress_thread* thread = &threads[i];
+        thread->options = &options;
+        thread->address = address;
+        thread->ssl_config = options.tls ? &config : NULL;
+        // Each thread's idle ones after its active ones
+        int idle = options.idle / options.threads + (i < options.idle % options.threads);
+        thread->count = options.connections / options.threads + (i < options.connections % options.threads);
+        thread->connections = &connections[assigned];
+        for (int k = 0; k < idle; k++) thread->connections[thread->count + k].idle = 1;
+        thread->count += idle;
+        assigned += thread->count;
+        thread->interval_ns = options.rate > 0 ? 1e9 * options.connections / options.rate : 0;
+        thread->random = (options.seed + (uint64_t)i + 1) * 0x9e3779b97f4a7c15ull;
+        if (thread->random == 0) thread->random = 1;
+        thread->end_ns = start + (uint64_t)options.duration * 1000000000ull;
+        thread->idle_start_ns = idle_start;
+        thread->epoll = epoll_create1(0);
+        if (thread->epoll < 0 || pthread_create(&thread->handle, NULL, stress_thread_run, thread) != 0) {
+            fprintf(stderr, "stress: could not start thread %d\n", i);
+            return 1;
+        }
+    }
+
+    // The server just before the idle connections, once they are up (or ten
+    // seconds on) and again just before the end; each scrape connects as one
+    // more. 0 when one failed.
+    stress_cache_counts idle_before, loaded, held;
+    int measured = 0, ready = 0;
+    double ramp = 0, hold = 0;
+    if (options.idle > 0 && scraped) {
+        uint64_t end = start + (uint64_t)options.duration * 1000000000ull;
+        uint64_t now = stress_now_ns();
+        if (idle_start > now + 10000000ull) usleep((useconds_t)((idle_start - now - 10000000ull) / 1000));
+        measured = stress_scrape(&options, address, &idle_before) == 0;
+        now = stress_now_ns();
+        while ((ready = __atomic_load_n(&g_idleReady, __ATOMIC_RELAXED)) < options.idle && now + 10000000ull < end &&
+               now < idle_start + 10000000000ull) {
+            usleep(10000);
+            now = stress_now_ns();
+        }
+        ramp = now > idle_start ? (double)(now - idle_start) / 1e9 : 0;
+        measured = measured && stress_scrape(&options, address, &loaded) == 0;
+        uint64_t loaded_ns = stress_now_ns();
+        if (end > loaded_ns + 500000000ull) usleep((useconds_t)((end - loaded_ns - 250000000ull) / 1000));
+        hold = (double)(stress_now_ns() - loaded_ns) / 1e9;
+        if (measured && stress_scrape(&options, address, &held) != 0) hold = 0;
+    }
+
+    stress_stats total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < options.threads; i++) {
+        stress_thread* thread = &threads[i];
+        pthread_join(thread->handle, NULL);
+        close(thread->epoll);
+        for (int k = 0; k < STRESS_KINDS; k++) {
+            stress_histogram_merge(&total.latency[k], &thread->stats.latency[k]);
+            total.requests[k] += thread->stats.requests[k];
+        }
+        for (int k = 0; k < 6; k++) total.status[k] += thread->stats.status[k];
+        total.bytes += thread->stats.bytes;
+        total.connects += thread->stats.connects;
+        total.connect_errors += thread->stats.connect_errors;
+        total.resets += thread->stats.resets;
+        total.io_errors += thread->stats.io_errors;
+        total.timeouts += thread->stats.timeouts;
+        total.idle_requests += thread->stats.idle_requests;
+    }
+    stress_report(&options, &total, (double)(stress_now_ns() - start) / 1e9);
+    if (measured) stress_report_idle(&options, &idle_before, &loaded, &held, ready, ramp, hold, total.idle_requests);
+    if (scraped && stress_scrape(&options, address, &after) == 0) stress_report_caches(&before, &after);
+    if (options.replay) stress_report_recorded(recorded, recorded_cache);
+    if (options.json && bench_report_write(options.json, "stress") != 0) {
+        fprintf(stderr, "stress: %s can not be written\n", options.json);
+    }
+
+    free(connections);
+    free(threads);
+    free(recorded);
+    for (int i = 0; i < g_replayCount; i++) free(g_replay[i].target);
+    free(g_replay);
+    freeaddrinfo(address);
+    if (options.tls) {
+        mbedtls_ssl_config_free(&config);
+        mbedtls_ctr_drbg_free(&drbg);
+        mbedtls_entropy_free(&entropy);
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+        mbedtls_psa_crypto_free();
+#endif
+    }
+    return total.connect_errors + total.resets + total.io_errors + total.timeouts > 0 ? 2 : 0;
+}
@@ -0,0 +1,421 @@
+// Handshakes a second and bulk throughput of the server's own TLS. The
+// server side is what a worker loop runs: conn_tls_accept_fd over the
+// loop's view (the configured certificates, suites, groups and tickets),
+// driven through conn_handshake and the connection's write. The clients
+// are plain mbedTLS on threads of their own over loopback.
+//
+// The server side takes one connection at a time on the main thread, so a
+// rate is what one worker core does while the clients keep it busy. Its CPU
+// time per handshake and per MB is reported next to it, that number does
+// not depend on how fast the clients are.
+//
+// Build with `make tls_bench`, MODE=release for numbers worth reading, and
+// once per crypto profile (CRYPTO=fast) to compare them. The certificate
+// is the server's, CERT_FILE_PATH and ECDSA_CERT_FILE_PATH in
+// global_defines.h. --json=FILE also writes the numbers for perfcheck.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench_report.h"
+#include "connection.h"
+
+#include "mbedtls/ssl_ciphersuites.h"
+#include "psa/crypto.h"
+
+#define BENCH_CHUNK 16384
+#define BENCH_IO_TIMEOUT_MS 5000
+
+typedef enum { BENCH_FULL, BENCH_RESUMED, BENCH_BULK } bench_phase;
+
+static const char* bench_phase_names[] = {"full", "resumed", "bulk"};
+
+typedef struct {
+    int seconds;
+    int clients;
+    int tls12;
+    int tls13;
+    long long bytes;
+    const char* suite;
+    const char* json;
+} bench_options;
+
+typedef struct {
+    const bench_options* options;
+    mbedtls_ssl_config* config;
+    bench_phase phase;
+    int port;
+    int* stop;
+    int* running;
+    uint64_t errors;
+    pthread_t thread;
+} bench_client;
+
+typedef struct {
+    uint64_t count;
+    uint64_t errors;
+    double seconds;
+    double cpu_seconds;
+    long long bytes;
+    char suite[64];
+} bench_result;
+
+static uint64_t bench_now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_connect(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Reads what the server writes for as long as the phase wants it, 0 or -1
+static int bench_client_read(mbedtls_ssl_context* ssl, long long want) {
+    static __thread unsigned char buffer[BENCH_CHUNK];
+    long long got = 0;
+    while (got < want) {
+        int n = mbedtls_ssl_read(ssl, buffer, sizeof(buffer));
+        if (n == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET || n == MBEDTLS_ERR_SSL_WANT_READ) continue;
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return 0;
+}
+
+// A connection after the other until the server says stop; for the
+// resumed phase every one offers the session of the first
+static void* bench_client_run(void* arg) {
+    bench_client* client = (bench_client*)arg;
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    int has_session = 0;
+    while (!__atomic_load_n(client->stop, __ATOMIC_ACQUIRE)) {
+        mbedtls_net_context net;
+        mbedtls_net_init(&net);
+        net.fd = bench_connect(client->port);
+        if (net.fd < 0) {
+            client->errors++;
+            break;
+        }
+        mbedtls_ssl_context ssl;
+        mbedtls_ssl_init(&ssl);
+        int ok = mbedtls_ssl_setup(&ssl, client->config) == 0;
+        if (ok) {
+            mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+            if (has_session) mbedtls_ssl_set_session(&ssl, &session);
+            ok = mbedtls_ssl_handshake(&ssl) == 0;
+        }
+        // the server writes once its side is done, TLS 1.3 tickets arrive ahead of it
+        long long want = client->phase == BENCH_BULK ? client->options->bytes : 1;
+        ok = ok && bench_client_read(&ssl, want) == 0;
+        if (ok && client->phase == BENCH_RESUMED && !has_session) {
+            has_session = mbedtls_ssl_get_session(&ssl, &session) == 0;
+        }
+        if (!ok) client->errors++;
+        mbedtls_ssl_free(&ssl);
+        mbedtls_net_free(&net);
+        if (client->phase == BENCH_BULK) break;
+    }
+    mbedtls_ssl_session_free(&session);
+    __atomic_sub_fetch(client->running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int bench_wait(int fd, short events) {
+    struct pollfd entry = {.fd = fd, .events = events};
+    return poll(&entry, 1, BENCH_IO_TIMEOUT_MS) == 1 ? 0 : -1;
+}
+
+static int bench_server_handshake(conn_t* conn) {
+    for (;;) {
+        int rv = conn_handshake(conn);
+        if (rv == 0) return 0;
+        // without a job pool the signature is computed inline, never async
+        if (rv < 0 || (rv & CONN_HANDSHAKE_ASYNC)) return -1;
+        if (bench_wait(conn->client_fd, (rv & SMW_READ) ? POLLIN : POLLOUT) != 0) return -1;
+    }
+}
+
+// The bytes through the connection's write, retried as a response would be
+static int bench_server_write(conn_t* conn, long long bytes) {
+    static unsigned char body[BENCH_CHUNK];
+    long long sent = 0;
+    int offset = 0;
+    while (sent < bytes) {
+        int length = (int)sizeof(body) - offset;
+        if (length > bytes - sent) length = (int)(bytes - sent);
+        int n = conn->vtable->write(conn, body + offset, length);
+        if (n < 0) return -1;
+        if (n == 0) {
+            if (bench_wait(conn->client_fd, POLLOUT) != 0) return -1;
+            continue;
+        }
+        sent += n;
+        offset = (offset + n) % (int)sizeof(body);
+    }
+    return 0;
+}
+
+// Serves the clients of one phase until they are gone, counting what was
+// done within the time
+static void bench_run_phase(const bench_options* options, conn_tls_view_t* view, int listen_fd, int port,
+                            mbedtls_ssl_config* config, bench_phase phase, bench_result* result) {
+    memset(result, 0, sizeof(*result));
+    int stop = 0;
+    int clients = phase == BENCH_BULK ? 1 : options->clients;
+    int running = clients;
+    bench_client* threads = (bench_client*)calloc(clients, sizeof(bench_client));
+    for (int i = 0; i < clients; i++) {
+        threads[i] = (bench_client){options, config, phase, port, &stop, &running, 0, 0};
+        pthread_create(&threads[i].thread, NULL, bench_client_run, &threads[i]);
+    }
+    uint64_t start = bench_now_ns(CLOCK_MONOTONIC);
+    uint64_t deadline = start + (uint64_t)options->seconds * 1000000000ull;
+    uint64_t finish = 0;
+    uint64_t cpu_start = bench_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t cpu_finish = 0;
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE) > 0) {
+        struct pollfd entry = {.fd = listen_fd, .events = POLLIN};
+        if (poll(&entry, 1, 100) != 1) continue;
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        conn_t* conn = conn_tls_accept_fd(view, fd);
+        if (!conn) {
+            close(fd);
+            result->errors++;
+            continue;
+        }
+        int ok = bench_server_handshake(conn) == 0;
+        if (ok && result->suite[0] == '\0') {
+            snprintf(result->suite, sizeof(result->suite), "%s", mbedtls_ssl_get_ciphersuite(&((conn_tls_t*)conn)->ssl));
+        }
+        long long bytes = phase == BENCH_BULK ? options->bytes : 1;
+        ok = ok && bench_server_write(conn, bytes) == 0;
+        conn->vtable->close(conn);
+        if (!ok) {
+            result->errors++;
+            continue;
+        }
+        uint64_t now = bench_now_ns(CLOCK_MONOTONIC);
+        if (finish == 0) {
+            result->count++;
+            result->bytes += bytes;
+        }
+        if (finish == 0 && (now >= deadline || phase == BENCH_BULK)) {
+            finish = now;
+            cpu_finish = bench_now_ns(CLOCK_THREAD_CPUTIME_ID);
+            __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+        }
+    }
+    if (finish == 0) {
+        finish = bench_now_ns(CLOCK_MONOTONIC);
+        cpu_finish = bench_now_ns(CLOCK_THREAD_CPUTIME_ID);
+    }
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i].thread, NULL);
+        result->errors += threads[i].errors;
+    }
+    free(threads);
+    result->seconds = (double)(finish - start) / 1e9;
+    result->cpu_seconds = (double)(cpu_finish - cpu_start) / 1e9;
+}
+
+static int bench_client_config(mbedtls_ssl_config* config, mbedtls_ctr_drbg_context* drbg, int version,
+                               const int* suites) {
+    mbedtls_ssl_config_init(config);
+    if (mbedtls_ssl_config_defaults(config, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        return -1;
+    }
+    // the handshake cost of the server is the point, not the client's checks
+    mbedtls_ssl_conf_authmode(config, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(config, mbedtls_ctr_drbg_random, drbg);
+    mbedtls_ssl_conf_min_tls_version(config, (mbedtls_ssl_protocol_version)version);
+    mbedtls_ssl_conf_max_tls_version(config, (mbedtls_ssl_protocol_version)version);
+    if (suites) mbedtls_ssl_conf_ciphersuites(config, suites);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+    // a TLS 1.3 client drops tickets unless asked to keep them
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(config, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+    return 0;
+}
+
+static void bench_print_profile(void) {
+#if defined(MBEDTLS_USER_CONFIG_FILE)
+    const char* profile = "fast";
+#else
+    const char* profile = "portable";
+#endif
+#if defined(MBEDTLS_AES_USE_HARDWARE_ONLY)
+    const char* aes = "hardware only";
+#elif defined(MBEDTLS_AESNI_C) || defined(MBEDTLS_AESCE_C)
+    const char* aes = "hardware if the CPU has it";
+#else
+    const char* aes = "software";
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    int cpu = __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#else
+    int cpu = -1;
+#endif
+    printf("crypto profile %s, AES %s, CPU AES %s, MPI window %d, ECP window %d\n", profile, aes,
+           cpu < 0 ? "unknown" : cpu ? "yes" : "no", MBEDTLS_MPI_WINDOW_SIZE, MBEDTLS_ECP_WINDOW_SIZE);
+}
+
+static void bench_usage(const char* name) {
+    printf("Usage: %s [options]\n"
+           "  --seconds=S   seconds per handshake phase (3)\n"
+           "  --clients=N   client threads handshaking at once (2)\n"
+           "  --tls=V       1.2, 1.3 or both (both, or the version of --suite)\n"
+           "  --mb=N        MB written in the bulk phase (256)\n"
+           "  --suite=NAME  the one suite the clients offer, e.g. TLS1-3-CHACHA20-POLY1305-SHA256\n"
+           "  --json=FILE   also write the results for perfcheck\n",
+           name);
+}
+
+static int bench_parse(int argc, char* argv[], bench_options* options) {
+    *options = (bench_options){3, 2, 1, 1, 256ll << 20, NULL, NULL};
+    const char* version = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--seconds=", 10) == 0) options->seconds = atoi(arg + 10);
+        else if (strncmp(arg, "--clients=", 10) == 0) options->clients = atoi(arg + 10);
+        else if (strncmp(arg, "--tls=", 6) == 0) version = arg + 6;
+        else if (strncmp(arg, "--mb=", 5) == 0) options->bytes = atoll(arg + 5) << 20;
+        else if (strncmp(arg, "--suite=", 8) == 0) options->suite = arg + 8;
+        else if (strncmp(arg, "--json=", 7) == 0) options->json = arg + 7;
+        else return -1;
+    }
+    if (options->seconds <= 0 || options->clients <= 0 || options->bytes <= 0) return -1;
+    if (!version && options->suite) version = strncmp(options->suite, "TLS1-3-", 7) == 0 ? "1.3" : "1.2";
+    if (version && strcmp(version, "1.2") == 0) options->tls13 = 0;
+    else if (version && strcmp(version, "1.3") == 0) options->tls12 = 0;
+    else if (version && strcmp(version, "both") != 0) return -1;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    bench_options options;
+    if (bench_parse(argc, argv, &options) != 0) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+#if SKIP_TLS_CERT_FOR_DEV
+    printf("Built with SKIP_TLS_CERT_FOR_DEV, the server has no certificate to handshake with\n");
+    return 1;
+#endif
+    int suites[2] = {0, 0};
+    if (options.suite) {
+        suites[0] = mbedtls_ssl_get_ciphersuite_id(options.suite);
+        if (suites[0] == 0) {
+            printf("%s is not a suite this mbedTLS has\n", options.suite);
+            return 1;
+        }
+    }
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+    // TLS 1.3 runs on PSA
+    if (psa_crypto_init() != PSA_SUCCESS) {
+        printf("psa_crypto_init failed\n");
+        return 1;
+    }
+#endif
+    conn_tls_view_t* view = conn_tls_view_acquire();
+    if (!view) {
+        printf("The server's TLS setup failed, see CERT_FILE_PATH in global_defines.h\n");
+        return 1;
+    }
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)"tls_bench", 9) != 0) {
+        printf("Seeding the clients' random generator failed\n");
+        return 1;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, 128) != 0 || getsockname(listen_fd, (struct sockaddr*)&address, &length) != 0) {
+        printf("Listening on loopback failed: %s\n", strerror(errno));
+        return 1;
+    }
+    int port = ntohs(address.sin_port);
+
+    bench_print_profile();
+    printf("%d client thread(s), %d s per handshake phase, %lld MB bulk\n", options.clients, options.seconds,
+           options.bytes >> 20);
+    int failed = 0;
+    static const struct {
+        const char* name;
+        int version;
+    } versions[] = {{"tls1.2", MBEDTLS_SSL_VERSION_TLS1_2}, {"tls1.3", MBEDTLS_SSL_VERSION_TLS1_3}};
+    for (int v = 0; v < 2; v++) {
+        if ((v == 0 && !options.tls12) || (v == 1 && !options.tls13)) continue;
+        mbedtls_ssl_config config;
+        if (bench_client_config(&config, &drbg, versions[v].version, options.suite ? suites : NULL) != 0) {
+            printf("%s client setup failed\n", versions[v].name);
+            return 1;
+        }
+        for (int phase = BENCH_FULL; phase <= BENCH_BULK; phase++) {
+            bench_result result;
+            bench_run_phase(&options, view, listen_fd, port, &config, (bench_phase)phase, &result);
+            const char* name = bench_phase_names[phase];
+            if (phase == BENCH_FULL) printf("%s %s\n", versions[v].name, result.suite[0] ? result.suite : "");
+            if (result.count == 0) {
+                printf("  %-8s nothing completed, %llu error(s)\n", name, (unsigned long long)result.errors);
+                failed = 1;
+                continue;
+            }
+            if (phase == BENCH_BULK) {
+                double mb = (double)result.bytes / (1 << 20);
+                printf("  %-8s %10.1f MB/s %10.3f ms server CPU per MB\n", name, mb / result.seconds,
+                       result.cpu_seconds * 1e3 / mb);
+                bench_report("rate", "MB/s", mb / result.seconds, "%s/bulk_mb_per_s", versions[v].name);
+                bench_report("time", "ns", result.cpu_seconds * 1e9 / mb, "%s/bulk_server_cpu_ns_per_mb",
+                             versions[v].name);
+            } else {
+                double rate = (double)result.count / result.seconds;
+                double cpu = result.cpu_seconds * 1e6 / result.count;
+                printf("  %-8s %10.1f handshakes/s %8.1f us server CPU each\n", name, rate, cpu);
+                bench_report("rate", "1/s", rate, "%s/%s_handshakes_per_s", versions[v].name, name);
+                bench_report("time", "ns", cpu * 1e3, "%s/%s_handshake_server_cpu_ns", versions[v].name, name);
+            }
+            if (result.errors > 0) printf("  %llu error(s)\n", (unsigned long long)result.errors);
+            bench_report("count", "errors", (double)result.errors, "%s/%s_errors", versions[v].name, name);
+        }
+        mbedtls_ssl_config_free(&config);
+    }
+    close(listen_fd);
+    conn_tls_view_release(view);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    if (options.json && bench_report_write(options.json, "tls_bench") != 0) {
+        printf("%s can not be written\n", options.json);
+        return 1;
+    }
+    return failed;
+}
@@ -0,0 +1,97 @@
+/*
+ * XDP companion of utilities/ip_ban.h: drops the TCP SYNs of banned client
+ * addresses to the server's ports before the kernel makes a socket of
+ * them. Everything else passes, a banned client's connections already up
+ * finish as they would.
+ *
+ *   make xdp_ban.bpf.o
+ *   bpftool prog load xdp_ban.bpf.o /sys/fs/bpf/ubweather_xdp type xdp pinmaps /sys/fs/bpf/ubweather
+ *   bpftool net attach xdp pinned /sys/fs/bpf/ubweather_xdp dev eth0   # xdpgeneric without driver support
+ *   ./server 8080 --xdp-ban=/sys/fs/bpf/ubweather
+ *
+ * Only <linux/bpf.h>, the map definitions and helpers are spelled out here
+ * rather than taken from libbpf's headers. Plain Ethernet (no VLAN tags),
+ * IPv6 without extension headers before TCP.
+ */
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+
+#define SEC(name) __attribute__((section(name), used))
+#define __uint(name, val) int (*name)[val]
+#define __type(name, val) __typeof__(val)* name
+
+static void* (*bpf_map_lookup_elem)(void* map, const void* key) = (void*)BPF_FUNC_map_lookup_elem;
+static long (*bpf_map_delete_elem)(void* map, const void* key) = (void*)BPF_FUNC_map_delete_elem;
+static __u64 (*bpf_ktime_get_ns)(void) = (void*)BPF_FUNC_ktime_get_ns;
+
+// IPv4 as ::ffff:a.b.c.d; what the server writes (src/utilities/ip_ban.c)
+struct ban_key {
+    __u8 addr[16];
+};
+
+#ifndef XDP_BAN_ENTRIES
+#define XDP_BAN_ENTRIES 65536
+#endif
+
+// Address to the CLOCK_MONOTONIC ns it is banned until; the least recently
+// used go first when it is full
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, XDP_BAN_ENTRIES);
+    __type(key, struct ban_key);
+    __type(value, __u64);
+} ubweather_bans SEC(".maps");
+
+// Ports (network order) whose SYNs are checked
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 16);
+    __type(key, __u16);
+    __type(value, __u8);
+} ubweather_ban_ports SEC(".maps");
+
+static __attribute__((always_inline)) int xdp_ban_check(struct ban_key* key, const struct tcphdr* tcp) {
+    if (!tcp->syn || tcp->ack) return XDP_PASS;
+    __u16 port = tcp->dest;
+    if (!bpf_map_lookup_elem(&ubweather_ban_ports, &port)) return XDP_PASS;
+    __u64* until = (__u64*)bpf_map_lookup_elem(&ubweather_bans, key);
+    if (!until) return XDP_PASS;
+    if (bpf_ktime_get_ns() < *until) return XDP_DROP;
+    bpf_map_delete_elem(&ubweather_bans, key);
+    return XDP_PASS;
+}
+
+SEC("xdp")
+int xdp_ban(struct xdp_md* ctx) {
+    void* data = (void*)(long)ctx->data;
+    void* end = (void*)(long)ctx->data_end;
+    struct ethhdr* eth = (struct ethhdr*)data;
+    if ((void*)(eth + 1) > end) return XDP_PASS;
+
+    struct ban_key key = {};
+    if (eth->h_proto == __builtin_bswap16(ETH_P_IP)) {
+        struct iphdr* ip = (struct iphdr*)(eth + 1);
+        if ((void*)(ip + 1) > end || ip->protocol != IPPROTO_TCP || ip->ihl < 5) return XDP_PASS;
+        struct tcphdr* tcp = (struct tcphdr*)((__u8*)ip + ip->ihl * 4);
+        if ((void*)(tcp + 1) > end) return XDP_PASS;
+        key.addr[10] = 0xff;
+        key.addr[11] = 0xff;
+        __builtin_memcpy(&key.addr[12], &ip->saddr, 4);
+        return xdp_ban_check(&key, tcp);
+    }
+    if (eth->h_proto == __builtin_bswap16(ETH_P_IPV6)) {
+        struct ipv6hdr* ip6 = (struct ipv6hdr*)(eth + 1);
+        if ((void*)(ip6 + 1) > end || ip6->nexthdr != IPPROTO_TCP) return XDP_PASS;
+        struct tcphdr* tcp = (struct tcphdr*)(ip6 + 1);
+        if ((void*)(tcp + 1) > end) return XDP_PASS;
+        __builtin_memcpy(key.addr, &ip6->saddr, 16);
+        return xdp_ban_check(&key, tcp);
+    }
+    return XDP_PASS;
+}
+
+char LICENSE[] SEC("license") = "GPL";